@@ -28,11 +28,13 @@
 #include "vmware.h"
 #include "guestApp.h"
 #include "vmcheck.h"
+#include "debug.h"
 #include "escBitvector.h"
 #include "hgfsEscape.h"
 #include "hgfs.h"
 #include "hgfsBd.h"
 #include "hgfsProto.h"
+#include "hgfsUtil.h"
 #include "conf.h"
 #include "str.h"
 #include "vmware/tools/log.h"
@@ -52,13 +54,59 @@ VM_EMBED_VERSION(HGFSCLIENT_VERSION_STRING);
 #include <string.h>
 #include <limits.h>
 
+/*
+ * Share enumeration is spread over up to this many connections to the host,
+ * each with its own search on the root directory; see HgfsClient_PrintShares.
+ * Every connection is a separate backdoor channel, so keep the limit low.
+ */
+#define HGFSCLIENT_DEFAULT_JOBS 4
+#define HGFSCLIENT_MAX_JOBS     8
+
 RpcOut *gChannel = NULL;
 char *gPacketBuffer = NULL;
 
-static Bool HgfsClient_Open(HgfsHandle *rootHandle);
-static HgfsFileName *HgfsClient_Read(HgfsHandle rootHandle,
-                                     int offset);
-static Bool HgfsClient_Close(HgfsHandle rootHandle);
+static gboolean gLongFormat = FALSE;
+static gint gJobs = HGFSCLIENT_DEFAULT_JOBS;
+
+/*
+ * A connection to the host's HGFS server and the search on the root
+ * directory opened over it.
+ */
+typedef struct HgfsClientConn {
+   RpcOut *channel;
+   char *packetBuffer;
+   HgfsHandle rootHandle;
+} HgfsClientConn;
+
+/* A share as read from the host, with the attributes of its root. */
+typedef struct HgfsClientShare {
+   char *name;
+   uint32 nameLength;
+   HgfsAttrV2 attr;
+} HgfsClientShare;
+
+/*
+ * Search state shared by the connections enumerating the shares. Each
+ * connection claims the next unread offset, and stores the shares it reads
+ * there by offset, so that they are printed in the host's order whichever
+ * connection read them. endOffset is the lowest offset the host said is past
+ * the last share.
+ */
+typedef struct HgfsClientSearch {
+   GMutex lock;
+   uint32 nextOffset;
+   uint32 endOffset;
+   HgfsOp readOp;
+   Bool failed;
+   GPtrArray *shares;
+} HgfsClientSearch;
+
+static Bool HgfsClient_Open(HgfsClientConn *conn);
+static Bool HgfsClient_Read(HgfsClientConn *conn,
+                            HgfsOp *readOp,
+                            uint32 offset,
+                            GPtrArray *shares);
+static Bool HgfsClient_Close(HgfsClientConn *conn);
 static Bool HgfsClient_PrintShares(void);
 static Bool HgfsClient_Init(void);
 static Bool HgfsClient_Cleanup(void);
@@ -73,7 +121,7 @@ static Bool HgfsClient_Cleanup(void);
  *
  * Results:
  *    TRUE on success. FALSE otherwise. When TRUE, the root directory handle
- *    is returned as an argument.
+ *    is returned in the connection.
  *
  * Side effects:
  *    The host has cached an open search for us.
@@ -82,7 +130,7 @@ static Bool HgfsClient_Cleanup(void);
  */
 
 static Bool
-HgfsClient_Open(HgfsHandle *rootHandle) // OUT: Handle to root directory
+HgfsClient_Open(HgfsClientConn *conn) // IN/OUT: Connection to the host
 {
    Bool success = FALSE;
    HgfsRequestSearchOpen *searchOpenReq;
@@ -92,7 +140,7 @@ HgfsClient_Open(HgfsHandle *rootHandle) // OUT: Handle to root directory
    size_t packetSize;
 
    /* Create a SearchOpen and send it. */
-   searchOpenReq = (HgfsRequestSearchOpen *)gPacketBuffer;
+   searchOpenReq = (HgfsRequestSearchOpen *)conn->packetBuffer;
    memset(searchOpenReq, 0, sizeof *searchOpenReq);
    searchOpenReq->header.id = 0;
    searchOpenReq->header.op = HGFS_OP_SEARCH_OPEN;
@@ -100,13 +148,13 @@ HgfsClient_Open(HgfsHandle *rootHandle) // OUT: Handle to root directory
    searchOpenReq->dirName.name[0] = 0;
    packetSize = sizeof *searchOpenReq;
 
-   err = HgfsBd_Dispatch(gChannel, (char *)searchOpenReq, 
+   err = HgfsBd_Dispatch(conn->channel, (char *)searchOpenReq,
                          &packetSize, &replyPacket);
    if (err != 0) {
       Warning("Failed to send search open request.\n");
       goto out;
    }
-   
+
    /* replyPacket has our search handle. */
    searchOpenRep = (HgfsReplySearchOpen *)replyPacket;
    if (searchOpenRep->header.status != HGFS_STATUS_SUCCESS) {
@@ -118,7 +166,7 @@ HgfsClient_Open(HgfsHandle *rootHandle) // OUT: Handle to root directory
   out:
    /* We got the root handle. */
    if (success) {
-      *rootHandle = searchOpenRep->search;
+      conn->rootHandle = searchOpenRep->search;
    }
    return success;
 }
@@ -127,16 +175,72 @@ HgfsClient_Open(HgfsHandle *rootHandle) // OUT: Handle to root directory
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsClient_Read --
+ * HgfsClientShareNew --
  *
- *    Read a share name from the host.
+ *    Allocate a share, with a copy of its name.
  *
  * Results:
- *    Pointer into the packet buffer where the caller can find the
- *    HgfsFileName struct. Since this is a pointer into the global
- *    packet buffer, the caller should not free it.
+ *    The share, with all attributes invalid. Free with HgfsClientShareFree.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsClientShare *
+HgfsClientShareNew(char const *name,  // IN: Share name, not NUL terminated
+                   uint32 nameLength) // IN: Length of name
+{
+   HgfsClientShare *share = g_new0(HgfsClientShare, 1);
+
+   share->name = g_malloc(nameLength + 1);
+   memcpy(share->name, name, nameLength);
+   share->name[nameLength] = '\0';
+   share->nameLength = nameLength;
+   return share;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
  *
- *    NULL if there was an error.
+ * HgfsClientShareFree --
+ *
+ *    Free a share. NULL is allowed.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsClientShareFree(gpointer data) // IN: HgfsClientShare to free
+{
+   HgfsClientShare *share = data;
+
+   if (share != NULL) {
+      g_free(share->name);
+      g_free(share);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsClientParseReadV3 --
+ *
+ *    Parse the payload of a V3 search read reply, which holds as many
+ *    directory entries as the host chose to return.
+ *
+ * Results:
+ *    TRUE if the reply is well formed, FALSE otherwise. The entries are
+ *    appended to shares; none are appended at the end of the directory.
  *
  * Side effects:
  *    None.
@@ -144,45 +248,164 @@ HgfsClient_Open(HgfsHandle *rootHandle) // OUT: Handle to root directory
  *-----------------------------------------------------------------------------
  */
 
-static HgfsFileName *
-HgfsClient_Read(HgfsHandle rootHandle, // IN: Handle to root directory
-                int offset)            // IN: Offset of dirent to read
+static Bool
+HgfsClientParseReadV3(char const *payload, // IN: Reply after the header
+                      size_t payloadSize,  // IN: Size of payload
+                      GPtrArray *shares)   // IN/OUT: Shares read
 {
-   HgfsFileName *shareName = NULL;
-   HgfsRequestSearchRead *searchReadReq;
+   HgfsReplySearchReadV3 const *searchReadRep =
+      (HgfsReplySearchReadV3 const *)payload;
+   size_t entryOffset = offsetof(HgfsReplySearchReadV3, payload);
+   size_t nameOffset = offsetof(HgfsDirEntry, fileName.name);
+   uint64 i;
+
+   if (payloadSize < entryOffset) {
+      Warning("Truncated search read reply.\n");
+      return FALSE;
+   }
+
+   for (i = 0; i < searchReadRep->count; i++) {
+      HgfsDirEntry const *dirEntry =
+         (HgfsDirEntry const *)(payload + entryOffset);
+      HgfsClientShare *share;
+
+      if (nameOffset > payloadSize - entryOffset ||
+          dirEntry->fileName.length > payloadSize - entryOffset - nameOffset) {
+         Warning("Truncated search read reply.\n");
+         return FALSE;
+      }
+
+      /* An empty name means there is no entry at this offset. */
+      if (dirEntry->fileName.length == 0) {
+         break;
+      }
+
+      share = HgfsClientShareNew(dirEntry->fileName.name,
+                                 dirEntry->fileName.length);
+      share->attr = dirEntry->attr;
+      g_ptr_array_add(shares, share);
+
+      if (dirEntry->nextEntry == 0) {
+         break;
+      }
+      entryOffset += dirEntry->nextEntry;
+      if (entryOffset >= payloadSize) {
+         Warning("Truncated search read reply.\n");
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsClient_Read --
+ *
+ *    Read share names, and their attributes, from the host, starting at the
+ *    given offset of the root directory.
+ *
+ *    The V3 search read lets the host return as many entries as fit in its
+ *    reply. Hosts that don't have it get the original search read, which
+ *    returns one entry, and readOp is changed so that later reads use it
+ *    directly.
+ *
+ * Results:
+ *    TRUE on success, with the shares read appended to shares; none are
+ *    appended at the end of the root directory. FALSE if there was an error.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsClient_Read(HgfsClientConn *conn, // IN: Connection to the host
+                HgfsOp *readOp,       // IN/OUT: Search read operation to use
+                uint32 offset,        // IN: Offset of first dirent to read
+                GPtrArray *shares)    // IN/OUT: Shares read
+{
+   HgfsRequest *header = (HgfsRequest *)conn->packetBuffer;
+   HgfsReply *replyHeader;
    HgfsReplySearchRead *searchReadRep;
+   HgfsClientShare *share;
    int err;
    char const *replyPacket;
    size_t packetSize;
 
    /* Create searchRead and send it. */
-   searchReadReq = (HgfsRequestSearchRead *)gPacketBuffer;
-   memset(searchReadReq, 0, sizeof *searchReadReq);
-   searchReadReq->header.id = 0;
-   searchReadReq->header.op = HGFS_OP_SEARCH_READ;
-   searchReadReq->search = rootHandle;
-   searchReadReq->offset = offset;
-   packetSize = sizeof *searchReadReq;
-
-   err = HgfsBd_Dispatch(gChannel, (char *)searchReadReq, 
+   if (*readOp == HGFS_OP_SEARCH_READ_V3) {
+      HgfsRequestSearchReadV3 *searchReadReq =
+         (HgfsRequestSearchReadV3 *)(header + 1);
+
+      memset(header, 0, sizeof *header + sizeof *searchReadReq);
+      searchReadReq->search = conn->rootHandle;
+      searchReadReq->offset = offset;
+      packetSize = sizeof *header + sizeof *searchReadReq;
+   } else {
+      HgfsRequestSearchRead *searchReadReq = (HgfsRequestSearchRead *)header;
+
+      memset(searchReadReq, 0, sizeof *searchReadReq);
+      searchReadReq->search = conn->rootHandle;
+      searchReadReq->offset = offset;
+      packetSize = sizeof *searchReadReq;
+   }
+   header->id = 0;
+   header->op = *readOp;
+
+   err = HgfsBd_Dispatch(conn->channel, (char *)header,
                          &packetSize, &replyPacket);
    if (err != 0) {
       Warning("Failed to send search read request.\n");
-      goto out;
+      return FALSE;
    }
 
-   /* replyPacket has our share name. */
-   searchReadRep = (HgfsReplySearchRead *)replyPacket;
-   if (searchReadRep->header.status != HGFS_STATUS_SUCCESS) {
+   replyHeader = (HgfsReply *)replyPacket;
+   if (packetSize < sizeof *replyHeader) {
+      Warning("Truncated search read reply.\n");
+      return FALSE;
+   }
+   if (*readOp == HGFS_OP_SEARCH_READ_V3 &&
+       (replyHeader->status == HGFS_STATUS_PROTOCOL_ERROR ||
+        replyHeader->status == HGFS_STATUS_OPERATION_NOT_SUPPORTED)) {
+      *readOp = HGFS_OP_SEARCH_READ;
+      return HgfsClient_Read(conn, readOp, offset, shares);
+   }
+   if (replyHeader->status != HGFS_STATUS_SUCCESS) {
       Warning("Error in getting share name.\n");
-      goto out;
+      return FALSE;
    }
 
-   /* We got the share name. */
-   shareName = &searchReadRep->fileName;
+   if (*readOp == HGFS_OP_SEARCH_READ_V3) {
+      return HgfsClientParseReadV3(replyPacket + sizeof *replyHeader,
+                                   packetSize - sizeof *replyHeader, shares);
+   }
 
-  out:
-   return shareName;
+   /* replyPacket has our share name. */
+   searchReadRep = (HgfsReplySearchRead *)replyPacket;
+   if (packetSize < sizeof *searchReadRep ||
+       searchReadRep->fileName.length > packetSize - sizeof *searchReadRep + 1) {
+      Warning("Truncated search read reply.\n");
+      return FALSE;
+   }
+   if (searchReadRep->fileName.length == 0) {
+      return TRUE;
+   }
+
+   share = HgfsClientShareNew(searchReadRep->fileName.name,
+                              searchReadRep->fileName.length);
+   share->attr.mask = HGFS_ATTR_VALID_TYPE |
+                      HGFS_ATTR_VALID_SIZE |
+                      HGFS_ATTR_VALID_WRITE_TIME |
+                      HGFS_ATTR_VALID_OWNER_PERMS;
+   share->attr.type = searchReadRep->attr.type;
+   share->attr.size = searchReadRep->attr.size;
+   share->attr.writeTime = searchReadRep->attr.writeTime;
+   share->attr.ownerPerms = searchReadRep->attr.permissions;
+   g_ptr_array_add(shares, share);
+   return TRUE;
 }
 
 
@@ -203,7 +426,7 @@ HgfsClient_Read(HgfsHandle rootHandle, // IN: Handle to root directory
  */
 
 static Bool
-HgfsClient_Close(HgfsHandle rootHandle) // IN: Handle to root directory
+HgfsClient_Close(HgfsClientConn *conn) // IN: Connection to the host
 {
    HgfsRequestSearchClose *searchCloseReq;
    HgfsReplySearchClose *searchCloseRep;
@@ -212,14 +435,14 @@ HgfsClient_Close(HgfsHandle rootHandle) // IN: Handle to root directory
    size_t packetSize;
 
    /* Create a SearchClose and send it. */
-   searchCloseReq = (HgfsRequestSearchClose *)gPacketBuffer;
+   searchCloseReq = (HgfsRequestSearchClose *)conn->packetBuffer;
    memset(searchCloseReq, 0, sizeof *searchCloseReq);
    searchCloseReq->header.id = 0;
    searchCloseReq->header.op = HGFS_OP_SEARCH_CLOSE;
-   searchCloseReq->search = rootHandle;
+   searchCloseReq->search = conn->rootHandle;
    packetSize = sizeof *searchCloseReq;
 
-   err = HgfsBd_Dispatch(gChannel, (char *)searchCloseReq, 
+   err = HgfsBd_Dispatch(conn->channel, (char *)searchCloseReq,
                          &packetSize, &replyPacket);
    if (err != 0) {
       Warning("Failed to send search close request.\n");
@@ -236,12 +459,213 @@ HgfsClient_Close(HgfsHandle rootHandle) // IN: Handle to root directory
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsClientEnumerate --
+ *
+ *    Read shares over one connection, claiming offsets from the shared
+ *    search, until the end of the root directory is known to have been
+ *    reached or an error occurs.
+ *
+ * Results:
+ *    TRUE unless a read on this connection failed.
+ *
+ * Side effects:
+ *    Updates the shared search.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsClientEnumerate(HgfsClientConn *conn,     // IN: Connection to the host
+                    HgfsClientSearch *search, // IN/OUT: Shared search state
+                    Bool once)                // IN: Stop after one read
+{
+   GPtrArray *shares = g_ptr_array_new_with_free_func(HgfsClientShareFree);
+   Bool success = TRUE;
+
+   do {
+      uint32 offset;
+      HgfsOp readOp;
+      guint i;
+
+      g_mutex_lock(&search->lock);
+      if (search->failed || search->nextOffset >= search->endOffset) {
+         g_mutex_unlock(&search->lock);
+         break;
+      }
+      offset = search->nextOffset++;
+      readOp = search->readOp;
+      g_mutex_unlock(&search->lock);
+
+      success = HgfsClient_Read(conn, &readOp, offset, shares);
+
+      g_mutex_lock(&search->lock);
+      if (readOp != HGFS_OP_SEARCH_READ_V3) {
+         search->readOp = readOp;
+      }
+      if (!success) {
+         search->failed = TRUE;
+      } else if (shares->len == 0) {
+         search->endOffset = MIN(search->endOffset, offset);
+      } else {
+         /*
+          * A reply with several entries covers offsets other connections
+          * may have claimed, or read, already; the first copy is kept.
+          */
+         if (search->shares->len < offset + shares->len) {
+            g_ptr_array_set_size(search->shares, offset + shares->len);
+         }
+         for (i = 0; i < shares->len; i++) {
+            gpointer *slot = &g_ptr_array_index(search->shares, offset + i);
+
+            if (*slot == NULL) {
+               *slot = g_ptr_array_index(shares, i);
+               g_ptr_array_index(shares, i) = NULL;
+            }
+         }
+         search->nextOffset = MAX(search->nextOffset, offset + shares->len);
+      }
+      g_mutex_unlock(&search->lock);
+
+      g_ptr_array_set_size(shares, 0);
+   } while (success && !once);
+
+   g_ptr_array_free(shares, TRUE);
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsClientEnumerateThread --
+ *
+ *    Thread entry point of an extra connection enumerating the shares. The
+ *    connection has its own backdoor channel and search; failing to set
+ *    them up only means the other connections do the work.
+ *
+ * Results:
+ *    TRUE, or FALSE if the search couldn't be closed, as a gpointer.
+ *
+ * Side effects:
+ *    Updates the shared search.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+HgfsClientEnumerateThread(gpointer data) // IN: Shared search state
+{
+   HgfsClientSearch *search = data;
+   HgfsClientConn conn;
+   Bool success = TRUE;
+
+   memset(&conn, 0, sizeof conn);
+   conn.channel = HgfsBd_GetChannel();
+   if (conn.channel == NULL) {
+      Debug("Failed to create an extra RPC channel.\n");
+      goto out;
+   }
+   conn.packetBuffer = HgfsBd_GetBuf();
+   if (conn.packetBuffer == NULL) {
+      goto out;
+   }
+
+   if (HgfsClient_Open(&conn)) {
+      HgfsClientEnumerate(&conn, search, FALSE);
+      success = HgfsClient_Close(&conn);
+   }
+
+  out:
+   if (conn.packetBuffer != NULL) {
+      HgfsBd_PutBuf(conn.packetBuffer);
+   }
+   if (conn.channel != NULL) {
+      HgfsBd_CloseChannel(conn.channel);
+   }
+   return GINT_TO_POINTER(success);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsClientPrintAttr --
+ *
+ *    Print the attributes of a share, for the long listing: the file type,
+ *    the owner permissions, the size and the time of last write. Invalid
+ *    attributes are printed as '?'.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsClientPrintAttr(HgfsAttrV2 const *attr) // IN: Share attributes
+{
+   char type = '?';
+   char perms[] = "???";
+   char size[24] = "?";
+   char writeTime[24] = "?";
+
+   if (attr->mask & HGFS_ATTR_VALID_TYPE) {
+      type = attr->type == HGFS_FILE_TYPE_DIRECTORY ? 'd' :
+             attr->type == HGFS_FILE_TYPE_SYMLINK ? 'l' : '-';
+   }
+   if (attr->mask & HGFS_ATTR_VALID_OWNER_PERMS) {
+      perms[0] = (attr->ownerPerms & HGFS_PERM_READ) ? 'r' : '-';
+      perms[1] = (attr->ownerPerms & HGFS_PERM_WRITE) ? 'w' : '-';
+      perms[2] = (attr->ownerPerms & HGFS_PERM_EXEC) ? 'x' : '-';
+   }
+   if (attr->mask & HGFS_ATTR_VALID_SIZE) {
+      Str_Sprintf(size, sizeof size, "%"FMT64"u", attr->size);
+   }
+   if (attr->mask & HGFS_ATTR_VALID_WRITE_TIME) {
+#ifdef _WIN32
+      FILETIME fileTime;
+      SYSTEMTIME sysTime;
+
+      fileTime.dwLowDateTime = (DWORD)attr->writeTime;
+      fileTime.dwHighDateTime = (DWORD)(attr->writeTime >> 32);
+      if (FileTimeToSystemTime(&fileTime, &sysTime)) {
+         Str_Sprintf(writeTime, sizeof writeTime, "%04u-%02u-%02u %02u:%02u",
+                     sysTime.wYear, sysTime.wMonth, sysTime.wDay,
+                     sysTime.wHour, sysTime.wMinute);
+      }
+#else
+      time_t unixTime;
+      struct tm tm;
+
+      HgfsConvertFromNtTime(&unixTime, attr->writeTime);
+      if (localtime_r(&unixTime, &tm) != NULL) {
+         strftime(writeTime, sizeof writeTime, "%Y-%m-%d %H:%M", &tm);
+      }
+#endif
+   }
+   printf("%c%s %12s %-16s ", type, perms, size, writeTime);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * HgfsClient_PrintShares --
  *
- *    List all the shares available on the host.
+ *    List all the shares available on the host, in the host's order, with
+ *    their attributes in the long format.
+ *
+ *    Each read is a synchronous round trip over the backdoor, and a host may
+ *    return only one entry per read. So when the first read doesn't reach
+ *    the end of the root directory, up to gJobs - 1 extra connections are
+ *    started to read the remaining offsets in parallel. Each connection
+ *    opens its own search; the host lists the same shares in each.
  *
  * Results:
  *    TRUE if successful, FALSE otherwise.
@@ -255,33 +679,56 @@ HgfsClient_Close(HgfsHandle rootHandle) // IN: Handle to root directory
 static Bool
 HgfsClient_PrintShares(void)
 {
-   Bool success = FALSE;
-   int offset = 0;
+   Bool success;
    char escapedName[PATH_MAX + 1];
-   HgfsHandle rootHandle;
-
-   if (!HgfsClient_Open(&rootHandle)) {
-      return success;
+   HgfsClientConn conn;
+   HgfsClientSearch search;
+   GThread *threads[HGFSCLIENT_MAX_JOBS];
+   gint numThreads = 0;
+   guint i;
+
+   conn.channel = gChannel;
+   conn.packetBuffer = gPacketBuffer;
+   if (!HgfsClient_Open(&conn)) {
+      return FALSE;
    }
 
-   while (TRUE) {
-      HgfsFileName *fileName = HgfsClient_Read(rootHandle, offset++);
-
-      if (fileName == NULL) {
-         break;
+   memset(&search, 0, sizeof search);
+   g_mutex_init(&search.lock);
+   search.endOffset = G_MAXUINT32;
+   search.readOp = HGFS_OP_SEARCH_READ_V3;
+   search.shares = g_ptr_array_new_with_free_func(HgfsClientShareFree);
+
+   success = HgfsClientEnumerate(&conn, &search, TRUE);
+   if (success && search.nextOffset < search.endOffset) {
+      for (numThreads = 0; numThreads < gJobs - 1; numThreads++) {
+         threads[numThreads] = g_thread_new("hgfsclient",
+                                            HgfsClientEnumerateThread,
+                                            &search);
       }
+      success = HgfsClientEnumerate(&conn, &search, FALSE);
+      for (i = 0; i < (guint)numThreads; i++) {
+         if (!GPOINTER_TO_INT(g_thread_join(threads[i]))) {
+            success = FALSE;
+         }
+      }
+   }
+   if (search.failed) {
+      success = FALSE;
+   }
 
-      /* Are we done? */
-      if (fileName->length == 0) {
-         success = TRUE;
-         break;
+   for (i = 0; i < search.shares->len && i < search.endOffset; i++) {
+      HgfsClientShare *share = g_ptr_array_index(search.shares, i);
+
+      if (share == NULL) {
+         continue;
       }
 
       /*
        * Escape this filename. If we get back a negative result, it means that
        * the escaped filename is too big, so skip this share.
        */
-      if (HgfsEscape_Do(fileName->name, fileName->length,
+      if (HgfsEscape_Do(share->name, share->nameLength,
                            sizeof escapedName, escapedName) < 0) {
         continue;
       }
@@ -291,11 +738,16 @@ HgfsClient_PrintShares(void)
           strcmp("..", escapedName) == 0) {
          continue;
       }
+      if (gLongFormat) {
+         HgfsClientPrintAttr(&share->attr);
+      }
       printf("%s\n", escapedName);
-
    }
 
-   if (!HgfsClient_Close(rootHandle)) {
+   g_ptr_array_free(search.shares, TRUE);
+   g_mutex_clear(&search.lock);
+
+   if (!HgfsClient_Close(&conn)) {
       success = FALSE;
    }
    return success;
@@ -418,15 +870,33 @@ int
 main(int argc,          // IN
      char *argv[])      // IN
 {
+   GOptionContext *optCtx;
+   GError *error = NULL;
+   GOptionEntry options[] = {
+      { "long", 'l', 0, G_OPTION_ARG_NONE, &gLongFormat,
+        "Print the type, owner permissions, size and time of last write of "
+        "each share", NULL },
+      { "jobs", 'j', 0, G_OPTION_ARG_INT, &gJobs,
+        "Read the shares over up to this many connections, 4 by default",
+        "<count>" },
+      { NULL }
+   };
+
 #ifdef _WIN32
    WinUtil_EnableSafePathSearching(TRUE);
 #endif
-   if (argc == 2 &&
-       (!strncmp(argv[1], "-h", 2) ||
-        !strncmp(argv[1], "--help", 6))) {
-      fprintf(stderr, "hgfsclient: lists any shared folders.\n");
-      return 0;
+
+   optCtx = g_option_context_new(NULL);
+   g_option_context_set_summary(optCtx, "Lists any shared folders.");
+   g_option_context_add_main_entries(optCtx, options, NULL);
+   if (!g_option_context_parse(optCtx, &argc, &argv, &error)) {
+      fprintf(stderr, "hgfsclient: %s\n", error->message);
+      g_clear_error(&error);
+      g_option_context_free(optCtx);
+      return EXIT_FAILURE;
    }
+   g_option_context_free(optCtx);
+   gJobs = CLAMP(gJobs, 1, HGFSCLIENT_MAX_JOBS);
 
    if (!HgfsClient_Init()) {
       return EXIT_FAILURE;
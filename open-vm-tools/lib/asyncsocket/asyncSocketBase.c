@@ -40,10 +40,12 @@
  */
 
 #include "vmware.h"
+#include "vm_atomic.h"
 #include "asyncsocket.h"
 #include "asyncSocketBase.h"
 #include "msg.h"
 #include "log.h"
+#include "toolsProbe.h"
 
 #define LOGLEVEL_MODULE asyncsocket
 #include "loglevel_user.h"
@@ -340,6 +342,8 @@ AsyncSocketInitSocket(AsyncSocket *s,                          // IN/OUT
       s->pollParams.flags = 0;
       s->pollParams.lock = NULL;
       s->pollParams.iPoll = NULL;
+      s->pollParams.loop = NULL;
+      s->pollParams.loopGroup = NULL;
    }
 }
 
@@ -551,6 +555,7 @@ AsyncSocketCheckAndDispatchRecv(AsyncSocket *s,  // IN
        */
 
       s->recvBuf = NULL;
+      TOOLS_PROBE2(asock__recv__done, s, s->recvPos);
       s->recvFn(recvBuf, s->recvPos, s, s->recvClientData);
       if (s->state == AsyncSocketClosed) {
          ASOCKLG0(s, "owner closed connection in recv callback\n");
@@ -687,6 +692,180 @@ AsyncSocketCancelRecv(AsyncSocket *asock,         // IN
 }
 
 
+/*
+ * Counters summed over all sockets, updated along with the per-socket ones.
+ */
+static Atomic_uint64 asyncSocketGlobalStats[ASOCK_STAT_MAX];
+static Atomic_uint64 asyncSocketGlobalQueueHighWater;
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocketStatsAdd --
+ *
+ *      Add to a counter of the socket and to the global one. The caller
+ *      holds the socket lock.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+AsyncSocketStatsAdd(AsyncSocket *asock,     // IN/OUT
+                    AsyncSocketStatId id,   // IN
+                    uint64 value)           // IN
+{
+   ASSERT(id < ASOCK_STAT_MAX);
+
+   asock->stats[id] += value;
+   Atomic_Add64(&asyncSocketGlobalStats[id], value);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocketStatsQueue --
+ *
+ *      Account for bytes entering (delta > 0) or leaving the send queue,
+ *      tracking its high-water mark.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+AsyncSocketStatsQueue(AsyncSocket *asock,   // IN/OUT
+                      int64 delta)          // IN
+{
+   ASSERT(delta >= 0 || asock->sendQueueBytes >= (uint64)-delta);
+
+   asock->sendQueueBytes += delta;
+   if (asock->sendQueueBytes > asock->sendQueueHighWater) {
+      uint64 old;
+
+      asock->sendQueueHighWater = asock->sendQueueBytes;
+      do {
+         old = Atomic_Read64(&asyncSocketGlobalQueueHighWater);
+      } while (old < asock->sendQueueHighWater &&
+               Atomic_ReadIfEqualWrite64(&asyncSocketGlobalQueueHighWater,
+                                         old, asock->sendQueueHighWater) !=
+               old);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocketStatsFill --
+ *
+ *      Copy counters into an AsyncSocketStats.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+AsyncSocketStatsFill(const uint64 *counters,   // IN: ASOCK_STAT_MAX values
+                     AsyncSocketStats *stats)  // OUT
+{
+   stats->bytesSent = counters[ASOCK_STAT_BYTES_SENT];
+   stats->bytesRecvd = counters[ASOCK_STAT_BYTES_RECVD];
+   stats->sendCalls = counters[ASOCK_STAT_SEND_CALLS];
+   stats->recvCalls = counters[ASOCK_STAT_RECV_CALLS];
+   stats->emptyWakeups = counters[ASOCK_STAT_EMPTY_WAKEUPS];
+   stats->blockedSendUs = counters[ASOCK_STAT_BLOCKED_SEND_US];
+   stats->blockedRecvUs = counters[ASOCK_STAT_BLOCKED_RECV_US];
+   stats->handshakes = counters[ASOCK_STAT_HANDSHAKES];
+   stats->handshakeUs = counters[ASOCK_STAT_HANDSHAKE_US];
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocket_GetStats --
+ *
+ *      Get the counters of a socket: bytes and system calls in each
+ *      direction, recv callbacks that found no data, time spent in blocking
+ *      sends and receives and in SSL handshakes, and the send queue.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, or ASOCKERR_INVAL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+AsyncSocket_GetStats(AsyncSocket *asock,       // IN
+                     AsyncSocketStats *stats)  // OUT
+{
+   if (asock == NULL || stats == NULL) {
+      return ASOCKERR_INVAL;
+   }
+
+   AsyncSocketLock(asock);
+   AsyncSocketStatsFill(asock->stats, stats);
+   stats->sendQueueBytes = asock->sendQueueBytes;
+   stats->sendQueueHighWater = asock->sendQueueHighWater;
+   AsyncSocketUnlock(asock);
+
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocket_GetGlobalStats --
+ *
+ *      Get the counters summed over all sockets since startup, closed ones
+ *      included. sendQueueHighWater is the highest of any socket.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+AsyncSocket_GetGlobalStats(AsyncSocketStats *stats)  // OUT
+{
+   uint64 counters[ASOCK_STAT_MAX];
+   unsigned int i;
+
+   for (i = 0; i < ASOCK_STAT_MAX; i++) {
+      counters[i] = Atomic_Read64(&asyncSocketGlobalStats[i]);
+   }
+   AsyncSocketStatsFill(counters, stats);
+   stats->sendQueueBytes = 0;
+   stats->sendQueueHighWater = Atomic_Read64(&asyncSocketGlobalQueueHighWater);
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
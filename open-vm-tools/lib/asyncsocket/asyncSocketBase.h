@@ -41,6 +41,22 @@
 
 #include "asyncSocketVTable.h"
 
+/*
+ * Counters behind AsyncSocketStats, see AsyncSocketStatsAdd.
+ */
+typedef enum {
+   ASOCK_STAT_BYTES_SENT,
+   ASOCK_STAT_BYTES_RECVD,
+   ASOCK_STAT_SEND_CALLS,
+   ASOCK_STAT_RECV_CALLS,
+   ASOCK_STAT_EMPTY_WAKEUPS,
+   ASOCK_STAT_BLOCKED_SEND_US,
+   ASOCK_STAT_BLOCKED_RECV_US,
+   ASOCK_STAT_HANDSHAKES,
+   ASOCK_STAT_HANDSHAKE_US,
+   ASOCK_STAT_MAX
+} AsyncSocketStatId;
+
 /*
  * The abstract base class for all asyncsocket implementations.
  */
@@ -62,6 +78,10 @@ struct AsyncSocket {
    void *recvClientData;
    Bool recvFireOnPartial;
 
+   uint64 stats[ASOCK_STAT_MAX];
+   uint64 sendQueueBytes;
+   uint64 sendQueueHighWater;
+
    const AsyncSocketVTable *vt;
 };
 
@@ -84,6 +104,9 @@ AsyncSocketPollParams *AsyncSocketGetPollParams(AsyncSocket *s);
 void AsyncSocketHandleError(AsyncSocket *asock, int asockErr);
 void AsyncSocketCancelRecv(AsyncSocket *asock, int *partialRecvd,
                            void **recvBuf, void **recvFn);
+void AsyncSocketStatsAdd(AsyncSocket *asock, AsyncSocketStatId id,
+                         uint64 value);
+void AsyncSocketStatsQueue(AsyncSocket *asock, int64 delta);
 
 
 int AsyncTCPSocket_Init(void);
@@ -950,6 +950,53 @@ AsyncSocket_RecvPartial(AsyncSocket *asock,         // IN
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncSocket_RecvBuffered --
+ *
+ *      Registers a callback that fires with everything received on the
+ *      socket each time more data arrives, so that one callback can take
+ *      several messages. buf points into the socket's own buffer and is
+ *      only valid during the callback. The callback returns the number of
+ *      bytes it consumed; the rest, e.g. an incomplete message, is offered
+ *      again with the next data received.
+ *
+ *      The callback stays registered until AsyncSocket_CancelRecv, or until
+ *      AsyncSocket_Recv or _RecvPartial replaces it. Those are served from
+ *      the unconsumed bytes first.
+ *
+ *      TCP usage:
+ *      AsyncSocket_RecvBuffered(AsyncSocket *asock,
+ *                               AsyncSocketRecvBufferedFn recvFn,
+ *                               void *clientData)
+ *
+ * Results:
+ *      ASOCKERR_*.
+ *
+ * Side effects:
+ *      Could register poll callback.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+AsyncSocket_RecvBuffered(AsyncSocket *asock,               // IN
+                         AsyncSocketRecvBufferedFn recvFn, // IN
+                         void *cbData)                     // IN
+{
+   int ret;
+   if (VALID(asock, recvBuffered)) {
+      AsyncSocketLock(asock);
+      ret = VT(asock)->recvBuffered(asock, recvFn, cbData);
+      AsyncSocketUnlock(asock);
+   } else {
+      ret = ASOCKERR_INVAL;
+   }
+   return ret;
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -99,6 +99,8 @@ typedef struct AsyncSocketVTable {
    int (*flush)(AsyncSocket *asock, int timeoutMS);
    int (*recv)(AsyncSocket *asock, void *buf, int len, Bool partial, void *cb,
                void *cbData);
+   int (*recvBuffered)(AsyncSocket *asock, AsyncSocketRecvBufferedFn cb,
+                       void *cbData);
    int (*recvPassedFd)(AsyncSocket *asock, void *buf, int len, void *cb,
                        void *cbData);
    int (*getReceivedFd)(AsyncSocket *asock);
@@ -93,6 +93,7 @@
 #include "util.h"
 #include "msg.h"
 #include "posix.h"
+#include "toolsProbe.h"
 #include "vm_basic_asm.h"
 #include "vmci_sockets.h"
 #ifndef VMX86_TOOLS
@@ -152,6 +153,40 @@
  */
 #define ADDR_STRING_LEN (INET6_ADDRSTRLEN + 2 + PORT_STRING_LEN)
 
+/*
+ * Read-ahead buffer. A recv request smaller than the buffer reads as much
+ * as the socket has into it and is then served from it, so that a header
+ * and the body after it cost one system call. AsyncSocket_RecvBuffered
+ * hands its content over directly, growing it up to ASOCK_RECV_AHEAD_MAX
+ * for a message that does not fit.
+ */
+#define ASOCK_RECV_AHEAD_SIZE (16 * 1024)
+#define ASOCK_RECV_AHEAD_MAX  (1024 * 1024)
+#define ASOCK_RECV_AHEAD_AVAIL(s) ((s)->recvAhead.end - (s)->recvAhead.start)
+
+/*
+ * Most queued buffers gathered into one sendmsg() call.
+ */
+#define ASOCK_SEND_IOV_MAX 64
+
+/*
+ * MSG_ZEROCOPY (Linux 4.14 and later) sends large buffers without copying
+ * them into the kernel. The pages stay pinned until the kernel posts a
+ * completion on the socket error queue, so the send callback of such a
+ * buffer, and of every buffer queued after it, is deferred until then.
+ * Completions are reaped from the send and recv callbacks, with a timer
+ * as a fallback for idle sockets.
+ */
+#if defined(__linux__) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define ASOCK_ZEROCOPY 1
+#define ASOCK_ZEROCOPY_REAP_US 10000
+#define ASOCK_USE_ZEROCOPY(s, b) \
+   ((s)->zeroCopyMin > 0 && (b)->len >= (s)->zeroCopyMin)
+#else
+#define ASOCK_USE_ZEROCOPY(s, b) FALSE
+#endif
+
 
 /* Local types. */
 
@@ -165,9 +200,52 @@ typedef struct SendBufList {
    int                   passFd;
    AsyncSocketSendFn     sendFn;
    void                 *clientData;
+   uint32                zeroCopySeq;   /* Last MSG_ZEROCOPY send of buf */
+   Bool                  zeroCopy;
 } SendBufList;
 
 
+/*
+ * Accept distributor of a listener with a loop group. The accept callback
+ * runs on one loop of the group and only accepts: each new connection is
+ * queued to the loop with the fewest devices and connections queued, and a
+ * timer on that loop binds it there and fires the connect callback. A loop
+ * finding its own queue empty steals from the longest queue of the others
+ * the connections waiting there for more than ASOCK_ACCEPT_STEAL_US, so
+ * connections queued to a loop busy with its sockets go to an idle one.
+ * The queues and timers are protected by the listener lock.
+ */
+typedef struct AsyncTCPSocketPendingConn {
+   struct AsyncTCPSocketPendingConn *next;
+   int                               fd;
+   VmTimeType                        queuedUs;
+   struct sockaddr_storage           remoteAddr;
+   socklen_t                         remoteAddrLen;
+} AsyncTCPSocketPendingConn;
+
+typedef struct AsyncTCPSocketAcceptQueue {
+   struct AsyncTCPSocket       *listener;
+   PollLoop                    *loop;
+   AsyncTCPSocketPendingConn   *head;
+   AsyncTCPSocketPendingConn  **tail;
+   unsigned int                 count;
+   Bool                         drainCb;   /* Drain timer is registered */
+} AsyncTCPSocketAcceptQueue;
+
+typedef struct AsyncTCPSocketAcceptDist {
+   PollLoop                    *acceptLoop;
+   unsigned int                 numQueues;
+   AsyncTCPSocketAcceptQueue   *queues;
+} AsyncTCPSocketAcceptDist;
+
+/*
+ * Most connections the accept callback takes from the backlog at once,
+ * leaving the loop to its other callbacks on a connection storm.
+ */
+#define ASOCK_ACCEPT_BATCH 32
+#define ASOCK_ACCEPT_STEAL_US 1000
+
+
 typedef struct AsyncTCPSocket {
    /*
     * The base class, which is just a vtable:
@@ -191,6 +269,7 @@ typedef struct AsyncTCPSocket {
    AsyncSocketSslAcceptFn sslAcceptFn;
    AsyncSocketSslConnectFn sslConnectFn;
    int sslPollFlags;       /* shared by sslAcceptFn, sslConnectFn */
+   VmTimeType sslStartUs;  /* when the async SSL handshake started */
 
    /* shared by connectFn, sslAcceptFn and sslConnectFn */
    void *clientData;
@@ -207,6 +286,15 @@ typedef struct AsyncTCPSocket {
    Bool recvCb;
    Bool recvCbTimer;
 
+   struct {
+      uint8 *buf;                /* Allocated on first use */
+      int size;
+      int start;                 /* First byte not handed out yet */
+      int end;                   /* One past the last byte read */
+   } recvAhead;
+   AsyncSocketRecvBufferedFn recvBufferedFn;
+   void *recvBufferedClientData;
+
    SendBufList *sendBufList;
    SendBufList **sendBufTail;
    int sendPos;
@@ -217,6 +305,13 @@ typedef struct AsyncTCPSocket {
    Bool sendLowLatency;
    int inLowLatencySendCb;
 
+   int zeroCopyMin;              /* Smallest buffer sent with MSG_ZEROCOPY */
+   uint32 zeroCopyNext;          /* Sequence number of the next one */
+   uint32 zeroCopyDone;          /* Sends below this one have completed */
+   SendBufList *zeroCopyList;    /* Sent, waiting for zero-copy completion */
+   SendBufList **zeroCopyTail;
+   Bool zeroCopyCb;
+
    Bool sslConnected;
 
    uint8 inIPollCb;
@@ -226,6 +321,8 @@ typedef struct AsyncTCPSocket {
    struct AsyncTCPSocket *listenAsock4;
    struct AsyncTCPSocket *listenAsock6;
 
+   AsyncTCPSocketAcceptDist *acceptDist;  /* Listener with a loop group */
+
    struct {
       Bool expected;
       int fd;
@@ -251,6 +348,9 @@ static int AsyncTCPSocketResolveAddr(const char *hostname,
 static AsyncTCPSocket *AsyncTCPSocketAttachToFd(
    int fd, AsyncSocketPollParams *pollParams, int *outError);
 static Bool AsyncTCPSocketHasDataPending(AsyncTCPSocket *asock);
+static int AsyncTCPSocketRecvAheadCopy(AsyncTCPSocket *asock, void *buf,
+                                       int len);
+static void AsyncTCPSocketCountRecv(AsyncTCPSocket *asock, int recvd);
 static int AsyncTCPSocketMakeNonBlocking(int fd);
 static void AsyncTCPSocketAcceptCallback(void *clientData);
 static void AsyncTCPSocketConnectCallback(void *clientData);
@@ -261,6 +361,17 @@ static int AsyncTCPSocketBlockingWork(AsyncTCPSocket *asock, Bool read,
 static VMwareStatus AsyncTCPSocketPollAdd(AsyncTCPSocket *asock, Bool socket,
                                           int flags, PollerFunction callback,
                                           ...);
+static VMwareStatus AsyncTCPSocketGroupPollAdd(AsyncTCPSocket *asock,
+                                               int flags,
+                                               PollerFunction callback,
+                                               PollEventType type,
+                                               PollDevHandle info);
+static Bool AsyncTCPSocketGroupPollRemove(AsyncTCPSocket *asock, int flags,
+                                          PollerFunction callback,
+                                          PollEventType type);
+static int AsyncTCPSocketAcceptDistribute(AsyncTCPSocket *s);
+static void AsyncTCPSocketAcceptDrainCallback(void *clientData);
+static void AsyncTCPSocketAcceptDistDestroy(AsyncTCPSocket *s);
 static Bool AsyncTCPSocketPollRemove(AsyncTCPSocket *asock, Bool socket,
                                      int flags, PollerFunction callback);
 static unsigned int AsyncTCPSocketGetPortFromAddr(
@@ -330,6 +441,9 @@ static void AsyncTCPSocketCancelRecvCb(AsyncTCPSocket *asock);
 
 static int AsyncTCPSocketRecv(AsyncSocket *asock,
              void *buf, int len, Bool partial, void *cb, void *cbData);
+static int AsyncTCPSocketRecvBuffered(AsyncSocket *asock,
+                                      AsyncSocketRecvBufferedFn cb,
+                                      void *cbData);
 static int AsyncTCPSocketRecvPassedFd(AsyncSocket *asock, void *buf, int len,
                      void *cb, void *cbData);
 static int AsyncTCPSocketGetReceivedFd(AsyncSocket *asock);
@@ -394,6 +508,7 @@ static const AsyncSocketVTable asyncTCPSocketVTable = {
    AsyncTCPSocketStartSslAccept,
    AsyncTCPSocketFlush,
    AsyncTCPSocketRecv,
+   AsyncTCPSocketRecvBuffered,
    AsyncTCPSocketRecvPassedFd,
    AsyncTCPSocketGetReceivedFd,
    AsyncTCPSocketSend,
@@ -2261,6 +2376,7 @@ AsyncTCPSocketCreate(AsyncSocketPollParams *pollParams) // IN
    s->inRecvLoop = FALSE;
    s->sendBufFull = FALSE;
    s->sendBufTail = &(s->sendBufList);
+   s->zeroCopyTail = &(s->zeroCopyList);
    s->passFd.fd = -1;
 
    if (pollParams && pollParams->iPoll) {
@@ -2584,8 +2700,96 @@ AsyncTCPSocketRecv(AsyncSocket *base,   // IN:
       return retVal;
    }
 
+   asock->recvBufferedFn = NULL;
    AsyncSocketSetRecvBuf(BaseSocket(asock), buf, len, fireOnPartial,
                          cb, cbData);
+   TOOLS_PROBE2(asock__recv, base, len);
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketRecvBuffered --
+ *
+ *      Registers a callback that fires with everything read ahead on the
+ *      socket, which may hold several messages, each time more data
+ *      arrives. The callback returns how many bytes it consumed; the rest
+ *      stays buffered and is offered again, together with the next data
+ *      received. The callback stays registered until the recv is cancelled
+ *      or a regular AsyncSocket_Recv replaces it, which is then served from
+ *      the bytes still buffered.
+ *
+ *      File descriptors passed on the socket are dropped in this mode.
+ *
+ * Results:
+ *      ASOCKERR_*.
+ *
+ * Side effects:
+ *      Could register poll callback.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketRecvBuffered(AsyncSocket *base,             // IN:
+                           AsyncSocketRecvBufferedFn cb,  // IN:
+                           void *cbData)                  // IN:
+{
+   AsyncTCPSocket *asock = TCPSocket(base);
+   Bool wasBuffered = asock->recvBufferedFn != NULL;
+   int retVal;
+
+   if (!asock->base.errorFn) {
+      TCPSOCKWARN(asock, "%s: no registered error handler!\n", __FUNCTION__);
+      return ASOCKERR_INVAL;
+   }
+
+   if (!cb) {
+      Warning(ASOCKPREFIX "RecvBuffered called with invalid arguments!\n");
+      return ASOCKERR_INVAL;
+   }
+
+   ASSERT(AsyncTCPSocketIsLocked(asock));
+
+   if (AsyncTCPSocketGetState(asock) != AsyncSocketConnected) {
+      TCPSOCKWARN(asock, "recv called but state is not connected!\n");
+      return ASOCKERR_NOTCONNECTED;
+   }
+
+   if (asock->inBlockingRecv && !asock->inRecvLoop) {
+      TCPSOCKWARN(asock, "Recv called while a blocking recv is pending.\n");
+      return ASOCKERR_INVAL;
+   }
+
+   retVal = AsyncTCPSocketRegisterRecvCb(asock);
+   if (retVal != ASOCKERR_SUCCESS) {
+      return retVal;
+   }
+
+   if (asock->base.recvBuf && asock->base.recvPos != 0) {
+      TCPSOCKWARN(asock, "Recv called -- partially read buffer discarded.\n");
+   }
+   AsyncSocketCancelRecv(BaseSocket(asock), NULL, NULL, NULL);
+   asock->passFd.expected = FALSE;
+   asock->recvBufferedFn = cb;
+   asock->recvBufferedClientData = cbData;
+
+   /*
+    * Switching over from a regular recv callback ends its recv loop, hand
+    * what it left buffered over from a timer.
+    */
+
+   if (asock->inRecvLoop && !wasBuffered &&
+       ASOCK_RECV_AHEAD_AVAIL(asock) > 0) {
+      if (AsyncTCPSocketPollAdd(asock, FALSE, 0, asock->internalRecvFn, 0) !=
+          VMWARE_STATUS_SUCCESS) {
+         return ASOCKERR_POLL;
+      }
+      asock->recvCbTimer = TRUE;
+   }
+
    return ASOCKERR_SUCCESS;
 }
 
@@ -2689,7 +2893,7 @@ AsyncTCPSocketPollWork(AsyncTCPSocket **asock,     // IN:
           numSock > 0);
 
    for (i = 0; i < numSock; i++) {
-      if (read && SSL_Pending(asock[i]->sslSock)) {
+      if (read && AsyncTCPSocketHasDataPending(asock[i])) {
          *outAsock = asock[i];
          return ASOCKERR_SUCCESS;
       }
@@ -2999,8 +3203,13 @@ AsyncTCPSocketRecvBlocking(AsyncSocket *base,     // IN
                            int timeoutMS)         // IN
 {
    AsyncTCPSocket *s = TCPSocket(base);
-   return AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received, timeoutMS,
-                                     FALSE);
+   VmTimeType start = Hostinfo_SystemTimerUS();
+   int ret = AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received,
+                                        timeoutMS, FALSE);
+
+   AsyncSocketStatsAdd(base, ASOCK_STAT_BLOCKED_RECV_US,
+                       Hostinfo_SystemTimerUS() - start);
+   return ret;
 }
 
 static int
@@ -3011,8 +3220,13 @@ AsyncTCPSocketRecvPartialBlocking(AsyncSocket *base,     // IN
                                   int timeoutMS)         // IN
 {
    AsyncTCPSocket *s = TCPSocket(base);
-   return AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received, timeoutMS,
-                                     TRUE);
+   VmTimeType start = Hostinfo_SystemTimerUS();
+   int ret = AsyncTCPSocketBlockingWork(s, TRUE, buf, len, received,
+                                        timeoutMS, TRUE);
+
+   AsyncSocketStatsAdd(base, ASOCK_STAT_BLOCKED_RECV_US,
+                       Hostinfo_SystemTimerUS() - start);
+   return ret;
 }
 
 static int
@@ -3023,7 +3237,13 @@ AsyncTCPSocketSendBlocking(AsyncSocket *base,         // IN
                            int timeoutMS)             // IN
 {
    AsyncTCPSocket *s = TCPSocket(base);
-   return AsyncTCPSocketBlockingWork(s, FALSE, buf, len, sent, timeoutMS, FALSE);
+   VmTimeType start = Hostinfo_SystemTimerUS();
+   int ret = AsyncTCPSocketBlockingWork(s, FALSE, buf, len, sent, timeoutMS,
+                                        FALSE);
+
+   AsyncSocketStatsAdd(base, ASOCK_STAT_BLOCKED_SEND_US,
+                       Hostinfo_SystemTimerUS() - start);
+   return ret;
 }
 
 
@@ -3075,8 +3295,20 @@ AsyncTCPSocketBlockingWork(AsyncTCPSocket *s,  // IN:
       int numBytes, error;
       AsyncTCPSocket *asock = NULL;
 
-      if ((numBytes = read ? SSL_Read(s->sslSock, buf, len)
-                           : SSL_Write(s->sslSock, buf, len)) > 0) {
+      if (read && ASOCK_RECV_AHEAD_AVAIL(s) > 0) {
+         numBytes = AsyncTCPSocketRecvAheadCopy(s, buf, len);
+      } else if (read) {
+         numBytes = SSL_Read(s->sslSock, buf, len);
+         AsyncTCPSocketCountRecv(s, numBytes);
+      } else {
+         numBytes = SSL_Write(s->sslSock, buf, len);
+         if (numBytes > 0) {
+            AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_SEND_CALLS, 1);
+            AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_BYTES_SENT,
+                                numBytes);
+         }
+      }
+      if (numBytes > 0) {
          if (completed) {
             *completed += numBytes;
          }
@@ -3237,6 +3469,7 @@ AsyncTCPSocketSendWithFd(AsyncSocket *base,         // IN:
    }
 
    LOG(2, "%s: sending %d bytes\n", __FUNCTION__, len);
+   TOOLS_PROBE2(asock__send, base, len);
 
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
@@ -3282,6 +3515,7 @@ AsyncTCPSocketSendWithFd(AsyncSocket *base,         // IN:
    *asock->sendBufTail = newBuf;
    asock->sendBufTail = passFd == -1 ? &(newBuf->next) : &(newBuf->next->next);
    bufferListWasEmpty = (asock->sendBufList == newBuf);
+   AsyncSocketStatsQueue(base, len);
 
    if (bufferListWasEmpty && !asock->sendCb) {
       if (asock->sendLowLatency) {
@@ -3366,6 +3600,7 @@ outUndoAppend:
          free(*pcur);
          *pcur = NULL;
          asock->sendBufTail = pcur;
+         AsyncSocketStatsQueue(base, -len);
       }
    }
 
@@ -3483,155 +3718,36 @@ bye:
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketFillRecvBuffer --
+ * AsyncTCPSocketCountRecv --
  *
- *      Called when an asock has data ready to be read via the poll callback.
+ *      Account for a system call receiving data.
  *
  * Results:
- *      ASOCKERR_SUCCESS if everything worked,
- *      ASOCKERR_REMOTE_DISCONNECT if peer closed connection gracefully,
- *      ASOCKERR_CLOSED if trying to read from a closed socket.
- *      ASOCKERR_GENERIC for other errors.
+ *      None.
  *
  * Side effects:
- *      Reads data, could fire recv completion or trigger socket destruction.
+ *      None.
  *
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketFillRecvBuffer(AsyncTCPSocket *s)         // IN
+static void
+AsyncTCPSocketCountRecv(AsyncTCPSocket *s,  // IN
+                        int recvd)          // IN: system call result
 {
-   int recvd;
-   int needed;
-   int sysErr = 0;
-   int result;
-   int pending = 0;
-
-   ASSERT(AsyncTCPSocketIsLocked(s));
-   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
-
-   /*
-    * When a socket has received all its desired content and FillRecvBuffer is
-    * called again for the same socket, just return ASOCKERR_SUCCESS. The
-    * reason we need this hack is that if a client which registered a receive
-    * callback asynchronously later changes its mind to do it synchronously,
-    * (e.g. aioMgr wait function), then FillRecvBuffer can be potentially be
-    * called twice for the same receive event.
-    */
-
-   needed = s->base.recvLen - s->base.recvPos;
-   if (!s->base.recvBuf && needed == 0) {
-      return ASOCKERR_SUCCESS;
+   AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_RECV_CALLS, 1);
+   if (recvd > 0) {
+      AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_BYTES_RECVD, recvd);
    }
-
-   ASSERT(needed > 0);
-
-   AsyncTCPSocketAddRef(s);
-
-   /*
-    * See comment in AsyncTCPSocket_Recv
-    */
-
-   s->inRecvLoop = TRUE;
-
-   do {
-
-      /*
-       * Try to read the remaining bytes to complete the current recv request.
-       */
-
-      if (s->passFd.expected) {
-         int fd;
-
-         recvd = SSL_RecvDataAndFd(s->sslSock,
-                                   (uint8 *) s->base.recvBuf +
-                                   s->base.recvPos,
-                                   needed, &fd);
-         if (fd != -1) {
-            s->passFd.fd = fd;
-            s->passFd.expected = FALSE;
-         }
-      } else {
-         recvd = SSL_Read(s->sslSock,
-                          (uint8 *) s->base.recvBuf +
-                          s->base.recvPos,
-                          needed);
-      }
-      /*
-       * Do NOT make any system call directly or indirectly here
-       * unless you can preserve the system error number
-       */
-      if (recvd > 0) {
-         TCPSOCKLOG(3, s, "need\t%d\trecv\t%d\tremain\t%d\n", needed, recvd,
-                    needed - recvd);
-         s->sslConnected = TRUE;
-         s->base.recvPos += recvd;
-         if (AsyncSocketCheckAndDispatchRecv(&s->base, &result)) {
-            goto exit;
-         }
-      } else if (recvd == 0) {
-         TCPSOCKLG0(s, "recv detected client closed connection\n");
-         /*
-          * We treat this as an error so that the owner can detect closing
-          * of connection by peer (via the error handler callback).
-          */
-         result = ASOCKERR_REMOTE_DISCONNECT;
-         goto exit;
-      } else if ((sysErr = ASOCK_LASTERROR()) == ASOCK_EWOULDBLOCK) {
-         TCPSOCKLOG(4, s, "recv would block\n");
-         break;
-      } else {
-         TCPSOCKLG0(s, "recv error %d: %s\n", sysErr, Err_Errno2String(sysErr));
-         s->genericErrno = sysErr;
-         result = ASOCKERR_GENERIC;
-         goto exit;
-      }
-
-      /*
-       * At this point, s->recvFoo have been updated to point to the
-       * next chained Recv buffer. By default we're done at this
-       * point, but we may want to continue if the SSL socket has data
-       * buffered in userspace already (SSL_Pending).
-       */
-
-      needed = s->base.recvLen - s->base.recvPos;
-      ASSERT(needed > 0);
-
-      pending = SSL_Pending(s->sslSock);
-      needed = MIN(needed, pending);
-
-   } while (needed);
-
-   /*
-    * Reach this point only when previous SSL_Pending returns 0 or
-    * error is ASOCK_EWOULDBLOCK
-    */
-
-   ASSERT(pending == 0 || sysErr == ASOCK_EWOULDBLOCK);
-
-   /*
-    * Both a spurious wakeup and receiving any data even if it wasn't enough
-    * to fire the callback are both success.  We were ready and now
-    * presumably we aren't ready anymore.
-    */
-
-   result = ASOCKERR_SUCCESS;
-
-exit:
-   s->inRecvLoop = FALSE;
-   AsyncTCPSocketRelease(s);
-
-   return result;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketDispatchSentBuffer --
+ * AsyncTCPSocketCountHandshake --
  *
- *      Pop off the head of the send buffer list and call its callback.
+ *      Account for a completed SSL handshake.
  *
  * Results:
  *      None.
@@ -3642,68 +3758,689 @@ exit:
  *----------------------------------------------------------------------------
  */
 
-static int
-AsyncTCPSocketDispatchSentBuffer(AsyncTCPSocket *s)         // IN
+static void
+AsyncTCPSocketCountHandshake(AsyncTCPSocket *s,   // IN
+                             VmTimeType start)    // IN: Hostinfo_SystemTimerUS
 {
-   int result = ASOCKERR_SUCCESS;
-
-   /*
-    * We're done with the current buffer, so pop it off and nuke it.
-    * We do the list management *first*, so that the list is in a
-    * consistent state.
-    */
-
-   SendBufList *head = s->sendBufList;
-   SendBufList tmp = *head;
+   AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_HANDSHAKES, 1);
+   AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_HANDSHAKE_US,
+                       Hostinfo_SystemTimerUS() - start);
+}
 
-   s->sendBufList = head->next;
-   if (s->sendBufList == NULL) {
-      s->sendBufTail = &(s->sendBufList);
-   }
-   s->sendPos = 0;
-   free(head);
 
-   if (tmp.sendFn) {
-      /*
-       * Firing the send completion cannot trigger immediate
-       * destruction of the socket because we hold a refCount across
-       * this and all other application callbacks.  If the socket is
-       * closed, however, we need to bubble the information up to the
-       * caller in the same way as we do in the Recv callback case.
-       */
-      ASSERT(s->base.refCount > 1);
-      tmp.sendFn(tmp.buf, tmp.len, BaseSocket(s), tmp.clientData);
-      if (AsyncTCPSocketGetState(s) == AsyncSocketClosed) {
-         TCPSOCKLG0(s, "owner closed connection in send callback\n");
-         result = ASOCKERR_CLOSED;
-      }
-   }
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketCanReadAhead --
+ *
+ *      Whether a regular recv may read ahead on the socket. Unix sockets
+ *      may carry file descriptors, which a plain read ahead of
+ *      AsyncSocket_RecvPassedFd would drop, and sockets attached to an fd
+ *      of unknown family are left alone as well.
+ *
+ * Results:
+ *      TRUE if read-ahead is allowed.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-   return result;
+static Bool
+AsyncTCPSocketCanReadAhead(AsyncTCPSocket *s)  // IN
+{
+   return s->remoteAddrLen > 0 && s->remoteAddr.ss_family != AF_UNIX &&
+          !s->passFd.expected;
 }
 
 
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketPassFd --
+ * AsyncTCPSocketRecvAheadFill --
  *
- *      Send a file descriptor on the TCP socket.
+ *      Read as much as fits into the read-ahead buffer, after moving the
+ *      bytes not handed out yet to its front.
  *
  * Results:
- *      1 if successful, -1 if not.
+ *      As SSL_Read: bytes read, 0 if the peer closed the connection or -1
+ *      with the error in ASOCK_LASTERROR().
  *
  * Side effects:
- *      None.
+ *      Allocates the buffer on first use.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketPassFd(int socket,  // IN:
-                     int passFd)  // IN:
+AsyncTCPSocketRecvAheadFill(AsyncTCPSocket *s)  // IN
 {
-#ifndef _WIN32
+   int recvd;
+
+   if (s->recvAhead.buf == NULL) {
+      s->recvAhead.size = ASOCK_RECV_AHEAD_SIZE;
+      s->recvAhead.buf = Util_SafeMalloc(s->recvAhead.size);
+   }
+
+   if (s->recvAhead.start > 0) {
+      memmove(s->recvAhead.buf, s->recvAhead.buf + s->recvAhead.start,
+              ASOCK_RECV_AHEAD_AVAIL(s));
+      s->recvAhead.end -= s->recvAhead.start;
+      s->recvAhead.start = 0;
+   }
+
+   ASSERT(s->recvAhead.end < s->recvAhead.size);
+   recvd = SSL_Read(s->sslSock, (char *) s->recvAhead.buf + s->recvAhead.end,
+                    s->recvAhead.size - s->recvAhead.end);
+   AsyncTCPSocketCountRecv(s, recvd);
+   if (recvd > 0) {
+      s->recvAhead.end += recvd;
+   }
+
+   return recvd;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketRecvAheadCopy --
+ *
+ *      Hand bytes out of the read-ahead buffer.
+ *
+ * Results:
+ *      The number of bytes copied, at most len.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketRecvAheadCopy(AsyncTCPSocket *s,  // IN
+                            void *buf,          // OUT
+                            int len)            // IN
+{
+   int n = MIN(len, ASOCK_RECV_AHEAD_AVAIL(s));
+
+   memcpy(buf, s->recvAhead.buf + s->recvAhead.start, n);
+   s->recvAhead.start += n;
+   if (s->recvAhead.start == s->recvAhead.end) {
+      s->recvAhead.start = 0;
+      s->recvAhead.end = 0;
+   }
+
+   return n;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketFillRecvBuffered --
+ *
+ *      AsyncTCPSocketFillRecvBuffer for AsyncSocket_RecvBuffered: read into
+ *      the read-ahead buffer and offer its content to the callback until
+ *      the socket has nothing more or the callback is cancelled.
+ *
+ * Results:
+ *      As AsyncTCPSocketFillRecvBuffer.
+ *
+ * Side effects:
+ *      Reads data, could fire recv completion or trigger socket destruction.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketFillRecvBuffered(AsyncTCPSocket *s)  // IN
+{
+   Bool fresh = ASOCK_RECV_AHEAD_AVAIL(s) > 0;
+   int result = ASOCKERR_SUCCESS;
+
+   AsyncTCPSocketAddRef(s);
+   s->inRecvLoop = TRUE;
+
+   while (s->recvBufferedFn != NULL) {
+      int room;
+      int recvd;
+      int sysErr;
+
+      if (s->recvAhead.buf != NULL &&
+          ASOCK_RECV_AHEAD_AVAIL(s) == s->recvAhead.size) {
+         if (s->recvAhead.size >= ASOCK_RECV_AHEAD_MAX) {
+            TCPSOCKLG0(s, "buffered recv message exceeds %d bytes\n",
+                       ASOCK_RECV_AHEAD_MAX);
+            s->genericErrno = ENOBUFS;
+            result = ASOCKERR_GENERIC;
+            goto exit;
+         }
+         s->recvAhead.size *= 2;
+         s->recvAhead.buf = Util_SafeRealloc(s->recvAhead.buf,
+                                             s->recvAhead.size);
+      }
+
+      room = s->recvAhead.buf == NULL ?
+             ASOCK_RECV_AHEAD_SIZE :
+             s->recvAhead.size - ASOCK_RECV_AHEAD_AVAIL(s);
+      recvd = AsyncTCPSocketRecvAheadFill(s);
+      if (recvd == 0) {
+         TCPSOCKLG0(s, "recv detected client closed connection\n");
+         result = ASOCKERR_REMOTE_DISCONNECT;
+         goto exit;
+      } else if (recvd < 0) {
+         if ((sysErr = ASOCK_LASTERROR()) != ASOCK_EWOULDBLOCK) {
+            TCPSOCKLG0(s, "recv error %d: %s\n", sysErr,
+                       Err_Errno2String(sysErr));
+            s->genericErrno = sysErr;
+            result = ASOCKERR_GENERIC;
+            goto exit;
+         }
+         TCPSOCKLOG(4, s, "recv would block\n");
+         if (!fresh) {
+            break;
+         }
+      } else {
+         TCPSOCKLOG(3, s, "buffered recv\t%d\tavail\t%d\n", recvd,
+                    ASOCK_RECV_AHEAD_AVAIL(s));
+         s->sslConnected = TRUE;
+      }
+
+      if (ASOCK_RECV_AHEAD_AVAIL(s) > 0) {
+         int consumed;
+
+         ASSERT(s->base.refCount > 1);
+         consumed = s->recvBufferedFn(s->recvAhead.buf + s->recvAhead.start,
+                                      ASOCK_RECV_AHEAD_AVAIL(s),
+                                      BaseSocket(s),
+                                      s->recvBufferedClientData);
+         if (AsyncTCPSocketGetState(s) == AsyncSocketClosed) {
+            TCPSOCKLG0(s, "owner closed connection in recv callback\n");
+            result = ASOCKERR_CLOSED;
+            goto exit;
+         }
+         ASSERT(consumed >= 0 && consumed <= ASOCK_RECV_AHEAD_AVAIL(s));
+         s->recvAhead.start += consumed;
+         if (s->recvAhead.start == s->recvAhead.end) {
+            s->recvAhead.start = 0;
+            s->recvAhead.end = 0;
+         }
+      }
+      fresh = FALSE;
+
+      /*
+       * A short read drained the socket, wait for the next poll event
+       * rather than making a system call to learn that.
+       */
+
+      if (recvd < room && SSL_Pending(s->sslSock) == 0) {
+         break;
+      }
+   }
+
+exit:
+   s->inRecvLoop = FALSE;
+   AsyncTCPSocketRelease(s);
+
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketFillRecvBuffer --
+ *
+ *      Called when an asock has data ready to be read via the poll callback.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if everything worked,
+ *      ASOCKERR_REMOTE_DISCONNECT if peer closed connection gracefully,
+ *      ASOCKERR_CLOSED if trying to read from a closed socket.
+ *      ASOCKERR_GENERIC for other errors.
+ *
+ * Side effects:
+ *      Reads data, could fire recv completion or trigger socket destruction.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketFillRecvBuffer(AsyncTCPSocket *s)         // IN
+{
+   int recvd;
+   int needed;
+   int sysErr = 0;
+   int result;
+   int pending = 0;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketConnected);
+
+   if (s->recvBufferedFn != NULL) {
+      result = AsyncTCPSocketFillRecvBuffered(s);
+
+      /*
+       * Go on if the callback replaced itself with a regular recv.
+       */
+
+      if (result != ASOCKERR_SUCCESS || s->recvBufferedFn != NULL ||
+          s->base.recvBuf == NULL) {
+         return result;
+      }
+   }
+
+   /*
+    * When a socket has received all its desired content and FillRecvBuffer is
+    * called again for the same socket, just return ASOCKERR_SUCCESS. The
+    * reason we need this hack is that if a client which registered a receive
+    * callback asynchronously later changes its mind to do it synchronously,
+    * (e.g. aioMgr wait function), then FillRecvBuffer can be potentially be
+    * called twice for the same receive event.
+    */
+
+   needed = s->base.recvLen - s->base.recvPos;
+   if (!s->base.recvBuf && needed == 0) {
+      return ASOCKERR_SUCCESS;
+   }
+
+   ASSERT(needed > 0);
+
+   AsyncTCPSocketAddRef(s);
+
+   /*
+    * See comment in AsyncTCPSocket_Recv
+    */
+
+   s->inRecvLoop = TRUE;
+
+   do {
+
+      /*
+       * Try to read the remaining bytes to complete the current recv request.
+       */
+
+      if (ASOCK_RECV_AHEAD_AVAIL(s) > 0) {
+         recvd = AsyncTCPSocketRecvAheadCopy(s,
+                                             (uint8 *) s->base.recvBuf +
+                                             s->base.recvPos,
+                                             needed);
+      } else if (s->passFd.expected) {
+         int fd;
+
+         recvd = SSL_RecvDataAndFd(s->sslSock,
+                                   (uint8 *) s->base.recvBuf +
+                                   s->base.recvPos,
+                                   needed, &fd);
+         AsyncTCPSocketCountRecv(s, recvd);
+         if (fd != -1) {
+            s->passFd.fd = fd;
+            s->passFd.expected = FALSE;
+         }
+      } else if (needed < ASOCK_RECV_AHEAD_SIZE &&
+                 AsyncTCPSocketCanReadAhead(s)) {
+         /*
+          * Small request: read whatever is there, the rest serves the
+          * requests that follow without another system call.
+          */
+
+         recvd = AsyncTCPSocketRecvAheadFill(s);
+         if (recvd > 0) {
+            recvd = AsyncTCPSocketRecvAheadCopy(s,
+                                                (uint8 *) s->base.recvBuf +
+                                                s->base.recvPos,
+                                                needed);
+         }
+      } else {
+         recvd = SSL_Read(s->sslSock,
+                          (uint8 *) s->base.recvBuf +
+                          s->base.recvPos,
+                          needed);
+         AsyncTCPSocketCountRecv(s, recvd);
+      }
+      /*
+       * Do NOT make any system call directly or indirectly here
+       * unless you can preserve the system error number
+       */
+      if (recvd > 0) {
+         TCPSOCKLOG(3, s, "need\t%d\trecv\t%d\tremain\t%d\n", needed, recvd,
+                    needed - recvd);
+         s->sslConnected = TRUE;
+         s->base.recvPos += recvd;
+         if (AsyncSocketCheckAndDispatchRecv(&s->base, &result)) {
+            goto exit;
+         }
+      } else if (recvd == 0) {
+         TCPSOCKLG0(s, "recv detected client closed connection\n");
+         /*
+          * We treat this as an error so that the owner can detect closing
+          * of connection by peer (via the error handler callback).
+          */
+         result = ASOCKERR_REMOTE_DISCONNECT;
+         goto exit;
+      } else if ((sysErr = ASOCK_LASTERROR()) == ASOCK_EWOULDBLOCK) {
+         TCPSOCKLOG(4, s, "recv would block\n");
+         break;
+      } else {
+         TCPSOCKLG0(s, "recv error %d: %s\n", sysErr, Err_Errno2String(sysErr));
+         s->genericErrno = sysErr;
+         result = ASOCKERR_GENERIC;
+         goto exit;
+      }
+
+      /*
+       * At this point, s->recvFoo have been updated to point to the
+       * next chained Recv buffer. By default we're done at this
+       * point, but we may want to continue if data was read ahead or the
+       * SSL socket has data buffered in userspace already (SSL_Pending).
+       */
+
+      needed = s->base.recvLen - s->base.recvPos;
+      ASSERT(needed > 0);
+
+      pending = ASOCK_RECV_AHEAD_AVAIL(s) + SSL_Pending(s->sslSock);
+      needed = MIN(needed, pending);
+
+   } while (needed);
+
+   /*
+    * Reach this point only when previous pending count is 0 or
+    * error is ASOCK_EWOULDBLOCK
+    */
+
+   ASSERT(pending == 0 || sysErr == ASOCK_EWOULDBLOCK);
+
+   /*
+    * Both a spurious wakeup and receiving any data even if it wasn't enough
+    * to fire the callback are both success.  We were ready and now
+    * presumably we aren't ready anymore.
+    */
+
+   result = ASOCKERR_SUCCESS;
+
+exit:
+   s->inRecvLoop = FALSE;
+   AsyncTCPSocketRelease(s);
+
+   return result;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketFireSentBuffers --
+ *
+ *      Free a list of sent buffers and call their callbacks, in order.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, or ASOCKERR_CLOSED if a callback closed the socket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketFireSentBuffers(AsyncTCPSocket *s,     // IN
+                              SendBufList *list)     // IN: list to consume
+{
+   Bool fired = FALSE;
+
+   while (list != NULL) {
+      SendBufList tmp = *list;
+
+      free(list);
+      list = tmp.next;
+
+      if (tmp.sendFn) {
+         /*
+          * Firing the send completion cannot trigger immediate
+          * destruction of the socket because we hold a refCount across
+          * this and all other application callbacks.  Callbacks of the
+          * rest of the list still fire if the socket gets closed, their
+          * buffers are already with the kernel.
+          */
+         ASSERT(s->base.refCount > 1);
+         TOOLS_PROBE2(asock__send__done, BaseSocket(s), tmp.len);
+         tmp.sendFn(tmp.buf, tmp.len, BaseSocket(s), tmp.clientData);
+         fired = TRUE;
+      }
+   }
+
+   /*
+    * If the socket is closed, we need to bubble the information up to the
+    * caller in the same way as we do in the Recv callback case.
+    */
+   if (fired && AsyncTCPSocketGetState(s) == AsyncSocketClosed) {
+      TCPSOCKLG0(s, "owner closed connection in send callback\n");
+      return ASOCKERR_CLOSED;
+   }
+
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketDispatchSentBuffers --
+ *
+ *      Account for bytes handed to the kernel: advance sendPos, pop the
+ *      buffers completed by them off the send buffer list and call their
+ *      callbacks. Buffers sent with MSG_ZEROCOPY, and any behind them, are
+ *      moved to the zero-copy list instead until the kernel releases them.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, or ASOCKERR_CLOSED if a callback closed the socket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketDispatchSentBuffers(AsyncTCPSocket *s,  // IN
+                                  int sent)           // IN: bytes sent
+{
+   SendBufList *done = NULL;
+   SendBufList **doneTail = &done;
+
+   /*
+    * We do the list management *first*, so that the list is in a
+    * consistent state if a callback sends more.
+    */
+
+   while (sent > 0) {
+      SendBufList *head = s->sendBufList;
+      int size = head->passFd == -1 ? head->len : 1;
+      int chunk = MIN(sent, size - s->sendPos);
+
+      s->sendPos += chunk;
+      sent -= chunk;
+      if (s->sendPos < size) {
+         ASSERT(sent == 0);
+         break;
+      }
+
+      s->sendBufList = head->next;
+      if (s->sendBufList == NULL) {
+         s->sendBufTail = &(s->sendBufList);
+      }
+      s->sendPos = 0;
+      head->next = NULL;
+
+#ifdef ASOCK_ZEROCOPY
+      if (head->zeroCopy || s->zeroCopyList != NULL) {
+         if (!head->zeroCopy) {
+            head->zeroCopySeq = s->zeroCopyNext - 1;
+         }
+         *s->zeroCopyTail = head;
+         s->zeroCopyTail = &(head->next);
+         continue;
+      }
+#endif
+
+      *doneTail = head;
+      doneTail = &(head->next);
+   }
+
+   return AsyncTCPSocketFireSentBuffers(s, done);
+}
+
+
+#ifdef ASOCK_ZEROCOPY
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketReapZeroCopy --
+ *
+ *      Drain the zero-copy completions from the socket error queue and
+ *      call the callbacks of the buffers the kernel has released. TCP
+ *      completes zero-copy sends in order, so the highest completed
+ *      sequence number covers all earlier sends.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, or ASOCKERR_CLOSED if a callback closed the socket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketReapZeroCopy(AsyncTCPSocket *s)  // IN
+{
+   SendBufList *done = NULL;
+   SendBufList **doneTail = &done;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   if (s->zeroCopyList == NULL) {
+      return ASOCKERR_SUCCESS;
+   }
+
+   for (;;) {
+      union {
+         struct cmsghdr cmsghdr;
+         char cbuf[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+      } cbuf_un;
+      struct msghdr msghdr = {0};
+      struct cmsghdr *cmsghdr;
+
+      msghdr.msg_control = cbuf_un.cbuf;
+      msghdr.msg_controllen = sizeof cbuf_un.cbuf;
+      if (recvmsg(s->fd, &msghdr, MSG_ERRQUEUE) < 0) {
+         break;
+      }
+
+      for (cmsghdr = CMSG_FIRSTHDR(&msghdr);
+           cmsghdr != NULL;
+           cmsghdr = CMSG_NXTHDR(&msghdr, cmsghdr)) {
+         const struct sock_extended_err *serr;
+
+         if (cmsghdr->cmsg_len < CMSG_LEN(sizeof *serr)) {
+            continue;
+         }
+         serr = (const struct sock_extended_err *)CMSG_DATA(cmsghdr);
+         if (serr->ee_errno != 0 ||
+             serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+            continue;
+         }
+         if ((serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0) {
+            TCPSOCKLOG(2, s, "zero-copy send %u-%u was copied\n",
+                       serr->ee_info, serr->ee_data);
+         }
+         if ((int32)(serr->ee_data + 1 - s->zeroCopyDone) > 0) {
+            s->zeroCopyDone = serr->ee_data + 1;
+         }
+      }
+   }
+
+   while (s->zeroCopyList != NULL &&
+          (int32)(s->zeroCopyDone - s->zeroCopyList->zeroCopySeq) > 0) {
+      SendBufList *head = s->zeroCopyList;
+
+      s->zeroCopyList = head->next;
+      if (s->zeroCopyList == NULL) {
+         s->zeroCopyTail = &(s->zeroCopyList);
+      }
+      head->next = NULL;
+      *doneTail = head;
+      doneTail = &(head->next);
+   }
+
+   return AsyncTCPSocketFireSentBuffers(s, done);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketZeroCopyCallback --
+ *
+ *      Timer reaping zero-copy completions of a socket with nothing more
+ *      to send. Reschedules itself while buffers are outstanding.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Could fire send completions or trigger socket destruction.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketZeroCopyCallback(void *clientData)  // IN
+{
+   AsyncTCPSocket *s = clientData;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   AsyncTCPSocketAddRef(s);
+   s->zeroCopyCb = FALSE;
+   if (AsyncTCPSocketReapZeroCopy(s) == ASOCKERR_SUCCESS &&
+       s->zeroCopyList != NULL) {
+      VMwareStatus pollStatus;
+
+      pollStatus = AsyncTCPSocketPollAdd(s, FALSE, 0,
+                                         AsyncTCPSocketZeroCopyCallback,
+                                         ASOCK_ZEROCOPY_REAP_US);
+      VERIFY(pollStatus == VMWARE_STATUS_SUCCESS);
+      s->zeroCopyCb = TRUE;
+   }
+   AsyncTCPSocketRelease(s);
+}
+#endif
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketPassFd --
+ *
+ *      Send a file descriptor on the TCP socket.
+ *
+ * Results:
+ *      1 if successful, -1 if not.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketPassFd(int socket,  // IN:
+                     int passFd)  // IN:
+{
+#ifndef _WIN32
    static unsigned char byte = 0;
    union {
       struct cmsghdr cmsghdr;
@@ -3734,6 +4471,69 @@ AsyncTCPSocketPassFd(int socket,  // IN:
 }
 
 
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketWriteV --
+ *
+ *      Write the head of the send buffer list, from sendPos, together with
+ *      the buffers queued behind it in one sendmsg() call. Gathering stops
+ *      at a buffer carrying a file descriptor. A buffer large enough for
+ *      MSG_ZEROCOPY is sent alone, so each zero-copy send maps to one
+ *      buffer.
+ *
+ * Results:
+ *      Bytes sent, or -1 with errno set.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketWriteV(AsyncTCPSocket *s,  // IN
+                     int *left,          // OUT: bytes offered
+                     Bool *zeroCopy)     // OUT: sent with MSG_ZEROCOPY
+{
+   struct iovec iov[ASOCK_SEND_IOV_MAX];
+   SendBufList *cur = s->sendBufList;
+   int pos = s->sendPos;
+   int iovcnt = 0;
+
+   *left = 0;
+   *zeroCopy = ASOCK_USE_ZEROCOPY(s, cur);
+
+   do {
+      iov[iovcnt].iov_base = (uint8 *) cur->buf + pos;
+      iov[iovcnt].iov_len = cur->len - pos;
+      *left += cur->len - pos;
+      iovcnt++;
+      pos = 0;
+      cur = cur->next;
+   } while (!*zeroCopy && iovcnt < ASOCK_SEND_IOV_MAX && cur != NULL &&
+            cur->passFd == -1 && !ASOCK_USE_ZEROCOPY(s, cur) &&
+            cur->len <= MAX_INT32 - *left);
+
+#ifdef ASOCK_ZEROCOPY
+   if (*zeroCopy) {
+      int sent = SSL_WriteV(s->sslSock, iov, iovcnt, MSG_ZEROCOPY);
+
+      if (sent >= 0 || errno != ENOBUFS) {
+         return sent;
+      }
+
+      /* Out of memory for pinning pages, copy this one. */
+      *zeroCopy = FALSE;
+   }
+#endif
+
+   return SSL_WriteV(s->sslSock, iov, iovcnt, 0);
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -3741,7 +4541,8 @@ AsyncTCPSocketPassFd(int socket,  // IN:
  *
  *      The meat of AsyncTCPSocket's sending functionality.  This function
  *      actually writes to the wire assuming there's space in the buffers
- *      for the socket.
+ *      for the socket.  Consecutive queued buffers go out in one sendmsg()
+ *      call where the platform supports it.
  *
  * Results:
  *      ASOCKERR_SUCCESS if everything worked, else ASOCKERR_GENERIC.
@@ -3770,18 +4571,29 @@ AsyncTCPSocketWriteBuffers(AsyncTCPSocket *s)  // IN
 
    AsyncTCPSocketAddRef(s);
 
+#ifdef ASOCK_ZEROCOPY
+   result = AsyncTCPSocketReapZeroCopy(s);
+   if (result != ASOCKERR_SUCCESS) {
+      goto exit;
+   }
+#endif
+
    while (s->sendBufList && AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
       SendBufList *head = s->sendBufList;
       int error = 0;
       int sent = 0;
-      int left = head->len - s->sendPos;
-      int sizeToSend = head->len;
+      int left = 1;
+      Bool zeroCopy = FALSE;
 
       if (head->passFd == -1) {
+#ifdef _WIN32
+         left = head->len - s->sendPos;
          sent = SSL_Write(s->sslSock,
                           (uint8 *) head->buf + s->sendPos, left);
+#else
+         sent = AsyncTCPSocketWriteV(s, &left, &zeroCopy);
+#endif
       } else {
-         sizeToSend = 1;
          sent = AsyncTCPSocketPassFd(s->fd, head->passFd);
       }
       /*
@@ -3793,11 +4605,18 @@ AsyncTCPSocketWriteBuffers(AsyncTCPSocket *s)  // IN
                     left, sent, left - sent);
          s->sendBufFull = FALSE;
          s->sslConnected = TRUE;
-         if ((s->sendPos += sent) == sizeToSend) {
-            result = AsyncTCPSocketDispatchSentBuffer(s);
-            if (result != ASOCKERR_SUCCESS) {
-               goto exit;
-            }
+         AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_SEND_CALLS, 1);
+         if (head->passFd == -1) {
+            AsyncSocketStatsAdd(BaseSocket(s), ASOCK_STAT_BYTES_SENT, sent);
+            AsyncSocketStatsQueue(BaseSocket(s), -sent);
+         }
+         if (zeroCopy) {
+            head->zeroCopy = TRUE;
+            head->zeroCopySeq = s->zeroCopyNext++;
+         }
+         result = AsyncTCPSocketDispatchSentBuffers(s, sent);
+         if (result != ASOCKERR_SUCCESS) {
+            goto exit;
          }
       } else if (sent == 0) {
          TCPSOCKLG0(s, "socket write() should never return 0.\n");
@@ -3825,6 +4644,19 @@ AsyncTCPSocketWriteBuffers(AsyncTCPSocket *s)  // IN
       }
    }
 
+#ifdef ASOCK_ZEROCOPY
+   if (s->zeroCopyList != NULL && !s->zeroCopyCb &&
+       AsyncTCPSocketGetState(s) == AsyncSocketConnected) {
+      VMwareStatus pollStatus;
+
+      pollStatus = AsyncTCPSocketPollAdd(s, FALSE, 0,
+                                         AsyncTCPSocketZeroCopyCallback,
+                                         ASOCK_ZEROCOPY_REAP_US);
+      VERIFY(pollStatus == VMWARE_STATUS_SUCCESS);
+      s->zeroCopyCb = TRUE;
+   }
+#endif
+
    result = ASOCKERR_SUCCESS;
 
 exit:
@@ -3837,44 +4669,43 @@ exit:
 /*
  *----------------------------------------------------------------------------
  *
- * AsyncTCPSocketAcceptInternal --
+ * AsyncTCPSocketAcceptFd --
  *
- *      The meat of 'accept'.  This function can be invoked either via a
- *      poll callback or blocking. We call accept to get the new socket fd,
- *      create a new asock, and call the newFn callback previously supplied
- *      by the call to AsyncTCPSocket_Listen.
+ *      Call accept on a listening socket.
  *
  * Results:
- *      ASOCKERR_SUCCESS if everything works, else an error code.
- *      ASOCKERR_GENERIC is returned to hide accept() system call's
- *        nitty-gritty, it implies that we should try accept() again and not
- *        report error to client.
- *      ASOCKERR_ACCEPT to report accept operation's error to client.
+ *      ASOCKERR_SUCCESS with the new fd and its remote address, else an
+ *      error code as for AsyncTCPSocketAcceptInternal. s->genericErrno is
+ *      ASOCK_EWOULDBLOCK if no connection was waiting.
  *
  * Side effects:
- *      Accepts on listening fd, creates new asock.
+ *      Accepts on listening fd.
  *
  *----------------------------------------------------------------------------
  */
 
 static int
-AsyncTCPSocketAcceptInternal(AsyncTCPSocket *s)         // IN
+AsyncTCPSocketAcceptFd(AsyncTCPSocket *s,                     // IN
+                       int *outFd,                            // OUT
+                       struct sockaddr_storage *remoteAddr,   // OUT
+                       socklen_t *remoteAddrLen)              // OUT
 {
-   AsyncTCPSocket *newsock;
    int sysErr;
    int fd;
-   struct sockaddr_storage remoteAddr;
-   socklen_t remoteAddrLen = sizeof remoteAddr;
 
    ASSERT(AsyncTCPSocketIsLocked(s));
    ASSERT(AsyncTCPSocketGetState(s) == AsyncSocketListening);
 
-   if ((fd = accept(s->fd, (struct sockaddr *)&remoteAddr,
-                    &remoteAddrLen)) == -1) {
+   *remoteAddrLen = sizeof *remoteAddr;
+   if ((fd = accept(s->fd, (struct sockaddr *)remoteAddr,
+                    remoteAddrLen)) == -1) {
       sysErr = ASOCK_LASTERROR();
       s->genericErrno = sysErr;
       if (sysErr == ASOCK_EWOULDBLOCK) {
-         TCPSOCKWARN(s, "spurious accept notification\n");
+         /* The accept distributor takes connections until none is left. */
+         if (s->acceptDist == NULL) {
+            TCPSOCKWARN(s, "spurious accept notification\n");
+         }
 #if TARGET_OS_IPHONE
          /*
           * For iOS, while the app is suspended and device's screen is locked,
@@ -3909,9 +4740,9 @@ AsyncTCPSocketAcceptInternal(AsyncTCPSocket *s)         // IN
       }
    }
 
-   if (remoteAddr.ss_family == AF_INET6 &&
+   if (remoteAddr->ss_family == AF_INET6 &&
        AsyncTCPSocketOSVersionSupportsV4Mapped()) {
-      struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)&remoteAddr;
+      struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *)remoteAddr;
 
       /*
        * Remote address should not be a V4MAPPED address. Validate for the rare
@@ -3928,25 +4759,120 @@ AsyncTCPSocketAcceptInternal(AsyncTCPSocket *s)         // IN
       }
    }
 
-   newsock = AsyncTCPSocketAttachToFd(fd, AsyncTCPSocketPollParams(s), NULL);
+   *outFd = fd;
+
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptAttach --
+ *
+ *      Create the asock of an accepted fd, bound to the given loop of the
+ *      listener's loop group, and call the newFn callback previously
+ *      supplied by the call to AsyncTCPSocket_Listen.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS, or ASOCKERR_ACCEPT if the asock can't be created.
+ *
+ * Side effects:
+ *      Creates new asock, or closes fd on failure.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketAcceptAttach(AsyncTCPSocket *s,                           // IN
+                           int fd,                                      // IN
+                           const struct sockaddr_storage *remoteAddr,   // IN
+                           socklen_t remoteAddrLen,                     // IN
+                           PollLoop *loop)                              // IN/OPT
+{
+   AsyncTCPSocket *newsock;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   if (AsyncTCPSocketPollParams(s)->loopGroup != NULL) {
+      AsyncSocketPollParams params = *AsyncTCPSocketPollParams(s);
+
+      ASSERT(loop != NULL);
+      params.loop = loop;
+      params.loopGroup = NULL;
+      params.lock = Poll_LoopGetLock(params.loop);
+      newsock = AsyncTCPSocketAttachToFd(fd, &params, NULL);
+   } else {
+      newsock = AsyncTCPSocketAttachToFd(fd, AsyncTCPSocketPollParams(s),
+                                         NULL);
+   }
    if (!newsock) {
       SSLGeneric_close(fd);
 
-      return ASOCKERR_ACCEPT;
+      return ASOCKERR_ACCEPT;
+   }
+
+   newsock->remoteAddr = *remoteAddr;
+   newsock->remoteAddrLen = remoteAddrLen;
+   AsyncTCPSocketSetState(newsock, AsyncSocketConnected);
+   newsock->internalRecvFn = s->internalRecvFn;
+   newsock->internalSendFn = s->internalSendFn;
+
+   /*
+    * Fire the connect callback, with the new socket locked as it is when
+    * it shares the lock of the listener.
+    */
+   AsyncTCPSocketLock(newsock);
+   s->connectFn(BaseSocket(newsock), s->clientData);
+   AsyncTCPSocketUnlock(newsock);
+
+   return ASOCKERR_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptInternal --
+ *
+ *      The meat of 'accept'.  This function can be invoked either via a
+ *      poll callback or blocking. We call accept to get the new socket fd,
+ *      create a new asock, and call the newFn callback previously supplied
+ *      by the call to AsyncTCPSocket_Listen. The connection of a listener
+ *      with a loop group is bound to the least loaded loop.
+ *
+ * Results:
+ *      ASOCKERR_SUCCESS if everything works, else an error code.
+ *      ASOCKERR_GENERIC is returned to hide accept() system call's
+ *        nitty-gritty, it implies that we should try accept() again and not
+ *        report error to client.
+ *      ASOCKERR_ACCEPT to report accept operation's error to client.
+ *
+ * Side effects:
+ *      Accepts on listening fd, creates new asock.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketAcceptInternal(AsyncTCPSocket *s)         // IN
+{
+   struct sockaddr_storage remoteAddr;
+   socklen_t remoteAddrLen;
+   PollLoop *loop = NULL;
+   int error;
+   int fd;
+
+   error = AsyncTCPSocketAcceptFd(s, &fd, &remoteAddr, &remoteAddrLen);
+   if (error != ASOCKERR_SUCCESS) {
+      return error;
    }
 
-   newsock->remoteAddr = remoteAddr;
-   newsock->remoteAddrLen = remoteAddrLen;
-   AsyncTCPSocketSetState(newsock, AsyncSocketConnected);
-   newsock->internalRecvFn = s->internalRecvFn;
-   newsock->internalSendFn = s->internalSendFn;
-
-   /*
-    * Fire the connect callback:
-    */
-   s->connectFn(BaseSocket(newsock), s->clientData);
+   if (AsyncTCPSocketPollParams(s)->loopGroup != NULL) {
+      loop = Poll_LoopGroupPick(AsyncTCPSocketPollParams(s)->loopGroup);
+   }
 
-   return ASOCKERR_SUCCESS;
+   return AsyncTCPSocketAcceptAttach(s, fd, &remoteAddr, remoteAddrLen, loop);
 }
 
 
@@ -4711,6 +5637,7 @@ AsyncTCPSocketCancelCbForClose(AsyncSocket *base)  // IN:
       asock->recvCb = FALSE;
       asock->base.recvBuf = NULL;
    }
+   asock->recvBufferedFn = NULL;
 
    if (asock->sendCb) {
       TCPSOCKLOG(1, asock,
@@ -4733,13 +5660,39 @@ AsyncTCPSocketCancelCbForClose(AsyncSocket *base)  // IN:
       asock->sendCbTimer = FALSE;
    }
 
+#ifdef ASOCK_ZEROCOPY
+   if (asock->zeroCopyCb) {
+      removed = AsyncTCPSocketPollRemove(asock, FALSE, 0,
+                                         AsyncTCPSocketZeroCopyCallback);
+      ASSERT(removed || AsyncTCPSocketPollParams(asock)->iPoll);
+      asock->zeroCopyCb = FALSE;
+   }
+#endif
+
+   AsyncTCPSocketAddRef(asock);
+
+   /*
+    * Buffers waiting for a zero-copy completion were fully submitted to
+    * the kernel, fire their callbacks first to keep them in order.
+    */
+   while (asock->zeroCopyList) {
+      SendBufList *cur = asock->zeroCopyList;
+
+      asock->zeroCopyList = cur->next;
+      if (cur->sendFn) {
+         TOOLS_PROBE2(asock__send__done, BaseSocket(asock), cur->len);
+         cur->sendFn(cur->buf, cur->len, BaseSocket(asock), cur->clientData);
+      }
+      free(cur);
+   }
+   asock->zeroCopyTail = &(asock->zeroCopyList);
+
    /*
     * Go through any send buffers on the list and fire their
     * callbacks, reflecting back how much of each buffer has been
     * submitted to the kernel.  For the first buffer in the list that
     * may be non-zero, for subsequent buffers it will be zero.
     */
-   AsyncTCPSocketAddRef(asock);
    while (asock->sendBufList) {
       /*
        * Pop each remaining buffer and fire its completion callback.
@@ -4756,6 +5709,8 @@ AsyncTCPSocketCancelCbForClose(AsyncSocket *base)  // IN:
       }
       free(cur);
    }
+   AsyncSocketStatsQueue(BaseSocket(asock),
+                         -(int64)asock->base.sendQueueBytes);
    AsyncTCPSocketRelease(asock);
    return ASOCKERR_SUCCESS;
 }
@@ -4896,6 +5851,7 @@ AsyncTCPSocketClose(AsyncSocket *base)   // IN
          TCPSOCKLOG(1, asock,
                     "old state was listening, removing accept callback\n");
          AsyncTCPSocketCancelListenCb(asock);
+         AsyncTCPSocketAcceptDistDestroy(asock);
          break;
 
       case AsyncSocketConnecting:
@@ -4991,7 +5947,7 @@ AsyncTCPSocketIsSendBufferFull(AsyncSocket *base)         // IN
  *
  * AsyncTCPSocketHasDataPending --
  *
- *      Determine if SSL has any pending/unread data.
+ *      Determine if data was read ahead or SSL has any pending/unread data.
  *
  * Results:
  *      TRUE if this socket has pending data.
@@ -5005,7 +5961,7 @@ AsyncTCPSocketIsSendBufferFull(AsyncSocket *base)         // IN
 static Bool
 AsyncTCPSocketHasDataPending(AsyncTCPSocket *asock)   // IN:
 {
-   return SSL_Pending(asock->sslSock);
+   return ASOCK_RECV_AHEAD_AVAIL(asock) > 0 || SSL_Pending(asock->sslSock);
 }
 
 
@@ -5091,7 +6047,11 @@ AsyncTCPSocketAcceptCallback(void *clientData)         // IN
    ASSERT(AsyncTCPSocketIsLocked(asock));
 
    AsyncTCPSocketAddRef(asock);
-   retval = AsyncTCPSocketAcceptInternal(asock);
+   if (asock->acceptDist != NULL) {
+      retval = AsyncTCPSocketAcceptDistribute(asock);
+   } else {
+      retval = AsyncTCPSocketAcceptInternal(asock);
+   }
 
    /*
     * See comment for return value of AsyncTCPSocketAcceptInternal().
@@ -5164,6 +6124,8 @@ static void
 AsyncTCPSocketRecvCallback(void *clientData)         // IN
 {
    AsyncTCPSocket *asock = clientData;
+   Bool pending;
+   uint64 recvd;
    int error;
 
    ASSERT(asock);
@@ -5171,9 +6133,29 @@ AsyncTCPSocketRecvCallback(void *clientData)         // IN
 
    AsyncTCPSocketAddRef(asock);
 
+#ifdef ASOCK_ZEROCOPY
+   /*
+    * Pending zero-copy completions raise POLLERR, which lands here.
+    */
+   if (AsyncTCPSocketReapZeroCopy(asock) != ASOCKERR_SUCCESS) {
+      AsyncTCPSocketRelease(asock);
+      return;
+   }
+#endif
+
+   /*
+    * A wakeup is empty if nothing was buffered and the socket had no data.
+    */
+
+   pending = AsyncTCPSocketHasDataPending(asock);
+   recvd = asock->base.stats[ASOCK_STAT_BYTES_RECVD];
+
    error = AsyncTCPSocketFillRecvBuffer(asock);
    if (error == ASOCKERR_GENERIC || error == ASOCKERR_REMOTE_DISCONNECT) {
       AsyncTCPSocketHandleError(asock, error);
+   } else if (!pending &&
+              asock->base.stats[ASOCK_STAT_BYTES_RECVD] == recvd) {
+      AsyncSocketStatsAdd(BaseSocket(asock), ASOCK_STAT_EMPTY_WAKEUPS, 1);
    }
 
    AsyncTCPSocketRelease(asock);
@@ -5418,6 +6400,18 @@ AsyncTCPSocketPollAdd(AsyncTCPSocket *asock,         // IN
       return AsyncTCPSocketIPollAdd(asock, socket, flags, callback, info);
    }
 
+   if (AsyncTCPSocketPollParams(asock)->loopGroup != NULL) {
+      return AsyncTCPSocketGroupPollAdd(asock, flags, callback, type, info);
+   }
+
+   if (AsyncTCPSocketPollParams(asock)->loop != NULL) {
+      return Poll_LoopCallback(AsyncTCPSocketPollParams(asock)->loop,
+                               AsyncTCPSocketPollParams(asock)->pollClass,
+                               flags | AsyncTCPSocketPollParams(asock)->flags,
+                               callback, asock, type, info,
+                               AsyncTCPSocketPollParams(asock)->lock);
+   }
+
    return Poll_Callback(AsyncTCPSocketPollParams(asock)->pollClass,
                         flags | AsyncTCPSocketPollParams(asock)->flags,
                         callback, asock, type, info,
@@ -5462,12 +6456,403 @@ AsyncTCPSocketPollRemove(AsyncTCPSocket *asock,         // IN
       type = POLL_REALTIME;
    }
 
+   if (AsyncTCPSocketPollParams(asock)->loopGroup != NULL) {
+      return AsyncTCPSocketGroupPollRemove(asock, flags, callback, type);
+   }
+
+   if (AsyncTCPSocketPollParams(asock)->loop != NULL) {
+      return Poll_LoopCallbackRemove(AsyncTCPSocketPollParams(asock)->loop,
+                                     AsyncTCPSocketPollParams(asock)->pollClass,
+                                     flags |
+                                     AsyncTCPSocketPollParams(asock)->flags,
+                                     callback, asock, type);
+   }
+
    return Poll_CallbackRemove(AsyncTCPSocketPollParams(asock)->pollClass,
                               flags | AsyncTCPSocketPollParams(asock)->flags,
                               callback, asock, type);
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketGroupPollAdd --
+ *
+ *    Set up the accept distributor of a listener with a loop group, and
+ *    add its accept callback to the least loaded loop of the group.
+ *
+ * Results:
+ *    VMwareStatus result code from Poll_LoopCallback.
+ *
+ * Side effects:
+ *    None on failure.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VMwareStatus
+AsyncTCPSocketGroupPollAdd(AsyncTCPSocket *asock,         // IN
+                           int flags,                     // IN
+                           PollerFunction callback,       // IN
+                           PollEventType type,            // IN
+                           PollDevHandle info)            // IN
+{
+   AsyncSocketPollParams *params = AsyncTCPSocketPollParams(asock);
+   AsyncTCPSocketAcceptDist *dist = asock->acceptDist;
+   Bool created = FALSE;
+   VMwareStatus status;
+
+   ASSERT(callback == AsyncTCPSocketAcceptCallback);
+   ASSERT(params->lock != NULL);
+
+   if (dist == NULL) {
+      unsigned int i;
+
+      dist = Util_SafeCalloc(1, sizeof *dist);
+      dist->acceptLoop = Poll_LoopGroupPick(params->loopGroup);
+      dist->numQueues = Poll_LoopGroupSize(params->loopGroup);
+      dist->queues = Util_SafeCalloc(dist->numQueues, sizeof *dist->queues);
+      for (i = 0; i < dist->numQueues; i++) {
+         AsyncTCPSocketAcceptQueue *queue = &dist->queues[i];
+
+         queue->listener = asock;
+         queue->loop = Poll_LoopGroupGet(params->loopGroup, i);
+         queue->tail = &queue->head;
+      }
+      asock->acceptDist = dist;
+      created = TRUE;
+   }
+
+   status = Poll_LoopCallback(dist->acceptLoop, params->pollClass,
+                              flags | params->flags, callback, asock, type,
+                              info, params->lock);
+   if (status != VMWARE_STATUS_SUCCESS && created) {
+      AsyncTCPSocketAcceptDistDestroy(asock);
+   }
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketGroupPollRemove --
+ *
+ *    Remove the accept callback of a listener with a loop group.
+ *
+ * Results:
+ *    TRUE if removed, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+AsyncTCPSocketGroupPollRemove(AsyncTCPSocket *asock,         // IN
+                              int flags,                     // IN
+                              PollerFunction callback,       // IN
+                              PollEventType type)            // IN
+{
+   AsyncSocketPollParams *params = AsyncTCPSocketPollParams(asock);
+
+   if (asock->acceptDist == NULL) {
+      return FALSE;
+   }
+   return Poll_LoopCallbackRemove(asock->acceptDist->acceptLoop,
+                                  params->pollClass, flags | params->flags,
+                                  callback, asock, type);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptPickQueue --
+ *
+ *    Pick the queue of the loop with the fewest devices and connections
+ *    queued.
+ *
+ * Results:
+ *    The queue.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static AsyncTCPSocketAcceptQueue *
+AsyncTCPSocketAcceptPickQueue(AsyncTCPSocketAcceptDist *dist)  // IN
+{
+   AsyncTCPSocketAcceptQueue *best = NULL;
+   unsigned int bestLoad = 0;
+   unsigned int i;
+
+   for (i = 0; i < dist->numQueues; i++) {
+      AsyncTCPSocketAcceptQueue *queue = &dist->queues[i];
+      unsigned int load = Poll_LoopGetLoad(queue->loop) + queue->count;
+
+      if (best == NULL || load < bestLoad) {
+         best = queue;
+         bestLoad = load;
+      }
+   }
+   return best;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptScheduleDrain --
+ *
+ *    Make the loop of a queue bind its queued connections, on its next
+ *    pass after the delay.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Registers a timer on the loop of the queue. If that fails, an
+ *    undelayed drain happens right away instead.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketAcceptScheduleDrain(AsyncTCPSocketAcceptQueue *queue,  // IN
+                                  VmTimeType delayUs)                // IN
+{
+   AsyncTCPSocket *s = queue->listener;
+   AsyncSocketPollParams *params = AsyncTCPSocketPollParams(s);
+   VMwareStatus status;
+
+   if (queue->drainCb) {
+      return;
+   }
+
+   status = Poll_LoopCallback(queue->loop, params->pollClass, params->flags,
+                              AsyncTCPSocketAcceptDrainCallback, queue,
+                              POLL_REALTIME, delayUs, params->lock);
+   if (status == VMWARE_STATUS_SUCCESS) {
+      queue->drainCb = TRUE;
+   } else if (delayUs == 0) {
+      TCPSOCKWARN(s, "could not schedule accepted connections, binding "
+                  "them to the accepting loop\n");
+      AsyncTCPSocketAcceptDrainCallback(queue);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptDistribute --
+ *
+ *    Accept callback of a listener with a loop group: take the waiting
+ *    connections, up to ASOCK_ACCEPT_BATCH, and queue each to a loop of
+ *    the group.
+ *
+ * Results:
+ *    ASOCKERR_SUCCESS, or an error code as for AsyncTCPSocketAcceptInternal
+ *    if no connection could be taken.
+ *
+ * Side effects:
+ *    Accepts on listening fd.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+AsyncTCPSocketAcceptDistribute(AsyncTCPSocket *s)  // IN
+{
+   unsigned int accepted = 0;
+   unsigned int tries;
+   int error = ASOCKERR_SUCCESS;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+   ASSERT(s->acceptDist != NULL);
+
+   /* A failed drain schedule binds inline, which may close the listener. */
+   for (tries = 0; tries < ASOCK_ACCEPT_BATCH && s->acceptDist != NULL;
+        tries++) {
+      AsyncTCPSocketPendingConn *conn = Util_SafeMalloc(sizeof *conn);
+      AsyncTCPSocketAcceptQueue *queue;
+
+      error = AsyncTCPSocketAcceptFd(s, &conn->fd, &conn->remoteAddr,
+                                     &conn->remoteAddrLen);
+      if (error != ASOCKERR_SUCCESS) {
+         free(conn);
+         if (error == ASOCKERR_GENERIC &&
+             s->genericErrno != ASOCK_EWOULDBLOCK) {
+            continue;
+         }
+         break;
+      }
+      accepted++;
+
+      queue = AsyncTCPSocketAcceptPickQueue(s->acceptDist);
+      conn->queuedUs = Hostinfo_SystemTimerUS();
+      conn->next = NULL;
+      *queue->tail = conn;
+      queue->tail = &conn->next;
+      queue->count++;
+      AsyncTCPSocketAcceptScheduleDrain(queue, 0);
+   }
+
+   if (accepted > 0) {
+      TCPSOCKLOG(2, s, "accepted %u connections\n", accepted);
+      return ASOCKERR_SUCCESS;
+   }
+   return error;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptDrainCallback --
+ *
+ *    Timer callback binding the queued connections of a loop to it. Once
+ *    its own queue is empty, the loop steals from the longest queue of the
+ *    other loops the connections they have not got to in time, and checks
+ *    again later for those which are not late yet.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Creates new asocks, fires newFn callbacks.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketAcceptDrainCallback(void *clientData)  // IN
+{
+   AsyncTCPSocketAcceptQueue *queue = clientData;
+   AsyncTCPSocket *s = queue->listener;
+   PollLoop *loop = queue->loop;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   AsyncTCPSocketAddRef(s);
+   queue->drainCb = FALSE;
+
+   /* The connect callback may close the listener, freeing the queues. */
+   while (s->acceptDist != NULL) {
+      AsyncTCPSocketAcceptDist *dist = s->acceptDist;
+      AsyncTCPSocketAcceptQueue *victim = queue;
+      AsyncTCPSocketPendingConn *conn;
+      struct sockaddr_storage remoteAddr;
+      socklen_t remoteAddrLen;
+      int fd;
+
+      if (victim->count == 0) {
+         VmTimeType lateUs = Hostinfo_SystemTimerUS() - ASOCK_ACCEPT_STEAL_US;
+         Bool pending = FALSE;
+         unsigned int i;
+
+         victim = NULL;
+         for (i = 0; i < dist->numQueues; i++) {
+            AsyncTCPSocketAcceptQueue *other = &dist->queues[i];
+
+            if (other->count == 0) {
+               continue;
+            }
+            if (other->head->queuedUs > lateUs) {
+               pending = TRUE;
+            } else if (victim == NULL || other->count > victim->count) {
+               victim = other;
+            }
+         }
+         if (victim == NULL) {
+            if (pending) {
+               AsyncTCPSocketAcceptScheduleDrain(queue,
+                                                 ASOCK_ACCEPT_STEAL_US);
+            }
+            break;
+         }
+         TCPSOCKLOG(2, s, "loop %p steals a connection from loop %p\n",
+                    loop, victim->loop);
+      }
+
+      conn = victim->head;
+      victim->head = conn->next;
+      if (victim->head == NULL) {
+         victim->tail = &victim->head;
+      }
+      victim->count--;
+
+      fd = conn->fd;
+      remoteAddr = conn->remoteAddr;
+      remoteAddrLen = conn->remoteAddrLen;
+      free(conn);
+
+      AsyncTCPSocketAcceptAttach(s, fd, &remoteAddr, remoteAddrLen, loop);
+   }
+
+   AsyncTCPSocketRelease(s);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AsyncTCPSocketAcceptDistDestroy --
+ *
+ *    Tear down the accept distributor of a closing listener, closing the
+ *    connections still queued.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Removes the drain timers.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+AsyncTCPSocketAcceptDistDestroy(AsyncTCPSocket *s)  // IN
+{
+   AsyncTCPSocketAcceptDist *dist = s->acceptDist;
+   unsigned int i;
+
+   ASSERT(AsyncTCPSocketIsLocked(s));
+
+   if (dist == NULL) {
+      return;
+   }
+
+   for (i = 0; i < dist->numQueues; i++) {
+      AsyncTCPSocketAcceptQueue *queue = &dist->queues[i];
+
+      if (queue->drainCb) {
+         Poll_LoopCallbackRemove(queue->loop,
+                                 AsyncTCPSocketPollParams(s)->pollClass,
+                                 AsyncTCPSocketPollParams(s)->flags,
+                                 AsyncTCPSocketAcceptDrainCallback, queue,
+                                 POLL_REALTIME);
+      }
+      while (queue->head != NULL) {
+         AsyncTCPSocketPendingConn *conn = queue->head;
+
+         queue->head = conn->next;
+         SSLGeneric_close(conn->fd);
+         free(conn);
+      }
+   }
+
+   s->acceptDist = NULL;
+   free(dist->queues);
+   free(dist);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -5655,6 +7040,7 @@ AsyncTCPSocketCancelRecv(AsyncSocket *base,          // IN
 
    AsyncTCPSocketCancelRecvCb(asock);
    AsyncSocketCancelRecv(BaseSocket(asock), partialRecvd, recvBuf, recvFn);
+   asock->recvBufferedFn = NULL;
 
    if (asock->passFd.fd != -1) {
       SSLGeneric_close(asock->passFd.fd);
@@ -5729,12 +7115,19 @@ AsyncTCPSocketConnectSSL(AsyncSocket *base,           // IN
    AsyncTCPSocket *asock = TCPSocket(base);
    ASSERT(asock);
 
+   VmTimeType start = Hostinfo_SystemTimerUS();
+   Bool ok;
+
    if (sslContext == NULL) {
       sslContext = SSL_DefaultContext();
    }
 
-   return SSL_ConnectAndVerifyWithContext(asock->sslSock, verifyParam,
-                                          hostname, sslContext);
+   ok = SSL_ConnectAndVerifyWithContext(asock->sslSock, verifyParam,
+                                        hostname, sslContext);
+   if (ok) {
+      AsyncTCPSocketCountHandshake(asock, start);
+   }
+   return ok;
 #else
    return FALSE;
 #endif
@@ -5766,11 +7159,18 @@ AsyncTCPSocketAcceptSSL(AsyncSocket *base,  // IN
    AsyncTCPSocket *asock = TCPSocket(base);
    ASSERT(asock);
 
+   VmTimeType start = Hostinfo_SystemTimerUS();
+   Bool ok;
+
    if (sslCtx) {
-      return SSL_AcceptWithContext(asock->sslSock, sslCtx);
+      ok = SSL_AcceptWithContext(asock->sslSock, sslCtx);
    } else {
-      return SSL_Accept(asock->sslSock);
+      ok = SSL_Accept(asock->sslSock);
    }
+   if (ok) {
+      AsyncTCPSocketCountHandshake(asock, start);
+   }
+   return ok;
 #else
    return FALSE;
 #endif
@@ -5812,6 +7212,7 @@ AsyncTCPSocketSslConnectCallback(void *clientData)  // IN
 
    sslOpCode = SSL_TryCompleteConnect(asock->sslSock);
    if (sslOpCode > 0) {
+      AsyncTCPSocketCountHandshake(asock, asock->sslStartUs);
       (*asock->sslConnectFn)(TRUE, BaseSocket(asock), asock->clientData);
    } else if (sslOpCode < 0) {
       (*asock->sslConnectFn)(FALSE, BaseSocket(asock), asock->clientData);
@@ -5895,6 +7296,7 @@ AsyncTCPSocketStartSslConnect(AsyncSocket *base,                    // IN
 
    asock->sslConnectFn = sslConnectFn;
    asock->clientData = clientData;
+   asock->sslStartUs = Hostinfo_SystemTimerUS();
 
    AsyncTCPSocketSslConnectCallback(asock);
    return ASOCKERR_SUCCESS;
@@ -5938,6 +7340,7 @@ AsyncTCPSocketSslAcceptCallback(void *clientData)         // IN
 
    sslOpCode = SSL_TryCompleteAccept(asock->sslSock);
    if (sslOpCode > 0) {
+      AsyncTCPSocketCountHandshake(asock, asock->sslStartUs);
       (*asock->sslAcceptFn)(TRUE, BaseSocket(asock), asock->clientData);
    } else if (sslOpCode < 0) {
       (*asock->sslAcceptFn)(FALSE, BaseSocket(asock), asock->clientData);
@@ -6017,6 +7420,7 @@ AsyncTCPSocketStartSslAccept(AsyncSocket *base,                  // IN
 
    asock->sslAcceptFn = sslAcceptFn;
    asock->clientData = clientData;
+   asock->sslStartUs = Hostinfo_SystemTimerUS();
 
    AsyncTCPSocketSslAcceptCallback(asock);
    return ASOCKERR_SUCCESS;
@@ -6040,7 +7444,8 @@ AsyncTCPSocketStartSslAccept(AsyncSocket *base,                  // IN
  *           TCP_NODELAY, TCP_KEEPINTVL, TCP_KEEPIDLE, TCP_KEEPCNT.
  *
  *         - layer = ASYNC_SOCKET_OPTS_LAYER_BASE, optID (type) =
- *           ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE (Bool).
+ *           ASYNC_SOCKET_OPT_SEND_LOW_LATENCY_MODE (Bool),
+ *           ASYNC_SOCKET_OPT_SEND_ZEROCOPY_MIN (int).
  *
  * Results:
  *      ASOCKERR_SUCCESS on success, ASOCKERR_* otherwise.
@@ -6094,6 +7499,38 @@ AsyncTCPSocketSetOption(AsyncSocket *asyncSocket,     // IN/OUT
       return ASOCKERR_SUCCESS;
    }
 
+   if ((layer == ASYNC_SOCKET_OPTS_LAYER_BASE) &&
+       (optID == ASYNC_SOCKET_OPT_SEND_ZEROCOPY_MIN)) {
+#ifdef ASOCK_ZEROCOPY
+      int zeroCopyMin;
+
+      ASSERT(inBufLen == sizeof(int));
+      zeroCopyMin = MAX(*((const int *)valuePtr), 0);
+      if (zeroCopyMin > 0 && tcpSocket->zeroCopyMin == 0) {
+         int on = 1;
+
+         if (setsockopt(tcpSocket->fd, SOL_SOCKET, SO_ZEROCOPY,
+                        &on, sizeof on) != 0) {
+            tcpSocket->genericErrno = Err_Errno();
+            TCPSOCKLG0(tcpSocket,
+                       "%s: could not enable SO_ZEROCOPY; "
+                           "error [%d: %s].\n",
+                        __FUNCTION__, tcpSocket->genericErrno,
+                        Err_Errno2String(tcpSocket->genericErrno));
+            return ASOCKERR_GENERIC;
+         }
+      }
+      tcpSocket->zeroCopyMin = zeroCopyMin;
+      TCPSOCKLG0(tcpSocket, "%s: sendZeroCopyMin set to [%d].\n",
+                 __FUNCTION__, tcpSocket->zeroCopyMin);
+      return ASOCKERR_SUCCESS;
+#else
+      TCPSOCKLG0(tcpSocket, "%s: zero-copy send is not supported.\n",
+                 __FUNCTION__);
+      return ASOCKERR_INVAL;
+#endif
+   }
+
    /*
     * Handle native (setsockopt()) options from this point on.
     *
@@ -6227,6 +7664,17 @@ AsyncTCPSocketGetOption(AsyncSocket *asyncSocket,     // IN/OUT
       return ASOCKERR_SUCCESS;
    }
 
+   if ((layer == ASYNC_SOCKET_OPTS_LAYER_BASE) &&
+       (optID == ASYNC_SOCKET_OPT_SEND_ZEROCOPY_MIN)) {
+      ASSERT(*outBufLen >= sizeof(int));
+      *outBufLen = sizeof(int);
+      *((int *)valuePtr) = tcpSocket->zeroCopyMin;
+      TCPSOCKLG0(tcpSocket,
+                 "%s: sendZeroCopyMin is [%d].\n",
+                  __FUNCTION__, tcpSocket->zeroCopyMin);
+      return ASOCKERR_SUCCESS;
+   }
+
    isSupported = FALSE;
    if (layer == SOL_SOCKET) {
       switch (optID) {
@@ -6298,6 +7746,7 @@ AsyncTCPSocketGetOption(AsyncSocket *asyncSocket,     // IN/OUT
 static void
 AsyncTCPSocketDestroy(AsyncSocket *base)         // IN/OUT
 {
+   free(TCPSocket(base)->recvAhead.buf);
    free(base);
 }
 
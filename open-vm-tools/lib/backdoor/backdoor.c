@@ -177,6 +177,12 @@ BackdoorPrintHbProtoStruct(Backdoor_proto_hb *myBp)
 #   define BACKDOOR_LOG_HB_PROTO_STRUCT(x)
 #endif
 
+/*
+ * Exit counters for Backdoor_GetStats. They are not updated atomically, so
+ * they are approximate when several threads use the backdoor at once.
+ */
+static BackdoorStats backdoorStats;
+
 #if defined(USE_HYPERCALL)
 /* Setting 'backdoorInterface' is idempotent, no atomic access is required. */
 static BackdoorInterface backdoorInterface = BACKDOOR_INTERFACE_NONE;
@@ -252,6 +258,12 @@ Backdoor_ForceLegacy(Bool force)
       BackdoorGetInterface();
    }
 }
+#else
+void
+Backdoor_ForceLegacy(Bool force)
+{
+   /* The I/O port interface is the only one. */
+}
 #endif
 
 
@@ -312,13 +324,14 @@ BackdoorHbVmmcallValgrind(uint16 tid, Backdoor_proto_hb *myBp)
 #endif
 #endif
 
-void
-Backdoor(Backdoor_proto *myBp) // IN/OUT
+static void
+BackdoorLb(Backdoor_proto *myBp,          // IN/OUT
+           BackdoorInterface interface)   // IN
 {
-   BackdoorInterface interface = BackdoorGetInterface();
    ASSERT(myBp);
 
    myBp->in.ax.word = BDOOR_MAGIC;
+   backdoorStats.exits++;
 
    switch (interface) {
    case BACKDOOR_INTERFACE_IO:
@@ -372,6 +385,76 @@ Backdoor(Backdoor_proto *myBp) // IN/OUT
 }
 
 
+void
+Backdoor(Backdoor_proto *myBp) // IN/OUT
+{
+   BackdoorLb(myBp, BackdoorGetInterface());
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Backdoor_Batch --
+ *
+ *      Send several low-bandwidth requests to vmware, in order, filling in
+ *      the reply of each. All of them go through the same backdoor
+ *      interface, which is looked up once.
+ *
+ *      The backdoor protocol carries a single command per exit, so this
+ *      still costs one exit per request; it saves the per-call setup and
+ *      keeps the call sites simple.
+ *
+ * Result:
+ *      None
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Backdoor_Batch(Backdoor_proto *bps,   // IN/OUT
+               size_t count)          // IN
+{
+   BackdoorInterface interface = BackdoorGetInterface();
+   size_t i;
+
+   ASSERT(bps != NULL || count == 0);
+
+   for (i = 0; i < count; i++) {
+      BackdoorLb(&bps[i], interface);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Backdoor_GetStats --
+ *
+ *      Get the number of backdoor exits made by this process (or kernel
+ *      module) and the bytes moved by high-bandwidth exits.
+ *
+ * Result:
+ *      None
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Backdoor_GetStats(BackdoorStats *stats)   // OUT
+{
+   ASSERT(stats);
+
+   *stats = backdoorStats;
+}
+
+
 void
 BackdoorHb(Backdoor_proto_hb *myBp, // IN/OUT
            Bool outbound)           // IN
@@ -380,6 +463,9 @@ BackdoorHb(Backdoor_proto_hb *myBp, // IN/OUT
    ASSERT(myBp);
 
    myBp->in.ax.word = BDOOR_MAGIC;
+   backdoorStats.exits++;
+   backdoorStats.hbExits++;
+   backdoorStats.hbBytes += myBp->in.size;
 
    switch (interface) {
    case BACKDOOR_INTERFACE_IO:
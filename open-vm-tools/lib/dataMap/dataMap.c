@@ -72,6 +72,16 @@ typedef union {
 typedef struct {
    DMFieldType type;
    DMFieldValue value;
+
+   /*
+    * Entries of a map deserialized with DataMap_DeserializeView refer to
+    * the caller's buffer: strings are not copied ('borrowed'), and lists
+    * are only decoded when they are first asked for; until then 'raw'
+    * points to the encoded value, 'rawLen' bytes long.
+    */
+   const char *raw;
+   int32 rawLen;
+   Bool borrowed;
 } DataMapEntry;
 
 /* structure used in hashMap iteration callback */
@@ -88,6 +98,7 @@ typedef struct {
    uint32 maxStrLen;      /* max number of bytes to print for each string */
    FieldIdNameEntry *fieldIdList;   /* array for field ID to name mapping */
    uint32 fieldIdListLen; /* fieldIdList size */
+   uint32 needed;         /* bytes the encoding needs, written or not */
 } ClientData;
 
 static const uint64 magic_cookie = 0x4d41474943ULL;   /* 'MAGIC' */
@@ -121,6 +132,9 @@ AddEntry_Int64(DataMap *that,      // IN/OUT
    }
    entry->type = DMFIELDTYPE_INT64;
    entry->value.number.val = value;
+   entry->raw = NULL;
+   entry->rawLen = 0;
+   entry->borrowed = FALSE;
    if (!HashMap_Put(that->map, &key, &entry)) {
       return DMERR_INSUFFICIENT_MEM;
    }
@@ -160,6 +174,9 @@ AddEntry_String(DataMap *that,      // IN/OUT
    entry->type = DMFIELDTYPE_STRING;
    entry->value.string.str = str;
    entry->value.string.length = strLen;
+   entry->raw = NULL;
+   entry->rawLen = 0;
+   entry->borrowed = FALSE;
 
    if (!HashMap_Put(that->map, &key, &entry)) {
       return DMERR_INSUFFICIENT_MEM;
@@ -201,6 +218,9 @@ AddEntry_Int64List(DataMap *that,            // IN/OUT
    entry->type = DMFIELDTYPE_INT64LIST;
    entry->value.numList.numbers = numbers;
    entry->value.numList.length = listLen;
+   entry->raw = NULL;
+   entry->rawLen = 0;
+   entry->borrowed = FALSE;
 
    if (!HashMap_Put(that->map, &key, &entry)) {
       return DMERR_INSUFFICIENT_MEM;
@@ -247,8 +267,64 @@ AddEntry_StringList(DataMap *that,            // IN/OUT
    entry->type = DMFIELDTYPE_STRINGLIST;
    entry->value.strList.strings = strList;
    entry->value.strList.lengths = strLens;
+   entry->raw = NULL;
+   entry->rawLen = 0;
+   entry->borrowed = FALSE;
+
+   if (!HashMap_Put(that->map, &key, &entry)) {
+      return DMERR_INSUFFICIENT_MEM;
+   }
+   return DMERR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * AddEntry_Borrowed --
+ *
+ *      Low level helper function to add an entry of a view to the map.
+ *      - 'raw': for a string, the string; for a list, its encoding. This
+ *        points into the buffer of the view, which must outlive the map.
+ *
+ * Result:
+ *      0 on success
+ *      error code otherwise
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ErrorCode
+AddEntry_Borrowed(DataMap *that,            // IN/OUT
+                  DMKeyType key,            // IN
+                  DMFieldType type,         // IN
+                  const char *raw,          // IN
+                  int32 rawLen)             // IN
+{
+   DataMapEntry *entry = (DataMapEntry *)malloc(sizeof(DataMapEntry));
+
+   if (entry == NULL) {
+      return DMERR_INSUFFICIENT_MEM;
+   }
+   entry->type = type;
+   if (type == DMFIELDTYPE_STRING) {
+      entry->value.string.str = (char *)raw;
+      entry->value.string.length = rawLen;
+      entry->raw = NULL;
+      entry->rawLen = 0;
+      entry->borrowed = TRUE;
+   } else {
+      ASSERT(type == DMFIELDTYPE_INT64LIST || type == DMFIELDTYPE_STRINGLIST);
+      entry->raw = raw;
+      entry->rawLen = rawLen;
+      entry->borrowed = FALSE;
+   }
 
    if (!HashMap_Put(that->map, &key, &entry)) {
+      free(entry);
       return DMERR_INSUFFICIENT_MEM;
    }
    return DMERR_SUCCESS;
@@ -293,12 +369,14 @@ FreeStringList(char **strList,    // IN
  * FreeEntryPayload --
  *
  *      - low level helper function to free entry payload only
+ *      - nothing is freed for the parts of the payload which are still in
+ *        the buffer of a view, see DataMap_DeserializeView.
  *
  * Result:
  *      None
  *
  * Side-effects:
- *      None
+ *      The entry no longer refers to the buffer of a view.
  *
  *-----------------------------------------------------------------------------
  */
@@ -310,22 +388,37 @@ FreeEntryPayload(DataMapEntry *entry)    // IN
       return;
    }
 
+   if (entry->raw != NULL) {
+      /* a list which was never decoded */
+      entry->raw = NULL;
+      entry->rawLen = 0;
+      return;
+   }
+
    switch(entry->type) {
       case DMFIELDTYPE_INT64:
          break;
       case DMFIELDTYPE_STRING:
-         free(entry->value.string.str);
+         if (!entry->borrowed) {
+            free(entry->value.string.str);
+         }
          break;
       case DMFIELDTYPE_INT64LIST:
          free(entry->value.numList.numbers);
          break;
       case DMFIELDTYPE_STRINGLIST:
-         FreeStringList(entry->value.strList.strings,
-                        entry->value.strList.lengths);
+         if (entry->borrowed) {
+            free(entry->value.strList.lengths);
+            free(entry->value.strList.strings);
+         } else {
+            FreeStringList(entry->value.strList.strings,
+                           entry->value.strList.lengths);
+         }
          break;
       default:
          ASSERT(0);    /*  we do not expect this to happen */
    }
+   entry->borrowed = FALSE;
 }
 
 
@@ -498,6 +591,7 @@ EncodeString(char **buf,         // IN/OUT
  * DecodeString --
  *
  *      - low level helper function to decode a string from  a byte buffer
+ *      - 'borrow': *str points into the buffer rather than to a copy.
  *
  * Result:
  *      None
@@ -511,6 +605,7 @@ EncodeString(char **buf,         // IN/OUT
 static ErrorCode
 DecodeString(char **buf,         // IN/OUT
              int32 *left,        // IN/OUT
+             Bool borrow,        // IN
              char **str,         // OUT
              int32 *strLen)      // OUT
 {
@@ -530,6 +625,13 @@ DecodeString(char **buf,         // IN/OUT
       return DMERR_TRUNCATED_DATA;
    }
 
+   if (borrow) {
+      *str = *buf;
+      *buf += *strLen;
+      *left -= *strLen;
+      return res;
+   }
+
    *str = (char *)malloc(*strLen);
    if (*str == NULL) {
       return DMERR_INSUFFICIENT_MEM;
@@ -585,6 +687,8 @@ EncodeInt64List(char **buf,        // IN/OUT
  *               on success.
  *      - 'left': indicates number of bytes left in the input buffer, *left is
  *                updated accordingly on success.
+ *      - 'numList': on success, the list, to be freed by the caller. NULL
+ *                   for an empty list.
  *
  * Result:
  *      None
@@ -598,47 +702,254 @@ EncodeInt64List(char **buf,        // IN/OUT
 static ErrorCode
 DecodeInt64List(char **buf,        // IN/OUT
                 int32 *left,       // IN/OUT
-                DMKeyType fieldId, // IN
-                DataMap *that)     // OUT
+                int64 **numList,   // OUT
+                int32 *listLen)    // OUT
 {
-   int32 listLen;
-   int64 *numList = NULL;
    ErrorCode res;
    int32 i;
 
-   res = DecodeInt32(buf, left, &listLen);
+   *numList = NULL;
+
+   res = DecodeInt32(buf, left, listLen);
    if (res != DMERR_SUCCESS) {
       return res;
    }
 
-   if (listLen < 0 || listLen > *left / sizeof(int64)) {
+   if (*listLen < 0 || *listLen > *left / sizeof(int64)) {
       /* listLen can be zero to support an empty list */
       return DMERR_BAD_DATA;
    }
 
-   if (listLen) {
-      numList = (int64 *)malloc(sizeof(int64) * listLen);
-      if (numList == NULL) {
+   if (*listLen) {
+      *numList = (int64 *)malloc(sizeof(int64) * *listLen);
+      if (*numList == NULL) {
          return DMERR_INSUFFICIENT_MEM;
       }
 
-      for(i = 0; i< listLen; i++) {
-         res = DecodeInt64(buf, left, numList + i);
+      for(i = 0; i< *listLen; i++) {
+         res = DecodeInt64(buf, left, *numList + i);
          if (res != DMERR_SUCCESS) {
+            free(*numList);
+            *numList = NULL;
             break;
          }
       }
    }
 
-   if (res == DMERR_SUCCESS) {
-      res = AddEntry_Int64List(that, fieldId, numList, listLen);
+   return res;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DecodeStringList --
+ *
+ *      Decode a string list entry
+ *      - 'buf': *buf points to the input buffer. *buf is advanced accordingly
+ *               on success.
+ *      - 'left': indicates number of bytes left in the input buffer, *left is
+ *                updated accordingly on success.
+ *      - 'borrow': the strings point into the buffer rather than to copies;
+ *                  only the two arrays are allocated.
+ *      - 'strList', 'strLens': on success, the list as DataMap_SetStringList
+ *                              takes it.
+ *
+ * Result:
+ *      None
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ErrorCode
+DecodeStringList(char **buf,           // IN
+                 int32 *left,          // IN
+                 Bool borrow,          // IN
+                 char ***strList,      // OUT
+                 int32 **strLens)      // OUT
+{
+   ErrorCode res;
+   int32 listSize;
+   char **list;
+   int32 *lens;
+   int32 i;
+
+   res = DecodeInt32(buf, left, &listSize);
+   if (res != DMERR_SUCCESS) {
+      return res;
+   }
+
+   if (listSize < 0 || listSize > *left / sizeof(int32)) {
+      /* listSize can be zero to support an empty list */
+      return DMERR_BAD_DATA;
+   }
+
+   list = (char **)calloc(listSize + 1, sizeof(char *));
+   if (list == NULL) {
+      return DMERR_INSUFFICIENT_MEM;
+   }
+   if (listSize) {
+      lens = (int32 *)malloc(sizeof(int32) * listSize);
+      if (lens == NULL) {
+         free(list);
+         return DMERR_INSUFFICIENT_MEM;
+      }
+   } else {
+      lens = NULL;
+   }
+
+   for (i = 0; i < listSize; i++) {
+      res = DecodeString(buf, left, borrow, &list[i], &lens[i]);
+      if (res != DMERR_SUCCESS) {
+         break;
+      }
+   }
+
+   if (res != DMERR_SUCCESS) {
+      if (borrow) {
+         free(lens);
+         free(list);
+      } else {
+         FreeStringList(list, lens);
+      }
+      return res;
    }
 
+   *strList = list;
+   *strLens = lens;
+   return DMERR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SkipList --
+ *
+ *      Check the encoding of a list, without decoding it.
+ *      - 'buf': *buf points to the input buffer. *buf is advanced past the
+ *               list on success.
+ *      - 'left': indicates number of bytes left in the input buffer, *left is
+ *                updated accordingly on success.
+ *
+ * Result:
+ *      The error DecodeInt64List or DecodeStringList would return.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ErrorCode
+SkipList(DMFieldType type,    // IN
+         char **buf,          // IN/OUT
+         int32 *left)         // IN/OUT
+{
+   ErrorCode res;
+   int32 listSize;
+   int32 i;
+
+   res = DecodeInt32(buf, left, &listSize);
    if (res != DMERR_SUCCESS) {
-      /* clean up memory */
-      free(numList);
+      return res;
+   }
+
+   if (type == DMFIELDTYPE_INT64LIST) {
+      if (listSize < 0 || listSize > *left / sizeof(int64)) {
+         return DMERR_BAD_DATA;
+      }
+      *buf += listSize * sizeof(int64);
+      *left -= listSize * sizeof(int64);
+      return DMERR_SUCCESS;
+   }
+
+   ASSERT(type == DMFIELDTYPE_STRINGLIST);
+
+   if (listSize < 0 || listSize > *left / sizeof(int32)) {
+      return DMERR_BAD_DATA;
+   }
+
+   for (i = 0; i < listSize; i++) {
+      int32 strLen;
+
+      res = DecodeInt32(buf, left, &strLen);
+      if (res != DMERR_SUCCESS) {
+         return res;
+      }
+      if (strLen <= 0) {
+         return DMERR_BAD_DATA;
+      }
+      if (*left < strLen) {
+         return DMERR_TRUNCATED_DATA;
+      }
+      *buf += strLen;
+      *left -= strLen;
+   }
+
+   return DMERR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DecodeRawEntry --
+ *
+ *      Decode a list of a view, which was left in the buffer by
+ *      DataMap_DeserializeView. The strings of a string list are not copied.
+ *
+ * Result:
+ *      0 on success
+ *      error code otherwise, the entry is left as it was.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ErrorCode
+DecodeRawEntry(DataMapEntry *entry)    // IN/OUT
+{
+   char *buf = (char *)entry->raw;
+   int32 left = entry->rawLen;
+   ErrorCode res;
+
+   ASSERT(entry->raw != NULL);
+
+   if (entry->type == DMFIELDTYPE_INT64LIST) {
+      int64 *numList;
+      int32 listLen;
+
+      res = DecodeInt64List(&buf, &left, &numList, &listLen);
+      if (res == DMERR_SUCCESS) {
+         entry->value.numList.numbers = numList;
+         entry->value.numList.length = listLen;
+      }
+   } else {
+      char **strList;
+      int32 *strLens;
+
+      ASSERT(entry->type == DMFIELDTYPE_STRINGLIST);
+
+      res = DecodeStringList(&buf, &left, TRUE, &strList, &strLens);
+      if (res == DMERR_SUCCESS) {
+         entry->value.strList.strings = strList;
+         entry->value.strList.lengths = strLens;
+         entry->borrowed = TRUE;
+      }
    }
 
+   if (res == DMERR_SUCCESS) {
+      /* the buffer was checked by SkipList */
+      ASSERT(left == 0);
+      entry->raw = NULL;
+      entry->rawLen = 0;
+   }
    return res;
 }
 
@@ -1159,6 +1470,13 @@ HashMapToStringEntryCb(void *key,            // IN
       return;
    }
 
+   if (entry->raw != NULL) {
+      clientData->result = DecodeRawEntry(entry);
+      if (clientData->result != DMERR_SUCCESS) {
+         return;
+      }
+   }
+
    if (clientData->fieldIdList!= NULL) {
       int32 cc;
       for (cc = 0; cc < clientData->fieldIdListLen; cc ++) {
@@ -1253,12 +1571,13 @@ HashMapToStringEntryCb(void *key,            // IN
 /*
  *-----------------------------------------------------------------------------
  *
- * HashMapCalcEntrySizeCb --
+ * CalcEntrySize --
  *
  *      - calculate how much space is needed to encode an entry
  *
  * Result:
- *      None
+ *      0 on success, *size is the size.
+ *      error code otherwise.
  *
  * Side-effects:
  *      None
@@ -1266,43 +1585,38 @@ HashMapToStringEntryCb(void *key,            // IN
  *-----------------------------------------------------------------------------
  */
 
-static void
-HashMapCalcEntrySizeCb(void *key,            // IN
-                       void *data,           // IN
-                       void *userData)       // IN/OUT
+static ErrorCode
+CalcEntrySize(const DataMapEntry *entry,    // IN
+              uint32 *size)                 // OUT
 {
-   DataMapEntry *entry = *((DataMapEntry **)data);
-   ClientData *clientData = (ClientData *)userData;
-   uint32 oldLen = clientData->buffLen;
-   uint32 *buffLen = &(clientData->buffLen);
+   uint32 oldLen;
 
-   if (clientData->result != DMERR_SUCCESS) {
-      /* a previous error has occurred, so stop. */
-      return;
+   *size = sizeof(int32);            /* type */
+   *size += sizeof(DMKeyType);       /* fieldId */
+   oldLen = *size;
+
+   if (entry->raw != NULL) {
+      /* a list of a view, copied as it is */
+      *size += entry->rawLen;
+      return DMERR_SUCCESS;
    }
 
    switch(entry->type) {
       case DMFIELDTYPE_INT64:
          {
-            *buffLen += sizeof(int32);        /* type */
-            *buffLen += sizeof(DMKeyType);    /* fieldId */
-            *buffLen += sizeof(int64);        /* int value */
+            *size += sizeof(int64);        /* int value */
             break;
          }
       case DMFIELDTYPE_STRING:
          {
-            *buffLen += sizeof(int32);        /* type */
-            *buffLen += sizeof(DMKeyType);    /* fieldId */
-            *buffLen += sizeof(int32);        /* string length */
-            *buffLen += entry->value.string.length; /* string payload */
+            *size += sizeof(int32);        /* string length */
+            *size += entry->value.string.length; /* string payload */
             break;
          }
       case DMFIELDTYPE_INT64LIST:
          {
-            *buffLen += sizeof(int32);        /* type */
-            *buffLen += sizeof(DMKeyType);    /* fieldId */
-            *buffLen += sizeof(int32);        /* list size */
-            *buffLen += sizeof(int64) * entry->value.numList.length;
+            *size += sizeof(int32);        /* list size */
+            *size += sizeof(int64) * entry->value.numList.length;
             break;
          }
       case DMFIELDTYPE_STRINGLIST:
@@ -1310,41 +1624,37 @@ HashMapCalcEntrySizeCb(void *key,            // IN
             char **strPtr = entry->value.strList.strings;
             int32 *lenPtr = entry->value.strList.lengths;
 
-            *buffLen += sizeof(int32);        /* type */
-            *buffLen += sizeof(DMKeyType);    /* fieldId */
-            *buffLen += sizeof(int32);        /* list size */
+            *size += sizeof(int32);        /* list size */
 
             for (; *strPtr != NULL; strPtr++, lenPtr++) {
-               if (*buffLen < oldLen) {
-                  clientData->result = DMERR_INTEGER_OVERFLOW;
-                  return;
+               if (*size < oldLen) {
+                  return DMERR_INTEGER_OVERFLOW;
                }
 
-               *buffLen += sizeof(int32);   /* string length */
-               *buffLen += *lenPtr;        /* string payload */
+               *size += sizeof(int32);   /* string length */
+               *size += *lenPtr;        /* string payload */
             }
             break;
          }
       default:
          {
-            clientData->result = DMERR_UNKNOWN_TYPE;
-            return;
+            return DMERR_UNKNOWN_TYPE;
          }
    }
 
-   if (*buffLen < oldLen) {
-      clientData->result = DMERR_INTEGER_OVERFLOW;
-      return;
+   if (*size < oldLen) {
+      return DMERR_INTEGER_OVERFLOW;
    }
+   return DMERR_SUCCESS;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HashMapSerializeEntryCb --
+ * HashMapCalcEntrySizeCb --
  *
- *      - serialize each entry into a byte buffer
+ *      - calculate how much space is needed to encode the map
  *
  * Result:
  *      None
@@ -1356,17 +1666,63 @@ HashMapCalcEntrySizeCb(void *key,            // IN
  */
 
 static void
-HashMapSerializeEntryCb(void *key,            // IN
-                        void *data,           // IN
-                        void *userData)       // OUT
+HashMapCalcEntrySizeCb(void *key,            // IN
+                       void *data,           // IN
+                       void *userData)       // IN/OUT
 {
    DataMapEntry *entry = *((DataMapEntry **)data);
    ClientData *clientData = (ClientData *)userData;
-   char **buffPtr = &(clientData->buffer);
-   char *buffPtrOrig = clientData->buffer;
+   uint32 size;
+
+   if (clientData->result != DMERR_SUCCESS) {
+      /* a previous error has occurred, so stop. */
+      return;
+   }
+
+   clientData->result = CalcEntrySize(entry, &size);
+   if (clientData->result != DMERR_SUCCESS) {
+      return;
+   }
+
+   if (clientData->buffLen + size < clientData->buffLen) {
+      clientData->result = DMERR_INTEGER_OVERFLOW;
+      return;
+   }
+   clientData->buffLen += size;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * EncodeEntry --
+ *
+ *      - serialize an entry into a byte buffer
+ *      - 'buf': *buf points to the output buffer, *buf is advanced properly.
+ *
+ * Result:
+ *      None
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
 
+static void
+EncodeEntry(DMKeyType fieldId,            // IN
+            const DataMapEntry *entry,    // IN
+            char **buffPtr)               // IN/OUT
+{
    EncodeInt32(buffPtr, entry->type);   /* encode type */
-   EncodeInt32(buffPtr, *((DMKeyType *)key));   /* encode field id*/
+   EncodeInt32(buffPtr, fieldId);       /* encode field id*/
+
+   if (entry->raw != NULL) {
+      /* a list of a view is already encoded */
+      memcpy(*buffPtr, entry->raw, entry->rawLen);
+      *buffPtr += entry->rawLen;
+      return;
+   }
 
    switch(entry->type) {
       case DMFIELDTYPE_INT64:
@@ -1402,22 +1758,15 @@ HashMapSerializeEntryCb(void *key,            // IN
       default:
          ASSERT(0);    /*  we do not expect this to happen */
    }
-
-   /* Update left buffer size so we can do a sanity check at the end */
-   clientData->buffLen -= (clientData->buffer - buffPtrOrig);
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * DecodeStringList --
+ * HashMapSerializeEntryCb --
  *
- *      Decode a string list entry and add to the dataMap
- *      - 'buf': *buf points to the input buffer. *buf is advanced accordingly
- *               on success.
- *      - 'left': indicates number of bytes left in the input buffer, *left is
- *                updated accordingly on success.
+ *      - serialize each entry into a byte buffer
  *
  * Result:
  *      None
@@ -1428,58 +1777,71 @@ HashMapSerializeEntryCb(void *key,            // IN
  *-----------------------------------------------------------------------------
  */
 
-static ErrorCode
-DecodeStringList(char **buf,           // IN
-                 int32 *left,          // IN
-                 DMKeyType fieldId,    // IN
-                 DataMap *that)        // OUT
+static void
+HashMapSerializeEntryCb(void *key,            // IN
+                        void *data,           // IN
+                        void *userData)       // OUT
 {
-   ErrorCode res;
-   int32 listSize;
-   char **strList;
-   int32 *strLens;
-   int32 i;
+   DataMapEntry *entry = *((DataMapEntry **)data);
+   ClientData *clientData = (ClientData *)userData;
+   char *buffPtrOrig = clientData->buffer;
 
-   res = DecodeInt32(buf, left, &listSize);
-   if (res != DMERR_SUCCESS) {
-      return res;
-   }
+   EncodeEntry(*((DMKeyType *)key), entry, &clientData->buffer);
 
-   if (listSize < 0 || listSize > *left / sizeof(int32)) {
-      /* listSize can be zero to support an empty list */
-      return DMERR_BAD_DATA;
-   }
+   /* Update left buffer size so we can do a sanity check at the end */
+   clientData->buffLen -= (clientData->buffer - buffPtrOrig);
+}
 
-   strList = (char **)calloc(listSize + 1, sizeof(char *));
-   if (strList == NULL) {
-      return DMERR_INSUFFICIENT_MEM;
-   }
-   if (listSize) {
-      strLens = (int32 *)malloc(sizeof(int32) * listSize);
-      if (strLens == NULL) {
-         FreeStringList(strList, strLens);
-         return DMERR_INSUFFICIENT_MEM;
-      }
-   } else {
-      strLens = NULL;
-   }
 
-   for (i = 0; i < listSize; i++) {
-      res = DecodeString(buf, left, &strList[i], &strLens[i]);
-      if (res != DMERR_SUCCESS) {
-         break;
-      }
-   }
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HashMapSerializeToEntryCb --
+ *
+ *      - serialize each entry into a byte buffer of a given size, counting
+ *        the space needed once the buffer is full.
+ *
+ * Result:
+ *      None
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
 
-   if (res == DMERR_SUCCESS) {
-      res = AddEntry_StringList(that, fieldId, strList, strLens);
+static void
+HashMapSerializeToEntryCb(void *key,            // IN
+                          void *data,           // IN
+                          void *userData)       // IN/OUT
+{
+   DataMapEntry *entry = *((DataMapEntry **)data);
+   ClientData *clientData = (ClientData *)userData;
+   uint32 size;
+   ErrorCode res;
+
+   if (clientData->result != DMERR_SUCCESS &&
+       clientData->result != DMERR_BUFFER_TOO_SMALL) {
+      /* a previous error has occurred, so stop. */
+      return;
    }
 
+   res = CalcEntrySize(entry, &size);
+   if (res == DMERR_SUCCESS && clientData->needed + size < clientData->needed) {
+      res = DMERR_INTEGER_OVERFLOW;
+   }
    if (res != DMERR_SUCCESS) {
-      FreeStringList(strList, strLens);
+      clientData->result = res;
+      return;
    }
+   clientData->needed += size;
 
-   return res;
+   if (clientData->result == DMERR_SUCCESS && size <= clientData->buffLen) {
+      EncodeEntry(*((DMKeyType *)key), entry, &clientData->buffer);
+      clientData->buffLen -= size;
+   } else {
+      clientData->result = DMERR_BUFFER_TOO_SMALL;
+   }
 }
 
 
@@ -1587,6 +1949,14 @@ HashMapCopyEntryCb(void *key,              // IN
       return;
    }
 
+   if (entry->raw != NULL) {
+      res = DecodeRawEntry(entry);
+      if (res != DMERR_SUCCESS) {
+         clientData->result = res;
+         return;
+      }
+   }
+
    switch(entry->type) {
       case DMFIELDTYPE_INT64:
          res = AddEntry_Int64(dst, fieldId, entry->value.number.val);
@@ -1614,6 +1984,10 @@ HashMapCopyEntryCb(void *key,              // IN
          if (numList == NULL) {
             res = DMERR_INSUFFICIENT_MEM;
          } else {
+            if (entry->value.numList.length > 0) {
+               memcpy(numList, entry->value.numList.numbers,
+                      sizeof(int64) * entry->value.numList.length);
+            }
             res = AddEntry_Int64List(dst, fieldId, numList,
                                      entry->value.numList.length);
             if (res != DMERR_SUCCESS) {
@@ -1827,16 +2201,20 @@ DataMap_Serialize(const DataMap *that,     // IN
 /*
  *-----------------------------------------------------------------------------
  *
- * DataMap_Deserialize --
+ * DataMap_SerializeTo --
  *
- *      Initialize an empty DataMap from a buffer.
- *      - 'that': the given map should *NOT* be initialized by the caller.
- *        On success, the caller needs to call DataMap_Destropy on 'that' to
- *        avoid any memory leak.
+ *     Serialize a DataMap to a buffer supplied by the caller, in one pass
+ *     over the map. For callers which know about how large the encoding
+ *     is, e.g. a packet with a payload and a few numbers.
+ *     - 'buf': the buffer, 'bufSize' bytes long.
+ *     - 'bufLen': on success, the length of the encoding. With
+ *       DMERR_BUFFER_TOO_SMALL, the size the buffer needs to be; its
+ *       content is undefined then.
  *
  * Result:
- *      - 0 on success
- *      - error code on failures.
+ *     0 on success
+ *     DMERR_BUFFER_TOO_SMALL if the encoding does not fit in the buffer.
+ *     error code on other failures.
  *
  * Side-effects:
  *      None
@@ -1845,44 +2223,55 @@ DataMap_Serialize(const DataMap *that,     // IN
  */
 
 ErrorCode
-DataMap_Deserialize(const char *bufIn ,    // IN
-                    const int32 bufLen,    // IN
-                    DataMap *that)         // OUT
+DataMap_SerializeTo(const DataMap *that,     // IN
+                    char *buf,               // OUT
+                    uint32 bufSize,          // IN
+                    uint32 *bufLen)          // OUT
 {
-   ErrorCode res;
-   int32 left = bufLen;   /* number of bytes undecoded */
-   int32 len;
-   char *buf = (char *)bufIn;
+   ClientData clientData;
+   char *lenPtr = buf;
 
-   if (that == NULL || bufIn == NULL || bufLen < 0) {
+   if (that == NULL || buf == NULL || bufLen == NULL) {
       return DMERR_INVALID_ARGS;
    }
 
-   /* decode the encoded buffer length */
-   res = DecodeInt32(&buf, &left, &len);
-   if (res != DMERR_SUCCESS) {
-      return res;
-   }
+   ASSERT(that->cookie == magic_cookie);
 
-   if (len > bufLen - sizeof(int32)) {
-      return DMERR_TRUNCATED_DATA;
+   memset(&clientData, 0, sizeof clientData);
+   clientData.map = (DataMap *)that;
+   clientData.result = DMERR_SUCCESS;
+
+   /* 4 bytes is payload length, encoded at the end */
+   clientData.needed = sizeof(uint32);
+   if (bufSize >= sizeof(uint32)) {
+      clientData.buffer = buf + sizeof(uint32);
+      clientData.buffLen = bufSize - sizeof(uint32);
+   } else {
+      clientData.result = DMERR_BUFFER_TOO_SMALL;
    }
 
-   left = len;
+   HashMap_Iterate(that->map, HashMapSerializeToEntryCb, FALSE, &clientData);
 
-   return DataMap_DeserializeContent(buf, left, that);
+   if (clientData.result == DMERR_SUCCESS) {
+      ASSERT(clientData.buffer - buf == clientData.needed);
+      EncodeInt32(&lenPtr, clientData.needed - sizeof(uint32));
+   }
+   if (clientData.result == DMERR_SUCCESS ||
+       clientData.result == DMERR_BUFFER_TOO_SMALL) {
+      *bufLen = clientData.needed;
+   }
+   return clientData.result;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * DataMap_DeserializeContent --
+ * DeserializeContent --
  *
- *      Initialize an empty DataMap from the content of the data map buffer
- *      - 'that': the given map should *NOT* be initialized by the caller.
- *        On success, the caller needs to call DataMap_Destropy on 'that' to
- *        avoid any memory leak.
+ *      Initialize an empty DataMap from the content of the data map buffer.
+ *      - 'view': strings are not copied and lists are only decoded when
+ *        they are asked for, see DataMap_DeserializeView.
  *
  * Result:
  *      - 0 on success
@@ -1894,10 +2283,11 @@ DataMap_Deserialize(const char *bufIn ,    // IN
  *-----------------------------------------------------------------------------
  */
 
-ErrorCode
-DataMap_DeserializeContent(const char *content,    // IN
-                           const int32 contentLen, // IN
-                           DataMap *that)          // OUT
+static ErrorCode
+DeserializeContent(const char *content,    // IN
+                   const int32 contentLen, // IN
+                   Bool view,              // IN
+                   DataMap *that)          // OUT
 {
    ErrorCode res;
    int32 left = contentLen;   /* number of bytes undecoded */
@@ -1951,10 +2341,14 @@ DataMap_DeserializeContent(const char *content,    // IN
          {
             char *str;
             int32 strLen;
-            res = DecodeString(&buf, &left, &str, &strLen);
+            res = DecodeString(&buf, &left, view, &str, &strLen);
             if (res != DMERR_SUCCESS) {
                goto out;
             }
+            if (view) {
+               res = AddEntry_Borrowed(that, fieldId, type, str, strLen);
+               break;
+            }
             res = AddEntry_String(that, fieldId, str, strLen);
             if (res != DMERR_SUCCESS) {
                /* clean up memory */
@@ -1963,13 +2357,39 @@ DataMap_DeserializeContent(const char *content,    // IN
             break;
          }
          case DMFIELDTYPE_INT64LIST:
-         {
-            res = DecodeInt64List(&buf, &left, fieldId, that);
-            break;
-         }
          case DMFIELDTYPE_STRINGLIST:
          {
-            res = DecodeStringList(&buf, &left, fieldId, that);
+            char *raw = buf;
+
+            if (view) {
+               res = SkipList(type, &buf, &left);
+               if (res == DMERR_SUCCESS) {
+                  res = AddEntry_Borrowed(that, fieldId, type, raw,
+                                          buf - raw);
+               }
+            } else if (type == DMFIELDTYPE_INT64LIST) {
+               int64 *numList;
+               int32 listLen;
+
+               res = DecodeInt64List(&buf, &left, &numList, &listLen);
+               if (res == DMERR_SUCCESS) {
+                  res = AddEntry_Int64List(that, fieldId, numList, listLen);
+                  if (res != DMERR_SUCCESS) {
+                     free(numList);
+                  }
+               }
+            } else {
+               char **strList;
+               int32 *strLens;
+
+               res = DecodeStringList(&buf, &left, FALSE, &strList, &strLens);
+               if (res == DMERR_SUCCESS) {
+                  res = AddEntry_StringList(that, fieldId, strList, strLens);
+                  if (res != DMERR_SUCCESS) {
+                     FreeStringList(strList, strLens);
+                  }
+               }
+            }
             break;
          }
          default:
@@ -1989,6 +2409,151 @@ out:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Deserialize --
+ *
+ *      Initialize an empty DataMap from a buffer, as a copy or as a view.
+ *
+ * Result:
+ *      - 0 on success
+ *      - error code on failures.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ErrorCode
+Deserialize(const char *bufIn ,    // IN
+            const int32 bufLen,    // IN
+            Bool view,             // IN
+            DataMap *that)         // OUT
+{
+   ErrorCode res;
+   int32 left = bufLen;   /* number of bytes undecoded */
+   int32 len;
+   char *buf = (char *)bufIn;
+
+   if (that == NULL || bufIn == NULL || bufLen < 0) {
+      return DMERR_INVALID_ARGS;
+   }
+
+   /* decode the encoded buffer length */
+   res = DecodeInt32(&buf, &left, &len);
+   if (res != DMERR_SUCCESS) {
+      return res;
+   }
+
+   if (len > bufLen - sizeof(int32)) {
+      return DMERR_TRUNCATED_DATA;
+   }
+
+   left = len;
+
+   return DeserializeContent(buf, left, view, that);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DataMap_Deserialize --
+ *
+ *      Initialize an empty DataMap from a buffer.
+ *      - 'that': the given map should *NOT* be initialized by the caller.
+ *        On success, the caller needs to call DataMap_Destropy on 'that' to
+ *        avoid any memory leak.
+ *
+ * Result:
+ *      - 0 on success
+ *      - error code on failures.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+ErrorCode
+DataMap_Deserialize(const char *bufIn ,    // IN
+                    const int32 bufLen,    // IN
+                    DataMap *that)         // OUT
+{
+   return Deserialize(bufIn, bufLen, FALSE, that);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DataMap_DeserializeView --
+ *
+ *      Initialize an empty DataMap from a buffer, without copying it.
+ *      The buffer is checked as DataMap_Deserialize does, but the map only
+ *      records where the fields are: strings returned by DataMap_GetString
+ *      point into the buffer, and lists are decoded the first time they
+ *      are asked for. This suits the common case of a packet of which a
+ *      field or two are read before it is dropped.
+ *      - 'bufIn': must not be modified or freed before 'that' is
+ *        destroyed.
+ *      - 'that': the given map should *NOT* be initialized by the caller.
+ *        On success, the caller needs to call DataMap_Destropy on 'that' to
+ *        avoid any memory leak.
+ *
+ *      The map can be modified like any other; the fields which are set
+ *      no longer refer to the buffer.
+ *
+ * Result:
+ *      - 0 on success
+ *      - error code on failures.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+ErrorCode
+DataMap_DeserializeView(const char *bufIn ,    // IN
+                        const int32 bufLen,    // IN
+                        DataMap *that)         // OUT
+{
+   return Deserialize(bufIn, bufLen, TRUE, that);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DataMap_DeserializeContent --
+ *
+ *      Initialize an empty DataMap from the content of the data map buffer
+ *      - 'that': the given map should *NOT* be initialized by the caller.
+ *        On success, the caller needs to call DataMap_Destropy on 'that' to
+ *        avoid any memory leak.
+ *
+ * Result:
+ *      - 0 on success
+ *      - error code on failures.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+ErrorCode
+DataMap_DeserializeContent(const char *content,    // IN
+                           const int32 contentLen, // IN
+                           DataMap *that)          // OUT
+{
+   return DeserializeContent(content, contentLen, FALSE, that);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -2362,6 +2927,14 @@ DataMap_GetInt64List(const DataMap *that,      // IN
       return DMERR_TYPE_MISMATCH;
    }
 
+   if (entry->raw != NULL) {
+      ErrorCode res = DecodeRawEntry(entry);
+
+      if (res != DMERR_SUCCESS) {
+         return res;
+      }
+   }
+
    *numList = entry->value.numList.numbers;
    *listLen  = entry->value.numList.length;
    return DMERR_SUCCESS;
@@ -2417,6 +2990,14 @@ DataMap_GetStringList(const DataMap *that,      // IN
       return DMERR_TYPE_MISMATCH;
    }
 
+   if (entry->raw != NULL) {
+      ErrorCode res = DecodeRawEntry(entry);
+
+      if (res != DMERR_SUCCESS) {
+         return res;
+      }
+   }
+
    *strList = entry->value.strList.strings;
    *strLens = entry->value.strList.lengths;
    return DMERR_SUCCESS;
@@ -17,6 +17,7 @@
  *********************************************************/
 
 #include <stdlib.h>
+#include <string.h>
 #if defined(_WIN32)
 #  include <winsock2.h>
 #else
@@ -403,6 +404,175 @@ DynXdr_AppendRaw(XDR *xdrs,         // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DynXdr_Reserve --
+ *
+ *    Makes room in the XDR stream's internal dynbuf for at least "size"
+ *    bytes in total, so that encoding that much data does not grow (and
+ *    copy) the buffer. Typically used with DynXdr_Sizeof.
+ *
+ * Results:
+ *    Whether the buffer could be allocated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+DynXdr_Reserve(XDR *xdrs,     // IN
+               size_t size)   // IN
+{
+   DynBuf *intbuf = &((DynXdrData *) xdrs->x_private)->data;
+   return DynBuf_Reserve(intbuf, size);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DynXdrCountBytes --
+ * DynXdrCountInt32 --
+ * DynXdrCountLong --
+ * DynXdrCountGetPos --
+ * DynXdrCountSetPos --
+ * DynXdrCountInline --
+ *
+ *    Operations of the counting stream used by DynXdr_Sizeof. Nothing is
+ *    written, the stream position is the number of bytes encoded so far.
+ *    Inline buffers are not offered, which makes the XDR routines fall back
+ *    to the put operations.
+ *
+ * Results:
+ *    See the DynXdr stream operations above.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static bool_t
+DynXdrCountBytes(XDR *xdrs,                 // IN/OUT
+                 DYNXDR_CONST char *data,   // IN
+                 DYNXDR_SIZE_T len)         // IN
+{
+   xdrs->x_handy += len;
+   return TRUE;
+}
+
+
+#if !defined(USE_TIRPC) &&    \
+     defined(__GLIBC__) ||    \
+     (defined(sun) &&         \
+        (defined(_LP64) ||    \
+           defined(_KERNEL)))
+static bool_t
+DynXdrCountInt32(XDR *xdrs,                       // IN/OUT
+                 DYNXDR_CONST int32_t *ip)        // IN
+{
+   xdrs->x_handy += sizeof *ip;
+   return TRUE;
+}
+#endif
+
+
+static bool_t
+DynXdrCountLong(XDR *xdrs,                    // IN/OUT
+                DYNXDR_CONST DYNXDR_LONG *lp) // IN
+{
+   xdrs->x_handy += sizeof (int32);
+   return TRUE;
+}
+
+
+static u_int
+DynXdrCountGetPos(DYNXDR_GETPOS_CONST XDR *xdrs) // IN
+{
+   return (u_int) xdrs->x_handy;
+}
+
+
+static bool_t
+DynXdrCountSetPos(XDR *xdrs, // IN
+                  u_int pos) // IN
+{
+   if (pos <= (u_int) xdrs->x_handy) {
+      xdrs->x_handy = pos;
+      return TRUE;
+   }
+   return FALSE;
+}
+
+
+static DYNXDR_INLINE_T *
+DynXdrCountInline(XDR *xdrs,                 // IN/OUT
+                  DYNXDR_INLINE_LEN_T len)   // IN
+{
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DynXdr_Sizeof --
+ *
+ *    Measures how many bytes the given XDR routine encodes for "data",
+ *    without encoding anything. Allows the caller to size the output
+ *    buffer up front.
+ *
+ * Results:
+ *    The encoded size, or 0 if the routine failed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+size_t
+DynXdr_Sizeof(xdrproc_t proc,   // IN
+              void *data)       // IN
+{
+   static struct xdr_ops countXdrOps = {
+#if !defined(sun) || (defined(sun) && !defined(_KERNEL))
+      NULL,                /* x_getlong */
+      DynXdrCountLong,     /* x_putlong */
+#endif
+      NULL,                /* x_getbytes */
+      DynXdrCountBytes,    /* x_putbytes */
+      DynXdrCountGetPos,   /* x_getpostn */
+      DynXdrCountSetPos,   /* x_setpostn */
+      DynXdrCountInline,   /* x_inline */
+      NULL,                /* x_destroy */
+#if defined(__APPLE__) || defined(USE_TIRPC)
+      NULL,                /* x_control */
+#elif defined(__GLIBC__)
+      NULL,                /* x_getint32 */
+      DynXdrCountInt32,    /* x_putint32 */
+#elif defined(sun) && (defined(_LP64) || defined(_KERNEL))
+      NULL,                /* x_control */
+      NULL,                /* x_getint32 */
+      DynXdrCountInt32,    /* x_putint32 */
+#endif
+   };
+   XDR xdrs;
+
+   memset(&xdrs, 0, sizeof xdrs);
+   xdrs.x_op = XDR_ENCODE;
+   xdrs.x_ops = &countXdrOps;
+
+   if (!proc(&xdrs, data, 0)) {
+      return 0;
+   }
+   return (size_t) xdrs.x_handy;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
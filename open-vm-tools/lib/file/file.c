@@ -908,6 +908,20 @@ File_CopyFromFdToFd(FileIODescriptor src,  // IN:
                     FileIODescriptor dst)  // IN:
 {
    Err_Number err;
+#if !defined(_WIN32)
+   /* Clones, or skips the holes and copies in the kernel when it can. */
+   err = FileCopyFdData(src.posix, dst.posix);
+   if (err != 0) {
+      Msg_Append(MSGID(File.CopyFromFdToFd.copy.failure)
+                 "Copy error: %s.\n\n", Err_Errno2String(err));
+
+      Err_SetErrno(err);
+
+      return FALSE;
+   }
+
+   return TRUE;
+#else
    FileIOResult fretR;
 
    do {
@@ -941,6 +955,7 @@ File_CopyFromFdToFd(FileIODescriptor src,  // IN:
    } while (fretR != FILEIO_READ_ERROR_EOF);
 
    return TRUE;
+#endif
 }
 
 
@@ -963,6 +978,7 @@ File_CopyFromFdToFd(FileIODescriptor src,  // IN:
  *-----------------------------------------------------------------------------
  */
 
+#if defined(_WIN32)
 static Bool
 FileCopyTree(const char *srcName,     // IN:
              const char *dstName,     // IN:
@@ -1055,6 +1071,7 @@ FileCopyTree(const char *srcName,     // IN:
 
    return success;
 }
+#endif
 
 
 /*
@@ -1104,7 +1121,28 @@ File_CopyTree(const char *srcName,     // IN:
       return FALSE;
    }
 
+#if defined(_WIN32)
    return FileCopyTree(srcName, dstName, overwriteExisting, followSymlinks);
+#else
+   {
+      char *errorPath;
+
+      /* The subdirectories are copied in parallel. */
+      err = FileTreeCopy(srcName, dstName, overwriteExisting, followSymlinks,
+                         &errorPath);
+      if (err != 0) {
+         Msg_Append(MSGID(File.CopyTree.tree.failure)
+                    "Unable to copy '%s' when copying files to '%s': %s\n\n",
+                    errorPath, dstName, Err_Errno2String(err));
+         Posix_Free(errorPath);
+         Err_SetErrno(err);
+
+         return FALSE;
+      }
+
+      return TRUE;
+   }
+#endif
 }
 
 
@@ -1571,10 +1609,12 @@ File_SupportsLargeFiles(const char *pathName)  // IN:
 int64
 File_GetSizeEx(const char *pathName)  // IN:
 {
+#if defined(_WIN32)
    int i;
    int numFiles;
    int64 totalSize = 0;
    char **fileList = NULL;
+#endif
 
    if (pathName == NULL) {
       return -1;
@@ -1584,6 +1624,10 @@ File_GetSizeEx(const char *pathName)  // IN:
       return File_GetSize(pathName);
    }
 
+#if !defined(_WIN32)
+   /* The subdirectories are walked in parallel. */
+   return FileTreeGetSize(pathName);
+#else
    numFiles = File_ListDirectory(pathName, &fileList);
    if (numFiles == -1) {
       return -1;
@@ -1603,6 +1647,7 @@ File_GetSizeEx(const char *pathName)  // IN:
    Util_FreeStringList(fileList, numFiles);
 
    return totalSize;
+#endif
 }
 
 
@@ -1865,13 +1910,14 @@ static INLINE Bool
 FileDeleteDirectoryTree(const char *pathName,  // IN: directory to delete
                         Bool contentOnly)      // IN: Content only or not
 {
+   int err = 0;
+   Err_Number fileError = 0;
+#if defined(_WIN32)
    int i;
    int numFiles;
-   int err = 0;
    char *base;
-
    char **fileList = NULL;
-   Err_Number fileError = 0;
+#endif
 
    if (Posix_EuidAccess(pathName, F_OK) != 0) {
       /*
@@ -1896,6 +1942,10 @@ FileDeleteDirectoryTree(const char *pathName,  // IN: directory to delete
          break;
    }
 
+#if !defined(_WIN32)
+   /* The subdirectories are deleted in parallel. */
+   fileError = FileTreeDelete(pathName, contentOnly);
+#else
    /* get list of files in current directory */
    numFiles = File_ListDirectory(pathName, &fileList);
 
@@ -1921,18 +1971,8 @@ FileDeleteDirectoryTree(const char *pathName,  // IN: directory to delete
             }
             break;
 
-#if !defined(_WIN32)
-         case S_IFLNK:
-            /* Delete symlink, not what it points to */
-            if (FileDeletion(curPath, FALSE) != 0) {
-               fileError = Err_Errno();
-            }
-            break;
-#endif
-
          default:
             if (FileDeletion(curPath, FALSE) != 0) {
-#if defined(_WIN32)
                if (File_SetFilePermissions(curPath, S_IWUSR)) {
                   if (FileDeletion(curPath, FALSE) != 0) {
                      fileError = Err_Errno();
@@ -1940,9 +1980,6 @@ FileDeleteDirectoryTree(const char *pathName,  // IN: directory to delete
                } else {
                   fileError = Err_Errno();
                }
-#else
-               fileError = Err_Errno();
-#endif
             }
             break;
          }
@@ -1968,6 +2005,7 @@ FileDeleteDirectoryTree(const char *pathName,  // IN: directory to delete
    }
 
    Util_FreeStringList(fileList, numFiles);
+#endif
 
    Err_SetErrno(fileError);
 
@@ -39,6 +39,7 @@
 #include <asm/unistd.h> // for __NR_SYSCALL_BASE
 #endif
 #include <errno.h>
+#include <pthread.h>
 #include <string.h>
 #include <sys/types.h>
 #include <dirent.h>
@@ -158,37 +159,68 @@ static FilePosixOptions filePosixOptions;
 /*
  * Data structures for FileIOAligned_* functions; only used on
  * hosted (see fileInt.h for rationale).
+ *
+ * The pool has a size class per power of four between 64 KiB and 1 MiB,
+ * each with its own lock, free list and sizing. Every thread caches one
+ * buffer of each class, so that a thread doing back to back I/Os gets its
+ * buffer back without taking a lock.
+ *
+ * Rather than aging the free buffers, a class keeps as many buffers as were
+ * at most in use during the previous ALIGNEDPOOL_DEMAND_WINDOW, so that a
+ * steady load neither frees nor allocates, and a burst is trimmed back once
+ * it is over.
  */
-#if !defined(VMX86_TOOLS) && !defined(VMX86_SERVER)
+#if !defined(VMX86_SERVER)
 #define ALIGNEDPOOL_FREELIST_SIZE 30
+#define ALIGNEDPOOL_MIN_BUFSZ     (64 * 1024)
 #define ALIGNEDPOOL_BUFSZ         (1024 * 1024)
-#define ALIGNEDPOOL_OLD_AGE       ((VmTimeType)1000 * 1000 * 1000) /* nanoseconds */
+#define ALIGNEDPOOL_NUM_CLASSES   3  // 64 KiB, 256 KiB, 1 MiB
+#define ALIGNEDPOOL_DEMAND_WINDOW ((VmTimeType)1000 * 1000 * 1000) /* nanoseconds */
 
-typedef struct AlignedPool {
+typedef struct AlignedPoolClass {
    MXUserExclLock *lock;
+   Atomic_Ptr      lockStorage;
+   size_t          bufSize;
+
+   /* Stack of the free buffers, not cached by a thread. */
+   void           *freeList[ALIGNEDPOOL_FREELIST_SIZE];
+   unsigned        numFree;
+
+   /* invariant: numFree + numBusy <= numAlloc <= ALIGNEDPOOL_FREELIST_SIZE */
+   unsigned        numAlloc;   // Buffers of the class
+   unsigned        numBusy;    // ... in use by a caller
+   unsigned        peakBusy;   // Highest numBusy of the window
+   unsigned        lastPeakBusy;
+   VmTimeType      windowStart;
+
+   Atomic_uint64   cacheHits;  // Reused from the thread cache
+   Atomic_uint64   poolHits;   // Reused from the free list
+   Atomic_uint64   misses;     // Newly allocated
+   Atomic_uint64   overflows;  // Not from the pool; the class is full
+} AlignedPoolClass;
 
-   /*
-    * list: Array of allocated buffers.
-    *        0 .. numBusy-1 : busy buffers (in use by a caller).
-    * numBusy .. numAlloc-1 : allocated but not busy.
-    *    numAlloc .. SIZE-1 : unused.
-    */
-   void           *list[ALIGNEDPOOL_FREELIST_SIZE];
+typedef struct AlignedPool {
+   Bool             initialized;
+   Atomic_uint32    generation;  // Invalidates the thread caches on exit
+   pthread_key_t    cacheKey;
 
    /*
-    * timestamp: Array of release timestamps.
-    *        0 .. numBusy-1 : unused.
-    * numBusy .. numAlloc-1 : last time we had N buffers outstanding.
-    *    numAlloc .. SIZE-1 : unused.
+    * Every buffer of class c is in registry[c * ALIGNEDPOOL_FREELIST_SIZE]
+    * .. [(c + 1) * ALIGNEDPOOL_FREELIST_SIZE - 1], which tells
+    * FileIOAligned_PoolFree the buffers of the pool without a lock: a slot
+    * only changes while its buffer is not in use.
     */
-   VmTimeType      timestamp[ALIGNEDPOOL_FREELIST_SIZE];
+   Atomic_Ptr       registry[ALIGNEDPOOL_NUM_CLASSES *
+                             ALIGNEDPOOL_FREELIST_SIZE];
 
-   /* invariant: 0 <= numBusy <= numAlloc <= ALIGNEDPOOL_FREELIST_SIZE */
-   unsigned        numAlloc;
-   unsigned        numBusy;
+   AlignedPoolClass classes[ALIGNEDPOOL_NUM_CLASSES];
 } AlignedPool;
 
-static Atomic_Ptr alignedPoolLockStorage;
+typedef struct AlignedPoolCache {
+   uint32           generation;
+   void            *buf[ALIGNEDPOOL_NUM_CLASSES];
+} AlignedPoolCache;
+
 static AlignedPool alignedPool;
 #endif
 
@@ -3000,9 +3032,153 @@ FileIO_SupportsPrealloc(const char *pathName,  // IN:
 
 /*
  * The FileIOAligned_* functions are only used on
- * hosted (see fileInt.h for rationale).
+ * hosted and the POSIX tools (see fileInt.h for rationale).
+ */
+#if !defined(VMX86_SERVER)
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * FileIOAlignedPoolClassPut --
+ *
+ *      Return a buffer, not cached by a thread, to its class; trim the
+ *      class down to the demand of the previous window.
+ *
+ * Result:
+ *      None.
+ *
+ * Side effects:
+ *      Might Aligned_Free() some free buffers of the class.
+ *
+ *---------------------------------------------------------------------------
+ */
+
+static void
+FileIOAlignedPoolClassPut(unsigned c,   // IN: class
+                          void *buf,    // IN:
+                          Bool busy)    // IN: in use by a caller
+{
+   AlignedPoolClass *cls = &alignedPool.classes[c];
+   VmTimeType now = Hostinfo_SystemTimerNS();
+   unsigned keep;
+
+   MXUser_AcquireExclLock(cls->lock);
+
+   ASSERT(cls->numFree < ARRAYSIZE(cls->freeList));
+   cls->freeList[cls->numFree++] = buf;
+
+   if (busy) {
+      ASSERT(cls->numBusy > 0);
+      cls->numBusy--;
+   }
+
+   if (now - cls->windowStart > ALIGNEDPOOL_DEMAND_WINDOW) {
+      cls->lastPeakBusy = cls->peakBusy;
+      cls->peakBusy = cls->numBusy;
+      cls->windowStart = now;
+   }
+
+   keep = MAX(cls->lastPeakBusy, cls->peakBusy);
+
+   while (cls->numFree > 0 && cls->numAlloc > keep) {
+      unsigned i;
+
+      buf = cls->freeList[--cls->numFree];
+
+      for (i = c * ALIGNEDPOOL_FREELIST_SIZE;
+           Atomic_ReadPtr(&alignedPool.registry[i]) != buf;
+           i++) {
+         ASSERT(i < (c + 1) * ALIGNEDPOOL_FREELIST_SIZE - 1);
+      }
+
+      Atomic_WritePtr(&alignedPool.registry[i], NULL);
+      cls->numAlloc--;
+      Aligned_Free(buf);
+   }
+
+   MXUser_ReleaseExclLock(cls->lock);
+}
+
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * FileIOAlignedPoolCacheExit --
+ *
+ *      Thread exit destructor of the thread cache; returns its buffers to
+ *      the pool unless the pool was torn down since.
+ *
+ * Result:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *---------------------------------------------------------------------------
+ */
+
+static void
+FileIOAlignedPoolCacheExit(void *data)  // IN:
+{
+   AlignedPoolCache *cache = data;
+
+   if (alignedPool.initialized &&
+       cache->generation == Atomic_Read32(&alignedPool.generation)) {
+      unsigned c;
+
+      for (c = 0; c < ALIGNEDPOOL_NUM_CLASSES; c++) {
+         if (cache->buf[c] != NULL) {
+            FileIOAlignedPoolClassPut(c, cache->buf[c], FALSE);
+         }
+      }
+   }
+
+   free(cache);
+}
+
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * FileIOAlignedPoolCache --
+ *
+ *      Get the cache of the calling thread.
+ *
+ * Result:
+ *      The cache, NULL on out of memory condition.
+ *
+ * Side effects:
+ *      None.
+ *
+ *---------------------------------------------------------------------------
  */
-#if !defined(VMX86_TOOLS) && !defined(VMX86_SERVER)
+
+static AlignedPoolCache *
+FileIOAlignedPoolCache(void)
+{
+   AlignedPoolCache *cache = pthread_getspecific(alignedPool.cacheKey);
+   uint32 generation = Atomic_Read32(&alignedPool.generation);
+
+   if (cache == NULL) {
+      cache = calloc(1, sizeof *cache);
+
+      if (cache == NULL ||
+          pthread_setspecific(alignedPool.cacheKey, cache) != 0) {
+         free(cache);
+
+         return NULL;
+      }
+
+      cache->generation = generation;
+   } else if (cache->generation != generation) {
+      /* The pool was torn down, and freed the cached buffers. */
+      memset(cache, 0, sizeof *cache);
+      cache->generation = generation;
+   }
+
+   return cache;
+}
+
 
 /*
  *---------------------------------------------------------------------------
@@ -3023,9 +3199,36 @@ FileIO_SupportsPrealloc(const char *pathName,  // IN:
 void
 FileIOAligned_PoolInit(void)
 {
-   alignedPool.lock = MXUser_CreateSingletonExclLock(&alignedPoolLockStorage,
-                                                     "alignedPoolLock",
-                                                     RANK_LEAF);
+   static Bool cacheKeyCreated = FALSE;
+   unsigned c;
+
+   if (alignedPool.initialized) {
+      return;
+   }
+
+   /* The key outlives PoolExit; the generation tells the stale caches. */
+   if (!cacheKeyCreated) {
+      if (pthread_key_create(&alignedPool.cacheKey,
+                             FileIOAlignedPoolCacheExit) != 0) {
+         LOG_ONCE("%s: cannot create the thread cache key\n", __FUNCTION__);
+         return;
+      }
+      cacheKeyCreated = TRUE;
+   }
+
+   for (c = 0; c < ALIGNEDPOOL_NUM_CLASSES; c++) {
+      AlignedPoolClass *cls = &alignedPool.classes[c];
+
+      cls->bufSize = (size_t) ALIGNEDPOOL_MIN_BUFSZ << (2 * c);
+      cls->lock = MXUser_CreateSingletonExclLock(&cls->lockStorage,
+                                                 "alignedPoolLock",
+                                                 RANK_LEAF);
+   }
+
+   ASSERT(alignedPool.classes[ALIGNEDPOOL_NUM_CLASSES - 1].bufSize ==
+          ALIGNEDPOOL_BUFSZ);
+
+   alignedPool.initialized = TRUE;
 }
 
 
@@ -3049,26 +3252,80 @@ FileIOAligned_PoolInit(void)
 void
 FileIOAligned_PoolExit(void)
 {
-   if (!alignedPool.lock) {
+   unsigned c;
+
+   if (!alignedPool.initialized) {
       LOG_ONCE("%s called without FileIOAligned_Pool lock\n", __FUNCTION__);
       return;
    }
 
-   MXUser_AcquireExclLock(alignedPool.lock);
+   alignedPool.initialized = FALSE;
+   Atomic_Inc32(&alignedPool.generation);
 
-   if (alignedPool.numBusy > 0) {
-      LOG_ONCE("%s: %d busy buffers!  Proceeding with trepidation.\n",
-               __FUNCTION__, alignedPool.numBusy);
-   }
-   while (alignedPool.numAlloc > 0) {
-      alignedPool.numAlloc--;
-      Aligned_Free(alignedPool.list[alignedPool.numAlloc]);
+   for (c = 0; c < ALIGNEDPOOL_NUM_CLASSES; c++) {
+      AlignedPoolClass *cls = &alignedPool.classes[c];
+      unsigned i;
+
+      MXUser_AcquireExclLock(cls->lock);
+
+      if (cls->numBusy > 0) {
+         LOG_ONCE("%s: %d busy buffers!  Proceeding with trepidation.\n",
+                  __FUNCTION__, cls->numBusy);
+      }
+
+      Log("%s: %"FMTSZ"u KiB buffers: %"FMT64"u cache hits, %"FMT64"u "
+          "pool hits, %"FMT64"u misses, %"FMT64"u overflows.\n", __FUNCTION__,
+          cls->bufSize / 1024, Atomic_Read64(&cls->cacheHits),
+          Atomic_Read64(&cls->poolHits), Atomic_Read64(&cls->misses),
+          Atomic_Read64(&cls->overflows));
+
+      /* This includes the buffers cached by the threads. */
+      for (i = c * ALIGNEDPOOL_FREELIST_SIZE;
+           i < (c + 1) * ALIGNEDPOOL_FREELIST_SIZE;
+           i++) {
+         Aligned_Free(Atomic_ReadPtr(&alignedPool.registry[i]));
+         Atomic_WritePtr(&alignedPool.registry[i], NULL);
+      }
+
+      MXUser_ReleaseExclLock(cls->lock);
+      MXUser_DestroyExclLock(cls->lock);
    }
 
-   MXUser_ReleaseExclLock(alignedPool.lock);
-   MXUser_DestroyExclLock(alignedPool.lock);
+   memset(alignedPool.classes, 0, sizeof alignedPool.classes);
+}
+
 
-   memset(&alignedPool, 0, sizeof alignedPool);
+/*
+ *---------------------------------------------------------------------------
+ *
+ * FileIOAligned_PoolGetStats --
+ *
+ *      Return the hit and miss counts of the pool, summed over the classes.
+ *
+ * Result:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *---------------------------------------------------------------------------
+ */
+
+void
+FileIOAligned_PoolGetStats(uint64 *hits,    // OUT:
+                           uint64 *misses)  // OUT:
+{
+   unsigned c;
+
+   *hits = 0;
+   *misses = 0;
+
+   for (c = 0; c < ALIGNEDPOOL_NUM_CLASSES; c++) {
+      AlignedPoolClass *cls = &alignedPool.classes[c];
+
+      *hits += Atomic_Read64(&cls->cacheHits) + Atomic_Read64(&cls->poolHits);
+      *misses += Atomic_Read64(&cls->misses) + Atomic_Read64(&cls->overflows);
+   }
 }
 
 
@@ -3095,9 +3352,12 @@ FileIOAligned_PoolExit(void)
 void *
 FileIOAligned_PoolMalloc(size_t size)  // IN:
 {
+   AlignedPoolClass *cls;
+   AlignedPoolCache *cache;
    void *buf = NULL;
+   unsigned c;
 
-   if (!alignedPool.lock) {
+   if (!alignedPool.initialized) {
       LOG_ONCE("%s called without FileIOAligned_Pool lock\n", __FUNCTION__);
       return NULL;
    }
@@ -3106,29 +3366,53 @@ FileIOAligned_PoolMalloc(size_t size)  // IN:
       return NULL;
    }
 
-   MXUser_AcquireExclLock(alignedPool.lock);
+   for (c = 0; alignedPool.classes[c].bufSize < size; c++) {
+      ASSERT(c < ALIGNEDPOOL_NUM_CLASSES - 1);
+   }
+   cls = &alignedPool.classes[c];
 
-   ASSERT(alignedPool.numBusy <= ARRAYSIZE(alignedPool.list));
-   ASSERT(alignedPool.numAlloc <= ARRAYSIZE(alignedPool.list));
-   ASSERT(alignedPool.numBusy <= alignedPool.numAlloc);
+   cache = FileIOAlignedPoolCache();
+
+   MXUser_AcquireExclLock(cls->lock);
+
+   ASSERT(cls->numFree + cls->numBusy <= cls->numAlloc);
+   ASSERT(cls->numAlloc <= ARRAYSIZE(cls->freeList));
+
+   if (cache != NULL && cache->buf[c] != NULL) {
+      /* The lock only protects the count; the buffer is ours. */
+      buf = cache->buf[c];
+      cache->buf[c] = NULL;
+      Atomic_Inc64(&cls->cacheHits);
+   } else if (cls->numFree > 0) {
+      buf = cls->freeList[--cls->numFree];
+      Atomic_Inc64(&cls->poolHits);
+   } else if (cls->numAlloc < ARRAYSIZE(cls->freeList)) {
+      buf = Aligned_UnsafeMalloc(cls->bufSize);
 
-   if (alignedPool.numBusy == ARRAYSIZE(alignedPool.list)) {
-      goto done;
-   }
-   if (alignedPool.numBusy == alignedPool.numAlloc) {
-      buf = Aligned_UnsafeMalloc(ALIGNEDPOOL_BUFSZ);
       /* If allocation fails, just bail. */
-      if (buf) {
-         alignedPool.list[alignedPool.numAlloc] = buf;
-         alignedPool.numBusy = ++alignedPool.numAlloc;
+      if (buf != NULL) {
+         unsigned i;
+
+         for (i = c * ALIGNEDPOOL_FREELIST_SIZE;
+              Atomic_ReadPtr(&alignedPool.registry[i]) != NULL;
+              i++) {
+            ASSERT(i < (c + 1) * ALIGNEDPOOL_FREELIST_SIZE - 1);
+         }
+
+         Atomic_WritePtr(&alignedPool.registry[i], buf);
+         cls->numAlloc++;
+         Atomic_Inc64(&cls->misses);
       }
-      goto done;
+   } else {
+      Atomic_Inc64(&cls->overflows);
+   }
+
+   if (buf != NULL) {
+      cls->numBusy++;
+      cls->peakBusy = MAX(cls->peakBusy, cls->numBusy);
    }
-   buf = alignedPool.list[alignedPool.numBusy];
-   alignedPool.numBusy++;
 
-done:
-   MXUser_ReleaseExclLock(alignedPool.lock);
+   MXUser_ReleaseExclLock(cls->lock);
 
    return buf;
 }
@@ -3146,8 +3430,8 @@ done:
  *      FALSE otherwise.
  *
  * Side effects:
- *      Might Aligned_Free() some entries from alignedPool if the timestamp[]
- *      entries indicate that we have not needed them for a while.
+ *      Might Aligned_Free() some entries from alignedPool if they were not
+ *      needed during the last ALIGNEDPOOL_DEMAND_WINDOW.
  *
  *---------------------------------------------------------------------------
  */
@@ -3155,60 +3439,48 @@ done:
 Bool
 FileIOAligned_PoolFree(void *ptr)  // IN:
 {
+   AlignedPoolCache *cache;
+   unsigned c;
    unsigned i;
-   Bool ret = FALSE;
-   VmTimeType now;
 
-   if (!alignedPool.lock) {
+   if (!alignedPool.initialized) {
       LOG_ONCE("%s called without FileIOAligned_Pool lock\n", __FUNCTION__);
 
       return FALSE;
    }
 
-   MXUser_AcquireExclLock(alignedPool.lock);
-
-   ASSERT(alignedPool.numBusy <= ARRAYSIZE(alignedPool.list));
-   ASSERT(alignedPool.numAlloc <= ARRAYSIZE(alignedPool.list));
-   ASSERT(alignedPool.numBusy <= alignedPool.numAlloc);
+   if (ptr == NULL) {
+      return FALSE;
+   }
 
-   for (i = 0; i < alignedPool.numBusy; i++) {
-      if (alignedPool.list[i] == ptr) {
+   for (i = 0; i < ARRAYSIZE(alignedPool.registry); i++) {
+      if (Atomic_ReadPtr(&alignedPool.registry[i]) == ptr) {
          break;
       }
    }
-   if (i == alignedPool.numBusy) {
+
+   if (i == ARRAYSIZE(alignedPool.registry)) {
       /* The pointer wasn't allocated from our pool. */
-      goto done;
+      return FALSE;
    }
 
-   alignedPool.numBusy--;
+   c = i / ALIGNEDPOOL_FREELIST_SIZE;
+   cache = FileIOAlignedPoolCache();
 
-   /*
-    * At this point either i points to the "top" busy item, or i points to an
-    * earlier busy item.  If i points to the top, we're done, and the following
-    * "swap" is a noop.  If i points somewhere further down the busy list, we
-    * can simply move the newly freed item to the top of the free list by
-    * swapping its place with the not-freed item at list[numBusy].
-    */
-   alignedPool.list[i] = alignedPool.list[alignedPool.numBusy];
-   alignedPool.list[alignedPool.numBusy] = ptr;
+   if (cache != NULL && cache->buf[c] == NULL) {
+      AlignedPoolClass *cls = &alignedPool.classes[c];
 
-   now = Hostinfo_SystemTimerNS();
-   alignedPool.timestamp[alignedPool.numBusy] = now;
+      MXUser_AcquireExclLock(cls->lock);
+      ASSERT(cls->numBusy > 0);
+      cls->numBusy--;
+      MXUser_ReleaseExclLock(cls->lock);
 
-   while (alignedPool.numAlloc > alignedPool.numBusy &&
-          now - alignedPool.timestamp[alignedPool.numAlloc - 1] > ALIGNEDPOOL_OLD_AGE) {
-      alignedPool.numAlloc--;
-      Aligned_Free(alignedPool.list[alignedPool.numAlloc]);
-      alignedPool.list[alignedPool.numAlloc] = NULL;
+      cache->buf[c] = ptr;
+   } else {
+      FileIOAlignedPoolClassPut(c, ptr, TRUE);
    }
 
-   ret = TRUE;
-
-done:
-   MXUser_ReleaseExclLock(alignedPool.lock);
-
-   return ret;
+   return TRUE;
 }
 
 #endif
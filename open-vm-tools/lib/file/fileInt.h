@@ -258,6 +258,22 @@ FileIOCreateRetry(FileIODescriptor *fd,
                   int mode,
                   uint32 maxWaitTimeMsec);
 
+#if !defined(_WIN32)
+int FileCopyFdData(int srcFd,
+                   int dstFd);
+
+int FileTreeDelete(const char *pathName,
+                   Bool contentOnly);
+
+int FileTreeCopy(const char *srcName,
+                 const char *dstName,
+                 Bool overwriteExisting,
+                 Bool followSymlinks,
+                 char **errorPath);
+
+int64 FileTreeGetSize(const char *pathName);
+#endif
+
 
 /*
  * FileIOAligned_* are useful on hosted platforms where malloc/memalign/valloc
@@ -275,11 +291,12 @@ FileIOCreateRetry(FileIODescriptor *fd,
  * 3. we don't have the same alignment constraints
  * so simply define it away to nothing.
  *
- * Tools is another case, we can use this path for IO but we don't want to add
- * MXUserExclLock dependencies.
+ * Windows tools is another case, we can use this path for IO but we don't want
+ * to add MXUserExclLock dependencies. The POSIX tools link lib/file into
+ * libvmtools, next to lib/lock, and use the pool.
  */
 
-#if defined(VMX86_TOOLS) || defined(VMX86_SERVER)
+#if (defined(VMX86_TOOLS) && defined(_WIN32)) || defined(VMX86_SERVER)
 #define FileIOAligned_PoolInit()     /* nothing */
 #define FileIOAligned_PoolExit()     /* nothing */
 #define FileIOAligned_PoolMalloc(sz) NULL
@@ -41,6 +41,9 @@
 #include <unistd.h>
 #include <sys/param.h>
 #endif
+#if defined(__linux__)
+#include <sys/vfs.h>
+#endif
 #include "vmware.h"
 #include "hostinfo.h"
 #include "util.h"
@@ -84,11 +87,17 @@ typedef struct parse_table
 
 #define FILELOCK_TOKEN_SIGNATURE 0x4B434C46  // 'FLCK' in memory
 
+typedef enum {
+   FILELOCK_TYPE_MANDATORY,
+   FILELOCK_TYPE_PORTABLE,
+   FILELOCK_TYPE_OFD,
+} FileLockType;
+
 struct FileLockToken
 {
-   uint32  signature;
-   Bool    portable;
-   char   *pathName;
+   uint32        signature;
+   FileLockType  type;
+   char         *pathName;
    union {
       struct {
          FileIODescriptor lockFd;
@@ -96,9 +105,48 @@ struct FileLockToken
       struct {
          char *lockFilePath;  // &implicitReadToken for implicit read locks
       } portable;
+      struct {
+         int   fd;
+         char *lockFilePath;
+      } ofd;
    } u;
 };
 
+/*
+ * Open file description locks (Linux 3.15 and later) are used on local
+ * filesystems. They are owned by the open file, so they conflict between
+ * the threads of a process, and are released by the kernel when the owner
+ * dies; the lock needs neither a lock directory nor member files.
+ */
+
+#if defined(__linux__) && defined(F_OFD_SETLK)
+#define FILELOCK_HAS_OFD 1
+
+#if !defined(BTRFS_SUPER_MAGIC)
+#define BTRFS_SUPER_MAGIC     0x9123683E
+#endif
+
+#if !defined(F2FS_SUPER_MAGIC)
+#define F2FS_SUPER_MAGIC      0xF2F52010
+#endif
+
+static Bool fileLockNoOFD;  // The kernel does not support OFD locks
+#endif
+
+/*
+ * Lock acquisition statistics; the wait times are in microseconds.
+ */
+
+static Atomic_uint64 fileLockAcquired;
+static Atomic_uint64 fileLockAcquiredOFD;
+static Atomic_uint64 fileLockTimedOut;
+static Atomic_uint64 fileLockWaitTime;
+static Atomic_uint64 fileLockMaxWaitTime;
+
+#if defined(FILELOCK_HAS_OFD)
+static int FileUnlockOFD(FileLockToken *tokenPtr);
+#endif
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -994,7 +1042,13 @@ FileUnlockIntrinsic(FileLockToken *tokenPtr)  // IN:
 
    LOG(1, "Requesting unlock on %s\n", tokenPtr->pathName);
 
-   if (tokenPtr->portable) {
+   if (tokenPtr->type == FILELOCK_TYPE_OFD) {
+#if defined(FILELOCK_HAS_OFD)
+      err = FileUnlockOFD(tokenPtr);
+#else
+      NOT_REACHED();
+#endif
+   } else if (tokenPtr->type == FILELOCK_TYPE_PORTABLE) {
       /*
        * If the lockFilePath (a pointer) is the fixed-address token representing
        * an implicit read lock, there is no lock file and the token can simply
@@ -1586,7 +1640,7 @@ FileLockIntrinsicMandatory(const char *pathName,   // IN:
    FileLockToken *tokenPtr = Util_SafeMalloc(sizeof *tokenPtr);
 
    tokenPtr->signature = FILELOCK_TOKEN_SIGNATURE;
-   tokenPtr->portable = FALSE;
+   tokenPtr->type = FILELOCK_TYPE_MANDATORY;
    tokenPtr->pathName = Unicode_Duplicate(pathName);
    FileIO_Invalidate(&tokenPtr->u.mandatory.lockFd);
 
@@ -1625,6 +1679,385 @@ FileLockIntrinsicMandatory(const char *pathName,   // IN:
 }
 
 
+#if defined(FILELOCK_HAS_OFD)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileLockSupportsOFD --
+ *
+ *      Should the lock file be locked with an OFD lock?
+ *
+ *      Only local filesystems qualify; on shared storage a locker on
+ *      another host would not see the lock (or see it through the NFS lock
+ *      manager only), so the portable scheme is kept there.
+ *
+ * Results:
+ *      TRUE    YES
+ *      FALSE   NO
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+FileLockSupportsOFD(const char *lockFile)  // IN:
+{
+   char *dirName;
+   struct statfs sfbuf;
+   int ret;
+
+   if (fileLockNoOFD || HostType_OSIsVMK()) {
+      return FALSE;
+   }
+
+   File_GetPathName(lockFile, &dirName, NULL);
+   ret = Posix_Statfs(*dirName == '\0' ? DIRSEPS : dirName, &sfbuf);
+   Posix_Free(dirName);
+
+   if (ret == -1) {
+      return FALSE;
+   }
+
+   switch (sfbuf.f_type) {
+   case EXT2_SUPER_MAGIC:  // And ext3, ext4
+   case XFS_SUPER_MAGIC:
+   case BTRFS_SUPER_MAGIC:
+   case F2FS_SUPER_MAGIC:
+   case TMPFS_SUPER_MAGIC:
+   case JFS_SUPER_MAGIC:
+   case REISERFS_SUPER_MAGIC:
+      return TRUE;
+
+   default:
+      return FALSE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileLockIntrinsicOFD --
+ *
+ *      Obtain a lock on a file; shared or exclusive access.
+ *
+ *      This implementation places an OFD lock on the "pathName.lck" file,
+ *      created if needed. The file is removed by the last holder of the
+ *      lock, so a locker which was waiting on a removed file retries on
+ *      the new one.
+ *
+ *      An infinite wait blocks in the kernel; bounded waits poll with the
+ *      backoff of the portable scheme. As for any lock owned by the open
+ *      file, it is held until the children forked while it was held exit
+ *      or exec.
+ *
+ *      A "pathName.lck" directory is a lock of the portable scheme (e.g.
+ *      taken through NFS by another host), conversely the portable scheme
+ *      does not take a lock if "pathName.lck" is a file.
+ *
+ * Results:
+ *      NULL    Lock not acquired. Check err.
+ *              err     0       Lock Timed Out
+ *              err     ENOTSUP The portable scheme has to be used
+ *              err     > 0     errno
+ *      !NULL   Lock Acquired. This is the "lockToken" for an unlock.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static FileLockToken *
+FileLockIntrinsicOFD(const char *pathName,   // IN:
+                     const char *lockFile,   // IN:
+                     LockValues *myValues,   // IN/OUT:
+                     int *err)               // OUT:
+{
+   FileLockToken *tokenPtr;
+   struct flock lock;
+   int cmd;
+   int fd;
+
+   memset(&lock, 0, sizeof lock);
+   lock.l_type = myValues->exclusivity ? F_WRLCK : F_RDLCK;
+   lock.l_whence = SEEK_SET;
+
+   cmd = (myValues->maxWaitTimeMsec == FILELOCK_INFINITE_WAIT) ? F_OFD_SETLKW :
+                                                                  F_OFD_SETLK;
+
+   while (TRUE) {
+      struct stat fdStat;
+      struct stat pathStat;
+      int errnum;
+
+      fd = Posix_Open(lockFile, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC,
+                      0644);
+
+      if (fd == -1) {
+         errnum = errno;
+
+         switch (errnum) {
+         case EISDIR:  // A portable lock
+         case EACCES:  // The portable scheme grants implicit read locks
+         case EROFS:
+            *err = ENOTSUP;
+            break;
+
+         default:
+            *err = errnum;
+            break;
+         }
+
+         return NULL;
+      }
+
+      while (fcntl(fd, cmd, &lock) == -1) {
+         errnum = errno;
+
+         if (errnum == EINTR) {
+            continue;
+         }
+
+         if ((errnum == EAGAIN) || (errnum == EACCES)) {
+            if (FileLockSleeper(myValues) == 0) {
+               continue;
+            }
+
+            *err = 0;  // Lock timed out
+         } else if (errnum == EINVAL) {
+            /*
+             * Kernel without OFD locks. The file may have just been
+             * created, that nobody else could lock it; remove it so that it
+             * does not block portable lockers.
+             */
+
+            Log(LGPFX" %s: OFD locks are not supported.\n", __FUNCTION__);
+            fileLockNoOFD = TRUE;
+            Posix_Unlink(lockFile);
+            *err = ENOTSUP;
+         } else {
+            *err = errnum;
+         }
+
+         close(fd);
+
+         return NULL;
+      }
+
+      /* Still the file that the others lock? */
+      if ((fstat(fd, &fdStat) == 0) &&
+          (Posix_Lstat(lockFile, &pathStat) == 0) &&
+          (fdStat.st_dev == pathStat.st_dev) &&
+          (fdStat.st_ino == pathStat.st_ino)) {
+         break;
+      }
+
+      close(fd);
+   }
+
+   tokenPtr = Util_SafeMalloc(sizeof *tokenPtr);
+
+   tokenPtr->signature = FILELOCK_TOKEN_SIGNATURE;
+   tokenPtr->type = FILELOCK_TYPE_OFD;
+   tokenPtr->pathName = Unicode_Duplicate(pathName);
+   tokenPtr->u.ofd.fd = fd;
+   tokenPtr->u.ofd.lockFilePath = Unicode_Duplicate(lockFile);
+   *err = 0;
+
+   return tokenPtr;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileUnlockOFD --
+ *
+ *      Release an OFD lock.
+ *
+ *      The file is removed, while still locked, if the lock can be made
+ *      exclusive; i.e. there is no other holder of a shared lock.
+ *
+ * Results:
+ *      0       unlocked
+ *      > 0     errno
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FileUnlockOFD(FileLockToken *tokenPtr)  // IN:
+{
+   int err = 0;
+   struct flock lock;
+
+   ASSERT(tokenPtr->type == FILELOCK_TYPE_OFD);
+   ASSERT(tokenPtr->u.ofd.fd != -1);
+
+   memset(&lock, 0, sizeof lock);
+   lock.l_type = F_WRLCK;
+   lock.l_whence = SEEK_SET;
+
+   if ((fcntl(tokenPtr->u.ofd.fd, F_OFD_SETLK, &lock) == 0) &&
+       (Posix_Unlink(tokenPtr->u.ofd.lockFilePath) == -1) &&
+       (errno != ENOENT)) {
+      err = errno;
+
+      if (vmx86_debug) {
+         Log(LGPFX" %s failed for '%s': %s\n", __FUNCTION__,
+             tokenPtr->u.ofd.lockFilePath, Err_Errno2String(err));
+      }
+   }
+
+   close(tokenPtr->u.ofd.fd);  // Releases the lock
+   tokenPtr->u.ofd.fd = -1;
+   Posix_Free(tokenPtr->u.ofd.lockFilePath);
+   tokenPtr->u.ofd.lockFilePath = NULL;
+
+   return err;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileLockIsLockedOFD --
+ *
+ *      Is a file currently OFD locked (at the time of the call)?
+ *
+ * Results:
+ *      TRUE    YES
+ *      FALSE   NO; if err is not NULL may check *err for an error
+ *              err     ENOTSUP The portable scheme has to be checked
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+FileLockIsLockedOFD(const char *lockFile,  // IN:
+                    int *err)              // OUT:
+{
+   struct flock lock;
+   struct stat statBuf;
+   int fd;
+
+   fd = Posix_Open(lockFile, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+
+   if (fd == -1) {
+      /* No lock file means unlocked */
+      *err = (errno == ENOENT) ? 0 : errno;
+
+      return FALSE;
+   }
+
+   if ((fstat(fd, &statBuf) == 0) && S_ISDIR(statBuf.st_mode)) {
+      close(fd);
+      *err = ENOTSUP;
+
+      return FALSE;
+   }
+
+   memset(&lock, 0, sizeof lock);
+   lock.l_type = F_WRLCK;
+   lock.l_whence = SEEK_SET;
+
+   if (fcntl(fd, F_OFD_GETLK, &lock) == -1) {
+      *err = errno;
+      close(fd);
+
+      return FALSE;
+   }
+
+   close(fd);
+   *err = 0;
+
+   return lock.l_type != F_UNLCK;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileLockUpdateStats --
+ *
+ *      Account for a lock acquisition attempt.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileLockUpdateStats(const FileLockToken *tokenPtr,  // IN/OPT:
+                    int err,                        // IN:
+                    VmTimeType startTimeUsec)       // IN:
+{
+   uint64 waitTime = Hostinfo_SystemTimerUS() - startTimeUsec;
+   uint64 maxWaitTime;
+
+   if (tokenPtr != NULL) {
+      Atomic_Inc64(&fileLockAcquired);
+
+      if (tokenPtr->type == FILELOCK_TYPE_OFD) {
+         Atomic_Inc64(&fileLockAcquiredOFD);
+      }
+   } else if (err == 0) {
+      Atomic_Inc64(&fileLockTimedOut);
+   }
+
+   Atomic_Add64(&fileLockWaitTime, waitTime);
+
+   do {
+      maxWaitTime = Atomic_Read64(&fileLockMaxWaitTime);
+   } while (waitTime > maxWaitTime &&
+            Atomic_ReadIfEqualWrite64(&fileLockMaxWaitTime, maxWaitTime,
+                                      waitTime) != maxWaitTime);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileLock_GetStats --
+ *
+ *      Return the lock acquisition statistics of the process.
+ *
+ * Results:
+ *      The statistics.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+FileLock_GetStats(FileLockStats *stats)  // OUT:
+{
+   ASSERT(stats != NULL);
+
+   stats->acquired = Atomic_Read64(&fileLockAcquired);
+   stats->acquiredOFD = Atomic_Read64(&fileLockAcquiredOFD);
+   stats->timedOut = Atomic_Read64(&fileLockTimedOut);
+   stats->waitTimeUsec = Atomic_Read64(&fileLockWaitTime);
+   stats->maxWaitTimeUsec = Atomic_Read64(&fileLockMaxWaitTime);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1796,7 +2229,7 @@ bail:
       tokenPtr = Util_SafeMalloc(sizeof *tokenPtr);
 
       tokenPtr->signature = FILELOCK_TOKEN_SIGNATURE;
-      tokenPtr->portable = TRUE;
+      tokenPtr->type = FILELOCK_TYPE_PORTABLE;
       tokenPtr->pathName = Unicode_Duplicate(pathName);
       tokenPtr->u.portable.lockFilePath = memberFilePath;
    } else {
@@ -1826,8 +2259,9 @@ bail:
  *      entities fails, particularly across distributed filesystems.
  *
  *      This wrapper function will adaptively switch between a scheme
- *      implemented via mandatory locks and a more portable scheme depending
- *      on host OS support.
+ *      implemented via mandatory locks, one implemented via OFD locks on
+ *      local Linux filesystems and a more portable scheme depending on host
+ *      OS and filesystem support.
  *
  *      maxWaitTimeMsec specifies the maximum amount of time, in
  *      milliseconds, to wait for the lock before returning the "not
@@ -1857,13 +2291,16 @@ FileLockIntrinsic(const char *pathName,    // IN:
    char *lockBase;
    LockValues myValues = { 0 };
    FileLockToken *tokenPtr;
+   VmTimeType startTimeUsec;
+   Bool usePortable;
 
    /* Construct the locking directory path */
    lockBase = Unicode_Append(pathName, FILELOCK_SUFFIX);
 
    myValues.lockType = exclusivity ? LOCK_EXCLUSIVE : LOCK_SHARED;
    myValues.exclusivity = exclusivity;
-   myValues.startTimeMsec = Hostinfo_SystemTimerMS();
+   startTimeUsec = Hostinfo_SystemTimerUS();
+   myValues.startTimeMsec = startTimeUsec / 1000;
    myValues.maxWaitTimeMsec = maxWaitTimeMsec;
 
    if (File_SupportsMandatoryLock(pathName)) {
@@ -1871,7 +2308,20 @@ FileLockIntrinsic(const char *pathName,    // IN:
           myValues.lockType, pathName, myValues.maxWaitTimeMsec);
 
       tokenPtr = FileLockIntrinsicMandatory(pathName, lockBase, &myValues, err);
+      usePortable = FALSE;
+#if defined(FILELOCK_HAS_OFD)
+   } else if (FileLockSupportsOFD(lockBase)) {
+      LOG(1, "Requesting %s lock on %s (ofd, %u).\n",
+          myValues.lockType, pathName, myValues.maxWaitTimeMsec);
+
+      tokenPtr = FileLockIntrinsicOFD(pathName, lockBase, &myValues, err);
+      usePortable = (tokenPtr == NULL) && (*err == ENOTSUP);
+#endif
    } else {
+      usePortable = TRUE;
+   }
+
+   if (usePortable) {
       myValues.machineID = (char *) FileLockGetMachineID(); // don't free this!
       myValues.executionID = FileLockGetExecutionID();      // free this!
       myValues.lamportNumber = 0;
@@ -1889,6 +2339,8 @@ FileLockIntrinsic(const char *pathName,    // IN:
       Posix_Free(myValues.executionID);
    }
 
+   FileLockUpdateStats(tokenPtr, *err, startTimeUsec);
+
    Posix_Free(lockBase);
 
    return tokenPtr;
@@ -2047,6 +2499,18 @@ FileLockIsLocked(const char *pathName,  // IN:
 
    if (File_SupportsMandatoryLock(pathName)) {
       isLocked = FileLockIsLockedMandatory(lockBase, err);
+#if defined(FILELOCK_HAS_OFD)
+   } else if (FileLockSupportsOFD(lockBase)) {
+      int res;
+
+      isLocked = FileLockIsLockedOFD(lockBase, &res);
+
+      if (res == ENOTSUP) {
+         isLocked = FileLockIsLockedPortable(lockBase, err);
+      } else if (err != NULL) {
+         *err = res;
+      }
+#endif
    } else {
       isLocked = FileLockIsLockedPortable(lockBase, err);
    }
@@ -51,6 +51,8 @@
 #include <dirent.h>
 #if defined(__linux__)
 #   include <pwd.h>
+#   include <syscall.h>
+#   include <sys/ioctl.h>
 #endif
 
 #if defined(__APPLE__)
@@ -106,6 +108,13 @@ struct WalkDirContextImpl {
 };
 
 
+#if defined(__linux__) && !defined(FICLONE)
+#define FICLONE _IOW(0x94, 9, int)
+#endif
+
+#define FILE_COPY_BUFFER_SIZE (1024 * 1024)
+#define FILE_COPY_CHUNK_SIZE  (64 * 1024 * 1024)  // Per copy_file_range
+
 /* A string for NFS on ESX file system type */
 #define FS_NFS_PREFIX_LEN 3
 #define FS_NFS_ON_ESX "NFS"
@@ -242,6 +251,302 @@ bail:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * FileCopyStream --
+ *
+ *      Copy from the current position of srcFd to its end, to the current
+ *      position of dstFd, through the buffer.
+ *
+ * Results:
+ *        0  success
+ *      > 0  failure (errno)
+ *
+ * Side effects:
+ *      The positions of the descriptors are moved.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FileCopyStream(int srcFd,     // IN:
+               int dstFd,     // IN:
+               char *buf,     // IN:
+               size_t size)   // IN:
+{
+   for (;;) {
+      ssize_t len = read(srcFd, buf, size);
+      ssize_t off;
+
+      if (len == 0) {
+         return 0;
+      }
+
+      if (len < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+
+         return errno;
+      }
+
+      for (off = 0; off < len; ) {
+         ssize_t written = write(dstFd, buf + off, len - off);
+
+         if (written < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+
+            return errno;
+         }
+
+         off += written;
+      }
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FileCopyRange --
+ *
+ *      Copy len bytes of srcFd at srcOff to dstFd at dstOff: in the
+ *      kernel with copy_file_range(2) where it can, through *buf of bufSize
+ *      bytes otherwise.
+ *
+ * Results:
+ *        0  success; *copied is less than len if srcFd was shorter
+ *      > 0  failure (errno)
+ *
+ * Side effects:
+ *      *buf is allocated on first use, to free by the caller.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+FileCopyRange(int srcFd,        // IN:
+              int dstFd,        // IN:
+              uint64 srcOff,    // IN:
+              uint64 dstOff,    // IN:
+              uint64 len,       // IN:
+              char **buf,       // IN/OUT:
+              size_t bufSize,   // IN:
+              uint64 *copied)   // OUT:
+{
+   uint64 done = 0;
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+   while (done < len) {
+      loff_t inOff = srcOff + done;
+      loff_t outOff = dstOff + done;
+      long n = syscall(__NR_copy_file_range, srcFd, &inOff, dstFd, &outOff,
+                       (size_t) MIN(len - done, FILE_COPY_CHUNK_SIZE), 0);
+
+      if (n <= 0) {
+         if (n < 0 && errno == EINTR) {
+            continue;
+         }
+
+         /*
+          * Older kernels, other file systems or a procfs-like source;
+          * anything not yet copied goes through the buffer.
+          */
+         if (n == 0 || errno == ENOSYS || errno == EXDEV ||
+             errno == EINVAL || errno == EOPNOTSUPP) {
+            break;
+         }
+
+         return errno;
+      }
+
+      done += n;
+   }
+#endif
+
+   while (done < len) {
+      size_t size = MIN(len - done, bufSize);
+      ssize_t n;
+      ssize_t off;
+
+      if (*buf == NULL) {
+         *buf = Util_SafeMalloc(bufSize);
+      }
+
+      n = pread(srcFd, *buf, size, srcOff + done);
+      if (n == 0) {
+         break;
+      }
+
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+
+         return errno;
+      }
+
+      for (off = 0; off < n; ) {
+         ssize_t written = pwrite(dstFd, *buf + off, n - off,
+                                  dstOff + done + off);
+
+         if (written < 0) {
+            if (errno == EINTR) {
+               continue;
+            }
+
+            return errno;
+         }
+
+         off += written;
+      }
+
+      done += n;
+   }
+
+   *copied = done;
+
+   return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FileCopyFdData --
+ *
+ *      Copy all data between the current position of srcFd and its end to
+ *      the current position of dstFd, as File_CopyFromFdToFd.
+ *
+ *      A whole file copied to an empty one is cloned (FICLONE) when the file
+ *      system shares extents. Otherwise only the data extents of the source
+ *      (SEEK_DATA/SEEK_HOLE) are copied, in the kernel when it can, so that
+ *      the holes stay holes as long as the destination is written past its
+ *      end. Anything but regular files is streamed.
+ *
+ * Results:
+ *        0  success
+ *      > 0  failure (errno)
+ *
+ * Side effects:
+ *      The positions of the descriptors are moved to the end of the copy.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+FileCopyFdData(int srcFd,  // IN:
+               int dstFd)  // IN:
+{
+   struct stat srcSb;
+   struct stat dstSb;
+   off_t srcPos;
+   off_t dstPos;
+   off_t srcEnd;
+   off_t off;
+   Bool sparse;
+   size_t bufSize;
+   char *buf = NULL;
+   int err = 0;
+
+   if (fstat(srcFd, &srcSb) != 0 || fstat(dstFd, &dstSb) != 0) {
+      return errno;
+   }
+
+   srcPos = lseek(srcFd, 0, SEEK_CUR);
+   dstPos = lseek(dstFd, 0, SEEK_CUR);
+
+   /* A procfs-like file has no size; read it to its end. */
+   if (!S_ISREG(srcSb.st_mode) || !S_ISREG(dstSb.st_mode) ||
+       srcSb.st_size == 0 || srcPos == -1 || dstPos == -1) {
+      buf = Util_SafeMalloc(FILE_COPY_BUFFER_SIZE);
+      err = FileCopyStream(srcFd, dstFd, buf, FILE_COPY_BUFFER_SIZE);
+      free(buf);
+
+      return err;
+   }
+
+   srcEnd = srcSb.st_size;
+   if (srcPos >= srcEnd) {
+      return 0;
+   }
+
+#if defined(__linux__) && defined(FICLONE)
+   if (srcPos == 0 && dstPos == 0 && dstSb.st_size == 0 &&
+       ioctl(dstFd, FICLONE, srcFd) == 0) {
+      lseek(srcFd, srcEnd, SEEK_SET);
+      lseek(dstFd, srcEnd, SEEK_SET);
+
+      return 0;
+   }
+#endif
+
+   /* Skipping a hole leaves zeroes only past the end of the destination. */
+   sparse = dstPos >= dstSb.st_size;
+   bufSize = MIN(srcEnd - srcPos, FILE_COPY_BUFFER_SIZE);
+
+   for (off = srcPos; off < srcEnd; ) {
+      off_t data = off;
+      off_t hole = srcEnd;
+      uint64 copied = 0;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+      if (sparse) {
+         data = lseek(srcFd, off, SEEK_DATA);
+
+         if (data == -1) {
+            if (errno == ENXIO) {         // Only a hole is left
+               break;
+            }
+
+            sparse = FALSE;               // Not supported
+            data = off;
+         } else {
+            hole = lseek(srcFd, data, SEEK_HOLE);
+            hole = (hole == -1) ? srcEnd : MIN(hole, srcEnd);
+         }
+      }
+#endif
+
+      if (data >= srcEnd) {
+         break;
+      }
+
+      err = FileCopyRange(srcFd, dstFd, data, dstPos + (data - srcPos),
+                          hole - data, &buf, bufSize, &copied);
+      if (err != 0) {
+         goto exit;
+      }
+
+      if (copied < hole - data) {         // The source shrank
+         srcEnd = data + copied;
+         break;
+      }
+
+      off = hole;
+   }
+
+   /* A trailing hole was not written. */
+   if (fstat(dstFd, &dstSb) == 0 &&
+       dstSb.st_size < dstPos + (srcEnd - srcPos) &&
+       ftruncate(dstFd, dstPos + (srcEnd - srcPos)) != 0) {
+      err = errno;
+      goto exit;
+   }
+
+   lseek(srcFd, srcEnd, SEEK_SET);
+   lseek(dstFd, dstPos + (srcEnd - srcPos), SEEK_SET);
+
+exit:
+   free(buf);
+
+   return err;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
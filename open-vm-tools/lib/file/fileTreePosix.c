@@ -0,0 +1,1155 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * fileTreePosix.c --
+ *
+ *      Parallel directory tree walks, and the tree deletion, copy and size
+ *      built on them.
+ *
+ *      Each worker thread owns a deque of directories to read. It reads
+ *      the directory it took, handles its entries relative to the
+ *      directory descriptor and pushes the subdirectories on its own deque,
+ *      which it then pops depth first; an idle worker steals the oldest,
+ *      and so largest, directory of another worker. The d_type of the
+ *      entries saves the stat of each of them on most file systems.
+ *
+ *      A directory is left (and, when deleting, removed) once it and all
+ *      its subdirectories are done. The helper threads are only started
+ *      once the walk finds a subdirectory, so a flat directory is walked
+ *      by the calling thread alone.
+ *
+ *      The paths are in the local encoding, as returned by the OS; only the
+ *      root and the path reported on error are converted.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#include <syscall.h>
+#endif
+
+#include "vmware.h"
+#include "fileInt.h"
+#include "hostinfo.h"
+#include "util.h"
+#include "str.h"
+#include "unicodeOperations.h"
+#include "userlock.h"
+#include "mutexRankLib.h"
+
+#define FILETREE_MAX_WORKERS  8
+#define FILETREE_IDLE_MSEC    10
+#define FILETREE_DENTS_SIZE   (64 * 1024)
+
+#if defined(__linux__) && defined(__NR_getdents64)
+#define FILETREE_HAS_GETDENTS64 1
+
+typedef struct FileTreeDirent64 {
+   uint64         d_ino;
+   int64          d_off;
+   unsigned short d_reclen;
+   unsigned char  d_type;
+   char           d_name[];
+} FileTreeDirent64;
+#endif
+
+typedef struct FileTreeDir {
+   struct FileTreeDir *parent;
+   Atomic_uint32       pending;  // Itself and its unfinished subdirectories
+   char               *path;     // Local encoding
+} FileTreeDir;
+
+typedef struct FileTreeWalk FileTreeWalk;
+
+typedef struct FileTreeWorker {
+   FileTreeWalk    *walk;
+   pthread_t        thread;
+   MXUserExclLock  *lock;        // Protects the deque
+   FileTreeDir    **deque;
+   unsigned         head;
+   unsigned         count;
+   unsigned         size;
+   char            *dents;       // getdents64 buffer
+} FileTreeWorker;
+
+typedef struct FileTreeOps {
+   Bool followSymlinks;
+   Bool stopOnError;
+
+   /* Before the entries of a directory. Returns an errno. */
+   int (*enterDir)(FileTreeWalk *walk, FileTreeWorker *worker,
+                   const FileTreeDir *dir);
+
+   /* Every entry but the subdirectories; sb is NULL if not fetched. */
+   int (*visit)(FileTreeWalk *walk, FileTreeWorker *worker,
+                const FileTreeDir *dir, int dirFd, const char *name,
+                unsigned char type, const struct stat *sb);
+
+   /* After a directory and all its subdirectories. */
+   int (*leaveDir)(FileTreeWalk *walk, FileTreeWorker *worker,
+                   const FileTreeDir *dir);
+} FileTreeOps;
+
+struct FileTreeWalk {
+   const FileTreeOps *ops;
+   size_t             rootLen;
+
+   Atomic_uint32      outstanding;  // Directories queued or being read
+   Atomic_uint32      error;        // First errno
+   char              *errorPath;    // Set along with error
+   Bool               rootFailed;
+
+   MXUserExclLock    *idleLock;
+   MXUserCondVar     *idleCondVar;
+   Atomic_uint32      numIdle;
+
+   unsigned           numWorkers;
+   Bool               spawned;
+   FileTreeWorker     workers[FILETREE_MAX_WORKERS];
+
+   /* Operation specific. */
+   Bool               contentOnly;
+   Bool               overwriteExisting;
+   char              *dstRoot;
+   Atomic_uint64      size;
+};
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeFail --
+ *
+ *      Record an error of the walk; the first one wins.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Stops the walk if the operation stops on error.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeFail(FileTreeWalk *walk,      // IN/OUT:
+             const FileTreeDir *dir,  // IN:
+             const char *name,        // IN/OPT: entry of dir
+             int err)                 // IN:
+{
+   ASSERT(err != 0);
+
+   if (Atomic_ReadIfEqualWrite32(&walk->error, 0, err) == 0) {
+      walk->errorPath = (name == NULL) ? Util_SafeStrdup(dir->path) :
+                        Str_SafeAsprintf(NULL, "%s/%s", dir->path, name);
+   }
+}
+
+
+static INLINE Bool
+FileTreeStopped(FileTreeWalk *walk)  // IN:
+{
+   return walk->ops->stopOnError && Atomic_Read32(&walk->error) != 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeSignal --
+ *
+ *      Wake the idle workers, if any.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeSignal(FileTreeWalk *walk,  // IN:
+               Bool all)            // IN: broadcast
+{
+   if (Atomic_Read32(&walk->numIdle) == 0) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(walk->idleLock);
+   if (all) {
+      MXUser_BroadcastCondVar(walk->idleCondVar);
+   } else {
+      MXUser_SignalCondVar(walk->idleCondVar);
+   }
+   MXUser_ReleaseExclLock(walk->idleLock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreePop --
+ * FileTreeSteal --
+ *
+ *      Take the newest directory of the deque of the worker, or the oldest
+ *      one of the deque of another worker.
+ *
+ * Results:
+ *      The directory, NULL if none.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static FileTreeDir *
+FileTreePop(FileTreeWorker *worker)  // IN/OUT:
+{
+   FileTreeDir *dir = NULL;
+
+   MXUser_AcquireExclLock(worker->lock);
+   if (worker->count > 0) {
+      worker->count--;
+      dir = worker->deque[(worker->head + worker->count) % worker->size];
+   }
+   MXUser_ReleaseExclLock(worker->lock);
+
+   return dir;
+}
+
+static FileTreeDir *
+FileTreeSteal(FileTreeWorker *thief)  // IN:
+{
+   FileTreeWalk *walk = thief->walk;
+   unsigned start = thief - walk->workers;
+   unsigned i;
+
+   for (i = 1; i < walk->numWorkers; i++) {
+      FileTreeWorker *victim = &walk->workers[(start + i) % walk->numWorkers];
+      FileTreeDir *dir = NULL;
+
+      /* Racy peek: a missed directory is found on the next round. */
+      if (victim->count == 0) {
+         continue;
+      }
+
+      MXUser_AcquireExclLock(victim->lock);
+      if (victim->count > 0) {
+         dir = victim->deque[victim->head];
+         victim->head = (victim->head + 1) % victim->size;
+         victim->count--;
+      }
+      MXUser_ReleaseExclLock(victim->lock);
+
+      if (dir != NULL) {
+         return dir;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeWorkerMain --
+ *
+ *      Thread body of the helper workers.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void FileTreeWork(FileTreeWorker *worker);
+
+static void *
+FileTreeWorkerMain(void *clientData)  // IN: worker
+{
+   FileTreeWork(clientData);
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeSpawn --
+ *
+ *      Start the helper workers. Called once, by the calling thread.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      If no thread can be started, the walk goes on in the calling thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeSpawn(FileTreeWalk *walk)  // IN/OUT:
+{
+   unsigned i;
+
+   walk->spawned = TRUE;
+
+   for (i = 1; i < walk->numWorkers; i++) {
+      if (pthread_create(&walk->workers[i].thread, NULL, FileTreeWorkerMain,
+                         &walk->workers[i]) != 0) {
+         break;
+      }
+   }
+
+   /* The deques of the workers not started stay empty. */
+   walk->numWorkers = i;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreePush --
+ *
+ *      Queue a subdirectory on the deque of the worker.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreePush(FileTreeWorker *worker,  // IN/OUT:
+             FileTreeDir *parent,     // IN/OUT:
+             const char *name)        // IN:
+{
+   FileTreeWalk *walk = worker->walk;
+   FileTreeDir *dir = Util_SafeMalloc(sizeof *dir);
+
+   dir->parent = parent;
+   Atomic_Write32(&dir->pending, 1);
+   dir->path = Str_SafeAsprintf(NULL, "%s/%s", parent->path, name);
+
+   Atomic_Inc32(&parent->pending);
+   Atomic_Inc32(&walk->outstanding);
+
+   MXUser_AcquireExclLock(worker->lock);
+   if (worker->count == worker->size) {
+      unsigned size = MAX(2 * worker->size, 64);
+      FileTreeDir **deque = Util_SafeCalloc(size, sizeof *deque);
+      unsigned i;
+
+      for (i = 0; i < worker->count; i++) {
+         deque[i] = worker->deque[(worker->head + i) % worker->size];
+      }
+
+      free(worker->deque);
+      worker->deque = deque;
+      worker->head = 0;
+      worker->size = size;
+   }
+   worker->deque[(worker->head + worker->count) % worker->size] = dir;
+   worker->count++;
+   MXUser_ReleaseExclLock(worker->lock);
+
+   if (!walk->spawned && worker == &walk->workers[0]) {
+      FileTreeSpawn(walk);
+   } else {
+      FileTreeSignal(walk, FALSE);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeDirDone --
+ *
+ *      Drop a reference to a directory; leave the directories which are
+ *      done, up the tree.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees the directories.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeDirDone(FileTreeWorker *worker,  // IN:
+                FileTreeDir *dir)        // IN/OUT:
+{
+   FileTreeWalk *walk = worker->walk;
+
+   while (dir != NULL && Atomic_ReadDec32(&dir->pending) == 1) {
+      FileTreeDir *parent = dir->parent;
+
+      if (walk->ops->leaveDir != NULL && !FileTreeStopped(walk)) {
+         int err = walk->ops->leaveDir(walk, worker, dir);
+
+         if (err != 0) {
+            FileTreeFail(walk, dir, NULL, err);
+         }
+      }
+
+      free(dir->path);
+      free(dir);
+      dir = parent;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeEntry --
+ *
+ *      Handle an entry of a directory: queue it if a directory, visit it
+ *      otherwise.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeEntry(FileTreeWorker *worker,  // IN:
+              FileTreeDir *dir,        // IN/OUT:
+              int dirFd,               // IN:
+              const char *name,        // IN:
+              unsigned char type)      // IN: d_type
+{
+   FileTreeWalk *walk = worker->walk;
+   struct stat sb;
+   struct stat *sbp = NULL;
+   int err;
+
+   if (name[0] == '.' &&
+       (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+      return;
+   }
+
+   if (type == DT_UNKNOWN ||
+       (type == DT_LNK && walk->ops->followSymlinks)) {
+      int flags = walk->ops->followSymlinks ? 0 : AT_SYMLINK_NOFOLLOW;
+
+      if (fstatat(dirFd, name, &sb, flags) != 0) {
+         FileTreeFail(walk, dir, name, errno);
+         return;
+      }
+
+      sbp = &sb;
+
+      switch (sb.st_mode & S_IFMT) {
+      case S_IFDIR:
+         type = DT_DIR;
+         break;
+      case S_IFLNK:
+         type = DT_LNK;
+         break;
+      case S_IFREG:
+         type = DT_REG;
+         break;
+      default:
+         type = DT_UNKNOWN;
+         break;
+      }
+   }
+
+   if (type == DT_DIR) {
+      FileTreePush(worker, dir, name);
+      return;
+   }
+
+   err = walk->ops->visit(walk, worker, dir, dirFd, name, type, sbp);
+   if (err != 0) {
+      FileTreeFail(walk, dir, name, err);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeReadDir --
+ *
+ *      Read a directory and handle its entries.
+ *
+ * Results:
+ *      0 on success, errno otherwise.
+ *
+ * Side effects:
+ *      Closes dirFd.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FileTreeReadDir(FileTreeWorker *worker,  // IN:
+                FileTreeDir *dir,        // IN/OUT:
+                int dirFd)               // IN:
+{
+   int err = 0;
+#if defined(FILETREE_HAS_GETDENTS64)
+   if (worker->dents == NULL) {
+      worker->dents = Util_SafeMalloc(FILETREE_DENTS_SIZE);
+   }
+
+   /* Up to 64 KiB of entries per call; readdir() reads a page or so. */
+   for (;;) {
+      long len = syscall(__NR_getdents64, dirFd, worker->dents,
+                         FILETREE_DENTS_SIZE);
+      long off;
+
+      if (len <= 0) {
+         err = (len < 0) ? errno : 0;
+         break;
+      }
+
+      for (off = 0; off < len && !FileTreeStopped(worker->walk); ) {
+         FileTreeDirent64 *ent = (FileTreeDirent64 *) (worker->dents + off);
+
+         FileTreeEntry(worker, dir, dirFd, ent->d_name, ent->d_type);
+         off += ent->d_reclen;
+      }
+   }
+
+   close(dirFd);
+#else
+   DIR *dirp = fdopendir(dirFd);
+
+   if (dirp == NULL) {
+      err = errno;
+      close(dirFd);
+
+      return err;
+   }
+
+   while (!FileTreeStopped(worker->walk)) {
+      struct dirent *ent;
+
+      errno = 0;
+      ent = readdir(dirp);
+      if (ent == NULL) {
+         err = errno;
+         break;
+      }
+
+#if defined(DT_UNKNOWN)
+      FileTreeEntry(worker, dir, dirFd, ent->d_name, ent->d_type);
+#else
+      FileTreeEntry(worker, dir, dirFd, ent->d_name, DT_UNKNOWN);
+#endif
+   }
+
+   closedir(dirp);
+#endif
+
+   return err;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeProcess --
+ *
+ *      Process one directory taken by the worker.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Wakes the workers when the walk is done.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeProcess(FileTreeWorker *worker,  // IN:
+                FileTreeDir *dir)        // IN/OUT:
+{
+   FileTreeWalk *walk = worker->walk;
+   int err = 0;
+
+   if (!FileTreeStopped(walk) && walk->ops->enterDir != NULL) {
+      err = walk->ops->enterDir(walk, worker, dir);
+   }
+
+   if (err == 0 && !FileTreeStopped(walk)) {
+      int flags = O_RDONLY | O_DIRECTORY | O_CLOEXEC;
+      int fd;
+
+      /* Do not follow a directory replaced by a symlink since it was read. */
+      if (dir->parent != NULL && !walk->ops->followSymlinks) {
+         flags |= O_NOFOLLOW;
+      }
+
+      fd = open(dir->path, flags);
+      err = (fd < 0) ? errno : FileTreeReadDir(worker, dir, fd);
+   }
+
+   if (err != 0) {
+      FileTreeFail(walk, dir, NULL, err);
+      walk->rootFailed = walk->rootFailed || dir->parent == NULL;
+   }
+
+   FileTreeDirDone(worker, dir);
+
+   if (Atomic_ReadDec32(&walk->outstanding) == 1) {
+      FileTreeSignal(walk, TRUE);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeWork --
+ *
+ *      Process directories until the walk is done.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+FileTreeWork(FileTreeWorker *worker)  // IN:
+{
+   FileTreeWalk *walk = worker->walk;
+
+   for (;;) {
+      FileTreeDir *dir = FileTreePop(worker);
+
+      if (dir == NULL) {
+         dir = FileTreeSteal(worker);
+      }
+
+      if (dir != NULL) {
+         FileTreeProcess(worker, dir);
+         continue;
+      }
+
+      if (Atomic_Read32(&walk->outstanding) == 0) {
+         break;
+      }
+
+      /* A missed signal only costs the timeout. */
+      MXUser_AcquireExclLock(walk->idleLock);
+      Atomic_Inc32(&walk->numIdle);
+      if (Atomic_Read32(&walk->outstanding) != 0) {
+         MXUser_TimedWaitCondVarExclLock(walk->idleLock, walk->idleCondVar,
+                                         FILETREE_IDLE_MSEC);
+      }
+      Atomic_Dec32(&walk->numIdle);
+      MXUser_ReleaseExclLock(walk->idleLock);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeWalkRun --
+ *
+ *      Walk the tree at pathName with the workers.
+ *
+ * Results:
+ *      0 on success, the first errno otherwise; *errorPath, if not NULL,
+ *      is then the path that failed, to free with Posix_Free.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FileTreeWalkRun(FileTreeWalk *walk,   // IN/OUT:
+                const char *pathName, // IN:
+                char **errorPath)     // OUT/OPT:
+{
+   uint32 numCPUs = Hostinfo_NumCPUs();
+   unsigned numThreads;
+   FileTreeDir *root;
+   unsigned i;
+   int err;
+
+   root = Util_SafeMalloc(sizeof *root);
+   root->parent = NULL;
+   Atomic_Write32(&root->pending, 1);
+   root->path = Unicode_GetAllocBytes(pathName, STRING_ENCODING_DEFAULT);
+   if (root->path == NULL) {
+      free(root);
+      walk->rootFailed = TRUE;
+      if (errorPath != NULL) {
+         *errorPath = Util_SafeStrdup(pathName);
+      }
+
+      return EINVAL;
+   }
+
+   walk->rootLen = strlen(root->path);
+   walk->numWorkers = (numCPUs == 0 || numCPUs == 0xFFFFFFFF) ? 1 :
+                      MIN(numCPUs, FILETREE_MAX_WORKERS);
+   walk->idleLock = MXUser_CreateExclLock("fileTreeIdleLock", RANK_LEAF);
+   walk->idleCondVar = MXUser_CreateCondVarExclLock(walk->idleLock);
+
+   for (i = 0; i < walk->numWorkers; i++) {
+      walk->workers[i].walk = walk;
+      walk->workers[i].lock = MXUser_CreateExclLock("fileTreeDequeLock",
+                                                    RANK_LEAF);
+   }
+
+   Atomic_Write32(&walk->outstanding, 1);
+   FileTreeProcess(&walk->workers[0], root);
+   FileTreeWork(&walk->workers[0]);
+
+   numThreads = walk->spawned ? walk->numWorkers : 1;
+
+   for (i = 0; i < FILETREE_MAX_WORKERS; i++) {
+      FileTreeWorker *worker = &walk->workers[i];
+
+      if (i > 0 && i < numThreads) {
+         pthread_join(worker->thread, NULL);
+      }
+
+      if (worker->lock != NULL) {
+         ASSERT(worker->count == 0);
+         MXUser_DestroyExclLock(worker->lock);
+      }
+      free(worker->deque);
+      free(worker->dents);
+   }
+
+   MXUser_DestroyCondVar(walk->idleCondVar);
+   MXUser_DestroyExclLock(walk->idleLock);
+
+   err = Atomic_Read32(&walk->error);
+
+   if (err != 0 && errorPath != NULL) {
+      *errorPath = Unicode_Alloc(walk->errorPath, STRING_ENCODING_DEFAULT);
+   }
+   free(walk->errorPath);
+
+   return err;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeDeleteVisit --
+ * FileTreeDeleteLeave --
+ *
+ *      Operations of FileTreeDelete.
+ *
+ * Results:
+ *      0 on success, errno otherwise.
+ *
+ * Side effects:
+ *      Deletes the entry or directory.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FileTreeDeleteVisit(FileTreeWalk *walk,      // IN:
+                    FileTreeWorker *worker,  // IN:
+                    const FileTreeDir *dir,  // IN:
+                    int dirFd,               // IN:
+                    const char *name,        // IN:
+                    unsigned char type,      // IN:
+                    const struct stat *sb)   // IN/OPT:
+{
+   /* Symlinks are deleted, not what they point to. */
+   if (unlinkat(dirFd, name, 0) != 0 && errno != ENOENT) {
+      return errno;
+   }
+
+   return 0;
+}
+
+static int
+FileTreeDeleteLeave(FileTreeWalk *walk,      // IN:
+                    FileTreeWorker *worker,  // IN:
+                    const FileTreeDir *dir)  // IN:
+{
+   if (dir->parent == NULL && walk->contentOnly) {
+      return 0;
+   }
+
+   /* Fails if some content could not be deleted, which was recorded first. */
+   return (rmdir(dir->path) == 0) ? 0 : errno;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeDelete --
+ *
+ *      Delete the directory tree at pathName, or only its content. Errors
+ *      do not stop the deletion.
+ *
+ * Results:
+ *      0 on success, the first errno otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+FileTreeDelete(const char *pathName,  // IN:
+               Bool contentOnly)      // IN:
+{
+   static const FileTreeOps ops = {
+      FALSE,                // followSymlinks
+      FALSE,                // stopOnError
+      NULL,
+      FileTreeDeleteVisit,
+      FileTreeDeleteLeave,
+   };
+   FileTreeWalk walk;
+
+   memset(&walk, 0, sizeof walk);
+   walk.ops = &ops;
+   walk.contentOnly = contentOnly;
+
+   return FileTreeWalkRun(&walk, pathName, NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeDstPath --
+ *
+ *      The destination path of an entry of a directory, or of the
+ *      directory itself.
+ *
+ * Results:
+ *      The path, to free.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static char *
+FileTreeDstPath(const FileTreeWalk *walk,  // IN:
+                const FileTreeDir *dir,    // IN:
+                const char *name)          // IN/OPT:
+{
+   return Str_SafeAsprintf(NULL, "%s%s%s%s", walk->dstRoot,
+                           dir->path + walk->rootLen,
+                           (name == NULL) ? "" : "/",
+                           (name == NULL) ? "" : name);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeCopyEnter --
+ * FileTreeCopyVisit --
+ *
+ *      Operations of FileTreeCopy.
+ *
+ * Results:
+ *      0 on success, errno otherwise.
+ *
+ * Side effects:
+ *      Creates the directory or copies the entry.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FileTreeCopyEnter(FileTreeWalk *walk,      // IN:
+                  FileTreeWorker *worker,  // IN:
+                  const FileTreeDir *dir)  // IN:
+{
+   char *dstPath;
+   int err = 0;
+
+   if (dir->parent == NULL) {
+      return 0;
+   }
+
+   dstPath = FileTreeDstPath(walk, dir, NULL);
+   if (mkdir(dstPath, 0777) != 0 && errno != EEXIST) {
+      err = errno;
+   }
+   free(dstPath);
+
+   return err;
+}
+
+static int
+FileTreeCopyVisit(FileTreeWalk *walk,      // IN:
+                  FileTreeWorker *worker,  // IN:
+                  const FileTreeDir *dir,  // IN:
+                  int dirFd,               // IN:
+                  const char *name,        // IN:
+                  unsigned char type,      // IN:
+                  const struct stat *sb)   // IN/OPT:
+{
+   char *dstPath = FileTreeDstPath(walk, dir, name);
+   struct stat srcSb;
+   int srcFd = -1;
+   int dstFd = -1;
+   int err = 0;
+
+   if (type == DT_LNK) {
+      char target[PATH_MAX];
+      ssize_t len = readlinkat(dirFd, name, target, sizeof target - 1);
+
+      if (len < 0) {
+         err = errno;
+      } else {
+         target[len] = '\0';
+         if (symlink(target, dstPath) != 0) {
+            err = errno;
+         }
+      }
+
+      goto exit;
+   }
+
+   /* O_NONBLOCK: a FIFO must not block the walk. */
+   srcFd = openat(dirFd, name, O_RDONLY | O_CLOEXEC | O_NONBLOCK |
+                  (walk->ops->followSymlinks ? 0 : O_NOFOLLOW));
+   if (srcFd < 0 || fstat(srcFd, &srcSb) != 0) {
+      err = errno;
+      goto exit;
+   }
+
+   if (!S_ISREG(srcSb.st_mode)) {
+      err = EINVAL;
+      goto exit;
+   }
+
+   dstFd = open(dstPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC |
+                (walk->overwriteExisting ? 0 : O_EXCL),
+                srcSb.st_mode & 0777);
+   if (dstFd < 0) {
+      err = errno;
+      goto exit;
+   }
+
+   err = FileCopyFdData(srcFd, dstFd);
+
+   if (close(dstFd) != 0 && err == 0) {
+      err = errno;
+   }
+   dstFd = -1;
+
+exit:
+   if (srcFd >= 0) {
+      close(srcFd);
+   }
+   free(dstPath);
+
+   return err;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeCopy --
+ *
+ *      Copy the content of the directory tree at srcName into the existing
+ *      directory dstName. Stops at the first error.
+ *
+ * Results:
+ *      0 on success, the first errno otherwise; *errorPath is then the path
+ *      that failed, to free with Posix_Free.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+FileTreeCopy(const char *srcName,     // IN:
+             const char *dstName,     // IN:
+             Bool overwriteExisting,  // IN:
+             Bool followSymlinks,     // IN:
+             char **errorPath)        // OUT:
+{
+   static const FileTreeOps copyOps = {
+      FALSE,                // followSymlinks
+      TRUE,                 // stopOnError
+      FileTreeCopyEnter,
+      FileTreeCopyVisit,
+      NULL,
+   };
+   static const FileTreeOps copyFollowOps = {
+      TRUE,                 // followSymlinks
+      TRUE,                 // stopOnError
+      FileTreeCopyEnter,
+      FileTreeCopyVisit,
+      NULL,
+   };
+   FileTreeWalk walk;
+   int err;
+
+   ASSERT(errorPath != NULL);
+
+   *errorPath = NULL;
+
+   memset(&walk, 0, sizeof walk);
+   walk.ops = followSymlinks ? &copyFollowOps : &copyOps;
+   walk.overwriteExisting = overwriteExisting;
+   walk.dstRoot = Unicode_GetAllocBytes(dstName, STRING_ENCODING_DEFAULT);
+   if (walk.dstRoot == NULL) {
+      *errorPath = Util_SafeStrdup(dstName);
+
+      return EINVAL;
+   }
+
+   err = FileTreeWalkRun(&walk, srcName, errorPath);
+   free(walk.dstRoot);
+
+   return err;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeSizeVisit --
+ *
+ *      Operation of FileTreeGetSize.
+ *
+ * Results:
+ *      0; entries which cannot be read are not counted.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+FileTreeSizeVisit(FileTreeWalk *walk,      // IN:
+                  FileTreeWorker *worker,  // IN:
+                  const FileTreeDir *dir,  // IN:
+                  int dirFd,               // IN:
+                  const char *name,        // IN:
+                  unsigned char type,      // IN:
+                  const struct stat *sb)   // IN/OPT:
+{
+   struct stat sbuf;
+
+   if (sb == NULL) {
+      if (fstatat(dirFd, name, &sbuf, 0) != 0) {
+         return 0;
+      }
+      sb = &sbuf;
+   }
+
+   Atomic_Add64(&walk->size, sb->st_size);
+
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * FileTreeGetSize --
+ *
+ *      Sum the sizes of the files of the directory tree at pathName,
+ *      following the symlinks.
+ *
+ * Results:
+ *      The size, -1 if the directory cannot be read.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int64
+FileTreeGetSize(const char *pathName)  // IN:
+{
+   static const FileTreeOps ops = {
+      TRUE,                 // followSymlinks
+      FALSE,                // stopOnError
+      NULL,
+      FileTreeSizeVisit,
+      NULL,
+   };
+   FileTreeWalk walk;
+   int err;
+
+   memset(&walk, 0, sizeof walk);
+   walk.ops = &ops;
+
+   err = FileTreeWalkRun(&walk, pathName, NULL);
+
+   /* The entries which cannot be read are not counted. */
+   if (walk.rootFailed) {
+      errno = err;
+
+      return -1;
+   }
+
+   return Atomic_Read64(&walk.size);
+}
@@ -456,6 +456,13 @@ static const VixCommandInfo vixCommandInfoTable[] = {
 
    VIX_DEFINE_COMMAND_INFO(VIX_COMMAND_REMOVE_AUTH_ALIAS_BY_CERT,
                            VIX_COMMAND_CATEGORY_ALWAYS_ALLOWED),
+
+   VIX_DEFINE_COMMAND_INFO(VIX_COMMAND_BATCH,
+                           VIX_COMMAND_CATEGORY_ALWAYS_ALLOWED),
+   VIX_DEFINE_COMMAND_INFO(VIX_COMMAND_READ_PROGRAM_OUTPUT,
+                           VIX_COMMAND_CATEGORY_ALWAYS_ALLOWED),
+   VIX_DEFINE_COMMAND_INFO(VIX_COMMAND_GET_MULTIPLE_FILE_INFO,
+                           VIX_COMMAND_CATEGORY_ALWAYS_ALLOWED),
 };
 
 
@@ -507,8 +514,6 @@ VixMsg_AllocResponseMsg(const VixCommandRequestHeader *requestHeader, // IN
                         const void *responseBody,                     // IN
                         size_t *responseMsgLength)                    // OUT
 {
-   char *responseBuffer = NULL;
-   VixCommandResponseHeader *responseHeader;
    size_t totalMessageSize;
 
    ASSERT((NULL != responseBody) || (0 == responseBodyLength));
@@ -528,8 +533,61 @@ VixMsg_AllocResponseMsg(const VixCommandRequestHeader *requestHeader, // IN
       return NULL;
    }
 
-   responseBuffer = Util_SafeMalloc(totalMessageSize);
-   responseHeader = (VixCommandResponseHeader *) responseBuffer;
+   return VixMsg_WriteResponseMsg(requestHeader,
+                                  error,
+                                  additionalError,
+                                  responseBodyLength,
+                                  responseBody,
+                                  Util_SafeMalloc(totalMessageSize),
+                                  totalMessageSize,
+                                  responseMsgLength);
+} // VixMsg_AllocResponseMsg
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * VixMsg_WriteResponseMsg --
+ *
+ *      Build a response message in a buffer supplied by the caller, e.g.
+ *      the reply buffer of the RPC which carries it, instead of allocating
+ *      it and copying it there.
+ *
+ * Results:
+ *      The message, at the start of the buffer, with the headers properly
+ *      initialized. NULL if the message would be larger than the buffer,
+ *      or than VIX_COMMAND_MAX_SIZE.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+VixCommandResponseHeader *
+VixMsg_WriteResponseMsg(const VixCommandRequestHeader *requestHeader, // IN
+                        VixError error,                               // IN
+                        uint32 additionalError,                       // IN
+                        size_t responseBodyLength,                    // IN
+                        const void *responseBody,                     // IN
+                        void *buffer,                                 // OUT
+                        size_t bufferSize,                            // IN
+                        size_t *responseMsgLength)                    // OUT
+{
+   VixCommandResponseHeader *responseHeader = buffer;
+   size_t totalMessageSize;
+
+   ASSERT((NULL != responseBody) || (0 == responseBodyLength));
+   ASSERT(NULL != buffer);
+
+   if (responseBodyLength > VIX_COMMAND_MAX_SIZE) {
+      return NULL;
+   }
+   totalMessageSize = sizeof(VixCommandResponseHeader) + responseBodyLength;
+   if (totalMessageSize > VIX_COMMAND_MAX_SIZE ||
+       totalMessageSize > bufferSize) {
+      return NULL;
+   }
 
    VixMsg_InitResponseMsg(responseHeader,
                           requestHeader,
@@ -537,10 +595,15 @@ VixMsg_AllocResponseMsg(const VixCommandRequestHeader *requestHeader, // IN
                           additionalError,
                           totalMessageSize);
 
-   if ((responseBodyLength > 0) && (responseBody)) {
-      memcpy(responseBuffer + sizeof(VixCommandResponseHeader), 
-             responseBody,
-             responseBodyLength);
+   /*
+    * The body may already be in place, if the caller built it there.
+    */
+   if ((responseBodyLength > 0) && (responseBody) &&
+       (responseBody != (const char *) buffer +
+                        sizeof(VixCommandResponseHeader))) {
+      memmove((char *) buffer + sizeof(VixCommandResponseHeader),
+              responseBody,
+              responseBodyLength);
    }
 
    if (NULL != responseMsgLength) {
@@ -548,7 +611,7 @@ VixMsg_AllocResponseMsg(const VixCommandRequestHeader *requestHeader, // IN
    }
 
    return responseHeader;
-} // VixMsg_AllocResponseMsg
+} // VixMsg_WriteResponseMsg
 
 
 /*
@@ -1086,6 +1149,67 @@ abort:
 } // VixMsg_ObfuscateNamePassword
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixMsg_DeObfuscateNamePasswordInBuffer --
+ *
+ *      This reverses VixMsg_ObfuscateNamePassword, leaving the name and the
+ *      password in the one buffer they are decoded into, so that a caller
+ *      which only looks at them does not copy them.
+ *
+ *      The buffer holds credentials: the caller must release it with
+ *      Util_ZeroFree(*packedBuffer, *packedBufferLength).
+ *
+ * Results:
+ *      VixError. VIX_OK if successful.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+VixError
+VixMsg_DeObfuscateNamePasswordInBuffer(const char *packagedName,   // IN
+                                       char **packedBuffer,        // OUT
+                                       size_t *packedBufferLength, // OUT
+                                       const char **userName,      // OUT
+                                       const char **password)      // OUT
+{
+   VixError err;
+   char *packedString = NULL;
+   size_t packedStringLength;
+   size_t nameLength;
+
+   /*
+    * The terminator added after the decoded bytes ends the password if
+    * the client left out its NUL.
+    */
+   err = VixMsgDecodeBuffer(packagedName, TRUE,
+                            &packedString, &packedStringLength);
+   if (err != VIX_OK) {
+      return err;
+   }
+   if (NULL == packedString) {
+      return VIX_E_INVALID_ARG;
+   }
+
+   nameLength = Str_Strlen(packedString, packedStringLength);
+   if (nameLength >= packedStringLength) {
+      Util_ZeroFree(packedString, packedStringLength + 1);
+      return VIX_E_INVALID_ARG;
+   }
+
+   *packedBuffer = packedString;
+   *packedBufferLength = packedStringLength + 1;
+   *userName = packedString;
+   *password = packedString + nameLength + 1;
+
+   return VIX_OK;
+} // VixMsg_DeObfuscateNamePasswordInBuffer
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1110,31 +1234,31 @@ VixMsg_DeObfuscateNamePassword(const char *packagedName,   // IN
 {
    VixError err;
    char *packedString = NULL;
-   char *srcPtr;
-   size_t packedStringLength;
+   size_t packedStringLength = 0;
+   const char *srcName;
+   const char *srcPassword;
    char *userName = NULL;
    char *passwd = NULL;
 
-   err = VixMsgDecodeBuffer(packagedName, FALSE,
-                            &packedString, &packedStringLength);
+   err = VixMsg_DeObfuscateNamePasswordInBuffer(packagedName,
+                                                &packedString,
+                                                &packedStringLength,
+                                                &srcName, &srcPassword);
    if (err != VIX_OK) {
       goto abort;
    }
 
-   srcPtr = packedString;
    if (NULL != userNameResult) {
       Bool allocateFailed;
-      userName = VixMsg_StrdupClientData(srcPtr, &allocateFailed);
+      userName = VixMsg_StrdupClientData(srcName, &allocateFailed);
       if (allocateFailed) {
          err = VIX_E_OUT_OF_MEMORY;
          goto abort;
       }
    }
-   srcPtr = srcPtr + strlen(srcPtr);
-   srcPtr++;
    if (NULL != passwordResult) {
       Bool allocateFailed;
-      passwd = VixMsg_StrdupClientData(srcPtr, &allocateFailed);
+      passwd = VixMsg_StrdupClientData(srcPassword, &allocateFailed);
       if (allocateFailed) {
          err = VIX_E_OUT_OF_MEMORY;
          goto abort;
@@ -1364,61 +1488,77 @@ VixMsgDecodeBuffer(const char *str,           // IN
 {
    VixError err = VIX_OK;
    char *base64String = NULL;
+   const char *base64Src;
+   size_t base64Length;
    char *resultStr = NULL;
-   char *srcPtr;
-   char *destPtr;
    size_t resultStrAllocatedLength;
    size_t resultStrLogicalLength;
-   Bool allocateFailed;
 
    if (NULL != bufferLength) {
       *bufferLength = 0;
    }
 
-   /*
-    * Remove escaped special characters.
-    * Do this in a private copy because we will change the string in place.
-    */
-   VixMsgInitializeObfuscationMapping();
-   base64String = VixMsg_StrdupClientData(str, &allocateFailed);
-   if (allocateFailed) {
-      err = VIX_E_OUT_OF_MEMORY;
-      goto abort;
-   }
-   destPtr = base64String;
-   srcPtr = base64String;
+   base64Src = str;
+   if (NULL == strchr(str, '\\')) {
+      /*
+       * None of the escaped characters is in the base64 alphabet, so
+       * VixMsgEncodeBuffer never escapes anything: decode the string as
+       * it is.
+       */
+      base64Length = strlen(str);
+   } else {
+      Bool allocateFailed;
+      char *srcPtr;
+      char *destPtr;
 
-   while (*srcPtr) {
-      if ('\\' == *srcPtr) {
-         srcPtr++;
-         /*
-          * There should never be a null byte as part of an escape character or
-          * an escape character than translates into a null byte.
-          */
-         if ((0 == *srcPtr)
-                || (0 == ObfuscatedToPlainCharMap[(unsigned int) (*srcPtr)])) {
-            goto abort;
+      /*
+       * Remove escaped special characters.
+       * Do this in a private copy because we will change the string in place.
+       */
+      VixMsgInitializeObfuscationMapping();
+      base64String = VixMsg_StrdupClientData(str, &allocateFailed);
+      if (allocateFailed) {
+         err = VIX_E_OUT_OF_MEMORY;
+         goto abort;
+      }
+      destPtr = base64String;
+      srcPtr = base64String;
+
+      while (*srcPtr) {
+         if ('\\' == *srcPtr) {
+            srcPtr++;
+            /*
+             * There should never be a null byte as part of an escape
+             * character or an escape character than translates into a
+             * null byte.
+             */
+            if ((0 == *srcPtr)
+                   || (0 == ObfuscatedToPlainCharMap[(unsigned int) (*srcPtr)])) {
+               goto abort;
+            }
+            *(destPtr++) = ObfuscatedToPlainCharMap[(unsigned int) (*srcPtr)];
+         } else {
+            *(destPtr++) = *srcPtr;
          }
-         *(destPtr++) = ObfuscatedToPlainCharMap[(unsigned int) (*srcPtr)];
-      } else {
-         *(destPtr++) = *srcPtr;
+         srcPtr++;
       }
-      srcPtr++;
+      *destPtr = 0;
+
+      base64Src = base64String;
+      base64Length = destPtr - base64String;
    }
-   *destPtr = 0;
 
    /*
     * Add 1 to the Base64_DecodedLength(), since we base64 encoded the string
     * without the NUL terminator and need to add one.
     */
-   resultStrAllocatedLength = Base64_DecodedLength(base64String,
-                                                   destPtr - base64String);
+   resultStrAllocatedLength = Base64_DecodedLength(base64Src, base64Length);
    if (nullTerminateResult) {
       resultStrAllocatedLength += 1;
    }
 
    resultStr = Util_SafeMalloc(resultStrAllocatedLength);
-   if (!Base64_Decode(base64String,
+   if (!Base64_Decode(base64Src,
                       resultStr,
                       resultStrAllocatedLength,
                       &resultStrLogicalLength)
@@ -15,7 +15,6 @@
  * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
  *
  *********************************************************/
-
 /*********************************************************
  * The contents of this file are subject to the terms of the Common
  * Development and Distribution License (the "License") version 1.0
@@ -31,10 +30,14 @@
  *********************************************************/
 
 #include "vm_basic_types.h"
+#include "vm_basic_asm.h"
 #include "vm_assert.h"
 
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "hashMap.h"
 #include "clamped.h"
@@ -51,10 +54,19 @@
  *    It is not intended to be thread safe nor should it be used in a way that
  *    this may cause problems.
  *
- *    Entries are stored based on a simple hash of their key.  Memory
- *    allocations are kept to a minimum to ensure that this is appropriate for
- *    use in a kernel mode driver.  Linear probing is used to resolve hash
- *    collisions.
+ *    Entries are stored based on a hash of their key.  Memory allocations are
+ *    kept to a minimum to ensure that this is appropriate for use in a kernel
+ *    mode driver.
+ *
+ *    The table is laid out as a "Swiss table": next to the array of entries,
+ *    which hold the key and the data inline, there is an array of one control
+ *    byte per entry that says whether the entry is empty, deleted or filled,
+ *    and for filled entries holds 7 bits of the hash of the key.  A lookup
+ *    loads the control bytes of a group of 16 consecutive entries at once
+ *    (with SSE2, or a plain loop elsewhere), and only compares the keys of
+ *    the entries whose 7 hash bits match; a group with an empty entry ends
+ *    the probe sequence.  Groups are probed quadratically, with the rest of
+ *    the hash selecting the first group.
  *
  *    This implementation only supports static length keys.  It might be
  *    possible to store the keys outside the table and thus support keys of
@@ -62,7 +74,8 @@
  *    string keys for example.
  *
  *    Callers should not store pointers to objects stored in the map as they may
- *    become invalid as a result of a resize.  If you need to share objects
+ *    become invalid as a result of a resize, which is spread over the puts and
+ *    removes that follow it (see Resize).  If you need to share objects
  *    stored as values in the map, then store pointers to the objects instead.
  *
  *    All objects are copied into the map and must be freed as appropriate by
@@ -75,7 +88,7 @@
  *      supports string and insensitive string keys and only supports pointer
  *      data.  This means its possible to store entire data structures in
  *      HashMap.
- *    - HashMap uses linear probing to resolve collisions while hashTable uses
+ *    - HashMap uses open addressing to resolve collisions while hashTable uses
  *      chaining.  HashMap will dynamically resize itself as necessary.
  *    - Pointers to HashMap values will be invalidated if the internal structure
  *      is resized.  If this is a problem, you should store the pointer in the
@@ -89,8 +102,50 @@
 
 #define HASHMAP_DEFAULT_ALPHA 2
 
+/*
+ * Control bytes.  Filled entries hold the low 7 bits of the hash, so the
+ * high bit tells empty and deleted entries from filled ones.
+ */
+#define HASHMAP_CTRL_EMPTY    ((uint8) 0x80)
+#define HASHMAP_CTRL_DELETED  ((uint8) 0xFE)
+#define HASHMAP_CTRL_IS_FULL(c)  (((c) & 0x80) == 0)
+
+/*
+ * Entries whose control bytes are probed at once.  The control array has
+ * HASHMAP_GROUP_WIDTH more bytes than entries, mirroring the first ones, so
+ * that a group can be loaded from any entry without wrapping around.  This
+ * is also the minimum size of a table.
+ */
+#define HASHMAP_GROUP_WIDTH   16
+
+/*
+ * Maximum load factor of the table, whatever alpha: a Swiss table needs
+ * some empty entries to end its probe sequences.
+ */
+#define HASHMAP_MAX_LOAD_NUM  7
+#define HASHMAP_MAX_LOAD_DEN  8
+
+/* Entries of the old table moved to the new one by each put or remove. */
+#define HASHMAP_MIGRATE_STEP  (2 * HASHMAP_GROUP_WIDTH)
+
+typedef struct HashMapTable {
+   uint8 *ctrl;         // numEntries + HASHMAP_GROUP_WIDTH control bytes
+   uint8 *entries;      // numEntries entries of entrySize bytes
+   uint32 numEntries;   // A power of 2, or 0 for no table
+   uint32 count;        // Filled entries
+   uint32 deleted;      // Deleted entries
+} HashMapTable;
+
 struct HashMap {
-   uint8 *entries;
+   HashMapTable table;
+   /*
+    * While a resize is in progress, the table being moved into the new one,
+    * and how many of its entries were moved.  Moved entries are marked
+    * deleted in it, so that a key is always in only one of the tables.
+    */
+   HashMapTable old;
+   uint32 migrated;
+
    uint32 numEntries;
    uint32 count;
    uint32 alpha;
@@ -122,31 +177,106 @@ struct HashMapOnDisk {
 HashMapOnDisk;
 #endif
 
-typedef enum {
-   HashMapState_EMPTY  = 0,
-   HashMapState_FILLED,
-   HashMapState_DELETED,
-} HashMapEntryState;
-
-typedef struct {
-   uint32 state;
-   uint32 hash;
-} HashMapEntryHeader;
-
 #define NO_FREE_INDEX ((uint32) -1)
 
 static Bool InitMap(struct HashMap *map, uint32 numEntries, uint32 alpha,
                     size_t keySize, size_t dataSize);
+static Bool InitTable(struct HashMap *map, HashMapTable *table,
+                      uint32 numEntries);
 static void CalculateEntrySize(struct HashMap *map);
-static void GetEntry(struct HashMap *map, uint32 index, HashMapEntryHeader **header, void **key, void **data);
+static INLINE uint8 *GetEntry(struct HashMap *map, const HashMapTable *table,
+                              uint32 index);
+static INLINE void SetCtrl(HashMapTable *table, uint32 index, uint8 ctrl);
 static uint32 ComputeHash(struct HashMap *map, const void *key);
-static Bool LookupKey(struct HashMap* map, const void *key, Bool constTimeLookup, HashMapEntryHeader **header, void **data, uint32 *freeIndex);
+static uint32 LookupKey(struct HashMap *map, const HashMapTable *table,
+                        const void *key, uint32 hash, Bool constTimeLookup);
+static Bool FindKey(struct HashMap *map, const void *key,
+                    Bool constTimeLookup, HashMapTable **table,
+                    uint32 *index);
+static uint32 FindFreeIndex(const HashMapTable *table, uint32 hash);
+static void InsertEntry(struct HashMap *map, HashMapTable *table,
+                        uint32 hash, const void *key, const void *data);
+static void RemoveEntry(struct HashMap *map, HashMapTable *table,
+                        uint32 index);
 static Bool CompareKeys(struct HashMap *map, const void *key, const void *compare);
 static Bool ConstTimeCompareKeys(struct HashMap *map, const void *key, const void *compare);
 static Bool NeedsResize(struct HashMap *map);
-static void Resize(struct HashMap *map);
+static Bool Resize(struct HashMap *map);
+static void Migrate(struct HashMap *map, uint32 numEntries);
 INLINE void EnsureSanity(HashMap *map);
 
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * GroupMatch --
+ *
+ *    Find the entries of the group of control bytes starting at ctrl whose
+ *    control byte is the given value.
+ *
+ * Results:
+ *    A bit mask, bit i set for entry i of the group.
+ *
+ * Side Effects:
+ *    None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+static INLINE uint32
+GroupMatch(const uint8 *ctrl,  // IN
+           uint8 value)        // IN
+{
+#if defined(__SSE2__)
+   __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(value)));
+#else
+   uint32 mask = 0;
+   uint32 i;
+
+   for (i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+      mask |= (uint32) (ctrl[i] == value) << i;
+   }
+   return mask;
+#endif
+}
+
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * GroupMatchFree --
+ *
+ *    Find the entries of the group of control bytes starting at ctrl that
+ *    are empty or deleted.
+ *
+ * Results:
+ *    A bit mask, bit i set for entry i of the group.
+ *
+ * Side Effects:
+ *    None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+static INLINE uint32
+GroupMatchFree(const uint8 *ctrl)  // IN
+{
+#if defined(__SSE2__)
+   return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+#else
+   uint32 mask = 0;
+   uint32 i;
+
+   for (i = 0; i < HASHMAP_GROUP_WIDTH; i++) {
+      mask |= (uint32) !HASHMAP_CTRL_IS_FULL(ctrl[i]) << i;
+   }
+   return mask;
+#endif
+}
+
+
 /*
  * ----------------------------------------------------------------------------
  *
@@ -164,37 +294,52 @@ INLINE void EnsureSanity(HashMap *map);
  */
 
 #ifdef VMX86_DEBUG
-static INLINE Bool
-CheckSanity(HashMap *map)
+static Bool
+CheckTableSanity(HashMap *map,               // IN
+                 const HashMapTable *table)  // IN
 {
-   uint32 i, cnt = 0;
+   uint32 i;
+   uint32 cnt = 0;
+   uint32 deleted = 0;
 
-   ASSERT(map);
-   for (i = 0; i < map->numEntries; i++) {
-      HashMapEntryHeader *header = NULL;
-      void *key, *data;
-
-      GetEntry(map, i, &header, &key, &data);
-      ASSERT(header);
-      ASSERT(header->state == HashMapState_FILLED ||
-             header->state == HashMapState_EMPTY ||
-             header->state == HashMapState_DELETED);
-      if (header->state == HashMapState_FILLED) {
+   for (i = 0; i < table->numEntries; i++) {
+      uint8 ctrl = table->ctrl[i];
+
+      if (i < HASHMAP_GROUP_WIDTH &&
+          table->ctrl[table->numEntries + i] != ctrl) {
+         return FALSE;
+      }
+      if (HASHMAP_CTRL_IS_FULL(ctrl)) {
          cnt++;
-         if (header->hash != ComputeHash(map, key)) {
+         if (ctrl != (ComputeHash(map, GetEntry(map, table, i)) & 0x7F)) {
             return FALSE;
          }
+      } else if (ctrl == HASHMAP_CTRL_DELETED) {
+         deleted++;
+      } else if (ctrl != HASHMAP_CTRL_EMPTY) {
+         return FALSE;
       }
    }
 
-   if (cnt != map->count) {
+   return cnt == table->count && deleted == table->deleted;
+}
+
+
+static INLINE Bool
+CheckSanity(HashMap *map)
+{
+   ASSERT(map);
+
+   if (!map->table.numEntries || map->numEntries != map->table.numEntries) {
       return FALSE;
    }
 
-   if (!map->numEntries) {
+   if (map->count != map->table.count + map->old.count) {
       return FALSE;
    }
-   return TRUE;
+
+   return CheckTableSanity(map, &map->table) &&
+          CheckTableSanity(map, &map->old);
 }
 #endif
 
@@ -285,7 +430,8 @@ void
 HashMap_DestroyMap(struct HashMap *map)  // IN
 {
    if (map) {
-      free(map->entries);
+      free(map->table.ctrl);
+      free(map->old.ctrl);
    }
    free(map);
 }
@@ -318,29 +464,84 @@ InitMap(struct HashMap *map,     // IN
         size_t keySize,          // IN
         size_t dataSize)         // IN
 {
+   uint32 required;
+   uint32 size = HASHMAP_GROUP_WIDTH;
+
    ASSERT(map);
    ASSERT(alpha);
    ASSERT(numEntries);
 
    /*
     * Ensure that the entries map is at least large enough to hold all of the
-    * entries that were requested taking into account the alpha factor.
+    * entries that were requested taking into account the alpha factor, and
+    * the maximum load factor of the table.
     */
-   numEntries *= alpha;
+   Clamped_UMul32(&required, numEntries, alpha);
+   Clamped_UMul32(&numEntries, numEntries, HASHMAP_MAX_LOAD_DEN);
+   required = MAX(required, numEntries / HASHMAP_MAX_LOAD_NUM);
+
+   while (size < required && size < (1U << 31)) {
+      size *= 2;
+   }
 
-   map->numEntries = numEntries;
    map->alpha = alpha;
    map->keySize = keySize;
    map->dataSize = dataSize;
 
    CalculateEntrySize(map);
-   map->entries = calloc(numEntries, map->entrySize);
+   if (!InitTable(map, &map->table, size)) {
+      return FALSE;
+   }
+   map->numEntries = size;
 
-   if (map->entries) {
-      EnsureSanity(map);
+   EnsureSanity(map);
+   return TRUE;
+}
+
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * InitTable --
+ *
+ *    Allocate the control bytes and entries of a table, all empty.  Both
+ *    arrays are in one allocation, the entries after the control bytes.
+ *
+ * Results:
+ *    Returns TRUE on success or FALSE if the memory allocation failed.
+ *
+ * Side Effects:
+ *    Allocates memory.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+static Bool
+InitTable(struct HashMap *map,   // IN
+          HashMapTable *table,   // OUT
+          uint32 numEntries)     // IN: a power of 2
+{
+   size_t ctrlSize = ROUNDUP((size_t) numEntries + HASHMAP_GROUP_WIDTH, 8);
+
+   ASSERT(numEntries >= HASHMAP_GROUP_WIDTH);
+   ASSERT((numEntries & (numEntries - 1)) == 0);
+
+   memset(table, 0, sizeof *table);
+
+   if ((SIZE_MAX - ctrlSize) / map->entrySize < numEntries) {
+      return FALSE;
+   }
+
+   table->ctrl = malloc(ctrlSize + (size_t) numEntries * map->entrySize);
+   if (table->ctrl == NULL) {
+      return FALSE;
    }
 
-   return map->entries != NULL;
+   memset(table->ctrl, HASHMAP_CTRL_EMPTY, numEntries + HASHMAP_GROUP_WIDTH);
+   table->entries = table->ctrl + ctrlSize;
+   table->numEntries = numEntries;
+
+   return TRUE;
 }
 
 
@@ -368,41 +569,22 @@ HashMap_Put(struct HashMap *map,    // IN
             const void *key,        // IN
             const void *data)       // IN
 {
-   uint32 freeIndex;
-   HashMapEntryHeader *header;
-   void *tableData;
-
-   if (!LookupKey(map, key, FALSE, &header, &tableData, &freeIndex)) {
-      uint32 hash = ComputeHash(map, key);
-      void *tableKey;
-
-      if (NeedsResize(map)) {
-         Resize(map);
-         if (LookupKey(map, key, FALSE, &header, &tableData, &freeIndex)) {
-            /*
-             * Somehow our key appeared after resizing the table.
-             */
-            ASSERT(FALSE);
-         }
-         if (freeIndex == NO_FREE_INDEX) {
-            /*
-             * The resize must have failed.
-             */
-            return FALSE;
-         }
-      }
+   HashMapTable *table;
+   uint32 index;
 
-      map->count++;
-      GetEntry(map, freeIndex, &header, &tableKey, &tableData);
-      ASSERT(header);
+   ASSERT(data || map->dataSize == 0);
 
-      header->state = HashMapState_FILLED;
-      header->hash = hash;
-      memcpy(tableKey, key, map->keySize);
+   if (FindKey(map, key, FALSE, &table, &index)) {
+      memcpy(GetEntry(map, table, index) + map->dataOffset, data,
+             map->dataSize);
+   } else {
+      if (NeedsResize(map) && !Resize(map)) {
+         return FALSE;
+      }
+      InsertEntry(map, &map->table, ComputeHash(map, key), key, data);
    }
 
-   ASSERT(data || map->dataSize == 0);
-   memcpy(tableData, data, map->dataSize);
+   Migrate(map, HASHMAP_MIGRATE_STEP);
 
    EnsureSanity(map);
    return TRUE;
@@ -430,12 +612,11 @@ void *
 HashMap_Get(struct HashMap *map,    // IN
             const void *key)        // IN
 {
-   void *data;
-   uint32 freeIndex;
-   HashMapEntryHeader *header;
+   HashMapTable *table;
+   uint32 index;
 
-   if (LookupKey(map, key, FALSE, &header, &data, &freeIndex)) {
-      return data;
+   if (FindKey(map, key, FALSE, &table, &index)) {
+      return GetEntry(map, table, index) + map->dataOffset;
    }
 
    return NULL;
@@ -467,12 +648,11 @@ void *
 HashMap_ConstTimeGet(struct HashMap *map,    // IN
                      const void *key)        // IN
 {
-   void *data;
-   uint32 freeIndex;
-   HashMapEntryHeader *header;
+   HashMapTable *table;
+   uint32 index;
 
-   if (LookupKey(map, key, TRUE, &header, &data, &freeIndex)) {
-      return data;
+   if (FindKey(map, key, TRUE, &table, &index)) {
+      return GetEntry(map, table, index) + map->dataOffset;
    }
 
    return NULL;
@@ -498,16 +678,16 @@ HashMap_ConstTimeGet(struct HashMap *map,    // IN
 void
 HashMap_Clear(struct HashMap *map) // IN
 {
-   int i = 0;
-   HashMapEntryHeader *header;
-   void *key, *data;
-
    ASSERT(map);
-   for (i = 0; i < map->numEntries; i++) {
-      GetEntry(map, i, &header, &key, &data);
-      ASSERT(header);
-      header->state = HashMapState_EMPTY;
-   }
+
+   free(map->old.ctrl);
+   memset(&map->old, 0, sizeof map->old);
+   map->migrated = 0;
+
+   memset(map->table.ctrl, HASHMAP_CTRL_EMPTY,
+          map->table.numEntries + HASHMAP_GROUP_WIDTH);
+   map->table.count = 0;
+   map->table.deleted = 0;
    map->count = 0;
    EnsureSanity(map);
 }
@@ -534,20 +714,15 @@ Bool
 HashMap_Remove(struct HashMap *map,   // IN
                const void *key)       // IN
 {
-   uint32 freeIndex;
-   HashMapEntryHeader *header;
-   void *tableData;
+   HashMapTable *table;
+   uint32 index;
 
-   if (!LookupKey(map, key, FALSE, &header, &tableData, &freeIndex)) {
+   if (!FindKey(map, key, FALSE, &table, &index)) {
       return FALSE;
    }
 
-   /*
-    * XXX: This could be made slightly smarter.  We could check the next entry
-    * to see if it's EMPTY and then mark this one as empty as well.
-    */
-   map->count--;
-   header->state = HashMapState_DELETED;
+   RemoveEntry(map, table, index);
+   Migrate(map, HASHMAP_MIGRATE_STEP);
 
    EnsureSanity(map);
 
@@ -584,6 +759,7 @@ HashMap_Count(struct HashMap *map) // IN
  * CalculateEntrySize --
  *
  *    Calculate the size of the entry and the offsets to the key and data.
+ *    Data of 8 bytes or more, typically pointers, is 8 byte aligned.
  *
  * Results:
  *    None.
@@ -597,20 +773,16 @@ HashMap_Count(struct HashMap *map) // IN
 void
 CalculateEntrySize(struct HashMap *map) // IN
 {
-   size_t alignKeySize, alignDataSize;
-   size_t alignKeyOffset, alignDataOffset;
+   size_t align;
 
    ASSERT(map);
 
-   alignKeySize = ROUNDUP(map->keySize, 4);
-   alignDataSize = ROUNDUP(map->dataSize, 4);
+   align = map->dataSize >= 8 || map->keySize >= 8 ? 8 : 4;
 
-   alignKeyOffset = sizeof (HashMapEntryHeader);
-   alignDataOffset = ROUNDUP(alignKeyOffset + alignKeySize, 4);
-
-   map->entrySize = sizeof (HashMapEntryHeader) + alignKeySize + alignDataSize;
-   map->keyOffset = alignKeyOffset;
-   map->dataOffset = alignDataOffset;
+   map->keyOffset = 0;
+   map->dataOffset = ROUNDUP(map->keySize, align);
+   map->entrySize = MAX(ROUNDUP(map->dataOffset + map->dataSize, align),
+                        align);
 }
 
 
@@ -619,93 +791,249 @@ CalculateEntrySize(struct HashMap *map) // IN
  *
  * LookupKey --
  *
- *    Use linear probing to find a free space in the table or the data that
- *    we're interested in.
+ *    Probe the groups of a table for the key, comparing only the keys of the
+ *    entries whose control byte matches the hash.
  *
  *    Call this function with constTimeLookup = TRUE to use a timing attack
  *    safe version of memcmp while comparing keys.
  *
  * Returns:
- *    - TRUE if the key was found in the table, FALSE otherwise.
- *    - Returns the entry header on header, data pointer on data and the first
- *    non-filled index that was encountered on freeIndex
+ *    The index of the key in the table, or NO_FREE_INDEX if it is not there.
  *
  * Side Effects:
- *    - Header and Data are changed.  They should only be considered valid if
- *    the key was found.
- *    - FreeIndex will be updated to point to the first non-filled index.
+ *    None.
  *
  * ----------------------------------------------------------------------------
  */
 
-Bool
-LookupKey(struct HashMap* map,          // IN
+uint32
+LookupKey(struct HashMap *map,          // IN
+          const HashMapTable *table,    // IN
           const void *key,              // IN
-          Bool constTimeLookup,         // IN
-          HashMapEntryHeader **header,  // OUT
-          void **data,                  // OUT
-          uint32 *freeIndex)            // OUT
+          uint32 hash,                  // IN
+          Bool constTimeLookup)         // IN
 {
-   uint32 hash = ComputeHash(map, key);
-   uint32 index = hash % map->numEntries;
-   uint32 probe = 0;
-
-   Bool done = FALSE, found = FALSE;
-   void *tableKey;
+   uint32 mask = table->numEntries - 1;
+   uint32 pos = (hash >> 7) & mask;
+   uint32 stride = 0;
+   uint8 h2 = hash & 0x7F;
 
    ASSERT(map);
    ASSERT(key);
-   ASSERT(data);
-   ASSERT(freeIndex);
 
-   *freeIndex = NO_FREE_INDEX;
+   if (table->numEntries == 0 || table->count == 0) {
+      return NO_FREE_INDEX;
+   }
 
-   while (!done && probe < map->numEntries + 1) {
-      uint32 currentIndex = (index + probe) % map->numEntries;
+   /*
+    * The probe sequence visits every group once, so this also ends for a
+    * table without empty entries.
+    */
+   while (stride < table->numEntries) {
+      uint32 match = GroupMatch(table->ctrl + pos, h2);
 
-      GetEntry(map, currentIndex, header, &tableKey, data);
-      ASSERT(header);
+      while (match != 0) {
+         uint32 index = (pos + lssb32_0(match)) & mask;
+         const uint8 *tableKey = GetEntry(map, table, index) + map->keyOffset;
+         Bool found;
 
-      switch ((*header)->state) {
-      case HashMapState_EMPTY:
-         done = TRUE;
-         /* FALL THROUGH */
-      case HashMapState_DELETED:
          /*
-          * We're not done if we've found a deleted space.  This may just mean
-          * that the entry was deleted but that the target entry may appear
-          * later.
+          * There is some performance penalty to doing a constant time
+          * comparison, so only use that version if it's been explicitly
+          * asked for.
           */
-         if (*freeIndex == NO_FREE_INDEX) {
-            *freeIndex = currentIndex;
+         if (constTimeLookup) {
+            found = ConstTimeCompareKeys(map, key, tableKey);
+         } else {
+            found = CompareKeys(map, key, tableKey);
          }
-         break;
-      case HashMapState_FILLED:
-         if ((*header)->hash == hash) {
-            /*
-             * There is some performance penalty to doing a constant time
-             * comparison, so only use that version if it's been explicitly
-             * asked for.
-             */
-            if (constTimeLookup) {
-               found = ConstTimeCompareKeys(map, key, tableKey);
-            } else {
-               found = CompareKeys(map, key, tableKey);
-            }
-            if (found) {
-               done = TRUE;
-            }
+         if (found) {
+            return index;
          }
+         match &= match - 1;
+      }
+
+      if (GroupMatch(table->ctrl + pos, HASHMAP_CTRL_EMPTY) != 0) {
          break;
-      default:
-         NOT_REACHED();
       }
-      probe++;
+
+      stride += HASHMAP_GROUP_WIDTH;
+      pos = (pos + stride) & mask;
+   }
+
+   return NO_FREE_INDEX;
+}
+
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * FindKey --
+ *
+ *    Find the key in the map: in its table, or while a resize is in
+ *    progress, in the old table still being moved from.
+ *
+ * Returns:
+ *    TRUE if the key was found, with the table and the index of its entry.
+ *
+ * Side Effects:
+ *    None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+Bool
+FindKey(struct HashMap *map,     // IN
+        const void *key,         // IN
+        Bool constTimeLookup,    // IN
+        HashMapTable **table,    // OUT
+        uint32 *index)           // OUT
+{
+   uint32 hash = ComputeHash(map, key);
+
+   ASSERT(map);
+   ASSERT(table);
+   ASSERT(index);
+
+   *table = &map->table;
+   *index = LookupKey(map, *table, key, hash, constTimeLookup);
+   if (*index == NO_FREE_INDEX && map->old.count != 0) {
+      *table = &map->old;
+      *index = LookupKey(map, *table, key, hash, constTimeLookup);
+   }
+
+   return *index != NO_FREE_INDEX;
+}
+
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * FindFreeIndex --
+ *
+ *    Find where to insert a key that is not in the table: the first empty
+ *    or deleted entry of its probe sequence.
+ *
+ * Returns:
+ *    The index of the entry, or NO_FREE_INDEX if the table is full.
+ *
+ * Side Effects:
+ *    None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+uint32
+FindFreeIndex(const HashMapTable *table,  // IN
+              uint32 hash)                // IN
+{
+   uint32 mask = table->numEntries - 1;
+   uint32 pos = (hash >> 7) & mask;
+   uint32 stride = 0;
+
+   while (stride < table->numEntries) {
+      uint32 match = GroupMatchFree(table->ctrl + pos);
+
+      if (match != 0) {
+         return (pos + lssb32_0(match)) & mask;
+      }
+      stride += HASHMAP_GROUP_WIDTH;
+      pos = (pos + stride) & mask;
    }
 
-   ASSERT(found || *freeIndex != NO_FREE_INDEX || map->count == map->numEntries);
+   return NO_FREE_INDEX;
+}
+
 
-   return found;
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * InsertEntry --
+ *
+ *    Insert a key that is not in the map into a table that has room for it.
+ *
+ * Results:
+ *    None.
+ *
+ * Side Effects:
+ *    The key and data are copied into the table.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+void
+InsertEntry(struct HashMap *map,     // IN
+            HashMapTable *table,     // IN
+            uint32 hash,             // IN
+            const void *key,         // IN
+            const void *data)        // IN
+{
+   uint32 index = FindFreeIndex(table, hash);
+   uint8 *entry;
+
+   VERIFY(index != NO_FREE_INDEX);
+
+   if (table->ctrl[index] == HASHMAP_CTRL_DELETED) {
+      table->deleted--;
+   }
+   SetCtrl(table, index, hash & 0x7F);
+   table->count++;
+   if (table == &map->table) {
+      map->count++;
+   }
+
+   entry = GetEntry(map, table, index);
+   memcpy(entry + map->keyOffset, key, map->keySize);
+   memcpy(entry + map->dataOffset, data, map->dataSize);
+}
+
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * RemoveEntry --
+ *
+ *    Remove an entry from a table.  The entry is marked empty when no probe
+ *    sequence can have gone past it, i.e. when every group that contains it
+ *    also contains an empty entry, and deleted otherwise.
+ *
+ * Results:
+ *    None.
+ *
+ * Side Effects:
+ *    The entry is removed.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+void
+RemoveEntry(struct HashMap *map,     // IN
+            HashMapTable *table,     // IN
+            uint32 index)            // IN
+{
+   uint32 mask = table->numEntries - 1;
+   uint32 before = 0;
+   uint32 after = 0;
+
+   ASSERT(HASHMAP_CTRL_IS_FULL(table->ctrl[index]));
+
+   while (before < HASHMAP_GROUP_WIDTH &&
+          table->ctrl[(index - before - 1) & mask] != HASHMAP_CTRL_EMPTY) {
+      before++;
+   }
+   while (after < HASHMAP_GROUP_WIDTH &&
+          table->ctrl[(index + after + 1) & mask] != HASHMAP_CTRL_EMPTY) {
+      after++;
+   }
+
+   if (before + after + 1 < HASHMAP_GROUP_WIDTH) {
+      SetCtrl(table, index, HASHMAP_CTRL_EMPTY);
+   } else {
+      SetCtrl(table, index, HASHMAP_CTRL_DELETED);
+      table->deleted++;
+   }
+   table->count--;
+   map->count--;
 }
 
 
@@ -718,35 +1046,56 @@ LookupKey(struct HashMap* map,          // IN
  *    hash compare, it's a simple index based lookup.
  *
  * Results:
- *    The header is stored in header, key in key and the data in data.  These
- *    are all direct pointers into the table.
+ *    A direct pointer to the entry in the table; the key is at keyOffset and
+ *    the data at dataOffset.
  *
  * Side Effects:
- *    The header, key and data pointers are modified.
+ *    None.
  *
  * ----------------------------------------------------------------------------
  */
 
-void
+uint8 *
 GetEntry(struct HashMap *map,          // IN
-         uint32 index,                 // IN
-         HashMapEntryHeader **header,  // OUT
-         void **key,                   // OUT
-         void **data)                  // OUT
+         const HashMapTable *table,    // IN
+         uint32 index)                 // IN
 {
-   uint8 *entry;
-
    ASSERT(map);
-   ASSERT(header);
-   ASSERT(key);
-   ASSERT(data);
-   ASSERT(index < map->numEntries);
-
-   entry = ((uint8 *)map->entries) + (map->entrySize * index);
-   ASSERT(entry);
-   *header = (HashMapEntryHeader *) (entry);
-   *key = (void*) (entry + map->keyOffset);
-   *data = (void*) (entry + map->dataOffset);
+   ASSERT(table);
+   ASSERT(index < table->numEntries);
+
+   return table->entries + map->entrySize * index;
+}
+
+
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * SetCtrl --
+ *
+ *    Set the control byte of an entry, and its mirror past the end of the
+ *    control bytes for the first group of the table.
+ *
+ * Results:
+ *    None.
+ *
+ * Side Effects:
+ *    None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+void
+SetCtrl(HashMapTable *table,  // IN
+        uint32 index,         // IN
+        uint8 ctrl)           // IN
+{
+   ASSERT(index < table->numEntries);
+
+   table->ctrl[index] = ctrl;
+   if (index < HASHMAP_GROUP_WIDTH) {
+      table->ctrl[table->numEntries + index] = ctrl;
+   }
 }
 
 
@@ -775,9 +1124,10 @@ ComputeHash(struct HashMap *map,  // IN
     * djb2, with n == 33. See http://www.cse.yorku.ca/~oz/hash.html.
     *
     * This hash function is largely borrowed from the emmet library in bora/lib
-    * This hash table implementation does a hash compare before comparing the
-    * keys so it's inappropriate for the hash function to take the modulo before
-    * returning.
+    * The low 7 bits go to the control bytes and the others select the group,
+    * so both need to depend on every byte of the key; djb2 alone leaves the
+    * low bits of the hash of small integer keys nearly unmixed, hence the
+    * murmur3 finalizer.
     */
    uint32 h = 5381;
    const uint8 *keyByte;
@@ -787,6 +1137,12 @@ ComputeHash(struct HashMap *map,  // IN
       h *= 33;
       h += *keyByte;
    }
+
+   h ^= h >> 16;
+   h *= 0x85ebca6b;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35;
+   h ^= h >> 16;
    return h;
 }
 
@@ -796,7 +1152,8 @@ ComputeHash(struct HashMap *map,  // IN
  *
  * CompareKeys --
  *
- *    Compare two keys to one another.
+ *    Compare two keys to one another.  Keys of 4 and 8 bytes, the handles
+ *    and ids most maps use, are compared as integers.
  *
  * Results:
  *    Returns TRUE if the two keys are binary equal over the length specified
@@ -813,6 +1170,19 @@ CompareKeys(struct HashMap *map,    // IN
             const void *key,        // IN
             const void *compare)    // IN
 {
+   if (map->keySize == sizeof (uint32)) {
+      uint32 a, b;
+
+      memcpy(&a, key, sizeof a);
+      memcpy(&b, compare, sizeof b);
+      return a == b;
+   } else if (map->keySize == sizeof (uint64)) {
+      uint64 a, b;
+
+      memcpy(&a, key, sizeof a);
+      memcpy(&b, compare, sizeof b);
+      return a == b;
+   }
    return memcmp(key, compare, map->keySize) == 0;
 }
 
@@ -852,7 +1222,8 @@ ConstTimeCompareKeys(struct HashMap *map,    // IN
  *
  *    Determine if adding another element to the map will require that the map
  *    be resized.  This takes into account the maximum load factor that is
- *    allowed for this map.
+ *    allowed for this map, and the deleted entries, which take room in the
+ *    probe sequences like filled ones.
  *
  * Results:
  *    Returns TRUE if the map should be resized.
@@ -867,10 +1238,16 @@ Bool
 NeedsResize(struct HashMap *map)
 {
    uint32 required;
+   uint32 used = map->count + map->table.deleted + 1;
 
-   Clamped_UMul32(&required, map->count, map->alpha);
+   Clamped_UMul32(&required, used, map->alpha);
+   if (required > map->table.numEntries) {
+      return TRUE;
+   }
 
-   return required >= map->numEntries;
+   Clamped_UMul32(&required, used, HASHMAP_MAX_LOAD_DEN);
+   return required > (map->table.numEntries / HASHMAP_MAX_LOAD_DEN) *
+                     HASHMAP_MAX_LOAD_NUM;
 }
 
 /*
@@ -878,102 +1255,129 @@ NeedsResize(struct HashMap *map)
  *
  * Resize --
  *
- *    Doubles the size of the entries array until it is at least large enough
- *    to ensure the maximum load factor is not exceeded.
+ *    Allocates a new table, at least large enough to ensure the maximum load
+ *    factor is not exceeded: twice as large as the current one, or as large
+ *    when most of the room is taken by deleted entries.  The entries are
+ *    then moved to it incrementally, by Migrate from HashMap_Put and
+ *    HashMap_Remove, so that no single put pays for copying the whole map.
+ *    A resize still in progress is completed first.
  *
  * Results:
- *    None.
+ *    FALSE if the map is full and a new table could not be allocated.
  *
  * Side Effects:
- *    The entries list is doubled in size and the entries are copied into the
- *    appropriate location.  Callers should not assume that the locations that
- *    were valid before this was called are still valid as all entries may
- *    appear at different locations after this function completes.
+ *    Callers should not assume that the locations that were valid before
+ *    this was called are still valid as all entries may appear at
+ *    different locations after the following puts and removes.
  *
  * ----------------------------------------------------------------------------
  */
 
-void
+Bool
 Resize(struct HashMap *map)   // IN
 {
-   struct HashMap oldHashMap = *map;
-   int i;
+   HashMapTable table;
+   uint32 numEntries = map->table.numEntries;
 
-   if (map->numEntries == MAX_UINT32) {
-      if (map->count < MAX_UINT32) {
+   if (map->old.numEntries != 0) {
+      Migrate(map, map->old.numEntries);
+      if (!NeedsResize(map)) {
+         return TRUE;
+      }
+   }
+
+   /*
+    * Drop the deleted entries at the same size when that is enough, grow
+    * geometrically otherwise.
+    */
+   if (map->table.deleted < map->count) {
+      if (numEntries == 1U << 31) {
          /*
-          * We're already at the maximum size of the array and there's still
-          * room for the new entry, don't bother resizing.
+          * We're already at the maximum size of the array, keep using it as
+          * long as there's still room for the new entry.
           */
-         return;
-      } else {
+         if (map->count + map->table.deleted + 1 < numEntries) {
+            return TRUE;
+         }
          /*
-          * This situation is fatal, though we're unlikely to ever hit this with
-          * realistic usage.
+          * This situation is fatal, though we're unlikely to ever hit this
+          * with realistic usage.
           */
          Panic("Ran out of room in the hashtable\n");
       }
+      numEntries *= 2;
    }
 
-   /*
-    * We might, at some point, want to look at making this grow geometrically
-    * until we hit some threshold and then grow arithmetically after that.  To
-    * keep it simple for now, however, we'll just grow geometrically all the
-    * time.
-    */
-   map->entries = calloc(oldHashMap.numEntries * 2, oldHashMap.entrySize);
-   if (!map->entries) {
-      map->entries = oldHashMap.entries;
-      return;
+   if (!InitTable(map, &table, numEntries)) {
+      /*
+       * No memory, keep going with the current table while there is room.
+       */
+      return map->count + map->table.deleted + 1 < map->table.numEntries;
    }
 
-   do {
-      if (!Clamped_UMul32(&map->numEntries, map->numEntries, 2)) {
-         /* Prevent overflow and */
-         break;
-      }
-   } while (NeedsResize(map));
+   map->old = map->table;
+   map->table = table;
+   map->numEntries = numEntries;
+   map->migrated = 0;
 
-   map->count = 0;
+   return TRUE;
+}
 
-   for (i = 0; i < oldHashMap.numEntries; i++) {
-      HashMapEntryHeader *oldHeader;
-      HashMapEntryHeader *newHeader;
-      void *oldKey;
-      void *oldData;
-      void *newKey;
-      void *newData;
-      uint32 freeIndex;
-
-      GetEntry(&oldHashMap, i, &oldHeader, &oldKey, &oldData);
-      switch (oldHeader->state) {
-      case HashMapState_EMPTY:
-      case HashMapState_DELETED:
-         continue;
-      case HashMapState_FILLED:
-         if (!LookupKey(map, oldKey, FALSE, &newHeader, &newData, &freeIndex)) {
-            GetEntry(map, freeIndex, &newHeader, &newKey, &newData);
 
-            newHeader->hash = oldHeader->hash;
-            newHeader->state = HashMapState_FILLED;
-            memcpy(newKey, oldKey, map->keySize);
-            memcpy(newData, oldData, map->dataSize);
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * Migrate --
+ *
+ *    Move up to the given number of entries of the old table into the new
+ *    one, while a resize is in progress.  Resize grows the table before the
+ *    new one gets too loaded, and a few groups of the old table are moved
+ *    with each put, so the move is over long before the new table fills.
+ *
+ * Results:
+ *    None.
+ *
+ * Side Effects:
+ *    The old table is freed once all its entries were moved.
+ *
+ * ----------------------------------------------------------------------------
+ */
 
-            map->count++;
-         } else {
-            /*
-             * There is only one way that this could happen; the key is in the
-             * old map twice.  That's clearly an error.
-             */
-            ASSERT(FALSE);
-            continue;
-         }
+void
+Migrate(struct HashMap *map,     // IN
+        uint32 numEntries)       // IN
+{
+   HashMapTable *old = &map->old;
+   uint32 end;
+
+   if (old->numEntries == 0) {
+      return;
+   }
+
+   end = MIN(old->numEntries - map->migrated, numEntries) + map->migrated;
+
+   for (; map->migrated < end; map->migrated++) {
+      uint8 *entry;
+
+      if (!HASHMAP_CTRL_IS_FULL(old->ctrl[map->migrated])) {
+         continue;
       }
+
+      entry = GetEntry(map, old, map->migrated);
+      map->count--;
+      InsertEntry(map, &map->table, ComputeHash(map, entry + map->keyOffset),
+                  entry + map->keyOffset, entry + map->dataOffset);
+      SetCtrl(old, map->migrated, HASHMAP_CTRL_DELETED);
+      old->count--;
+      old->deleted++;
    }
 
-   ASSERT(oldHashMap.count == map->count);
-   free(oldHashMap.entries);
-   EnsureSanity(map);
+   if (map->migrated == old->numEntries) {
+      ASSERT(old->count == 0);
+      free(old->ctrl);
+      memset(old, 0, sizeof *old);
+      map->migrated = 0;
+   }
 }
 
 
@@ -1002,39 +1406,152 @@ HashMap_Iterate(HashMap *map,             // IN
                 Bool clear,               // IN
                 void *userData)           // IN/OUT
 {
-   int i = 0;
-   HashMapEntryHeader *header;
-   void *key, *data;
+   HashMapTable *tables[2];
+   uint32 t;
 
    ASSERT(map);
    ASSERT(itFn);
 
-   for (i = 0; i < map->numEntries; i++) {
-      GetEntry(map, i, &header, &key, &data);
-      if (header->state == HashMapState_FILLED) {
-         itFn(key, data, userData);
-         if (clear) {
-            map->count--;
+   tables[0] = &map->table;
+   tables[1] = &map->old;
+
+   for (t = 0; t < ARRAYSIZE(tables); t++) {
+      HashMapTable *table = tables[t];
+      uint32 i;
+
+      for (i = 0; i < table->numEntries; i++) {
+         if (HASHMAP_CTRL_IS_FULL(table->ctrl[i])) {
+            uint8 *entry = GetEntry(map, table, i);
+
+            itFn(entry + map->keyOffset, entry + map->dataOffset, userData);
          }
       }
-      if (clear) {
-         header->state = HashMapState_EMPTY;
-      }
+   }
+
+   if (clear) {
+      HashMap_Clear(map);
    }
 
    ASSERT(map->count == 0 || !clear);
 }
 
 
+/*
+ * ----------------------------------------------------------------------------
+ *
+ * HashMap_DoTests --
+ *
+ *    Self test of the map: random puts, gets and removes with small and
+ *    large keys and several load factors, checked against a plain array,
+ *    with resizes in progress and without.
+ *
+ * Results:
+ *    TRUE if the map behaved.
+ *
+ * Side Effects:
+ *    None.
+ *
+ * ----------------------------------------------------------------------------
+ */
+
+typedef struct HashMapTestKey {
+   uint32 id;
+   uint8 pad[20];
+} HashMapTestKey;
+
+#define HASHMAP_TEST_KEYS  5000
+#define HASHMAP_TEST_OPS   200000
+
+static void
+HashMapTestCount(void *key,        // IN
+                 void *data,       // IN
+                 void *userData)   // IN/OUT
+{
+   (*(uint32 *) userData)++;
+}
+
+Bool
+HashMap_DoTests(void)
+{
+   static const uint32 alphas[] = { 1, 2, 4 };
+   static const size_t keySizes[] = {
+      sizeof (uint32), sizeof (HashMapTestKey)
+   };
+   uint8 *present = calloc(HASHMAP_TEST_KEYS, 1);
+   Bool ok = present != NULL;
+   uint32 a;
+   uint32 k;
+
+   for (a = 0; ok && a < ARRAYSIZE(alphas); a++) {
+      for (k = 0; ok && k < ARRAYSIZE(keySizes); k++) {
+         HashMap *map = HashMap_AllocMapAlpha(1, alphas[a], keySizes[k],
+                                              sizeof (uint64));
+         uint32 seed = 12345 + a * 7 + k;
+         uint32 count = 0;
+         uint32 seen = 0;
+         uint32 i;
+
+         if (map == NULL) {
+            ok = FALSE;
+            break;
+         }
+         memset(present, 0, HASHMAP_TEST_KEYS);
+
+         for (i = 0; ok && i < HASHMAP_TEST_OPS; i++) {
+            HashMapTestKey key;
+            uint64 data;
+            uint64 *found;
+
+            seed = seed * 1103515245 + 12345;
+            memset(&key, 0, sizeof key);
+            /* Grow the key space over time, to resize while deleting. */
+            key.id = (seed >> 8) % (1 + i % HASHMAP_TEST_KEYS);
+            data = (uint64) key.id * 3 + 1;
+
+            switch ((seed >> 4) % 4) {
+            case 0:
+            case 1:
+               ok &= HashMap_Put(map, &key, &data);
+               count += !present[key.id];
+               present[key.id] = 1;
+               break;
+            case 2:
+               ok &= HashMap_Remove(map, &key) == present[key.id];
+               count -= present[key.id];
+               present[key.id] = 0;
+               break;
+            default:
+               found = (i & 1) ? HashMap_Get(map, &key) :
+                                 HashMap_ConstTimeGet(map, &key);
+               ok &= present[key.id] ? found != NULL && *found == data :
+                                       found == NULL;
+               break;
+            }
+            ok &= HashMap_Count(map) == count;
+         }
+
+         HashMap_Iterate(map, HashMapTestCount, FALSE, &seen);
+         ok &= seen == count;
+         HashMap_Iterate(map, HashMapTestCount, TRUE, &seen);
+         ok &= seen == 2 * count && HashMap_Count(map) == 0;
+         HashMap_DestroyMap(map);
+      }
+   }
+
+   free(present);
+   return ok;
+}
+
+
 /*
  * ----------------------------------------------------------------------------
  *
  * EnsureSanity --
  *
  *    Ensure that the HashMap contents are still sane.  That is, each entry has
- *    a correctly computed hash, the count is correct and the header states are
- *    valid for all entries.  This should be called at the end of every
- *    function which modifies the map.
+ *    a control byte matching its hash, the counts are correct and the control
+ *    bytes are valid for all entries.  This should be called at the end of
+ *    every function which modifies the map.
  *
  * Results:
  *    None.
@@ -1050,6 +1567,3 @@ EnsureSanity(HashMap *map)
 {
    ASSERT(CheckSanity(map) == TRUE);
 }
-
-
-
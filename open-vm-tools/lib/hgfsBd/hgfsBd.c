@@ -287,6 +287,100 @@ HgfsBd_Dispatch(RpcOut *out,            // IN: Channel to send on
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBd_DispatchV --
+ *
+ *    Send an hgfs request given as a list of segments and scatter the reply
+ *    into another list of segments, so callers can keep headers and data
+ *    in separate buffers.
+ *
+ *    The backdoor moves a message as one contiguous buffer, so the request
+ *    segments are gathered into packetIn, a buffer obtained with
+ *    HgfsBd_GetBuf or HgfsBd_GetLargeBuf. Segments which already sit at
+ *    their place in packetIn are not copied, typically the header the
+ *    caller built there. The reply is copied straight from the channel
+ *    buffer into the reply segments, saving the copy through an
+ *    intermediate reply packet.
+ *
+ * Results:
+ *    On success, returns zero and the size of the reply in replySize.
+ *    On failure, returns a negative error, which includes a request or
+ *    reply not fitting in the buffers given.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+HgfsBd_DispatchV(RpcOut *out,                 // IN: Channel to send on
+                 char *packetIn,              // IN: Buf to gather the request in
+                 size_t packetInSize,         // IN: Size of that buffer
+                 HgfsBdIov const *reqIov,     // IN: Request segments
+                 uint32 reqIovCount,          // IN: Number of request segments
+                 HgfsBdIov const *replyIov,   // IN: Reply segments
+                 uint32 replyIovCount,        // IN: Number of reply segments
+                 size_t *replySize)           // OUT: Size of the reply
+{
+   Bool success;
+   Bool rpcStatus;
+   char const *reply;
+   size_t replyLen;
+   size_t offset = 0;
+   uint32 i;
+   char *bdPacket = packetIn - HGFS_SYNC_REQREP_CLIENT_CMD_LEN;
+
+   ASSERT(out);
+   ASSERT(packetIn);
+   ASSERT(reqIov || reqIovCount == 0);
+   ASSERT(replyIov || replyIovCount == 0);
+   ASSERT(replySize);
+
+   for (i = 0; i < reqIovCount; i++) {
+      if (reqIov[i].len > packetInSize - offset) {
+         Debug("HgfsBd_DispatchV: request does not fit the packet\n");
+         return -1;
+      }
+      if (reqIov[i].va != packetIn + offset) {
+         memcpy(packetIn + offset, reqIov[i].va, reqIov[i].len);
+      }
+      offset += reqIov[i].len;
+   }
+
+   memcpy(bdPacket, HGFS_SYNC_REQREP_CLIENT_CMD, HGFS_SYNC_REQREP_CLIENT_CMD_LEN);
+
+   success = RpcOut_send(out, bdPacket, offset + HGFS_CLIENT_CMD_LEN,
+                         &rpcStatus, &reply, &replyLen);
+   if (!success || !rpcStatus) {
+      Debug("HgfsBd_DispatchV: RpcOut_send returned failure\n");
+      return -1;
+   }
+
+   ASSERT(replyLen <= HgfsLargePacketMax(TRUE));
+   *replySize = replyLen;
+
+   for (i = 0, offset = 0; i < replyIovCount && offset < replyLen; i++) {
+      size_t copyLen = replyLen - offset;
+
+      if (copyLen > replyIov[i].len) {
+         copyLen = replyIov[i].len;
+      }
+      memcpy(replyIov[i].va, reply + offset, copyLen);
+      offset += copyLen;
+   }
+
+   if (offset < replyLen) {
+      Debug("HgfsBd_DispatchV: reply does not fit the buffers\n");
+      return -1;
+   }
+
+   return 0;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -56,8 +56,15 @@ typedef void (*HgfsNotifyEventReceiveCb)(HgfsSharedFolderHandle sharedFolder,
                                          uint32 mask,
                                          struct HgfsSessionInfo *session);
 
+/*
+ * Invoked when entries are added to, removed from or renamed within a
+ * watched directory, so that cached lookups of the directory can be dropped.
+ */
+typedef void (*HgfsNotifyDirChangedCb)(const char *dirPath);
+
 typedef struct HgfsServerNotifyCallbacks {
    HgfsNotifyEventReceiveCb       eventReceive;
+   HgfsNotifyDirChangedCb         dirChanged;
 } HgfsServerNotifyCallbacks;
 
 HgfsInternalStatus HgfsNotify_Init(const HgfsServerNotifyCallbacks *serverCbData);
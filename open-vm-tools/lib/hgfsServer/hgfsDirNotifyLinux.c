@@ -0,0 +1,1440 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsDirNotifyLinux.c --
+ *
+ *	Directory change notification for Linux guests, built on inotify.
+ *
+ *	Each subscriber watches a directory of a shared folder, and optionally
+ *	all of its subdirectories. Inotify watches are reference counted by the
+ *	subscribers that need them, since the kernel hands out one watch
+ *	descriptor per directory. A single thread reads the inotify events,
+ *	translates them to HGFS events and collects them for a short interval
+ *	so that bursts of identical events (e.g. many writes to one file) are
+ *	coalesced into one notification per subscriber and file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "vmware.h"
+#include "vm_basic_types.h"
+#include "util.h"
+#include "str.h"
+#include "posix.h"
+#include "hostinfo.h"
+#include "userlock.h"
+#include "mutexRankLib.h"
+#include "dbllnklst.h"
+#include "hashTable.h"
+
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerInt.h"
+#include "hgfsUtil.h"
+#include "hgfsDirNotify.h"
+
+/*
+ * Events are delivered once no new event has arrived for
+ * HGFS_NOTIFY_COALESCE_MSEC, but never later than HGFS_NOTIFY_MAX_DELAY_MSEC
+ * after the first of them, or as soon as HGFS_NOTIFY_MAX_PENDING distinct
+ * events are waiting.
+ */
+#define HGFS_NOTIFY_COALESCE_MSEC   20
+#define HGFS_NOTIFY_MAX_DELAY_MSEC  100
+#define HGFS_NOTIFY_MAX_PENDING     256
+
+#define HGFS_NOTIFY_READ_BUFFER_SIZE (16 * 1024)
+
+/* Inotify events that are always watched for. */
+#define HGFS_NOTIFY_INOTIFY_BASE_MASK \
+   (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+    IN_DELETE_SELF | IN_MOVE_SELF)
+
+typedef struct HgfsNotifyFolder {
+   DblLnkLst_Links links;
+   HgfsSharedFolderHandle handle;
+   char *path;                      // Host path of the shared folder root
+   char *shareName;
+} HgfsNotifyFolder;
+
+typedef struct HgfsNotifyWatch {
+   int wd;                          // Inotify watch descriptor
+   HgfsSharedFolderHandle folder;
+   char *relPath;                   // Directory relative to the share root
+   uint32 refCount;                 // Subscribers using this watch
+} HgfsNotifyWatch;
+
+typedef struct HgfsNotifySubscriber {
+   DblLnkLst_Links links;
+   HgfsSubscriberHandle handle;
+   HgfsSharedFolderHandle folder;
+   char *relPath;                   // Watched directory relative to the share
+   uint32 eventFilter;              // HGFS_NOTIFY_* events to report
+   uint32 inotifyMask;              // Inotify events to watch for
+   Bool recursive;
+   struct HgfsSessionInfo *session;
+   int *wds;                        // Watches referenced by this subscriber
+   uint32 numWds;
+   uint32 maxWds;
+} HgfsNotifySubscriber;
+
+typedef struct HgfsNotifyPending {
+   DblLnkLst_Links links;
+   HgfsSharedFolderHandle folder;
+   HgfsSubscriberHandle subscriber;
+   struct HgfsSessionInfo *session;
+   char *name;                      // File name relative to the share
+   uint32 mask;                     // Coalesced HGFS_NOTIFY_* events
+} HgfsNotifyPending;
+
+typedef struct HgfsNotifyState {
+   MXUserExclLock *lock;            // Protects everything below
+   MXUserExclLock *deliveryLock;    // Held while pending events are delivered
+   HgfsServerNotifyCallbacks callbacks;
+   int inotifyFd;
+   int wakeFds[2];                  // Wakes the event thread on exit
+   pthread_t thread;
+   Bool exiting;
+   Bool suspended;                  // Server sync in progress, drop events
+   Bool droppedWhileSuspended;
+   DblLnkLst_Links folders;
+   DblLnkLst_Links subscribers;
+   HashTable *watches;              // wd -> HgfsNotifyWatch
+   DblLnkLst_Links pending;
+   uint32 numPending;
+   VmTimeType firstPendingTime;
+   HgfsSharedFolderHandle nextFolderHandle;
+   HgfsSubscriberHandle nextSubscriberHandle;
+} HgfsNotifyState;
+
+static HgfsNotifyState *gHgfsNotify = NULL;
+
+static void HgfsNotifyQueueEvent(HgfsNotifySubscriber *subscriber,
+                                 const char *name,
+                                 uint32 mask);
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyEventsToInotify --
+ *
+ *    Convert an HGFS event filter into the inotify events needed to
+ *    produce it.
+ *
+ * Results:
+ *    Inotify event mask.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsNotifyEventsToInotify(uint32 eventFilter)  // IN: HGFS_NOTIFY_* events
+{
+   uint32 mask = HGFS_NOTIFY_INOTIFY_BASE_MASK;
+
+   if (eventFilter & HGFS_NOTIFY_ACCESS) {
+      mask |= IN_ACCESS;
+   }
+   if (eventFilter & (HGFS_NOTIFY_ATTRIB | HGFS_NOTIFY_ATIME |
+                      HGFS_NOTIFY_CTIME | HGFS_NOTIFY_CHANGE_SECURITY |
+                      HGFS_NOTIFY_CHANGE_EA)) {
+      mask |= IN_ATTRIB;
+   }
+   if (eventFilter & (HGFS_NOTIFY_MODIFY | HGFS_NOTIFY_SIZE |
+                      HGFS_NOTIFY_MTIME)) {
+      mask |= IN_MODIFY;
+   }
+   if (eventFilter & HGFS_NOTIFY_OPEN) {
+      mask |= IN_OPEN;
+   }
+   if (eventFilter & HGFS_NOTIFY_CLOSE_WRITE) {
+      mask |= IN_CLOSE_WRITE;
+   }
+   if (eventFilter & HGFS_NOTIFY_CLOSE_NOWRITE) {
+      mask |= IN_CLOSE_NOWRITE;
+   }
+
+   return mask;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyInotifyToEvents --
+ *
+ *    Convert an inotify event mask into HGFS events.
+ *
+ * Results:
+ *    HGFS_NOTIFY_* event mask.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsNotifyInotifyToEvents(uint32 mask)  // IN: inotify event mask
+{
+   Bool isDir = (mask & IN_ISDIR) != 0;
+   uint32 events = 0;
+
+   if (mask & IN_ACCESS) {
+      events |= HGFS_NOTIFY_ACCESS;
+   }
+   if (mask & IN_ATTRIB) {
+      events |= HGFS_NOTIFY_ATTRIB | HGFS_NOTIFY_CTIME;
+   }
+   if (mask & IN_MODIFY) {
+      events |= HGFS_NOTIFY_MODIFY | HGFS_NOTIFY_SIZE | HGFS_NOTIFY_MTIME;
+   }
+   if (mask & IN_OPEN) {
+      events |= HGFS_NOTIFY_OPEN;
+   }
+   if (mask & IN_CLOSE_WRITE) {
+      events |= HGFS_NOTIFY_CLOSE_WRITE;
+   }
+   if (mask & IN_CLOSE_NOWRITE) {
+      events |= HGFS_NOTIFY_CLOSE_NOWRITE;
+   }
+   if (mask & IN_CREATE) {
+      events |= isDir ? HGFS_NOTIFY_CREATE_DIR : HGFS_NOTIFY_CREATE_FILE;
+   }
+   if (mask & IN_DELETE) {
+      events |= isDir ? HGFS_NOTIFY_DELETE_DIR : HGFS_NOTIFY_DELETE_FILE;
+   }
+   if (mask & IN_MOVED_FROM) {
+      events |= isDir ? HGFS_NOTIFY_OLD_DIR_NAME : HGFS_NOTIFY_OLD_FILE_NAME;
+   }
+   if (mask & IN_MOVED_TO) {
+      events |= isDir ? HGFS_NOTIFY_NEW_DIR_NAME : HGFS_NOTIFY_NEW_FILE_NAME;
+   }
+   if (mask & IN_DELETE_SELF) {
+      events |= HGFS_NOTIFY_DELETE_SELF;
+   }
+   if (mask & IN_MOVE_SELF) {
+      events |= HGFS_NOTIFY_MOVE_SELF;
+   }
+
+   return events;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyJoinPath --
+ *
+ *    Join two relative path fragments, either of which may be empty.
+ *
+ * Results:
+ *    Allocated path.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static char *
+HgfsNotifyJoinPath(const char *dir,   // IN: leading fragment
+                   const char *name)  // IN: trailing fragment
+{
+   if (*dir == '\0') {
+      return Util_SafeStrdup(name);
+   }
+   if (*name == '\0') {
+      return Util_SafeStrdup(dir);
+   }
+   return Str_SafeAsprintf(NULL, "%s"DIRSEPS"%s", dir, name);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyIsWithin --
+ *
+ *    Check whether a relative directory is the watched directory itself or,
+ *    for recursive watches, one of its descendants.
+ *
+ * Results:
+ *    TRUE if events from dirPath are of interest to the subscriber.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsNotifyIsWithin(const HgfsNotifySubscriber *subscriber,  // IN: subscriber
+                   const char *dirPath)                     // IN: relative dir
+{
+   size_t len = strlen(subscriber->relPath);
+
+   if (strcmp(subscriber->relPath, dirPath) == 0) {
+      return TRUE;
+   }
+   if (!subscriber->recursive) {
+      return FALSE;
+   }
+   if (len == 0) {
+      return TRUE;
+   }
+   return strncmp(subscriber->relPath, dirPath, len) == 0 &&
+          dirPath[len] == DIRSEPC;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyFindFolder --
+ *
+ *    Find a shared folder by handle. The notify lock must be held.
+ *
+ * Results:
+ *    The shared folder or NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsNotifyFolder *
+HgfsNotifyFindFolder(HgfsSharedFolderHandle handle)  // IN: shared folder
+{
+   DblLnkLst_Links *link;
+
+   DblLnkLst_ForEach(link, &gHgfsNotify->folders) {
+      HgfsNotifyFolder *folder =
+         DblLnkLst_Container(link, HgfsNotifyFolder, links);
+
+      if (folder->handle == handle) {
+         return folder;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyAddWatch --
+ *
+ *    Add an inotify watch on a directory of a shared folder on behalf of a
+ *    subscriber. The notify lock must be held.
+ *
+ * Results:
+ *    TRUE if the directory is watched, FALSE otherwise.
+ *
+ * Side effects:
+ *    May add a watch to the watch table.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsNotifyAddWatch(HgfsNotifySubscriber *subscriber,  // IN/OUT: subscriber
+                   const char *sharePath,             // IN: share root
+                   const char *relPath)               // IN: relative dir
+{
+   HgfsNotifyWatch *watch;
+   char *fullPath;
+   int wd;
+   uint32 i;
+
+   fullPath = HgfsNotifyJoinPath(sharePath, relPath);
+   wd = inotify_add_watch(gHgfsNotify->inotifyFd, fullPath,
+                          subscriber->inotifyMask | IN_ONLYDIR | IN_MASK_ADD);
+   if (wd < 0) {
+      LOG(4, "%s: could not watch %s: %d\n", __FUNCTION__, fullPath, errno);
+      free(fullPath);
+      return FALSE;
+   }
+   free(fullPath);
+
+   for (i = 0; i < subscriber->numWds; i++) {
+      if (subscriber->wds[i] == wd) {
+         /* Reached through another path, e.g. a symlink. */
+         return TRUE;
+      }
+   }
+
+   if (!HashTable_Lookup(gHgfsNotify->watches, (const void *)(uintptr_t)wd,
+                         (void **)&watch)) {
+      watch = Util_SafeMalloc(sizeof *watch);
+      watch->wd = wd;
+      watch->folder = subscriber->folder;
+      watch->relPath = Util_SafeStrdup(relPath);
+      watch->refCount = 0;
+      HashTable_Insert(gHgfsNotify->watches, (const void *)(uintptr_t)wd,
+                       watch);
+   }
+   watch->refCount++;
+
+   if (subscriber->numWds == subscriber->maxWds) {
+      subscriber->maxWds = MAX(8, subscriber->maxWds * 2);
+      subscriber->wds = Util_SafeRealloc(subscriber->wds,
+                                         subscriber->maxWds *
+                                         sizeof *subscriber->wds);
+   }
+   subscriber->wds[subscriber->numWds++] = wd;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyAddTreeWatches --
+ *
+ *    Watch all subdirectories of a directory for a recursive subscriber.
+ *    The notify lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyAddTreeWatches(HgfsNotifySubscriber *subscriber,  // IN/OUT: subscriber
+                         const char *sharePath,             // IN: share root
+                         const char *relPath)               // IN: relative dir
+{
+   char *fullPath = HgfsNotifyJoinPath(sharePath, relPath);
+   DIR *dir = Posix_OpenDir(fullPath);
+   struct dirent *dirent;
+
+   free(fullPath);
+   if (dir == NULL) {
+      return;
+   }
+
+   while ((dirent = readdir(dir)) != NULL) {
+      char *childPath;
+
+      if (dirent->d_type != DT_DIR && dirent->d_type != DT_UNKNOWN) {
+         continue;
+      }
+      if (strcmp(dirent->d_name, ".") == 0 ||
+          strcmp(dirent->d_name, "..") == 0) {
+         continue;
+      }
+
+      childPath = HgfsNotifyJoinPath(relPath, dirent->d_name);
+      /* Watching fails with ENOTDIR for DT_UNKNOWN entries that are files. */
+      if (HgfsNotifyAddWatch(subscriber, sharePath, childPath)) {
+         HgfsNotifyAddTreeWatches(subscriber, sharePath, childPath);
+      }
+      free(childPath);
+   }
+   closedir(dir);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyReleaseWatch --
+ *
+ *    Drop a subscriber's reference on a watch, removing the inotify watch
+ *    once it is no longer used. The notify lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyReleaseWatch(int wd)  // IN: watch descriptor
+{
+   HgfsNotifyWatch *watch;
+
+   if (!HashTable_Lookup(gHgfsNotify->watches, (const void *)(uintptr_t)wd,
+                         (void **)&watch)) {
+      return;
+   }
+
+   ASSERT(watch->refCount > 0);
+   if (--watch->refCount == 0) {
+      inotify_rm_watch(gHgfsNotify->inotifyFd, wd);
+      HashTable_Delete(gHgfsNotify->watches, (const void *)(uintptr_t)wd);
+      free(watch->relPath);
+      free(watch);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyDropPending --
+ *
+ *    Discard the undelivered events of a subscriber. The notify lock must be
+ *    held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyDropPending(HgfsSubscriberHandle handle)  // IN: subscriber
+{
+   DblLnkLst_Links *link, *nextLink;
+
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->pending) {
+      HgfsNotifyPending *event =
+         DblLnkLst_Container(link, HgfsNotifyPending, links);
+
+      if (event->subscriber == handle) {
+         DblLnkLst_Unlink1(&event->links);
+         gHgfsNotify->numPending--;
+         free(event->name);
+         free(event);
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyFreeSubscriber --
+ *
+ *    Unlink a subscriber, release its watches and free it. The notify lock
+ *    must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyFreeSubscriber(HgfsNotifySubscriber *subscriber)  // IN: subscriber
+{
+   uint32 i;
+
+   DblLnkLst_Unlink1(&subscriber->links);
+   HgfsNotifyDropPending(subscriber->handle);
+   for (i = 0; i < subscriber->numWds; i++) {
+      HgfsNotifyReleaseWatch(subscriber->wds[i]);
+   }
+   free(subscriber->wds);
+   free(subscriber->relPath);
+   free(subscriber);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyQueueEvent --
+ *
+ *    Queue an event for a subscriber, merging it with an undelivered event
+ *    for the same file. The notify lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyQueueEvent(HgfsNotifySubscriber *subscriber,  // IN: subscriber
+                     const char *name,                  // IN: relative name
+                     uint32 mask)                       // IN: HGFS events
+{
+   DblLnkLst_Links *link;
+   HgfsNotifyPending *event;
+
+   DblLnkLst_ForEach(link, &gHgfsNotify->pending) {
+      event = DblLnkLst_Container(link, HgfsNotifyPending, links);
+
+      if (event->subscriber == subscriber->handle &&
+          strcmp(event->name, name) == 0) {
+         event->mask |= mask;
+         return;
+      }
+   }
+
+   event = Util_SafeMalloc(sizeof *event);
+   DblLnkLst_Init(&event->links);
+   event->folder = subscriber->folder;
+   event->subscriber = subscriber->handle;
+   event->session = subscriber->session;
+   event->name = Util_SafeStrdup(name);
+   event->mask = mask;
+   DblLnkLst_LinkLast(&gHgfsNotify->pending, &event->links);
+   if (gHgfsNotify->numPending++ == 0) {
+      gHgfsNotify->firstPendingTime = Hostinfo_SystemTimerMS();
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyQueueOverflow --
+ *
+ *    Tell every subscriber that events were lost. The notify lock must be
+ *    held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyQueueOverflow(void)
+{
+   DblLnkLst_Links *link;
+
+   DblLnkLst_ForEach(link, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *subscriber =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+      HgfsNotifyQueueEvent(subscriber, subscriber->relPath,
+                           HGFS_NOTIFY_EVENTS_DROPPED);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyProcessEvent --
+ *
+ *    Translate one inotify event and queue it for the interested subscribers.
+ *    The notify lock must be held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    New subdirectories of recursively watched trees get watched. Changes
+ *    to directory contents are reported to the server's dirChanged callback.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyProcessEvent(const struct inotify_event *ev)  // IN: inotify event
+{
+   HgfsNotifyWatch *watch;
+   HgfsNotifyFolder *folder;
+   DblLnkLst_Links *link, *nextLink;
+   char *name;
+   uint32 events;
+   Bool isSelf = ev->len == 0;
+
+   if (ev->mask & IN_Q_OVERFLOW) {
+      LOG(4, "%s: inotify queue overflow\n", __FUNCTION__);
+      HgfsNotifyQueueOverflow();
+      return;
+   }
+
+   if (!HashTable_Lookup(gHgfsNotify->watches,
+                         (const void *)(uintptr_t)ev->wd, (void **)&watch)) {
+      return;
+   }
+
+   folder = HgfsNotifyFindFolder(watch->folder);
+   if (folder == NULL) {
+      return;
+   }
+
+   if ((ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) &&
+       gHgfsNotify->callbacks.dirChanged != NULL) {
+      char *dirPath = HgfsNotifyJoinPath(folder->path, watch->relPath);
+
+      gHgfsNotify->callbacks.dirChanged(dirPath);
+      free(dirPath);
+   }
+
+   name = isSelf ? Util_SafeStrdup(watch->relPath) :
+                   HgfsNotifyJoinPath(watch->relPath, ev->name);
+   events = HgfsNotifyInotifyToEvents(ev->mask);
+
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *subscriber =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+      Bool isRoot;
+      uint32 reported;
+
+      if (subscriber->folder != watch->folder ||
+          !HgfsNotifyIsWithin(subscriber, watch->relPath)) {
+         continue;
+      }
+
+      /*
+       * Self events of subdirectories are already reported by their parent
+       * as deletes or renames of a directory entry.
+       */
+      isRoot = strcmp(subscriber->relPath, watch->relPath) == 0;
+      if (isSelf && !isRoot) {
+         continue;
+      }
+
+      reported = events & subscriber->eventFilter;
+      if ((ev->mask & IN_IGNORED) && isRoot) {
+         reported |= HGFS_NOTIFY_WATCH_DELETED;
+      }
+      if (reported != 0) {
+         HgfsNotifyQueueEvent(subscriber, name, reported);
+      }
+
+      if (subscriber->recursive && (ev->mask & IN_ISDIR) &&
+          (ev->mask & (IN_CREATE | IN_MOVED_TO))) {
+         if (HgfsNotifyAddWatch(subscriber, folder->path, name)) {
+            HgfsNotifyAddTreeWatches(subscriber, folder->path, name);
+         }
+      }
+   }
+   free(name);
+
+   if (ev->mask & IN_IGNORED) {
+      /*
+       * The kernel removed the watch, the directory is gone. Forget it in
+       * every subscriber that referenced it.
+       */
+      DblLnkLst_ForEach(link, &gHgfsNotify->subscribers) {
+         HgfsNotifySubscriber *subscriber =
+            DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+         uint32 i;
+
+         for (i = 0; i < subscriber->numWds; i++) {
+            if (subscriber->wds[i] == ev->wd) {
+               subscriber->wds[i] = subscriber->wds[--subscriber->numWds];
+               break;
+            }
+         }
+      }
+      HashTable_Delete(gHgfsNotify->watches, (const void *)(uintptr_t)ev->wd);
+      free(watch->relPath);
+      free(watch);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyReadEvents --
+ *
+ *    Read and process all available inotify events.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyReadEvents(char *buffer)  // IN: HGFS_NOTIFY_READ_BUFFER_SIZE bytes
+{
+   for (;;) {
+      ssize_t len = read(gHgfsNotify->inotifyFd, buffer,
+                         HGFS_NOTIFY_READ_BUFFER_SIZE);
+      char *p;
+
+      if (len <= 0) {
+         if (len < 0 && errno == EINTR) {
+            continue;
+         }
+         break;
+      }
+
+      MXUser_AcquireExclLock(gHgfsNotify->lock);
+      for (p = buffer; p < buffer + len; ) {
+         const struct inotify_event *ev = (const struct inotify_event *)p;
+
+         if (gHgfsNotify->suspended && !(ev->mask & IN_IGNORED)) {
+            gHgfsNotify->droppedWhileSuspended = TRUE;
+         } else {
+            HgfsNotifyProcessEvent(ev);
+         }
+         p += sizeof *ev + ev->len;
+      }
+      MXUser_ReleaseExclLock(gHgfsNotify->lock);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyDeliver --
+ *
+ *    Deliver all pending events to the server.
+ *
+ *    The events are handed to the server without the notify lock held, as
+ *    the server acquires lower ranked locks. The delivery lock keeps
+ *    sessions from going away while their events are being delivered.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNotifyDeliver(void)
+{
+   DblLnkLst_Links events;
+   DblLnkLst_Links *link, *nextLink;
+
+   DblLnkLst_Init(&events);
+
+   MXUser_AcquireExclLock(gHgfsNotify->deliveryLock);
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   if (gHgfsNotify->numPending > 0) {
+      DblLnkLst_Link(&events, &gHgfsNotify->pending);
+      DblLnkLst_Unlink1(&gHgfsNotify->pending);
+      gHgfsNotify->numPending = 0;
+   }
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   DblLnkLst_ForEachSafe(link, nextLink, &events) {
+      HgfsNotifyPending *event =
+         DblLnkLst_Container(link, HgfsNotifyPending, links);
+
+      gHgfsNotify->callbacks.eventReceive(event->folder, event->subscriber,
+                                          event->name, event->mask,
+                                          event->session);
+      DblLnkLst_Unlink1(&event->links);
+      free(event->name);
+      free(event);
+   }
+
+   MXUser_ReleaseExclLock(gHgfsNotify->deliveryLock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotifyThread --
+ *
+ *    Event thread: waits for inotify events and delivers them once a burst
+ *    has settled.
+ *
+ * Results:
+ *    NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsNotifyThread(void *data)  // IN: unused
+{
+   char *buffer = Util_SafeMalloc(HGFS_NOTIFY_READ_BUFFER_SIZE);
+
+   for (;;) {
+      struct pollfd fds[2];
+      uint32 numPending;
+      int timeout = -1;
+      int ret;
+
+      MXUser_AcquireExclLock(gHgfsNotify->lock);
+      if (gHgfsNotify->exiting) {
+         MXUser_ReleaseExclLock(gHgfsNotify->lock);
+         break;
+      }
+      numPending = gHgfsNotify->numPending;
+      if (numPending > 0) {
+         VmTimeType age = Hostinfo_SystemTimerMS() -
+                          gHgfsNotify->firstPendingTime;
+
+         if (numPending >= HGFS_NOTIFY_MAX_PENDING ||
+             age >= HGFS_NOTIFY_MAX_DELAY_MSEC) {
+            timeout = 0;
+         } else {
+            timeout = MIN(HGFS_NOTIFY_COALESCE_MSEC,
+                          HGFS_NOTIFY_MAX_DELAY_MSEC - age);
+         }
+      }
+      MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+      if (timeout == 0) {
+         HgfsNotifyDeliver();
+         continue;
+      }
+
+      fds[0].fd = gHgfsNotify->inotifyFd;
+      fds[0].events = POLLIN;
+      fds[1].fd = gHgfsNotify->wakeFds[0];
+      fds[1].events = POLLIN;
+
+      ret = poll(fds, ARRAYSIZE(fds), timeout);
+      if (ret < 0) {
+         if (errno != EINTR) {
+            LOG(4, "%s: poll failed: %d\n", __FUNCTION__, errno);
+            break;
+         }
+         continue;
+      }
+
+      if (ret == 0) {
+         /* The burst settled. */
+         HgfsNotifyDeliver();
+         continue;
+      }
+
+      if (fds[1].revents & POLLIN) {
+         char c;
+
+         while (read(gHgfsNotify->wakeFds[0], &c, sizeof c) > 0) {
+         }
+      }
+      if (fds[0].revents & POLLIN) {
+         HgfsNotifyReadEvents(buffer);
+      }
+   }
+
+   free(buffer);
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Init --
+ *
+ *    Initialization for the notification component.
+ *
+ * Results:
+ *    HGFS_STATUS_SUCCESS on success, an error otherwise.
+ *
+ * Side effects:
+ *    Starts the event thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsNotify_Init(const HgfsServerNotifyCallbacks *serverCbData) // IN: server callbacks
+{
+   HgfsNotifyState *state;
+   HgfsInternalStatus status;
+   int i;
+
+   ASSERT(gHgfsNotify == NULL);
+   ASSERT(serverCbData != NULL && serverCbData->eventReceive != NULL);
+
+   state = Util_SafeCalloc(1, sizeof *state);
+   state->wakeFds[0] = state->wakeFds[1] = -1;
+
+   state->inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (state->inotifyFd < 0) {
+      status = errno;
+      LOG(4, "%s: inotify is not available: %d\n", __FUNCTION__, status);
+      goto error;
+   }
+
+   if (pipe(state->wakeFds) < 0) {
+      status = errno;
+      goto error;
+   }
+   for (i = 0; i < ARRAYSIZE(state->wakeFds); i++) {
+      fcntl(state->wakeFds[i], F_SETFL, O_NONBLOCK);
+      fcntl(state->wakeFds[i], F_SETFD, FD_CLOEXEC);
+   }
+
+   state->lock = MXUser_CreateExclLock("hgfsNotifyLock", RANK_hgfsNotifyLock);
+   state->deliveryLock = MXUser_CreateExclLock("hgfsNotifyDeliveryLock",
+                                               RANK_hgfsNotifyDeliveryLock);
+   state->callbacks = *serverCbData;
+   state->watches = HashTable_Alloc(256, HASH_INT_KEY, NULL);
+   DblLnkLst_Init(&state->folders);
+   DblLnkLst_Init(&state->subscribers);
+   DblLnkLst_Init(&state->pending);
+   state->nextFolderHandle = 0;
+   state->nextSubscriberHandle = 0;
+
+   gHgfsNotify = state;
+
+   status = pthread_create(&state->thread, NULL, HgfsNotifyThread, NULL);
+   if (status != 0) {
+      LOG(4, "%s: could not start the event thread: %d\n", __FUNCTION__,
+          status);
+      gHgfsNotify = NULL;
+      HashTable_Free(state->watches);
+      MXUser_DestroyExclLock(state->deliveryLock);
+      MXUser_DestroyExclLock(state->lock);
+      goto error;
+   }
+
+   return HGFS_STATUS_SUCCESS;
+
+error:
+   if (state->inotifyFd >= 0) {
+      close(state->inotifyFd);
+   }
+   for (i = 0; i < ARRAYSIZE(state->wakeFds); i++) {
+      if (state->wakeFds[i] >= 0) {
+         close(state->wakeFds[i]);
+      }
+   }
+   free(state);
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Exit --
+ *
+ *    Exit for the notification component.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Stops the event thread and frees all shared folders and subscribers.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_Exit(void)
+{
+   DblLnkLst_Links *link, *nextLink;
+   char c = 0;
+
+   if (gHgfsNotify == NULL) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   gHgfsNotify->exiting = TRUE;
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+   if (write(gHgfsNotify->wakeFds[1], &c, sizeof c) < 0) {
+      LOG(4, "%s: could not wake the event thread: %d\n", __FUNCTION__, errno);
+   }
+   pthread_join(gHgfsNotify->thread, NULL);
+
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->subscribers) {
+      HgfsNotifyFreeSubscriber(DblLnkLst_Container(link, HgfsNotifySubscriber,
+                                                   links));
+   }
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->folders) {
+      HgfsNotifyFolder *folder =
+         DblLnkLst_Container(link, HgfsNotifyFolder, links);
+
+      DblLnkLst_Unlink1(&folder->links);
+      free(folder->path);
+      free(folder->shareName);
+      free(folder);
+   }
+   ASSERT(gHgfsNotify->numPending == 0);
+   ASSERT(HashTable_GetNumElements(gHgfsNotify->watches) == 0);
+
+   HashTable_Free(gHgfsNotify->watches);
+   close(gHgfsNotify->inotifyFd);
+   close(gHgfsNotify->wakeFds[0]);
+   close(gHgfsNotify->wakeFds[1]);
+   MXUser_DestroyExclLock(gHgfsNotify->deliveryLock);
+   MXUser_DestroyExclLock(gHgfsNotify->lock);
+   free(gHgfsNotify);
+   gHgfsNotify = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Activate --
+ *
+ *    Activates generating file system change notifications.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    If events were dropped while deactivated, all subscribers are told so.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_Activate(HgfsNotifyActivateReason reason, // IN: reason
+                    struct HgfsSessionInfo *session) // IN: session
+{
+   if (gHgfsNotify == NULL || reason != HGFS_NOTIFY_REASON_SERVER_SYNC) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   gHgfsNotify->suspended = FALSE;
+   if (gHgfsNotify->droppedWhileSuspended) {
+      gHgfsNotify->droppedWhileSuspended = FALSE;
+      HgfsNotifyQueueOverflow();
+   }
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_Deactivate --
+ *
+ *    Deactivates generating file system change notifications.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Events are dropped until the component is activated again.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_Deactivate(HgfsNotifyActivateReason reason, // IN: reason
+                      struct HgfsSessionInfo *session) // IN: session
+{
+   if (gHgfsNotify == NULL || reason != HGFS_NOTIFY_REASON_SERVER_SYNC) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   gHgfsNotify->suspended = TRUE;
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_AddSharedFolder --
+ *
+ *    Allocates memory and initializes new shared folder structure.
+ *
+ * Results:
+ *    Opaque subscriber handle for the new subscriber or HGFS_INVALID_FOLDER_HANDLE
+ *    if adding shared folder fails.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsSharedFolderHandle
+HgfsNotify_AddSharedFolder(const char *path,       // IN: path in the host
+                           const char *shareName)  // IN: name of the shared folder
+{
+   HgfsNotifyFolder *folder;
+   HgfsSharedFolderHandle handle;
+
+   if (gHgfsNotify == NULL || path == NULL || shareName == NULL) {
+      return HGFS_INVALID_FOLDER_HANDLE;
+   }
+
+   folder = Util_SafeMalloc(sizeof *folder);
+   DblLnkLst_Init(&folder->links);
+   folder->path = Util_SafeStrdup(path);
+   folder->shareName = Util_SafeStrdup(shareName);
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   handle = gHgfsNotify->nextFolderHandle++;
+   if (gHgfsNotify->nextFolderHandle == HGFS_INVALID_FOLDER_HANDLE) {
+      gHgfsNotify->nextFolderHandle = 0;
+   }
+   folder->handle = handle;
+   DblLnkLst_LinkLast(&gHgfsNotify->folders, &folder->links);
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   LOG(8, "%s: %s (%s) -> %#x\n", __FUNCTION__, shareName, path, handle);
+   return handle;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_AddSubscriber --
+ *
+ *    Allocates memory and initializes new subscriber structure.
+ *    Inserts allocated subscriber into corrspondent array.
+ *
+ * Results:
+ *    Opaque subscriber handle for the new subscriber or HGFS_INVALID_SUBSCRIBER_HANDLE
+ *    if adding subscriber fails.
+ *
+ * Side effects:
+ *    Adds inotify watches on the directory and, for recursive watches, on
+ *    all of its subdirectories.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsSubscriberHandle
+HgfsNotify_AddSubscriber(HgfsSharedFolderHandle sharedFolder, // IN: shared folder handle
+                         const char *path,                    // IN: relative path
+                         uint32 eventFilter,                  // IN: event filter
+                         uint32 recursive,                    // IN: look in subfolders
+                         struct HgfsSessionInfo *session)     // IN: server context
+{
+   HgfsNotifySubscriber *subscriber;
+   HgfsNotifyFolder *folder;
+   HgfsSubscriberHandle handle = HGFS_INVALID_SUBSCRIBER_HANDLE;
+
+   if (gHgfsNotify == NULL || path == NULL) {
+      return HGFS_INVALID_SUBSCRIBER_HANDLE;
+   }
+
+   /* Names are relative to the share root, drop any leading separators. */
+   while (*path == DIRSEPC) {
+      path++;
+   }
+
+   subscriber = Util_SafeCalloc(1, sizeof *subscriber);
+   DblLnkLst_Init(&subscriber->links);
+   subscriber->folder = sharedFolder;
+   subscriber->relPath = Util_SafeStrdup(path);
+   subscriber->eventFilter = eventFilter;
+   subscriber->inotifyMask = HgfsNotifyEventsToInotify(eventFilter);
+   subscriber->recursive = recursive != 0;
+   subscriber->session = session;
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+
+   folder = HgfsNotifyFindFolder(sharedFolder);
+   if (folder == NULL ||
+       !HgfsNotifyAddWatch(subscriber, folder->path, subscriber->relPath)) {
+      MXUser_ReleaseExclLock(gHgfsNotify->lock);
+      free(subscriber->relPath);
+      free(subscriber);
+      LOG(4, "%s: could not watch %#x:%s\n", __FUNCTION__, sharedFolder, path);
+      return HGFS_INVALID_SUBSCRIBER_HANDLE;
+   }
+   if (subscriber->recursive) {
+      HgfsNotifyAddTreeWatches(subscriber, folder->path, subscriber->relPath);
+   }
+
+   handle = gHgfsNotify->nextSubscriberHandle++;
+   if (gHgfsNotify->nextSubscriberHandle == HGFS_INVALID_SUBSCRIBER_HANDLE) {
+      gHgfsNotify->nextSubscriberHandle = 0;
+   }
+   subscriber->handle = handle;
+   DblLnkLst_LinkLast(&gHgfsNotify->subscribers, &subscriber->links);
+
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   LOG(8, "%s: %#x:%s filter %#x recursive %u -> %"FMT64"x (%u watches)\n",
+       __FUNCTION__, sharedFolder, path, eventFilter, recursive, handle,
+       subscriber->numWds);
+   return handle;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_RemoveSharedFolder --
+ *
+ *    Deallcates memory used by shared folder and performs necessary cleanup.
+ *    Also deletes all subscribers that are defined for the shared folder.
+ *
+ * Results:
+ *    TRUE if the shared folder was found and removed, FALSE otherwise.
+ *
+ * Side effects:
+ *    Removes all subscribers that correspond to the shared folder and invalidates
+ *    thier handles.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsNotify_RemoveSharedFolder(HgfsSharedFolderHandle sharedFolder) // IN
+{
+   DblLnkLst_Links *link, *nextLink;
+   HgfsNotifyFolder *folder;
+
+   if (gHgfsNotify == NULL) {
+      return FALSE;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+
+   folder = HgfsNotifyFindFolder(sharedFolder);
+   if (folder == NULL) {
+      MXUser_ReleaseExclLock(gHgfsNotify->lock);
+      return FALSE;
+   }
+
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *subscriber =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+      if (subscriber->folder == sharedFolder) {
+         HgfsNotifyFreeSubscriber(subscriber);
+      }
+   }
+
+   DblLnkLst_Unlink1(&folder->links);
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   free(folder->path);
+   free(folder->shareName);
+   free(folder);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_RemoveSubscriber --
+ *
+ *    Deallcates memory used by NotificationSubscriber and performs necessary cleanup.
+ *
+ * Results:
+ *    TRUE if the subscriber was found and removed, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsNotify_RemoveSubscriber(HgfsSubscriberHandle subscriber) // IN
+{
+   DblLnkLst_Links *link;
+   Bool found = FALSE;
+
+   if (gHgfsNotify == NULL) {
+      return FALSE;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   DblLnkLst_ForEach(link, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *current =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+      if (current->handle == subscriber) {
+         HgfsNotifyFreeSubscriber(current);
+         found = TRUE;
+         break;
+      }
+   }
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNotify_RemoveSessionSubscribers --
+ *
+ *    Removes all entries that are related to a particular session.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Waits for any delivery in progress, so no events for the session are
+ *    delivered once this returns.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsNotify_RemoveSessionSubscribers(struct HgfsSessionInfo *session) // IN
+{
+   DblLnkLst_Links *link, *nextLink;
+
+   if (gHgfsNotify == NULL) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsNotify->deliveryLock);
+   MXUser_AcquireExclLock(gHgfsNotify->lock);
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsNotify->subscribers) {
+      HgfsNotifySubscriber *subscriber =
+         DblLnkLst_Container(link, HgfsNotifySubscriber, links);
+
+      if (subscriber->session == session) {
+         HgfsNotifyFreeSubscriber(subscriber);
+      }
+   }
+   MXUser_ReleaseExclLock(gHgfsNotify->lock);
+   MXUser_ReleaseExclLock(gHgfsNotify->deliveryLock);
+}
@@ -48,16 +48,20 @@
 #include "hgfsServerOplock.h"
 #include "hgfsDirNotify.h"
 #include "hgfsThreadpool.h"
+#include "hgfsServerStats.h"
 #include "userlock.h"
 #include "poll.h"
 #include "mutexRankLib.h"
+#include "toolsProbe.h"
 #include "vm_basic_asm.h"
 #include "unicodeOperations.h"
+#include "hostinfo.h"
 
 #if defined(_WIN32)
 #include <io.h>
 #define HGFS_PARENT_DIR "..\\"
 #else
+#include <pthread.h>
 #include <unistd.h>
 #define stricmp strcasecmp
 #define HGFS_PARENT_DIR "../"
@@ -123,9 +127,36 @@
 #define NUM_FILE_NODES 100
 #define NUM_SEARCHES 100
 
+/* Terminates a chain of the file node handle index. */
+#define HGFS_FILE_NODE_INDEX_INVALID ((uint32)~((uint32)0))
+
 /* Default maximun number of open nodes that have server locks. */
 #define MAX_LOCKED_FILENODES 10
 
+/*
+ * Read-ahead and write-behind for handles accessed sequentially. The
+ * read-ahead window of a handle starts at HGFS_STREAM_MIN_WINDOW and doubles
+ * while the access stays sequential, up to HGFS_STREAM_MAX_WINDOW or the
+ * handle's share of HGFS_STREAM_SESSION_BUDGET. Sequentially written data is
+ * pushed to disk in chunks of HGFS_STREAM_WRITE_BEHIND.
+ */
+#define HGFS_STREAM_MIN_WINDOW      (128 * 1024)
+#define HGFS_STREAM_MAX_WINDOW      (4 * 1024 * 1024)
+#define HGFS_STREAM_SESSION_BUDGET  (32 * 1024 * 1024)
+#define HGFS_STREAM_WRITE_BEHIND    (1024 * 1024)
+
+/*
+ * Once a handle has been written sequentially for HGFS_STREAM_PREALLOC_MIN,
+ * the file is preallocated ahead of the writes by as much as was written so
+ * far, up to HGFS_STREAM_PREALLOC_MAX, so that a large copy does not leave
+ * the file fragmented. What is left beyond the end of the file is freed at
+ * close. The throughput of handles that moved at least HGFS_STREAM_REPORT_MIN
+ * is logged at close.
+ */
+#define HGFS_STREAM_PREALLOC_MIN    (4 * 1024 * 1024)
+#define HGFS_STREAM_PREALLOC_MAX    (64 * 1024 * 1024)
+#define HGFS_STREAM_REPORT_MIN      (64 * 1024 * 1024)
+
 
 struct HgfsTransportSessionInfo {
    /* Default session id. */
@@ -143,6 +174,9 @@ struct HgfsTransportSessionInfo {
    /* Total number of sessions present this transport session*/
    uint32 numSessions;
 
+   /* Number of inactive-session sweeps done. */
+   uint32 sweepCount;
+
    /* Transport session context. */
    void *transportData;
 
@@ -173,8 +207,19 @@ typedef struct HgfsInputParam {
    HgfsOp op;                    /* Hgfs operation command code */
    uint32 id;                    /* Request ID to be matched with the reply */
    Bool sessionEnabled;          /* Requests have session enabled headers */
+   VmTimeType queuedTime;        /* Stats: parsing done, waiting for handler */
+   VmTimeType processTime;       /* Stats: handler started */
 } HgfsInputParam;
 
+/*
+ * Released input params kept for reuse so that steady state request
+ * processing does not go through the heap. Slots are emptied and refilled
+ * with atomic exchanges, so neither the synchronous path nor the threadpool
+ * workers ever block on the cache.
+ */
+#define HGFS_INPUT_CACHE_SIZE (HGFS_THREADPOOL_MAX_COUNT + 2)
+static Atomic_Ptr gHgfsInputCache[HGFS_INPUT_CACHE_SIZE];
+
 /*
  * The HGFS server configurable settings.
  * (Note: the guest sets these to all defaults only modifiable from the VMX.)
@@ -252,16 +297,18 @@ static void HgfsServerNotifyReceiveEventCb(HgfsSharedFolderHandle sharedFolder,
                                            char* fileName,
                                            uint32 mask,
                                            struct HgfsSessionInfo *session);
+static void HgfsServerNotifyDirChangedCb(const char *dirPath);
 
 /*
  * Callback table passed to the directory change notification component.
  */
 static const HgfsServerNotifyCallbacks gHgfsServerNotifyCBTable = {
    HgfsServerNotifyReceiveEventCb,
+   HgfsServerNotifyDirChangedCb,
 };
 
 /* Lock that protects shared folders list. */
-static MXUserExclLock *gHgfsSharedFoldersLock = NULL;
+static MXUserRWLock *gHgfsSharedFoldersLock = NULL;
 
 /* List of shared folders nodes. */
 static DblLnkLst_Links gHgfsSharedFoldersList;
@@ -280,6 +327,43 @@ static Bool gHgfsDirNotifyActive = FALSE;
  */
 static Bool gHgfsThreadpoolActive = FALSE;
 
+#if !defined(_WIN32)
+/*
+ * Volume information cached per path, see HgfsServerStatFs.
+ */
+
+#define HGFS_STATFS_CACHE_SIZE      32
+#define HGFS_STATFS_CACHE_TTL_MS    2000
+#define HGFS_STATFS_WAIT_MS         500
+
+typedef struct HgfsStatFsCache HgfsStatFsCache;
+
+typedef struct HgfsStatFsEntry {
+   HgfsStatFsCache *cache;
+   char *path;                 /* NULL if the entry is free. */
+   uint64 freeBytes;
+   uint64 totalBytes;
+   Bool success;               /* The last query succeeded. */
+   Bool fetched;               /* The path was queried at least once. */
+   Bool refreshing;            /* A thread is querying the path. */
+   VmTimeType fetchTime;       /* When the last query completed, in ms. */
+   VmTimeType useTime;         /* When the entry was last used, in ms. */
+} HgfsStatFsEntry;
+
+struct HgfsStatFsCache {
+   MXUserExclLock *lock;       /* Protects everything below. */
+   MXUserCondVar *refreshed;   /* Broadcast when a refresh completes. */
+   uint32 numRefreshing;
+   Bool exiting;               /* The last refresh frees the cache. */
+   HgfsStatFsEntry entries[HGFS_STATFS_CACHE_SIZE];
+};
+
+static HgfsStatFsCache *gHgfsStatFsCache = NULL;
+
+static void HgfsServerStatFsCacheFree(HgfsStatFsCache *cache);
+#endif
+
+
 typedef struct HgfsSharedFolderProperties {
    DblLnkLst_Links links;
    char *name;                                /* Name of the share. */
@@ -288,10 +372,11 @@ typedef struct HgfsSharedFolderProperties {
 
 
 /* Allocate/Add sessions helper functions. */
-#ifndef VMX86_TOOLS
-static void
+static Bool
 HgfsServerAsyncInfoIncCount(HgfsAsyncRequestInfo *info);
-#endif
+
+static void
+HgfsServerAsyncWaitForCredit(HgfsAsyncRequestInfo *info);
 
 static Bool
 HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession,
@@ -323,6 +408,7 @@ static Bool HgfsIsCachedInternal(HgfsHandle handle,
 static Bool HgfsRemoveLruNode(HgfsSessionInfo *session);
 static Bool HgfsRemoveFromCacheInternal(HgfsHandle handle,
                                         HgfsSessionInfo *session);
+static void HgfsServerStreamClose(HgfsFileNode *node);
 static void HgfsRemoveSearchInternal(HgfsSearch *search,
                                      HgfsSessionInfo *session);
 static HgfsSearch *HgfsSearchHandle2Search(HgfsHandle handle,
@@ -390,6 +476,7 @@ static void HgfsServerRename(HgfsInputParam *input);
 static void HgfsServerQueryVolume(HgfsInputParam *input);
 static void HgfsServerSymlinkCreate(HgfsInputParam *input);
 static void HgfsServerServerLockChange(HgfsInputParam *input);
+static void HgfsServerOplockBreakAck(HgfsInputParam *input);
 static void HgfsServerWriteWin32Stream(HgfsInputParam *input);
 static void HgfsServerCreateSession(HgfsInputParam *input);
 static void HgfsServerDestroySession(HgfsInputParam *input);
@@ -397,6 +484,10 @@ static void HgfsServerClose(HgfsInputParam *input);
 static void HgfsServerSearchClose(HgfsInputParam *input);
 static void HgfsServerSetDirNotifyWatch(HgfsInputParam *input);
 static void HgfsServerRemoveDirNotifyWatch(HgfsInputParam *input);
+static void HgfsServerCompound(HgfsInputParam *input);
+static void HgfsServerCopyFileRange(HgfsInputParam *input);
+static Bool HgfsServerIsSessionCapable(HgfsOp op,
+                                       const HgfsSessionInfo *session);
 
 
 /*
@@ -415,7 +506,7 @@ static void HgfsServerRemoveDirNotifyWatch(HgfsInputParam *input);
  *----------------------------------------------------------------------------
  */
 
-static void
+void
 HgfsServerSessionGet(HgfsSessionInfo *session)   // IN: session context
 {
    ASSERT(session && Atomic_Read(&session->refCount) != 0);
@@ -441,7 +532,7 @@ HgfsServerSessionGet(HgfsSessionInfo *session)   // IN: session context
  *----------------------------------------------------------------------------
  */
 
-static void
+void
 HgfsServerSessionPut(HgfsSessionInfo *session)   // IN: session context
 {
    ASSERT(session);
@@ -575,6 +666,147 @@ HgfsServerGetNextHandleCounter(void)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeHashBucket --
+ *
+ *    Map a handle to its bucket in the session's handle index.
+ *
+ *    Handles are dished out from a monotonically increasing counter, so
+ *    the low bits alone distribute consecutive opens evenly.
+ *
+ * Results:
+ *    Pointer to the head of the bucket chain.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE uint32 *
+HgfsNodeHashBucket(HgfsHandle handle,        // IN: Hgfs file handle
+                   HgfsSessionInfo *session) // IN: Session info
+{
+   return &session->nodeHashBuckets[handle & session->nodeHashMask];
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeHashInsert --
+ *
+ *    Add an in use file node to the session's handle index.
+ *
+ *    The session's nodeArrayLock should be acquired for write prior to
+ *    calling this function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNodeHashInsert(HgfsFileNode *node,        // IN: file node
+                   HgfsSessionInfo *session)  // IN: session info
+{
+   uint32 *bucket = HgfsNodeHashBucket(node->handle, session);
+
+   node->hashNext = *bucket;
+   *bucket = (uint32)(node - session->nodeArray);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeHashRemove --
+ *
+ *    Remove a file node from the session's handle index.
+ *
+ *    The session's nodeArrayLock should be acquired for write prior to
+ *    calling this function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNodeHashRemove(HgfsFileNode *node,        // IN: file node
+                   HgfsSessionInfo *session)  // IN: session info
+{
+   uint32 index = (uint32)(node - session->nodeArray);
+   uint32 *link = HgfsNodeHashBucket(node->handle, session);
+
+   while (*link != HGFS_FILE_NODE_INDEX_INVALID) {
+      if (*link == index) {
+         *link = node->hashNext;
+         break;
+      }
+      link = &session->nodeArray[*link].hashNext;
+   }
+   node->hashNext = HGFS_FILE_NODE_INDEX_INVALID;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNodeHashRebuild --
+ *
+ *    (Re)create the session's handle index so that it has at least one
+ *    bucket per node in the nodeArray, and index all nodes in use.
+ *
+ *    The session's nodeArrayLock should be acquired for write prior to
+ *    calling this function.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Memory allocation.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNodeHashRebuild(HgfsSessionInfo *session)  // IN: session info
+{
+   uint32 numBuckets = 1;
+   uint32 i;
+
+   while (numBuckets < session->numNodes) {
+      numBuckets <<= 1;
+   }
+
+   free(session->nodeHashBuckets);
+   session->nodeHashBuckets = Util_SafeMalloc(numBuckets *
+                                              sizeof *session->nodeHashBuckets);
+   session->nodeHashMask = numBuckets - 1;
+   for (i = 0; i < numBuckets; i++) {
+      session->nodeHashBuckets[i] = HGFS_FILE_NODE_INDEX_INVALID;
+   }
+
+   for (i = 0; i < session->numNodes; i++) {
+      session->nodeArray[i].hashNext = HGFS_FILE_NODE_INDEX_INVALID;
+      if (session->nodeArray[i].state != FILENODE_STATE_UNUSED) {
+         HgfsNodeHashInsert(&session->nodeArray[i], session);
+      }
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -582,8 +814,8 @@ HgfsServerGetNextHandleCounter(void)
  *
  *    Retrieve the file node a handle refers to.
  *
- *    The session's nodeArrayLock should be acquired prior to calling this
- *    function.
+ *    The session's nodeArrayLock should be acquired (for read at least)
+ *    prior to calling this function.
  *
  * Results:
  *    The file node if the handle is valid (i.e. it refers to an existing file
@@ -600,22 +832,23 @@ static HgfsFileNode *
 HgfsHandle2FileNode(HgfsHandle handle,        // IN: Hgfs file handle
                     HgfsSessionInfo *session) // IN: Session info
 {
-   unsigned int i;
-   HgfsFileNode *fileNode = NULL;
+   uint32 index;
 
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   /* XXX: This O(n) lookup can and should be optimized. */
-   for (i = 0; i < session->numNodes; i++) {
-      if (session->nodeArray[i].state != FILENODE_STATE_UNUSED &&
-          session->nodeArray[i].handle == handle) {
-         fileNode = &session->nodeArray[i];
-         break;
+   for (index = *HgfsNodeHashBucket(handle, session);
+        index != HGFS_FILE_NODE_INDEX_INVALID;
+        index = session->nodeArray[index].hashNext) {
+      HgfsFileNode *fileNode = &session->nodeArray[index];
+
+      ASSERT(fileNode->state != FILENODE_STATE_UNUSED);
+      if (fileNode->handle == handle) {
+         return fileNode;
       }
    }
 
-   return fileNode;
+   return NULL;
 }
 
 
@@ -714,7 +947,7 @@ HgfsHandle2FileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    Bool found = FALSE;
    HgfsFileNode *fileNode = NULL;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    fileNode = HgfsHandle2FileNode(handle, session);
    if (fileNode == NULL) {
       goto exit;
@@ -727,7 +960,7 @@ HgfsHandle2FileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -759,7 +992,7 @@ HgfsHandle2AppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    Bool found = FALSE;
    HgfsFileNode *fileNode = NULL;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    fileNode = HgfsHandle2FileNode(handle, session);
    if (fileNode == NULL) {
       goto exit;
@@ -769,7 +1002,7 @@ HgfsHandle2AppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -803,7 +1036,7 @@ HgfsHandle2LocalId(HgfsHandle handle,        // IN: Hgfs file handle
 
    ASSERT(localId);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
    fileNode = HgfsHandle2FileNode(handle, session);
    if (fileNode == NULL) {
       goto exit;
@@ -815,7 +1048,52 @@ HgfsHandle2LocalId(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsHandle2ServerLock --
+ *
+ *    Retrieve the serverlock information for the file node that corresponds to
+ *    the specified hgfs handle. Without oplock support the node lock is
+ *    always HGFS_LOCK_NONE.
+ *
+ * Results:
+ *    TRUE if the hgfs handle is valid and the lock was retrieved successfully.
+ *    FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsHandle2ServerLock(HgfsHandle handle,        // IN: Hgfs file handle
+                      HgfsSessionInfo *session, // IN: Session info
+                      HgfsLockType *lock)       // OUT: Server lock
+{
+   Bool found = FALSE;
+   HgfsFileNode *fileNode;
+
+   ASSERT(lock);
+
+   MXUser_AcquireForRead(session->nodeArrayLock);
+   fileNode = HgfsHandle2FileNode(handle, session);
+   if (fileNode == NULL) {
+      goto exit;
+   }
+
+   *lock = fileNode->serverLock;
+   found = TRUE;
+
+exit:
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -850,7 +1128,7 @@ HgfsFileDesc2Handle(fileDesc fd,              // IN: OS handle (file descriptor)
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       existingFileNode = &session->nodeArray[i];
@@ -862,7 +1140,7 @@ HgfsFileDesc2Handle(fileDesc fd,              // IN: OS handle (file descriptor)
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -898,7 +1176,7 @@ HgfsHandle2ShareMode(HgfsHandle handle,         // IN: Hgfs file handle
       return found;
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    existingFileNode = HgfsHandle2FileNode(handle, session);
    if (existingFileNode == NULL) {
@@ -911,7 +1189,7 @@ HgfsHandle2ShareMode(HgfsHandle handle,         // IN: Hgfs file handle
    found = (nameStatus == HGFS_NAME_STATUS_COMPLETE);
 
 exit_unlock:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -981,7 +1259,7 @@ HgfsHandle2FileNameMode(HgfsHandle handle,       // IN: Hgfs file handle
       return found;
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    existingFileNode = HgfsHandle2FileNode(handle, session);
    if (existingFileNode == NULL) {
@@ -1000,7 +1278,7 @@ HgfsHandle2FileNameMode(HgfsHandle handle,       // IN: Hgfs file handle
    found = TRUE;
 
 exit_unlock:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    *fileName = name;
    *fileNameSize = nameSize;
@@ -1041,7 +1319,7 @@ HgfsHandle2NotifyInfo(HgfsHandle handle,                    // IN: Hgfs file han
    size_t nameSize;
 
    ASSERT(fileName != NULL && fileNameSize != NULL);
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    existingFileNode = HgfsHandle2FileNode(handle, session);
    if (NULL != existingFileNode) {
@@ -1055,7 +1333,7 @@ HgfsHandle2NotifyInfo(HgfsHandle handle,                    // IN: Hgfs file han
       found = TRUE;
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -1091,7 +1369,7 @@ HgfsGetNodeCopy(HgfsHandle handle,        // IN: Hgfs file handle
 
    ASSERT(copy);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    original = HgfsHandle2FileNode(handle, session);
    if (original == NULL) {
@@ -1122,7 +1400,7 @@ HgfsGetNodeCopy(HgfsHandle handle,        // IN: Hgfs file handle
    found = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 }
@@ -1155,7 +1433,7 @@ HgfsHandleIsSequentialOpen(HgfsHandle handle,        // IN:  Hgfs file handle
 
    ASSERT(sequentialOpen);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1166,7 +1444,7 @@ HgfsHandleIsSequentialOpen(HgfsHandle handle,        // IN:  Hgfs file handle
    success = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return success;
 }
@@ -1199,7 +1477,7 @@ HgfsHandleIsSharedFolderOpen(HgfsHandle handle,        // IN:  Hgfs file handle
 
    ASSERT(sharedFolderOpen);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1210,7 +1488,7 @@ HgfsHandleIsSharedFolderOpen(HgfsHandle handle,        // IN:  Hgfs file handle
    success = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return success;
 }
@@ -1243,7 +1521,7 @@ HgfsUpdateNodeFileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    HgfsFileNode *node;
    Bool updated = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1255,7 +1533,7 @@ HgfsUpdateNodeFileDesc(HgfsHandle handle,        // IN: Hgfs file handle
    updated = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return updated;
 }
@@ -1291,12 +1569,22 @@ HgfsUpdateNodeServerLock(fileDesc fd,                // IN: OS handle
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       existingFileNode = &session->nodeArray[i];
       if (existingFileNode->state != FILENODE_STATE_UNUSED) {
          if (existingFileNode->fileDesc == fd) {
+            if (existingFileNode->state == FILENODE_STATE_IN_USE_CACHED) {
+               /* Keep the count of locked nodes used by HgfsAddToCacheInternal. */
+               if (existingFileNode->serverLock == HGFS_LOCK_NONE &&
+                   serverLock != HGFS_LOCK_NONE) {
+                  session->numCachedLockedNodes++;
+               } else if (existingFileNode->serverLock != HGFS_LOCK_NONE &&
+                          serverLock == HGFS_LOCK_NONE) {
+                  session->numCachedLockedNodes--;
+               }
+            }
             existingFileNode->serverLock = serverLock;
             updated = TRUE;
             break;
@@ -1304,7 +1592,7 @@ HgfsUpdateNodeServerLock(fileDesc fd,                // IN: OS handle
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return updated;
 }
@@ -1335,7 +1623,7 @@ HgfsUpdateNodeAppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    HgfsFileNode *node;
    Bool updated = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    node = HgfsHandle2FileNode(handle, session);
    if (node == NULL) {
@@ -1348,7 +1636,7 @@ HgfsUpdateNodeAppendFlag(HgfsHandle handle,        // IN: Hgfs file handle
    updated = TRUE;
 
 exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return updated;
 }
@@ -1572,6 +1860,7 @@ HgfsGetNewNode(HgfsSessionInfo *session)  // IN: session info
          DblLnkLst_Init(&newMem[i].links);
 
          newMem[i].state = FILENODE_STATE_UNUSED;
+         newMem[i].hashNext = HGFS_FILE_NODE_INDEX_INVALID;
          newMem[i].utf8Name = NULL;
          newMem[i].utf8NameLen = 0;
          newMem[i].fileCtx = NULL;
@@ -1582,6 +1871,9 @@ HgfsGetNewNode(HgfsSessionInfo *session)  // IN: session info
       session->nodeArray = newMem;
       session->numNodes = newNumNodes;
 
+      /* Grow the handle index along with the array. */
+      HgfsNodeHashRebuild(session);
+
       if (DOLOG(4)) {
          Log("Dumping nodes after pointer changes\n");
          HgfsDumpAllNodes(session);
@@ -1635,6 +1927,14 @@ HgfsRemoveFileNode(HgfsFileNode *node,        // IN: file node
       node->utf8Name = NULL;
    }
 
+   if (node->state != FILENODE_STATE_UNUSED) {
+      HgfsNodeHashRemove(node, session);
+   }
+   if (node->streamWindow != 0) {
+      ASSERT(session->numStreamingNodes > 0);
+      session->numStreamingNodes--;
+      node->streamWindow = 0;
+   }
    node->state = FILENODE_STATE_UNUSED;
    ASSERT(node->fileCtx == NULL);
    node->fileCtx = NULL;
@@ -1700,9 +2000,9 @@ static void
 HgfsFreeFileNode(HgfsHandle handle,         // IN: Handle to free
                  HgfsSessionInfo *session)  // IN: Session info
 {
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    HgfsFreeFileNodeInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 }
 
 
@@ -1815,6 +2115,14 @@ HgfsAddNewFileNode(HgfsFileOpenInfo *openInfo,  // IN: open info struct
 
    newNode->serverLock = openInfo->acquiredLock;
    newNode->state = FILENODE_STATE_IN_USE_NOT_CACHED;
+   newNode->streamNext = 0;
+   newNode->streamAhead = 0;
+   newNode->streamDirty = 0;
+   newNode->streamWindow = 0;
+   newNode->streamAlloc = 0;
+   newNode->streamBytes = 0;
+   newNode->streamStart = 0;
+   HgfsNodeHashInsert(newNode, session);
    newNode->shareInfo.readPermissions = openInfo->shareInfo.readPermissions;
    newNode->shareInfo.writePermissions = openInfo->shareInfo.writePermissions;
    newNode->shareInfo.handle = openInfo->shareInfo.handle;
@@ -1942,6 +2250,13 @@ HgfsRemoveFromCacheInternal(HgfsHandle handle,        // IN: Hgfs handle to the
           __FUNCTION__, session->numCachedOpenNodes, node->utf8Name,
           node->localId.fileId, node->fileDesc);
 
+      /* Closing the file descriptor drops the lease along with it. */
+      if (node->serverLock != HGFS_LOCK_NONE) {
+         HgfsServerOplockRemoveLease(node->fileDesc, session);
+         node->serverLock = HGFS_LOCK_NONE;
+         session->numCachedLockedNodes--;
+      }
+
       /*
        * XXX: From this point and up in the call chain (i.e. this function and
        * all callers), Bool is returned instead of the HgfsInternalStatus.
@@ -1953,6 +2268,8 @@ HgfsRemoveFromCacheInternal(HgfsHandle handle,        // IN: Hgfs handle to the
        * Instead, we'll just await the lobotomization of the node cache to
        * really fix this.
        */
+      HgfsServerStreamClose(node);
+
       if (HgfsPlatformCloseFile(node->fileDesc, node->fileCtx)) {
          LOG(4, "%s: Could not close fd %u\n", __FUNCTION__, node->fileDesc);
 
@@ -2051,9 +2368,14 @@ HgfsIsServerLockAllowed(HgfsSessionInfo *session)  // IN: session info
 {
    Bool allowed;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   /* Without oplocks negotiated the client could not be sent a break. */
+   if (0 == (session->flags & HGFS_SESSION_OPLOCK_ENABLED)) {
+      return FALSE;
+   }
+
+   MXUser_AcquireForRead(session->nodeArrayLock);
    allowed = session->numCachedLockedNodes < MAX_LOCKED_FILENODES;
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return allowed;
 }
@@ -2709,7 +3031,7 @@ HgfsUpdateNodeNames(const char *oldLocalName,  // IN: Name of file to look for
 
    newBufferLen = strlen(newLocalName);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       fileNode = &session->nodeArray[i];
@@ -2735,7 +3057,7 @@ HgfsUpdateNodeNames(const char *oldLocalName,  // IN: Name of file to look for
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 }
 
 
@@ -2883,7 +3205,7 @@ static struct {
    { HgfsServerSearchOpen,       HGFS_SIZEOF_OP(HgfsRequestSearchOpenV3),       REQ_SYNC },
    { HgfsServerSearchRead,       HGFS_SIZEOF_OP(HgfsRequestSearchReadV3),       REQ_SYNC },
    { HgfsServerSearchClose,      HGFS_SIZEOF_OP(HgfsRequestSearchCloseV3),      REQ_SYNC },
-   { HgfsServerGetattr,          HGFS_SIZEOF_OP(HgfsRequestGetattrV3),          REQ_SYNC },
+   { HgfsServerGetattr,          HGFS_SIZEOF_OP(HgfsRequestGetattrV3),          REQ_ASYNC },
    { HgfsServerSetattr,          HGFS_SIZEOF_OP(HgfsRequestSetattrV3),          REQ_SYNC },
    { HgfsServerCreateDir,        HGFS_SIZEOF_OP(HgfsRequestCreateDirV3),        REQ_SYNC },
    { HgfsServerDeleteFile,       HGFS_SIZEOF_OP(HgfsRequestDeleteV3),           REQ_SYNC },
@@ -2891,7 +3213,7 @@ static struct {
    { HgfsServerRename,           HGFS_SIZEOF_OP(HgfsRequestRenameV3),           REQ_SYNC },
    { HgfsServerQueryVolume,      HGFS_SIZEOF_OP(HgfsRequestQueryVolumeV3),      REQ_SYNC },
    { HgfsServerSymlinkCreate,    HGFS_SIZEOF_OP(HgfsRequestSymlinkCreateV3),    REQ_SYNC },
-   { HgfsServerServerLockChange, sizeof (HgfsRequestServerLockChange),          REQ_SYNC },
+   { HgfsServerServerLockChange, HGFS_SIZEOF_OP(HgfsRequestServerLockChangeV2), REQ_SYNC },
    { HgfsServerWriteWin32Stream, HGFS_SIZEOF_OP(HgfsRequestWriteWin32StreamV3), REQ_SYNC },
    /*
     * Starting from HGFS_OP_CREATE_SESSION_V4 (all V4 commands and above) the
@@ -2906,10 +3228,122 @@ static struct {
    { HgfsServerRemoveDirNotifyWatch, sizeof (HgfsRequestRemoveWatchV4),            REQ_SYNC},
    { NULL,                       0,                                                REQ_SYNC}, // No Op notify
    { HgfsServerSearchRead,       sizeof (HgfsRequestSearchReadV4),                 REQ_SYNC},
+   { NULL,                       0,                                                REQ_SYNC}, // Open V4
+   { NULL,                       0,                                                REQ_SYNC}, // Enumerate streams V4
+   { NULL,                       0,                                                REQ_SYNC}, // Getattr V4
+   { NULL,                       0,                                                REQ_SYNC}, // Setattr V4
+   { NULL,                       0,                                                REQ_SYNC}, // Delete V4
+   { NULL,                       0,                                                REQ_SYNC}, // Linkmove V4
+   { NULL,                       0,                                                REQ_SYNC}, // Fsctl V4
+   { NULL,                       0,                                                REQ_SYNC}, // Access check V4
+   { NULL,                       0,                                                REQ_SYNC}, // Fsync V4
+   { NULL,                       0,                                                REQ_SYNC}, // Query volume V4
+   { NULL,                       0,                                                REQ_SYNC}, // Oplock acquire V4
+   { HgfsServerOplockBreakAck,   sizeof (HgfsReplyOplockBreakV4),                  REQ_SYNC}, // Oplock break V4
+   { NULL,                       0,                                                REQ_SYNC}, // Lock byte range V4
+   { NULL,                       0,                                                REQ_SYNC}, // Unlock byte range V4
+   { NULL,                       0,                                                REQ_SYNC}, // Query EAs V4
+   { NULL,                       0,                                                REQ_SYNC}, // Set EAs V4
+   { HgfsServerCompound,         sizeof (HgfsRequestCompoundV4),                   REQ_SYNC},
+   { HgfsServerCopyFileRange,    sizeof (HgfsRequestCopyFileRangeV4),              REQ_ASYNC},
 
 };
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerInputAlloc --
+ *
+ *    Takes a zeroed input params object from the cache, or allocates one if
+ *    the cache is empty.
+ *
+ * Results:
+ *    The input params object.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInputParam *
+HgfsServerInputAlloc(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsInputCache); i++) {
+      HgfsInputParam *params = Atomic_ReadWritePtr(&gHgfsInputCache[i], NULL);
+
+      if (NULL != params) {
+         memset(params, 0, sizeof *params);
+         return params;
+      }
+   }
+
+   return Util_SafeCalloc(1, sizeof (HgfsInputParam));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerInputFree --
+ *
+ *    Returns an input params object to the cache, or frees it if the cache is
+ *    full.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerInputFree(HgfsInputParam *params)  // IN: input params
+{
+   unsigned int i;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsInputCache); i++) {
+      if (NULL == Atomic_ReadIfEqualWritePtr(&gHgfsInputCache[i], NULL, params)) {
+         return;
+      }
+   }
+
+   free(params);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerInputCacheFlush --
+ *
+ *    Frees all the cached input params objects.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerInputCacheFlush(void)
+{
+   unsigned int i;
+
+   for (i = 0; i < ARRAYSIZE(gHgfsInputCache); i++) {
+      free(Atomic_ReadWritePtr(&gHgfsInputCache[i], NULL));
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -2941,7 +3375,7 @@ HgfsServerInputAllocInit(HgfsPacket *packet,                        // IN: packe
 {
    HgfsInputParam *localParams;
 
-   localParams = Util_SafeCalloc(1, sizeof *localParams);
+   localParams = HgfsServerInputAlloc();
 
    localParams->packet = packet;
    localParams->request = request;
@@ -2985,21 +3419,64 @@ HgfsServerInputExit(HgfsInputParam *params)                        // IN: packet
       HgfsServerSessionPut(params->session);
    }
    HgfsServerTransportSessionPut(params->transportSession);
-   free(params);
+   HgfsServerInputFree(params);
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerGetRequest --
+ * HgfsServerSessionTouch --
  *
- *    Takes the Hgfs packet and extracts the operation parameters.
- *    This validates the incoming packet as part of the processing.
+ *    Record a request on a session. The first request after an inactive
+ *    session sweep moves the session to the end of the list of its
+ *    transport, which keeps the list ordered from the longest inactive
+ *    session to the most recently used one.
  *
  * Results:
- *    HGFS_ERROR_SUCCESS if all the request parameters are successfully extracted.
- *    HGFS_ERROR_INTERNAL if an error occurs without sufficient request data to be
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerSessionTouch(HgfsSessionInfo *session)  // IN: session info
+{
+   HgfsTransportSessionInfo *transportSession = session->transportSession;
+
+   /* Already moved since the last sweep. */
+   if (session->activeSweep == transportSession->sweepCount) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(transportSession->sessionArrayLock);
+
+   session->activeSweep = transportSession->sweepCount;
+   session->objectsInvalidated = FALSE;
+   if (session->state == HGFS_SESSION_STATE_OPEN &&
+       DblLnkLst_IsLinked(&session->links)) {
+      DblLnkLst_Unlink1(&session->links);
+      DblLnkLst_LinkLast(&transportSession->sessionArray, &session->links);
+   }
+
+   MXUser_ReleaseExclLock(transportSession->sessionArrayLock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerGetRequest --
+ *
+ *    Takes the Hgfs packet and extracts the operation parameters.
+ *    This validates the incoming packet as part of the processing.
+ *
+ * Results:
+ *    HGFS_ERROR_SUCCESS if all the request parameters are successfully extracted.
+ *    HGFS_ERROR_INTERNAL if an error occurs without sufficient request data to be
  *    able to send a reply to the client.
  *    Any other appropriate error if the incoming packet has errors and there is
  *    sufficient information to send a response.
@@ -3070,7 +3547,7 @@ HgfsServerGetRequest(HgfsPacket *packet,                        // IN: packet
    }
 
    if (NULL != session) {
-      session->isInactive = FALSE;
+      HgfsServerSessionTouch(session);
    }
 
    HgfsServerInputAllocInit(packet,
@@ -3211,6 +3688,7 @@ HgfsServerCompleteRequest(HgfsInternalStatus status,   // IN: Status of the requ
    size_t replyTotalSize;
    size_t replyHeaderSize;
    uint64 replySessionId;
+   VmTimeType sendTime;
 
    if (HGFS_ERROR_SUCCESS == status) {
       HGFS_ASSERT_INPUT(input);
@@ -3250,6 +3728,21 @@ HgfsServerCompleteRequest(HgfsInternalStatus status,   // IN: Status of the requ
       goto exit;
    }
 
+   TOOLS_PROBE4(hgfs__request__complete, input->op, input->id, status,
+                replyPayloadSize);
+
+   sendTime = HgfsServerStats_Now();
+   if (sendTime != 0) {
+      HgfsServerStats_RecordPhase(input->op, HGFS_STATS_PHASE_PROCESS,
+                                  input->processTime, sendTime);
+      HgfsServerStats_RecordReply(input->op, status);
+   }
+
+   if (0 != (input->packet->state & HGFS_STATE_COMPOUND_MEMBER)) {
+      /* The compound request collects the reply and sends them all at once. */
+      goto exit;
+   }
+
    if (!HgfsPacketSend(input->packet,
                        input->transportSession,
                        input->session,
@@ -3258,6 +3751,11 @@ HgfsServerCompleteRequest(HgfsInternalStatus status,   // IN: Status of the requ
       Log("%s: Error sending reply\n", __FUNCTION__);
    }
 
+   if (sendTime != 0) {
+      HgfsServerStats_RecordPhase(input->op, HGFS_STATS_PHASE_SEND,
+                                  sendTime, HgfsServerStats_Now());
+   }
+
 exit:
    HgfsServerInputExit(input);
 }
@@ -3283,6 +3781,8 @@ static void
 HgfsServerProcessRequest(void *context)
 {
    HgfsInputParam *input = (HgfsInputParam *)context;
+   HgfsOp op;
+
    if (!input->request) {
       input->request = HSPU_GetMetaPacket(input->packet,
                                           &input->requestSize,
@@ -3290,7 +3790,138 @@ HgfsServerProcessRequest(void *context)
    }
 
    input->payload = (char *)input->request + input->payloadOffset;
-   (*handlers[input->op].handler)(input);
+
+   if (input->queuedTime != 0) {
+      input->processTime = HgfsServerStats_Now();
+      HgfsServerStats_RecordPhase(input->op, HGFS_STATS_PHASE_QUEUE,
+                                  input->queuedTime, input->processTime);
+   }
+
+   /*
+    * The handler may free the request when it completes it, and
+    * asynchronous handlers may complete it after returning.
+    */
+   op = input->op;
+   TOOLS_PROBE3(hgfs__request__entry, op, input->id, input->payloadSize);
+   (*handlers[op].handler)(input);
+   TOOLS_PROBE1(hgfs__request__return, op);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerHandle2ShareId --
+ *
+ *    Find the share a file handle is open on, for scheduling.
+ *
+ * Results:
+ *    The HgfsThreadpool_ShareId of the share, 0 if the handle is unknown.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsServerHandle2ShareId(HgfsHandle handle,         // IN: Hgfs file handle
+                         HgfsSessionInfo *session)  // IN: Session info
+{
+   HgfsFileNode *fileNode;
+   uint32 shareId = 0;
+
+   MXUser_AcquireForRead(session->nodeArrayLock);
+
+   fileNode = HgfsHandle2FileNode(handle, session);
+   if (fileNode != NULL && fileNode->shareName != NULL) {
+      shareId = HgfsThreadpool_ShareId(fileNode->shareName,
+                                       fileNode->shareNameLen);
+   }
+
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   return shareId;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerGetSchedInfo --
+ *
+ *    Describe an asynchronous request to the threadpool scheduler: the
+ *    session and share it belongs to and how many bytes it moves. Requests
+ *    on the same handle are kept in order, requests on different handles,
+ *    or on names, run in parallel.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerGetSchedInfo(HgfsInputParam *input,            // IN: request context
+                       HgfsThreadpoolSchedInfo *sched)   // OUT: scheduling
+{
+   HgfsHandle file;
+
+   memset(sched, 0, sizeof *sched);
+   sched->sessionId = input->session->sessionId;
+
+   switch (input->op) {
+   case HGFS_OP_GETATTR_V3: {
+      const HgfsRequestGetattrV3 *request = input->payload;
+      size_t nameOffset = offsetof(HgfsRequestGetattrV3, fileName.name);
+
+      if (input->payloadSize < sizeof *request) {
+         return;
+      }
+      if (0 == (request->fileName.flags & HGFS_FILE_NAME_USE_FILE_DESC)) {
+         /* The share is the first component of the name. */
+         size_t nameLen = MIN(request->fileName.length,
+                              input->payloadSize - nameOffset);
+         const char *end = memchr(request->fileName.name, '\0', nameLen);
+
+         if (end != NULL) {
+            nameLen = end - request->fileName.name;
+         }
+         sched->shareId = HgfsThreadpool_ShareId(request->fileName.name,
+                                                 nameLen);
+         return;
+      }
+      file = request->fileName.fid;
+      break;
+   }
+   case HGFS_OP_READ_V3:
+      sched->cost = ((const HgfsRequestReadV3 *)input->payload)->requiredSize;
+      file = ((const HgfsRequestReadV3 *)input->payload)->file;
+      break;
+   case HGFS_OP_WRITE_V3:
+      sched->cost = ((const HgfsRequestWriteV3 *)input->payload)->requiredSize;
+      file = ((const HgfsRequestWriteV3 *)input->payload)->file;
+      break;
+   case HGFS_OP_COPY_FILE_RANGE_V4: {
+      const HgfsRequestCopyFileRangeV4 *request = input->payload;
+
+      /* Data is read and written. */
+      sched->cost = (uint32)MIN(request->length, MAX_UINT32 / 2) * 2;
+      file = request->srcFile;
+      break;
+   }
+   default:
+      /* Other requests start with the file handle. */
+      file = *(const HgfsHandle *)input->payload;
+      break;
+   }
+
+   sched->ordered = TRUE;
+   sched->orderKey = file;
+   sched->shareId = HgfsServerHandle2ShareId(file, input->session);
 }
 
 
@@ -3332,6 +3963,7 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
    HgfsTransportSessionInfo *transportSession = clientData;
    HgfsInternalStatus status;
    HgfsInputParam *input = NULL;
+   VmTimeType parseTime;
 
    ASSERT(transportSession);
 
@@ -3343,6 +3975,7 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
 
    HgfsServerTransportSessionGet(transportSession);
 
+   parseTime = HgfsServerStats_Now();
    status = HgfsServerGetRequest(packet, transportSession, &input);
    if (HGFS_ERROR_INTERNAL == status) {
       LOG(4, "%s: %d: Error: packet invalid and cannot reply %d.\n ",
@@ -3351,6 +3984,12 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
       return;
    }
 
+   if (parseTime != 0) {
+      input->queuedTime = HgfsServerStats_Now();
+      HgfsServerStats_RecordPhase(input->op, HGFS_STATS_PHASE_PARSE,
+                                  parseTime, input->queuedTime);
+   }
+
    HGFS_ASSERT_MINIMUM_OP(input->op);
    HGFS_ASSERT_CLIENT(input->op);
 
@@ -3364,30 +4003,59 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
           * Server will only handle the request asynchronously when both the
           * server and client support asynchronous IO, this is indicated by
           * bit HGFS_SESSION_ASYNC_IO_ENABLED in input->session->flags which
-          * is negotiated when the session is created.
+          * is negotiated when the session is created. A channel without
+          * shared memory, like the guest backdoor, waits for the reply of a
+          * request before it takes the next one, so its requests are handled
+          * asynchronously without the client asking for it.
+          */
+         /*
+          * Each asynchronous request takes one of the session's credits
+          * until its reply is sent, so requests complete out of order and
+          * a small request is not stuck behind a large read. A request past
+          * the credit still goes to the queue of its handle, so it cannot
+          * overtake the earlier requests on it, but the receiving thread
+          * waits for a credit to be returned before taking more requests.
+          * See HGFS_SESSION_MAX_ASYNC_REQUESTS for the channels this
+          * applies to.
           */
          if ((handlers[input->op].reqType == REQ_ASYNC) &&
              (transportSession->channelCapabilities.flags & HGFS_CHANNEL_ASYNC) &&
-             (input->session->flags & HGFS_SESSION_ASYNC_IO_ENABLED)) {
-             packet->state |= HGFS_STATE_ASYNC_REQUEST;
+             ((input->session->flags & HGFS_SESSION_ASYNC_IO_ENABLED) ||
+              !(transportSession->channelCapabilities.flags &
+                HGFS_CHANNEL_SHARED_MEM))) {
+            packet->state |= HGFS_STATE_ASYNC_REQUEST;
+            if (!HgfsServerAsyncInfoIncCount(&input->session->asyncRequestsInfo) &&
+                gHgfsThreadpoolActive) {
+               LOG(4, "%s: %d: session out of async credit\n", __FUNCTION__,
+                   __LINE__);
+               HgfsServerAsyncWaitForCredit(&input->session->asyncRequestsInfo);
+            }
          }
          if (0 != (packet->state & HGFS_STATE_ASYNC_REQUEST)) {
+            HgfsThreadpoolSchedInfo sched;
+
             LOG(4, "%s: %d: @@Async\n", __FUNCTION__, __LINE__);
-#ifndef VMX86_TOOLS
+            if (gHgfsThreadpoolActive) {
+               HgfsServerGetSchedInfo(input, &sched);
+            }
             /*
              * Asynchronous processing is supported by the transport.
              * We can release mappings here and reacquire when needed.
+             * A transport without mappings keeps its buffer until the reply.
              */
-            HSPU_PutMetaPacket(packet, transportSession->channelCbTable);
-            input->request = NULL;
-            HgfsServerAsyncInfoIncCount(&input->session->asyncRequestsInfo);
+            if (transportSession->channelCbTable->getReadVa != NULL) {
+               HSPU_PutMetaPacket(packet, transportSession->channelCbTable);
+               input->request = NULL;
+            }
 
             if (gHgfsThreadpoolActive) {
-               if (!HgfsThreadpool_QueueWorkItem(HgfsServerProcessRequest, input)) {
+               if (!HgfsThreadpool_QueueScheduledWorkItem(HgfsServerProcessRequest,
+                                                          input, &sched)) {
                   LOG(4, "%s: %d: failed to queue item.\n", __FUNCTION__, __LINE__);
                   HgfsServerProcessRequest(input);
                }
             } else {
+#ifndef VMX86_TOOLS
                 /* Remove pending requests during poweroff. */
                 Poll_Callback(POLL_CS_MAIN,
                               POLL_FLAG_REMOVE_AT_POWEROFF,
@@ -3396,11 +4064,11 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
                               POLL_REALTIME,
                               1000,
                               NULL);
-            }
 #else
-            /* Tools code should never process request async. */
-            ASSERT(0);
+               /* Tools code only offloads requests to the threadpool. */
+               HgfsServerProcessRequest(input);
 #endif
+            }
          } else {
             LOG(4, "%s: %d: ##Sync\n", __FUNCTION__, __LINE__);
             HgfsServerProcessRequest(input);
@@ -3431,6 +4099,366 @@ HgfsServerSessionReceive(HgfsPacket *packet,      // IN: Hgfs Packet
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCompoundMember --
+ *
+ *    Execute one member of a compound request through the regular request
+ *    parsing and op handler, with the member reply packed into the compound
+ *    reply buffer instead of being sent.
+ *
+ * Results:
+ *    TRUE if a member reply was produced, FALSE otherwise.
+ *
+ * Side effects:
+ *    The member request may be modified to use the last opened handle.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsServerCompoundMember(HgfsInputParam *input,  // IN: compound request
+                         char *request,          // IN/OUT: member request
+                         size_t requestSize,     // IN: member request size
+                         uint32 entryFlags,      // IN: member entry flags
+                         HgfsHandle *lastHandle, // IN/OUT: last opened handle
+                         char *reply,            // OUT: member reply
+                         size_t replySpace,      // IN: space for the reply
+                         size_t *replySize)      // OUT: member reply size
+{
+   HgfsTransportSessionInfo *transportSession = input->transportSession;
+   HgfsPacket packet;
+   HgfsInputParam *member = NULL;
+   HgfsInternalStatus status;
+   const HgfsHeader *replyHeader = (const HgfsHeader *)reply;
+   HgfsOp op;
+
+   memset(&packet, 0, sizeof packet);
+   packet.state = HGFS_STATE_CLIENT_REQUEST | HGFS_STATE_COMPOUND_MEMBER;
+   packet.metaPacket = request;
+   packet.metaPacketSize = requestSize;
+   packet.metaPacketDataSize = requestSize;
+   packet.metaMappingType = BUF_READWRITEABLE;
+   packet.replyPacket = reply;
+   packet.replyPacketSize = replySpace;
+
+   HgfsServerTransportSessionGet(transportSession);
+
+   status = HgfsServerGetRequest(&packet, transportSession, &member);
+   if (HGFS_ERROR_INTERNAL == status) {
+      LOG(4, "%s: member packet invalid and cannot reply.\n", __FUNCTION__);
+      HgfsServerTransportSessionPut(transportSession);
+      return FALSE;
+   }
+
+   op = member->op;
+   if (HGFS_ERROR_SUCCESS == status) {
+      if (!member->sessionEnabled ||
+          member->session != input->session ||
+          op >= ARRAYSIZE(handlers) ||
+          handlers[op].handler == NULL ||
+          member->requestSize < handlers[op].minReqSize ||
+          op == HGFS_OP_COMPOUND_V4 ||
+          op == HGFS_OP_CREATE_SESSION_V4 ||
+          op == HGFS_OP_DESTROY_SESSION_V4) {
+         LOG(4, "%s: op %u not allowed in a compound.\n", __FUNCTION__, op);
+         status = HGFS_ERROR_PROTOCOL;
+      } else if (0 != (entryFlags & HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE) &&
+                 !HgfsUnpackCompoundSetHandle((void *)member->payload,
+                                              member->payloadSize,
+                                              op,
+                                              *lastHandle)) {
+         status = HGFS_ERROR_PROTOCOL;
+      }
+   }
+
+   /* Both paths release the member input. */
+   if (HGFS_ERROR_SUCCESS == status) {
+      HgfsServerProcessRequest(member);
+   } else {
+      HgfsServerCompleteRequest(status, 0, member);
+   }
+
+   *replySize = packet.replyPacketDataSize;
+   if (*replySize < sizeof *replyHeader) {
+      return FALSE;
+   }
+
+   if (op == HGFS_OP_OPEN_V3 || op == HGFS_OP_SEARCH_OPEN_V3) {
+      if (replyHeader->status != HGFS_STATUS_SUCCESS ||
+          !HgfsUnpackCompoundReplyHandle(reply + sizeof *replyHeader,
+                                         *replySize - sizeof *replyHeader,
+                                         op,
+                                         lastHandle)) {
+         *lastHandle = HGFS_INVALID_HANDLE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCheckCopyHandles --
+ *
+ *    Check that two open handles may be used as the source and destination
+ *    of a server side copy: both are open, belong to the same shared folder
+ *    and the share permits reading the source and writing the destination.
+ *
+ * Results:
+ *    HGFS_ERROR_SUCCESS if the copy is allowed.
+ *    HGFS_ERROR_INVALID_HANDLE if a handle is not open.
+ *    HGFS_ERROR_NOT_SAME_DEVICE if the files are on different shares.
+ *    HGFS_ERROR_ACCESS_DENIED if the share permissions do not allow it.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsServerCheckCopyHandles(HgfsHandle srcFile,         // IN: file to copy from
+                           HgfsHandle dstFile,         // IN: file to copy to
+                           HgfsSessionInfo *session)   // IN: Session info
+{
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+   HgfsFileNode *srcNode;
+   HgfsFileNode *dstNode;
+
+   MXUser_AcquireForRead(session->nodeArrayLock);
+
+   srcNode = HgfsHandle2FileNode(srcFile, session);
+   dstNode = HgfsHandle2FileNode(dstFile, session);
+   if (srcNode == NULL || dstNode == NULL) {
+      status = HGFS_ERROR_INVALID_HANDLE;
+   } else if (srcNode->shareNameLen != dstNode->shareNameLen ||
+              memcmp(srcNode->shareName, dstNode->shareName,
+                     srcNode->shareNameLen) != 0) {
+      status = HGFS_ERROR_NOT_SAME_DEVICE;
+   } else if (!srcNode->shareInfo.readPermissions ||
+              !dstNode->shareInfo.writePermissions) {
+      status = HGFS_ERROR_ACCESS_DENIED;
+   }
+
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCopyFileRange --
+ *
+ *    Handle a copy file range request. The data is copied between the two
+ *    open files on the host and never travels through the guest. At most
+ *    HGFS_COPY_RANGE_MAX bytes are copied per request so that a single
+ *    request does not hold a worker for too long, the client asks again
+ *    for the remainder.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerCopyFileRange(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsInternalStatus status;
+   HgfsHandle srcFile;
+   HgfsHandle dstFile;
+   uint64 srcOffset;
+   uint64 dstOffset;
+   uint64 length;
+   uint64 copied = 0;
+   fileDesc srcFd;
+   fileDesc dstFd;
+   size_t replyPayloadSize = 0;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (!input->sessionEnabled ||
+       !HgfsServerIsSessionCapable(input->op, input->session)) {
+      status = HGFS_ERROR_NOT_SUPPORTED;
+      goto exit;
+   }
+
+   if (!HgfsUnpackCopyFileRangeRequest(input->payload, input->payloadSize,
+                                       input->op, &srcFile, &srcOffset,
+                                       &dstFile, &dstOffset, &length)) {
+      status = HGFS_ERROR_PROTOCOL;
+      goto exit;
+   }
+
+   LOG(4, "%s: copy fh %u offset %"FMT64"u -> fh %u offset %"FMT64"u, "
+       "count %"FMT64"u\n", __FUNCTION__, srcFile, srcOffset, dstFile,
+       dstOffset, length);
+
+   status = HgfsServerCheckCopyHandles(srcFile, dstFile, input->session);
+   if (status != HGFS_ERROR_SUCCESS) {
+      goto exit;
+   }
+
+   status = HgfsPlatformGetFd(srcFile, input->session, FALSE, &srcFd);
+   if (status != HGFS_ERROR_SUCCESS) {
+      goto exit;
+   }
+
+   status = HgfsPlatformGetFd(dstFile, input->session, FALSE, &dstFd);
+   if (status != HGFS_ERROR_SUCCESS) {
+      goto exit;
+   }
+
+   status = HgfsPlatformCopyFileRange(srcFd, srcOffset, dstFd, dstOffset,
+                                      MIN(length, HGFS_COPY_RANGE_MAX),
+                                      &copied);
+   if (status != HGFS_ERROR_SUCCESS) {
+      goto exit;
+   }
+
+   if (!HgfsPackCopyFileRangeReply(input->packet, input->request, input->op,
+                                   copied, &replyPayloadSize,
+                                   input->session)) {
+      status = HGFS_ERROR_INTERNAL;
+   }
+
+exit:
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerCompound --
+ *
+ *    Handle a compound request: execute the member requests in order within
+ *    the same session and return all their replies in a single reply.
+ *
+ *    The members are copied out of the request first since some channels
+ *    return the reply in the request buffer. Members are executed until all
+ *    are done, one fails with HGFS_COMPOUND_FLAG_STOP_ON_ERROR set, or the
+ *    space left in the reply is less than any member reply could need.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerCompound(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+   const char *entries;
+   size_t entriesSize;
+   uint32 flags;
+   uint32 numRequests;
+   char *requests = NULL;
+   char *replyBuf;
+   size_t replyTotalSize;
+   size_t replyHeaderSize;
+   size_t replyPayloadSize = 0;
+   HgfsReplyCompoundV4 *reply;
+   HgfsHandle lastHandle = HGFS_INVALID_HANDLE;
+   size_t requestOffset = 0;
+   size_t replyOffset;
+   uint32 i;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (!input->sessionEnabled ||
+       !HgfsServerIsSessionCapable(input->op, input->session)) {
+      status = HGFS_ERROR_NOT_SUPPORTED;
+      goto exit;
+   }
+
+   if (!HgfsUnpackCompoundRequest(input->payload, input->payloadSize, input->op,
+                                  &flags, &numRequests, &entries, &entriesSize)) {
+      status = HGFS_ERROR_PROTOCOL;
+      goto exit;
+   }
+
+   replyHeaderSize = HgfsServerGetReplyHeaderSize(input->sessionEnabled,
+                                                  input->op);
+   replyTotalSize = HSPU_GetReplyPacketCapacity(input->packet,
+                                                input->transportSession->channelCbTable);
+   if (replyTotalSize < replyHeaderSize + sizeof *reply) {
+      status = HGFS_ERROR_INVALID_PARAMETER;
+      goto exit;
+   }
+
+   requests = Util_SafeMalloc(entriesSize);
+   memcpy(requests, entries, entriesSize);
+
+   replyBuf = HSPU_GetReplyPacket(input->packet,
+                                  input->transportSession->channelCbTable,
+                                  replyTotalSize,
+                                  &replyTotalSize);
+   reply = (HgfsReplyCompoundV4 *)(replyBuf + replyHeaderSize);
+   memset(reply, 0, sizeof *reply);
+   replyOffset = replyHeaderSize + sizeof *reply;
+
+   for (i = 0; i < numRequests; i++) {
+      const HgfsCompoundEntryV4 *requestEntry =
+         (const HgfsCompoundEntryV4 *)(requests + requestOffset);
+      HgfsCompoundEntryV4 *replyEntry;
+      size_t memberReplySize;
+      size_t replySpace;
+
+      replySpace = replyTotalSize - replyOffset;
+      if (replySpace < sizeof *replyEntry + HGFS_PACKET_MAX) {
+         LOG(4, "%s: stopping after %u of %u, reply is full.\n", __FUNCTION__,
+             i, numRequests);
+         break;
+      }
+      replySpace -= sizeof *replyEntry;
+      replyEntry = (HgfsCompoundEntryV4 *)(replyBuf + replyOffset);
+
+      if (!HgfsServerCompoundMember(input,
+                                    (char *)(requestEntry + 1),
+                                    requestEntry->size,
+                                    requestEntry->flags,
+                                    &lastHandle,
+                                    (char *)(replyEntry + 1),
+                                    replySpace,
+                                    &memberReplySize)) {
+         /* Nothing to return for this member, the client resumes from here. */
+         break;
+      }
+
+      replyEntry->size = memberReplySize;
+      replyEntry->flags = 0;
+      replyOffset += sizeof *replyEntry + memberReplySize;
+      requestOffset += sizeof *requestEntry + requestEntry->size;
+      reply->numReplies++;
+
+      if (0 != (flags & HGFS_COMPOUND_FLAG_STOP_ON_ERROR) &&
+          ((const HgfsHeader *)(replyEntry + 1))->status != HGFS_STATUS_SUCCESS) {
+         break;
+      }
+   }
+
+   replyPayloadSize = replyOffset - replyHeaderSize;
+
+exit:
+   free(requests);
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -3765,9 +4793,9 @@ HgfsServerShareAdd(const char *shareName,   // IN: shared folder name
       return HGFS_INVALID_FOLDER_HANDLE;
    }
 
-   MXUser_AcquireExclLock(gHgfsSharedFoldersLock);
+   MXUser_AcquireForWrite(gHgfsSharedFoldersLock);
    handle = HgfsServerShareAddInternal(shareName, sharePath);
-   MXUser_ReleaseExclLock(gHgfsSharedFoldersLock);
+   MXUser_ReleaseRWLock(gHgfsSharedFoldersLock);
 
    LOG(8, "%s: exit(%#x)\n", __FUNCTION__, handle);
    return handle;
@@ -3807,7 +4835,7 @@ HgfsServerSharesReset(DblLnkLst_Links *newSharesList)  // IN: List of new shares
       return;
    }
 
-   MXUser_AcquireExclLock(gHgfsSharedFoldersLock);
+   MXUser_AcquireForWrite(gHgfsSharedFoldersLock);
 
    /*
     * Now we go through the shares properties list to
@@ -3828,7 +4856,7 @@ HgfsServerSharesReset(DblLnkLst_Links *newSharesList)  // IN: List of new shares
       HgfsServerShareAddInternal(newShare->name, newShare->path);
    }
 
-   MXUser_ReleaseExclLock(gHgfsSharedFoldersLock);
+   MXUser_ReleaseRWLock(gHgfsSharedFoldersLock);
    LOG(8, "%s: exit\n", __FUNCTION__);
 }
 
@@ -3860,7 +4888,7 @@ HgfsServerGetShareHandle(const char *shareName)  // IN: name of the shared folde
       return HGFS_INVALID_FOLDER_HANDLE;
    }
 
-   MXUser_AcquireExclLock(gHgfsSharedFoldersLock);
+   MXUser_AcquireForRead(gHgfsSharedFoldersLock);
 
    DblLnkLst_ForEach(link, &gHgfsSharedFoldersList) {
       HgfsSharedFolderProperties *folder =
@@ -3870,7 +4898,7 @@ HgfsServerGetShareHandle(const char *shareName)  // IN: name of the shared folde
          break;
       }
    }
-   MXUser_ReleaseExclLock(gHgfsSharedFoldersLock);
+   MXUser_ReleaseRWLock(gHgfsSharedFoldersLock);
    return result;
 }
 
@@ -3905,7 +4933,7 @@ HgfsServerGetShareName(HgfsSharedFolderHandle sharedFolder, // IN: Notify handle
       return FALSE;
    }
 
-   MXUser_AcquireExclLock(gHgfsSharedFoldersLock);
+   MXUser_AcquireForRead(gHgfsSharedFoldersLock);
 
    DblLnkLst_ForEach(link, &gHgfsSharedFoldersList) {
       HgfsSharedFolderProperties *folder =
@@ -3917,7 +4945,7 @@ HgfsServerGetShareName(HgfsSharedFolderHandle sharedFolder, // IN: Notify handle
          break;
       }
    }
-   MXUser_ReleaseExclLock(gHgfsSharedFoldersLock);
+   MXUser_ReleaseRWLock(gHgfsSharedFoldersLock);
    return result;
 }
 
@@ -3959,14 +4987,30 @@ HgfsServer_InitState(const HgfsServerCallbacks **callbackTable,   // IN/OUT: our
     */
 
    DblLnkLst_Init(&gHgfsSharedFoldersList);
-   gHgfsSharedFoldersLock = MXUser_CreateExclLock("sharedFoldersLock",
-                                                  RANK_hgfsSharedFolders);
+   gHgfsSharedFoldersLock =
+      MXUser_CreateRWLockReaderBiased("sharedFoldersLock",
+                                      RANK_hgfsSharedFolders);
 
    if (!HgfsPlatformInit()) {
       LOG(4, "Could not initialize server platform specific \n");
       result = FALSE;
    }
 
+#if !defined(_WIN32)
+   if (result) {
+      uint32 i;
+
+      gHgfsStatFsCache = Util_SafeCalloc(1, sizeof *gHgfsStatFsCache);
+      gHgfsStatFsCache->lock = MXUser_CreateExclLock("statFsCacheLock",
+                                                     RANK_hgfsStatFsCacheLock);
+      gHgfsStatFsCache->refreshed =
+         MXUser_CreateCondVarExclLock(gHgfsStatFsCache->lock);
+      for (i = 0; i < ARRAYSIZE(gHgfsStatFsCache->entries); i++) {
+         gHgfsStatFsCache->entries[i].cache = gHgfsStatFsCache;
+      }
+   }
+#endif
+
    if (result) {
       *callbackTable = &gHgfsServerCBTable;
 
@@ -4032,7 +5076,7 @@ HgfsServer_ExitState(void)
    }
 
    if (NULL != gHgfsSharedFoldersLock) {
-      MXUser_DestroyExclLock(gHgfsSharedFoldersLock);
+      MXUser_DestroyRWLock(gHgfsSharedFoldersLock);
       gHgfsSharedFoldersLock = NULL;
    }
 
@@ -4042,7 +5086,29 @@ HgfsServer_ExitState(void)
       Log("%s: exit threadpool - inactive.\n", __FUNCTION__);
    }
 
+#if !defined(_WIN32)
+   if (NULL != gHgfsStatFsCache) {
+      HgfsStatFsCache *cache = gHgfsStatFsCache;
+      Bool freeCache;
+
+      /* Refreshes stuck on a share free the cache when they complete. */
+      gHgfsStatFsCache = NULL;
+      MXUser_AcquireExclLock(cache->lock);
+      cache->exiting = TRUE;
+      freeCache = 0 == cache->numRefreshing;
+      MXUser_ReleaseExclLock(cache->lock);
+      if (freeCache) {
+         HgfsServerStatFsCacheFree(cache);
+      }
+   }
+#endif
+
    HgfsPlatformDestroy();
+   HgfsServerInputCacheFlush();
+
+   if (gHgfsServerStatsEnabled) {
+      HgfsServerStats_Log();
+   }
 
    /*
     * Reset the server manager callbacks.
@@ -4177,6 +5243,42 @@ HgfsServerSetSessionCapability(HgfsOp op,                  // IN: operation code
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerIsSessionCapable --
+ *
+ *    Checks whether the capabilities returned to the client when the session
+ *    was created mark the operation as supported. Operations that only this
+ *    server implements must be refused when they are not, so that no client
+ *    relies on them without having seen them negotiated.
+ *
+ * Results:
+ *    TRUE if the operation is supported within the session, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsServerIsSessionCapable(HgfsOp op,                       // IN: operation code
+                           const HgfsSessionInfo *session)  // IN: session
+{
+   uint32 i;
+
+   for (i = 0; i < session->numberOfCapabilities; i++) {
+      if (session->hgfsSessionCapabilities[i].op == op) {
+         return 0 != (session->hgfsSessionCapabilities[i].flags &
+                      HGFS_OP_CAPFLAG_IS_SUPPORTED);
+      }
+   }
+
+   return FALSE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -4579,7 +5681,8 @@ HgfsServerAsyncSignalAllRequestsDone(HgfsAsyncRequestInfo *info) // IN: info
  *    None.
  *
  * Side effects:
- *    None.
+ *    Wakes up the waiters when the count drops to zero or back to
+ *    HGFS_SESSION_MAX_ASYNC_REQUESTS.
  *
  *-----------------------------------------------------------------------------
  */
@@ -4587,13 +5690,14 @@ HgfsServerAsyncSignalAllRequestsDone(HgfsAsyncRequestInfo *info) // IN: info
 static void
 HgfsServerAsyncInfoDecCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
 {
-   if (Atomic_ReadDec32(&info->requestCount) == 1) {
+   uint32 count = Atomic_ReadDec32(&info->requestCount);
+
+   if (count == 1 || count == HGFS_SESSION_MAX_ASYNC_REQUESTS + 1) {
       HgfsServerAsyncSignalAllRequestsDone(info);
    }
 }
 
 
-#ifndef VMX86_TOOLS
 /*
  *-----------------------------------------------------------------------------
  *
@@ -4603,6 +5707,32 @@ HgfsServerAsyncInfoDecCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
  *
  *
  * Results:
+ *    TRUE if the request is within the credit of the session, FALSE if
+ *    the session already had HGFS_SESSION_MAX_ASYNC_REQUESTS outstanding.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsServerAsyncInfoIncCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
+{
+   return Atomic_ReadInc32(&info->requestCount) < HGFS_SESSION_MAX_ASYNC_REQUESTS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerAsyncWaitForCredit --
+ *
+ *    Wait until the session is back within its credit of async requests,
+ *    counting the request that went past it.
+ *
+ *
+ * Results:
  *    None.
  *
  * Side effects:
@@ -4612,11 +5742,14 @@ HgfsServerAsyncInfoDecCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
  */
 
 static void
-HgfsServerAsyncInfoIncCount(HgfsAsyncRequestInfo *info) // IN/OUT: info
+HgfsServerAsyncWaitForCredit(HgfsAsyncRequestInfo *info) // IN: info
 {
-   Atomic_Inc(&info->requestCount);
+   MXUser_AcquireExclLock(info->lock);
+   while (Atomic_Read(&info->requestCount) > HGFS_SESSION_MAX_ASYNC_REQUESTS) {
+      MXUser_WaitCondVarExclLock(info->lock, info->requestCountIsZero);
+   }
+   MXUser_ReleaseExclLock(info->lock);
 }
-#endif // VMX86_TOOLS
 
 
 /*
@@ -4660,8 +5793,8 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
    session->fileIOLock = MXUser_CreateExclLock("HgfsFileIOLock",
                                                RANK_hgfsFileIOLock);
 
-   session->nodeArrayLock = MXUser_CreateExclLock("HgfsNodeArrayLock",
-                                                  RANK_hgfsNodeArrayLock);
+   session->nodeArrayLock = MXUser_CreateRWLock("HgfsNodeArrayLock",
+                                                RANK_hgfsNodeArrayLock);
 
    session->searchArrayLock = MXUser_CreateExclLock("HgfsSearchArrayLock",
                                                     RANK_hgfsSearchArrayLock);
@@ -4669,9 +5802,9 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
    session->sessionId = HgfsGenerateSessionId();
    session->state = HGFS_SESSION_STATE_OPEN;
    DblLnkLst_Init(&session->links);
-   session->isInactive = TRUE;
+   session->activeSweep = transportSession->sweepCount;
+   session->objectsInvalidated = FALSE;
    session->transportSession = transportSession;
-   session->numInvalidationAttempts = 0;
 
    if (  createSessionInfo.maxPacketSize
        < transportSession->channelCapabilities.maxPacketSize) {
@@ -4684,10 +5817,16 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
    /*
     * If the server is enabled for processing oplocks and the client
     * is requesting to use them, then report back to the client oplocks
-    * are enabled by propagating the session flag.
+    * are enabled by propagating the session flag. Oplock breaks are sent
+    * to the client unsolicited, so like change notifications they need a
+    * channel that can do so. The lease monitoring is only started for the
+    * first such session.
     */
    if ((0 != (createSessionInfo.flags & HGFS_SESSION_OPLOCK_ENABLED)) &&
-       (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_ENABLED))) {
+       (0 != (gHgfsCfgSettings.flags & HGFS_CONFIG_OPLOCK_ENABLED)) &&
+       (0 != (transportSession->channelCapabilities.flags &
+              HGFS_CHANNEL_SHARED_MEM)) &&
+       HgfsServerOplockStart()) {
       session->flags |= HGFS_SESSION_OPLOCK_ENABLED;
    }
 
@@ -4710,6 +5849,7 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
       /* Append at the end of the list. */
       DblLnkLst_LinkLast(&session->nodeFreeList, &session->nodeArray[i].links);
    }
+   HgfsNodeHashRebuild(session);
 
    /*
     * Initialize the search handling components.
@@ -4739,6 +5879,15 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
    HgfsServerGetDefaultCapabilities(session->hgfsSessionCapabilities,
                                     &session->numberOfCapabilities);
 
+   if (0 != (session->flags & HGFS_SESSION_OPLOCK_ENABLED)) {
+      HgfsServerSetSessionCapability(HGFS_OP_SERVER_LOCK_CHANGE,
+                                     HGFS_OP_CAPFLAG_IS_SUPPORTED, session);
+      HgfsServerSetSessionCapability(HGFS_OP_SERVER_LOCK_CHANGE_V3,
+                                     HGFS_OP_CAPFLAG_IS_SUPPORTED, session);
+      HgfsServerSetSessionCapability(HGFS_OP_OPLOCK_BREAK_V4,
+                                     HGFS_OP_CAPFLAG_IS_SUPPORTED, session);
+   }
+
    if (transportSession->channelCapabilities.flags & HGFS_CHANNEL_SHARED_MEM) {
       flags = HGFS_OP_CAPFLAG_IS_SUPPORTED;
       if (   (0 != (createSessionInfo.flags & HGFS_SESSION_ASYNC_IO_ENABLED))
@@ -4781,6 +5930,19 @@ HgfsServerAllocateSession(HgfsTransportSessionInfo *transportSession, // IN:
 
       HgfsServerSetSessionCapability(HGFS_OP_SEARCH_READ_V4,
                                      HGFS_OP_CAPFLAG_IS_SUPPORTED, session);
+   } else if ((transportSession->channelCapabilities.flags &
+               HGFS_CHANNEL_ASYNC) && gHgfsThreadpoolActive) {
+      /*
+       * The requests of the session are queued on the threadpool without
+       * the client asking, see HgfsServerSessionReceive.
+       */
+      if (HgfsThreadpool_Activate()) {
+         LOG(8, "%s: threadpool is enabled\n", __FUNCTION__);
+      } else {
+         HgfsThreadpool_Exit();
+         gHgfsThreadpoolActive = FALSE;
+         Log("%s: failed to activate the threadpool\n", __FUNCTION__);
+      }
    }
 
    *sessionData = session;
@@ -4948,9 +6110,12 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
       HgfsNotify_RemoveSessionSubscribers(session);
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    Log("%s: teardown session %p id 0x%"FMT64"x\n", __FUNCTION__, session, session->sessionId);
+   LOG(4, "%s: zero-copy reads %"FMT64"u writes %"FMT64"u\n", __FUNCTION__,
+       Atomic_Read64(&session->numZeroCopyReads),
+       Atomic_Read64(&session->numZeroCopyWrites));
 
    /* Recycle all nodes that are still in use, then destroy the node pool. */
    for (i = 0; i < session->numNodes; i++) {
@@ -4966,8 +6131,10 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
    }
    free(session->nodeArray);
    session->nodeArray = NULL;
+   free(session->nodeHashBuckets);
+   session->nodeHashBuckets = NULL;
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    /*
     * Recycle all searches that are still in use, then destroy the
@@ -4992,7 +6159,7 @@ HgfsServerExitSessionInternal(HgfsSessionInfo *session)    // IN: session contex
    }
 
    /* Teardown the locks for the sessions and destroy itself. */
-   MXUser_DestroyExclLock(session->nodeArrayLock);
+   MXUser_DestroyRWLock(session->nodeArrayLock);
    MXUser_DestroyExclLock(session->searchArrayLock);
    MXUser_DestroyExclLock(session->fileIOLock);
 
@@ -5051,6 +6218,133 @@ HgfsServer_SetHandleCounter(uint32 newHandleCounter)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_EnableStats --
+ *
+ *    Start or stop recording per-opcode counters and latency histograms.
+ *    While disabled the request path only tests a flag.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServer_EnableStats(Bool enable)  // IN: TRUE to start recording
+{
+   HgfsServerStats_Enable(enable);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_ResetStats --
+ *
+ *    Zero the per-opcode counters and latency histograms.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServer_ResetStats(void)
+{
+   HgfsServerStats_Reset();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_GetStats --
+ *
+ *    Render the per-opcode counters and latency histograms as text.
+ *
+ * Results:
+ *    Allocated string, the caller must free it.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+HgfsServer_GetStats(void)
+{
+   return HgfsServerStats_Format();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_SetShareLimits --
+ *
+ *    Set how asynchronous requests on a share are scheduled: its weight
+ *    among the sessions and shares competing for the worker threads,
+ *    relative to the default weight of 1, and the bytes per second its
+ *    reads and writes may move, 0 for no cap. Passing 1 and 0 restores
+ *    the defaults.
+ *
+ * Results:
+ *    TRUE on success, FALSE if the threadpool is not in use.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServer_SetShareLimits(const char *shareName,  // IN: share name
+                          uint32 weight,          // IN: scheduling weight
+                          uint64 bytesPerSec)     // IN: cap, 0 for none
+{
+   ASSERT(shareName != NULL);
+
+   if (!gHgfsThreadpoolActive) {
+      return FALSE;
+   }
+   return HgfsThreadpool_SetShareLimits(shareName, weight, bytesPerSec);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServer_LogStats --
+ *
+ *    Write the per-opcode counters and latency histograms to the log.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServer_LogStats(void)
+{
+   HgfsServerStats_Log();
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -5250,7 +6544,7 @@ HgfsInvalidateSessionObjects(DblLnkLst_Links *shares,  // IN: List of new shares
    ASSERT(session->searchArray);
    LOG(4, "%s: Beginning\n", __FUNCTION__);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    /*
     * Iterate over each node, skipping those that are unused. For each node,
@@ -5292,7 +6586,7 @@ HgfsInvalidateSessionObjects(DblLnkLst_Links *shares,  // IN: List of new shares
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    MXUser_AcquireExclLock(session->searchArrayLock);
 
@@ -5365,22 +6659,37 @@ HgfsServerSessionInvalidateObjects(void *clientData,         // IN:
                                    DblLnkLst_Links *shares)  // IN: List of new shares
 {
    HgfsTransportSessionInfo *transportSession = clientData;
+   HgfsSessionInfo **sessions;
+   uint32 numSessions = 0;
    DblLnkLst_Links *curr;
+   uint32 i;
 
    LOG(4, "%s: Beginning\n", __FUNCTION__);
 
    ASSERT(transportSession);
    MXUser_AcquireExclLock(transportSession->sessionArrayLock);
 
+   sessions = Util_SafeMalloc((transportSession->numSessions + 1) *
+                              sizeof *sessions);
    DblLnkLst_ForEach(curr, &transportSession->sessionArray) {
       HgfsSessionInfo *session = DblLnkLst_Container(curr, HgfsSessionInfo, links);
-      HgfsServerSessionGet(session);
-      HgfsInvalidateSessionObjects(shares, session);
-      HgfsServerSessionPut(session);
+
+      /* Inactive sessions whose objects were closed have none left. */
+      if (!session->objectsInvalidated) {
+         HgfsServerSessionGet(session);
+         sessions[numSessions++] = session;
+      }
    }
 
    MXUser_ReleaseExclLock(transportSession->sessionArrayLock);
 
+   /* Closing files and searches takes time, do not block the lookups. */
+   for (i = 0; i < numSessions; i++) {
+      HgfsInvalidateSessionObjects(shares, sessions[i]);
+      HgfsServerSessionPut(sessions[i]);
+   }
+   free(sessions);
+
    /* Now invalidate any stale shares and add any new ones. */
    HgfsServerSharesReset(shares);
    LOG(4, "%s: Ending\n", __FUNCTION__);
@@ -5392,19 +6701,17 @@ HgfsServerSessionInvalidateObjects(void *clientData,         // IN:
  *
  * HgfsServerSessionInvalidateInactiveSessions --
  *
- *      Iterates over all sessions and invalidate all inactive session objects.
- *
- *      Following clock algorithm is used to determine whether the session object
- *      is inactive or not.
+ *      Invalidates the objects of sessions that were inactive since the last
+ *      call and closes the sessions inactive for too long.
  *
- *      When this function is called, the HGFS server manager will iterate
- *      over all the sessions belonging to this manager. Each session is marked
- *      as inactive. Whenever a message is processed for a session, that
- *      session is marked as active. When this function is called the next time,
- *      any sessions that are still inactive will be invalidated.
- *
- *      Caller guarantees that the sessions won't go away under us, so no locks
- *      needed.
+ *      Each call is a sweep. A session records the sweep of its first request
+ *      after a sweep and moves to the end of the session list, so the list is
+ *      ordered by last activity and the walk stops at the first session used
+ *      since the previous sweep. The objects of an inactive session are
+ *      invalidated once per inactive period, at most
+ *      HGFS_SESSION_INVALIDATE_BATCH sessions per sweep and outside of the
+ *      session list lock. Sessions inactive for
+ *      MAX_SESSION_INVALIDATION_ATTEMPTS sweeps are closed.
  *
  * Results:
  *      Number of active sessions remaining inside the HGFS server.
@@ -5419,52 +6726,70 @@ uint32
 HgfsServerSessionInvalidateInactiveSessions(void *clientData)         // IN:
 {
    HgfsTransportSessionInfo *transportSession = clientData;
-   uint32 numActiveSessionsLeft = 0;
-   DblLnkLst_Links shares, *curr, *next;
+   HgfsSessionInfo *inactive[HGFS_SESSION_INVALIDATE_BATCH];
+   uint32 numInactive = 0;
+   uint32 numActiveSessionsLeft;
+   DblLnkLst_Links shares, closed, *curr, *next;
+   uint32 i;
 
    ASSERT(transportSession);
-   MXUser_AcquireExclLock(transportSession->sessionArrayLock);
 
    DblLnkLst_Init(&shares);
+   DblLnkLst_Init(&closed);
+
+   MXUser_AcquireExclLock(transportSession->sessionArrayLock);
 
    DblLnkLst_ForEachSafe(curr, next,  &transportSession->sessionArray) {
       HgfsSessionInfo *session = DblLnkLst_Container(curr, HgfsSessionInfo, links);
-      HgfsServerSessionGet(session);
+      uint32 inactiveSweeps = transportSession->sweepCount - session->activeSweep;
 
-      session->numInvalidationAttempts++;
-      numActiveSessionsLeft++;
-
-      /*
-       * Check if the session is inactive. If the session is inactive, then
-       * invalidate the session objects.
-       */
-      if (session->isInactive) {
-
-         if (session->numInvalidationAttempts == MAX_SESSION_INVALIDATION_ATTEMPTS) {
-            LOG(4, "%s: closing inactive session %"FMT64"x\n", __FUNCTION__,
-                session->sessionId);
-            session->state = HGFS_SESSION_STATE_CLOSED;
-            HgfsServerTransportRemoveSessionFromList(transportSession,
-                                                     session);
-            /*
-             * We need to reduce the refcount by 1 since we want to
-             * destroy the session.
-             */
-            numActiveSessionsLeft--;
-            HgfsServerSessionPut(session);
-         } else {
-            HgfsInvalidateSessionObjects(&shares, session);
-         }
-      } else {
-         session->isInactive = TRUE;
-         session->numInvalidationAttempts = 0;
+      /* This session and the following ones were used since the last sweep. */
+      if (0 == inactiveSweeps) {
+         break;
       }
 
-      HgfsServerSessionPut(session);
+      if (inactiveSweeps >= MAX_SESSION_INVALIDATION_ATTEMPTS) {
+         LOG(4, "%s: closing inactive session %"FMT64"x\n", __FUNCTION__,
+             session->sessionId);
+         session->state = HGFS_SESSION_STATE_CLOSED;
+         DblLnkLst_Unlink1(&session->links);
+         transportSession->numSessions--;
+         /* The reference of the list goes with the session. */
+         DblLnkLst_LinkLast(&closed, &session->links);
+      } else if (!session->objectsInvalidated &&
+                 numInactive < ARRAYSIZE(inactive)) {
+         session->objectsInvalidated = TRUE;
+         HgfsServerSessionGet(session);
+         inactive[numInactive++] = session;
+      }
    }
 
+   transportSession->sweepCount++;
+   numActiveSessionsLeft = transportSession->numSessions;
+
    MXUser_ReleaseExclLock(transportSession->sessionArrayLock);
 
+   /*
+    * Closing files and searches takes time, do not block the lookups.
+    * Sessions beyond the batch are handled by the next sweeps.
+    */
+   for (i = 0; i < numInactive; i++) {
+      HgfsInvalidateSessionObjects(&shares, inactive[i]);
+      HgfsServerSessionPut(inactive[i]);
+   }
+
+   DblLnkLst_ForEachSafe(curr, next, &closed) {
+      HgfsSessionInfo *session = DblLnkLst_Container(curr, HgfsSessionInfo, links);
+
+      DblLnkLst_Unlink1(&session->links);
+      HgfsServerSessionPut(session);
+      /*
+       * We need to reduce the refcount by 1 more since we want to
+       * destroy the session.
+       */
+      HgfsServerSessionPut(session);
+   }
+
    return numActiveSessionsLeft;
 }
 
@@ -5472,7 +6797,7 @@ HgfsServerSessionInvalidateInactiveSessions(void *clientData)         // IN:
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerStatFs --
+ * HgfsServerStatFsInt --
  *
  *      Calls on the wiper library to return the number of free bytes and
  *      total bytes on the filesystem underlying the given pathname.
@@ -5487,11 +6812,11 @@ HgfsServerSessionInvalidateInactiveSessions(void *clientData)         // IN:
  *-----------------------------------------------------------------------------
  */
 
-Bool
-HgfsServerStatFs(const char *pathName, // IN: Path we're interested in
-                 size_t pathLength,    // IN: Length of path
-                 uint64 *freeBytes,    // OUT: Free bytes on volume
-                 uint64 *totalBytes)   // OUT: Total bytes on volume
+static Bool
+HgfsServerStatFsInt(const char *pathName, // IN: Path we're interested in
+                    size_t pathLength,    // IN: Length of path
+                    uint64 *freeBytes,    // OUT: Free bytes on volume
+                    uint64 *totalBytes)   // OUT: Total bytes on volume
 {
    WiperPartition p;
    unsigned char *wiperError;
@@ -5524,7 +6849,259 @@ HgfsServerStatFs(const char *pathName, // IN: Path we're interested in
       return FALSE;
    }
 
-   return TRUE;
+   return TRUE;
+}
+
+
+#if !defined(_WIN32)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStatFsCacheFree --
+ *
+ *      Free the volume information cache. Called once the server exited and
+ *      no refresh is running.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerStatFsCacheFree(HgfsStatFsCache *cache)  // IN: cache to free
+{
+   uint32 i;
+
+   ASSERT(0 == cache->numRefreshing);
+
+   for (i = 0; i < ARRAYSIZE(cache->entries); i++) {
+      free(cache->entries[i].path);
+   }
+   MXUser_DestroyCondVar(cache->refreshed);
+   MXUser_DestroyExclLock(cache->lock);
+   free(cache);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStatFsRefresh --
+ *
+ *      Thread fetching the volume information of a cache entry. The entry
+ *      is not reused while it is being refreshed.
+ *
+ * Results:
+ *      Always NULL.
+ *
+ * Side effects:
+ *      Wakes up the requests waiting for the entry. Frees the cache if the
+ *      server exited meanwhile.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsServerStatFsRefresh(void *data)  // IN: entry to refresh
+{
+   HgfsStatFsEntry *entry = data;
+   HgfsStatFsCache *cache = entry->cache;
+   uint64 freeBytes = 0;
+   uint64 totalBytes = 0;
+   Bool success;
+   Bool freeCache;
+
+   success = HgfsServerStatFsInt(entry->path, strlen(entry->path),
+                                 &freeBytes, &totalBytes);
+
+   MXUser_AcquireExclLock(cache->lock);
+   entry->success = success;
+   entry->freeBytes = freeBytes;
+   entry->totalBytes = totalBytes;
+   entry->fetchTime = Hostinfo_SystemTimerMS();
+   entry->fetched = TRUE;
+   entry->refreshing = FALSE;
+   cache->numRefreshing--;
+   MXUser_BroadcastCondVar(cache->refreshed);
+   freeCache = cache->exiting && 0 == cache->numRefreshing;
+   MXUser_ReleaseExclLock(cache->lock);
+
+   if (freeCache) {
+      HgfsServerStatFsCacheFree(cache);
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStatFsCacheEntry --
+ *
+ *      Find the cache entry of a path, or reuse the least recently used
+ *      entry that is not being refreshed for it. The cache lock must be
+ *      held.
+ *
+ * Results:
+ *      The entry, NULL if every entry is being refreshed.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatFsEntry *
+HgfsServerStatFsCacheEntry(HgfsStatFsCache *cache,  // IN: cache
+                           const char *pathName)    // IN: path
+{
+   HgfsStatFsEntry *victim = NULL;
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(cache->entries); i++) {
+      HgfsStatFsEntry *entry = &cache->entries[i];
+
+      if (NULL != entry->path && 0 == strcmp(entry->path, pathName)) {
+         return entry;
+      }
+      if (!entry->refreshing &&
+          (NULL == victim || NULL == entry->path ||
+           (NULL != victim->path && entry->useTime < victim->useTime))) {
+         victim = entry;
+      }
+   }
+
+   if (NULL != victim) {
+      free(victim->path);
+      victim->path = Util_SafeStrdup(pathName);
+      victim->fetched = FALSE;
+   }
+
+   return victim;
+}
+#endif // !_WIN32
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStatFs --
+ *
+ *      Return the number of free bytes and total bytes on the filesystem
+ *      underlying the given pathname.
+ *
+ *      Clients query volumes constantly and a network share that does not
+ *      respond blocks statfs, so the results are cached per path for
+ *      HGFS_STATFS_CACHE_TTL_MS. An expired entry is refreshed by a
+ *      background thread; the request waits HGFS_STATFS_WAIT_MS for it at
+ *      most and then uses the previous result, or fails the first time.
+ *
+ * Results:
+ *      TRUE if successful: freeBytes and totalBytes have been written to.
+ *      FALSE otherwise.
+ *
+ * Side effects:
+ *      May start a thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServerStatFs(const char *pathName, // IN: Path we're interested in
+                 size_t pathLength,    // IN: Length of path
+                 uint64 *freeBytes,    // OUT: Free bytes on volume
+                 uint64 *totalBytes)   // OUT: Total bytes on volume
+{
+#if !defined(_WIN32)
+   HgfsStatFsCache *cache = gHgfsStatFsCache;
+   HgfsStatFsEntry *entry;
+   VmTimeType now;
+   VmTimeType deadline;
+   Bool success = FALSE;
+
+   ASSERT(pathName);
+   ASSERT(freeBytes);
+   ASSERT(totalBytes);
+
+   if (NULL == cache || strlen(pathName) != pathLength) {
+      return HgfsServerStatFsInt(pathName, pathLength, freeBytes, totalBytes);
+   }
+
+   MXUser_AcquireExclLock(cache->lock);
+
+   entry = HgfsServerStatFsCacheEntry(cache, pathName);
+   if (NULL == entry) {
+      /* Every entry waits for a share; do not add to it. */
+      MXUser_ReleaseExclLock(cache->lock);
+      LOG(4, "%s: cache full, querying %s\n", __FUNCTION__, pathName);
+      return HgfsServerStatFsInt(pathName, pathLength, freeBytes, totalBytes);
+   }
+
+   now = Hostinfo_SystemTimerMS();
+   entry->useTime = now;
+   if (!entry->refreshing &&
+       (!entry->fetched || now - entry->fetchTime >= HGFS_STATFS_CACHE_TTL_MS)) {
+      pthread_attr_t attr;
+      pthread_t thread;
+      Bool started;
+
+      entry->refreshing = TRUE;
+      cache->numRefreshing++;
+
+      pthread_attr_init(&attr);
+      pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+      started = pthread_create(&thread, &attr,
+                               HgfsServerStatFsRefresh, entry) == 0;
+      pthread_attr_destroy(&attr);
+
+      if (!started) {
+         LOG(4, "%s: could not start refresh, querying %s\n", __FUNCTION__,
+             pathName);
+         entry->refreshing = FALSE;
+         cache->numRefreshing--;
+         MXUser_ReleaseExclLock(cache->lock);
+         return HgfsServerStatFsInt(pathName, pathLength, freeBytes,
+                                    totalBytes);
+      }
+   }
+
+   /* Give the refresh some time, then make do with what we have. */
+   deadline = now + HGFS_STATFS_WAIT_MS;
+   while (entry->refreshing && now < deadline) {
+      MXUser_TimedWaitCondVarExclLock(cache->lock, cache->refreshed,
+                                      (uint32)(deadline - now));
+      now = Hostinfo_SystemTimerMS();
+   }
+
+   if (NULL == entry->path || 0 != strcmp(entry->path, pathName)) {
+      /* The entry was reused meanwhile. */
+      MXUser_ReleaseExclLock(cache->lock);
+      return HgfsServerStatFsInt(pathName, pathLength, freeBytes, totalBytes);
+   }
+
+   if (entry->fetched) {
+      if (entry->refreshing) {
+         LOG(4, "%s: %s is slow, using cached values\n", __FUNCTION__,
+             pathName);
+      }
+      success = entry->success;
+      *freeBytes = entry->freeBytes;
+      *totalBytes = entry->totalBytes;
+   } else {
+      LOG(4, "%s: timed out querying %s\n", __FUNCTION__, pathName);
+   }
+
+   MXUser_ReleaseExclLock(cache->lock);
+
+   return success;
+#else
+   return HgfsServerStatFsInt(pathName, pathLength, freeBytes, totalBytes);
+#endif
 }
 
 
@@ -6161,9 +7738,9 @@ HgfsRemoveFromCache(HgfsHandle handle,	      // IN: Hgfs handle to the node
 {
    Bool removed = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    removed = HgfsRemoveFromCacheInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return removed;
 }
@@ -6192,9 +7769,9 @@ HgfsIsCached(HgfsHandle handle,         // IN: Structure representing file node
 {
    Bool cached = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    cached = HgfsIsCachedInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return cached;
 }
@@ -6303,9 +7880,9 @@ HgfsAddToCache(HgfsHandle handle,        // IN: HGFS file handle
 {
    Bool added = FALSE;
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
    added = HgfsAddToCacheInternal(handle, session);
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return added;
 }
@@ -6369,49 +7946,375 @@ HgfsCreateAndCacheFileNode(HgfsFileOpenInfo *openInfo, // IN: Open info struct
       sharedFolderOpen = TRUE;
    }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForWrite(session->nodeArrayLock);
 
    node = HgfsAddNewFileNode(openInfo, localId, fileDesc, append, len,
                              openInfo->cpName, sharedFolderOpen, session);
 
    if (node == NULL) {
       LOG(4, "%s: Failed to add new node.\n", __FUNCTION__);
-      MXUser_ReleaseExclLock(session->nodeArrayLock);
+      MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+      HgfsPlatformCloseFile(fileDesc, NULL);
+      return FALSE;
+   }
+   handle = HgfsFileNode2Handle(node);
+
+   if (!HgfsAddToCacheInternal(handle, session)) {
+      HgfsFreeFileNodeInternal(handle, session);
+      HgfsPlatformCloseFile(fileDesc, NULL);
+
+      LOG(4, "%s: Failed to add node to the cache.\n", __FUNCTION__);
+      MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+      return FALSE;
+   }
+
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   /* Only after everything is successful, save the handle in the open info. */
+   openInfo->file = handle;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsAllocInitReply --
+ *
+ *    Retrieves the hgfs protocol reply data buffer that follows the reply header.
+ *
+ * Results:
+ *    Cannot fail, returns the protocol reply data buffer for the corresponding
+ *    processed protocol request.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void *
+HgfsAllocInitReply(HgfsPacket *packet,           // IN/OUT: Hgfs Packet
+                   const void *packetHeader,     // IN: packet header
+                   size_t replyDataSize,         // IN: replyDataSize size
+                   HgfsSessionInfo *session)     // IN: Session Info
+{
+   const HgfsRequest *request = packetHeader;
+   size_t replyPacketSize;
+   size_t headerSize = 0; /* Replies prior to V3 do not have a header. */
+   void *replyHeader;
+   void *replyData;
+
+   /*
+    * XXX - this should be modified to use the common HgfsServerGetReplyHeaderSize
+    * so that all requests and replies are handled consistently.
+    */
+   if (HGFS_OP_NEW_HEADER == request->op) {
+      headerSize = sizeof(HgfsHeader);
+   } else if (request->op < HGFS_OP_CREATE_SESSION_V4 &&
+              request->op > HGFS_OP_RENAME_V2) {
+      headerSize = sizeof(HgfsReply);
+   }
+   replyHeader = HSPU_GetReplyPacket(packet,
+                                     session->transportSession->channelCbTable,
+                                     headerSize + replyDataSize,
+                                     &replyPacketSize);
+
+   ASSERT(replyHeader && (replyPacketSize >= headerSize + replyDataSize));
+
+   memset(replyHeader, 0, headerSize + replyDataSize);
+   if (replyDataSize > 0) {
+      replyData = (char *)replyHeader + headerSize;
+   } else {
+      replyData = NULL;
+      ASSERT(FALSE);
+   }
+
+   return replyData;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerValidateRead --
+ *
+ *    Validate a Read request's arguments.
+ *
+ *    Note, the readOffset is ignored here but is checked in the platform specific
+ *    read handler.
+ *
+ * Results:
+ *    HGFS_ERROR_SUCCESS on success.
+ *    HGFS error code on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsServerValidateRead(HgfsInputParam *input,  // IN: Input params
+                       HgfsHandle readHandle,  // IN: read Handle
+                       uint32 readSize,        // IN: size to read
+                       uint64 readOffset,      // IN: offset to read unused
+                       fileDesc *readfd,       // OUT: read file descriptor
+                       size_t *readReplySize,  // OUT: read reply size
+                       size_t *readDataSize)   // OUT: read data size
+{
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+   size_t replyReadHeaderSize;
+   size_t replyReadResultSize = 0;
+   size_t replyReadResultDataSize = 0;
+   size_t replyReadDataSize = 0;
+   fileDesc readFileDesc = 0;
+   Bool useMappedBuffer;
+
+   useMappedBuffer = (input->transportSession->channelCbTable->getWriteVa != NULL);
+   replyReadHeaderSize = HgfsServerGetReplyHeaderSize(input->sessionEnabled,
+                                                      input->op);
+   switch (input->op) {
+   case HGFS_OP_READ_FAST_V4:
+      /* Data is packed into a separate buffer from the read results. */
+      replyReadResultSize = sizeof (HgfsReplyReadV3);
+      replyReadResultDataSize = 0;
+      replyReadDataSize = readSize;
+      break;
+   case HGFS_OP_READ_V3:
+      /* Data is packed as a part of the read results. */
+      replyReadResultSize = sizeof (HgfsReplyReadV3);
+      replyReadResultDataSize = readSize;
+      replyReadDataSize = 0;
+      break;
+   case HGFS_OP_READ:
+      /* Data is packed as a part of the read results. */
+      replyReadResultSize = sizeof (HgfsReplyRead);
+      replyReadResultDataSize = readSize;
+      replyReadDataSize = 0;
+      break;
+   default:
+      status = HGFS_ERROR_PROTOCOL;
+      LOG(4, "%s: Unsupported protocol version passed %d -> PROTOCOL_ERROR.\n",
+          __FUNCTION__, input->op);
+      NOT_IMPLEMENTED();
+      goto exit;
+   }
+
+   if (!HSPU_ValidateDataPacketSize(input->packet, replyReadDataSize) ||
+       !HSPU_ValidateReplyPacketSize(input->packet,
+                                     replyReadHeaderSize,
+                                     replyReadResultSize,
+                                     replyReadResultDataSize,
+                                     useMappedBuffer)) {
+      status = HGFS_ERROR_INVALID_PARAMETER;
+      LOG(4, "%s: Error: arg validation read size -> %d.\n",
+          __FUNCTION__, status);
+      goto exit;
+   }
+
+   /* Validate the file handle by retrieving it possibly from the cache. */
+   status = HgfsPlatformGetFd(readHandle, input->session, FALSE, &readFileDesc);
+   if (status != HGFS_ERROR_SUCCESS) {
+      LOG(4, "%s: Error: arg validation handle -> %d.\n",
+          __FUNCTION__, status);
+      goto exit;
+   }
+
+exit:
+   *readDataSize = replyReadDataSize;
+   *readReplySize = replyReadResultSize + replyReadResultDataSize;
+   *readfd = readFileDesc;
+   LOG(4, "%s: arg validation check return (%"FMTSZ"u) %d.\n",
+       __FUNCTION__, replyReadDataSize, status);
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStreamIo --
+ *
+ *    Track the access pattern of a handle after a successful read or write.
+ *    While the handle is accessed sequentially, start reading ahead of the
+ *    reads and push the written data out behind the writes, so that large
+ *    copies are not bound by the latency of each request.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    May issue read-ahead or write-behind hints for the file.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerStreamIo(HgfsSessionInfo *session,  // IN: session info
+                   HgfsHandle handle,         // IN: file handle
+                   fileDesc fd,               // IN: file descriptor
+                   uint64 offset,             // IN: offset of the I/O
+                   uint32 size,               // IN: bytes transferred
+                   Bool isWrite)              // IN: write or read
+{
+   HgfsFileNode *node;
+   uint64 hintOffset = 0;
+   uint64 hintLength = 0;
+   uint64 allocSize = 0;
+
+   if (size == 0) {
+      return;
+   }
+
+   MXUser_AcquireForWrite(session->nodeArrayLock);
+
+   node = HgfsHandle2FileNode(handle, session);
+   if (node == NULL) {
+      goto exit;
+   }
+
+   if (node->streamBytes == 0) {
+      node->streamStart = Hostinfo_SystemTimerUS();
+   }
+   node->streamBytes += size;
+
+   if (node->flags & HGFS_FILE_NODE_SEQUENTIAL_FL) {
+      /* Sequential only files have no offsets to read ahead of. */
+      goto exit;
+   }
+
+   if (offset != node->streamNext) {
+      /* Random access, stop streaming until it becomes sequential again. */
+      if (node->streamWindow != 0) {
+         session->numStreamingNodes--;
+         node->streamWindow = 0;
+      }
+      node->streamNext = offset + size;
+      node->streamAhead = node->streamNext;
+      node->streamDirty = node->streamNext;
+      goto exit;
+   }
+
+   node->streamNext = offset + size;
+
+   if (isWrite) {
+      if (node->streamDirty > offset) {
+         node->streamDirty = offset;
+      }
+      if (node->streamNext - node->streamDirty >= HGFS_STREAM_WRITE_BEHIND) {
+         hintOffset = node->streamDirty;
+         hintLength = node->streamNext - node->streamDirty;
+         node->streamDirty = node->streamNext;
+      }
+      if (node->streamNext >= HGFS_STREAM_PREALLOC_MIN &&
+          node->streamNext + HGFS_STREAM_PREALLOC_MIN / 2 > node->streamAlloc) {
+         allocSize = node->streamNext +
+                     MIN(node->streamNext, HGFS_STREAM_PREALLOC_MAX);
+         node->streamAlloc = allocSize;
+      }
+   } else {
+      uint32 maxWindow;
+
+      if (node->streamWindow == 0) {
+         node->streamWindow = HGFS_STREAM_MIN_WINDOW;
+         session->numStreamingNodes++;
+      }
+      maxWindow = HGFS_STREAM_SESSION_BUDGET / session->numStreamingNodes;
+      maxWindow = MAX(MIN(maxWindow, HGFS_STREAM_MAX_WINDOW),
+                      HGFS_STREAM_MIN_WINDOW);
+
+      if (node->streamAhead < node->streamNext) {
+         node->streamAhead = node->streamNext;
+      }
+
+      /* Refill once less than half a window is left ahead of the reader. */
+      if (node->streamAhead - node->streamNext < node->streamWindow / 2) {
+         hintOffset = node->streamAhead;
+         hintLength = node->streamWindow;
+         node->streamAhead += node->streamWindow;
+         node->streamWindow = MIN(node->streamWindow * 2, maxWindow);
+      }
+   }
+
+exit:
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
+
+   if (hintLength != 0) {
+      LOG(4, "%s: %s hint handle %u offset %"FMT64"u length %"FMT64"u\n",
+          __FUNCTION__, isWrite ? "write-behind" : "read-ahead", handle,
+          hintOffset, hintLength);
+      if (isWrite) {
+         HgfsPlatformWriteBehind(fd, hintOffset, hintLength);
+      } else {
+         HgfsPlatformReadAhead(fd, hintOffset, hintLength);
+      }
+   }
+   if (allocSize != 0) {
+      LOG(4, "%s: preallocate handle %u to %"FMT64"u\n", __FUNCTION__, handle,
+          allocSize);
+      HgfsPlatformPreallocate(fd, allocSize);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStreamClose --
+ *
+ *    Called before the file descriptor of a node is closed. Frees what was
+ *    preallocated beyond the end of the file and logs the throughput of
+ *    large transfers.
+ *
+ *    The session nodeArrayLock should be acquired prior to calling this
+ *    function.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
 
-      HgfsPlatformCloseFile(fileDesc, NULL);
-      return FALSE;
+static void
+HgfsServerStreamClose(HgfsFileNode *node)  // IN: file node
+{
+   if (node->streamAlloc != 0) {
+      HgfsPlatformTrimPreallocation(node->fileDesc);
+      node->streamAlloc = 0;
    }
-   handle = HgfsFileNode2Handle(node);
-
-   if (!HgfsAddToCacheInternal(handle, session)) {
-      HgfsFreeFileNodeInternal(handle, session);
-      HgfsPlatformCloseFile(fileDesc, NULL);
 
-      LOG(4, "%s: Failed to add node to the cache.\n", __FUNCTION__);
-      MXUser_ReleaseExclLock(session->nodeArrayLock);
+   if (node->streamBytes >= HGFS_STREAM_REPORT_MIN) {
+      VmTimeType elapsed = Hostinfo_SystemTimerUS() - node->streamStart;
 
-      return FALSE;
+      Log("HGFS: handle %u transferred %"FMT64"u bytes in %"FMT64"d ms, "
+          "%"FMT64"u KB/s\n", HgfsFileNode2Handle(node), node->streamBytes,
+          elapsed / 1000,
+          elapsed > 0 ? node->streamBytes * 1000 / (uint64)elapsed : 0);
    }
-
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
-
-   /* Only after everything is successful, save the handle in the open info. */
-   openInfo->file = handle;
-
-   return TRUE;
+   node->streamBytes = 0;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsAllocInitReply --
+ * HgfsServerReadToDataPacket --
  *
- *    Retrieves the hgfs protocol reply data buffer that follows the reply header.
+ *    Read file data straight into the mapped guest pages of the data packet,
+ *    avoiding the intermediate buffer HSPU_GetDataPacketBuf allocates when
+ *    the data packet spans more than one page.
  *
  * Results:
- *    Cannot fail, returns the protocol reply data buffer for the corresponding
- *    processed protocol request.
+ *    HGFS_ERROR_SUCCESS on success.
+ *    HGFS_ERROR_NOT_SUPPORTED if the caller must use the contiguous buffer.
+ *    HGFS error code on failure.
  *
  * Side effects:
  *    None
@@ -6419,59 +8322,47 @@ HgfsCreateAndCacheFileNode(HgfsFileOpenInfo *openInfo, // IN: Open info struct
  *-----------------------------------------------------------------------------
  */
 
-void *
-HgfsAllocInitReply(HgfsPacket *packet,           // IN/OUT: Hgfs Packet
-                   const void *packetHeader,     // IN: packet header
-                   size_t replyDataSize,         // IN: replyDataSize size
-                   HgfsSessionInfo *session)     // IN: Session Info
-{
-   const HgfsRequest *request = packetHeader;
-   size_t replyPacketSize;
-   size_t headerSize = 0; /* Replies prior to V3 do not have a header. */
-   void *replyHeader;
-   void *replyData;
+static HgfsInternalStatus
+HgfsServerReadToDataPacket(HgfsInputParam *input,  // IN: Input params
+                           fileDesc readFd,        // IN: file to read
+                           uint64 offset,          // IN: file offset
+                           uint32 requiredSize,    // IN: bytes to read
+                           uint32 *actualSize)     // OUT: bytes read
+{
+   HgfsServerChannelCallbacks *chanCb = input->transportSession->channelCbTable;
+   HgfsVmxIov *iov;
+   uint32 iovCount;
+   HgfsInternalStatus status;
 
-   /*
-    * XXX - this should be modified to use the common HgfsServerGetReplyHeaderSize
-    * so that all requests and replies are handled consistently.
-    */
-   if (HGFS_OP_NEW_HEADER == request->op) {
-      headerSize = sizeof(HgfsHeader);
-   } else if (request->op < HGFS_OP_CREATE_SESSION_V4 &&
-              request->op > HGFS_OP_RENAME_V2) {
-      headerSize = sizeof(HgfsReply);
+   iov = HSPU_MapDataPacketIov(input->packet, BUF_WRITEABLE, requiredSize,
+                               chanCb, &iovCount);
+   if (NULL == iov) {
+      return HGFS_ERROR_NOT_SUPPORTED;
    }
-   replyHeader = HSPU_GetReplyPacket(packet,
-                                     session->transportSession->channelCbTable,
-                                     headerSize + replyDataSize,
-                                     &replyPacketSize);
 
-   ASSERT(replyHeader && (replyPacketSize >= headerSize + replyDataSize));
+   status = HgfsPlatformReadFileIov(readFd, input->session, offset,
+                                    requiredSize, iov, iovCount, actualSize);
+   HSPU_UnmapDataPacketIov(input->packet, chanCb);
 
-   memset(replyHeader, 0, headerSize + replyDataSize);
-   if (replyDataSize > 0) {
-      replyData = (char *)replyHeader + headerSize;
-   } else {
-      replyData = NULL;
-      ASSERT(FALSE);
+   if (HGFS_ERROR_SUCCESS == status) {
+      Atomic_Inc64(&input->session->numZeroCopyReads);
    }
-
-   return replyData;
+   return status;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerValidateRead --
- *
- *    Validate a Read request's arguments.
+ * HgfsServerWriteFromDataPacket --
  *
- *    Note, the readOffset is ignored here but is checked in the platform specific
- *    read handler.
+ *    Write file data straight from the mapped guest pages of the data packet,
+ *    avoiding the intermediate copy HSPU_GetDataPacketBuf makes when the data
+ *    packet spans more than one page.
  *
  * Results:
  *    HGFS_ERROR_SUCCESS on success.
+ *    HGFS_ERROR_NOT_SUPPORTED if the caller must use the contiguous buffer.
  *    HGFS error code on failure.
  *
  * Side effects:
@@ -6481,78 +8372,34 @@ HgfsAllocInitReply(HgfsPacket *packet,           // IN/OUT: Hgfs Packet
  */
 
 static HgfsInternalStatus
-HgfsServerValidateRead(HgfsInputParam *input,  // IN: Input params
-                       HgfsHandle readHandle,  // IN: read Handle
-                       uint32 readSize,        // IN: size to read
-                       uint64 readOffset,      // IN: offset to read unused
-                       fileDesc *readfd,       // OUT: read file descriptor
-                       size_t *readReplySize,  // OUT: read reply size
-                       size_t *readDataSize)   // OUT: read data size
-{
-   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
-   size_t replyReadHeaderSize;
-   size_t replyReadResultSize = 0;
-   size_t replyReadResultDataSize = 0;
-   size_t replyReadDataSize = 0;
-   fileDesc readFileDesc = 0;
-   Bool useMappedBuffer;
+HgfsServerWriteFromDataPacket(HgfsInputParam *input,      // IN: Input params
+                              fileDesc writeFd,           // IN: file to write
+                              uint64 writeOffset,         // IN: file offset
+                              uint32 writeSize,           // IN: bytes to write
+                              HgfsWriteFlags writeFlags,  // IN: write flags
+                              Bool writeSequential,       // IN: write is sequential
+                              Bool writeAppend,           // IN: write is appended
+                              uint32 *writtenSize)        // OUT: bytes written
+{
+   HgfsServerChannelCallbacks *chanCb = input->transportSession->channelCbTable;
+   HgfsVmxIov *iov;
+   uint32 iovCount;
+   HgfsInternalStatus status;
 
-   useMappedBuffer = (input->transportSession->channelCbTable->getWriteVa != NULL);
-   replyReadHeaderSize = HgfsServerGetReplyHeaderSize(input->sessionEnabled,
-                                                      input->op);
-   switch (input->op) {
-   case HGFS_OP_READ_FAST_V4:
-      /* Data is packed into a separate buffer from the read results. */
-      replyReadResultSize = sizeof (HgfsReplyReadV3);
-      replyReadResultDataSize = 0;
-      replyReadDataSize = readSize;
-      break;
-   case HGFS_OP_READ_V3:
-      /* Data is packed as a part of the read results. */
-      replyReadResultSize = sizeof (HgfsReplyReadV3);
-      replyReadResultDataSize = readSize;
-      replyReadDataSize = 0;
-      break;
-   case HGFS_OP_READ:
-      /* Data is packed as a part of the read results. */
-      replyReadResultSize = sizeof (HgfsReplyRead);
-      replyReadResultDataSize = readSize;
-      replyReadDataSize = 0;
-      break;
-   default:
-      status = HGFS_ERROR_PROTOCOL;
-      LOG(4, "%s: Unsupported protocol version passed %d -> PROTOCOL_ERROR.\n",
-          __FUNCTION__, input->op);
-      NOT_IMPLEMENTED();
-      goto exit;
+   iov = HSPU_MapDataPacketIov(input->packet, BUF_READABLE, writeSize,
+                               chanCb, &iovCount);
+   if (NULL == iov) {
+      return HGFS_ERROR_NOT_SUPPORTED;
    }
 
-   if (!HSPU_ValidateDataPacketSize(input->packet, replyReadDataSize) ||
-       !HSPU_ValidateReplyPacketSize(input->packet,
-                                     replyReadHeaderSize,
-                                     replyReadResultSize,
-                                     replyReadResultDataSize,
-                                     useMappedBuffer)) {
-      status = HGFS_ERROR_INVALID_PARAMETER;
-      LOG(4, "%s: Error: arg validation read size -> %d.\n",
-          __FUNCTION__, status);
-      goto exit;
-   }
+   status = HgfsPlatformWriteFileIov(writeFd, input->session, writeOffset,
+                                     writeSize, writeFlags, writeSequential,
+                                     writeAppend, iov, iovCount, writtenSize);
+   HSPU_UnmapDataPacketIov(input->packet, chanCb);
 
-   /* Validate the file handle by retrieving it possibly from the cache. */
-   status = HgfsPlatformGetFd(readHandle, input->session, FALSE, &readFileDesc);
-   if (status != HGFS_ERROR_SUCCESS) {
-      LOG(4, "%s: Error: arg validation handle -> %d.\n",
-          __FUNCTION__, status);
-      goto exit;
+   if (HGFS_ERROR_SUCCESS == status) {
+      Atomic_Inc64(&input->session->numZeroCopyWrites);
    }
-
-exit:
-   *readDataSize = replyReadDataSize;
-   *readReplySize = replyReadResultSize + replyReadResultDataSize;
-   *readfd = readFileDesc;
-   LOG(4, "%s: arg validation check return (%"FMTSZ"u) %d.\n",
-       __FUNCTION__, replyReadDataSize, status);
    return status;
 }
 
@@ -6585,6 +8432,7 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
    size_t replyPayloadSize = 0;
    size_t replyReadSize = 0;
    size_t replyReadDataSize = 0;
+   uint32 readSize = 0;
    void *replyRead;
 
    HGFS_ASSERT_INPUT(input);
@@ -6632,6 +8480,21 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
           * same buffer as the reply arguments.
           */
          if (readUseDataBuffer) {
+            uint32 actualSize = 0;
+
+            status = HgfsServerReadToDataPacket(input, readFd, offset,
+                                                requiredSize, &actualSize);
+            if (HGFS_ERROR_SUCCESS == status) {
+               reply->reserved = 0;
+               reply->actualSize = actualSize;
+               replyPayloadSize = sizeof *reply;
+               HSPU_SetDataPacketSize(input->packet, reply->actualSize);
+               readSize = actualSize;
+               break;
+            } else if (HGFS_ERROR_NOT_SUPPORTED != status) {
+               break;
+            }
+
             payload = HSPU_GetDataPacketBuf(input->packet, BUF_WRITEABLE,
                                             input->transportSession->channelCbTable);
          } else {
@@ -6646,6 +8509,7 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
                reply->reserved = 0;
                reply->actualSize = actualSize;
                replyPayloadSize = sizeof *reply;
+               readSize = actualSize;
 
                if (readUseDataBuffer) {
                   HSPU_SetDataPacketSize(input->packet, reply->actualSize);
@@ -6669,6 +8533,7 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
          if (HGFS_ERROR_SUCCESS == status) {
             reply->actualSize = actualSize;
             replyPayloadSize = sizeof *reply + reply->actualSize;
+            readSize = actualSize;
          } else {
             LOG(4, "%s: V1 Failed to read-> %d.\n", __FUNCTION__, status);
          }
@@ -6679,6 +8544,10 @@ HgfsServerRead(HgfsInputParam *input)  // IN: Input params
       break;
    }
 
+   if (HGFS_ERROR_SUCCESS == status) {
+      HgfsServerStreamIo(input->session, file, readFd, offset, readSize, FALSE);
+   }
+
 exit:
    HgfsServerCompleteRequest(status, replyPayloadSize, input);
 }
@@ -6905,6 +8774,16 @@ HgfsServerWrite(HgfsInputParam *input)  // IN: Input params
       if (NULL == writeData) {
          /* No inline data to write, get it from the transport shared memory. */
          HSPU_SetDataPacketSize(input->packet, writeSize);
+         status = HgfsServerWriteFromDataPacket(input, writeFd, writeOffset,
+                                                writeSize, writeFlags,
+                                                writeSequential, writeAppend,
+                                                &writtenSize);
+         if (HGFS_ERROR_SUCCESS == status) {
+            goto pack;
+         } else if (HGFS_ERROR_NOT_SUPPORTED != status) {
+            goto exit;
+         }
+
          writeData = HSPU_GetDataPacketBuf(input->packet, BUF_READABLE,
                                            input->transportSession->channelCbTable);
          if (NULL == writeData) {
@@ -6929,6 +8808,10 @@ HgfsServerWrite(HgfsInputParam *input)  // IN: Input params
       }
    }
 
+pack:
+   HgfsServerStreamIo(input->session, writeFile, writeFd, writeOffset,
+                      writtenSize, TRUE);
+
    if (!HgfsPackWriteReply(input->packet, input->request, input->op,
                            writtenSize, &writeReplySize, input->session)) {
       status = HGFS_ERROR_INTERNAL;
@@ -7876,10 +9759,75 @@ HgfsServerDeleteDir(HgfsInputParam *input)  // IN: Input params
 static void
 HgfsServerServerLockChange(HgfsInputParam *input)  // IN: Input params
 {
+   HgfsHandle file;
+   HgfsLockType serverLock;
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
+   size_t replyPayloadSize = 0;
+
+   HGFS_ASSERT_INPUT(input);
+
+   if (0 == (input->session->flags & HGFS_SESSION_OPLOCK_ENABLED)) {
+      status = HGFS_ERROR_NOT_SUPPORTED;
+   } else if (HgfsUnpackServerLockChangeRequest(input->payload,
+                                                input->payloadSize,
+                                                input->op, &file,
+                                                &serverLock)) {
+      LOG(4, "%s: lock change fh %u to %d\n", __FUNCTION__, file, serverLock);
+
+      if (!HgfsServerOplockChange(file, input->session, &serverLock)) {
+         status = HGFS_ERROR_INVALID_HANDLE;
+      } else if (!HgfsPackServerLockChangeReply(input->packet, input->request,
+                                                input->op, serverLock,
+                                                &replyPayloadSize,
+                                                input->session)) {
+         status = HGFS_ERROR_INTERNAL;
+      }
+   } else {
+      status = HGFS_ERROR_PROTOCOL;
+   }
+
+   HgfsServerCompleteRequest(status, replyPayloadSize, input);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockBreakAck --
+ *
+ *    Handle the client reply to an oplock break sent by
+ *    HgfsServerOplockSendBreak. The reply itself is answered with an empty
+ *    reply, which the synchronous transports need to complete the send.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The oplock on the file is downgraded or broken.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerOplockBreakAck(HgfsInputParam *input)  // IN: Input params
+{
+   HgfsHandle file;
+   HgfsLockType serverLock;
+   HgfsInternalStatus status = HGFS_ERROR_SUCCESS;
 
    HGFS_ASSERT_INPUT(input);
 
-   HgfsServerCompleteRequest(HGFS_ERROR_NOT_SUPPORTED, 0, input);
+   if (0 == (input->session->flags & HGFS_SESSION_OPLOCK_ENABLED)) {
+      status = HGFS_ERROR_NOT_SUPPORTED;
+   } else if (!HgfsUnpackOplockBreakAckReply(input->payload,
+                                             input->payloadSize,
+                                             input->op, &file, &serverLock)) {
+      status = HGFS_ERROR_PROTOCOL;
+   } else if (!HgfsServerOplockBreakReply(input->session, file, serverLock)) {
+      status = HGFS_ERROR_INVALID_HANDLE;
+   }
+
+   HgfsServerCompleteRequest(status, 0, input);
 }
 
 
@@ -9425,6 +11373,98 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockSendBreak --
+ *
+ *    Called by the oplock component when the host file system needs the
+ *    oplock of a file to be broken or downgraded. Builds the oplock break
+ *    request and queues it to be sent to the client, which acknowledges it
+ *    with a reply handled by HgfsServerOplockBreakAck.
+ *
+ * Results:
+ *    TRUE if the request was sent, FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServerOplockSendBreak(HgfsSessionInfo *session,   // IN: session info
+                          HgfsHandle fileId,          // IN: oplocked file
+                          HgfsLockType serverLock)    // IN: lock to downgrade to
+{
+   HgfsPacket *packet;
+   HgfsHeader *packetHeader;
+   size_t sizeNeeded;
+
+   if (session->state == HGFS_SESSION_STATE_CLOSED) {
+      LOG(4, "%s: session has been closed drop the break %"FMT64"x\n",
+          __FUNCTION__, session->sessionId);
+      return FALSE;
+   }
+
+   sizeNeeded = HgfsPackGetOplockBreakSize();
+
+   /*
+    * As for notifications, the packet and metapacket share a single buffer
+    * released in HgfsServerSessionSendComplete.
+    */
+   packet = Util_SafeCalloc(1, sizeof *packet + sizeNeeded);
+   packetHeader = (HgfsHeader *)((char *)packet + sizeof *packet);
+   packet->metaPacketSize = sizeNeeded;
+   packet->metaPacketDataSize = packet->metaPacketSize;
+   packet->metaPacket = packetHeader;
+
+   if (!HgfsPackOplockBreakRequest(packetHeader, fileId, serverLock,
+                                   session->sessionId, &sizeNeeded)) {
+      LOG(4, "%s: failed to pack oplock break request\n", __FUNCTION__);
+      free(packet);
+      return FALSE;
+   }
+
+   if (!HgfsPacketSend(packet,
+                       session->transportSession,
+                       session,
+                       0)) {
+      LOG(4, "%s: failed to send oplock break to the client\n", __FUNCTION__);
+      free(packet);
+      return FALSE;
+   }
+
+   LOG(4, "%s: Sent oplock break for handle %u lock %d\n", __FUNCTION__,
+       fileId, serverLock);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerNotifyDirChangedCb --
+ *
+ *    The callback is invoked by the file system change notification component
+ *    when entries of a watched directory are created, deleted or renamed.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Cached lookups of the directory are dropped.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerNotifyDirChangedCb(const char *dirPath) // IN: changed directory
+{
+   HgfsPlatformInvalidateNameCache(dirPath);
+}
+
+
 /*
  * more testing
  */
@@ -190,6 +190,9 @@ typedef struct HgfsFileNode {
    /* HGFS handle uniquely identifying this node. */
    HgfsHandle handle;
 
+   /* Index of the next node in the same handle hash bucket. */
+   uint32 hashNext;
+
    /* Local filename (in UTF8) */
    char *utf8Name;
 
@@ -233,6 +236,15 @@ typedef struct HgfsFileNode {
 
    /* Parameters associated with the share. */
    HgfsShareInfo shareInfo;
+
+   /* Sequential access tracking for read-ahead and write-behind. */
+   uint64 streamNext;      /* Offset following the last read or write. */
+   uint64 streamAhead;     /* End of the range already read ahead. */
+   uint64 streamDirty;     /* Start of written data not yet pushed out. */
+   uint32 streamWindow;    /* Read-ahead window, 0 if not streaming. */
+   uint64 streamAlloc;     /* End of the range preallocated for writes. */
+   uint64 streamBytes;     /* Bytes read and written since the first I/O. */
+   VmTimeType streamStart; /* Time of the first read or write (us). */
 } HgfsFileNode;
 
 
@@ -312,14 +324,38 @@ typedef struct HgfsAsyncRequestInfo {
    /* Asynchronous request handling. */
    Atomic_uint32   requestCount;
    MXUserExclLock *lock;
-   MXUserCondVar  *requestCountIsZero;
+   MXUserCondVar  *requestCountIsZero;   /* Also signalled on a free credit. */
 } HgfsAsyncRequestInfo;
 
+/*
+ * Number of asynchronous requests a session may have outstanding. Requests
+ * arriving past this credit are still queued behind the earlier requests
+ * on their handle, but the receiving thread then holds the channel back
+ * until a credit is free again.
+ *
+ * Only a channel that takes the next request before the reply to the last
+ * one, i.e. a shared memory channel of a hypervisor side server, has more
+ * than one request outstanding. The guest backdoor channel waits for each
+ * reply, so in the tools its sessions never use more than one credit and
+ * their requests do not overtake each other.
+ */
+#define HGFS_SESSION_MAX_ASYNC_REQUESTS 64
+
+/* Largest range copied by a single copy file range request. */
+#define HGFS_COPY_RANGE_MAX (64 * 1024 * 1024)
+
 typedef struct HgfsSessionInfo {
 
    DblLnkLst_Links links;
 
-   Bool isInactive;
+   /*
+    * Number of the first inactive-session sweep after the last request on
+    * the session. Sessions are ordered on it in the list of the transport.
+    */
+   uint32 activeSweep;
+
+   /* The open files and searches were closed since the last request. */
+   Bool objectsInvalidated;
 
    /* The sessions state and capabilities. */
    HgfsSessionFlags flags;
@@ -339,17 +375,16 @@ typedef struct HgfsSessionInfo {
    /* Lock to ensure some fileIO requests are atomic for a handle. */
    MXUserExclLock *fileIOLock;
 
-   int numInvalidationAttempts;
-
    Atomic_uint32 refCount;    /* Reference count for session. */
 
    /*
     ** START NODE ARRAY **************************************************
     *
-    * Lock for the following 6 fields: the node array,
-    * counters and lists for this session.
+    * Lock for the following 8 fields: the node array, its handle
+    * index, counters and lists for this session. Lookups that do not
+    * modify any node or list only need to acquire it for read.
     */
-   MXUserExclLock *nodeArrayLock;
+   MXUserRWLock *nodeArrayLock;
 
    /* Open file nodes of this session. */
    HgfsFileNode *nodeArray;
@@ -357,6 +392,15 @@ typedef struct HgfsSessionInfo {
    /* Number of nodes in the nodeArray. */
    uint32 numNodes;
 
+   /*
+    * Handle index: buckets of nodeArray indices chained through
+    * HgfsFileNode.hashNext. The bucket count is a power of two.
+    */
+   uint32 *nodeHashBuckets;
+
+   /* Number of buckets minus one. */
+   uint32 nodeHashMask;
+
    /* Free list of file nodes. LIFO to be cache-friendly. */
    DblLnkLst_Links nodeFreeList;
 
@@ -368,6 +412,9 @@ typedef struct HgfsSessionInfo {
 
    /* Number of open nodes having server locks. */
    unsigned int numCachedLockedNodes;
+
+   /* Nodes with an active read-ahead window, protected by nodeArrayLock. */
+   unsigned int numStreamingNodes;
    /** END NODE ARRAY ****************************************************/
 
    /*
@@ -395,6 +442,10 @@ typedef struct HgfsSessionInfo {
 
    /* Asynchronous request handling. */
    HgfsAsyncRequestInfo  asyncRequestsInfo;
+
+   /* Reads and writes done directly on the transport buffers. */
+   Atomic_uint64 numZeroCopyReads;
+   Atomic_uint64 numZeroCopyWrites;
 } HgfsSessionInfo;
 
 /*
@@ -413,6 +464,12 @@ typedef struct HgfsSessionInfo {
  */
 #define MAX_SESSION_INVALIDATION_ATTEMPTS 4
 
+/*
+ * Maximum number of inactive sessions whose objects are invalidated by one
+ * run of the invalidator. The rest are handled by the following runs.
+ */
+#define HGFS_SESSION_INVALIDATE_BATCH 16
+
 /*
  * These structs represent information about file open requests, file
  * attributes, and directory creation requests.
@@ -639,6 +696,17 @@ HgfsIsCached(HgfsHandle handle,         // IN: Hgfs handle of the node
 Bool
 HgfsIsServerLockAllowed(HgfsSessionInfo *session);  // IN: session info
 
+Bool
+HgfsServerOplockSendBreak(HgfsSessionInfo *session,   // IN: session info
+                          HgfsHandle fileId,          // IN: oplocked file
+                          HgfsLockType serverLock);   // IN: lock to downgrade to
+
+void
+HgfsServerSessionGet(HgfsSessionInfo *session);     // IN: session context
+
+void
+HgfsServerSessionPut(HgfsSessionInfo *session);     // IN: session context
+
 Bool
 HgfsHandle2FileDesc(HgfsHandle handle,        // IN: Hgfs file handle
                     HgfsSessionInfo *session, // IN: session info
@@ -746,6 +814,21 @@ HgfsPlatformFilenameLookup(const char *sharePath,             // IN: share path
                            uint32 caseFlags,                  // IN: case-sensitivity flags
                            char **convertedFileName,          // OUT: case-converted filename
                            size_t *convertedFileNameLength);  // OUT
+void
+HgfsPlatformInvalidateNameCache(const char *dirPath);         // IN: changed directory
+void
+HgfsPlatformReadAhead(fileDesc file,                          // IN: file descriptor
+                      uint64 offset,                          // IN: start of range
+                      uint64 length);                         // IN: range length
+void
+HgfsPlatformWriteBehind(fileDesc file,                        // IN: file descriptor
+                        uint64 offset,                        // IN: start of range
+                        uint64 length);                       // IN: range length
+void
+HgfsPlatformPreallocate(fileDesc file,                        // IN: file descriptor
+                        uint64 size);                         // IN: size to allocate
+void
+HgfsPlatformTrimPreallocation(fileDesc file);                 // IN: file descriptor
 HgfsInternalStatus
 HgfsPlatformConvertFromNameStatus(HgfsNameStatus status);  // IN: name status
 HgfsNameStatus
@@ -827,6 +910,32 @@ HgfsPlatformWriteFile(fileDesc writeFile,          // IN: file descriptor
                       const void *writeData,       // IN: data to be written
                       uint32 *writtenSize);        // OUT: byte length written
 HgfsInternalStatus
+HgfsPlatformCopyFileRange(fileDesc srcFile,            // IN: file to copy from
+                          uint64 srcOffset,            // IN: offset to copy from
+                          fileDesc dstFile,            // IN: file to copy to
+                          uint64 dstOffset,            // IN: offset to copy to
+                          uint64 length,               // IN: bytes to copy
+                          uint64 *copied);             // OUT: bytes copied
+HgfsInternalStatus
+HgfsPlatformReadFileIov(fileDesc readFile,           // IN: file descriptor
+                        HgfsSessionInfo *session,    // IN: session info
+                        uint64 offset,               // IN: file offset to read from
+                        uint32 requiredSize,         // IN: length of data to read
+                        HgfsVmxIov *iov,             // IN: mapped buffers to read into
+                        uint32 iovCount,             // IN: number of buffers
+                        uint32 *actualSize);         // OUT: actual length read
+HgfsInternalStatus
+HgfsPlatformWriteFileIov(fileDesc writeFile,          // IN: file descriptor
+                         HgfsSessionInfo *session,    // IN: session info
+                         uint64 writeOffset,          // IN: file offset to write to
+                         uint32 writeDataSize,        // IN: length of data to write
+                         HgfsWriteFlags writeFlags,   // IN: write flags
+                         Bool writeSequential,        // IN: write is sequential
+                         Bool writeAppend,            // IN: write is appended
+                         HgfsVmxIov *iov,             // IN: mapped buffers to write
+                         uint32 iovCount,             // IN: number of buffers
+                         uint32 *writtenSize);        // OUT: byte length written
+HgfsInternalStatus
 HgfsPlatformWriteWin32Stream(HgfsHandle file,           // IN: packet header
                              char *dataToWrite,         // IN: data to write
                              size_t requiredSize,       // IN: data size
@@ -916,6 +1025,17 @@ HSPU_GetDataPacketBuf(HgfsPacket *packet,                   // IN/OUT: Hgfs Pack
                       MappingType mappingType,              // IN: Readable/ Writeable ?
                       HgfsServerChannelCallbacks *chanCb);  // IN: Channel callbacks
 
+HgfsVmxIov *
+HSPU_MapDataPacketIov(HgfsPacket *packet,                   // IN/OUT: Hgfs Packet
+                      MappingType mappingType,              // IN: Readable/ Writeable ?
+                      size_t mapSize,                       // IN: size to map
+                      HgfsServerChannelCallbacks *chanCb,   // IN: Channel callbacks
+                      uint32 *iovCount);                    // OUT: mapped iov count
+
+void
+HSPU_UnmapDataPacketIov(HgfsPacket *packet,                   // IN/OUT: Hgfs Packet
+                        HgfsServerChannelCallbacks *chanCb);  // IN: Channel callbacks
+
 void
 HSPU_SetDataPacketSize(HgfsPacket *packet,            // IN/OUT: Hgfs Packet
                        size_t dataSize);              // IN: data size
@@ -941,6 +1061,10 @@ HSPU_ValidateReplyPacketSize(HgfsPacket *packet,         // IN: Hgfs Packet
                              size_t replyResultDataSize, // IN: reply result data size
                              Bool useMappedMetaPacket);    // IN: using meta buffer
 
+size_t
+HSPU_GetReplyPacketCapacity(HgfsPacket *packet,                  // IN: Hgfs Packet
+                            HgfsServerChannelCallbacks *chanCb); // IN: Channel callbacks
+
 void *
 HSPU_GetReplyPacket(HgfsPacket *packet,                  // IN/OUT: Hgfs Packet
                     HgfsServerChannelCallbacks *chanCb,  // IN: Channel callbacks
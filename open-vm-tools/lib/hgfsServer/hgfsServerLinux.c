@@ -44,6 +44,8 @@
 #include <sys/types.h>
 #include <dirent.h>
 #include <sys/resource.h> // for getrlimit
+#include <sys/uio.h>      // for preadv/pwritev
+#include <limits.h>       // for IOV_MAX
 
 #if defined(__FreeBSD__)
 #   include <sys/param.h>
@@ -63,11 +65,16 @@
 #include "hgfsUtil.h"  // for cross-platform time conversion
 #include "posix.h"
 #include "file.h"
+#include "fileIO.h"
 #include "util.h"
 #include "su.h"
 #include "codeset.h"
 #include "unicodeOperations.h"
+#include "unicodeTransforms.h"
 #include "userlock.h"
+#include "hashTable.h"
+#include "dbllnklst.h"
+#include "mutexRankLib.h"
 
 #if defined(__linux__) && !defined(SYS_getdents64)
 /* For DT_UNKNOWN */
@@ -113,6 +120,45 @@ typedef struct DirectoryEntry {
 #   define ALLPERMS (S_ISUID|S_ISGID|S_ISVTX|S_IRWXU|S_IRWXG|S_IRWXO)
 #endif
 
+/*
+ * Size of the buffer handed to getdents(2) by HgfsPlatformScandir, and the
+ * initial size of the dents array it builds.
+ */
+#define HGFS_SCANDIR_BUFFER_SIZE (64 * 1024)
+#define HGFS_SCANDIR_MIN_DENTS   64
+
+/*
+ * Case-insensitive name lookup cache.
+ *
+ * HgfsConvertComponentCase caches the case-folded listing of each directory
+ * it scans, so that repeated lookups in the same directory, including those
+ * for names that do not exist, are answered without reading the directory
+ * again. A listing is revalidated against the directory's identity and
+ * modification time on every use. Listings of directories modified very
+ * recently are not cached, as a further change within the same timestamp
+ * tick would go unnoticed.
+ */
+#define HGFS_NAME_CACHE_MAX_DIRS        256
+#define HGFS_NAME_CACHE_MAX_DIR_ENTRIES 4096
+#define HGFS_NAME_CACHE_RACY_SECS       2
+
+typedef struct HgfsNameCacheDir {
+   DblLnkLst_Links links;      // LRU list linkage
+   char *dirPath;              // Key in the directory table
+   dev_t dev;
+   ino_t ino;
+   time_t mtimeSec;
+   long mtimeNsec;
+   HashTable *names;           // Folded name -> real name
+} HgfsNameCacheDir;
+
+static struct {
+   MXUserExclLock *lock;
+   HashTable *dirs;            // Directory path -> HgfsNameCacheDir
+   DblLnkLst_Links lru;        // Most recently used first
+   uint32 numDirs;
+} hgfsNameCache;
+
 
 /*
  * On Linux, we must wrap getdents64, as glibc does not wrap it for us. We use getdents64
@@ -339,6 +385,8 @@ static void HgfsGetSequentialOnlyFlagFromName(const char *fileName,
 static void HgfsGetSequentialOnlyFlagFromFd(int fd,
                                             HgfsFileAttrInfo *attr);
 
+static void HgfsNameCacheEvict(HgfsNameCacheDir *dir);
+
 static int HgfsConvertComponentCase(char *currentComponent,
                                     const char *dirPath,
                                     const char **convertedComponent,
@@ -559,6 +607,14 @@ HgfsServerGetOpenFlags(HgfsOpenFlags flagsIn, // IN
 Bool
 HgfsPlatformInit(void)
 {
+   hgfsNameCache.lock = MXUser_CreateExclLock("hgfsNameCacheLock",
+                                              RANK_hgfsNameCacheLock);
+   MXUser_SetAdaptiveSpinExclLock(hgfsNameCache.lock,
+                                  MXUSER_ADAPTIVE_SPIN_DEFAULT);
+   hgfsNameCache.dirs = HashTable_Alloc(HGFS_NAME_CACHE_MAX_DIRS,
+                                        HASH_STRING_KEY, NULL);
+   DblLnkLst_Init(&hgfsNameCache.lru);
+   hgfsNameCache.numDirs = 0;
    return TRUE;
 }
 
@@ -582,6 +638,16 @@ HgfsPlatformInit(void)
 void
 HgfsPlatformDestroy(void)
 {
+   while (hgfsNameCache.numDirs > 0) {
+      HgfsNameCacheDir *dir = DblLnkLst_Container(hgfsNameCache.lru.prev,
+                                                  HgfsNameCacheDir, links);
+
+      HgfsNameCacheEvict(dir);
+   }
+   HashTable_Free(hgfsNameCache.dirs);
+   hgfsNameCache.dirs = NULL;
+   MXUser_DestroyExclLock(hgfsNameCache.lock);
+   hgfsNameCache.lock = NULL;
 }
 
 
@@ -1401,6 +1467,207 @@ HgfsGetHiddenAttr(char const *fileName,         // IN:  Input filename
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNameCacheGetStamp --
+ *
+ *    Fill in the directory identity and modification time of a cached
+ *    directory listing from the directory's stat data.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNameCacheGetStamp(const struct stat *dirStat,  // IN: directory stat data
+                      HgfsNameCacheDir *stamp)     // OUT: stamp fields
+{
+   stamp->dev = dirStat->st_dev;
+   stamp->ino = dirStat->st_ino;
+   stamp->mtimeSec = dirStat->st_mtime;
+#if defined(__linux__) && \
+    !((__GLIBC__ == 2) && (__GLIBC_MINOR__ < 3) && !defined(__UCLIBC__))
+   stamp->mtimeNsec = dirStat->st_mtim.tv_nsec;
+#elif defined(__APPLE__) || defined(__FreeBSD__)
+   stamp->mtimeNsec = dirStat->st_mtimespec.tv_nsec;
+#else
+   stamp->mtimeNsec = 0;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNameCacheEvict --
+ *
+ *    Remove a directory listing from the name cache and free it.
+ *    The name cache lock must be held, or the cache must be no longer shared.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNameCacheEvict(HgfsNameCacheDir *dir)  // IN: listing to remove
+{
+   HashTable_Delete(hgfsNameCache.dirs, dir->dirPath);
+   DblLnkLst_Unlink1(&dir->links);
+   hgfsNameCache.numDirs--;
+   HashTable_Free(dir->names);
+   free(dir->dirPath);
+   free(dir);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNameCacheLookup --
+ *
+ *    Look up a case-folded name in the cached listing of a directory.
+ *
+ * Results:
+ *    TRUE if the cache holds a valid listing for the directory. realName is
+ *    then set to an allocated copy of the matching entry's name, or NULL if
+ *    the directory has no such entry.
+ *    FALSE if the directory must be read.
+ *
+ * Side effects:
+ *    Stale listings are dropped from the cache.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsNameCacheLookup(const char *dirPath,          // IN: directory path
+                    const struct stat *dirStat,   // IN: directory stat data
+                    const char *foldedName,       // IN: case-folded name
+                    char **realName)              // OUT: matching entry name
+{
+   HgfsNameCacheDir *dir;
+   HgfsNameCacheDir stamp;
+   Bool found = FALSE;
+
+   HgfsNameCacheGetStamp(dirStat, &stamp);
+   *realName = NULL;
+
+   MXUser_AcquireExclLock(hgfsNameCache.lock);
+   if (HashTable_Lookup(hgfsNameCache.dirs, dirPath, (void **)&dir)) {
+      if (dir->dev == stamp.dev && dir->ino == stamp.ino &&
+          dir->mtimeSec == stamp.mtimeSec &&
+          dir->mtimeNsec == stamp.mtimeNsec) {
+         char *name;
+
+         if (HashTable_Lookup(dir->names, foldedName, (void **)&name)) {
+            *realName = Util_SafeStrdup(name);
+         }
+         DblLnkLst_Unlink1(&dir->links);
+         DblLnkLst_LinkFirst(&hgfsNameCache.lru, &dir->links);
+         found = TRUE;
+      } else {
+         HgfsNameCacheEvict(dir);
+      }
+   }
+   MXUser_ReleaseExclLock(hgfsNameCache.lock);
+
+   return found;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsNameCacheInsert --
+ *
+ *    Add the case-folded listing of a directory to the name cache, evicting
+ *    the least recently used listing if the cache is full.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Takes ownership of names.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsNameCacheInsert(const char *dirPath,          // IN: directory path
+                    const struct stat *dirStat,   // IN: directory stat data
+                    HashTable *names)             // IN: folded listing
+{
+   HgfsNameCacheDir *dir;
+   HgfsNameCacheDir *oldDir;
+
+   dir = Util_SafeCalloc(1, sizeof *dir);
+   DblLnkLst_Init(&dir->links);
+   dir->dirPath = Util_SafeStrdup(dirPath);
+   dir->names = names;
+   HgfsNameCacheGetStamp(dirStat, dir);
+
+   MXUser_AcquireExclLock(hgfsNameCache.lock);
+   if (HashTable_Lookup(hgfsNameCache.dirs, dirPath, (void **)&oldDir)) {
+      HgfsNameCacheEvict(oldDir);
+   } else if (hgfsNameCache.numDirs >= HGFS_NAME_CACHE_MAX_DIRS) {
+      HgfsNameCacheEvict(DblLnkLst_Container(hgfsNameCache.lru.prev,
+                                             HgfsNameCacheDir, links));
+   }
+   HashTable_Insert(hgfsNameCache.dirs, dir->dirPath, dir);
+   DblLnkLst_LinkFirst(&hgfsNameCache.lru, &dir->links);
+   hgfsNameCache.numDirs++;
+   MXUser_ReleaseExclLock(hgfsNameCache.lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformInvalidateNameCache --
+ *
+ *    Drop the cached listing of a directory whose entries changed.
+ *
+ *    Cached listings are revalidated against the directory modification time
+ *    anyway, this only lets changes seen by the notification component take
+ *    effect without waiting for that.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformInvalidateNameCache(const char *dirPath)  // IN: changed directory
+{
+   HgfsNameCacheDir *dir;
+
+   if (hgfsNameCache.lock == NULL) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(hgfsNameCache.lock);
+   if (HashTable_Lookup(hgfsNameCache.dirs, dirPath, (void **)&dir)) {
+      HgfsNameCacheEvict(dir);
+   }
+   MXUser_ReleaseExclLock(hgfsNameCache.lock);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1409,6 +1676,9 @@ HgfsGetHiddenAttr(char const *fileName,         // IN:  Input filename
  *    Do a case insensitive search of a directory for the specified entry. If
  *    a matching entry is found, return it in the convertedComponent argument.
  *
+ *    The directory's case-folded listing is cached, so later lookups in an
+ *    unchanged directory need neither open nor read it.
+ *
  * Results:
  *    On Success:
  *    Returns 0 and the converted component name in the argument convertedComponent.
@@ -1432,11 +1702,14 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
                          size_t *convertedComponentSize)   // OUT
 {
    struct dirent *dirent;
+   struct stat dirStat;
    DIR *dir = NULL;
    char *dentryName;
    size_t dentryNameLen;
+   char *foldedComponent = NULL;
    char *myConvertedComponent = NULL;
-   size_t myConvertedComponentSize;
+   HashTable *names = NULL;
+   uint32 numNames = 0;
    int ret;
 
    ASSERT(currentComponent);
@@ -1444,6 +1717,29 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
    ASSERT(convertedComponent);
    ASSERT(convertedComponentSize);
 
+   /*
+    * Unicode_FoldCase crashes with invalid unicode strings,
+    * validate it before passing it to Unicode_* functions.
+    */
+   if (!Unicode_IsBufferValid(currentComponent, -1, STRING_ENCODING_UTF8)) {
+      /* Invalid unicode string, return failure. */
+      ret = EINVAL;
+      goto exit;
+   }
+
+   if (Posix_Stat(dirPath, &dirStat) != 0) {
+      ret = errno;
+      goto exit;
+   }
+
+   foldedComponent = Unicode_FoldCase(currentComponent);
+
+   if (HgfsNameCacheLookup(dirPath, &dirStat, foldedComponent,
+                           &myConvertedComponent)) {
+      ret = myConvertedComponent != NULL ? 0 : ENOENT;
+      goto exit;
+   }
+
    /* Open the specified directory. */
    dir = Posix_OpenDir(dirPath);
    if (!dir) {
@@ -1452,28 +1748,27 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
    }
 
    /*
-    * Unicode_CompareIgnoreCase crashes with invalid unicode strings,
-    * validate it before passing it to Unicode_* functions.
+    * A listing of a directory modified within the timestamp granularity
+    * cannot be validated later, so do not build one.
     */
-   if (!Unicode_IsBufferValid(currentComponent, -1, STRING_ENCODING_UTF8)) {
-      /* Invalid unicode string, return failure. */
-      ret = EINVAL;
-      goto exit;
+   if (time(NULL) - dirStat.st_mtime >= HGFS_NAME_CACHE_RACY_SECS) {
+      names = HashTable_Alloc(64, HASH_STRING_KEY | HASH_FLAG_COPYKEY, free);
    }
 
    /*
-    * Read all of the directory entries. For each one, convert the name
-    * to lower case and then compare it to the lower case component.
+    * Read all of the directory entries. For each one, fold the case of the
+    * name and compare it to the folded component, recording it in the
+    * listing as we go.
     */
    while ((dirent = readdir(dir))) {
       char *dentryNameU;
-      int cmpResult;
+      char *foldedName;
 
       dentryName = dirent->d_name;
       dentryNameLen = strlen(dentryName);
 
       /*
-       * Unicode_CompareIgnoreCase crashes with invalid unicode strings,
+       * Unicode_FoldCase crashes with invalid unicode strings,
        * validate and convert it appropriately before passing it to Unicode_*
        * functions.
        */
@@ -1485,41 +1780,65 @@ HgfsConvertComponentCase(char *currentComponent,           // IN
       }
 
       dentryNameU = Unicode_Alloc(dentryName, STRING_ENCODING_DEFAULT);
-
-      cmpResult = Unicode_CompareIgnoreCase(currentComponent, dentryNameU);
+      foldedName = Unicode_FoldCase(dentryNameU);
       free(dentryNameU);
 
-      if (cmpResult == 0) {
+      if (myConvertedComponent == NULL &&
+          strcmp(foldedName, foldedComponent) == 0) {
          /*
           * The current directory entry is a case insensitive match to
-          * the specified component. Malloc and copy the current directory entry.
+          * the specified component. Copy the current directory entry.
           */
-         myConvertedComponentSize = dentryNameLen + 1;
-         myConvertedComponent = malloc(myConvertedComponentSize);
-         if (myConvertedComponent == NULL) {
-            ret = errno;
-            LOG(4, "%s: failed to malloc myConvertedComponent.\n",
-                __FUNCTION__);
-            goto exit;
+         myConvertedComponent = Util_SafeStrdup(dentryName);
+      }
+
+      if (names != NULL) {
+         if (numNames >= HGFS_NAME_CACHE_MAX_DIR_ENTRIES) {
+            /* Too large to cache, just finish the search. */
+            HashTable_Free(names);
+            names = NULL;
+         } else {
+            char *realName = Util_SafeStrdup(dentryName);
+
+            /*
+             * If an earlier entry folds to the same name keep it, lookups
+             * match the first one as the uncached search does.
+             */
+            if (HashTable_Insert(names, foldedName, realName)) {
+               numNames++;
+            } else {
+               free(realName);
+            }
          }
-         Str_Strcpy(myConvertedComponent, dentryName, myConvertedComponentSize);
+      }
+      free(foldedName);
 
-         /* Success. Cleanup and exit. */
-         ret = 0;
-         *convertedComponentSize = myConvertedComponentSize;
-         *convertedComponent = myConvertedComponent;
-         goto exit;
+      if (myConvertedComponent != NULL && names == NULL) {
+         break;
       }
    }
 
-   /* We didn't find a match. Failure. */
-   ret = ENOENT;
+   if (names != NULL) {
+      HgfsNameCacheInsert(dirPath, &dirStat, names);
+      names = NULL;
+   }
+
+   /* If we didn't find a match it is a failure. */
+   ret = myConvertedComponent != NULL ? 0 : ENOENT;
 
 exit:
    if (dir) {
       closedir(dir);
    }
-   if (ret) {
+   if (names) {
+      HashTable_Free(names);
+   }
+   free(foldedComponent);
+   if (ret == 0) {
+      *convertedComponentSize = strlen(myConvertedComponent) + 1;
+      *convertedComponent = myConvertedComponent;
+   } else {
+      free(myConvertedComponent);
       *convertedComponent = NULL;
       *convertedComponentSize = 0;
    }
@@ -1657,7 +1976,9 @@ HgfsCaseInsensitiveLookup(const char *sharePath,           // IN
        * the path case-converted uptil now (curDir) and append to it the
        * rest of the unconverted path.
        */
-      error = HgfsConvertComponentCase(currentComponent, curDir,
+      /* The root share has an empty share path. */
+      error = HgfsConvertComponentCase(currentComponent,
+                                       *curDir != '\0' ? curDir : DIRSEPS,
                                        (const char **)&convertedComponent,
                                        &convertedComponentSize);
       /* Restore the path separator if we removed it earlier. */
@@ -2341,7 +2662,17 @@ HgfsPlatformGetattrFromName(char *fileName,                 // IN/OUT:  Input fi
     */
    HgfsGetHiddenAttr(fileName, attr);
 
-   HgfsGetSequentialOnlyFlagFromName(fileName, followSymlinks, attr);
+   /*
+    * Probing for sequential only access costs an open, fstat, pread and close.
+    * Directories and symlinks are never tagged, and regular files that
+    * report a size are seekable, so only probe the remainder (e.g. procfs
+    * files which report a size of zero, FIFOs). This keeps directory
+    * listings from paying for four extra syscalls per entry.
+    */
+   if (!S_ISDIR(stats.st_mode) && !S_ISLNK(stats.st_mode) &&
+       !(S_ISREG(stats.st_mode) && stats.st_size > 0)) {
+      HgfsGetSequentialOnlyFlagFromName(fileName, followSymlinks, attr);
+   }
 
    /* Get effective permissions if we can */
    if (!(S_ISLNK(stats.st_mode))) {
@@ -3775,13 +4106,14 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
    int result;
    DirectoryEntry **myDents = NULL;
    int myNumDents = 0;
+   int maxDents = 0;
    HgfsInternalStatus status = 0;
 
    /*
-    * XXX: glibc uses 8192 (BUFSIZ) when it can't get st_blksize from a stat.
-    * Should we follow its lead and use stat to get st_blksize?
+    * A large buffer lets each getdents(2) call return a few hundred dents
+    * at once, which matters for directories with many thousands of entries.
     */
-   char buffer[8192];
+   char *buffer = Util_SafeMalloc(HGFS_SCANDIR_BUFFER_SIZE);
 
 #if defined(__APPLE__)
    /*
@@ -3831,23 +4163,33 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
     * Rather than read a single dent at a time, batch up multiple dents
     * in each call by using a buffer substantially larger than one dent.
     */
-   while ((result = getdents(fd, (void *)buffer, sizeof buffer)) > 0) {
+   while ((result = getdents(fd, (void *)buffer, HGFS_SCANDIR_BUFFER_SIZE)) > 0) {
       size_t offset = 0;
       while (offset < result) {
-         DirectoryEntry *newDent, **newDents;
+         DirectoryEntry *newDent;
 
          newDent = (DirectoryEntry *)(buffer + offset);
 
          /* This dent had better fit in the actual space we've got left. */
          ASSERT(newDent->d_reclen <= result - offset);
 
-         /* Add another dent pointer to the dents array. */
-         newDents = realloc(myDents, sizeof *myDents * (myNumDents + 1));
-         if (newDents == NULL) {
-            status = ENOMEM;
-            goto exit;
+         /*
+          * Make room for another dent pointer. Grow the array geometrically
+          * so that scanning a large directory is not quadratic.
+          */
+         if (myNumDents == maxDents) {
+            DirectoryEntry **newDents;
+            int newMaxDents = maxDents == 0 ? HGFS_SCANDIR_MIN_DENTS
+                                            : 2 * maxDents;
+
+            newDents = realloc(myDents, sizeof *myDents * newMaxDents);
+            if (newDents == NULL) {
+               status = ENOMEM;
+               goto exit;
+            }
+            myDents = newDents;
+            maxDents = newMaxDents;
          }
-         myDents = newDents;
 
          /*
           * Allocate the new dent and set it up. We do a straight memcpy of
@@ -3899,6 +4241,7 @@ HgfsPlatformScandir(char const *baseDir,            // IN: Directory to search i
       LOG(4, "%s: error in close: %d (%s)\n", __FUNCTION__, status,
           Err_Errno2String(status));
    }
+   free(buffer);
 
    /*
     * On error, free all allocated dents. On success, set the dents pointer
@@ -4340,16 +4683,17 @@ HgfsPlatformWriteFile(fileDesc writeFd,            // IN: file descriptor
 }
 
 
+#if defined(__linux__)
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsPlatformSearchDir --
+ * HgfsIovToIovec --
  *
- *    Handle platform specific logic needed to perform search open request.
+ *    Convert mapped HGFS iovs into a struct iovec array covering exactly
+ *    dataSize bytes.
  *
  * Results:
- *    Zero on success.
- *    Non-zero on failure.
+ *    Number of iovec entries filled, 0 if the iovs do not fit.
  *
  * Side effects:
  *    None
@@ -4357,76 +4701,571 @@ HgfsPlatformWriteFile(fileDesc writeFd,            // IN: file descriptor
  *-----------------------------------------------------------------------------
  */
 
-HgfsInternalStatus
-HgfsPlatformSearchDir(HgfsNameStatus nameStatus,       // IN: name status
-                      const char *dirName,             // IN: relative directory name
-                      size_t dirNameLength,            // IN: length of dirName
-                      uint32 caseFlags,                // IN: case flags
-                      HgfsShareInfo *shareInfo,        // IN: sharfed folder information
-                      char *baseDir,                   // IN: name of the shared directory
-                      uint32 baseDirLen,               // IN: length of the baseDir
-                      HgfsSessionInfo *session,        // IN: session info
-                      HgfsHandle *handle)              // OUT: search handle
+static int
+HgfsIovToIovec(HgfsVmxIov *iov,          // IN: mapped iovs
+               uint32 iovCount,          // IN: number of iovs
+               uint32 dataSize,          // IN: bytes to cover
+               struct iovec *vec,        // OUT: iovec array
+               int maxVec)               // IN: size of vec
 {
-   HgfsInternalStatus status = 0;
-   switch (nameStatus) {
-   case HGFS_NAME_STATUS_COMPLETE:
-   {
-      const char *inEnd;
-      const char *next;
-      int len;
+   uint32 remaining = dataSize;
+   int i;
 
-      ASSERT(baseDir);
-      LOG(4, "%s: searching in \"%s\", %s.\n", __FUNCTION__, baseDir, dirName);
+   for (i = 0; i < iovCount && remaining > 0; i++) {
+      if (i == maxVec) {
+         return 0;
+      }
+      vec[i].iov_base = iov[i].va;
+      vec[i].iov_len = MIN(iov[i].len, remaining);
+      remaining -= vec[i].iov_len;
+   }
 
-      inEnd = dirName + dirNameLength;
+   return remaining == 0 ? i : 0;
+}
+#endif
 
-      /* Get the first component. */
-      len = CPName_GetComponent(dirName, inEnd, &next);
-      if (len >= 0) {
-         if (*inEnd != '\0') {
-            LOG(4, "%s: dir name not nul-terminated!\n", __FUNCTION__);
-            /*
-             * NT4 clients can send the name without a nul-terminator.
-             * The space for the nul is included and tested for in the size
-             * calculations above. Size of structure (includes a single
-             * character of the name) and the full dirname length.
-             */
-            *(char *)inEnd = '\0';
-         }
 
-         LOG(4, "%s: dirName: %s.\n", __FUNCTION__, dirName);
-         status = HgfsServerSearchRealDir(baseDir,
-                                          baseDirLen,
-                                          dirName,
-                                          shareInfo->rootDir,
-                                          session,
-                                          handle);
-      } else {
-         LOG(4, "%s: get first component failed\n", __FUNCTION__);
-         status = ENOENT;
-      }
-      /*
-       * If the directory exists but shared folder is write only
-       * then return access denied, otherwise preserve the original
-       * error code.
-       */
-      if (!shareInfo->readPermissions && HGFS_NAME_STATUS_COMPLETE == status) {
-         status = HGFS_NAME_STATUS_ACCESS_DENIED;
-      }
-      if (status != 0) {
-         LOG(4, "%s: couldn't scandir\n", __FUNCTION__);
-      }
-      break;
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformReadAhead --
+ *
+ *    Start reading a range of a file into the page cache without waiting
+ *    for it, ahead of the client asking for it.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformReadAhead(fileDesc file,   // IN: file descriptor
+                      uint64 offset,   // IN: start of range
+                      uint64 length)   // IN: range length
+{
+#if defined(__linux__) || defined(__FreeBSD__)
+   int error = posix_fadvise(file, offset, length, POSIX_FADV_WILLNEED);
+
+   if (error != 0) {
+      LOG(4, "%s: read-ahead failed: %s\n", __FUNCTION__,
+          Err_Errno2String(error));
    }
+#endif
+}
 
-   case HGFS_NAME_STATUS_INCOMPLETE_BASE:
-      /*
-       * This is the base of our namespace, so enumerate all
-       * shares. [bac]
-       */
 
-      LOG(4, "%s: opened search on base\n", __FUNCTION__);
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformWriteBehind --
+ *
+ *    Start writing out a range of a file's dirty pages without waiting for
+ *    it, so that the guest's sequential writes do not pile up as dirty page
+ *    cache and stall later on writeback.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformWriteBehind(fileDesc file,   // IN: file descriptor
+                        uint64 offset,   // IN: start of range
+                        uint64 length)   // IN: range length
+{
+#if defined(__linux__)
+   if (sync_file_range(file, offset, length, SYNC_FILE_RANGE_WRITE) != 0) {
+      LOG(4, "%s: write-behind failed: %s\n", __FUNCTION__,
+          Err_Errno2String(errno));
+   }
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformPreallocate --
+ *
+ *    Allocate the blocks of a file up to size without changing its length,
+ *    ahead of the sequential writes that will fill them.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformPreallocate(fileDesc file,   // IN: file descriptor
+                        uint64 size)     // IN: size to allocate
+{
+#if defined(__linux__)
+   FileIODescriptor desc;
+
+   FileIO_Invalidate(&desc);
+   desc.posix = file;
+
+   if (!FileIO_SetAllocSize(&desc, size)) {
+      LOG(4, "%s: preallocation failed: %s\n", __FUNCTION__,
+          Err_Errno2String(errno));
+   }
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformTrimPreallocation --
+ *
+ *    Free the blocks HgfsPlatformPreallocate allocated beyond the end of
+ *    the file. The file times are kept, the client may have set them after
+ *    its last write.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsPlatformTrimPreallocation(fileDesc file)   // IN: file descriptor
+{
+#if defined(__linux__)
+   struct stat st;
+   struct timespec times[2];
+
+   if (fstat(file, &st) != 0 ||
+       (uint64)st.st_blocks * 512 <=
+          ROUNDUP((uint64)st.st_size, (uint64)st.st_blksize)) {
+      return;
+   }
+
+   times[0] = st.st_atim;
+   times[1] = st.st_mtim;
+
+   /* Truncating to the current length drops the blocks beyond it. */
+   if (ftruncate(file, st.st_size) != 0 || futimens(file, times) != 0) {
+      LOG(4, "%s: trimming failed: %s\n", __FUNCTION__,
+          Err_Errno2String(errno));
+   }
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsCopyFileRangeBounce --
+ *
+ *    Copy a range between two files through a bounce buffer on the host.
+ *    Used when the file system cannot copy the range itself.
+ *
+ * Results:
+ *    Zero on success.
+ *    Non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsInternalStatus
+HgfsCopyFileRangeBounce(fileDesc srcFd,      // IN: file to copy from
+                        uint64 srcOffset,    // IN: offset to copy from
+                        fileDesc dstFd,      // IN: file to copy to
+                        uint64 dstOffset,    // IN: offset to copy to
+                        uint64 length,       // IN: bytes to copy
+                        uint64 *copied)      // OUT: bytes copied
+{
+   const size_t bufferSize = 1024 * 1024;
+   HgfsInternalStatus status = 0;
+   char *buffer = Util_SafeMalloc(MIN(length, bufferSize));
+
+   *copied = 0;
+   while (*copied < length) {
+      size_t chunk = MIN(length - *copied, bufferSize);
+      ssize_t bytesRead;
+      ssize_t bytesWritten = 0;
+
+      bytesRead = pread(srcFd, buffer, chunk, srcOffset + *copied);
+      if (bytesRead < 0) {
+         status = errno;
+         break;
+      } else if (bytesRead == 0) {
+         break;
+      }
+
+      while (bytesWritten < bytesRead) {
+         ssize_t result = pwrite(dstFd, buffer + bytesWritten,
+                                 bytesRead - bytesWritten,
+                                 dstOffset + *copied + bytesWritten);
+         if (result < 0) {
+            status = errno;
+            break;
+         }
+         bytesWritten += result;
+      }
+      *copied += bytesWritten;
+      if (status != 0) {
+         break;
+      }
+   }
+
+   free(buffer);
+
+   /* A partial copy is reported as success, the client retries the rest. */
+   return *copied != 0 ? 0 : status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformCopyFileRange --
+ *
+ *    Copy a range of bytes from one open file to another on the host. On
+ *    Linux copy_file_range(2) is tried first, which lets file systems that
+ *    support it share the extents (reflink) or copy them without leaving the
+ *    kernel. Otherwise the data is copied through a buffer here, which still
+ *    saves the round trips through the guest.
+ *
+ *    Overlapping ranges of the same file are rejected, as copy_file_range
+ *    does.
+ *
+ * Results:
+ *    Zero on success, copied may be short of length.
+ *    Non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformCopyFileRange(fileDesc srcFd,      // IN: file to copy from
+                          uint64 srcOffset,    // IN: offset to copy from
+                          fileDesc dstFd,      // IN: file to copy to
+                          uint64 dstOffset,    // IN: offset to copy to
+                          uint64 length,       // IN: bytes to copy
+                          uint64 *copied)      // OUT: bytes copied
+{
+   struct stat srcStat;
+   struct stat dstStat;
+   HgfsInternalStatus status;
+
+   *copied = 0;
+
+   if (length == 0) {
+      return 0;
+   }
+
+   if (srcOffset > MAX_INT64 - length || dstOffset > MAX_INT64 - length) {
+      return EINVAL;
+   }
+
+#if !defined(sun)
+   status = HgfsWriteCheckIORange(dstOffset, (uint32)MIN(length, MAX_UINT32));
+   if (status != 0) {
+      return status;
+   }
+#endif
+
+   if (fstat(srcFd, &srcStat) < 0 || fstat(dstFd, &dstStat) < 0) {
+      return errno;
+   }
+
+   if (!S_ISREG(srcStat.st_mode) || !S_ISREG(dstStat.st_mode)) {
+      return EINVAL;
+   }
+
+   if (srcStat.st_dev == dstStat.st_dev && srcStat.st_ino == dstStat.st_ino &&
+       srcOffset < dstOffset + length && dstOffset < srcOffset + length) {
+      LOG(4, "%s: overlapping ranges of the same file\n", __FUNCTION__);
+      return EINVAL;
+   }
+
+#if defined(__linux__) && defined(__NR_copy_file_range)
+   {
+      loff_t srcOff = srcOffset;
+      loff_t dstOff = dstOffset;
+      long result = syscall(__NR_copy_file_range, srcFd, &srcOff, dstFd,
+                            &dstOff, (size_t)length, 0);
+
+      if (result >= 0) {
+         LOG(4, "%s: copied %ld bytes in the kernel\n", __FUNCTION__, result);
+         *copied = result;
+         return 0;
+      }
+
+      status = errno;
+      if (status != ENOSYS && status != EXDEV && status != EINVAL &&
+          status != EOPNOTSUPP) {
+         LOG(4, "%s: copy_file_range failed: %s\n", __FUNCTION__,
+             Err_Errno2String(status));
+         return status;
+      }
+   }
+#endif
+
+   status = HgfsCopyFileRangeBounce(srcFd, srcOffset, dstFd, dstOffset,
+                                    length, copied);
+   LOG(4, "%s: copied %"FMT64"u bytes through a buffer\n", __FUNCTION__,
+       *copied);
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformReadFileIov --
+ *
+ *    Reads data from a file directly into the mapped transport buffers.
+ *
+ * Results:
+ *    Zero on success.
+ *    HGFS_ERROR_NOT_SUPPORTED if the caller needs to use a contiguous buffer.
+ *    Other non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformReadFileIov(fileDesc file,               // IN: file descriptor
+                        HgfsSessionInfo *session,    // IN: session info
+                        uint64 offset,               // IN: file offset to read from
+                        uint32 requiredSize,         // IN: length of data to read
+                        HgfsVmxIov *iov,             // IN: mapped buffers to read into
+                        uint32 iovCount,             // IN: number of buffers
+                        uint32 *actualSize)          // OUT: actual length read
+{
+#if defined(__linux__)
+   struct iovec vec[IOV_MAX];
+   int vecCount;
+   ssize_t result;
+   HgfsHandle handle;
+   Bool sequentialOpen;
+
+   ASSERT(session);
+
+   vecCount = HgfsIovToIovec(iov, iovCount, requiredSize, vec, ARRAYSIZE(vec));
+   if (vecCount == 0) {
+      return HGFS_ERROR_NOT_SUPPORTED;
+   }
+
+   if (!HgfsFileDesc2Handle(file, session, &handle) ||
+       !HgfsHandleIsSequentialOpen(handle, session, &sequentialOpen)) {
+      LOG(4, "%s: Could not get file handle\n", __FUNCTION__);
+      return EBADF;
+   }
+
+   if (sequentialOpen) {
+      result = readv(file, vec, vecCount);
+   } else {
+      result = preadv(file, vec, vecCount, offset);
+   }
+
+   if (result < 0) {
+      HgfsInternalStatus status = errno;
+
+      LOG(4, "%s: error reading from file: %s\n", __FUNCTION__,
+          Err_Errno2String(status));
+      return status;
+   }
+
+   LOG(4, "%s: read %"FMTSZ"d bytes into %d iovs\n", __FUNCTION__,
+       result, vecCount);
+   *actualSize = result;
+
+   return 0;
+#else
+   return HGFS_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformWriteFileIov --
+ *
+ *    Writes data to a file directly from the mapped transport buffers.
+ *
+ * Results:
+ *    Zero on success.
+ *    HGFS_ERROR_NOT_SUPPORTED if the caller needs to use a contiguous buffer.
+ *    Other non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformWriteFileIov(fileDesc writeFd,            // IN: file descriptor
+                         HgfsSessionInfo *session,    // IN: session info
+                         uint64 writeOffset,          // IN: file offset to write to
+                         uint32 writeDataSize,        // IN: length of data to write
+                         HgfsWriteFlags writeFlags,   // IN: write flags
+                         Bool writeSequential,        // IN: write is sequential
+                         Bool writeAppend,            // IN: write is appended
+                         HgfsVmxIov *iov,             // IN: mapped buffers to write
+                         uint32 iovCount,             // IN: number of buffers
+                         uint32 *writtenSize)         // OUT: actual length written
+{
+#if defined(__linux__)
+   struct iovec vec[IOV_MAX];
+   int vecCount;
+   ssize_t result;
+
+   vecCount = HgfsIovToIovec(iov, iovCount, writeDataSize, vec, ARRAYSIZE(vec));
+   if (vecCount == 0) {
+      return HGFS_ERROR_NOT_SUPPORTED;
+   }
+
+   if (!writeSequential) {
+      HgfsInternalStatus status = HgfsWriteCheckIORange(writeOffset,
+                                                        writeDataSize);
+      if (status != 0) {
+         return status;
+      }
+   }
+
+   if (writeSequential) {
+      result = writev(writeFd, vec, vecCount);
+   } else {
+      result = pwritev(writeFd, vec, vecCount, writeOffset);
+   }
+
+   if (result < 0) {
+      HgfsInternalStatus status = errno;
+
+      LOG(4, "%s: error writing to file: %s\n", __FUNCTION__,
+          Err_Errno2String(status));
+      return status;
+   }
+
+   *writtenSize = result;
+   LOG(4, "%s: wrote %u bytes from %d iovs\n", __FUNCTION__, *writtenSize,
+       vecCount);
+
+   return 0;
+#else
+   return HGFS_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPlatformSearchDir --
+ *
+ *    Handle platform specific logic needed to perform search open request.
+ *
+ * Results:
+ *    Zero on success.
+ *    Non-zero on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsPlatformSearchDir(HgfsNameStatus nameStatus,       // IN: name status
+                      const char *dirName,             // IN: relative directory name
+                      size_t dirNameLength,            // IN: length of dirName
+                      uint32 caseFlags,                // IN: case flags
+                      HgfsShareInfo *shareInfo,        // IN: sharfed folder information
+                      char *baseDir,                   // IN: name of the shared directory
+                      uint32 baseDirLen,               // IN: length of the baseDir
+                      HgfsSessionInfo *session,        // IN: session info
+                      HgfsHandle *handle)              // OUT: search handle
+{
+   HgfsInternalStatus status = 0;
+   switch (nameStatus) {
+   case HGFS_NAME_STATUS_COMPLETE:
+   {
+      const char *inEnd;
+      const char *next;
+      int len;
+
+      ASSERT(baseDir);
+      LOG(4, "%s: searching in \"%s\", %s.\n", __FUNCTION__, baseDir, dirName);
+
+      inEnd = dirName + dirNameLength;
+
+      /* Get the first component. */
+      len = CPName_GetComponent(dirName, inEnd, &next);
+      if (len >= 0) {
+         if (*inEnd != '\0') {
+            LOG(4, "%s: dir name not nul-terminated!\n", __FUNCTION__);
+            /*
+             * NT4 clients can send the name without a nul-terminator.
+             * The space for the nul is included and tested for in the size
+             * calculations above. Size of structure (includes a single
+             * character of the name) and the full dirname length.
+             */
+            *(char *)inEnd = '\0';
+         }
+
+         LOG(4, "%s: dirName: %s.\n", __FUNCTION__, dirName);
+         status = HgfsServerSearchRealDir(baseDir,
+                                          baseDirLen,
+                                          dirName,
+                                          shareInfo->rootDir,
+                                          session,
+                                          handle);
+      } else {
+         LOG(4, "%s: get first component failed\n", __FUNCTION__);
+         status = ENOENT;
+      }
+      /*
+       * If the directory exists but shared folder is write only
+       * then return access denied, otherwise preserve the original
+       * error code.
+       */
+      if (!shareInfo->readPermissions && HGFS_NAME_STATUS_COMPLETE == status) {
+         status = HGFS_NAME_STATUS_ACCESS_DENIED;
+      }
+      if (status != 0) {
+         LOG(4, "%s: couldn't scandir\n", __FUNCTION__);
+      }
+      break;
+   }
+
+   case HGFS_NAME_STATUS_INCOMPLETE_BASE:
+      /*
+       * This is the base of our namespace, so enumerate all
+       * shares. [bac]
+       */
+
+      LOG(4, "%s: opened search on base\n", __FUNCTION__);
       status = HgfsServerSearchVirtualDir(HgfsServerResEnumGet,
                                           HgfsServerResEnumInit,
                                           HgfsServerResEnumExit,
@@ -4863,6 +5702,111 @@ HgfsPlatformSymlinkCreate(char *localSymlinkName,   // IN: symbolic link file na
 }
 
 
+#if defined(__linux__) && defined(__NR_openat2) && defined(O_PATH)
+#ifndef RESOLVE_BENEATH
+struct open_how {
+   uint64 flags;
+   uint64 mode;
+   uint64 resolve;
+};
+#define RESOLVE_BENEATH 0x08
+#endif
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsResolveBeneath --
+ *
+ *      Checks that a directory, relative to the share path, resolves
+ *      beneath the share with openat2(2) RESOLVE_BENEATH: the kernel
+ *      resolves the whole path, symlinks included, and fails if it
+ *      escapes, replacing the lstat(2) of every component by realpath(3).
+ *
+ *      Absolute symlinks are refused by RESOLVE_BENEATH even when they
+ *      point into the share, and older kernels lack openat2(2), so those
+ *      cases are left to the realpath(3) check.
+ *
+ * Results:
+ *      TRUE if the check was done, *nameStatus is its result.
+ *      FALSE if the caller must do the realpath(3) check.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsResolveBeneath(const char *sharePath,      // IN
+                   const char *relDirName,     // IN
+                   HgfsNameStatus *nameStatus) // OUT
+{
+   static Bool openat2Missing = FALSE;
+   struct open_how how;
+   char *share;
+   char *dir;
+   int shareFd = -1;
+   int fd = -1;
+   int error = 0;
+
+   if (openat2Missing) {
+      return FALSE;
+   }
+
+   share = Unicode_GetAllocBytes(sharePath, STRING_ENCODING_DEFAULT);
+   dir = Unicode_GetAllocBytes(relDirName, STRING_ENCODING_DEFAULT);
+   if (share == NULL || dir == NULL) {
+      free(share);
+      free(dir);
+      return FALSE;
+   }
+
+   shareFd = open(share, O_PATH | O_DIRECTORY | O_CLOEXEC);
+   if (shareFd < 0) {
+      error = errno;
+   } else {
+      memset(&how, 0, sizeof how);
+      how.flags = O_PATH | O_DIRECTORY | O_CLOEXEC;
+      how.resolve = RESOLVE_BENEATH;
+
+      fd = syscall(__NR_openat2, shareFd, dir, &how, sizeof how);
+      if (fd < 0) {
+         error = errno;
+      }
+   }
+
+   if (fd >= 0) {
+      close(fd);
+   }
+   if (shareFd >= 0) {
+      close(shareFd);
+   }
+   free(share);
+   free(dir);
+
+   switch (error) {
+   case 0:
+      *nameStatus = HGFS_NAME_STATUS_COMPLETE;
+      return TRUE;
+   case ENOENT:
+      *nameStatus = HGFS_NAME_STATUS_DOES_NOT_EXIST;
+      return TRUE;
+   case ENOTDIR:
+      *nameStatus = HGFS_NAME_STATUS_NOT_A_DIRECTORY;
+      return TRUE;
+   case ENOSYS:
+      openat2Missing = TRUE;
+      return FALSE;
+   default:
+      /* EXDEV: escaping, or an absolute symlink; EAGAIN, ELOOP, ... */
+      LOG(4, "%s: openat2 of %s failed: %s\n", __FUNCTION__, relDirName,
+          Err_Errno2String(error));
+      return FALSE;
+   }
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -4885,6 +5829,10 @@ HgfsPlatformSymlinkCreate(char *localSymlinkName,   // IN: symbolic link file na
  *      that doesn't exist. After resolving, we determine if sharePath is a
  *      prefix of fileName.
  *
+ *      On Linux, the parent is first resolved by openat2(2) beneath the
+ *      share (see HgfsResolveBeneath), which costs a constant number of
+ *      system calls instead of one per path component.
+ *
  *      Note that realpath(3) behaves differently on GNU and BSD systems.
  *      Following table lists the difference:
  *
@@ -4959,6 +5907,28 @@ HgfsPlatformPathHasSymlink(const char *fileName,      // IN
       }
    }
 
+#if defined(__linux__) && defined(__NR_openat2) && defined(O_PATH)
+   /*
+    * Resolve the parent relative to the share in a single system call when
+    * it is spelled under the share path.
+    */
+   if (Str_Strncmp(sharePath, fileDirName, sharePathLength) == 0 &&
+       (fileDirName[sharePathLength] == DIRSEPC ||
+        fileDirName[sharePathLength] == '\0')) {
+      const char *relDirName = fileDirName + sharePathLength;
+
+      while (*relDirName == DIRSEPC) {
+         relDirName++;
+      }
+
+      if (HgfsResolveBeneath(sharePath,
+                             *relDirName == '\0' ? "." : relDirName,
+                             &nameStatus)) {
+         goto exit;
+      }
+   }
+#endif
+
    /*
     * Resolve parent directory of fileName.
     * Use realpath(2) to resolve the parent.
@@ -20,6 +20,12 @@
  * hgfsServerOplock.c --
  *
  *      HGFS server opportunistic lock support that is common to all platforms.
+ *
+ *      Every file descriptor holding a lease is registered together with the
+ *      session that owns it, so that a lease break reported by the platform
+ *      for a file descriptor can be routed to the right session and client.
+ *      The registration also tracks the break that was sent to the client
+ *      and is awaiting its acknowledgement.
  */
 
 #if defined(__APPLE__)
@@ -32,9 +38,14 @@
 
 #include "vmware.h"
 #include "str.h"
+#include "util.h"
+#include "hostinfo.h"
+#include "userlock.h"
+#include "mutexRankLib.h"
 #include "cpName.h"
 #include "cpNameLite.h"
 #include "hgfsServerInt.h"
+#include "hgfsServerOplock.h"
 #include "hgfsServerOplockInt.h"
 
 
@@ -43,6 +54,32 @@
  * Local data
  */
 
+#ifdef HGFS_OPLOCKS
+/* A file descriptor that holds a lease. */
+typedef struct HgfsOplockLease {
+   DblLnkLst_Links links;
+   fileDesc fileDesc;
+   HgfsSessionInfo *session;       /* Not referenced, see below. */
+   ServerLockData *pendingBreak;   /* Break sent to the client or NULL. */
+} HgfsOplockLease;
+
+/*
+ * Registered leases. The lock is taken while the session node array lock
+ * is held, so nothing else is acquired under it. The session pointers are
+ * not referenced: a lease is unregistered before its file is closed, which
+ * happens before the session goes away.
+ */
+static MXUserExclLock *gHgfsOplockLock;
+static DblLnkLst_Links gHgfsOplockLeases;
+
+/*
+ * Whether the platform lease monitoring (signal handler and lease break
+ * thread) is running. It is started under the lock by the first session
+ * that negotiates oplocks.
+ */
+static Bool gHgfsOplockStarted;
+#endif
+
 
 /*
  * Global data
@@ -61,8 +98,11 @@
  *
  *      Set up any state needed to start HGFS server.
  *
+ *      The platform lease monitoring is not started here but by
+ *      HgfsServerOplockStart, once a session actually negotiates oplocks.
+ *
  * Results:
- *      None.
+ *      TRUE if oplocks are supported, FALSE otherwise.
  *
  * Side effects:
  *      None.
@@ -75,7 +115,11 @@ HgfsServerOplockInit(void)
 {
    Bool result = FALSE;
 #ifdef HGFS_OPLOCKS
-   result = HgfsPlatformOplockInit();
+   gHgfsOplockLock = MXUser_CreateExclLock("hgfsOplockLock",
+                                           RANK_hgfsOplockLock);
+   DblLnkLst_Init(&gHgfsOplockLeases);
+   gHgfsOplockStarted = FALSE;
+   result = TRUE;
 #endif
    return result;
 }
@@ -84,81 +128,92 @@ HgfsServerOplockInit(void)
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerOplockDestroy --
+ * HgfsServerOplockStart --
  *
- *      Tear down any oplock related state used for HGFS server.
+ *      Start the platform lease monitoring if it is not running yet.
+ *      Called when a session is about to enable oplocks, so that servers
+ *      whose clients never negotiate them do not install the lease break
+ *      signal handler or run the lease break thread.
  *
  * Results:
- *      None.
+ *      TRUE if oplocks can be granted, FALSE otherwise.
  *
  * Side effects:
- *      None.
+ *      May install a signal handler and start a thread.
  *
  *-----------------------------------------------------------------------------
  */
 
-void
-HgfsServerOplockDestroy(void)
+Bool
+HgfsServerOplockStart(void)
 {
+   Bool result = FALSE;
 #ifdef HGFS_OPLOCKS
-   /* Tear down oplock state, so we no longer catch signals. */
-   HgfsPlatformOplockDestroy();
+   if (gHgfsOplockLock == NULL) {
+      return FALSE;
+   }
+
+   MXUser_AcquireExclLock(gHgfsOplockLock);
+   if (!gHgfsOplockStarted) {
+      gHgfsOplockStarted = HgfsPlatformOplockInit();
+   }
+   result = gHgfsOplockStarted;
+   MXUser_ReleaseExclLock(gHgfsOplockLock);
 #endif
+   return result;
 }
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsHandle2ServerLock --
+ * HgfsServerOplockDestroy --
  *
- *    Retrieve the serverlock information for the file node that corresponds to
- *    the specified hgfs handle. If the server is not compiled with oplock
- *    support, we always return TRUE and HGFS_LOCK_NONE.
+ *      Tear down any oplock related state used for HGFS server.
  *
  * Results:
- *    TRUE if the hgfs handle is valid and the lock was retrieved successfully.
- *    FALSE otherwise.
+ *      None.
  *
  * Side effects:
- *    None.
+ *      None.
  *
  *-----------------------------------------------------------------------------
  */
 
-Bool
-HgfsHandle2ServerLock(HgfsHandle handle,        // IN: Hgfs file handle
-                      HgfsSessionInfo *session, // IN: Session info
-                      HgfsLockType *lock)       // OUT: Server lock
+void
+HgfsServerOplockDestroy(void)
 {
 #ifdef HGFS_OPLOCKS
-   Bool found = FALSE;
-   HgfsFileNode *fileNode;
+   DblLnkLst_Links *link, *nextLink;
 
-   ASSERT(lock);
+   if (gHgfsOplockLock == NULL) {
+      return;
+   }
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
-   fileNode = HgfsHandle2FileNode(handle, session);
-   if (fileNode == NULL) {
-      goto exit;
+   /* Tear down oplock state, so we no longer catch signals. */
+   if (gHgfsOplockStarted) {
+      HgfsPlatformOplockDestroy();
+      gHgfsOplockStarted = FALSE;
    }
 
-   *lock = fileNode->serverLock;
-   found = TRUE;
+   /* All sessions are gone by now, and with them their leases. */
+   DblLnkLst_ForEachSafe(link, nextLink, &gHgfsOplockLeases) {
+      HgfsOplockLease *lease = DblLnkLst_Container(link, HgfsOplockLease,
+                                                   links);
 
-exit:
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+      DblLnkLst_Unlink1(&lease->links);
+      if (lease->pendingBreak != NULL) {
+         HgfsServerOplockFreeBreak(lease->pendingBreak);
+      }
+      free(lease);
+   }
 
-   return found;
-#else
-   *lock = HGFS_LOCK_NONE;
-   return TRUE;
+   MXUser_DestroyExclLock(gHgfsOplockLock);
+   gHgfsOplockLock = NULL;
 #endif
 }
 
 
-
-
 /*
  *-----------------------------------------------------------------------------
  *
@@ -192,14 +247,14 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
    ASSERT(session);
    ASSERT(session->nodeArray);
 
-   MXUser_AcquireExclLock(session->nodeArrayLock);
+   MXUser_AcquireForRead(session->nodeArrayLock);
 
    for (i = 0; i < session->numNodes; i++) {
       HgfsFileNode *existingFileNode = &session->nodeArray[i];
 
       if ((existingFileNode->state == FILENODE_STATE_IN_USE_CACHED) &&
           (existingFileNode->serverLock != HGFS_LOCK_NONE) &&
-          (!stricmp(existingFileNode->utf8Name, utf8Name))) {
+          (!Str_Strcasecmp(existingFileNode->utf8Name, utf8Name))) {
          LOG(4, "Found file with a lock: %s\n", utf8Name);
          *serverLock = existingFileNode->serverLock;
          *fileDesc = existingFileNode->fileDesc;
@@ -208,7 +263,7 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
       }
    }
 
-   MXUser_ReleaseExclLock(session->nodeArrayLock);
+   MXUser_ReleaseRWLock(session->nodeArrayLock);
 
    return found;
 #else
@@ -217,19 +272,91 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
 }
 
 
-
 #ifdef HGFS_OPLOCKS
 /*
  *-----------------------------------------------------------------------------
  *
- * HgfsServerOplockBreakReply --
+ * HgfsServerOplockFindLease --
  *
- *      The client was sent an oplock break request, and responded with this
- *      reply. It contains the oplock status that the client is now in. Since
- *      the break could have actually been a degrade, it is well within the
- *      client's rights to transition to a non-broken state. We need to make
- *      sure that such a transition was legal, acknowledge the brea
- *      appropriately, and update our own state.
+ *      Find the registration of a leased file descriptor. If session is NULL
+ *      the lease of any session matches.
+ *
+ *      The oplock lock must be held.
+ *
+ * Results:
+ *      The lease or NULL if the file descriptor holds no lease.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsOplockLease *
+HgfsServerOplockFindLease(fileDesc fileDesc,          // IN: leased file
+                          HgfsSessionInfo *session)   // IN: owner or NULL
+{
+   DblLnkLst_Links *link;
+
+   ASSERT(MXUser_IsCurThreadHoldingExclLock(gHgfsOplockLock));
+
+   DblLnkLst_ForEach(link, &gHgfsOplockLeases) {
+      HgfsOplockLease *lease = DblLnkLst_Container(link, HgfsOplockLease,
+                                                   links);
+
+      if (lease->fileDesc == fileDesc &&
+          (session == NULL || lease->session == session)) {
+         return lease;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockTakeBreak --
+ *
+ *      Detach the break pending on a leased file descriptor, so that exactly
+ *      one of the client acknowledgement, the timeout or a client lock
+ *      change completes it.
+ *
+ * Results:
+ *      The pending break or NULL if there is none.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static ServerLockData *
+HgfsServerOplockTakeBreak(fileDesc fileDesc,          // IN: leased file
+                          HgfsSessionInfo *session)   // IN: owner
+{
+   HgfsOplockLease *lease;
+   ServerLockData *lockData = NULL;
+
+   MXUser_AcquireExclLock(gHgfsOplockLock);
+   lease = HgfsServerOplockFindLease(fileDesc, session);
+   if (lease != NULL) {
+      lockData = lease->pendingBreak;
+      lease->pendingBreak = NULL;
+   }
+   MXUser_ReleaseExclLock(gHgfsOplockLock);
+
+   return lockData;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockAddLease --
+ *
+ *      Register a file descriptor which is about to get a lease.
  *
  * Results:
  *      None.
@@ -241,29 +368,98 @@ HgfsFileHasServerLock(const char *utf8Name,             // IN: Name in UTF8
  */
 
 void
-HgfsServerOplockBreakReply(const unsigned char *packetIn, // IN: Reply packet
-                           unsigned int packetSize,       // IN: Size of packet
-                           void *clientData)              // IN: From request
+HgfsServerOplockAddLease(fileDesc fileDesc,          // IN: leased file
+                         HgfsSessionInfo *session)   // IN: owner
 {
-   HgfsReplyServerLockChange *reply;
-   ServerLockData *lockData = clientData;
+   HgfsOplockLease *lease;
+
+   MXUser_AcquireExclLock(gHgfsOplockLock);
+   if (HgfsServerOplockFindLease(fileDesc, session) == NULL) {
+      lease = Util_SafeCalloc(1, sizeof *lease);
+      DblLnkLst_Init(&lease->links);
+      lease->fileDesc = fileDesc;
+      lease->session = session;
+      DblLnkLst_LinkLast(&gHgfsOplockLeases, &lease->links);
+   }
+   MXUser_ReleaseExclLock(gHgfsOplockLock);
+}
 
-   ASSERT(packetIn);
-   ASSERT(clientData);
 
-   if (packetSize < sizeof *reply) {
-      return;
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockFreeBreak --
+ *
+ *      Free the state of a completed oplock break.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Drops the session reference held by the break.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerOplockFreeBreak(ServerLockData *lockData)  // IN: break state
+{
+   if (lockData->session != NULL) {
+      HgfsServerSessionPut(lockData->session);
    }
-   reply = (HgfsReplyServerLockChange *)packetIn;
+   free(lockData);
+}
 
-   /*
-    * XXX: It should be safe to ignore the status and id from the actual
-    * HgfsReply. The only information we need to properly acknowledge the break
-    * is the original fd and the new lease, which, in the case of a degrade,
-    * is double checked in HgfsAckOplockBreak, so we'd be safe from a garbage
-    * value.
-    */
-   HgfsAckOplockBreak(lockData, reply->serverLock);
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockCheckTimeouts --
+ *
+ *      Break the oplocks whose break the client did not acknowledge in
+ *      time. Called periodically by the platform.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerOplockCheckTimeouts(void)
+{
+   VmTimeType now = Hostinfo_SystemTimerUS();
+
+   for (;;) {
+      ServerLockData *lockData = NULL;
+      DblLnkLst_Links *link;
+
+      MXUser_AcquireExclLock(gHgfsOplockLock);
+      DblLnkLst_ForEach(link, &gHgfsOplockLeases) {
+         HgfsOplockLease *lease = DblLnkLst_Container(link, HgfsOplockLease,
+                                                      links);
+
+         if (lease->pendingBreak != NULL &&
+             now - lease->pendingBreak->breakTime >=
+                                             HGFS_OPLOCK_BREAK_TIMEOUT_US) {
+            lockData = lease->pendingBreak;
+            lease->pendingBreak = NULL;
+            break;
+         }
+      }
+      MXUser_ReleaseExclLock(gHgfsOplockLock);
+
+      if (lockData == NULL) {
+         break;
+      }
+
+      LOG(4, "%s: break on fd %d was not acknowledged\n", __FUNCTION__,
+          lockData->fileDesc);
+      HgfsAckOplockBreak(lockData, HGFS_LOCK_NONE);
+   }
 }
 
 
@@ -273,20 +469,20 @@ HgfsServerOplockBreakReply(const unsigned char *packetIn, // IN: Reply packet
  * HgfsServerOplockBreak --
  *
  *      When the host FS needs to break the oplock so that another client
- *      can open the file, it signals the event in the overlapped structure
- *      that we used to request an oplock.
+ *      can open the file, the platform code calls this function with the
+ *      file descriptor and the lock it has to be downgraded to.
  *      This sets off the following chains of events:
  *      1. Send the oplock break request to the guest.
- *      2. Once the guest acknowledges the oplock break, the completion
- *      routine GuestRpcServerRequestCallback will fire, causing
- *      HgfsServerOplockBreakReply to also fire, which will break the oplock
- *      on the host FS.
+ *      2. Once the guest acknowledges the oplock break, the HGFS server calls
+ *      HgfsServerOplockBreakReply which will break the oplock on the host
+ *      FS. If the guest does not answer, HgfsServerOplockCheckTimeouts
+ *      breaks it instead.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      If successful, allocates memory for the rpc request.
+ *      Takes ownership of lockData.
  *
  *-----------------------------------------------------------------------------
  */
@@ -295,83 +491,229 @@ void
 HgfsServerOplockBreak(ServerLockData *lockData)
 {
    HgfsHandle hgfsHandle;
-   char *requestBuffer = NULL;
-   HgfsRequestServerLockChange *request;
+   HgfsOplockLease *lease;
+   HgfsSessionInfo *session;
    HgfsLockType lock;
 
    LOG(4, "%s: entered\n", __FUNCTION__);
 
+   MXUser_AcquireExclLock(gHgfsOplockLock);
+   lease = HgfsServerOplockFindLease(lockData->fileDesc, NULL);
+   if (lease == NULL || lease->pendingBreak != NULL) {
+      /* The file was closed meanwhile or the break was already sent. */
+      MXUser_ReleaseExclLock(gHgfsOplockLock);
+      LOG(4, "%s: no lease to break for fd %d\n", __FUNCTION__,
+          lockData->fileDesc);
+      HgfsServerOplockFreeBreak(lockData);
+      return;
+   }
+   session = lease->session;
+   HgfsServerSessionGet(session);
+   lockData->session = session;
+   lockData->breakTime = Hostinfo_SystemTimerUS();
+   lease->pendingBreak = lockData;
+   MXUser_ReleaseExclLock(gHgfsOplockLock);
+
    /*
     * XXX: Just because the file in not in the cache on the server,
     * does not mean it was closed on the client. It is possible that
     * we closed the file on the server because we ran out of space
     * in cache. That's why for now as long as a file has a lock,
-    * we don't remove it from the node cache. This should be fixed.
+    * we don't remove it from the node cache.
     *
-    * In any case, none of these cache-related failures should cause us to ack
-    * the oplock break locally. That is because if the file wasn't in the
-    * cache, or it had no lock, chances are someone else (maybe the VCPU
-    * thread) broke the oplock and/or closed the file.
+    * If the node is gone or has no lock, the lease is stale and is broken
+    * locally right away, the kernel is waiting for it.
     */
 
-   if (!HgfsFileDesc2Handle(lockData->fileDesc, &hgfsHandle)) {
+   if (!HgfsFileDesc2Handle(lockData->fileDesc, session, &hgfsHandle)) {
       LOG(4, "%s: file is not in the cache\n", __FUNCTION__);
-      goto free_and_exit;
+      goto ack_and_exit;
    }
 
-   if (!HgfsHandle2ServerLock(hgfsHandle, &lock)) {
+   if (!HgfsHandle2ServerLock(hgfsHandle, session, &lock)) {
       LOG(4, "%s: could not retrieve node's lock info.\n", __FUNCTION__);
-      goto free_and_exit;
+      goto ack_and_exit;
    }
 
    if (lock == HGFS_LOCK_NONE) {
       LOG(4, "%s: the file does not have a server lock.\n", __FUNCTION__);
-      goto free_and_exit;
-   }
-
-   /*
-    * We need to setup the entire request here. The command prefix will be
-    * added later, so save some space for it.
-    *
-    * XXX: This should probably go into a common allocation function that
-    * other out-of-band requests can use.
-    */
-
-   requestBuffer = malloc(sizeof *request + HGFS_CLIENT_CMD_LEN);
-   if (requestBuffer == NULL) {
-      LOG(4, "%s: could not allocate memory.\n", __FUNCTION__);
       goto ack_and_exit;
    }
 
-   /* Save space for the command prefix. */
-   request = (HgfsRequestServerLockChange *)
-      (requestBuffer + HGFS_CLIENT_CMD_LEN);
-   request->header.op = HGFS_OP_SERVER_LOCK_CHANGE;
-   request->header.id = 0; /* XXX */
-   request->file = hgfsHandle;
-   request->newServerLock = lockData->serverLock;
-
    /*
-    * Just send the request size for our actual request; our callee will
-    * write in the command prefix and modify the request size appropriately.
-    *
     * If for some reason we fail, we'll acknowledge the oplock break
     * immediately.
     */
-
-   if (HgfsServerManager_SendRequest(requestBuffer, sizeof *request,
-                                     HgfsServerOplockBreakReply, lockData)) {
+   if (HgfsServerOplockSendBreak(session, hgfsHandle, lockData->serverLock)) {
       return;
    }
-   free(requestBuffer);
 
   ack_and_exit:
-   HgfsAckOplockBreak(lockData, HGFS_LOCK_NONE);
+   /* The client may have raced us and already acknowledged the break. */
+   lockData = HgfsServerOplockTakeBreak(lockData->fileDesc, session);
+   if (lockData != NULL) {
+      HgfsAckOplockBreak(lockData, HGFS_LOCK_NONE);
+   }
+}
+#endif
 
-   return;
 
-  free_and_exit:
-   free(lockData);
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockRemoveLease --
+ *
+ *      Unregister a file descriptor whose lease is gone, either because its
+ *      lock was broken or because the file is about to be closed.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Frees any break still pending on the file.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerOplockRemoveLease(fileDesc fileDesc,          // IN: leased file
+                            HgfsSessionInfo *session)   // IN: owner
+{
+#ifdef HGFS_OPLOCKS
+   HgfsOplockLease *lease;
+
+   if (gHgfsOplockLock == NULL) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsOplockLock);
+   lease = HgfsServerOplockFindLease(fileDesc, session);
+   if (lease != NULL) {
+      DblLnkLst_Unlink1(&lease->links);
+   }
+   MXUser_ReleaseExclLock(gHgfsOplockLock);
+
+   if (lease != NULL) {
+      if (lease->pendingBreak != NULL) {
+         HgfsServerOplockFreeBreak(lease->pendingBreak);
+      }
+      free(lease);
+   }
+#endif
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockBreakReply --
+ *
+ *      The client was sent an oplock break request, and responded with this
+ *      reply. It contains the oplock status that the client is now in. Since
+ *      the break could have actually been a degrade, it is well within the
+ *      client's rights to transition to a non-broken state. We need to make
+ *      sure that such a transition was legal, acknowledge the break
+ *      appropriately, and update our own state.
+ *
+ * Results:
+ *      TRUE if a break was pending on the handle, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServerOplockBreakReply(HgfsSessionInfo *session,  // IN: session info
+                           HgfsHandle handle,         // IN: Hgfs file handle
+                           HgfsLockType serverLock)   // IN: lock client kept
+{
+#ifdef HGFS_OPLOCKS
+   ServerLockData *lockData;
+   fileDesc fd;
+
+   if (!HgfsHandle2FileDesc(handle, session, &fd, NULL)) {
+      LOG(4, "%s: invalid handle %u\n", __FUNCTION__, handle);
+      return FALSE;
+   }
+
+   lockData = HgfsServerOplockTakeBreak(fd, session);
+   if (lockData == NULL) {
+      LOG(4, "%s: no break pending on handle %u\n", __FUNCTION__, handle);
+      return FALSE;
+   }
+
+   /*
+    * The lock the client kept is double checked in HgfsAckOplockBreak
+    * against the lock the host allows, so a garbage value is harmless.
+    */
+   HgfsAckOplockBreak(lockData, serverLock);
+   return TRUE;
+#else
+   return FALSE;
 #endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockChange --
+ *
+ *      Change the oplock of an open file at the client's request. Releasing
+ *      or downgrading the oplock while a break is pending acknowledges the
+ *      break. Asking for a stronger oplock is opportunistic and may leave
+ *      the lock unchanged.
+ *
+ * Results:
+ *      TRUE on success with serverLock set to the lock now held.
+ *      FALSE if the handle is invalid.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServerOplockChange(HgfsHandle handle,          // IN: Hgfs file handle
+                       HgfsSessionInfo *session,   // IN: session info
+                       HgfsLockType *serverLock)   // IN/OUT: lock wanted/held
+{
+#ifdef HGFS_OPLOCKS
+   ServerLockData *lockData;
+   HgfsLockType currentLock;
+   fileDesc fd;
+
+   if (!HgfsHandle2FileDesc(handle, session, &fd, NULL) ||
+       !HgfsHandle2ServerLock(handle, session, &currentLock)) {
+      return FALSE;
+   }
 
+   lockData = HgfsServerOplockTakeBreak(fd, session);
+   if (lockData != NULL) {
+      /* A break is in flight, take the change as its acknowledgement. */
+      HgfsAckOplockBreak(lockData, *serverLock);
+   } else if (*serverLock == HGFS_LOCK_NONE ||
+              (*serverLock == HGFS_LOCK_SHARED &&
+               currentLock == HGFS_LOCK_EXCLUSIVE)) {
+      lockData = Util_SafeCalloc(1, sizeof *lockData);
+      lockData->fileDesc = fd;
+      lockData->serverLock = *serverLock;
+      lockData->session = session;
+      HgfsServerSessionGet(session);
+      HgfsAckOplockBreak(lockData, *serverLock);
+   } else if (*serverLock != currentLock) {
+      HgfsLockType newLock = *serverLock;
+
+      if (HgfsAcquireServerLock(fd, session, &newLock)) {
+         HgfsUpdateNodeServerLock(fd, session, newLock);
+      }
+   }
+
+   return HgfsHandle2ServerLock(handle, session, serverLock);
+#else
+   return FALSE;
+#endif
+}
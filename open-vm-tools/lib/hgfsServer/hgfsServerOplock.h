@@ -47,6 +47,7 @@
  */
 
 Bool HgfsServerOplockInit(void);
+Bool HgfsServerOplockStart(void);
 void HgfsServerOplockDestroy(void);
 Bool HgfsHandle2ServerLock(HgfsHandle handle,
                            HgfsSessionInfo *session,
@@ -59,6 +60,14 @@ Bool HgfsFileHasServerLock(const char *utf8Name,
 Bool HgfsAcquireServerLock(fileDesc fileDesc,
                            HgfsSessionInfo *session,
                            HgfsLockType *serverLock);
+Bool HgfsServerOplockChange(HgfsHandle handle,
+                            HgfsSessionInfo *session,
+                            HgfsLockType *serverLock);
+Bool HgfsServerOplockBreakReply(HgfsSessionInfo *session,
+                                HgfsHandle handle,
+                                HgfsLockType serverLock);
+void HgfsServerOplockRemoveLease(fileDesc fileDesc,
+                                 HgfsSessionInfo *session);
 
 
 #endif // ifndef _HGFS_SERVER_OPLOCK_H_
@@ -31,23 +31,33 @@
 
 /*
  * Does this platform have oplock support? We define it here to avoid long
- * ifdefs all over the code. For now, Linux and Windows hosts only.
- *
- * XXX: Just kidding, no oplock support yet.
+ * ifdefs all over the code. For now, Linux only, where oplocks map onto
+ * fcntl(F_SETLEASE) leases.
  */
-#if 0
+#if defined(__linux__)
 #define HGFS_OPLOCKS
 #endif
 
 /*
- * XXX describe the data structure
+ * How long the client has to acknowledge an oplock break before the server
+ * breaks the lock on its own. This must stay below the kernel lease break
+ * time (/proc/sys/fs/lease-break-time, 45 seconds by default) so that the
+ * node state is updated before the kernel revokes the lease.
  */
+#define HGFS_OPLOCK_BREAK_TIMEOUT_US   (30 * 1000 * 1000)
 
-/* Server lock related structure */
+/*
+ * State of one oplock break. Allocated when the host file system asks for
+ * the lock to be broken and freed by HgfsServerOplockFreeBreak once the
+ * break has been acknowledged, either by the client or by the timeout.
+ * Holds a reference to the session while alive.
+ */
 typedef struct {
    fileDesc fileDesc;
    int32 event;
-   HgfsLockType serverLock;
+   HgfsLockType serverLock;     /* Lock the file is being downgraded to. */
+   HgfsSessionInfo *session;    /* Session which owns the oplocked node. */
+   VmTimeType breakTime;        /* When the break was sent to the client. */
 } ServerLockData;
 
 
@@ -62,9 +72,25 @@ typedef struct {
  */
 
 #ifdef HGFS_OPLOCKS
+Bool
+HgfsPlatformOplockInit(void);
+
+void
+HgfsPlatformOplockDestroy(void);
+
 void
 HgfsServerOplockBreak(ServerLockData *data);
 
+void
+HgfsServerOplockCheckTimeouts(void);
+
+void
+HgfsServerOplockFreeBreak(ServerLockData *lockData);
+
+void
+HgfsServerOplockAddLease(fileDesc fileDesc,
+                         HgfsSessionInfo *session);
+
 void
 HgfsAckOplockBreak(ServerLockData *lockData,
                    HgfsLockType replyLock);
@@ -20,8 +20,16 @@
  * hgfsServerOplockLinux.c --
  *
  *      HGFS server opportunistic lock support for the Linux platform.
+ *
+ *      Oplocks are implemented with file leases. The kernel reports a lease
+ *      break with a realtime signal carrying the file descriptor. The signal
+ *      handler only forwards the descriptor through a pipe to the lease
+ *      break thread, which does the actual work of breaking the oplock.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // for F_SETSIG and F_SETLEASE
+#endif
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -31,11 +39,30 @@
 #include "vmware.h"
 #include "err.h"
 #include "hgfsServerInt.h"
+#include "hgfsServerOplock.h"
 #include "hgfsServerOplockInt.h"
 
 #ifdef HGFS_OPLOCKS
+#   include <fcntl.h>
 #   include <signal.h>
-#   include "sig.h"
+#   include <unistd.h>
+#   include <pthread.h>
+#   include <sys/poll.h>
+#   include "util.h"
+
+/*
+ * Signal the kernel sends on a lease break. A realtime signal is queued
+ * with its siginfo_t, so no break is lost if several arrive at once. If the
+ * realtime queue overflows the kernel falls back to SIGIO, which cannot
+ * happen here as the number of oplocked files per session is small.
+ */
+#define HGFS_OPLOCK_SIGNAL        (SIGRTMIN + 1)
+
+/* How often the lease break thread checks for unacknowledged breaks. */
+#define HGFS_OPLOCK_POLL_MSEC     1000
+
+/* Written to the pipe to make the lease break thread exit. */
+#define HGFS_OPLOCK_EXIT_FD       (-1)
 #endif
 
 
@@ -43,6 +70,12 @@
  * Local data
  */
 
+#ifdef HGFS_OPLOCKS
+static int gHgfsOplockFds[2] = { -1, -1 };
+static pthread_t gHgfsOplockThread;
+static struct sigaction gHgfsOplockOldAction;
+#endif
+
 /*
  * Global data
  */
@@ -55,8 +88,9 @@
 #ifdef HGFS_OPLOCKS
 static void HgfsServerSigOplockBreak(int sigNum,
                                      siginfo_t *info,
-                                     ucontext_t *u,
-                                     void *clientData);
+                                     void *context);
+static void *HgfsServerOplockThread(void *data);
+static void HgfsServerOplockBreakFd(int fd);
 #endif
 
 
@@ -69,10 +103,11 @@ static void HgfsServerSigOplockBreak(int sigNum,
  *      Set up any state needed to start Linux HGFS server oplock support.
  *
  * Results:
- *      TRUE always.
+ *      TRUE on success, FALSE if leases cannot be monitored.
  *
  * Side effects:
- *      None.
+ *      Installs the lease break signal handler and starts the lease break
+ *      thread.
  *
  *-----------------------------------------------------------------------------
  */
@@ -81,10 +116,60 @@ Bool
 HgfsPlatformOplockInit(void)
 {
 #ifdef HGFS_OPLOCKS
+   struct sigaction action;
+   int status;
+   int i;
+
+   if (pipe(gHgfsOplockFds) < 0) {
+      status = errno;
+      Log("%s: Could not create the lease break pipe: %s\n", __FUNCTION__,
+          Err_Errno2String(status));
+      gHgfsOplockFds[0] = gHgfsOplockFds[1] = -1;
+
+      return FALSE;
+   }
+   for (i = 0; i < ARRAYSIZE(gHgfsOplockFds); i++) {
+      fcntl(gHgfsOplockFds[i], F_SETFD, FD_CLOEXEC);
+   }
+   /* The signal handler must never block on a full pipe. */
+   fcntl(gHgfsOplockFds[1], F_SETFL, O_NONBLOCK);
+
+   status = pthread_create(&gHgfsOplockThread, NULL, HgfsServerOplockThread,
+                           NULL);
+   if (status != 0) {
+      Log("%s: Could not start the lease break thread: %s\n", __FUNCTION__,
+          Err_Errno2String(status));
+      goto error;
+   }
+
    /* Register a signal handler to catch oplock break signals. */
-   Sig_Callback(SIGIO, SIG_SAFE, HgfsServerSigOplockBreak, NULL);
-#endif
+   memset(&action, 0, sizeof action);
+   action.sa_sigaction = HgfsServerSigOplockBreak;
+   action.sa_flags = SA_SIGINFO | SA_RESTART;
+   sigemptyset(&action.sa_mask);
+   if (sigaction(HGFS_OPLOCK_SIGNAL, &action, &gHgfsOplockOldAction) < 0) {
+      int fd = HGFS_OPLOCK_EXIT_FD;
+
+      status = errno;
+      Log("%s: Could not install the lease break handler: %s\n", __FUNCTION__,
+          Err_Errno2String(status));
+      if (write(gHgfsOplockFds[1], &fd, sizeof fd) == sizeof fd) {
+         pthread_join(gHgfsOplockThread, NULL);
+      }
+      goto error;
+   }
+
    return TRUE;
+
+error:
+   for (i = 0; i < ARRAYSIZE(gHgfsOplockFds); i++) {
+      close(gHgfsOplockFds[i]);
+      gHgfsOplockFds[i] = -1;
+   }
+   return FALSE;
+#else
+   return TRUE;
+#endif
 }
 
 
@@ -99,7 +184,7 @@ HgfsPlatformOplockInit(void)
  *      None.
  *
  * Side effects:
- *      None.
+ *      Stops the lease break thread.
  *
  *-----------------------------------------------------------------------------
  */
@@ -108,8 +193,32 @@ void
 HgfsPlatformOplockDestroy(void)
 {
 #ifdef HGFS_OPLOCKS
+   int fd = HGFS_OPLOCK_EXIT_FD;
+   int i;
+
+   if (gHgfsOplockFds[1] < 0) {
+      return;
+   }
+
    /* Tear down oplock state, so we no longer catch signals. */
-   Sig_Callback(SIGIO, SIG_NOHANDLER, NULL, NULL);
+   sigaction(HGFS_OPLOCK_SIGNAL, &gHgfsOplockOldAction, NULL);
+
+   /*
+    * The write end is non-blocking for the signal handler; make sure the
+    * exit request is not dropped just because the pipe happens to be full.
+    */
+   fcntl(gHgfsOplockFds[1], F_SETFL, 0);
+   if (write(gHgfsOplockFds[1], &fd, sizeof fd) != sizeof fd) {
+      Log("%s: Could not stop the lease break thread: %s\n", __FUNCTION__,
+          Err_Errno2String(errno));
+   } else {
+      pthread_join(gHgfsOplockThread, NULL);
+   }
+
+   for (i = 0; i < ARRAYSIZE(gHgfsOplockFds); i++) {
+      close(gHgfsOplockFds[i]);
+      gHgfsOplockFds[i] = -1;
+   }
 #endif
 }
 
@@ -131,7 +240,7 @@ HgfsPlatformOplockDestroy(void)
  *    but since it is opportunistic by nature, it isn't necessary to do so.
  *
  * Side effects:
- *    None.
+ *    The file is registered for lease break handling.
  *
  *-----------------------------------------------------------------------------
  */
@@ -159,15 +268,14 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
    }
 
    /*
-    * First tell the kernel which signal to send us. SIGIO is already the
-    * default, but if we skip this step, we won't get the siginfo_t when
-    * a lease break occurs.
-    *
-    * XXX: Do I need to do fcntl(fileDesc, F_SETOWN, getpid())?
+    * First tell the kernel which signal to send us. If we skip this step,
+    * the kernel sends SIGIO without the siginfo_t and we could not tell
+    * which file the lease break is for. The lease owner is set to this
+    * process by F_SETLEASE itself.
     */
-   if (fcntl(fileDesc, F_SETSIG, SIGIO)) {
+   if (fcntl(fileDesc, F_SETSIG, HGFS_OPLOCK_SIGNAL)) {
       error = errno;
-      Log("%s: Could not set SIGIO as the desired lease break signal for "
+      Log("%s: Could not set the desired lease break signal for "
           "fd %d: %s\n", __FUNCTION__, fileDesc, Err_Errno2String(error));
 
       return FALSE;
@@ -187,6 +295,13 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
 
       return FALSE;
    }
+
+   /*
+    * Register the lease before taking it, a break may be signalled as soon
+    * as the lease is granted.
+    */
+   HgfsServerOplockAddLease(fileDesc, session);
+
    if (fcntl(fileDesc, F_SETLEASE, leaseType)) {
       /*
        * If our client was opportunistic and we failed to get his lease because
@@ -201,7 +316,7 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
             LOG(4, "%s: Could not get any opportunistic lease for fd %d: %s\n",
                 __FUNCTION__, fileDesc, Err_Errno2String(error));
 
-            return FALSE;
+            goto error;
          }
       } else {
          error = errno;
@@ -209,7 +324,7 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
              __FUNCTION__, leaseType == F_WRLCK ? "write" : "read",
              fileDesc, Err_Errno2String(errno));
 
-         return FALSE;
+         goto error;
       }
    }
 
@@ -218,6 +333,13 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
        leaseType == F_WRLCK ? "write" : "read", fileDesc);
    *serverLock = leaseType == F_WRLCK ? HGFS_LOCK_EXCLUSIVE : HGFS_LOCK_SHARED;
    return TRUE;
+
+error:
+   /* An upgrade that failed leaves the lease the file already had. */
+   if (fcntl(fileDesc, F_GETLEASE) == F_UNLCK) {
+      HgfsServerOplockRemoveLease(fileDesc, session);
+   }
+   return FALSE;
 #else
    return FALSE;
 #endif
@@ -231,11 +353,12 @@ HgfsAcquireServerLock(fileDesc fileDesc,            // IN: OS handle
  * HgfsAckOplockBreak --
  *
  *    Platform-dependent implementation of oplock break acknowledgement.
- *    This function gets called when the oplock break rpc command is completed.
- *    The rpc oplock break command (HgfsServerOplockBreak) is in hgfsServer.c
+ *    This function gets called when the client acknowledged the oplock
+ *    break sent by HgfsServerOplockBreak, when the client did not answer in
+ *    time, or when the client itself releases or downgrades its oplock.
  *
  *    On Linux, we use fcntl() to downgrade the lease. Then we update the node
- *    cache, free the clientData, and call it a day.
+ *    cache, free the lock data, and call it a day.
  *
  * Results:
  *    None
@@ -254,6 +377,7 @@ HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
    HgfsLockType actualLock;
 
    ASSERT(lockData);
+   ASSERT(lockData->session);
    fileDesc = lockData->fileDesc;
    LOG(4, "%s: Acknowledging break on fd %d\n", __FUNCTION__, fileDesc);
 
@@ -279,8 +403,11 @@ HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
    }
 
    /* Cleanup. */
-   HgfsUpdateNodeServerLock(fileDesc, actualLock);
-   free(lockData);
+   HgfsUpdateNodeServerLock(fileDesc, lockData->session, actualLock);
+   if (actualLock == HGFS_LOCK_NONE) {
+      HgfsServerOplockRemoveLease(fileDesc, lockData->session);
+   }
+   HgfsServerOplockFreeBreak(lockData);
 }
 
 
@@ -289,9 +416,9 @@ HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
  *
  * HgfsServerSigOplockBreak --
  *
- *      Handle a pending oplock break. Called from the VMX poll loop context.
- *      All we really do is set up the state for an oplock break and call
- *      HgfsServerOplockBreak which will do the rest of the work.
+ *      Signal handler for lease breaks. Only async-signal-safe calls are
+ *      allowed here, so the file descriptor is handed to the lease break
+ *      thread which does the rest of the work.
  *
  * Results:
  *      None.
@@ -305,25 +432,112 @@ HgfsAckOplockBreak(ServerLockData *lockData, // IN: server lock info
 static void
 HgfsServerSigOplockBreak(int sigNum,       // IN: Signal number
                          siginfo_t *info,  // IN: Additional info about signal
-                         ucontext_t *u,    // IN: Interrupted context (regs etc)
-                         void *clientData) // IN: Ignored
+                         void *context)    // IN: Interrupted context (ignored)
 {
-   ServerLockData *lockData;
-   int newLease, fd;
-   HgfsLockType newServerLock;
-
-   ASSERT(sigNum == SIGIO);
-   ASSERT(info);
-   ASSERT(clientData == NULL);
-
-   fd = info->si_fd;
-   LOG(4, "%s: Received SIGIO for fd %d\n", __FUNCTION__, fd);
+   int savedErrno = errno;
+   int fd = info->si_fd;
 
    /*
-    * We've got all we need from the signal handler, let it continue handling
-    * signals of this type.
+    * If the pipe is full the break is lost here; the break is then forced
+    * by the kernel after the lease break time and the node state is fixed
+    * up when the file is next closed.
     */
-   Sig_Continue(sigNum);
+   if (write(gHgfsOplockFds[1], &fd, sizeof fd) < 0) {
+      /* Nothing can be done from a signal handler. */
+   }
+   errno = savedErrno;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockThread --
+ *
+ *      Lease break thread. Waits for file descriptors from the signal
+ *      handler and periodically breaks oplocks the client did not
+ *      acknowledge in time.
+ *
+ * Results:
+ *      Always NULL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsServerOplockThread(void *data)  // IN: unused
+{
+   sigset_t sigMask;
+
+   /* Leave the lease break signal to the other threads. */
+   sigemptyset(&sigMask);
+   sigaddset(&sigMask, HGFS_OPLOCK_SIGNAL);
+   pthread_sigmask(SIG_BLOCK, &sigMask, NULL);
+
+   for (;;) {
+      struct pollfd pfd;
+      int ret;
+      int fd;
+
+      pfd.fd = gHgfsOplockFds[0];
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+
+      ret = poll(&pfd, 1, HGFS_OPLOCK_POLL_MSEC);
+      if (ret < 0) {
+         if (errno != EINTR) {
+            Log("%s: poll failed: %s\n", __FUNCTION__, Err_Errno2String(errno));
+            break;
+         }
+         continue;
+      }
+
+      if (ret > 0 && (pfd.revents & POLLIN)) {
+         if (read(gHgfsOplockFds[0], &fd, sizeof fd) != sizeof fd) {
+            continue;
+         }
+         if (fd == HGFS_OPLOCK_EXIT_FD) {
+            break;
+         }
+         HgfsServerOplockBreakFd(fd);
+      }
+
+      HgfsServerOplockCheckTimeouts();
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerOplockBreakFd --
+ *
+ *      Handle a pending oplock break. Called from the lease break thread.
+ *      All we really do is set up the state for an oplock break and call
+ *      HgfsServerOplockBreak which will do the rest of the work.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsServerOplockBreakFd(int fd)  // IN: file with a lease break pending
+{
+   ServerLockData *lockData;
+   int newLease;
+   HgfsLockType newServerLock;
+
+   LOG(4, "%s: Received lease break for fd %d\n", __FUNCTION__, fd);
 
    /*
     * According to locks.c in kernel source, doing F_GETLEASE when a lease
@@ -336,14 +550,14 @@ HgfsServerSigOplockBreak(int sigNum,       // IN: Signal number
    } else if (newLease == F_UNLCK) {
       newServerLock = HGFS_LOCK_NONE;
    } else if (newLease == -1) {
-      int error = errno;
-      Log("%s: Could not get old lease for fd %d: %s\n", __FUNCTION__,
-          fd, Err_Errno2String(error));
-      goto error;
+      /* The file has been closed since the signal was sent. */
+      LOG(4, "%s: Could not get old lease for fd %d: %s\n", __FUNCTION__,
+          fd, Err_Errno2String(errno));
+      return;
    } else {
       Log("%s: Unexpected reply to get lease for fd %d: %d\n",
           __FUNCTION__, fd, newLease);
-      goto error;
+      return;
    }
 
    /*
@@ -353,26 +567,15 @@ HgfsServerSigOplockBreak(int sigNum,       // IN: Signal number
     * the acknowledgement, and firing the platform-specific acknowledgement
     * function (where we'll downgrade the lease).
     */
-   lockData = malloc(sizeof *lockData);
-   if (lockData) {
-      lockData->fileDesc = fd;
-      lockData->serverLock = newServerLock;
-      lockData->event = 0; // not needed
+   lockData = Util_SafeCalloc(1, sizeof *lockData);
+   lockData->fileDesc = fd;
+   lockData->serverLock = newServerLock;
+   lockData->event = 0; // not needed
 
-      /*
-       * Relinquish control of this data. It'll get freed later, when the RPC
-       * command completes.
-       */
-      HgfsServerOplockBreak(lockData);
-      return;
-   } else {
-      Log("%s: Could not allocate memory for lease break on behalf of fd %d\n",
-          __FUNCTION__, fd);
-   }
-
-  error:
-   /* Clean up as best we can. */
-   fcntl(fd, F_SETLEASE, F_UNLCK);
-   HgfsUpdateNodeServerLock(fd, HGFS_LOCK_NONE);
+   /*
+    * Relinquish control of this data. It'll get freed later, when the break
+    * is acknowledged.
+    */
+   HgfsServerOplockBreak(lockData);
 }
 #endif /* HGFS_OPLOCKS */
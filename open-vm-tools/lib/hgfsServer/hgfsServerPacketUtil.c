@@ -182,6 +182,39 @@ exit:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_GetReplyPacketCapacity --
+ *
+ *    Get the largest reply HSPU_GetReplyPacket can provide for an hgfs
+ *    packet, for replies whose size is only known once they have been built.
+ *
+ * Results:
+ *    Reply capacity in bytes, including the reply header.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+size_t
+HSPU_GetReplyPacketCapacity(HgfsPacket *packet,                  // IN: Hgfs Packet
+                            HgfsServerChannelCallbacks *chanCb)  // IN: Channel callbacks
+{
+   if (packet->replyPacket != NULL) {
+      /* Pre-allocated reply buffer (as used by the backdoor). */
+      return packet->replyPacketSize;
+   } else if (chanCb != NULL && chanCb->getWriteVa != NULL) {
+      /* No reply buffer (as used by the VMCI) reuse the metapacket buffer. */
+      return packet->metaPacketSize;
+   }
+
+   /* No reply buffer but we will allocate the size required. */
+   return HGFS_LARGE_PACKET_MAX;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -404,6 +437,110 @@ HSPU_GetDataPacketBuf(HgfsPacket *packet,                   // IN/OUT: Hgfs Pack
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_MapDataPacketIov --
+ *
+ *    Establish guest mappings for the data packet and return the mapped
+ *    iovs directly, so that file data can be transferred with vectored I/O
+ *    instead of through the contiguous (and possibly allocated) buffer
+ *    HSPU_GetDataPacketBuf provides.
+ *
+ *    The mappings must be released with HSPU_UnmapDataPacketIov.
+ *
+ * Results:
+ *    Pointer to the first mapped iov, NULL if mapping failed or the
+ *    data packet buffer is already in use.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsVmxIov *
+HSPU_MapDataPacketIov(HgfsPacket *packet,                   // IN/OUT: Hgfs Packet
+                      MappingType mappingType,              // IN: Writeable/Readable
+                      size_t mapSize,                       // IN: size to map
+                      HgfsServerChannelCallbacks *chanCb,   // IN: Channel callbacks
+                      uint32 *iovCount)                     // OUT: mapped iov count
+{
+   HgfsChannelMapVirtAddrFunc mapVa;
+
+   *iovCount = 0;
+
+   if (packet->dataPacket != NULL ||
+       packet->dataPacketMappedIov != 0 ||
+       mapSize == 0 ||
+       mapSize > packet->dataPacketSize ||
+       chanCb == NULL ||
+       chanCb->putVa == NULL) {
+      return NULL;
+   }
+
+   if (mappingType == BUF_WRITEABLE ||
+       mappingType == BUF_READWRITEABLE) {
+      mapVa = chanCb->getWriteVa;
+   } else {
+      ASSERT(mappingType == BUF_READABLE);
+      mapVa = chanCb->getReadVa;
+   }
+
+   /* Looks like we are in the middle of poweroff. */
+   if (mapVa == NULL) {
+      return NULL;
+   }
+
+   if (!HSPUMapBuf(mapVa,
+                   chanCb->putVa,
+                   mapSize,
+                   packet->dataPacketIovIndex,
+                   packet->iovCount,
+                   packet->iov,
+                   &packet->dataPacketMappedIov)) {
+      /* Guest probably passed us bad physical address */
+      return NULL;
+   }
+
+   packet->dataMappingType = mappingType;
+   *iovCount = packet->dataPacketMappedIov;
+
+   return &packet->iov[packet->dataPacketIovIndex];
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HSPU_UnmapDataPacketIov --
+ *
+ *    Release the guest mappings established by HSPU_MapDataPacketIov.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HSPU_UnmapDataPacketIov(HgfsPacket *packet,                   // IN/OUT: Hgfs Packet
+                        HgfsServerChannelCallbacks *chanCb)   // IN: Channel callbacks
+{
+   ASSERT(packet->dataPacket == NULL);
+
+   if (packet->dataPacketMappedIov == 0) {
+      return;
+   }
+
+   HSPUUnmapBuf(chanCb->putVa,
+                packet->dataPacketIovIndex,
+                packet->iov,
+                &packet->dataPacketMappedIov);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
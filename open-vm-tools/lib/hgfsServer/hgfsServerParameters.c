@@ -120,6 +120,8 @@ static HgfsOpCapability hgfsDefaultCapabilityTable[] =
    {HGFS_OP_UNLOCK_BYTE_RANGE_V4,  HGFS_OP_CAPFLAG_NOT_SUPPORTED},
    {HGFS_OP_QUERY_EAS_V4,          HGFS_OP_CAPFLAG_NOT_SUPPORTED},
    {HGFS_OP_SET_EAS_V4,            HGFS_OP_CAPFLAG_NOT_SUPPORTED},
+   {HGFS_OP_COMPOUND_V4,           HGFS_OP_CAPFLAG_IS_SUPPORTED},
+   {HGFS_OP_COPY_FILE_RANGE_V4,    HGFS_OP_CAPFLAG_IS_SUPPORTED},
 };
 
 
@@ -5728,6 +5730,231 @@ HgfsPackCalculateNotificationSize(char const *shareName, // IN: shared folder na
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackServerLockChangeRequest --
+ *
+ *    Unpack hgfs server lock change request to get the file and the lock
+ *    the client wants on it.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackServerLockChangeRequest(const void *packet,        // IN: HGFS packet
+                                  size_t packetSize,         // IN: request packet size
+                                  HgfsOp op,                 // IN: request type
+                                  HgfsHandle *file,          // OUT: file to change
+                                  HgfsLockType *serverLock)  // OUT: lock wanted
+{
+   ASSERT(packet);
+   ASSERT(file);
+   ASSERT(serverLock);
+
+   switch (op) {
+   case HGFS_OP_SERVER_LOCK_CHANGE_V3: {
+      const HgfsRequestServerLockChangeV2 *requestV3 = packet;
+
+      LOG(4, "%s: HGFS_OP_SERVER_LOCK_CHANGE_V3\n", __FUNCTION__);
+      if (packetSize < sizeof *requestV3) {
+         LOG(4, "%s: Too small HGFS packet\n", __FUNCTION__);
+         return FALSE;
+      }
+      *file = requestV3->fid;
+      *serverLock = requestV3->serverLock;
+      break;
+   }
+   case HGFS_OP_SERVER_LOCK_CHANGE: {
+      const HgfsRequestServerLockChange *requestV1 = packet;
+
+      LOG(4, "%s: HGFS_OP_SERVER_LOCK_CHANGE\n", __FUNCTION__);
+      if (packetSize < sizeof *requestV1) {
+         LOG(4, "%s: Too small HGFS packet\n", __FUNCTION__);
+         return FALSE;
+      }
+      *file = requestV1->file;
+      *serverLock = requestV1->newServerLock;
+      break;
+   }
+   default:
+      NOT_REACHED();
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackServerLockChangeReply --
+ *
+ *    Pack hgfs server lock change reply with the lock now held on the file.
+ *
+ * Results:
+ *    TRUE on success, FALSE if bad opcode.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackServerLockChangeReply(HgfsPacket *packet,         // IN/OUT: Hgfs Packet
+                              const void *packetHeader,   // IN: packet header
+                              HgfsOp op,                  // IN: request type
+                              HgfsLockType serverLock,    // IN: lock held
+                              size_t *payloadSize,        // OUT: size of packet
+                              HgfsSessionInfo *session)   // IN: Session info
+{
+   Bool result = TRUE;
+
+   HGFS_ASSERT_PACK_PARAMS;
+
+   *payloadSize = 0;
+
+   switch (op) {
+   case HGFS_OP_SERVER_LOCK_CHANGE_V3: {
+      HgfsReplyServerLockChangeV2 *reply;
+
+      reply = HgfsAllocInitReply(packet, packetHeader, sizeof *reply,
+                                 session);
+      reply->serverLock = serverLock;
+      reply->reserved = 0;
+      *payloadSize = sizeof *reply;
+      break;
+   }
+   case HGFS_OP_SERVER_LOCK_CHANGE: {
+      HgfsReplyServerLockChange *reply;
+
+      reply = HgfsAllocInitReply(packet, packetHeader, sizeof *reply,
+                                 session);
+      reply->serverLock = serverLock;
+      *payloadSize = sizeof *reply;
+      break;
+   }
+   default:
+      NOT_REACHED();
+      result = FALSE;
+   }
+
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCopyFileRangeRequest --
+ *
+ *    Unpack hgfs copy file range request.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCopyFileRangeRequest(const void *packet,   // IN: HGFS packet
+                               size_t packetSize,    // IN: request packet size
+                               HgfsOp op,            // IN: request type
+                               HgfsHandle *srcFile,  // OUT: file to copy from
+                               uint64 *srcOffset,    // OUT: offset to copy from
+                               HgfsHandle *dstFile,  // OUT: file to copy to
+                               uint64 *dstOffset,    // OUT: offset to copy to
+                               uint64 *length)       // OUT: bytes to copy
+{
+   const HgfsRequestCopyFileRangeV4 *requestV4 = packet;
+
+   ASSERT(packet);
+   ASSERT(srcFile);
+   ASSERT(srcOffset);
+   ASSERT(dstFile);
+   ASSERT(dstOffset);
+   ASSERT(length);
+
+   if (HGFS_OP_COPY_FILE_RANGE_V4 != op || packetSize < sizeof *requestV4) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+
+   if (requestV4->flags != 0) {
+      LOG(4, "%s: Unsupported flags %#x\n", __FUNCTION__, requestV4->flags);
+      return FALSE;
+   }
+
+   *srcFile = requestV4->srcFile;
+   *srcOffset = requestV4->srcOffset;
+   *dstFile = requestV4->dstFile;
+   *dstOffset = requestV4->dstOffset;
+   *length = requestV4->length;
+
+   LOG(4, "%s: HGFS_OP_COPY_FILE_RANGE_V4 fh %u -> %u\n", __FUNCTION__,
+       *srcFile, *dstFile);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsPackCopyFileRangeReply --
+ *
+ *    Pack hgfs copy file range reply.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsPackCopyFileRangeReply(HgfsPacket *packet,         // IN/OUT: Hgfs Packet
+                           const void *packetHeader,   // IN: packet header
+                           HgfsOp op,                  // IN: request type
+                           uint64 actualSize,          // IN: bytes copied
+                           size_t *payloadSize,        // OUT: size of packet
+                           HgfsSessionInfo *session)   // IN: Session info
+{
+   HgfsReplyCopyFileRangeV4 *reply;
+
+   HGFS_ASSERT_PACK_PARAMS;
+
+   *payloadSize = 0;
+
+   if (HGFS_OP_COPY_FILE_RANGE_V4 != op) {
+      NOT_REACHED();
+      return FALSE;
+   }
+
+   reply = HgfsAllocInitReply(packet, packetHeader, sizeof *reply, session);
+   reply->actualSize = actualSize;
+   reply->reserved = 0;
+   *payloadSize = sizeof *reply;
+
+   return TRUE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -5941,10 +6168,13 @@ HgfsUnpackOplockBreakAckReply(const void *packet,            // IN: HGFS packet
  * HgfsBuildCPName --
  *
  *    Build crossplatform name out of share name and relative to the shared folder
- *    file path.
+ *    file path. The name is converted straight into the caller's buffer, which
+ *    is normally the reply packet, and the intermediate full path is only
+ *    allocated if it does not fit on the stack.
  *
  * Results:
- *    Length of the output crossplatform name.
+ *    Length of the output crossplatform name, negative if the name could not
+ *    be converted or did not fit.
  *
  * Side effects:
  *    None
@@ -5954,65 +6184,33 @@ HgfsUnpackOplockBreakAckReply(const void *packet,            // IN: HGFS packet
 
 static int
 HgfsBuildCPName(char const *shareName,  // IN: utf8 share name
-                char *fileName,         // IN: utf8 file path
-                char **cpName)          // OUT: full name in cp format
+                char const *fileName,   // IN: utf8 file path
+                size_t bufOutSize,      // IN: size of the output buffer
+                char *bufOut)           // OUT: full name in cp format
 {
    size_t shareNameLen = strlen(shareName) + 1;
    size_t fileNameLen = strlen(fileName) + 1;
-   char *fullName = Util_SafeMalloc(shareNameLen + fileNameLen);
+   char localName[HGFS_PACKET_MAX];
+   char *fullName = localName;
    int cpNameResult;
 
-   *cpName = Util_SafeMalloc(shareNameLen + fileNameLen);
+   if (shareNameLen + fileNameLen > sizeof localName) {
+      fullName = Util_SafeMalloc(shareNameLen + fileNameLen);
+   }
+
    Str_Strcpy(fullName, shareName, shareNameLen);
    fullName[shareNameLen - 1] = DIRSEPC;
    Str_Strcpy(fullName + shareNameLen, fileName, fileNameLen);
 
-   // Unescaped name can't be longer then escaped thus it must fit.
-   cpNameResult = CPName_ConvertTo(fullName, shareNameLen + fileNameLen, *cpName);
-   free(fullName);
-   if (cpNameResult < 0) {
-      free(*cpName);
-      *cpName = NULL;
+   cpNameResult = CPName_ConvertTo(fullName, bufOutSize, bufOut);
+   if (fullName != localName) {
+      free(fullName);
    }
 
    return cpNameResult;
 }
 
 
-/*
- *-----------------------------------------------------------------------------
- *
- * HgfsPackHgfsName --
- *
- *    Pack cpName into HgfsFileName structure.
- *
- * Results:
- *    TRUE if there is enough space in the buffer,
- *    FALSE otherwise.
- *
- * Side effects:
- *    None
- *
- *-----------------------------------------------------------------------------
- */
-
-static Bool
-HgfsPackHgfsName(char *cpName,            // IN: cpName to pack
-                 size_t cpNameLen,        // IN: length of the cpName
-                 size_t availableSpace,   // IN: space available for HgfsFileName
-                 size_t *nameSize,        // OUT: space consumed by HgfsFileName
-                 HgfsFileName *fileName)  // OUT: structure to pack cpName into
-{
-   if (availableSpace < offsetof(HgfsFileName, name) + cpNameLen) {
-      return FALSE;
-   }
-   fileName->length = cpNameLen;
-   memcpy(fileName->name, cpName, cpNameLen);
-   *nameSize = offsetof(HgfsFileName, name) + cpNameLen;
-   return TRUE;
-}
-
-
 /*
  *-----------------------------------------------------------------------------
  *
@@ -6047,29 +6245,20 @@ HgfsPackChangeNotifyEventV4(uint32 mask,              // IN: event mask
    reply->nextOffset = 0;
    reply->mask = mask;
    if (NULL != fileName) {
-      char *cpFullName;
       size_t remainingSize;
-      size_t hgfsNameSize;
       int cpFullNameSize;
 
-      cpFullNameSize = HgfsBuildCPName(shareName, fileName, &cpFullName);
+      remainingSize = bufferSize - offsetof(HgfsNotifyEventV4, fileName) -
+                      offsetof(HgfsFileName, name);
+      cpFullNameSize = HgfsBuildCPName(shareName, fileName, remainingSize,
+                                       reply->fileName.name);
       if (cpFullNameSize < 0) {
-         /* Could not build the crossplatform name, drop the event. */
-         goto exit;
-      }
-      remainingSize = bufferSize - offsetof(HgfsNotifyEventV4, fileName);
-      if (!HgfsPackHgfsName(cpFullName,
-                            cpFullNameSize,
-                            remainingSize,
-                            &hgfsNameSize,
-                            &reply->fileName)) {
-         /* Name would not fit, drop the event. */
-         free(cpFullName);
+         /* Could not build the crossplatform name or it would not fit, drop the event. */
          goto exit;
       }
-      remainingSize -= hgfsNameSize;
-      totalLength = bufferSize - remainingSize;
-      free(cpFullName);
+      reply->fileName.length = cpFullNameSize;
+      totalLength = offsetof(HgfsNotifyEventV4, fileName) +
+                    offsetof(HgfsFileName, name) + cpFullNameSize;
    } else {
       reply->fileName.length = 0;
       totalLength = sizeof *reply;
@@ -6224,3 +6413,189 @@ HgfsPackChangeNotificationRequest(void *packet,                    // IN/OUT: Hg
 exit:
    return result;
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCompoundRequest --
+ *
+ *    Unpack hgfs compound request and validate that the member entries it
+ *    announces are all contained in the request.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE on failure.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCompoundRequest(const void *packet,         // IN: HGFS packet
+                          size_t packetSize,          // IN: request packet size
+                          HgfsOp op,                  // IN: requested operation
+                          uint32 *flags,              // OUT: compound flags
+                          uint32 *numRequests,        // OUT: number of members
+                          const char **entries,       // OUT: first member entry
+                          size_t *entriesSize)        // OUT: size of all entries
+{
+   const HgfsRequestCompoundV4 *requestV4 = packet;
+   const char *entry;
+   size_t remaining;
+   uint32 i;
+
+   ASSERT(packet);
+   ASSERT(flags);
+   ASSERT(numRequests);
+   ASSERT(entries);
+   ASSERT(entriesSize);
+
+   if (HGFS_OP_COMPOUND_V4 != op || packetSize < sizeof *requestV4) {
+      LOG(4, "%s: Error decoding HGFS packet\n", __FUNCTION__);
+      return FALSE;
+   }
+
+   if (requestV4->numRequests == 0 ||
+       requestV4->numRequests > HGFS_COMPOUND_MAX_REQUESTS) {
+      LOG(4, "%s: Invalid number of requests %u\n", __FUNCTION__,
+          requestV4->numRequests);
+      return FALSE;
+   }
+
+   entry = (const char *)(requestV4 + 1);
+   remaining = packetSize - sizeof *requestV4;
+   for (i = 0; i < requestV4->numRequests; i++) {
+      const HgfsCompoundEntryV4 *entryV4 = (const HgfsCompoundEntryV4 *)entry;
+
+      if (remaining < sizeof *entryV4 ||
+          remaining - sizeof *entryV4 < entryV4->size ||
+          entryV4->size < sizeof (HgfsHeader)) {
+         LOG(4, "%s: Malformed entry %u\n", __FUNCTION__, i);
+         return FALSE;
+      }
+      remaining -= sizeof *entryV4 + entryV4->size;
+      entry += sizeof *entryV4 + entryV4->size;
+   }
+
+   *flags = requestV4->flags;
+   *numRequests = requestV4->numRequests;
+   *entries = (const char *)(requestV4 + 1);
+   *entriesSize = packetSize - sizeof *requestV4 - remaining;
+
+   LOG(4, "%s: HGFS_OP_COMPOUND_V4 %u requests\n", __FUNCTION__, *numRequests);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCompoundSetHandle --
+ *
+ *    Substitute the handle a compound member request operates on, for
+ *    members flagged HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE.
+ *
+ * Results:
+ *    TRUE on success.
+ *    FALSE if the operation does not take a handle.
+ *
+ * Side effects:
+ *    The request payload is modified.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCompoundSetHandle(void *payload,        // IN/OUT: member request payload
+                            size_t payloadSize,   // IN: payload size
+                            HgfsOp op,            // IN: member operation
+                            HgfsHandle handle)    // IN: handle to use
+{
+   HgfsFileNameV3 *fileName;
+
+   switch (op) {
+   case HGFS_OP_READ_V3:
+   case HGFS_OP_WRITE_V3:
+   case HGFS_OP_CLOSE_V3:
+   case HGFS_OP_SEARCH_READ_V3:
+   case HGFS_OP_SEARCH_CLOSE_V3:
+      /* All of these requests start with the file or search handle. */
+      if (payloadSize < sizeof handle) {
+         return FALSE;
+      }
+      *(HgfsHandle *)payload = handle;
+      return TRUE;
+   case HGFS_OP_GETATTR_V3: {
+      HgfsRequestGetattrV3 *requestV3 = payload;
+
+      if (payloadSize < sizeof *requestV3) {
+         return FALSE;
+      }
+      fileName = &requestV3->fileName;
+      break;
+   }
+   case HGFS_OP_SETATTR_V3: {
+      HgfsRequestSetattrV3 *requestV3 = payload;
+
+      if (payloadSize < sizeof *requestV3) {
+         return FALSE;
+      }
+      fileName = &requestV3->fileName;
+      break;
+   }
+   default:
+      LOG(4, "%s: op %u does not take a handle\n", __FUNCTION__, op);
+      return FALSE;
+   }
+
+   fileName->flags |= HGFS_FILE_NAME_USE_FILE_DESC;
+   fileName->fid = handle;
+   fileName->length = 0;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsUnpackCompoundReplyHandle --
+ *
+ *    Extract the handle returned by a successful compound member open or
+ *    search open.
+ *
+ * Results:
+ *    TRUE if the member returned a handle.
+ *    FALSE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsUnpackCompoundReplyHandle(const void *payload,   // IN: member reply payload
+                              size_t payloadSize,    // IN: payload size
+                              HgfsOp op,             // IN: member operation
+                              HgfsHandle *handle)    // OUT: returned handle
+{
+   switch (op) {
+   case HGFS_OP_OPEN_V3:
+      if (payloadSize < sizeof (HgfsReplyOpenV3)) {
+         return FALSE;
+      }
+      *handle = ((const HgfsReplyOpenV3 *)payload)->file;
+      return TRUE;
+   case HGFS_OP_SEARCH_OPEN_V3:
+      if (payloadSize < sizeof (HgfsReplySearchOpenV3)) {
+         return FALSE;
+      }
+      *handle = ((const HgfsReplySearchOpenV3 *)payload)->search;
+      return TRUE;
+   default:
+      return FALSE;
+   }
+}
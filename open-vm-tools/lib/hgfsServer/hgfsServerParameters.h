@@ -350,6 +350,67 @@ HgfsPackChangeNotificationRequest(void *packet,                    // IN/OUT: Hg
                                   uint32 notifyFlags,              // IN: notify flags
                                   HgfsSessionInfo *session,        // IN: session
                                   size_t *bufferSize);             // IN/OUT: packet size
+Bool
+HgfsUnpackServerLockChangeRequest(const void *packet,       // IN: HGFS packet
+                                  size_t packetSize,        // IN: request packet size
+                                  HgfsOp op,                // IN: request type
+                                  HgfsHandle *file,         // OUT: file to change
+                                  HgfsLockType *serverLock);// OUT: lock wanted
+Bool
+HgfsPackServerLockChangeReply(HgfsPacket *packet,         // IN/OUT: Hgfs Packet
+                              const void *packetHeader,   // IN: packet header
+                              HgfsOp op,                  // IN: request type
+                              HgfsLockType serverLock,    // IN: lock held
+                              size_t *payloadSize,        // OUT: size of packet
+                              HgfsSessionInfo *session);  // IN: Session info
+Bool
+HgfsUnpackCopyFileRangeRequest(const void *packet,   // IN: HGFS packet
+                               size_t packetSize,    // IN: request packet size
+                               HgfsOp op,            // IN: request type
+                               HgfsHandle *srcFile,  // OUT: file to copy from
+                               uint64 *srcOffset,    // OUT: offset to copy from
+                               HgfsHandle *dstFile,  // OUT: file to copy to
+                               uint64 *dstOffset,    // OUT: offset to copy to
+                               uint64 *length);      // OUT: bytes to copy
+Bool
+HgfsPackCopyFileRangeReply(HgfsPacket *packet,         // IN/OUT: Hgfs Packet
+                           const void *packetHeader,   // IN: packet header
+                           HgfsOp op,                  // IN: request type
+                           uint64 actualSize,          // IN: bytes copied
+                           size_t *payloadSize,        // OUT: size of packet
+                           HgfsSessionInfo *session);  // IN: Session info
+size_t
+HgfsPackGetOplockBreakSize(void);
+Bool
+HgfsPackOplockBreakRequest(void *packet,                    // IN/OUT: Hgfs Packet
+                           HgfsHandle fileId,               // IN: file ID
+                           HgfsLockType serverLock,         // IN: lock type
+                           uint64 sessionId,                // IN: session ID
+                           size_t *bufferSize);             // IN/OUT: size of packet
+Bool
+HgfsUnpackOplockBreakAckReply(const void *packet,            // IN: HGFS packet
+                              size_t packetSize,             // IN: reply packet size
+                              HgfsOp op,                     // IN: operation version
+                              HgfsHandle *fileId,            // OUT: file Id to remove
+                              HgfsLockType *serverLock);     // OUT: lock type
+Bool
+HgfsUnpackCompoundRequest(const void *packet,         // IN: HGFS packet
+                          size_t packetSize,          // IN: request packet size
+                          HgfsOp op,                  // IN: requested operation
+                          uint32 *flags,              // OUT: compound flags
+                          uint32 *numRequests,        // OUT: number of members
+                          const char **entries,       // OUT: first member entry
+                          size_t *entriesSize);       // OUT: size of all entries
+Bool
+HgfsUnpackCompoundSetHandle(void *payload,        // IN/OUT: member request payload
+                            size_t payloadSize,   // IN: payload size
+                            HgfsOp op,            // IN: member operation
+                            HgfsHandle handle);   // IN: handle to use
+Bool
+HgfsUnpackCompoundReplyHandle(const void *payload,   // IN: member reply payload
+                              size_t payloadSize,    // IN: payload size
+                              HgfsOp op,             // IN: member operation
+                              HgfsHandle *handle);   // OUT: returned handle
 
 
 #endif // ifndef _HGFS_SERVER_PARAMETERS_H_
@@ -0,0 +1,348 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsServerStats.c --
+ *
+ *	Per-opcode request counters and latency histograms for the HGFS
+ *	server.
+ *
+ *	All counters are updated with atomics so that the synchronous path
+ *	and the threadpool workers can record without taking a lock. Readers
+ *	get a snapshot that may be slightly inconsistent across counters,
+ *	which is fine for diagnostics. Nothing is recorded unless statistics
+ *	were enabled, see HgfsServerStats_Now.
+ */
+
+#include <string.h>
+
+#include "vmware.h"
+#include "vm_atomic.h"
+#include "vm_basic_asm.h"
+#include "strutil.h"
+
+#include "hgfsServerInt.h"
+#include "hgfsServerStats.h"
+
+typedef struct HgfsStatsHistogram {
+   Atomic_uint64 samples;
+   Atomic_uint64 totalUs;
+   Atomic_uint32 buckets[HGFS_STATS_NUM_BUCKETS];
+} HgfsStatsHistogram;
+
+typedef struct HgfsStatsOp {
+   Atomic_uint64 replies;
+   Atomic_uint64 errors;
+   HgfsStatsHistogram phases[HGFS_STATS_PHASE_MAX];
+} HgfsStatsOp;
+
+static const char *const gHgfsStatsPhaseNames[HGFS_STATS_PHASE_MAX] = {
+   "queue",
+   "parse",
+   "process",
+   "send",
+};
+
+Bool gHgfsServerStatsEnabled = FALSE;
+static HgfsStatsOp gHgfsStatsOps[HGFS_OP_MAX];
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_Enable --
+ *
+ *    Turn recording on or off. Counters collected so far are kept.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerStats_Enable(Bool enable)  // IN: TRUE to start recording
+{
+   gHgfsServerStatsEnabled = enable;
+   LOG(4, "%s: statistics %s\n", __FUNCTION__, enable ? "enabled" : "disabled");
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_Reset --
+ *
+ *    Zero all counters and histograms.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Requests in flight may still add to the freshly zeroed counters.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerStats_Reset(void)
+{
+   unsigned int op;
+
+   for (op = 0; op < ARRAYSIZE(gHgfsStatsOps); op++) {
+      HgfsStatsOp *opStats = &gHgfsStatsOps[op];
+      unsigned int phase;
+
+      Atomic_Write64(&opStats->replies, 0);
+      Atomic_Write64(&opStats->errors, 0);
+      for (phase = 0; phase < HGFS_STATS_PHASE_MAX; phase++) {
+         HgfsStatsHistogram *hist = &opStats->phases[phase];
+         unsigned int i;
+
+         Atomic_Write64(&hist->samples, 0);
+         Atomic_Write64(&hist->totalUs, 0);
+         for (i = 0; i < ARRAYSIZE(hist->buckets); i++) {
+            Atomic_Write32(&hist->buckets[i], 0);
+         }
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_RecordPhase --
+ *
+ *    Add one sample to the histogram of the given phase of an opcode. The
+ *    timestamps come from HgfsServerStats_Now and a zero start means the
+ *    phase began while statistics were disabled.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerStats_RecordPhase(HgfsOp op,              // IN: request opcode
+                            HgfsStatsPhase phase,   // IN: timed phase
+                            VmTimeType start,       // IN: phase start (us)
+                            VmTimeType end)         // IN: phase end (us)
+{
+   HgfsStatsHistogram *hist;
+   uint64 elapsed;
+   int bucket;
+
+   if (start == 0 || end < start ||
+       (unsigned int)op >= ARRAYSIZE(gHgfsStatsOps)) {
+      return;
+   }
+
+   ASSERT(phase < HGFS_STATS_PHASE_MAX);
+   hist = &gHgfsStatsOps[op].phases[phase];
+   elapsed = end - start;
+   bucket = MIN(mssb64_0(elapsed) + 1, HGFS_STATS_NUM_BUCKETS - 1);
+
+   Atomic_Inc64(&hist->samples);
+   Atomic_Add64(&hist->totalUs, elapsed);
+   Atomic_Inc32(&hist->buckets[bucket]);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_RecordReply --
+ *
+ *    Count a reply sent for an opcode and whether it carried an error.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerStats_RecordReply(HgfsOp op,                   // IN: request opcode
+                            HgfsInternalStatus status)   // IN: reply status
+{
+   HgfsStatsOp *opStats;
+
+   if ((unsigned int)op >= ARRAYSIZE(gHgfsStatsOps)) {
+      return;
+   }
+
+   opStats = &gHgfsStatsOps[op];
+   Atomic_Inc64(&opStats->replies);
+   if (status != HGFS_ERROR_SUCCESS) {
+      Atomic_Inc64(&opStats->errors);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStatsPercentile --
+ *
+ *    Estimate a percentile from a histogram snapshot.
+ *
+ * Results:
+ *    Upper bound in microseconds of the bucket holding the percentile.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint64
+HgfsServerStatsPercentile(const uint32 *buckets,   // IN: histogram snapshot
+                          uint64 samples,          // IN: sum of the buckets
+                          unsigned int percent)    // IN: percentile wanted
+{
+   uint64 wanted = (samples * percent + 99) / 100;
+   uint64 seen = 0;
+   unsigned int i;
+
+   for (i = 0; i < HGFS_STATS_NUM_BUCKETS; i++) {
+      seen += buckets[i];
+      if (seen >= wanted) {
+         break;
+      }
+   }
+
+   return CONST64U(1) << MIN(i, HGFS_STATS_NUM_BUCKETS - 1);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_Format --
+ *
+ *    Render the statistics of every opcode that saw traffic as text, one
+ *    "op" line per opcode followed by one line per timed phase:
+ *
+ *      op 42 replies 100 errors 0
+ *        process samples 100 avg_us 12 p50_us 16 p99_us 64 hist 0 0 3 ...
+ *
+ *    The histogram lists buckets up to the last non-empty one.
+ *
+ * Results:
+ *    Allocated string, the caller must free it.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+HgfsServerStats_Format(void)
+{
+   char *result = NULL;
+   unsigned int op;
+
+   StrUtil_SafeStrcatF(&result, "enabled %d\n", gHgfsServerStatsEnabled);
+
+   for (op = 0; op < ARRAYSIZE(gHgfsStatsOps); op++) {
+      HgfsStatsOp *opStats = &gHgfsStatsOps[op];
+      uint64 replies = Atomic_Read64(&opStats->replies);
+      unsigned int phase;
+
+      if (replies == 0) {
+         continue;
+      }
+
+      StrUtil_SafeStrcatF(&result, "op %u replies %"FMT64"u errors %"FMT64"u\n",
+                          op, replies, Atomic_Read64(&opStats->errors));
+
+      for (phase = 0; phase < HGFS_STATS_PHASE_MAX; phase++) {
+         HgfsStatsHistogram *hist = &opStats->phases[phase];
+         uint32 buckets[HGFS_STATS_NUM_BUCKETS];
+         uint64 samples = 0;
+         unsigned int last = 0;
+         unsigned int i;
+
+         for (i = 0; i < ARRAYSIZE(buckets); i++) {
+            buckets[i] = Atomic_Read32(&hist->buckets[i]);
+            samples += buckets[i];
+            if (buckets[i] != 0) {
+               last = i;
+            }
+         }
+         if (samples == 0) {
+            continue;
+         }
+
+         StrUtil_SafeStrcatF(&result,
+                             "  %s samples %"FMT64"u avg_us %"FMT64"u "
+                             "p50_us %"FMT64"u p99_us %"FMT64"u hist",
+                             gHgfsStatsPhaseNames[phase], samples,
+                             Atomic_Read64(&hist->totalUs) / samples,
+                             HgfsServerStatsPercentile(buckets, samples, 50),
+                             HgfsServerStatsPercentile(buckets, samples, 99));
+         for (i = 0; i <= last; i++) {
+            StrUtil_SafeStrcatF(&result, " %u", buckets[i]);
+         }
+         StrUtil_SafeStrcatF(&result, "\n");
+      }
+   }
+
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_Log --
+ *
+ *    Write the statistics to the log, for debugging alongside
+ *    HgfsDumpAllNodes.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsServerStats_Log(void)
+{
+   char *stats = HgfsServerStats_Format();
+
+   Log("Dumping server statistics\n");
+   Log("%s", stats);
+   Log("Done\n");
+   free(stats);
+}
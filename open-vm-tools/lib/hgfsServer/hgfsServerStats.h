@@ -0,0 +1,94 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+#ifndef _HGFS_SERVER_STATS_H
+#define _HGFS_SERVER_STATS_H
+
+/*
+ * hgfsServerStats.h --
+ *
+ *	Per-opcode request counters and latency histograms.
+ */
+
+#include "vm_basic_types.h"
+#include "hostinfo.h"
+#include "hgfsProto.h"      // for HgfsOp
+#include "hgfsUtil.h"       // for HgfsInternalStatus
+
+/*
+ * Phases of a request that are timed separately.
+ *
+ * QUEUE   - from the end of parsing until a handler starts running it
+ *           (non-zero only for requests handed to the threadpool).
+ * PARSE   - header validation and session lookup.
+ * PROCESS - the opcode handler, including the platform calls it makes.
+ * SEND    - handing the reply to the transport.
+ */
+typedef enum {
+   HGFS_STATS_PHASE_QUEUE,
+   HGFS_STATS_PHASE_PARSE,
+   HGFS_STATS_PHASE_PROCESS,
+   HGFS_STATS_PHASE_SEND,
+   HGFS_STATS_PHASE_MAX
+} HgfsStatsPhase;
+
+/*
+ * Histogram bucket i counts samples in [2^(i-1), 2^i) microseconds, bucket 0
+ * counts samples under 1us and the last bucket everything from ~8s up.
+ */
+#define HGFS_STATS_NUM_BUCKETS 24
+
+extern Bool gHgfsServerStatsEnabled;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerStats_Now --
+ *
+ *    Timestamp for a phase boundary.
+ *
+ * Results:
+ *    Current time in microseconds, or 0 if statistics are disabled. Callers
+ *    treat a zero timestamp as "not timed" so that disabled statistics cost a
+ *    single load and branch per phase.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE VmTimeType
+HgfsServerStats_Now(void)
+{
+   return gHgfsServerStatsEnabled ? Hostinfo_SystemTimerUS() : 0;
+}
+
+void HgfsServerStats_Enable(Bool enable);
+void HgfsServerStats_Reset(void);
+void HgfsServerStats_RecordPhase(HgfsOp op,
+                                 HgfsStatsPhase phase,
+                                 VmTimeType start,
+                                 VmTimeType end);
+void HgfsServerStats_RecordReply(HgfsOp op,
+                                 HgfsInternalStatus status);
+char *HgfsServerStats_Format(void);
+void HgfsServerStats_Log(void);
+
+#endif // _HGFS_SERVER_STATS_H
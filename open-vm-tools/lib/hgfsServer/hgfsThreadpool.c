@@ -0,0 +1,912 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsThreadpool.c --
+ *
+ *	Worker threadpool for the HGFS server on POSIX guests.
+ *
+ *	The pool owns a fixed set of worker threads, which pick the next work
+ *	item from a scheduler instead of running items in arrival order, so
+ *	that one session streaming a large file does not starve the others:
+ *
+ *	- Items are queued per flow, the pair of a session and a share. Flows
+ *	  are served by deficit round robin: each turn a flow earns a quantum
+ *	  of bytes scaled by the weight of its share, and runs items while
+ *	  their cost, the bytes they move, is covered.
+ *	- Unordered items that move no data skip the flows and run first, up
+ *	  to a burst so that they cannot hold the flows off.
+ *	- A share may be capped to a number of bytes per second. Its flows are
+ *	  not served while the share is over its budget.
+ *	- Ordered items with the same key (e.g. reads and writes on one handle)
+ *	  belong to one flow. An item is not started while an item with its
+ *	  key runs, and the items of a flow with one key start in order.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "vm_basic_types.h"
+#include "util.h"
+#include "userlock.h"
+#include "mutexRankLib.h"
+#include "dbllnklst.h"
+#include "hostinfo.h"
+
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsThreadpool.h"
+
+/* Bytes a flow of weight 1 earns per turn. */
+#define HGFS_THREADPOOL_QUANTUM         (64 * 1024)
+/* Largest cost charged for one item, bounds the turns it waits for. */
+#define HGFS_THREADPOOL_MAX_COST        (4 * 1024 * 1024)
+#define HGFS_THREADPOOL_MAX_WEIGHT      64
+/* Items run ahead of the flows in a row, while the flows have work. */
+#define HGFS_THREADPOOL_PRIORITY_BURST  8
+
+
+typedef struct HgfsThreadpoolFlow {
+   DblLnkLst_Links links;        /* On the ring of flows with queued items. */
+   uint64 sessionId;
+   uint32 shareId;
+   int64 deficit;                /* Bytes the flow may still move this turn. */
+   DblLnkLst_Links queue;        /* Its items, in submission order. */
+} HgfsThreadpoolFlow;
+
+typedef struct HgfsThreadpoolItem {
+   DblLnkLst_Links links;
+   HgfsThreadpoolWorkItem workItem;
+   void *data;
+   HgfsThreadpoolFlow *flow;     /* NULL if on the priority queue. */
+   uint32 cost;
+   Bool ordered;
+   uint32 orderKey;
+} HgfsThreadpoolItem;
+
+typedef struct HgfsThreadpoolShare {
+   DblLnkLst_Links links;
+   uint32 shareId;
+   uint32 weight;
+   uint64 bytesPerSec;           /* 0 if not capped. */
+   int64 tokens;                 /* Bytes that can be moved, < 0 if over. */
+   VmTimeType refillTime;        /* When tokens were last refilled, in us. */
+} HgfsThreadpoolShare;
+
+typedef struct HgfsThreadpoolWorker {
+   pthread_t thread;
+   uint32 index;
+   Bool running;                 /* The worker is executing an item. */
+   Bool ordered;                 /* The item is ordered on orderKey. */
+   uint32 orderKey;
+} HgfsThreadpoolWorker;
+
+typedef struct HgfsThreadpoolState {
+   MXUserExclLock *lock;              /* Protects everything below. */
+   MXUserCondVar *workAvailable;      /* Signalled when items are queued. */
+   MXUserCondVar *queueDrained;       /* Signalled when a worker goes idle. */
+   DblLnkLst_Links priorityQueue;     /* Items run ahead of the flows. */
+   uint32 priorityRun;                /* Such items run in a row. */
+   DblLnkLst_Links flows;             /* Flows with queued items. */
+   uint32 numFlows;
+   DblLnkLst_Links shares;            /* Shares with a weight or a cap. */
+   HgfsThreadpoolWorker workers[HGFS_THREADPOOL_MAX_COUNT];
+   uint32 numWorkers;
+   uint32 numRunning;                 /* Workers currently executing an item. */
+   uint32 numPending;                 /* Items queued but not yet started. */
+   Bool active;                       /* Workers are started and accept work. */
+   Bool stopping;                     /* Workers should exit when drained. */
+} HgfsThreadpoolState;
+
+static HgfsThreadpoolState *gHgfsThreadpool = NULL;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolFindShare --
+ *
+ *    Find the settings of a share. Called with the pool lock held.
+ *
+ * Results:
+ *    The share, NULL if it has the default weight and no cap.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsThreadpoolShare *
+HgfsThreadpoolFindShare(uint32 shareId)  // IN: share
+{
+   DblLnkLst_Links *link;
+
+   DblLnkLst_ForEach(link, &gHgfsThreadpool->shares) {
+      HgfsThreadpoolShare *share =
+         DblLnkLst_Container(link, HgfsThreadpoolShare, links);
+
+      if (share->shareId == shareId) {
+         return share;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolShareWait --
+ *
+ *    Check whether a capped share may move data now. Refills its budget for
+ *    the time elapsed, up to one second worth. While the pool is stopping
+ *    caps are not enforced, so that draining is not delayed.
+ *
+ *    Called with the pool lock held.
+ *
+ * Results:
+ *    0 if the share may move data, else the milliseconds until it may.
+ *
+ * Side effects:
+ *    Updates the budget of the share.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsThreadpoolShareWait(HgfsThreadpoolShare *share)  // IN/OUT: share
+{
+   VmTimeType now;
+
+   if (NULL == share || 0 == share->bytesPerSec || !gHgfsThreadpool->active) {
+      return 0;
+   }
+
+   now = Hostinfo_SystemTimerUS();
+   if (now > share->refillTime) {
+      VmTimeType elapsed = MIN(now - share->refillTime, 1000000);
+
+      share->tokens += elapsed * share->bytesPerSec / 1000000;
+      share->tokens = MIN(share->tokens, (int64)share->bytesPerSec);
+   }
+   share->refillTime = now;
+
+   if (share->tokens >= 0) {
+      return 0;
+   }
+   return (uint32)(-share->tokens * 1000 / share->bytesPerSec) + 1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolKeyBusy --
+ *
+ *    Check whether an item ordered on a key is running. Called with the
+ *    pool lock held.
+ *
+ * Results:
+ *    TRUE if so.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsThreadpoolKeyBusy(uint32 orderKey)  // IN: key
+{
+   uint32 i;
+
+   for (i = 0; i < gHgfsThreadpool->numWorkers; i++) {
+      const HgfsThreadpoolWorker *worker = &gHgfsThreadpool->workers[i];
+
+      if (worker->running && worker->ordered && worker->orderKey == orderKey) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolFlowNext --
+ *
+ *    Find the first item of a flow that can start. The items before it are
+ *    ordered on keys that are running, so it does not pass an item with its
+ *    own key. Called with the pool lock held.
+ *
+ * Results:
+ *    The item, NULL if every item of the flow must wait.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsThreadpoolItem *
+HgfsThreadpoolFlowNext(HgfsThreadpoolFlow *flow)  // IN: flow
+{
+   DblLnkLst_Links *link;
+
+   DblLnkLst_ForEach(link, &flow->queue) {
+      HgfsThreadpoolItem *item =
+         DblLnkLst_Container(link, HgfsThreadpoolItem, links);
+
+      if (!item->ordered || !HgfsThreadpoolKeyBusy(item->orderKey)) {
+         return item;
+      }
+   }
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolDequeue --
+ *
+ *    Pick the next item to run: an item of the priority queue, unless a
+ *    burst of them ran while the flows had work, else an item of the flow
+ *    at the head of the ring, if its deficit covers it. A flow whose item
+ *    is not covered earns a quantum and goes to the tail of the ring, so
+ *    every item is eventually covered.
+ *
+ *    Called with the pool lock held.
+ *
+ * Results:
+ *    The item to execute, NULL if nothing can run now. In that case
+ *    waitMsec is the time until a capped share may move data, or 0 if
+ *    the worker should wait for new items.
+ *
+ * Side effects:
+ *    The item is unlinked from its queue, empty flows are freed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsThreadpoolItem *
+HgfsThreadpoolDequeue(uint32 *waitMsec)  // OUT: time to wait
+{
+   HgfsThreadpoolState *pool = gHgfsThreadpool;
+   HgfsThreadpoolItem *item = NULL;
+   Bool covered = FALSE;
+
+   *waitMsec = 0;
+
+   if (DblLnkLst_IsLinked(&pool->priorityQueue) &&
+       (pool->priorityRun < HGFS_THREADPOOL_PRIORITY_BURST ||
+        0 == pool->numFlows)) {
+      pool->priorityRun++;
+      item = DblLnkLst_Container(pool->priorityQueue.next,
+                                 HgfsThreadpoolItem, links);
+      goto found;
+   }
+
+   /* Each round either runs an item or adds a quantum to an eligible flow. */
+   while (!covered) {
+      Bool eligible = FALSE;
+      uint32 i;
+
+      for (i = 0; i < pool->numFlows; i++) {
+         HgfsThreadpoolFlow *flow =
+            DblLnkLst_Container(pool->flows.next, HgfsThreadpoolFlow, links);
+         HgfsThreadpoolShare *share = HgfsThreadpoolFindShare(flow->shareId);
+         HgfsThreadpoolItem *next = HgfsThreadpoolFlowNext(flow);
+         uint32 shareWait = 0;
+
+         if (NULL != next && 0 != next->cost) {
+            shareWait = HgfsThreadpoolShareWait(share);
+         }
+         if (NULL == next || 0 != shareWait) {
+            if (0 != shareWait && (0 == *waitMsec || shareWait < *waitMsec)) {
+               *waitMsec = shareWait;
+            }
+         } else if (next->cost <= flow->deficit) {
+            flow->deficit -= next->cost;
+            if (NULL != share && 0 != share->bytesPerSec) {
+               share->tokens -= next->cost;
+            }
+            item = next;
+            covered = TRUE;
+            break;
+         } else {
+            flow->deficit += HGFS_THREADPOOL_QUANTUM *
+                             (NULL != share ? share->weight : 1);
+            eligible = TRUE;
+         }
+
+         /* Next flow's turn. */
+         DblLnkLst_Unlink1(&flow->links);
+         DblLnkLst_LinkLast(&pool->flows, &flow->links);
+      }
+
+      if (!covered && !eligible) {
+         break;
+      }
+   }
+
+   if (NULL == item) {
+      if (!DblLnkLst_IsLinked(&pool->priorityQueue)) {
+         return NULL;
+      }
+      /* Nothing else can run, the burst does not matter. */
+      item = DblLnkLst_Container(pool->priorityQueue.next,
+                                 HgfsThreadpoolItem, links);
+   }
+   pool->priorityRun = 0;
+
+found:
+   DblLnkLst_Unlink1(&item->links);
+   pool->numPending--;
+   *waitMsec = 0;
+
+   if (NULL != item->flow && !DblLnkLst_IsLinked(&item->flow->queue)) {
+      DblLnkLst_Unlink1(&item->flow->links);
+      pool->numFlows--;
+      free(item->flow);
+   }
+   item->flow = NULL;
+
+   return item;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolWorkerMain --
+ *
+ *    Worker thread body. Executes queued items until the pool is stopped
+ *    and every queue is empty.
+ *
+ * Results:
+ *    Always NULL.
+ *
+ * Side effects:
+ *    Runs work items.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void *
+HgfsThreadpoolWorkerMain(void *clientData)  // IN: worker
+{
+   HgfsThreadpoolWorker *worker = clientData;
+
+   MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+
+   for (;;) {
+      uint32 waitMsec;
+      HgfsThreadpoolItem *item = HgfsThreadpoolDequeue(&waitMsec);
+      Bool ordered;
+
+      if (NULL == item) {
+         if (gHgfsThreadpool->stopping) {
+            break;
+         }
+         if (0 != waitMsec) {
+            MXUser_TimedWaitCondVarExclLock(gHgfsThreadpool->lock,
+                                            gHgfsThreadpool->workAvailable,
+                                            waitMsec);
+         } else {
+            MXUser_WaitCondVarExclLock(gHgfsThreadpool->lock,
+                                       gHgfsThreadpool->workAvailable);
+         }
+         continue;
+      }
+
+      worker->running = TRUE;
+      worker->ordered = ordered = item->ordered;
+      worker->orderKey = item->orderKey;
+      gHgfsThreadpool->numRunning++;
+      MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+
+      item->workItem(item->data);
+      free(item);
+
+      MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+      worker->running = FALSE;
+      gHgfsThreadpool->numRunning--;
+      if (ordered && 0 != gHgfsThreadpool->numPending) {
+         /* Items waiting for this key can start now. */
+         MXUser_BroadcastCondVar(gHgfsThreadpool->workAvailable);
+      }
+      if (0 == gHgfsThreadpool->numRunning &&
+          0 == gHgfsThreadpool->numPending) {
+         MXUser_BroadcastCondVar(gHgfsThreadpool->queueDrained);
+      }
+   }
+
+   MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+   LOG(8, "%s: worker %u exiting\n", __FUNCTION__, worker->index);
+
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolStopWorkers --
+ *
+ *    Wait for every queued item to complete and then join all the workers.
+ *
+ *    Called with the pool lock held, returns with it held.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The pool no longer accepts work.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsThreadpoolStopWorkers(void)
+{
+   uint32 i;
+
+   if (!gHgfsThreadpool->active) {
+      return;
+   }
+
+   /*
+    * Stop accepting new items and let the workers finish the backlog.
+    * Workers waiting for a capped share stop waiting.
+    */
+   gHgfsThreadpool->active = FALSE;
+   MXUser_BroadcastCondVar(gHgfsThreadpool->workAvailable);
+   while (0 != gHgfsThreadpool->numPending ||
+          0 != gHgfsThreadpool->numRunning) {
+      MXUser_WaitCondVarExclLock(gHgfsThreadpool->lock,
+                                 gHgfsThreadpool->queueDrained);
+   }
+
+   gHgfsThreadpool->stopping = TRUE;
+   MXUser_BroadcastCondVar(gHgfsThreadpool->workAvailable);
+   MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+
+   for (i = 0; i < gHgfsThreadpool->numWorkers; i++) {
+      pthread_join(gHgfsThreadpool->workers[i].thread, NULL);
+   }
+
+   MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+   gHgfsThreadpool->numWorkers = 0;
+   gHgfsThreadpool->stopping = FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Init --
+ *
+ *    Initialization of the threadpool component.
+ *
+ * Results:
+ *    0 if success, error code otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+HgfsInternalStatus
+HgfsThreadpool_Init(void)
+{
+   ASSERT(NULL == gHgfsThreadpool);
+
+   gHgfsThreadpool = Util_SafeCalloc(1, sizeof *gHgfsThreadpool);
+   gHgfsThreadpool->lock = MXUser_CreateExclLock("HgfsThreadpoolLock",
+                                                 RANK_hgfsThreadpoolLock);
+   gHgfsThreadpool->workAvailable =
+      MXUser_CreateCondVarExclLock(gHgfsThreadpool->lock);
+   gHgfsThreadpool->queueDrained =
+      MXUser_CreateCondVarExclLock(gHgfsThreadpool->lock);
+   DblLnkLst_Init(&gHgfsThreadpool->priorityQueue);
+   DblLnkLst_Init(&gHgfsThreadpool->flows);
+   DblLnkLst_Init(&gHgfsThreadpool->shares);
+
+   return HGFS_ERROR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Activate --
+ *
+ *    Activate the threadpool, starting the workers if they are not running.
+ *    The worker count follows the number of online CPUs, bounded by
+ *    HGFS_THREADPOOL_MAX_COUNT.
+ *
+ * Results:
+ *    TRUE if the pool is running, FALSE if no worker could be started.
+ *
+ * Side effects:
+ *    Creates threads.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsThreadpool_Activate(void)
+{
+   long numCpus;
+   uint32 numWorkers;
+   uint32 i;
+   Bool result;
+
+   ASSERT(NULL != gHgfsThreadpool);
+
+   MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+
+   if (gHgfsThreadpool->active) {
+      MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+      return TRUE;
+   }
+
+   /* Activation and deactivation are serialized by the server. */
+   ASSERT(!gHgfsThreadpool->stopping);
+
+   numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+   numWorkers = numCpus > 0 ? 2 * (uint32)numCpus : 2;
+   numWorkers = MIN(numWorkers, HGFS_THREADPOOL_MAX_COUNT);
+
+   for (i = 0; i < numWorkers; i++) {
+      HgfsThreadpoolWorker *worker = &gHgfsThreadpool->workers[i];
+
+      worker->index = i;
+      worker->running = FALSE;
+      if (pthread_create(&worker->thread, NULL,
+                         HgfsThreadpoolWorkerMain, worker) != 0) {
+         Log("%s: failed to create worker %u\n", __FUNCTION__, i);
+         break;
+      }
+      gHgfsThreadpool->numWorkers++;
+   }
+
+   result = gHgfsThreadpool->numWorkers > 0;
+   if (result) {
+      gHgfsThreadpool->active = TRUE;
+      LOG(4, "%s: started %u workers\n", __FUNCTION__,
+          gHgfsThreadpool->numWorkers);
+   }
+
+   MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+
+   return result;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Deactivate --
+ *
+ *    Deactivate the threadpool. All queued work items are completed before
+ *    the workers are stopped. Until the pool is activated again
+ *    HgfsThreadpool_QueueWorkItem fails and callers run items inline.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Joins the worker threads.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsThreadpool_Deactivate(void)
+{
+   if (NULL == gHgfsThreadpool) {
+      return;
+   }
+
+   MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+   HgfsThreadpoolStopWorkers();
+   MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_Exit --
+ *
+ *    Exit for the threadpool component.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+HgfsThreadpool_Exit(void)
+{
+   DblLnkLst_Links *link;
+   DblLnkLst_Links *next;
+
+   if (NULL == gHgfsThreadpool) {
+      return;
+   }
+
+   HgfsThreadpool_Deactivate();
+
+   ASSERT(0 == gHgfsThreadpool->numFlows);
+   DblLnkLst_ForEachSafe(link, next, &gHgfsThreadpool->shares) {
+      DblLnkLst_Unlink1(link);
+      free(DblLnkLst_Container(link, HgfsThreadpoolShare, links));
+   }
+
+   MXUser_DestroyCondVar(gHgfsThreadpool->queueDrained);
+   MXUser_DestroyCondVar(gHgfsThreadpool->workAvailable);
+   MXUser_DestroyExclLock(gHgfsThreadpool->lock);
+   free(gHgfsThreadpool);
+   gHgfsThreadpool = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpoolQueue --
+ *
+ *    Queue a work item on the priority queue if it is unordered and moves
+ *    no data, else on the queue of its flow, which is created if it has no
+ *    items yet.
+ *
+ * Results:
+ *    TRUE if the work item is queued successfully,
+ *    FALSE if the pool is not active.
+ *
+ * Side effects:
+ *    Wakes up a worker.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsThreadpoolQueue(HgfsThreadpoolWorkItem workItem,        // IN
+                    void *data,                             // IN
+                    const HgfsThreadpoolSchedInfo *sched)   // IN
+{
+   HgfsThreadpoolItem *item;
+   DblLnkLst_Links *link;
+
+   if (NULL == gHgfsThreadpool) {
+      return FALSE;
+   }
+
+   item = Util_SafeMalloc(sizeof *item);
+   DblLnkLst_Init(&item->links);
+   item->workItem = workItem;
+   item->data = data;
+   item->flow = NULL;
+   item->cost = MIN(sched->cost, HGFS_THREADPOOL_MAX_COST);
+   item->ordered = sched->ordered;
+   item->orderKey = sched->orderKey;
+
+   MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+
+   if (!gHgfsThreadpool->active) {
+      MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+      free(item);
+      return FALSE;
+   }
+
+   gHgfsThreadpool->numPending++;
+   if (!item->ordered && 0 == item->cost) {
+      DblLnkLst_LinkLast(&gHgfsThreadpool->priorityQueue, &item->links);
+   } else {
+      DblLnkLst_ForEach(link, &gHgfsThreadpool->flows) {
+         HgfsThreadpoolFlow *flow =
+            DblLnkLst_Container(link, HgfsThreadpoolFlow, links);
+
+         if (flow->sessionId == sched->sessionId &&
+             flow->shareId == sched->shareId) {
+            item->flow = flow;
+            break;
+         }
+      }
+      if (NULL == item->flow) {
+         item->flow = Util_SafeCalloc(1, sizeof *item->flow);
+         DblLnkLst_Init(&item->flow->links);
+         DblLnkLst_Init(&item->flow->queue);
+         item->flow->sessionId = sched->sessionId;
+         item->flow->shareId = sched->shareId;
+         DblLnkLst_LinkLast(&gHgfsThreadpool->flows, &item->flow->links);
+         gHgfsThreadpool->numFlows++;
+      }
+      DblLnkLst_LinkLast(&item->flow->queue, &item->links);
+   }
+   MXUser_SignalCondVar(gHgfsThreadpool->workAvailable);
+
+   MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_QueueWorkItem --
+ *
+ *    Queue a work item to be executed by any available worker, ahead of
+ *    the flows.
+ *
+ * Results:
+ *    TRUE if the work item is queued successfully,
+ *    FALSE if the work item is not queued.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsThreadpool_QueueWorkItem(HgfsThreadpoolWorkItem workItem, // IN
+                             void *data)                      // IN
+{
+   HgfsThreadpoolSchedInfo sched = { 0 };
+
+   return HgfsThreadpoolQueue(workItem, data, &sched);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_QueueScheduledWorkItem --
+ *
+ *    Queue a work item on the flow of its session and share. Ordered items
+ *    with the same key must be queued on the same flow.
+ *
+ * Results:
+ *    TRUE if the work item is queued successfully,
+ *    FALSE if the work item is not queued.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsThreadpool_QueueScheduledWorkItem(HgfsThreadpoolWorkItem workItem,      // IN
+                                      void *data,                           // IN
+                                      const HgfsThreadpoolSchedInfo *sched) // IN
+{
+   return HgfsThreadpoolQueue(workItem, data, sched);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_ShareId --
+ *
+ *    Identify a share for scheduling, by the FNV-1a hash of its name.
+ *
+ * Results:
+ *    The share id.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+uint32
+HgfsThreadpool_ShareId(const char *shareName,  // IN: share name
+                       size_t shareNameLen)    // IN: its length
+{
+   uint32 hash = 2166136261u;
+   size_t i;
+
+   for (i = 0; i < shareNameLen; i++) {
+      hash = (hash ^ (uint8)shareName[i]) * 16777619u;
+   }
+
+   return hash;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsThreadpool_SetShareLimits --
+ *
+ *    Set the weight of a share, relative to the default weight of 1, and
+ *    the bytes per second its requests may read or write, 0 for no cap.
+ *
+ * Results:
+ *    TRUE on success, FALSE if the pool is not initialized.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsThreadpool_SetShareLimits(const char *shareName,  // IN: share name
+                              uint32 weight,          // IN: 1 by default
+                              uint64 bytesPerSec)     // IN: 0 for no cap
+{
+   uint32 shareId;
+   HgfsThreadpoolShare *share;
+
+   if (NULL == gHgfsThreadpool) {
+      return FALSE;
+   }
+
+   shareId = HgfsThreadpool_ShareId(shareName, strlen(shareName));
+   weight = MIN(MAX(weight, 1), HGFS_THREADPOOL_MAX_WEIGHT);
+
+   MXUser_AcquireExclLock(gHgfsThreadpool->lock);
+
+   share = HgfsThreadpoolFindShare(shareId);
+   if (1 == weight && 0 == bytesPerSec) {
+      if (NULL != share) {
+         DblLnkLst_Unlink1(&share->links);
+         free(share);
+      }
+   } else {
+      if (NULL == share) {
+         share = Util_SafeCalloc(1, sizeof *share);
+         DblLnkLst_Init(&share->links);
+         share->shareId = shareId;
+         DblLnkLst_LinkLast(&gHgfsThreadpool->shares, &share->links);
+      }
+      share->weight = weight;
+      share->bytesPerSec = bytesPerSec;
+      share->tokens = MIN(share->tokens, (int64)bytesPerSec);
+      share->refillTime = Hostinfo_SystemTimerUS();
+   }
+
+   /* Workers waiting for the share see the new cap. */
+   MXUser_BroadcastCondVar(gHgfsThreadpool->workAvailable);
+   MXUser_ReleaseExclLock(gHgfsThreadpool->lock);
+
+   LOG(4, "%s: share %s weight %u cap %"FMT64"u bytes/s\n", __FUNCTION__,
+       shareName, weight, bytesPerSec);
+
+   return TRUE;
+}
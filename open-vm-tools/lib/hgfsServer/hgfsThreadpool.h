@@ -38,6 +38,21 @@
 
 typedef void(*HgfsThreadpoolWorkItem)(void *data);
 
+/*
+ * How a work item is scheduled. The items of one flow, that is one session
+ * working on one share, are queued together, and the flows take turns in
+ * proportion to the weight of their share and to the bytes their items
+ * move. Unordered items that move no data, e.g. getattr by name, are run
+ * ahead of the flows.
+ */
+typedef struct HgfsThreadpoolSchedInfo {
+   uint64 sessionId;     /* Session the item belongs to. */
+   uint32 shareId;       /* HgfsThreadpool_ShareId of the share, 0 if unknown. */
+   uint32 cost;          /* Bytes the item reads or writes. */
+   Bool ordered;         /* Run after the earlier items with orderKey. */
+   uint32 orderKey;
+} HgfsThreadpoolSchedInfo;
+
 HgfsInternalStatus HgfsThreadpool_Init(void);
 
 Bool HgfsThreadpool_Activate(void);
@@ -45,5 +60,13 @@ void HgfsThreadpool_Deactivate(void);
 
 void HgfsThreadpool_Exit(void);
 Bool HgfsThreadpool_QueueWorkItem(HgfsThreadpoolWorkItem workItem, void *data);
+Bool HgfsThreadpool_QueueScheduledWorkItem(HgfsThreadpoolWorkItem workItem,
+                                           void *data,
+                                           const HgfsThreadpoolSchedInfo *sched);
+
+uint32 HgfsThreadpool_ShareId(const char *shareName, size_t shareNameLen);
+Bool HgfsThreadpool_SetShareLimits(const char *shareName,
+                                   uint32 weight,
+                                   uint64 bytesPerSec);
 
 #endif // _HGFS_THREADPOOL_H
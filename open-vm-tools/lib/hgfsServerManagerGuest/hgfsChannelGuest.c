@@ -35,8 +35,7 @@
 /*
  * HGFS server connection channel and state object usage.
  *
- * Currently, all plugins can share this same HGFS server channel and state.
- * This allows us to use a common channel so it is only initialized
+ * All plugins share the same HGFS server state, which is initialized
  * once, by the first loaded plugin which requires an HGFS channel, and torn
  * down when the final plugin that uses the HGFS server is unloaded.
  *
@@ -50,10 +49,13 @@
  * have multiple connections. Some plugins also create and teardown connections
  * during general mutlithreaded operation of the tools processes.
  *
- * In order to support the above, we must track how many users of the shared
- * connection there are. This allows us to tear down the shared connection
- * when the final plugin that is using it is unloaded, and when no
- * channels are in use the HGFS server state can be torn down.
+ * In order to support the above, each caller registering with the server
+ * manager is given its own channel, with its own transport connection and
+ * so its own HGFS server session. Requests of separate callers (e.g. the vix
+ * file transfers and the DnD transfers) are then processed concurrently
+ * by the server instead of sharing the state of a single connection.
+ * The channels reference the server state, which is torn down when the
+ * final channel is closed.
  */
 
 /*
@@ -75,9 +77,9 @@ typedef struct HgfsChannelServerData {
 /*
  * Transport channels context.
  *
- * Multiple callers share this same channel currently as only one
- * transport channel is required. Therefore, the channel is referenced
- * for each client that it is returned to (a usage count).
+ * A channel is allocated for each caller from the registered channel type
+ * below and is referenced by that caller only, the reference count covers
+ * the initialization error paths.
  */
 typedef struct HgfsChannelData {
    const char                    *name;          /* Channel name. */
@@ -91,13 +93,32 @@ typedef struct HgfsChannelData {
 #define HGFS_CHANNEL_STATE_INIT         (1 << 0)
 #define HGFS_CHANNEL_STATE_CBINIT       (1 << 1)
 
-/* Static channel registration - assumes only one for now. */
-static HgfsChannelData gHgfsChannels[] = {
+/* Static channel type registration - assumes only one for now. */
+static const HgfsChannelData gHgfsChannels[] = {
    { "guest", &gGuestBackdoorOps, 0, NULL, NULL, {0} },
 };
 
+/*
+ * Oplocks are backed by file leases, and change notifications by inotify,
+ * on Linux. They are only granted to sessions on channels that can send the
+ * client an oplock break or a change event.
+ *
+ * The threadpool runs the requests of the asynchronous backdoor channel on
+ * Linux, see hgfsChannelGuestBd.c.
+ */
+#if defined(__linux__)
+#define HGFS_GUEST_CFG_OPLOCK       HGFS_CONFIG_OPLOCK_ENABLED
+#define HGFS_GUEST_CFG_NOTIFY       HGFS_CONFIG_NOTIFY_ENABLED
+#define HGFS_GUEST_CFG_THREADPOOL   HGFS_CONFIG_THREADPOOL_ENABLED
+#else
+#define HGFS_GUEST_CFG_OPLOCK       0
+#define HGFS_GUEST_CFG_NOTIFY       0
+#define HGFS_GUEST_CFG_THREADPOOL   0
+#endif
+
 static HgfsServerConfig gHgfsGuestCfgSettings = {
-   (HGFS_CONFIG_SHARE_ALL_HOST_DRIVES_ENABLED | HGFS_CONFIG_VOL_INFO_MIN),
+   (HGFS_CONFIG_SHARE_ALL_HOST_DRIVES_ENABLED | HGFS_CONFIG_VOL_INFO_MIN |
+    HGFS_GUEST_CFG_OPLOCK | HGFS_GUEST_CFG_NOTIFY | HGFS_GUEST_CFG_THREADPOOL),
    HGFS_MAX_CACHED_FILENODES
 };
 
@@ -314,10 +335,38 @@ HgfsChannelPutChannel(HgfsChannelData *channel)   // IN/OUT: ref count
    ASSERT(NULL != channel);
    if (Atomic_ReadDec32(&channel->refCount) == 1) {
       HgfsChannelTeardownChannel(channel);
+      free(channel);
    }
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsChannelCreateChannel --
+ *
+ *      Allocates a new channel of the registered type for a caller.
+ *
+ * Results:
+ *      The new channel, with no reference.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsChannelData *
+HgfsChannelCreateChannel(const HgfsChannelData *channelType) // IN: registered channel
+{
+   HgfsChannelData *channel = Util_SafeCalloc(1, sizeof *channel);
+
+   channel->name = channelType->name;
+   channel->ops = channelType->ops;
+   return channel;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -559,9 +608,9 @@ HgfsChannelTeardownChannel(HgfsChannelData *channel) // IN/OUT: connection manag
  *
  *      Sets up the channel for HGFS.
  *
- *      Initialize all the defined channels.
- *      At least one channel should succeed it's initialization
- *      completely, else we fail.
+ *      Creates a new channel for the caller, with its own connection
+ *      and HGFS server session, and references the HGFS server state
+ *      which is initialized for the first channel.
  *
  * Results:
  *      TRUE on success, FALSE on failure.
@@ -577,8 +626,7 @@ HgfsChannelGuest_Init(HgfsServerMgrData *mgrData,    // IN/OUT: server manager d
                       HgfsServerMgrCallbacks *mgrCb) // IN: server manager callbacks
 {
    Bool success = FALSE;
-   HgfsChannelData *channel = &gHgfsChannels[0]; // Shared channel (internal RPC)
-   uint32 channelRefCount;
+   HgfsChannelData *channel;
 
    ASSERT(NULL != mgrData);
    ASSERT(NULL == mgrData->connection);
@@ -592,37 +640,30 @@ HgfsChannelGuest_Init(HgfsServerMgrData *mgrData,    // IN/OUT: server manager d
 
    if (NULL != mgrData->rpc || NULL != mgrData->rpcCallback) {
       /*
-       * XXX - Would malloc a new channel here and activate
-       * with the required RPC.
+       * XXX - Would activate the new channel with the required RPC.
        */
 
       Debug("%s: Guest channel RPC override not supported.\n", __FUNCTION__);
       goto exit;
    }
 
-   /*
-    * Reference the channel. Initialize only for the first
-    * caller instance, otherwise only reference the channel for
-    * return to the caller.
-    */
-   channelRefCount = HgfsChannelGetChannel(channel);
-   /* We have referenced the channel, save it for later dereference. */
+   channel = HgfsChannelCreateChannel(&gHgfsChannels[0]);
+   /* Reference the channel for the caller, dereferenced on exit. */
+   HgfsChannelGetChannel(channel);
    mgrData->connection = channel;
-   if (0 == channelRefCount) {
 
-      /* Initialize channels objects. */
-      if (!HgfsChannelInitChannel(channel, mgrCb, &gHgfsChannelServerInfo)) {
-         Debug("%s: Could not init channel.\n", __FUNCTION__);
-         goto exit;
-      }
+   /* Initialize channels objects. */
+   if (!HgfsChannelInitChannel(channel, mgrCb, &gHgfsChannelServerInfo)) {
+      Debug("%s: Could not init channel.\n", __FUNCTION__);
+      goto exit;
+   }
 
-      /* Call the channels initializers. */
-      if (!HgfsChannelActivateChannel(channel,
-                                      mgrData->rpc,
-                                      mgrData->rpcCallback)) {
-         Debug("%s: Could not activate channel.\n", __FUNCTION__);
-         goto exit;
-      }
+   /* Call the channels initializers. */
+   if (!HgfsChannelActivateChannel(channel,
+                                   mgrData->rpc,
+                                   mgrData->rpcCallback)) {
+      Debug("%s: Could not activate channel.\n", __FUNCTION__);
+      goto exit;
    }
 
    success = TRUE;
@@ -640,8 +681,8 @@ exit:
  *
  * HgfsChannelGuest_Exit --
  *
- *      Dereference the channel which for the final reference will
- *      close the channel for HGFS.
+ *      Dereference the channel of the caller, which closes the channel
+ *      and its HGFS server session.
  *
  * Results:
  *      None.
@@ -28,6 +28,7 @@
 #include "vm_assert.h"
 #include "vm_atomic.h"
 #include "util.h"
+#include "userlock.h"
 #include "hgfsChannelGuestInt.h"
 #include "hgfsServer.h"
 #include "hgfsServerManager.h"
@@ -39,13 +40,27 @@ typedef enum {
 } HgfsGuestConnState;
 
 
-/* Since there is only one connection we use globals. */
+/*
+ * The server threadpool runs the requests of an asynchronous channel. The
+ * backdoor RPC still returns the reply, so the channel waits for it.
+ */
+#if defined(__linux__)
+#define HGFS_GUEST_BD_CAPS    HGFS_CHANNEL_ASYNC
+#else
+#define HGFS_GUEST_BD_CAPS    0
+#endif
+
+
+/* One connection per channel, each with its own server session. */
 typedef struct HgfsGuestConn {
    Atomic_uint32 refCount;                   /* Reference count. */
    HgfsGuestConnState state;
    const HgfsServerSessionCallbacks *serverCbTable; /* Server session callbacks. */
    HgfsServerChannelCallbacks channelCbTable;
    void *serverSession;
+   MXUserExclLock *replyLock;                /* Protects replyPending. */
+   MXUserCondVar *replySent;                 /* Signaled by the reply send. */
+   Bool replyPending;                        /* Request without its reply. */
    size_t packetOutLen;
    unsigned char *clientPacketOut;                 /* Client supplied buffer. */
    unsigned char packetOut[HGFS_LARGE_PACKET_MAX]; /* For RPC msg callbacks. */
@@ -174,6 +189,8 @@ HgfsChannelGuestConnInit(HgfsGuestConn **connData,                        // IN/
    HgfsChannelGuestConnGet(conn);
    conn->serverCbTable = serverCBTable;
    conn->state = HGFS_GST_CONN_NOTCONNECTED;
+   conn->replyLock = MXUser_CreateExclLock("hgfsGuestConnLock", RANK_LEAF);
+   conn->replySent = MXUser_CreateCondVarExclLock(conn->replyLock);
 
    *connData = conn;
    return TRUE;
@@ -232,6 +249,8 @@ HgfsChannelGuestConnDestroy(HgfsGuestConn *connData) // IN/OUT: channel object
       connData->serverCbTable->close(connData->serverSession);
       connData->serverSession = NULL;
    }
+   MXUser_DestroyCondVar(connData->replySent);
+   MXUser_DestroyExclLock(connData->replyLock);
    free(connData);
 }
 
@@ -250,8 +269,8 @@ HgfsChannelGuestConnDestroy(HgfsGuestConn *connData) // IN/OUT: channel object
  *      connection object passed. We will have the ability to receive
  *      requests until we unregister our callback.)
  *
- *      NOTE: There is only handler and connction that can be used for
- *      all HGFS guest requests.
+ *      NOTE: Each channel manager caller has its own connection, and so
+ *      its own HGFS server session.
  *
  * Results:
  *      None.
@@ -343,7 +362,7 @@ HgfsChannelGuestConnConnect(HgfsGuestConn *connData)  // IN: our connection data
 {
    Bool result;
    static HgfsServerChannelData HgfsBdCapData = {
-      0,
+      HGFS_GUEST_BD_CAPS,
       HGFS_LARGE_PACKET_MAX
    };
 
@@ -489,9 +508,26 @@ HgfsChannelGuestReceiveInternal(HgfsGuestConn *connData,  // IN: connection
    packet.replyPacketSize = *packetOutSize;
    packet.state |= HGFS_STATE_CLIENT_REQUEST;
 
-   /* The server will perform a synchronous processing of requests. */
+   MXUser_AcquireExclLock(connData->replyLock);
+   connData->replyPending = TRUE;
+   MXUser_ReleaseExclLock(connData->replyLock);
+
    connData->serverCbTable->receive(&packet, connData->serverSession);
 
+   /*
+    * A synchronous request is replied to by now. The reply of an asynchronous
+    * one is sent from a threadpool worker, and until then the packet on our
+    * stack is still used by the server.
+    */
+   MXUser_AcquireExclLock(connData->replyLock);
+   if (0 != (packet.state & HGFS_STATE_ASYNC_REQUEST)) {
+      while (connData->replyPending) {
+         MXUser_WaitCondVarExclLock(connData->replyLock, connData->replySent);
+      }
+   }
+   connData->replyPending = FALSE;
+   MXUser_ReleaseExclLock(connData->replyLock);
+
    *packetOutSize = connData->packetOutLen;
 
    return TRUE;
@@ -619,11 +655,14 @@ HgfsChannelGuestBdInvalidateInactiveSessions(HgfsGuestConn *connData)  // IN: co
  *
  *      Send reply to the request
  *
+ *      Called from a threadpool worker for an asynchronous request, while
+ *      HgfsChannelGuestReceiveInternal waits for the reply.
+ *
  * Results:
  *      Always TRUE.
  *
  * Side effects:
- *      None
+ *      Wakes up the receiving thread.
  *
  *-----------------------------------------------------------------------------
  */
@@ -651,6 +690,11 @@ HgfsChannelGuestBdSend(void *conn,              // IN: our connection data
                                             connData->serverSession);
    }
 
+   MXUser_AcquireExclLock(connData->replyLock);
+   connData->replyPending = FALSE;
+   MXUser_BroadcastCondVar(connData->replySent);
+   MXUser_ReleaseExclLock(connData->replyLock);
+
    return TRUE;
 }
 
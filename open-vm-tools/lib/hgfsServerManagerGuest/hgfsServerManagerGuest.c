@@ -218,6 +218,84 @@ HgfsServerManager_InvalidateInactiveSessions(HgfsServerMgrData *mgrData)  // IN:
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsServerManager_QueryStats --
+ *
+ *    Controls and reports the HGFS server request statistics. The command
+ *    is one of "on", "off", "reset", "log" or empty, and is applied before
+ *    the current statistics are returned.
+ *
+ * Results:
+ *    Allocated text report the caller must free, NULL for an unknown
+ *    command.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+char *
+HgfsServerManager_QueryStats(HgfsServerMgrData *mgrData,  // IN: RpcIn channel
+                             const char *command)         // IN: stats command
+{
+   ASSERT(mgrData);
+   ASSERT(command);
+
+   Debug("%s: stats command \"%s\" for %s.\n", __FUNCTION__, command,
+         mgrData->appName);
+
+   if (strcmp(command, "on") == 0) {
+      HgfsServer_EnableStats(TRUE);
+   } else if (strcmp(command, "off") == 0) {
+      HgfsServer_EnableStats(FALSE);
+   } else if (strcmp(command, "reset") == 0) {
+      HgfsServer_ResetStats();
+   } else if (strcmp(command, "log") == 0) {
+      HgfsServer_LogStats();
+   } else if (*command != '\0') {
+      return NULL;
+   }
+
+   return HgfsServer_GetStats();
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsServerManager_SetShareLimits --
+ *
+ *    Sets the scheduling weight and the bytes per second cap of the root
+ *    share, the only share the guest server exports. Weight 1 and cap 0
+ *    restore the defaults.
+ *
+ * Results:
+ *    TRUE on success, FALSE if the server threadpool is not in use.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+Bool
+HgfsServerManager_SetShareLimits(HgfsServerMgrData *mgrData,  // IN: RpcIn channel
+                                 uint32 weight,               // IN: 1 by default
+                                 uint64 bytesPerSec)          // IN: 0 for no cap
+{
+   ASSERT(mgrData);
+
+   Debug("%s: weight %u cap %"FMT64"u bytes/s for %s.\n", __FUNCTION__,
+         weight, bytesPerSec, mgrData->appName);
+
+   return HgfsServer_SetShareLimits(HGFS_SERVER_POLICY_ROOT_SHARE_NAME,
+                                    weight, bytesPerSec);
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -68,6 +68,17 @@ typedef struct HgfsServerPolicyState {
 } HgfsServerPolicyState;
 
 
+/*
+ * A share of the guest policy: the share and the hash of its case folded
+ * name, compared before the names.
+ */
+
+typedef struct HgfsServerPolicyShare {
+   HgfsSharedFolder folder;
+   uint32 nameHash;
+} HgfsServerPolicyShare;
+
+
 static HgfsServerPolicyState myState;
 
 static void *
@@ -81,6 +92,88 @@ static Bool
 HgfsServerPolicyEnumSharesExit(void *data);
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerPolicyHashName --
+ *
+ *    Hash a share name, folding the ASCII case so that the names which only
+ *    differ in case collide (FNV-1a).
+ *
+ * Results:
+ *    The hash.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint32
+HgfsServerPolicyHashName(char const *name,  // IN: Name to hash
+                         size_t nameLen)    // IN: Length of name
+{
+   uint32 hash = 2166136261U;
+   size_t i;
+
+   for (i = 0; i < nameLen; i++) {
+      unsigned char c = name[i];
+
+      if (c >= 'A' && c <= 'Z') {
+         c += 'a' - 'A';
+      }
+      hash = (hash ^ c) * 16777619U;
+   }
+
+   return hash;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsServerPolicyNameCaseEqual --
+ *
+ *    Compare 2 names of the same length ignoring the ASCII case. The names
+ *    need not be NUL terminated.
+ *
+ * Results:
+ *    TRUE if they match.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsServerPolicyNameCaseEqual(char const *name1,  // IN: First name
+                              char const *name2,  // IN: Second name
+                              size_t nameLen)     // IN: Length of both
+{
+   size_t i;
+
+   for (i = 0; i < nameLen; i++) {
+      unsigned char c1 = name1[i];
+      unsigned char c2 = name2[i];
+
+      if (c1 != c2) {
+         if (c1 >= 'A' && c1 <= 'Z') {
+            c1 += 'a' - 'A';
+         }
+         if (c2 >= 'A' && c2 <= 'Z') {
+            c2 += 'a' - 'A';
+         }
+         if (c1 != c2) {
+            return FALSE;
+         }
+      }
+   }
+
+   return TRUE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -102,7 +195,7 @@ HgfsServerPolicyDestroyShare(HgfsSharedFolder *share) // IN
 {
    ASSERT(share);
 
-   free(share);
+   free(DblLnkLst_Container(share, HgfsServerPolicyShare, folder));
 }
 
 
@@ -160,6 +253,7 @@ Bool
 HgfsServerPolicy_Init(HgfsInvalidateObjectsFunc invalidateObjects,  // Unused
                       HgfsServerResEnumCallbacks *enumResources)    // OUT enum callbacks
 {
+   HgfsServerPolicyShare *policyShare;
    HgfsSharedFolder *rootShare;
 
    /*
@@ -173,11 +267,12 @@ HgfsServerPolicy_Init(HgfsInvalidateObjectsFunc invalidateObjects,  // Unused
    DblLnkLst_Init(&myState.shares);
 
    /* For the guest, we hard code a "root" share */
-   rootShare = (HgfsSharedFolder *)malloc(sizeof *rootShare);
-   if (!rootShare) {
+   policyShare = (HgfsServerPolicyShare *)malloc(sizeof *policyShare);
+   if (!policyShare) {
       LOG(4, ("HgfsServerPolicy_Init: memory allocation failed\n"));
       return FALSE;
    }
+   rootShare = &policyShare->folder;
 
    DblLnkLst_Init(&rootShare->links);
 
@@ -195,6 +290,8 @@ HgfsServerPolicy_Init(HgfsInvalidateObjectsFunc invalidateObjects,  // Unused
    rootShare->pathLen = strlen(rootShare->path);
    rootShare->nameLen = strlen(rootShare->name);
    rootShare->handle = HGFS_INVALID_FOLDER_HANDLE;
+   policyShare->nameHash = HgfsServerPolicyHashName(rootShare->name,
+                                                    rootShare->nameLen);
 
    /* Add the root node to the end of the list */
    DblLnkLst_LinkLast(&myState.shares, &rootShare->links);
@@ -262,65 +359,46 @@ HgfsServerPolicyGetShare(HgfsServerPolicyState *state, // IN
                          size_t nameInLen)             // IN: Length of nameIn
 {
    DblLnkLst_Links *l;
+   HgfsSharedFolder *caseMatch = NULL;
+   uint32 nameHash;
 
    ASSERT(state);
    ASSERT(nameIn);
 
-   /*
-    * First try to find a share that matches the given name exactly.
-    * This is to handle the case where 2 share names differ in case only.
-    */
-
-   for (l = state->shares.next; l != &state->shares; l = l->next) {
-      HgfsSharedFolder *share;
-
-      share = DblLnkLst_Container(l, HgfsSharedFolder, links);
-      ASSERT(share);
-      if (nameInLen == share->nameLen &&
-          !memcmp(nameIn, share->name, nameInLen)) {
-         return share;
-      }
-   }
+   nameHash = HgfsServerPolicyHashName(nameIn, nameInLen);
 
    /*
-    * There was no match. As a fall back try a case insensitive match.
-    * This is because some Windows applications uppercase or lowercase the
-    * entire path before sending the request.
+    * A share that matches the given name exactly is preferred. This is to
+    * handle the case where 2 share names differ in case only.
+    *
+    * Otherwise, fall back to a case insensitive match. This is because some
+    * Windows applications uppercase or lowercase the entire path before
+    * sending the request.
+    *
+    * Only the shares whose folded name hash matches are compared.
     */
 
    for (l = state->shares.next; l != &state->shares; l = l->next) {
+      HgfsServerPolicyShare *policyShare;
       HgfsSharedFolder *share;
-      char *tempName;
 
-      /*
-       * Null terminate the input name before a case insensitive comparison.
-       * This is just to protect against bad implementations of strnicmp.
-       */
-
-      if (!(tempName = (char *)malloc(nameInLen + 1))) {
-         LOG(4, ("HgfsServerPolicyGetShare: couldn't allocate tempName\n"));
-         return NULL;
+      policyShare = DblLnkLst_Container(l, HgfsServerPolicyShare, folder.links);
+      share = &policyShare->folder;
+      if (policyShare->nameHash != nameHash || nameInLen != share->nameLen) {
+         continue;
       }
 
-      memcpy(tempName, nameIn, nameInLen);
-      tempName[nameInLen] = 0;
-
-      share = DblLnkLst_Container(l, HgfsSharedFolder, links);
-      ASSERT(share);
-      if (nameInLen == share->nameLen &&
-#ifdef _WIN32
-          !strnicmp(tempName, share->name, nameInLen)) {
-#else
-          !strncasecmp(tempName, share->name, nameInLen)) {
-#endif
-         free(tempName);
+      if (!memcmp(nameIn, share->name, nameInLen)) {
          return share;
       }
 
-      free(tempName);
+      if (caseMatch == NULL &&
+          HgfsServerPolicyNameCaseEqual(nameIn, share->name, nameInLen)) {
+         caseMatch = share;
+      }
    }
 
-   return NULL;
+   return caseMatch;
 }
 
 
@@ -71,6 +71,9 @@ ImpersonateGetLock(void)
  *      Acquire or release the impersonate lock. Protects access to
  *      the library's static and TLS states.
  *
+ *      With IMPERSONATE_PER_THREAD the state is only ever accessed by its
+ *      own thread, so this is a no-op.
+ *
  * Results:
  *      None.
  *
@@ -83,6 +86,7 @@ ImpersonateGetLock(void)
 static INLINE void
 ImpersonateLock(Bool lock) // IN
 {
+#if !defined(IMPERSONATE_PER_THREAD)
    MXUserRecLock *impersonateLock = ImpersonateGetLock();
 
    if (lock) {
@@ -90,6 +94,7 @@ ImpersonateLock(Bool lock) // IN
    } else {
       MXUser_ReleaseRecLock(impersonateLock);
    }
+#endif
 }
 
 
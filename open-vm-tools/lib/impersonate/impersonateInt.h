@@ -38,6 +38,15 @@
 #define IMPWARN(x)
 #endif
 
+/*
+ * On Linux the credentials are switched with raw syscalls, which only
+ * affect the calling thread. Each thread then has its own impersonation
+ * state and impersonations in different threads need not serialize.
+ */
+#if defined(__linux__)
+#define IMPERSONATE_PER_THREAD 1
+#endif
+
 typedef struct ImpersonationState {
    const char *impersonatedUser;       // the user we are currently impersonating
    int refCount;                       // # of times we are impersonating as same user
@@ -31,24 +31,51 @@
 #include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
-#if !defined(VMX86_TOOLS)
 #include <pthread.h>
-#endif
 #include <stdio.h>
 
 #include "impersonateInt.h"
 #include "su.h"
 #include "posix.h"
+#include "hostinfo.h"
+
+#if !defined(VMX86_TOOLS) || defined(IMPERSONATE_PER_THREAD)
+#define IMPERSONATE_TLS 1
+#endif
 
-#if !defined(VMX86_TOOLS)
-static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER; 
+/* Protects the process wide environment. */
+static pthread_mutex_t mut = PTHREAD_MUTEX_INITIALIZER;
+#if defined(IMPERSONATE_TLS)
 static pthread_key_t threadLocalStorageKey = INVALID_PTHREAD_KEY_VALUE;
 static void ThreadLocalFree(void *ptr);
 #else
 static ImpersonationState *impLinux = NULL;
 #endif
 
-static Bool ImpersonateDoPosix(struct passwd *pwd);
+/*
+ * Resolved passwd entries and supplementary groups, so that repeated
+ * impersonations of the same user do not go through NSS each time.
+ */
+#define IMPERSONATE_CACHE_SIZE   16
+#define IMPERSONATE_CACHE_TTL_MS (60 * 1000)
+
+typedef struct ImpersonateUser {
+   struct ImpersonateUser *next;
+   int refCount;                       // protected by cacheMut
+   VmTimeType expires;
+   uid_t uid;
+   gid_t gid;
+   char *name;
+   char *dir;
+   char *shell;
+   int numGroups;
+   gid_t *groups;
+} ImpersonateUser;
+
+static pthread_mutex_t cacheMut = PTHREAD_MUTEX_INITIALIZER;
+static ImpersonateUser *userCache = NULL;
+
+static Bool ImpersonateDoPosix(ImpersonateUser *user);
 
 /*
  *----------------------------------------------------------------------------
@@ -69,7 +96,7 @@ static Bool ImpersonateDoPosix(struct passwd *pwd);
 void
 ImpersonateInit(void)
 {
-#if !defined(VMX86_TOOLS)
+#if defined(IMPERSONATE_TLS)
    int status;
 
    status = pthread_key_create(&threadLocalStorageKey, ThreadLocalFree);
@@ -93,7 +120,7 @@ ImpersonateInit(void)
  *
  *----------------------------------------------------------------------
  */
-#if !defined(VMX86_TOOLS)
+#if defined(IMPERSONATE_TLS)
 static void
 ThreadLocalFree(void *ptr)
 {
@@ -134,8 +161,7 @@ ImpersonateGetTLS(void)
    int status;
 
    /* If a prior call has already allocated state, then use it */
-#if !defined(VMX86_TOOLS)
-   /* If a prior call has already allocated state, then use it */
+#if defined(IMPERSONATE_TLS)
    ptr = pthread_getspecific(threadLocalStorageKey);
 #else
 	ptr = impLinux;
@@ -147,7 +173,7 @@ ImpersonateGetTLS(void)
    /* No state allocated, so we need to allocate it */
    ptr = calloc(1, sizeof *ptr);
    VERIFY(ptr);
-#if !defined(VMX86_TOOLS)
+#if defined(IMPERSONATE_TLS)
    status = pthread_setspecific(threadLocalStorageKey, ptr);
 #else
 	impLinux = ptr;
@@ -161,6 +187,223 @@ ImpersonateGetTLS(void)
    return ptr;
 }
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * ImpersonateUserRelease --
+ *
+ *      Drop a reference to a cached user, freeing it with the last one.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory may be freed.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+ImpersonateUserRelease(ImpersonateUser *user)   // IN
+{
+   Bool last;
+
+   pthread_mutex_lock(&cacheMut);
+   ASSERT(user->refCount > 0);
+   last = --user->refCount == 0;
+   pthread_mutex_unlock(&cacheMut);
+
+   if (last) {
+      free(user->name);
+      free(user->dir);
+      free(user->shell);
+      free(user->groups);
+      free(user);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * ImpersonateUserCreate --
+ *
+ *      Copy a passwd entry and resolve the supplementary groups of the user.
+ *
+ * Results:
+ *      The new entry, with one reference, or NULL on failure.
+ *
+ * Side effects:
+ *      Memory allocated.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static ImpersonateUser *
+ImpersonateUserCreate(const struct passwd *pwd)  // IN
+{
+   ImpersonateUser *user = calloc(1, sizeof *user);
+   int numGroups = 32;
+   int prevGroups;
+
+   VERIFY(user);
+   user->refCount = 1;
+   user->uid = pwd->pw_uid;
+   user->gid = pwd->pw_gid;
+   user->name = strdup(pwd->pw_name);
+   user->dir = strdup(pwd->pw_dir);
+   user->shell = strdup(pwd->pw_shell);
+   VERIFY(user->name && user->dir && user->shell);
+
+   /*
+    * getgrouplist() updates numGroups to the required size when the list
+    * does not fit, on some systems only to the size it did fill.
+    */
+   do {
+      prevGroups = numGroups;
+      free(user->groups);
+      user->groups = malloc(numGroups * sizeof *user->groups);
+      VERIFY(user->groups);
+      if (getgrouplist(pwd->pw_name, pwd->pw_gid, user->groups,
+                       &numGroups) != -1) {
+         user->numGroups = numGroups;
+         user->expires = Hostinfo_SystemTimerMS() + IMPERSONATE_CACHE_TTL_MS;
+         return user;
+      }
+      numGroups = MAX(numGroups, prevGroups * 2);
+   } while (numGroups <= 65536);
+
+   Warning("Failed to get the groups of %s\n", pwd->pw_name);
+   free(user->name);
+   free(user->dir);
+   free(user->shell);
+   free(user->groups);
+   free(user);
+
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * ImpersonateUserGet --
+ *
+ *      Look up a user by name, or by uid if name is NULL, in the cache first.
+ *      Entries older than IMPERSONATE_CACHE_TTL_MS are looked up again so
+ *      that changes of the user database are picked up.
+ *
+ * Results:
+ *      The user, to be released with ImpersonateUserRelease, or NULL.
+ *
+ * Side effects:
+ *      The cache may be updated.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static ImpersonateUser *
+ImpersonateUserGet(const char *name,  // IN/OPT
+                   uid_t uid)         // IN
+{
+   VmTimeType now = Hostinfo_SystemTimerMS();
+   ImpersonateUser **link;
+   ImpersonateUser *user;
+   ImpersonateUser *stale = NULL;
+   char buffer[BUFSIZ];
+   struct passwd pw;
+   struct passwd *ppw = &pw;
+   int count = 0;
+   int error;
+
+   pthread_mutex_lock(&cacheMut);
+   for (link = &userCache; (user = *link) != NULL; ) {
+      if (user->expires <= now || ++count > IMPERSONATE_CACHE_SIZE) {
+         /* Unlink, the cache reference is dropped below. */
+         *link = user->next;
+         user->next = stale;
+         stale = user;
+         continue;
+      }
+      if (name != NULL ? strcmp(user->name, name) == 0 : user->uid == uid) {
+         user->refCount++;
+         break;
+      }
+      link = &user->next;
+   }
+   pthread_mutex_unlock(&cacheMut);
+
+   while (stale != NULL) {
+      ImpersonateUser *next = stale->next;
+
+      ImpersonateUserRelease(stale);
+      stale = next;
+   }
+
+   if (user != NULL) {
+      return user;
+   }
+
+   if (name != NULL) {
+      error = Posix_Getpwnam_r(name, &pw, buffer, BUFSIZ, &ppw);
+   } else {
+      error = Posix_Getpwuid_r(uid, &pw, buffer, BUFSIZ, &ppw);
+   }
+   if (error != 0 || !ppw) {
+      if (error == 0) {
+         error = ENOENT;
+      }
+      if (name != NULL) {
+         Warning("Failed to get password entry for : %s. Reason: %s\n", name,
+                 Err_Errno2String(error));
+      } else {
+         Warning("Failed to lookup user with uid: %" FMTUID ". Reason: %s\n",
+                 uid, Err_Errno2String(error));
+      }
+      return NULL;
+   }
+
+   user = ImpersonateUserCreate(ppw);
+   if (user != NULL) {
+      pthread_mutex_lock(&cacheMut);
+      user->refCount++;
+      user->next = userCache;
+      userCache = user;
+      pthread_mutex_unlock(&cacheMut);
+   }
+
+   return user;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * ImpersonateSetEnv --
+ *
+ *      Set the USER, HOME and SHELL environment variables for a user. The
+ *      environment is shared by all threads.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Environment updated.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+ImpersonateSetEnv(const ImpersonateUser *user)  // IN
+{
+   pthread_mutex_lock(&mut);
+   Posix_Setenv("USER", user->name, 1);
+   Posix_Setenv("HOME", user->dir, 1);
+   Posix_Setenv("SHELL", user->shell, 1);
+   pthread_mutex_unlock(&mut);
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -212,10 +455,8 @@ Bool
 ImpersonateOwner(const char *file)          // IN
 {
    struct stat buf;
-   char buffer[BUFSIZ];
-   struct passwd pw;
-   struct passwd *ppw = &pw;
-   int error;
+   ImpersonateUser *user;
+   Bool res;
 
    if (Posix_Stat(file, &buf) == -1) {
       Warning("Failed to lookup owner for: %s. Reason: %s\n", file, 
@@ -223,16 +464,15 @@ ImpersonateOwner(const char *file)          // IN
       return FALSE;
    }
 
-   if ((error = Posix_Getpwuid_r(buf.st_uid, &pw, buffer, BUFSIZ, &ppw)) != 0 || !ppw) {
-      if (error == 0) {
-         error = ENOENT;
-      }
-      Warning("Failed to lookup user with uid: %" FMTUID ". Reason: %s\n", buf.st_uid,
-              Err_Errno2String(error));
+   user = ImpersonateUserGet(NULL, buf.st_uid);
+   if (user == NULL) {
       return FALSE;
    }
-   
-   return ImpersonateDoPosix(ppw);
+
+   res = ImpersonateDoPosix(user);
+   ImpersonateUserRelease(user);
+
+   return res;
 }
 
 
@@ -254,28 +494,17 @@ ImpersonateOwner(const char *file)          // IN
 Bool
 ImpersonateUndo(void)
 {
-   char buffer[BUFSIZ];
-   struct passwd pw;
-   struct passwd *ppw = &pw;
+   ImpersonateUser *user;
    ImpersonationState *imp = NULL;
    int ret;
-   int error;
-
-#if !defined(VMX86_TOOLS)
-   pthread_mutex_lock(&mut);
-#endif
 
    imp = ImpersonateGetTLS();
    ASSERT(imp);
    //ASSERT(imp->impersonatedUser);
-   
-   if ((error = Posix_Getpwuid_r(0, &pw, buffer, BUFSIZ, &ppw)) != 0 || !ppw) {
-      if (error == 0) {
-         error = ENOENT;
-      }
-      ret = error;
-      Warning("Failed to get password entry for uid 0: %s\n",
-              Err_Errno2String(error));
+
+   user = ImpersonateUserGet(NULL, 0);
+   if (user == NULL) {
+      ret = -1;
       goto exit;
    }
 
@@ -283,31 +512,24 @@ ImpersonateUndo(void)
    NOT_IMPLEMENTED();
 #else
    /* Return to root */
-   ret = Id_SetEUid(ppw->pw_uid);
+   ret = Id_SetEUid(user->uid);
    if (ret < 0) {
       goto exit;
    }
 #endif
 
-   ret = Id_SetGid(ppw->pw_gid);
+   ret = Id_SetGid(user->gid);
    if (ret < 0) {
       goto exit;
    }
 
-   /* 
-    * The call to initgroups leaks memory in versions of glibc earlier than 2.1.93.
-    * See bug 10042. -jhu 
-    */
-
-   ret = initgroups(ppw->pw_name, ppw->pw_gid);
+   ret = Id_SetGroups(user->numGroups, user->groups);
    if (ret < 0) {
       goto exit;
    }
 
    /* Restore root's environment */
-   Posix_Setenv("USER", ppw->pw_name, 1);
-   Posix_Setenv("HOME", ppw->pw_dir, 1);
-   Posix_Setenv("SHELL", ppw->pw_shell, 1);
+   ImpersonateSetEnv(user);
 
    free((char *)imp->impersonatedUser);
    imp->impersonatedUser = NULL;
@@ -315,9 +537,9 @@ ImpersonateUndo(void)
 
 exit:
    VERIFY(ret == 0);
-#if !defined(VMX86_TOOLS)
-   pthread_mutex_unlock(&mut);
-#endif
+   if (user != NULL) {
+      ImpersonateUserRelease(user);
+   }
    return (ret ? FALSE : TRUE);
 }
 
@@ -340,39 +562,30 @@ exit:
  */
 
 Bool
-ImpersonateDoPosix(struct passwd *pwd)            // IN
+ImpersonateDoPosix(ImpersonateUser *user)         // IN
 {
    int ret = 0;
    ImpersonationState *imp = NULL;
 
-#if !defined(VMX86_TOOLS)
-   pthread_mutex_lock(&mut);
-#endif
-
    imp = ImpersonateGetTLS();
    ASSERT(imp);
 
-   if (pwd->pw_uid == geteuid()) {
+   if (user->uid == geteuid()) {
       imp->refCount++;
       IMPWARN(("ImpersonateDoPosix (%s : %x : %x) refcount = %d\n",
                imp->impersonatedUser, getpid(), imp, imp->refCount));
-      goto unlock;
+      return TRUE;
    }
 
    ASSERT(getuid() == 0);
    VERIFY(geteuid() == 0);
 
-   ret = Id_SetGid(pwd->pw_gid);
+   ret = Id_SetGid(user->gid);
    if (ret < 0) {
       goto exit;
    }
-   
-   /* 
-    * The call to initgroups leaks memory in versions of glibc earlier than
-    * 2.1.93.See bug 10042. -jhu 
-    */
-   
-   ret = initgroups(pwd->pw_name, pwd->pw_gid);
+
+   ret = Id_SetGroups(user->numGroups, user->groups);
    if (ret < 0) {
       goto exit;
    }
@@ -380,27 +593,21 @@ ImpersonateDoPosix(struct passwd *pwd)            // IN
 #if __APPLE__
    NOT_IMPLEMENTED();
 #else
-   ret = Id_SetEUid(pwd->pw_uid);
+   ret = Id_SetEUid(user->uid);
    if (ret < 0) {
       goto exit;
    }
 #endif
 
    /* Setup the user's environment */
-   Posix_Setenv("USER", pwd->pw_name, 1);
-   Posix_Setenv("HOME", pwd->pw_dir, 1);
-   Posix_Setenv("SHELL", pwd->pw_shell, 1);
+   ImpersonateSetEnv(user);
 
-   imp->impersonatedUser = strdup(pwd->pw_name);
+   imp->impersonatedUser = strdup(user->name);
    VERIFY(imp->impersonatedUser);
 
 exit:
    imp->refCount = 1;
    VERIFY(ret == 0);
-unlock:
-#if !defined(VMX86_TOOLS)
-   pthread_mutex_unlock(&mut);
-#endif
    return (ret ? FALSE : TRUE);
 }
 
@@ -428,21 +635,17 @@ Bool
 ImpersonateDo(const char *user,       // IN
               AuthToken token)        // IN
 {
-   char buffer[BUFSIZ];
-   struct passwd pw;
-   struct passwd *ppw = &pw;
-   int error;
+   ImpersonateUser *entry = ImpersonateUserGet(user, 0);
+   Bool res;
 
-   if ((error = Posix_Getpwnam_r(user, &pw, buffer, BUFSIZ, &ppw)) != 0 || !ppw) {
-      if (error == 0) {
-         error = ENOENT;
-      }
-      Warning("Failed to get password entry for : %s. Reason: %s\n", user,
-              Err_Errno2String(error));
+   if (entry == NULL) {
       return FALSE;
    }
 
-   return ImpersonateDoPosix(ppw);
+   res = ImpersonateDoPosix(entry);
+   ImpersonateUserRelease(entry);
+
+   return res;
 }
 
 
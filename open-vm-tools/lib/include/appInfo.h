@@ -38,4 +38,19 @@
 #define APP_INFO_KEY_APP_NAME         "a"
 #define APP_INFO_KEY_APP_VERSION      "v"
 
+/*
+ * Number of identical applications, when not 1. Only present when the
+ * appinfo.group-duplicates configuration is set.
+ */
+#define APP_INFO_KEY_APP_COUNT        "n"
+
+/*
+ * The applications that do not fit in one guest variable continue in
+ * APP_INFO_GUESTVAR_KEY.1, APP_INFO_GUESTVAR_KEY.2, etc. Each of them has
+ * the same header, plus the index of the chunk and the number of chunks
+ * (which are not present when everything fits in one).
+ */
+#define APP_INFO_KEY_CHUNK            "chunk"
+#define APP_INFO_KEY_CHUNK_COUNT      "chunkCount"
+
 #endif /* _APPINFO_H_ */
@@ -168,6 +168,15 @@ typedef struct AsyncSocket AsyncSocket;
  * used (callback is registered in POLL_CS_MAIN and locked by the BULL).
  * Or the client can specify its favorite poll class and locking behavior.
  * Use of IVmdbPoll is only supported for regular sockets and for Attach.
+ *
+ * A socket given a loop registers its callbacks there (see Poll_LoopCreate)
+ * and they fire on the thread running that loop. A listener given a loop
+ * group accepts on one loop of the group and queues each connection to the
+ * least loaded loop, which binds it and fires the connect callback. Loops
+ * with nothing queued steal the connections a busy loop has left waiting.
+ * The new socket is bound to the loop firing its connect callback and is
+ * locked by the loop's lock. A listener with a loop group must have a lock,
+ * since its callbacks fire on several threads.
  */
 #include "poll.h"
 struct IVmdbPoll;
@@ -176,6 +185,8 @@ typedef struct AsyncSocketPollParams {
    MXUserRecLock *lock;     /* Default: none but BULL */
    PollClassSet pollClass;  /* Default is POLL_CS_MAIN */
    struct IVmdbPoll *iPoll; /* Default NULL: use Poll_Callback */
+   PollLoop *loop;          /* Default NULL: the default poll loop */
+   PollLoopGroup *loopGroup;/* Default NULL, for listeners only */
 } AsyncSocketPollParams;
 
 /*
@@ -205,6 +216,25 @@ typedef struct AsyncSocketNetworkStats {
 } AsyncSocketNetworkStats;
 
 
+/*
+ * Counters kept by every socket, and summed over all sockets since
+ * startup, see AsyncSocket_GetStats and AsyncSocket_GetGlobalStats.
+ */
+typedef struct AsyncSocketStats {
+   uint64 bytesSent;
+   uint64 bytesRecvd;
+   uint64 sendCalls;             /* system calls sending data */
+   uint64 recvCalls;             /* system calls receiving data */
+   uint64 emptyWakeups;          /* recv callbacks that found no data */
+   uint64 blockedSendUs;         /* time in AsyncSocket_SendBlocking */
+   uint64 blockedRecvUs;         /* time in AsyncSocket_Recv*Blocking */
+   uint64 handshakes;            /* SSL handshakes completed */
+   uint64 handshakeUs;           /* time spent in them */
+   uint64 sendQueueBytes;        /* queued, not yet sent; 0 if global */
+   uint64 sendQueueHighWater;    /* most bytes ever queued on a socket */
+} AsyncSocketStats;
+
+
 /*
  * The following covers all facilities involving dynamic socket options w.r.t.
  * various async sockets, excluding the async socket options API on the
@@ -351,7 +381,17 @@ typedef enum {
     *
     * Default: 0.
     */
-   ASYNC_SOCKET_OPT_DSCP
+   ASYNC_SOCKET_OPT_DSCP,
+   /*
+    * int: buffers of at least this many bytes are sent with MSG_ZEROCOPY
+    * where the OS supports it (Linux 4.14 and later), skipping the copy
+    * into the kernel. The send callback of such a buffer fires once the
+    * kernel no longer references it, so it may fire well after the data
+    * left the queue. 0 disables zero-copy sends.
+    *
+    * Default: 0.
+    */
+   ASYNC_SOCKET_OPT_SEND_ZEROCOPY_MIN
 } AsyncSocket_OptID;
 
 /*
@@ -403,6 +443,14 @@ unsigned int AsyncSocket_GetPort(AsyncSocket *asock);
 typedef void (*AsyncSocketRecvFn) (void *buf, int len, AsyncSocket *asock,
                                    void *clientData);
 
+/*
+ * Buffered recv callback fires with all data received so far and returns
+ * how many bytes it consumed, see AsyncSocket_RecvBuffered.
+ */
+typedef int (*AsyncSocketRecvBufferedFn) (void *buf, int len,
+                                          AsyncSocket *asock,
+                                          void *clientData);
+
 /*
  * Send callback fires once previously queued data has been sent
  */
@@ -643,6 +691,13 @@ int AsyncSocket_Recv(AsyncSocket *asock, void *buf, int len, void *cb, void *cbD
 int AsyncSocket_RecvPartial(AsyncSocket *asock, void *buf, int len,
                             void *cb, void *cbData);
 
+/*
+ * Receive whatever arrives, possibly several messages per callback.
+ */
+int AsyncSocket_RecvBuffered(AsyncSocket *asock,
+                             AsyncSocketRecvBufferedFn recvFn,
+                             void *cbData);
+
 /*
  * Specify the amount of data to receive and the receive function to call.
  */
@@ -682,6 +737,8 @@ int AsyncSocket_SendWithFd(AsyncSocket *asock, void *buf, int len, int passFd,
 int AsyncSocket_IsSendBufferFull(AsyncSocket *asock);
 int AsyncSocket_GetNetworkStats(AsyncSocket *asock,
                                 AsyncSocketNetworkStats *stats);
+int AsyncSocket_GetStats(AsyncSocket *asock, AsyncSocketStats *stats);
+void AsyncSocket_GetGlobalStats(AsyncSocketStats *stats);
 int AsyncSocket_CancelRecv(AsyncSocket *asock, int *partialRecvd, void **recvBuf,
                            void **recvFn);
 int AsyncSocket_CancelRecvEx(AsyncSocket *asock, int *partialRecvd, void **recvBuf,
@@ -48,9 +48,23 @@
 extern "C" {
 #endif
 
+/* Backdoor usage counters, see Backdoor_GetStats. */
+typedef struct BackdoorStats {
+   uint64 exits;     // All backdoor exits
+   uint64 hbExits;   // High-bandwidth exits
+   uint64 hbBytes;   // Bytes moved by high-bandwidth exits
+} BackdoorStats;
+
 void
 Backdoor(Backdoor_proto *bp); // IN/OUT
 
+void
+Backdoor_Batch(Backdoor_proto *bps,  // IN/OUT
+               size_t count);        // IN
+
+void
+Backdoor_GetStats(BackdoorStats *stats);  // OUT
+
 void
 Backdoor_ForceLegacy(Bool force);  // IN
 
@@ -389,6 +389,9 @@ int CodeSet_GetUtf8(const char *string,  // IN:
 Bool CodeSet_IsValidUTF8(const char *bufIn,  // IN:
                          size_t sizeIn);     // IN:
 
+size_t CodeSet_AsciiLength(const char *bufIn,  // IN:
+                           size_t sizeIn);     // IN:
+
 Bool CodeSet_IsStringValidUTF8(const char *string);  // IN:
 
 /*
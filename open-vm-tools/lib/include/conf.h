@@ -47,6 +47,7 @@
 #define CONFNAME_POWEROFFSCRIPT           "poweroff-script"
 #define CONFNAME_RESUMESCRIPT             "resume-script"
 #define CONFNAME_SUSPENDSCRIPT            "suspend-script"
+#define CONFNAME_SCRIPTTIMEOUT            "script-timeout"
 #define CONFNAME_LOG                      "log"
 #define CONFNAME_LOGFILE                  "log.file"
 #define CONFNAME_LOGLEVEL                 "log.level"
@@ -97,6 +98,35 @@
  */
 #define CONFNAME_APPINFO_USE_WMI "useWMI"
 
+/**
+ * Lets user disable tracking the processes from the proc connector on Linux.
+ * While they are tracked, the application information is published as soon
+ * as the set of applications changes, and the polls do not list the
+ * processes.
+ *
+ * @param boolean Set to FALSE to list the processes on each poll.
+ */
+#define CONFNAME_APPINFO_WATCHPROCESSES "watch-processes"
+
+/**
+ * Define the largest number of guest variables the application information
+ * can be published into, when it does not fit in one.
+ *
+ * @note Illegal values result in a @c g_warning and fallback to the default
+ * value.
+ *
+ * @param int   Number of guest variables, from 1 to 64.
+ */
+#define CONFNAME_APPINFO_MAXCHUNKS "max-chunks"
+
+/**
+ * Defines the configuration to describe the identical applications once,
+ * with their number, instead of once per process.
+ *
+ * @param boolean Set to TRUE to group the identical applications.
+ */
+#define CONFNAME_APPINFO_GROUPDUPLICATES "group-duplicates"
+
 /*
  * END AppInfo goodies.
  ******************************************************************************
@@ -123,6 +153,42 @@
  */
 #define CONFNAME_SERVICEDISCOVERY_DISABLED "disabled"
 
+/**
+ * Defines whether the Linux service data is collected by the plugin itself,
+ * from sock_diag netlink and /proc, instead of by the scripts. The scripts
+ * are still used for the data without a native collector, and when the
+ * guest does not support sock_diag.
+ *
+ * @note Illegal values result in a @c g_warning and fallback to the default
+ * value.
+ *
+ * @param boolean Set to FALSE to always run the scripts.
+ */
+#define CONFNAME_SERVICEDISCOVERY_NATIVECOLLECTORS "native-collectors"
+
+/**
+ * Defines how long each service discovery script may run, in seconds. A
+ * script still running after that is killed, and its data is not published
+ * for the cycle.
+ *
+ * @note Illegal values result in a @c g_warning and fallback to the default
+ * value.
+ *
+ * @param int   The time budget of each script, 60 by default.
+ */
+#define CONFNAME_SERVICEDISCOVERY_SCRIPTTIMEOUT "script-timeout"
+
+/**
+ * Defines how often the service discovery loop checks whether the data
+ * should be published, in seconds.
+ *
+ * @note Illegal values result in a @c g_warning and fallback to the default
+ * value.
+ *
+ * @param int   The poll interval, 300 by default.
+ */
+#define CONFNAME_SERVICEDISCOVERY_POLLINTERVAL "poll-interval"
+
 /*
  * END ServiceDiscovery goodies.
  ******************************************************************************
@@ -229,6 +295,61 @@
  */
 #define CONFNAME_GUESTINFO_STATSINTERVAL "stats-interval"
 
+/**
+ * Define how many times the GuestStats poll interval may be stretched while
+ * the guest is idle or in a steady state.
+ *
+ * @param int   Maximum factor, rounded down to a power of 2. Set to 1 to
+ *              always sample at the stats-interval.
+ */
+#define CONFNAME_GUESTINFO_STATSMAXBACKOFF "stats-max-backoff"
+
+/**
+ * Define how many of the top CPU and of the top memory consuming cgroups
+ * are reported with the GuestStats, on guests with a cgroup v2 hierarchy.
+ *
+ * @param int   Number of cgroups. Set to 0 to disable cgroup stats.
+ */
+#define CONFNAME_GUESTINFO_CGROUPSTATSTOP "cgroup-stats-top"
+
+/**
+ * Define how long (in milliseconds) each GuestStats poll may spend reading
+ * cgroup stats. The cgroups not read in time keep their previous stats.
+ *
+ * @param int   Time budget of the cgroup scans.
+ */
+#define CONFNAME_GUESTINFO_CGROUPSCANBUDGET "cgroup-scan-budget"
+
+/**
+ * Lets user disable watching NIC and disk changes, where the guest reports
+ * them. While changes are watched, the GuestInfo poll loop only does a full
+ * scan every CONFNAME_GUESTINFO_FULLSCANINTERVAL seconds.
+ *
+ * @param boolean Set to false to gather everything on each poll.
+ */
+#define CONFNAME_GUESTINFO_WATCHCHANGES "watch-changes"
+
+/**
+ * Define the interval (in seconds) of the full GuestInfo scans while NIC and
+ * disk changes are watched. Disk free space and uptime are still sent on
+ * each poll.
+ *
+ * @note Illegal values result in a @c g_warning and fallback to the default
+ * full scan interval.
+ *
+ * @param int   User-defined full scan interval.
+ */
+#define CONFNAME_GUESTINFO_FULLSCANINTERVAL "full-scan-interval"
+
+/**
+ * Define the interval (in seconds) at which vmtoolsd refreshes the guestlib
+ * statistics it shares with the libguestlib consumers, which then do not
+ * query the host themselves.
+ *
+ * @param int   User-defined refresh interval. Set to 0 to disable sharing.
+ */
+#define CONFNAME_GUESTINFO_GUESTLIBEXPORTINTERVAL "guestlib-export-interval"
+
 /**
  * Indicates whether stat results should be written to the log.
  */
@@ -422,6 +543,96 @@
 /* Wait 5 seconds between polls to see if the conf file has changed */
 #define CONF_POLL_TIME     5
 
+/*
+ ******************************************************************************
+ * BEGIN timeSync goodies.
+ */
+
+/**
+ * Defines the string used for the timeSync config file group.
+ */
+#define CONFGROUPNAME_TIMESYNC "timeSync"
+
+/**
+ * Lets user enable the precise periodic synchronization, where each period
+ * takes a burst of host time samples, keeps the one with the lowest round
+ * trip, and steers the frequency of the guest clock from the offset and
+ * frequency estimated over the recent bursts.
+ *
+ * @param boolean Set to TRUE to enable.
+ */
+#define CONFNAME_TIMESYNC_PRECISE "precise"
+
+/**
+ * Define how many host time samples each burst takes.
+ *
+ * @param int   Number of samples.
+ */
+#define CONFNAME_TIMESYNC_BURSTSAMPLES "burst-samples"
+
+/**
+ * Define the NTP SHM reference clock unit the host time samples are
+ * exported to. While exported, the periodic synchronization leaves the
+ * correction of the guest clock to the NTP daemon.
+ *
+ * @param int   SHM unit. Set to -1 to disable the export.
+ */
+#define CONFNAME_TIMESYNC_REFCLOCKUNIT "refclock-shm-unit"
+
+/**
+ * Define how the one time synchronizations requested by the host, e.g.
+ * after resume or vMotion, correct the time: "step" steps it, "slew"
+ * slews it when the correction can complete within resync-catchup-time,
+ * and only steps it otherwise.
+ *
+ * @param string  Policy.
+ */
+#define CONFNAME_TIMESYNC_RESYNCPOLICY "resync-policy"
+
+/**
+ * Define the longest time (in seconds) a slewed one time synchronization
+ * may take to catch up.
+ *
+ * @param int   Catch-up time bound.
+ */
+#define CONFNAME_TIMESYNC_CATCHUPTIME "resync-catchup-time"
+
+/*
+ * END timeSync goodies.
+ ******************************************************************************
+ */
+
+/*
+ ******************************************************************************
+ * BEGIN hgfsServer goodies.
+ */
+
+/**
+ * Defines the string used for the hgfsServer config file group.
+ */
+#define CONFGROUPNAME_HGFSSERVER "hgfsServer"
+
+/**
+ * Define the weight of the exported share when its requests compete for
+ * the server worker threads, relative to the default weight of 1.
+ *
+ * @param int   Weight, 1 to 64.
+ */
+#define CONFNAME_HGFSSERVER_SHAREWEIGHT "share-weight"
+
+/**
+ * Define how many bytes per second the reads and writes on the exported
+ * share may move.
+ *
+ * @param int   Cap in bytes per second. Set to 0 for no cap.
+ */
+#define CONFNAME_HGFSSERVER_SHAREMAXBYTESPERSEC "share-max-bytes-per-sec"
+
+/*
+ * END hgfsServer goodies.
+ ******************************************************************************
+ */
+
 /*
  ******************************************************************************
  * BEGIN upgrader goodies.
@@ -96,10 +96,21 @@ DataMap_Serialize(const DataMap *that,   //IN
                   char **buf,            // OUT
                   uint32 *bufLen);          // OUT
 ErrorCode
+DataMap_SerializeTo(const DataMap *that,   // IN
+                    char *buf,             // OUT
+                    uint32 bufSize,        // IN
+                    uint32 *bufLen);       // OUT
+
+ErrorCode
 DataMap_Deserialize(const char *bufIn,     // IN
                     const int32 bufLen,    // IN
                     DataMap *that);        // OUT
 
+ErrorCode
+DataMap_DeserializeView(const char *bufIn,     // IN
+                        const int32 bufLen,    // IN
+                        DataMap *that);        // OUT
+
 ErrorCode
 DataMap_DeserializeContent(const char *bufIn,     // IN
                            const int32 bufLen,    // IN
@@ -37,6 +37,7 @@ typedef struct DynBuf {
    char   *data;
    size_t  size;
    size_t  allocated;
+   char   *fixed;      // Caller storage of DynBuf_InitWithBuffer, or NULL.
 } DynBuf;
 
 
@@ -52,6 +53,11 @@ void
 DynBuf_InitWithString(DynBuf *b,
                       char *str);
 
+void
+DynBuf_InitWithBuffer(DynBuf *b,
+                      size_t bufSize,
+                      void *buf);
+
 void
 DynBuf_Destroy(DynBuf *b); // IN
 
@@ -70,6 +76,10 @@ Bool
 DynBuf_Enlarge(DynBuf *b,        // IN/OUT
                size_t min_size); // IN
 
+Bool
+DynBuf_Reserve(DynBuf *b,        // IN/OUT
+               size_t size);     // IN
+
 Bool
 DynBuf_Append(DynBuf *b,        // IN/OUT
               void const *data, // IN
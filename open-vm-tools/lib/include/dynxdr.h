@@ -44,6 +44,8 @@ extern "C" {
 
 XDR *DynXdr_Create(XDR *in);
 Bool DynXdr_AppendRaw(XDR *xdrs, const void *buf, size_t len);
+Bool DynXdr_Reserve(XDR *xdrs, size_t size);
+size_t DynXdr_Sizeof(xdrproc_t proc, void *data);
 void *DynXdr_AllocGet(XDR *xdrs);
 void *DynXdr_Get(XDR *xdrs);
 void DynXdr_Destroy(XDR *xdrs, Bool release);
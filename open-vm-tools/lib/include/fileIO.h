@@ -476,6 +476,11 @@ const char *FileIO_ErrorEnglish(FileIOResult status);
 
 void FileIO_OptionalSafeInitialize(void);
 
+#if !defined(_WIN32) && !defined(VMX86_SERVER)
+void FileIOAligned_PoolGetStats(uint64 *hits,
+                                uint64 *misses);
+#endif
+
 #if defined(_WIN32)
 FileIODescriptor FileIO_CreateFDWin32(HANDLE win32,
                                       DWORD access,
@@ -78,6 +78,17 @@ Bool FileLock_CleanupVM(const char *cfgfilePath,
                         int *err,
                         MsgList **msgs);
 
+/* Lock acquisition statistics of the process */
+typedef struct FileLockStats {
+   uint64 acquired;         // Locks acquired
+   uint64 acquiredOFD;      // ... of which with OFD locks
+   uint64 timedOut;         // Locks not acquired within the wait time
+   uint64 waitTimeUsec;     // Total time spent acquiring locks
+   uint64 maxWaitTimeUsec;  // Longest time spent acquiring a lock
+} FileLockStats;
+
+void FileLock_GetStats(FileLockStats *stats);
+
 #if defined(__cplusplus)
 }  // extern "C"
 #endif
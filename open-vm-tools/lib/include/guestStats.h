@@ -43,6 +43,9 @@
  * Version 4: Dead
  * Version 5: Legacy structure followed by one or more GuestStat
  *            structures and data.
+ * Version 6: Legacy structure followed by a compact stat list, see
+ *            GuestStatCompactKind. Only sent once the host enabled
+ *            TOOLSOPTION_ENABLE_COMPACT_GUESTSTATS.
  */
 
 #define GUESTMEMINFO_V1 1
@@ -50,6 +53,7 @@
 #define GUESTMEMINFO_V3 3
 #define GUESTMEMINFO_V4 4
 #define GUESTMEMINFO_V5 5
+#define GUESTMEMINFO_V6 6
 
 /*
  * Flags for GuestMemInfoLegacy
@@ -130,6 +134,58 @@ struct GuestDatumHeader {
 #include "vmware_pack_end.h"
 GuestDatumHeader;
 
+/*
+ * Compact (version 6) stat list.
+ *
+ * The legacy structure is followed by one uint8 of GUEST_STATS_COMPACT_*
+ * flags, then by one record per stat:
+ *
+ *    varint    (GuestStatToolsID << 3) | GuestStatCompactKind
+ *    data      depends on the kind
+ *
+ * Varints are unsigned LEB128: 7 bits per byte, least significant group
+ * first, the high bit set on all bytes but the last. All stats belong to
+ * GUEST_TOOLS_NAMESPACE, and their type and units are the ones documented
+ * for their ID.
+ *
+ * A full report carries every published stat. Other reports only carry
+ * the stats that changed since the previous report; the others keep their
+ * previous value.
+ *
+ * With GUEST_STATS_COMPACT_HISTORY, the flags are followed by the samples
+ * taken since the previous report, oldest first, before the records of
+ * the report itself:
+ *
+ *    varint    number of samples
+ *    then, for each sample:
+ *    varint    age of the sample when the report was built, in ms
+ *    varint    size of the sample's records, in bytes
+ *    records   changes since the previous report, as above
+ *
+ * Samples are independent of each other, so a sample does not need the
+ * ones before it to be decoded.
+ *
+ * With GUEST_STATS_COMPACT_CGROUPS, the next item is a cgroup stat list:
+ *
+ *    varint    size of the list, in bytes
+ *    stats     GUEST_CGROUP_NAMESPACE stats, encoded as in the version 5
+ *              (GuestStatHeader) format
+ */
+
+#define GUEST_STATS_COMPACT_FULL     0x01  // Report is not a delta
+#define GUEST_STATS_COMPACT_HISTORY  0x02  // Samples precede the report
+#define GUEST_STATS_COMPACT_CGROUPS  0x04  // Cgroup stats precede the report
+
+typedef enum {
+   GuestStatCompactNone   = 0,  // No value, nothing follows
+   GuestStatCompactUint   = 1,  // varint value
+   GuestStatCompactDelta  = 2,  // varint zigzag(value - previous value)
+   GuestStatCompactFloat  = 3,  // 4 byte IEEE 754, little endian
+   GuestStatCompactDouble = 4,  // 8 byte IEEE 754, little endian
+} GuestStatCompactKind;
+
+#define GUEST_STAT_COMPACT_KIND_BITS  3
+
 /*
  * Units datum enum.
  * Note: The entirety (all bits) of the units must always be understood by a client.
@@ -346,4 +402,26 @@ MY_ASSERTS(GUEST_STAT_IDS_ARE_WELL_ORDERED, GUEST_STAT_TOOLS_IDS)
 
 #undef DEFINE_GUEST_STAT
 
+/*
+ * Defines the namespace of the per-cgroup stats, which follow the
+ * GUEST_TOOLS_NAMESPACE stats of a report.
+ *
+ * The stats of a cgroup start with its GuestStatCgroupID_Path; the stats
+ * that follow, up to the next path, belong to that cgroup. Only the top
+ * consumers are reported.
+ *
+ * NOTE: IDs can only be added to the end.
+ */
+#define GUEST_CGROUP_NAMESPACE "_tools/cgroup/v1"
+
+typedef enum GuestStatCgroupID {
+   GuestStatCgroupID_Invalid      = 0,
+   GuestStatCgroupID_Path         = 1,  // String, from the cgroup v2 root
+   GuestStatCgroupID_CpuUsageRate = 2,  // Double, CPU usec per second
+   GuestStatCgroupID_MemAnon      = 3,  // Uint64, bytes
+   GuestStatCgroupID_MemFile      = 4,  // Uint64, bytes
+   GuestStatCgroupID_IoReadRate   = 5,  // Double, bytes per second
+   GuestStatCgroupID_IoWriteRate  = 6,  // Double, bytes per second
+} GuestStatCgroupID;
+
 #endif // _GUEST_STATS_H_
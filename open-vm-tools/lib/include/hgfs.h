@@ -353,4 +353,11 @@ typedef enum {
  */
 #define HGFS_CLIENT_CMD_LEN HGFS_SYNC_REQREP_CLIENT_CMD_LEN
 
+/*
+ * Diagnostic command answered by the guest HGFS server with its per-opcode
+ * request counters and latency histograms. An optional argument of "on",
+ * "off", "reset" or "log" is applied before the report is returned.
+ */
+#define HGFS_STATS_CMD "hgfs.stats"
+
 #endif // _HGFS_H_
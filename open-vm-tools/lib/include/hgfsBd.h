@@ -41,6 +41,14 @@
 
 #include "rpcout.h"
 
+/*
+ * One segment of a request or reply for HgfsBd_DispatchV.
+ */
+typedef struct HgfsBdIov {
+   char *va;
+   size_t len;
+} HgfsBdIov;
+
 char *HgfsBd_GetBuf(void);
 
 char *HgfsBd_GetLargeBuf(void);
@@ -56,6 +64,15 @@ int HgfsBd_Dispatch(RpcOut *out,
                     size_t *packetSize,
                     char const **packetOut);
 
+int HgfsBd_DispatchV(RpcOut *out,
+                     char *packetIn,
+                     size_t packetInSize,
+                     HgfsBdIov const *reqIov,
+                     uint32 reqIovCount,
+                     HgfsBdIov const *replyIov,
+                     uint32 replyIovCount,
+                     size_t *replySize);
+
 Bool HgfsBd_Enabled(RpcOut *out,
                     char *requestPacket);
 
@@ -146,6 +146,8 @@ typedef enum {
    HGFS_OP_UNLOCK_BYTE_RANGE_V4,  /* Release byte range lock. */
    HGFS_OP_QUERY_EAS_V4,          /* Query extended attributes. */
    HGFS_OP_SET_EAS_V4,            /* Add or modify extended attributes. */
+   HGFS_OP_COMPOUND_V4,           /* Execute a sequence of requests. */
+   HGFS_OP_COPY_FILE_RANGE_V4,    /* Copy a range between two open files. */
 
    HGFS_OP_MAX,                   /* Dummy op, must be last in enum */
    HGFS_OP_NEW_HEADER = 0xff,     /* Header op, must be unique, distinguishes packet headers. */
@@ -2715,4 +2717,100 @@ struct HgfsReplyDeleteFileV4 {
 #include "vmware_pack_end.h"
 HgfsReplyDeleteFileV4;
 
+/*
+ * A compound request carries a sequence of complete HGFS requests, each with
+ * its own HgfsHeader for the session the compound is sent on. The server
+ * executes them in order and returns a single reply holding the individual
+ * replies in the same order. Every member request and reply is preceded by
+ * an HgfsCompoundEntryV4 giving its size.
+ *
+ * A member flagged HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE has its file or search
+ * handle replaced by the one returned by the most recent open or search open
+ * of the same compound, e.g. open + getattr + read + close in a single round
+ * trip. The handle is invalid if that open failed.
+ *
+ * Members cannot be compound requests, create or destroy sessions, or use the
+ * separate data buffer of the shared memory channels. The server may execute
+ * fewer members than requested when the remaining replies might not fit in
+ * the reply packet, or after a failure with HGFS_COMPOUND_FLAG_STOP_ON_ERROR.
+ * numReplies tells the client where to resume.
+ *
+ * Only the guest HGFS server implements it, host servers do not. A client
+ * must find it supported in the capabilities of the create session reply
+ * before sending it.
+ */
+
+#define HGFS_COMPOUND_MAX_REQUESTS           16
+
+/* HgfsRequestCompoundV4 flags. */
+#define HGFS_COMPOUND_FLAG_STOP_ON_ERROR     (1 << 0)  /* Skip the rest after a failure. */
+
+/* HgfsCompoundEntryV4 flags. */
+#define HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE  (1 << 0)  /* Use the last opened handle. */
+
+typedef
+#include "vmware_pack_begin.h"
+struct HgfsCompoundEntryV4 {
+   uint32 size;           /* Size of the request or reply that follows. */
+   uint32 flags;          /* Entry flags, see above. Zero in the reply. */
+}
+#include "vmware_pack_end.h"
+HgfsCompoundEntryV4;
+
+typedef
+#include "vmware_pack_begin.h"
+struct HgfsRequestCompoundV4 {
+   uint32 flags;          /* Compound flags, see above. */
+   uint32 numRequests;    /* Number of member requests that follow. */
+   uint64 reserved;       /* Reserved for future use. */
+}
+#include "vmware_pack_end.h"
+HgfsRequestCompoundV4;
+
+typedef
+#include "vmware_pack_begin.h"
+struct HgfsReplyCompoundV4 {
+   uint32 numReplies;     /* Number of member replies that follow. */
+   uint32 reserved1;      /* Reserved for future use. */
+   uint64 reserved;       /* Reserved for future use. */
+}
+#include "vmware_pack_end.h"
+HgfsReplyCompoundV4;
+
+/*
+ * Copy a byte range from one open file to another without moving the data
+ * through the client. Both handles must belong to the same shared folder,
+ * the source opened for reading and the destination for writing. The
+ * server may copy less than asked, the client repeats the request for the
+ * remainder; a zero actualSize means the source ended.
+ *
+ * Only the guest HGFS server implements it, host servers do not. A client
+ * must find it supported in the capabilities of the create session reply
+ * before sending it.
+ */
+
+typedef
+#include "vmware_pack_begin.h"
+struct HgfsRequestCopyFileRangeV4 {
+   HgfsHandle srcFile;    /* Opaque source file ID used by the server. */
+   HgfsHandle dstFile;    /* Opaque destination file ID used by the server. */
+   uint64 srcOffset;      /* Offset in the source to copy from. */
+   uint64 dstOffset;      /* Offset in the destination to copy to. */
+   uint64 length;         /* Number of bytes to copy. */
+   uint32 flags;          /* Reserved for future use, must be zero. */
+   uint32 reserved1;      /* Reserved for future use. */
+   uint64 reserved;       /* Reserved for future use. */
+}
+#include "vmware_pack_end.h"
+HgfsRequestCopyFileRangeV4;
+
+typedef
+#include "vmware_pack_begin.h"
+struct HgfsReplyCopyFileRangeV4 {
+   uint64 actualSize;     /* Number of bytes copied. */
+   uint64 reserved;       /* Reserved for future use. */
+}
+#include "vmware_pack_end.h"
+HgfsReplyCopyFileRangeV4;
+
 #endif /* _HGFS_PROTO_H_ */
@@ -47,6 +47,7 @@ typedef enum {
 typedef uint64 HgfsStateFlags;
 #define HGFS_STATE_CLIENT_REQUEST         (1 << 0)
 #define HGFS_STATE_ASYNC_REQUEST          (1 << 1)
+#define HGFS_STATE_COMPOUND_MEMBER        (1 << 2)
 typedef struct HgfsPacket {
    uint64 id;
 
@@ -222,6 +223,15 @@ Bool HgfsServer_ShareAccessCheck(HgfsOpenMode accessMode,
 uint32 HgfsServer_GetHandleCounter(void);
 void HgfsServer_SetHandleCounter(uint32 newHandleCounter);
 
+void HgfsServer_EnableStats(Bool enable);
+void HgfsServer_ResetStats(void);
+char *HgfsServer_GetStats(void);
+void HgfsServer_LogStats(void);
+
+Bool HgfsServer_SetShareLimits(const char *shareName,
+                               uint32 weight,
+                               uint64 bytesPerSec);
+
 #if defined(__cplusplus)
 }  // extern "C"
 #endif
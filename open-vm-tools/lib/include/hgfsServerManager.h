@@ -65,6 +65,11 @@ Bool HgfsServerManager_ProcessPacket(HgfsServerMgrData *mgrData,
                                      char *packetOut,
                                      size_t *packetOutSize);
 uint32 HgfsServerManager_InvalidateInactiveSessions(HgfsServerMgrData *mgrData);
+char *HgfsServerManager_QueryStats(HgfsServerMgrData *mgrData,
+                                  const char *command);
+Bool HgfsServerManager_SetShareLimits(HgfsServerMgrData *mgrData,
+                                      uint32 weight,
+                                      uint64 bytesPerSec);
 #endif
 
 #if defined(__cplusplus)
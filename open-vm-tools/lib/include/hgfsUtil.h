@@ -106,6 +106,7 @@ struct timespec {
 #define HGFS_ERROR_NOT_ENOUGH_MEMORY ERROR_NOT_ENOUGH_MEMORY
 #define HGFS_ERROR_TOO_MANY_SESSIONS ERROR_MAX_SESSIONS_REACHED
 #define HGFS_ERROR_INTERNAL          ERROR_INTERNAL_ERROR
+#define HGFS_ERROR_NOT_SAME_DEVICE   ERROR_NOT_SAME_DEVICE
 #else
 #define HGFS_ERROR_SUCCESS           0
 #define HGFS_ERROR_IO                EIO
@@ -122,6 +123,7 @@ struct timespec {
 #define HGFS_ERROR_NOT_ENOUGH_MEMORY ENOMEM
 #define HGFS_ERROR_TOO_MANY_SESSIONS ECONNREFUSED
 #define HGFS_ERROR_INTERNAL          EINTERNAL
+#define HGFS_ERROR_NOT_SAME_DEVICE   EXDEV
 #endif // _WIN32
 
 /*
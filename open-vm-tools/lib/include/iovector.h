@@ -68,6 +68,12 @@ typedef struct VMIOVec {
 VMIOVec* IOV_Split(VMIOVec *regionV,
                    SectorType numSectors,
                    uint32 sectorSize);
+void IOV_SplitStatic(VMIOVec *origV,
+                     SectorType numSectors,
+                     uint32 sectorSize,
+                     int numStaticEntries,
+                     struct iovec *staticEntries,
+                     VMIOVec *regionV);
 
 void IOV_Log(const VMIOVec *iov);
 void IOV_Zero(VMIOVec *iov);
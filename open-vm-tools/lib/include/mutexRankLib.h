@@ -58,6 +58,7 @@ extern "C" {
  * hgfs locks
  */
 #define RANK_hgfsSessionArrayLock    (RANK_libLockBase + 0x4010)
+#define RANK_hgfsNotifyDeliveryLock  (RANK_libLockBase + 0x4020)
 #define RANK_hgfsSharedFolders       (RANK_libLockBase + 0x4030)
 #define RANK_hgfsNotifyLock          (RANK_libLockBase + 0x4040)
 #define RANK_hgfsFileIOLock          (RANK_libLockBase + 0x4050)
@@ -65,6 +66,9 @@ extern "C" {
 #define RANK_hgfsNodeArrayLock       (RANK_libLockBase + 0x4070)
 #define RANK_hgfsActivateLock        (RANK_libLockBase + 0x4080)
 #define RANK_hgfsThreadpoolLock      (RANK_libLockBase + 0x4090)
+#define RANK_hgfsNameCacheLock       (RANK_libLockBase + 0x40A0)
+#define RANK_hgfsOplockLock          (RANK_libLockBase + 0x40B0)
+#define RANK_hgfsStatFsCacheLock     (RANK_libLockBase + 0x40C0)
 
 /*
  * vigor (must be < VMDB range and < disklib, see bug 741290)
@@ -185,6 +189,7 @@ extern "C" {
  *
  * At least:
  *    impersonate < pollDefault
+ *    pollLoopCb < pollDefault
  *    keyLocator < preference (for checking AESNI)
  *    keyLocator < sslState (bug 743010)
  *    configDb < keyLocator (for unlocking dictionaries)
@@ -198,6 +203,7 @@ extern "C" {
 #define RANK_batteryLock             (RANK_libLockBase + 0x7030)
 #define RANK_buttonLock              (RANK_libLockBase + 0x7040)
 #define RANK_impersonateLock         (RANK_libLockBase + 0x7045)
+#define RANK_pollLoopCbLock          (RANK_libLockBase + 0x7048)
 #define RANK_pollDefaultLock         (RANK_libLockBase + 0x7050)
 #define RANK_workerLibLock           (RANK_libLockBase + 0x7060)
 #define RANK_configDbLock            (RANK_libLockBase + 0x7070)
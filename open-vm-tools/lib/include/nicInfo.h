@@ -83,6 +83,9 @@ Bool
 GuestInfo_IsEqual_WinsConfigInfo(const WinsConfigInfo *a,
                                  const WinsConfigInfo *b);
 
+uint64
+GuestInfo_Hash_NicInfoV3(const NicInfoV3 *info);
+
 void GuestInfo_SetIfaceExcludeList(char **list);
 
 void GuestInfo_SetIfacePrimaryList(char **list);
@@ -93,4 +96,25 @@ Bool GuestInfo_IfaceIsExcluded(const char *name);
 
 NicInfoPriority GuestInfo_IfaceGetPriority(const char *name);
 
+#if defined __linux__ && !defined USERWORLD
+/*
+ * Link lookups served from the netlink model of the NIC gathers. They return
+ * FALSE when netlink is not usable and the system must be queried instead.
+ */
+
+Bool GuestInfo_LinkCacheGetPrimaryIPv4(char *ipstr,
+                                       size_t size);
+
+Bool GuestInfo_LinkCacheGetIfIndex(const char *ifName,
+                                   int *ifIndex);
+
+Bool GuestInfo_LinkCacheGetIfName(int ifIndex,
+                                  char *ifName,
+                                  size_t size);
+
+Bool GuestInfo_LinkCacheGetHwAddr(int ifIndex,
+                                  uint8 mac[6],
+                                  size_t *macLen);
+#endif
+
 #endif
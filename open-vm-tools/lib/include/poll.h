@@ -245,6 +245,7 @@ typedef struct PollOptions {
 void Poll_InitDefault(void);
 void Poll_InitDefaultEx(const PollOptions *opts);
 void Poll_InitGtk(void); // On top of glib for Linux
+void Poll_InitEpoll(void); // On top of epoll/kqueue for Linux and FreeBSD
 void Poll_InitCF(void);  // On top of CoreFoundation for OSX
 
 
@@ -255,6 +256,7 @@ int Poll_SocketPair(Bool vmci, Bool stream, int fds[2]);
 void Poll_Loop(Bool loop, Bool *exit, PollClass c);
 void Poll_LoopTimeout(Bool loop, Bool *exit, PollClass c, int timeout);
 Bool Poll_LockingEnabled(void);
+Bool Poll_IsInitialized(void);
 void Poll_Exit(void);
 
 
@@ -291,6 +293,47 @@ Bool Poll_CallbackRemoveOneByCB(PollClassSet classSet,
 
 void Poll_NotifyChange(PollClassSet classSet);
 
+/*
+ * Independent poll loops, for programs spreading their callbacks over more
+ * than one thread. Each loop is dispatched by the thread calling
+ * Poll_LoopRun, and fires its callbacks on that thread. Any thread may add
+ * and remove callbacks. Loops are provided by the epoll/kqueue
+ * implementation, whichever implementation runs the default loop.
+ *
+ * A loop group is a set of loops each run by its own thread, one per CPU
+ * by default. Poll_LoopGroupPick returns the loop with the fewest devices.
+ */
+typedef struct PollLoop PollLoop;
+typedef struct PollLoopGroup PollLoopGroup;
+
+PollLoop *Poll_LoopCreate(void);
+void Poll_LoopDestroy(PollLoop *loop);
+void Poll_LoopRun(PollLoop *loop);
+void Poll_LoopStop(PollLoop *loop);
+PollLoop *Poll_LoopGetCurrent(void);
+MXUserRecLock *Poll_LoopGetLock(PollLoop *loop);
+unsigned int Poll_LoopGetLoad(PollLoop *loop);
+VMwareStatus Poll_LoopCallback(PollLoop *loop,
+                               PollClassSet classSet,
+                               int flags,
+                               PollerFunction f,
+                               void *clientData,
+                               PollEventType type,
+                               PollDevHandle info, // fd/microsec delay
+                               MXUserRecLock *lck);
+Bool Poll_LoopCallbackRemove(PollLoop *loop,
+                             PollClassSet classSet,
+                             int flags,
+                             PollerFunction f,
+                             void *clientData,
+                             PollEventType type);
+
+PollLoopGroup *Poll_LoopGroupCreate(const char *name, unsigned int numLoops);
+void Poll_LoopGroupDestroy(PollLoopGroup *group);
+unsigned int Poll_LoopGroupSize(const PollLoopGroup *group);
+PollLoop *Poll_LoopGroupGet(const PollLoopGroup *group, unsigned int i);
+PollLoop *Poll_LoopGroupPick(PollLoopGroup *group);
+
 /*
  * Wrappers for Poll_Callback and Poll_CallbackRemove that present
  * simpler subsets of those interfaces.
@@ -122,6 +122,14 @@ typedef struct ProcMgr_ProcArgs {
     * started.
     */
    char *workingDirectory;
+
+   /*
+    * If positive, the descriptors the process's stdout and stderr are
+    * redirected to. Only used by ProcMgr_ExecAsync; 0 keeps the current
+    * ones.
+    */
+   int stdoutFd;
+   int stderrFd;
 #endif
 } ProcMgr_ProcArgs;
 
@@ -138,6 +146,23 @@ typedef int Selectable;
 
 ProcMgrProcInfoArray *ProcMgr_ListProcesses(void);
 
+/*
+ * Fields of ProcMgrProcInfo filled by ProcMgr_ListProcessesSelect(), the
+ * others are left NULL or 0. The process id is always filled.
+ */
+#define PROCMGR_INFO_CMDNAME     (1 << 0)
+#define PROCMGR_INFO_ABSPATH     (1 << 1)
+#define PROCMGR_INFO_CMDLINE     (1 << 2)
+#define PROCMGR_INFO_OWNER       (1 << 3)
+#define PROCMGR_INFO_STARTTIME   (1 << 4)
+#define PROCMGR_INFO_ALL         ((1 << 5) - 1)
+
+#if defined(__linux__)
+ProcMgrProcInfoArray *ProcMgr_ListProcessesSelect(unsigned int fields);
+#else
+#define ProcMgr_ListProcessesSelect(fields) ProcMgr_ListProcesses()
+#endif
+
 #if defined(_WIN32)
 ProcMgrProcInfoArray *ProcMgr_ListProcessesEx(Bool useRemoteThreadForCmdLine,
                                               Bool useWMIForCmdLine);
@@ -37,6 +37,13 @@ typedef void RpcIn_ClearErrorFunc(void *clientData);
 
 typedef struct RpcIn RpcIn;
 
+/* Activity counters of an RpcIn channel. */
+typedef struct RpcInStats {
+   uint64 rpcs;          // RPCs received from the host
+   uint64 idleWakeups;   // Backdoor polls with nothing to do, heartbeats
+   Bool vsock;           // Receiving on vsocket rather than polling
+} RpcInStats;
+
 #if defined(VMTOOLS_USE_GLIB) /* { */
 
 #include "vmware/tools/guestrpc.h"
@@ -50,6 +57,10 @@ Bool RpcIn_start(RpcIn *in, unsigned int delay,
                  RpcIn_ClearErrorFunc *clearErrorFunc,
                  void *errorData);
 
+Bool RpcIn_DeferReply(RpcIn *in);
+void RpcIn_CompleteReply(RpcIn *in, Bool status,
+                         const char *result, size_t resultLen);
+
 #else /* } { */
 
 #include "dbllnklst.h"
@@ -91,6 +102,7 @@ unsigned int RpcIn_SetRetVals(char const **result, size_t *resultLen,
 
 void RpcIn_Destruct(RpcIn *in);
 void RpcIn_stop(RpcIn *in);
+void RpcIn_GetStats(RpcIn *in, RpcInStats *stats);
 
 #ifdef __cplusplus
 } // extern "C"
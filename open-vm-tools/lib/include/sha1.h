@@ -83,6 +83,7 @@ extern "C" {
 #define SHA1Update           VMW_SHA1Update
 #define SHA1Final            VMW_SHA1Final
 #define SHA1RawBufferHash    VMW_SHA1RawBufferHash
+#define SHA1MultiBuffer      VMW_SHA1MultiBuffer
 
 #endif /* !VMKERNEL */
 
@@ -127,6 +128,7 @@ void SHA1RawTransformBlocks(uint32 state[5],
                             const unsigned char *buffer,
                             uint32 numBlocks);
 void SHA1RawInit(uint32 state[5]);
+#endif
 
 #define SHA1_MULTI_MAX_BUFFERS 8
 
@@ -136,7 +138,6 @@ void SHA1MultiBuffer(uint32 numBuffers,
                      uint32 saltLen,
                      const void *data[],
                      unsigned char *digests[]);
-#endif
 
 #endif // defined __APPLE__ && defined USERLEVEL
 
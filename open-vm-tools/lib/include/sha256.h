@@ -0,0 +1,98 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*********************************************************
+ * The contents of this file are subject to the terms of the Common
+ * Development and Distribution License (the "License") version 1.0
+ * and no later version.  You may not use this file except in
+ * compliance with the License.
+ *
+ * You can obtain a copy of the License at
+ *         http://www.opensource.org/licenses/cddl1.php
+ *
+ * See the License for the specific language governing permissions
+ * and limitations under the License.
+ *
+ *********************************************************/
+
+/*
+ * sha256.h --
+ *
+ *	SHA-256 hashing, FIPS PUB 180-4.
+ */
+
+#ifndef _SHA256_H_
+#define _SHA256_H_
+
+#define INCLUDE_ALLOW_MODULE
+#define INCLUDE_ALLOW_USERLEVEL
+#define INCLUDE_ALLOW_VMKERNEL
+#define INCLUDE_ALLOW_VMCORE
+#include "includeCheck.h"
+
+#include "vm_basic_types.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+
+#if defined __APPLE__ && defined USERLEVEL
+
+#include <CommonCrypto/CommonDigest.h>
+
+#define SHA256_HASH_LEN CC_SHA256_DIGEST_LENGTH
+#define SHA256Context   CC_SHA256_CTX
+#define SHA256Init      CC_SHA256_Init
+#define SHA256Update    CC_SHA256_Update
+#define SHA256Final     CC_SHA256_Final
+
+#else
+
+#ifndef VMKERNEL
+
+/* Same as for SHA1, do not clash with the OpenSSL symbols. */
+
+#define SHA256Init           VMW_SHA256Init
+#define SHA256Update         VMW_SHA256Update
+#define SHA256Final          VMW_SHA256Final
+
+#endif /* !VMKERNEL */
+
+#define SHA256_HASH_LEN      32
+
+typedef struct SHA256Context {
+    uint32 state[8];
+    uint64 count;             // In bytes.
+    unsigned char buffer[64];
+} SHA256Context;
+
+void SHA256Init(SHA256Context *context);
+void SHA256Update(SHA256Context *context,
+                  const unsigned char *data,
+                  size_t len);
+void SHA256Final(unsigned char digest[SHA256_HASH_LEN],
+                 SHA256Context *context);
+
+#endif // defined __APPLE__ && defined USERLEVEL
+
+#if defined(__cplusplus)
+}  // extern "C"
+#endif
+
+#endif // ifndef _SHA256_H_
@@ -67,6 +67,7 @@ int Id_SetREUid(uid_t ruid, uid_t euid);
 int Id_SetREGid(gid_t rgid, gid_t egid);
 int Id_SetRESUid(uid_t ruid, uid_t euid, uid_t suid);
 int Id_SetRESGid(gid_t rgid, gid_t egid, gid_t sgid);
+int Id_SetGroups(size_t ngroups, const gid_t *groups);
 
 /* For symmetry */
 #define Id_GetEUid() geteuid()
@@ -59,6 +59,17 @@ void SyncDriver_CloseHandle(SyncDriverHandle *handle);
 #if defined(__linux__)
 void SyncDriver_GetAttr(const SyncDriverHandle handle, const char **name,
                         Bool *quiesces);
+
+/* How long flushing and freezing one file system took. */
+typedef struct SyncDriverFsTime {
+   char *path;
+   uint64 flushUsecs;      // 0 unless flushed in parallel before freezing
+   uint64 freezeUsecs;
+} SyncDriverFsTime;
+
+size_t SyncDriver_GetFreezeTimes(const SyncDriverHandle handle,
+                                 const SyncDriverFsTime **times);
+void SyncDriver_SetParallelFreeze(Bool enable);
 #endif
 
 #endif
@@ -0,0 +1,56 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * toolsProbe.h --
+ *
+ *    Static tracepoints (USDT probes) of the "vmtools" provider, for
+ *    bpftrace, perf, SystemTap and the like:
+ *
+ *       bpftrace -e 'usdt:/usr/bin/vmtoolsd:vmtools:rpc__dispatch__entry
+ *                    { printf("%s\n", str(arg0)); }'
+ *
+ *    With <sys/sdt.h> (systemtap-sdt-devel), a probe is a single nop and an
+ *    ELF note describing where its arguments are, which a tracer turns into
+ *    a breakpoint when attached. The arguments are still computed, so they
+ *    should be values at hand. Without <sys/sdt.h>, probes compile to
+ *    nothing. Arguments must be integers or pointers.
+ *
+ *    Probe names use "__" for "-", as in DTrace.
+ */
+
+#ifndef _TOOLSPROBE_H_
+#define _TOOLSPROBE_H_
+
+#if defined(__GNUC__) && defined(HAVE_SYS_SDT_H)
+#   include <sys/sdt.h>
+#   define TOOLS_PROBE0(name)              DTRACE_PROBE(vmtools, name)
+#   define TOOLS_PROBE1(name, a)           DTRACE_PROBE1(vmtools, name, a)
+#   define TOOLS_PROBE2(name, a, b)        DTRACE_PROBE2(vmtools, name, a, b)
+#   define TOOLS_PROBE3(name, a, b, c)     DTRACE_PROBE3(vmtools, name, a, b, c)
+#   define TOOLS_PROBE4(name, a, b, c, d)  DTRACE_PROBE4(vmtools, name, a, b, \
+                                                          c, d)
+#else
+#   define TOOLS_PROBE0(name)              do { } while (0)
+#   define TOOLS_PROBE1(name, a)           do { } while (0)
+#   define TOOLS_PROBE2(name, a, b)        do { } while (0)
+#   define TOOLS_PROBE3(name, a, b, c)     do { } while (0)
+#   define TOOLS_PROBE4(name, a, b, c, d)  do { } while (0)
+#endif
+
+#endif /* _TOOLSPROBE_H_ */
@@ -57,6 +57,11 @@ void MXUser_ReleaseExclLock(MXUserExclLock *lock);
 void MXUser_DestroyExclLock(MXUserExclLock *lock);
 Bool MXUser_IsCurThreadHoldingExclLock(MXUserExclLock *lock);
 
+#define MXUSER_ADAPTIVE_SPIN_DEFAULT 100  // retries
+
+void MXUser_SetAdaptiveSpinExclLock(MXUserExclLock *lock,
+                                    uint32 spinLimit);
+
 /* Use only when necessary */
 MXUserExclLock *MXUser_CreateSingletonExclLockInt(Atomic_Ptr *lockStorage,
                                                   const char *name,
@@ -180,6 +185,9 @@ Bool MXUser_SetContentionDurationFloorRecLock(MXUserRecLock *lock,
 MXUserRWLock *MXUser_CreateRWLock(const char *name,
                                    MX_Rank rank);
 
+MXUserRWLock *MXUser_CreateRWLockReaderBiased(const char *name,
+                                              MX_Rank rank);
+
 void MXUser_AcquireForRead(MXUserRWLock *lock);
 void MXUser_AcquireForWrite(MXUserRWLock *lock);
 void MXUser_ReleaseRWLock(MXUserRWLock *lock);
@@ -321,6 +329,9 @@ void MXUser_SetStatsFunc(void *context,
                                            const char *fmt,
                                            va_list ap));
 
+void MXUser_SetContentionSampling(uint32 period);
+char *MXUser_TopContendedLocks(uint32 maxLocks);
+
 void MXUser_SetInPanic(void);
 Bool MXUser_InPanic(void);
 
@@ -112,6 +112,7 @@ enum {
    VIX_REQUESTMSG_ESCAPE_XML_DATA                     = 0x040,
    VIX_REQUESTMSG_HAS_HASHED_SHARED_SECRET            = 0x080,
    VIX_REQUESTMSG_VIGOR_COMMAND                       = 0x100,
+   VIX_REQUESTMSG_CAPTURE_PROGRAM_OUTPUT              = 0x200,
 };
 
 
@@ -756,6 +757,26 @@ struct VixMsgListFilesRequest {
 #include "vmware_pack_end.h"
 VixMsgListFilesRequest;
 
+/*
+ * Get the extended file info of several guest paths with one command.
+ *
+ * The request is followed by numPaths NUL terminated paths, pathsLength
+ * bytes in all. The reply is formatted like the ListFiles one: the
+ * truncation flag and the number of paths left out, then for each path, in
+ * order, its <fxi> element, or an <fxe> element with the path and the Vix
+ * error it got.
+ */
+typedef
+#include "vmware_pack_begin.h"
+struct VixMsgGetMultipleFileInfoRequest {
+   VixCommandRequestHeader header;
+
+   uint32                  numPaths;
+   uint32                  pathsLength;
+}
+#include "vmware_pack_end.h"
+VixMsgGetMultipleFileInfoRequest;
+
 typedef
 #include "vmware_pack_begin.h"
 struct VixCommandInitiateFileTransferToGuestRequest {
@@ -1618,6 +1639,50 @@ struct VixMsgListProcessesExRequest {
 #include "vmware_pack_end.h"
 VixMsgListProcessesExRequest;
 
+/*
+ * Read the output of a program started with
+ * VIX_REQUESTMSG_CAPTURE_PROGRAM_OUTPUT.
+ *
+ * Each stream is kept in a bounded ring buffer, so only its most recent
+ * output can be read. offset counts the bytes the program has written
+ * to the stream since it started.
+ *
+ * The request must set VIX_COMMAND_GUEST_RETURNS_BINARY. The reply is a
+ * VixMsgReadProgramOutputResponse followed by dataLength bytes, starting
+ * at dataOffset. dataOffset is past the requested offset when the
+ * output there was overwritten already.
+ */
+enum {
+   VIX_PROGRAM_OUTPUT_STDOUT     = 0,
+   VIX_PROGRAM_OUTPUT_STDERR     = 1,
+};
+
+typedef
+#include "vmware_pack_begin.h"
+struct VixMsgReadProgramOutputRequest {
+   VixCommandRequestHeader header;
+
+   uint64                  pid;
+   uint32                  stream;
+   uint64                  offset;
+   uint32                  maxLength;
+}
+#include "vmware_pack_end.h"
+VixMsgReadProgramOutputRequest;
+
+typedef
+#include "vmware_pack_begin.h"
+struct VixMsgReadProgramOutputResponse {
+   uint64                  dataOffset;
+   uint64                  totalLength;   // Bytes written so far
+   uint32                  eof;           // The stream is closed
+   uint32                  dataLength;
+
+   /* Followed by dataLength bytes of output. */
+}
+#include "vmware_pack_end.h"
+VixMsgReadProgramOutputResponse;
+
 typedef
 #include "vmware_pack_begin.h"
 struct VixMsgReadEnvironmentVariablesRequest {
@@ -1704,6 +1769,48 @@ struct VixMsgListMappedAliasesRequest {
 #include "vmware_pack_end.h"
 VixMsgListMappedAliasesRequest;
 
+/*
+ * **********************************************************
+ * Run several guest operations with a single round trip.
+ *
+ * The request is followed by numCommands complete request messages,
+ * each one totalMessageLength bytes, that run in order under the
+ * impersonation of the batch. Their own credentials are ignored.
+ *
+ * The request must set VIX_COMMAND_GUEST_RETURNS_BINARY. The reply is a
+ * VixMsgBatchResult, followed by its result, for each command that ran.
+ * There are fewer of them than commands if the batch stopped early.
+ */
+enum {
+   VIX_BATCH_STOP_ON_ERROR       = 0x01,
+};
+
+typedef
+#include "vmware_pack_begin.h"
+struct VixMsgBatchRequest {
+   VixCommandRequestHeader header;
+
+   uint32                  options;
+   uint32                  numCommands;
+
+   /* Followed by the request messages. */
+}
+#include "vmware_pack_end.h"
+VixMsgBatchRequest;
+
+typedef
+#include "vmware_pack_begin.h"
+struct VixMsgBatchResult {
+   uint32                  opCode;
+   int64                   error;
+   uint32                  additionalError;
+   uint32                  resultLength;
+
+   /* Followed by resultLength bytes of result. */
+}
+#include "vmware_pack_end.h"
+VixMsgBatchResult;
+
 /*
  * Windows Registry Management Support.
  */
@@ -2371,6 +2478,10 @@ enum {
 
    VIX_COMMAND_REMOVE_AUTH_ALIAS_BY_CERT        = 207,
 
+   VIX_COMMAND_BATCH                            = 208,
+   VIX_COMMAND_READ_PROGRAM_OUTPUT              = 209,
+   VIX_COMMAND_GET_MULTIPLE_FILE_INFO           = 210,
+
    /*
     * HOWTO: Adding a new Vix Command. Step 2a.
     *
@@ -2381,7 +2492,7 @@ enum {
     * Once a new command is added here, a command info field needs to be added
     * in bora/lib/foundryMsg/foundryMsg.c as well.
     */
-   VIX_COMMAND_LAST_NORMAL_COMMAND              = 208,
+   VIX_COMMAND_LAST_NORMAL_COMMAND              = 211,
 
    VIX_TEST_UNSUPPORTED_TOOLS_OPCODE_COMMAND    = 998,
    VIX_TEST_UNSUPPORTED_VMX_OPCODE_COMMAND      = 999,
@@ -2506,6 +2617,16 @@ VixMsg_AllocResponseMsg(const struct VixCommandRequestHeader *requestHeader,
                         const void *responseBody,
                         size_t *responseMsgLength);
 
+struct VixCommandResponseHeader *
+VixMsg_WriteResponseMsg(const struct VixCommandRequestHeader *requestHeader,
+                        VixError error,
+                        uint32 additionalError,
+                        size_t responseBodyLength,
+                        const void *responseBody,
+                        void *buffer,
+                        size_t bufferSize,
+                        size_t *responseMsgLength);
+
 void VixMsg_InitResponseMsg(struct VixCommandResponseHeader *responseHeader,
                             const struct VixCommandRequestHeader *requestHeader,
                             VixError error,
@@ -2530,6 +2651,12 @@ VixError VixMsg_DeObfuscateNamePassword(const char *packagedName,
                                         char **userNameResult,
                                         char **passwordResult);
 
+VixError VixMsg_DeObfuscateNamePasswordInBuffer(const char *packagedName,
+                                                char **packedBuffer,
+                                                size_t *packedBufferLength,
+                                                const char **userName,
+                                                const char **password);
+
 VixError VixMsg_EncodeString(const char *str, char **result);
 
 VixError VixMsg_DecodeString(const char *str, char **result);
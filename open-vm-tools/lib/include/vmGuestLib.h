@@ -470,6 +470,132 @@ VMGuestLib_GetHostMemUnmappedMB(VMGuestLibHandle handle,    // IN
                                 uint64 *hostMemUnmappedMB); // OUT
 
 
+/*
+ * Bulk retrieval.
+ *
+ * VMGuestLib_GetStats() copies all the integral statistics of the last
+ * VMGuestLib_UpdateInfo() into a VMGuestLibStats, checking its arguments
+ * once and walking the statistics once, for callers that sample all of
+ * them: it is equivalent to, and cheaper than, calling each accessor
+ * below in turn.
+ *
+ * Bit VMGUESTLIB_STAT_xxx of 'available' is set for each statistic the
+ * host provided; the fields of the other statistics are zeroed. statsSize
+ * is the size in bytes of the caller's VMGuestLibStats, normally
+ * sizeof *stats, which lets the structure grow in later releases. As with
+ * VMGuestLib_GetMemShares64(), memShares64 falls back to memShares on
+ * hosts that do not provide it.
+ *
+ * If VMGuestLib_UpdateInfo() has never been called,
+ * VMGUESTLIB_ERROR_NO_INFO is returned.
+ */
+
+typedef enum {
+   VMGUESTLIB_STAT_CPU_RESERVATION_MHZ,
+   VMGUESTLIB_STAT_CPU_LIMIT_MHZ,
+   VMGUESTLIB_STAT_CPU_SHARES,
+   VMGUESTLIB_STAT_CPU_USED_MS,
+   VMGUESTLIB_STAT_HOST_MHZ,
+   VMGUESTLIB_STAT_MEM_RESERVATION_MB,
+   VMGUESTLIB_STAT_MEM_LIMIT_MB,
+   VMGUESTLIB_STAT_MEM_SHARES,
+   VMGUESTLIB_STAT_MEM_MAPPED_MB,
+   VMGUESTLIB_STAT_MEM_ACTIVE_MB,
+   VMGUESTLIB_STAT_MEM_OVERHEAD_MB,
+   VMGUESTLIB_STAT_MEM_BALLOONED_MB,
+   VMGUESTLIB_STAT_MEM_SWAPPED_MB,
+   VMGUESTLIB_STAT_MEM_SHARED_MB,
+   VMGUESTLIB_STAT_MEM_SHARED_SAVED_MB,
+   VMGUESTLIB_STAT_MEM_USED_MB,
+   VMGUESTLIB_STAT_ELAPSED_MS,
+   VMGUESTLIB_STAT_CPU_STOLEN_MS,
+   VMGUESTLIB_STAT_MEM_TARGET_SIZE_MB,
+   VMGUESTLIB_STAT_HOST_NUM_CPU_CORES,
+   VMGUESTLIB_STAT_HOST_CPU_USED_MS,
+   VMGUESTLIB_STAT_HOST_MEM_SWAPPED_MB,
+   VMGUESTLIB_STAT_HOST_MEM_SHARED_MB,
+   VMGUESTLIB_STAT_HOST_MEM_USED_MB,
+   VMGUESTLIB_STAT_HOST_MEM_PHYS_MB,
+   VMGUESTLIB_STAT_HOST_MEM_PHYS_FREE_MB,
+   VMGUESTLIB_STAT_HOST_MEM_KERN_OVHD_MB,
+   VMGUESTLIB_STAT_HOST_MEM_MAPPED_MB,
+   VMGUESTLIB_STAT_HOST_MEM_UNMAPPED_MB,
+   VMGUESTLIB_STAT_MEM_ZIPPED_MB,
+   VMGUESTLIB_STAT_MEM_ZIP_SAVED_MB,
+   VMGUESTLIB_STAT_MEM_LL_SWAPPED_MB,
+   VMGUESTLIB_STAT_MEM_SWAP_TARGET_MB,
+   VMGUESTLIB_STAT_MEM_BALLOON_TARGET_MB,
+   VMGUESTLIB_STAT_MEM_BALLOON_MAX_MB,
+   VMGUESTLIB_STAT_MEM_SHARES_64,
+   VMGUESTLIB_STAT_MAX
+} VMGuestLibStatId;
+
+#define VMGUESTLIB_STAT_IS_AVAILABLE(stats, id) \
+   ((((stats)->available) >> (id)) & 1)
+
+typedef struct VMGuestLibStats {
+   uint64 available;            // Bit mask of VMGuestLibStatId
+
+   uint32 cpuReservationMHz;
+   uint32 cpuLimitMHz;
+   uint32 cpuShares;
+   uint64 cpuUsedMs;
+   uint32 hostMHz;
+   uint32 memReservationMB;
+   uint32 memLimitMB;
+   uint32 memShares;
+   uint32 memMappedMB;
+   uint32 memActiveMB;
+   uint32 memOverheadMB;
+   uint32 memBalloonedMB;
+   uint32 memSwappedMB;
+   uint32 memSharedMB;
+   uint32 memSharedSavedMB;
+   uint32 memUsedMB;
+   uint64 elapsedMs;
+   uint64 cpuStolenMs;
+   uint64 memTargetSizeMB;
+   uint32 hostNumCpuCores;
+   uint64 hostCpuUsedMs;
+   uint64 hostMemSwappedMB;
+   uint64 hostMemSharedMB;
+   uint64 hostMemUsedMB;
+   uint64 hostMemPhysMB;
+   uint64 hostMemPhysFreeMB;
+   uint64 hostMemKernOvhdMB;
+   uint64 hostMemMappedMB;
+   uint64 hostMemUnmappedMB;
+   uint32 memZippedMB;
+   uint32 memZipSavedMB;
+   uint32 memLLSwappedMB;
+   uint32 memSwapTargetMB;
+   uint32 memBalloonTargetMB;
+   uint32 memBalloonMaxMB;
+   uint64 memShares64;
+} VMGuestLibStats;
+
+VMGuestLibError VMGuestLib_GetStats(VMGuestLibHandle handle, // IN
+                                    VMGuestLibStats *stats,  // OUT
+                                    size_t statsSize);       // IN
+
+
+/*
+ * Update cookie.
+ *
+ * The update cookie of a handle changes whenever VMGuestLib_UpdateInfo()
+ * brings statistics that differ from those of the previous update, which
+ * includes a change of session. Polling agents can keep the cookie of the
+ * statistics they last processed and skip recomputing anything derived
+ * from them while VMGuestLib_GetUpdateCookie() returns the same value.
+ *
+ * If VMGuestLib_UpdateInfo() has never been called,
+ * VMGUESTLIB_ERROR_NO_INFO is returned.
+ */
+
+VMGuestLibError VMGuestLib_GetUpdateCookie(VMGuestLibHandle handle, // IN
+                                           uint64 *cookie);         // OUT
+
+
 /*
  * Semi-structured hypervisor stats collection, for troubleshooting.
  */
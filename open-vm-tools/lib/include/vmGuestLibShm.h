@@ -0,0 +1,72 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * vmGuestLibShm.h --
+ *
+ *      Layout of the segment through which vmtoolsd shares the guestlib
+ *      statistics with libguestlib, so that the backdoor is queried once
+ *      per refresh interval instead of once per consumer.
+ *
+ *      The segment is a root owned, world readable file in a tmpfs, which
+ *      the consumers map read-only. The writer bumps 'seq' to an odd value
+ *      before updating the segment and to an even one after, readers retry
+ *      if 'seq' was odd or changed while they copied the reply.
+ */
+
+#ifndef _VM_GUEST_LIB_SHM_H_
+#define _VM_GUEST_LIB_SHM_H_
+
+#define INCLUDE_ALLOW_USERLEVEL
+#include "includeCheck.h"
+
+#include "vm_basic_types.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define VMGUESTLIB_SHM_PATH      "/var/run/vmware/guestlibStats"
+#define VMGUESTLIB_SHM_MAGIC     0x4d48534c   /* "LSHM" */
+#define VMGUESTLIB_SHM_VERSION   1
+#define VMGUESTLIB_SHM_SIZE      (64 * 1024)
+
+/*
+ * Readers ignore a reply older than this many refresh intervals, e.g. when
+ * vmtoolsd stopped or the host stopped answering.
+ */
+#define VMGUESTLIB_SHM_STALE_INTERVALS  3
+
+typedef struct VMGuestLibShm {
+   uint32 magic;
+   uint32 version;
+   volatile uint32 seq;       // Odd while the writer updates the segment.
+   uint32 interval;           // Refresh interval, in seconds.
+   uint64 updateTime;         // CLOCK_MONOTONIC of the reply, in usecs.
+   uint32 dataVersion;        // Version of the guestlib.info.get reply.
+   uint32 replyLen;           // 0 if the host did not answer.
+   char reply[0];
+} VMGuestLibShm;
+
+#define VMGUESTLIB_SHM_MAX_REPLY (VMGUESTLIB_SHM_SIZE - sizeof (VMGuestLibShm))
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* _VM_GUEST_LIB_SHM_H_ */
@@ -66,6 +66,8 @@
 #define TOOLSOPTION_ENABLE_MESSAGE_BUS_TUNNEL     "enableMessageBusTunnel"
 #define TOOLSOPTION_GUEST_LOG_LEVEL               "guestLogLevel"
 #define TOOLSOPTION_ENABLE_APPINFO                "enableAppInfo"
+#define TOOLSOPTION_ENABLE_COMPACT_GUESTSTATS     "enableCompactGuestStats"
+#define TOOLSOPTION_GUESTSTATS_BURST              "guestStatsBurst"
 
 /*
  * Auto-upgrade commands.
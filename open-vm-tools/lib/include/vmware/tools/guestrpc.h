@@ -47,6 +47,18 @@ G_BEGIN_DECLS
 
 typedef struct _RpcChannel RpcChannel;
 
+/** How an RPC handler is dispatched, see RpcChannelCallback. */
+typedef enum RpcChannelPriority {
+   /** Run on the thread of the channel's main context. */
+   RPCCHANNEL_PRIORITY_NORMAL = 0,
+   /**
+    * Handler that may run for a long time and does not need the main
+    * context: run by the channel's bulk runner when one is set, see
+    * RpcChannel_SetBulkRunner. The handler must be thread-safe.
+    */
+   RPCCHANNEL_PRIORITY_BULK
+} RpcChannelPriority;
+
 /** Data structure passed to RPC callbacks. */
 typedef struct RpcInData {
    /** RPC name. */
@@ -74,6 +86,8 @@ typedef struct RpcInData {
    void *appCtx;
    /** Client data specified in the registration data. */
    void *clientData;
+   /** Memory released after the reply is sent, see RpcChannel_Alloc. */
+   struct RpcInArena *arena;
 } RpcInData;
 
 typedef enum RpcChannelType {
@@ -112,6 +126,8 @@ typedef struct RpcChannelCallback {
     * for deserializing the input data.
     */
    size_t            xdrInSize;
+   /** How the callback is dispatched. */
+   RpcChannelPriority priority;
 } RpcChannelCallback;
 
 /**
@@ -133,6 +149,49 @@ typedef void (*RpcChannelResetCb)(RpcChannel *chan,
  */
 typedef void (*RpcChannelFailureCb)(gpointer _state);
 
+/**
+ * Signature for the dispatch observer of an RpcChannel, called on the
+ * dispatching thread before and after each incoming RPC is handled.
+ *
+ * @param[in]  name     Name of the RPC.
+ * @param[in]  done     FALSE before the handler runs, TRUE after.
+ * @param[in]  data     Client data.
+ */
+typedef void (*RpcChannelDispatchCb)(const char *name,
+                                     gboolean done,
+                                     gpointer data);
+
+/** An RPC whose handler runs off the main context, see RpcChannel_RunBulk. */
+typedef struct RpcChannelBulkJob RpcChannelBulkJob;
+
+/**
+ * Signature for the bulk runner of an RpcChannel, which runs the handlers
+ * of RPCCHANNEL_PRIORITY_BULK RPCs by calling RpcChannel_RunBulk, e.g. on a
+ * worker thread. Called on the dispatching thread.
+ *
+ * @param[in]  job      The RPC to run.
+ * @param[in]  data     Client data.
+ *
+ * @return Whether the job will be run. If not, the channel runs it on the
+ *         dispatching thread instead.
+ */
+typedef gboolean (*RpcChannelBulkRunner)(RpcChannelBulkJob *job,
+                                         gpointer data);
+
+/**
+ * Signature for the completion callback of RpcChannel_SendAsync.
+ *
+ * @param[in]  status     TRUE if the RPC was successful.
+ * @param[in]  result     Reply, or a description of the error. Only valid
+ *                        during the call.
+ * @param[in]  resultLen  Number of bytes in the reply.
+ * @param[in]  data       Client data.
+ */
+typedef void (*RpcChannelAsyncCb)(gboolean status,
+                                  const char *result,
+                                  size_t resultLen,
+                                  gpointer data);
+
 
 gboolean
 RpcChannel_Start(RpcChannel *chan);
@@ -153,6 +212,19 @@ RpcChannel_Send(RpcChannel *chan,
 void
 RpcChannel_Free(void *ptr);
 
+/** Activity counters of an RPC channel. */
+typedef struct RpcChannelStats {
+   guint    fallbacks;     /**< Times the channel fell back to the Backdoor. */
+   guint64  degradedSecs;  /**< Seconds spent on the Backdoor after those. */
+   gboolean degraded;      /**< Whether it currently runs on the Backdoor. */
+   guint64  rpcs;          /**< RPCs received from the host. */
+   guint64  idleWakeups;   /**< Receive wakeups with no RPC to dispatch. */
+} RpcChannelStats;
+
+void
+RpcChannel_GetStats(RpcChannel *chan,
+                    RpcChannelStats *stats);
+
 #if !defined(USE_RPCI_ONLY)
 gboolean
 RpcChannel_BuildXdrCommand(const char *cmd,
@@ -180,6 +252,27 @@ RpcChannel_RegisterCallback(RpcChannel *chan,
 void
 RpcChannel_UnregisterCallback(RpcChannel *chan,
                               RpcChannelCallback *rpc);
+
+void
+RpcChannel_SetDispatchCb(RpcChannel *chan,
+                         RpcChannelDispatchCb cb,
+                         gpointer data);
+
+void
+RpcChannel_SetBulkRunner(RpcChannel *chan,
+                         RpcChannelBulkRunner runner,
+                         gpointer data);
+
+void
+RpcChannel_RunBulk(RpcChannelBulkJob *job);
+
+gboolean
+RpcChannel_SendAsync(RpcChannel *chan,
+                     char const *data,
+                     size_t dataLen,
+                     GMainContext *ctx,
+                     RpcChannelAsyncCb cb,
+                     gpointer cbData);
 #endif
 
 RpcChannel *
@@ -226,6 +319,37 @@ RpcChannel_SendOnePriv(char **reply,
                        ...);
 #endif
 
+gpointer
+RpcChannel_Alloc(RpcInData *data,
+                 size_t size);
+
+gchar *
+RpcChannel_StrnDup(RpcInData *data,
+                   const char *str,
+                   size_t len);
+
+gchar *
+RpcChannel_Printf(RpcInData *data,
+                  const char *fmt,
+                  ...) G_GNUC_PRINTF(2, 3);
+
+const char *
+RpcChannel_NextArg(RpcInData *data,
+                   size_t *index,
+                   const char *delimiters,
+                   size_t *len);
+
+gchar *
+RpcChannel_NextArgDup(RpcInData *data,
+                      size_t *index,
+                      const char *delimiters);
+
+gboolean
+RpcChannel_NextArgUint(RpcInData *data,
+                       size_t *index,
+                       const char *delimiters,
+                       guint32 *out);
+
 RpcChannel *
 RpcChannel_New(void);
 
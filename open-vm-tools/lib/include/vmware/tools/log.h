@@ -131,12 +131,29 @@
  *
  * So, for example, @a log.${USER}.${PID}.txt would expand to "log.jdoe.1234.txt"
  * for user "jdoe" if the process ID were 1234.
+ *
+ * The application's default domain can also keep a binary trace of the
+ * messages logged with Debug(), Log(), Warning() and LogV(). The format
+ * string and the arguments are stored in a ring in a memory mapped file,
+ * without formatting, which makes it cheap enough to leave debug tracing
+ * on. The file is decoded with "vmware-toolbox-cmd logging binlog decode".
+ *
+ *    - binaryLog: path of the binary log file. It is recreated when the
+ *      process starts, so each application needs its own file.
+ *    - binaryLogLevel: minimum level to record, defaults to "debug".
+ *    - binaryLogSize: size of the ring in KB, defaults to 4096.
+ *
+ * @verbatim
+ * [logging]
+ * vmsvc.binaryLog = /var/log/vmware-vmsvc.binlog
+ * @endverbatim
  * */
 
 #if !defined(G_LOG_DOMAIN)
 #  error "G_LOG_DOMAIN must be defined."
 #endif
 
+#include <stdio.h>
 #include <glib.h>
 
 #if defined(__GNUC__)
@@ -335,6 +352,13 @@ VMTools_SetupVmxGuestLog(gboolean refreshRpcChannel, GKeyFile *cfg,
 void
 VMTools_TeardownVmxGuestLog(void);
 
+gboolean
+VMTools_LogLevelEnabled(GLogLevelFlags level);
+
+gboolean
+VMTools_DecodeBinaryLog(const gchar *path,
+                        FILE *out);
+
 typedef enum {
    TO_HOST,
    IN_GUEST
@@ -0,0 +1,100 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+#ifndef _VMWARE_TOOLS_METRICS_H_
+#define _VMWARE_TOOLS_METRICS_H_
+
+/**
+ * @file metrics.h
+ *
+ * Process-wide registry of named metrics, from the VMTools shared library.
+ *
+ * @defgroup vmtools_metrics Metrics
+ * @{
+ *
+ * @brief Counters, gauges and histograms, exported as one snapshot.
+ *
+ * Metrics are registered by name, once, and then updated from any thread.
+ * Updates are lock-free: counters and histograms are sharded per thread, and
+ * the shards are only summed when a snapshot is taken. The snapshot is in
+ * the Prometheus text exposition format.
+ *
+ * Names follow the Prometheus rules, and may end with a set of labels, e.g.
+ * "vmtools_pool_tasks_total{class=\"bulk\"}"; metrics with the same name
+ * before the labels form one family and must have the same type and help.
+ * Registering an existing name returns the existing metric. Metrics live
+ * for the life of the process, except those removed with
+ * VMTools_MetricRemove().
+ *
+ * All update functions accept a NULL metric and do nothing then, so callers
+ * need not check the result of a registration.
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/** Opaque handle of a registered metric. */
+typedef struct VMToolsMetric VMToolsMetric;
+
+/** Callback that computes the value of a gauge when a snapshot is taken. */
+typedef gint64 (*VMToolsMetricGaugeFunc)(gpointer data);
+
+VMToolsMetric *
+VMTools_MetricCounter(const gchar *name,
+                      const gchar *help);
+
+VMToolsMetric *
+VMTools_MetricGauge(const gchar *name,
+                    const gchar *help);
+
+VMToolsMetric *
+VMTools_MetricGaugeFunc(const gchar *name,
+                        const gchar *help,
+                        VMToolsMetricGaugeFunc func,
+                        gpointer data);
+
+VMToolsMetric *
+VMTools_MetricHistogram(const gchar *name,
+                        const gchar *help,
+                        const guint64 *bounds,
+                        guint numBounds);
+
+void
+VMTools_MetricRemove(const gchar *name);
+
+void
+VMTools_MetricAdd(VMToolsMetric *metric,
+                  gint64 value);
+
+void
+VMTools_MetricSet(VMToolsMetric *metric,
+                  gint64 value);
+
+void
+VMTools_MetricObserve(VMToolsMetric *metric,
+                      guint64 value);
+
+gchar *
+VMTools_MetricsSnapshot(void);
+
+G_END_DECLS
+
+/** @} */
+
+#endif /* _VMWARE_TOOLS_METRICS_H_ */
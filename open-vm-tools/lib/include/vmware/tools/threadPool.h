@@ -39,6 +39,18 @@
  * with the lifecycle of the new thread managed by the thread pool so that it
  * is properly notified of service shutdown.
  *
+ * Tasks belong to a work class (see ToolsCorePoolClass). Each class has its
+ * own queue and its own worker threads, so a burst of bulk or background work
+ * never delays latency-critical tasks. Where the OS allows, the worker threads
+ * of a class also get the class's CPU scheduling policy and affinity, which
+ * are configurable from the Tools config file. Dedicated threads and main loop
+ * timers can be given a class too.
+ *
+ * Tasks may also name the plugin they are run for. The CPU time and I/O of
+ * such tasks are accounted to the plugin and, if the plugin has a budget in
+ * the config file and exceeds it, its further tasks are skipped for a growing
+ * number of budget intervals.
+ *
  * Finally, depending on the configuration, the shared thread pool might not
  * be a thread pool at all: if the configuration has disabled threading, tasks
  * destined to the shared thread pool will be executed on the main service
@@ -50,6 +62,20 @@
 
 #define TOOLS_CORE_PROP_TPOOL "tcs_prop_thread_pool"
 
+/**
+ * Work classes of the shared thread pool, in decreasing priority. Tasks
+ * submitted without a class are bulk tasks.
+ */
+typedef enum ToolsCorePoolClass {
+   /** Short tasks something is waiting on, e.g. quiescing. */
+   TOOLS_CORE_POOL_CLASS_CRITICAL,
+   /** Regular work. */
+   TOOLS_CORE_POOL_CLASS_BULK,
+   /** Periodic gathers that can wait. */
+   TOOLS_CORE_POOL_CLASS_BACKGROUND,
+   TOOLS_CORE_POOL_CLASS_MAX
+} ToolsCorePoolClass;
+
 /** Type of callback function used to register tasks with the pool. */
 typedef void (*ToolsCorePoolCb)(ToolsAppCtx *ctx,
                                 gpointer data);
@@ -75,6 +101,24 @@ typedef struct ToolsCorePool {
                      ToolsCorePoolCb interrupt,
                      gpointer data,
                      GDestroyNotify dtor);
+   guint (*submitClass)(ToolsAppCtx *ctx,
+                        ToolsCorePoolClass cls,
+                        ToolsCorePoolCb cb,
+                        gpointer data,
+                        GDestroyNotify dtor);
+   gboolean (*startClass)(ToolsAppCtx *ctx,
+                          ToolsCorePoolClass cls,
+                          const gchar *threadName,
+                          ToolsCorePoolCb cb,
+                          ToolsCorePoolCb interrupt,
+                          gpointer data,
+                          GDestroyNotify dtor);
+   guint (*submitOwned)(ToolsAppCtx *ctx,
+                        const gchar *owner,
+                        ToolsCorePoolClass cls,
+                        ToolsCorePoolCb cb,
+                        gpointer data,
+                        GDestroyNotify dtor);
 } ToolsCorePool;
 
 
@@ -137,6 +181,88 @@ ToolsCorePool_SubmitTask(ToolsAppCtx *ctx,
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePool_SubmitClassTask --                                       */ /**
+ *
+ * @brief Submits a task of the given work class for execution in the thread
+ * pool.
+ *
+ * Same as ToolsCorePool_SubmitTask(), except that the task is queued behind
+ * tasks of its own class only, and runs on the worker threads of that class.
+ *
+ * @param[in] ctx    Application context.
+ * @param[in] cls    Work class of the task.
+ * @param[in] cb     Function to execute the task.
+ * @param[in] data   Opaque data for the task.
+ * @param[in] dtor   Destructor for the task data.
+ *
+ * @return An identifier for the task, or 0 on error.
+ *
+ *******************************************************************************
+ */
+
+static inline guint
+ToolsCorePool_SubmitClassTask(ToolsAppCtx *ctx,
+                              ToolsCorePoolClass cls,
+                              ToolsCorePoolCb cb,
+                              gpointer data,
+                              GDestroyNotify dtor)
+{
+   ToolsCorePool *pool = ToolsCorePool_GetPool(ctx);
+   if (pool != NULL) {
+      if (pool->submitClass != NULL) {
+         return pool->submitClass(ctx, cls, cb, data, dtor);
+      }
+      return pool->submit(ctx, cb, data, dtor);
+   }
+   return 0;
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePool_SubmitPluginTask --                                      */ /**
+ *
+ * @brief Submits a task of the given work class, run on behalf of a plugin.
+ *
+ * Same as ToolsCorePool_SubmitClassTask(), except that the CPU time and I/O
+ * of the task are accounted to the plugin. While the plugin is backing off
+ * for exceeding its budget, the task is skipped: it is not run, its data's
+ * destructor is called right away, and a valid ID is still returned, so
+ * periodic callers just see a longer interval.
+ *
+ * @param[in] ctx    Application context.
+ * @param[in] owner  Name of the plugin, as in its ToolsPluginData.
+ * @param[in] cls    Work class of the task.
+ * @param[in] cb     Function to execute the task.
+ * @param[in] data   Opaque data for the task.
+ * @param[in] dtor   Destructor for the task data.
+ *
+ * @return An identifier for the task, or 0 on error.
+ *
+ *******************************************************************************
+ */
+
+static inline guint
+ToolsCorePool_SubmitPluginTask(ToolsAppCtx *ctx,
+                               const gchar *owner,
+                               ToolsCorePoolClass cls,
+                               ToolsCorePoolCb cb,
+                               gpointer data,
+                               GDestroyNotify dtor)
+{
+   ToolsCorePool *pool = ToolsCorePool_GetPool(ctx);
+   if (pool != NULL) {
+      if (pool->submitOwned != NULL) {
+         return pool->submitOwned(ctx, owner, cls, cb, data, dtor);
+      }
+      return ToolsCorePool_SubmitClassTask(ctx, cls, cb, data, dtor);
+   }
+   return 0;
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePool_CancelTask --                                            */ /**
@@ -212,6 +338,88 @@ ToolsCorePool_StartThread(ToolsAppCtx *ctx,
    return FALSE;
 }
 
+
+/*
+ *******************************************************************************
+ * ToolsCorePool_StartClassThread --                                      */ /**
+ *
+ * @brief Starts a task of the given work class on its own thread.
+ *
+ * Same as ToolsCorePool_StartThread(), except that the new thread runs with
+ * the CPU scheduling policy and affinity configured for the class.
+ *
+ * @param[in] ctx          Application context.
+ * @param[in] cls          Work class of the task.
+ * @param[in] threadName   Name for the new thread.
+ * @param[in] cb           Function that implements the task to execute.
+ * @param[in] interrupt    A function that will request the task to be
+ *                         interrupted.
+ * @param[in] data         Opaque data for both task callback and interrupt
+ *                         functions.
+ * @param[in] dtor         Destructor for the task data.
+ *
+ * @return TRUE iff thread was successfully started.
+ *
+ *******************************************************************************
+ */
+
+static inline gboolean
+ToolsCorePool_StartClassThread(ToolsAppCtx *ctx,
+                               ToolsCorePoolClass cls,
+                               const gchar *threadName,
+                               ToolsCorePoolCb cb,
+                               ToolsCorePoolCb interrupt,
+                               gpointer data,
+                               GDestroyNotify dtor)
+{
+   ToolsCorePool *pool = ToolsCorePool_GetPool(ctx);
+   if (pool != NULL) {
+      if (pool->startClass != NULL) {
+         return pool->startClass(ctx, cls, threadName, cb, interrupt, data,
+                                 dtor);
+      }
+      return pool->start(ctx, threadName, cb, interrupt, data, dtor);
+   }
+   return FALSE;
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePool_SetSourceClass --                                        */ /**
+ *
+ * @brief Sets the main loop priority of a source, such as a timer, from the
+ * work class of its callback.
+ *
+ * Sources run on the main service thread, so they can't have their own CPU
+ * scheduling policy; instead, sources of a latency-critical class are
+ * dispatched ahead of others, and background ones after them. Heavy work
+ * started by the callback should be submitted to the pool with the same
+ * class.
+ *
+ * @param[in] src  The source, before it's attached.
+ * @param[in] cls  Work class of the source's callback.
+ *
+ *******************************************************************************
+ */
+
+static inline void
+ToolsCorePool_SetSourceClass(GSource *src,
+                             ToolsCorePoolClass cls)
+{
+   switch (cls) {
+   case TOOLS_CORE_POOL_CLASS_CRITICAL:
+      g_source_set_priority(src, G_PRIORITY_HIGH);
+      break;
+   case TOOLS_CORE_POOL_CLASS_BACKGROUND:
+      g_source_set_priority(src, G_PRIORITY_LOW);
+      break;
+   default:
+      g_source_set_priority(src, G_PRIORITY_DEFAULT);
+      break;
+   }
+}
+
 /** @} */
 
 #endif /* _THREADPOOL_H_ */
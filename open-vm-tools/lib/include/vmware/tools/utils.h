@@ -134,6 +134,33 @@ VMTools_ConfigGetString(GKeyFile *config,
                         const gchar *key,
                         const gchar *defValue);
 
+/**
+ * Type of the callbacks of VMTools_ConfigAddWatch(). 'key' is NULL for a
+ * subscription to a whole group.
+ */
+typedef void (*VMToolsConfigChangedCb)(GKeyFile *config,
+                                       const gchar *group,
+                                       const gchar *key,
+                                       gpointer data);
+
+gboolean
+VMTools_ConfigGroupEqual(GKeyFile *a,
+                         GKeyFile *b,
+                         const gchar *group);
+
+guint
+VMTools_ConfigAddWatch(const gchar *group,
+                       const gchar *key,
+                       VMToolsConfigChangedCb cb,
+                       gpointer data);
+
+void
+VMTools_ConfigRemoveWatch(guint id);
+
+gboolean
+VMTools_ConfigNotifyChanges(GKeyFile *oldConfig,
+                            GKeyFile *newConfig);
+
 #if defined(G_PLATFORM_WIN32)
 
 gboolean
@@ -181,6 +208,19 @@ VMTools_WrapArray(gconstpointer data,
                   guint elemSize,
                   guint count);
 
+void
+VMTools_SetLowMemory(gboolean enabled);
+
+gboolean
+VMTools_IsLowMemory(void);
+
+void
+VMTools_TrimMemory(void);
+
+gboolean
+VMTools_GetMemoryUsage(guint64 *rss,
+                       guint64 *peakRss);
+
 G_END_DECLS
 
 /** @} */
@@ -114,6 +114,9 @@ unsigned char *WiperSinglePartition_GetSpace(const WiperPartition *p,
                                              uint64 *avail,
                                              uint64 *free,
                                              uint64 *total);
+#if !defined(_WIN32)
+char *WiperSinglePartition_GetDisk(const WiperPartition *p);
+#endif
 
 /* External definition of the wiper state */
 struct Wiper_State;
@@ -123,6 +126,12 @@ Wiper_State *Wiper_Start(const WiperPartition *p, unsigned int maxWiperFileSize)
 
 unsigned char *Wiper_Next(Wiper_State **s, unsigned int *progress);
 unsigned char *Wiper_Cancel(Wiper_State **s);
+#if !defined(_WIN32)
+uint64 Wiper_GetBytesDone(const Wiper_State *s);
+void Wiper_SetBackground(Wiper_State *s, uint64 freeFloor,
+                         unsigned int maxLatency);
+unsigned int Wiper_GetDutyCycle(const Wiper_State *s);
+#endif
 
 #if defined(__cplusplus)
 }  // extern "C"
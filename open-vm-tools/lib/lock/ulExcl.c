@@ -17,21 +17,157 @@
  *********************************************************/
 
 #include "vmware.h"
+#include "vm_basic_asm.h"
 #include "str.h"
 #include "util.h"
 #include "userlock.h"
 #include "hostinfo.h"
 #include "ulInt.h"
 
+/*
+ * Adaptive spinning. A contended acquisition retries the lock with an
+ * exponential backoff before blocking in the native lock, for up to twice
+ * the number of retries that recent acquisitions needed (plus a minimum, to
+ * keep probing) and never more than the limit set on the lock.
+ */
+
+#define MXUSER_SPIN_MIN          16     // retries always allowed
+#define MXUSER_SPIN_MAX_BACKOFF  32     // PAUSEs between retries
+#define MXUSER_SPIN_MAX_HOLD_NS  20000  // longer holds are not worth a spin
+
 struct MXUserExclLock
 {
    MXUserHeader  header;
    MXRecLock     recursiveLock;
    Atomic_Ptr    heldStatsMem;
    Atomic_Ptr    acquireStatsMem;
+
+   uint32        spinLimit;     // 0: no spinning
+   uint32        spinEstimate;  // Retries recently needed; racy by design
 };
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserExclSpin --
+ *
+ *      Spin on a contended exclusive lock, retrying with an exponential
+ *      backoff.
+ *
+ *      The spin budget follows the retries that the recent acquisitions
+ *      needed. When the held times are recorded (statistics builds) a lock
+ *      held for longer, on average, than a block and wake up costs is not
+ *      spun on at all.
+ *
+ * Results:
+ *      TRUE    the native lock was acquired
+ *      FALSE   the caller must block
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+MXUserExclSpin(MXUserExclLock *lock)  // IN/OUT:
+{
+   uint32 estimate = lock->spinEstimate;
+   uint32 budget = MIN(lock->spinLimit, 2 * estimate + MXUSER_SPIN_MIN);
+   uint32 backoff = 1;
+   uint32 spins;
+
+   if (vmx86_stats) {
+      MXUserHeldStats *heldStats = Atomic_ReadPtr(&lock->heldStatsMem);
+
+      if (heldStats != NULL && heldStats->data.numSamples != 0 &&
+          heldStats->data.timeSum / heldStats->data.numSamples >
+                                                  MXUSER_SPIN_MAX_HOLD_NS) {
+         return FALSE;
+      }
+   }
+
+   for (spins = 0; spins < budget; spins++) {
+      uint32 i;
+
+      for (i = 0; i < backoff; i++) {
+         PAUSE();
+      }
+
+      backoff = MIN(2 * backoff, MXUSER_SPIN_MAX_BACKOFF);
+
+      if (MXRecLockTryAcquireInternal(&lock->recursiveLock) == 0) {
+         lock->spinEstimate = estimate + ((int32) (spins - estimate)) / 8;
+
+         return TRUE;
+      }
+   }
+
+   /* Spinning did not pay off; spin less next time */
+   lock->spinEstimate = estimate / 2;
+
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserExclAcquire --
+ *
+ *      Acquire the native lock of an exclusive lock, spinning first if the
+ *      lock is adaptive.
+ *
+ * Results:
+ *      The lock is acquired. The time waited is returned if requested.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE void
+MXUserExclAcquire(MXUserExclLock *lock,   // IN/OUT:
+                  VmTimeType *duration)   // OUT/OPT:
+{
+   VmTimeType start;
+
+   if (LIKELY(lock->spinLimit == 0)) {
+      MXRecLockAcquire(&lock->recursiveLock, duration);
+
+      return;
+   }
+
+   if (MXRecLockTryAcquire(&lock->recursiveLock)) {
+      if (duration != NULL) {
+         *duration = 0ULL;
+      }
+
+      return;  // Uncontended
+   }
+
+   start = (duration == NULL) ? 0 : Hostinfo_SystemTimerNS();
+
+   if (!MXUserExclSpin(lock)) {
+      int err = MXRecLockAcquireInternal(&lock->recursiveLock);
+
+      if (vmx86_debug && (err != 0)) {
+         Panic("%s: MXRecLockAcquireInternal error %d\n", __FUNCTION__, err);
+      }
+   }
+
+   if (duration != NULL) {
+      *duration = Hostinfo_SystemTimerNS() - start;
+   }
+
+   ASSERT(MXRecLockCount(&lock->recursiveLock) == 0);
+
+   MXRecLockIncCount(&lock->recursiveLock, 1);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -381,6 +517,42 @@ MXUser_CreateExclLock(const char *userName,  // IN:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUser_SetAdaptiveSpinExclLock --
+ *
+ *      Make a contended acquisition of the specified lock spin, up to
+ *      'spinLimit' retries, before blocking. 0 turns spinning off.
+ *
+ *      Worth it for locks protecting very short critical sections, which
+ *      are usually released before a block and wake up would complete.
+ *      Spinning is never done on a uniprocessor, where the owner cannot
+ *      release the lock while it is spun on.
+ *
+ * Results:
+ *      As above.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+MXUser_SetAdaptiveSpinExclLock(MXUserExclLock *lock,  // IN/OUT:
+                               uint32 spinLimit)      // IN:
+{
+   uint32 numCPUs = Hostinfo_NumCPUs();
+
+   ASSERT(lock != NULL);
+   MXUserValidateHeader(&lock->header, MXUSER_TYPE_EXCL);
+
+   lock->spinEstimate = 0;
+   lock->spinLimit = (numCPUs > 1 && numCPUs != 0xFFFFFFFF) ? spinLimit : 0;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -455,8 +627,7 @@ MXUser_AcquireExclLock(MXUserExclLock *lock)  // IN/OUT:
 
       acquireStats = Atomic_ReadPtr(&lock->acquireStatsMem);
 
-      MXRecLockAcquire(&lock->recursiveLock,
-                       (acquireStats == NULL) ? NULL : &value);
+      MXUserExclAcquire(lock, (acquireStats == NULL) ? NULL : &value);
 
       if (LIKELY(acquireStats != NULL)) {
          MXUserHisto *histo;
@@ -478,9 +649,14 @@ MXUser_AcquireExclLock(MXUserExclLock *lock)  // IN/OUT:
             heldStats->holdStart = Hostinfo_SystemTimerNS();
          }
       }
+   } else if (UNLIKELY(MXUserSampleContention())) {
+      VmTimeType value = 0;
+
+      MXUserExclAcquire(lock, &value);
+      MXUserContentionSample(&lock->header, value);
    } else {
-      MXRecLockAcquire(&lock->recursiveLock,
-                       NULL);  // non-stats
+      MXUserExclAcquire(lock,
+                        NULL);  // non-stats
    }
 
    if (vmx86_debug && (MXRecLockCount(&lock->recursiveLock) > 1)) {
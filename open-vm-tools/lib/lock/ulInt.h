@@ -464,6 +464,11 @@ typedef struct MXUserHeader {
 
    uint64       serialNumber;
    Bool         badHeader;
+
+   /* Sampled contention, see MXUser_SetContentionSampling; list lock */
+   uint64       contentionSamples;
+   uint64       contentionCount;
+   uint64       contentionTime;
 } MXUserHeader;
 
 
@@ -644,6 +649,59 @@ void MXUserEnableStats(Atomic_Ptr *acquisitionMem,
 void MXUserDisableStats(Atomic_Ptr *acquisitionMem,
                         Atomic_Ptr *heldMem);
 
+/*
+ * Sampled contention profiling. Unlike the statistics above, this is
+ * available in every build: 1 in mxUserContentionSamplePeriod acquisitions
+ * of each thread is timed and accumulated in a per-thread buffer, so the
+ * acquisition fast path costs a thread local increment and touches no
+ * shared cache line.
+ */
+
+#define MXUSER_CONTENTION_FLOOR_NS  1000  // waits above this are contended
+
+extern uint32 mxUserContentionSamplePeriod;
+
+#if defined(VMW_HAVE_TLS)
+extern __thread uint32 mxUserContentionSampleTick;
+#endif
+
+static INLINE Bool
+MXUserSampleContention(void)
+{
+#if defined(VMW_HAVE_TLS)
+   uint32 period = mxUserContentionSamplePeriod;
+
+   if (LIKELY(period == 0) ||
+       LIKELY(++mxUserContentionSampleTick < period)) {
+      return FALSE;
+   }
+
+   mxUserContentionSampleTick = 0;
+
+   return TRUE;
+#else
+   return FALSE;
+#endif
+}
+
+void MXUserContentionSample(MXUserHeader *header,
+                            VmTimeType waitTime);
+
+static INLINE void
+MXUserSampledAcquire(MXUserHeader *header,  // IN/OUT:
+                     MXRecLock *lock)       // IN/OUT:
+{
+   if (UNLIKELY(MXUserSampleContention())) {
+      VmTimeType value = 0;
+
+      MXRecLockAcquire(lock, &value);
+      MXUserContentionSample(header, value);
+   } else {
+      MXRecLockAcquire(lock,
+                       NULL);  // non-stats
+   }
+}
+
 extern void  (*MXUserMX_LockRec)(struct MX_MutexRec *lock);
 extern void  (*MXUserMX_UnlockRec)(struct MX_MutexRec *lock);
 extern Bool  (*MXUserMX_TryLockRec)(struct MX_MutexRec *lock);
@@ -191,9 +191,273 @@ struct MXUserRWLock
 
    Atomic_Ptr      heldStatsMem;
    Atomic_Ptr      acquireStatsMem;
+
+   Bool            readerBiased;   // See MXUser_CreateRWLockReaderBiased
+   Atomic_uint32   readBias;       // Readers may use the visible readers
+   VmTimeType      inhibitUntil;   // No read bias before; write locked
 };
 
 
+/*
+ * Reader bias (BRAVO, Dice and Kogan, USENIX ATC 2019).
+ *
+ * While a reader-biased lock is read biased, a reader publishes itself by
+ * installing the lock in a slot of a global visible readers table, hashed
+ * from the thread and the lock, and touches no cache line of the lock
+ * itself. A writer acquires the native lock for write, revokes the bias
+ * and waits for the published readers to drain. The bias is inhibited for
+ * a multiple of the time the revocation took, so that write heavy phases
+ * go through the native lock only; a reader re-enables it afterwards.
+ *
+ * Readers that find their slot taken, or that already hold too many fast
+ * read locks, use the native lock.
+ */
+
+#define MXUSER_BRAVO_SLOTS        4096  // power of 2
+#define MXUSER_BRAVO_MAX_HELD     8     // fast read locks held by a thread
+#define MXUSER_BRAVO_INHIBIT      9     // inhibit for 9x the revocation time
+
+#if defined(VMW_HAVE_TLS)
+static Atomic_Ptr mxUserBravoSlots[MXUSER_BRAVO_SLOTS];
+
+typedef struct {
+   uint32         count;
+   MXUserRWLock  *lock[MXUSER_BRAVO_MAX_HELD];
+   uint32         slot[MXUSER_BRAVO_MAX_HELD];
+} MXUserBravoHeld;
+
+static __thread MXUserBravoHeld mxUserBravoHeld;
+#endif
+
+
+#if defined(VMW_HAVE_TLS)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserBravoFind --
+ *
+ *      Find the specified lock among the fast read locks of the calling
+ *      thread.
+ *
+ * Results:
+ *      Its index, -1 if the thread does not hold it for a fast read.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE int
+MXUserBravoFind(const MXUserRWLock *lock)  // IN:
+{
+   MXUserBravoHeld *held = &mxUserBravoHeld;
+   uint32 i;
+
+   for (i = 0; i < held->count; i++) {
+      if (held->lock[i] == lock) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserBravoTryRead --
+ *
+ *      Try to acquire a reader-biased lock for read through the visible
+ *      readers table.
+ *
+ * Results:
+ *      TRUE    acquired
+ *      FALSE   the native lock must be used
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE Bool
+MXUserBravoTryRead(MXUserRWLock *lock)  // IN/OUT:
+{
+   MXUserBravoHeld *held = &mxUserBravoHeld;
+   uintptr_t hash;
+   uint32 slot;
+
+   if (!Atomic_Read32(&lock->readBias) ||
+       held->count == MXUSER_BRAVO_MAX_HELD ||
+       (vmx86_stats && Atomic_ReadPtr(&lock->acquireStatsMem) != NULL)) {
+      return FALSE;
+   }
+
+   /* The address of the thread's TLS identifies the thread */
+   hash = ((uintptr_t) lock >> 4) ^ ((uintptr_t) held >> 6);
+   slot = (uint32) ((hash * CONST64U(0x9E3779B97F4A7C15)) >> 32) &
+          (MXUSER_BRAVO_SLOTS - 1);
+
+   if (Atomic_ReadIfEqualWritePtr(&mxUserBravoSlots[slot], NULL,
+                                  lock) != NULL) {
+      return FALSE;
+   }
+
+   /* A writer may have revoked the bias before seeing the slot */
+   if (UNLIKELY(!Atomic_Read32(&lock->readBias))) {
+      Atomic_WritePtr(&mxUserBravoSlots[slot], NULL);
+
+      return FALSE;
+   }
+
+   held->lock[held->count] = lock;
+   held->slot[held->count] = slot;
+   held->count++;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserBravoRelease --
+ *
+ *      Release a fast read lock of the calling thread.
+ *
+ * Results:
+ *      TRUE    released
+ *      FALSE   the thread did not hold it for a fast read
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE Bool
+MXUserBravoRelease(MXUserRWLock *lock)  // IN/OUT:
+{
+   MXUserBravoHeld *held = &mxUserBravoHeld;
+   int i = MXUserBravoFind(lock);
+
+   if (i < 0) {
+      return FALSE;
+   }
+
+   /* Ordered after the reads of the critical section */
+   Atomic_ReadWritePtr(&mxUserBravoSlots[held->slot[i]], NULL);
+
+   held->count--;
+   held->lock[i] = held->lock[held->count];
+   held->slot[i] = held->slot[held->count];
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserBravoRevoke --
+ *
+ *      Revoke the read bias of a lock and wait for its fast readers to
+ *      drain. The native lock is held for write.
+ *
+ * Results:
+ *      As above.
+ *
+ * Side effects:
+ *      The bias is inhibited for a while.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+MXUserBravoRevoke(MXUserRWLock *lock)  // IN/OUT:
+{
+   VmTimeType start;
+   VmTimeType end;
+   uint32 i;
+
+   if (LIKELY(!Atomic_Read32(&lock->readBias))) {
+      return;
+   }
+
+   start = Hostinfo_SystemTimerNS();
+
+   /* Full barrier: ordered before the scan */
+   Atomic_ReadWrite32(&lock->readBias, FALSE);
+
+   for (i = 0; i < MXUSER_BRAVO_SLOTS; i++) {
+      while (UNLIKELY(Atomic_ReadPtr(&mxUserBravoSlots[i]) == lock)) {
+         PAUSE();
+      }
+   }
+
+   end = Hostinfo_SystemTimerNS();
+   lock->inhibitUntil = end + (end - start) * MXUSER_BRAVO_INHIBIT;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserBravoEnable --
+ *
+ *      Re-enable the read bias once its inhibition expired. The native
+ *      lock is held for read.
+ *
+ * Results:
+ *      As above.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE void
+MXUserBravoEnable(MXUserRWLock *lock)  // IN/OUT:
+{
+   if (!Atomic_Read32(&lock->readBias) &&
+       Hostinfo_SystemTimerNS() >= lock->inhibitUntil) {
+      Atomic_Write32(&lock->readBias, TRUE);
+   }
+}
+#else
+static INLINE int
+MXUserBravoFind(const MXUserRWLock *lock)  // IN:
+{
+   return -1;
+}
+
+static INLINE Bool
+MXUserBravoTryRead(MXUserRWLock *lock)  // IN/OUT:
+{
+   return FALSE;
+}
+
+static INLINE Bool
+MXUserBravoRelease(MXUserRWLock *lock)  // IN/OUT:
+{
+   return FALSE;
+}
+
+static INLINE void
+MXUserBravoRevoke(MXUserRWLock *lock)  // IN/OUT:
+{
+}
+
+static INLINE void
+MXUserBravoEnable(MXUserRWLock *lock)  // IN/OUT:
+{
+}
+#endif
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -301,6 +565,10 @@ MXUserDumpRWLock(MXUserHeader *header)  // IN:
    }
 
    Warning("\tholderCount %d\n", Atomic_Read(&lock->holderCount));
+
+   if (lock->readerBiased) {
+      Warning("\tread bias %u\n", Atomic_Read32(&lock->readBias));
+   }
 }
 
 
@@ -404,6 +672,54 @@ MXUser_CreateRWLock(const char *userName,  // IN:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUser_CreateRWLockReaderBiased --
+ *
+ *      Create a read/write lock for read-mostly data. Concurrent readers do
+ *      not share any cache line, at the cost of making the first write
+ *      after a read phase wait for the readers to be revoked.
+ *
+ *      The lock is a plain read/write lock when the statistics are enabled,
+ *      native read-write locks or thread local storage are not available.
+ *
+ * Results:
+ *      A pointer to a read/write lock.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+MXUserRWLock *
+MXUser_CreateRWLockReaderBiased(const char *userName,  // IN:
+                                MX_Rank rank)          // IN:
+{
+   MXUserRWLock *lock;
+
+   if (userName == NULL) {
+      char *properName = Str_SafeAsprintf(NULL, "RWbias-%p",
+                                          GetReturnAddress());
+
+      lock = MXUser_CreateRWLock(properName, rank);
+      free(properName);
+   } else {
+      lock = MXUser_CreateRWLock(userName, rank);
+   }
+
+#if defined(VMW_HAVE_TLS)
+   if (lock->useNative && MXUserStatsMode() == 0) {
+      lock->readerBiased = TRUE;
+      Atomic_Write32(&lock->readBias, TRUE);
+   }
+#endif
+
+   return lock;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -529,6 +845,18 @@ MXUserAcquisition(MXUserRWLock *lock,  // IN/OUT:
 
    MXUserAcquisitionTracking(&lock->header, TRUE);
 
+   if (lock->readerBiased) {
+      if (UNLIKELY(MXUserBravoFind(lock) >= 0)) {
+         MXUserDumpAndPanic(&lock->header,
+                            "%s: AcquireFor%s after AcquireForRead\n",
+                            __FUNCTION__, forRead ? "Read" : "Write");
+      }
+
+      if (forRead && MXUserBravoTryRead(lock)) {
+         return;
+      }
+   }
+
    myContext = MXUserGetHolderContext(lock);
 
    if (UNLIKELY(myContext->state != RW_UNLOCKED)) {
@@ -604,15 +932,33 @@ MXUserAcquisition(MXUserRWLock *lock,  // IN/OUT:
       if (LIKELY(lock->useNative)) {
          int err = 0;
 
-         MXUserNativeRWAcquire(&lock->nativeLock, forRead, &err);
+         if (UNLIKELY(MXUserSampleContention())) {
+            VmTimeType begin = Hostinfo_SystemTimerNS();
+            Bool contended;
+
+            contended = MXUserNativeRWAcquire(&lock->nativeLock, forRead,
+                                              &err);
+
+            MXUserContentionSample(&lock->header, contended ?
+                                   Hostinfo_SystemTimerNS() - begin : 0);
+         } else {
+            MXUserNativeRWAcquire(&lock->nativeLock, forRead, &err);
+         }
 
          if (UNLIKELY(err != 0)) {
             MXUserDumpAndPanic(&lock->header, "%s: Error %d\n",
                                __FUNCTION__, err);
          }
       } else {
-         MXRecLockAcquire(&lock->recursiveLock,
-                          NULL);  // non-stats
+         MXUserSampledAcquire(&lock->header, &lock->recursiveLock);
+      }
+   }
+
+   if (lock->readerBiased) {
+      if (forRead) {
+         MXUserBravoEnable(lock);
+      } else {
+         MXUserBravoRevoke(lock);
       }
    }
 
@@ -700,6 +1046,10 @@ MXUser_IsCurThreadHoldingRWLock(MXUserRWLock *lock,  // IN:
    ASSERT(lock != NULL);
    MXUserValidateHeader(&lock->header, MXUSER_TYPE_RW);
 
+   if (lock->readerBiased && MXUserBravoFind(lock) >= 0) {
+      return queryType != MXUSER_RW_FOR_WRITE;
+   }
+
    myContext = MXUserGetHolderContext(lock);
 
    switch (queryType) {
@@ -742,6 +1092,12 @@ MXUser_ReleaseRWLock(MXUserRWLock *lock)  // IN/OUT:
    ASSERT(lock != NULL);
    MXUserValidateHeader(&lock->header, MXUSER_TYPE_RW);
 
+   if (lock->readerBiased && MXUserBravoRelease(lock)) {
+      MXUserReleaseTracking(&lock->header);
+
+      return;
+   }
+
    myContext = MXUserGetHolderContext(lock);
 
    if (vmx86_stats) {
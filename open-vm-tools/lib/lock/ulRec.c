@@ -531,8 +531,7 @@ MXUser_AcquireRecLock(MXUserRecLock *lock)  // IN/OUT:
             }
          }
       } else {
-         MXRecLockAcquire(&lock->recursiveLock,
-                          NULL);  // non-stats
+         MXUserSampledAcquire(&lock->header, &lock->recursiveLock);
       }
    }
 }
@@ -24,6 +24,7 @@
 
 #include "vmware.h"
 #include "str.h"
+#include "strutil.h"
 #include "util.h"
 #include "userlock.h"
 #include "ulInt.h"
@@ -62,6 +63,34 @@ static void  (*mxUserStatsFunc)(void *context,
                                 const char *fmt,
                                 va_list ap) = NULL;
 
+/*
+ * Sampled contention. Each thread accumulates its samples in a small buffer,
+ * keyed by the serial number of the lock so that a destroyed lock is simply
+ * not found when the buffer is flushed into the lock headers.
+ */
+
+#define MXUSER_CONTENTION_SLOTS  8   // power of 2
+#define MXUSER_CONTENTION_FLUSH  64  // samples between flushes
+
+typedef struct {
+   uint64  serialNumber;
+   uint64  samples;
+   uint64  contended;
+   uint64  waitTime;
+} MXUserContentionSlot;
+
+typedef struct {
+   MXUserContentionSlot  slot[MXUSER_CONTENTION_SLOTS];
+   uint32                pending;
+} MXUserContentionBuffer;
+
+uint32 mxUserContentionSamplePeriod = 0;  // "off"
+
+#if defined(VMW_HAVE_TLS)
+__thread uint32 mxUserContentionSampleTick;
+static __thread MXUserContentionBuffer mxUserContentionBuffer;
+#endif
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -1285,3 +1314,244 @@ MXUserEnableStats(Atomic_Ptr *acquisitionMem,  // IN/OPT:
    }
 }
 
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserContentionFlush --
+ *
+ *      Add the samples of the calling thread's buffer to the lock headers.
+ *
+ *      The list lock is only tried: a lock may be acquired, and sampled,
+ *      by code running under the list lock (see MXUser_PerLockData). If
+ *      the list lock is busy the samples stay in the buffer, unless
+ *      'evict' is set, in which case they are dropped.
+ *
+ * Results:
+ *      TRUE if the buffer was flushed.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#if defined(VMW_HAVE_TLS)
+static Bool
+MXUserContentionFlush(MXUserContentionSlot *slots,  // IN/OUT:
+                      uint32 numSlots,              // IN:
+                      Bool evict)                   // IN:
+{
+   MXRecLock *listLock = MXUserInternalSingleton(&mxLockMemPtr);
+   uint32 i;
+
+   if (listLock == NULL || !MXRecLockTryAcquire(listLock)) {
+      if (evict) {
+         memset(slots, 0, numSlots * sizeof *slots);
+      }
+
+      return FALSE;
+   }
+
+   for (i = 0; i < numSlots; i++) {
+      ListItem *entry;
+
+      if (slots[i].samples == 0) {
+         continue;
+      }
+
+      CIRC_LIST_SCAN(entry, mxUserLockList) {
+         MXUserHeader *header = CIRC_LIST_CONTAINER(entry, MXUserHeader, item);
+
+         if (header->serialNumber == slots[i].serialNumber) {
+            header->contentionSamples += slots[i].samples;
+            header->contentionCount += slots[i].contended;
+            header->contentionTime += slots[i].waitTime;
+            break;
+         }
+      }
+   }
+
+   MXRecLockRelease(listLock);
+
+   memset(slots, 0, numSlots * sizeof *slots);
+
+   return TRUE;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUserContentionSample --
+ *
+ *      Record a sampled acquisition of a lock in the calling thread's
+ *      buffer. Called for 1 in mxUserContentionSamplePeriod acquisitions.
+ *
+ * Results:
+ *      As above.
+ *
+ * Side effects:
+ *      The buffer is periodically flushed into the lock headers.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+MXUserContentionSample(MXUserHeader *header,  // IN:
+                       VmTimeType waitTime)   // IN:
+{
+#if defined(VMW_HAVE_TLS)
+   MXUserContentionBuffer *buffer = &mxUserContentionBuffer;
+   MXUserContentionSlot *slot;
+
+   slot = &buffer->slot[header->serialNumber & (MXUSER_CONTENTION_SLOTS - 1)];
+
+   if (UNLIKELY(slot->serialNumber != header->serialNumber)) {
+      if (slot->samples != 0) {
+         MXUserContentionFlush(slot, 1, TRUE);
+      }
+
+      slot->serialNumber = header->serialNumber;
+   }
+
+   slot->samples++;
+
+   if (waitTime > MXUSER_CONTENTION_FLOOR_NS) {
+      slot->contended++;
+      slot->waitTime += waitTime;
+   }
+
+   if (UNLIKELY(++buffer->pending >= MXUSER_CONTENTION_FLUSH)) {
+      if (MXUserContentionFlush(buffer->slot, MXUSER_CONTENTION_SLOTS,
+                                FALSE)) {
+         buffer->pending = 0;
+      }
+   }
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUser_SetContentionSampling --
+ *
+ *      Set the contention sampling period: every thread times 1 in 'period'
+ *      of its lock acquisitions. 0 turns sampling off.
+ *
+ *      Sampling is independent of the statistics, which time every
+ *      acquisition of the locks they are enabled on, and is only available
+ *      on platforms with thread local storage.
+ *
+ * Results:
+ *      As above.
+ *
+ * Side effects:
+ *      The samples already taken are kept.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+MXUser_SetContentionSampling(uint32 period)  // IN:
+{
+   mxUserContentionSamplePeriod = period;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MXUser_TopContendedLocks --
+ *
+ *      Report the locks with the most sampled contention time, one line per
+ *      lock, at most 'maxLocks' lines:
+ *
+ *      name=<name> rank=<rank> samples=<n> contended=<n> waitNS=<n>
+ *
+ *      The counts are those of the samples; multiply by the sampling period
+ *      to estimate the totals. Samples of other threads that are not yet
+ *      flushed are not included.
+ *
+ * Results:
+ *      The report, to be freed by the caller. An empty string if no lock
+ *      was contended.
+ *
+ * Side effects:
+ *      The calling thread's samples are flushed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+MXUser_TopContendedLocks(uint32 maxLocks)  // IN:
+{
+   MXRecLock *listLock = MXUserInternalSingleton(&mxLockMemPtr);
+   MXUserHeader **top;
+   char *report = Util_SafeStrdup("");
+   uint32 numTop = 0;
+   uint32 i;
+
+   if (listLock == NULL || maxLocks == 0) {
+      return report;
+   }
+
+#if defined(VMW_HAVE_TLS)
+   if (MXUserContentionFlush(mxUserContentionBuffer.slot,
+                             MXUSER_CONTENTION_SLOTS, FALSE)) {
+      mxUserContentionBuffer.pending = 0;
+   }
+#endif
+
+   top = Util_SafeMalloc(maxLocks * sizeof *top);
+
+   MXRecLockAcquire(listLock,
+                    NULL);  // non-stats
+
+   {
+      ListItem *entry;
+
+      CIRC_LIST_SCAN(entry, mxUserLockList) {
+         MXUserHeader *header = CIRC_LIST_CONTAINER(entry, MXUserHeader, item);
+         uint32 j;
+
+         if (header->contentionTime == 0) {
+            continue;
+         }
+
+         if (numTop == maxLocks) {
+            if (header->contentionTime <= top[numTop - 1]->contentionTime) {
+               continue;
+            }
+
+            numTop--;
+         }
+
+         for (j = numTop;
+              j > 0 && top[j - 1]->contentionTime < header->contentionTime;
+              j--) {
+            top[j] = top[j - 1];
+         }
+
+         top[j] = header;
+         numTop++;
+      }
+   }
+
+   for (i = 0; i < numTop; i++) {
+      StrUtil_SafeStrcatF(&report, "name=%s rank=0x%x samples=%"FMT64"u "
+                          "contended=%"FMT64"u waitNS=%"FMT64"u\n",
+                          top[i]->name, top[i]->rank,
+                          top[i]->contentionSamples, top[i]->contentionCount,
+                          top[i]->contentionTime);
+   }
+
+   MXRecLockRelease(listLock);
+
+   free(top);
+
+   return report;
+}
@@ -50,6 +50,20 @@
 #include "vm_assert.h"
 #include "base64.h"
 
+/*
+ * The SSSE3 and AVX2 paths are compiled with target attributes and picked
+ * at run time, so the library still runs on any x86 CPU.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(BASE64_NO_SIMD)
+#define BASE64_SIMD_X86 1
+#include <immintrin.h>
+
+/* Cleared by the self test to compare with the scalar path. */
+static Bool base64UseSimd = TRUE;
+#endif
+
 static const char Base64[] =
 "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 static const char Pad64 = '=';
@@ -174,6 +188,348 @@ static const signed char base64Reverse[256] = {
    characters followed by one "=" padding character.
 */
 
+#if defined(BASE64_SIMD_X86)
+/*
+ * The vector code is the pshufb based algorithm of Wojciech Mula and
+ * Daniel Lemire, "Faster Base64 Encoding and Decoding Using AVX2
+ * Instructions". Each 128-bit lane turns 12 bytes into 16 characters, or
+ * back.
+ */
+
+#define BASE64_TARGET_SSSE3 __attribute__((target("ssse3")))
+#define BASE64_TARGET_AVX2  __attribute__((target("avx2")))
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * Base64SimdAvailable --
+ *
+ *      Which vector paths the CPU, and the OS, support.
+ *
+ * Results:
+ *      2 for AVX2, 1 for SSSE3, 0 for none.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE int
+Base64SimdAvailable(void)
+{
+   if (!base64UseSimd) {
+      return 0;
+   }
+   if (__builtin_cpu_supports("avx2")) {
+      return 2;
+   }
+   return __builtin_cpu_supports("ssse3") ? 1 : 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * Base64EncodeLanes --
+ *
+ *      Encode the 12 bytes at the start of each 128-bit lane, laid out as
+ *      4 groups of 3 bytes, into 16 characters.
+ *
+ * Results:
+ *      The characters.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE BASE64_TARGET_SSSE3 __m128i
+Base64EncodeLanes(__m128i in)  // IN:
+{
+   const __m128i shiftLUT = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+   __m128i t0, t1, t2, t3, indices, result, less;
+
+   /* Spread the 6-bit groups into bytes. */
+   in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                          4, 5, 3, 4, 1, 2, 0, 1));
+   t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+   t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+   t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+   t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+   indices = _mm_or_si128(t1, t3);
+
+   /* Map each 6-bit value to the offset of its alphabet range. */
+   result = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+   less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+   result = _mm_or_si128(result, _mm_and_si128(less, _mm_set1_epi8(13)));
+   result = _mm_shuffle_epi8(shiftLUT, result);
+
+   return _mm_add_epi8(result, indices);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * Base64EncodeLanesAVX2 --
+ *
+ *      Base64EncodeLanes for both lanes of a 256-bit vector.
+ *
+ * Results:
+ *      The characters.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE BASE64_TARGET_AVX2 __m256i
+Base64EncodeLanesAVX2(__m256i in)  // IN:
+{
+   const __m256i shiftLUT = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0,
+                                             'a' - 26, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '0' - 52,
+                                             '0' - 52, '0' - 52, '+' - 62,
+                                             '/' - 63, 'A', 0, 0);
+   __m256i t0, t1, t2, t3, indices, result, less;
+
+   in = _mm256_shuffle_epi8(in, _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                                4, 5, 3, 4, 1, 2, 0, 1,
+                                                10, 11, 9, 10, 7, 8, 6, 7,
+                                                4, 5, 3, 4, 1, 2, 0, 1));
+   t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+   t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+   t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+   t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+   indices = _mm256_or_si256(t1, t3);
+
+   result = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+   less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+   result = _mm256_or_si256(result,
+                            _mm256_and_si256(less, _mm256_set1_epi8(13)));
+   result = _mm256_shuffle_epi8(shiftLUT, result);
+
+   return _mm256_add_epi8(result, indices);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * Base64EncodeSSSE3 --
+ * Base64EncodeAVX2 --
+ *
+ *      Encode whole blocks of 12 (24) bytes from src into dst, as long as
+ *      16 (28) bytes can be read. The caller checked dst is large enough
+ *      for the whole encoding.
+ *
+ * Results:
+ *      The number of bytes encoded, a multiple of 12.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static BASE64_TARGET_SSSE3 size_t
+Base64EncodeSSSE3(uint8 const *src,  // IN:
+                  size_t srcSize,    // IN:
+                  char *dst)         // OUT:
+{
+   size_t done = 0;
+
+   for (; srcSize - done >= 16; done += 12, dst += 16) {
+      __m128i in = _mm_loadu_si128((const __m128i *) (src + done));
+
+      _mm_storeu_si128((__m128i *) dst, Base64EncodeLanes(in));
+   }
+
+   return done;
+}
+
+
+static BASE64_TARGET_AVX2 size_t
+Base64EncodeAVX2(uint8 const *src,  // IN:
+                 size_t srcSize,    // IN:
+                 char *dst)         // OUT:
+{
+   size_t done = 0;
+
+   for (; srcSize - done >= 28; done += 24, dst += 32) {
+      __m128i lo = _mm_loadu_si128((const __m128i *) (src + done));
+      __m128i hi = _mm_loadu_si128((const __m128i *) (src + done + 12));
+      __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+
+      _mm256_storeu_si256((__m256i *) dst, Base64EncodeLanesAVX2(in));
+   }
+
+   return done + Base64EncodeSSSE3(src + done, srcSize - done, dst);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * Base64DecodeSSSE3 --
+ * Base64DecodeAVX2 --
+ *
+ *      Decode whole blocks of 16 (32) characters from src, as long as they
+ *      are all in the alphabet and the decoded bytes fit in out. Decoding
+ *      stops at the first block with anything else, whitespace, padding or
+ *      a NUL included, for the scalar path to handle.
+ *
+ * Results:
+ *      The number of characters decoded, a multiple of 16, which is 4/3 of
+ *      the number of bytes stored.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static BASE64_TARGET_SSSE3 size_t
+Base64DecodeSSSE3(char const *src,   // IN:
+                  size_t srcSize,    // IN: characters readable at src
+                  uint8 *out,        // OUT:
+                  size_t outSize)    // IN:
+{
+   const __m128i lutLo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                       0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                       0x1b, 0x1b, 0x1b, 0x1a);
+   const __m128i lutHi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                       0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                       0x10, 0x10, 0x10, 0x10);
+   const __m128i lutRoll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+   const __m128i nibble = _mm_set1_epi8(0x0f);
+   size_t done = 0;
+
+   for (; srcSize - done >= 16 && outSize >= 12;
+        done += 16, out += 12, outSize -= 12) {
+      __m128i str = _mm_loadu_si128((const __m128i *) (src + done));
+      __m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(str, 4), nibble);
+      __m128i loNibbles = _mm_and_si128(str, nibble);
+      __m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+      __m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+      __m128i roll;
+      __m128i merged;
+      int32 tail;
+
+      /* lutLo and lutHi share a bit for every character outside the alphabet. */
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi),
+                                           _mm_setzero_si128())) != 0xffff) {
+         break;
+      }
+
+      /* Characters to 6-bit values, '/' is the one apart in its range. */
+      roll = _mm_shuffle_epi8(lutRoll,
+                              _mm_add_epi8(_mm_cmpeq_epi8(str,
+                                                          _mm_set1_epi8('/')),
+                                           hiNibbles));
+      str = _mm_add_epi8(str, roll);
+
+      /* Pack 4 6-bit values into 3 bytes, big endian. */
+      merged = _mm_maddubs_epi16(str, _mm_set1_epi32(0x01400140));
+      merged = _mm_madd_epi16(merged, _mm_set1_epi32(0x00011000));
+      merged = _mm_shuffle_epi8(merged, _mm_setr_epi8(2, 1, 0, 6, 5, 4,
+                                                      10, 9, 8, 14, 13, 12,
+                                                      -1, -1, -1, -1));
+
+      _mm_storel_epi64((__m128i *) out, merged);
+      tail = _mm_cvtsi128_si32(_mm_srli_si128(merged, 8));
+      memcpy(out + 8, &tail, sizeof tail);
+   }
+
+   return done;
+}
+
+
+static BASE64_TARGET_AVX2 size_t
+Base64DecodeAVX2(char const *src,   // IN:
+                 size_t srcSize,    // IN: characters readable at src
+                 uint8 *out,        // OUT:
+                 size_t outSize)    // IN:
+{
+   const __m256i lutLo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                          0x1b, 0x1b, 0x1b, 0x1a,
+                                          0x15, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                          0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+                                          0x1b, 0x1b, 0x1b, 0x1a);
+   const __m256i lutHi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                          0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x01, 0x02, 0x04, 0x08,
+                                          0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+                                          0x10, 0x10, 0x10, 0x10);
+   const __m256i lutRoll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0,
+                                            0, 16, 19, 4, -65, -65, -71, -71,
+                                            0, 0, 0, 0, 0, 0, 0, 0);
+   const __m256i nibble = _mm256_set1_epi8(0x0f);
+   size_t done = 0;
+
+   for (; srcSize - done >= 32 && outSize >= 24;
+        done += 32, out += 24, outSize -= 24) {
+      __m256i str = _mm256_loadu_si256((const __m256i *) (src + done));
+      __m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(str, 4), nibble);
+      __m256i loNibbles = _mm256_and_si256(str, nibble);
+      __m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+      __m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+      __m256i roll;
+      __m256i merged;
+
+      if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi),
+                                                 _mm256_setzero_si256())) != -1) {
+         break;
+      }
+
+      roll = _mm256_shuffle_epi8(lutRoll,
+                                 _mm256_add_epi8(
+                                    _mm256_cmpeq_epi8(str,
+                                                      _mm256_set1_epi8('/')),
+                                    hiNibbles));
+      str = _mm256_add_epi8(str, roll);
+
+      merged = _mm256_maddubs_epi16(str, _mm256_set1_epi32(0x01400140));
+      merged = _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000));
+      merged = _mm256_shuffle_epi8(merged,
+                                   _mm256_setr_epi8(2, 1, 0, 6, 5, 4,
+                                                    10, 9, 8, 14, 13, 12,
+                                                    -1, -1, -1, -1,
+                                                    2, 1, 0, 6, 5, 4,
+                                                    10, 9, 8, 14, 13, 12,
+                                                    -1, -1, -1, -1));
+      /* Join the 12 bytes of each lane. */
+      merged = _mm256_permutevar8x32_epi32(merged,
+                                           _mm256_setr_epi32(0, 1, 2, 4, 5, 6,
+                                                             3, 7));
+
+      _mm_storeu_si128((__m128i *) out, _mm256_castsi256_si128(merged));
+      _mm_storel_epi64((__m128i *) (out + 16),
+                       _mm256_extracti128_si256(merged, 1));
+   }
+
+   return done + Base64DecodeSSSE3(src + done, srcSize - done,
+                                   out, outSize);
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -213,6 +569,21 @@ Base64_Encode(uint8 const *src,  // IN:
       goto exit;
    }
 
+#if defined(BASE64_SIMD_X86)
+   {
+      int simd = Base64SimdAvailable();
+
+      if (simd != 0) {
+         size_t done = simd == 2 ? Base64EncodeAVX2(src, srcSize, dst)
+                                 : Base64EncodeSSSE3(src, srcSize, dst);
+
+         src += done;
+         srcSize -= done;
+         dst += done / 3 * 4;
+      }
+   }
+#endif
+
    while (LIKELY(srcSize > 2)) {
       dst[0] = Base64[src[0] >> 2];
       dst[1] = Base64[(src[0] & 0x03) << 4 | src[1] >> 4];
@@ -264,11 +635,11 @@ main()
    size_t bufMax;
    if (1) {
       for (bufMax = 0; bufMax < 7; ++bufMax) {
-         char buf[999];
+         char buf[1000];
          size_t bufSize;
 
          if (bufMax == 6) {
-            bufMax = sizeof buf;
+            bufMax = sizeof buf - 1;
          }
 
          printf("\nBuffer size %"FMTSZ"u:\n", bufMax);
@@ -309,6 +680,53 @@ main()
       }
    }
 
+#if defined(BASE64_SIMD_X86)
+   /* The vector paths must match the scalar one, byte for byte. */
+   for (bufMax = 0; bufMax < 2000; ++bufMax) {
+      static uint8 data[1024];
+      static char enc[2][2048];
+      static uint8 dec[2][1024];
+      size_t len = rand() % sizeof data;
+      size_t encSize[2], decSize[2];
+      size_t outMax = rand() % 2 ? sizeof dec[0] : rand() % (len + 1);
+      Bool encOk[2], decOk[2];
+      int pass;
+      size_t j;
+
+      for (j = 0; j < len; j++) {
+         data[j] = rand();
+      }
+
+      for (pass = 0; pass < 2; pass++) {
+         base64UseSimd = pass == 0;
+         encOk[pass] = Base64_Encode(data, len, enc[pass], sizeof enc[pass],
+                                     &encSize[pass]);
+      }
+      if (!encOk[0] || !encOk[1] || encSize[0] != encSize[1] ||
+          memcmp(enc[0], enc[1], encSize[0]) != 0) {
+         printf("Vector encoding of %"FMTSZ"u bytes differs.\n", len);
+      }
+
+      /* Sprinkle whitespace, padding or garbage to exit the vector loop. */
+      if (len != 0 && rand() % 4 == 0) {
+         static const char junk[] = " \n=*-_\x80";
+
+         enc[0][rand() % encSize[0]] = junk[rand() % (sizeof junk - 1)];
+      }
+
+      for (pass = 0; pass < 2; pass++) {
+         base64UseSimd = pass == 0;
+         decOk[pass] = Base64_Decode(enc[0], dec[pass], outMax,
+                                     &decSize[pass]);
+      }
+      if (decOk[0] != decOk[1] || decSize[0] != decSize[1] ||
+          memcmp(dec[0], dec[1], decSize[0]) != 0) {
+         printf("Vector decoding of %"FMTSZ"u bytes differs.\n", len);
+      }
+   }
+   base64UseSimd = TRUE;
+#endif
+
    for (bufMax = 0; bufMax < 100000; ++bufMax) {
       char random_in[8000];
       char random_out[16000];
@@ -385,6 +803,10 @@ Base64_ChunkDecode(char const *in,      // IN:
    int n = 0;
    uintptr_t i = 0;
    size_t inputIndex = 0;
+#if defined(BASE64_SIMD_X86)
+   int simd = Base64SimdAvailable();
+   size_t readable = 0;
+#endif
 
    ASSERT(in);
    ASSERT(out || outSize == 0);
@@ -392,9 +814,35 @@ Base64_ChunkDecode(char const *in,      // IN:
    ASSERT((inSize == -1) || (inSize % 4) == 0);
    *dataLength = 0;
 
+#if defined(BASE64_SIMD_X86)
+   /* The vector code must not read past the NUL of unbounded input. */
+   if (simd != 0) {
+      readable = inSize == -1 ? strlen(in) : inSize;
+   }
+#endif
+
    i = 0;
    for (;inputIndex < inSize;) {
-      int p = base64Reverse[(unsigned char)in[inputIndex]];
+      int p;
+
+#if defined(BASE64_SIMD_X86)
+      /* Only at a quantum boundary, where no bits are pending. */
+      if (simd != 0 && n == 0 && readable - inputIndex >= 16) {
+         size_t done = simd == 2 ?
+            Base64DecodeAVX2(in + inputIndex, readable - inputIndex,
+                             out + i, outSize - i) :
+            Base64DecodeSSSE3(in + inputIndex, readable - inputIndex,
+                              out + i, outSize - i);
+
+         inputIndex += done;
+         i += done / 4 * 3;
+         if (inputIndex >= inSize) {
+            break;
+         }
+      }
+#endif
+
+      p = base64Reverse[(unsigned char)in[inputIndex]];
 
       if (UNLIKELY(p < 0)) {
          switch (p) {
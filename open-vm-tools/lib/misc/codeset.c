@@ -728,7 +728,30 @@ found:
 }
 
 
-#if defined(CURRENT_IS_UTF8)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CodeSetIsUtf8 --
+ *
+ *    Is the encoding name the one of UTF-8, as passed by lib/unicode and
+ *    most callers?
+ *
+ * Results:
+ *    TRUE if so. FALSE if not, or if it is one of its rarer aliases.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+CodeSetIsUtf8(const char *code)  // IN: encoding name
+{
+   return Str_Strcasecmp(code, "UTF-8") == 0 ||
+          Str_Strcasecmp(code, "UTF8") == 0;
+}
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -775,8 +798,6 @@ CodeSetDuplicateUtf8Str(const char *bufIn,  // IN: Input string
    return TRUE;
 }
 
-#endif // defined(CURRENT_IS_UTF8)
-
 
 /*
  *-----------------------------------------------------------------------------
@@ -1122,6 +1143,16 @@ CodeSet_GenericToGeneric(const char *codeIn,  // IN
    DynBuf db;
    Bool ok;
 
+   /*
+    * Valid UTF-8 to UTF-8 converts to itself, whatever the flags: copy it
+    * once instead of converting it through a growing DynBuf.
+    */
+
+   if (CodeSetIsUtf8(codeIn) && CodeSetIsUtf8(codeOut) &&
+       CodeSet_IsValidUTF8(bufIn, sizeIn)) {
+      return CodeSetDuplicateUtf8Str(bufIn, sizeIn, bufOut, sizeOut);
+   }
+
    DynBuf_Init(&db);
    ok = CodeSet_GenericToGenericDb(codeIn, bufIn, sizeIn, codeOut, flags, &db);
    return CodeSetDynBufFinalize(ok, &db, bufOut, sizeOut);
@@ -1690,12 +1721,19 @@ CodeSet_Validate(const char *buf,   // IN: the string
                  size_t size,       // IN: length of string
                  const char *code)  // IN: encoding
 {
-#if defined(NO_ICU)
-   return CodeSetOld_Validate(buf, size, code);
-#else
+#if !defined(NO_ICU)
    UConverter *cv;
    UErrorCode uerr;
+#endif
+
+   /* The common case needs no converter. */
+   if (CodeSetIsUtf8(code)) {
+      return CodeSet_IsValidUTF8(buf, size);
+   }
 
+#if defined(NO_ICU)
+   return CodeSetOld_Validate(buf, size, code);
+#else
    // ucnv_toUChars takes 32-bit int size
    VERIFY(size <= (size_t) MAX_INT32);
 
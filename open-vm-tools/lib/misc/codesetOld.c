@@ -67,6 +67,8 @@
    #include <dlfcn.h>
    #include <iconv.h>
    #include <langinfo.h>
+   #include <pthread.h>
+   #include "vthreadBase.h"
 #endif
 
 
@@ -816,7 +818,7 @@ CodeSetOld_GetCurrentCodeSet(void)
  *-----------------------------------------------------------------------------
  */
 
-static INLINE_SINGLE_CALLER iconv_t
+static iconv_t
 CodeSetOldIconvOpen(const char  *codeIn,   // IN:
                     const char  *codeOut,  // IN:
                     unsigned int flags)    // IN:
@@ -850,6 +852,264 @@ CodeSetOldIconvOpen(const char  *codeIn,   // IN:
 }
 
 
+#if defined(VMW_HAVE_TLS)
+/*
+ * Each thread keeps the last few descriptors it opened, so that repeated
+ * conversions between the same encodings do not pay for iconv_open, which
+ * loads and parses gconv modules.  A descriptor is reset to its initial
+ * shift state before it is used again.  The descriptors are closed when
+ * the thread exits.
+ */
+
+#define CODESET_ICONV_CACHE_SIZE  4
+#define CODESET_ICONV_NAME_MAX    48
+
+typedef struct CodeSetOldIconvEntry {
+   iconv_t cd;                 // (iconv_t)-1 if the entry is free
+   unsigned int flags;
+   uint32 lastUse;
+   char codeIn[CODESET_ICONV_NAME_MAX];
+   char codeOut[CODESET_ICONV_NAME_MAX];
+} CodeSetOldIconvEntry;
+
+typedef struct CodeSetOldIconvCache {
+   Bool initialized;
+   uint32 clock;
+   CodeSetOldIconvEntry entries[CODESET_ICONV_CACHE_SIZE];
+} CodeSetOldIconvCache;
+
+static __thread CodeSetOldIconvCache codeSetOldIconvCache;
+static pthread_key_t codeSetOldIconvKey;
+static pthread_once_t codeSetOldIconvOnce = PTHREAD_ONCE_INIT;
+static Bool codeSetOldIconvKeyValid;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CodeSetOldIconvCacheExit --
+ *
+ *    Thread exit destructor: close the descriptors cached by the thread.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+CodeSetOldIconvCacheExit(void *data)  // IN:
+{
+   CodeSetOldIconvCache *cache = data;
+   unsigned int i;
+
+   for (i = 0; i < ARRAYSIZE(cache->entries); i++) {
+      if (cache->entries[i].cd != (iconv_t)-1) {
+         iconv_close(cache->entries[i].cd);
+         cache->entries[i].cd = (iconv_t)-1;
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CodeSetOldIconvCacheKeyCreate --
+ *
+ *    Create the key used to run CodeSetOldIconvCacheExit at thread exit.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+CodeSetOldIconvCacheKeyCreate(void)
+{
+   codeSetOldIconvKeyValid =
+      pthread_key_create(&codeSetOldIconvKey, CodeSetOldIconvCacheExit) == 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CodeSetOldIconvCacheGet --
+ *
+ *    Return the cache of the calling thread, or NULL if descriptors cannot
+ *    be cached because they could not be closed at thread exit.
+ *
+ * Results:
+ *    See above.
+ *
+ * Side effects:
+ *    On first use by a thread, registers the cache for CodeSetOldIconvCacheExit.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static CodeSetOldIconvCache *
+CodeSetOldIconvCacheGet(void)
+{
+   CodeSetOldIconvCache *cache = &codeSetOldIconvCache;
+
+   if (!cache->initialized) {
+      unsigned int i;
+
+      pthread_once(&codeSetOldIconvOnce, CodeSetOldIconvCacheKeyCreate);
+      if (!codeSetOldIconvKeyValid ||
+          pthread_setspecific(codeSetOldIconvKey, cache) != 0) {
+         return NULL;
+      }
+      for (i = 0; i < ARRAYSIZE(cache->entries); i++) {
+         cache->entries[i].cd = (iconv_t)-1;
+      }
+      cache->initialized = TRUE;
+   }
+
+   return cache;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CodeSetOldIconvAcquire --
+ *
+ *    Get an iconv descriptor in its initial state for the conversion from
+ *    codeIn to codeOut, from the cache of the thread if possible.
+ *
+ * Results:
+ *    (iconv_t)-1 on failure
+ *    iconv handle on success; hand it back with CodeSetOldIconvRelease.
+ *
+ * Side effects:
+ *    May evict the least recently used descriptor of the thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static iconv_t
+CodeSetOldIconvAcquire(const char  *codeIn,   // IN:
+                       const char  *codeOut,  // IN:
+                       unsigned int flags)    // IN:
+{
+#if defined(VMW_HAVE_TLS)
+   CodeSetOldIconvCache *cache;
+   CodeSetOldIconvEntry *victim;
+   unsigned int i;
+   iconv_t cd;
+
+   if (strlen(codeIn) >= CODESET_ICONV_NAME_MAX ||
+       strlen(codeOut) >= CODESET_ICONV_NAME_MAX ||
+       (cache = CodeSetOldIconvCacheGet()) == NULL) {
+      return CodeSetOldIconvOpen(codeIn, codeOut, flags);
+   }
+
+   victim = &cache->entries[0];
+   for (i = 0; i < ARRAYSIZE(cache->entries); i++) {
+      CodeSetOldIconvEntry *entry = &cache->entries[i];
+
+      if (entry->cd == (iconv_t)-1) {
+         victim = entry;
+         continue;
+      }
+      if (entry->flags == flags &&
+          strcmp(entry->codeIn, codeIn) == 0 &&
+          strcmp(entry->codeOut, codeOut) == 0) {
+         entry->lastUse = ++cache->clock;
+         cd = entry->cd;
+         entry->cd = (iconv_t)-1;  // Owned by the caller until released.
+         iconv(cd, NULL, NULL, NULL, NULL);
+
+         return cd;
+      }
+      if (victim->cd != (iconv_t)-1 && entry->lastUse < victim->lastUse) {
+         victim = entry;
+      }
+   }
+
+   cd = CodeSetOldIconvOpen(codeIn, codeOut, flags);
+   if (cd != (iconv_t)-1) {
+      /*
+       * Reserve the slot now; the descriptor goes into it on release.
+       */
+
+      if (victim->cd != (iconv_t)-1) {
+         iconv_close(victim->cd);
+         victim->cd = (iconv_t)-1;
+      }
+      victim->flags = flags;
+      victim->lastUse = ++cache->clock;
+      Str_Strcpy(victim->codeIn, codeIn, sizeof victim->codeIn);
+      Str_Strcpy(victim->codeOut, codeOut, sizeof victim->codeOut);
+   }
+
+   return cd;
+#else
+   return CodeSetOldIconvOpen(codeIn, codeOut, flags);
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CodeSetOldIconvRelease --
+ *
+ *    Hand back a descriptor obtained from CodeSetOldIconvAcquire.  A
+ *    descriptor that failed a conversion is not trusted again and is closed.
+ *
+ * Results:
+ *    TRUE on success
+ *    FALSE if closing the descriptor failed
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+CodeSetOldIconvRelease(iconv_t cd,            // IN:
+                       const char  *codeIn,   // IN:
+                       const char  *codeOut,  // IN:
+                       unsigned int flags,    // IN:
+                       Bool failed)           // IN:
+{
+#if defined(VMW_HAVE_TLS)
+   CodeSetOldIconvCache *cache = &codeSetOldIconvCache;
+   unsigned int i;
+
+   if (!failed && cache->initialized) {
+      for (i = 0; i < ARRAYSIZE(cache->entries); i++) {
+         CodeSetOldIconvEntry *entry = &cache->entries[i];
+
+         if (entry->cd == (iconv_t)-1 &&
+             entry->flags == flags &&
+             strcmp(entry->codeIn, codeIn) == 0 &&
+             strcmp(entry->codeOut, codeOut) == 0) {
+            entry->cd = cd;
+
+            return TRUE;
+         }
+      }
+   }
+#endif
+
+   return iconv_close(cd) == 0;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -888,7 +1148,7 @@ CodeSetOld_GenericToGenericDb(char const *codeIn,   // IN:
       flags = CSGTG_TRANSLIT | CSGTG_IGNORE;
    }
 
-   cd = CodeSetOldIconvOpen(codeIn, codeOut, flags);
+   cd = CodeSetOldIconvAcquire(codeIn, codeOut, flags);
    if (cd == (iconv_t)-1) {
       return FALSE;
    }
@@ -984,14 +1244,10 @@ CodeSetOld_GenericToGenericDb(char const *codeIn,   // IN:
       /* Need a larger buffer --hpreg */
    }
 
-   if (iconv_close(cd) < 0) {
-      return FALSE;
-   }
-
-   return TRUE;
+   return CodeSetOldIconvRelease(cd, codeIn, codeOut, flags, FALSE);
 
 error:
-   iconv_close(cd);
+   CodeSetOldIconvRelease(cd, codeIn, codeOut, flags, TRUE);
 
    return FALSE;
 }
@@ -26,9 +26,15 @@
  */
 
 
+#include <string.h>
+
 #include "vmware.h"
 #include "codeset.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #define UTF8_ACCEPT 0
 #define UTF8_REJECT 1
 
@@ -61,16 +67,49 @@ CodeSetDecode(uint32 *state,  // IN:
 }
 
 
-Bool
-CodeSet_IsStringValidUTF8(const char *bufIn)  // IN:
+/*
+ * Returns the number of leading ASCII bytes of bufIn. Paths and RPC
+ * strings are mostly ASCII, which is checked 16 (SSE2) or 8 bytes at a
+ * time instead of going through the DFA.
+ */
+
+size_t
+CodeSet_AsciiLength(const char *bufIn,  // IN:
+                    size_t sizeIn)      // IN:
 {
-   uint32 state = UTF8_ACCEPT;
+   size_t i = 0;
+
+#if defined(__SSE2__)
+   for (; sizeIn - i >= 16; i += 16) {
+      __m128i chunk = _mm_loadu_si128((const __m128i *) (bufIn + i));
+
+      if (_mm_movemask_epi8(chunk) != 0) {
+         break;
+      }
+   }
+#else
+   for (; sizeIn - i >= 8; i += 8) {
+      uint64 word;
+
+      memcpy(&word, bufIn + i, sizeof word);
+      if ((word & CONST64U(0x8080808080808080)) != 0) {
+         break;
+      }
+   }
+#endif
 
-   while (*bufIn) {
-      CodeSetDecode(&state, (unsigned char) *bufIn++);
+   while (i < sizeIn && (unsigned char) bufIn[i] < 0x80) {
+      i++;
    }
 
-   return state == UTF8_ACCEPT;
+   return i;
+}
+
+
+Bool
+CodeSet_IsStringValidUTF8(const char *bufIn)  // IN:
+{
+   return CodeSet_IsValidUTF8(bufIn, strlen(bufIn));
 }
 
 
@@ -78,11 +117,23 @@ Bool
 CodeSet_IsValidUTF8(const char *bufIn,  // IN:
                     size_t sizeIn)      // IN:
 {
-   size_t i;
+   size_t i = 0;
    uint32 state = UTF8_ACCEPT;
 
-   for (i = 0; i < sizeIn; i++) {
-      CodeSetDecode(&state, (unsigned char) *bufIn++);
+   while (i < sizeIn) {
+      unsigned char byte = bufIn[i];
+
+      /* Skip ASCII runs between code points. */
+      if (byte < 0x80 && state == UTF8_ACCEPT) {
+         i += CodeSet_AsciiLength(bufIn + i, sizeIn - i);
+         continue;
+      }
+
+      /* UTF8_REJECT is final. */
+      if (CodeSetDecode(&state, byte) == UTF8_REJECT) {
+         return FALSE;
+      }
+      i++;
    }
 
    return state == UTF8_ACCEPT;
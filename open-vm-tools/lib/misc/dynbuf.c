@@ -55,6 +55,7 @@ DynBuf_Init(DynBuf *b)  // OUT:
    b->data = NULL;
    b->size = 0;
    b->allocated = 0;
+   b->fixed = NULL;
 }
 
 
@@ -87,6 +88,7 @@ DynBuf_InitWithMemory(DynBuf *b,        // IN/OUT:
    b->size = 0;
    b->data = data;
    b->allocated = dataSize;
+   b->fixed = NULL;
 }
 
 
@@ -120,6 +122,66 @@ DynBuf_InitWithString(DynBuf *b, // IN/OUT
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DynBuf_InitWithBuffer --
+ *
+ *      Dynamic buffer constructor. The dynamic buffer is empty and uses the
+ *      caller's buffer, typically on the stack, until it outgrows it, so
+ *      that short contents need no heap allocation. The buffer is never
+ *      freed nor reallocated, and must outlive the dynamic buffer.
+ *      DynBuf_Detach returns a heap copy of the contents while they are
+ *      still in it.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+DynBuf_InitWithBuffer(DynBuf *b,       // OUT:
+                      size_t bufSize,  // IN:
+                      void *buf)       // IN:
+{
+   ASSERT(b);
+   ASSERT(bufSize != 0);
+   ASSERT(buf != NULL);
+
+   b->data = buf;
+   b->size = 0;
+   b->allocated = bufSize;
+   b->fixed = buf;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DynBufIsFixed --
+ *
+ *      Whether the data is still in the caller's buffer.
+ *
+ * Results:
+ *      TRUE if it is, FALSE if the data is on the heap.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE Bool
+DynBufIsFixed(DynBuf const *b)  // IN:
+{
+   return b->fixed != NULL && b->data == b->fixed;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -141,7 +203,9 @@ DynBuf_Destroy(DynBuf *b)  // IN/OUT:
 {
    ASSERT(b);
 
-   free(b->data);
+   if (!DynBufIsFixed(b)) {
+      free(b->data);
+   }
    DynBuf_Init(b);
 }
 
@@ -171,7 +235,9 @@ DynBuf_Attach(DynBuf *b,    // IN/OUT:
    ASSERT(b);
    ASSERT((size == 0) == (data == NULL));
 
-   free(b->data);
+   if (!DynBufIsFixed(b)) {
+      free(b->data);
+   }
    b->data = data;
    b->size = b->allocated = size;
 }
@@ -183,7 +249,8 @@ DynBuf_Attach(DynBuf *b,    // IN/OUT:
  * DynBuf_Detach --
  *
  *      Transfers ownership of the buffer stored in the DynBuf object to the
- *      caller.
+ *      caller. Data still in the buffer of DynBuf_InitWithBuffer is copied
+ *      to the heap, with no spare room.
  *
  * Results:
  *      Returns a pointer to the data.  The caller must free it with free().
@@ -201,7 +268,14 @@ DynBuf_Detach(DynBuf *b)  // IN/OUT:
 
    ASSERT(b);
 
-   data = b->data;
+   if (DynBufIsFixed(b)) {
+      data = malloc(b->size + 1);
+      ASSERT_MEM_ALLOC(data);
+      memcpy(data, b->data, b->size);
+      ((char *) data)[b->size] = '\0';
+   } else {
+      data = b->data;
+   }
    b->data = NULL;
    b->allocated = 0;
 
@@ -230,9 +304,8 @@ DynBuf_Detach(DynBuf *b)  // IN/OUT:
 char *
 DynBuf_DetachString(DynBuf *b) // IN/OUT
 {
-   char *data = DynBuf_GetString(b);
-   DynBuf_Detach(b);
-   return data;
+   DynBuf_GetString(b);
+   return DynBuf_Detach(b);
 }
 
 
@@ -243,6 +316,9 @@ DynBuf_DetachString(DynBuf *b) // IN/OUT
  *
  *      Reallocate a dynamic buffer --hpreg
  *
+ *      Data in the caller's buffer moves to the heap when it grows, and
+ *      stays when it shrinks.
+ *
  * Results:
  *      TRUE on success
  *      FALSE on failure (not enough memory)
@@ -261,6 +337,22 @@ DynBufRealloc(DynBuf *b,            // IN/OUT:
 
    ASSERT(b);
 
+   if (DynBufIsFixed(b)) {
+      if (newAllocated <= b->allocated) {
+         return TRUE;
+      }
+
+      new_data = malloc(newAllocated);
+      if (new_data == NULL) {
+         return FALSE;
+      }
+      memcpy(new_data, b->data, b->size);
+      b->data = new_data;
+      b->allocated = newAllocated;
+
+      return TRUE;
+   }
+
    new_data = realloc(b->data, newAllocated);
    if (new_data == NULL && newAllocated) {
       /* Not enough memory */
@@ -343,6 +435,39 @@ DynBuf_Enlarge(DynBuf *b,       // IN/OUT:
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * DynBuf_Reserve --
+ *
+ *      Make the dynamic buffer at least 'size' bytes large, allocating
+ *      exactly that much if it must grow. For callers which know the final
+ *      size, where DynBuf_Enlarge would round it up.
+ *
+ * Results:
+ *      TRUE on success
+ *      FALSE on failure (not enough memory)
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+DynBuf_Reserve(DynBuf *b,     // IN/OUT:
+               size_t size)   // IN:
+{
+   ASSERT(b);
+
+   if (size <= b->allocated) {
+      return TRUE;
+   }
+
+   return DynBufRealloc(b, size);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
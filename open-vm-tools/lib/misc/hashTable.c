@@ -21,6 +21,11 @@
  *
  *      An implementation of hashtable with no removals.
  *      For string keys.
+ *
+ *      Non-atomic hash tables double their bucket count once they hold
+ *      more entries than buckets. The entries are then moved to the new
+ *      buckets a few old buckets at a time by the following inserts and
+ *      deletes, so that no single operation pays for the whole rehash.
  */
 
 #include <stdio.h>
@@ -39,7 +44,15 @@
 #include "vm_atomic.h"
 
 
-#define HASH_ROTATE     5
+/* FNV-1a. */
+#define HASH_FNV_OFFSET 2166136261U
+#define HASH_FNV_PRIME  16777619U
+
+/* Grow once the table holds this many entries per bucket. */
+#define HASH_MAX_LOAD   1
+
+/* Old buckets moved to the new ones by each insert or delete. */
+#define HASH_MIGRATE_STEP 8
 
 
 /*
@@ -69,6 +82,7 @@ typedef Atomic_Ptr HashTableLink;
 
 typedef struct HashTableEntry {
    HashTableLink     next;
+   uint32            hash;   // Full hash of keyStr.
    const void       *keyStr;
    Atomic_Ptr        clientData;
 } HashTableEntry;
@@ -87,6 +101,15 @@ struct HashTable {
    HashTableLink         *buckets;
 
    size_t                 numElements;
+
+   /*
+    * While the table grows, the buckets before migrateIndex were moved
+    * to 'buckets', the others are still in use.
+    */
+
+   HashTableLink         *oldBuckets;
+   uint32                 oldNumEntries;
+   uint32                 migrateIndex;
 };
 
 
@@ -104,10 +127,12 @@ HashTableEntry *HashTableLookupOrInsert(HashTable *ht,
  *
  * HashTableComputeHash --
  *
- *      Compute hash value based on key type and hash size.
+ *      Compute hash value based on key type. Strings are hashed with
+ *      FNV-1a, then all keys go through the murmur3 finalizer, so that
+ *      the low bits used as the bucket index depend on the whole key.
  *
  * Results:
- *      The hash value.
+ *      The hash value, of all 32 bits.
  *
  * Side effects:
  *      None.
@@ -119,7 +144,7 @@ static uint32
 HashTableComputeHash(const HashTable *ht,  // IN: hash table
                      const void *s)        // IN: string to hash
 {
-   uint32 h = 0;
+   uint32 h = HASH_FNV_OFFSET;
 
    switch (ht->keyType) {
    case HASH_STRING_KEY: {
@@ -127,8 +152,7 @@ HashTableComputeHash(const HashTable *ht,  // IN: hash table
          unsigned char *keyPtr = (unsigned char *) s;
 
          while ((c = *keyPtr++)) {
-            h ^= c;
-            h = h << HASH_ROTATE | h >> (32 - HASH_ROTATE);
+            h = (h ^ c) * HASH_FNV_PRIME;
          }
       }
       break;
@@ -137,8 +161,7 @@ HashTableComputeHash(const HashTable *ht,  // IN: hash table
          unsigned char *keyPtr = (unsigned char *) s;
 
          while ((c = tolower(*keyPtr++))) {
-            h ^= c;
-            h = h << HASH_ROTATE | h >> (32 - HASH_ROTATE);
+            h = (h ^ c) * HASH_FNV_PRIME;
          }
       }
       break;
@@ -150,23 +173,166 @@ HashTableComputeHash(const HashTable *ht,  // IN: hash table
       } else {
          h = (uint32) (uintptr_t) s ^ (uint32) ((uint64) (uintptr_t) s >> 32);
       }
-      h *= 48271;  // http://www.google.com/search?q=48271+pseudorandom
       break;
    default:
       NOT_REACHED();
    }
 
-   {
-      int numBits = ht->numBits;
-      uint32 mask = MASK(numBits);
+   h ^= h >> 16;
+   h *= 0x85ebca6b;
+   h ^= h >> 13;
+   h *= 0xc2b2ae35;
+   h ^= h >> 16;
+
+   return h;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HashTableBucket --
+ *
+ *      Find the bucket of a hash value: the old one if the table is growing
+ *      and the old bucket was not moved yet, the new one otherwise.
+ *
+ * Results:
+ *      The bucket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HashTableLink *
+HashTableBucket(const HashTable *ht,  // IN: hash table
+                uint32 hash)          // IN: full hash value
+{
+   if (ht->oldBuckets != NULL) {
+      uint32 oldIndex = hash & (ht->oldNumEntries - 1);
 
-      for (; h > mask; h = (h & mask) ^ (h >> numBits)) {
+      if (oldIndex >= ht->migrateIndex) {
+         return &ht->oldBuckets[oldIndex];
       }
    }
 
-   ASSERT(h < ht->numEntries);
+   return &ht->buckets[hash & MASK(ht->numBits)];
+}
 
-   return h;
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HashTableMigrate --
+ *
+ *      Move up to 'count' old buckets to the new ones, and free the old
+ *      buckets once all were moved.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HashTableMigrate(HashTable *ht,  // IN/OUT: hash table
+                 uint32 count)   // IN: number of old buckets to move
+{
+   ASSERT(!ht->atomic);
+
+   for (; ht->oldBuckets != NULL && count > 0; count--) {
+      HashTableLink *oldBucket = &ht->oldBuckets[ht->migrateIndex];
+      HashTableEntry *entry;
+
+      while ((entry = ENTRY(*oldBucket)) != NULL) {
+         HashTableLink *bucket = &ht->buckets[entry->hash & MASK(ht->numBits)];
+
+         SETENTRY(*oldBucket, ENTRY(entry->next));
+         SETENTRY(entry->next, ENTRY(*bucket));
+         SETENTRY(*bucket, entry);
+      }
+
+      if (++ht->migrateIndex == ht->oldNumEntries) {
+         free(ht->oldBuckets);
+         ht->oldBuckets = NULL;
+         ht->oldNumEntries = 0;
+         ht->migrateIndex = 0;
+      }
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HashTableGrow --
+ *
+ *      Double the bucket count of a non-atomic table which holds more than
+ *      HASH_MAX_LOAD entries per bucket. The entries are moved by the next
+ *      calls to HashTableMigrate.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HashTableGrow(HashTable *ht)  // IN/OUT: hash table
+{
+   if (ht->atomic ||
+       ht->numElements <= (size_t) ht->numEntries * HASH_MAX_LOAD ||
+       ht->numBits >= 30) {
+      return;
+   }
+
+   /* A previous growth is normally long done, but deletes do not grow. */
+   HashTableMigrate(ht, ht->oldNumEntries);
+   ASSERT(ht->oldBuckets == NULL);
+
+   ht->oldBuckets = ht->buckets;
+   ht->oldNumEntries = ht->numEntries;
+   ht->migrateIndex = 0;
+
+   ht->numBits++;
+   ht->numEntries <<= 1;
+   ht->buckets = Util_SafeCalloc(ht->numEntries, sizeof *ht->buckets);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HashTableBucketAt --
+ *
+ *      Walk the buckets: indexes below numEntries are the new buckets, the
+ *      following ones the old buckets of a growing table. Moved old buckets
+ *      are empty.
+ *
+ * Results:
+ *      The bucket.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE const HashTableLink *
+HashTableBucketAt(const HashTable *ht,  // IN: hash table
+                  uint32 i)             // IN: index
+{
+   ASSERT(i < ht->numEntries + ht->oldNumEntries);
+
+   return i < ht->numEntries ? &ht->buckets[i]
+                             : &ht->oldBuckets[i - ht->numEntries];
 }
 
 
@@ -196,7 +362,9 @@ HashTableEqualKeys(const HashTable *ht,  // IN: hash table
       return Str_Strcmp((const char *) key1, (const char *) key2) == 0;
 
    case HASH_ISTRING_KEY:
-      return Str_Strcasecmp((const char *) key1, (const char *) key2) == 0;
+      /* Names are mostly looked up with the case they were inserted with. */
+      return strcmp((const char *) key1, (const char *) key2) == 0 ||
+             Str_Strcasecmp((const char *) key1, (const char *) key2) == 0;
 
    default:
       return key1 == key2;
@@ -209,7 +377,8 @@ HashTableEqualKeys(const HashTable *ht,  // IN: hash table
  *
  * HashTable_Alloc --
  *
- *      Create a hash table.
+ *      Create a hash table. numEntries is the initial bucket count,
+ *      which non-atomic tables grow as needed.
  *
  * Results:
  *      The new hashtable.
@@ -248,6 +417,9 @@ HashTable_Alloc(uint32 numEntries,        // IN: must be a power of 2
    ht->freeEntryFn = fn;
    ht->buckets = Util_SafeCalloc(ht->numEntries, sizeof *ht->buckets);
    ht->numElements = 0;
+   ht->oldBuckets = NULL;
+   ht->oldNumEntries = 0;
+   ht->migrateIndex = 0;
 
    return ht;
 }
@@ -316,15 +488,16 @@ HashTable_AllocOnce(Atomic_Ptr *var,          // IN/OUT: the atomic var
 static void
 HashTableClearInternal(HashTable *ht)  // IN/OUT:
 {
-   int i;
+   uint32 i;
 
    ht->numElements = 0;
 
-   for (i = 0; i < ht->numEntries; i++) {
+   for (i = 0; i < ht->numEntries + ht->oldNumEntries; i++) {
+      HashTableLink *bucket = (HashTableLink *) HashTableBucketAt(ht, i);
       HashTableEntry *entry;
 
-      while ((entry = ENTRY(ht->buckets[i])) != NULL) {
-         SETENTRY(ht->buckets[i], ENTRY(entry->next));
+      while ((entry = ENTRY(*bucket)) != NULL) {
+         SETENTRY(*bucket, ENTRY(entry->next));
          if (ht->copyKey) {
             free((void *) entry->keyStr);
          }
@@ -334,6 +507,11 @@ HashTableClearInternal(HashTable *ht)  // IN/OUT:
          free(entry);
       }
    }
+
+   free(ht->oldBuckets);
+   ht->oldBuckets = NULL;
+   ht->oldNumEntries = 0;
+   ht->migrateIndex = 0;
 }
 
 
@@ -431,10 +609,11 @@ HashTableLookup(const HashTable *ht,  // IN:
 {
    HashTableEntry *entry;
 
-   for (entry = ENTRY(ht->buckets[hash]);
+   for (entry = ENTRY(*HashTableBucket(ht, hash));
         entry != NULL;
         entry = ENTRY(entry->next)) {
-      if (HashTableEqualKeys(ht, entry->keyStr, keyStr)) {
+      if (entry->hash == hash &&
+          HashTableEqualKeys(ht, entry->keyStr, keyStr)) {
          return entry;
       }
    }
@@ -537,10 +716,13 @@ HashTable_LookupAndDelete(HashTable *ht,       // IN/OUT: the hash table
 
    ASSERT(!ht->atomic);
 
-   for (linkp = &ht->buckets[hash];
+   HashTableMigrate(ht, HASH_MIGRATE_STEP);
+
+   for (linkp = HashTableBucket(ht, hash);
         (entry = ENTRY(*linkp)) != NULL;
         linkp = &entry->next) {
-      if (HashTableEqualKeys(ht, entry->keyStr, keyStr)) {
+      if (entry->hash == hash &&
+          HashTableEqualKeys(ht, entry->keyStr, keyStr)) {
          SETENTRY(*linkp, ENTRY(entry->next));
          ht->numElements--;
          if (ht->copyKey) {
@@ -754,10 +936,16 @@ HashTableLookupOrInsert(HashTable *ht,       // IN/OUT:
    uint32 hash = HashTableComputeHash(ht, keyStr);
    HashTableEntry *entry = NULL;
    HashTableEntry *oldEntry = NULL;
+   HashTableLink *bucket;
    HashTableEntry *head;
 
+   if (!ht->atomic) {
+      HashTableMigrate(ht, HASH_MIGRATE_STEP);
+   }
+
 again:
-   head = ENTRY(ht->buckets[hash]);
+   bucket = HashTableBucket(ht, hash);
+   head = ENTRY(*bucket);
 
    oldEntry = HashTableLookup(ht, keyStr, hash);
    if (oldEntry != NULL) {
@@ -773,6 +961,7 @@ again:
 
    if (entry == NULL) {
       entry = Util_SafeMalloc(sizeof *entry);
+      entry->hash = hash;
       if (ht->copyKey) {
          entry->keyStr = Util_SafeStrdup(keyStr);
       } else {
@@ -782,14 +971,15 @@ again:
    }
    SETENTRY(entry->next, head);
    if (ht->atomic) {
-      if (!SETENTRYATOMIC(ht->buckets[hash], head, entry)) {
+      if (!SETENTRYATOMIC(*bucket, head, entry)) {
          goto again;
       }
    } else {
-      SETENTRY(ht->buckets[hash], entry);
+      SETENTRY(*bucket, entry);
    }
 
    ht->numElements++;
+   HashTableGrow(ht);
 
    return NULL;
 }
@@ -868,10 +1058,10 @@ HashTable_KeyArray(const HashTable *ht,  // IN:
    *keys = Util_SafeMalloc(*size * sizeof **keys);
 
    /* fill array */
-   for (i = 0, j = 0; i < ht->numEntries; i++) {
+   for (i = 0, j = 0; i < ht->numEntries + ht->oldNumEntries; i++) {
       HashTableEntry *entry;
 
-      for (entry = ENTRY(ht->buckets[i]);
+      for (entry = ENTRY(*HashTableBucketAt(ht, i));
            entry != NULL;
            entry = ENTRY(entry->next)) {
          (*keys)[j++] = entry->keyStr;
@@ -924,10 +1114,10 @@ HashTable_ToArray(const HashTable *ht,  // IN:
    *clientDatas = Util_SafeMalloc(*size * sizeof **clientDatas);
 
    /* fill array */
-   for (i = 0, j = 0; i < ht->numEntries; i++) {
+   for (i = 0, j = 0; i < ht->numEntries + ht->oldNumEntries; i++) {
       HashTableEntry *entry;
 
-      for (entry = ENTRY(ht->buckets[i]);
+      for (entry = ENTRY(*HashTableBucketAt(ht, i));
            entry != NULL;
            entry = ENTRY(entry->next)) {
          (*clientDatas)[j++] = Atomic_ReadPtr(&entry->clientData);
@@ -960,15 +1150,15 @@ HashTable_ForEach(const HashTable *ht,          // IN:
                   HashTableForEachCallback cb,  // IN:
                   void *clientData)             // IN:
 {
-   int i;
+   uint32 i;
 
    ASSERT(ht);
    ASSERT(cb);
 
-   for (i = 0; i < ht->numEntries; i++) {
+   for (i = 0; i < ht->numEntries + ht->oldNumEntries; i++) {
       HashTableEntry *entry;
 
-      for (entry = ENTRY(ht->buckets[i]);
+      for (entry = ENTRY(*HashTableBucketAt(ht, i));
            entry != NULL;
            entry = ENTRY(entry->next)) {
          int result = (*cb)(entry->keyStr, Atomic_ReadPtr(&entry->clientData),
@@ -44,7 +44,8 @@
 
 
 /*
- * HostinfoOSData caches its returned value.
+ * HostinfoOSData caches its returned value, until HostinfoOSCacheValid sees
+ * the distro identification change.
  */
 
 volatile Bool hostinfoCacheValid = FALSE;
@@ -257,7 +258,7 @@ char *
 Hostinfo_GetOSName(void)
 {
    char *name;
-   Bool data = hostinfoCacheValid ? TRUE : HostinfoOSData();
+   Bool data = HostinfoOSCacheValid() ? TRUE : HostinfoOSData();
 
    if (data) {
        name = Util_SafeStrdup(hostinfoCachedOSFullName);
@@ -291,7 +292,7 @@ char *
 Hostinfo_GetOSGuestString(void)
 {
    char *name;
-   Bool data = hostinfoCacheValid ? TRUE : HostinfoOSData();
+   Bool data = HostinfoOSCacheValid() ? TRUE : HostinfoOSData();
 
    if (data) {
        name = Util_SafeStrdup(hostinfoCachedOSName);
@@ -325,7 +326,7 @@ char *
 Hostinfo_GetOSDetailedData(void)
 {
    char *detailedData;
-   Bool data = hostinfoCacheValid ? TRUE : HostinfoOSData();
+   Bool data = HostinfoOSCacheValid() ? TRUE : HostinfoOSData();
 
    if (data) {
       detailedData = Util_SafeStrdup(hostinfoCachedDetailedData);
@@ -67,5 +67,6 @@ extern char          hostinfoCachedDetailedData[MAX_DETAILED_STRING_LEN];
  */
 
 extern Bool HostinfoOSData(void);
+extern Bool HostinfoOSCacheValid(void);
 
 #endif // ifndef _HOSTINFOINT_H_
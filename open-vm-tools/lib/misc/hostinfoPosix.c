@@ -89,6 +89,11 @@
 #include <paths.h>
 #endif
 
+#if defined(__linux__) && !defined(VMX86_SERVER) && !defined(USERWORLD)
+#include <sys/inotify.h>
+#define HOSTINFO_OS_WATCH 1
+#endif
+
 #ifdef __linux__
 #include <dlfcn.h>
 #endif
@@ -1372,7 +1377,11 @@ HostinfoLsbRemoveQuotes(char *lsbOutput)  // IN/OUT:
  *      Attempt to return the distro identification data we're interested in
  *      from the LSB standard file.
  *
- *      The fields of interest are found in lsbFields above.
+ *      The fields of interest are found in lsbFields above. /etc/lsb-release
+ *      is parsed directly, as lsb_release does; the command is only run, as a
+ *      last resort, when neither it, a distro file nor os-release data is
+ *      there: forking it (a python script on many distros) took a noticeable
+ *      part of the boot.
  *
  *      https://refspecs.linuxfoundation.org/lsb.shtml
  *
@@ -1390,7 +1399,8 @@ HostinfoLsbRemoveQuotes(char *lsbOutput)  // IN/OUT:
  */
 
 static int
-HostinfoLsb(char ***args)  // OUT:
+HostinfoLsb(Bool runCmd,   // IN: lsb_release may be run
+            char ***args)  // OUT:
 {
    uint32 i;
    int score;
@@ -1398,12 +1408,20 @@ HostinfoLsb(char ***args)  // OUT:
    size_t fields = ARRAYSIZE(lsbFields) - 1;  // Exclude terminator
 
    /*
-    * Try to get OS detailed information from the lsb_release command.
+    * Try to get OS detailed information from the LSB file, the way
+    * lsb_release -sd/-si/-sr reports it.
     */
 
-   lsbOutput = HostinfoGetCmdOutput("/usr/bin/lsb_release -sd 2>/dev/null");
+   *args = HostinfoReadDistroFile(TRUE, "/etc/lsb-release", &lsbFields[0]);
+
+   if (*args != NULL && (*args)[3] != NULL) {
+      free((*args)[fields]);
+      (*args)[fields] = Util_SafeStrdup((*args)[3]);
+   } else {
+      if (*args != NULL) {
+         Util_FreeStringList(*args, ARRAYSIZE(lsbFields));
+      }
 
-   if (lsbOutput == NULL) {
       /*
        * Try to get more detailed information from the version file.
        */
@@ -1416,7 +1434,11 @@ HostinfoLsb(char ***args)  // OUT:
             break;
          }
       }
-   } else {
+   }
+
+   if (*args == NULL && runCmd &&
+       (lsbOutput = HostinfoGetCmdOutput("/usr/bin/lsb_release -sd "
+                                         "2>/dev/null")) != NULL) {
       *args = Util_SafeCalloc(fields + 1, sizeof(char *));
 
       /* LSB Description (pretty name) */
@@ -1572,8 +1594,8 @@ HostinfoBestScore(char *distro,            // OUT:
 {
    char **lsbData = NULL;
    char **osReleaseData = NULL;
-   int lsbScore = HostinfoLsb(&lsbData);
    int osReleaseScore = HostinfoOsRelease(&osReleaseData);
+   int lsbScore = HostinfoLsb(osReleaseScore <= 0, &lsbData);
 
    /* We prefer the LSB so as to maintain the best backwards compatibility. */
    if ((lsbScore > 0) && (lsbScore >= osReleaseScore)) {
@@ -1829,6 +1851,149 @@ HostinfoSun(struct utsname *buf)  // IN:
 #endif // !defined(__APPLE__) && !defined(VMX86_SERVER) && !defined(USERWORLD)
 
 
+#if defined(HOSTINFO_OS_WATCH)
+/*
+ * inotify descriptor watching the directories of the distro identification
+ * files, so that the cached OS data is recomputed once they change (e.g. on
+ * a distro upgrade) instead of only after a restart. -1 if not watching.
+ */
+
+static Atomic_Int hostinfoOSWatchFd = { -1 };
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HostinfoOSWatchInit --
+ *
+ *      Start watching the distro identification files, if not done yet.
+ *      /etc/os-release is often a symbolic link to /usr/lib/os-release, and
+ *      package managers replace both by renaming, so the directories are
+ *      watched rather than the files.
+ *
+ * Return value:
+ *      None
+ *
+ * Side effects:
+ *      An inotify descriptor is opened for the life of the process.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HostinfoOSWatchInit(void)
+{
+   static const char *dirs[] = { "/etc", "/usr/lib" };
+   uint32 mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                 IN_MOVED_TO | IN_ONLYDIR;
+   uint32 i;
+   int fd;
+
+   if (Atomic_ReadInt(&hostinfoOSWatchFd) != -1) {
+      return;
+   }
+
+   fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (fd == -1) {
+      Log("%s: inotify_init1 failed %d\n", __FUNCTION__, errno);
+      return;
+   }
+
+   for (i = 0; i < ARRAYSIZE(dirs); i++) {
+      if (inotify_add_watch(fd, dirs[i], mask) == -1 && errno != ENOENT) {
+         Log("%s: cannot watch %s: %d\n", __FUNCTION__, dirs[i], errno);
+      }
+   }
+
+   if (Atomic_ReadIfEqualWriteInt(&hostinfoOSWatchFd, -1, fd) != -1) {
+      close(fd);  // Another thread won the race
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HostinfoOSWatchChanged --
+ *
+ *      Consume the pending events of the watch.
+ *
+ * Return value:
+ *      TRUE   A distro identification file may have changed.
+ *      FALSE  No change, or not watching.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HostinfoOSWatchChanged(void)
+{
+   int fd = Atomic_ReadInt(&hostinfoOSWatchFd);
+   Bool changed = FALSE;
+   char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+   ssize_t len;
+
+   if (fd == -1) {
+      return FALSE;
+   }
+
+   while ((len = read(fd, buf, sizeof buf)) > 0) {
+      char *p = buf;
+
+      while (p < buf + len) {
+         const struct inotify_event *ev = (const struct inotify_event *) p;
+
+         if ((ev->mask & IN_Q_OVERFLOW) != 0 ||
+             (ev->len != 0 && (strstr(ev->name, "release") != NULL ||
+                               strstr(ev->name, "version") != NULL))) {
+            changed = TRUE;
+         }
+
+         p += sizeof *ev + ev->len;
+      }
+   }
+
+   return changed;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HostinfoOSCacheValid --
+ *
+ *      Tell if the cached OS data can be returned, or has to be recomputed
+ *      by HostinfoOSData because it was never computed or the distro
+ *      identification files changed since.
+ *
+ * Return value:
+ *      TRUE   The cache is valid.
+ *      FALSE  Call HostinfoOSData.
+ *
+ * Side effects:
+ *      The cache may be invalidated.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+HostinfoOSCacheValid(void)
+{
+#if defined(HOSTINFO_OS_WATCH)
+   if (hostinfoCacheValid && HostinfoOSWatchChanged()) {
+      Log("%s: distro identification changed\n", __FUNCTION__);
+      hostinfoCacheValid = FALSE;
+   }
+#endif
+
+   return hostinfoCacheValid;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1879,6 +2044,12 @@ HostinfoOSData(void)
    Str_Strcpy(detailedDataFields[BITNESS].value, bitness,
               sizeof detailedDataFields[BITNESS].value);
 
+#if defined(HOSTINFO_OS_WATCH)
+   /* Watch first, so that changes made while the files are read are seen. */
+   HostinfoOSWatchInit();
+   HostinfoOSWatchChanged();
+#endif
+
 #if defined(VMX86_SERVER) || defined(USERWORLD)  // ESXi
    success = HostinfoESX(&buf);
 #elif defined(__APPLE__) // MacOS
@@ -23,6 +23,7 @@
  */
 
 #include <errno.h>
+#include <grp.h>
 #include <stdlib.h>
 #include <sys/syscall.h>
 #include <string.h>
@@ -303,6 +304,46 @@ Id_SetRESGid(gid_t gid,		// IN: new gid
 #endif
 
 
+#if !defined(__APPLE__)
+/*
+ *----------------------------------------------------------------------------
+ *
+ * Id_SetGroups --
+ *
+ *      Sets the supplementary groups.  On Linux this affects the current
+ *      thread only, unlike setgroups() and initgroups() of glibc which
+ *      change the credentials of every thread of the process.
+ *
+ * Results:
+ *      0 on success, -1 on failure, errno set
+ *
+ * Side effects:
+ *      errno may be modified on success
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+Id_SetGroups(size_t ngroups,            // IN: number of groups
+             const gid_t *groups)       // IN: groups
+{
+#if defined(__linux__)
+   /*
+    * The 16bit syscall takes an array of 16bit gids, so there is no
+    * fallback to it on 32bit systems.
+    */
+#ifdef VM_64BIT
+   return syscall(SYS_setgroups, ngroups, groups);
+#else
+   return syscall(SYS_setgroups32, ngroups, groups);
+#endif
+#else
+   return setgroups(ngroups, groups);
+#endif
+}
+#endif
+
+
 #if defined(__linux__)
 /*
  *----------------------------------------------------------------------------
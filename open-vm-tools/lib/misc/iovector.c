@@ -26,12 +26,23 @@
 #include <windows.h>
 #endif
 
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "vmware.h"
 #include "util.h"
 #include "iovector.h"
 
 #define LGPFX   "IOV: "
 
+/*
+ * The data is copied with the memcpy of the C library, which is vectorized:
+ * it beats the rep movs of Util_Memcpy on entries of up to a few pages, and
+ * is on par past that.
+ */
+
 /*
  * Structure used when duplicating iov.
  */
@@ -231,6 +242,65 @@ IOV_MakeSingleIOV(VMIOVec* v,              // IN/OUT
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * IOVBufferIsZero --
+ *
+ *      Tell if a buffer is full of zeros, 64 bytes at a time. Data that is
+ *      not zero is usually so from its first bytes, which are checked first.
+ *
+ * Result:
+ *      TRUE/FALSE
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+IOVBufferIsZero(const void *base,  // IN:
+                size_t len)        // IN:
+{
+#if defined(__SSE2__)
+   const uint8 *p = base;
+   const uint8 *end = p + len;
+   const __m128i zero = _mm_setzero_si128();
+   size_t head;
+
+   if (len < 64) {
+      return Util_BufferIsEmpty(base, len);
+   }
+
+   if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p),
+                                        zero)) != 0xFFFF) {
+      return FALSE;
+   }
+
+   /* Page-aligned buffers, as most I/O buffers, have no head. */
+   head = (16 - ((uintptr_t) p & 15)) & 15;
+   p += head;
+
+   for (; p + 64 <= end; p += 64) {
+      __m128i acc = _mm_or_si128(
+         _mm_or_si128(_mm_load_si128((const __m128i *) p),
+                      _mm_load_si128((const __m128i *) (p + 16))),
+         _mm_or_si128(_mm_load_si128((const __m128i *) (p + 32)),
+                      _mm_load_si128((const __m128i *) (p + 48))));
+
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) {
+         return FALSE;
+      }
+   }
+
+   return Util_BufferIsEmpty(p, end - p);
+#else
+   return Util_BufferIsEmpty(base, len);
+#endif
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -255,8 +325,8 @@ IOV_IsZero(VMIOVec* iov)      // IN: the iov to scan
    uint32 i;
 
    for (i = 0; i < iov->numEntries; i++) {
-      if (!Util_BufferIsEmpty(iov->entries[i].iov_base,
-                              iov->entries[i].iov_len)) {
+      if (!IOVBufferIsZero(iov->entries[i].iov_base,
+                           iov->entries[i].iov_len)) {
          return FALSE;
       }
    }
@@ -348,49 +418,37 @@ IOVSplitList(VMIOVec *regionV,      // IN/OUT: VMIOVec for this region
 }
 
 
-/*                              
+/*
  *----------------------------------------------------------------------------
  *
- * IOV_Split --
+ * IOVSplit --
  *
- *      Utility function useful for iterating over VMIOVec.  You setup
- *      numSectors and then pass in the vector for the whole remaining
- *      transfer.  The code creates a VMIOVec to describe the subset of the
- *      transfer contained in the region and adjusts origV so that it describes
- *      the remainder.  
+ *      Body of IOV_Split and IOV_SplitStatic: describes the first numSectors
+ *      sectors of origV in iov, whose entries are stored in 'entries'.
  *
  * Results:
- *      a VMIOVec* describing the first numSectors sectors of origV.
+ *      None.
  *
  * Side effects:
- *      See above-- origV is split into regionV and the remainder with
- *      overlap filled in if the last entry of the region straddled the
- *      boundary.  Otherwise overlap->iov_len is set to zero.
+ *      See IOV_Split.
  *
  *----------------------------------------------------------------------------
  */
 
-VMIOVec*
-IOV_Split(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
-          SectorType numSectors,  // IN
-          uint32 sectorSize)      // IN: # bytes in a sector
-{  
-   struct VMIOVecAndEntries *v;
+static void
+IOVSplit(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
+         SectorType numSectors,  // IN
+         uint32 sectorSize,      // IN: # bytes in a sector
+         VMIOVec *iov,           // OUT: region
+         struct iovec *entries)  // IN: origV->numEntries entries for iov
+{
    int cpySize;
-   VMIOVec* iov;
 
    ASSERT(origV);
    ASSERT(numSectors > 0);
    ASSERT(numSectors <= origV->numSectors);
 
-   /*
-    * The resulting iov cannot have more entries than the incoming one.
-    */
-
-   v = Util_SafeMalloc(sizeof *v + origV->numEntries * sizeof(struct iovec));
-   iov = &v->iov;
    Util_Memcpy(iov, origV, sizeof *iov);
-   iov->allocEntries = NULL;
    iov->numSectors = numSectors;
 
    /*
@@ -401,7 +459,7 @@ IOV_Split(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
        origV->entries->iov_len == 0) {
 
       ASSERT(origV->numEntries == 1);
-      iov->entries = v->e;
+      iov->entries = entries;
       Util_Memcpy(iov->entries, origV->entries, sizeof(struct iovec));
 
       iov->numBytes = iov->numSectors * sectorSize;
@@ -410,13 +468,13 @@ IOV_Split(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
       origV->numSectors -= numSectors;
       origV->numBytes -= iov->numBytes;
 
-      return iov;
+      return;
    }
 
    /* See if the region is the whole thing */
    if (origV->numSectors == numSectors) {
       cpySize = origV->numEntries * sizeof *origV->entries;
-      iov->entries = v->e;
+      iov->entries = entries;
       Util_Memcpy(iov->entries, origV->entries, cpySize);
 
       origV->startSector += numSectors;
@@ -436,7 +494,7 @@ IOV_Split(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
 
       cpySize = iov->numEntries * sizeof *iov->entries;
       tmpPtr = iov->entries;
-      iov->entries = v->e;
+      iov->entries = entries;
       Util_Memcpy(iov->entries, tmpPtr, cpySize);
 
       origV->numEntries -= iov->numEntries;
@@ -448,8 +506,98 @@ IOV_Split(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
       origV->numBytes -= iov->numBytes;
    }
    ASSERT(iov->numEntries > 0);
+}
+
+
+/*                              
+ *----------------------------------------------------------------------------
+ *
+ * IOV_Split --
+ *
+ *      Utility function useful for iterating over VMIOVec.  You setup
+ *      numSectors and then pass in the vector for the whole remaining
+ *      transfer.  The code creates a VMIOVec to describe the subset of the
+ *      transfer contained in the region and adjusts origV so that it describes
+ *      the remainder.  
+ *
+ * Results:
+ *      a VMIOVec* describing the first numSectors sectors of origV, to free
+ *      with IOV_Free.
+ *
+ * Side effects:
+ *      See above-- origV is split into regionV and the remainder with
+ *      overlap filled in if the last entry of the region straddled the
+ *      boundary.  Otherwise overlap->iov_len is set to zero.
+ *
+ *----------------------------------------------------------------------------
+ */
 
-   return iov;
+VMIOVec*
+IOV_Split(VMIOVec *origV,         // IN/OUT: VMIOVec for whole xfer
+          SectorType numSectors,  // IN
+          uint32 sectorSize)      // IN: # bytes in a sector
+{  
+   struct VMIOVecAndEntries *v;
+
+   ASSERT(origV);
+
+   /*
+    * The resulting iov cannot have more entries than the incoming one.
+    */
+
+   v = Util_SafeMalloc(sizeof *v + origV->numEntries * sizeof(struct iovec));
+   IOVSplit(origV, numSectors, sectorSize, &v->iov, v->e);
+   v->iov.allocEntries = NULL;
+
+   return &v->iov;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * IOV_SplitStatic --
+ *
+ *      Same as IOV_Split, but the region is described in regionV, with the
+ *      static'ly allocated array of struct iovec if origV has no more
+ *      entries than it, as IOV_DuplicateStatic; a loop over a transfer can
+ *      then split it without allocating.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      As IOV_Split. regionV->allocEntries, if not NULL, is to be freed by
+ *      the caller.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+IOV_SplitStatic(VMIOVec *origV,               // IN/OUT: VMIOVec for whole xfer
+                SectorType numSectors,        // IN
+                uint32 sectorSize,            // IN: # bytes in a sector
+                int numStaticEntries,         // IN
+                struct iovec *staticEntries,  // IN
+                VMIOVec *regionV)             // OUT
+{
+   struct iovec *entries;
+   struct iovec *allocEntries = NULL;
+
+   ASSERT(origV);
+   ASSERT(staticEntries);
+   ASSERT(regionV);
+
+   if (origV->numEntries <= numStaticEntries) {
+      entries = staticEntries;
+   } else {
+      allocEntries = Util_SafeMalloc(origV->numEntries *
+                                     sizeof(struct iovec));
+      entries = allocEntries;
+   }
+
+   IOVSplit(origV, numSectors, sectorSize, regionV, entries);
+   regionV->allocEntries = allocEntries;
 }
 
 
@@ -482,6 +630,13 @@ IOV_WriteIovToBuf(struct iovec const *entries, // IN
    ASSERT(entries);
    ASSERT(bufOut);
 
+   if (numEntries == 1) {
+      ASSERT(entries[0].iov_base != LAZY_ALLOC_MAGIC);
+      memcpy(bufOut, entries[0].iov_base, MIN(bufSize, entries[0].iov_len));
+
+      return;
+   }
+
    for (i = 0; i < numEntries; i++) {
       size_t numBytes;
 
@@ -490,7 +645,7 @@ IOV_WriteIovToBuf(struct iovec const *entries, // IN
 
       numBytes = MIN(bufSize - count, entries[i].iov_len);
 
-      Util_Memcpy(&bufOut[count], entries[i].iov_base, numBytes);
+      memcpy(&bufOut[count], entries[i].iov_base, numBytes);
       count += numBytes;
 
       if (count >= bufSize) {
@@ -592,6 +747,13 @@ IOV_WriteBufToIov(const uint8 *bufIn,          // IN
    ASSERT(entries);
    VERIFY_BUG(29009, bufIn);
 
+   if (numEntries == 1) {
+      ASSERT(entries[0].iov_base != LAZY_ALLOC_MAGIC);
+      memcpy(entries[0].iov_base, bufIn, MIN(bufSize, entries[0].iov_len));
+
+      return;
+   }
+
    for (i = 0; i < numEntries; i++) {
       size_t numBytes;
 
@@ -600,7 +762,7 @@ IOV_WriteBufToIov(const uint8 *bufIn,          // IN
 
       numBytes = MIN(bufSize - count, entries[i].iov_len);
 
-      Util_Memcpy(entries[i].iov_base, &bufIn[count], numBytes);
+      memcpy(entries[i].iov_base, &bufIn[count], numBytes);
       count += numBytes;
       if (count >= bufSize) {
          return;
@@ -713,7 +875,7 @@ IOV_WriteIovToBufPlus(struct iovec* entries,    // IN
       }
       entryLen = MIN(count, iov_len - entryOffset);
 
-      Util_Memcpy(bufOut, base, entryLen);
+      memcpy(bufOut, base, entryLen);
 
       count -= entryLen;
       bufOut += entryLen;
@@ -772,7 +934,7 @@ IOV_WriteBufToIovPlus(uint8* bufIn,             // IN
       }
       entryLen = MIN(count, iov_len - entryOffset);
       
-      Util_Memcpy(base, bufIn, entryLen);
+      memcpy(base, bufIn, entryLen);
 
       count -= entryLen;
       bufIn += entryLen;
@@ -814,7 +976,7 @@ IOV_WriteIovToIov(VMIOVec *srcIov,        // IN
                   VMIOVec *dstIov,        // OUT
                   uint32 sectorSizeShift) // IN
 {
-   size_t entryLen = 0, srcEntryOffset, copyLen, retval;
+   size_t srcEntryOffset, dstEntryOffset, copyLen, retval;
    uint64 srcStartByte, dstStartByte, startByte, endByte;
    int64 count, srcIovOffset, dstIovOffset;
    struct iovec *srcEntries = srcIov->entries;
@@ -822,6 +984,7 @@ IOV_WriteIovToIov(VMIOVec *srcIov,        // IN
    struct iovec *dstEntries = dstIov->entries;
    uint32 dstNumEntries = dstIov->numEntries;
    int i;
+   int j;
 
    ASSERT(srcIov);
    ASSERT(dstIov);
@@ -862,34 +1025,40 @@ IOV_WriteIovToIov(VMIOVec *srcIov,        // IN
 
    retval = (size_t)count;
 
-   /* first find the src entry where to start */
+   /* find the src and dst entries where to start */
    i = IOVFindFirstEntryOffset(srcEntries, srcNumEntries,
                                (size_t) srcIovOffset, &srcEntryOffset);
+   j = IOVFindFirstEntryOffset(dstEntries, dstNumEntries,
+                               (size_t) dstIovOffset, &dstEntryOffset);
 
-   for (; count && (i < srcNumEntries); i++) {
-      size_t iov_len = srcEntries[i].iov_len;
-
+   /* walk both in step, rather than looking up the dst offset per entry */
+   while (count && (i < srcNumEntries) && (j < dstNumEntries)) {
       ASSERT(srcEntries[i].iov_base || srcEntries[i].iov_len == 0);
       ASSERT(srcEntries[i].iov_base != LAZY_ALLOC_MAGIC);
+      VERIFY_BUG(33859, dstEntries[j].iov_base || dstEntries[j].iov_len == 0);
+      ASSERT(dstEntries[j].iov_base != LAZY_ALLOC_MAGIC);
 
-      if (iov_len <= 0) {
-         continue;
-      }
-      entryLen = MIN(count, iov_len - srcEntryOffset);
-
-      copyLen = IOV_WriteBufToIovPlus(
-                           (uint8 *)(srcEntries[i].iov_base) + srcEntryOffset,
-                                      entryLen, dstEntries,
-                                      dstNumEntries, dstIovOffset);
+      copyLen = MIN(srcEntries[i].iov_len - srcEntryOffset,
+                    dstEntries[j].iov_len - dstEntryOffset);
+      copyLen = MIN(count, copyLen);
 
-      if (copyLen == 0) {  /* finished */
-         break;
+      if (copyLen != 0) {
+         memcpy((uint8 *) dstEntries[j].iov_base + dstEntryOffset,
+                (uint8 *) srcEntries[i].iov_base + srcEntryOffset, copyLen);
       }
-      ASSERT(copyLen <= entryLen);
 
       count -= copyLen;
-      dstIovOffset += copyLen;
-      srcEntryOffset = 0;
+      srcEntryOffset += copyLen;
+      dstEntryOffset += copyLen;
+
+      if (srcEntryOffset == srcEntries[i].iov_len) {
+         i++;
+         srcEntryOffset = 0;
+      }
+      if (dstEntryOffset == dstEntries[j].iov_len) {
+         j++;
+         dstEntryOffset = 0;
+      }
    }
 
    ASSERT(count <= retval);
@@ -33,16 +33,18 @@
 #else
 #   include <errno.h>
 #   include <fcntl.h>
+#   include <pthread.h>
 #   include <unistd.h>
+#   include <sys/syscall.h>
 
 #   define GENERIC_RANDOM_DEVICE "/dev/urandom"
 #endif
 
 #include "vmware.h"
-#include "vm_basic_asm.h"  // RDTSC()
 #include "log.h"
 #include "random.h"
 #include "util.h"
+#include "vm_atomic.h"
 
 
 #if defined(_WIN32)
@@ -156,6 +158,259 @@ RandomBytesPosix(const char *name,  // IN:
 
    return TRUE;
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RandomBytesKernel --
+ *
+ *      Generate 'size' bytes of cryptographically strong random bits in
+ *      'buffer' from the kernel, with getrandom(2) when available. Unlike
+ *      /dev/urandom, it needs no file descriptor, and it waits for the
+ *      kernel pool to be initialized on early boot.
+ *
+ * Results:
+ *      TRUE   success
+ *      FALSE  failure
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RandomBytesKernel(size_t size,   // IN:
+                  void *buffer)  // OUT:
+{
+#if defined(__linux__) && defined(__NR_getrandom)
+   static Bool noGetrandom = FALSE;
+
+   while (size > 0 && !noGetrandom) {
+      long bytesRead = syscall(__NR_getrandom, buffer, size, 0);
+
+      if (bytesRead > 0) {
+         size -= bytesRead;
+         buffer = ((uint8 *) buffer) + bytesRead;
+      } else if (bytesRead == -1 && errno == ENOSYS) {
+         noGetrandom = TRUE;
+      } else if (bytesRead == 0 || errno != EINTR) {
+         Log("%s: %"FMTSZ"u byte getrandom failed: %s\n",
+             __FUNCTION__, size, strerror(errno));
+
+         return FALSE;
+      }
+   }
+
+   if (size == 0) {
+      return TRUE;
+   }
+#endif
+
+   /*
+    * We use /dev/urandom and not /dev/random because it is good enough and
+    * because it cannot block. --hpreg
+    */
+
+   return RandomBytesPosix(GENERIC_RANDOM_DEVICE, size, buffer);
+}
+
+
+/*
+ * Small requests are served from a per-thread ChaCha20 generator, seeded
+ * from the kernel, in the "fast key erasure" construction: each refill
+ * produces the next key along with the output, and output is wiped as it
+ * is handed out, so the state never allows recovering past output. The
+ * generator is reseeded every RANDOM_DRBG_RESEED bytes and in the child
+ * after fork().
+ */
+
+#define RANDOM_DRBG_MAX_REQUEST  256
+#define RANDOM_DRBG_BLOCKS       8
+#define RANDOM_DRBG_RESEED       (1024 * 1024)
+
+typedef struct RandomDrbg {
+   uint32 key[8];
+   uint8 buf[RANDOM_DRBG_BLOCKS * 64 - sizeof (uint32[8])];
+   size_t avail;           // Unused bytes at the end of buf.
+   size_t generated;       // Since the last seed.
+   uint32 forkGen;
+   Bool seeded;
+} RandomDrbg;
+
+static __thread RandomDrbg randomDrbg;
+static Atomic_uint32 randomForkGen;
+static pthread_once_t randomAtForkOnce = PTHREAD_ONCE_INIT;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RandomAtForkChild --
+ * RandomAtForkRegister --
+ *
+ *      Have the generators of the child of a fork() reseeded, so that parent
+ *      and child do not produce the same bits.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RandomAtForkChild(void)
+{
+   Atomic_Inc32(&randomForkGen);
+}
+
+static void
+RandomAtForkRegister(void)
+{
+   pthread_atfork(NULL, NULL, RandomAtForkChild);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RandomChaCha20Block --
+ *
+ *      Compute one 64 byte ChaCha20 block for 'key', with a zero nonce.
+ *
+ * Results:
+ *      The block in 'out'.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#define RANDOM_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define RANDOM_QR(a, b, c, d)                        \
+   a += b; d ^= a; d = RANDOM_ROTL(d, 16);           \
+   c += d; b ^= c; b = RANDOM_ROTL(b, 12);           \
+   a += b; d ^= a; d = RANDOM_ROTL(d, 8);            \
+   c += d; b ^= c; b = RANDOM_ROTL(b, 7)
+
+static void
+RandomChaCha20Block(const uint32 key[8],  // IN:
+                    uint32 counter,       // IN:
+                    uint32 out[16])       // OUT:
+{
+   uint32 in[16];
+   uint32 x[16];
+   int i;
+
+   in[0] = 0x61707865;  // "expand 32-byte k"
+   in[1] = 0x3320646e;
+   in[2] = 0x79622d32;
+   in[3] = 0x6b206574;
+   memcpy(&in[4], key, 8 * sizeof key[0]);
+   in[12] = counter;
+   in[13] = in[14] = in[15] = 0;
+   memcpy(x, in, sizeof x);
+
+   for (i = 0; i < 10; i++) {
+      RANDOM_QR(x[0], x[4], x[8],  x[12]);
+      RANDOM_QR(x[1], x[5], x[9],  x[13]);
+      RANDOM_QR(x[2], x[6], x[10], x[14]);
+      RANDOM_QR(x[3], x[7], x[11], x[15]);
+      RANDOM_QR(x[0], x[5], x[10], x[15]);
+      RANDOM_QR(x[1], x[6], x[11], x[12]);
+      RANDOM_QR(x[2], x[7], x[8],  x[13]);
+      RANDOM_QR(x[3], x[4], x[9],  x[14]);
+   }
+
+   for (i = 0; i < 16; i++) {
+      out[i] = x[i] + in[i];
+   }
+}
+
+#undef RANDOM_QR
+#undef RANDOM_ROTL
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RandomDrbgRefill --
+ *
+ *      Refill the output buffer of the generator, reseeding it first when
+ *      needed.
+ *
+ * Results:
+ *      TRUE   success
+ *      FALSE  failure to seed
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RandomDrbgRefill(RandomDrbg *drbg)  // IN/OUT:
+{
+   uint32 blocks[RANDOM_DRBG_BLOCKS][16];
+   uint32 forkGen;
+   uint32 i;
+
+   pthread_once(&randomAtForkOnce, RandomAtForkRegister);
+   forkGen = Atomic_Read32(&randomForkGen);
+
+   if (!drbg->seeded || drbg->forkGen != forkGen ||
+       drbg->generated >= RANDOM_DRBG_RESEED) {
+      if (!RandomBytesKernel(sizeof drbg->key, drbg->key)) {
+         return FALSE;
+      }
+      drbg->seeded = TRUE;
+      drbg->forkGen = forkGen;
+      drbg->generated = 0;
+   }
+
+   for (i = 0; i < RANDOM_DRBG_BLOCKS; i++) {
+      RandomChaCha20Block(drbg->key, i, blocks[i]);
+   }
+
+   memcpy(drbg->key, blocks, sizeof drbg->key);
+   memcpy(drbg->buf, (uint8 *) blocks + sizeof drbg->key, sizeof drbg->buf);
+   Util_Zero(blocks, sizeof blocks);
+   drbg->avail = sizeof drbg->buf;
+   drbg->generated += sizeof drbg->buf;
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RandomBytesDrbg --
+ *
+ *      Generate 'size' bytes, at most RANDOM_DRBG_MAX_REQUEST, of
+ *      cryptographically strong random bits in 'buffer' from the generator
+ *      of the calling thread.
+ *
+ * Results:
+ *      TRUE   success
+ *      FALSE  failure
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RandomBytesDrbg(size_t size,   // IN:
+                void *buffer)  // OUT:
+{
+   RandomDrbg *drbg = &randomDrbg;
+
+   ASSERT(size <= RANDOM_DRBG_MAX_REQUEST);
+
+   /* A fork invalidates the buffered bits, in the child. */
+   if (drbg->avail < size ||
+       drbg->forkGen != Atomic_Read32(&randomForkGen)) {
+      if (!RandomDrbgRefill(drbg)) {
+         return FALSE;
+      }
+   }
+
+   memcpy(buffer, drbg->buf + sizeof drbg->buf - drbg->avail, size);
+   Util_Zero(drbg->buf + sizeof drbg->buf - drbg->avail, size);
+   drbg->avail -= size;
+
+   return TRUE;
+}
 #endif
 
 
@@ -172,6 +427,10 @@ RandomBytesPosix(const char *name,  // IN:
  *      DO NOT USE THIS FUNCTION UNLESS YOU HAVE AN ABSOLUTE, EXPLICIT
  *      NEED FOR CRYPTOGRAPHICALLY VALID RANDOM NUMBERS.
  *
+ *      On POSIX, requests of up to RANDOM_DRBG_MAX_REQUEST bytes come from
+ *      a per-thread generator seeded by the kernel, larger ones straight
+ *      from the kernel.
+ *
  * Results:
  *      TRUE   success
  *      FALSE  failure
@@ -189,12 +448,11 @@ Random_Crypto(size_t size,   // IN:
 #if defined(_WIN32)
    return RandomBytesWin32(size, buffer);
 #else
-   /*
-    * We use /dev/urandom and not /dev/random because it is good enough and
-    * because it cannot block. --hpreg
-    */
+   if (size <= RANDOM_DRBG_MAX_REQUEST) {
+      return RandomBytesDrbg(size, buffer);
+   }
 
-   return RandomBytesPosix(GENERIC_RANDOM_DEVICE, size, buffer);
+   return RandomBytesKernel(size, buffer);
 #endif
 }
 
@@ -323,77 +581,3 @@ Random_Quick(rqContext *rs)  // IN/OUT:
    return y;
 }
 
-
-#if 0
-/*
- *----------------------------------------------------------------------
- *
- * Random_SpeedTest --
- *
- *      Benchmarks the speed of various random number generators.
- *      (Intended for debugging).
- *
- * Results:
- *      Populates *out with cycle counts.
- *
- * Side Effects:
- *      None.
- *
- *----------------------------------------------------------------------
- */
-
-typedef struct {
-   uint64 nop;
-   uint64 simple;
-   uint64 fast;
-   uint64 quick;
-} RandomSpeedTestResults;
-void Random_SpeedTest(uint64 iters, RandomSpeedTestResults *out);
-
-static int ABSOLUTELY_NOINLINE
-RandomNop(int *seed)
-{
-   return *(volatile int *)seed;
-}
-
-void
-Random_SpeedTest(uint64 iters,                 // IN:
-                 RandomSpeedTestResults *out)  // OUT:
-{
-   int i;
-   uint64 start;
-   int nop, simple;
-   uint64 fast;
-   rqContext *rq;
-
-   simple = nop = getpid();
-   Random_FastSeed(&fast, simple);
-   rq = Random_QuickSeed(nop);
-
-   start = RDTSC();
-   for (i = 0; i < iters; i++) {
-      RandomNop(&nop);
-   }
-   out->nop = RDTSC() - start;
-
-   start = RDTSC();
-   for (i = 0; i < iters; i++) {
-      simple = Random_Simple(simple);
-   }
-   out->simple = RDTSC() - start;
-
-   start = RDTSC();
-   for (i = 0; i < iters; i++) {
-      Random_Fast(&fast);
-   }
-   out->fast = RDTSC() - start;
-
-   start = RDTSC();
-   for (i = 0; i < iters; i++) {
-      Random_Quick(rq);
-   }
-   out->quick = RDTSC() - start;
-
-   free(rq);
-}
-#endif
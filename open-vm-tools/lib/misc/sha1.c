@@ -49,11 +49,13 @@
  *
  *    10/14: rberinde: Added SSE3 code and test, cleaned up a bit.
  *
+ *    10/26: Added the SHA-NI transform and SHA1MultiBuffer at userlevel.
+ *
  * If any changes are made to this file, please run:
  *    test-esx -n misc/sha1.sh
  */
 
-#if defined(USERLEVEL) || defined(_WIN32)
+#if !defined(VMKERNEL) && !defined(VMKBOOT) && !defined(_KERNEL)
 #   include <string.h>
 #   if defined(_WIN32)
 #      include <memory.h>
@@ -82,6 +84,19 @@
 #include "vm_basic_asm.h"
 #include "vmk_exports.h"
 
+/*
+ * The SHA extensions are only used outside of the kernel, where the vector
+ * state is free to use. The code is compiled with a target attribute and
+ * picked at run time.
+ */
+
+#if !defined(VMKERNEL) && !defined(VMKBOOT) && !defined(_KERNEL) && \
+    (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__)
+#define SHA1_SHA_NI 1
+#include <immintrin.h>
+#include "x86cpuid_asm.h"
+#endif
+
 /* Initialization vectors. */
 static const uint32 sha1InitVec[5] = { 0x67452301,
                                        0xEFCDAB89,
@@ -203,6 +218,171 @@ SHA1TransformNoSSE(uint32 state[5],           // IN/OUT
 }
 
 
+#if defined(SHA1_SHA_NI)
+
+#define SHA1_TARGET_SHA_NI __attribute__((target("sha,sse4.1")))
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA1HasShaNI --
+ *
+ *    Whether the CPU has the SHA extensions, and SSE4.1 for the shuffles.
+ *
+ * Results:
+ *    TRUE if SHA1TransformShaNI can be used.
+ *
+ * Side effects:
+ *    Queries CPUID the first time.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+SHA1HasShaNI(void)
+{
+   static int hasShaNI = -1;
+
+   if (hasShaNI == -1) {
+      CPUIDRegs regs;
+      Bool sse41;
+
+      __GET_CPUID(0, &regs);
+      if (regs.eax < 7) {
+         hasShaNI = FALSE;
+      } else {
+         __GET_CPUID(1, &regs);
+         sse41 = CPUID_ISSET(1, ECX, SSE41, regs.ecx);
+         __GET_CPUID2(7, 0, &regs);
+         hasShaNI = sse41 && CPUID_ISSET(7, EBX, SHA, regs.ebx);
+      }
+   }
+
+   return hasShaNI;
+}
+
+
+/*
+ * 4 rounds of SHA-1 with the SHA extensions. 'e' holds the ABCD of before
+ * the previous 4 rounds, from which sha1nexte derives E. The schedule then
+ * computes the message words of 4 rounds later in place of the ones used.
+ */
+
+#define SHA1_NI_ROUNDS4(g, func)                                           \
+   do {                                                                    \
+      __m128i abcdPrev = abcd;                                             \
+                                                                           \
+      e = (g) == 0 ? _mm_add_epi32(e, w[0]) :                              \
+                     _mm_sha1nexte_epu32(e, w[(g) & 3]);                   \
+      abcd = _mm_sha1rnds4_epu32(abcd, e, func);                           \
+      e = abcdPrev;                                                        \
+      if ((g) < 16) {                                                      \
+         w[(g) & 3] = _mm_sha1msg2_epu32(                                  \
+            _mm_xor_si128(_mm_sha1msg1_epu32(w[(g) & 3], w[((g) + 1) & 3]),\
+                          w[((g) + 2) & 3]),                               \
+            w[((g) + 3) & 3]);                                             \
+      }                                                                    \
+   } while (0)
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA1BlockShaNI --
+ *
+ *    Apply SHA-1 transformation on a single 512-bit block, with the state
+ *    in the layout of the SHA extensions.
+ *
+ * Results:
+ *    'abcdState' and 'eState' are updated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static INLINE_ALWAYS SHA1_TARGET_SHA_NI void
+SHA1BlockShaNI(__m128i *abcdState,           // IN/OUT
+               __m128i *eState,              // IN/OUT
+               const unsigned char *buffer)  // IN
+{
+   const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+                                        0x08090a0b0c0d0e0fULL);
+   __m128i abcd = *abcdState;
+   __m128i e = *eState;
+   __m128i w[4];
+   int i;
+
+   for (i = 0; i < 4; i++) {
+      w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buffer + i),
+                              bswap);
+   }
+
+   SHA1_NI_ROUNDS4(0, 0);
+   SHA1_NI_ROUNDS4(1, 0);
+   SHA1_NI_ROUNDS4(2, 0);
+   SHA1_NI_ROUNDS4(3, 0);
+   SHA1_NI_ROUNDS4(4, 0);
+   SHA1_NI_ROUNDS4(5, 1);
+   SHA1_NI_ROUNDS4(6, 1);
+   SHA1_NI_ROUNDS4(7, 1);
+   SHA1_NI_ROUNDS4(8, 1);
+   SHA1_NI_ROUNDS4(9, 1);
+   SHA1_NI_ROUNDS4(10, 2);
+   SHA1_NI_ROUNDS4(11, 2);
+   SHA1_NI_ROUNDS4(12, 2);
+   SHA1_NI_ROUNDS4(13, 2);
+   SHA1_NI_ROUNDS4(14, 2);
+   SHA1_NI_ROUNDS4(15, 3);
+   SHA1_NI_ROUNDS4(16, 3);
+   SHA1_NI_ROUNDS4(17, 3);
+   SHA1_NI_ROUNDS4(18, 3);
+   SHA1_NI_ROUNDS4(19, 3);
+
+   *eState = _mm_sha1nexte_epu32(e, *eState);
+   *abcdState = _mm_add_epi32(abcd, *abcdState);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA1TransformShaNI --
+ *
+ *    Apply SHA-1 transformation on one or more 512-bit block buffers, with
+ *    the SHA extensions.
+ *
+ * Results:
+ *    'state' is updated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static SHA1_TARGET_SHA_NI void
+SHA1TransformShaNI(uint32 state[5],              // IN/OUT
+                   const unsigned char *buffer,  // IN
+                   size_t numBlocks)             // IN
+{
+   __m128i abcd, e;
+
+   /* sha1rnds4 wants A in the top lane, E is in the top lane of its own. */
+   abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1b);
+   e = _mm_set_epi32(state[4], 0, 0, 0);
+
+   for (; numBlocks > 0; numBlocks--, buffer += 64) {
+      SHA1BlockShaNI(&abcd, &e, buffer);
+   }
+
+   _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1b));
+   state[4] = _mm_extract_epi32(e, 3);
+}
+#endif /* SHA1_SHA_NI */
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -222,9 +402,16 @@ SHA1TransformNoSSE(uint32 state[5],           // IN/OUT
 static void
 SHA1Transform(uint32 state[5],              // IN/OUT
               const unsigned char *buffer,  // IN
-              uint32 numBlocks)             // IN
+              size_t numBlocks)             // IN
 {
-    uint32 i;
+    size_t i;
+
+#if defined(SHA1_SHA_NI)
+    if (SHA1HasShaNI()) {
+       SHA1TransformShaNI(state, buffer, numBlocks);
+       return;
+    }
+#endif
 
     for (i = 0; i < numBlocks; i++) {
        unsigned char workspace[64];
@@ -366,3 +553,50 @@ SHA1Final(unsigned char digest[SHA1_HASH_LEN],  // OUT
     memset(context->count, 0, 8);
     memset(&finalcount, 0, 8);
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA1MultiBuffer --
+ *
+ *    Hash 'numBuffers' independent buffers of 'len' bytes, each prefixed by
+ *    the same 'salt'.
+ *
+ *    Each stream goes through the SHA extensions on its own: their rounds
+ *    are bound by the throughput of the SHA unit, interleaving two streams
+ *    does not gain anything.
+ *
+ * Results:
+ *    160 bit SHA1 value of each buffer in 'digests'.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+SHA1MultiBuffer(uint32 numBuffers,         // IN
+                uint32 len,                // IN
+                const void *salt,          // IN
+                uint32 saltLen,            // IN
+                const void *data[],        // IN
+                unsigned char *digests[])  // OUT
+{
+    uint32 i;
+
+    ASSERT(numBuffers <= SHA1_MULTI_MAX_BUFFERS);
+    ASSERT(saltLen == 0 || salt != NULL);
+
+    for (i = 0; i < numBuffers; i++) {
+       SHA1_CTX context;
+
+       SHA1Init(&context);
+       if (saltLen != 0) {
+          SHA1Update(&context, salt, saltLen);
+       }
+       SHA1Update(&context, data[i], len);
+       SHA1Final(digests[i], &context);
+    }
+}
@@ -0,0 +1,445 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * sha256.c --
+ *
+ *    SHA-256, FIPS PUB 180-4, the sibling of sha1.c. At userlevel on x86
+ *    the blocks go through the SHA extensions when the CPU has them.
+ *
+ * Test Vectors (from FIPS PUB 180-4)
+ * "abc"
+ *   BA7816BF 8F01CFEA 414140DE 5DAE2223 B00361A3 96177A9C B410FF61 F20015AD
+ * "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+ *   248D6A61 D20638B8 E5C02693 0C3E6039 A33CE459 64FF2167 F6ECEDD4 19DB06C1
+ */
+
+#if !defined(VMKERNEL) && !defined(VMKBOOT) && !defined(_KERNEL)
+#   include <string.h>
+#endif
+
+#include "vmware.h"
+#include "sha256.h"
+#include "vm_basic_asm.h"
+
+#if !defined(VMKERNEL) && !defined(VMKBOOT) && !defined(_KERNEL) && \
+    (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__)
+#define SHA256_SHA_NI 1
+#include <immintrin.h>
+#include "x86cpuid_asm.h"
+#endif
+
+/* Initialization vectors. */
+static const uint32 sha256InitVec[8] = { 0x6a09e667, 0xbb67ae85,
+                                         0x3c6ef372, 0xa54ff53a,
+                                         0x510e527f, 0x9b05688c,
+                                         0x1f83d9ab, 0x5be0cd19 };
+
+/* Round constants. */
+static const uint32 sha256K[64] = {
+   0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+   0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+   0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+   0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+   0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+   0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+   0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+   0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+   0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+   0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+   0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+   0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+   0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+   0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+   0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+   0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ror(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+#define CH(x,y,z)  (((x) & ((y) ^ (z))) ^ (z))
+#define MAJ(x,y,z) (((x) & (y)) | (((x) | (y)) & (z)))
+#define S0(x)      (ror(x, 2) ^ ror(x, 13) ^ ror(x, 22))
+#define S1(x)      (ror(x, 6) ^ ror(x, 11) ^ ror(x, 25))
+#define s0(x)      (ror(x, 7) ^ ror(x, 18) ^ ((x) >> 3))
+#define s1(x)      (ror(x, 17) ^ ror(x, 19) ^ ((x) >> 10))
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256TransformC --
+ *
+ *    Apply SHA-256 transformation on one or more 512-bit block buffers.
+ *
+ * Results:
+ *    'state' is updated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+SHA256TransformC(uint32 state[8],              // IN/OUT
+                 const unsigned char *buffer,  // IN
+                 size_t numBlocks)             // IN
+{
+   for (; numBlocks > 0; numBlocks--, buffer += 64) {
+      uint32 w[64];
+      uint32 f[8];
+      int i;
+
+      for (i = 0; i < 16; i++) {
+         w[i] = (uint32)buffer[4 * i] << 24 |
+                (uint32)buffer[4 * i + 1] << 16 |
+                (uint32)buffer[4 * i + 2] << 8 |
+                (uint32)buffer[4 * i + 3];
+      }
+      for (; i < 64; i++) {
+         w[i] = s1(w[i - 2]) + w[i - 7] + s0(w[i - 15]) + w[i - 16];
+      }
+
+      for (i = 0; i < 8; i++) {
+         f[i] = state[i];
+      }
+
+      for (i = 0; i < 64; i++) {
+         uint32 t1 = f[7] + S1(f[4]) + CH(f[4], f[5], f[6]) + sha256K[i] +
+                     w[i];
+         uint32 t2 = S0(f[0]) + MAJ(f[0], f[1], f[2]);
+
+         f[7] = f[6];
+         f[6] = f[5];
+         f[5] = f[4];
+         f[4] = f[3] + t1;
+         f[3] = f[2];
+         f[2] = f[1];
+         f[1] = f[0];
+         f[0] = t1 + t2;
+      }
+
+      for (i = 0; i < 8; i++) {
+         state[i] += f[i];
+      }
+   }
+}
+
+
+#if defined(SHA256_SHA_NI)
+
+#define SHA256_TARGET_SHA_NI __attribute__((target("sha,sse4.1")))
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256HasShaNI --
+ *
+ *    Whether SHA256TransformShaNI can run: the SHA extensions, and SSE4.1
+ *    for the blends.
+ *
+ * Results:
+ *    TRUE if it can.
+ *
+ * Side effects:
+ *    Queries CPUID the first time.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+SHA256HasShaNI(void)
+{
+   static int hasShaNI = -1;
+
+   if (hasShaNI == -1) {
+      CPUIDRegs regs;
+      Bool sse41;
+
+      __GET_CPUID(0, &regs);
+      if (regs.eax < 7) {
+         hasShaNI = FALSE;
+      } else {
+         __GET_CPUID(1, &regs);
+         sse41 = CPUID_ISSET(1, ECX, SSE41, regs.ecx);
+         __GET_CPUID2(7, 0, &regs);
+         hasShaNI = sse41 && CPUID_ISSET(7, EBX, SHA, regs.ebx);
+      }
+   }
+
+   return hasShaNI;
+}
+
+
+/*
+ * 4 rounds of SHA-256 with the SHA extensions, 2 per sha256rnds2. The
+ * message words of 4 rounds later are completed with sha256msg2, and
+ * those of 8 rounds later started with sha256msg1, in place of the ones
+ * no longer needed.
+ */
+
+#define SHA256_NI_ROUNDS4(g)                                               \
+   do {                                                                    \
+      __m128i msg = _mm_add_epi32(w[(g) & 3],                              \
+                          _mm_loadu_si128((const __m128i *)&sha256K[4 * (g)])); \
+                                                                           \
+      cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg);                       \
+      if ((g) >= 3 && (g) < 15) {                                          \
+         w[((g) + 1) & 3] = _mm_add_epi32(w[((g) + 1) & 3],                \
+                               _mm_alignr_epi8(w[(g) & 3],                 \
+                                               w[((g) + 3) & 3], 4));      \
+         w[((g) + 1) & 3] = _mm_sha256msg2_epu32(w[((g) + 1) & 3],         \
+                                                 w[(g) & 3]);              \
+      }                                                                    \
+      msg = _mm_shuffle_epi32(msg, 0x0e);                                  \
+      abef = _mm_sha256rnds2_epu32(abef, cdgh, msg);                       \
+      if ((g) >= 1 && (g) < 13) {                                          \
+         w[((g) + 3) & 3] = _mm_sha256msg1_epu32(w[((g) + 3) & 3],         \
+                                                 w[(g) & 3]);              \
+      }                                                                    \
+   } while (0)
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256TransformShaNI --
+ *
+ *    Apply SHA-256 transformation on one or more 512-bit block buffers,
+ *    with the SHA extensions.
+ *
+ * Results:
+ *    'state' is updated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static SHA256_TARGET_SHA_NI void
+SHA256TransformShaNI(uint32 state[8],              // IN/OUT
+                     const unsigned char *buffer,  // IN
+                     size_t numBlocks)             // IN
+{
+   const __m128i bswap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                        0x0405060700010203ULL);
+   __m128i abef, cdgh, tmp;
+
+   /* sha256rnds2 wants the state as ABEF and CDGH. */
+   tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+   cdgh = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+   abef = _mm_alignr_epi8(tmp, cdgh, 8);
+   cdgh = _mm_blend_epi16(cdgh, tmp, 0xf0);
+
+   for (; numBlocks > 0; numBlocks--, buffer += 64) {
+      __m128i abefSave = abef;
+      __m128i cdghSave = cdgh;
+      __m128i w[4];
+      int i;
+
+      for (i = 0; i < 4; i++) {
+         w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buffer + i),
+                                 bswap);
+      }
+
+      SHA256_NI_ROUNDS4(0);
+      SHA256_NI_ROUNDS4(1);
+      SHA256_NI_ROUNDS4(2);
+      SHA256_NI_ROUNDS4(3);
+      SHA256_NI_ROUNDS4(4);
+      SHA256_NI_ROUNDS4(5);
+      SHA256_NI_ROUNDS4(6);
+      SHA256_NI_ROUNDS4(7);
+      SHA256_NI_ROUNDS4(8);
+      SHA256_NI_ROUNDS4(9);
+      SHA256_NI_ROUNDS4(10);
+      SHA256_NI_ROUNDS4(11);
+      SHA256_NI_ROUNDS4(12);
+      SHA256_NI_ROUNDS4(13);
+      SHA256_NI_ROUNDS4(14);
+      SHA256_NI_ROUNDS4(15);
+
+      abef = _mm_add_epi32(abef, abefSave);
+      cdgh = _mm_add_epi32(cdgh, cdghSave);
+   }
+
+   tmp = _mm_shuffle_epi32(abef, 0x1b);
+   cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+   _mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(tmp, cdgh, 0xf0));
+   _mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, tmp, 8));
+}
+#endif /* SHA256_SHA_NI */
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256Transform --
+ *
+ *    Apply SHA-256 transformation on one or more 512-bit block buffers,
+ *    with the best implementation the CPU has.
+ *
+ * Results:
+ *    'state' is updated.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+SHA256Transform(uint32 state[8],              // IN/OUT
+                const unsigned char *buffer,  // IN
+                size_t numBlocks)             // IN
+{
+#if defined(SHA256_SHA_NI)
+   if (SHA256HasShaNI()) {
+      SHA256TransformShaNI(state, buffer, numBlocks);
+      return;
+   }
+#endif
+
+   SHA256TransformC(state, buffer, numBlocks);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256Init --
+ *
+ *    Fill context with initial SHA-256 state.
+ *
+ * Results:
+ *    Initialized context.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+SHA256Init(SHA256Context *context)  // OUT
+{
+   memcpy(context->state, sha256InitVec, sizeof context->state);
+   context->count = 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256Update --
+ *
+ *    Hash data into context.
+ *
+ * Results:
+ *    Updated context.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+SHA256Update(SHA256Context *context,     // IN/OUT
+             const unsigned char *data,  // IN
+             size_t len)                 // IN
+{
+   size_t curOfs = context->count & 63;
+
+   context->count += len;
+
+   if (curOfs != 0) {
+      size_t numRemaining = 64 - curOfs;
+
+      if (len < numRemaining) {
+         memcpy(&context->buffer[curOfs], data, len);
+         return;
+      }
+
+      /* Complete the current buffer and update. */
+      memcpy(&context->buffer[curOfs], data, numRemaining);
+      SHA256Transform(context->state, context->buffer, 1);
+      data += numRemaining;
+      len -= numRemaining;
+   }
+
+   /* Update with any complete 64-byte buffers, in place. */
+   if (len >= 64) {
+      size_t numBlocks = len / 64;
+
+      SHA256Transform(context->state, data, numBlocks);
+      data += 64 * numBlocks;
+      len -= 64 * numBlocks;
+   }
+
+   /* Copy over whatever is left. */
+   ASSERT(len < 64);
+   memcpy(context->buffer, data, len);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SHA256Final --
+ *
+ *    Add padding and return the message digest.
+ *
+ * Results:
+ *    256 bit SHA-256 value in digest.
+ *
+ * Side effects:
+ *    The context is wiped.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+SHA256Final(unsigned char digest[SHA256_HASH_LEN],  // OUT
+            SHA256Context *context)                 // IN
+{
+   uint64 bits = context->count << 3;
+   size_t curOfs = context->count & 63;
+   int i;
+
+   context->buffer[curOfs++] = 0x80;
+   if (curOfs > 56) {
+      memset(&context->buffer[curOfs], 0, 64 - curOfs);
+      SHA256Transform(context->state, context->buffer, 1);
+      curOfs = 0;
+   }
+   memset(&context->buffer[curOfs], 0, 56 - curOfs);
+   for (i = 0; i < 8; i++) {
+      context->buffer[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+   }
+   SHA256Transform(context->state, context->buffer, 1);
+
+   for (i = 0; i < SHA256_HASH_LEN; i++) {
+      digest[i] = (unsigned char)(context->state[i >> 2] >> ((3 - (i & 3)) * 8));
+   }
+
+   /* Wipe variables */
+   memset(context, 0, sizeof *context);
+}
@@ -70,6 +70,16 @@
 #include "util.h"
 #include "str.h"
 
+/*
+ * On Linux, link lookups are served from the netlink model that lib/nicInfo
+ * keeps up to date from change events, and only go to the kernel when
+ * netlink can't be used.
+ */
+#if defined(__linux__) && !defined(USERWORLD) && !defined(DUMMY_NETUTIL)
+#define NETUTIL_LINK_CACHE
+#include "nicInfo.h"
+#endif
+
 #define MAX_IFACES      64
 #define LOOPBACK        "lo"    // XXX: We would have a problem with something like "loa0".
 #ifndef INET_ADDRSTRLEN
@@ -159,6 +169,12 @@ NetUtil_GetPrimaryIP(void)
    struct ifreq ifaces[MAX_IFACES];
    char ipstr[INET_ADDRSTRLEN] = "";
 
+#ifdef NETUTIL_LINK_CACHE
+   if (GuestInfo_LinkCacheGetPrimaryIPv4(ipstr, sizeof ipstr)) {
+      return strdup(ipstr);
+   }
+#endif
+
    /* Get a socket descriptor to give to ioctl(). */
    sd = socket(PF_INET, SOCK_STREAM, 0);
    if (sd < 0) {
@@ -348,6 +364,75 @@ NetUtil_GetIfName(int ifIndex)  // IN: interface index
 }
 
 
+#   else // ifdef DUMMY_NETUTIL
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * NetUtil_GetIfIndex --
+ *
+ *      Given an interface name, return its index.
+ *
+ * Results:
+ *      Returns a valid interface index on success or -1 on failure.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+NetUtil_GetIfIndex(const char *ifName)  // IN: interface name
+{
+   unsigned int ifIndex;
+
+#ifdef NETUTIL_LINK_CACHE
+   int cachedIndex;
+
+   if (GuestInfo_LinkCacheGetIfIndex(ifName, &cachedIndex)) {
+      return cachedIndex;
+   }
+#endif
+
+   ifIndex = if_nametoindex(ifName);
+   return ifIndex != 0 ? ifIndex : -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * NetUtil_GetIfName --
+ *
+ *      Given an interface index, return its name.
+ *
+ * Results:
+ *      Returns a valid interface name on success, NULL on failure.
+ *
+ * Side effects:
+ *      Caller is responsible for freeing the returned string.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+NetUtil_GetIfName(int ifIndex)  // IN: interface index
+{
+   char ifName[IF_NAMESIZE] = "";
+
+#ifdef NETUTIL_LINK_CACHE
+   if (GuestInfo_LinkCacheGetIfName(ifIndex, ifName, sizeof ifName)) {
+      return ifName[0] != '\0' ? Util_SafeStrdup(ifName) : NULL;
+   }
+#endif
+
+   if (if_indextoname(ifIndex, ifName) == NULL) {
+      return NULL;
+   }
+   return Util_SafeStrdup(ifName);
+}
+
+
 #   endif // ifdef DUMMY_NETUTIL
 
 
@@ -382,6 +467,15 @@ NetUtil_GetHardwareAddress(int ifIndex,         // IN
       return FALSE;
    }
 
+#ifdef NETUTIL_LINK_CACHE
+   if (GuestInfo_LinkCacheGetHwAddr(ifIndex, (uint8 *)hwAddr, &ret)) {
+      if (ret == IFHWADDRLEN) {
+         *ifType = IANA_IFTYPE_ETHERNETCSMACD;
+      }
+      return ret;
+   }
+#endif
+
    ASSERT(sizeof ifreq.ifr_name >= IF_NAMESIZE);
 
    memset(&ifreq, 0, sizeof ifreq);
@@ -451,3 +451,358 @@ GuestInfo_IsEqual_WinsConfigInfo(const WinsConfigInfo *a,
    return GuestInfo_IsEqual_TypedIpAddress(&a->primary, &b->primary) &&
           GuestInfo_IsEqual_TypedIpAddress(&a->secondary, &b->secondary);
 }
+
+
+/*
+ * Hashing of NicInfoV3s.
+ *
+ * The hash covers what the GuestInfo_IsEqual_* routines compare, the same
+ * way: MAC addresses and DNS names are hashed case-insensitively, routes
+ * refer to their NIC by MAC address, and lists are hashed as sets (sum of
+ * the mixed hashes of their items), so that reordering a list does not
+ * change the hash.  Two NicInfoV3s that GuestInfo_IsEqual_NicInfoV3
+ * considers equal thus hash the same, and one hash per gather replaces a
+ * comparison whose cost grows with the square of the number of routes or
+ * addresses.
+ */
+
+#define NICINFO_HASH_OFFSET     CONST64U(14695981039346656037)
+#define NICINFO_HASH_PRIME      CONST64U(1099511628211)
+
+#define NICINFO_HASH_SET_INIT(set)        ((set) = 0)
+#define NICINFO_HASH_SET_ADD(set, item)   ((set) += NicInfoHashMix(item))
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashMix --                                                     */ /**
+ *
+ * Scrambles a hash (murmur3 finalizer), so that sums of hashes of related
+ * items do not cancel out.
+ *
+ * @param[in] h   Hash.
+ *
+ * @return Mixed hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashMix(uint64 h)
+{
+   h ^= h >> 33;
+   h *= CONST64U(0xff51afd7ed558ccd);
+   h ^= h >> 33;
+   h *= CONST64U(0xc4ceb9fe1a85ec53);
+   h ^= h >> 33;
+
+   return h;
+}
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashBytes --                                                   */ /**
+ *
+ * Adds bytes to a hash (FNV-1a).
+ *
+ * @param[in] h     Hash so far.
+ * @param[in] data  Bytes.
+ * @param[in] len   Number of bytes.
+ *
+ * @return Updated hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashBytes(uint64 h,
+                 const void *data,
+                 size_t len)
+{
+   const uint8 *p = data;
+   size_t i;
+
+   for (i = 0; i < len; i++) {
+      h = (h ^ p[i]) * NICINFO_HASH_PRIME;
+   }
+
+   return h;
+}
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashUint --                                                    */ /**
+ *
+ * Adds a number to a hash.
+ *
+ * @param[in] h     Hash so far.
+ * @param[in] n     Number.
+ *
+ * @return Updated hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashUint(uint64 h,
+                uint64 n)
+{
+   return NicInfoHashBytes(h, &n, sizeof n);
+}
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashString --                                                  */ /**
+ *
+ * Adds a string to a hash, including its terminator so that consecutive
+ * strings cannot run into each other.
+ *
+ * @param[in] h          Hash so far.
+ * @param[in] str        String.  May be NULL, hashed as "".
+ * @param[in] caseless   Whether to ignore the (ASCII) case.
+ *
+ * @return Updated hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashString(uint64 h,
+                  const char *str,
+                  Bool caseless)
+{
+   if (str != NULL) {
+      for (; *str != '\0'; str++) {
+         uint8 c = *str;
+
+         if (caseless && c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+         }
+         h = (h ^ c) * NICINFO_HASH_PRIME;
+      }
+   }
+
+   return (h ^ 0) * NICINFO_HASH_PRIME;
+}
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashTypedIpAddress --                                          */ /**
+ *
+ * Adds a TypedIpAddress to a hash.
+ *
+ * @param[in] h     Hash so far.
+ * @param[in] ip    TypedIpAddress.  May be NULL.
+ *
+ * @return Updated hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashTypedIpAddress(uint64 h,
+                          const TypedIpAddress *ip)
+{
+   if (ip == NULL) {
+      return NicInfoHashUint(h, 0);
+   }
+
+   h = NicInfoHashUint(h, 1 + ip->ipAddressAddrType);
+   h = NicInfoHashUint(h, ip->ipAddressAddr.InetAddress_len);
+
+   return NicInfoHashBytes(h, ip->ipAddressAddr.InetAddress_val,
+                           ip->ipAddressAddr.InetAddress_len);
+}
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashStack --                                                   */ /**
+ *
+ * Adds the stack settings of a NIC, or of the whole NicInfoV3, to a hash.
+ *
+ * @param[in] h      Hash so far.
+ * @param[in] dns    DnsConfigInfo.  May be NULL.
+ * @param[in] wins   WinsConfigInfo.  May be NULL.
+ * @param[in] dhcp4  DhcpConfigInfo for IPv4.  May be NULL.
+ * @param[in] dhcp6  DhcpConfigInfo for IPv6.  May be NULL.
+ *
+ * @return Updated hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashStack(uint64 h,
+                 const DnsConfigInfo *dns,
+                 const WinsConfigInfo *wins,
+                 const DhcpConfigInfo *dhcp4,
+                 const DhcpConfigInfo *dhcp6)
+{
+   const DhcpConfigInfo *dhcp[2] = { dhcp4, dhcp6 };
+   u_int i;
+
+   if (dns == NULL) {
+      h = NicInfoHashUint(h, 0);
+   } else {
+      uint64 servers;
+      uint64 suffixes;
+
+      NICINFO_HASH_SET_INIT(servers);
+      XDRUTIL_FOREACH(i, dns, serverList) {
+         NICINFO_HASH_SET_ADD(servers,
+            NicInfoHashTypedIpAddress(NICINFO_HASH_OFFSET,
+                                      XDRUTIL_GETITEM(dns, serverList, i)));
+      }
+
+      NICINFO_HASH_SET_INIT(suffixes);
+      XDRUTIL_FOREACH(i, dns, searchSuffixes) {
+         NICINFO_HASH_SET_ADD(suffixes,
+            NicInfoHashString(NICINFO_HASH_OFFSET,
+                              *XDRUTIL_GETITEM(dns, searchSuffixes, i),
+                              TRUE));
+      }
+
+      h = NicInfoHashUint(h, 1 + (dns->hostName != NULL) +
+                             2 * (dns->domainName != NULL));
+      if (dns->hostName != NULL) {
+         h = NicInfoHashString(h, *dns->hostName, TRUE);
+      }
+      if (dns->domainName != NULL) {
+         h = NicInfoHashString(h, *dns->domainName, TRUE);
+      }
+      h = NicInfoHashUint(h, dns->serverList.serverList_len);
+      h = NicInfoHashUint(h, servers);
+      h = NicInfoHashUint(h, dns->searchSuffixes.searchSuffixes_len);
+      h = NicInfoHashUint(h, suffixes);
+   }
+
+   if (wins == NULL) {
+      h = NicInfoHashUint(h, 0);
+   } else {
+      h = NicInfoHashUint(h, 1);
+      h = NicInfoHashTypedIpAddress(h, &wins->primary);
+      h = NicInfoHashTypedIpAddress(h, &wins->secondary);
+   }
+
+   for (i = 0; i < ARRAYSIZE(dhcp); i++) {
+      if (dhcp[i] == NULL) {
+         h = NicInfoHashUint(h, 0);
+      } else {
+         h = NicInfoHashUint(h, 1 + (dhcp[i]->enabled != 0));
+         h = NicInfoHashString(h, dhcp[i]->dhcpSettings, FALSE);
+      }
+   }
+
+   return h;
+}
+
+
+/*
+ ******************************************************************************
+ * NicInfoHashGuestNicV3 --                                              */ /**
+ *
+ * Hashes a GuestNicV3.
+ *
+ * @param[in] nic   GuestNicV3.
+ *
+ * @return Hash.
+ *
+ ******************************************************************************
+ */
+
+static uint64
+NicInfoHashGuestNicV3(const GuestNicV3 *nic)
+{
+   uint64 h = NICINFO_HASH_OFFSET;
+   uint64 ips;
+   u_int i;
+
+   NICINFO_HASH_SET_INIT(ips);
+   XDRUTIL_FOREACH(i, nic, ips) {
+      const IpAddressEntry *ip = XDRUTIL_GETITEM(nic, ips, i);
+      uint64 ipHash = NicInfoHashTypedIpAddress(NICINFO_HASH_OFFSET,
+                                                &ip->ipAddressAddr);
+
+      ipHash = NicInfoHashUint(ipHash, ip->ipAddressPrefixLength);
+      ipHash = NicInfoHashUint(ipHash, ip->ipAddressOrigin == NULL ?
+                                       0 : 1 + (uint64)*ip->ipAddressOrigin);
+      ipHash = NicInfoHashUint(ipHash, ip->ipAddressStatus == NULL ?
+                                       0 : 1 + (uint64)*ip->ipAddressStatus);
+      NICINFO_HASH_SET_ADD(ips, ipHash);
+   }
+
+   h = NicInfoHashString(h, nic->macAddress, TRUE);
+   h = NicInfoHashUint(h, nic->ips.ips_len);
+   h = NicInfoHashUint(h, ips);
+
+   return NicInfoHashStack(h, nic->dnsConfigInfo, nic->winsConfigInfo,
+                           nic->dhcpConfigInfov4, nic->dhcpConfigInfov6);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_Hash_NicInfoV3 --                                           */ /**
+ *
+ * Hashes a NicInfoV3.  NicInfoV3s that are equal per
+ * GuestInfo_IsEqual_NicInfoV3 have the same hash; different hashes mean
+ * that the NicInfoV3s differ.
+ *
+ * @param[in] info  NicInfoV3.  May be NULL.
+ *
+ * @return Hash.
+ *
+ ******************************************************************************
+ */
+
+uint64
+GuestInfo_Hash_NicInfoV3(const NicInfoV3 *info)
+{
+   uint64 h = NICINFO_HASH_OFFSET;
+   uint64 nics;
+   uint64 routes;
+   u_int i;
+
+   if (info == NULL) {
+      return 0;
+   }
+
+   NICINFO_HASH_SET_INIT(nics);
+   XDRUTIL_FOREACH(i, info, nics) {
+      NICINFO_HASH_SET_ADD(nics,
+                           NicInfoHashGuestNicV3(XDRUTIL_GETITEM(info, nics, i)));
+   }
+
+   NICINFO_HASH_SET_INIT(routes);
+   XDRUTIL_FOREACH(i, info, routes) {
+      const InetCidrRouteEntry *route = XDRUTIL_GETITEM(info, routes, i);
+      uint64 routeHash = NicInfoHashTypedIpAddress(NICINFO_HASH_OFFSET,
+                                                   &route->inetCidrRouteDest);
+
+      routeHash = NicInfoHashUint(routeHash, route->inetCidrRoutePfxLen);
+      routeHash = NicInfoHashTypedIpAddress(routeHash,
+                                            route->inetCidrRouteNextHop);
+      routeHash = NicInfoHashString(routeHash,
+         route->inetCidrRouteIfIndex < info->nics.nics_len ?
+         info->nics.nics_val[route->inetCidrRouteIfIndex].macAddress : NULL,
+         TRUE);
+      routeHash = NicInfoHashUint(routeHash, route->inetCidrRouteType);
+      routeHash = NicInfoHashUint(routeHash, route->inetCidrRouteMetric);
+      NICINFO_HASH_SET_ADD(routes, routeHash);
+   }
+
+   h = NicInfoHashUint(h, info->nics.nics_len);
+   h = NicInfoHashUint(h, nics);
+   h = NicInfoHashUint(h, info->routes.routes_len);
+   h = NicInfoHashUint(h, routes);
+   h = NicInfoHashStack(h, info->dnsConfigInfo, info->winsConfigInfo,
+                        info->dhcpConfigInfov4, info->dhcpConfigInfov6);
+
+   /* 0 is for NULL. */
+   return h != 0 ? h : 1;
+}
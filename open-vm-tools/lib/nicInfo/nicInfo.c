@@ -38,9 +38,34 @@
 #include "netutil.h"
 #include "wiper.h"
 
-static GPtrArray *gIfaceExcludePatterns = NULL;
-static GPtrArray *gIfacePrimaryPatterns = NULL;
-static GPtrArray *gIfaceLowPriorityPatterns = NULL;
+/*
+ * The 'exclude-nics', 'primary-nics' and 'low-priority-nics' patterns.
+ *
+ * Nearly all of them are either names or prefixes ("docker*"), which are
+ * compiled into a single trie whose nodes tell, with a bit per list, which
+ * lists match a name ending there or starting with the path to there. Any
+ * other pattern is kept as a GPatternSpec, only tried when the trie does
+ * not match its list.
+ */
+typedef enum {
+   IFACE_LIST_EXCLUDE,
+   IFACE_LIST_PRIMARY,
+   IFACE_LIST_LOW_PRIORITY,
+   IFACE_LIST_MAX
+} IfaceList;
+
+typedef struct IfacePatternNode {
+   struct IfacePatternNode *child;
+   struct IfacePatternNode *sibling;
+   char c;
+   uint8 exactMask;     // Lists having the path to this node as a pattern
+   uint8 prefixMask;    // Lists having the path to this node + '*'
+} IfacePatternNode;
+
+static char **gIfacePatterns[IFACE_LIST_MAX];
+static GPtrArray *gIfaceGlobs[IFACE_LIST_MAX];
+static IfacePatternNode *gIfacePatternTrie = NULL;
+static uint32 gIfacePatternGen = 1;
 
 /**
  * Helper to initialize an opaque struct member.
@@ -63,39 +88,156 @@ static void * Util_DupeThis(const void *source, size_t sourceSize);
 /*
  ******************************************************************************
  *
- * GuestInfoResetPatternList --
+ * GuestInfoFreePatternTrie --
  *
- * @brief Create list of patterns (to be used with the 'exclude-nics',
- * 'primary-nics' and low-priority options).
+ * @brief Free a pattern trie.
  *
- * @param[in]   list          NULL terminated array of pointers to strings with
- *                            patterns
- * @param[out]  pPatternList  pointer to the list to be created. If not NULL,
- *                            pPatternList will be freed.
+ * @param[in] node   Root of the trie, may be NULL.
  *
  ******************************************************************************
  */
 
 static void
-GuestInfoResetPatternList(char **list,
-                          GPtrArray **pPatternList)
+GuestInfoFreePatternTrie(IfacePatternNode *node)
+{
+   while (node != NULL) {
+      IfacePatternNode *next = node->sibling;
+
+      GuestInfoFreePatternTrie(node->child);
+      free(node);
+      node = next;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ *
+ * GuestInfoAddTriePattern --
+ *
+ * @brief Add a name or a prefix pattern to the trie.
+ *
+ * @param[in] pattern   The pattern, possibly ending with a single '*'.
+ * @param[in] which     The list of the pattern.
+ *
+ * @retval FALSE if the pattern has other wildcards, and was not added.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoAddTriePattern(const char *pattern,
+                        IfaceList which)
 {
-   guint i;
+   size_t len = strcspn(pattern, "*?");
+   IfacePatternNode **link = &gIfacePatternTrie;
+   IfacePatternNode *node;
+   Bool prefix;
+   size_t i;
+
+   if (pattern[len] == '\0') {
+      prefix = FALSE;
+   } else if (pattern[len] == '*' && pattern[len + 1] == '\0') {
+      prefix = TRUE;
+   } else {
+      return FALSE;
+   }
+
+   /* The root stands for the empty name, its siblings are not used. */
+   if (*link == NULL) {
+      *link = Util_SafeCalloc(1, sizeof **link);
+   }
+   node = *link;
+
+   for (i = 0; i < len; i++) {
+      link = &node->child;
+      while (*link != NULL && (*link)->c != pattern[i]) {
+         link = &(*link)->sibling;
+      }
+      if (*link == NULL) {
+         *link = Util_SafeCalloc(1, sizeof **link);
+         (*link)->c = pattern[i];
+      }
+      node = *link;
+   }
 
-   if (*pPatternList != NULL) {
-      g_ptr_array_free(*pPatternList, TRUE);
-      *pPatternList = NULL;
+   if (prefix) {
+      node->prefixMask |= 1 << which;
+   } else {
+      node->exactMask |= 1 << which;
    }
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ *
+ * GuestInfoCompilePatterns --
+ *
+ * @brief Rebuild the trie and the remaining GPatternSpecs from all lists.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoCompilePatterns(void)
+{
+   IfaceList which;
+
+   GuestInfoFreePatternTrie(gIfacePatternTrie);
+   gIfacePatternTrie = NULL;
 
-   if (list != NULL) {
-      *pPatternList =
-         g_ptr_array_new_with_free_func((GDestroyNotify) &g_pattern_spec_free);
-      for (i = 0; list[i] != NULL; i++) {
-         if (list[i][0] != '\0') {
-            g_ptr_array_add(*pPatternList, g_pattern_spec_new(list[i]));
+   for (which = 0; which < IFACE_LIST_MAX; which++) {
+      char **list = gIfacePatterns[which];
+      guint i;
+
+      if (gIfaceGlobs[which] != NULL) {
+         g_ptr_array_free(gIfaceGlobs[which], TRUE);
+         gIfaceGlobs[which] = NULL;
+      }
+
+      for (i = 0; list != NULL && list[i] != NULL; i++) {
+         if (list[i][0] == '\0' || GuestInfoAddTriePattern(list[i], which)) {
+            continue;
+         }
+         if (gIfaceGlobs[which] == NULL) {
+            gIfaceGlobs[which] = g_ptr_array_new_with_free_func(
+                                    (GDestroyNotify) &g_pattern_spec_free);
          }
+         g_ptr_array_add(gIfaceGlobs[which], g_pattern_spec_new(list[i]));
       }
    }
+
+   /* Invalidate the classifications cached by the callers. */
+   if (++gIfacePatternGen == 0) {
+      gIfacePatternGen = 1;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ *
+ * GuestInfoResetPatternList --
+ *
+ * @brief Set one of the lists of patterns (the 'exclude-nics',
+ * 'primary-nics' or low-priority options).
+ *
+ * @param[in]   list    NULL terminated array of pointers to strings with
+ *                      patterns, or NULL to clear the list.
+ * @param[in]   which   The list to set.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoResetPatternList(char **list,
+                          IfaceList which)
+{
+   g_strfreev(gIfacePatterns[which]);
+   gIfacePatterns[which] = g_strdupv(list);
+   GuestInfoCompilePatterns();
 }
 
 
@@ -108,15 +250,13 @@ GuestInfoResetPatternList(char **list,
  *
  * @param[in] NULL terminated array of pointers to strings with patterns
  *
- * @sa gIfacePrimaryPatterns will be set
- *
  ******************************************************************************
  */
 
 void
 GuestInfo_SetIfacePrimaryList(char **list)
 {
-   GuestInfoResetPatternList(list, &gIfacePrimaryPatterns);
+   GuestInfoResetPatternList(list, IFACE_LIST_PRIMARY);
 }
 
 
@@ -129,15 +269,13 @@ GuestInfo_SetIfacePrimaryList(char **list)
  *
  * @param[in] NULL terminated array of pointers to strings with patterns
  *
- * @sa gIfaceLowPriorityPatterns will be set
- *
  *******************************************************************************
  */
 
 void
 GuestInfo_SetIfaceLowPriorityList(char **list)
 {
-   GuestInfoResetPatternList(list, &gIfaceLowPriorityPatterns);
+   GuestInfoResetPatternList(list, IFACE_LIST_LOW_PRIORITY);
 }
 
 
@@ -150,8 +288,6 @@ GuestInfo_SetIfaceLowPriorityList(char **list)
  *
  * @param[in] NULL terminated array of pointers to strings with patterns
  *
- * @sa gIfaceExcludePatterns will be set
- *
  *******************************************************************************
  */
 
@@ -159,43 +295,119 @@ GuestInfo_SetIfaceLowPriorityList(char **list)
 void
 GuestInfo_SetIfaceExcludeList(char **list)
 {
-   GuestInfoResetPatternList(list, &gIfaceExcludePatterns);
+   GuestInfoResetPatternList(list, IFACE_LIST_EXCLUDE);
 }
 
 
 /*
  ******************************************************************************
  *
- * GuestInfoMatchesPatternList --
+ * GuestInfoMatchPatterns --
  *
- * @brief Determine if a specific name matches a pattern in a list
+ * @brief Determine which lists have a pattern matching a name.
  *
  * @param[in] The interface name.
- * @param[in] The list of patterns
  *
- * @retval TRUE if the name matches one of the patterns in the list.
+ * @return Mask of the matching lists, with a bit per IfaceList.
  *
  ******************************************************************************
 */
 
-static Bool
-GuestInfoMatchesPatternList(const char *name,
-                            const GPtrArray *patterns)
+static uint8
+GuestInfoMatchPatterns(const char *name)
 {
-   int i;
+   const IfacePatternNode *node = gIfacePatternTrie;
+   uint8 mask = 0;
+   IfaceList which;
+   const char *p;
 
    ASSERT(name);
-   ASSERT(patterns);
-
-   for (i = 0; i < patterns->len; i++) {
-      if (g_pattern_match_string(g_ptr_array_index(patterns, i),
-                                 name)) {
-         g_debug("%s: interface %s matched pattern %d",
-                 __FUNCTION__, name, i);
-         return TRUE;
+
+   for (p = name; node != NULL; p++) {
+      mask |= node->prefixMask;
+      if (*p == '\0') {
+         mask |= node->exactMask;
+         break;
+      }
+      for (node = node->child; node != NULL && node->c != *p;
+           node = node->sibling) {
+      }
+   }
+
+   for (which = 0; which < IFACE_LIST_MAX; which++) {
+      const GPtrArray *globs = gIfaceGlobs[which];
+      guint i;
+
+      if ((mask & (1 << which)) != 0 || globs == NULL) {
+         continue;
       }
+      for (i = 0; i < globs->len; i++) {
+         if (g_pattern_match_string(g_ptr_array_index(globs, i), name)) {
+            mask |= 1 << which;
+            break;
+         }
+      }
+   }
+
+   if (mask != 0) {
+      g_debug("%s: interface %s matched lists 0x%x",
+              __FUNCTION__, name, mask);
+   }
+   return mask;
+}
+
+
+/*
+ ******************************************************************************
+ *
+ * GuestInfoIfaceClassify --
+ *
+ * @brief Determine at once whether an interface is excluded, and its
+ * priority.
+ *
+ * @param[in]  name       The interface name.
+ * @param[out] excluded   Whether the interface shall be excluded.
+ * @param[out] priority   Priority of the interface.
+ *
+ * @return Generation of the patterns, which changes whenever a list is set,
+ *         so that callers can cache the result.
+ *
+ ******************************************************************************
+*/
+
+uint32
+GuestInfoIfaceClassify(const char *name,
+                       Bool *excluded,
+                       NicInfoPriority *priority)
+{
+   uint8 mask = GuestInfoMatchPatterns(name);
+
+   *excluded = (mask & (1 << IFACE_LIST_EXCLUDE)) != 0;
+   if (mask & (1 << IFACE_LIST_PRIMARY)) {
+      *priority = NICINFO_PRIORITY_PRIMARY;
+   } else if (mask & (1 << IFACE_LIST_LOW_PRIORITY)) {
+      *priority = NICINFO_PRIORITY_LOW;
+   } else {
+      *priority = NICINFO_PRIORITY_NORMAL;
    }
-   return FALSE;
+   return gIfacePatternGen;
+}
+
+
+/*
+ ******************************************************************************
+ *
+ * GuestInfoIfacePatternGen --
+ *
+ * @return Generation of the patterns, see GuestInfoIfaceClassify.
+ *
+ ******************************************************************************
+*/
+
+uint32
+GuestInfoIfacePatternGen(void)
+{
+   return gIfacePatternGen;
 }
 
 
@@ -215,9 +427,7 @@ GuestInfoMatchesPatternList(const char *name,
 
 Bool GuestInfo_IfaceIsExcluded(const char *name)
 {
-   ASSERT(name);
-   return gIfaceExcludePatterns != NULL &&
-          GuestInfoMatchesPatternList(name, gIfaceExcludePatterns);
+   return (GuestInfoMatchPatterns(name) & (1 << IFACE_LIST_EXCLUDE)) != 0;
 }
 
 
@@ -239,16 +449,11 @@ Bool GuestInfo_IfaceIsExcluded(const char *name)
 NicInfoPriority
 GuestInfo_IfaceGetPriority(const char *name)
 {
-   ASSERT(name);
-   g_debug("%s: checking %s", __FUNCTION__, name);
-   if (gIfacePrimaryPatterns != NULL &&
-       GuestInfoMatchesPatternList(name, gIfacePrimaryPatterns)) {
-      return NICINFO_PRIORITY_PRIMARY;
-   } else if (gIfaceLowPriorityPatterns != NULL &&
-              GuestInfoMatchesPatternList(name, gIfaceLowPriorityPatterns)) {
-      return NICINFO_PRIORITY_LOW;
-   }
-   return NICINFO_PRIORITY_NORMAL;
+   Bool excluded;
+   NicInfoPriority priority;
+
+   GuestInfoIfaceClassify(name, &excluded, &priority);
+   return priority;
 }
 
 
@@ -51,6 +51,11 @@ IpAddressEntry *GuestInfoAddIpAddress(GuestNicV3 *nic,                  // IN/OU
 
 char *GuestInfoGetPrimaryIP(void);
 
+uint32 GuestInfoIfaceClassify(const char *name,             // IN
+                              Bool *excluded,               // OUT
+                              NicInfoPriority *priority);   // OUT
+uint32 GuestInfoIfacePatternGen(void);
+
 #if defined _WIN32
 void GuestInfoDupTypedIpAddress(TypedIpAddress *srcIp,   // IN
                                 TypedIpAddress *destIp);  // OUT
@@ -61,6 +66,11 @@ Bool GuestInfoGetNicInfoIfIndex(NicInfoV3 *nicInfo,  // IN
                                 int ifIndex,         // IN
                                 int *nicIfIndex);    // OUT
 #endif // if defined __linux__ || defined _WIN32
+#if defined __linux__ && !defined USERWORLD
+Bool GuestInfoNetlinkGetNicInfo(unsigned int maxIPv4Routes,  // IN
+                                unsigned int maxIPv6Routes,  // IN
+                                NicInfoV3 *nicInfo);         // OUT
+#endif // if defined __linux__ && !defined USERWORLD
 void GuestInfoSockaddrToTypedIpAddress(const struct sockaddr *sa,    // IN
                                        TypedIpAddress *typedIp);     // OUT
 
@@ -0,0 +1,1216 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file nicInfoNetlink.c
+ *
+ * rtnetlink backend of the Linux NIC and route collection.
+ *
+ * Rather than walking getifaddrs(3) and parsing /proc/net/route and
+ * /proc/net/ipv6_route on each gather, a netlink socket subscribed to link,
+ * address and route changes is kept open. The links, addresses and routes
+ * are dumped once; each gather then applies the pending change messages to
+ * that model and builds the NicInfoV3 from memory. If the kernel drops
+ * messages (ENOBUFS), the model is dumped again.
+ *
+ * The same model backs the link lookups of lib/netUtil on Linux, see the
+ * GuestInfo_LinkCache functions.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "vmware.h"
+#include "nicInfoInt.h"
+#include "str.h"
+#include "util.h"
+#include "xdrutil.h"
+
+#define NICINFO_NETLINK_BUF_SIZE   (32 * 1024)
+#define NICINFO_NETLINK_RCVBUF     (1024 * 1024)
+#define NICINFO_NETLINK_DUMP_TRIES 3
+
+typedef struct NetlinkAddr {
+   uint8          family;
+   uint8          prefixLen;
+   uint8          addr[16];
+} NetlinkAddr;
+
+typedef struct NetlinkLink {
+   int            index;
+   unsigned int   flags;
+   unsigned short type;
+   Bool           hasMac;
+   uint8          mac[6];
+   char           name[IFNAMSIZ];
+   GArray        *addrs;          // NetlinkAddr
+   int            nicIndex;       // In the NicInfoV3 being built, or -1
+   uint32         patternGen;     // Of excluded and priority, 0 if unset
+   Bool           excluded;
+   NicInfoPriority priority;
+} NetlinkLink;
+
+/*
+ * Routes are keyed by what identifies them to the kernel, i.e. all of the
+ * structure but the gateway.
+ */
+typedef struct NetlinkRoute {
+   uint8          family;
+   uint8          dstLen;
+   uint8          tos;
+   uint8          hasGateway;
+   uint32         metric;
+   int            oif;
+   uint8          dst[16];
+   uint8          gateway[16];
+} NetlinkRoute;
+
+#define NETLINK_ROUTE_KEY_SIZE offsetof(NetlinkRoute, gateway)
+
+typedef struct NetlinkModel {
+   int            fd;
+   uint32         seq;
+   uint32         gen;            // Bumped on each change applied
+   Bool           needDump;
+   GHashTable    *links;          // ifindex -> NetlinkLink
+   GHashTable    *routes;         // NetlinkRoute -> itself
+   uint8          buf[NICINFO_NETLINK_BUF_SIZE];
+} NetlinkModel;
+
+/*
+ * The model is shared by the NIC gathers and the link cache lookups, which
+ * may run on different threads.
+ */
+static GMutex gModelLock;
+static NetlinkModel *gModel = NULL;
+static Bool gNetlinkUnavailable = FALSE;
+
+/* Primary IPv4 address, as of model generation gPrimaryIPv4Gen. */
+static char gPrimaryIPv4[INET_ADDRSTRLEN];
+static uint32 gPrimaryIPv4Gen = 0;
+
+
+/*
+ ******************************************************************************
+ * NetlinkLinkFree --
+ * NetlinkRouteHash --
+ * NetlinkRouteEqual --                                                  */ /**
+ *
+ * @brief GHashTable helpers.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkLinkFree(gpointer data)
+{
+   NetlinkLink *link = data;
+
+   g_array_free(link->addrs, TRUE);
+   g_free(link);
+}
+
+
+static guint
+NetlinkRouteHash(gconstpointer key)
+{
+   const uint8 *p = key;
+   guint hash = 5381;
+   size_t i;
+
+   for (i = 0; i < NETLINK_ROUTE_KEY_SIZE; i++) {
+      hash = hash * 33 + p[i];
+   }
+   return hash;
+}
+
+
+static gboolean
+NetlinkRouteEqual(gconstpointer a,
+                  gconstpointer b)
+{
+   return memcmp(a, b, NETLINK_ROUTE_KEY_SIZE) == 0;
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkParseAttrs --                                                  */ /**
+ *
+ * @brief Index the attributes following a netlink message body.
+ *
+ * @param[in]  rta      First attribute.
+ * @param[in]  len      Length of the attributes.
+ * @param[out] attrs    Attributes, by type; those above @a max are ignored.
+ * @param[in]  max      Highest attribute type of interest.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkParseAttrs(struct rtattr *rta,
+                  int len,
+                  struct rtattr **attrs,
+                  int max)
+{
+   memset(attrs, 0, sizeof *attrs * (max + 1));
+
+   for (; RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+      if (rta->rta_type <= max) {
+         attrs[rta->rta_type] = rta;
+      }
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkHandleLink --                                                  */ /**
+ *
+ * @brief Apply a RTM_NEWLINK or RTM_DELLINK message to the model.
+ *
+ * @param[in]  model    The model.
+ * @param[in]  nlh      The message.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkHandleLink(NetlinkModel *model,
+                  struct nlmsghdr *nlh)
+{
+   struct ifinfomsg *ifi = NLMSG_DATA(nlh);
+   struct rtattr *attrs[IFLA_MAX + 1];
+   NetlinkLink *link;
+
+   if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ifi)) {
+      return;
+   }
+
+   if (nlh->nlmsg_type == RTM_DELLINK) {
+      g_hash_table_remove(model->links, GINT_TO_POINTER(ifi->ifi_index));
+      return;
+   }
+
+   NetlinkParseAttrs(IFLA_RTA(ifi), IFLA_PAYLOAD(nlh), attrs, IFLA_MAX);
+
+   link = g_hash_table_lookup(model->links, GINT_TO_POINTER(ifi->ifi_index));
+   if (link == NULL) {
+      link = g_new0(NetlinkLink, 1);
+      link->index = ifi->ifi_index;
+      link->addrs = g_array_new(FALSE, FALSE, sizeof(NetlinkAddr));
+      g_hash_table_insert(model->links, GINT_TO_POINTER(link->index), link);
+   }
+
+   link->flags = ifi->ifi_flags;
+   link->type = ifi->ifi_type;
+
+   if (attrs[IFLA_IFNAME] != NULL &&
+       strncmp(link->name, RTA_DATA(attrs[IFLA_IFNAME]),
+               sizeof link->name) != 0) {
+      Str_Strcpy(link->name, RTA_DATA(attrs[IFLA_IFNAME]), sizeof link->name);
+      link->patternGen = 0;
+   }
+   if (attrs[IFLA_ADDRESS] != NULL) {
+      link->hasMac = RTA_PAYLOAD(attrs[IFLA_ADDRESS]) == sizeof link->mac;
+      if (link->hasMac) {
+         memcpy(link->mac, RTA_DATA(attrs[IFLA_ADDRESS]), sizeof link->mac);
+      }
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkHandleAddr --                                                  */ /**
+ *
+ * @brief Apply a RTM_NEWADDR or RTM_DELADDR message to the model.
+ *
+ * @param[in]  model    The model.
+ * @param[in]  nlh      The message.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkHandleAddr(NetlinkModel *model,
+                  struct nlmsghdr *nlh)
+{
+   struct ifaddrmsg *ifa = NLMSG_DATA(nlh);
+   struct rtattr *attrs[IFA_MAX + 1];
+   struct rtattr *rta;
+   NetlinkLink *link;
+   NetlinkAddr addr;
+   size_t addrLen;
+   guint i;
+
+   if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof *ifa) ||
+       (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)) {
+      return;
+   }
+
+   link = g_hash_table_lookup(model->links, GINT_TO_POINTER(ifa->ifa_index));
+   if (link == NULL) {
+      return;
+   }
+
+   NetlinkParseAttrs(IFA_RTA(ifa), IFA_PAYLOAD(nlh), attrs, IFA_MAX);
+
+   /* IFA_ADDRESS is the peer of point to point IPv4 links. */
+   rta = attrs[IFA_LOCAL] != NULL ? attrs[IFA_LOCAL] : attrs[IFA_ADDRESS];
+   addrLen = ifa->ifa_family == AF_INET ? 4 : 16;
+   if (rta == NULL || RTA_PAYLOAD(rta) != addrLen) {
+      return;
+   }
+
+   memset(&addr, 0, sizeof addr);
+   addr.family = ifa->ifa_family;
+   addr.prefixLen = ifa->ifa_prefixlen;
+   memcpy(addr.addr, RTA_DATA(rta), addrLen);
+
+   for (i = 0; i < link->addrs->len; i++) {
+      if (memcmp(&g_array_index(link->addrs, NetlinkAddr, i), &addr,
+                 sizeof addr) == 0) {
+         break;
+      }
+   }
+
+   if (nlh->nlmsg_type == RTM_DELADDR) {
+      if (i < link->addrs->len) {
+         g_array_remove_index(link->addrs, i);
+      }
+   } else if (i == link->addrs->len) {
+      g_array_append_val(link->addrs, addr);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkHandleRoute --                                                 */ /**
+ *
+ * @brief Apply a RTM_NEWROUTE or RTM_DELROUTE message to the model. Only
+ *        the unicast routes of the main table are kept, which is what
+ *        /proc/net/route shows.
+ *
+ * @param[in]  model    The model.
+ * @param[in]  nlh      The message.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkHandleRoute(NetlinkModel *model,
+                   struct nlmsghdr *nlh)
+{
+   struct rtmsg *rtm = NLMSG_DATA(nlh);
+   struct rtattr *attrs[RTA_MAX + 1];
+   NetlinkRoute *route;
+   size_t addrLen;
+   uint32 table;
+
+   if (nlh->nlmsg_len < NLMSG_LENGTH(sizeof *rtm) ||
+       (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6) ||
+       rtm->rtm_type != RTN_UNICAST) {
+      return;
+   }
+
+   NetlinkParseAttrs(RTM_RTA(rtm), RTM_PAYLOAD(nlh), attrs, RTA_MAX);
+
+   table = attrs[RTA_TABLE] != NULL ? *(uint32 *)RTA_DATA(attrs[RTA_TABLE])
+                                    : rtm->rtm_table;
+   if (table != RT_TABLE_MAIN || attrs[RTA_OIF] == NULL) {
+      /* Multipath routes have no RTA_OIF, nor an interface to report. */
+      return;
+   }
+
+   addrLen = rtm->rtm_family == AF_INET ? 4 : 16;
+
+   route = g_new0(NetlinkRoute, 1);
+   route->family = rtm->rtm_family;
+   route->dstLen = rtm->rtm_dst_len;
+   route->tos = rtm->rtm_tos;
+   route->oif = *(int *)RTA_DATA(attrs[RTA_OIF]);
+   if (attrs[RTA_PRIORITY] != NULL) {
+      route->metric = *(uint32 *)RTA_DATA(attrs[RTA_PRIORITY]);
+   }
+   if (attrs[RTA_DST] != NULL && RTA_PAYLOAD(attrs[RTA_DST]) == addrLen) {
+      memcpy(route->dst, RTA_DATA(attrs[RTA_DST]), addrLen);
+   }
+   if (attrs[RTA_GATEWAY] != NULL &&
+       RTA_PAYLOAD(attrs[RTA_GATEWAY]) == addrLen) {
+      route->hasGateway = TRUE;
+      memcpy(route->gateway, RTA_DATA(attrs[RTA_GATEWAY]), addrLen);
+   }
+
+   if (nlh->nlmsg_type == RTM_DELROUTE) {
+      g_hash_table_remove(model->routes, route);
+      g_free(route);
+   } else {
+      g_hash_table_replace(model->routes, route, route);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkHandleMessages --                                              */ /**
+ *
+ * @brief Apply the messages of a datagram to the model.
+ *
+ * @param[in]  model    The model.
+ * @param[in]  len      Length of the datagram in @a model's buffer.
+ * @param[in]  seq      Sequence number of the dump in progress, or 0.
+ *
+ * @retval  1  The dump in progress is done.
+ * @retval  0  More messages are expected.
+ * @retval -1  The dump failed or was interrupted.
+ *
+ ******************************************************************************
+ */
+
+static int
+NetlinkHandleMessages(NetlinkModel *model,
+                      ssize_t len,
+                      uint32 seq)
+{
+   struct nlmsghdr *nlh;
+   int len32 = len;
+
+   for (nlh = (struct nlmsghdr *)model->buf;
+        NLMSG_OK(nlh, len32);
+        nlh = NLMSG_NEXT(nlh, len32)) {
+      Bool ours = seq != 0 && nlh->nlmsg_seq == seq;
+
+      if (ours && (nlh->nlmsg_flags & NLM_F_DUMP_INTR)) {
+         return -1;
+      }
+
+      switch (nlh->nlmsg_type) {
+      case NLMSG_DONE:
+         if (ours) {
+            return 1;
+         }
+         break;
+      case NLMSG_ERROR:
+         if (ours) {
+            return -1;
+         }
+         break;
+      case RTM_NEWLINK:
+      case RTM_DELLINK:
+         NetlinkHandleLink(model, nlh);
+         model->gen++;
+         break;
+      case RTM_NEWADDR:
+      case RTM_DELADDR:
+         NetlinkHandleAddr(model, nlh);
+         model->gen++;
+         break;
+      case RTM_NEWROUTE:
+      case RTM_DELROUTE:
+         NetlinkHandleRoute(model, nlh);
+         break;
+      default:
+         break;
+      }
+   }
+
+   return 0;
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkDumpOne --                                                     */ /**
+ *
+ * @brief Request a dump of one kind of objects, and apply it to the model.
+ *
+ * @param[in]  model    The model.
+ * @param[in]  type     RTM_GETLINK, RTM_GETADDR or RTM_GETROUTE.
+ *
+ * @retval TRUE  The dump completed.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+NetlinkDumpOne(NetlinkModel *model,
+               uint16 type)
+{
+   struct {
+      struct nlmsghdr nlh;
+      struct rtgenmsg gen;
+   } req;
+   struct sockaddr_nl kernel;
+   uint32 seq = ++model->seq;
+
+   memset(&req, 0, sizeof req);
+   req.nlh.nlmsg_len = NLMSG_LENGTH(sizeof req.gen);
+   req.nlh.nlmsg_type = type;
+   req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+   req.nlh.nlmsg_seq = seq;
+   req.gen.rtgen_family = AF_UNSPEC;
+
+   memset(&kernel, 0, sizeof kernel);
+   kernel.nl_family = AF_NETLINK;
+
+   if (sendto(model->fd, &req, req.nlh.nlmsg_len, 0,
+              (struct sockaddr *)&kernel, sizeof kernel) < 0) {
+      return FALSE;
+   }
+
+   for (;;) {
+      ssize_t len = recv(model->fd, model->buf, sizeof model->buf, 0);
+      int ret;
+
+      if (len < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         /* ENOBUFS loses the end of the dump as well as events. */
+         return FALSE;
+      }
+      if (len == 0) {
+         return FALSE;
+      }
+
+      ret = NetlinkHandleMessages(model, len, seq);
+      if (ret != 0) {
+         return ret > 0;
+      }
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkDump --                                                        */ /**
+ *
+ * @brief Rebuild the model from scratch.
+ *
+ * @param[in]  model    The model.
+ *
+ * @retval TRUE  The model is up to date.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+NetlinkDump(NetlinkModel *model)
+{
+   int tries;
+
+   for (tries = 0; tries < NICINFO_NETLINK_DUMP_TRIES; tries++) {
+      g_hash_table_remove_all(model->routes);
+      g_hash_table_remove_all(model->links);
+      model->gen++;
+
+      /* Links first, addresses are matched to them. */
+      if (NetlinkDumpOne(model, RTM_GETLINK) &&
+          NetlinkDumpOne(model, RTM_GETADDR) &&
+          NetlinkDumpOne(model, RTM_GETROUTE)) {
+         model->needDump = FALSE;
+         return TRUE;
+      }
+   }
+
+   g_warning("%s: Unable to dump the network configuration: %s\n",
+             __FUNCTION__, strerror(errno));
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkOpen --                                                        */ /**
+ *
+ * @brief Create the model and its netlink socket.
+ *
+ * @return The model, NULL on failure.
+ *
+ ******************************************************************************
+ */
+
+static NetlinkModel *
+NetlinkOpen(void)
+{
+   NetlinkModel *model;
+   struct sockaddr_nl addr;
+   int rcvbuf = NICINFO_NETLINK_RCVBUF;
+   int fd;
+
+   fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+   if (fd < 0) {
+      g_debug("%s: socket failed: %s\n", __FUNCTION__, strerror(errno));
+      return NULL;
+   }
+
+   memset(&addr, 0, sizeof addr);
+   addr.nl_family = AF_NETLINK;
+   addr.nl_groups = RTMGRP_LINK |
+                    RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                    RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+   if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+      g_debug("%s: bind failed: %s\n", __FUNCTION__, strerror(errno));
+      close(fd);
+      return NULL;
+   }
+
+   /* Best effort, fewer overruns mean fewer full dumps. */
+   setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof rcvbuf);
+
+   model = g_new0(NetlinkModel, 1);
+   model->fd = fd;
+   model->gen = 1;
+   model->needDump = TRUE;
+   model->links = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                        NULL, NetlinkLinkFree);
+   model->routes = g_hash_table_new_full(NetlinkRouteHash, NetlinkRouteEqual,
+                                         g_free, NULL);
+   return model;
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkUpdate --                                                      */ /**
+ *
+ * @brief Apply the pending change messages to the model, or dump it again
+ *        if some were lost.
+ *
+ * @param[in]  model    The model.
+ *
+ * @retval TRUE  The model is up to date.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+NetlinkUpdate(NetlinkModel *model)
+{
+   while (!model->needDump) {
+      ssize_t len = recv(model->fd, model->buf, sizeof model->buf,
+                         MSG_DONTWAIT);
+
+      if (len > 0) {
+         NetlinkHandleMessages(model, len, 0);
+      } else if (len < 0 && errno == EINTR) {
+         continue;
+      } else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         return TRUE;
+      } else {
+         g_debug("%s: Lost netlink messages (%s), dumping again.\n",
+                 __FUNCTION__, len < 0 ? strerror(errno) : "EOF");
+         model->needDump = TRUE;
+      }
+   }
+
+   return NetlinkDump(model);
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkCompareLinks --
+ * NetlinkCompareRoutes --                                               */ /**
+ *
+ * @brief qsort comparators, so that the NicInfoV3 keeps a stable order.
+ *
+ ******************************************************************************
+ */
+
+static int
+NetlinkCompareLinks(const void *a,
+                    const void *b)
+{
+   const NetlinkLink *la = *(NetlinkLink * const *)a;
+   const NetlinkLink *lb = *(NetlinkLink * const *)b;
+
+   return (la->index > lb->index) - (la->index < lb->index);
+}
+
+
+static int
+NetlinkCompareRoutes(const void *a,
+                     const void *b)
+{
+   const NetlinkRoute *ra = *(NetlinkRoute * const *)a;
+   const NetlinkRoute *rb = *(NetlinkRoute * const *)b;
+
+   if (ra->family != rb->family) {
+      /* IPv4 first. */
+      return ra->family == AF_INET ? -1 : 1;
+   }
+   return memcmp(ra, rb, NETLINK_ROUTE_KEY_SIZE);
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkToSockaddr --                                                  */ /**
+ *
+ * @brief Build a sockaddr from a raw address.
+ *
+ * @param[in]  family   AF_INET or AF_INET6.
+ * @param[in]  addr     The address.
+ * @param[out] ss       The sockaddr.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkToSockaddr(uint8 family,
+                  const uint8 *addr,
+                  struct sockaddr_storage *ss)
+{
+   memset(ss, 0, sizeof *ss);
+
+   if (family == AF_INET) {
+      struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+
+      sin->sin_family = AF_INET;
+      memcpy(&sin->sin_addr, addr, sizeof sin->sin_addr);
+   } else {
+      struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+
+      sin6->sin6_family = AF_INET6;
+      memcpy(&sin6->sin6_addr, addr, sizeof sin6->sin6_addr);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkRecordNics --                                                  */ /**
+ *
+ * @brief Add the Ethernet NICs that are up, with their addresses, to the
+ *        NicInfoV3: primary ones first, then normal, then low priority
+ *        ones.
+ *
+ * @param[in]  links    Links sorted by index.
+ * @param[in]  numLinks Number of links.
+ * @param[out] nicInfo  NicInfoV3 container.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkRecordNics(NetlinkLink **links,
+                  guint numLinks,
+                  NicInfoV3 *nicInfo)
+{
+   NicInfoPriority priority;
+   uint32 patternGen = GuestInfoIfacePatternGen();
+   guint i;
+
+   for (i = 0; i < numLinks; i++) {
+      NetlinkLink *link = links[i];
+
+      link->nicIndex = -1;
+
+      /* Names are only matched again when they or the patterns change. */
+      if (link->patternGen != patternGen) {
+         link->patternGen = GuestInfoIfaceClassify(link->name, &link->excluded,
+                                                   &link->priority);
+      }
+   }
+
+   for (priority = NICINFO_PRIORITY_PRIMARY;
+        priority < NICINFO_PRIORITY_MAX;
+        priority++) {
+      for (i = 0; i < numLinks; i++) {
+         NetlinkLink *link = links[i];
+         char macAddress[NICINFO_MAC_LEN];
+         GuestNicV3 *nic;
+         guint j;
+
+         if (link->type != ARPHRD_ETHER || !link->hasMac ||
+             !(link->flags & IFF_UP) || (link->flags & IFF_LOOPBACK) ||
+             link->priority != priority || link->excluded) {
+            continue;
+         }
+
+         Str_Sprintf(macAddress, sizeof macAddress,
+                     "%02x:%02x:%02x:%02x:%02x:%02x",
+                     link->mac[0], link->mac[1], link->mac[2],
+                     link->mac[3], link->mac[4], link->mac[5]);
+         nic = GuestInfoAddNicEntry(nicInfo, macAddress, NULL, NULL);
+         if (nic == NULL) {
+            /*
+             * We reached the maximum number of NICs that we can report.
+             */
+            return;
+         }
+         link->nicIndex = nicInfo->nics.nics_len - 1;
+
+         for (j = 0; j < link->addrs->len; j++) {
+            const NetlinkAddr *addr = &g_array_index(link->addrs,
+                                                     NetlinkAddr, j);
+            struct sockaddr_storage ss;
+
+            /*
+             * Ignore any loopback addresses, which would indicate a
+             * misconfiguration on a non loopback device.
+             */
+            if ((addr->family == AF_INET && addr->addr[0] == IN_LOOPBACKNET) ||
+                (addr->family == AF_INET6 &&
+                 IN6_IS_ADDR_LOOPBACK((const struct in6_addr *)addr->addr))) {
+               continue;
+            }
+
+            NetlinkToSockaddr(addr->family, addr->addr, &ss);
+            if (GuestInfoAddIpAddress(nic, (struct sockaddr *)&ss,
+                                      addr->prefixLen, NULL, NULL) == NULL) {
+               /*
+                * Reached the max number of IPs that can be reported
+                */
+               break;
+            }
+         }
+      }
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkRecordRoutes --                                                */ /**
+ *
+ * @brief Add the routes through the reported NICs to the NicInfoV3, like
+ *        RecordRoutingInfo: at most @a maxIPv4Routes IPv4 routes, then at
+ *        most @a maxIPv6Routes IPv6 routes.
+ *
+ * @param[in]  model          The model, with the NICs recorded.
+ * @param[in]  maxIPv4Routes  Max IPv4 routes to gather.
+ * @param[in]  maxIPv6Routes  Max IPv6 routes to gather.
+ * @param[out] nicInfo        NicInfoV3 container.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkRecordRoutes(NetlinkModel *model,
+                    unsigned int maxIPv4Routes,
+                    unsigned int maxIPv6Routes,
+                    NicInfoV3 *nicInfo)
+{
+   GHashTableIter iter;
+   gpointer key;
+   NetlinkRoute **routes;
+   guint numRoutes = 0;
+   unsigned int numIPv4 = 0;
+   unsigned int numIPv6 = 0;
+   guint i;
+
+   routes = g_new(NetlinkRoute *, g_hash_table_size(model->routes) + 1);
+   g_hash_table_iter_init(&iter, model->routes);
+   while (g_hash_table_iter_next(&iter, &key, NULL)) {
+      routes[numRoutes++] = key;
+   }
+   qsort(routes, numRoutes, sizeof *routes, NetlinkCompareRoutes);
+
+   for (i = 0; i < numRoutes; i++) {
+      const NetlinkRoute *route = routes[i];
+      struct sockaddr_storage ss;
+      InetCidrRouteEntry *icre;
+      NetlinkLink *link;
+
+      if (route->family == AF_INET ? numIPv4++ >= maxIPv4Routes
+                                   : numIPv6++ >= maxIPv6Routes) {
+         continue;
+      }
+
+      /* Check to see if we're going above our limit. See bug 605821. */
+      if (nicInfo->routes.routes_len == NICINFO_MAX_ROUTES) {
+         g_message("%s: route limit (%d) reached, skipping overflow.",
+                   __FUNCTION__, NICINFO_MAX_ROUTES);
+         break;
+      }
+
+      link = g_hash_table_lookup(model->links, GINT_TO_POINTER(route->oif));
+      if (link == NULL || link->nicIndex < 0) {
+         continue;
+      }
+
+      icre = XDRUTIL_ARRAYAPPEND(nicInfo, routes, 1);
+      ASSERT_MEM_ALLOC(icre);
+
+      NetlinkToSockaddr(route->family, route->dst, &ss);
+      GuestInfoSockaddrToTypedIpAddress((struct sockaddr *)&ss,
+                                        &icre->inetCidrRouteDest);
+      icre->inetCidrRoutePfxLen = route->dstLen;
+
+      /*
+       * Gateways are optional (ex: one can bind a route to an interface w/o
+       * specifying a next hop address).
+       */
+      if (route->hasGateway) {
+         TypedIpAddress *ip = Util_SafeCalloc(1, sizeof *ip);
+
+         NetlinkToSockaddr(route->family, route->gateway, &ss);
+         GuestInfoSockaddrToTypedIpAddress((struct sockaddr *)&ss, ip);
+         icre->inetCidrRouteNextHop = ip;
+      }
+
+      icre->inetCidrRouteIfIndex = link->nicIndex;
+      icre->inetCidrRouteMetric = route->metric;
+   }
+
+   g_free(routes);
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkGetModel --                                                    */ /**
+ *
+ * @brief Get the model, created on first use, with the pending changes
+ *        applied. Must be called with gModelLock held.
+ *
+ * @return The model, NULL if netlink is not usable.
+ *
+ ******************************************************************************
+ */
+
+static NetlinkModel *
+NetlinkGetModel(void)
+{
+   if (gNetlinkUnavailable) {
+      return NULL;
+   }
+
+   if (gModel == NULL && (gModel = NetlinkOpen()) == NULL) {
+      g_info("%s: netlink unavailable, falling back to polling.\n",
+             __FUNCTION__);
+      gNetlinkUnavailable = TRUE;
+      return NULL;
+   }
+
+   return NetlinkUpdate(gModel) ? gModel : NULL;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoNetlinkGetNicInfo --                                         */ /**
+ *
+ * @brief Gather the NICs, their addresses and routes from the netlink model.
+ *
+ * @param[in]  maxIPv4Routes  Max IPv4 routes to gather.
+ * @param[in]  maxIPv6Routes  Max IPv6 routes to gather.
+ * @param[out] nicInfo        NicInfoV3 container, left untouched on failure.
+ *
+ * @retval TRUE  Success.
+ * @retval FALSE Netlink is not usable, the caller must fall back to the
+ *               other sources.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfoNetlinkGetNicInfo(unsigned int maxIPv4Routes,
+                           unsigned int maxIPv6Routes,
+                           NicInfoV3 *nicInfo)
+{
+   GHashTableIter iter;
+   gpointer value;
+   NetlinkModel *model;
+   NetlinkLink **links;
+   guint numLinks = 0;
+
+   g_mutex_lock(&gModelLock);
+   model = NetlinkGetModel();
+   if (model == NULL) {
+      g_mutex_unlock(&gModelLock);
+      return FALSE;
+   }
+
+   links = g_new(NetlinkLink *, g_hash_table_size(model->links) + 1);
+   g_hash_table_iter_init(&iter, model->links);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      links[numLinks++] = value;
+   }
+   qsort(links, numLinks, sizeof *links, NetlinkCompareLinks);
+
+   NetlinkRecordNics(links, numLinks, nicInfo);
+   g_free(links);
+
+   if (maxIPv4Routes > 0 || maxIPv6Routes > 0) {
+      NetlinkRecordRoutes(model, maxIPv4Routes, maxIPv6Routes, nicInfo);
+   }
+   g_mutex_unlock(&gModelLock);
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkFindLinkByName --                                              */ /**
+ *
+ * @brief Look a link up by name. Must be called with gModelLock held.
+ *
+ * @param[in]  model    The model.
+ * @param[in]  name     Interface name.
+ *
+ * @return The link, NULL if there is none by that name.
+ *
+ ******************************************************************************
+ */
+
+static NetlinkLink *
+NetlinkFindLinkByName(NetlinkModel *model,
+                      const char *name)
+{
+   GHashTableIter iter;
+   gpointer value;
+
+   g_hash_table_iter_init(&iter, model->links);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      NetlinkLink *link = value;
+
+      if (strcmp(link->name, name) == 0) {
+         return link;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ ******************************************************************************
+ * NetlinkComputePrimaryIPv4 --                                          */ /**
+ *
+ * @brief Find the primary IPv4 address the way NetUtil_GetPrimaryIP() did
+ *        with SIOCGIFCONF: the first non-zero IPv4 address of the first
+ *        interface, in interface order, whose name doesn't start with "lo".
+ *
+ * @param[in]  model    The model.
+ * @param[out] ipstr    The address, "" if there is none.
+ *
+ ******************************************************************************
+ */
+
+static void
+NetlinkComputePrimaryIPv4(NetlinkModel *model,
+                          char ipstr[INET_ADDRSTRLEN])
+{
+   GHashTableIter iter;
+   gpointer value;
+   NetlinkLink *best = NULL;
+   const NetlinkAddr *bestAddr = NULL;
+
+   g_hash_table_iter_init(&iter, model->links);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      NetlinkLink *link = value;
+      guint i;
+
+      if ((best != NULL && link->index > best->index) ||
+          link->name[0] == '\0' || strncmp(link->name, "lo", 2) == 0) {
+         continue;
+      }
+
+      for (i = 0; i < link->addrs->len; i++) {
+         const NetlinkAddr *addr = &g_array_index(link->addrs, NetlinkAddr, i);
+         static const uint8 zero[4] = { 0 };
+
+         if (addr->family == AF_INET && memcmp(addr->addr, zero, 4) != 0) {
+            best = link;
+            bestAddr = addr;
+            break;
+         }
+      }
+   }
+
+   if (bestAddr == NULL ||
+       inet_ntop(AF_INET, bestAddr->addr, ipstr, INET_ADDRSTRLEN) == NULL) {
+      ipstr[0] = '\0';
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_LinkCacheGetPrimaryIPv4 --                                  */ /**
+ *
+ * @brief Get the primary IPv4 address from the netlink model.
+ *
+ * The address is only recomputed when a link or address change was applied
+ * to the model since the last call; otherwise this costs one non-blocking
+ * read of the netlink socket.
+ *
+ * @param[out] ipstr    The address, "" if there is none.
+ * @param[in]  size     Size of @a ipstr.
+ *
+ * @retval TRUE  Success.
+ * @retval FALSE Netlink is not usable, the caller must query the system.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfo_LinkCacheGetPrimaryIPv4(char *ipstr,
+                                  size_t size)
+{
+   NetlinkModel *model;
+
+   g_mutex_lock(&gModelLock);
+   model = NetlinkGetModel();
+   if (model == NULL) {
+      g_mutex_unlock(&gModelLock);
+      return FALSE;
+   }
+
+   if (gPrimaryIPv4Gen != model->gen) {
+      NetlinkComputePrimaryIPv4(model, gPrimaryIPv4);
+      gPrimaryIPv4Gen = model->gen;
+   }
+   g_strlcpy(ipstr, gPrimaryIPv4, size);
+   g_mutex_unlock(&gModelLock);
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_LinkCacheGetIfIndex --                                      */ /**
+ *
+ * @brief Get the index of an interface from the netlink model.
+ *
+ * @param[in]  ifName   Interface name.
+ * @param[out] ifIndex  Its index, -1 if there is no such interface.
+ *
+ * @retval TRUE  Success.
+ * @retval FALSE Netlink is not usable, the caller must query the system.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfo_LinkCacheGetIfIndex(const char *ifName,
+                              int *ifIndex)
+{
+   NetlinkModel *model;
+   NetlinkLink *link;
+
+   g_mutex_lock(&gModelLock);
+   model = NetlinkGetModel();
+   if (model == NULL) {
+      g_mutex_unlock(&gModelLock);
+      return FALSE;
+   }
+
+   link = NetlinkFindLinkByName(model, ifName);
+   *ifIndex = link != NULL ? link->index : -1;
+   g_mutex_unlock(&gModelLock);
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_LinkCacheGetIfName --                                       */ /**
+ *
+ * @brief Get the name of an interface from the netlink model.
+ *
+ * @param[in]  ifIndex  Interface index.
+ * @param[out] ifName   Its name, "" if there is no such interface.
+ * @param[in]  size     Size of @a ifName.
+ *
+ * @retval TRUE  Success.
+ * @retval FALSE Netlink is not usable, the caller must query the system.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfo_LinkCacheGetIfName(int ifIndex,
+                             char *ifName,
+                             size_t size)
+{
+   NetlinkModel *model;
+   NetlinkLink *link;
+
+   g_mutex_lock(&gModelLock);
+   model = NetlinkGetModel();
+   if (model == NULL) {
+      g_mutex_unlock(&gModelLock);
+      return FALSE;
+   }
+
+   link = g_hash_table_lookup(model->links, GINT_TO_POINTER(ifIndex));
+   g_strlcpy(ifName, link != NULL ? link->name : "", size);
+   g_mutex_unlock(&gModelLock);
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_LinkCacheGetHwAddr --                                       */ /**
+ *
+ * @brief Get the Ethernet address of an interface from the netlink model.
+ *
+ * @param[in]  ifIndex  Interface index.
+ * @param[out] mac      The address, if @a macLen is set.
+ * @param[out] macLen   6 if the interface is an Ethernet one with an
+ *                      address, 0 otherwise.
+ *
+ * @retval TRUE  Success.
+ * @retval FALSE Netlink is not usable, the caller must query the system.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfo_LinkCacheGetHwAddr(int ifIndex,
+                             uint8 mac[6],
+                             size_t *macLen)
+{
+   NetlinkModel *model;
+   NetlinkLink *link;
+
+   g_mutex_lock(&gModelLock);
+   model = NetlinkGetModel();
+   if (model == NULL) {
+      g_mutex_unlock(&gModelLock);
+      return FALSE;
+   }
+
+   link = g_hash_table_lookup(model->links, GINT_TO_POINTER(ifIndex));
+   *macLen = 0;
+   if (link != NULL && link->type == ARPHRD_ETHER && link->hasMac) {
+      memcpy(mac, link->mac, sizeof link->mac);
+      *macLen = sizeof link->mac;
+   }
+   g_mutex_unlock(&gModelLock);
+
+   return TRUE;
+}
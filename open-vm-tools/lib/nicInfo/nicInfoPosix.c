@@ -394,21 +394,25 @@ GuestInfoGetInterface(struct ifaddrs *ifaddrs,
 
 /*
  ******************************************************************************
- * GuestInfoGetNicInfo --                                                */ /**
+ * GuestInfoScanNicInfo --                                               */ /**
+ *
+ * @brief Gather the NICs and routes by scanning the interfaces and the
+ *        routing tables.
  *
  * @param[in]  maxIPv4Routes  Max IPv4 routes to gather.
  * @param[in]  maxIPv6Routes  Max IPv6 routes to gather.
  * @param[out] nicInfo        NicInfoV3 container.
  *
- * @copydoc GuestInfo_GetNicInfo
+ * @retval TRUE  Success.
+ * @retval FALSE Failure.
  *
  ******************************************************************************
  */
 
-Bool
-GuestInfoGetNicInfo(unsigned int maxIPv4Routes,
-                    unsigned int maxIPv6Routes,
-                    NicInfoV3 *nicInfo)
+static Bool
+GuestInfoScanNicInfo(unsigned int maxIPv4Routes,
+                     unsigned int maxIPv6Routes,
+                     NicInfoV3 *nicInfo)
 {
 #ifndef NO_DNET
    intf_t *intf;
@@ -486,6 +490,42 @@ GuestInfoGetNicInfo(unsigned int maxIPv4Routes,
 }
 
 
+/*
+ ******************************************************************************
+ * GuestInfoGetNicInfo --                                                */ /**
+ *
+ * @param[in]  maxIPv4Routes  Max IPv4 routes to gather.
+ * @param[in]  maxIPv6Routes  Max IPv6 routes to gather.
+ * @param[out] nicInfo        NicInfoV3 container.
+ *
+ * @copydoc GuestInfo_GetNicInfo
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfoGetNicInfo(unsigned int maxIPv4Routes,
+                    unsigned int maxIPv6Routes,
+                    NicInfoV3 *nicInfo)
+{
+#if defined(__linux__) && !defined(USERWORLD)
+   /*
+    * The netlink model saves rescanning the interfaces and routing tables;
+    * fall back to the scans if netlink cannot be used.
+    */
+   if (GuestInfoNetlinkGetNicInfo(maxIPv4Routes, maxIPv6Routes, nicInfo)) {
+#ifdef USE_RESOLVE
+      return RecordResolverInfo(nicInfo);
+#else
+      return TRUE;
+#endif
+   }
+#endif
+
+   return GuestInfoScanNicInfo(maxIPv4Routes, maxIPv6Routes, nicInfo);
+}
+
+
 /*
  ******************************************************************************
  * GuestInfoGetPrimaryIP --                                              */ /**
@@ -1339,6 +1379,8 @@ RecordRoutingInfoIPv4(unsigned int maxRoutes,
                       NicInfoV3 *nicInfo)
 {
    GPtrArray *routes = NULL;
+   const char *lastDev = NULL;
+   unsigned int lastIfIndex = 0;
    guint i;
    Bool ret = FALSE;
 
@@ -1365,9 +1407,13 @@ RecordRoutingInfoIPv4(unsigned int maxRoutes,
 
       rtentry = g_ptr_array_index(routes, i);
 
-      if (!GuestInfoGetNicInfoIfIndex(nicInfo,
-                                      if_nametoindex(rtentry->rt_dev),
-                                      &ifIndex)) {
+      /* Routes of an interface share their rt_dev. */
+      if (rtentry->rt_dev != lastDev) {
+         lastDev = rtentry->rt_dev;
+         lastIfIndex = if_nametoindex(lastDev);
+      }
+
+      if (!GuestInfoGetNicInfoIfIndex(nicInfo, lastIfIndex, &ifIndex)) {
          continue;
       }
 
@@ -113,6 +113,29 @@ Poll_InitWithImpl(const PollImpl *impl)
    pollImpl->Init();
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_IsInitialized --
+ *
+ *      Check whether a Poll implementation was installed.
+ *
+ * Results:
+ *      TRUE if Poll_InitWithImpl was called without a Poll_Exit since.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+Poll_IsInitialized(void)
+{
+   return pollImpl != NULL;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
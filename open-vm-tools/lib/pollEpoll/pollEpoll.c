@@ -0,0 +1,2368 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * pollEpoll.c -- a Poll implementation built on epoll (Linux) or kqueue
+ * (FreeBSD).
+ *
+ * pollGtk turns every callback into its own GSource, so each main loop
+ * iteration costs time linear in the number of registered fds and timers.
+ * Here all device callbacks share one kernel poll set and all timers
+ * share one timer wheel:
+ *
+ * - Device callbacks are kept in a hash table by fd. Every callback is
+ *   also kept in a hash table by (function, clientData, type, direction),
+ *   which is what Poll_CallbackRemove gets, so registering and removing a
+ *   callback does not depend on how many there are.
+ * - POLL_REALTIME and POLL_MAIN_LOOP callbacks sit in a hierarchical
+ *   timer wheel: 4 levels of 64 slots, the first with one millisecond
+ *   slots, each next one with slots as long as the whole level below.
+ *   A timer is linked in the slot of the lowest level covering its
+ *   expiry and moves down a level each time the wheel enters that slot,
+ *   so adding, removing and expiring a timer are O(1), and finding the
+ *   next expiry looks at one bitmap per level. Timers without a delay
+ *   are kept on their own list and fire on the next pass.
+ * - Timers may fire up to 1/16th of their delay late, rounded so that
+ *   timers of similar delays expire on the same tick and the process
+ *   wakes up once for all of them.
+ * - A callback whose lock is held by another thread is retried one tick
+ *   later. Its fd is taken out of the poll set meanwhile, as a ready fd
+ *   would otherwise wake the loop right away and spin until the lock is
+ *   dropped.
+ *
+ * The poll set is attached to the default GMainContext as a single
+ * GSource, so callbacks fire from the GLib main loop as they do with
+ * pollGtk. Poll_LoopTimeout works too, for programs without a main loop.
+ *
+ * As with pollGtk, any thread may register or remove callbacks. They fire
+ * on the thread dispatching the poll set, without the poll lock held.
+ *
+ * Besides the default loop, Poll_LoopCreate makes loops with their own
+ * poll set, timer wheel and lock, each run by one thread calling
+ * Poll_LoopRun, so that callbacks spread over several CPUs do not contend
+ * on a single poll lock.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/epoll.h>
+#else
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include <glib.h>
+
+#include "pollImpl.h"
+#include "mutexRankLib.h"
+#include "dbllnklst.h"
+#include "vm_atomic.h"
+#include "err.h"
+
+#define LOGLEVEL_MODULE poll
+#include "loglevel_user.h"
+
+#define POLL_EPOLL_MAX_EVENTS   64
+#define POLL_EPOLL_TICK_US      1000
+#define POLL_EPOLL_WHEEL_BITS   6
+#define POLL_EPOLL_WHEEL_SLOTS  (1 << POLL_EPOLL_WHEEL_BITS)
+#define POLL_EPOLL_WHEEL_MASK   (POLL_EPOLL_WHEEL_SLOTS - 1)
+#define POLL_EPOLL_WHEEL_LEVELS 4
+#define POLL_EPOLL_SLACK_SHIFT  4       /* Timers fire up to delay/16 late. */
+#define POLL_EPOLL_RETRY_US     POLL_EPOLL_TICK_US  /* Busy callback lock. */
+
+/* First tick of the level of a slot, and the range the wheel covers. */
+#define POLL_EPOLL_LEVEL_SHIFT(_l) ((_l) * POLL_EPOLL_WHEEL_BITS)
+#define POLL_EPOLL_WHEEL_RANGE \
+   (CONST64U(1) << POLL_EPOLL_LEVEL_SHIFT(POLL_EPOLL_WHEEL_LEVELS))
+
+
+/*
+ * What Poll_CallbackRemove identifies a callback by.
+ */
+typedef struct PollEpollKey {
+   PollerFunction cb;
+   void          *clientData;
+   PollEventType  type;
+   Bool           isWrite;
+} PollEpollKey;
+
+/*
+ * All callbacks sharing a key. There is usually one.
+ */
+typedef struct PollEpollBucket {
+   PollEpollKey    key;
+   DblLnkLst_Links entries;
+} PollEpollBucket;
+
+/*
+ * A single callback waiting for an event or a timeout.
+ */
+typedef struct PollEpollEntry {
+   PollEpollBucket *bucket;
+   DblLnkLst_Links  bucketLinks;
+   int              flags;
+   PollClassSet     classSet;
+   MXUserRecLock   *cbLock;
+   PollDevHandle    fd;          /* POLL_DEVICE */
+   VmTimeType       delay;       /* Timers, in microseconds. */
+   uint64           tick;        /* Timers, expiry tick. */
+   DblLnkLst_Links  wheelLinks;  /* Timers */
+} PollEpollEntry;
+
+/*
+ * The callbacks of one fd.
+ */
+typedef struct PollEpollDevice {
+   PollDevHandle   fd;
+   PollEpollEntry *read;
+   PollEpollEntry *write;
+   int             mask;         /* POLL_FLAG_READ/WRITE in the poll set. */
+   int             deferred;     /* POLL_FLAG_READ/WRITE left out of it... */
+   uint64          retryTick;    /* ... until that tick. */
+   DblLnkLst_Links deferLinks;   /* PollLoop.deferred */
+} PollEpollDevice;
+
+/*
+ * A ready fd returned by the kernel.
+ */
+typedef struct PollEpollEvent {
+   int fd;
+   int flags;                    /* POLL_FLAG_READ and/or POLL_FLAG_WRITE */
+} PollEpollEvent;
+
+/*
+ * What Poll_CallbackRemoveOneByCB looks for.
+ */
+typedef struct PollEpollFindData {
+   PollEpollKey   key;
+   int            flags;
+   PollClassSet   classSet;
+} PollEpollFindData;
+
+typedef struct PollEpollSource {
+   GSource src;
+   GPollFD pfd;
+} PollEpollSource;
+
+/*
+ * The state of a poll loop. The default loop runs from the GLib main loop,
+ * others from Poll_LoopRun.
+ */
+struct PollLoop {
+   MXUserExclLock  *lock;
+
+   int              pollFd;
+   int              wakeFds[2];
+   Bool             waiting;     /* Someone waits on pollFd... */
+   uint64           waitTick;    /* ... until that tick. */
+   Bool             wakePending;
+
+   GHashTable      *deviceTable; /* fd -> PollEpollDevice */
+   GHashTable      *keyTable;    /* PollEpollKey -> PollEpollBucket */
+
+   /*
+    * All ticks before wheelTick have run. The slots of every level which
+    * wheelTick is in have been moved down already. A bit set in occupied
+    * means the slot may hold timers; bits are cleared when the slot is
+    * run or moved down, not when timers are removed.
+    */
+   DblLnkLst_Links  immediate;
+   DblLnkLst_Links  wheel[POLL_EPOLL_WHEEL_LEVELS][POLL_EPOLL_WHEEL_SLOTS];
+   uint64           occupied[POLL_EPOLL_WHEEL_LEVELS];
+   uint64           wheelTick;
+   unsigned int     numTimers;
+
+   /* Devices deferred for a busy callback lock, by retryTick. */
+   DblLnkLst_Links  deferred;
+
+   MXUserRecLock   *cbLock;      /* Poll_LoopGetLock */
+   Bool             stop;        /* Poll_LoopStop */
+
+   GSource         *source;      /* Default loop */
+};
+
+/*
+ * A set of loops, each with its own thread.
+ */
+struct PollLoopGroup {
+   unsigned int     numLoops;
+   PollLoop       **loops;
+   GThread        **threads;
+   Atomic_uint32    nextPick;
+};
+
+static PollLoop *pollState;
+static GPrivate curLoop = G_PRIVATE_INIT(NULL); /* Loop in Poll_LoopRun */
+static volatile gsize inited = 0;
+
+static gboolean PollEpollSourcePrepare(GSource *src, gint *timeout);
+static gboolean PollEpollSourceCheck(GSource *src);
+static gboolean PollEpollSourceDispatch(GSource *src,
+                                        GSourceFunc callback,
+                                        gpointer data);
+
+#define ASSERT_POLL_LOCKED(_p)                                  \
+   ASSERT(MXUser_IsCurThreadHoldingExclLock((_p)->lock))
+
+#define LOG_ENTRY(_l, _str, _e)                                               \
+   LOG(_l, "POLL: entry %p (cb %p, data %p, flags %x, type %x)" _str,        \
+       (_e), (_e)->bucket->key.cb, (_e)->bucket->key.clientData,             \
+       (_e)->flags, (_e)->bucket->key.type)
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollLock --
+ * PollEpollUnlock --
+ *
+ *      Locking of the internal poll state.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static INLINE void
+PollEpollLock(PollLoop *poll)  // IN
+{
+   MXUser_AcquireExclLock(poll->lock);
+}
+
+
+static INLINE void
+PollEpollUnlock(PollLoop *poll)  // IN
+{
+   MXUser_ReleaseExclLock(poll->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollSetCloexec --
+ *
+ *      Set FD_CLOEXEC and optionally O_NONBLOCK on a fd.
+ *
+ * Results:
+ *      TRUE on success.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollSetCloexec(int fd,            // IN
+                    Bool nonBlocking)  // IN
+{
+   if (fcntl(fd, F_SETFD, FD_CLOEXEC) < 0) {
+      return FALSE;
+   }
+   if (nonBlocking) {
+      int flags = fcntl(fd, F_GETFL);
+
+      if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollBackendCreate --
+ *
+ *      Create the kernel poll set.
+ *
+ * Results:
+ *      The poll set fd, -1 on failure.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PollEpollBackendCreate(void)
+{
+   int fd;
+
+#if defined(__linux__)
+   fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+   fd = kqueue();
+   if (fd >= 0 && !PollEpollSetCloexec(fd, FALSE)) {
+      close(fd);
+      fd = -1;
+   }
+#endif
+   return fd;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollBackendSet --
+ *
+ *      Change the events the poll set waits for on a fd. A fd closed
+ *      without removing its callbacks has left the kernel poll set
+ *      already, and its number may have been reused since; both cases
+ *      are handled here.
+ *
+ * Results:
+ *      TRUE on success.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollBackendSet(int pollFd,   // IN
+                    int fd,       // IN
+                    int oldMask,  // IN: POLL_FLAG_READ/WRITE
+                    int newMask)  // IN: POLL_FLAG_READ/WRITE
+{
+#if defined(__linux__)
+   struct epoll_event ev;
+   int op;
+   int ret;
+
+   memset(&ev, 0, sizeof ev);
+   ev.data.fd = fd;
+   if (newMask & POLL_FLAG_READ) {
+      ev.events |= EPOLLIN | EPOLLPRI;
+   }
+   if (newMask & POLL_FLAG_WRITE) {
+      ev.events |= EPOLLOUT;
+   }
+
+   if (oldMask == 0) {
+      op = EPOLL_CTL_ADD;
+   } else if (newMask == 0) {
+      op = EPOLL_CTL_DEL;
+   } else {
+      op = EPOLL_CTL_MOD;
+   }
+
+   ret = epoll_ctl(pollFd, op, fd, &ev);
+   if (ret < 0 && op == EPOLL_CTL_MOD && errno == ENOENT) {
+      ret = epoll_ctl(pollFd, EPOLL_CTL_ADD, fd, &ev);
+   } else if (ret < 0 && op == EPOLL_CTL_ADD && errno == EEXIST) {
+      ret = epoll_ctl(pollFd, EPOLL_CTL_MOD, fd, &ev);
+   } else if (ret < 0 && op == EPOLL_CTL_DEL &&
+              (errno == ENOENT || errno == EBADF)) {
+      ret = 0;
+   }
+   if (ret < 0) {
+      LOG(0, "POLL: epoll_ctl(%d, fd %d) failed: %s\n", op, fd,
+          Err_Errno2String(errno));
+      return FALSE;
+   }
+   return TRUE;
+#else
+   static const struct {
+      int flag;
+      short filter;
+   } filters[] = {
+      { POLL_FLAG_READ,  EVFILT_READ },
+      { POLL_FLAG_WRITE, EVFILT_WRITE },
+   };
+   unsigned int i;
+
+   for (i = 0; i < ARRAYSIZE(filters); i++) {
+      struct kevent kev;
+      Bool add = (newMask & filters[i].flag) != 0;
+
+      if (add == ((oldMask & filters[i].flag) != 0)) {
+         continue;
+      }
+
+      EV_SET(&kev, fd, filters[i].filter, add ? EV_ADD : EV_DELETE,
+             0, 0, NULL);
+      if (kevent(pollFd, &kev, 1, NULL, 0, NULL) < 0 &&
+          (add || (errno != ENOENT && errno != EBADF))) {
+         LOG(0, "POLL: kevent(fd %d, filter %d) failed: %s\n", fd,
+             filters[i].filter, Err_Errno2String(errno));
+         return FALSE;
+      }
+   }
+   return TRUE;
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollBackendWait --
+ *
+ *      Wait for fds of the poll set to become ready.
+ *
+ * Results:
+ *      Number of events returned, 0 on timeout or error.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PollEpollBackendWait(int pollFd,              // IN
+                     PollEpollEvent *events,  // OUT
+                     int maxEvents,           // IN
+                     int timeoutMs)           // IN: -1 for none
+{
+   int n;
+   int i;
+#if defined(__linux__)
+   struct epoll_event evs[POLL_EPOLL_MAX_EVENTS];
+
+   ASSERT(maxEvents <= POLL_EPOLL_MAX_EVENTS);
+   n = epoll_wait(pollFd, evs, maxEvents, timeoutMs);
+   for (i = 0; i < n; i++) {
+      events[i].fd = evs[i].data.fd;
+      events[i].flags = 0;
+      if (evs[i].events & (EPOLLIN | EPOLLPRI | EPOLLERR | EPOLLHUP)) {
+         events[i].flags |= POLL_FLAG_READ;
+      }
+      if (evs[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+         events[i].flags |= POLL_FLAG_WRITE;
+      }
+   }
+#else
+   struct kevent evs[POLL_EPOLL_MAX_EVENTS];
+   struct timespec ts;
+
+   ASSERT(maxEvents <= POLL_EPOLL_MAX_EVENTS);
+   if (timeoutMs >= 0) {
+      ts.tv_sec = timeoutMs / 1000;
+      ts.tv_nsec = (timeoutMs % 1000) * 1000000;
+   }
+   n = kevent(pollFd, NULL, 0, evs, maxEvents, timeoutMs >= 0 ? &ts : NULL);
+   for (i = 0; i < n; i++) {
+      events[i].fd = evs[i].ident;
+      events[i].flags = evs[i].filter == EVFILT_WRITE ? POLL_FLAG_WRITE
+                                                      : POLL_FLAG_READ;
+   }
+#endif
+
+   if (n < 0) {
+      if (errno != EINTR) {
+         LOG(0, "POLL: wait failed: %s\n", Err_Errno2String(errno));
+      }
+      n = 0;
+   }
+   return n;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollWakeup --
+ *
+ *      Wake up whoever waits on the poll set, so it sees a timer that
+ *      expires earlier than what it sleeps for.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollWakeup(PollLoop *poll)  // IN
+{
+   char c = 0;
+
+   ASSERT_POLL_LOCKED(poll);
+   if (poll->waiting && !poll->wakePending) {
+      poll->wakePending = TRUE;
+      if (write(poll->wakeFds[1], &c, 1) < 0 && errno != EAGAIN) {
+         LOG(0, "POLL: cannot wake up the poll loop: %s\n",
+             Err_Errno2String(errno));
+      }
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollKeyHash --
+ * PollEpollKeyEqual --
+ *
+ *      Hash table functions for PollEpollKey.
+ *
+ * Results:
+ *      The hash, whether the keys are equal.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static guint
+PollEpollKeyHash(gconstpointer data)  // IN
+{
+   const PollEpollKey *key = data;
+   uintptr_t h = (uintptr_t)key->cb * 31 + (uintptr_t)key->clientData;
+
+   h = h * 31 + (uintptr_t)key->type * 2 + key->isWrite;
+   return (guint)(h ^ (h >> 17));
+}
+
+
+static gboolean
+PollEpollKeyEqual(gconstpointer a,  // IN
+                  gconstpointer b)  // IN
+{
+   const PollEpollKey *ka = a;
+   const PollEpollKey *kb = b;
+
+   return ka->cb == kb->cb && ka->clientData == kb->clientData &&
+          ka->type == kb->type && ka->isWrite == kb->isWrite;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollTimerLink --
+ *
+ *      Link a timer in the wheel slot for its expiry tick: on the lowest
+ *      level whose current slot range the tick shares with wheelTick
+ *      one level up, so that the slot is moved down before the tick
+ *      runs. Timers beyond the range of the wheel are parked in the top
+ *      level slot reached last and linked again from there.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollTimerLink(PollLoop *poll,         // IN
+                   PollEpollEntry *entry)  // IN
+{
+   uint64 tick = MAX(entry->tick, poll->wheelTick);
+   unsigned int level = 0;
+   unsigned int idx;
+
+   ASSERT_POLL_LOCKED(poll);
+   ASSERT(!DblLnkLst_IsLinked(&entry->wheelLinks));
+
+   if (tick != poll->wheelTick) {
+      level = mssb64_0(tick ^ poll->wheelTick) / POLL_EPOLL_WHEEL_BITS;
+   }
+   if (level < POLL_EPOLL_WHEEL_LEVELS) {
+      idx = (tick >> POLL_EPOLL_LEVEL_SHIFT(level)) & POLL_EPOLL_WHEEL_MASK;
+   } else {
+      uint64 top = tick >> POLL_EPOLL_LEVEL_SHIFT(POLL_EPOLL_WHEEL_LEVELS - 1);
+      uint64 cur = poll->wheelTick >>
+                   POLL_EPOLL_LEVEL_SHIFT(POLL_EPOLL_WHEEL_LEVELS - 1);
+
+      level = POLL_EPOLL_WHEEL_LEVELS - 1;
+      if (top - cur >= POLL_EPOLL_WHEEL_SLOTS) {
+         top = cur - 1;
+      }
+      idx = top & POLL_EPOLL_WHEEL_MASK;
+   }
+
+   DblLnkLst_LinkLast(&poll->wheel[level][idx], &entry->wheelLinks);
+   poll->occupied[level] |= CONST64U(1) << idx;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollTimerArm --
+ *
+ *      Arm a timer to expire after the given delay. Timers with no delay
+ *      go to the immediate list. Others have their expiry tick rounded
+ *      up to a multiple of the largest power of 2 under 1/16th of the
+ *      delay, so that timers due at about the same time share a tick.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      May wake up the poll loop.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollTimerArm(PollLoop *poll,         // IN
+                  PollEpollEntry *entry,  // IN
+                  VmTimeType now,         // IN
+                  VmTimeType delay)       // IN: microseconds
+{
+   uint64 slack;
+   uint64 tick;
+
+   ASSERT_POLL_LOCKED(poll);
+
+   if (delay == 0) {
+      entry->tick = poll->wheelTick;
+      DblLnkLst_LinkLast(&poll->immediate, &entry->wheelLinks);
+      PollEpollWakeup(poll);
+      return;
+   }
+
+   tick = (now + delay + POLL_EPOLL_TICK_US - 1) / POLL_EPOLL_TICK_US;
+   slack = (delay / POLL_EPOLL_TICK_US) >> POLL_EPOLL_SLACK_SHIFT;
+   if (slack > 0) {
+      uint64 grain = CONST64U(1) << mssb64_0(slack);
+
+      tick = (tick + grain - 1) & ~(grain - 1);
+   }
+   entry->tick = tick;
+   PollEpollTimerLink(poll, entry);
+
+   if (poll->waiting && tick < poll->waitTick) {
+      PollEpollWakeup(poll);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollNextTick --
+ *
+ *      Find the next tick at which the wheel has work: one whose level 0
+ *      slot holds timers, or the first tick of a higher level slot
+ *      holding timers. The occupied bitmaps are rotated so that the
+ *      slots following the current one come first.
+ *
+ * Results:
+ *      The tick, MAX_UINT64 if there are no timers on the wheel. As
+ *      removed timers do not clear the bitmaps, it may be too early.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint64
+PollEpollNextTick(PollLoop *poll)  // IN
+{
+   uint64 next = MAX_UINT64;
+   unsigned int level;
+   uint64 bits;
+
+   ASSERT_POLL_LOCKED(poll);
+   if (poll->numTimers == 0) {
+      return next;
+   }
+
+   bits = poll->occupied[0] >> (poll->wheelTick & POLL_EPOLL_WHEEL_MASK);
+   if (bits != 0) {
+      return poll->wheelTick + lssb64_0(bits);
+   }
+
+   for (level = 1; level < POLL_EPOLL_WHEEL_LEVELS; level++) {
+      unsigned int shift = POLL_EPOLL_LEVEL_SHIFT(level);
+      uint64 cur = poll->wheelTick >> shift;
+      unsigned int rot = (cur + 1) & POLL_EPOLL_WHEEL_MASK;
+
+      bits = poll->occupied[level];
+      bits = (bits >> rot) | (bits << ((POLL_EPOLL_WHEEL_SLOTS - rot) &
+                                        POLL_EPOLL_WHEEL_MASK));
+      if (bits != 0) {
+         next = MIN(next, (cur + lssb64_0(bits) + 1) << shift);
+      }
+   }
+   return next;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollTimerSetTick --
+ *
+ *      Move the wheel to a tick, moving down the slots of the levels
+ *      the tick starts a slot of. The slots of any tick skipped must be
+ *      empty.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollTimerSetTick(PollLoop *poll,  // IN
+                      uint64 tick)     // IN
+{
+   int level;
+
+   ASSERT_POLL_LOCKED(poll);
+   ASSERT(tick >= poll->wheelTick);
+
+   poll->wheelTick = tick;
+
+   /* From the top, timers moved down may land in the next slot to move. */
+   for (level = POLL_EPOLL_WHEEL_LEVELS - 1; level > 0; level--) {
+      unsigned int shift = POLL_EPOLL_LEVEL_SHIFT(level);
+      unsigned int idx = (tick >> shift) & POLL_EPOLL_WHEEL_MASK;
+      uint64 bit = CONST64U(1) << idx;
+      DblLnkLst_Links pending;
+
+      if ((tick & ((CONST64U(1) << shift) - 1)) != 0 ||
+          (poll->occupied[level] & bit) == 0) {
+         continue;
+      }
+
+      poll->occupied[level] &= ~bit;
+      DblLnkLst_Init(&pending);
+      DblLnkLst_Swap(&pending, &poll->wheel[level][idx]);
+      while (DblLnkLst_IsLinked(&pending)) {
+         PollEpollEntry *entry = DblLnkLst_Container(pending.next,
+                                                     PollEpollEntry,
+                                                     wheelLinks);
+
+         DblLnkLst_Unlink1(&entry->wheelLinks);
+         PollEpollTimerLink(poll, entry);
+      }
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollTimerAdvance --
+ *
+ *      Run the wheel up to a tick, moving the timers due to a list. Only
+ *      the slots holding timers are visited.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      wheelTick is past nowTick.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollTimerAdvance(PollLoop *poll,             // IN
+                      uint64 nowTick,            // IN
+                      DblLnkLst_Links *expired)  // IN/OUT
+{
+
+   ASSERT_POLL_LOCKED(poll);
+
+   while (poll->wheelTick <= nowTick) {
+      unsigned int idx = poll->wheelTick & POLL_EPOLL_WHEEL_MASK;
+      DblLnkLst_Links *slot = &poll->wheel[0][idx];
+
+      if (DblLnkLst_IsLinked(slot)) {
+         DblLnkLst_Links *first = slot->next;
+
+         DblLnkLst_Unlink1(slot);
+         DblLnkLst_Link(expired, first);
+      }
+      poll->occupied[0] &= ~(CONST64U(1) << idx);
+
+      PollEpollTimerSetTick(poll, MIN(PollEpollNextTick(poll), nowTick + 1));
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollDeviceUpdate --
+ *
+ *      Make the poll set wait for the callbacks of a device, and forget
+ *      the device once it has none.
+ *
+ * Results:
+ *      TRUE on success.
+ *
+ * Side effects:
+ *      May free the device.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollDeviceUpdate(PollLoop *poll,        // IN
+                      PollEpollDevice *dev)  // IN
+{
+   int cbMask = (dev->read != NULL ? POLL_FLAG_READ : 0) |
+                (dev->write != NULL ? POLL_FLAG_WRITE : 0);
+   int newMask;
+   Bool ok = TRUE;
+
+   ASSERT_POLL_LOCKED(poll);
+   dev->deferred &= cbMask;
+   if (dev->deferred == 0 && DblLnkLst_IsLinked(&dev->deferLinks)) {
+      DblLnkLst_Unlink1(&dev->deferLinks);
+   }
+
+   newMask = cbMask & ~dev->deferred;
+   if (newMask != dev->mask) {
+      ok = PollEpollBackendSet(poll->pollFd, dev->fd, dev->mask, newMask);
+      if (ok || newMask == 0) {
+         dev->mask = newMask;
+      }
+   }
+   if (cbMask == 0) {
+      g_hash_table_remove(poll->deviceTable, (gpointer)(intptr_t)dev->fd);
+   }
+   return ok;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollDeviceDefer --
+ *
+ *      Leave a callback of a device out of the poll set until the next
+ *      tick, because its lock is busy.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollDeviceDefer(PollLoop *poll,        // IN
+                     PollEpollDevice *dev,  // IN
+                     int flag)              // IN: POLL_FLAG_READ/WRITE
+{
+   ASSERT_POLL_LOCKED(poll);
+
+   /* All devices wait for the same time, so the list stays sorted. */
+   if (dev->deferred == 0) {
+      dev->retryTick = (g_get_monotonic_time() + POLL_EPOLL_RETRY_US +
+                        POLL_EPOLL_TICK_US - 1) / POLL_EPOLL_TICK_US;
+      DblLnkLst_LinkLast(&poll->deferred, &dev->deferLinks);
+   }
+   dev->deferred |= flag;
+   PollEpollDeviceUpdate(poll, dev);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollDeviceRetry --
+ *
+ *      Put the devices deferred until a tick back in the poll set.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollDeviceRetry(PollLoop *poll,  // IN
+                     uint64 nowTick)  // IN
+{
+   ASSERT_POLL_LOCKED(poll);
+
+   while (DblLnkLst_IsLinked(&poll->deferred)) {
+      PollEpollDevice *dev = DblLnkLst_Container(poll->deferred.next,
+                                                 PollEpollDevice,
+                                                 deferLinks);
+
+      if (dev->retryTick > nowTick) {
+         break;
+      }
+      DblLnkLst_Unlink1(&dev->deferLinks);
+      dev->deferred = 0;
+      PollEpollDeviceUpdate(poll, dev);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollNextWork --
+ *
+ *      Find the next tick at which the loop has work: a timer, or a
+ *      deferred device to put back in the poll set.
+ *
+ * Results:
+ *      The tick, MAX_UINT64 if none. See PollEpollNextTick.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint64
+PollEpollNextWork(PollLoop *poll)  // IN
+{
+   uint64 next = PollEpollNextTick(poll);
+
+   if (DblLnkLst_IsLinked(&poll->deferred)) {
+      PollEpollDevice *dev = DblLnkLst_Container(poll->deferred.next,
+                                                 PollEpollDevice,
+                                                 deferLinks);
+
+      next = MIN(next, dev->retryTick);
+   }
+   return next;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollEntryFree --
+ *
+ *      Unregister and free a callback.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollEntryFree(PollLoop *poll,         // IN
+                   PollEpollEntry *entry)  // IN
+{
+   PollEpollBucket *bucket = entry->bucket;
+
+   ASSERT_POLL_LOCKED(poll);
+   LOG_ENTRY(2, " to be removed\n", entry);
+
+   if (bucket->key.type == POLL_DEVICE) {
+      PollEpollDevice *dev = g_hash_table_lookup(poll->deviceTable,
+                                                 (gpointer)(intptr_t)entry->fd);
+
+      ASSERT(dev != NULL);
+      if (dev != NULL) {
+         if (dev->read == entry) {
+            dev->read = NULL;
+         } else if (dev->write == entry) {
+            dev->write = NULL;
+         }
+         PollEpollDeviceUpdate(poll, dev);
+      }
+   } else {
+      DblLnkLst_Unlink1(&entry->wheelLinks);
+      poll->numTimers--;
+   }
+
+   DblLnkLst_Unlink1(&entry->bucketLinks);
+   if (!DblLnkLst_IsLinked(&bucket->entries)) {
+      g_hash_table_remove(poll->keyTable, &bucket->key);
+   }
+   g_free(entry);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollBucketFind --
+ *
+ *      Look for a callback with the given flags and class set in a bucket.
+ *
+ * Results:
+ *      The callback, NULL if none.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static PollEpollEntry *
+PollEpollBucketFind(const PollEpollBucket *bucket,  // IN
+                    int flags,                      // IN
+                    PollClassSet classSet)          // IN
+{
+   DblLnkLst_Links *cur;
+
+   DblLnkLst_ForEach(cur, &bucket->entries) {
+      PollEpollEntry *entry = DblLnkLst_Container(cur, PollEpollEntry,
+                                                  bucketLinks);
+
+      if (entry->flags == flags &&
+          PollClassSet_Equals(entry->classSet, classSet)) {
+         return entry;
+      }
+   }
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollFindByCBPredicate --
+ *
+ *      Predicate usable by GHashTable iteration functions to find a
+ *      bucket holding a callback for the given function, whatever its
+ *      client data.
+ *
+ * Results:
+ *      TRUE if the bucket matches our search criteria, FALSE otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static gboolean
+PollEpollFindByCBPredicate(gpointer key,   // IN
+                           gpointer value, // IN: PollEpollBucket
+                           gpointer data)  // IN: PollEpollFindData
+{
+   const PollEpollBucket *bucket = value;
+   const PollEpollFindData *search = data;
+
+   return bucket->key.cb == search->key.cb &&
+          bucket->key.type == search->key.type &&
+          bucket->key.isWrite == search->key.isWrite &&
+          PollEpollBucketFind(bucket, search->flags, search->classSet) != NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollLoopNew --
+ *
+ *      Create the state of a poll loop.
+ *
+ * Results:
+ *      The loop, NULL if the poll set cannot be created.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static PollLoop *
+PollEpollLoopNew(void)
+{
+   PollLoop *poll = g_new0(PollLoop, 1);
+   unsigned int i;
+
+   poll->pollFd = PollEpollBackendCreate();
+   if (poll->pollFd < 0) {
+      LOG(0, "POLL: cannot create the poll set: %s\n", Err_Errno2String(errno));
+      g_free(poll);
+      return NULL;
+   }
+   if (pipe(poll->wakeFds) < 0) {
+      LOG(0, "POLL: cannot create the wakeup pipe: %s\n",
+          Err_Errno2String(errno));
+      close(poll->pollFd);
+      g_free(poll);
+      return NULL;
+   }
+   if (!PollEpollSetCloexec(poll->wakeFds[0], TRUE) ||
+       !PollEpollSetCloexec(poll->wakeFds[1], TRUE) ||
+       !PollEpollBackendSet(poll->pollFd, poll->wakeFds[0], 0,
+                            POLL_FLAG_READ)) {
+      close(poll->wakeFds[0]);
+      close(poll->wakeFds[1]);
+      close(poll->pollFd);
+      g_free(poll);
+      return NULL;
+   }
+
+   poll->lock = MXUser_CreateExclLock("pollEpollLock", RANK_pollDefaultLock);
+   poll->deviceTable = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                             NULL, g_free);
+   poll->keyTable = g_hash_table_new_full(PollEpollKeyHash, PollEpollKeyEqual,
+                                          NULL, g_free);
+   DblLnkLst_Init(&poll->immediate);
+   DblLnkLst_Init(&poll->deferred);
+   for (i = 0; i < POLL_EPOLL_WHEEL_LEVELS; i++) {
+      unsigned int j;
+
+      for (j = 0; j < POLL_EPOLL_WHEEL_SLOTS; j++) {
+         DblLnkLst_Init(&poll->wheel[i][j]);
+      }
+   }
+   poll->wheelTick = g_get_monotonic_time() / POLL_EPOLL_TICK_US;
+
+   return poll;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollLoopFree --
+ *
+ *      Discard the state of a poll loop, and the callbacks left in it.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollLoopFree(PollLoop *poll)  // IN
+{
+   GHashTableIter iter;
+   gpointer value;
+
+   PollEpollLock(poll);
+   g_hash_table_iter_init(&iter, poll->keyTable);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      PollEpollBucket *bucket = value;
+      DblLnkLst_Links *cur;
+      DblLnkLst_Links *next;
+
+      DblLnkLst_ForEachSafe(cur, next, &bucket->entries) {
+         g_free(DblLnkLst_Container(cur, PollEpollEntry, bucketLinks));
+      }
+   }
+   g_hash_table_destroy(poll->keyTable);
+   g_hash_table_destroy(poll->deviceTable);
+   close(poll->wakeFds[0]);
+   close(poll->wakeFds[1]);
+   close(poll->pollFd);
+   PollEpollUnlock(poll);
+
+   MXUser_DestroyExclLock(poll->lock);
+   if (poll->cbLock != NULL) {
+      MXUser_DestroyRecLock(poll->cbLock);
+   }
+   g_free(poll);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollInit --
+ *
+ *      Module initialization.
+ *
+ * Results:
+ *       None
+ *
+ * Side effects:
+ *       Initializes the default loop and sets pollState.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollInit(void)
+{
+   static GSourceFuncs srcFuncs = {
+      PollEpollSourcePrepare,
+      PollEpollSourceCheck,
+      PollEpollSourceDispatch,
+      NULL,
+   };
+   PollEpollSource *src;
+
+   ASSERT(pollState == NULL);
+   pollState = PollEpollLoopNew();
+   if (pollState == NULL) {
+      Panic("POLL: cannot create the default poll loop\n");
+   }
+
+   src = (PollEpollSource *)g_source_new(&srcFuncs, sizeof *src);
+   src->pfd.fd = pollState->pollFd;
+   src->pfd.events = G_IO_IN;
+   g_source_add_poll(&src->src, &src->pfd);
+   g_source_attach(&src->src, NULL);
+   pollState->source = &src->src;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollExit --
+ *
+ *      Module exit.
+ *
+ * Results:
+ *       None
+ *
+ * Side effects:
+ *       Discards the default loop and clears pollState.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollExit(void)
+{
+   ASSERT(pollState != NULL);
+
+   g_source_destroy(pollState->source);
+   g_source_unref(pollState->source);
+   PollEpollLoopFree(pollState);
+   pollState = NULL;
+   inited = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollPrepare --
+ *
+ *      Compute how long the poll set may be waited on, and flag that
+ *      someone waits on it.
+ *
+ * Results:
+ *      The timeout in milliseconds, -1 for none.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+PollEpollPrepare(PollLoop *poll,      // IN
+                 VmTimeType maxWait)  // IN: microseconds, -1 for none
+{
+   VmTimeType now = g_get_monotonic_time();
+   VmTimeType wait = maxWait;
+   uint64 next;
+
+   PollEpollLock(poll);
+   if (poll->stop || DblLnkLst_IsLinked(&poll->immediate)) {
+      wait = 0;
+   } else if ((next = PollEpollNextWork(poll)) != MAX_UINT64) {
+      wait = MAX((VmTimeType)(next * POLL_EPOLL_TICK_US) - now, 0);
+      if (maxWait >= 0) {
+         wait = MIN(wait, maxWait);
+      }
+   }
+   poll->waiting = wait != 0;
+   poll->waitTick = wait < 0 ? MAX_UINT64 : (now + wait) / POLL_EPOLL_TICK_US;
+   PollEpollUnlock(poll);
+
+   if (wait < 0) {
+      return -1;
+   }
+   return (int)MIN((wait + 999) / 1000, G_MAXINT);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollFireDevice --
+ *
+ *      Fire the read or write callback of a ready fd.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Drops the poll lock around the callback. A non-periodic
+ *      callback is removed before it fires, in case it re-registers.
+ *      A callback whose lock is busy is deferred to the next tick.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollFireDevice(PollLoop *poll,  // IN
+                    int fd,          // IN
+                    Bool isWrite)  // IN
+{
+   PollEpollDevice *dev;
+   PollEpollEntry *entry;
+   PollerFunction cb;
+   void *clientData;
+   MXUserRecLock *cbLock;
+
+   ASSERT_POLL_LOCKED(poll);
+   dev = g_hash_table_lookup(poll->deviceTable, (gpointer)(intptr_t)fd);
+   entry = dev == NULL ? NULL : isWrite ? dev->write : dev->read;
+   if (entry == NULL) {
+      return;
+   }
+
+   cbLock = entry->cbLock;
+   if (cbLock != NULL && !MXUser_TryAcquireRecLock(cbLock)) {
+      /* The fd is still ready, keep it from waking the loop meanwhile. */
+      LOG_ENTRY(3, " did not fire, deferred\n", entry);
+      PollEpollDeviceDefer(poll, dev,
+                           isWrite ? POLL_FLAG_WRITE : POLL_FLAG_READ);
+      return;
+   }
+
+   LOG_ENTRY(3, " about to fire\n", entry);
+   cb = entry->bucket->key.cb;
+   clientData = entry->bucket->key.clientData;
+   if (!(entry->flags & POLL_FLAG_PERIODIC)) {
+      PollEpollEntryFree(poll, entry);
+   }
+
+   PollEpollUnlock(poll);
+   cb(clientData);
+   if (cbLock != NULL) {
+      MXUser_ReleaseRecLock(cbLock);
+   }
+   PollEpollLock(poll);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollFireTimers --
+ *
+ *      Fire the immediate and the expired timers. Timers armed while
+ *      firing, including periodic ones re-armed with no delay, wait for
+ *      the next pass. Timers whose lock is busy are retried a tick later.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Drops the poll lock around each callback.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollFireTimers(PollLoop *poll)  // IN
+{
+   VmTimeType now = g_get_monotonic_time();
+   DblLnkLst_Links expired;
+
+   ASSERT_POLL_LOCKED(poll);
+
+   /* Removing a timer unlinks it from expired too. */
+   DblLnkLst_Init(&expired);
+   DblLnkLst_Swap(&expired, &poll->immediate);
+   PollEpollTimerAdvance(poll, now / POLL_EPOLL_TICK_US, &expired);
+
+   while (DblLnkLst_IsLinked(&expired)) {
+      PollEpollEntry *entry = DblLnkLst_Container(expired.next,
+                                                  PollEpollEntry,
+                                                  wheelLinks);
+      PollerFunction cb;
+      void *clientData;
+      MXUserRecLock *cbLock;
+
+      DblLnkLst_Unlink1(&entry->wheelLinks);
+      cbLock = entry->cbLock;
+      if (cbLock != NULL && !MXUser_TryAcquireRecLock(cbLock)) {
+         LOG_ENTRY(3, " did not fire, retrying\n", entry);
+         PollEpollTimerArm(poll, entry, now, POLL_EPOLL_RETRY_US);
+         continue;
+      }
+
+      LOG_ENTRY(3, " about to fire\n", entry);
+      cb = entry->bucket->key.cb;
+      clientData = entry->bucket->key.clientData;
+      if (entry->flags & POLL_FLAG_PERIODIC) {
+         PollEpollTimerArm(poll, entry, now, entry->delay);
+      } else {
+         PollEpollEntryFree(poll, entry);
+      }
+
+      PollEpollUnlock(poll);
+      cb(clientData);
+      if (cbLock != NULL) {
+         MXUser_ReleaseRecLock(cbLock);
+      }
+      PollEpollLock(poll);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollDispatch --
+ *
+ *      Wait for the poll set, then fire the callbacks of ready fds and
+ *      of expired timers.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Callbacks fire.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollDispatch(PollLoop *poll,  // IN
+                  int timeoutMs)   // IN: -1 for none
+{
+   PollEpollEvent events[POLL_EPOLL_MAX_EVENTS];
+   int n;
+   int i;
+
+   n = PollEpollBackendWait(poll->pollFd, events, ARRAYSIZE(events),
+                            timeoutMs);
+
+   PollEpollLock(poll);
+   poll->waiting = FALSE;
+   for (i = 0; i < n; i++) {
+      if (events[i].fd == poll->wakeFds[0]) {
+         char buf[16];
+
+         while (read(poll->wakeFds[0], buf, sizeof buf) > 0) {
+         }
+         poll->wakePending = FALSE;
+         continue;
+      }
+      if (events[i].flags & POLL_FLAG_READ) {
+         PollEpollFireDevice(poll, events[i].fd, FALSE);
+      }
+      if (events[i].flags & POLL_FLAG_WRITE) {
+         PollEpollFireDevice(poll, events[i].fd, TRUE);
+      }
+   }
+   PollEpollDeviceRetry(poll, g_get_monotonic_time() / POLL_EPOLL_TICK_US);
+   PollEpollFireTimers(poll);
+   PollEpollUnlock(poll);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollSourcePrepare --
+ * PollEpollSourceCheck --
+ * PollEpollSourceDispatch --
+ *
+ *      GSource functions running the poll set from the GLib main loop.
+ *
+ * Results:
+ *      Whether the source is ready, TRUE to keep it.
+ *
+ * Side effects:
+ *      Dispatch fires callbacks.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static gboolean
+PollEpollSourcePrepare(GSource *src,   // IN
+                       gint *timeout)  // OUT
+{
+   *timeout = PollEpollPrepare(pollState, -1);
+   return *timeout == 0;
+}
+
+
+static gboolean
+PollEpollSourceCheck(GSource *src)  // IN
+{
+   PollEpollSource *epSrc = (PollEpollSource *)src;
+   PollLoop *poll = pollState;
+   Bool ready;
+
+   PollEpollLock(poll);
+   poll->waiting = FALSE;
+   ready = (epSrc->pfd.revents & G_IO_IN) != 0 ||
+           DblLnkLst_IsLinked(&poll->immediate) ||
+           PollEpollNextWork(poll) <= g_get_monotonic_time() / POLL_EPOLL_TICK_US;
+   PollEpollUnlock(poll);
+   return ready;
+}
+
+
+static gboolean
+PollEpollSourceDispatch(GSource *src,         // IN
+                        GSourceFunc callback, // IN: unused
+                        gpointer data)        // IN: unused
+{
+   PollEpollDispatch(pollState, 0);
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollLoopTimeout --
+ *
+ *       The poll loop, for programs which do not run a GLib main loop.
+ *       All callbacks are in POLL_CLASS_MAIN, the class is not used.
+ *
+ * Result:
+ *       Void.
+ *
+ * Side effects:
+ *       Callbacks fire.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+PollEpollLoopTimeout(Bool loop,          // IN: loop forever if TRUE, else do one pass.
+                     Bool *exit,         // IN: NULL or set to TRUE to end loop.
+                     PollClass class,    // IN: class of events (POLL_CLASS_*)
+                     int timeout)        // IN: maximum time to sleep (us)
+{
+   do {
+      PollEpollDispatch(pollState, PollEpollPrepare(pollState, timeout));
+   } while (loop && (exit == NULL || !*exit));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollCallbackRemoveInt --
+ *
+ *      Remove a callback.
+ *
+ * Results:
+ *      TRUE if entry found and removed, FALSE otherwise
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollCallbackRemoveInt(PollLoop *poll,                  // IN
+                           PollClassSet classSet,           // IN
+                           int flags,                       // IN
+                           PollerFunction f,                // IN
+                           void *clientData,                // IN
+                           Bool matchAnyClientData,         // IN
+                           PollEventType type,              // IN
+                           void **foundClientData)          // OUT
+{
+   PollEpollFindData search;
+   PollEpollBucket *bucket;
+   PollEpollEntry *foundEntry = NULL;
+
+   ASSERT(poll);
+   ASSERT(!clientData || !matchAnyClientData);
+   ASSERT(foundClientData);
+
+   switch (type) {
+   case POLL_REALTIME:
+   case POLL_MAIN_LOOP:
+   case POLL_DEVICE:
+      break;
+   case POLL_VIRTUALREALTIME:
+   case POLL_VTIME:
+   default:
+      NOT_IMPLEMENTED();
+   }
+
+   search.key.cb = f;
+   search.key.clientData = clientData;
+   search.key.type = type;
+   search.key.isWrite = type == POLL_DEVICE && (flags & POLL_FLAG_WRITE) != 0;
+   search.flags = flags;
+   search.classSet = classSet;
+
+   PollEpollLock(poll);
+
+   if (matchAnyClientData) {
+      /*
+       * Only Poll_CallbackRemoveOneByCB gets here; it does not know the
+       * client data, so every bucket has to be looked at.
+       */
+      bucket = g_hash_table_find(poll->keyTable, PollEpollFindByCBPredicate,
+                                 &search);
+   } else {
+      bucket = g_hash_table_lookup(poll->keyTable, &search.key);
+   }
+
+   if (bucket != NULL) {
+      foundEntry = PollEpollBucketFind(bucket, flags, classSet);
+   }
+   if (foundEntry != NULL) {
+      *foundClientData = bucket->key.clientData;
+      PollEpollEntryFree(poll, foundEntry);
+   } else {
+      LOG(1, "POLL: no matching entry for cb %p, data %p, flags %x, type %x\n",
+          f, clientData, flags, type);
+   }
+
+   PollEpollUnlock(poll);
+   return foundEntry != NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollCallbackRemove --
+ *
+ *      Remove a callback.
+ *
+ * Results:
+ *      TRUE if entry found and removed, FALSE otherwise
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollCallbackRemove(PollClassSet classSet,   // IN
+                        int flags,               // IN
+                        PollerFunction f,        // IN
+                        void *clientData,        // IN
+                        PollEventType type)      // IN
+{
+   void *foundClientData;
+
+   return PollEpollCallbackRemoveInt(pollState, classSet, flags, f,
+                                     clientData, FALSE, type,
+                                     &foundClientData);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollCallbackRemoveOneByCB --
+ *
+ *      Remove a callback.
+ *
+ * Results:
+ *      TRUE if entry found and removed (*clientData updated), FALSE otherwise
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+PollEpollCallbackRemoveOneByCB(PollClassSet classSet,   // IN
+                               int flags,               // IN
+                               PollerFunction f,        // IN
+                               PollEventType type,      // IN
+                               void **clientData)       // OUT
+{
+   return PollEpollCallbackRemoveInt(pollState, classSet, flags, f, NULL,
+                                     TRUE, type, clientData);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollCallbackInt --
+ *
+ *      For the POLL_REALTIME or POLL_DEVICE queues, entries can be
+ *      inserted for good, to fire on a periodic basis (by setting the
+ *      POLL_FLAG_PERIODIC flag).
+ *
+ *      Otherwise, the callback fires only once.
+ *
+ *      For periodic POLL_REALTIME callbacks, "info" is the time in
+ *      microseconds between execution of the callback.  For
+ *      POLL_DEVICE callbacks, info is a file descriptor.
+ *
+ * Results:
+ *      VMWARE_STATUS_SUCCESS, VMWARE_STATUS_ERROR if the fd cannot be
+ *      added to the poll set.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static VMwareStatus
+PollEpollCallbackInt(PollLoop *poll,          // IN
+                     PollClassSet classSet,   // IN
+                     int flags,               // IN
+                     PollerFunction f,        // IN
+                     void *clientData,        // IN
+                     PollEventType type,      // IN
+                     PollDevHandle info,      // IN
+                     MXUserRecLock *lock)     // IN
+{
+   PollEpollEntry *newEntry;
+   PollEpollBucket *bucket;
+   PollEpollKey key;
+
+   ASSERT(f);
+   ASSERT(poll != NULL);
+
+   /*
+    * Every callback must be in POLL_CLASS_MAIN (plus possibly others)
+    */
+   ASSERT(PollClassSet_IsMember(classSet, POLL_CLASS_MAIN) != 0);
+
+   newEntry = g_new0(PollEpollEntry, 1);
+   newEntry->flags = flags;
+   newEntry->classSet = classSet;
+   newEntry->cbLock = lock;
+   DblLnkLst_Init(&newEntry->bucketLinks);
+   DblLnkLst_Init(&newEntry->wheelLinks);
+
+   key.cb = f;
+   key.clientData = clientData;
+   key.type = type;
+   key.isWrite = type == POLL_DEVICE && (flags & POLL_FLAG_WRITE) != 0;
+
+   PollEpollLock(poll);
+
+   bucket = g_hash_table_lookup(poll->keyTable, &key);
+   if (bucket == NULL) {
+      bucket = g_new0(PollEpollBucket, 1);
+      bucket->key = key;
+      DblLnkLst_Init(&bucket->entries);
+      g_hash_table_insert(poll->keyTable, &bucket->key, bucket);
+   }
+   newEntry->bucket = bucket;
+   DblLnkLst_LinkLast(&bucket->entries, &newEntry->bucketLinks);
+   LOG_ENTRY(2, " is being added\n", newEntry);
+
+   switch (type) {
+   case POLL_MAIN_LOOP:
+      ASSERT(info == 0);
+      /* Fall-through */
+   case POLL_REALTIME:
+      ASSERT(info >= 0);
+      newEntry->delay = info;
+      poll->numTimers++;
+      PollEpollTimerArm(poll, newEntry, g_get_monotonic_time(), info);
+      break;
+
+   case POLL_DEVICE: {
+      PollEpollDevice *dev = g_hash_table_lookup(poll->deviceTable,
+                                                 (gpointer)(intptr_t)info);
+      PollEpollEntry **slot;
+
+      if (dev == NULL) {
+         dev = g_new0(PollEpollDevice, 1);
+         dev->fd = info;
+         DblLnkLst_Init(&dev->deferLinks);
+         g_hash_table_insert(poll->deviceTable, (gpointer)(intptr_t)info, dev);
+      }
+
+      /* There is at most one read and one write callback per fd. */
+      slot = key.isWrite ? &dev->write : &dev->read;
+      ASSERT(*slot == NULL);
+      newEntry->fd = info;
+      if (*slot == NULL) {
+         *slot = newEntry;
+         if (!PollEpollDeviceUpdate(poll, dev)) {
+            *slot = NULL;
+            PollEpollDeviceUpdate(poll, dev);
+         }
+      }
+      if (*slot != newEntry) {
+         LOG_ENTRY(0, " cannot be added\n", newEntry);
+         DblLnkLst_Unlink1(&newEntry->bucketLinks);
+         if (!DblLnkLst_IsLinked(&bucket->entries)) {
+            g_hash_table_remove(poll->keyTable, &bucket->key);
+         }
+         g_free(newEntry);
+         PollEpollUnlock(poll);
+         return VMWARE_STATUS_ERROR;
+      }
+      break;
+   }
+
+   case POLL_VIRTUALREALTIME:
+   case POLL_VTIME:
+   default:
+      NOT_IMPLEMENTED();
+   }
+
+   PollEpollUnlock(poll);
+
+   return VMWARE_STATUS_SUCCESS;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollCallback --
+ *
+ *      Register a callback in the default loop.
+ *
+ * Results:
+ *      See PollEpollCallbackInt.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static VMwareStatus
+PollEpollCallback(PollClassSet classSet,   // IN
+                  int flags,               // IN
+                  PollerFunction f,        // IN
+                  void *clientData,        // IN
+                  PollEventType type,      // IN
+                  PollDevHandle info,      // IN
+                  MXUserRecLock *lock)     // IN
+{
+   return PollEpollCallbackInt(pollState, classSet, flags, f, clientData,
+                               type, info, lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * PollEpollNotifyChange --
+ *
+ *      Wake up the poll loop.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static void
+PollEpollNotifyChange(PollClassSet classSet)  // IN: unused
+{
+   PollLoop *poll = pollState;
+
+   PollEpollLock(poll);
+   PollEpollWakeup(poll);
+   PollEpollUnlock(poll);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Poll_InitEpoll --
+ *
+ *      Public init function for this Poll implementation. Poll loop will be
+ *      up and running after this is called.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Poll_InitEpoll(void)
+{
+   static const PollImpl epollImpl =
+   {
+      PollEpollInit,
+      PollEpollExit,
+      PollEpollLoopTimeout,
+      PollEpollCallback,
+      PollEpollCallbackRemove,
+      PollEpollCallbackRemoveOneByCB,
+      PollLockingAlwaysEnabled,
+      PollEpollNotifyChange,
+   };
+
+   if (g_once_init_enter(&inited)) {
+      gsize didInit = 1;
+      Poll_InitWithImpl(&epollImpl);
+      g_once_init_leave(&inited, didInit);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopCreate --
+ *
+ *      Create a poll loop, independent from the default one.
+ *
+ * Results:
+ *      The loop, NULL on failure.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+PollLoop *
+Poll_LoopCreate(void)
+{
+   PollLoop *poll = PollEpollLoopNew();
+
+   if (poll != NULL) {
+      poll->cbLock = MXUser_CreateRecLock("pollLoopCbLock",
+                                          RANK_pollLoopCbLock);
+   }
+   return poll;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopDestroy --
+ *
+ *      Destroy a poll loop created by Poll_LoopCreate. No thread may be
+ *      running it.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Callbacks left in the loop are dropped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Poll_LoopDestroy(PollLoop *loop)  // IN
+{
+   ASSERT(loop != pollState);
+   PollEpollLoopFree(loop);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopRun --
+ *
+ *      Dispatch a poll loop until Poll_LoopStop.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Callbacks fire on the calling thread.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Poll_LoopRun(PollLoop *loop)  // IN
+{
+   ASSERT(loop != pollState);
+   ASSERT(g_private_get(&curLoop) == NULL);
+
+   g_private_set(&curLoop, loop);
+   PollEpollLock(loop);
+   while (!loop->stop) {
+      PollEpollUnlock(loop);
+      PollEpollDispatch(loop, PollEpollPrepare(loop, -1));
+      PollEpollLock(loop);
+   }
+   loop->stop = FALSE;
+   PollEpollUnlock(loop);
+   g_private_set(&curLoop, NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopStop --
+ *
+ *      Make Poll_LoopRun return once the callbacks firing are done.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Poll_LoopStop(PollLoop *loop)  // IN
+{
+   PollEpollLock(loop);
+   loop->stop = TRUE;
+   PollEpollWakeup(loop);
+   PollEpollUnlock(loop);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGetCurrent --
+ *
+ *      The loop the calling thread runs.
+ *
+ * Results:
+ *      The loop, NULL outside Poll_LoopRun.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+PollLoop *
+Poll_LoopGetCurrent(void)
+{
+   return g_private_get(&curLoop);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGetLock --
+ *
+ *      A lock owned by the loop, for callbacks that only run on the loop
+ *      but whose state other threads may touch too.
+ *
+ * Results:
+ *      The lock.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+MXUserRecLock *
+Poll_LoopGetLock(PollLoop *loop)  // IN
+{
+   return loop->cbLock;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGetLoad --
+ *
+ *      How many devices the loop waits for.
+ *
+ * Results:
+ *      The number of devices.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+unsigned int
+Poll_LoopGetLoad(PollLoop *loop)  // IN
+{
+   unsigned int load;
+
+   PollEpollLock(loop);
+   load = g_hash_table_size(loop->deviceTable);
+   PollEpollUnlock(loop);
+   return load;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopCallback --
+ * Poll_LoopCallbackRemove --
+ *
+ *      Poll_Callback and Poll_CallbackRemove for a given loop.
+ *
+ * Results:
+ *      See Poll_Callback and Poll_CallbackRemove.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+VMwareStatus
+Poll_LoopCallback(PollLoop *loop,          // IN
+                  PollClassSet classSet,   // IN
+                  int flags,               // IN
+                  PollerFunction f,        // IN
+                  void *clientData,        // IN
+                  PollEventType type,      // IN
+                  PollDevHandle info,      // IN
+                  MXUserRecLock *lock)     // IN
+{
+   return PollEpollCallbackInt(loop, classSet, flags, f, clientData, type,
+                               info, lock);
+}
+
+
+Bool
+Poll_LoopCallbackRemove(PollLoop *loop,          // IN
+                        PollClassSet classSet,   // IN
+                        int flags,               // IN
+                        PollerFunction f,        // IN
+                        void *clientData,        // IN
+                        PollEventType type)      // IN
+{
+   void *foundClientData;
+
+   return PollEpollCallbackRemoveInt(loop, classSet, flags, f, clientData,
+                                     FALSE, type, &foundClientData);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PollEpollGroupThread --
+ *
+ *      Thread running one loop of a group.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static gpointer
+PollEpollGroupThread(gpointer data)  // IN: PollLoop
+{
+   Poll_LoopRun(data);
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGroupCreate --
+ *
+ *      Create loops and a thread running each.
+ *
+ * Results:
+ *      The group, NULL on failure.
+ *
+ * Side effects:
+ *      Starts threads named <name>-<index>.
+ *
+ *----------------------------------------------------------------------
+ */
+
+PollLoopGroup *
+Poll_LoopGroupCreate(const char *name,       // IN
+                     unsigned int numLoops)  // IN: 0 for one per CPU
+{
+   PollLoopGroup *group = g_new0(PollLoopGroup, 1);
+   unsigned int i;
+
+   if (numLoops == 0) {
+      numLoops = MAX(g_get_num_processors(), 1);
+   }
+   group->loops = g_new0(PollLoop *, numLoops);
+   group->threads = g_new0(GThread *, numLoops);
+
+   for (i = 0; i < numLoops; i++) {
+      gchar *threadName;
+
+      group->loops[i] = Poll_LoopCreate();
+      if (group->loops[i] == NULL) {
+         break;
+      }
+      threadName = g_strdup_printf("%s-%u", name, i);
+      group->threads[i] = g_thread_new(threadName, PollEpollGroupThread,
+                                       group->loops[i]);
+      g_free(threadName);
+      group->numLoops++;
+   }
+
+   if (group->numLoops < numLoops) {
+      Poll_LoopGroupDestroy(group);
+      return NULL;
+   }
+   return group;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGroupDestroy --
+ *
+ *      Stop the threads of a group and destroy its loops.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Callbacks left in the loops are dropped.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+Poll_LoopGroupDestroy(PollLoopGroup *group)  // IN
+{
+   unsigned int i;
+
+   for (i = 0; i < group->numLoops; i++) {
+      Poll_LoopStop(group->loops[i]);
+   }
+   for (i = 0; i < group->numLoops; i++) {
+      g_thread_join(group->threads[i]);
+      Poll_LoopDestroy(group->loops[i]);
+   }
+   g_free(group->threads);
+   g_free(group->loops);
+   g_free(group);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGroupSize --
+ * Poll_LoopGroupGet --
+ *
+ *      Accessors for the loops of a group.
+ *
+ * Results:
+ *      The number of loops, the loop at an index.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+unsigned int
+Poll_LoopGroupSize(const PollLoopGroup *group)  // IN
+{
+   return group->numLoops;
+}
+
+
+PollLoop *
+Poll_LoopGroupGet(const PollLoopGroup *group,  // IN
+                  unsigned int i)              // IN
+{
+   ASSERT(i < group->numLoops);
+   return group->loops[i];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Poll_LoopGroupPick --
+ *
+ *      Pick the loop of a group with the fewest devices, for a new
+ *      connection. Each call starts looking at the next loop, so equally
+ *      loaded loops take turns.
+ *
+ * Results:
+ *      The loop.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+PollLoop *
+Poll_LoopGroupPick(PollLoopGroup *group)  // IN
+{
+   unsigned int start = Atomic_ReadInc32(&group->nextPick);
+   PollLoop *best = NULL;
+   unsigned int bestLoad = MAX_UINT32;
+   unsigned int i;
+
+   for (i = 0; i < group->numLoops; i++) {
+      PollLoop *loop = group->loops[(start + i) % group->numLoops];
+      unsigned int load = Poll_LoopGetLoad(loop);
+
+      if (load < bestLoad) {
+         best = loop;
+         bestLoad = load;
+      }
+   }
+   return best;
+}
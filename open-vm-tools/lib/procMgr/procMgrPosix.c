@@ -117,7 +117,9 @@ struct ProcMgr_AsyncProc {
 
 static pid_t ProcMgrStartProcess(char const *cmd,
                                  char * const  *envp,
-                                 char const *workingDir);
+                                 char const *workingDir,
+                                 int stdoutFd,
+                                 int stderrFd);
 
 static Bool ProcMgrWaitForProcCompletion(pid_t pid,
                                          Bool *validExitCode,
@@ -225,56 +227,227 @@ done:
 }
 
 
+/*
+ * An entry's strings are kept in a single buffer per list. While the list
+ * is built, the buffer moves as it grows, so the string pointers of the
+ * entries hold their offset + 1 (0 for NULL) until the end.
+ */
+typedef struct ProcMgrProcList {
+   ProcMgrProcInfoArray array;   // Must be first, this is what is returned
+   char *strings;
+} ProcMgrProcList;
+
+typedef struct ProcMgrOwner {
+   uid_t uid;
+   char *name;                  // Offset, as above
+} ProcMgrOwner;
+
+typedef struct ProcMgrScan {
+   unsigned int fields;         // PROCMGR_INFO_*
+   DynBuf buf;                  // Contents of the file read last
+   DynBuf strings;
+   ProcMgrOwner owners[32];     // Cache of the owner names
+   unsigned int numOwners;
+} ProcMgrScan;
+
+#define PROCMGR_STRING_OFFSET(str)  ((char *) (uintptr_t) (str))
+
+
 /*
  *----------------------------------------------------------------------
  *
- * ProcMgr_ListProcesses --
+ * ProcMgrReadAt --
  *
- *      List all the processes that the calling client has privilege to
- *      enumerate. The strings in the returned structure should be all
- *      UTF-8 encoded, although we do not enforce it right now.
+ *    Read the contents of a file in /proc/<pid> into the scan buffer,
+ *    NUL terminated.
  *
  * Results:
  *
- *      A ProcMgrProcInfoArray.
+ *    The length of the file.
+ *
+ *    -1 on error.
  *
  * Side effects:
  *
+ *    None.
+ *
  *----------------------------------------------------------------------
  */
 
-ProcMgrProcInfoArray *
-ProcMgr_ListProcesses(void)
+static ssize_t
+ProcMgrReadAt(ProcMgrScan *scan,   // IN/OUT
+              int pidFd,           // IN
+              const char *name)    // IN
 {
-   ProcMgrProcInfoArray *procList = NULL;
-   ProcMgrProcInfo procInfo;
-   Bool failed = TRUE;
-   DIR *dir;
-   struct dirent *ent;
-   static time_t hostStartTime = 0;
-   static unsigned long long hertz = 100;
-   int numberFound;
+   size_t size = 0;
+   int fd;
 
-   procList = Util_SafeCalloc(1, sizeof *procList);
-   ProcMgrProcInfoArray_Init(procList, 0);
-   procInfo.procCmdName = NULL;
-   procInfo.procCmdAbsPath = NULL;
-   procInfo.procCmdLine = NULL;
-   procInfo.procOwner = NULL;
+   fd = openat(pidFd, name, O_RDONLY | O_CLOEXEC);
+   if (fd == -1) {
+      return -1;
+   }
+
+   for (;;) {
+      ssize_t numRead;
+
+      if (DynBuf_GetAllocatedSize(&scan->buf) - size < 512) {
+         DynBuf_SafeEnlarge(&scan->buf, size + 512);
+      }
+      numRead = read(fd, (char *) DynBuf_Get(&scan->buf) + size,
+                     DynBuf_GetAllocatedSize(&scan->buf) - size - 1);
+      if (numRead < 0 && errno == EINTR) {
+         continue;
+      }
+      if (numRead < 0) {
+         close(fd);
+         return -1;
+      }
+      if (numRead == 0) {
+         break;
+      }
+      size += numRead;
+   }
+   close(fd);
+
+   ((char *) DynBuf_Get(&scan->buf))[size] = '\0';
+   return size;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrAddString --
+ *
+ *    Convert a string from the current encoding to UTF-8 and append it
+ *    to the strings of the list.
+ *
+ * Results:
+ *
+ *    The offset + 1 of the string, 0 if it could not be converted.
+ *
+ * Side effects:
+ *
+ *    None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+ProcMgrAddString(ProcMgrScan *scan,   // IN/OUT
+                 const char *str,     // IN
+                 size_t len)          // IN
+{
+   size_t offset = DynBuf_GetSize(&scan->strings) + 1;
+   size_t i;
+
+   for (i = 0; i < len && (unsigned char) str[i] < 0x80; i++) {
+   }
+
+   if (i == len) {
+      /* The common case: ASCII needs no conversion. */
+      DynBuf_SafeAppend(&scan->strings, str, len);
+   } else {
+      char *utf8 = Unicode_AllocWithLength(str, len, STRING_ENCODING_DEFAULT);
+
+      if (utf8 == NULL) {
+         return NULL;
+      }
+      DynBuf_SafeAppend(&scan->strings, utf8, strlen(utf8));
+      free(utf8);
+   }
+   DynBuf_SafeAppend(&scan->strings, "", 1);
+
+   return PROCMGR_STRING_OFFSET(offset);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrGetOwner --
+ *
+ *    Get the name of the owner of a process, or its uid if it has no
+ *    name.
+ *
+ * Results:
+ *
+ *    The offset + 1 of the name.
+ *
+ * Side effects:
+ *
+ *    None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+ProcMgrGetOwner(ProcMgrScan *scan,   // IN/OUT
+                uid_t uid)           // IN
+{
+   struct passwd *pwd;
+   char uidStr[16];
+   char *name;
+   unsigned int i;
+
+   /* Few users own most processes, and getpwuid() can be slow. */
+   for (i = 0; i < scan->numOwners; i++) {
+      if (scan->owners[i].uid == uid) {
+         return scan->owners[i].name;
+      }
+   }
+
+   pwd = getpwuid(uid);
+   if (pwd != NULL) {
+      name = ProcMgrAddString(scan, pwd->pw_name, strlen(pwd->pw_name));
+   } else {
+      Str_Sprintf(uidStr, sizeof uidStr, "%d", (int) uid);
+      name = ProcMgrAddString(scan, uidStr, strlen(uidStr));
+   }
+
+   if (scan->numOwners < ARRAYSIZE(scan->owners)) {
+      scan->owners[scan->numOwners].uid = uid;
+      scan->owners[scan->numOwners].name = name;
+      scan->numOwners++;
+   }
+   return name;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrGetHostStartTime --
+ *
+ *      Figure out when the system started.  We need this number to
+ *      compute process start times, which are relative to this number.
+ *      We grab the first float in /proc/uptime, convert it to an integer,
+ *      and then subtract that from the current time.  That leaves us
+ *      with the seconds since epoch that the system booted up.
+ *
+ * Results:
+ *
+ *      The boot time, 0 if unknown.
+ *
+ * Side effects:
+ *
+ *      /proc/uptime is only read once.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static time_t
+ProcMgrGetHostStartTime(void)
+{
+   static time_t hostStartTime = 0;
 
-   /*
-    * Figure out when the system started.  We need this number to
-    * compute process start times, which are relative to this number.
-    * We grab the first float in /proc/uptime, convert it to an integer,
-    * and then subtract that from the current time.  That leaves us
-    * with the seconds since epoch that the system booted up.
-    */
    if (0 == hostStartTime) {
       FILE *uptimeFile = fopen("/proc/uptime", "r");
       if (NULL != uptimeFile) {
          double secondsSinceBoot;
          char *realLocale;
          char *savedLocale;
+         int numberFound;
 
          /*
           * Set the locale such that floats are delimited with ".".
@@ -298,21 +471,257 @@ ProcMgr_ListProcesses(void)
          }
          fclose(uptimeFile);
       }
+   }
 
+   return hostStartTime;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrReadCmdLine --
+ *
+ *      Read the command name, absolute path and command line of a process.
+ *
+ *      Arguments are separated by \0, which we convert to ' '.  Example:
+ *      "perl\0-cw\0try.pl\0" is reported as "perl -cw try.pl".  It would
+ *      have been nice to preserve the NUL character so it is easy to
+ *      determine what the command line arguments are without using a
+ *      quote and space parsing heuristic.  But we do this to have parity
+ *      with how Windows reports the command line.
+ *
+ * Results:
+ *
+ *      FALSE if the command line could not be read.
+ *
+ * Side effects:
+ *
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+ProcMgrReadCmdLine(ProcMgrScan *scan,          // IN/OUT
+                   int pidFd,                  // IN
+                   ProcMgrProcInfo *procInfo)  // IN/OUT
+{
+   ssize_t numRead;
+   char *cmdLine;
+   ssize_t i;
+
+   if ((scan->fields & PROCMGR_INFO_ABSPATH) != 0) {
+      char exeRealPath[1024];
+      ssize_t exeLen;
+
+      exeLen = readlinkat(pidFd, "exe", exeRealPath, sizeof exeRealPath - 1);
+      if (exeLen != -1) {
+         procInfo->procCmdAbsPath = ProcMgrAddString(scan, exeRealPath,
+                                                     exeLen);
+      }
+   }
+
+   numRead = ProcMgrReadAt(scan, pidFd, "cmdline");
+   if (numRead < 0) {
+      return FALSE;
+   }
+   cmdLine = DynBuf_Get(&scan->buf);
+
+   if (numRead > 0) {
       /*
-       * Figure out the "hertz" value, which may be radically
-       * different than the actual CPU frequency of the machine.
-       * The process start time is expressed in terms of this value,
-       * so let's compute it now and keep it in a static variable.
+       * Store the command name.
+       * Find the last path separator, to get the cmd name.
+       * If no separator is found, then use the whole name.
+       * This needs to be done only if there is an absolute
+       * path for the binary. Else, the parsing may result
+       * in incorrect results. Following are few examples:
+       *
+       *   sshd: root@pts/1
+       *   gdm-session-worker [pam/gdm-autologin]
+       *
        */
-#ifdef HZ
-      hertz = (unsigned long long) HZ;
-#else
+      if ((scan->fields & PROCMGR_INFO_CMDNAME) != 0) {
+         char *cmdNameBegin = strrchr(cmdLine, '/');
+
+         if (NULL != cmdNameBegin && cmdLine[0] == '/') {
+            cmdNameBegin++;
+         } else {
+            cmdNameBegin = cmdLine;
+         }
+         procInfo->procCmdName = ProcMgrAddString(scan, cmdNameBegin,
+                                                  strlen(cmdNameBegin));
+      }
+      if ((scan->fields & PROCMGR_INFO_ABSPATH) != 0 &&
+          procInfo->procCmdAbsPath == NULL && cmdLine[0] == '/') {
+         procInfo->procCmdAbsPath = ProcMgrAddString(scan, cmdLine,
+                                                     strlen(cmdLine));
+      }
+
       /*
-       * Don't do anything.  Use the default value of 100.
+       * Replace only the intermediate '\0' with ' ', then chop off the
+       * trailing whitespace characters.
        */
+      for (i = 0; i < numRead - 1; i++) {
+         if (cmdLine[i] == '\0') {
+            cmdLine[i] = ' ';
+         }
+      }
+   } else {
+      /*
+       * Some procs don't have a command line text, so read a name from
+       * the 'status' file (should be the first line). The format looks
+       * like this:
+       *     "^Name:[ \t]*(.*)$"
+       * for example:
+       *     "Name:    nfsd"
+       * If unable to get a name, the process is still real, so it should
+       * be included in the list, just without a name.
+       */
+      numRead = ProcMgrReadAt(scan, pidFd, "status");
+      if (numRead <= 0) {
+         cmdLine = "";
+      } else {
+         cmdLine = DynBuf_Get(&scan->buf);
+         cmdLine += strcspn(cmdLine, " \t\n");
+         cmdLine += strspn(cmdLine, " \t\n");
+         cmdLine[strcspn(cmdLine, "\n")] = '\0';
+
+         if ((scan->fields & PROCMGR_INFO_CMDNAME) != 0) {
+            procInfo->procCmdName = ProcMgrAddString(scan, cmdLine,
+                                                     strlen(cmdLine));
+         }
+         if ((scan->fields & PROCMGR_INFO_ABSPATH) != 0 &&
+             procInfo->procCmdAbsPath == NULL && cmdLine[0] == '/') {
+            procInfo->procCmdAbsPath = ProcMgrAddString(scan, cmdLine,
+                                                        strlen(cmdLine));
+         }
+      }
+   }
+
+   if ((scan->fields & PROCMGR_INFO_CMDLINE) != 0) {
+      for (i = strlen(cmdLine); i > 0 && cmdLine[i - 1] == ' '; i--) {
+      }
+      procInfo->procCmdLine = ProcMgrAddString(scan, cmdLine, i);
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgrReadStartTime --
+ *
+ *      Figure out the process start time, from the 22nd field of
+ *      /proc/<pid>/stat.
+ *
+ * Results:
+ *
+ *      FALSE if the start time could not be read.
+ *
+ * Side effects:
+ *
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+ProcMgrReadStartTime(ProcMgrScan *scan,          // IN/OUT
+                     int pidFd,                  // IN
+                     ProcMgrProcInfo *procInfo)  // IN/OUT
+{
+   /*
+    * Figure out the "hertz" value, which may be radically
+    * different than the actual CPU frequency of the machine.
+    * The process start time is expressed in terms of this value.
+    */
+#ifdef HZ
+   unsigned long long hertz = (unsigned long long) HZ;
+#else
+   unsigned long long hertz = 100;
 #endif
-   } // if (0 == hostStartTime)
+   unsigned long long relativeStartTime;
+   char *field;
+   char *end;
+   int i;
+
+   if (ProcMgrReadAt(scan, pidFd, "stat") <= 0) {
+      return FALSE;
+   }
+
+   /*
+    * Skip over the process id and name, "123 (bash) S [...]". The name may
+    * contain parentheses and spaces, but not the ") " before the state.
+    */
+   field = strrchr(DynBuf_Get(&scan->buf), ')');
+   if (field == NULL) {
+      return FALSE;
+   }
+   field++;
+
+   /* Skip the state and the 18 fields after it. */
+   for (i = 0; i < 19; i++) {
+      field += strspn(field, " ");
+      field += strcspn(field, " ");
+   }
+
+   relativeStartTime = strtoull(field, &end, 10);
+   if (end == field) {
+      return FALSE;
+   }
+
+   procInfo->procStartTime = ProcMgrGetHostStartTime() +
+                             (relativeStartTime / hertz);
+   return TRUE;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgr_ListProcessesSelect --
+ *
+ *      List all the processes that the calling client has privilege to
+ *      enumerate, only filling in the requested fields. The strings in
+ *      the returned structure should be all UTF-8 encoded, although we do
+ *      not enforce it right now.
+ *
+ *      The files of each process are opened relative to its /proc
+ *      directory, read into a buffer shared by all of them, and the
+ *      strings of all the processes are allocated together.
+ *
+ * Results:
+ *
+ *      A ProcMgrProcInfoArray.
+ *
+ * Side effects:
+ *
+ *----------------------------------------------------------------------
+ */
+
+ProcMgrProcInfoArray *
+ProcMgr_ListProcessesSelect(unsigned int fields)  // IN: PROCMGR_INFO_*
+{
+   ProcMgrProcList *list;
+   ProcMgrProcInfoArray *procList;
+   ProcMgrScan scan;
+   Bool failed = TRUE;
+   DIR *dir;
+   struct dirent *ent;
+   size_t procCount;
+   size_t i;
+
+   list = Util_SafeCalloc(1, sizeof *list);
+   procList = &list->array;
+   ProcMgrProcInfoArray_Init(procList, 0);
+
+   memset(&scan, 0, sizeof scan);
+   scan.fields = fields;
+   DynBuf_Init(&scan.buf);
+   DynBuf_Init(&scan.strings);
 
    /*
     * Scan /proc for any directory that is all numbers.
@@ -325,20 +734,9 @@ ProcMgr_ListProcesses(void)
    }
 
    while ((ent = readdir(dir))) {
+      ProcMgrProcInfo procInfo;
       struct stat fileStat;
-      char cmdFilePath[1024];
-      int statResult;
-      int numRead = 0;   /* number of bytes that read() actually read */
-      int cmdFd;
-      int replaceLoop;
-      struct passwd *pwd;
-      char *cmdLineTemp = NULL;
-      char *cmdStatTemp = NULL;
-      size_t strLen = 0;
-      unsigned long long dummy;
-      unsigned long long relativeStartTime;
-      char *stringBegin;
-      Bool cmdNameLookup = TRUE;
+      int pidFd;
 
       /*
        * We only care about dirs that look like processes.
@@ -347,302 +745,61 @@ ProcMgr_ListProcesses(void)
          continue;
       }
 
-      if (snprintf(cmdFilePath,
-                   sizeof cmdFilePath,
-                   "/proc/%s/cmdline",
-                   ent->d_name) == -1) {
-         Debug("Giant process id '%s'\n", ent->d_name);
-         continue;
-      }
-
-      cmdFd = open(cmdFilePath, O_RDONLY);
-      if (-1 == cmdFd) {
+      pidFd = openat(dirfd(dir), ent->d_name,
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (-1 == pidFd) {
          /*
-          * We may not be able to open the file due to the security reason.
-          * In that case, just ignore and continue.
+          * We may not be able to open the directory due to the security
+          * reason, or the process exited. In that case, just ignore and
+          * continue.
           */
          continue;
       }
 
-      /*
-       * Read in the command and its arguments.  Arguments are separated
-       * by \0, which we convert to ' '.  Then we add a NULL terminator
-       * at the end.  Example: "perl -cw try.pl" is read in as
-       * "perl\0-cw\0try.pl\0", which we convert to "perl -cw try.pl\0".
-       * It would have been nice to preserve the NUL character so it is easy
-       * to determine what the command line arguments are without
-       * using a quote and space parsing heuristic.  But we do this
-       * to have parity with how Windows reports the command line.
-       * In the future, we could keep the NUL version around and pass it
-       * back to the client for easier parsing when retrieving individual
-       * command line parameters is needed.
-       */
-      numRead = ProcMgr_ReadProcFile(cmdFd, &cmdLineTemp);
-      close(cmdFd);
+      memset(&procInfo, 0, sizeof procInfo);
+      procInfo.procId = (pid_t) atoi(ent->d_name);
 
-      if (numRead < 0) {
+      if ((fields & (PROCMGR_INFO_CMDNAME | PROCMGR_INFO_ABSPATH |
+                     PROCMGR_INFO_CMDLINE)) != 0 &&
+          !ProcMgrReadCmdLine(&scan, pidFd, &procInfo)) {
+         close(pidFd);
          continue;
       }
 
-      if (snprintf(cmdFilePath,
-                   sizeof cmdFilePath,
-                   "/proc/%s/exe",
-                   ent->d_name) != -1) {
-         int exeLen;
-         char exeRealPath[1024];
-
-         /*
-          * This readlink() call on the "exe" file of the current /proc
-          * entry is not intended as a check on the subsequent open() of
-          * the "status" file of that entry, hence no time-of-check to
-          * time-of-use issue.
-          */
-         /* coverity[fs_check_call] */
-         exeLen = readlink(cmdFilePath, exeRealPath, sizeof exeRealPath -1);
-         if (exeLen != -1) {
-            exeRealPath[exeLen] = '\0';
-            procInfo.procCmdAbsPath =
-               Unicode_Alloc(exeRealPath, STRING_ENCODING_DEFAULT);
-         }
-      }
-
-      if (numRead > 0) {
-         for (replaceLoop = 0 ; replaceLoop < numRead ; replaceLoop++) {
-            if ('\0' == cmdLineTemp[replaceLoop] ||
-                replaceLoop == numRead - 1) {
-               if (cmdNameLookup) {
-                  /*
-                   * Store the command name.
-                   * Find the last path separator, to get the cmd name.
-                   * If no separator is found, then use the whole name.
-                   * This needs to be done only if there is an absolute
-                   * path for the binary. Else, the parsing may result
-                   * in incorrect results. Following are few examples:
-                   *
-                   *   sshd: root@pts/1
-                   *   gdm-session-worker [pam/gdm-autologin]
-                   *
-                   */
-                  char *cmdNameBegin = strrchr(cmdLineTemp, '/');
-                  if (NULL != cmdNameBegin && cmdLineTemp[0] == '/') {
-                     /*
-                      * Skip over the last separator.
-                      */
-                     cmdNameBegin++;
-                  } else {
-                     cmdNameBegin = cmdLineTemp;
-                  }
-                  procInfo.procCmdName = Unicode_Alloc(cmdNameBegin, STRING_ENCODING_DEFAULT);
-                  if (procInfo.procCmdAbsPath == NULL &&
-                      cmdLineTemp[0] == '/') {
-                     procInfo.procCmdAbsPath =
-                        Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
-                  }
-                  cmdNameLookup = FALSE;
-               }
-
-               /*
-                * In /proc/{PID}/cmdline file, the command and the
-                * arguments are separated by '\0'. We need to replace
-                * only the intermediate '\0' with ' ' and not the trailing
-                * NUL characer.
-                */
-               if (replaceLoop < (numRead - 1)) {
-                  cmdLineTemp[replaceLoop] = ' ';
-               }
-            }
-         }
-      } else {
-         /*
-          * Some procs don't have a command line text, so read a name from
-          * the 'status' file (should be the first line). If unable to get a name,
-          * the process is still real, so it should be included in the list, just
-          * without a name.
-          */
-         cmdFd = -1;
-         numRead = 0;
-
-         if (snprintf(cmdFilePath,
-                      sizeof cmdFilePath,
-                      "/proc/%s/status",
-                      ent->d_name) != -1) {
-            cmdFd = open(cmdFilePath, O_RDONLY);
-         }
-         if (cmdFd != -1) {
-            numRead = ProcMgr_ReadProcFile(cmdFd, &cmdLineTemp);
-            close(cmdFd);
-         }
-         if (numRead > 0) {
-            /*
-             * Extract the part with just the name, by reading until the first
-             * space, then reading the next non-space word after that, and
-             * ignoring everything else. The format looks like this:
-             *     "^Name:[ \t]*(.*)$"
-             * for example:
-             *     "Name:    nfsd"
-             */
-            const char *nameStart;
-            char *copyItr;
-
-            /* Skip non-whitespace. */
-            for (nameStart = cmdLineTemp; *nameStart &&
-                                          *nameStart != ' ' &&
-                                          *nameStart != '\t' &&
-                                          *nameStart != '\n'; ++nameStart);
-            /* Skip whitespace. */
-            for (;*nameStart &&
-                  (*nameStart == ' ' ||
-                   *nameStart == '\t' ||
-                   *nameStart == '\n'); ++nameStart);
-            /* Copy the name to the start of the string and null term it. */
-            for (copyItr = cmdLineTemp; *nameStart && *nameStart != '\n';) {
-               *(copyItr++) = *(nameStart++);
-            }
-            *copyItr = '\0';
-            /*
-             * Store the command name.
-             */
-            procInfo.procCmdName = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
-            if (procInfo.procCmdAbsPath == NULL &&
-                cmdLineTemp[0] == '/') {
-               procInfo.procCmdAbsPath = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
-            }
-         }
-      }
-
-      /*
-       * Get the inode information for this process.  This gives us
-       * the process owner.
-       */
-      if (snprintf(cmdFilePath,
-                   sizeof cmdFilePath,
-                   "/proc/%s",
-                   ent->d_name) == -1) {
-         Debug("Giant process id '%s'\n", ent->d_name);
-         goto next_entry;
-      }
-
       /*
-       * stat() /proc/<pid> to get the owner.  We use fileStat.st_uid
-       * later in this code.  If we can't stat(), ignore and continue.
-       * Maybe we don't have enough permission.
-       *
-       * This stat() call on the current /proc entry is not intended
-       * as a check on the open() near the top of the while loop which
-       * is on the cmdline file of the next entry in /proc, hence no
-       * time-of-check to time-of-use issue.
+       * The owner of /proc/<pid> is the owner of the process.  If we
+       * can't stat it, ignore and continue.  Maybe we don't have enough
+       * permission.
        */
-      /* coverity[fs_check_call] */
-      statResult = stat(cmdFilePath, &fileStat);
-      if (0 != statResult) {
-         goto next_entry;
+      if ((fields & PROCMGR_INFO_OWNER) != 0) {
+         if (fstat(pidFd, &fileStat) != 0) {
+            close(pidFd);
+            continue;
+         }
+         procInfo.procOwner = ProcMgrGetOwner(&scan, fileStat.st_uid);
       }
 
-      /*
-       * Figure out the process start time.  Open /proc/<pid>/stat
-       * and read the start time and compute it in absolute time.
-       */
-      if (snprintf(cmdFilePath,
-                   sizeof cmdFilePath,
-                   "/proc/%s/stat",
-                   ent->d_name) == -1) {
-         Debug("Giant process id '%s'\n", ent->d_name);
-         goto next_entry;
-      }
-      cmdFd = open(cmdFilePath, O_RDONLY);
-      if (-1 == cmdFd) {
-         goto next_entry;
-      }
-      numRead = ProcMgr_ReadProcFile(cmdFd, &cmdStatTemp);
-      close(cmdFd);
-      if (0 >= numRead) {
-         goto next_entry;
-      }
-      /*
-       * Skip over initial process id and process name.  "123 (bash) [...]".
-       */
-      stringBegin = strchr(cmdStatTemp, ')') + 2;
-
-      numberFound = sscanf(stringBegin, "%c %d %d %d %d %d "
-                           "%lu %lu %lu %lu %lu %Lu %Lu %Lu %Lu %ld %ld "
-                           "%d %ld %Lu",
-                           (char *) &dummy, (int *) &dummy, (int *) &dummy,
-                           (int *) &dummy, (int *) &dummy,  (int *) &dummy,
-                           (unsigned long *) &dummy, (unsigned long *) &dummy,
-                           (unsigned long *) &dummy, (unsigned long *) &dummy,
-                           (unsigned long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (unsigned long long *) &dummy,
-                           (long *) &dummy, (long *) &dummy,
-                           (int *) &dummy, (long *) &dummy,
-                           &relativeStartTime);
-      if (20 != numberFound) {
-         goto next_entry;
+      if ((fields & PROCMGR_INFO_STARTTIME) != 0 &&
+          !ProcMgrReadStartTime(&scan, pidFd, &procInfo)) {
+         close(pidFd);
+         continue;
       }
+      close(pidFd);
 
-      /*
-       * Store the command line string pointer in dynbuf.
-       */
-      if (cmdLineTemp) {
-         int i;
-
-         /*
-          * Chop off the trailing whitespace characters.
-          */
-         for (i = strlen(cmdLineTemp) - 1 ;
-              i >= 0 && cmdLineTemp[i] == ' ' ;
-              i--) {
-            cmdLineTemp[i] = '\0';
-         }
-
-         procInfo.procCmdLine = Unicode_Alloc(cmdLineTemp, STRING_ENCODING_DEFAULT);
-      } else {
-         procInfo.procCmdLine = Unicode_Alloc("", STRING_ENCODING_UTF8);
+      if ((fields & PROCMGR_INFO_CMDLINE) != 0 &&
+          procInfo.procCmdLine == NULL) {
+         procInfo.procCmdLine = ProcMgrAddString(&scan, "", 0);
       }
 
       /*
-       * Store the pid in dynbuf.
-       */
-      procInfo.procId = (pid_t) atoi(ent->d_name);
-
-      /*
-       * Store the owner of the process.
-       */
-      pwd = getpwuid(fileStat.st_uid);
-      procInfo.procOwner = (NULL == pwd)
-                           ? Str_SafeAsprintf(&strLen, "%d", (int) fileStat.st_uid)
-                           : Unicode_Alloc(pwd->pw_name, STRING_ENCODING_DEFAULT);
-
-      /*
-       * Store the time that the process started.
-       */
-      procInfo.procStartTime = hostStartTime + (relativeStartTime / hertz);
-
-      /*
-       * Store the process info pointer into a list buffer.
+       * Store the process info into a list buffer.
        */
       if (!ProcMgrProcInfoArray_Push(procList, procInfo)) {
          Warning("%s: failed to expand DynArray - out of memory\n",
                  __FUNCTION__);
-         free(cmdLineTemp);
-         free(cmdStatTemp);
+         ProcMgrProcInfoArray_SetCount(procList, 0);
          goto abort;
       }
-      procInfo.procCmdName = NULL;
-      procInfo.procCmdAbsPath = NULL;
-      procInfo.procCmdLine = NULL;
-      procInfo.procOwner = NULL;
-
-next_entry:
-      free(procInfo.procCmdName);
-      procInfo.procCmdName = NULL;
-      free(procInfo.procCmdAbsPath);
-      procInfo.procCmdAbsPath = NULL;
-
-      free(cmdLineTemp);
-      free(cmdStatTemp);
    } // while readdir
 
    if (0 < ProcMgrProcInfoArray_Count(procList)) {
@@ -650,12 +807,31 @@ next_entry:
    }
 
 abort:
-   closedir(dir);
+   if (NULL != dir) {
+      closedir(dir);
+   }
+   DynBuf_Destroy(&scan.buf);
 
-   free(procInfo.procCmdName);
-   free(procInfo.procCmdAbsPath);
-   free(procInfo.procCmdLine);
-   free(procInfo.procOwner);
+   /*
+    * Turn the offsets into pointers, now that the strings do not move.
+    */
+   DynBuf_Trim(&scan.strings);
+   list->strings = DynBuf_Detach(&scan.strings);
+   DynBuf_Destroy(&scan.strings);
+
+   procCount = ProcMgrProcInfoArray_Count(procList);
+   for (i = 0; i < procCount; i++) {
+      ProcMgrProcInfo *procInfo = ProcMgrProcInfoArray_AddressOf(procList, i);
+      char **strs[] = { &procInfo->procCmdName, &procInfo->procCmdAbsPath,
+                        &procInfo->procCmdLine, &procInfo->procOwner };
+      size_t j;
+
+      for (j = 0; j < ARRAYSIZE(strs); j++) {
+         uintptr_t offset = (uintptr_t) *strs[j];
+
+         *strs[j] = offset == 0 ? NULL : list->strings + offset - 1;
+      }
+   }
 
    if (failed) {
       ProcMgr_FreeProcList(procList);
@@ -664,6 +840,31 @@ abort:
 
    return procList;
 }
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ProcMgr_ListProcesses --
+ *
+ *      List all the processes that the calling client has privilege to
+ *      enumerate. The strings in the returned structure should be all
+ *      UTF-8 encoded, although we do not enforce it right now.
+ *
+ * Results:
+ *
+ *      A ProcMgrProcInfoArray.
+ *
+ * Side effects:
+ *
+ *----------------------------------------------------------------------
+ */
+
+ProcMgrProcInfoArray *
+ProcMgr_ListProcesses(void)
+{
+   return ProcMgr_ListProcessesSelect(PROCMGR_INFO_ALL);
+}
 #endif // defined(__linux__)
 
 
@@ -1247,23 +1448,27 @@ abort:
 void
 ProcMgr_FreeProcList(ProcMgrProcInfoArray *procList)
 {
+#if !defined(__linux__)
    int i;
    size_t procCount;
+#endif
 
    if (NULL == procList) {
       return;
    }
 
+#if defined(__linux__)
+   /* The strings of all the entries are allocated together. */
+   free(((ProcMgrProcList *) procList)->strings);
+#else
    procCount = ProcMgrProcInfoArray_Count(procList);
    for (i = 0; i < procCount; i++) {
       ProcMgrProcInfo *procInfo = ProcMgrProcInfoArray_AddressOf(procList, i);
       free(procInfo->procCmdName);
-#if defined(__linux__)
-      free(procInfo->procCmdAbsPath);
-#endif
       free(procInfo->procCmdLine);
       free(procInfo->procOwner);
    }
+#endif
 
    ProcMgrProcInfoArray_Destroy(procList);
    free(procList);
@@ -1315,7 +1520,8 @@ ProcMgrExecSync(char const *cmd,                  // IN: UTF-8 command line
    }
 
    pid = ProcMgrStartProcess(cmd, userArgs ? userArgs->envp : NULL,
-                             userArgs ? userArgs->workingDirectory : NULL);
+                             userArgs ? userArgs->workingDirectory : NULL,
+                             0, 0);
 
    if (pid == -1) {
       return FALSE;
@@ -1418,7 +1624,9 @@ ProcMgr_ExecSyncWithExitCode(char const *cmd,                  // IN: UTF-8 comm
 static pid_t
 ProcMgrStartProcess(char const *cmd,            // IN: UTF-8 encoded cmd
                     char * const *envp,         // IN: UTF-8 encoded env vars
-                    char const *workingDir)     // IN: UTF-8 working directory
+                    char const *workingDir,     // IN: UTF-8 working directory
+                    int stdoutFd,               // IN: if positive, new stdout
+                    int stderrFd)               // IN: if positive, new stderr
 {
    pid_t pid;
    char *cmdCurrent = NULL;
@@ -1455,7 +1663,9 @@ ProcMgrStartProcess(char const *cmd,            // IN: UTF-8 encoded cmd
       static const char filePath[] = "/bin/sh";
       char * const argv[] = { "sh", "++group=host/vim/tmp",
                               "-c", cmdCurrent, NULL };
-      int initFds[] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+      int initFds[] = { STDIN_FILENO,
+                        stdoutFd > 0 ? stdoutFd : STDOUT_FILENO,
+                        stderrFd > 0 ? stderrFd : STDERR_FILENO };
       int workingDirFd;
       VmkuserStatus_Code status;
       int outPid;
@@ -1544,6 +1754,21 @@ ProcMgrStartProcess(char const *cmd,            // IN: UTF-8 encoded cmd
          }
       }
 
+      if (stdoutFd > 0 && dup2(stdoutFd, STDOUT_FILENO) == -1) {
+         Warning("%s: Could not redirect stdout %s\n", __FUNCTION__,
+                 strerror(errno));
+      }
+      if (stderrFd > 0 && dup2(stderrFd, STDERR_FILENO) == -1) {
+         Warning("%s: Could not redirect stderr %s\n", __FUNCTION__,
+                 strerror(errno));
+      }
+      if (stdoutFd > STDERR_FILENO) {
+         close(stdoutFd);
+      }
+      if (stderrFd > STDERR_FILENO && stderrFd != stdoutFd) {
+         close(stderrFd);
+      }
+
       if (NULL != envpCurrent) {
          execve(shellPath, args, envpCurrent);
       } else  {
@@ -1658,6 +1883,8 @@ ProcMgr_ExecAsync(char const *cmd,                 // IN: UTF-8 command line
    int fds[2];
    pid_t resultPid;
    int readFd, writeFd;
+   int stdoutFd = userArgs ? userArgs->stdoutFd : 0;
+   int stderrFd = userArgs ? userArgs->stderrFd : 0;
 
    Debug("Executing async command: '%s' in working dir '%s'\n",
          cmd, (userArgs && userArgs->workingDirectory) ? userArgs->workingDirectory : "");
@@ -1697,7 +1924,7 @@ ProcMgr_ExecAsync(char const *cmd,                 // IN: UTF-8 command line
        */
       maxfd = sysconf(_SC_OPEN_MAX);
       for (i = STDERR_FILENO + 1; i < maxfd; i++) {
-         if (i != readFd && i != writeFd) {
+         if (i != readFd && i != writeFd && i != stdoutFd && i != stderrFd) {
             close(i);
          }
       }
@@ -1720,10 +1947,23 @@ ProcMgr_ExecAsync(char const *cmd,                 // IN: UTF-8 command line
       if (status) {
          childPid = ProcMgrStartProcess(cmd,
                                         userArgs ? userArgs->envp : NULL,
-                                        userArgs ? userArgs->workingDirectory : NULL);
+                                        userArgs ? userArgs->workingDirectory : NULL,
+                                        stdoutFd,
+                                        stderrFd);
          status = childPid != -1;
       }
 
+      /*
+       * Only the child writes to the redirected outputs, so that their
+       * reader sees the end of them when the child exits.
+       */
+      if (stdoutFd > STDERR_FILENO) {
+         close(stdoutFd);
+      }
+      if (stderrFd > STDERR_FILENO && stderrFd != stdoutFd) {
+         close(stderrFd);
+      }
+
       /*
        * Send the child's pid back immediately, so that the caller can
        * report the result pid back synchronously.
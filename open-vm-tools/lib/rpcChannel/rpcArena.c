@@ -0,0 +1,304 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file rpcArena.c
+ *
+ *    Per-RPC memory for TCLO handlers, and argument parsing that does not
+ *    copy the arguments.
+ *
+ *    Each channel owns an arena that RpcChannel_Dispatch hands to the
+ *    handlers through RpcInData. Allocations are carved out of a block that
+ *    is kept from one RPC to the next, so a handler that formats its reply
+ *    or copies an argument usually does not touch malloc at all. Whatever
+ *    the handler allocated is released in one shot when the next RPC is
+ *    dispatched, i.e. after the reply to this one was sent.
+ */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "vm_assert.h"
+#include "vm_basic_defs.h"
+#include "rpcChannelInt.h"
+
+/** Alignment of the arena allocations. */
+#define RPCIN_ARENA_ALIGN        8
+
+/** Initial and maximum size of the arena block. */
+#define RPCIN_ARENA_MIN_BLOCK    4096
+#define RPCIN_ARENA_MAX_BLOCK    (64 * 1024)
+
+
+/**
+ * Releases everything allocated in the arena of an RPC. Allocations that
+ * did not fit in the block are freed; the block is kept, grown so that the
+ * same load fits in it next time, up to RPCIN_ARENA_MAX_BLOCK.
+ *
+ * @param[in]  arena    The arena.
+ */
+
+void
+RpcInArena_Reset(RpcInArena *arena)
+{
+   if (arena->overflow != NULL) {
+      size_t needed = arena->used + arena->overflowSize;
+
+      g_slist_free_full(arena->overflow, g_free);
+      arena->overflow = NULL;
+
+      if (needed > arena->blockSize &&
+          arena->blockSize < RPCIN_ARENA_MAX_BLOCK) {
+         g_free(arena->block);
+         arena->block = NULL;
+         arena->blockSize = MIN(RPCIN_ARENA_MAX_BLOCK,
+                                MAX(arena->blockSize * 2, needed));
+      }
+      arena->overflowSize = 0;
+   }
+   arena->used = 0;
+}
+
+
+/**
+ * Frees an arena and all the memory allocated from it.
+ *
+ * @param[in]  arena    The arena.
+ */
+
+void
+RpcInArena_Destroy(RpcInArena *arena)
+{
+   RpcInArena_Reset(arena);
+   g_free(arena->block);
+   memset(arena, 0, sizeof *arena);
+}
+
+
+/**
+ * Allocates memory that stays valid until the reply to the RPC was sent.
+ * It must not be freed by the caller; it can be used as the result of the
+ * RPC with RPCIN_SETRETVALS.
+ *
+ * @param[in]  data     The RPC data.
+ * @param[in]  size     Number of bytes needed.
+ *
+ * @return The memory, aligned for any basic type. Never NULL.
+ */
+
+gpointer
+RpcChannel_Alloc(RpcInData *data,
+                 size_t size)
+{
+   RpcInArena *arena = data->arena;
+   gpointer ret;
+
+   ASSERT(arena != NULL);
+
+   size = ROUNDUP(MAX(size, 1), RPCIN_ARENA_ALIGN);
+
+   if (arena->block == NULL) {
+      arena->blockSize = MAX(arena->blockSize, RPCIN_ARENA_MIN_BLOCK);
+      arena->block = g_malloc(arena->blockSize);
+   }
+
+   if (size <= arena->blockSize - arena->used) {
+      ret = arena->block + arena->used;
+      arena->used += size;
+   } else {
+      ret = g_malloc(size);
+      arena->overflow = g_slist_prepend(arena->overflow, ret);
+      arena->overflowSize += size;
+   }
+
+   return ret;
+}
+
+
+/**
+ * Copies a string to the arena of an RPC.
+ *
+ * @param[in]  data     The RPC data.
+ * @param[in]  str      The string; need not be NUL-terminated.
+ * @param[in]  len      Number of bytes to copy.
+ *
+ * @return A NUL-terminated copy, valid until the reply was sent.
+ */
+
+gchar *
+RpcChannel_StrnDup(RpcInData *data,
+                   const char *str,
+                   size_t len)
+{
+   gchar *ret = RpcChannel_Alloc(data, len + 1);
+
+   memcpy(ret, str, len);
+   ret[len] = '\0';
+   return ret;
+}
+
+
+/**
+ * Formats a string in the arena of an RPC. Meant for replies:
+ *
+ * @code
+ *    return RPCIN_SETRETVALS(data, RpcChannel_Printf(data, "%u", n), TRUE);
+ * @endcode
+ *
+ * @param[in]  data     The RPC data.
+ * @param[in]  fmt      printf-style format.
+ *
+ * @return The string, valid until the reply was sent.
+ */
+
+gchar *
+RpcChannel_Printf(RpcInData *data,
+                  const char *fmt,
+                  ...)
+{
+   va_list args;
+   gint len;
+   gchar *ret;
+
+   va_start(args, fmt);
+   len = g_vsnprintf(NULL, 0, fmt, args);
+   va_end(args);
+   ASSERT(len >= 0);
+
+   ret = RpcChannel_Alloc(data, len + 1);
+
+   va_start(args, fmt);
+   g_vsnprintf(ret, len + 1, fmt, args);
+   va_end(args);
+
+   return ret;
+}
+
+
+/**
+ * Finds the next argument of an RPC, without copying it. Same semantics as
+ * StrUtil_GetNextToken: leading delimiters are skipped and the argument
+ * runs until the next delimiter, or to the end with an empty delimiter
+ * set. The arguments do not have to be NUL-terminated.
+ *
+ * @param[in]     data        The RPC data.
+ * @param[in,out] index       Where to start in data->args; updated past
+ *                            the argument.
+ * @param[in]     delimiters  Characters separating the arguments.
+ * @param[out]    len         Length of the argument.
+ *
+ * @return The argument, pointing into data->args, or NULL if there are no
+ *         more arguments.
+ */
+
+const char *
+RpcChannel_NextArg(RpcInData *data,
+                   size_t *index,
+                   const char *delimiters,
+                   size_t *len)
+{
+   const char *args = data->args;
+   size_t end = data->argsSize;
+   size_t start;
+
+   ASSERT(*index <= end);
+
+#define RPCIN_IS_DELIMITER(c)  ((c) != '\0' && strchr(delimiters, (c)) != NULL)
+
+   while (*index < end && RPCIN_IS_DELIMITER(args[*index])) {
+      (*index)++;
+   }
+   if (*index == end || args[*index] == '\0') {
+      return NULL;
+   }
+
+   start = *index;
+   while (*index < end && args[*index] != '\0' &&
+          !RPCIN_IS_DELIMITER(args[*index])) {
+      (*index)++;
+   }
+
+#undef RPCIN_IS_DELIMITER
+
+   *len = *index - start;
+   return args + start;
+}
+
+
+/**
+ * Like RpcChannel_NextArg, but returns a NUL-terminated copy of the
+ * argument allocated in the arena of the RPC.
+ *
+ * @param[in]     data        The RPC data.
+ * @param[in,out] index       Where to start in data->args.
+ * @param[in]     delimiters  Characters separating the arguments.
+ *
+ * @return The argument, valid until the reply was sent, or NULL.
+ */
+
+gchar *
+RpcChannel_NextArgDup(RpcInData *data,
+                      size_t *index,
+                      const char *delimiters)
+{
+   size_t len;
+   const char *arg = RpcChannel_NextArg(data, index, delimiters, &len);
+
+   return arg != NULL ? RpcChannel_StrnDup(data, arg, len) : NULL;
+}
+
+
+/**
+ * Parses the next argument of an RPC as an unsigned decimal number.
+ *
+ * @param[in]     data        The RPC data.
+ * @param[in,out] index       Where to start in data->args.
+ * @param[in]     delimiters  Characters separating the arguments.
+ * @param[out]    out         The number.
+ *
+ * @return TRUE if there was an argument and it is a number that fits.
+ */
+
+gboolean
+RpcChannel_NextArgUint(RpcInData *data,
+                       size_t *index,
+                       const char *delimiters,
+                       guint32 *out)
+{
+   size_t len;
+   size_t i;
+   guint64 value = 0;
+   const char *arg = RpcChannel_NextArg(data, index, delimiters, &len);
+
+   if (arg == NULL) {
+      return FALSE;
+   }
+
+   for (i = 0; i < len; i++) {
+      if (!g_ascii_isdigit(arg[i])) {
+         return FALSE;
+      }
+      value = value * 10 + (arg[i] - '0');
+      if (value > G_MAXUINT32) {
+         return FALSE;
+      }
+   }
+
+   *out = (guint32)value;
+   return TRUE;
+}
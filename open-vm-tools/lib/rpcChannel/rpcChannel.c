@@ -36,6 +36,7 @@
 
 #include "str.h"
 #include "strutil.h"
+#include "toolsProbe.h"
 #include "util.h"
 #include "vm_assert.h"
 
@@ -64,9 +65,30 @@ typedef struct RpcChannelInt {
    guint                   rpcMaxFailures;
    gboolean                rpcInInitialized;
    GSource                *restartTimer; /* Channel restart timer */
+   RpcChannelDispatchCb    dispatchCb;
+   gpointer                dispatchData;
+   RpcInArena              arena;         /* Memory of the current RPC */
+   guint                   dispatchDepth; /* Nested RpcChannel_Dispatch */
+   RpcChannelBulkRunner    bulkRunner;
+   gpointer                bulkData;
+   RpcChannelBulkJob      *bulkJob;       /* Bulk RPC awaiting its reply */
 #endif
 } RpcChannelInt;
 
+#if defined(NEED_RPCIN)
+/** A bulk RPC, see RpcChannelDispatchBulk. */
+struct RpcChannelBulkJob {
+   RpcChannelInt          *chan;      /* NULL once the channel stopped. */
+   GMainContext           *mainCtx;   /* Where the reply is sent from. */
+   RpcChannelCallback      rpc;
+   RpcInData               data;
+   RpcInArena              arena;
+   char                   *name;
+   char                   *args;
+   gboolean                status;
+};
+#endif
+
 #define LGPFX "RpcChannel: "
 
 static gboolean gUseBackdoorOnly = FALSE;
@@ -283,6 +305,7 @@ RpcChannelXdrWrapper(RpcInData *data,
       copy.freeResult = data->freeResult;
       copy.appCtx = data->appCtx;
       copy.clientData = rpc->clientData;
+      copy.arena = data->arena;
    } else {
       memcpy(&copy, data, sizeof copy);
    }
@@ -307,7 +330,8 @@ RpcChannelXdrWrapper(RpcInData *data,
          goto exit;
       }
 
-      if (!xdrProc(&xdrs, copy.result, 0)) {
+      if (!DynXdr_Reserve(&xdrs, DynXdr_Sizeof(xdrProc, copy.result)) ||
+          !xdrProc(&xdrs, copy.result, 0)) {
          ret = RPCIN_SETRETVALS(data, "XDR serialization failed.", FALSE);
 
          /*
@@ -363,13 +387,22 @@ RpcChannel_BuildXdrCommand(const char *cmd,
 {
    Bool ret = FALSE;
    xdrproc_t proc = xdrProc;
+   size_t cmdLen = strlen(cmd);
    XDR xdrs;
 
    if (DynXdr_Create(&xdrs) == NULL) {
       return FALSE;
    }
 
-   if (!DynXdr_AppendRaw(&xdrs, cmd, strlen(cmd))) {
+   /*
+    * Size the buffer up front so that large payloads are encoded in place
+    * instead of growing (and copying) the buffer as they go.
+    */
+   if (!DynXdr_Reserve(&xdrs, cmdLen + 1 + DynXdr_Sizeof(proc, xdrData))) {
+      goto exit;
+   }
+
+   if (!DynXdr_AppendRaw(&xdrs, cmd, cmdLen)) {
       goto exit;
    }
 
@@ -398,6 +431,122 @@ exit:
 }
 
 
+/**
+ * Sends the reply of a bulk RPC once its handler has run. Runs on the
+ * channel's main context.
+ *
+ * @param[in]  _job     The bulk RPC.
+ *
+ * @return FALSE.
+ */
+
+static gboolean
+RpcChannelBulkDone(gpointer _job)
+{
+   RpcChannelBulkJob *job = _job;
+   RpcChannelInt *chan = job->chan;
+
+   if (chan != NULL) {
+      ASSERT(chan->bulkJob == job);
+      chan->bulkJob = NULL;
+      RpcIn_CompleteReply(chan->impl.in, job->status, job->data.result,
+                          job->data.resultLen);
+   }
+
+   if (job->data.freeResult) {
+      free(job->data.result);
+   }
+   RpcInArena_Destroy(&job->arena);
+   g_main_context_unref(job->mainCtx);
+   g_free(job->name);
+   g_free(job->args);
+   g_free(job);
+   return FALSE;
+}
+
+
+/**
+ * Runs the handler of a bulk RPC, and schedules the reply on the channel's
+ * main context. Called by the channel's bulk runner, on any thread.
+ *
+ * @param[in]  job      The bulk RPC.
+ */
+
+void
+RpcChannel_RunBulk(RpcChannelBulkJob *job)
+{
+   GSource *src;
+
+   if (job->rpc.xdrIn != NULL || job->rpc.xdrOut != NULL) {
+      job->status = RpcChannelXdrWrapper(&job->data, &job->rpc);
+   } else {
+      job->status = job->rpc.callback(&job->data);
+   }
+   ASSERT(job->data.result != NULL);
+
+   src = g_idle_source_new();
+   g_source_set_priority(src, G_PRIORITY_HIGH);
+   g_source_set_callback(src, RpcChannelBulkDone, job, NULL);
+   g_source_attach(src, job->mainCtx);
+   g_source_unref(src);
+}
+
+
+/**
+ * Hands an RPC whose handler is marked RPCCHANNEL_PRIORITY_BULK to the
+ * channel's bulk runner, so that the main context is free while it runs.
+ * The reply is deferred until then; the host does not send the next RPC
+ * before it gets it anyway.
+ *
+ * Only one bulk RPC can be outstanding, and RPCs dispatched from within a
+ * handler or not received by the channel's RpcIn run inline.
+ *
+ * @param[in]  chan     The channel.
+ * @param[in]  data     The RPC data, with the name already stripped.
+ * @param[in]  rpc      The handler.
+ *
+ * @return Whether the RPC was handed off.
+ */
+
+static gboolean
+RpcChannelDispatchBulk(RpcChannelInt *chan,
+                       RpcInData *data,
+                       RpcChannelCallback *rpc)
+{
+   RpcChannelBulkJob *job;
+
+   if (chan->bulkRunner == NULL ||
+       chan->bulkJob != NULL ||
+       chan->dispatchDepth > 0 ||
+       chan->impl.in == NULL ||
+       !RpcIn_DeferReply(chan->impl.in)) {
+      return FALSE;
+   }
+
+   /* The arguments are only valid during the dispatch. */
+   job = g_new0(RpcChannelBulkJob, 1);
+   job->chan = chan;
+   job->mainCtx = g_main_context_ref(chan->mainCtx);
+   job->rpc = *rpc;
+   job->name = g_strdup(data->name);
+   job->args = g_malloc(data->argsSize + 1);
+   memcpy(job->args, data->args, data->argsSize);
+   job->args[data->argsSize] = '\0';
+   job->data.name = job->name;
+   job->data.args = job->args;
+   job->data.argsSize = data->argsSize;
+   job->data.appCtx = data->appCtx;
+   job->data.clientData = data->clientData;
+   job->data.arena = &job->arena;
+   chan->bulkJob = job;
+
+   if (!chan->bulkRunner(job, chan->bulkData)) {
+      RpcChannel_RunBulk(job);
+   }
+   return TRUE;
+}
+
+
 /**
  * Dispatches the given RPC to the registered handler. This mimics the behavior
  * of the RpcIn library (but is not tied to that particular implementation of
@@ -418,6 +567,17 @@ RpcChannel_Dispatch(RpcInData *data)
    RpcChannelCallback *rpc = NULL;
    RpcChannelInt *chan = data->clientData;
 
+   TOOLS_PROBE2(rpc__dispatch__entry, data->args, data->argsSize);
+
+   /*
+    * The reply to the previous RPC was sent by now, so its arena memory can
+    * go; not when dispatching from within a handler (lazy plugin loading).
+    */
+   if (chan->dispatchDepth == 0) {
+      RpcInArena_Reset(&chan->arena);
+   }
+   data->arena = &chan->arena;
+
    name = StrUtil_GetNextToken(&index, data->args, " ");
    if (name == NULL) {
       Debug(LGPFX "Bad command (null) received.\n");
@@ -443,15 +603,32 @@ RpcChannel_Dispatch(RpcInData *data)
    data->appCtx = chan->appCtx;
    data->clientData = rpc->clientData;
 
-   if (rpc->xdrIn != NULL || rpc->xdrOut != NULL) {
-      status = RpcChannelXdrWrapper(data, rpc);
+   if (chan->dispatchCb != NULL) {
+      chan->dispatchCb(name, FALSE, chan->dispatchData);
+   }
+
+   if (rpc->priority == RPCCHANNEL_PRIORITY_BULK &&
+       RpcChannelDispatchBulk(chan, data, rpc)) {
+      /* RpcIn ignores this; the reply is sent by RpcChannelBulkDone. */
+      status = RPCIN_SETRETVALS(data, "", TRUE);
    } else {
-      status = rpc->callback(data);
+      chan->dispatchDepth++;
+      if (rpc->xdrIn != NULL || rpc->xdrOut != NULL) {
+         status = RpcChannelXdrWrapper(data, rpc);
+      } else {
+         status = rpc->callback(data);
+      }
+      chan->dispatchDepth--;
+   }
+
+   if (chan->dispatchCb != NULL) {
+      chan->dispatchCb(name, TRUE, chan->dispatchData);
    }
 
    ASSERT(data->result != NULL);
 
 exit:
+   TOOLS_PROBE2(rpc__dispatch__return, name, status);
    data->name = NULL;
    free(name);
    return status;
@@ -631,6 +808,50 @@ RpcChannel_UnregisterCallback(RpcChannel *chan,
 }
 
 
+/**
+ * Sets a function to be called before and after each incoming RPC is
+ * dispatched on the channel, e.g. to profile the handlers. Only one observer
+ * can be set; pass NULL to remove it. This function is not thread-safe.
+ *
+ * @param[in]  chan     The channel instance.
+ * @param[in]  cb       The observer, or NULL.
+ * @param[in]  data     Client data for the observer.
+ */
+
+void
+RpcChannel_SetDispatchCb(RpcChannel *chan,
+                         RpcChannelDispatchCb cb,
+                         gpointer data)
+{
+   RpcChannelInt *cdata = (RpcChannelInt *) chan;
+
+   cdata->dispatchCb = cb;
+   cdata->dispatchData = data;
+}
+
+
+/**
+ * Sets the function that runs the handlers of RPCCHANNEL_PRIORITY_BULK RPCs
+ * off the main context. Without one they run inline like the others. This
+ * function is not thread-safe.
+ *
+ * @param[in]  chan     The channel instance.
+ * @param[in]  runner   The bulk runner, or NULL.
+ * @param[in]  data     Client data for the runner.
+ */
+
+void
+RpcChannel_SetBulkRunner(RpcChannel *chan,
+                         RpcChannelBulkRunner runner,
+                         gpointer data)
+{
+   RpcChannelInt *cdata = (RpcChannelInt *) chan;
+
+   cdata->bulkRunner = runner;
+   cdata->bulkData = data;
+}
+
+
 /**
  * Callback function to clear the cumulative channel error count when RpcIn
  * is able to establish a working connection following an error or reset.
@@ -733,6 +954,12 @@ RpcChannel_Destroy(RpcChannel *chan)
       return;
    }
 
+#if !defined(USE_RPCI_ONLY)
+   if (chan->vsockProbe != NULL) {
+      g_thread_join(chan->vsockProbe);
+   }
+#endif
+
    g_mutex_lock(&chan->outLock);
 
    RpcChannelStopNoLock(chan);
@@ -744,6 +971,7 @@ RpcChannel_Destroy(RpcChannel *chan)
 
 #if defined(NEED_RPCIN)
    RpcChannelTeardown(chan);
+   RpcInArena_Destroy(&((RpcChannelInt *)chan)->arena);
 #endif
 
    g_mutex_unlock(&chan->outLock);
@@ -855,6 +1083,120 @@ RpcChannel_New(void)
 }
 
 
+/**
+ * Backs off the next vsocket retry attempt: doubles the delay, with up to
+ * 25% of jitter so that guests which lost vsocket together (host agent
+ * restart) do not reconnect in lockstep, and caps it at the max value.
+ * The outLock must be acquired by the caller.
+ *
+ * @param[in]  chan        The RPC channel instance.
+ */
+
+static void
+RpcChannelBackoff(RpcChannel *chan)
+{
+   uint32 delay = chan->vsockRetryDelay * 2;
+
+#if !defined(USE_RPCI_ONLY)
+   {
+      uint32 jitter = delay / 4;
+
+      delay = delay - jitter + g_random_int_range(0, 2 * jitter + 1);
+   }
+#endif
+   chan->vsockFailureTS = time(NULL);
+   chan->vsockRetryDelay = CLAMP(delay, RPCCHANNEL_VSOCKET_RETRY_MIN_DELAY,
+                                 RPCCHANNEL_VSOCKET_RETRY_MAX_DELAY);
+}
+
+
+#if ((defined(__linux__) && !defined(USERWORLD)) || defined(_WIN32)) && \
+    !defined(USE_RPCI_ONLY)
+/**
+ * Thread that checks whether vsocket is usable again for a channel that
+ * fell back to the Backdoor, by starting a vsocket channel of its own.
+ * The channel keeps serving RPCs on the Backdoor meanwhile.
+ *
+ * @param[in]  data        The RPC channel instance.
+ *
+ * @return NULL
+ */
+
+static gpointer
+RpcChannelVSockProbe(gpointer data)
+{
+   RpcChannel *chan = data;
+   RpcChannel *probe;
+   gboolean ok;
+
+   probe = VSockChannel_New(chan->vsockChannelFlags |
+                            RPCCHANNEL_FLAGS_SEND_ONE);
+   probe->isMutable = FALSE;
+   ok = probe->funcs->start(probe);
+   RpcChannel_Destroy(probe);
+
+   g_mutex_lock(&chan->outLock);
+   if (ok) {
+      Log(LGPFX "vsocket is reachable again.\n");
+      chan->vsockHealthy = TRUE;
+   } else {
+      RpcChannelBackoff(chan);
+      Debug(LGPFX "vsocket is still unreachable, next try in %u seconds.\n",
+            chan->vsockRetryDelay);
+   }
+   chan->vsockProbing = FALSE;
+   g_mutex_unlock(&chan->outLock);
+
+   return NULL;
+}
+
+
+/**
+ * Starts the vsocket probe of a channel running on the fallback Backdoor,
+ * once the retry delay has passed, and reaps the previous one.
+ * The outLock must be acquired by the caller.
+ *
+ * @param[in]  chan        The RPC channel instance.
+ */
+
+static void
+RpcChannelCheckVSock(RpcChannel *chan)
+{
+   GError *err = NULL;
+
+   if (chan->vsockProbe != NULL) {
+      GThread *done = chan->vsockProbe;
+
+      if (chan->vsockProbing) {
+         return;
+      }
+      /* The probe is done; it may still be on its way out of the lock. */
+      chan->vsockProbe = NULL;
+      g_mutex_unlock(&chan->outLock);
+      g_thread_join(done);
+      g_mutex_lock(&chan->outLock);
+   }
+
+   if (chan->vsockHealthy ||
+       (chan->vsockFailureTS != 0 &&
+        (time(NULL) - chan->vsockFailureTS) < chan->vsockRetryDelay)) {
+      return;
+   }
+
+   chan->vsockProbing = TRUE;
+   chan->vsockProbe = g_thread_try_new("rpcVSockProbe", RpcChannelVSockProbe,
+                                       chan, &err);
+   if (chan->vsockProbe == NULL) {
+      Warning(LGPFX "Failed to start vsocket probe: %s\n",
+              err != NULL ? err->message : "unknown error");
+      g_clear_error(&err);
+      chan->vsockProbing = FALSE;
+      RpcChannelBackoff(chan);
+   }
+}
+#endif
+
+
 /**
  * Start an RPC channel. We may fallback to backdoor channel when other type
  * of channel fails to start.
@@ -925,16 +1267,23 @@ RpcChannel_Start(RpcChannel *chan)
        * behavior until the channel is reset/restarted or
        * retry delay has passed.
        */
-      chan->vsockFailureTS = time(NULL);
-      /*
-       * Backoff retry attempts. Cap the delay at max value.
-       */
-      chan->vsockRetryDelay *= 2;
-      if (chan->vsockRetryDelay > RPCCHANNEL_VSOCKET_RETRY_MAX_DELAY) {
-         chan->vsockRetryDelay = RPCCHANNEL_VSOCKET_RETRY_MAX_DELAY;
-      }
+      RpcChannelBackoff(chan);
       Log(LGPFX "Sticking backdoor RpcOut channel for %u seconds.\n",
           chan->vsockRetryDelay);
+      chan->vsockHealthy = FALSE;
+      if (chan->degradedSince == 0) {
+         chan->degradedSince = time(NULL);
+         chan->fallbacks++;
+      }
+   } else if (ok && chan->degradedSince != 0 &&
+              funcs->getType(chan) != RPCCHANNEL_TYPE_BKDOOR) {
+      uint64 secs = time(NULL) - chan->degradedSince;
+
+      Log(LGPFX "Back on vsocket RpcOut channel after %"FMT64"u seconds.\n",
+          secs);
+      chan->degradedSecs += secs;
+      chan->degradedSince = 0;
+      chan->vsockHealthy = FALSE;
    }
 
    return ok;
@@ -966,6 +1315,12 @@ RpcChannelStopNoLock(RpcChannel *chan)
    } else {
       ASSERT(!chan->inStarted);
    }
+
+   /* A bulk RPC still running has no one to reply to. */
+   if (((RpcChannelInt *)chan)->bulkJob != NULL) {
+      ((RpcChannelInt *)chan)->bulkJob->chan = NULL;
+      ((RpcChannelInt *)chan)->bulkJob = NULL;
+   }
 #endif
 }
 
@@ -1001,6 +1356,44 @@ RpcChannel_GetType(RpcChannel *chan)
 }
 
 
+/**
+ * Gets the activity counters of an RPC channel. The fallback counters stay
+ * zero for channels that never fell back from vsocket to the Backdoor, the
+ * receive counters for channels without an RpcIn.
+ *
+ * @param[in]  chan        The RPC channel instance.
+ * @param[out] stats       Where to store the counters.
+ */
+
+void
+RpcChannel_GetStats(RpcChannel *chan,
+                    RpcChannelStats *stats)
+{
+   ASSERT(chan != NULL);
+   ASSERT(stats != NULL);
+
+   g_mutex_lock(&chan->outLock);
+   stats->fallbacks = chan->fallbacks;
+   stats->degradedSecs = chan->degradedSecs;
+   stats->degraded = chan->degradedSince != 0;
+   if (stats->degraded) {
+      stats->degradedSecs += time(NULL) - chan->degradedSince;
+   }
+   stats->rpcs = 0;
+   stats->idleWakeups = 0;
+#if defined(NEED_RPCIN)
+   if (chan->in != NULL) {
+      RpcInStats inStats;
+
+      RpcIn_GetStats(chan->in, &inStats);
+      stats->rpcs = inStats.rpcs;
+      stats->idleWakeups = inStats.idleWakeups;
+   }
+#endif
+   g_mutex_unlock(&chan->outLock);
+}
+
+
 /**
  * Free the allocated memory for the results from RpcChannel_Send* calls.
  *
@@ -1045,6 +1438,7 @@ RpcChannel_Send(RpcChannel *chan,
    const RpcChannelFuncs *funcs;
 
    Debug(LGPFX "Sending: %"FMTSZ"u bytes\n", dataLen);
+   TOOLS_PROBE2(rpc__send__entry, data, dataLen);
 
    ASSERT(chan && chan->funcs);
 
@@ -1063,13 +1457,26 @@ RpcChannel_Send(RpcChannel *chan,
 #if (defined(__linux__) && !defined(USERWORLD)) || defined(_WIN32)
    if (chan->isMutable &&
        funcs->getType(chan) == RPCCHANNEL_TYPE_BKDOOR) {
+      gboolean tryVSocket;
+
+#if !defined(USE_RPCI_ONLY)
       /*
-       * Switch the channel type if it has been long enough
-       * time since last vsocket failure.
+       * Switch the channel type once the background probe found vsocket
+       * usable again; until then RPCs keep going over the Backdoor
+       * instead of waiting for a vsocket connect.
        */
-      gboolean tryVSocket = (chan->vsockFailureTS == 0 ||
-                             (time(NULL) - chan->vsockFailureTS) >=
-                             chan->vsockRetryDelay);
+      RpcChannelCheckVSock(chan);
+      funcs = chan->funcs;
+      tryVSocket = chan->vsockHealthy;
+#else
+      /*
+       * No threads without glib: switch the channel type if it has been
+       * long enough time since last vsocket failure.
+       */
+      tryVSocket = (chan->vsockFailureTS == 0 ||
+                    (time(NULL) - chan->vsockFailureTS) >=
+                    chan->vsockRetryDelay);
+#endif
       if (tryVSocket && funcs->stop != NULL) {
          Log(LGPFX "Stop backdoor RpcOut channel and try vsock again ...\n");
          /*
@@ -1077,6 +1484,7 @@ RpcChannel_Send(RpcChannel *chan,
           * RpcChannel_Start will switch it to vsocket when
           * possible or fallback to Backdoor again.
           */
+         chan->vsockHealthy = FALSE;
          funcs->stop(chan);
          if (!RpcChannel_Start(chan)) {
             ok = FALSE;
@@ -1137,12 +1545,119 @@ done:
 
 exit:
    g_mutex_unlock(&chan->outLock);
+   TOOLS_PROBE2(rpc__send__return, ok && rpcStatus, resLen);
    return ok && rpcStatus;
 }
 
 
+/*
+ * One-shot RPCs reuse a process-wide channel, one for regular and one for
+ * privileged RPCs, so that back-to-back calls from tools like rpctool skip
+ * the vsock connect and privileged port negotiation. A thread checks the
+ * channel out for the length of one RPC; concurrent callers that find it
+ * checked out use a channel of their own, as before. A channel that sat
+ * idle longer than RPCCHANNEL_ONE_IDLE_TIMEOUT is reconnected before use
+ * since the host may have dropped it, and RpcChannel_Send transparently
+ * reconnects one that fails.
+ */
+
+#define RPCCHANNEL_ONE_IDLE_TIMEOUT 30 /* seconds */
+
+typedef struct RpcChannelOne {
+   RpcChannel *chan;
+   time_t lastUse;
+} RpcChannelOne;
+
+static GMutex gRpcOneLock;
+static RpcChannelOne gRpcOne[2]; /* Indexed by priv. */
+
+
 /**
- * Open/close RpcChannel each time for sending a Rpc message, this is a wrapper
+ * Get a started channel for a one-shot RPC, the pooled one if available.
+ *
+ * @param[in]  priv        TRUE for a privileged RPC.
+ * @param[out] errMsg      Error description on failure.
+ *
+ * @return The channel, NULL on failure.
+ */
+
+static RpcChannel *
+RpcChannelOneGet(gboolean priv,
+                 const char **errMsg)
+{
+   RpcChannel *chan;
+   time_t lastUse;
+   int flags;
+
+   g_mutex_lock(&gRpcOneLock);
+   chan = gRpcOne[priv].chan;
+   lastUse = gRpcOne[priv].lastUse;
+   gRpcOne[priv].chan = NULL;
+   g_mutex_unlock(&gRpcOneLock);
+
+   if (chan != NULL) {
+      if (time(NULL) - lastUse >= RPCCHANNEL_ONE_IDLE_TIMEOUT) {
+         Debug(LGPFX "Reconnecting idle one-shot channel.\n");
+         RpcChannel_Stop(chan);
+      }
+   } else {
+      /*
+       * The channel is kept open between RPCs, so do not ask the host to
+       * close it after every reply.
+       */
+      flags = RPCCHANNEL_FLAGS_SEND_ONE;
+#if (defined(__linux__) && !defined(USERWORLD)) || defined(_WIN32)
+      chan = priv ? VSockChannel_New(flags) : RpcChannel_NewOne(flags);
+#else
+      chan = RpcChannel_NewOne(flags);
+#endif
+      if (chan == NULL) {
+         *errMsg = "RpcChannel: Unable to create the RpcChannel object";
+         return NULL;
+      }
+   }
+
+   if (!RpcChannel_Start(chan)) {
+      *errMsg = "RpcChannel: Unable to open the communication channel";
+   } else if (priv && RpcChannel_GetType(chan) != RPCCHANNEL_TYPE_PRIV_VSOCK) {
+      *errMsg = "Permission denied";
+   } else {
+      return chan;
+   }
+
+   RpcChannel_Destroy(chan);
+   return NULL;
+}
+
+
+/**
+ * Return a channel obtained with RpcChannelOneGet, keeping it for the next
+ * one-shot RPC unless another thread already returned one.
+ *
+ * @param[in]  chan        The channel.
+ * @param[in]  priv        TRUE for a privileged RPC.
+ */
+
+static void
+RpcChannelOnePut(RpcChannel *chan,
+                 gboolean priv)
+{
+   g_mutex_lock(&gRpcOneLock);
+   if (gRpcOne[priv].chan == NULL) {
+      gRpcOne[priv].chan = chan;
+      gRpcOne[priv].lastUse = time(NULL);
+      chan = NULL;
+   }
+   g_mutex_unlock(&gRpcOneLock);
+
+   if (chan != NULL) {
+      RpcChannel_Destroy(chan);
+   }
+}
+
+
+/**
+ * Send a one-shot Rpc message on the pooled RpcChannel, this is a wrapper
  * for RpcChannel APIs.
  *
  * @param[in]  data        request data
@@ -1163,64 +1678,31 @@ RpcChannelSendOneRaw(const char *data,
                      gboolean priv)
 {
    RpcChannel *chan;
+   const char *errMsg = NULL;
    gboolean status = FALSE;
-   int flags;
-
-   flags = RPCCHANNEL_FLAGS_SEND_ONE;
-#if (defined(__linux__) && !defined(USERWORLD)) || defined(_WIN32)
-   flags |= RPCCHANNEL_FLAGS_FAST_CLOSE;
-   chan = priv ? VSockChannel_New(flags) : RpcChannel_NewOne(flags);
-#else
-   chan = RpcChannel_NewOne(flags);
-#endif
 
+   chan = RpcChannelOneGet(priv, &errMsg);
    if (chan == NULL) {
       if (result != NULL) {
-         *result = Util_SafeStrdup("RpcChannel: Unable to create "
-                                   "the RpcChannel object");
+         *result = Util_SafeStrdup(errMsg);
          if (resultLen != NULL) {
             *resultLen = strlen(*result);
          }
       }
-      goto sent;
-   } else if (!RpcChannel_Start(chan)) {
-      if (result != NULL) {
-         *result = Util_SafeStrdup("RpcChannel: Unable to open the "
-                                   "communication channel");
-         if (resultLen != NULL) {
-            *resultLen = strlen(*result);
-         }
-      }
-      goto sent;
-   } else if (priv && RpcChannel_GetType(chan) != RPCCHANNEL_TYPE_PRIV_VSOCK) {
-      if (result != NULL) {
-         *result = Util_SafeStrdup("Permission denied");
-         if (resultLen != NULL) {
-            *resultLen = strlen(*result);
-         }
-      }
-      goto sent;
-   } else if (!RpcChannel_Send(chan, data, dataLen, result, resultLen)) {
-      /* We already have the description of the error */
-      goto sent;
+   } else {
+      status = RpcChannel_Send(chan, data, dataLen, result, resultLen);
+      RpcChannelOnePut(chan, priv);
    }
 
-   status = TRUE;
-
-sent:
    Debug(LGPFX "Request %s: reqlen=%"FMTSZ"u, replyLen=%"FMTSZ"u\n",
          status ? "OK" : "FAILED", dataLen, resultLen ? *resultLen : 0);
-   if (chan) {
-      RpcChannel_Stop(chan);
-      RpcChannel_Destroy(chan);
-   }
 
    return status;
 }
 
 
 /**
- * Open/close RpcChannel each time for sending a Rpc message, this is a wrapper
+ * Send a one-shot Rpc message on the pooled RpcChannel, this is a wrapper
  * for RpcChannel APIs.
  *
  * @param[in]  data        request data
@@ -1244,7 +1726,7 @@ RpcChannel_SendOneRaw(const char *data,
 #if defined(__linux__) || defined(_WIN32)
 
 /**
- * Open/close VSock RPC Channel each time for sending a privileged Rpc message,
+ * Send a one-shot privileged Rpc message on the pooled VSock RPC Channel,
  * this is a wrapper for RpcChannel APIs.
  *
  * @param[in]  data        request data
@@ -1268,7 +1750,7 @@ RpcChannel_SendOneRawPriv(const char *data,
 
 
 /**
- * Open/close RpcChannel each time for sending a Rpc message, this is a wrapper
+ * Send a one-shot Rpc message on the pooled RpcChannel, this is a wrapper
  * for RpcChannel APIs.
  *
  * @param[out] reply       reply, should be freed by calling RpcChannel_Free.
@@ -1324,7 +1806,7 @@ error:
 
 
 /**
- * Open/close RpcChannel each time for sending a Rpc message, this is a wrapper
+ * Send a one-shot Rpc message on the pooled RpcChannel, this is a wrapper
  * for RpcChannel APIs.
  *
  * @param[out] reply       reply, should be freed by calling RpcChannel_Free.
@@ -1355,7 +1837,7 @@ RpcChannel_SendOne(char **reply,
 #if defined(__linux__) || defined(_WIN32)
 
 /**
- * Open/close VSock RPC Channel each time for sending a privileged Rpc message,
+ * Send a one-shot privileged Rpc message on the pooled VSock RPC Channel,
  * this is a wrapper for RpcChannel APIs.
  *
  * @param[out] reply       reply, should be freed by calling RpcChannel_Free.
@@ -1383,3 +1865,219 @@ RpcChannel_SendOnePriv(char **reply,
 }
 
 #endif
+
+
+#if !defined(USE_RPCI_ONLY)
+
+/*
+ * Asynchronous sends.
+ *
+ * RPCs sent with RpcChannel_SendAsync are carried by a small pool of worker
+ * threads, each with a channel of its own, so several of them are on the
+ * wire at once and none of them waits for the outLock of the application's
+ * channel. The RPCI wire format has no request ids, so replies on one
+ * connection can only come back in order; pipelining on a single connection
+ * would let one slow reply hold up everything queued behind it, which is
+ * what the separate connections avoid. A worker closes its channel when the
+ * queue drains.
+ */
+
+/** Most RPCs sent asynchronously at the same time. */
+#define RPCCHANNEL_ASYNC_MAX_THREADS 4
+
+typedef struct RpcChannelAsyncReq {
+   char *data;
+   size_t dataLen;
+   gboolean backdoorOnly;
+   GMainContext *ctx;
+   RpcChannelAsyncCb cb;
+   gpointer cbData;
+   gboolean status;
+   char *result;
+   size_t resultLen;
+} RpcChannelAsyncReq;
+
+static GMutex gRpcAsyncLock;
+static GThreadPool *gRpcAsyncPool;
+
+
+/**
+ * Free an RpcChannel of an asynchronous worker thread.
+ *
+ * @param[in]  data     The RPC channel.
+ */
+
+static void
+RpcChannelAsyncChannelFree(gpointer data)
+{
+   RpcChannel_Destroy(data);
+}
+
+static GPrivate gRpcAsyncBackdoorChan =
+   G_PRIVATE_INIT(RpcChannelAsyncChannelFree);
+static GPrivate gRpcAsyncChan = G_PRIVATE_INIT(RpcChannelAsyncChannelFree);
+
+
+/**
+ * Free an asynchronous request.
+ *
+ * @param[in]  data     The request.
+ */
+
+static void
+RpcChannelAsyncReqFree(gpointer data)
+{
+   RpcChannelAsyncReq *req = data;
+
+   if (req->ctx != NULL) {
+      g_main_context_unref(req->ctx);
+   }
+   free(req->result);
+   g_free(req->data);
+   g_free(req);
+}
+
+
+/**
+ * Idle callback delivering the reply of an asynchronous request in the
+ * caller's main context.
+ *
+ * @param[in]  data     The request.
+ *
+ * @return FALSE, the source is removed.
+ */
+
+static gboolean
+RpcChannelAsyncComplete(gpointer data)
+{
+   RpcChannelAsyncReq *req = data;
+
+   req->cb(req->status, req->result, req->resultLen, req->cbData);
+   return FALSE;
+}
+
+
+/**
+ * Worker thread function sending one asynchronous request on the channel
+ * of the thread, which is opened on first use.
+ *
+ * @param[in]  data       The request.
+ * @param[in]  userData   Unused.
+ */
+
+static void
+RpcChannelAsyncWorker(gpointer data,
+                      gpointer userData)
+{
+   RpcChannelAsyncReq *req = data;
+   GPrivate *key = req->backdoorOnly ? &gRpcAsyncBackdoorChan : &gRpcAsyncChan;
+   RpcChannel *chan = g_private_get(key);
+
+   if (chan == NULL) {
+      chan = req->backdoorOnly ? BackdoorChannel_New() : RpcChannel_New();
+      if (chan != NULL && !RpcChannel_Start(chan)) {
+         RpcChannel_Destroy(chan);
+         chan = NULL;
+      }
+      g_private_set(key, chan);
+   }
+
+   if (chan == NULL) {
+      req->result = Util_SafeStrdup("RpcChannel: Unable to open the "
+                                    "communication channel");
+      req->resultLen = strlen(req->result);
+      req->status = FALSE;
+   } else {
+      req->status = RpcChannel_Send(chan, req->data, req->dataLen,
+                                    &req->result, &req->resultLen);
+   }
+   Debug(LGPFX "Async request %s: reqlen=%"FMTSZ"u, replyLen=%"FMTSZ"u\n",
+         req->status ? "OK" : "FAILED", req->dataLen, req->resultLen);
+
+   /* Do not hold on to a connection between bursts. */
+   g_mutex_lock(&gRpcAsyncLock);
+   if (g_thread_pool_unprocessed(gRpcAsyncPool) == 0) {
+      g_private_replace(key, NULL);
+   }
+   g_mutex_unlock(&gRpcAsyncLock);
+
+   if (req->cb != NULL) {
+      GSource *src = g_idle_source_new();
+
+      g_source_set_callback(src, RpcChannelAsyncComplete, req,
+                            RpcChannelAsyncReqFree);
+      g_source_attach(src, req->ctx);
+      g_source_unref(src);
+   } else {
+      RpcChannelAsyncReqFree(req);
+   }
+}
+
+
+/**
+ * Send an RPC without waiting for the reply. The RPC goes out on a channel
+ * of the same kind as @a chan but not on @a chan itself, so it neither
+ * waits for nor holds up other senders of @a chan. When the reply arrives
+ * @a cb is called from @a ctx with the status and reply; the reply is only
+ * valid for the length of the callback.
+ *
+ * RPCs sent this way may be processed by the host in any order relative to
+ * each other and to RPCs sent on @a chan.
+ *
+ * @param[in]  chan       Channel whose kind to use.
+ * @param[in]  data       Data to send.
+ * @param[in]  dataLen    Number of bytes to send.
+ * @param[in]  ctx        Main context to call @a cb from, NULL for the
+ *                        default one.
+ * @param[in]  cb         Completion callback, may be NULL.
+ * @param[in]  cbData     Data for @a cb.
+ *
+ * @return TRUE if the request was queued. FALSE otherwise, and @a cb is not
+ *         called.
+ */
+
+gboolean
+RpcChannel_SendAsync(RpcChannel *chan,
+                     char const *data,
+                     size_t dataLen,
+                     GMainContext *ctx,
+                     RpcChannelAsyncCb cb,
+                     gpointer cbData)
+{
+   RpcChannelAsyncReq *req;
+   GError *err = NULL;
+   gboolean ok;
+
+   ASSERT(chan);
+
+   req = g_new0(RpcChannelAsyncReq, 1);
+   req->data = g_memdup(data, dataLen);
+   req->dataLen = dataLen;
+   req->backdoorOnly = gUseBackdoorOnly || !chan->isMutable;
+   req->cb = cb;
+   req->cbData = cbData;
+   if (cb != NULL) {
+      req->ctx = ctx != NULL ? g_main_context_ref(ctx)
+                             : g_main_context_ref(g_main_context_default());
+   }
+
+   g_mutex_lock(&gRpcAsyncLock);
+   if (gRpcAsyncPool == NULL) {
+      gRpcAsyncPool = g_thread_pool_new(RpcChannelAsyncWorker, NULL,
+                                        RPCCHANNEL_ASYNC_MAX_THREADS,
+                                        FALSE, &err);
+   }
+   ok = gRpcAsyncPool != NULL &&
+        g_thread_pool_push(gRpcAsyncPool, req, &err);
+   g_mutex_unlock(&gRpcAsyncLock);
+
+   if (!ok) {
+      Warning(LGPFX "Unable to queue async request: %s\n",
+              err != NULL ? err->message : "unknown error");
+      g_clear_error(&err);
+      RpcChannelAsyncReqFree(req);
+   }
+   return ok;
+}
+
+#endif
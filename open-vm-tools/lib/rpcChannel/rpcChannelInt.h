@@ -50,6 +50,18 @@ struct RpcIn;
 /* VMX should close channel after sending reply */
 #define RPCCHANNEL_FLAGS_FAST_CLOSE   0x2
 
+/** Per-RPC memory of a channel, see rpcArena.c. */
+typedef struct RpcInArena {
+   char *block;          /* Kept from one RPC to the next. */
+   size_t blockSize;
+   size_t used;
+   GSList *overflow;     /* Allocations that did not fit in the block. */
+   size_t overflowSize;
+} RpcInArena;
+
+void RpcInArena_Reset(RpcInArena *arena);
+void RpcInArena_Destroy(RpcInArena *arena);
+
 /** a list of interface functions for a channel implementation */
 typedef struct _RpcChannelFuncs{
    gboolean (*start)(RpcChannel *);
@@ -100,6 +112,18 @@ struct _RpcChannel {
     * and RPCCHANNEL_VSOCKET_RETRY_MAX_DELAY.
     */
    uint32 vsockRetryDelay;
+   /*
+    * While a mutable channel runs on the fallback Backdoor channel,
+    * vsocket is reconnected in the background by vsockProbe; when it
+    * succeeds it sets vsockHealthy and the next send switches back.
+    */
+   GThread *vsockProbe;
+   gboolean vsockProbing;
+   gboolean vsockHealthy;
+   /* Time spent on the fallback Backdoor channel, see RpcChannel_GetStats. */
+   uint64 degradedSince;
+   uint64 degradedSecs;
+   uint32 fallbacks;
 };
 
 void BackdoorChannel_Fallback(RpcChannel *chan);
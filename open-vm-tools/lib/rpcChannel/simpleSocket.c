@@ -473,8 +473,8 @@ Socket_DecodePacket(const char *recvBuf,       // IN
    *payload = NULL;
    *payloadLen = 0;
 
-   /* decoding the packet */
-   res = DataMap_Deserialize(recvBuf, fullPktLen, &map);
+   /* decoding the packet, the payload is copied once, below */
+   res = DataMap_DeserializeView(recvBuf, fullPktLen, &map);
    if (res != DMERR_SUCCESS) {
       Debug(LGPFX "Error in dataMap decoding, error=%d\n", res);
       return FALSE;
@@ -535,6 +535,8 @@ Socket_PackSendData(const char *buf,             // IN
    char *newBuf;
    gboolean mapCreated = FALSE;
    int64 pktType = GUESTRPCPKT_TYPE_DATA;
+   uint32 bufSize;
+   uint32 pktLen;
 
    res = DataMap_Create(&map);
    if (res != DMERR_SUCCESS) {
@@ -568,10 +570,23 @@ Socket_PackSendData(const char *buf,             // IN
       }
    }
 
-   res = DataMap_Serialize(&map, serBuf, serBufLen);
+   /*
+    * Type and fast close take 16 bytes each, the payload 12 plus its
+    * length, and the packet starts with its length.
+    */
+   bufSize = len + 3 * 16 + sizeof(uint32);
+   *serBuf = malloc(bufSize);
+   if (*serBuf == NULL) {
+      Debug(LGPFX "Error in allocating memory.\n");
+      goto error;
+   }
+   res = DataMap_SerializeTo(&map, *serBuf, bufSize, &pktLen);
    if (res != DMERR_SUCCESS) {
+      free(*serBuf);
+      *serBuf = NULL;
       goto error;
    }
+   *serBufLen = pktLen;
 
    DataMap_Destroy(&map);
    return TRUE;
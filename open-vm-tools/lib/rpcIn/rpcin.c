@@ -104,8 +104,28 @@ typedef struct RpcInCallbackList {
 #if defined(VMTOOLS_USE_VSOCKET)
 
 #define RPCIN_HEARTBEAT_INTERVAL              1000             /* 1 second */
+/*
+ * How often to try to move from backdoor polling back to vsocket, in
+ * units of 10 msec. vsocket may come up after we started, e.g. when the
+ * vsock module is loaded late during boot.
+ */
+#define RPCIN_VSOCK_RETRY_INTERVAL            6000             /* 1 minute */
 #define RPCIN_MIN_SEND_BUF_SIZE               (64 * 1024)
 #define RPCIN_MIN_RECV_BUF_SIZE               (64 * 1024)
+/* Smaller buffers in the low-memory profile, see VMTools_SetLowMemory. */
+#define RPCIN_LOW_MEMORY_BUF_SIZE             (8 * 1024)
+#define RPCIN_MIN_BUF_SIZE(size)                                        \
+   (VMTools_IsLowMemory() ? RPCIN_LOW_MEMORY_BUF_SIZE : (size))
+
+/*
+ * Size of the DataMap header of a reply packet: the packet length, the
+ * packet type entry and the header of the payload entry. Replies are built
+ * with this much room in front of them so that the header can be written
+ * in place, see RpcInPackSendData.
+ */
+#define RPCIN_PKT_HDR_LEN     (sizeof(uint32) + 4 * sizeof(int32) + \
+                               3 * sizeof(int32))
+#define RPCIN_RESULT_HEADROOM RPCIN_PKT_HDR_LEN
 
 struct RpcIn;
 
@@ -129,6 +149,8 @@ typedef struct _ConnInfo {
 
 static void RpcInConnRecvHeader(ConnInfo *conn);
 static Bool RpcInConnRecvPacket(ConnInfo *conn, const char **errmsg);
+#else
+#define RPCIN_RESULT_HEADROOM 0
 #endif  /* VMTOOLS_USE_VSOCKET */
 
 
@@ -146,8 +168,11 @@ struct RpcIn {
 #if defined(VMTOOLS_USE_VSOCKET)
    ConnInfo *conn;
    GSource *heartbeatSrc;
+   uint64 vsockRetryTime;   /* When to retry vsocket, 0 for never */
 #endif
 
+   RpcInStats stats;
+
    Message_Channel *channel;
    unsigned int delay;   /* The delay of the previous iteration of RpcInLoop */
    unsigned int maxDelay;  /* The maximum delay to schedule in RpcInLoop */
@@ -161,7 +186,7 @@ struct RpcIn {
    /* Should we send the result back? */
    Bool mustSend;
 
-   /* The result itself */
+   /* The result itself, preceded by RPCIN_RESULT_HEADROOM bytes */
    char *last_result;
 
    /* The size of the result */
@@ -179,6 +204,14 @@ struct RpcIn {
    Bool inLoop;     // RpcInLoop is running.
    Bool shouldStop; // Stop the channel the next time RpcInLoop exits.
 
+   /*
+    * A handler may leave the reply to the current request for later, see
+    * RpcIn_DeferReply. The host does not send another request until it gets
+    * the reply, so nothing is received while replyDeferred is set.
+    */
+   Bool inDispatch;    // The dispatch function is running.
+   Bool replyDeferred; // RpcIn_CompleteReply sends the reply.
+
    /*
     * RpcInConnErrorHandler called; cleared when a non "reset" reply has been
     * received.
@@ -190,6 +223,11 @@ struct RpcIn {
 static Bool RpcInSend(RpcIn *in, int flags);
 static Bool RpcInScheduleRecvEvent(RpcIn *in);
 static void RpcInStop(RpcIn *in);
+static Bool RpcInSetResult(RpcIn *in,            // IN
+                           Bool status,          // IN
+                           const char *result,   // IN
+                           size_t resultLen,     // IN
+                           const char **errmsg); // OUT
 static Bool RpcInExecRpc(RpcIn *in,            // IN
                          const char *reply,    // IN
                          size_t repLen,        // IN
@@ -428,7 +466,10 @@ RpcIn_Construct(GMainContext *mainCtx,    // IN
    RpcIn *result;
 
 #if defined(VMTOOLS_USE_VSOCKET)
-   Poll_InitGtk();
+   /* The application may have picked another Poll implementation. */
+   if (!Poll_IsInitialized()) {
+      Poll_InitGtk();
+   }
 #endif
 
    ASSERT(mainCtx != NULL);
@@ -545,6 +586,15 @@ static void
 RpcInCloseConn(ConnInfo *conn) // IN
 {
    int fd = AsyncSocket_GetFd(conn->asock);
+   AsyncSocketStats stats;
+
+   if (AsyncSocket_GetStats(conn->asock, &stats) == ASOCKERR_SUCCESS) {
+      Debug("RpcIn: vsocket connection %d sent %"FMT64"u bytes in "
+            "%"FMT64"u calls, received %"FMT64"u bytes in %"FMT64"u calls, "
+            "%"FMT64"u empty wakeups, send queue peak %"FMT64"u bytes.\n",
+            fd, stats.bytesSent, stats.sendCalls, stats.bytesRecvd,
+            stats.recvCalls, stats.emptyWakeups, stats.sendQueueHighWater);
+   }
 
    if (conn->in != NULL) {
       conn->in->conn = NULL;
@@ -606,12 +656,43 @@ RpcInConnSendDoneCb(void *buf,            // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcInPutInt32 --
+ *
+ *    Encode an int32 the way DataMap does.
+ *
+ * Result:
+ *    None
+ *
+ * Side-effects:
+ *    Advances *buf.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcInPutInt32(char **buf,   // IN/OUT
+              int32 val)    // IN
+{
+   uint32 netVal = htonl((uint32)val);
+
+   memcpy(*buf, &netVal, sizeof netVal);
+   *buf += sizeof netVal;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * RpcInPackSendData --
  *
- *    Helper function for building send packet and serialize it.
+ *    Helper function for building a send packet in DataMap encoding format.
+ *    A non-empty payload must be preceded by RPCIN_PKT_HDR_LEN bytes of
+ *    headroom; the header is written there, so the packet starts at
+ *    buf - RPCIN_PKT_HDR_LEN and the payload is not copied. Without a
+ *    payload a new buffer is allocated.
  *
  * Result:
  *    TRUE on sucess, FALSE otherwise.
@@ -624,60 +705,48 @@ RpcInConnSendDoneCb(void *buf,            // IN
 
 static Bool
 RpcInPackSendData(int fd,                      // IN
-                  const char *buf,             // IN
+                  char *buf,                   // IN
                   int len,                     // IN
                   int flags,                   // IN
                   char **serBuf,               // OUT
                   int32 *serBufLen)            // OUT
 {
-   DataMap map;
-   ErrorCode res;
-   char *newBuf;
-   gboolean mapCreated = FALSE;
    int64 pktType = (flags & RPCIN_TCLO_PING) ?
                    GUESTRPCPKT_TYPE_PING : GUESTRPCPKT_TYPE_DATA;
+   Bool hasPayload = buf != NULL && len > 0;
+   int32 hdrLen = RPCIN_PKT_HDR_LEN;
+   char *ptr;
 
-   res = DataMap_Create(&map);
-   if (res != DMERR_SUCCESS) {
-      goto quit;
-   }
-
-   mapCreated = TRUE;
-   res = DataMap_SetInt64(&map, GUESTRPCPKT_FIELD_TYPE,
-                          pktType, TRUE);
-   if (res != DMERR_SUCCESS) {
-      goto quit;
-   }
-
-   if (buf != NULL && len > 0) {
-      newBuf = malloc(len);
-      if (newBuf == NULL) {
+   if (hasPayload) {
+      *serBuf = buf - RPCIN_PKT_HDR_LEN;
+   } else {
+      /* No payload entry. */
+      hdrLen -= 3 * sizeof(int32);
+      *serBuf = malloc(hdrLen);
+      if (*serBuf == NULL) {
          Debug("RpcIn: Error in allocating memory for conn %d.\n", fd);
-         goto quit;
-      }
-      memcpy(newBuf, buf, len);
-      res = DataMap_SetString(&map, GUESTRPCPKT_FIELD_PAYLOAD, newBuf,
-                              len, TRUE);
-      if (res != DMERR_SUCCESS) {
-         free(newBuf);
-         goto quit;
+         return FALSE;
       }
+      len = 0;
    }
+   *serBufLen = hdrLen + len;
 
-   res = DataMap_Serialize(&map, serBuf, serBufLen);
-   if (res != DMERR_SUCCESS) {
-      goto quit;
-   }
+   ptr = *serBuf;
+   RpcInPutInt32(&ptr, *serBufLen - sizeof(uint32));
 
-   DataMap_Destroy(&map);
-   return TRUE;
+   RpcInPutInt32(&ptr, DMFIELDTYPE_INT64);
+   RpcInPutInt32(&ptr, GUESTRPCPKT_FIELD_TYPE);
+   RpcInPutInt32(&ptr, (int32)pktType);
+   RpcInPutInt32(&ptr, (int32)(pktType >> 32));
 
-quit:
-   if (mapCreated) {
-      DataMap_Destroy(&map);
+   if (hasPayload) {
+      RpcInPutInt32(&ptr, DMFIELDTYPE_STRING);
+      RpcInPutInt32(&ptr, GUESTRPCPKT_FIELD_PAYLOAD);
+      RpcInPutInt32(&ptr, len);
+      ASSERT(ptr == buf);
    }
-   Debug("RpcIn: Error in dataMap encoding for conn %d.\n", fd);
-   return FALSE;
+
+   return TRUE;
 }
 
 
@@ -687,7 +756,8 @@ quit:
  * RpcInConnSend --
  *
  *    Helper function for writing data to a socket.
- *    ownership of buffer is untouched.
+ *    On success the socket owns the buffer, which must have been allocated
+ *    with RPCIN_RESULT_HEADROOM in front of it.
  *
  * Result:
  *    TRUE on sucess, FALSE otherwise.
@@ -700,7 +770,7 @@ quit:
 
 static Bool
 RpcInConnSend(ConnInfo *conn,              // IN
-              const char *buf,             // IN
+              char *buf,                   // IN
               int len,                     // IN
               int flags)                   // IN
 {
@@ -721,7 +791,10 @@ RpcInConnSend(ConnInfo *conn,              // IN
    if (res != ASOCKERR_SUCCESS) {
       Debug("RpcIn: error in AsyncSocket_Send for socket %d: %s\n",
             AsyncSocket_GetFd(conn->asock), AsyncSocket_Err2String(res));
-      free(packetBuf);
+      if (buf == NULL || len <= 0) {
+         /* Not the caller's buffer. */
+         free(packetBuf);
+      }
       return FALSE;
    } else {
       conn->sendQueueLen += packetLen;
@@ -779,10 +852,15 @@ RpcInHeartbeatCallback(void *clientData)      // IN
    RpcIn *in = (RpcIn *)clientData;
    ASSERT(in);
    if (in->conn) {
+      if (in->replyDeferred) {
+         /* The host is waiting for the reply, not for a ping. */
+         return TRUE;
+      }
       ASSERT(!in->mustSend);
       ASSERT(in->last_result == NULL);
       ASSERT(in->last_resultLen == 0);
 
+      in->stats.idleWakeups++;
       in->mustSend = TRUE;
       if (RpcInSend(in, RPCIN_TCLO_PING)) {
          return TRUE;
@@ -828,18 +906,56 @@ RpcInRegisterHeartbeatCallback(RpcIn *in)      // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcInGetInt32 --
+ *
+ *    Decode an int32 encoded the way DataMap does.
+ *
+ * Result:
+ *    TRUE on success, FALSE if the buffer is too short.
+ *
+ * Side-effects:
+ *    Advances *buf and decreases *left.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcInGetInt32(char **buf,     // IN/OUT
+              int32 *left,    // IN/OUT
+              int32 *val)     // OUT
+{
+   uint32 netVal;
+
+   if (*left < (int32)sizeof netVal) {
+      return FALSE;
+   }
+   memcpy(&netVal, *buf, sizeof netVal);
+   *val = (int32)ntohl(netVal);
+   *buf += sizeof netVal;
+   *left -= sizeof netVal;
+   return TRUE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * RpcInDecodePacket --
  *
  *    Helper function to decode received packet in DataMap encoding format.
+ *    The packet is walked in place rather than deserialized, and the
+ *    payload is returned by reference into the receive buffer of the
+ *    connection. It is NUL terminated for backward compatibility and stays
+ *    valid until the next packet is received.
  *
  * Result:
- *    None
+ *    TRUE on success, FALSE on malformed packet or missing payload.
  *
  * Side-effects:
- *    None
+ *    Modifies the receive buffer.
  *
  *-----------------------------------------------------------------------------
  */
@@ -849,45 +965,90 @@ RpcInDecodePacket(ConnInfo *conn,       // IN
                   char **payload,       // OUT
                   int32 *payloadLen)    // OUT
 {
-   ErrorCode res;
-   DataMap map;
    int fd = AsyncSocket_GetFd(conn->asock);
-   int fullPacketLen = conn->packetLen + sizeof conn->packetLen;
-   char *buf;
-   int32 len;
-
-
-   /* decoding the packet */
-   res = DataMap_Deserialize(conn->recvBuf, fullPacketLen, &map);
-   if (res != DMERR_SUCCESS) {
-      Debug("RpcIn: Error in dataMap decoding for conn %d, error=%d\n",
-            fd, res);
-      return FALSE;
-   }
+   char *buf = conn->recvBuf + sizeof conn->packetLen;
+   int32 left = conn->packetLen;
+   char *found = NULL;
+   int32 foundLen = 0;
+
+   while (left > 0) {
+      int32 type;
+      int32 fieldId;
+      int32 count;
+      int32 strLen;
+
+      if (!RpcInGetInt32(&buf, &left, &type) ||
+          !RpcInGetInt32(&buf, &left, &fieldId)) {
+         goto bad;
+      }
 
-   res = DataMap_GetString(&map, GUESTRPCPKT_FIELD_PAYLOAD, &buf, &len);
-   if (res == DMERR_SUCCESS) {
-      char *tmpPtr = (char *)malloc(len + 1);
-      if (tmpPtr == NULL) {
-         Debug("RpcIn: Error in allocating memory for conn %d\n", fd);
-         goto exit;
+      switch (type) {
+      case DMFIELDTYPE_INT64:
+         if (left < (int32)sizeof(int64)) {
+            goto bad;
+         }
+         buf += sizeof(int64);
+         left -= sizeof(int64);
+         break;
+      case DMFIELDTYPE_STRING:
+         if (!RpcInGetInt32(&buf, &left, &strLen) ||
+             strLen <= 0 || strLen > left) {
+            goto bad;
+         }
+         if (fieldId == GUESTRPCPKT_FIELD_PAYLOAD) {
+            if (found != NULL) {
+               goto bad;
+            }
+            found = buf;
+            foundLen = strLen;
+         }
+         buf += strLen;
+         left -= strLen;
+         break;
+      case DMFIELDTYPE_INT64LIST:
+         if (!RpcInGetInt32(&buf, &left, &count) ||
+             count < 0 || count > left / (int32)sizeof(int64)) {
+            goto bad;
+         }
+         buf += count * sizeof(int64);
+         left -= count * sizeof(int64);
+         break;
+      case DMFIELDTYPE_STRINGLIST:
+         if (!RpcInGetInt32(&buf, &left, &count) || count < 0) {
+            goto bad;
+         }
+         while (count-- > 0) {
+            if (!RpcInGetInt32(&buf, &left, &strLen) ||
+                strLen <= 0 || strLen > left) {
+               goto bad;
+            }
+            buf += strLen;
+            left -= strLen;
+         }
+         break;
+      default:
+         goto bad;
       }
-      memcpy(tmpPtr, buf, len);
-      /* add a trailing 0 for backward compatible */
-      tmpPtr[len] = '\0';
+   }
 
-      *payload = tmpPtr;
-      *payloadLen = len;
-   } else {
+   if (found == NULL) {
       Debug("RpcIn: Empty payload for conn %d\n", fd);
-      goto exit;
+      return FALSE;
    }
 
-   DataMap_Destroy(&map);
+   /*
+    * Add a trailing 0 for backward compatible. The byte after the payload
+    * is either past the entries already walked or the spare byte at the end
+    * of the receive buffer.
+    */
+   found[foundLen] = '\0';
+
+   *payload = found;
+   *payloadLen = foundLen;
    return TRUE;
 
-exit:
-   DataMap_Destroy(&map);
+bad:
+   Debug("RpcIn: Error in dataMap decoding for conn %d\n", fd);
    return FALSE;
 }
 
@@ -944,6 +1105,10 @@ RpcInConnRecvedCb(void *buf,            // IN
             AsyncSocket_GetFd(conn->asock), payload);
 
       if (RpcInExecRpc(conn->in, payload, payloadLen, &errmsg)) {
+         if (conn->in->replyDeferred) {
+            /* RpcIn_CompleteReply sends the reply and receives again. */
+            return;
+         }
          conn->in->mustSend = TRUE;
          if (RpcInSend(conn->in, 0)) {
             if (conn->in->heartbeatSrc == NULL) {
@@ -952,7 +1117,6 @@ RpcInConnRecvedCb(void *buf,            // IN
                RpcInRegisterHeartbeatCallback(conn->in);
             }
             RpcInConnRecvHeader(conn);
-            free(payload);
             return;
          } else {
             errmsg = "RpcIn: Unable to send";
@@ -960,7 +1124,6 @@ RpcInConnRecvedCb(void *buf,            // IN
       }
 
       RpcInCloseChannel(conn->in, errmsg);  /* on error */
-      free(payload);
    }
 }
 
@@ -1022,9 +1185,17 @@ RpcInConnRecvPacket(ConnInfo *conn,         // IN
    int32 pktLen = conn->packetLen;
    int fullPktLen = pktLen + sizeof pktLen;
 
-   if (conn->recvBuf == NULL || conn->recvBufLen < fullPktLen) {
+   /*
+    * The buffer is kept across packets, except a large one in the
+    * low-memory profile. One spare byte lets RpcInDecodePacket terminate a
+    * payload at the end of the packet.
+    */
+   if (conn->recvBuf == NULL || conn->recvBufLen < fullPktLen + 1 ||
+       (VMTools_IsLowMemory() &&
+        conn->recvBufLen > MAX(fullPktLen + 1, RPCIN_LOW_MEMORY_BUF_SIZE))) {
       // allocate buffer if needed.
-      conn->recvBufLen = fullPktLen;
+      conn->recvBufLen = MAX(fullPktLen + 1,
+                             RPCIN_MIN_BUF_SIZE(RPCIN_MIN_RECV_BUF_SIZE));
       free(conn->recvBuf);
       conn->recvBuf = malloc(conn->recvBufLen);
       if (conn->recvBuf == NULL) {
@@ -1115,12 +1286,14 @@ RpcInConnectDone(AsyncSocket *asock,   // IN
       goto exit;
    }
 
-   if (!AsyncSocket_EstablishMinBufferSizes(asock, RPCIN_MIN_SEND_BUF_SIZE,
-                                            RPCIN_MIN_RECV_BUF_SIZE)) {
+   if (!AsyncSocket_EstablishMinBufferSizes(asock,
+                        RPCIN_MIN_BUF_SIZE(RPCIN_MIN_SEND_BUF_SIZE),
+                        RPCIN_MIN_BUF_SIZE(RPCIN_MIN_RECV_BUF_SIZE))) {
       goto exit;
    }
 
    conn->connected = TRUE;
+   in->stats.vsock = TRUE;
    RpcInConnRecvHeader(conn);
    return;
 
@@ -1165,6 +1338,10 @@ RpcInSend(RpcIn *in,   // IN
       useBackdoor = FALSE;
       status = RpcInConnSend(in->conn, in->last_result, in->last_resultLen,
                              flags);
+      if (status) {
+         /* The socket owns the reply now. */
+         in->last_result = NULL;
+      }
    }
 #endif
 
@@ -1181,8 +1358,10 @@ RpcInSend(RpcIn *in,   // IN
       Debug("RpcIn: couldn't send back the last result\n");
    }
 
-   free(in->last_result);
-   in->last_result = NULL;
+   if (in->last_result != NULL) {
+      free(in->last_result - RPCIN_RESULT_HEADROOM);
+      in->last_result = NULL;
+   }
    in->last_resultLen = 0;
    in->mustSend = FALSE;
 
@@ -1210,6 +1389,13 @@ static void
 RpcInStop(RpcIn *in) // IN
 {
    ASSERT(in);
+
+   Debug("RpcIn: stopping after %"FMT64"u RPCs, %"FMT64"u idle wakeups\n",
+         in->stats.rpcs, in->stats.idleWakeups);
+   in->stats.vsock = FALSE;
+
+   /* A reply completed from now on is for a channel that is gone. */
+   in->replyDeferred = FALSE;
    if (in->nextEvent) {
       /* The loop is started. Stop it */
 #if defined(VMTOOLS_USE_GLIB)
@@ -1258,6 +1444,35 @@ RpcInStop(RpcIn *in) // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcIn_GetStats --
+ *
+ *      Get the activity counters of the RPC channel. Idle wakeups are the
+ *      empty backdoor polls and the vsocket heartbeats; a channel on
+ *      vsocket otherwise only wakes up when the host sends an RPC.
+ *
+ * Results:
+ *      None
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+RpcIn_GetStats(RpcIn *in,            // IN
+               RpcInStats *stats)    // OUT
+{
+   ASSERT(in);
+   ASSERT(stats);
+
+   *stats = in->stats;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1285,6 +1500,109 @@ RpcIn_stop(RpcIn *in) // IN
 }
 
 
+#if defined(VMTOOLS_USE_GLIB)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcIn_DeferReply --
+ *
+ *      Called by the dispatch function to reply to the current request later,
+ *      with RpcIn_CompleteReply, e.g. once a worker thread has handled it.
+ *      The result of the dispatch function is then ignored. Nothing else is
+ *      received on the channel until the reply is sent.
+ *
+ * Results:
+ *      TRUE if the reply is deferred, FALSE if the caller is not the dispatch
+ *      function of the channel and has to reply right away.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+RpcIn_DeferReply(RpcIn *in) // IN
+{
+   ASSERT(in);
+
+   if (!in->inDispatch || in->replyDeferred) {
+      return FALSE;
+   }
+   in->replyDeferred = TRUE;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcIn_CompleteReply --
+ *
+ *      Send the reply to a request deferred with RpcIn_DeferReply and resume
+ *      receiving. Has to be called on the thread of the channel's main
+ *      context. The reply is dropped if the channel was stopped meanwhile.
+ *
+ * Results:
+ *      None
+ *
+ * Side-effects:
+ *      On failure the channel is closed and its error function called.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+RpcIn_CompleteReply(RpcIn *in,            // IN
+                    Bool status,          // IN
+                    const char *result,   // IN
+                    size_t resultLen)     // IN
+{
+   const char *errmsg = NULL;
+
+   ASSERT(in);
+
+   if (!in->replyDeferred) {
+      Debug("RpcIn: dropping the reply for a stopped channel\n");
+      return;
+   }
+   in->replyDeferred = FALSE;
+
+   if (!RpcInSetResult(in, status, result, resultLen, &errmsg)) {
+      goto error;
+   }
+   ASSERT(in->mustSend == FALSE);
+   in->mustSend = TRUE;
+
+#if defined(VMTOOLS_USE_VSOCKET)
+   if (in->conn != NULL) {
+      if (!RpcInSend(in, 0)) {
+         errmsg = "RpcIn: Unable to send";
+         goto error;
+      }
+      if (in->heartbeatSrc == NULL) {
+         RpcInRegisterHeartbeatCallback(in);
+      }
+      RpcInConnRecvHeader(in->conn);
+      return;
+   }
+#endif
+
+   /* The next RpcInLoop sends the reply along with the poll. */
+   if (!RpcInScheduleRecvEvent(in)) {
+      errmsg = "RpcIn: Unable to run the loop";
+      goto error;
+   }
+   return;
+
+error:
+   /* Call the error routine */
+   (*in->errorFunc)(in->errorData, errmsg);
+   RpcInStop(in);
+}
+#endif
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1308,12 +1626,12 @@ RpcInExecRpc(RpcIn *in,            // IN
              const char **errmsg)  // OUT
 {
    unsigned int status;
-   const char *statusStr;
-   unsigned int statusLen;
    char *result;
    size_t resultLen;
    Bool freeResult = FALSE;
 
+   in->stats.rpcs++;
+
    /*
     * Execute the RPC
     */
@@ -1321,7 +1639,16 @@ RpcInExecRpc(RpcIn *in,            // IN
 #if defined(VMTOOLS_USE_GLIB)
    RpcInData data = { NULL, reply, repLen, NULL, 0, FALSE, NULL, in->clientData };
 
+   in->inDispatch = TRUE;
    status = in->dispatch(&data);
+   in->inDispatch = FALSE;
+
+   if (in->replyDeferred) {
+      /* Poll again right after the reply, as below. */
+      in->delay = 0;
+      return TRUE;
+   }
+
    result = data.result;
    resultLen = data.resultLen;
    freeResult = data.freeResult;
@@ -1354,17 +1681,9 @@ RpcInExecRpc(RpcIn *in,            // IN
    }
 #endif
 
-   statusStr = status ? "OK " : "ERROR ";
-   statusLen = strlen(statusStr);
-
-   in->last_result = (char *)malloc(statusLen + resultLen);
-   if (in->last_result == NULL) {
-      *errmsg = "RpcIn: Not enough memory";
+   if (!RpcInSetResult(in, status, result, resultLen, errmsg)) {
       return FALSE;
    }
-   memcpy(in->last_result, statusStr, statusLen);
-   memcpy(in->last_result + statusLen, result, resultLen);
-   in->last_resultLen = statusLen + resultLen;
 
    if (freeResult) {
       free(result);
@@ -1380,6 +1699,47 @@ RpcInExecRpc(RpcIn *in,            // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcInSetResult --
+ *
+ *      Store the reply to the current request, to be sent by RpcInSend.
+ *
+ * Result:
+ *      TRUE on success, FALSE on error.
+ *
+ * Side-effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcInSetResult(RpcIn *in,            // IN
+               Bool status,          // IN
+               const char *result,   // IN
+               size_t resultLen,     // IN
+               const char **errmsg)  // OUT
+{
+   const char *statusStr = status ? "OK " : "ERROR ";
+   size_t statusLen = strlen(statusStr);
+
+   in->last_result = (char *)malloc(RPCIN_RESULT_HEADROOM + statusLen +
+                                    resultLen);
+   if (in->last_result == NULL) {
+      *errmsg = "RpcIn: Not enough memory";
+      return FALSE;
+   }
+   in->last_result += RPCIN_RESULT_HEADROOM;
+   memcpy(in->last_result, statusStr, statusLen);
+   memcpy(in->last_result + statusLen, result, resultLen);
+   in->last_resultLen = statusLen + resultLen;
+
+   return TRUE;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1606,6 +1966,15 @@ RpcInLoop(void *clientData) // IN
       if (!RpcInExecRpc(in, reply, repLen, &errmsg)) {
          goto error;
       }
+
+      if (in->replyDeferred) {
+         /*
+          * Drop the timer; RpcIn_CompleteReply sets up a new one that sends
+          * the reply.
+          */
+         resched = TRUE;
+         goto exit;
+      }
    } else {
       static uint64 lastPrintMilli = 0;
       uint64 now = System_GetTimeMonotonic() * 10;
@@ -1631,7 +2000,33 @@ RpcInLoop(void *clientData) // IN
       ASSERT(in->last_result == NULL);
       ASSERT(in->last_resultLen == 0);
 
+      in->stats.idleWakeups++;
       RpcInUpdateDelayTime(in);
+
+#if defined(VMTOOLS_USE_VSOCKET)
+      if (in->vsockRetryTime != 0 && !in->shouldStop &&
+          System_GetTimeMonotonic() >= in->vsockRetryTime) {
+         /*
+          * Nothing is pending on the backdoor, so this is a good time to
+          * try to switch back to the event driven vsocket connection.
+          * Dropping this timer source is the last use of it; if vsocket
+          * fails again RpcInOpenChannel sets up a new one.
+          */
+         Debug("RpcIn: trying to switch from backdoor to vsocket ...\n");
+         if (Message_Close(in->channel) == FALSE) {
+            Debug("RpcIn: couldn't close channel\n");
+         }
+         in->channel = NULL;
+         g_source_unref(in->nextEvent);
+         in->nextEvent = NULL;
+         resched = TRUE;
+         if (!RpcInOpenChannel(in, FALSE)) {
+            errmsg = "RpcIn: Unable to reopen the channel";
+            goto error;
+         }
+         goto exit;
+      }
+#endif
    }
 
    ASSERT(in->mustSend == FALSE);
@@ -1696,6 +2091,11 @@ RpcInScheduleRecvEvent(RpcIn *in)      // IN
    }
    in->nextEvent = VMTools_CreateTimer(in->delay * 10);
    if (in->nextEvent != NULL) {
+      /*
+       * Host commands (option changes, quiescing, power operations) should
+       * not wait behind other main loop work that is ready at the same time.
+       */
+      g_source_set_priority(in->nextEvent, G_PRIORITY_HIGH);
       g_source_set_callback(in->nextEvent, RpcInLoop, in, NULL);
       g_source_attach(in->nextEvent, in->mainCtx);
    }
@@ -1789,6 +2189,9 @@ RpcInOpenChannel(RpcIn *in,                 // IN
       in->conn = NULL;
    }
 
+   in->vsockRetryTime = initOk ?
+                        System_GetTimeMonotonic() + RPCIN_VSOCK_RETRY_INTERVAL :
+                        0;
 #endif
 
    ASSERT(in->channel == NULL);
@@ -66,6 +66,12 @@
 struct RpcOut {
    Message_Channel channel;
    Bool started;
+   /*
+    * Receive buffer of the last channel, kept across a stop and start so
+    * that a restarted channel does not grow a new one.
+    */
+   unsigned char *spareIn;
+   size_t spareInAlloc;
 };
 
 
@@ -139,6 +145,7 @@ RpcOut_Destruct(RpcOut *out) // IN
    ASSERT(out != NULL);
    ASSERT(!out->started);
 
+   free(out->spareIn);
    free(out);
 }
 
@@ -176,6 +183,12 @@ RpcOut_startWithReceiveBuffer(RpcOut *out, char *receiveBuffer,
                                         receiveBuffer, receiveBufferSize);
    if (!out->started) {
       Debug("RpcOut: couldn't open channel with RPCI protocol\n");
+   } else if (receiveBuffer == NULL && out->spareIn != NULL) {
+      /* Reuse the receive buffer of the previous channel. */
+      out->channel.in = out->spareIn;
+      out->channel.inAlloc = out->spareInAlloc;
+      out->spareIn = NULL;
+      out->spareInAlloc = 0;
    }
    return out->started;
 }
@@ -301,6 +314,14 @@ RpcOut_stop(RpcOut *out) // IN
    ASSERT(out != NULL);
 
    if (out->started) {
+      if (!out->channel.inPreallocated && out->channel.in != NULL) {
+         free(out->spareIn);
+         out->spareIn = out->channel.in;
+         out->spareInAlloc = out->channel.inAlloc;
+         out->channel.in = NULL;
+         out->channel.inAlloc = 0;
+      }
+
       /* Try to close the channel */
       if (Message_CloseAllocated(&out->channel) == FALSE) {
          Debug("RpcOut: couldn't close channel\n");
@@ -507,6 +528,9 @@ RpcOutSendOneRawWork(void *request,         // IN: RPCI command
       status = FALSE;
    }
 
+   /* The channel is not reused, drop its receive buffer. */
+   free(out.spareIn);
+
    return status && rpcStatus;
 }
 
@@ -50,21 +50,50 @@
 
 
 /**
- * @brief Evaluate an expression with a regular expression match.
- *
- * Convenience wrapper to fetch a regular expression match result, evaluate
- * it as an argument in some expression, and then free it.
- *
- * @param[in] matchInfo  GMatchInfo RE context.
- * @param[in] matchIndex Match index.
- * @param[in] expr       Expression to evaluate.  Must contain @c MATCH as
- *                       placeholder where matched value will be inserted.
+ * Initial size of the read buffer.  Lines longer than this grow it.
+ */
+#define SLASHPROC_BUF_SIZE      (64 * 1024)
+
+
+/**
+ * Per-thread state kept from one call to the next, so that parsing a node
+ * does not allocate anything but the result.
  */
-#define MATCHEXPR(matchInfo, matchIndex, expr) do {                     \
-   gchar *MATCH = g_match_info_fetch(matchInfo, matchIndex);            \
-   expr;                                                                \
-   g_free(MATCH);                                                       \
-} while(0)
+typedef struct SlashProcNetCache {
+   char        *buf;            ///< Read buffer.
+   size_t       bufSize;        ///< Size of buf.
+   GArray      *entries;        ///< IPv4 routes being collected.
+   GString     *names;          ///< Interface names of the IPv4 routes.
+   GArray      *entries6;       ///< IPv6 routes being collected.
+} SlashProcNetCache;
+
+
+/**
+ * A node being read, line by line, through the read buffer of the thread.
+ */
+typedef struct SlashProcFile {
+   int                  fd;
+   SlashProcNetCache   *cache;
+   size_t               start;  ///< Start of the unparsed data in buf.
+   size_t               end;    ///< End of the data in buf.
+   Bool                 eof;
+   Bool                 error;
+} SlashProcFile;
+
+
+/**
+ * A route of @ref pathToNetRoute before it is handed out: rt_dev is not
+ * set yet, the name is at devOffset in the names of the cache.
+ */
+typedef struct SlashProcRoute {
+   struct rtentry       rt;
+   gsize                devOffset;
+} SlashProcRoute;
+
+
+static void SlashProcNetCacheFree(gpointer data);
+
+static GPrivate slashProcNetCache = G_PRIVATE_INIT(SlashProcNetCacheFree);
 
 
 /**
@@ -95,11 +124,23 @@ static const char *pathToNetRoute6 = PROC_NET_ROUTE6;
  * Private function prototypes.
  */
 
-static void Ip6StringToIn6Addr(const char *ip6String,
-                               struct in6_addr *in6_addr);
-static guint64 MatchToGuint64(const GMatchInfo *matchInfo,
-                              const gint matchIndex,
-                              gint base);
+static SlashProcNetCache *SlashProcNetGetCache(void);
+static Bool SlashProcFileOpen(const char *path,
+                              SlashProcFile *file);
+static char *SlashProcFileReadLine(SlashProcFile *file);
+static void SlashProcFileClose(SlashProcFile *file);
+static char *NextField(char **cursor);
+static Bool IsWord(const char *field);
+static Bool IsPrefix(const char *field,
+                     size_t *len);
+static Bool ParseUint(const char *field,
+                      unsigned int base,
+                      size_t digits,
+                      guint64 *value);
+static Bool ParseInt(const char *field,
+                     guint64 *value);
+static Bool ParseIn6Addr(const char *field,
+                         struct in6_addr *in6_addr);
 
 
 /*
@@ -203,11 +244,10 @@ SlashProcNetSetPathRoute6(const char *newPathToNetRoute6)
  *
  * @note        Caller should free the returned @c GHashTable with
  *              @c g_hash_table_destroy.
- * @note        This routine creates persistent GLib GRegexs.
+ * @note        This routine keeps a per-thread read buffer.
  *
  * @return      On failure, NULL.  On success, a valid @c GHashTable.
  * @todo        Provide a case-insensitive key comparison function.
- * @todo        Consider init/cleanup routines to not "leak" GRegexs.
  *
  ******************************************************************************
  */
@@ -215,34 +255,18 @@ SlashProcNetSetPathRoute6(const char *newPathToNetRoute6)
 GHashTable *
 SlashProcNet_GetSnmp(void)
 {
+   SlashProcFile file;
    GHashTable *myHashTable = NULL;
-   GIOChannel *myChannel = NULL;
-   GIOStatus keyIoStatus = G_IO_STATUS_ERROR;
-   GIOStatus valIoStatus = G_IO_STATUS_ERROR;
-   gchar *myKeyLine = NULL;
-   gchar *myValLine = NULL;
+   GPtrArray *myKeys = NULL;
+   char *myKeyLine;
    Bool parseError = FALSE;
-   int fd = -1;
-
-   static GRegex *myKeyRegex = NULL;
-   static GRegex *myValRegex = NULL;
 
-   if (myKeyRegex == NULL) {
-      myKeyRegex = g_regex_new("^(\\w+): (\\w+ )*(\\w+)$", G_REGEX_OPTIMIZE,
-                               0, NULL);
-      myValRegex = g_regex_new("^(\\w+): (-?\\d+ )*(-?\\d+)$", G_REGEX_OPTIMIZE,
-                               0, NULL);
-      ASSERT(myKeyRegex);
-      ASSERT(myValRegex);
-   }
-
-   if ((fd = g_open(pathToNetSnmp, O_RDONLY)) == -1) {
+   if (!SlashProcFileOpen(pathToNetSnmp, &file)) {
       return NULL;
    }
 
-   myChannel = g_io_channel_unix_new(fd);
-
    myHashTable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+   myKeys = g_ptr_array_new_with_free_func(g_free);
 
    /*
     * Expected format:
@@ -253,101 +277,80 @@ SlashProcNet_GetSnmp(void)
     * pfxN: ...
     */
 
-   while ((keyIoStatus = g_io_channel_read_line(myChannel, &myKeyLine, NULL, NULL,
-                                                NULL)) == G_IO_STATUS_NORMAL &&
-          (valIoStatus = g_io_channel_read_line(myChannel, &myValLine, NULL, NULL,
-                                                NULL)) == G_IO_STATUS_NORMAL) {
-
-      GMatchInfo *keyMatchInfo = NULL;
-      GMatchInfo *valMatchInfo = NULL;
-
-      gchar **myKeys = NULL;
-      gchar **myVals = NULL;
-
-      gchar **myKey = NULL;
-      gchar **myVal = NULL;
-
-      gchar *keyPrefix = NULL;
-      gchar *valPrefix = NULL;
+   while ((myKeyLine = SlashProcFileReadLine(&file)) != NULL) {
+      char *myValLine;
+      char *cursor = myKeyLine;
+      char *prefix = NextField(&cursor);
+      char *field;
+      size_t prefixLen;
+      size_t valPrefixLen;
+      guint i;
 
       /*
-       * Per format above, we expect a pair of lines with a matching prefix.
+       * Combine the column keys with the prefix to form the key names.
+       * (I.e., "Ip: InDiscards" => "IpInDiscards".)  The key line is gone
+       * once the value line is read; the prefix stays at the start of the
+       * first key.
        */
-      {
-         if (!g_regex_match(myKeyRegex, myKeyLine, 0, &keyMatchInfo) ||
-             !g_regex_match(myValRegex, myValLine, 0, &valMatchInfo)) {
-            parseError = TRUE;
-            goto badIteration;
-         }
-
-         keyPrefix = g_match_info_fetch(keyMatchInfo, 1);
-         valPrefix = g_match_info_fetch(valMatchInfo, 1);
-
-         ASSERT(keyPrefix);
-         ASSERT(valPrefix);
+      if (!IsPrefix(prefix, &prefixLen)) {
+         parseError = TRUE;
+         break;
+      }
+      prefix[prefixLen] = '\0';
 
-         if (strcmp(keyPrefix, valPrefix)) {
+      g_ptr_array_set_size(myKeys, 0);
+      while ((field = NextField(&cursor)) != NULL) {
+         if (!IsWord(field)) {
             parseError = TRUE;
-            goto badIteration;
+            break;
          }
+         g_ptr_array_add(myKeys, g_strconcat(prefix, field, NULL));
+      }
+      if (parseError || myKeys->len == 0) {
+         parseError = TRUE;
+         break;
       }
-
-      myKeys = g_strsplit(myKeyLine, " ", 0);
-      myVals = g_strsplit(myValLine, " ", 0);
 
       /*
-       * Iterate over the columns, combining the column keys with the prefix
-       * to form the new key name.  (I.e., "Ip: InDiscards" => "IpInDiscards".)
+       * Per format above, we expect a pair of lines with a matching prefix.
        */
-      for (myKey = &myKeys[1], myVal = &myVals[1];
-           *myKey && *myVal;
-           myKey++, myVal++) {
-         gchar *hashKey;
-         guint64 *myIntVal = NULL;
+      if ((myValLine = SlashProcFileReadLine(&file)) == NULL) {
+         break;
+      }
 
-         hashKey = g_strjoin(NULL, keyPrefix, *myKey, NULL);
-         g_strstrip(hashKey);
+      cursor = myValLine;
+      field = NextField(&cursor);
+      if (!IsPrefix(field, &valPrefixLen) || valPrefixLen != prefixLen ||
+          memcmp(field, g_ptr_array_index(myKeys, 0), prefixLen) != 0) {
+         parseError = TRUE;
+         break;
+      }
 
-         /*
-          * By virtue of having matched the above regex, this conversion
-          * must hold.
-          */
-         myIntVal = g_new(guint64, 1);
-         *myIntVal = g_ascii_strtoull(*myVal, NULL, 10);
+      for (i = 0; i < myKeys->len; i++) {
+         guint64 *myIntVal = g_new(guint64, 1);
+
+         if (!ParseInt(NextField(&cursor), myIntVal)) {
+            g_free(myIntVal);
+            parseError = TRUE;
+            break;
+         }
 
          /*
           * If our input contains duplicate keys, which I really don't see
           * happening, the latter value overrides the former.
           *
-          * NB: myHashTable claims ownership of hashKey.
+          * NB: myHashTable claims ownership of the key.
           */
-         g_hash_table_insert(myHashTable, hashKey, myIntVal);
+         g_hash_table_insert(myHashTable, g_ptr_array_index(myKeys, i),
+                             myIntVal);
+         g_ptr_array_index(myKeys, i) = NULL;
       }
 
       /*
-       * Make sure the column counts matched.  If we succeeded, both pointers
-       * should now be NULL.
+       * Make sure the column counts matched.
        */
-      if (*myKey || *myVal) {
+      if (parseError || NextField(&cursor) != NULL) {
          parseError = TRUE;
-      }
-
-badIteration:
-      g_match_info_free(keyMatchInfo);
-      g_match_info_free(valMatchInfo);
-
-      g_free(keyPrefix);
-      g_free(valPrefix);
-
-      g_strfreev(myKeys);
-      g_strfreev(myVals);
-
-      g_free(myKeyLine);
-      g_free(myValLine);
-      myKeyLine = NULL;
-      myValLine = NULL;
-
-      if (parseError) {
          break;
       }
    }
@@ -355,25 +358,17 @@ badIteration:
    /*
     * Error conditions:
     *    Hash table empty:      Unable to parse any input.
-    *    myKeyLine != NULL:     Failed to read "key" and "value" lines during
-    *                           same loop iteration.
     *    parseError == TRUE:    See loop body above.
     */
-   if (keyIoStatus == G_IO_STATUS_ERROR ||
-       valIoStatus == G_IO_STATUS_ERROR ||
+   if (file.error ||
        g_hash_table_size(myHashTable) == 0 ||
        parseError) {
       g_hash_table_destroy(myHashTable);
       myHashTable = NULL;
    }
 
-   g_free(myKeyLine);
-   g_free(myValLine);
-   myKeyLine = NULL;
-   myValLine = NULL;
-
-   close(fd);
-   g_io_channel_unref(myChannel);
+   g_ptr_array_free(myKeys, TRUE);
+   SlashProcFileClose(&file);
 
    return myHashTable;
 }
@@ -394,11 +389,10 @@ badIteration:
  *
  * @note        Caller should free the returned @c GHashTable with
  *              @c g_hash_table_destroy.
- * @note        This routine creates persistent GLib GRegexs.
+ * @note        This routine keeps a per-thread read buffer.
  *
  * @return      On failure, NULL.  On success, a valid @c GHashTable.
  * @todo        Provide a case-insensitive key comparison function.
- * @todo        Consider init/cleanup routines to not "leak" GRegexs.
  *
  ******************************************************************************
  */
@@ -406,27 +400,15 @@ badIteration:
 GHashTable *
 SlashProcNet_GetSnmp6(void)
 {
+   SlashProcFile file;
    GHashTable *myHashTable = NULL;
-   GIOChannel *myChannel = NULL;
-   GIOStatus ioStatus;
-   gchar *myInputLine = NULL;
+   char *myInputLine;
    Bool parseError = FALSE;
-   int fd = -1;
-
-   static GRegex *myRegex = NULL;
-
-   if (myRegex == NULL) {
-      myRegex = g_regex_new("^(\\w+)\\s+(-?\\d+)\\s*$", G_REGEX_OPTIMIZE,
-                            0, NULL);
-      ASSERT(myRegex);
-   }
 
-   if ((fd = g_open(pathToNetSnmp6, O_RDONLY)) == -1) {
+   if (!SlashProcFileOpen(pathToNetSnmp6, &file)) {
       return NULL;
    }
 
-   myChannel = g_io_channel_unix_new(fd);
-
    myHashTable = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
 
    /*
@@ -438,53 +420,33 @@ SlashProcNet_GetSnmp6(void)
     * keyN                              valueN
     */
 
-   while ((ioStatus = g_io_channel_read_line(myChannel, &myInputLine, NULL,
-                                             NULL, NULL)) == G_IO_STATUS_NORMAL) {
-      GMatchInfo *matchInfo = NULL;
-
-      if (g_regex_match(myRegex, myInputLine, 0, &matchInfo)) {
-         gchar *myKey = NULL;
-         gchar *myVal = NULL;
-         guint64 *myIntVal = NULL;
-
-         myKey = g_match_info_fetch(matchInfo, 1);
-         myVal = g_match_info_fetch(matchInfo, 2);
+   while ((myInputLine = SlashProcFileReadLine(&file)) != NULL) {
+      char *cursor = myInputLine;
+      char *myKey = NextField(&cursor);
+      guint64 *myIntVal = g_new(guint64, 1);
 
-         /*
-          * By virtue of having matched the above regex, this conversion
-          * must hold.
-          */
-         myIntVal = g_new(guint64, 1);
-         *myIntVal = g_ascii_strtoull(myVal, NULL, 10);
-
-         /*
-          * The hash table will take ownership of myKey and myIntVal.  We're
-          * still responsible for myVal.
-          */
-         g_hash_table_insert(myHashTable, myKey, myIntVal);
-         g_free(myVal);
-      } else {
+      if (!IsWord(myKey) ||
+          !ParseInt(NextField(&cursor), myIntVal) ||
+          NextField(&cursor) != NULL) {
+         g_free(myIntVal);
          parseError = TRUE;
-      }
-
-      g_match_info_free(matchInfo);
-      g_free(myInputLine);
-      myInputLine = NULL;
-
-      if (parseError) {
          break;
       }
+
+      /*
+       * The hash table will take ownership of the key and myIntVal.
+       */
+      g_hash_table_insert(myHashTable, g_strdup(myKey), myIntVal);
    }
 
-   if (ioStatus == G_IO_STATUS_ERROR ||
+   if (file.error ||
        g_hash_table_size(myHashTable) == 0 ||
        parseError) {
       g_hash_table_destroy(myHashTable);
       myHashTable = NULL;
    }
 
-   close(fd);
-   g_io_channel_unref(myChannel);
+   SlashProcFileClose(&file);
 
    return myHashTable;
 }
@@ -510,15 +472,15 @@ SlashProcNet_GetSnmp6(void)
  * @endcode
  *
  * @note        Caller is responsible for freeing the @c GPtrArray with
- *              SlashProcNet_FreeRoute.
- * @note        This routine creates persistent GLib GRegexs.
+ *              SlashProcNet_FreeRoute.  The entries share one allocation
+ *              and must not be freed individually.
+ * @note        This routine keeps a per-thread read buffer.
  *
  * @param[in]   maxRoutes       Max routes to gather.
  * @param[in]   rtFilterFlags   Route flags used to filter out what we want.
  *                              Set ~0 if want everything.
  *
  * @return      On failure, NULL.  On success, a valid @c GPtrArray.
- * @todo        Consider init/cleanup routines to not "leak" GRegexs.
  * @todo        Consider rewriting, integrating with libdnet.
  *
  ******************************************************************************
@@ -528,42 +490,33 @@ GPtrArray *
 SlashProcNet_GetRoute(unsigned int maxRoutes,
                       unsigned short rtFilterFlags)
 {
-   GIOChannel *myChannel = NULL;
-   GIOStatus myIoStatus;
+   static const char *myFields[] = {
+      "Iface", "Destination", "Gateway", "Flags", "RefCnt", "Use", "Metric",
+      "Mask", "MTU", "Window", "IRTT",
+   };
+   SlashProcFile file;
+   SlashProcNetCache *cache;
    GPtrArray *myArray = NULL;
-   gchar *myLine = NULL;
-   int fd = -1;
-   unsigned int lineCount = 0;
-
-   static GRegex *myFieldsRE = NULL;
-   static GRegex *myValuesRE = NULL;
+   struct rtentry *myEntries;
+   char *myNames;
+   char *myLine;
+   char *cursor;
+   gsize lastDev = 0;
+   Bool parseError = FALSE;
+   unsigned int i;
 
    ASSERT(maxRoutes > 0);
 
-   if (myFieldsRE == NULL) {
-      myFieldsRE = g_regex_new("^Iface\\s+Destination\\s+Gateway\\s+Flags\\s+"
-                               "RefCnt\\s+Use\\s+Metric\\s+Mask\\s+MTU\\s+"
-                               "Window\\s+IRTT\\s*$", 0, 0, NULL);
-      myValuesRE = g_regex_new("^(\\S+)\\s+([[:xdigit:]]{8})\\s+"
-                               "([[:xdigit:]]{8})\\s+([[:xdigit:]]{4})\\s+"
-                               "\\d+\\s+\\d+\\s+(\\d+)\\s+"
-                               "([[:xdigit:]]{8})\\s+(\\d+)\\s+\\d+\\s+(\\d+)\\s*$",
-                               0, 0, NULL);
-      ASSERT(myFieldsRE);
-      ASSERT(myValuesRE);
-   }
-
    /*
-    * 1.  Open pathToNetRoute, associate it with a GIOChannel.
+    * 1.  Open pathToNetRoute.
     */
 
-   if ((fd = g_open(pathToNetRoute, O_RDONLY)) == -1) {
+   if (!SlashProcFileOpen(pathToNetRoute, &file)) {
       Warning("%s: open(%s): %s\n", __func__, pathToNetRoute,
               g_strerror(errno));
       return NULL;
    }
-
-   myChannel = g_io_channel_unix_new(fd);
+   cache = file.cache;
 
    /*
     * 2.  Sanity check the header, making sure it matches what we expect.
@@ -571,95 +524,128 @@ SlashProcNet_GetRoute(unsigned int maxRoutes,
     *     anyway.)
     */
 
-   myIoStatus = g_io_channel_read_line(myChannel, &myLine, NULL, NULL, NULL);
-   if (myIoStatus != G_IO_STATUS_NORMAL ||
-       g_regex_match(myFieldsRE, myLine, 0, NULL) == FALSE) {
+   if ((myLine = SlashProcFileReadLine(&file)) == NULL) {
       goto out;
    }
+   cursor = myLine;
+   for (i = 0; i < ARRAYSIZE(myFields); i++) {
+      char *field = NextField(&cursor);
 
-   g_free(myLine);
-   myLine = NULL;
+      if (field == NULL || strcmp(field, myFields[i]) != 0) {
+         goto out;
+      }
+   }
+   if (NextField(&cursor) != NULL) {
+      goto out;
+   }
 
-   myArray = g_ptr_array_new();
+   g_array_set_size(cache->entries, 0);
+   g_string_truncate(cache->names, 0);
 
    /*
-    * 3.  For each line...
+    * 3.  For each line, validate and convert the fields:
+    *
+    *     Iface Destination Gateway Flags RefCnt Use Metric Mask MTU Window IRTT
+    *     eth0  0000A8C0    00000000 0001 0      0   100    00FFFFFF 0 0   0
     */
 
-   while (lineCount < maxRoutes &&
-             (myIoStatus = g_io_channel_read_line(myChannel,
-                  &myLine, NULL, NULL, NULL)) == G_IO_STATUS_NORMAL) {
-      GMatchInfo *myMatchInfo = NULL;
-      struct rtentry *myEntry = NULL;
-      struct sockaddr_in *sin = NULL;
-      Bool parseError = FALSE;
-
-      /*
-       * 3a. Validate with regex.
-       */
-      if (!g_regex_match(myValuesRE, myLine, 0, &myMatchInfo)) {
+   while (cache->entries->len < maxRoutes &&
+          (myLine = SlashProcFileReadLine(&file)) != NULL) {
+      SlashProcRoute myRoute = { { 0 } };
+      struct sockaddr_in *sin;
+      char *myDev;
+      guint64 myDst;
+      guint64 myGateway;
+      guint64 myFlags;
+      guint64 myMetric;
+      guint64 myMask;
+      guint64 myMtu;
+      guint64 myIrtt;
+      guint64 unused;
+
+      cursor = myLine;
+      myDev = NextField(&cursor);
+      if (myDev == NULL ||
+          !ParseUint(NextField(&cursor), 16, 8, &myDst) ||
+          !ParseUint(NextField(&cursor), 16, 8, &myGateway) ||
+          !ParseUint(NextField(&cursor), 16, 4, &myFlags) ||
+          !ParseUint(NextField(&cursor), 10, 0, &unused) ||
+          !ParseUint(NextField(&cursor), 10, 0, &unused) ||
+          !ParseUint(NextField(&cursor), 10, 0, &myMetric) ||
+          !ParseUint(NextField(&cursor), 16, 8, &myMask) ||
+          !ParseUint(NextField(&cursor), 10, 0, &myMtu) ||
+          !ParseUint(NextField(&cursor), 10, 0, &unused) ||
+          !ParseUint(NextField(&cursor), 10, 0, &myIrtt) ||
+          NextField(&cursor) != NULL) {
          parseError = TRUE;
-         goto iterationCleanup;
+         break;
       }
 
-      /*
-       * 3b. Allocate new rtentry, add to array.  This simplifies the cleanup
-       *     code path.
-       */
-      myEntry = g_new0(struct rtentry, 1);
-
-      /*
-       * 3c. Copy contents to new struct rtentry.
-       */
-      myEntry->rt_dev = g_match_info_fetch(myMatchInfo, 1);
+      myRoute.rt.rt_flags = myFlags;
+      if (rtFilterFlags != (unsigned short)~0 &&
+          (myRoute.rt.rt_flags & rtFilterFlags) == 0) {
+         continue;
+      }
 
-      sin = (struct sockaddr_in *)&myEntry->rt_dst;
+      sin = (struct sockaddr_in *)&myRoute.rt.rt_dst;
       sin->sin_family = AF_INET;
-      sin->sin_addr.s_addr = MatchToGuint64(myMatchInfo, 2, 16);
+      sin->sin_addr.s_addr = myDst;
 
-      sin = (struct sockaddr_in *)&myEntry->rt_gateway;
+      sin = (struct sockaddr_in *)&myRoute.rt.rt_gateway;
       sin->sin_family = AF_INET;
-      sin->sin_addr.s_addr = MatchToGuint64(myMatchInfo, 3, 16);
+      sin->sin_addr.s_addr = myGateway;
 
-      sin = (struct sockaddr_in *)&myEntry->rt_genmask;
+      sin = (struct sockaddr_in *)&myRoute.rt.rt_genmask;
       sin->sin_family = AF_INET;
-      sin->sin_addr.s_addr = MatchToGuint64(myMatchInfo, 6, 16);
+      sin->sin_addr.s_addr = myMask;
 
-      myEntry->rt_flags = MatchToGuint64(myMatchInfo, 4, 16);
-      myEntry->rt_metric = MatchToGuint64(myMatchInfo, 5, 10);
-      myEntry->rt_mtu = MatchToGuint64(myMatchInfo, 7, 10);
-      myEntry->rt_irtt = MatchToGuint64(myMatchInfo, 8, 10);
+      myRoute.rt.rt_metric = myMetric;
+      myRoute.rt.rt_mtu = myMtu;
+      myRoute.rt.rt_irtt = myIrtt;
 
-      if (rtFilterFlags == (unsigned short)~0 ||
-          (myEntry->rt_flags & rtFilterFlags) != 0) {
-         g_ptr_array_add(myArray, myEntry);
-         lineCount++;
-      } else {
-         g_free(myEntry->rt_dev);
-         g_free(myEntry);
+      /*
+       * Routes come grouped by interface; store each name once per group.
+       */
+      if (cache->names->len == 0 ||
+          strcmp(cache->names->str + lastDev, myDev) != 0) {
+         lastDev = cache->names->len;
+         g_string_append_len(cache->names, myDev, strlen(myDev) + 1);
       }
+      myRoute.devOffset = lastDev;
 
-iterationCleanup:
-      g_free(myLine);
-      myLine = NULL;
+      g_array_append_val(cache->entries, myRoute);
+   }
 
-      g_match_info_free(myMatchInfo);
-      myMatchInfo = NULL;
+   if (parseError || file.error) {
+      /* Return NULL to signal parsing error */
+      goto out;
+   }
 
-      if (parseError) {
-         /* Return NULL to signal parsing error */
-         if (myArray) {
-            SlashProcNet_FreeRoute(myArray);
-            myArray = NULL;
-         }
-         break;
-      }
+   /*
+    * 4.  Hand out the routes and their interface names in one allocation.
+    */
+
+   myArray = g_ptr_array_sized_new(cache->entries->len);
+   if (cache->entries->len == 0) {
+      goto out;
+   }
+
+   myEntries = g_malloc(cache->entries->len * sizeof *myEntries +
+                        cache->names->len);
+   myNames = (char *)&myEntries[cache->entries->len];
+   memcpy(myNames, cache->names->str, cache->names->len);
+
+   for (i = 0; i < cache->entries->len; i++) {
+      const SlashProcRoute *myRoute = &g_array_index(cache->entries,
+                                                     SlashProcRoute, i);
+
+      myEntries[i] = myRoute->rt;
+      myEntries[i].rt_dev = myNames + myRoute->devOffset;
+      g_ptr_array_add(myArray, &myEntries[i]);
    }
 
 out:
-   g_free(myLine);
-   close(fd);
-   g_io_channel_unref(myChannel);
+   SlashProcFileClose(&file);
 
    return myArray;
 }
@@ -680,17 +666,13 @@ out:
 void
 SlashProcNet_FreeRoute(GPtrArray *routeArray)
 {
-   int i;
-
    if (routeArray == NULL) {
       return;
    }
 
-   for (i = 0; i < routeArray->len; i++) {
-      struct rtentry *myEntry = g_ptr_array_index(routeArray, i);
-      ASSERT(myEntry->rt_dev);
-      g_free(myEntry->rt_dev);
-      g_free(myEntry);
+   /* The first entry is the start of the allocation of all the entries. */
+   if (routeArray->len > 0) {
+      g_free(g_ptr_array_index(routeArray, 0));
    }
 
    g_ptr_array_free(routeArray, TRUE);
@@ -717,15 +699,15 @@ SlashProcNet_FreeRoute(GPtrArray *routeArray)
  * @endcode
  *
  * @note        Caller is responsible for freeing the @c GPtrArray with
- *              SlashProcNet_FreeRoute6.
- * @note        This routine creates persistent GLib GRegexs.
+ *              SlashProcNet_FreeRoute6.  The entries share one allocation
+ *              and must not be freed individually.
+ * @note        This routine keeps a per-thread read buffer.
  *
  * @param[in]   maxRoutes       Max routes to gather.
  * @param[in]   rtFilterFlags   Route flags used to filter out what we want.
  *                              Set ~0 if want everything.
  *
  * @return      On failure, NULL.  On success, a valid @c GPtrArray.
- * @todo        Consider init/cleanup routines to not "leak" GRegexs.
  * @todo        Consider rewriting, integrating with libdnet.
  *
  ******************************************************************************
@@ -735,96 +717,108 @@ GPtrArray *
 SlashProcNet_GetRoute6(unsigned int maxRoutes,
                        unsigned int rtFilterFlags)
 {
-   GIOChannel *myChannel = NULL;
-   GIOStatus myIoStatus;
+   SlashProcFile file;
+   SlashProcNetCache *cache;
    GPtrArray *myArray = NULL;
-   gchar *myLine = NULL;
+   struct in6_rtmsg *myEntries;
+   char *myLine;
+   char lastDev[IFNAMSIZ] = "";
+   unsigned int lastIfIndex = 0;
    Bool parseError = FALSE;
-   int fd = -1;
-   unsigned int lineCount = 0;
-
-   static GRegex *myValuesRE = NULL;
+   unsigned int i;
 
    ASSERT(maxRoutes > 0);
 
-   if (myValuesRE == NULL) {
-      myValuesRE = g_regex_new("^([[:xdigit:]]{32}) ([[:xdigit:]]{2}) "
-                                "([[:xdigit:]]{32}) ([[:xdigit:]]{2}) "
-                                "([[:xdigit:]]{32}) ([[:xdigit:]]{8}) "
-                                "[[:xdigit:]]{8} [[:xdigit:]]{8} "
-                                "([[:xdigit:]]{8})\\s+(\\S+)\\s*$", 0, 0,
-                                NULL);
-      ASSERT(myValuesRE);
-   }
-
-   /*
-    * 1.  Open pathToNetRoute6, associate it with a GIOChannel.
-    */
-
-   if ((fd = g_open(pathToNetRoute6, O_RDONLY)) == -1) {
+   if (!SlashProcFileOpen(pathToNetRoute6, &file)) {
       Warning("%s: open(%s): %s\n", __func__, pathToNetRoute6,
               g_strerror(errno));
       return NULL;
    }
+   cache = file.cache;
 
-   myChannel = g_io_channel_unix_new(fd);
+   g_array_set_size(cache->entries6, 0);
 
-   myArray = g_ptr_array_new();
-
-   while (lineCount < maxRoutes &&
-               (myIoStatus = g_io_channel_read_line(myChannel,
-                     &myLine, NULL, NULL, NULL)) == G_IO_STATUS_NORMAL) {
-      struct in6_rtmsg *myEntry = NULL;
-      GMatchInfo *myMatchInfo = NULL;
+   /*
+    * Expected format, one route per line:
+    *
+    *    dst dstLen src srcLen gateway metric refCnt use flags iface
+    *
+    * with 32 hex digits for the addresses, 2 for the lengths and 8 for the
+    * numbers.
+    */
 
-      if (!g_regex_match(myValuesRE, myLine, 0, &myMatchInfo)) {
+   while (cache->entries6->len < maxRoutes &&
+          (myLine = SlashProcFileReadLine(&file)) != NULL) {
+      struct in6_rtmsg myEntry;
+      char *cursor = myLine;
+      char *myDev;
+      guint64 myDstLen;
+      guint64 mySrcLen;
+      guint64 myMetric;
+      guint64 myFlags;
+      guint64 unused;
+
+      memset(&myEntry, 0, sizeof myEntry);
+      if (!ParseIn6Addr(NextField(&cursor), &myEntry.rtmsg_dst) ||
+          !ParseUint(NextField(&cursor), 16, 2, &myDstLen) ||
+          !ParseIn6Addr(NextField(&cursor), &myEntry.rtmsg_src) ||
+          !ParseUint(NextField(&cursor), 16, 2, &mySrcLen) ||
+          !ParseIn6Addr(NextField(&cursor), &myEntry.rtmsg_gateway) ||
+          !ParseUint(NextField(&cursor), 16, 8, &myMetric) ||
+          !ParseUint(NextField(&cursor), 16, 8, &unused) ||
+          !ParseUint(NextField(&cursor), 16, 8, &unused) ||
+          !ParseUint(NextField(&cursor), 16, 8, &myFlags) ||
+          (myDev = NextField(&cursor)) == NULL ||
+          NextField(&cursor) != NULL) {
          parseError = TRUE;
-         goto iterationCleanup;
+         break;
       }
 
-      myEntry = g_new0(struct in6_rtmsg, 1);
-
-      MATCHEXPR(myMatchInfo, 1, Ip6StringToIn6Addr(MATCH, &myEntry->rtmsg_dst));
-      MATCHEXPR(myMatchInfo, 3, Ip6StringToIn6Addr(MATCH, &myEntry->rtmsg_src));
-      MATCHEXPR(myMatchInfo, 5, Ip6StringToIn6Addr(MATCH, &myEntry->rtmsg_gateway));
-
-      myEntry->rtmsg_dst_len = MatchToGuint64(myMatchInfo, 2, 16);
-      myEntry->rtmsg_src_len = MatchToGuint64(myMatchInfo, 4, 16);
-      myEntry->rtmsg_metric = MatchToGuint64(myMatchInfo, 6, 16);
-      myEntry->rtmsg_flags = MatchToGuint64(myMatchInfo, 7, 16);
+      myEntry.rtmsg_dst_len = myDstLen;
+      myEntry.rtmsg_src_len = mySrcLen;
+      myEntry.rtmsg_metric = myMetric;
+      myEntry.rtmsg_flags = myFlags;
 
-      MATCHEXPR(myMatchInfo, 8, myEntry->rtmsg_ifindex = if_nametoindex(MATCH));
+      if (rtFilterFlags != (uint)~0 &&
+          (myEntry.rtmsg_flags & rtFilterFlags) == 0) {
+         continue;
+      }
 
-      if (rtFilterFlags == (uint)~0 ||
-          (myEntry->rtmsg_flags & rtFilterFlags) != 0) {
-         g_ptr_array_add(myArray, myEntry);
-         lineCount++;
-      } else {
-         g_free(myEntry);
+      /*
+       * Routes come grouped by interface; look each one up once per group.
+       */
+      if (strcmp(lastDev, myDev) != 0) {
+         lastIfIndex = if_nametoindex(myDev);
+         if (strlen(myDev) < sizeof lastDev) {
+            strcpy(lastDev, myDev);
+         } else {
+            lastDev[0] = '\0';
+         }
       }
+      myEntry.rtmsg_ifindex = lastIfIndex;
 
-iterationCleanup:
-      g_free(myLine);
-      myLine = NULL;
+      g_array_append_val(cache->entries6, myEntry);
+   }
 
-      g_match_info_free(myMatchInfo);
-      myMatchInfo = NULL;
+   if (parseError || file.error) {
+      /* Return NULL to signal parsing error */
+      goto out;
+   }
 
-      if (parseError) {
-         /* Return NULL to signal parsing error */
-         if (myArray) {
-            SlashProcNet_FreeRoute6(myArray);
-            myArray = NULL;
-         }
-         break;
-      }
+   myArray = g_ptr_array_sized_new(cache->entries6->len);
+   if (cache->entries6->len == 0) {
+      goto out;
    }
 
-   g_free(myLine);
-   myLine = NULL;
+   myEntries = g_new(struct in6_rtmsg, cache->entries6->len);
+   memcpy(myEntries, cache->entries6->data,
+          cache->entries6->len * sizeof *myEntries);
+   for (i = 0; i < cache->entries6->len; i++) {
+      g_ptr_array_add(myArray, &myEntries[i]);
+   }
 
-   close(fd);
-   g_io_channel_unref(myChannel);
+out:
+   SlashProcFileClose(&file);
 
    return myArray;
 }
@@ -845,15 +839,13 @@ iterationCleanup:
 void
 SlashProcNet_FreeRoute6(GPtrArray *routeArray)
 {
-   int i;
-
    if (routeArray == NULL) {
       return;
    }
 
-   for (i = 0; i < routeArray->len; i++) {
-      struct rtentry *myEntry = g_ptr_array_index(routeArray, i);
-      g_free(myEntry);
+   /* The first entry is the start of the allocation of all the entries. */
+   if (routeArray->len > 0) {
+      g_free(g_ptr_array_index(routeArray, 0));
    }
 
    g_ptr_array_free(routeArray, TRUE);
@@ -867,53 +859,408 @@ SlashProcNet_FreeRoute6(GPtrArray *routeArray)
 
 /*
  ******************************************************************************
- * Ip6StringToIn6Addr --                                                */ /**
+ * SlashProcNetCacheFree --                                             */ /**
  *
- * @brief Parses a @c /proc/net/ipv6_route hexadecimal IPv6 address and
- *        records it in a <tt>struct in6_addr</tt>.
+ * @brief Frees the state of a thread, when it exits.
  *
- * @param[in]   ip6String       Source string.
- * @param[out]  in6_addr        Output struct.
+ * @param[in]   data            The SlashProcNetCache.
  *
  ******************************************************************************
  */
 
 static void
-Ip6StringToIn6Addr(const char *ip6String,
-                   struct in6_addr *in6_addr)
+SlashProcNetCacheFree(gpointer data)
 {
-   unsigned int i;
+   SlashProcNetCache *cache = data;
 
-   ASSERT(strlen(ip6String) == 32);
+   g_free(cache->buf);
+   g_array_free(cache->entries, TRUE);
+   g_string_free(cache->names, TRUE);
+   g_array_free(cache->entries6, TRUE);
+   g_free(cache);
+}
 
-   for (i = 0; i < 16; i++) {
-      int nmatched;
-      nmatched = sscanf(&ip6String[2 * i], "%2hhx", &in6_addr->s6_addr[i]);
-      ASSERT(nmatched == 1);
+
+/*
+ ******************************************************************************
+ * SlashProcNetGetCache --                                              */ /**
+ *
+ * @brief Returns the state of the calling thread, creating it if needed.
+ *
+ * @return      The SlashProcNetCache of the thread.
+ *
+ ******************************************************************************
+ */
+
+static SlashProcNetCache *
+SlashProcNetGetCache(void)
+{
+   SlashProcNetCache *cache = g_private_get(&slashProcNetCache);
+
+   if (cache == NULL) {
+      cache = g_new0(SlashProcNetCache, 1);
+      cache->bufSize = SLASHPROC_BUF_SIZE;
+      cache->buf = g_malloc(cache->bufSize);
+      cache->entries = g_array_new(FALSE, FALSE, sizeof (SlashProcRoute));
+      cache->names = g_string_new(NULL);
+      cache->entries6 = g_array_new(FALSE, FALSE, sizeof (struct in6_rtmsg));
+      g_private_set(&slashProcNetCache, cache);
    }
+
+   return cache;
 }
 
 
 /*
  ******************************************************************************
- * MatchToGuint64 --                                                    */ /**
+ * SlashProcFileOpen --                                                 */ /**
+ *
+ * @brief Opens a node to read it with SlashProcFileReadLine.
  *
- * @brief Wrapper around @c g_ascii_strtoull and @c g_match_info_fetch.
+ * @param[in]   path            Path to the node.
+ * @param[out]  file            The opened node.
  *
- * @param[in]   matchInfo       Source regular expression match context.
- * @param[in]   matchIndex      Match number to fetch.
- * @param[in]   base            Base represented by matched string.
- *                              (See @c g_ascii_strtoull docs.)
+ * @retval TRUE         Success; close @a file with SlashProcFileClose.
+ * @retval FALSE        Failure, errno is set.
  *
  ******************************************************************************
  */
 
-static guint64
-MatchToGuint64(const GMatchInfo *matchInfo,
-               const gint matchIndex,
-               gint base)
+static Bool
+SlashProcFileOpen(const char *path,
+                  SlashProcFile *file)
 {
-   guint64 retval;
-   MATCHEXPR(matchInfo, matchIndex, retval = g_ascii_strtoull(MATCH, NULL, base));
-   return retval;
+   if ((file->fd = g_open(path, O_RDONLY)) == -1) {
+      return FALSE;
+   }
+
+   file->cache = SlashProcNetGetCache();
+   file->start = 0;
+   file->end = 0;
+   file->eof = FALSE;
+   file->error = FALSE;
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * SlashProcFileReadLine --                                             */ /**
+ *
+ * @brief Returns the next line of a node, without its newline.  The node
+ *        is read in buffer-sized chunks; lines are returned in place.
+ *
+ * @param[in]   file            The node.
+ *
+ * @return      The line, NUL-terminated and modifiable, valid until the next
+ *              call; NULL at the end of the node or on error, in which case
+ *              @a file->error is set.
+ *
+ ******************************************************************************
+ */
+
+static char *
+SlashProcFileReadLine(SlashProcFile *file)
+{
+   SlashProcNetCache *cache = file->cache;
+
+   for (;;) {
+      char *line = cache->buf + file->start;
+      char *newline = memchr(line, '\n', file->end - file->start);
+      ssize_t n;
+
+      if (newline != NULL) {
+         *newline = '\0';
+         file->start = newline + 1 - cache->buf;
+         return line;
+      }
+
+      if (file->eof) {
+         if (file->start == file->end) {
+            return NULL;
+         }
+
+         /* There is always room for the terminator, see below. */
+         cache->buf[file->end] = '\0';
+         file->start = file->end;
+         return line;
+      }
+
+      /*
+       * Get more data, after moving the partial line to the start of the
+       * buffer.  Keep a byte for the terminator of a last line without
+       * a newline.
+       */
+
+      if (file->start > 0) {
+         memmove(cache->buf, line, file->end - file->start);
+         file->end -= file->start;
+         file->start = 0;
+      }
+
+      if (file->end == cache->bufSize - 1) {
+         cache->bufSize *= 2;
+         cache->buf = g_realloc(cache->buf, cache->bufSize);
+      }
+
+      n = read(file->fd, cache->buf + file->end,
+               cache->bufSize - 1 - file->end);
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         file->error = TRUE;
+         return NULL;
+      }
+
+      if (n == 0) {
+         file->eof = TRUE;
+      } else {
+         file->end += n;
+      }
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * SlashProcFileClose --                                                */ /**
+ *
+ * @brief Closes a node opened with SlashProcFileOpen.
+ *
+ * @param[in]   file            The node.
+ *
+ ******************************************************************************
+ */
+
+static void
+SlashProcFileClose(SlashProcFile *file)
+{
+   close(file->fd);
+   file->fd = -1;
+}
+
+
+/*
+ ******************************************************************************
+ * NextField --                                                         */ /**
+ *
+ * @brief Splits the next whitespace-separated field off a line.
+ *
+ * @param[in,out] cursor        Where to start; updated past the field.
+ *
+ * @return      The field, NUL-terminated in place, or NULL if there are no
+ *              more fields.
+ *
+ ******************************************************************************
+ */
+
+static char *
+NextField(char **cursor)
+{
+   char *p = *cursor;
+   char *field;
+
+   while (*p == ' ' || *p == '\t' || *p == '\r') {
+      p++;
+   }
+   if (*p == '\0') {
+      *cursor = p;
+      return NULL;
+   }
+
+   field = p;
+   while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r') {
+      p++;
+   }
+   if (*p != '\0') {
+      *p++ = '\0';
+   }
+
+   *cursor = p;
+   return field;
+}
+
+
+/*
+ ******************************************************************************
+ * IsWord --                                                            */ /**
+ *
+ * @brief Tells whether a field is a non-empty run of alphanumerics and
+ *        underscores (regular expression @c \\w+).
+ *
+ * @param[in]   field           The field.  May be NULL.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+IsWord(const char *field)
+{
+   if (field == NULL || *field == '\0') {
+      return FALSE;
+   }
+
+   for (; *field != '\0'; field++) {
+      if (!g_ascii_isalnum(*field) && *field != '_') {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * IsPrefix --                                                          */ /**
+ *
+ * @brief Tells whether a field is the prefix of a @c /proc/net/snmp line,
+ *        i.e. a word followed by a colon.
+ *
+ * @param[in]   field           The field.  May be NULL.
+ * @param[out]  len             Length of the word.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+IsPrefix(const char *field,
+         size_t *len)
+{
+   size_t i;
+
+   if (field == NULL) {
+      return FALSE;
+   }
+
+   for (i = 0; g_ascii_isalnum(field[i]) || field[i] == '_'; i++) {
+   }
+
+   *len = i;
+   return i > 0 && field[i] == ':' && field[i + 1] == '\0';
+}
+
+
+/*
+ ******************************************************************************
+ * ParseUint --                                                         */ /**
+ *
+ * @brief Parses a field that is an unsigned number and nothing else.
+ *
+ * @param[in]   field           The field.  May be NULL.
+ * @param[in]   base            10 or 16.
+ * @param[in]   digits          Exact number of digits, or 0 for any.
+ * @param[out]  value           The number.
+ *
+ * @retval TRUE         The field is a number that fits.
+ * @retval FALSE        Otherwise.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+ParseUint(const char *field,
+          unsigned int base,
+          size_t digits,
+          guint64 *value)
+{
+   guint64 result = 0;
+   size_t i;
+
+   ASSERT(base == 10 || base == 16);
+
+   if (field == NULL || *field == '\0') {
+      return FALSE;
+   }
+
+   for (i = 0; field[i] != '\0'; i++) {
+      int digit = base == 16 ? g_ascii_xdigit_value(field[i])
+                             : g_ascii_digit_value(field[i]);
+
+      if (digit < 0 || result > (G_MAXUINT64 - digit) / base) {
+         return FALSE;
+      }
+      result = result * base + digit;
+   }
+
+   if (digits != 0 && i != digits) {
+      return FALSE;
+   }
+
+   *value = result;
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * ParseInt --                                                          */ /**
+ *
+ * @brief Parses a field that is a decimal number, possibly negative.  Like
+ *        @c g_ascii_strtoull, negative numbers are returned two's complement.
+ *
+ * @param[in]   field           The field.  May be NULL.
+ * @param[out]  value           The number.
+ *
+ * @retval TRUE         The field is a number that fits.
+ * @retval FALSE        Otherwise.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+ParseInt(const char *field,
+         guint64 *value)
+{
+   if (field != NULL && *field == '-') {
+      if (!ParseUint(field + 1, 10, 0, value)) {
+         return FALSE;
+      }
+      *value = -*value;
+      return TRUE;
+   }
+
+   return ParseUint(field, 10, 0, value);
+}
+
+
+/*
+ ******************************************************************************
+ * ParseIn6Addr --                                                      */ /**
+ *
+ * @brief Parses a @c /proc/net/ipv6_route hexadecimal IPv6 address and
+ *        records it in a <tt>struct in6_addr</tt>.
+ *
+ * @param[in]   field           Source field.  May be NULL.
+ * @param[out]  in6_addr        Output struct.
+ *
+ * @retval TRUE         The field is 32 hexadecimal digits.
+ * @retval FALSE        Otherwise.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+ParseIn6Addr(const char *field,
+             struct in6_addr *in6_addr)
+{
+   unsigned int i;
+
+   if (field == NULL) {
+      return FALSE;
+   }
+
+   for (i = 0; i < 16; i++) {
+      int hi = g_ascii_xdigit_value(field[2 * i]);
+      int lo = hi < 0 ? -1 : g_ascii_xdigit_value(field[2 * i + 1]);
+
+      if (lo < 0) {
+         return FALSE;
+      }
+      in6_addr->s6_addr[i] = hi << 4 | lo;
+   }
+
+   return field[32] == '\0';
 }
@@ -33,6 +33,7 @@
 #include <winsock2.h>
 #else
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 #endif
@@ -80,6 +81,39 @@ SSL_Write(SSLSock sslSock,   // IN
 }
 
 
+#ifndef _WIN32
+/*
+ *----------------------------------------------------------------------
+ *
+ * SSL_WriteV()
+ *
+ *    Functional equivalent of sendmsg() on an iovec, so that several
+ *    queued buffers go out in one system call. flags are passed to
+ *    sendmsg(), e.g. MSG_ZEROCOPY.
+ *
+ * Results:
+ *    Returns the number of bytes written, or -1 on error.
+ *
+ * Side effects:
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+SSL_WriteV(SSLSock sslSock,           // IN
+           const struct iovec *iov,   // IN
+           int iovcnt,                // IN
+           int flags)                 // IN
+{
+   struct msghdr msg = { 0 };
+
+   msg.msg_iov = (struct iovec *)iov;
+   msg.msg_iovlen = iovcnt;
+   return sendmsg(sslSock->fd, &msg, flags);
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -49,6 +49,8 @@ typedef struct SyncHandle {
 #if defined(__linux__)
    void (*getattr)(const SyncDriverHandle handle, const char **name,
                    Bool *quiesces);
+   size_t (*getfreezetimes)(const SyncDriverHandle handle,
+                            const SyncDriverFsTime **times);
 #endif
 } SyncHandle;
 
@@ -57,6 +59,9 @@ SyncDriverErr
 LinuxDriver_Freeze(const GSList *userPaths,
                    SyncDriverHandle *handle);
 
+void
+LinuxDriver_SetParallelFreeze(Bool enable);
+
 SyncDriverErr
 VmSync_Freeze(const GSList *userPaths,
               SyncDriverHandle *handle);
@@ -32,6 +32,8 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
 #include "debug.h"
 #include "dynbuf.h"
 #include "syncDriverInt.h"
@@ -42,14 +44,135 @@
 #  define FITHAW          _IOWR('X', 120, int)    /* Thaw */
 #endif
 
+/* Major number of loop devices, from linux/major.h. */
+#define LINUX_LOOP_MAJOR     7
+
+/* How many file systems are flushed or frozen at once in parallel mode. */
+#define LINUX_FI_MAX_THREADS 16
+
+/*
+ * Parallel mode: all file systems are flushed with syncfs() at once, then
+ * frozen concurrently, in waves that keep dependency order: a file system
+ * on a loop device is frozen in an earlier wave than the file system
+ * holding the loop device's backing file, and thawed in a later one.
+ * File systems on distinct block device stacks (dm, md, ...) don't depend
+ * on each other, so each wave freezes them all at once.
+ */
+static Bool gParallelFreeze = FALSE;
+
 
 typedef struct LinuxDriver {
    SyncHandle  driver;
    size_t      fdCnt;
    int        *fds;
+   int        *waves;         // freeze wave of each fd, parallel mode only
+   int         maxWave;
+   SyncDriverFsTime *times;   // one per frozen fd
 } LinuxDriver;
 
 
+/*
+ * A file system being frozen in parallel mode.
+ */
+typedef struct LinuxFiFs {
+   char       *path;
+   int         fd;
+   dev_t       dev;
+   dev_t       lowerDev;      // fs holding the loop device's backing file
+   int         wave;
+   int         ioctlErr;      // errno of FIFREEZE/FITHAW, 0 on success
+   uint64      flushUsecs;
+   uint64      freezeUsecs;
+} LinuxFiFs;
+
+
+/*
+ *******************************************************************************
+ * LinuxFiThawFd --                                                       */ /**
+ *
+ * Thaws one file system.
+ *
+ * @param[in] fd  The frozen file system.
+ *
+ * @return TRUE on success.
+ *
+ *******************************************************************************
+ */
+
+static Bool
+LinuxFiThawFd(int fd)
+{
+   Debug(LGPFX "Thawing fd=%d.\n", fd);
+   if (ioctl(fd, FITHAW) == -1) {
+      Debug(LGPFX "Thaw failed for fd=%d.\n", fd);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiThawWorker --                                                   */ /**
+ *
+ * Thread pool function thawing one file system in parallel mode.
+ *
+ * @param[in] data      The LinuxFiFs to thaw.
+ * @param[in] userData  Unused.
+ *
+ *******************************************************************************
+ */
+
+static void
+LinuxFiThawWorker(gpointer data,
+                  gpointer userData)
+{
+   LinuxFiFs *fs = data;
+
+   fs->ioctlErr = LinuxFiThawFd(fs->fd) ? 0 : EIO;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiRunParallel --                                                  */ /**
+ *
+ * Runs func on each of the given file systems, at most LINUX_FI_MAX_THREADS
+ * at a time, and waits for all of them.  Runs them one after the other if
+ * threads can't be started.
+ *
+ * @param[in] fs     The file systems.
+ * @param[in] count  Number of file systems.
+ * @param[in] func   The function to run.
+ *
+ *******************************************************************************
+ */
+
+static void
+LinuxFiRunParallel(LinuxFiFs **fs,
+                   size_t count,
+                   GFunc func)
+{
+   GThreadPool *pool = NULL;
+   size_t i;
+
+   if (count > 1) {
+      pool = g_thread_pool_new(func, NULL,
+                               MIN(count, LINUX_FI_MAX_THREADS), FALSE, NULL);
+   }
+
+   for (i = 0; i < count; i++) {
+      if (pool == NULL || !g_thread_pool_push(pool, fs[i], NULL)) {
+         func(fs[i], NULL);
+      }
+   }
+
+   if (pool != NULL) {
+      g_thread_pool_free(pool, FALSE, TRUE);
+   }
+}
+
+
 /*
  *******************************************************************************
  * LinuxFiThaw --                                                         */ /**
@@ -71,13 +194,41 @@ LinuxFiThaw(const SyncDriverHandle handle)
    LinuxDriver *sync = (LinuxDriver *) handle;
    SyncDriverErr err = SD_SUCCESS;
 
+   if (sync->waves != NULL) {
+      /*
+       * Thaw the waves in the reverse order of freeze, each one in
+       * parallel.
+       */
+      LinuxFiFs *fs = g_new0(LinuxFiFs, sync->fdCnt);
+      LinuxFiFs **wave = g_new0(LinuxFiFs *, sync->fdCnt);
+      int w;
+
+      for (w = sync->maxWave; w >= 0; w--) {
+         size_t n = 0;
+
+         for (i = 0; i < sync->fdCnt; i++) {
+            if (sync->waves[i] == w) {
+               fs[i].fd = sync->fds[i];
+               wave[n++] = &fs[i];
+            }
+         }
+         LinuxFiRunParallel(wave, n, LinuxFiThawWorker);
+      }
+      for (i = 0; i < sync->fdCnt; i++) {
+         if (fs[i].ioctlErr != 0) {
+            err = SD_ERROR;
+         }
+      }
+      g_free(wave);
+      g_free(fs);
+      return err;
+   }
+
    /*
     * Thaw in the reverse order of freeze
     */
    for (i = sync->fdCnt; i > 0; i--) {
-      Debug(LGPFX "Thawing fd=%d.\n", sync->fds[i-1]);
-      if (ioctl(sync->fds[i-1], FITHAW) == -1) {
-         Debug(LGPFX "Thaw failed for fd=%d.\n", sync->fds[i-1]);
+      if (!LinuxFiThawFd(sync->fds[i-1])) {
          err = SD_ERROR;
       }
    }
@@ -110,8 +261,11 @@ LinuxFiClose(SyncDriverHandle handle)
    for (i = sync->fdCnt; i > 0; i--) {
       Debug(LGPFX "Closing fd=%d.\n", sync->fds[i-1]);
       close(sync->fds[i-1]);
+      g_free(sync->times[i-1].path);
    }
    free(sync->fds);
+   g_free(sync->waves);
+   g_free(sync->times);
    free(sync);
 }
 
@@ -139,6 +293,457 @@ LinuxFiGetAttr(const SyncDriverHandle handle,   // IN (ignored)
 }
 
 
+/*
+ *******************************************************************************
+ * LinuxFiGetFreezeTimes --                                               */ /**
+ *
+ * Returns how long flushing and freezing each frozen file system took.
+ *
+ * @param[in]  handle   The freeze handle.
+ * @param[out] times    The times, valid until the handle is closed.
+ *
+ * @return The number of entries in times.
+ *
+ *******************************************************************************
+ */
+
+static size_t
+LinuxFiGetFreezeTimes(const SyncDriverHandle handle,   // IN
+                      const SyncDriverFsTime **times)  // OUT
+{
+   LinuxDriver *sync = (LinuxDriver *) handle;
+
+   *times = sync->times;
+   return sync->fdCnt;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiOpen --                                                         */ /**
+ *
+ * Opens a mount point for freezing.  Paths that can't or needn't be frozen
+ * are skipped.
+ *
+ * @param[in]  path   The mount point.
+ * @param[out] fd     The opened directory, or -1 if the path is skipped.
+ * @param[out] sbuf   The stat of the directory.
+ *
+ * @return A SyncDriverErr; SD_SUCCESS also when the path is skipped.
+ *
+ *******************************************************************************
+ */
+
+static SyncDriverErr
+LinuxFiOpen(const char *path,
+            int *fd,
+            struct stat *sbuf)
+{
+   Debug(LGPFX "opening path '%s'.\n", path);
+   *fd = open(path, O_RDONLY);
+   if (*fd == -1) {
+      switch (errno) {
+      case ENOENT:
+         /*
+          * We sometimes get stale mountpoints or special mountpoints
+          * created by the docker engine.
+          */
+         Debug(LGPFX "cannot find the directory '%s'.\n", path);
+         return SD_SUCCESS;
+
+      case EACCES:
+         /*
+          * We sometimes get access errors to virtual filesystems mounted
+          * as users with permission 700, so just ignore these.
+          */
+         Debug(LGPFX "cannot access mounted directory '%s'.\n", path);
+         return SD_SUCCESS;
+
+      case ENXIO:
+         /*
+          * A bind-mounted file, such as a mount of /dev/log for a
+          * chrooted application, will land us here.  Just skip it.
+          */
+         Debug(LGPFX "no such device or address '%s'.\n", path);
+         return SD_SUCCESS;
+
+      case EIO:
+         /*
+          * A mounted HGFS filesystem with the backend disabled will give
+          * us these; probably could use a better way to detect HFGS, but
+          * this should be enough. Just skip.
+          */
+         Debug(LGPFX "I/O error reading directory '%s'.\n", path);
+         return SD_SUCCESS;
+
+      default:
+         Debug(LGPFX "failed to open '%s': %d (%s)\n",
+               path, errno, strerror(errno));
+         return SD_ERROR;
+      }
+   }
+
+   if (fstat(*fd, sbuf) == -1) {
+      Debug(LGPFX "failed to stat '%s': %d (%s)\n",
+            path, errno, strerror(errno));
+      close(*fd);
+      *fd = -1;
+      return SD_ERROR;
+   }
+
+   if (!S_ISDIR(sbuf->st_mode)) {
+      Debug(LGPFX "Skipping a non-directory path '%s'.\n", path);
+      close(*fd);
+      *fd = -1;
+   }
+
+   return SD_SUCCESS;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiFreezeFd --                                                     */ /**
+ *
+ * Freezes one file system.
+ *
+ * @param[in]  path          The mount point, for logging.
+ * @param[in]  fd            The opened mount point.
+ * @param[out] freezeUsecs   How long the freeze took.
+ *
+ * @return 0 on success, the errno of the ioctl otherwise.
+ *
+ *******************************************************************************
+ */
+
+static int
+LinuxFiFreezeFd(const char *path,
+                int fd,
+                uint64 *freezeUsecs)
+{
+   gint64 start = g_get_monotonic_time();
+   int ioctlerr = 0;
+
+   Debug(LGPFX "freezing path '%s' (fd=%d).\n", path, fd);
+   if (ioctl(fd, FIFREEZE) == -1) {
+      ioctlerr = errno;
+      Debug(LGPFX "freeze on '%s' returned: %d (%s)\n",
+            path, ioctlerr, strerror(ioctlerr));
+   } else {
+      Debug(LGPFX "successfully froze '%s' (fd=%d).\n", path, fd);
+   }
+   *freezeUsecs = g_get_monotonic_time() - start;
+
+   return ioctlerr;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiFlushWorker --                                                  */ /**
+ *
+ * Thread pool function flushing one file system in parallel mode, so that
+ * the freeze that follows has little left to write.
+ *
+ * @param[in] data      The LinuxFiFs to flush.
+ * @param[in] userData  Unused.
+ *
+ *******************************************************************************
+ */
+
+static void
+LinuxFiFlushWorker(gpointer data,
+                   gpointer userData)
+{
+   LinuxFiFs *fs = data;
+   gint64 start = g_get_monotonic_time();
+
+#if defined(SYS_syncfs)
+   if (syscall(SYS_syncfs, fs->fd) == -1) {
+      Debug(LGPFX "syncfs on '%s' failed: %d (%s)\n",
+            fs->path, errno, strerror(errno));
+   }
+#endif
+   fs->flushUsecs = g_get_monotonic_time() - start;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiFreezeWorker --                                                 */ /**
+ *
+ * Thread pool function freezing one file system in parallel mode.
+ *
+ * @param[in] data      The LinuxFiFs to freeze.
+ * @param[in] userData  Unused.
+ *
+ *******************************************************************************
+ */
+
+static void
+LinuxFiFreezeWorker(gpointer data,
+                    gpointer userData)
+{
+   LinuxFiFs *fs = data;
+
+   fs->ioctlErr = LinuxFiFreezeFd(fs->path, fs->fd, &fs->freezeUsecs);
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiLoopLowerDev --                                                 */ /**
+ *
+ * Finds the device of the file system holding the backing file of the loop
+ * device a file system is on.
+ *
+ * @param[in] dev  The device of the file system.
+ *
+ * @return The device of the backing file's file system, or 0 if the file
+ *         system is not on a loop device.
+ *
+ *******************************************************************************
+ */
+
+static dev_t
+LinuxFiLoopLowerDev(dev_t dev)
+{
+   char *sysPath;
+   gchar *backingFile = NULL;
+   struct stat sbuf;
+   dev_t lowerDev = 0;
+
+   if (major(dev) != LINUX_LOOP_MAJOR) {
+      return 0;
+   }
+
+   sysPath = g_strdup_printf("/sys/dev/block/%u:%u/loop/backing_file",
+                             major(dev), minor(dev));
+   if (g_file_get_contents(sysPath, &backingFile, NULL, NULL)) {
+      g_strchomp(backingFile);
+      if (stat(backingFile, &sbuf) == 0) {
+         lowerDev = sbuf.st_dev;
+      }
+   }
+   g_free(backingFile);
+   g_free(sysPath);
+
+   return lowerDev;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiAssignWaves --                                                  */ /**
+ *
+ * Assigns each file system the wave it is frozen in: a file system on a
+ * loop device goes in an earlier wave than the file system holding its
+ * backing file.
+ *
+ * @param[in] fs     The file systems.
+ * @param[in] count  Number of file systems.
+ *
+ * @return The last wave.
+ *
+ *******************************************************************************
+ */
+
+static int
+LinuxFiAssignWaves(LinuxFiFs *fs,
+                   size_t count)
+{
+   size_t pass;
+   size_t i;
+   size_t j;
+   int maxWave = 0;
+
+   /*
+    * Loop device chains are short, and can't be circular, so this is done
+    * after at most count passes.
+    */
+   for (pass = 0; pass < count; pass++) {
+      Bool changed = FALSE;
+
+      for (i = 0; i < count; i++) {
+         if (fs[i].lowerDev == 0) {
+            continue;
+         }
+         for (j = 0; j < count; j++) {
+            if (j != i && fs[j].dev == fs[i].lowerDev &&
+                fs[j].wave <= fs[i].wave) {
+               fs[j].wave = fs[i].wave + 1;
+               maxWave = MAX(maxWave, fs[j].wave);
+               changed = TRUE;
+            }
+         }
+      }
+      if (!changed) {
+         break;
+      }
+   }
+
+   return maxWave;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxFiFreezeParallel --                                               */ /**
+ *
+ * Parallel mode of LinuxDriver_Freeze(): opens all the paths, flushes the
+ * file systems all at once, then freezes them wave by wave.
+ *
+ * @param[in]  paths    List of paths to freeze.
+ * @param[in]  sync     The handle to fill in.
+ *
+ * @return A SyncDriverErr.
+ *
+ *******************************************************************************
+ */
+
+static SyncDriverErr
+LinuxFiFreezeParallel(const GSList *paths,
+                      LinuxDriver *sync)
+{
+   GArray *all = g_array_new(FALSE, TRUE, sizeof (LinuxFiFs));
+   LinuxFiFs **wave = NULL;
+   SyncDriverErr err = SD_SUCCESS;
+   Bool unsupported = FALSE;
+   size_t count;
+   size_t frozen = 0;
+   size_t i;
+   int w;
+
+   /*
+    * Open everything first, keeping one path per file system: freezing
+    * the same superblock twice only gets EBUSY.
+    */
+   for (; paths != NULL; paths = g_slist_next(paths)) {
+      const char *path = paths->data;
+      LinuxFiFs fs = { 0 };
+      struct stat sbuf;
+
+      err = LinuxFiOpen(path, &fs.fd, &sbuf);
+      if (err != SD_SUCCESS) {
+         goto exit;
+      }
+      if (fs.fd == -1) {
+         continue;
+      }
+
+      for (i = 0; i < all->len; i++) {
+         if (g_array_index(all, LinuxFiFs, i).dev == sbuf.st_dev) {
+            break;
+         }
+      }
+      if (i < all->len) {
+         Debug(LGPFX "'%s' is on an already listed file system.\n", path);
+         close(fs.fd);
+         continue;
+      }
+
+      fs.path = g_strdup(path);
+      fs.dev = sbuf.st_dev;
+      fs.lowerDev = LinuxFiLoopLowerDev(sbuf.st_dev);
+      g_array_append_val(all, fs);
+   }
+
+   count = all->len;
+   if (count == 0) {
+      goto exit;
+   }
+
+   wave = g_new0(LinuxFiFs *, count);
+   for (i = 0; i < count; i++) {
+      wave[i] = &g_array_index(all, LinuxFiFs, i);
+   }
+   Debug(LGPFX "flushing %"FMTSZ"u file systems in parallel.\n", count);
+   LinuxFiRunParallel(wave, count, LinuxFiFlushWorker);
+
+   sync->maxWave = LinuxFiAssignWaves((LinuxFiFs *) all->data, count);
+   sync->fds = calloc(count, sizeof *sync->fds);
+   sync->waves = g_new0(int, count);
+   sync->times = g_new0(SyncDriverFsTime, count);
+   if (sync->fds == NULL) {
+      err = SD_ERROR;
+      goto exit;
+   }
+
+   for (w = 0; w <= sync->maxWave && err == SD_SUCCESS; w++) {
+      size_t n = 0;
+
+      for (i = 0; i < count; i++) {
+         LinuxFiFs *fs = &g_array_index(all, LinuxFiFs, i);
+
+         if (fs->wave == w) {
+            wave[n++] = fs;
+         }
+      }
+      Debug(LGPFX "freezing wave %d (%"FMTSZ"u file systems).\n", w, n);
+      LinuxFiRunParallel(wave, n, LinuxFiFreezeWorker);
+
+      for (i = 0; i < n; i++) {
+         LinuxFiFs *fs = wave[i];
+
+         if (fs->ioctlErr == 0) {
+            sync->fds[frozen] = fs->fd;
+            sync->waves[frozen] = w;
+            sync->times[frozen].path = fs->path;
+            sync->times[frozen].flushUsecs = fs->flushUsecs;
+            sync->times[frozen].freezeUsecs = fs->freezeUsecs;
+            fs->fd = -1;
+            fs->path = NULL;
+            frozen++;
+         } else if (fs->ioctlErr == ENOTTY) {
+            /* See LinuxDriver_Freeze() for the errors ignored. */
+            unsupported = TRUE;
+         } else if (fs->ioctlErr != EBUSY && fs->ioctlErr != EOPNOTSUPP) {
+            Debug(LGPFX "failed to freeze '%s': %d (%s)\n",
+                  fs->path, fs->ioctlErr, strerror(fs->ioctlErr));
+            err = SD_ERROR;
+         }
+      }
+   }
+
+   if (unsupported) {
+      err = frozen == 0 ? SD_UNAVAILABLE : SD_ERROR;
+   }
+
+exit:
+   sync->fdCnt = frozen;
+   for (i = 0; i < all->len; i++) {
+      LinuxFiFs *fs = &g_array_index(all, LinuxFiFs, i);
+
+      if (fs->fd != -1) {
+         close(fs->fd);
+      }
+      g_free(fs->path);
+   }
+   g_array_free(all, TRUE);
+   g_free(wave);
+
+   return err;
+}
+
+
+/*
+ *******************************************************************************
+ * LinuxDriver_SetParallelFreeze --                                       */ /**
+ *
+ * Enables or disables the parallel mode of LinuxDriver_Freeze().
+ *
+ * @param[in]  enable   Whether to flush and freeze in parallel.
+ *
+ *******************************************************************************
+ */
+
+void
+LinuxDriver_SetParallelFreeze(Bool enable)
+{
+   gParallelFreeze = enable;
+}
+
+
 /*
  *******************************************************************************
  * LinuxDriver_Freeze --                                                  */ /**
@@ -148,6 +753,10 @@ LinuxFiGetAttr(const SyncDriverHandle handle,   // IN (ignored)
  * If the first attempt at using the ioctl fails, assume that it doesn't exist
  * and return SD_UNAVAILABLE, so that other means of freezing are tried.
  *
+ * In parallel mode (see LinuxDriver_SetParallelFreeze()), all file systems
+ * are flushed concurrently first, then frozen concurrently in dependency
+ * order.
+ *
  * NOTE: This function performs two system calls open() and ioctl(). We have
  * seen open() being slow with NFS mount points at times and ioctl() being
  * slow when guest is performing significant IO. Therefore, caller should
@@ -168,10 +777,14 @@ LinuxDriver_Freeze(const GSList *paths,
    ssize_t count = 0;
    Bool first = TRUE;
    DynBuf fds;
+   GArray *times;
    LinuxDriver *sync = NULL;
    SyncDriverErr err = SD_SUCCESS;
 
-   DynBuf_Init(&fds);
+   /*
+    * Ensure we did not get an empty list
+    */
+   VERIFY(paths != NULL);
 
    Debug(LGPFX "Freezing using Linux ioctls...\n");
 
@@ -183,11 +796,15 @@ LinuxDriver_Freeze(const GSList *paths,
    sync->driver.thaw = LinuxFiThaw;
    sync->driver.close = LinuxFiClose;
    sync->driver.getattr = LinuxFiGetAttr;
+   sync->driver.getfreezetimes = LinuxFiGetFreezeTimes;
 
-   /*
-    * Ensure we did not get an empty list
-    */
-   VERIFY(paths != NULL);
+   if (gParallelFreeze) {
+      err = LinuxFiFreezeParallel(paths, sync);
+      goto done;
+   }
+
+   DynBuf_Init(&fds);
+   times = g_array_new(FALSE, TRUE, sizeof (SyncDriverFsTime));
 
    /*
     * Iterate through the requested paths. If we get an error for the first
@@ -196,71 +813,22 @@ LinuxDriver_Freeze(const GSList *paths,
     */
    while (paths != NULL) {
       int fd;
+      int ioctlerr;
       struct stat sbuf;
+      SyncDriverFsTime fsTime = { 0 };
       const char *path = paths->data;
-      Debug(LGPFX "opening path '%s'.\n", path);
       paths = g_slist_next(paths);
-      fd = open(path, O_RDONLY);
-      if (fd == -1) {
-         switch (errno) {
-         case ENOENT:
-            /*
-             * We sometimes get stale mountpoints or special mountpoints
-             * created by the docker engine.
-             */
-            Debug(LGPFX "cannot find the directory '%s'.\n", path);
-            continue;
-
-         case EACCES:
-            /*
-             * We sometimes get access errors to virtual filesystems mounted
-             * as users with permission 700, so just ignore these.
-             */
-            Debug(LGPFX "cannot access mounted directory '%s'.\n", path);
-            continue;
-
-         case ENXIO:
-            /*
-             * A bind-mounted file, such as a mount of /dev/log for a
-             * chrooted application, will land us here.  Just skip it.
-             */
-            Debug(LGPFX "no such device or address '%s'.\n", path);
-            continue;
-
-         case EIO:
-            /*
-             * A mounted HGFS filesystem with the backend disabled will give
-             * us these; probably could use a better way to detect HFGS, but
-             * this should be enough. Just skip.
-             */
-            Debug(LGPFX "I/O error reading directory '%s'.\n", path);
-            continue;
 
-         default:
-            Debug(LGPFX "failed to open '%s': %d (%s)\n",
-                  path, errno, strerror(errno));
-            err = SD_ERROR;
-            goto exit;
-         }
-      }
-
-      if (fstat(fd, &sbuf) == -1) {
-         close(fd);
-         Debug(LGPFX "failed to stat '%s': %d (%s)\n",
-               path, errno, strerror(errno));
-         err = SD_ERROR;
+      err = LinuxFiOpen(path, &fd, &sbuf);
+      if (err != SD_SUCCESS) {
          goto exit;
       }
-
-      if (!S_ISDIR(sbuf.st_mode)) {
-         close(fd);
-         Debug(LGPFX "Skipping a non-directory path '%s'.\n", path);
+      if (fd == -1) {
          continue;
       }
 
-      Debug(LGPFX "freezing path '%s' (fd=%d).\n", path, fd);
-      if (ioctl(fd, FIFREEZE) == -1) {
-         int ioctlerr = errno;
+      ioctlerr = LinuxFiFreezeFd(path, fd, &fsTime.freezeUsecs);
+      if (ioctlerr != 0) {
          /*
           * If the ioctl does not exist, Linux will return ENOTTY. If it's not
           * supported on the device, we get EOPNOTSUPP. Ignore the latter,
@@ -272,8 +840,6 @@ LinuxDriver_Freeze(const GSList *paths,
           * bind mounts).
           */
          close(fd);
-         Debug(LGPFX "freeze on '%s' returned: %d (%s)\n",
-               path, ioctlerr, strerror(ioctlerr));
          if (ioctlerr != EBUSY && ioctlerr != EOPNOTSUPP) {
             Debug(LGPFX "failed to freeze '%s': %d (%s)\n",
                   path, ioctlerr, strerror(ioctlerr));
@@ -281,7 +847,6 @@ LinuxDriver_Freeze(const GSList *paths,
             break;
          }
       } else {
-         Debug(LGPFX "successfully froze '%s' (fd=%d).\n", path, fd);
          if (!DynBuf_Append(&fds, &fd, sizeof fd)) {
             if (ioctl(fd, FITHAW) == -1) {
                Warning(LGPFX "failed to thaw '%s': %d (%s)\n",
@@ -291,6 +856,8 @@ LinuxDriver_Freeze(const GSList *paths,
             err = SD_ERROR;
             break;
          }
+         fsTime.path = g_strdup(path);
+         g_array_append_val(times, fsTime);
          count++;
       }
 
@@ -300,7 +867,9 @@ LinuxDriver_Freeze(const GSList *paths,
 exit:
    sync->fds = DynBuf_Detach(&fds);
    sync->fdCnt = count;
+   sync->times = (SyncDriverFsTime *) g_array_free(times, FALSE);
 
+done:
    if (err != SD_SUCCESS) {
       LinuxFiThaw(&sync->driver);
       LinuxFiClose(&sync->driver);
@@ -309,4 +878,3 @@ exit:
    }
    return err;
 }
-
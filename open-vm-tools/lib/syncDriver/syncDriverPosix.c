@@ -644,4 +644,59 @@ SyncDriver_GetAttr(const SyncDriverHandle handle,  // IN
       *quiesces = FALSE;
    }
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SyncDriver_GetFreezeTimes --
+ *
+ *    Returns how long flushing and freezing each file system frozen by
+ *    this handle took.  Backends that don't keep these return none.
+ *
+ * Results:
+ *    The number of entries in *times, which stay valid until the handle
+ *    is closed.
+ *
+ * Side effects:
+ *   None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+size_t
+SyncDriver_GetFreezeTimes(const SyncDriverHandle handle,    // IN
+                          const SyncDriverFsTime **times)   // OUT
+{
+   if (handle != SYNCDRIVER_INVALID_HANDLE && handle->getfreezetimes != NULL) {
+      return handle->getfreezetimes(handle, times);
+   }
+   *times = NULL;
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * SyncDriver_SetParallelFreeze --
+ *
+ *    Selects whether the FIFREEZE backend flushes all file systems in
+ *    parallel and freezes independent ones concurrently, instead of
+ *    freezing them one by one.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Applies to the following SyncDriver_Freeze() calls.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+SyncDriver_SetParallelFreeze(Bool enable)   // IN
+{
+   LinuxDriver_SetParallelFreeze(enable);
+}
 #endif /* __linux__ */
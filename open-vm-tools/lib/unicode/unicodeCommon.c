@@ -27,6 +27,7 @@
 
 #include "vmware.h"
 
+#include "codeset.h"
 #include "escape.h"
 #include "vm_assert.h"
 #include "unicodeBase.h"
@@ -125,23 +126,11 @@ UnicodeSanityCheck(const void *buffer,      // IN
     */
 
    if (encoding == STRING_ENCODING_US_ASCII) {
-      const uint8 *asciiBytes = (const uint8 *) buffer;
-
       if (lengthInBytes == -1) {
-	 for (; *asciiBytes != '\0'; asciiBytes++) {
-	    if (*asciiBytes >= 0x80) {
-	       return FALSE;
-	    }
-	 }
-      } else {
-	 ssize_t i;
-
-	 for (i = 0; i < lengthInBytes; i++) {
-	    if (asciiBytes[i] >= 0x80) {
-	       return FALSE;
-	    }
-	 }
+         lengthInBytes = strlen(buffer);
       }
+
+      return CodeSet_AsciiLength(buffer, lengthInBytes) == lengthInBytes;
    }
 
    return TRUE;
@@ -42,6 +42,17 @@ char *UnicodeAllocStatic(const char *asciiBytes,
 
 utf16_t UnicodeSimpleCaseFold(utf16_t codeUnit);
 
+/*
+ * UnicodeSimpleCaseFold of an ASCII character, which only folds A-Z. Most
+ * names are ASCII and fold with this instead of through UTF-16.
+ */
+
+static INLINE char
+UnicodeSimpleCaseFoldAscii(char c)  // IN
+{
+   return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
 void *UnicodeGetAllocBytesInternal(const char *src,
                                    StringEncoding encoding,
                                    ssize_t lengthInBytes,
@@ -114,6 +114,29 @@ Unicode_CompareRange(const char *str1,         // IN:
    uint32 codePoint1;
    uint32 codePoint2;
 
+   /*
+    * Compare the common ASCII prefix of whole strings in place: each byte
+    * is a code point, and folds to an ASCII one. The first non-ASCII code
+    * point starts the same comparison on both sides, in UTF-16 below.
+    */
+
+   if (str1Start == 0 && str1Length == -1 &&
+       str2Start == 0 && str2Length == -1) {
+      while ((uint8)*str1 < 0x80 && (uint8)*str2 < 0x80) {
+         char c1 = ignoreCase ? UnicodeSimpleCaseFoldAscii(*str1) : *str1;
+         char c2 = ignoreCase ? UnicodeSimpleCaseFoldAscii(*str2) : *str2;
+
+         if (c1 != c2) {
+            return c1 < c2 ? -1 : 1;
+         }
+         if (c1 == '\0') {
+            return 0;
+         }
+         str1++;
+         str2++;
+      }
+   }
+
    /*
     * TODO: Allocating substrings is a performance hit.  We should do this
     * search in-place.  (However, searching UTF-8 requires tender loving
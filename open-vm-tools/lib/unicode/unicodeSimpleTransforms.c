@@ -22,8 +22,12 @@
  *      Simple UTF-8 implementation of unicodeTransforms.h interface.
  */
 
+#include <string.h>
+
 #include "vmware.h"
 
+#include "codeset.h"
+#include "util.h"
 #include "unicodeBase.h"
 #include "unicodeInt.h"
 #include "unicodeTransforms.h"
@@ -319,9 +323,22 @@ Unicode_FoldCase(const char *str) // IN
    char *folded;
    utf16_t *utf16;
    utf16_t *utf16Current;
+   size_t len;
 
    ASSERT(str);
 
+   len = strlen(str);
+   if (CodeSet_AsciiLength(str, len) == len) {
+      size_t i;
+
+      folded = Util_SafeMalloc(len + 1);
+      for (i = 0; i <= len; i++) {
+         folded[i] = UnicodeSimpleCaseFoldAscii(str[i]);
+      }
+
+      return folded;
+   }
+
    utf16 = Unicode_GetAllocBytes(str, STRING_ENCODING_UTF16);
 
    utf16Current = utf16;
@@ -28,10 +28,17 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #if defined(__linux__) || defined(sun)
 # if defined(__linux__)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <limits.h>
+#  include <sys/ioctl.h>
+#  include <sys/syscall.h>
 #  include <sys/sysmacros.h>
+#  include <linux/fs.h>
 # endif
 # include <sys/vfs.h>
 #elif defined(__FreeBSD__) || defined(__APPLE__)
@@ -54,20 +61,35 @@
 #include "mntinfo.h"
 #include "posix.h"
 #include "util.h"
+#include "hostinfo.h"
 
 
-/* Number of bytes per disk sector */
-#define WIPER_SECTOR_SIZE 512
+/*
+ * Number of bytes to write per write system call. Wiper files are opened
+ * with O_DIRECT where the file system allows it, so this is also the size
+ * of each I/O sent to the disk: large enough to stream at the bandwidth of
+ * the device, and a multiple of any sector size.
+ */
+#define WIPER_WRITE_SIZE (1 << 20)
 
-/* Number of disk sectors to write per write system call.
+/* Alignment of the write buffer, as required by O_DIRECT. */
+#define WIPER_WRITE_ALIGN 4096
 
-   The bigger it is, the less calls we do and the faster we are.
+/* Time budget of a call to Wiper_Next(), in microseconds. */
+#define WIPER_STEP_USECS 200000
 
-   This value has been empirically determined to give maximum performance.
+/* Size of the file system range trimmed in one FITRIM call. */
+#define WIPER_TRIM_SIZE (((uint64)4) << 30)
 
---hpreg
-*/
-#define WIPER_SECTOR_STEP 128
+/*
+ * Background mode: the share of each WIPER_STEP_USECS spent writing, in
+ * percent, is halved whenever the read latency of the disk exceeds the
+ * target and grows by WIPER_DUTY_STEP otherwise.
+ */
+#define WIPER_DUTY_STEP 10
+
+/* Free space never consumed by the wiper, in bytes */
+#define WIPER_MIN_FREE (((uint64)5) << 20) /* 5 MB */
 
 /* Number of device numbers to store for device-mapper */
 #define WIPER_MAX_DM_NUMBERS 8
@@ -81,6 +103,7 @@
 
 /* Types */
 typedef enum {
+   WIPER_PHASE_TRIM,
    WIPER_PHASE_CREATE,
    WIPER_PHASE_FILL,
 } WiperPhase;
@@ -102,8 +125,29 @@ typedef struct WiperState {
    File *f;
    /* Serial number of the next wiper file to create */
    unsigned int nr;
-   /*  Buffer to write in each sector of a wiper file */
-   unsigned char buf[WIPER_SECTOR_STEP * WIPER_SECTOR_SIZE];
+   /* Zero-filled buffer, aligned for O_DIRECT */
+   unsigned char *buf;
+   /* Whether wiper files are opened with O_DIRECT */
+   Bool direct;
+   /* Descriptor of the mount point while trimming, or -1 */
+   int trimFd;
+   /* File system offset of the next range to trim */
+   uint64 trimOffset;
+   /* Bytes written to wiper files or trimmed so far */
+   uint64 bytesDone;
+   /* Whether Wiper_SetBackground() has been called */
+   Bool background;
+   /* Background mode: free space to leave on the partition */
+   uint64 freeFloor;
+   /* Background mode: target read latency of the disk (ms), 0 for none */
+   unsigned int maxLatency;
+   /* Background mode: current write duty cycle, in percent */
+   unsigned int duty;
+   /* Background mode: name of the disk in /proc/diskstats, or NULL */
+   char *diskName;
+   /* Background mode: read counters at the previous throttling decision */
+   uint64 readIOs;
+   uint64 readTicks;
    /* Effective user id */
    uid_t euid;
 } WiperState;
@@ -680,6 +724,68 @@ WiperSinglePartition_GetSpace(const WiperPartition *p, // IN
    return "";
 }
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WiperSinglePartition_GetDisk --
+ *
+ *      Identify the disk a partition lives on, so that callers wiping
+ *      several partitions can wipe the ones on different disks in parallel
+ *      and the ones sharing a disk one after another.
+ *
+ * Results:
+ *      An allocated string naming the disk (its sysfs path on Linux), to be
+ *      freed by the caller, or NULL if it can't be determined.
+ *
+ * Side Effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+char *
+WiperSinglePartition_GetDisk(const WiperPartition *p)  // IN
+{
+#if defined(__linux__)
+   struct stat st;
+   char *sysPath;
+   char *devPath;
+   char *partFile;
+
+   ASSERT(p);
+
+   if (Posix_Stat(p->mountPoint, &st) != 0) {
+      return NULL;
+   }
+
+   sysPath = Str_Asprintf(NULL, "/sys/dev/block/%u:%u",
+                          major(st.st_dev), minor(st.st_dev));
+   if (sysPath == NULL) {
+      return NULL;
+   }
+   devPath = Posix_RealPath(sysPath);
+   free(sysPath);
+   if (devPath == NULL) {
+      return NULL;
+   }
+
+   /* The sysfs node of a partition is a child of the node of its disk. */
+   partFile = Str_Asprintf(NULL, "%s/partition", devPath);
+   if (partFile != NULL && Posix_Access(partFile, F_OK) == 0) {
+      char *slash = strrchr(devPath, '/');
+      if (slash != NULL && slash != devPath) {
+         *slash = '\0';
+      }
+   }
+   free(partFile);
+
+   return devPath;
+#else
+   return NULL;
+#endif
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -791,20 +897,53 @@ Wiper_Start(const WiperPartition *p,             // IN
             unsigned int maxWiperFileSize)       // IN : unused
 {
    WiperState *state;
+   void *buf;
 
    state = (WiperState *)malloc(sizeof *state);
    if (state == NULL) {
       return NULL;
    }
+   if (posix_memalign(&buf, WIPER_WRITE_ALIGN, WIPER_WRITE_SIZE) != 0) {
+      free(state);
+      return NULL;
+   }
 
    /* Initialize the state */
    state->phase = WIPER_PHASE_CREATE;
    state->p = p;
    state->f = NULL;
    state->nr = 0;
-   memset(state->buf, 0, WIPER_SECTOR_STEP * WIPER_SECTOR_SIZE);
+   state->buf = buf;
+   memset(state->buf, 0, WIPER_WRITE_SIZE);
+   state->direct = TRUE;
+   state->trimFd = -1;
+   state->trimOffset = 0;
+   state->bytesDone = 0;
+   state->background = FALSE;
+   state->freeFloor = WIPER_MIN_FREE;
+   state->maxLatency = 0;
+   state->duty = 100;
+   state->diskName = NULL;
+   state->readIOs = 0;
+   state->readTicks = 0;
    state->euid = geteuid();
 
+#if defined(__linux__) && defined(FITRIM)
+   /*
+    * If unmaps are allowed, first try to discard the free space of the
+    * file system with FITRIM: it doesn't need to write anything, and on a
+    * thin disk it hands the free blocks back to the host directly. If the
+    * file system or the disk can't do it, fall back to filling the free
+    * space with zeroes.
+    */
+   if (p->attemptUnmaps) {
+      state->trimFd = Posix_Open(p->mountPoint, O_RDONLY | O_DIRECTORY);
+      if (state->trimFd >= 0) {
+         state->phase = WIPER_PHASE_TRIM;
+      }
+   }
+#endif
+
    return (void *)state;
 }
 
@@ -866,10 +1005,184 @@ WiperClean(WiperState *state)      // IN/OUT
       state->f = next;
    }
 
+   if (state->trimFd >= 0) {
+      close(state->trimFd);
+   }
+   free(state->diskName);
+   free(state->buf);
    free(state);
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WiperTrimNext --
+ *
+ *      Discard the free space of the next few ranges of the file system with
+ *      FITRIM, for up to WIPER_STEP_USECS.
+ *
+ * Results:
+ *      1 if there is more to trim.
+ *      0 if the whole file system has been trimmed.
+ *      -1 if trimming is not possible; the caller should fall back to
+ *      filling the free space.
+ *
+ * Side Effects:
+ *      The mount point descriptor is closed unless there is more to trim.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#if defined(__linux__) && defined(FITRIM)
+static int
+WiperTrimNext(WiperState *state,  // IN/OUT
+              uint64 total)       // IN: size of the file system
+{
+   VmTimeType start = Hostinfo_SystemTimerUS();
+   int ret = 1;
+
+   do {
+      struct fstrim_range range;
+      Bool last = state->trimOffset >= total;
+
+      /*
+       * The free space reported by statfs() doesn't include the file system
+       * metadata, so block offsets may go beyond "total": let the last call
+       * cover whatever is left.
+       */
+      range.start = state->trimOffset;
+      range.len = last ? ULLONG_MAX - state->trimOffset : WIPER_TRIM_SIZE;
+      range.minlen = 0;
+
+      if (ioctl(state->trimFd, FITRIM, &range) < 0) {
+         if (last && errno == EINVAL) {
+            /* Nothing left beyond the end of the file system. */
+            ret = 0;
+         } else {
+            Log("FITRIM on %s failed (%d), filling the free space instead.\n",
+                state->p->mountPoint, errno);
+            ret = -1;
+         }
+         break;
+      }
+
+      /* The kernel updates range.len with the number of bytes discarded. */
+      state->bytesDone += range.len;
+      if (last) {
+         ret = 0;
+         break;
+      }
+      state->trimOffset += WIPER_TRIM_SIZE;
+   } while (Hostinfo_SystemTimerUS() - start < WIPER_STEP_USECS);
+
+   if (ret != 1) {
+      close(state->trimFd);
+      state->trimFd = -1;
+   }
+   return ret;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WiperReadLatency --
+ *
+ *      Compute the average latency of the reads completed by the disk of the
+ *      partition since the previous call, from /proc/diskstats. The wiper
+ *      only writes, so the reads are those of the rest of the guest and
+ *      their latency tells how much the wipe hurts it.
+ *
+ * Results:
+ *      The average read latency in milliseconds.
+ *      -1 if it is unknown, or if the disk completed no read.
+ *
+ * Side Effects:
+ *      The read counters of the state are updated.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+WiperReadLatency(WiperState *state)  // IN/OUT
+{
+#if defined(__linux__)
+   char line[512];
+   FILE *fp;
+   int latency = -1;
+
+   if (state->diskName == NULL) {
+      return -1;
+   }
+
+   fp = Posix_Fopen("/proc/diskstats", "r");
+   if (fp == NULL) {
+      return -1;
+   }
+
+   while (fgets(line, sizeof line, fp) != NULL) {
+      char diskName[NAME_MAX + 1];
+      unsigned long readIOs;
+      unsigned long readTicks;
+
+      /* major minor name reads merged sectors ms-reading ... */
+      if (sscanf(line, "%*d %*d %" XSTR(NAME_MAX) "s %lu %*u %*u %lu",
+                 diskName, &readIOs, &readTicks) != 3 ||
+          strcmp(diskName, state->diskName) != 0) {
+         continue;
+      }
+
+      if (state->readIOs != 0 && readIOs > state->readIOs) {
+         latency = (readTicks - state->readTicks) / (readIOs - state->readIOs);
+      }
+      state->readIOs = readIOs;
+      state->readTicks = readTicks;
+      break;
+   }
+
+   fclose(fp);
+   return latency;
+#else
+   return -1;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * WiperThrottle --
+ *
+ *      Adjust the write duty cycle of a background wipe to the current read
+ *      latency of the disk.
+ *
+ * Results:
+ *      The time to spend writing during this step, in microseconds. 0 means
+ *      the wipe is paused for this step.
+ *
+ * Side Effects:
+ *      The duty cycle of the state is updated.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VmTimeType
+WiperThrottle(WiperState *state)  // IN/OUT
+{
+   int latency = WiperReadLatency(state);
+
+   if (state->maxLatency > 0 && latency > (int)state->maxLatency) {
+      state->duty /= 2;
+   } else {
+      state->duty = MIN(state->duty + WIPER_DUTY_STEP, 100);
+   }
+
+   return (VmTimeType)WIPER_STEP_USECS * state->duty / 100;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -915,7 +1228,7 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
 
    /* Disk space is an important system resource. Don't fill the partition
       completely */
-   if (free <= (((uint64)5) << 20) /* 5 MB */) {
+   if (free <= (*state)->freeFloor) {
       /* We are done */
       WiperClean(*state);
       *state = NULL;
@@ -925,6 +1238,26 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
 
    /* We are not done */
    switch ((*state)->phase) {
+#if defined(__linux__) && defined(FITRIM)
+   case WIPER_PHASE_TRIM:
+      switch (WiperTrimNext(*state, total)) {
+      case 1:
+         *progress = 99 * MIN((*state)->trimOffset, total) / total;
+         return "";
+
+      case 0:
+         WiperClean(*state);
+         *state = NULL;
+         *progress = 100;
+         return "";
+
+      default:
+         (*state)->phase = WIPER_PHASE_CREATE;
+         break;
+      }
+      break;
+#endif
+
    case WIPER_PHASE_CREATE:
       {
          File *new;
@@ -955,12 +1288,23 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
             fret = FileIO_Open(&new->fd,
                                new->name,
                                FILEIO_OPEN_ACCESS_WRITE
-                               | FILEIO_OPEN_DELETE_ASAP,
+                               | FILEIO_OPEN_DELETE_ASAP
+                               | ((*state)->direct ? FILEIO_OPEN_UNBUFFERED : 0),
                                FILEIO_OPEN_CREATE_SAFE);
             if (FileIO_IsSuccess(fret)) {
                break;
             }
 
+            if ((*state)->direct && fret != FILEIO_OPEN_ERROR_EXIST) {
+               /*
+                * Some file systems don't support O_DIRECT, and may have
+                * created the file before failing. Use buffered writes.
+                */
+               Posix_Unlink(new->name);
+               (*state)->direct = FALSE;
+               continue;
+            }
+
             if (fret != FILEIO_OPEN_ERROR_EXIST) {
                WiperClean(*state);
                *state = NULL;
@@ -977,14 +1321,19 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
 
    case WIPER_PHASE_FILL:
       {
-         unsigned int i;
+         VmTimeType start = Hostinfo_SystemTimerUS();
+         VmTimeType budget = WIPER_STEP_USECS;
+         VmTimeType elapsed;
+
+         if ((*state)->background) {
+            budget = WiperThrottle(*state);
+         }
 
          /* Do several write system calls per call to Wiper_Next() */
-         for (i = 0; i < (2 << 20) /* 2 MB */
-                         / (WIPER_SECTOR_STEP * WIPER_SECTOR_SIZE); i++) {
+         while (Hostinfo_SystemTimerUS() - start < budget) {
             FileIOResult fret;
 
-            if ((*state)->f->size + WIPER_SECTOR_STEP * WIPER_SECTOR_SIZE >=
+            if ((*state)->f->size + WIPER_WRITE_SIZE >=
                 (((uint64)2) << 30) /* 2 GB */) {
                /* The file is going to be larger than what most filesystems
                   can support. Create a new file */
@@ -993,7 +1342,7 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
             }
 
             fret = FileIO_Write(&(*state)->f->fd, (*state)->buf,
-                                WIPER_SECTOR_STEP * WIPER_SECTOR_SIZE, NULL);
+                                WIPER_WRITE_SIZE, NULL);
 
             /*
              * We distiguish errors from FilieIO_Write.
@@ -1024,7 +1373,14 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
                                                        "Unable to write to a wiper file";
             }
 
-            (*state)->f->size += WIPER_SECTOR_STEP * WIPER_SECTOR_SIZE;
+            (*state)->f->size += WIPER_WRITE_SIZE;
+            (*state)->bytesDone += WIPER_WRITE_SIZE;
+         }
+
+         /* Leave the disk alone for the rest of the step. */
+         elapsed = Hostinfo_SystemTimerUS() - start;
+         if ((*state)->background && elapsed < WIPER_STEP_USECS) {
+            Util_Usleep(WIPER_STEP_USECS - elapsed);
          }
       }
       break;
@@ -1035,11 +1391,129 @@ Wiper_Next(Wiper_State **s,         // IN/OUT
       break;
    }
 
-   *progress = 99 - 99 * free / total;
+   if ((*state)->background) {
+      /* Progress towards the free-space floor rather than a full partition. */
+      *progress = 99 - 99 * (free - (*state)->freeFloor) /
+                            MAX(total - (*state)->freeFloor, 1);
+   } else {
+      *progress = 99 - 99 * free / total;
+   }
    return "";
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Wiper_GetBytesDone --
+ *
+ *      Get the amount of work done so far by a wipe operation, for
+ *      throughput reporting.
+ *
+ * Results:
+ *      The number of bytes written to wiper files or trimmed.
+ *
+ * Side Effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+uint64
+Wiper_GetBytesDone(const Wiper_State *s)   // IN
+{
+   ASSERT(s);
+   return ((const WiperState *)s)->bytesDone;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Wiper_SetBackground --
+ *
+ *      Switch a wipe operation to background mode, for wiping file systems
+ *      in use by production workloads:
+ *      - the wipe stops, as if complete, once the free space of the
+ *        partition drops to freeFloor bytes;
+ *      - the time spent writing is adapted to the read latency of the disk:
+ *        halved while it exceeds maxLatency milliseconds, and raised again
+ *        once it recovers, the wipe pausing and resuming in place;
+ *      - on Linux, the I/O priority of the calling thread, which should be
+ *        the one calling Wiper_Next(), is lowered to the idle class.
+ *
+ * Results:
+ *      None
+ *
+ * Side Effects:
+ *      Wiper_Next() may sleep for the rest of its time budget.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+Wiper_SetBackground(Wiper_State *s,            // IN/OUT
+                    uint64 freeFloor,          // IN: free space to leave
+                    unsigned int maxLatency)   // IN: target read latency (ms)
+{
+   WiperState *state = (WiperState *)s;
+
+   ASSERT(state);
+
+   state->background = TRUE;
+   state->freeFloor = MAX(freeFloor, WIPER_MIN_FREE);
+   state->maxLatency = maxLatency;
+   /* Start gently, the first decision lacks a latency sample. */
+   state->duty = 50;
+
+#if defined(__linux__)
+   {
+      char *disk = WiperSinglePartition_GetDisk(state->p);
+
+      free(state->diskName);
+      state->diskName = NULL;
+      if (disk != NULL) {
+         char *slash = strrchr(disk, '/');
+         state->diskName = strdup(slash != NULL ? slash + 1 : disk);
+         free(disk);
+      }
+      WiperReadLatency(state);
+   }
+
+#if defined(SYS_ioprio_set)
+   /* IOPRIO_WHO_PROCESS (1) of the calling thread, IOPRIO_CLASS_IDLE (3). */
+   if (syscall(SYS_ioprio_set, 1, 0, 3 << 13) != 0) {
+      Log("Unable to lower the I/O priority of the wiper (%d).\n", errno);
+   }
+#endif
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * Wiper_GetDutyCycle --
+ *
+ *      Get the share of the time a background wipe currently spends writing.
+ *
+ * Results:
+ *      The duty cycle in percent; 100 unless in background mode.
+ *
+ * Side Effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+unsigned int
+Wiper_GetDutyCycle(const Wiper_State *s)   // IN
+{
+   ASSERT(s);
+   return ((const WiperState *)s)->duty;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -24,6 +24,7 @@
 
 #include <sys/wait.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -66,8 +67,6 @@ VM_EMBED_VERSION(SYSIMAGE_VERSION_EXT_STR);
  * customization)
  */
 
-#define CLEANUPCMD  "/bin/rm -r -f "
-
 #ifndef TMP_PATH_VAR
 #define TMP_PATH_VAR "/tmp/.vmware/linux/deploy"
 #endif
@@ -160,6 +159,13 @@ LogFunction sLog = NoLogging;
 static uint16 gProcessTimeout = DEPLOYPKG_PROCESSTIMEOUT_DEFAULT;
 static bool gProcessTimeoutSetByLauncher = false;
 
+/*
+ * Monotonic start times, in ms, of the current state and of the current
+ * phase of the deployment, to log where the customization time goes.
+ */
+static uint64 gStateStartMs = 0;
+static uint64 gPhaseStartMs = 0;
+
 // .....................................................................................
 
 /*
@@ -618,6 +624,45 @@ Init(void)
 
 //......................................................................................
 
+/**
+ *
+ * Get the monotonic time.
+ *
+ * @param   None
+ * @return  The time in milliseconds
+ *
+ **/
+static uint64
+GetTimeMs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+//......................................................................................
+
+/**
+ *
+ * Log the time spent in a phase of the deployment and start the next one.
+ *
+ * @param   [IN]  phase   The phase which ended
+ * @return  None
+ *
+ **/
+static void
+EndPhase(const char* phase)
+{
+   uint64 now = GetTimeMs();
+
+   sLog(log_info, "Phase '%s' took %"FMT64"u ms.\n", phase,
+        now - gPhaseStartMs);
+   gPhaseStartMs = now;
+}
+
+//......................................................................................
+
 /**
  *
  * Get the command to execute from the cab file.
@@ -790,11 +835,20 @@ UnTouch(const char* state)
  * @returns DEPLOYPKG_STATUS_SUCCESS on success
  *          DEPLOYPKG_STATUS_ERROR on error
  *
+ * The time spent in stateFrom is logged.
+ *
  **/
 static DeployPkgStatus
 TransitionState(const char* stateFrom, const char* stateTo)
 {
+   uint64 now = GetTimeMs();
+
    sLog(log_info, "Transitioning from state '%s' to state '%s'.\n", stateFrom, stateTo);
+   if (stateFrom != NULL) {
+      sLog(log_info, "State '%s' lasted %"FMT64"u ms.\n", stateFrom,
+           now - gStateStartMs);
+   }
+   gStateStartMs = now;
 
    // Create a file to indicate state to
    if (stateTo != NULL) {
@@ -1228,28 +1282,12 @@ UseCloudInitWorkflow(const char* dirPath)
 static bool
 DeleteTempDeploymentDirectory(const char* imcDirPath)
 {
-   int cleanupCommandSize;
-   char* cleanupCommand;
-
-   cleanupCommandSize = strlen(CLEANUPCMD) + strlen(imcDirPath) + 1;
-   cleanupCommand = malloc(cleanupCommandSize);
-   if (cleanupCommand == NULL) {
-      SetDeployError("Error allocating memory."
-                     "Failed to clean up imc directory '%s'", imcDirPath);
-      return false;
-   }
-
-   strcpy(cleanupCommand, CLEANUPCMD);
-   Str_Strcat(cleanupCommand, imcDirPath, cleanupCommandSize);
-
-   sLog(log_info, "Launching cleanup.\n");
-   if (ForkExecAndWaitCommand(cleanupCommand, false) != 0) {
+   sLog(log_info, "Cleaning up imc directory '%s'.\n", imcDirPath);
+   if (!File_DeleteDirectoryTree(imcDirPath)) {
       sLog(log_warning, "Error while cleaning up imc directory '%s'. (%s)\n",
            imcDirPath, strerror(errno));
-      free(cleanupCommand);
       return false;
    }
-   free(cleanupCommand);
    return true;
 }
 
@@ -1282,6 +1320,8 @@ Deploy(const char* packageName)
    char *imcDirPath = NULL;
    bool useCloudInitWorkflow = false;
    int imcDirPathSize = 0;
+
+   gPhaseStartMs = GetTimeMs();
    TransitionState(NULL, INPROGRESS);
 
    // Notify the vpx of customization in-progress state
@@ -1346,6 +1386,7 @@ Deploy(const char* packageName)
    free(pkgCommand);
 
    sLog(log_info, "Actual deployment command: '%s'.\n", command);
+   EndPhase("setup");
 
    if (archiveType == VMWAREDEPLOYPKG_PAYLOAD_TYPE_CAB) {
       if (!ExtractCabPackage(packageName, imcDirPath)) {
@@ -1363,6 +1404,8 @@ Deploy(const char* packageName)
       }
    }
 
+   EndPhase("extraction");
+
    if (!(flags & VMWAREDEPLOYPKG_HEADER_FLAGS_IGNORE_CLOUD_INIT)) {
       useCloudInitWorkflow = UseCloudInitWorkflow(imcDirPath);
    } else {
@@ -1374,10 +1417,12 @@ Deploy(const char* packageName)
       sSkipReboot = TRUE;
       free(command);
       deployPkgStatus = CloudInitSetup(imcDirPath);
+      EndPhase("cloud-init setup");
    } else {
       sLog(log_info, "Executing traditional GOSC workflow.\n");
       deploymentResult = ForkExecAndWaitCommand(command, false);
       free(command);
+      EndPhase("customization");
 
       if (deploymentResult != CUST_SUCCESS) {
          sLog(log_error, "Customization process returned with error.\n");
@@ -1420,6 +1465,7 @@ Deploy(const char* packageName)
          } else {
             sLog(log_info, "No nics to enable.\n");
          }
+         EndPhase("enabling nics");
 
          SetCustomizationStatusInVmx(TOOLSDEPLOYPKG_DONE,
                                      TOOLSDEPLOYPKG_ERROR_SUCCESS,
@@ -1437,6 +1483,7 @@ Deploy(const char* packageName)
       return DEPLOYPKG_STATUS_ERROR;
    }
    free(imcDirPath);
+   EndPhase("cleanup");
 
    if (flags & VMWAREDEPLOYPKG_HEADER_FLAGS_SKIP_REBOOT) {
       forceSkipReboot = true;
@@ -1531,7 +1578,7 @@ ExtractZipPackage(const char* pkgName,
 
    int pkgFd, zipFd;
    char zipName[1024];
-   char copyBuf[4096];
+   char copyBuf[65536];
    ssize_t rdCount;
    char* destCopy;
 
@@ -1560,6 +1607,17 @@ ExtractZipPackage(const char* pkgName,
       ret = FALSE;
       goto done;
    }
+   /*
+    * unzip needs a seekable file starting with the archive, and errors out on
+    * the prepended header, so the payload has to be copied. Do it in the
+    * kernel (without even copying the data on file systems with reflinks)
+    * and only go through copyBuf for the part that could not.
+    */
+#if defined(__NR_copy_file_range)
+   while ((rdCount = syscall(__NR_copy_file_range, pkgFd, NULL, zipFd, NULL,
+                             (size_t) 64 << 20, 0)) > 0) {
+   }
+#endif
    while ((rdCount = read(pkgFd, copyBuf, sizeof copyBuf)) > 0) {
       if (write(zipFd, copyBuf, rdCount) < 0) {
          sLog(log_error, "Failed to write the zip file '%s'. (%s)\n", zipName,
@@ -27,6 +27,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <stdlib.h>
 
@@ -54,6 +58,48 @@ static void
 ProcessRead(ProcessInternal *p, ReadStatus *status, Bool out, Bool readToEof);
 
 
+/*
+ *------------------------------------------------------------------------------
+ *
+ * ProcessGetTimeMs --
+ *
+ *      Returns the monotonic time in milliseconds.
+ *
+ *------------------------------------------------------------------------------
+ */
+
+static uint64
+ProcessGetTimeMs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/*
+ *------------------------------------------------------------------------------
+ *
+ * ProcessOpenPidFd --
+ *
+ *      Returns a descriptor which becomes readable when the process exits,
+ *      or -1 if the kernel does not support it (before Linux 5.3).
+ *
+ *------------------------------------------------------------------------------
+ */
+
+static int
+ProcessOpenPidFd(pid_t pid)
+{
+#if defined(__NR_pidfd_open)
+   return syscall(__NR_pidfd_open, pid, 0);
+#else
+   return -1;
+#endif
+}
+
+
 /*
  *------------------------------------------------------------------------------
  *
@@ -144,12 +190,10 @@ Process_RunToComplete(ProcessHandle h, unsigned long timeoutSec)
    int stderr[2];
    int flags;
    ProcessInternal* p;
-   // poll for the process to complete and read the output
-   const unsigned int OneSecMicroSec = 1000000;
-   const unsigned int LoopSleepMicrosec = OneSecMicroSec / 10;
-   const unsigned long timeoutLoopSleeps =
-      timeoutSec * (OneSecMicroSec / LoopSleepMicrosec);
-   unsigned long elapsedTimeLoopSleeps;
+   int pidFd;
+   Bool killed = FALSE;
+   uint64 startMs = ProcessGetTimeMs();
+   uint64 deadlineMs = startMs + (uint64)timeoutSec * 1000;
 
    ReadStatus res_stdout = READSTATUS_UNDEFINED;
    ReadStatus res_stderr = READSTATUS_UNDEFINED;
@@ -208,65 +252,108 @@ Process_RunToComplete(ProcessHandle h, unsigned long timeoutSec)
              strerror(errno));
    }
 
-   elapsedTimeLoopSleeps = 0;
+   /*
+    * Wait for the process to exit, collecting its output as it comes rather
+    * than polling: the pipes and the pidfd of the process wake us up.
+    * Without a pidfd, the exit is checked every 100ms, or every 10ms once
+    * the process closed its output.
+    */
+
+   pidFd = ProcessOpenPidFd(p->pid);
 
    while (1) {
       int processStatus;
-      int processFinished = (waitpid(p->pid, &processStatus, WNOHANG) > 0);
+      struct pollfd fds[3];
+      uint64 nowMs;
+      int waitMs;
+
+      if (waitpid(p->pid, &processStatus, WNOHANG) > 0) {
+         unsigned int elapsedSec = (ProcessGetTimeMs() - startMs) / 1000;
 
-      if (processFinished) {
          if (WIFEXITED(processStatus)) {
             p->exitCode = WEXITSTATUS(processStatus);
             p->log(log_info,
                    "Process exited normally after %d seconds, returned %d",
-                   elapsedTimeLoopSleeps * LoopSleepMicrosec / OneSecMicroSec,
-                   p->exitCode);
+                   elapsedSec, p->exitCode);
          } else if (WIFSIGNALED(processStatus)) {
             p->exitCode = 127;
             p->log(log_error,
                    "Process exited abnormally after %d sec, uncaught signal %d",
-                   elapsedTimeLoopSleeps * LoopSleepMicrosec / OneSecMicroSec,
-                   WTERMSIG(processStatus));
+                   elapsedSec, WTERMSIG(processStatus));
          }
 
          break;
+      }
+
+      nowMs = ProcessGetTimeMs();
+      if (nowMs >= deadlineMs && !killed) {
+         p->log(log_error, "Timed out waiting for process exit, killing...");
+         kill(p->pid, SIGKILL);
+         killed = TRUE;
+      }
+
+      fds[0].fd = res_stdout == READSTATUS_DONE ? -1 : p->stdoutFd;
+      fds[0].events = POLLIN;
+      fds[1].fd = res_stderr == READSTATUS_DONE ? -1 : p->stderrFd;
+      fds[1].events = POLLIN;
+      fds[2].fd = pidFd;
+      fds[2].events = POLLIN;
+
+      if (pidFd == -1) {
+         waitMs = (fds[0].fd == -1 && fds[1].fd == -1) ? 10 : 100;
       } else {
-         if (timeoutLoopSleeps == elapsedTimeLoopSleeps) {
-            p->log(log_error, "Timed out waiting for process exit, killing...");
-            kill(p->pid, SIGKILL);
-         }
+         waitMs = -1;
+      }
+      if (!killed && (waitMs == -1 || nowMs + waitMs > deadlineMs)) {
+         waitMs = deadlineMs - nowMs;
+      }
 
-         // Empty the pipes.
+      if (poll(fds, ARRAYSIZE(fds), waitMs) < 0 && errno != EINTR) {
+         p->log(log_error, "Failed to poll process output: %s",
+                strerror(errno));
+         usleep(10000);
+         continue;
+      }
+
+      // Empty the pipes.
+      if (fds[0].fd != -1 && fds[0].revents != 0) {
          ProcessRead(p, &res_stdout, TRUE, FALSE);
          if (res_stdout == READSTATUS_ERROR) {
             p->log(log_error, "Error while reading process output, killing...");
             kill(p->pid, SIGKILL);
+            res_stdout = READSTATUS_DONE;
          }
+      }
 
+      if (fds[1].fd != -1 && fds[1].revents != 0) {
          ProcessRead(p, &res_stderr, FALSE, FALSE);
          if (res_stderr == READSTATUS_ERROR) {
             p->log(log_error, "Error while reading process output, killing...");
             kill(p->pid, SIGKILL);
+            res_stderr = READSTATUS_DONE;
          }
-
-         usleep(LoopSleepMicrosec);
-         elapsedTimeLoopSleeps++;
       }
    }
 
+   if (pidFd != -1) {
+      close(pidFd);
+   }
+
    // Process completed. Now read all the output to EOF.
-   ProcessRead(p, &res_stdout, TRUE, TRUE);
-   if (res_stdout == READSTATUS_ERROR) {
-      p->log(log_error, "Error while reading process output, killing...");
+   if (res_stdout != READSTATUS_DONE) {
+      ProcessRead(p, &res_stdout, TRUE, TRUE);
+      if (res_stdout == READSTATUS_ERROR) {
+         p->log(log_error, "Error while reading process output, killing...");
+      }
    }
 
-   ProcessRead(p, &res_stderr, FALSE, TRUE);
-   if (res_stderr == READSTATUS_ERROR) {
-      p->log(log_error, "Error while reading process output, killing...");
+   if (res_stderr != READSTATUS_DONE) {
+      ProcessRead(p, &res_stderr, FALSE, TRUE);
+      if (res_stderr == READSTATUS_ERROR) {
+         p->log(log_error, "Error while reading process output, killing...");
+      }
    }
 
-   close(stdout[1]);
-   close(stderr[1]);
    return PROCESS_SUCCESS;
 }
 
@@ -284,6 +371,7 @@ Process_RunToComplete(ProcessHandle h, unsigned long timeoutSec)
  * There are two modes:
  * readToEof = TRUE - block until the read returns 0 (EOF). This signifies
  *                    that the process has exited and there's nothing left.
+ *                    Waits for more output in poll.
  * readToEof = FALSE- Just empty the pipe. This will return even if we get
  *             EAGAIN back from the read. Use this in the midst of the poll
  *             loop so the pipe doesn't fill up and block the process.
@@ -326,13 +414,19 @@ ProcessRead(ProcessInternal *p, ReadStatus *status, Bool stdout, Bool readToEof)
          return;
       } else if (count < 0) {
          if (errno == EAGAIN && readToEof) {
+            struct pollfd pfd;
+
             if (*status != READSTATUS_PENDING) {
-               // waiting for more output, sleep briefly and try again
+               // waiting for more output, wait for it and try again
                p->log(log_info, "Pending output from %s, trying again", stdstr);
                *status = READSTATUS_PENDING;
             }
 
-            usleep(1000);
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            poll(&pfd, 1, -1);
+         } else if (errno == EINTR) {
+            continue;
          } else if (errno == EAGAIN && !readToEof) {
             if (*status != READSTATUS_PENDING) {
                // caller doesn't want to wait until EOF
@@ -23,7 +23,15 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#if defined(__linux__)
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include "vmware.h"
+#include "vm_basic_asm.h"
 #include "vmGuestLib.h"
 #include "vmGuestLibInt.h"
 #include "str.h"
@@ -37,6 +45,7 @@
 #include "dynxdr.h"
 #include "xdrutil.h"
 #include "ctype.h"
+#include "vmGuestLibShm.h"
 
 #define GUESTLIB_NAME "VMware Guest API"
 
@@ -67,12 +76,112 @@ typedef struct {
     */
    size_t dataSize;
    void *data;
+
+   /*
+    * Change detection: hash of the last reply from the host, and a counter
+    * bumped each time an update brings a reply with a different hash.
+    */
+   uint64 replyHash;
+   uint64 updateCookie;
+
+#if defined(__linux__)
+   /* Statistics shared by vmtoolsd, mapped on first use. */
+   const VMGuestLibShm *shm;
+#endif
 } VMGuestLibHandleType;
 
 #define HANDLE_VERSION(h)     (((VMGuestLibHandleType *)(h))->version)
 #define HANDLE_SESSIONID(h)   (((VMGuestLibHandleType *)(h))->sessionId)
 #define HANDLE_DATA(h)        (((VMGuestLibHandleType *)(h))->data)
 #define HANDLE_DATASIZE(h)    (((VMGuestLibHandleType *)(h))->dataSize)
+#define HANDLE_REPLYHASH(h)   (((VMGuestLibHandleType *)(h))->replyHash)
+#define HANDLE_COOKIE(h)      (((VMGuestLibHandleType *)(h))->updateCookie)
+#define HANDLE_SHM(h)         (((VMGuestLibHandleType *)(h))->shm)
+
+/* How many times a reader retries when vmtoolsd updates the shared reply. */
+#define VMGUESTLIB_SHM_READ_RETRIES 4
+
+/*
+ * The integral statistics, as (VMGuestLibStats field, VMGuestLibStatId,
+ * V3 statistic id, V3 union member). The first ones are also those of the
+ * V2 protocol, where the VMGuestLibDataV2 field is named as the V3 member.
+ */
+#define VMGUESTLIB_V2_STATS(X)                                                 \
+   X(cpuReservationMHz, VMGUESTLIB_STAT_CPU_RESERVATION_MHZ,                   \
+     GUESTLIB_CPU_RESERVATION_MHZ, cpuReservationMHz)                          \
+   X(cpuLimitMHz, VMGUESTLIB_STAT_CPU_LIMIT_MHZ,                               \
+     GUESTLIB_CPU_LIMIT_MHZ, cpuLimitMHz)                                      \
+   X(cpuShares, VMGUESTLIB_STAT_CPU_SHARES,                                    \
+     GUESTLIB_CPU_SHARES, cpuShares)                                           \
+   X(cpuUsedMs, VMGUESTLIB_STAT_CPU_USED_MS,                                   \
+     GUESTLIB_CPU_USED_MS, cpuUsedMs)                                          \
+   X(hostMHz, VMGUESTLIB_STAT_HOST_MHZ,                                        \
+     GUESTLIB_HOST_MHZ, hostMHz)                                               \
+   X(memReservationMB, VMGUESTLIB_STAT_MEM_RESERVATION_MB,                     \
+     GUESTLIB_MEM_RESERVATION_MB, memReservationMB)                            \
+   X(memLimitMB, VMGUESTLIB_STAT_MEM_LIMIT_MB,                                 \
+     GUESTLIB_MEM_LIMIT_MB, memLimitMB)                                        \
+   X(memShares, VMGUESTLIB_STAT_MEM_SHARES,                                    \
+     GUESTLIB_MEM_SHARES, memShares)                                           \
+   X(memMappedMB, VMGUESTLIB_STAT_MEM_MAPPED_MB,                               \
+     GUESTLIB_MEM_MAPPED_MB, memMappedMB)                                      \
+   X(memActiveMB, VMGUESTLIB_STAT_MEM_ACTIVE_MB,                               \
+     GUESTLIB_MEM_ACTIVE_MB, memActiveMB)                                      \
+   X(memOverheadMB, VMGUESTLIB_STAT_MEM_OVERHEAD_MB,                           \
+     GUESTLIB_MEM_OVERHEAD_MB, memOverheadMB)                                  \
+   X(memBalloonedMB, VMGUESTLIB_STAT_MEM_BALLOONED_MB,                         \
+     GUESTLIB_MEM_BALLOONED_MB, memBalloonedMB)                                \
+   X(memSwappedMB, VMGUESTLIB_STAT_MEM_SWAPPED_MB,                             \
+     GUESTLIB_MEM_SWAPPED_MB, memSwappedMB)                                    \
+   X(memSharedMB, VMGUESTLIB_STAT_MEM_SHARED_MB,                               \
+     GUESTLIB_MEM_SHARED_MB, memSharedMB)                                      \
+   X(memSharedSavedMB, VMGUESTLIB_STAT_MEM_SHARED_SAVED_MB,                    \
+     GUESTLIB_MEM_SHARED_SAVED_MB, memSharedSavedMB)                           \
+   X(memUsedMB, VMGUESTLIB_STAT_MEM_USED_MB,                                   \
+     GUESTLIB_MEM_USED_MB, memUsedMB)                                          \
+   X(elapsedMs, VMGUESTLIB_STAT_ELAPSED_MS,                                    \
+     GUESTLIB_ELAPSED_MS, elapsedMs)
+
+#define VMGUESTLIB_V3_STATS(X)                                                 \
+   VMGUESTLIB_V2_STATS(X)                                                      \
+   X(cpuStolenMs, VMGUESTLIB_STAT_CPU_STOLEN_MS,                               \
+     GUESTLIB_CPU_STOLEN_MS, cpuStolenMs)                                      \
+   X(memTargetSizeMB, VMGUESTLIB_STAT_MEM_TARGET_SIZE_MB,                      \
+     GUESTLIB_MEM_TARGET_SIZE_MB, memTargetSizeMB)                             \
+   X(hostNumCpuCores, VMGUESTLIB_STAT_HOST_NUM_CPU_CORES,                      \
+     GUESTLIB_HOST_CPU_NUM_CORES, hostCpuNumCores)                             \
+   X(hostCpuUsedMs, VMGUESTLIB_STAT_HOST_CPU_USED_MS,                          \
+     GUESTLIB_HOST_CPU_USED_MS, hostCpuUsedMs)                                 \
+   X(hostMemSwappedMB, VMGUESTLIB_STAT_HOST_MEM_SWAPPED_MB,                    \
+     GUESTLIB_HOST_MEM_SWAPPED_MB, hostMemSwappedMB)                           \
+   X(hostMemSharedMB, VMGUESTLIB_STAT_HOST_MEM_SHARED_MB,                      \
+     GUESTLIB_HOST_MEM_SHARED_MB, hostMemSharedMB)                             \
+   X(hostMemUsedMB, VMGUESTLIB_STAT_HOST_MEM_USED_MB,                          \
+     GUESTLIB_HOST_MEM_USED_MB, hostMemUsedMB)                                 \
+   X(hostMemPhysMB, VMGUESTLIB_STAT_HOST_MEM_PHYS_MB,                          \
+     GUESTLIB_HOST_MEM_PHYS_MB, hostMemPhysMB)                                 \
+   X(hostMemPhysFreeMB, VMGUESTLIB_STAT_HOST_MEM_PHYS_FREE_MB,                 \
+     GUESTLIB_HOST_MEM_PHYS_FREE_MB, hostMemPhysFreeMB)                        \
+   X(hostMemKernOvhdMB, VMGUESTLIB_STAT_HOST_MEM_KERN_OVHD_MB,                 \
+     GUESTLIB_HOST_MEM_KERN_OVHD_MB, hostMemKernOvhdMB)                        \
+   X(hostMemMappedMB, VMGUESTLIB_STAT_HOST_MEM_MAPPED_MB,                      \
+     GUESTLIB_HOST_MEM_MAPPED_MB, hostMemMappedMB)                             \
+   X(hostMemUnmappedMB, VMGUESTLIB_STAT_HOST_MEM_UNMAPPED_MB,                  \
+     GUESTLIB_HOST_MEM_UNMAPPED_MB, hostMemUnmappedMB)                         \
+   X(memZippedMB, VMGUESTLIB_STAT_MEM_ZIPPED_MB,                               \
+     GUESTLIB_MEM_ZIPPED_MB, memZippedMB)                                      \
+   X(memZipSavedMB, VMGUESTLIB_STAT_MEM_ZIP_SAVED_MB,                          \
+     GUESTLIB_MEM_ZIPSAVED_MB, memZipSavedMB)                                  \
+   X(memLLSwappedMB, VMGUESTLIB_STAT_MEM_LL_SWAPPED_MB,                        \
+     GUESTLIB_MEM_LLSWAPPED_MB, memLLSwappedMB)                                \
+   X(memSwapTargetMB, VMGUESTLIB_STAT_MEM_SWAP_TARGET_MB,                      \
+     GUESTLIB_MEM_SWAP_TARGET_MB, memSwapTargetMB)                             \
+   X(memBalloonTargetMB, VMGUESTLIB_STAT_MEM_BALLOON_TARGET_MB,                \
+     GUESTLIB_MEM_BALLOON_TARGET_MB, memBalloonTargetMB)                       \
+   X(memBalloonMaxMB, VMGUESTLIB_STAT_MEM_BALLOON_MAX_MB,                      \
+     GUESTLIB_MEM_BALLOON_MAX_MB, memBalloonMaxMB)                             \
+   X(memShares64, VMGUESTLIB_STAT_MEM_SHARES_64,                               \
+     GUESTLIB_MEM_SHARES_64, memShares64)
 
 #define VMGUESTLIB_GETSTAT_V2(HANDLE, ERROR, OUTPTR, FIELDNAME)      \
    do {                                                              \
@@ -319,6 +428,12 @@ VMGuestLib_CloseHandle(VMGuestLibHandle handle) // IN
    }
    free(data);
 
+#if defined(__linux__)
+   if (HANDLE_SHM(handle) != NULL) {
+      munmap((void *)HANDLE_SHM(handle), VMGUESTLIB_SHM_SIZE);
+   }
+#endif
+
    /* Be paranoid. */
    HANDLE_DATA(handle) = NULL;
    free(handle);
@@ -327,6 +442,152 @@ VMGuestLib_CloseHandle(VMGuestLibHandle handle) // IN
 }
 
 
+#if defined(__linux__)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VMGuestLibShmMap --
+ *
+ *      Map the statistics shared by vmtoolsd, if it shares them. The segment
+ *      is only trusted if root owned and not writable by anyone else.
+ *
+ * Results:
+ *      The segment, NULL if not available.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static const VMGuestLibShm *
+VMGuestLibShmMap(void)
+{
+   const VMGuestLibShm *shm;
+   struct stat st;
+   int fd;
+
+   fd = open(VMGUESTLIB_SHM_PATH, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd < 0) {
+      return NULL;
+   }
+
+   if (fstat(fd, &st) != 0 ||
+       !S_ISREG(st.st_mode) ||
+       st.st_uid != 0 ||
+       (st.st_mode & (S_IWGRP | S_IWOTH)) != 0 ||
+       st.st_size < VMGUESTLIB_SHM_SIZE) {
+      Debug("Ignoring untrusted %s\n", VMGUESTLIB_SHM_PATH);
+      close(fd);
+      return NULL;
+   }
+
+   shm = mmap(NULL, VMGUESTLIB_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (shm == MAP_FAILED) {
+      return NULL;
+   }
+
+   if (shm->magic != VMGUESTLIB_SHM_MAGIC ||
+       shm->version != VMGUESTLIB_SHM_VERSION) {
+      munmap((void *)shm, VMGUESTLIB_SHM_SIZE);
+      return NULL;
+   }
+
+   return shm;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VMGuestLibShmRead --
+ *
+ *      Copy the reply to "guestlib.info.get <version>" shared by vmtoolsd,
+ *      if fresh. The segment is mapped on first use, and remapped when its
+ *      reply went stale, as vmtoolsd replaces it when restarted.
+ *
+ * Results:
+ *      TRUE and the reply to free() on success.
+ *      FALSE if the caller must query the host itself.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VMGuestLibShmRead(VMGuestLibHandle handle, // IN
+                  uint32 version,          // IN
+                  char **reply,            // OUT
+                  size_t *replyLen)        // OUT
+{
+   const VMGuestLibShm *shm = HANDLE_SHM(handle);
+   unsigned int i;
+
+   if (shm == NULL) {
+      shm = VMGuestLibShmMap();
+      if (shm == NULL) {
+         return FALSE;
+      }
+      HANDLE_SHM(handle) = shm;
+   }
+
+   for (i = 0; i < VMGUESTLIB_SHM_READ_RETRIES; i++) {
+      uint32 seq = shm->seq;
+      struct timespec now;
+      uint64 age;
+      uint32 len;
+      char *copy;
+
+      if ((seq & 1) != 0) {
+         continue;
+      }
+      SMP_R_BARRIER_R();
+
+      len = shm->replyLen;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      age = (uint64)now.tv_sec * 1000000 + now.tv_nsec / 1000 -
+            shm->updateTime;
+      if (shm->dataVersion != version ||
+          len < sizeof (VMGuestLibHeader) ||
+          len > VMGUESTLIB_SHM_MAX_REPLY ||
+          age > (uint64)shm->interval * VMGUESTLIB_SHM_STALE_INTERVALS *
+                1000000) {
+         SMP_R_BARRIER_R();
+         if (shm->seq != seq) {
+            continue;
+         }
+         break;
+      }
+
+      copy = Util_SafeMalloc(len);
+      memcpy(copy, shm->reply, len);
+
+      SMP_R_BARRIER_R();
+      if (shm->seq == seq) {
+         *reply = copy;
+         *replyLen = len;
+         return TRUE;
+      }
+      free(copy);
+   }
+
+   if (i < VMGUESTLIB_SHM_READ_RETRIES &&
+       (shm->dataVersion == 0 || shm->dataVersion == version)) {
+      /*
+       * Stale, or the host did not answer vmtoolsd. Remap next time, in case
+       * vmtoolsd was restarted.
+       */
+      munmap((void *)shm, VMGUESTLIB_SHM_SIZE);
+      HANDLE_SHM(handle) = NULL;
+   }
+   return FALSE;
+}
+#endif
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -378,8 +639,15 @@ VMGuestLibUpdateInfo(VMGuestLibHandle handle) // IN
                   VMGUESTLIB_BACKDOOR_COMMAND_STRING,
                   hostVersion);
 
-      /* Send the request. */
-      if (RpcChannel_SendOne(&reply, &replyLen, commandBuf)) {
+      /*
+       * Use the reply shared by vmtoolsd when fresh, otherwise send the
+       * request.
+       */
+      if (
+#if defined(__linux__)
+          VMGuestLibShmRead(handle, hostVersion, &reply, &replyLen) ||
+#endif
+          RpcChannel_SendOne(&reply, &replyLen, commandBuf)) {
          VMGuestLibDataV2 *v2reply = (VMGuestLibDataV2 *)reply;
          VMSessionId sessionId = HANDLE_SESSIONID(handle);
 
@@ -570,6 +838,20 @@ VMGuestLibUpdateInfo(VMGuestLibHandle handle) // IN
       ret = VMGUESTLIB_ERROR_OTHER;
    }
 
+   if (ret == VMGUESTLIB_ERROR_SUCCESS) {
+      /* 64-bit FNV-1a hash of the reply, for VMGuestLib_GetUpdateCookie(). */
+      uint64 hash = CONST64U(14695981039346656037);
+      size_t i;
+
+      for (i = 0; i < replyLen; i++) {
+         hash = (hash ^ (uint8)reply[i]) * CONST64U(1099511628211);
+      }
+      if (hash != HANDLE_REPLYHASH(handle)) {
+         HANDLE_REPLYHASH(handle) = hash;
+         HANDLE_COOKIE(handle)++;
+      }
+   }
+
 done:
    free(reply);
    return ret;
@@ -1808,6 +2090,123 @@ VMGuestLib_GetMemShares64(VMGuestLibHandle handle, // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VMGuestLib_GetStats --
+ *
+ *      Retrieve all the integral statistics at once.
+ *
+ * Results:
+ *      VMGuestLibError
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+VMGuestLibError
+VMGuestLib_GetStats(VMGuestLibHandle handle, // IN
+                    VMGuestLibStats *stats,  // OUT
+                    size_t statsSize)        // IN
+{
+   VMGuestLibStats all;
+   VMGuestLibError error;
+   void *data;
+
+   error = VMGuestLibCheckArgs(handle, stats, &data);
+   if (VMGUESTLIB_ERROR_SUCCESS != error) {
+      return error;
+   }
+   if (statsSize < sizeof stats->available) {
+      return VMGUESTLIB_ERROR_BUFFER_TOO_SMALL;
+   }
+
+   memset(&all, 0, sizeof all);
+
+#define VMGUESTLIB_COPY_V2(FIELD, BIT, STATID, MEMBER)                         \
+   if (v2->MEMBER.valid) {                                                     \
+      all.FIELD = v2->MEMBER.value;                                            \
+      all.available |= CONST64U(1) << (BIT);                                   \
+   }
+
+#define VMGUESTLIB_COPY_V3(FIELD, BIT, STATID, MEMBER)                         \
+   case STATID:                                                                \
+      if (stat->GuestLibV3Stat_u.MEMBER.valid) {                               \
+         all.FIELD = stat->GuestLibV3Stat_u.MEMBER.value;                      \
+         all.available |= CONST64U(1) << (BIT);                                \
+      }                                                                        \
+      break;
+
+   if (HANDLE_VERSION(handle) == 2) {
+      VMGuestLibDataV2 *v2 = data;
+
+      VMGUESTLIB_V2_STATS(VMGUESTLIB_COPY_V2)
+   } else if (HANDLE_VERSION(handle) == 3) {
+      VMGuestLibStatisticsV3 *v3stats = data;
+      GuestLibV3StatCount i;
+
+      for (i = 0; i < v3stats->numStats; i++) {
+         const GuestLibV3Stat *stat = &v3stats->stats[i];
+
+         switch (stat->d) {
+         VMGUESTLIB_V3_STATS(VMGUESTLIB_COPY_V3)
+         default:
+            break;
+         }
+      }
+   }
+
+#undef VMGUESTLIB_COPY_V2
+#undef VMGUESTLIB_COPY_V3
+
+   /* Same fallback as VMGuestLib_GetMemShares64(). */
+   if (!VMGUESTLIB_STAT_IS_AVAILABLE(&all, VMGUESTLIB_STAT_MEM_SHARES_64) &&
+       VMGUESTLIB_STAT_IS_AVAILABLE(&all, VMGUESTLIB_STAT_MEM_SHARES)) {
+      all.memShares64 = all.memShares;
+      all.available |= CONST64U(1) << VMGUESTLIB_STAT_MEM_SHARES_64;
+   }
+
+   memcpy(stats, &all, MIN(statsSize, sizeof all));
+   return VMGUESTLIB_ERROR_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VMGuestLib_GetUpdateCookie --
+ *
+ *      Retrieve a value that changes whenever VMGuestLib_UpdateInfo() brings
+ *      different statistics.
+ *
+ * Results:
+ *      VMGuestLibError
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+VMGuestLibError
+VMGuestLib_GetUpdateCookie(VMGuestLibHandle handle, // IN
+                           uint64 *cookie)          // OUT
+{
+   void *data;
+   VMGuestLibError error;
+
+   error = VMGuestLibCheckArgs(handle, cookie, &data);
+   if (VMGUESTLIB_ERROR_SUCCESS != error) {
+      return error;
+   }
+
+   *cookie = HANDLE_COOKIE(handle);
+   return VMGUESTLIB_ERROR_SUCCESS;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
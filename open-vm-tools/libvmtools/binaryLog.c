@@ -0,0 +1,1095 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file binaryLog.c
+ *
+ * Binary trace log for the VMware logging functions (Debug(), Log(), ...).
+ *
+ * Instead of formatting the message, the caller stores the format string's
+ * id and the raw arguments in a ring kept in a memory mapped file, which is
+ * decoded offline with VMTools_DecodeBinaryLog(). This keeps the cost of
+ * leaving verbose tracing on down to parsing the format and a memcpy.
+ *
+ * The file starts with a header, followed by a table holding each distinct
+ * format string once, followed by the ring of records. A record is a
+ * BinLogRecord followed by the arguments in the order the format consumes
+ * them: integers and pointers as 64-bit values, floating point values as
+ * doubles, and strings as a 16-bit length followed by the bytes. Records
+ * are 8-byte aligned so the decoder can find the oldest complete record
+ * after the ring wrapped.
+ *
+ * Formats the encoder does not understand (%n, wide strings) and formats
+ * that do not fit in the table are not recorded.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib/gstdio.h>
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#endif
+
+#include "vmtoolsInt.h"
+#include "vmware/tools/log.h"
+
+#define BINLOG_MAGIC             "VMTBLOG"
+#define BINLOG_VERSION           1
+#define BINLOG_REC_MAGIC         0x52474f4c
+#define BINLOG_FMT_TABLE_SIZE    (64 * 1024)
+#define BINLOG_FMT_NONE          ((uint32)-1)
+#define BINLOG_FMT_PAD           ((uint32)-2)
+#define BINLOG_MAX_PAYLOAD       (2 * 1024)
+#define BINLOG_MAX_STRING        256
+#define BINLOG_ALIGN(x)          (((x) + 7) & ~(size_t)7)
+
+typedef struct BinLogHeader {
+   char     magic[8];
+   uint32   version;
+   uint32   fmtTableSize;
+   uint32   fmtTableUsed;
+   uint32   ringSize;
+   uint64   ringHead;      /* Bytes written to the ring since creation. */
+} BinLogHeader;
+
+typedef struct BinLogRecord {
+   uint32   magic;
+   uint32   size;          /* Record and arguments, 8-byte aligned. */
+   uint64   timeUs;        /* Wall clock time, UTC. */
+   uint32   fmtId;         /* Offset of the format in the format table. */
+   uint32   level;
+} BinLogRecord;
+
+#define BINLOG_FMT_TABLE_OFFSET  BINLOG_ALIGN(sizeof(BinLogHeader))
+#define BINLOG_RING_OFFSET       (BINLOG_FMT_TABLE_OFFSET + BINLOG_FMT_TABLE_SIZE)
+
+typedef enum {
+   BINLOG_ARG_NONE,
+   BINLOG_ARG_INT,
+   BINLOG_ARG_UINT,
+   BINLOG_ARG_DOUBLE,
+   BINLOG_ARG_STRING,
+   BINLOG_ARG_POINTER,
+   BINLOG_ARG_BAD,
+} BinLogArgType;
+
+typedef enum {
+   BINLOG_LEN_INT,
+   BINLOG_LEN_LONG,
+   BINLOG_LEN_LLONG,
+   BINLOG_LEN_SIZE,
+   BINLOG_LEN_INTMAX,
+   BINLOG_LEN_PTRDIFF,
+} BinLogArgLen;
+
+/** One conversion in a format string. */
+typedef struct BinLogSpec {
+   size_t         len;          /* Length of the conversion, from the '%'. */
+   BinLogArgType  type;
+   BinLogArgLen   argLen;
+   gboolean       starWidth;
+   gboolean       starPrec;
+   char           conv;
+} BinLogSpec;
+
+typedef struct BinLogState {
+   GMutex         lock;
+   gchar         *path;
+   guint8        *map;
+   size_t         mapSize;
+   BinLogHeader  *header;
+   gchar         *formats;
+   guint8        *ring;
+   GHashTable    *formatIds;
+   guint          dropped;
+} BinLogState;
+
+static BinLogState gBinLog;
+static gint gBinLogMask = 0;
+
+
+/*
+ *******************************************************************************
+ * BinLogNextSpec --                                                      */ /**
+ *
+ * Finds the next conversion in a printf format string.
+ *
+ * @param[in]  fmt      Format string.
+ * @param[out] spec     Description of the conversion.
+ *
+ * @return Pointer to the conversion's '%', NULL if there are no more.
+ *
+ *******************************************************************************
+ */
+
+static const char *
+BinLogNextSpec(const char *fmt,
+               BinLogSpec *spec)
+{
+   const char *start = strchr(fmt, '%');
+   const char *p;
+
+   if (start == NULL) {
+      return NULL;
+   }
+
+   memset(spec, 0, sizeof *spec);
+   p = start + 1;
+
+   while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+      p++;
+   }
+   if (*p == '*') {
+      spec->starWidth = TRUE;
+      p++;
+   } else {
+      while (g_ascii_isdigit(*p)) {
+         p++;
+      }
+   }
+   if (*p == '.') {
+      p++;
+      if (*p == '*') {
+         spec->starPrec = TRUE;
+         p++;
+      } else {
+         while (g_ascii_isdigit(*p)) {
+            p++;
+         }
+      }
+   }
+
+   for (;; p++) {
+      if (*p == 'h') {
+         continue;
+      } else if (*p == 'l') {
+         spec->argLen = spec->argLen == BINLOG_LEN_LONG ? BINLOG_LEN_LLONG
+                                                        : BINLOG_LEN_LONG;
+      } else if (*p == 'q' || *p == 'L') {
+         spec->argLen = BINLOG_LEN_LLONG;
+      } else if (*p == 'z') {
+         spec->argLen = BINLOG_LEN_SIZE;
+      } else if (*p == 'j') {
+         spec->argLen = BINLOG_LEN_INTMAX;
+      } else if (*p == 't') {
+         spec->argLen = BINLOG_LEN_PTRDIFF;
+      } else {
+         break;
+      }
+   }
+
+   spec->conv = *p;
+   switch (*p) {
+   case 'd':
+   case 'i':
+      spec->type = BINLOG_ARG_INT;
+      break;
+   case 'c':
+      spec->type = spec->argLen == BINLOG_LEN_INT ? BINLOG_ARG_INT
+                                                  : BINLOG_ARG_BAD;
+      break;
+   case 'u':
+   case 'o':
+   case 'x':
+   case 'X':
+      spec->type = BINLOG_ARG_UINT;
+      break;
+   case 'e':
+   case 'E':
+   case 'f':
+   case 'F':
+   case 'g':
+   case 'G':
+   case 'a':
+   case 'A':
+      spec->type = BINLOG_ARG_DOUBLE;
+      break;
+   case 's':
+      spec->type = spec->argLen == BINLOG_LEN_INT ? BINLOG_ARG_STRING
+                                                  : BINLOG_ARG_BAD;
+      break;
+   case 'p':
+      spec->type = BINLOG_ARG_POINTER;
+      break;
+   case '%':
+   case 'm':
+      spec->type = BINLOG_ARG_NONE;
+      break;
+   default:
+      spec->type = BINLOG_ARG_BAD;
+      break;
+   }
+
+   if (*p != '\0') {
+      p++;
+   }
+   spec->len = p - start;
+   return start;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogPut --                                                           */ /**
+ *
+ * Appends bytes to an encoding buffer.
+ *
+ * @param[in]     buf      Buffer.
+ * @param[in,out] used     Bytes used in the buffer.
+ * @param[in]     data     Data to append.
+ * @param[in]     len      Length of data.
+ *
+ * @return FALSE if the buffer is full.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+BinLogPut(guint8 *buf,
+          size_t *used,
+          const void *data,
+          size_t len)
+{
+   if (*used + len > BINLOG_MAX_PAYLOAD) {
+      return FALSE;
+   }
+   memcpy(buf + *used, data, len);
+   *used += len;
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogEncode --                                                        */ /**
+ *
+ * Copies the arguments consumed by a format string into a buffer.
+ *
+ * @param[in]  fmt      Format string.
+ * @param[in]  args     Arguments.
+ * @param[out] buf      Buffer of BINLOG_MAX_PAYLOAD bytes.
+ * @param[out] used     Bytes used in the buffer.
+ *
+ * @return FALSE if the format can't be recorded.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+BinLogEncode(const char *fmt,
+             va_list args,
+             guint8 *buf,
+             size_t *used)
+{
+   BinLogSpec spec;
+   const char *s;
+
+   *used = 0;
+   while ((s = BinLogNextSpec(fmt, &spec)) != NULL) {
+      gint64 ival;
+      guint64 uval;
+      double dval;
+
+      fmt = s + spec.len;
+
+      if (spec.type == BINLOG_ARG_BAD) {
+         return FALSE;
+      }
+      if (spec.starWidth) {
+         ival = va_arg(args, int);
+         if (!BinLogPut(buf, used, &ival, sizeof ival)) {
+            return FALSE;
+         }
+      }
+      if (spec.starPrec) {
+         ival = va_arg(args, int);
+         if (!BinLogPut(buf, used, &ival, sizeof ival)) {
+            return FALSE;
+         }
+      }
+
+      switch (spec.type) {
+      case BINLOG_ARG_INT:
+         switch (spec.argLen) {
+         case BINLOG_LEN_LONG:    ival = va_arg(args, long);      break;
+         case BINLOG_LEN_LLONG:   ival = va_arg(args, long long); break;
+         case BINLOG_LEN_SIZE:    ival = va_arg(args, gssize);    break;
+         case BINLOG_LEN_INTMAX:  ival = va_arg(args, intmax_t);  break;
+         case BINLOG_LEN_PTRDIFF: ival = va_arg(args, ptrdiff_t); break;
+         default:                 ival = va_arg(args, int);       break;
+         }
+         if (!BinLogPut(buf, used, &ival, sizeof ival)) {
+            return FALSE;
+         }
+         break;
+
+      case BINLOG_ARG_UINT:
+         switch (spec.argLen) {
+         case BINLOG_LEN_LONG:    uval = va_arg(args, unsigned long);      break;
+         case BINLOG_LEN_LLONG:   uval = va_arg(args, unsigned long long); break;
+         case BINLOG_LEN_SIZE:    uval = va_arg(args, size_t);             break;
+         case BINLOG_LEN_INTMAX:  uval = va_arg(args, uintmax_t);          break;
+         case BINLOG_LEN_PTRDIFF: uval = va_arg(args, ptrdiff_t);          break;
+         default:                 uval = va_arg(args, unsigned int);       break;
+         }
+         if (!BinLogPut(buf, used, &uval, sizeof uval)) {
+            return FALSE;
+         }
+         break;
+
+      case BINLOG_ARG_DOUBLE:
+         if (spec.argLen == BINLOG_LEN_LLONG) {
+            dval = (double)va_arg(args, long double);
+         } else {
+            dval = va_arg(args, double);
+         }
+         if (!BinLogPut(buf, used, &dval, sizeof dval)) {
+            return FALSE;
+         }
+         break;
+
+      case BINLOG_ARG_STRING:
+         {
+            const char *str = va_arg(args, const char *);
+            guint16 len;
+
+            if (str == NULL) {
+               str = "(null)";
+            }
+            len = (guint16)strnlen(str, BINLOG_MAX_STRING);
+            if (!BinLogPut(buf, used, &len, sizeof len) ||
+                !BinLogPut(buf, used, str, len)) {
+               return FALSE;
+            }
+         }
+         break;
+
+      case BINLOG_ARG_POINTER:
+         uval = (uintptr_t)va_arg(args, void *);
+         if (!BinLogPut(buf, used, &uval, sizeof uval)) {
+            return FALSE;
+         }
+         break;
+
+      default:
+         break;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogGet --                                                           */ /**
+ *
+ * Reads bytes from an encoded record.
+ *
+ * @param[in,out] p        Read position.
+ * @param[in]     end      End of the record.
+ * @param[out]    data     Where to copy the data.
+ * @param[in]     len      Length of data.
+ *
+ * @return FALSE if the record is too short.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+BinLogGet(const guint8 **p,
+          const guint8 *end,
+          void *data,
+          size_t len)
+{
+   if ((size_t)(end - *p) < len) {
+      return FALSE;
+   }
+   memcpy(data, *p, len);
+   *p += len;
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogAppendSpec --                                                    */ /**
+ *
+ * Formats one conversion of a decoded record. The conversion is rebuilt
+ * without its length modifiers, which are replaced by the ones matching
+ * the stored argument.
+ *
+ * @param[in]  str      Where to append the text.
+ * @param[in]  conv     Conversion, from the '%'.
+ * @param[in]  spec     Description of the conversion.
+ * @param[in]  p        Read position in the record.
+ * @param[in]  end      End of the record.
+ *
+ * @return FALSE if the record is invalid.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+BinLogAppendSpec(GString *str,
+                 const char *conv,
+                 const BinLogSpec *spec,
+                 const guint8 **p,
+                 const guint8 *end)
+{
+   char sub[64];
+   size_t len = 0;
+   size_t i;
+   gint64 width = 0;
+   gint64 prec = 0;
+   gint64 ival;
+   guint64 uval;
+   double dval;
+   guint16 slen;
+   gchar *sval;
+
+   if (spec->len + 4 > sizeof sub) {
+      return FALSE;
+   }
+   for (i = 0; i < spec->len - 1; i++) {
+      if (strchr("hlqLzjt", conv[i]) == NULL) {
+         sub[len++] = conv[i];
+      }
+   }
+   if (spec->type == BINLOG_ARG_INT || spec->type == BINLOG_ARG_UINT) {
+      if (spec->conv != 'c') {
+         sub[len++] = 'l';
+         sub[len++] = 'l';
+      }
+   }
+   sub[len++] = spec->conv;
+   sub[len] = '\0';
+
+   if ((spec->starWidth && !BinLogGet(p, end, &width, sizeof width)) ||
+       (spec->starPrec && !BinLogGet(p, end, &prec, sizeof prec))) {
+      return FALSE;
+   }
+
+#define BINLOG_APPEND(val)                                                    \
+   do {                                                                       \
+      if (spec->starWidth && spec->starPrec) {                                \
+         g_string_append_printf(str, sub, (int)width, (int)prec, val);        \
+      } else if (spec->starWidth) {                                           \
+         g_string_append_printf(str, sub, (int)width, val);                   \
+      } else if (spec->starPrec) {                                            \
+         g_string_append_printf(str, sub, (int)prec, val);                    \
+      } else {                                                                \
+         g_string_append_printf(str, sub, val);                               \
+      }                                                                       \
+   } while (0)
+
+   switch (spec->type) {
+   case BINLOG_ARG_INT:
+      if (!BinLogGet(p, end, &ival, sizeof ival)) {
+         return FALSE;
+      }
+      if (spec->conv == 'c') {
+         BINLOG_APPEND((int)ival);
+      } else {
+         BINLOG_APPEND((long long)ival);
+      }
+      break;
+
+   case BINLOG_ARG_UINT:
+      if (!BinLogGet(p, end, &uval, sizeof uval)) {
+         return FALSE;
+      }
+      BINLOG_APPEND((unsigned long long)uval);
+      break;
+
+   case BINLOG_ARG_DOUBLE:
+      if (!BinLogGet(p, end, &dval, sizeof dval)) {
+         return FALSE;
+      }
+      BINLOG_APPEND(dval);
+      break;
+
+   case BINLOG_ARG_STRING:
+      if (!BinLogGet(p, end, &slen, sizeof slen) ||
+          (size_t)(end - *p) < slen) {
+         return FALSE;
+      }
+      sval = g_strndup((const gchar *)*p, slen);
+      *p += slen;
+      BINLOG_APPEND(sval);
+      g_free(sval);
+      break;
+
+   case BINLOG_ARG_POINTER:
+      if (!BinLogGet(p, end, &uval, sizeof uval)) {
+         return FALSE;
+      }
+      BINLOG_APPEND((void *)(uintptr_t)uval);
+      break;
+
+   default:
+      return FALSE;
+   }
+
+#undef BINLOG_APPEND
+
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogFormat --                                                        */ /**
+ *
+ * Rebuilds the message of a decoded record.
+ *
+ * @param[in]  fmt      Format string of the record.
+ * @param[in]  p        Start of the record's arguments.
+ * @param[in]  end      End of the record.
+ * @param[out] str      Where to append the message.
+ *
+ * @return FALSE if the record is invalid.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+BinLogFormat(const char *fmt,
+             const guint8 *p,
+             const guint8 *end,
+             GString *str)
+{
+   BinLogSpec spec;
+   const char *s;
+
+   while ((s = BinLogNextSpec(fmt, &spec)) != NULL) {
+      g_string_append_len(str, fmt, s - fmt);
+      fmt = s + spec.len;
+
+      if (spec.type == BINLOG_ARG_NONE) {
+         if (spec.conv == '%') {
+            g_string_append_c(str, '%');
+         } else {
+            g_string_append_len(str, s, spec.len);
+         }
+      } else if (!BinLogAppendSpec(str, s, &spec, &p, end)) {
+         return FALSE;
+      }
+   }
+   g_string_append(str, fmt);
+
+   return TRUE;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogLevelString --                                                   */ /**
+ *
+ * @param[in]  level    Log level.
+ *
+ * @return Name of the level, as printed by the text log.
+ *
+ *******************************************************************************
+ */
+
+static const char *
+BinLogLevelString(uint32 level)
+{
+   if (level & G_LOG_LEVEL_ERROR) {
+      return "error";
+   } else if (level & G_LOG_LEVEL_CRITICAL) {
+      return "critical";
+   } else if (level & G_LOG_LEVEL_WARNING) {
+      return "warning";
+   } else if (level & G_LOG_LEVEL_MESSAGE) {
+      return "message";
+   } else if (level & G_LOG_LEVEL_INFO) {
+      return "info";
+   }
+   return "debug";
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogDecodeRange --                                                   */ /**
+ *
+ * Decodes the records of part of the ring.
+ *
+ * @param[in]  formats  Format table.
+ * @param[in]  fmtUsed  Bytes used in the format table.
+ * @param[in]  ring     The ring.
+ * @param[in]  start    Offset of the first record.
+ * @param[in]  end      Offset where the records end.
+ * @param[in]  resync   Whether the first bytes may be the tail of an
+ *                      overwritten record.
+ * @param[in]  out      Where to print the messages.
+ *
+ * @return Number of records decoded.
+ *
+ *******************************************************************************
+ */
+
+static guint
+BinLogDecodeRange(const gchar *formats,
+                  uint32 fmtUsed,
+                  const guint8 *ring,
+                  size_t start,
+                  size_t end,
+                  gboolean resync,
+                  FILE *out)
+{
+   GString *line = g_string_sized_new(256);
+   size_t off = start;
+   guint count = 0;
+
+   while (off + sizeof(BinLogRecord) <= end) {
+      BinLogRecord rec;
+      const gchar *fmt;
+
+      memcpy(&rec, ring + off, sizeof rec);
+      if (rec.magic != BINLOG_REC_MAGIC ||
+          rec.size < sizeof rec ||
+          rec.size > end - off ||
+          rec.size != BINLOG_ALIGN(rec.size) ||
+          (rec.fmtId >= fmtUsed && rec.fmtId != BINLOG_FMT_PAD)) {
+         if (!resync) {
+            break;
+         }
+         off += 8;
+         continue;
+      }
+
+      if (rec.fmtId == BINLOG_FMT_PAD) {
+         off += rec.size;
+         continue;
+      }
+
+      fmt = formats + rec.fmtId;
+      if (memchr(fmt, '\0', fmtUsed - rec.fmtId) == NULL) {
+         break;
+      }
+
+      g_string_truncate(line, 0);
+      if (BinLogFormat(fmt, ring + off + sizeof rec, ring + off + rec.size,
+                       line)) {
+         GDateTime *time;
+         gchar *tstamp = NULL;
+
+         time = g_date_time_new_from_unix_utc(rec.timeUs / G_USEC_PER_SEC);
+         if (time != NULL) {
+            tstamp = g_date_time_format(time, "%FT%T");
+            g_date_time_unref(time);
+         }
+         if (line->len > 0 && line->str[line->len - 1] == '\n') {
+            g_string_truncate(line, line->len - 1);
+         }
+         fprintf(out, "[%s.%03dZ] [%8s] %s\n",
+                 tstamp != NULL ? tstamp : "no time",
+                 (int)(rec.timeUs % G_USEC_PER_SEC / 1000),
+                 BinLogLevelString(rec.level), line->str);
+         g_free(tstamp);
+         count++;
+      }
+
+      resync = FALSE;
+      off += rec.size;
+   }
+
+   g_string_free(line, TRUE);
+   return count;
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_DecodeBinaryLog --                                             */ /**
+ *
+ * Prints the messages stored in a binary log file, oldest first, in the
+ * format used by the text logs.
+ *
+ * @param[in]  path     Path of the binary log.
+ * @param[in]  out      Where to print the messages.
+ *
+ * @return TRUE on success, FALSE if the file is not a binary log.
+ *
+ *******************************************************************************
+ */
+
+gboolean
+VMTools_DecodeBinaryLog(const gchar *path,
+                        FILE *out)
+{
+   gchar *data = NULL;
+   gsize len = 0;
+   GError *err = NULL;
+   BinLogHeader header;
+   const guint8 *ring;
+   size_t pos;
+
+   if (!g_file_get_contents(path, &data, &len, &err)) {
+      g_warning("Cannot read %s: %s\n", path, err->message);
+      g_clear_error(&err);
+      return FALSE;
+   }
+
+   if (len < BINLOG_RING_OFFSET) {
+      goto invalid;
+   }
+   memcpy(&header, data, sizeof header);
+   if (memcmp(header.magic, BINLOG_MAGIC, sizeof header.magic) != 0 ||
+       header.version != BINLOG_VERSION ||
+       header.fmtTableSize != BINLOG_FMT_TABLE_SIZE ||
+       header.fmtTableUsed > header.fmtTableSize ||
+       header.ringSize != BINLOG_ALIGN(header.ringSize) ||
+       len < BINLOG_RING_OFFSET + header.ringSize) {
+      goto invalid;
+   }
+
+   ring = (const guint8 *)data + BINLOG_RING_OFFSET;
+   if (header.ringHead <= header.ringSize) {
+      BinLogDecodeRange(data + BINLOG_FMT_TABLE_OFFSET, header.fmtTableUsed,
+                        ring, 0, header.ringHead, FALSE, out);
+   } else {
+      pos = header.ringHead % header.ringSize;
+      BinLogDecodeRange(data + BINLOG_FMT_TABLE_OFFSET, header.fmtTableUsed,
+                        ring, pos, header.ringSize, TRUE, out);
+      BinLogDecodeRange(data + BINLOG_FMT_TABLE_OFFSET, header.fmtTableUsed,
+                        ring, 0, pos, FALSE, out);
+   }
+
+   g_free(data);
+   return TRUE;
+
+invalid:
+   g_warning("%s is not a binary log file.\n", path);
+   g_free(data);
+   return FALSE;
+}
+
+
+#if !defined(_WIN32)
+
+/*
+ *******************************************************************************
+ * BinLogFormatId --                                                      */ /**
+ *
+ * Looks up a format string in the format table, adding it if needed.
+ * Must be called with the binary log lock held.
+ *
+ * @param[in]  fmt      Format string.
+ *
+ * @return Id of the format, BINLOG_FMT_NONE if the table is full.
+ *
+ *******************************************************************************
+ */
+
+static uint32
+BinLogFormatId(const char *fmt)
+{
+   gpointer val;
+   size_t len;
+   uint32 id;
+
+   if (g_hash_table_lookup_extended(gBinLog.formatIds, fmt, NULL, &val)) {
+      return GPOINTER_TO_UINT(val);
+   }
+
+   len = strlen(fmt) + 1;
+   if (gBinLog.header->fmtTableUsed + len > gBinLog.header->fmtTableSize) {
+      return BINLOG_FMT_NONE;
+   }
+
+   id = gBinLog.header->fmtTableUsed;
+   memcpy(gBinLog.formats + id, fmt, len);
+   gBinLog.header->fmtTableUsed += len;
+   g_hash_table_insert(gBinLog.formatIds, gBinLog.formats + id,
+                       GUINT_TO_POINTER(id));
+   return id;
+}
+
+
+/*
+ *******************************************************************************
+ * BinLogAppend --                                                        */ /**
+ *
+ * Appends a record to the ring, wrapping around if it does not fit before
+ * the end. Must be called with the binary log lock held.
+ *
+ * @param[in]  level    Log level.
+ * @param[in]  fmtId    Id of the format string.
+ * @param[in]  payload  Encoded arguments.
+ * @param[in]  len      Length of the encoded arguments.
+ *
+ *******************************************************************************
+ */
+
+static void
+BinLogAppend(GLogLevelFlags level,
+             uint32 fmtId,
+             const guint8 *payload,
+             size_t len)
+{
+   BinLogHeader *header = gBinLog.header;
+   uint64 head = header->ringHead;
+   size_t pos = head % header->ringSize;
+   BinLogRecord rec;
+
+   rec.magic = BINLOG_REC_MAGIC;
+   rec.size = BINLOG_ALIGN(sizeof rec + len);
+
+   if (pos + rec.size > header->ringSize) {
+      size_t left = header->ringSize - pos;
+
+      if (left >= sizeof rec) {
+         BinLogRecord pad;
+
+         memset(&pad, 0, sizeof pad);
+         pad.magic = BINLOG_REC_MAGIC;
+         pad.size = left;
+         pad.fmtId = BINLOG_FMT_PAD;
+         memcpy(gBinLog.ring + pos, &pad, sizeof pad);
+      }
+      head += left;
+      pos = 0;
+   }
+
+   rec.timeUs = g_get_real_time();
+   rec.fmtId = fmtId;
+   rec.level = level;
+   memcpy(gBinLog.ring + pos, &rec, sizeof rec);
+   memcpy(gBinLog.ring + pos + sizeof rec, payload, len);
+
+   header->ringHead = head + rec.size;
+}
+
+
+/*
+ *******************************************************************************
+ * VMToolsBinLogWrite --                                                  */ /**
+ *
+ * Records a message in the binary log.
+ *
+ * @param[in]  level    Log level.
+ * @param[in]  fmt      Message format.
+ * @param[in]  args     Message arguments.
+ *
+ *******************************************************************************
+ */
+
+void
+VMToolsBinLogWrite(GLogLevelFlags level,
+                   const gchar *fmt,
+                   va_list args)
+{
+   guint8 payload[BINLOG_MAX_PAYLOAD];
+   size_t len;
+   uint32 fmtId;
+   va_list copy;
+   gboolean ok;
+
+   va_copy(copy, args);
+   ok = BinLogEncode(fmt, copy, payload, &len);
+   va_end(copy);
+
+   g_mutex_lock(&gBinLog.lock);
+   if (gBinLog.header == NULL) {
+      goto exit;
+   }
+   if (!ok || (fmtId = BinLogFormatId(fmt)) == BINLOG_FMT_NONE) {
+      gBinLog.dropped++;
+      goto exit;
+   }
+   if (BINLOG_ALIGN(sizeof(BinLogRecord) + len) > gBinLog.header->ringSize) {
+      gBinLog.dropped++;
+      goto exit;
+   }
+   BinLogAppend(level, fmtId, payload, len);
+
+exit:
+   g_mutex_unlock(&gBinLog.lock);
+}
+
+
+/*
+ *******************************************************************************
+ * VMToolsBinLogClose --                                                  */ /**
+ *
+ * Stops binary logging and unmaps the log file.
+ *
+ *******************************************************************************
+ */
+
+void
+VMToolsBinLogClose(void)
+{
+   guint dropped;
+
+   g_atomic_int_set(&gBinLogMask, 0);
+
+   g_mutex_lock(&gBinLog.lock);
+   if (gBinLog.map == NULL) {
+      g_mutex_unlock(&gBinLog.lock);
+      return;
+   }
+
+   g_hash_table_destroy(gBinLog.formatIds);
+   munmap(gBinLog.map, gBinLog.mapSize);
+   g_free(gBinLog.path);
+   dropped = gBinLog.dropped;
+   gBinLog.path = NULL;
+   gBinLog.map = NULL;
+   gBinLog.mapSize = 0;
+   gBinLog.header = NULL;
+   gBinLog.formats = NULL;
+   gBinLog.ring = NULL;
+   gBinLog.formatIds = NULL;
+   gBinLog.dropped = 0;
+   g_mutex_unlock(&gBinLog.lock);
+
+   if (dropped > 0) {
+      g_message("Binary log: %u messages could not be recorded.", dropped);
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * VMToolsBinLogOpen --                                                   */ /**
+ *
+ * Starts binary logging to the given file. The file is recreated, unless it
+ * is already the current binary log with the same size, in which case only
+ * the level mask is updated so reloading the configuration keeps the trace.
+ *
+ * @param[in]  path     Path of the binary log.
+ * @param[in]  sizeKB   Size of the ring, in kilobytes.
+ * @param[in]  mask     Levels to record.
+ *
+ *******************************************************************************
+ */
+
+void
+VMToolsBinLogOpen(const gchar *path,
+                  guint sizeKB,
+                  GLogLevelFlags mask)
+{
+   size_t ringSize = (size_t)sizeKB * 1024;
+   size_t mapSize = BINLOG_RING_OFFSET + ringSize;
+   guint8 *map;
+   int fd;
+
+   g_mutex_lock(&gBinLog.lock);
+   if (gBinLog.map != NULL &&
+       strcmp(gBinLog.path, path) == 0 &&
+       gBinLog.mapSize == mapSize) {
+      g_mutex_unlock(&gBinLog.lock);
+      g_atomic_int_set(&gBinLogMask, mask);
+      return;
+   }
+   g_mutex_unlock(&gBinLog.lock);
+
+   VMToolsBinLogClose();
+
+   fd = g_open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+   if (fd < 0) {
+      g_warning("Cannot open binary log %s: %s\n", path, g_strerror(errno));
+      return;
+   }
+   if (ftruncate(fd, mapSize) != 0) {
+      g_warning("Cannot size binary log %s: %s\n", path, g_strerror(errno));
+      close(fd);
+      return;
+   }
+   map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      g_warning("Cannot map binary log %s: %s\n", path, g_strerror(errno));
+      return;
+   }
+
+   g_mutex_lock(&gBinLog.lock);
+   gBinLog.path = g_strdup(path);
+   gBinLog.map = map;
+   gBinLog.mapSize = mapSize;
+   gBinLog.header = (BinLogHeader *)map;
+   gBinLog.formats = (gchar *)map + BINLOG_FMT_TABLE_OFFSET;
+   gBinLog.ring = map + BINLOG_RING_OFFSET;
+   gBinLog.formatIds = g_hash_table_new(g_str_hash, g_str_equal);
+   gBinLog.dropped = 0;
+
+   memcpy(gBinLog.header->magic, BINLOG_MAGIC, sizeof gBinLog.header->magic);
+   gBinLog.header->version = BINLOG_VERSION;
+   gBinLog.header->fmtTableSize = BINLOG_FMT_TABLE_SIZE;
+   gBinLog.header->fmtTableUsed = 0;
+   gBinLog.header->ringSize = ringSize;
+   gBinLog.header->ringHead = 0;
+   g_mutex_unlock(&gBinLog.lock);
+
+   g_atomic_int_set(&gBinLogMask, mask);
+   g_message("Binary logging to %s with a %u KB ring.", path, sizeKB);
+}
+
+#else
+
+void
+VMToolsBinLogWrite(GLogLevelFlags level,
+                   const gchar *fmt,
+                   va_list args)
+{
+}
+
+
+void
+VMToolsBinLogClose(void)
+{
+}
+
+
+void
+VMToolsBinLogOpen(const gchar *path,
+                  guint sizeKB,
+                  GLogLevelFlags mask)
+{
+   g_warning("Binary logging is not supported on this platform.\n");
+}
+
+#endif
+
+
+/*
+ *******************************************************************************
+ * VMToolsBinLogWants --                                                  */ /**
+ *
+ * @param[in]  level    Log level.
+ *
+ * @return Whether messages at the given level are recorded in the binary log.
+ *
+ *******************************************************************************
+ */
+
+gboolean
+VMToolsBinLogWants(GLogLevelFlags level)
+{
+   return (g_atomic_int_get(&gBinLogMask) & level) != 0;
+}
@@ -0,0 +1,629 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file metrics.c
+ *
+ * Process-wide metrics registry (see metrics.h).
+ *
+ * Each counter and histogram has METRICS_SHARDS copies of its cells, each
+ * copy on its own cache lines. A thread is assigned a shard the first time
+ * it updates a metric, and from then on only does atomic adds to that
+ * shard's cells, so threads rarely contend. Gauges have a single cell, since
+ * setting a value can't be sharded. The registry lock is only taken to
+ * register, remove and snapshot metrics.
+ */
+
+#include <string.h>
+
+#include "vmtoolsInt.h"
+#include "vm_atomic.h"
+#include "vmware/tools/metrics.h"
+
+#define METRICS_SHARDS           16
+#define METRICS_CACHE_LINE       64
+#define METRICS_CELLS_PER_LINE   (METRICS_CACHE_LINE / sizeof (Atomic_uint64))
+#define METRICS_MAX_BOUNDS       64
+
+typedef enum MetricType {
+   METRIC_COUNTER,
+   METRIC_GAUGE,
+   METRIC_HISTOGRAM,
+} MetricType;
+
+static const gchar *gMetricTypeNames[] = {
+   [METRIC_COUNTER]   = "counter",
+   [METRIC_GAUGE]     = "gauge",
+   [METRIC_HISTOGRAM] = "histogram",
+};
+
+/*
+ * Cells of a histogram shard: one per bound, one for +Inf, and the sum.
+ * The count is the sum of the buckets.
+ */
+struct VMToolsMetric {
+   gchar                  *name;
+   gchar                  *family;
+   gchar                  *labels;
+   gchar                  *help;
+   MetricType              type;
+   guint64                *bounds;
+   guint                   numBounds;
+   guint                   stride;
+   gpointer                mem;
+   Atomic_uint64          *cells;
+   VMToolsMetricGaugeFunc  func;
+   gpointer                funcData;
+};
+
+static GMutex gMetricsLock;
+static GHashTable *gMetrics = NULL;
+
+static GPrivate gMetricsShard = G_PRIVATE_INIT(NULL);
+static Atomic_uint32 gMetricsNextShard;
+
+
+/*
+ *******************************************************************************
+ * MetricsShard --                                                        */ /**
+ *
+ * Returns the shard of the calling thread, assigning one round-robin on the
+ * first call.
+ *
+ * @return The shard index.
+ *
+ *******************************************************************************
+ */
+
+static inline guint
+MetricsShard(void)
+{
+   guint shard = GPOINTER_TO_UINT(g_private_get(&gMetricsShard));
+
+   if (shard == 0) {
+      shard = Atomic_ReadInc32(&gMetricsNextShard) % METRICS_SHARDS + 1;
+      g_private_set(&gMetricsShard, GUINT_TO_POINTER(shard));
+   }
+   return shard - 1;
+}
+
+
+/*
+ *******************************************************************************
+ * MetricsValidName --                                                    */ /**
+ *
+ * Checks a metric name: a Prometheus metric name, optionally followed by a
+ * set of labels in braces.
+ *
+ * @param[in] name   The name.
+ *
+ * @return The length of the name before the labels, or 0 if invalid.
+ *
+ *******************************************************************************
+ */
+
+static gsize
+MetricsValidName(const gchar *name)
+{
+   gsize i;
+
+   for (i = 0; name[i] != '\0' && name[i] != '{'; i++) {
+      if (!(g_ascii_isalpha(name[i]) || name[i] == '_' || name[i] == ':' ||
+            (i > 0 && g_ascii_isdigit(name[i])))) {
+         return 0;
+      }
+   }
+
+   if (name[i] == '{' && (name[strlen(name) - 1] != '}' || name[i + 1] == '}')) {
+      return 0;
+   }
+   return i;
+}
+
+
+/*
+ *******************************************************************************
+ * MetricsFree --                                                         */ /**
+ *
+ * Frees a metric.
+ *
+ * @param[in] data   The VMToolsMetric.
+ *
+ *******************************************************************************
+ */
+
+static void
+MetricsFree(gpointer data)
+{
+   VMToolsMetric *metric = data;
+
+   g_free(metric->name);
+   g_free(metric->family);
+   g_free(metric->labels);
+   g_free(metric->help);
+   g_free(metric->bounds);
+   g_free(metric->mem);
+   g_free(metric);
+}
+
+
+/*
+ *******************************************************************************
+ * MetricsRegister --                                                     */ /**
+ *
+ * Registers a metric, or returns the existing metric of the same name.
+ *
+ * @param[in] name       Name, with optional labels.
+ * @param[in] help       Description of the metric family.
+ * @param[in] type       Type of the metric.
+ * @param[in] bounds     Upper bounds of a histogram's buckets, ascending.
+ * @param[in] numBounds  Number of bounds.
+ *
+ * @return The metric, or NULL if the name is invalid or taken by another type.
+ *
+ *******************************************************************************
+ */
+
+static VMToolsMetric *
+MetricsRegister(const gchar *name,
+                const gchar *help,
+                MetricType type,
+                const guint64 *bounds,
+                guint numBounds)
+{
+   VMToolsMetric *metric;
+   gsize familyLen;
+   guint shards;
+   guint i;
+
+   g_return_val_if_fail(name != NULL, NULL);
+   g_return_val_if_fail(numBounds <= METRICS_MAX_BOUNDS, NULL);
+
+   familyLen = MetricsValidName(name);
+   if (familyLen == 0) {
+      g_warning("Invalid metric name '%s'.\n", name);
+      return NULL;
+   }
+   for (i = 1; i < numBounds; i++) {
+      if (bounds[i] <= bounds[i - 1]) {
+         g_warning("Buckets of metric '%s' are not ascending.\n", name);
+         return NULL;
+      }
+   }
+
+   g_mutex_lock(&gMetricsLock);
+
+   if (gMetrics == NULL) {
+      gMetrics = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                       MetricsFree);
+   }
+
+   metric = g_hash_table_lookup(gMetrics, name);
+   if (metric != NULL) {
+      if (metric->type != type || metric->func != NULL) {
+         g_warning("Metric '%s' is already registered as a %s.\n", name,
+                   gMetricTypeNames[metric->type]);
+         metric = NULL;
+      }
+      goto exit;
+   }
+
+   metric = g_malloc0(sizeof *metric);
+   metric->name = g_strdup(name);
+   metric->family = g_strndup(name, familyLen);
+   if (name[familyLen] == '{') {
+      metric->labels = g_strndup(name + familyLen + 1,
+                                 strlen(name) - familyLen - 2);
+   }
+   metric->help = g_strdup(help != NULL ? help : "");
+   metric->type = type;
+
+   switch (type) {
+   case METRIC_HISTOGRAM:
+      metric->bounds = g_memdup(bounds, numBounds * sizeof *bounds);
+      metric->numBounds = numBounds;
+      metric->stride = numBounds + 2;
+      shards = METRICS_SHARDS;
+      break;
+   case METRIC_COUNTER:
+      metric->stride = 1;
+      shards = METRICS_SHARDS;
+      break;
+   default:
+      metric->stride = 1;
+      shards = 1;
+      break;
+   }
+
+   /* Round each shard up to whole cache lines, and align the first one. */
+   metric->stride = ROUNDUP(metric->stride, METRICS_CELLS_PER_LINE);
+   metric->mem = g_malloc0(shards * metric->stride * sizeof (Atomic_uint64) +
+                           METRICS_CACHE_LINE);
+   metric->cells = (Atomic_uint64 *) ROUNDUP((uintptr_t) metric->mem,
+                                             METRICS_CACHE_LINE);
+
+   g_hash_table_insert(gMetrics, metric->name, metric);
+
+exit:
+   g_mutex_unlock(&gMetricsLock);
+   return metric;
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricCounter --                                               */ /**
+ *
+ * Registers a counter: a value that only goes up.
+ *
+ * @param[in] name   Name, with optional labels; should end with "_total".
+ * @param[in] help   Description of the metric family.
+ *
+ * @return The metric, or NULL on error.
+ *
+ *******************************************************************************
+ */
+
+VMToolsMetric *
+VMTools_MetricCounter(const gchar *name,
+                      const gchar *help)
+{
+   return MetricsRegister(name, help, METRIC_COUNTER, NULL, 0);
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricGauge --                                                 */ /**
+ *
+ * Registers a gauge: a value that is set, or goes up and down.
+ *
+ * @param[in] name   Name, with optional labels.
+ * @param[in] help   Description of the metric family.
+ *
+ * @return The metric, or NULL on error.
+ *
+ *******************************************************************************
+ */
+
+VMToolsMetric *
+VMTools_MetricGauge(const gchar *name,
+                    const gchar *help)
+{
+   return MetricsRegister(name, help, METRIC_GAUGE, NULL, 0);
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricGaugeFunc --                                             */ /**
+ *
+ * Registers a gauge whose value is computed by a callback whenever a
+ * snapshot is taken; the callback may run on any thread, with the registry
+ * lock held, so it must not use the registry. Such a gauge must be removed
+ * with VMTools_MetricRemove() before the callback or its data go away.
+ *
+ * @param[in] name   Name, with optional labels.
+ * @param[in] help   Description of the metric family.
+ * @param[in] func   The callback.
+ * @param[in] data   Data for the callback.
+ *
+ * @return The metric, or NULL on error.
+ *
+ *******************************************************************************
+ */
+
+VMToolsMetric *
+VMTools_MetricGaugeFunc(const gchar *name,
+                        const gchar *help,
+                        VMToolsMetricGaugeFunc func,
+                        gpointer data)
+{
+   VMToolsMetric *metric;
+
+   g_return_val_if_fail(func != NULL, NULL);
+
+   metric = MetricsRegister(name, help, METRIC_GAUGE, NULL, 0);
+   if (metric != NULL) {
+      g_mutex_lock(&gMetricsLock);
+      metric->func = func;
+      metric->funcData = data;
+      g_mutex_unlock(&gMetricsLock);
+   }
+   return metric;
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricHistogram --                                             */ /**
+ *
+ * Registers a histogram: counts of observed values in buckets, plus their
+ * sum. A value falls in the first bucket whose bound is not less than it, or
+ * in the implicit +Inf bucket.
+ *
+ * @param[in] name       Name, with optional labels.
+ * @param[in] help       Description of the metric family.
+ * @param[in] bounds     Upper bounds of the buckets, ascending.
+ * @param[in] numBounds  Number of bounds, at most 64.
+ *
+ * @return The metric, or NULL on error.
+ *
+ *******************************************************************************
+ */
+
+VMToolsMetric *
+VMTools_MetricHistogram(const gchar *name,
+                        const gchar *help,
+                        const guint64 *bounds,
+                        guint numBounds)
+{
+   return MetricsRegister(name, help, METRIC_HISTOGRAM, bounds, numBounds);
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricRemove --                                                */ /**
+ *
+ * Removes a metric from the registry. Its handle must not be used anymore.
+ *
+ * @param[in] name   Name of the metric, with its labels.
+ *
+ *******************************************************************************
+ */
+
+void
+VMTools_MetricRemove(const gchar *name)
+{
+   g_mutex_lock(&gMetricsLock);
+   if (gMetrics != NULL) {
+      g_hash_table_remove(gMetrics, name);
+   }
+   g_mutex_unlock(&gMetricsLock);
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricAdd --                                                   */ /**
+ *
+ * Adds to a counter or a gauge. Counters should only be added positive
+ * values.
+ *
+ * @param[in] metric  The metric, may be NULL.
+ * @param[in] value   The value to add.
+ *
+ *******************************************************************************
+ */
+
+void
+VMTools_MetricAdd(VMToolsMetric *metric,
+                  gint64 value)
+{
+   if (metric != NULL && metric->type != METRIC_HISTOGRAM) {
+      guint shard = metric->type == METRIC_COUNTER ? MetricsShard() : 0;
+
+      Atomic_Add64(&metric->cells[shard * metric->stride], (uint64) value);
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricSet --                                                   */ /**
+ *
+ * Sets a gauge.
+ *
+ * @param[in] metric  The metric, may be NULL.
+ * @param[in] value   The new value.
+ *
+ *******************************************************************************
+ */
+
+void
+VMTools_MetricSet(VMToolsMetric *metric,
+                  gint64 value)
+{
+   if (metric != NULL && metric->type == METRIC_GAUGE) {
+      Atomic_Write64(&metric->cells[0], (uint64) value);
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricObserve --                                               */ /**
+ *
+ * Records a value in a histogram.
+ *
+ * @param[in] metric  The metric, may be NULL.
+ * @param[in] value   The observed value.
+ *
+ *******************************************************************************
+ */
+
+void
+VMTools_MetricObserve(VMToolsMetric *metric,
+                      guint64 value)
+{
+   if (metric != NULL && metric->type == METRIC_HISTOGRAM) {
+      Atomic_uint64 *cells = &metric->cells[MetricsShard() * metric->stride];
+      guint bucket = 0;
+
+      while (bucket < metric->numBounds && value > metric->bounds[bucket]) {
+         bucket++;
+      }
+      Atomic_Inc64(&cells[bucket]);
+      Atomic_Add64(&cells[metric->numBounds + 1], value);
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * MetricsCompare --                                                      */ /**
+ *
+ * Orders metrics by name, so that the members of a family are adjacent.
+ *
+ * @param[in] a   Pointer to a VMToolsMetric pointer.
+ * @param[in] b   Pointer to a VMToolsMetric pointer.
+ *
+ * @return < 0, 0, > 0 as for strcmp().
+ *
+ *******************************************************************************
+ */
+
+static gint
+MetricsCompare(gconstpointer a,
+               gconstpointer b)
+{
+   const VMToolsMetric *m1 = *(VMToolsMetric * const *) a;
+   const VMToolsMetric *m2 = *(VMToolsMetric * const *) b;
+   gint ret = strcmp(m1->family, m2->family);
+
+   return ret != 0 ? ret : strcmp(m1->name, m2->name);
+}
+
+
+/*
+ *******************************************************************************
+ * MetricsAppendHistogram --                                              */ /**
+ *
+ * Appends the sample lines of a histogram to a snapshot.
+ *
+ * @param[in] str      The snapshot.
+ * @param[in] metric   The histogram.
+ *
+ *******************************************************************************
+ */
+
+static void
+MetricsAppendHistogram(GString *str,
+                       const VMToolsMetric *metric)
+{
+   guint64 buckets[METRICS_MAX_BOUNDS + 1] = { 0 };
+   guint64 sum = 0;
+   guint64 count = 0;
+   const gchar *sep = metric->labels != NULL ? "," : "";
+   const gchar *labels = metric->labels != NULL ? metric->labels : "";
+   guint shard;
+   guint i;
+
+   for (shard = 0; shard < METRICS_SHARDS; shard++) {
+      Atomic_uint64 *cells = &metric->cells[shard * metric->stride];
+
+      for (i = 0; i <= metric->numBounds; i++) {
+         buckets[i] += Atomic_Read64(&cells[i]);
+      }
+      sum += Atomic_Read64(&cells[metric->numBounds + 1]);
+   }
+
+   /* Prometheus buckets are cumulative. */
+   for (i = 0; i < metric->numBounds; i++) {
+      count += buckets[i];
+      g_string_append_printf(str, "%s_bucket{%s%sle=\"%"G_GUINT64_FORMAT"\"} "
+                             "%"G_GUINT64_FORMAT"\n", metric->family, labels,
+                             sep, metric->bounds[i], count);
+   }
+   count += buckets[metric->numBounds];
+   g_string_append_printf(str, "%s_bucket{%s%sle=\"+Inf\"} %"G_GUINT64_FORMAT
+                          "\n", metric->family, labels, sep, count);
+
+   sep = metric->labels != NULL ? "{" : "";
+   g_string_append_printf(str, "%s_sum%s%s%s %"G_GUINT64_FORMAT"\n",
+                          metric->family, sep, labels,
+                          metric->labels != NULL ? "}" : "", sum);
+   g_string_append_printf(str, "%s_count%s%s%s %"G_GUINT64_FORMAT"\n",
+                          metric->family, sep, labels,
+                          metric->labels != NULL ? "}" : "", count);
+}
+
+
+/*
+ *******************************************************************************
+ * VMTools_MetricsSnapshot --                                             */ /**
+ *
+ * Returns the current value of all metrics, in the Prometheus text
+ * exposition format (version 0.0.4).
+ *
+ * @return The snapshot, to free with g_free.
+ *
+ *******************************************************************************
+ */
+
+gchar *
+VMTools_MetricsSnapshot(void)
+{
+   GString *str = g_string_new(NULL);
+   GPtrArray *metrics = g_ptr_array_new();
+   const gchar *family = NULL;
+   GHashTableIter iter;
+   gpointer value;
+   guint i;
+
+   g_mutex_lock(&gMetricsLock);
+
+   if (gMetrics != NULL) {
+      g_hash_table_iter_init(&iter, gMetrics);
+      while (g_hash_table_iter_next(&iter, NULL, &value)) {
+         g_ptr_array_add(metrics, value);
+      }
+   }
+   g_ptr_array_sort(metrics, MetricsCompare);
+
+   for (i = 0; i < metrics->len; i++) {
+      VMToolsMetric *metric = g_ptr_array_index(metrics, i);
+
+      if (family == NULL || strcmp(family, metric->family) != 0) {
+         family = metric->family;
+         g_string_append_printf(str, "# HELP %s %s\n# TYPE %s %s\n",
+                                family, metric->help, family,
+                                gMetricTypeNames[metric->type]);
+      }
+
+      switch (metric->type) {
+      case METRIC_COUNTER:
+         {
+            guint64 total = 0;
+            guint shard;
+
+            for (shard = 0; shard < METRICS_SHARDS; shard++) {
+               total += Atomic_Read64(&metric->cells[shard * metric->stride]);
+            }
+            g_string_append_printf(str, "%s %"G_GUINT64_FORMAT"\n",
+                                   metric->name, total);
+         }
+         break;
+      case METRIC_GAUGE:
+         g_string_append_printf(str, "%s %"G_GINT64_FORMAT"\n", metric->name,
+                                metric->func != NULL ?
+                                   metric->func(metric->funcData) :
+                                   (gint64) Atomic_Read64(&metric->cells[0]));
+         break;
+      case METRIC_HISTOGRAM:
+         MetricsAppendHistogram(str, metric);
+         break;
+      }
+   }
+
+   g_mutex_unlock(&gMetricsLock);
+
+   g_ptr_array_free(metrics, TRUE);
+   return g_string_free(str, FALSE);
+}
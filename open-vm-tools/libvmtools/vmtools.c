@@ -30,6 +30,12 @@
 #if defined(_WIN32)
 #  include <windows.h>
 #  include "netutil.h"
+#else
+#  include <pthread.h>
+#  include <sys/resource.h>
+#endif
+#if defined(__GLIBC__)
+#  include <malloc.h>
 #endif
 
 #include "vmware.h"
@@ -71,6 +77,139 @@ VMTools_WrapArray(gconstpointer data,
 }
 
 
+/*
+ * Low-memory profile: stack size of the threads created afterwards, and
+ * number of malloc arenas. Each arena keeps its own free memory.
+ */
+#define LOW_MEMORY_THREAD_STACK  (256 * 1024)
+#define LOW_MEMORY_MALLOC_ARENAS 1
+
+static gboolean gLowMemory = FALSE;
+
+
+/**
+ * Enables or disables the low-memory profile of the process. Components of
+ * the library and of the services shrink their buffers, caches and thread
+ * counts when it is enabled. Where the C library allows it, the threads
+ * created afterwards get smaller stacks and all threads share one malloc
+ * arena, so this should be called before creating threads.
+ *
+ * @param[in]  enabled     Whether to enable the profile.
+ */
+
+void
+VMTools_SetLowMemory(gboolean enabled)
+{
+   if (enabled == gLowMemory) {
+      return;
+   }
+   gLowMemory = enabled;
+   if (!enabled) {
+      return;
+   }
+
+#if defined(__GLIBC__)
+   mallopt(M_ARENA_MAX, LOW_MEMORY_MALLOC_ARENAS);
+#endif
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 18)
+   {
+      pthread_attr_t attr;
+
+      if (pthread_getattr_default_np(&attr) == 0) {
+         size_t stack;
+
+         if (pthread_attr_getstacksize(&attr, &stack) == 0 &&
+             stack > LOW_MEMORY_THREAD_STACK &&
+             pthread_attr_setstacksize(&attr, LOW_MEMORY_THREAD_STACK) == 0) {
+            pthread_setattr_default_np(&attr);
+         }
+         pthread_attr_destroy(&attr);
+      }
+   }
+#endif
+}
+
+
+/**
+ * Tells whether the low-memory profile is enabled.
+ *
+ * @return TRUE if VMTools_SetLowMemory() enabled it.
+ */
+
+gboolean
+VMTools_IsLowMemory(void)
+{
+   return gLowMemory;
+}
+
+
+/**
+ * Returns the free memory of the heap to the system, where the C library
+ * keeps it otherwise. Meant to be called after large, infrequent
+ * allocations, e.g. a big gather, in the low-memory profile.
+ */
+
+void
+VMTools_TrimMemory(void)
+{
+#if defined(__GLIBC__)
+   malloc_trim(0);
+#endif
+}
+
+
+/**
+ * Gets the resident set size of the process, current and peak.
+ *
+ * @param[out] rss         Current resident size, in bytes. 0 if unknown.
+ * @param[out] peakRss     Peak resident size, in bytes. 0 if unknown.
+ *
+ * @return FALSE if both are unknown.
+ */
+
+gboolean
+VMTools_GetMemoryUsage(guint64 *rss,
+                       guint64 *peakRss)
+{
+   *rss = 0;
+   *peakRss = 0;
+
+#if defined(__linux__)
+   {
+      gchar *status;
+
+      if (g_file_get_contents("/proc/self/status", &status, NULL, NULL)) {
+         const gchar *p;
+
+         if ((p = strstr(status, "\nVmRSS:")) != NULL) {
+            *rss = g_ascii_strtoull(p + sizeof "\nVmRSS:" - 1, NULL, 10) * 1024;
+         }
+         if ((p = strstr(status, "\nVmHWM:")) != NULL) {
+            *peakRss = g_ascii_strtoull(p + sizeof "\nVmHWM:" - 1, NULL,
+                                        10) * 1024;
+         }
+         g_free(status);
+      }
+   }
+#endif
+#if !defined(_WIN32)
+   if (*peakRss == 0) {
+      struct rusage usage;
+
+      if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+         *peakRss = usage.ru_maxrss;
+#else
+         *peakRss = (guint64) usage.ru_maxrss * 1024;
+#endif
+      }
+   }
+#endif
+
+   return *rss != 0 || *peakRss != 0;
+}
+
+
 /**
  * Library constructor. Calls any needed initialization functions.
  *
@@ -374,3 +374,242 @@ VMTools_ConfigGetString(GKeyFile *config,
    }
    return value;
 }
+
+
+/**
+ * A subscription to the changes of a config group or key, see
+ * VMTools_ConfigAddWatch().
+ */
+
+typedef struct ConfigWatch {
+   guint                   id;
+   gchar                  *group;
+   gchar                  *key;
+   VMToolsConfigChangedCb  cb;
+   gpointer                data;
+} ConfigWatch;
+
+static GSList *gConfigWatches = NULL;
+static guint gConfigWatchNextId = 1;
+
+
+/**
+ * Tells whether a key has the same raw value in two config dictionaries,
+ * counting a key missing from both as equal.
+ *
+ * @param[in]  a      First dictionary, may be NULL.
+ * @param[in]  b      Second dictionary, may be NULL.
+ * @param[in]  group  Group of the key.
+ * @param[in]  key    The key.
+ *
+ * @return TRUE if the values are the same.
+ */
+
+static gboolean
+VMToolsConfigKeyEqual(GKeyFile *a,
+                      GKeyFile *b,
+                      const gchar *group,
+                      const gchar *key)
+{
+   gchar *va = a != NULL ? g_key_file_get_value(a, group, key, NULL) : NULL;
+   gchar *vb = b != NULL ? g_key_file_get_value(b, group, key, NULL) : NULL;
+   gboolean equal = g_strcmp0(va, vb) == 0;
+
+   g_free(va);
+   g_free(vb);
+   return equal;
+}
+
+
+/**
+ * Tells whether every key of 'group' in 'a' has the same value in 'b'.
+ *
+ * @param[in]  a      Dictionary whose keys are compared, may be NULL.
+ * @param[in]  b      Other dictionary, may be NULL.
+ * @param[in]  group  The group.
+ *
+ * @return TRUE if the keys are the same.
+ */
+
+static gboolean
+VMToolsConfigGroupSubset(GKeyFile *a,
+                         GKeyFile *b,
+                         const gchar *group)
+{
+   gchar **keys;
+   gboolean equal = TRUE;
+   gsize i;
+
+   if (a == NULL) {
+      return TRUE;
+   }
+
+   keys = g_key_file_get_keys(a, group, NULL, NULL);
+   for (i = 0; keys != NULL && keys[i] != NULL && equal; i++) {
+      equal = VMToolsConfigKeyEqual(a, b, group, keys[i]);
+   }
+   g_strfreev(keys);
+   return equal;
+}
+
+
+/**
+ * Compares a group of two config dictionaries, so that users can skip
+ * reprocessing the groups which did not change on reload.
+ *
+ * @param[in]  a      First dictionary, may be NULL.
+ * @param[in]  b      Second dictionary, may be NULL.
+ * @param[in]  group  The group to compare.
+ *
+ * @return TRUE if both have the same keys with the same values in the group.
+ */
+
+gboolean
+VMTools_ConfigGroupEqual(GKeyFile *a,
+                         GKeyFile *b,
+                         const gchar *group)
+{
+   ASSERT(group);
+
+   return VMToolsConfigGroupSubset(a, b, group) &&
+          VMToolsConfigGroupSubset(b, a, group);
+}
+
+
+/**
+ * Subscribes to the changes of a config key, or of any key of a group,
+ * reported by VMTools_ConfigNotifyChanges(). Must be called from the thread
+ * which reloads the config, the main loop thread of vmtoolsd.
+ *
+ * @param[in]  group  The group.
+ * @param[in]  key    The key, or NULL for any key of the group.
+ * @param[in]  cb     Called with the new config when the value changes.
+ * @param[in]  data   Data for the callback.
+ *
+ * @return Id of the subscription, for VMTools_ConfigRemoveWatch().
+ */
+
+guint
+VMTools_ConfigAddWatch(const gchar *group,
+                       const gchar *key,
+                       VMToolsConfigChangedCb cb,
+                       gpointer data)
+{
+   ConfigWatch *watch = g_new0(ConfigWatch, 1);
+
+   ASSERT(group);
+   ASSERT(cb);
+
+   watch->id = gConfigWatchNextId++;
+   watch->group = g_strdup(group);
+   watch->key = g_strdup(key);
+   watch->cb = cb;
+   watch->data = data;
+   gConfigWatches = g_slist_append(gConfigWatches, watch);
+
+   return watch->id;
+}
+
+
+/**
+ * Cancels a subscription made with VMTools_ConfigAddWatch().
+ *
+ * @param[in]  id     Id of the subscription.
+ */
+
+void
+VMTools_ConfigRemoveWatch(guint id)
+{
+   GSList *l;
+
+   for (l = gConfigWatches; l != NULL; l = l->next) {
+      ConfigWatch *watch = l->data;
+
+      if (watch->id == id) {
+         gConfigWatches = g_slist_delete_link(gConfigWatches, l);
+         g_free(watch->group);
+         g_free(watch->key);
+         g_free(watch);
+         return;
+      }
+   }
+}
+
+
+/**
+ * Calls the subscriptions to the keys and groups which differ between the
+ * old and the new config.
+ *
+ * @param[in]  oldConfig   The config before the reload, may be NULL.
+ * @param[in]  newConfig   The config after the reload.
+ *
+ * @return Whether anything changed.
+ */
+
+gboolean
+VMTools_ConfigNotifyChanges(GKeyFile *oldConfig,
+                            GKeyFile *newConfig)
+{
+   gchar **groups;
+   gboolean changed = FALSE;
+   GSList *pending = NULL;
+   GSList *l;
+   gsize i;
+
+   ASSERT(newConfig);
+
+   /* A group removed from the new config differs as well. */
+   groups = g_key_file_get_groups(newConfig, NULL);
+   for (i = 0; groups[i] != NULL && !changed; i++) {
+      changed = !VMTools_ConfigGroupEqual(oldConfig, newConfig, groups[i]);
+   }
+   g_strfreev(groups);
+
+   if (!changed && oldConfig != NULL) {
+      groups = g_key_file_get_groups(oldConfig, NULL);
+      for (i = 0; groups[i] != NULL && !changed; i++) {
+         changed = !g_key_file_has_group(newConfig, groups[i]) &&
+                   !VMToolsConfigGroupSubset(oldConfig, NULL, groups[i]);
+      }
+      g_strfreev(groups);
+   }
+
+   if (!changed) {
+      return FALSE;
+   }
+
+   /*
+    * Find the callbacks first, callbacks may add or remove subscriptions.
+    */
+   for (l = gConfigWatches; l != NULL; l = l->next) {
+      ConfigWatch *watch = l->data;
+      gboolean equal;
+
+      if (watch->key != NULL) {
+         equal = VMToolsConfigKeyEqual(oldConfig, newConfig, watch->group,
+                                       watch->key);
+      } else {
+         equal = VMTools_ConfigGroupEqual(oldConfig, newConfig, watch->group);
+      }
+      if (!equal) {
+         pending = g_slist_prepend(pending, GUINT_TO_POINTER(watch->id));
+      }
+   }
+
+   pending = g_slist_reverse(pending);
+   for (l = pending; l != NULL; l = l->next) {
+      GSList *w;
+
+      for (w = gConfigWatches; w != NULL; w = w->next) {
+         ConfigWatch *watch = w->data;
+
+         if (watch->id == GPOINTER_TO_UINT(l->data)) {
+            watch->cb(newConfig, watch->group, watch->key, watch->data);
+            break;
+         }
+      }
+   }
+   g_slist_free(pending);
+
+   return TRUE;
+}
@@ -43,6 +43,67 @@ VMToolsMsgCleanup(void);
 GlibLogger *
 VMToolsCreateVMXLogger(void);
 
+/* Defaults for batching host-bound log lines. */
+#define VMX_LOG_BATCH_DEFAULT_BYTES       4096
+#define VMX_LOG_BATCH_DEFAULT_WINDOW_MS   250
+#define VMX_LOG_BATCH_DEFAULT_RATE        100
+#define VMX_LOG_BATCH_MAX_BYTES           (60 * 1024)
+
+typedef struct VMXLogBatch VMXLogBatch;
+
+typedef void (*VMXLogBatchFlushFn)(VMXLogBatch *batch,
+                                   gpointer data);
+
+VMXLogBatch *
+VMXLogBatch_New(VMXLogBatchFlushFn flush,
+                gpointer data);
+
+void
+VMXLogBatch_Configure(VMXLogBatch *batch,
+                      guint maxBytes,
+                      guint windowMs,
+                      guint rateLimit);
+
+void
+VMXLogBatch_Add(VMXLogBatch *batch,
+                const gchar *domain,
+                GLogLevelFlags level,
+                const gchar *message);
+
+gchar *
+VMXLogBatch_Take(VMXLogBatch *batch,
+                 gboolean force,
+                 gchar **domain,
+                 GLogLevelFlags *level);
+
+gboolean
+VMXLogBatch_Stopping(VMXLogBatch *batch);
+
+void
+VMXLogBatch_Destroy(VMXLogBatch *batch);
+
+void
+VMToolsAcquireLogHandlers(void);
+
+void
+VMToolsReleaseLogHandlers(void);
+
+void
+VMToolsBinLogOpen(const gchar *path,
+                  guint sizeKB,
+                  GLogLevelFlags mask);
+
+void
+VMToolsBinLogClose(void);
+
+gboolean
+VMToolsBinLogWants(GLogLevelFlags level);
+
+void
+VMToolsBinLogWrite(GLogLevelFlags level,
+                   const gchar *fmt,
+                   va_list args);
+
 /* ************************************************************************** *
  * Miscelaneous.                                                              *
  * ************************************************************************** */
@@ -41,6 +41,7 @@
 #  include <unistd.h>
 #  include <sys/resource.h>
 #  include <sys/time.h>
+#  include <time.h>
 #endif
 
 #include "glibUtils.h"
@@ -69,6 +70,18 @@
  * recent messages are preserved.
  */
 #define DEFAULT_MAX_CACHE_ENTRIES      (4*1024)
+#define LOW_MEMORY_MAX_CACHE_ENTRIES   256
+
+/*
+ * Default max number of log messages waiting for the asynchronous writer.
+ * In case of overflow, new messages are dropped and counted.
+ */
+#define DEFAULT_MAX_ASYNC_ENTRIES      (4*1024)
+
+/* Default, min and max size of the binary log ring, in KB. */
+#define DEFAULT_BINARY_LOG_SIZE_KB     (4*1024)
+#define MIN_BINARY_LOG_SIZE_KB         (64)
+#define MAX_BINARY_LOG_SIZE_KB         (1024*1024)
 
 /** The default handler to use if none is specified by the config data. */
 #define DEFAULT_HANDLER "file+"
@@ -95,6 +108,14 @@
 /** Tells whether the given log level is a fatal error. */
 #define IS_FATAL(level) ((level) & G_LOG_FLAG_FATAL)
 
+/**
+ * Tells whether a message must be written synchronously even when the
+ * asynchronous writer is enabled.
+ */
+#define IS_SYNC_LEVEL(level) ((level) & (G_LOG_FLAG_FATAL |      \
+                                         G_LOG_LEVEL_ERROR |     \
+                                         G_LOG_LEVEL_CRITICAL))
+
 /**
  * Tells whether a message should be logged. All fatal messages are logged,
  * regardless of what the configuration says. Otherwise, the log domain's
@@ -170,6 +191,41 @@ static gboolean gLogHandlerEnabled = TRUE;
 
 static gboolean gLogIOSuspended = FALSE;
 
+/*
+ * State of the asynchronous log writer. The writer thread takes entries
+ * off the queue and hands them to the file and syslog handlers without
+ * holding gLogStateMutex, so callers do not wait for the I/O. The queue
+ * and its counters are protected by 'lock'; the handlers referenced by
+ * queued entries stay valid because the queue is drained before any of
+ * them is freed.
+ */
+typedef struct AsyncLogState {
+   GMutex       lock;
+   GCond        queued;    /* Signaled when an entry is queued. */
+   GCond        drained;   /* Signaled when the queue becomes empty. */
+   GQueue       entries;
+   GThread     *thread;
+   gboolean     writing;   /* Whether the writer holds an entry. */
+   guint        dropped;   /* Dropped since the last queued entry. */
+} AsyncLogState;
+
+/*
+ * Levels accepted by at least one log handler. Read without the lock by
+ * VMTools_LogLevelEnabled(), so callers can skip formatting messages that
+ * would be dropped anyway.
+ */
+static gint gLogLevelsEnabled = G_LOG_LEVEL_MASK;
+
+/*
+ * Whether log timestamps come from the coarse realtime clock, which is
+ * cheaper to read but only as precise as the kernel tick.
+ */
+static gboolean gCoarseTimestamps = FALSE;
+
+static gboolean gAsyncLogEnabled = FALSE;
+static gint gMaxAsyncEntries = DEFAULT_MAX_ASYNC_ENTRIES;
+static AsyncLogState gAsyncLog;
+
 /* Data structures for the VMX guest logger */
 
 /*
@@ -184,6 +240,7 @@ static gchar *gAppName;
  */
 static GRecMutex gVmxGuestLogMutex;
 static RpcChannel *gChannel; /* either NULL or allocated AND started */
+static VMXLogBatch *gVmxLogBatch;
 
 /*
  * 1) VMX supports guest.log.* RPCs, use the query result of guest.log.state
@@ -327,23 +384,24 @@ VMToolsAsprintf(gchar **string,
 }
 
 
+/* Length of a timestamp, as in "2018-02-22T21:17:38.517Z". */
+#define TIMESTAMP_LEN  24
+
 /**
- * VMTools_GetTimeAsString --
- *
- *    Returns the current UTC timestamp information
+ * Formats the current UTC time as a timestamp. On POSIX the part up to the
+ * seconds is cached per thread, so that most log lines only cost a clock
+ * read; gmtime_r() does not consult the time zone.
  *
- *    Ex: "2018-02-22T21:17:38.517Z"
- *
- *    The caller must free the return value using g_free
+ * @param[out] buf   Where to write the timestamp, TIMESTAMP_LEN + 1 bytes.
  *
- * @return Properly formatted string that contains the timestamp.
- *         NULL if the timestamp cannot be retrieved.
+ * @return TRUE on success.
  */
 
-gchar *
-VMTools_GetTimeAsString(void)
+static gboolean
+VMToolsFormatTimestamp(gchar buf[TIMESTAMP_LEN + 1])
 {
-   gchar *timePrefix = NULL;
+#if defined(G_PLATFORM_WIN32)
+   gboolean ret = FALSE;
    GDateTime *utcTime = g_date_time_new_now_utc();
 
    if (utcTime != NULL) {
@@ -352,16 +410,73 @@ VMTools_GetTimeAsString(void)
       if (dateFormat != NULL) {
          gint msec = g_date_time_get_microsecond(utcTime) / 1000;
 
-         timePrefix = g_strdup_printf("%s.%03dZ", dateFormat, msec);
-
+         g_snprintf(buf, TIMESTAMP_LEN + 1, "%s.%03dZ", dateFormat, msec);
          g_free(dateFormat);
-         dateFormat = NULL;
+         ret = TRUE;
       }
 
       g_date_time_unref(utcTime);
    }
 
-   return timePrefix;
+   return ret;
+#else
+   static __thread time_t cachedSec = -1;
+   static __thread gchar cachedPrefix[TIMESTAMP_LEN + 1];
+   struct timespec ts;
+   clockid_t clock = CLOCK_REALTIME;
+
+#if defined(CLOCK_REALTIME_COARSE)
+   if (gCoarseTimestamps) {
+      clock = CLOCK_REALTIME_COARSE;
+   }
+#endif
+
+   if (clock_gettime(clock, &ts) != 0) {
+      return FALSE;
+   }
+
+   if (ts.tv_sec != cachedSec) {
+      struct tm tm;
+
+      if (gmtime_r(&ts.tv_sec, &tm) == NULL ||
+          strftime(cachedPrefix, sizeof cachedPrefix, "%Y-%m-%dT%H:%M:%S",
+                   &tm) == 0) {
+         cachedSec = -1;
+         return FALSE;
+      }
+      cachedSec = ts.tv_sec;
+   }
+
+   g_snprintf(buf, TIMESTAMP_LEN + 1, "%s.%03dZ", cachedPrefix,
+              (int)(ts.tv_nsec / 1000000));
+   return TRUE;
+#endif
+}
+
+
+/**
+ * VMTools_GetTimeAsString --
+ *
+ *    Returns the current UTC timestamp information
+ *
+ *    Ex: "2018-02-22T21:17:38.517Z"
+ *
+ *    The caller must free the return value using g_free
+ *
+ * @return Properly formatted string that contains the timestamp.
+ *         NULL if the timestamp cannot be retrieved.
+ */
+
+gchar *
+VMTools_GetTimeAsString(void)
+{
+   gchar tstamp[TIMESTAMP_LEN + 1];
+
+   if (!VMToolsFormatTimestamp(tstamp)) {
+      return NULL;
+   }
+
+   return g_strdup(tstamp);
 }
 
 
@@ -392,7 +507,8 @@ VMToolsLogFormat(const gchar *message,
    size_t len = 0;
    gboolean shared = TRUE;
    gboolean addsTimestamp = TRUE;
-   gchar *tstamp;
+   gchar tstampBuf[TIMESTAMP_LEN + 1];
+   const gchar *tstamp = NULL;
 
    if (domain == NULL) {
       domain = gLogDomain;
@@ -413,7 +529,10 @@ VMToolsLogFormat(const gchar *message,
       addsTimestamp = data->logger->addsTimestamp;
    }
 
-   tstamp = VMTools_GetTimeAsString();
+   /* Handlers which add their own timestamp only need one for cached lines. */
+   if ((!addsTimestamp || cached) && VMToolsFormatTimestamp(tstampBuf)) {
+      tstamp = tstampBuf;
+   }
 
    if (!addsTimestamp) {
       if (shared) {
@@ -446,8 +565,6 @@ VMToolsLogFormat(const gchar *message,
       }
    }
 
-   g_free(tstamp);
-
    /*
     * The log messages from glib itself (and probably other libraries based
     * on glib) do not include a trailing new line. Most of our code does. So
@@ -523,6 +640,132 @@ VMToolsLogMsg(gpointer _data, gpointer userData)
 }
 
 
+/**
+ * Body of the asynchronous log writer thread. Writes queued entries in
+ * order and wakes up anyone waiting in VMToolsAsyncLogFlush() when the
+ * queue is empty.
+ *
+ * @param[in] data   Unused.
+ *
+ * @return NULL, never returns.
+ */
+
+static gpointer
+VMToolsAsyncLogThread(gpointer data)
+{
+   g_mutex_lock(&gAsyncLog.lock);
+   for (;;) {
+      LogEntry *entry;
+
+      while ((entry = g_queue_pop_head(&gAsyncLog.entries)) == NULL) {
+         g_cond_broadcast(&gAsyncLog.drained);
+         g_cond_wait(&gAsyncLog.queued, &gAsyncLog.lock);
+      }
+
+      gAsyncLog.writing = TRUE;
+      g_mutex_unlock(&gAsyncLog.lock);
+
+      VMToolsLogMsg(entry, NULL);
+
+      g_mutex_lock(&gAsyncLog.lock);
+      gAsyncLog.writing = FALSE;
+   }
+
+   return NULL;
+}
+
+
+/**
+ * Waits until the asynchronous writer has written everything queued so
+ * far. Does nothing if the writer was never started.
+ */
+
+static void
+VMToolsAsyncLogFlush(void)
+{
+   g_mutex_lock(&gAsyncLog.lock);
+   if (gAsyncLog.thread != NULL) {
+      while (gAsyncLog.entries.length > 0 || gAsyncLog.writing) {
+         g_cond_wait(&gAsyncLog.drained, &gAsyncLog.lock);
+      }
+   }
+   g_mutex_unlock(&gAsyncLog.lock);
+}
+
+
+/**
+ * atexit() hook so that messages queued right before the process exits
+ * without tearing down logging still make it to the log.
+ */
+
+static void
+VMToolsAsyncLogAtExit(void)
+{
+   VMToolsAsyncLogFlush();
+}
+
+
+/**
+ * Hands a formatted log entry to the asynchronous writer, starting it on
+ * first use. If the queue is full the entry is dropped; the count of
+ * dropped messages is reported as a warning ahead of the next entry that
+ * fits.
+ *
+ * NOTE: This must be called after acquiring LogState lock.
+ *
+ * @param[in] entry    Entry to queue, owned by the writer on success.
+ *
+ * @return TRUE if the entry was consumed (queued or dropped), FALSE if the
+ *         writer could not be started and the caller should write it.
+ */
+
+static gboolean
+VMToolsAsyncLogPush(LogEntry *entry)
+{
+   gboolean ret = TRUE;
+
+   g_mutex_lock(&gAsyncLog.lock);
+
+   if (gAsyncLog.thread == NULL) {
+      gAsyncLog.thread = g_thread_try_new("vmtoolsLog", VMToolsAsyncLogThread,
+                                          NULL, NULL);
+      if (gAsyncLog.thread == NULL) {
+         ret = FALSE;
+         goto exit;
+      }
+      atexit(VMToolsAsyncLogAtExit);
+   }
+
+   if (gAsyncLog.entries.length >= (guint)gMaxAsyncEntries) {
+      gAsyncLog.dropped++;
+      VMToolsFreeLogEntry(entry);
+      goto exit;
+   }
+
+   if (gAsyncLog.dropped > 0) {
+      LogEntry *notice = g_malloc0(sizeof(LogEntry));
+      gchar *text = g_strdup_printf("Dropped %u log messages, the log writer "
+                                    "could not keep up.", gAsyncLog.dropped);
+
+      notice->domain = g_strdup(entry->domain);
+      notice->handler = entry->handler;
+      notice->level = G_LOG_LEVEL_WARNING;
+      notice->msg = VMToolsLogFormat(text, entry->domain, G_LOG_LEVEL_WARNING,
+                                     entry->handler, FALSE);
+      g_free(text);
+      g_queue_push_tail(&gAsyncLog.entries, notice);
+      gAsyncLog.dropped = 0;
+   }
+
+   g_queue_push_tail(&gAsyncLog.entries, entry);
+   g_cond_signal(&gAsyncLog.queued);
+
+exit:
+   g_mutex_unlock(&gAsyncLog.lock);
+   return ret;
+}
+
+
 /**
  * This is called to avoid nested glib logging.
  * For example the VMX logger calls RpcChannel code which calls
@@ -580,6 +823,32 @@ EnableLogHandler(void)
 }
 
 
+/**
+ * Acquires the log state lock and keeps messages logged by this thread from
+ * reaching the log handlers, for code running outside a log handler that
+ * calls into one (e.g. a batch thread sending to the VMX).
+ */
+
+void
+VMToolsAcquireLogHandlers(void)
+{
+   VMTools_AcquireLogStateLock();
+   DisableLogHandler();
+}
+
+
+/**
+ * Undoes VMToolsAcquireLogHandlers().
+ */
+
+void
+VMToolsReleaseLogHandlers(void)
+{
+   EnableLogHandler();
+   VMTools_ReleaseLogStateLock();
+}
+
+
 /**
  * Internal Log handler function that does the common processing of logs,
  * and delegates the actual printing of the message to the given handler.
@@ -668,6 +937,19 @@ VMToolsLogInt(const gchar *domain,
 
       } else {
          entry->msg = VMToolsLogFormat(message, domain, level, data, FALSE);
+
+         if (gAsyncLogEnabled && (data->needsFileIO || data->isSysLog)) {
+            if (!IS_SYNC_LEVEL(level) && gPanicCount == 0 &&
+                VMToolsAsyncLogPush(entry)) {
+               goto exit;
+            }
+
+            /*
+             * Errors and panics are written right away; let the writer
+             * catch up first so they show up after what precedes them.
+             */
+            VMToolsAsyncLogFlush();
+         }
          VMToolsLogMsg(entry, NULL);
       }
    }
@@ -830,6 +1112,131 @@ VMToolsDefaultLogFilePath(const gchar *domain)
 }
 
 
+/**
+ * Builds the mask of levels enabled by a log level name.
+ *
+ * @param[in]  level    Name of the level, as in the configuration file.
+ * @param[out] mask     The mask.
+ *
+ * @return FALSE if the level name is unknown.
+ */
+
+static gboolean
+VMToolsParseLogLevel(const gchar *level,
+                     GLogLevelFlags *mask)
+{
+   if (strcmp(level, "error") == 0) {
+      *mask = G_LOG_LEVEL_ERROR;
+   } else if (strcmp(level, "critical") == 0) {
+      *mask = G_LOG_LEVEL_ERROR |
+              G_LOG_LEVEL_CRITICAL;
+   } else if (strcmp(level, "warning") == 0) {
+      *mask = G_LOG_LEVEL_ERROR |
+              G_LOG_LEVEL_CRITICAL |
+              G_LOG_LEVEL_WARNING;
+   } else if (strcmp(level, "message") == 0) {
+      *mask = G_LOG_LEVEL_ERROR |
+              G_LOG_LEVEL_CRITICAL |
+              G_LOG_LEVEL_WARNING |
+              G_LOG_LEVEL_MESSAGE;
+   } else if (strcmp(level, "info") == 0) {
+      *mask = G_LOG_LEVEL_ERROR |
+              G_LOG_LEVEL_CRITICAL |
+              G_LOG_LEVEL_WARNING |
+              G_LOG_LEVEL_MESSAGE |
+              G_LOG_LEVEL_INFO;
+   } else if (strcmp(level, "debug") == 0) {
+      *mask = G_LOG_LEVEL_MASK;
+   } else if (strcmp(level, "none") == 0) {
+      *mask = 0;
+   } else {
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/**
+ * Recomputes the levels accepted by at least one log handler, used by
+ * VMTools_LogLevelEnabled(). Must be called after acquiring LogState lock,
+ * whenever the handlers or their masks change.
+ */
+
+static void
+VMToolsUpdateLevelsEnabled(void)
+{
+   guint mask = 0;
+
+   if (gLogEnabled) {
+      if (gDefaultData != NULL) {
+         mask |= gDefaultData->mask;
+      }
+      if (gDomains != NULL) {
+         guint i;
+
+         for (i = 0; i < gDomains->len; i++) {
+            LogHandler *data = g_ptr_array_index(gDomains, i);
+            mask |= data->mask;
+         }
+      }
+   }
+
+   g_atomic_int_set(&gLogLevelsEnabled, mask);
+}
+
+
+/**
+ * Configures the binary log of the default domain, or stops it if that
+ * domain has no "binaryLog" key. See VMTools_DecodeBinaryLog().
+ *
+ * @param[in]  cfg      Dictionary with config data.
+ */
+
+static void
+VMToolsConfigBinaryLog(GKeyFile *cfg)
+{
+   gchar key[128];
+   gchar *path;
+   gchar *level;
+   GLogLevelFlags mask = G_LOG_LEVEL_MASK;
+   gint sizeKB;
+   GError *err = NULL;
+
+   g_snprintf(key, sizeof key, "%s.binaryLog", gLogDomain);
+   path = g_key_file_get_string(cfg, LOGGING_GROUP, key, NULL);
+   if (path != NULL) {
+      g_strstrip(path);
+   }
+   if (path == NULL || *path == '\0') {
+      VMToolsBinLogClose();
+      g_free(path);
+      return;
+   }
+
+   g_snprintf(key, sizeof key, "%s.binaryLogLevel", gLogDomain);
+   level = g_key_file_get_string(cfg, LOGGING_GROUP, key, NULL);
+   if (level != NULL) {
+      g_strstrip(level);
+      if (!VMToolsParseLogLevel(level, &mask)) {
+         g_warning("Unknown binary log level (%s): %s\n", gLogDomain, level);
+         mask = G_LOG_LEVEL_MASK;
+      }
+      g_free(level);
+   }
+
+   g_snprintf(key, sizeof key, "%s.binaryLogSize", gLogDomain);
+   sizeKB = g_key_file_get_integer(cfg, LOGGING_GROUP, key, &err);
+   if (err != NULL || sizeKB < MIN_BINARY_LOG_SIZE_KB) {
+      sizeKB = err != NULL ? DEFAULT_BINARY_LOG_SIZE_KB : MIN_BINARY_LOG_SIZE_KB;
+      g_clear_error(&err);
+   }
+   sizeKB = MIN(sizeKB, MAX_BINARY_LOG_SIZE_KB);
+
+   VMToolsBinLogOpen(path, sizeKB, mask);
+   g_free(path);
+}
+
+
 /*
  *******************************************************************************
  * VMToolsGetLogFilePath --                                               */ /**
@@ -1145,31 +1552,7 @@ VMToolsConfigLogDomain(const gchar *domain,
    }
 
    /* Parse the log level configuration, and build the mask. */
-   if (strcmp(level, "error") == 0) {
-      levelsMask = G_LOG_LEVEL_ERROR;
-   } else if (strcmp(level, "critical") == 0) {
-      levelsMask = G_LOG_LEVEL_ERROR |
-                   G_LOG_LEVEL_CRITICAL;
-   } else if (strcmp(level, "warning") == 0) {
-      levelsMask = G_LOG_LEVEL_ERROR |
-                   G_LOG_LEVEL_CRITICAL |
-                   G_LOG_LEVEL_WARNING;
-   } else if (strcmp(level, "message") == 0) {
-      levelsMask = G_LOG_LEVEL_ERROR |
-                   G_LOG_LEVEL_CRITICAL |
-                   G_LOG_LEVEL_WARNING |
-                   G_LOG_LEVEL_MESSAGE;
-   } else if (strcmp(level, "info") == 0) {
-      levelsMask = G_LOG_LEVEL_ERROR |
-                   G_LOG_LEVEL_CRITICAL |
-                   G_LOG_LEVEL_WARNING |
-                   G_LOG_LEVEL_MESSAGE |
-                   G_LOG_LEVEL_INFO;
-   } else if (strcmp(level, "debug") == 0) {
-      levelsMask = G_LOG_LEVEL_MASK;
-   } else if (strcmp(level, "none") == 0) {
-      levelsMask = 0;
-   } else {
+   if (!VMToolsParseLogLevel(level, &levelsMask)) {
       g_warning("Unknown log level (%s): %s\n", domain, level);
       goto exit;
    }
@@ -1261,6 +1644,9 @@ exit:
 static void
 VMToolsResetLogging(gboolean hard)
 {
+   /* Queued entries reference the handlers freed below. */
+   VMToolsAsyncLogFlush();
+
    gLogEnabled = FALSE;
    g_log_set_default_handler(g_log_default_handler, NULL);
 
@@ -1486,7 +1872,8 @@ VMToolsConfigLoggingInt(const gchar *defaultDomain,
        * Use default value in case of error.
        * A value '0' will turn off log caching.
        */
-      gMaxCacheEntries = DEFAULT_MAX_CACHE_ENTRIES;
+      gMaxCacheEntries = VMTools_IsLowMemory() ? LOW_MEMORY_MAX_CACHE_ENTRIES :
+                                                 DEFAULT_MAX_CACHE_ENTRIES;
       if (err != NULL) {
          if (err->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND &&
              err->code != G_KEY_FILE_ERROR_GROUP_NOT_FOUND) {
@@ -1504,11 +1891,37 @@ VMToolsConfigLoggingInt(const gchar *defaultDomain,
       g_message("Log caching is disabled.");
    }
 
+   gCoarseTimestamps = g_key_file_get_boolean(cfg, LOGGING_GROUP,
+                                              "coarseTimestamps", NULL);
+   gAsyncLogEnabled = g_key_file_get_boolean(cfg, LOGGING_GROUP,
+                                             "asyncLogging", NULL);
+   gMaxAsyncEntries = g_key_file_get_integer(cfg, LOGGING_GROUP,
+                                             "maxAsyncEntries", &err);
+   if (err != NULL || gMaxAsyncEntries <= 0) {
+      gMaxAsyncEntries = DEFAULT_MAX_ASYNC_ENTRIES;
+      if (err != NULL) {
+         if (err->code != G_KEY_FILE_ERROR_KEY_NOT_FOUND &&
+             err->code != G_KEY_FILE_ERROR_GROUP_NOT_FOUND) {
+            g_warning("Invalid value for maxAsyncEntries key: Error %d.",
+                      err->code);
+         }
+         g_clear_error(&err);
+      }
+   }
+
+   if (gAsyncLogEnabled) {
+      g_message("Asynchronous logging is enabled with maxAsyncEntries=%d.",
+                gMaxAsyncEntries);
+   }
+
    if (g_key_file_has_key(cfg, LOGGING_GROUP, "enableCoreDump", NULL)) {
       gEnableCoreDump = g_key_file_get_boolean(cfg, LOGGING_GROUP,
                                                "enableCoreDump", NULL);
    }
 
+   VMToolsUpdateLevelsEnabled();
+   VMToolsConfigBinaryLog(cfg);
+
    /* If needed, restore the old configuration. */
    if (!reset) {
       if (oldDomains != NULL) {
@@ -1624,6 +2037,39 @@ VMTools_ConfigLogging(const gchar *defaultDomain,
 }
 
 
+/*
+ *******************************************************************************
+ * VMTools_LogLevelEnabled --                                             */ /**
+ *
+ * Tells whether messages at the given level may be logged by any of the
+ * configured handlers. This is a cheap check that hot paths can use to skip
+ * building expensive log messages; glib formats a message before handing
+ * it to the handler, so g_debug() and friends pay for the formatting even
+ * when the message ends up being dropped.
+ *
+ * The answer is conservative: a message may still be dropped by its
+ * domain's handler when this returns TRUE.
+ *
+ * @param[in]  level    Log level.
+ *
+ * @return Whether the level is enabled.
+ *
+ *******************************************************************************
+ */
+
+gboolean
+VMTools_LogLevelEnabled(GLogLevelFlags level)
+{
+   guint mask = g_atomic_int_get(&gLogLevelsEnabled);
+
+   if (gUseVmxGuestLog) {
+      mask |= gLevelMask;
+   }
+
+   return (level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR | mask)) != 0;
+}
+
+
 /* Wrappers for VMware's logging functions. */
 
 /*
@@ -1656,6 +2102,17 @@ VMToolsLogWrapper(GLogLevelFlags level,
       return;
    }
 
+   /*
+    * The binary log records the message without formatting it, and the
+    * formatting below is skipped when no handler wants the message.
+    */
+   if (VMToolsBinLogWants(level)) {
+      VMToolsBinLogWrite(level, fmt, args);
+   }
+   if (!VMTools_LogLevelEnabled(level)) {
+      return;
+   }
+
    VMTools_AcquireLogStateLock();
 
    if (gPanicCount == 0) {
@@ -1973,32 +2430,23 @@ done:
 
 /*
  *******************************************************************************
- * VmxGuestLog --                                                         */ /**
+ * VmxGuestLogSend --                                                     */ /**
  *
- * Logs a message to the VMX using RpcChannel.
+ * Sends lines to the VMX using RpcChannel.
+ * Must be called with the vmxGuestLog mutex held.
  *
- * @param[in] domain    Unused.
+ * @param[in] domain    Log domain.
  * @param[in] level     Log level.
- * @param[in] message   Message to log.
+ * @param[in] message   Lines to log, separated by new lines.
  *
  *******************************************************************************
  */
 
 static void
-VmxGuestLog(const gchar *domain,
-            GLogLevelFlags level,
-            const gchar *message)
+VmxGuestLogSend(const gchar *domain,
+                GLogLevelFlags level,
+                const gchar *message)
 {
-   if (!(gLevelMask & level)) { /* level is not sufficient */
-      return;
-   }
-
-   if (NULL == gChannel) {
-      /* This could happen upon a toolsd reset, e.g. vMotion */
-      Debug("The LOG RPC channel is not up, skip logging.\n");
-      return;
-   }
-
    if (RPC_GUEST_LOG_TEXT == gRpcMode) {
       gchar *msg = NULL;
       gint len = VMToolsAsprintf(&msg, GUEST_LOG_TEXT_CMD
@@ -2039,6 +2487,100 @@ VmxGuestLog(const gchar *domain,
 }
 
 
+/*
+ *******************************************************************************
+ * VmxGuestLogFlush --                                                    */ /**
+ *
+ * Sends the batched lines that are due, or drops them if the RPC channel
+ * went away in the meantime.
+ * Must be called with the vmxGuestLog mutex held.
+ *
+ * @param[in] force     Whether to send lines that could still wait.
+ *
+ *******************************************************************************
+ */
+
+static void
+VmxGuestLogFlush(gboolean force)
+{
+   GLogLevelFlags level;
+   gchar *domain;
+   gchar *text;
+
+   while ((text = VMXLogBatch_Take(gVmxLogBatch, force,
+                                   &domain, &level)) != NULL) {
+      if (NULL != gChannel && RPC_OFF != gRpcMode) {
+         VmxGuestLogSend(domain, level, text);
+      }
+      g_free(domain);
+      g_free(text);
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * VmxGuestLogFlushCb --                                                  */ /**
+ *
+ * Batch thread callback, sends the lines whose time window expired. Uses
+ * the same locking as LogToHost().
+ *
+ * @param[in] batch     Unused.
+ * @param[in] data      Unused.
+ *
+ *******************************************************************************
+ */
+
+static void
+VmxGuestLogFlushCb(VMXLogBatch *batch,
+                   gpointer data)
+{
+   VMTools_AcquireLogStateLock();
+   StopGlibLogging();
+   g_rec_mutex_lock(&gVmxGuestLogMutex);
+
+   VmxGuestLogFlush(TRUE);
+
+   g_rec_mutex_unlock(&gVmxGuestLogMutex);
+   RestartGlibLogging();
+   VMTools_ReleaseLogStateLock();
+}
+
+
+/*
+ *******************************************************************************
+ * VmxGuestLog --                                                         */ /**
+ *
+ * Queues a message for the VMX, and sends the batches that are due. See
+ * vmxLogger.c for how messages are batched.
+ *
+ * @param[in] domain    Log domain.
+ * @param[in] level     Log level.
+ * @param[in] message   Message to log.
+ *
+ *******************************************************************************
+ */
+
+static void
+VmxGuestLog(const gchar *domain,
+            GLogLevelFlags level,
+            const gchar *message)
+{
+   if (!(gLevelMask & level)) { /* level is not sufficient */
+      return;
+   }
+
+   if (NULL == gChannel) {
+      /* This could happen upon a toolsd reset, e.g. vMotion */
+      Debug("The LOG RPC channel is not up, skip logging.\n");
+      return;
+   }
+
+   VMXLogBatch_Add(gVmxLogBatch, domain, level, message);
+   VmxGuestLogFlush(FALSE);
+}
+
+
 /**
  * Acquire the log state lock.
  */
@@ -2068,7 +2610,15 @@ VMTools_ReleaseLogStateLock(void)
 void
 VMTools_SuspendLogIO()
 {
+   VMTools_AcquireLogStateLock();
    gLogIOSuspended = TRUE;
+
+   /*
+    * Anything already handed to the asynchronous writer must reach the
+    * disk before the file systems are frozen.
+    */
+   VMToolsAsyncLogFlush();
+   VMTools_ReleaseLogStateLock();
 }
 
 
@@ -2497,11 +3047,74 @@ VMTools_UseVmxGuestLog(const gchar *appName)
    if (!gUseVmxGuestLog) {
       gAppName = g_strdup(appName);
       g_rec_mutex_init(&gVmxGuestLogMutex);
+      gVmxLogBatch = VMXLogBatch_New(VmxGuestLogFlushCb, NULL);
       gUseVmxGuestLog = TRUE;
    }
 }
 
 
+/*
+ *******************************************************************************
+ * GetVmxLogBatchSetting --                                               */ /**
+ *
+ * Reads a non-negative integer setting from the logging group.
+ *
+ * @param[in]  cfg      tools config file object.
+ * @param[in]  key      Name of the setting.
+ * @param[in]  def      Value if the setting is missing or invalid.
+ *
+ * @return The value.
+ *
+ *******************************************************************************
+ */
+
+static guint
+GetVmxLogBatchSetting(GKeyFile *cfg,
+                      const gchar *key,
+                      guint def)
+{
+   GError *err = NULL;
+   gint value = g_key_file_get_integer(cfg, LOGGING_GROUP, key, &err);
+
+   if (err != NULL || value < 0) {
+      g_clear_error(&err);
+      return def;
+   }
+   return value;
+}
+
+
+/*
+ *******************************************************************************
+ * ConfigVmxLogBatch --                                                   */ /**
+ *
+ * Loads the batching and rate limiting settings for lines sent to the VMX:
+ *
+ *    - vmxBatchSize: bytes per RPC before a batch is sent, 0 sends each
+ *      line on its own.
+ *    - vmxBatchWindowMs: max time a line waits for a batch to fill up.
+ *    - vmxRateLimit: max lines per second sent to the VMX, 0 for no limit.
+ *
+ * @param[in]  cfg      tools config file object.
+ *
+ *******************************************************************************
+ */
+
+static void
+ConfigVmxLogBatch(GKeyFile *cfg)
+{
+   guint maxBytes = GetVmxLogBatchSetting(cfg, "vmxBatchSize",
+                                          VMX_LOG_BATCH_DEFAULT_BYTES);
+   guint windowMs = GetVmxLogBatchSetting(cfg, "vmxBatchWindowMs",
+                                          VMX_LOG_BATCH_DEFAULT_WINDOW_MS);
+   guint rate = GetVmxLogBatchSetting(cfg, "vmxRateLimit",
+                                      VMX_LOG_BATCH_DEFAULT_RATE);
+
+   VMXLogBatch_Configure(gVmxLogBatch, MIN(maxBytes, VMX_LOG_BATCH_MAX_BYTES),
+                         windowMs, rate);
+}
+
+
 /*
  *******************************************************************************
  * SetupVmxGuestLogInt --                                                 */ /**
@@ -2523,7 +3136,10 @@ SetupVmxGuestLogInt(gboolean refreshRpcChannel,   // IN
                     GKeyFile *cfg,                // IN
                     const gchar *level)           // IN
 {
+   ConfigVmxLogBatch(cfg);
+
    if (refreshRpcChannel) {
+      VmxGuestLogFlush(TRUE);
       DestroyRpcChannel();
    }
 
@@ -2630,6 +3246,7 @@ VMTools_TeardownVmxGuestLog(void)
 
    g_rec_mutex_lock(&gVmxGuestLogMutex);
 
+   VmxGuestLogFlush(TRUE);
    DestroyRpcChannel();
 
    g_rec_mutex_unlock(&gVmxGuestLogMutex);
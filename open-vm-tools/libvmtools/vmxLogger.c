@@ -19,30 +19,507 @@
 /**
  * @file vmxLogger.c
  *
- * A logger that writes the logs to the VMX log file.
+ * A logger that writes the logs to the VMX log file, and the batching of
+ * host-bound log lines shared with the vmx guest logger in vmtoolsLog.c.
+ *
+ * Each RPC to the host costs a backdoor exit, so lines are coalesced: runs of
+ * lines with the same level and domain are joined with new lines and sent as
+ * one message when the batch is full, when its time window expires, or right
+ * away for errors. A token bucket limits how many lines per second reach the
+ * host; suppressed lines are counted and reported in a warning once lines
+ * are accepted again.
  */
 
+#include <string.h>
+
 #include "vmtoolsInt.h"
 #include "vmware/tools/guestrpc.h"
 
+/*
+ * A run of lines with the same level and domain, sent as one message.
+ */
+typedef struct VMXLogChunk {
+   GLogLevelFlags    level;
+   gchar            *domain;
+   GString          *text;
+   gint64            deadline;   /* When the chunk must be sent. */
+   gboolean          ready;      /* Whether it can be sent now. */
+} VMXLogChunk;
+
+
+struct VMXLogBatch {
+   GMutex               lock;
+   GCond                cond;
+   GThread             *thread;
+   gboolean             stopping;
+   VMXLogBatchFlushFn   flush;
+   gpointer             flushData;
+   guint                maxBytes;
+   guint                windowMs;
+   guint                rateLimit;   /* Lines per second, 0 for no limit. */
+   GQueue               chunks;
+   gdouble              tokens;
+   gint64               lastRefill;
+   guint                suppressed;
+};
+
+
+/*
+ *******************************************************************************
+ * VMXLogChunkFree --                                                     */ /**
+ *
+ * @param[in] chunk  Chunk to free.
+ *
+ *******************************************************************************
+ */
+
+static void
+VMXLogChunkFree(VMXLogChunk *chunk)
+{
+   g_free(chunk->domain);
+   g_string_free(chunk->text, TRUE);
+   g_free(chunk);
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatchFree --                                                     */ /**
+ *
+ * @param[in] batch  Batch to free, with the lines not yet taken.
+ *
+ *******************************************************************************
+ */
+
+static void
+VMXLogBatchFree(VMXLogBatch *batch)
+{
+   g_queue_foreach(&batch->chunks, (GFunc)VMXLogChunkFree, NULL);
+   g_queue_clear(&batch->chunks);
+   g_cond_clear(&batch->cond);
+   g_mutex_clear(&batch->lock);
+   g_free(batch);
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatchThread --                                                   */ /**
+ *
+ * Sends batches whose time window expired when no new line comes in to
+ * push them out. The thread owns the batch once it runs, and frees it when
+ * VMXLogBatch_Destroy() asks it to stop.
+ *
+ * @param[in] data   The batch.
+ *
+ * @return NULL.
+ *
+ *******************************************************************************
+ */
+
+static gpointer
+VMXLogBatchThread(gpointer data)
+{
+   VMXLogBatch *batch = data;
+
+   g_mutex_lock(&batch->lock);
+   while (!batch->stopping) {
+      VMXLogChunk *chunk = g_queue_peek_head(&batch->chunks);
+
+      if (chunk == NULL) {
+         g_cond_wait(&batch->cond, &batch->lock);
+      } else if (!chunk->ready &&
+                 g_get_monotonic_time() < chunk->deadline) {
+         g_cond_wait_until(&batch->cond, &batch->lock, chunk->deadline);
+      } else {
+         g_mutex_unlock(&batch->lock);
+         batch->flush(batch, batch->flushData);
+         g_mutex_lock(&batch->lock);
+      }
+   }
+   g_mutex_unlock(&batch->lock);
+
+   VMXLogBatchFree(batch);
+   return NULL;
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatchAppend --                                                   */ /**
+ *
+ * Adds a line to the last chunk, or to a new one if the level or domain
+ * differ. Must be called with the batch lock held.
+ *
+ * @param[in] batch     The batch.
+ * @param[in] domain    Log domain, may be NULL.
+ * @param[in] level     Log level.
+ * @param[in] message   Line to add.
+ * @param[in] now       Current monotonic time.
+ *
+ *******************************************************************************
+ */
+
+static void
+VMXLogBatchAppend(VMXLogBatch *batch,
+                  const gchar *domain,
+                  GLogLevelFlags level,
+                  const gchar *message,
+                  gint64 now)
+{
+   VMXLogChunk *chunk = g_queue_peek_tail(&batch->chunks);
+   gsize len = strlen(message);
+
+   /* The lines are joined with new lines, drop the message's own. */
+   if (len > 0 && message[len - 1] == '\n') {
+      len--;
+   }
+
+   if (chunk == NULL || chunk->ready || chunk->level != level ||
+       g_strcmp0(chunk->domain, domain) != 0) {
+      if (chunk != NULL) {
+         chunk->ready = TRUE;
+      }
+      chunk = g_new0(VMXLogChunk, 1);
+      chunk->level = level;
+      chunk->domain = g_strdup(domain);
+      chunk->text = g_string_sized_new(MIN(batch->maxBytes, 1024));
+      chunk->deadline = now + (gint64)batch->windowMs * 1000;
+      g_queue_push_tail(&batch->chunks, chunk);
+      g_cond_signal(&batch->cond);
+   } else {
+      g_string_append_c(chunk->text, '\n');
+   }
+   g_string_append_len(chunk->text, message, len);
+
+   if (chunk->text->len >= batch->maxBytes ||
+       (level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR |
+                 G_LOG_LEVEL_CRITICAL)) != 0) {
+      chunk->ready = TRUE;
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatch_New --                                                     */ /**
+ *
+ * Creates a batch of host-bound log lines. Batching starts disabled, so
+ * each line is sent on its own until VMXLogBatch_Configure() is called.
+ *
+ * @param[in] flush     Called from the batch's thread when lines are due;
+ *                      must drain the batch with VMXLogBatch_Take().
+ * @param[in] data      Data for the callback.
+ *
+ * @return The batch.
+ *
+ *******************************************************************************
+ */
+
+VMXLogBatch *
+VMXLogBatch_New(VMXLogBatchFlushFn flush,
+                gpointer data)
+{
+   VMXLogBatch *batch = g_new0(VMXLogBatch, 1);
+
+   g_mutex_init(&batch->lock);
+   g_cond_init(&batch->cond);
+   g_queue_init(&batch->chunks);
+   batch->flush = flush;
+   batch->flushData = data;
+   batch->lastRefill = g_get_monotonic_time();
+   return batch;
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatch_Configure --                                               */ /**
+ *
+ * Sets the batching and rate limiting parameters.
+ *
+ * @param[in] batch     The batch.
+ * @param[in] maxBytes  Send a batch once it holds this many bytes. 0 to send
+ *                      each line on its own.
+ * @param[in] windowMs  Max time a line waits before being sent.
+ * @param[in] rateLimit Max lines per second sent to the host, 0 for no limit.
+ *
+ *******************************************************************************
+ */
+
+void
+VMXLogBatch_Configure(VMXLogBatch *batch,
+                      guint maxBytes,
+                      guint windowMs,
+                      guint rateLimit)
+{
+   g_mutex_lock(&batch->lock);
+   batch->maxBytes = windowMs > 0 ? maxBytes : 0;
+   batch->windowMs = windowMs;
+   batch->rateLimit = rateLimit;
+   batch->tokens = rateLimit;
+   g_mutex_unlock(&batch->lock);
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatch_Add --                                                     */ /**
+ *
+ * Queues a line for the host, unless the rate limit drops it. Errors and
+ * critical messages are never dropped. The caller should then send what is
+ * ready with VMXLogBatch_Take().
+ *
+ * @param[in] batch     The batch.
+ * @param[in] domain    Log domain, may be NULL.
+ * @param[in] level     Log level.
+ * @param[in] message   Line to send.
+ *
+ *******************************************************************************
+ */
+
+void
+VMXLogBatch_Add(VMXLogBatch *batch,
+                const gchar *domain,
+                GLogLevelFlags level,
+                const gchar *message)
+{
+   gint64 now = g_get_monotonic_time();
+
+   g_mutex_lock(&batch->lock);
+
+   if (batch->rateLimit > 0) {
+      batch->tokens += (gdouble)(now - batch->lastRefill) *
+                       batch->rateLimit / G_USEC_PER_SEC;
+      batch->tokens = MIN(batch->tokens, batch->rateLimit);
+      batch->lastRefill = now;
+
+      if (batch->tokens < 1 &&
+          (level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR |
+                    G_LOG_LEVEL_CRITICAL)) == 0) {
+         batch->suppressed++;
+         goto exit;
+      }
+      batch->tokens = MAX(batch->tokens - 1, 0);
+   }
+
+   if (batch->suppressed > 0) {
+      gchar *notice = g_strdup_printf("%u log messages were not sent to the "
+                                      "host because of the rate limit.",
+                                      batch->suppressed);
+
+      VMXLogBatchAppend(batch, domain, G_LOG_LEVEL_WARNING, notice, now);
+      g_free(notice);
+      batch->suppressed = 0;
+   }
+
+   VMXLogBatchAppend(batch, domain, level, message, now);
+
+   if (batch->maxBytes > 0 && batch->thread == NULL) {
+      batch->thread = g_thread_try_new("vmxLogBatch", VMXLogBatchThread,
+                                       batch, NULL);
+      if (batch->thread == NULL) {
+         /* Without the thread nothing would send lines that are late. */
+         batch->maxBytes = 0;
+      }
+   }
+   if (batch->maxBytes == 0) {
+      VMXLogChunk *chunk = g_queue_peek_tail(&batch->chunks);
+      chunk->ready = TRUE;
+   }
+
+exit:
+   g_mutex_unlock(&batch->lock);
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatch_Take --                                                    */ /**
+ *
+ * Takes the oldest batch that is due.
+ *
+ * @param[in]  batch    The batch.
+ * @param[in]  force    Take it even if it could wait for more lines.
+ * @param[out] domain   Domain of the lines, to be freed by the caller.
+ * @param[out] level    Level of the lines.
+ *
+ * @return The lines separated by new lines, to be freed by the caller. NULL
+ *         if nothing is due.
+ *
+ *******************************************************************************
+ */
+
+gchar *
+VMXLogBatch_Take(VMXLogBatch *batch,
+                 gboolean force,
+                 gchar **domain,
+                 GLogLevelFlags *level)
+{
+   VMXLogChunk *chunk;
+   gchar *text = NULL;
+
+   g_mutex_lock(&batch->lock);
+   chunk = g_queue_peek_head(&batch->chunks);
+   if (chunk != NULL &&
+       (force || chunk->ready || g_get_monotonic_time() >= chunk->deadline)) {
+      g_queue_pop_head(&batch->chunks);
+      *domain = chunk->domain;
+      *level = chunk->level;
+      text = g_string_free(chunk->text, FALSE);
+      g_free(chunk);
+   }
+   g_mutex_unlock(&batch->lock);
+
+   return text;
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatch_Stopping --                                                */ /**
+ *
+ * Tells a flush callback whether VMXLogBatch_Destroy() was called, in which
+ * case the callback's data may be gone.
+ *
+ * @param[in] batch     The batch.
+ *
+ * @return Whether the batch is being destroyed.
+ *
+ *******************************************************************************
+ */
+
+gboolean
+VMXLogBatch_Stopping(VMXLogBatch *batch)
+{
+   gboolean stopping;
+
+   g_mutex_lock(&batch->lock);
+   stopping = batch->stopping;
+   g_mutex_unlock(&batch->lock);
+   return stopping;
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLogBatch_Destroy --                                                 */ /**
+ *
+ * Destroys a batch, dropping lines not yet taken. The batch's thread is not
+ * waited for since its callback may be blocked on a lock the caller holds;
+ * it frees the batch when it wakes up.
+ *
+ * @param[in] batch     The batch.
+ *
+ *******************************************************************************
+ */
+
+void
+VMXLogBatch_Destroy(VMXLogBatch *batch)
+{
+   GThread *thread;
+
+   g_mutex_lock(&batch->lock);
+   batch->stopping = TRUE;
+   thread = batch->thread;
+   g_cond_signal(&batch->cond);
+   g_mutex_unlock(&batch->lock);
+
+   if (thread != NULL) {
+      g_thread_unref(thread);
+   } else {
+      VMXLogBatchFree(batch);
+   }
+}
+
+
 typedef struct VMXLoggerData {
    GlibLogger     handler;
    RpcChannel    *chan;
+   VMXLogBatch   *batch;
 } VMXLoggerData;
 
 
 /*
  *******************************************************************************
- * VMXLoggerLog --                                                        */ /**
+ * VMXLoggerSend --                                                       */ /**
  *
- * Logs a message to the VMX using RpcChannel.
+ * Sends the batches that are due to the VMX using RpcChannel.
  *
  * The logger uses its own RpcChannel, opening and closing the channel for each
- * log message sent. This is not optimal, especially if the application already
+ * batch sent. This is not optimal, especially if the application already
  * has an RpcChannel instantiated; this could be fixed by providing a way for
  * the application to provide its own RpcChannel to the logging code, if it uses
  * one, so that this logger can re-use it.
  *
+ * @param[in] logger    VMX logger data.
+ * @param[in] force     Whether to send batches that could still wait.
+ *
+ *******************************************************************************
+ */
+
+static void
+VMXLoggerSend(VMXLoggerData *logger,
+              gboolean force)
+{
+   gboolean started = FALSE;
+   GLogLevelFlags level;
+   gchar *domain;
+   gchar *text;
+
+   while ((text = VMXLogBatch_Take(logger->batch, force,
+                                   &domain, &level)) != NULL) {
+      if (started || (started = RpcChannel_Start(logger->chan))) {
+         gchar *msg;
+         gint cnt = VMToolsAsprintf(&msg, "log %s", text);
+
+         RpcChannel_Send(logger->chan, msg, cnt, NULL, NULL);
+         g_free(msg);
+      }
+      g_free(domain);
+      g_free(text);
+   }
+
+   if (started) {
+      RpcChannel_Stop(logger->chan);
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLoggerFlush --                                                      */ /**
+ *
+ * Batch thread callback, sends the lines that are due. Holding the log
+ * state lock serializes this with VMXLoggerLog() and the logger's
+ * destruction, and keeps messages logged by the RpcChannel code from
+ * coming back into this logger.
+ *
+ * @param[in] batch     Unused.
+ * @param[in] data      VMX logger data.
+ *
+ *******************************************************************************
+ */
+
+static void
+VMXLoggerFlush(VMXLogBatch *batch,
+               gpointer data)
+{
+   VMToolsAcquireLogHandlers();
+   if (!VMXLogBatch_Stopping(batch)) {
+      VMXLoggerSend(data, TRUE);
+   }
+   VMToolsReleaseLogHandlers();
+}
+
+
+/*
+ *******************************************************************************
+ * VMXLoggerLog --                                                        */ /**
+ *
+ * Logs a message to the VMX. The message is already formatted with its
+ * domain, so lines are only batched by level.
+ *
  * @param[in] domain    Unused.
  * @param[in] level     Log level.
  * @param[in] message   Message to log.
@@ -59,15 +536,9 @@ VMXLoggerLog(const gchar *domain,
 {
    VMXLoggerData *logger = data;
 
-   if (RpcChannel_Start(logger->chan)) {
-      gchar *msg;
-      gint cnt = VMToolsAsprintf(&msg, "log %s", message);
-
-      RpcChannel_Send(logger->chan, msg, cnt, NULL, NULL);
-
-      g_free(msg);
-      RpcChannel_Stop(logger->chan);
-   }
+   VMXLogBatch_Add(logger->batch, NULL, level, message);
+   VMXLoggerSend(logger, (level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR |
+                                   G_LOG_LEVEL_CRITICAL)) != 0);
 }
 
 
@@ -86,6 +557,9 @@ static void
 VMXLoggerDestroy(gpointer data)
 {
    VMXLoggerData *logger = data;
+
+   VMXLoggerSend(logger, TRUE);
+   VMXLogBatch_Destroy(logger->batch);
    RpcChannel_Destroy(logger->chan);
    g_free(logger);
 }
@@ -111,6 +585,10 @@ VMToolsCreateVMXLogger(void)
    data->handler.shared = TRUE;
    data->handler.dtor = VMXLoggerDestroy;
    data->chan = BackdoorChannel_New();
+   data->batch = VMXLogBatch_New(VMXLoggerFlush, data);
+   VMXLogBatch_Configure(data->batch, VMX_LOG_BATCH_DEFAULT_BYTES,
+                         VMX_LOG_BATCH_DEFAULT_WINDOW_MS,
+                         VMX_LOG_BATCH_DEFAULT_RATE);
    return &data->handler;
 }
 
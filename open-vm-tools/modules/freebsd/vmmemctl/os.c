@@ -113,6 +113,16 @@ MALLOC_DEFINE(M_VMMEMCTL, BALLOON_NAME, "vmmemctl metadata");
    #define VM_SYS_PAGES vm_cnt.v_page_count
 #endif
 
+/* Free and inactive pages, which the page daemon reclaims first. */
+#if __FreeBSD_version < 1100015
+   #define VM_RECLAIMABLE_PAGES (cnt.v_free_count + cnt.v_cache_count + \
+                                 cnt.v_inactive_count)
+#elif __FreeBSD_version < 1200060
+   #define VM_RECLAIMABLE_PAGES (vm_cnt.v_free_count + vm_cnt.v_inactive_count)
+#else
+   #define VM_RECLAIMABLE_PAGES (vm_free_count() + vm_inactive_count())
+#endif
+
 /*
  * The kmem_malloc() and kmem_free() APIs changed at different times during
  * the FreeBSD 12.0 ALPHA snapshot releases.  The difference in the
@@ -288,6 +298,29 @@ OS_ReservedPageGetLimit(void)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * OS_ReservedPageGetReclaimable --
+ *
+ *      Estimate how much memory the guest can give up without swapping.
+ *
+ * Results:
+ *      Free and inactive memory pages.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+unsigned long
+OS_ReservedPageGetReclaimable(void)
+{
+   return VM_RECLAIMABLE_PAGES;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -860,10 +893,18 @@ vmmemctl_sysctl(SYSCTL_HANDLER_ARGS)
    len += snprintf(buf + len, sizeof(buf) - len,
                    "rateNoSleepAlloc:   %8d pages/sec\n"
                    "rateSleepAlloc:     %8d pages/sec\n"
-                   "rateFree:           %8d pages/sec\n",
+                   "rateFree:           %8d pages/sec\n"
+                   "rateInflate:        %8u pages/sec\n"
+                   "rateDeflate:        %8u pages/sec\n"
+                   "reclaimable:        %8"FMT64"u pages\n"
+                   "inflateAllowance:   %8"FMT64"u pages\n",
                    stats->rateNoSleepAlloc,
                    stats->rateAlloc,
-                   stats->rateFree);
+                   stats->rateFree,
+                   stats->rateInflate,
+                   stats->rateDeflate,
+                   stats->nPagesReclaimable,
+                   stats->nPagesInflateAllowance);
 
    len += snprintf(buf + len, sizeof(buf) - len,
                    "\n"
@@ -85,8 +85,14 @@ typedef struct BlockInfo {
 } BlockInfo;
 
 
-/* XXX: Is it worth turning this into a hash table? */
-static DblLnkLst_Links blockedFiles;
+/*
+ * Blocks are hashed by filename, so that a drag of many files does not make
+ * every lookup walk all of their blocks. Waiters sleep on the completion of
+ * their own block, see BlockWaitOnFile().
+ */
+#define BLOCK_HASH_SIZE 256
+
+static DblLnkLst_Links blockedFiles[BLOCK_HASH_SIZE];
 static os_rwlock_t blockedFilesLock;
 static os_kmem_cache_t *blockInfoCache;
 
@@ -110,6 +116,8 @@ static os_kmem_cache_t *blockInfoCache;
 int
 BlockInit(void)
 {
+   unsigned int i;
+
    ASSERT(!blockInfoCache);
 
    blockInfoCache = os_kmem_cache_create("blockInfoCache",
@@ -120,7 +128,9 @@ BlockInit(void)
       return OS_ENOMEM;
    }
 
-   DblLnkLst_Init(&blockedFiles);
+   for (i = 0; i < BLOCK_HASH_SIZE; i++) {
+      DblLnkLst_Init(&blockedFiles[i]);
+   }
    os_rwlock_init(&blockedFilesLock);
 
    return 0;
@@ -146,14 +156,50 @@ BlockInit(void)
 void
 BlockCleanup(void)
 {
+#ifdef VMX86_DEBUG
+   unsigned int i;
+
+   for (i = 0; i < BLOCK_HASH_SIZE; i++) {
+      ASSERT(!DblLnkLst_IsLinked(&blockedFiles[i]));
+   }
+#endif
    ASSERT(blockInfoCache);
-   ASSERT(!DblLnkLst_IsLinked(&blockedFiles));
 
    os_rwlock_destroy(&blockedFilesLock);
    os_kmem_cache_destroy(blockInfoCache);
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * BlockHashBucket --
+ *
+ *    Returns the list of the blocks whose filename hashes like filename
+ *    (FNV-1a).
+ *
+ * Results:
+ *    The list.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static DblLnkLst_Links *
+BlockHashBucket(const char *filename)   // IN: filename of block
+{
+   unsigned int hash = 2166136261U;
+   const unsigned char *c;
+
+   for (c = (const unsigned char *)filename; *c != '\0'; c++) {
+      hash = (hash ^ *c) * 16777619U;
+   }
+   return &blockedFiles[hash % BLOCK_HASH_SIZE];
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -328,7 +374,7 @@ GetBlock(const char *filename,          // IN: file to find block for
    ASSERT(os_rwlock_held(&blockedFilesLock));
 #endif
 
-   DblLnkLst_ForEach(curr, &blockedFiles) {
+   DblLnkLst_ForEach(curr, BlockHashBucket(filename)) {
       BlockInfo *currBlock = DblLnkLst_Container(curr, BlockInfo, links);
       if ((blocker == OS_UNKNOWN_BLOCKER || currBlock->blocker == blocker) &&
           strcmp(currBlock->filename, filename) == 0) {
@@ -422,7 +468,7 @@ BlockAddFileBlock(const char *filename,           // IN: name of file to block
       goto out;
    }
 
-   DblLnkLst_LinkLast(&blockedFiles, &block->links);
+   DblLnkLst_LinkLast(BlockHashBucket(filename), &block->links);
    LOG(4, "added block for [%s]\n", filename);
    retval = 0;
 
@@ -498,20 +544,23 @@ BlockRemoveAllBlocks(const os_blocker_id_t blocker)  // IN: blocker to remove bl
    struct DblLnkLst_Links *curr;
    struct DblLnkLst_Links *tmp;
    unsigned int removed = 0;
+   unsigned int i;
 
    os_write_lock(&blockedFilesLock);
 
-   DblLnkLst_ForEachSafe(curr, tmp, &blockedFiles) {
-      BlockInfo *currBlock = DblLnkLst_Container(curr, BlockInfo, links);
-      if (currBlock->blocker == blocker || blocker == OS_UNKNOWN_BLOCKER) {
+   for (i = 0; i < BLOCK_HASH_SIZE; i++) {
+      DblLnkLst_ForEachSafe(curr, tmp, &blockedFiles[i]) {
+         BlockInfo *currBlock = DblLnkLst_Container(curr, BlockInfo, links);
+         if (currBlock->blocker == blocker || blocker == OS_UNKNOWN_BLOCKER) {
 
-         BlockDoRemoveBlock(currBlock);
+            BlockDoRemoveBlock(currBlock);
 
-         /*
-          * We count only entries removed from the -list-, regardless of whether
-          * or not other waiters exist.
-          */
-         ++removed;
+            /*
+             * We count only entries removed from the -list-, regardless of
+             * whether or not other waiters exist.
+             */
+            ++removed;
+         }
       }
    }
 
@@ -562,6 +611,50 @@ BlockWaitFileBlock(const char *filename,          // IN: block to wait
 }
 
 
+#if defined(vmblock_fuse)
+/*
+ *----------------------------------------------------------------------------
+ *
+ * BlockPollFileBlock --
+ *
+ *    Non-blocking variant of BlockWaitFileBlock(). Checks whether any other
+ *    thread accessed the file specified by the filename or the block on the
+ *    file was removed, and if not, has pollHandle notified when it happens.
+ *
+ * Results:
+ *    1 if it happened, 0 if not, error code on failure.
+ *
+ * Side effects:
+ *    The poll handle is owned by the block.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+BlockPollFileBlock(const char *filename,          // IN: block to poll
+                   const os_blocker_id_t blocker, // IN: blocker
+                   void *pollHandle)              // IN: poller to notify
+{
+   BlockInfo *block;
+   int retval;
+
+   ASSERT(filename);
+
+   /* Hold the lock so that the block cannot be freed meanwhile. */
+   os_write_lock(&blockedFilesLock);
+   block = GetBlock(filename, blocker);
+   if (!block) {
+      retval = OS_ENOENT;
+   } else {
+      retval = os_completion_poll(&block->notification, pollHandle);
+   }
+   os_write_unlock(&blockedFilesLock);
+
+   return retval;
+}
+#endif
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -689,13 +782,16 @@ BlockListFileBlocks(void)
 {
    DblLnkLst_Links *curr;
    int count = 0;
+   unsigned int i;
 
    os_read_lock(&blockedFilesLock);
 
-   DblLnkLst_ForEach(curr, &blockedFiles) {
-      BlockInfo *currBlock = DblLnkLst_Container(curr, BlockInfo, links);
-      LOG(1, "BlockListFileBlocks: (%d) Filename: [%s], Blocker: [%p]\n",
-          count++, currBlock->filename, currBlock->blocker);
+   for (i = 0; i < BLOCK_HASH_SIZE; i++) {
+      DblLnkLst_ForEach(curr, &blockedFiles[i]) {
+         BlockInfo *currBlock = DblLnkLst_Container(curr, BlockInfo, links);
+         LOG(1, "BlockListFileBlocks: (%d) Filename: [%s], Blocker: [%p]\n",
+             count++, currBlock->filename, currBlock->blocker);
+      }
    }
 
    os_read_unlock(&blockedFilesLock);
@@ -79,6 +79,10 @@ int BlockRemoveFileBlock(const char *filename, const os_blocker_id_t blocker);
 unsigned int BlockRemoveAllBlocks(const os_blocker_id_t blocker);
 int BlockWaitFileBlock(const char *filename, const os_blocker_id_t blocker);
 int BlockWaitOnFile(const char *filename, BlockHandle cookie);
+#if defined(vmblock_fuse)
+int BlockPollFileBlock(const char *filename, const os_blocker_id_t blocker,
+                       void *pollHandle);
+#endif
 BlockHandle BlockLookup(const char *filename, const os_blocker_id_t blocker);
 #ifdef VMX86_DEVEL
 void BlockListFileBlocks(void);
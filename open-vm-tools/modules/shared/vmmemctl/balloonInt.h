@@ -82,7 +82,22 @@
 #define BALLOON_DEBUG_VERBOSE   0
 
 #define BALLOON_POLL_PERIOD             1 /* sec */
-#define BALLOON_NOSLEEP_ALLOC_MAX       16384
+#define BALLOON_NOSLEEP_ALLOC_MIN       2048
+#define BALLOON_NOSLEEP_ALLOC_MAX       65536
+
+/*
+ * The nosleep allocation rate aims at closing 1 / 2^BALLOON_RATE_DELTA_SHIFT
+ * of the gap to the target per cycle, and at most doubles from one cycle to
+ * the next.
+ */
+#define BALLOON_RATE_DELTA_SHIFT        2
+
+/*
+ * Nosleep allocations never bring the guest's reclaimable memory below
+ * 1 / 2^BALLOON_RECLAIM_RESERVE_SHIFT of its memory, so that the balloon does
+ * not push the guest into swapping at full speed.
+ */
+#define BALLOON_RECLAIM_RESERVE_SHIFT   6
 
 #define BALLOON_RATE_ALLOC_MIN          512
 #define BALLOON_RATE_ALLOC_MAX          2048
@@ -97,6 +97,7 @@ extern void OS_Free(void *ptr, size_t size);
 extern void OS_Yield(void);
 
 extern unsigned long OS_ReservedPageGetLimit(void);
+extern unsigned long OS_ReservedPageGetReclaimable(void);
 extern PA64          OS_ReservedPageGetPA(PageHandle handle);
 extern PageHandle    OS_ReservedPageGetHandle(PA64 pa);
 extern PageHandle    OS_ReservedPageAlloc(int canSleep, int isLargePage);
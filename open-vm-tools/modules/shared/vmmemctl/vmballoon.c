@@ -104,6 +104,7 @@ extern "C" {
  */
 static void BalloonPageFree(Balloon *b, int isLargePage);
 static void BalloonAdjustSize(Balloon *b, uint64 target);
+static void BalloonUpdateRates(Balloon *b, uint64 target);
 static void BalloonReset(Balloon *b);
 
 static void BalloonAddPage(Balloon *b, uint16 idx, PageHandle page);
@@ -165,9 +166,13 @@ Balloon_GetStats(void)
     */
    stats->nPages = b->nPages;
    stats->nPagesTarget = b->nPagesTarget;
-   stats->rateNoSleepAlloc = BALLOON_NOSLEEP_ALLOC_MAX;
+   stats->rateNoSleepAlloc = b->rateNoSleepAlloc;
    stats->rateAlloc = b->rateAlloc;
    stats->rateFree = b->rateFree;
+   stats->rateInflate = b->rateInflate;
+   stats->rateDeflate = b->rateDeflate;
+   stats->nPagesReclaimable = b->nPagesReclaimable;
+   stats->nPagesInflateAllowance = b->nPagesInflateAllowance;
 
    return stats;
 }
@@ -448,10 +453,27 @@ Balloon_QueryAndExecute(void)
       b->slowPageAllocationCycles--;
    }
 
+   b->rateInflate = 0;
+   b->rateDeflate = 0;
+
    if (status == BALLOON_SUCCESS) {
+      uint64 nPages = b->nPages;
+
       /* update target, adjust size */
       b->nPagesTarget = target;
+      BalloonUpdateRates(b, target);
       BalloonAdjustSize(b, target);
+
+      /*
+       * A cycle either inflates or deflates the balloon, so its net size
+       * change is the throughput achieved. Large pages count as
+       * OS_LARGE_2_SMALL_PAGES small pages.
+       */
+      if (b->nPages > nPages) {
+         b->rateInflate = (b->nPages - nPages) / BALLOON_POLL_PERIOD;
+      } else {
+         b->rateDeflate = (nPages - b->nPages) / BALLOON_POLL_PERIOD;
+      }
    }
 }
 
@@ -731,6 +753,51 @@ BalloonPageFree(Balloon *b,      // IN/OUT
    BalloonChunkDestroyEmpty(b, chunk, isLargePage);
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * BalloonUpdateRates --
+ *
+ *      Rate controller, run once per cycle before adjusting the balloon
+ *      size. It sizes the nosleep allocation rate after the distance to the
+ *      target, and bounds how much nosleep allocations may take by the
+ *      memory the guest can reclaim without swapping.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the rates and the inflate allowance of the balloon.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+BalloonUpdateRates(Balloon *b,     // IN/OUT
+                   uint64 target)  // IN
+{
+   uint64 reserve = OS_ReservedPageGetLimit() >> BALLOON_RECLAIM_RESERVE_SHIFT;
+
+   b->nPagesReclaimable = OS_ReservedPageGetReclaimable();
+   b->nPagesInflateAllowance = b->nPagesReclaimable > reserve ?
+                               b->nPagesReclaimable - reserve : 0;
+
+   if (b->nPages < target) {
+      uint64 want = (target - b->nPages) >> BALLOON_RATE_DELTA_SHIFT;
+
+      want = MAX(want, BALLOON_NOSLEEP_ALLOC_MIN);
+      want = MIN(want, (uint64)b->rateNoSleepAlloc * 2);
+      b->rateNoSleepAlloc = MIN(want, BALLOON_NOSLEEP_ALLOC_MAX);
+   } else if (b->nPages > target && b->nPagesInflateAllowance == 0) {
+      /*
+       * The guest is short of memory and the host wants some back: return
+       * it as fast as we can.
+       */
+      b->rateFree = BALLOON_RATE_FREE_MAX;
+   }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -758,8 +825,18 @@ BalloonInflate(Balloon *b,      // IN/OUT
    BalloonPageAllocType allocType;
    Bool isLargePages;
    unsigned numPagesPerEntry;
-
-   if ((b->hypervisorCapabilities & BALLOON_BATCHED_2M_CMDS) != 0) {
+   uint64 limit = target;
+
+   if (b->nPagesInflateAllowance == 0) {
+      /*
+       * The guest has no memory left to give without swapping: only inflate
+       * with sleeping allocations, at the reduced rate.
+       */
+      b->slowPageAllocationCycles = SLOW_PAGE_ALLOCATION_CYCLES;
+      allocType = BALLOON_PAGE_ALLOC_CANSLEEP;
+      isLargePages = FALSE;
+      numPagesPerEntry = 1;
+   } else if ((b->hypervisorCapabilities & BALLOON_BATCHED_2M_CMDS) != 0) {
       allocType = BALLOON_PAGE_ALLOC_LPAGE;
       isLargePages = TRUE;
       numPagesPerEntry = OS_LARGE_2_SMALL_PAGES;
@@ -790,14 +867,19 @@ BalloonInflate(Balloon *b,      // IN/OUT
 
    /*
     * Start with no sleep allocation rate which may be higher
-    * than sleeping allocation rate.
+    * than sleeping allocation rate. Nosleep allocations stop at the
+    * inflate allowance.
     */
    rate = b->slowPageAllocationCycles ?
-                b->rateAlloc : BALLOON_NOSLEEP_ALLOC_MAX;
+                b->rateAlloc : b->rateNoSleepAlloc;
+   if (allocType != BALLOON_PAGE_ALLOC_CANSLEEP &&
+       target - b->nPages > b->nPagesInflateAllowance) {
+      limit = b->nPages + b->nPagesInflateAllowance;
+   }
 
    nEntries = 0;
-   while (b->nPages < target &&
-          nEntries * numPagesPerEntry < target - b->nPages) {
+   while (b->nPages < limit &&
+          nEntries * numPagesPerEntry < limit - b->nPages) {
       PageHandle handle;
 
       STATS_INC(b->stats.primAlloc[allocType]);
@@ -1348,7 +1430,10 @@ BalloonDeflateInt(Balloon *b,       // IN/OUT
    }
 
    if (BALLOON_RATE_ADAPT) {
-      if (status == BALLOON_SUCCESS) {
+      if (status == BALLOON_SUCCESS && deallocations >= b->rateFree) {
+         /* quickly increase rate if no errors and the rate was the limit */
+         b->rateFree = MIN(b->rateFree * 2, BALLOON_RATE_FREE_MAX);
+      } else if (status == BALLOON_SUCCESS) {
          /* slowly increase rate if no errors */
          b->rateFree = MIN(b->rateFree + BALLOON_RATE_FREE_INC,
                            BALLOON_RATE_FREE_MAX);
@@ -1447,6 +1532,7 @@ Balloon_Init(BalloonGuest guestType)    // IN
    b->guestType = guestType;
 
    /* initialize rates */
+   b->rateNoSleepAlloc = BALLOON_NOSLEEP_ALLOC_MIN;
    b->rateAlloc = BALLOON_RATE_ALLOC_MAX;
    b->rateFree  = BALLOON_RATE_FREE_MAX;
 
@@ -92,6 +92,14 @@ typedef struct {
    uint32 rateAlloc;
    uint32 rateFree;
 
+   /* measured throughput over the last cycle (small pages per second) */
+   uint32 rateInflate;
+   uint32 rateDeflate;
+
+   /* rate controller inputs at the last cycle (small pages) */
+   uint64 nPagesReclaimable;
+   uint64 nPagesInflateAllowance;
+
    /* high-level operations */
    uint32 timer;
 
@@ -156,9 +164,19 @@ typedef struct {
    int resetFlag;
 
    /* adjustment rates (pages per second) */
+   int rateNoSleepAlloc;
    int rateAlloc;
    int rateFree;
 
+   /* guest memory reclaimable without swapping, and how much of it nosleep
+      allocations may take (small pages) */
+   uint64 nPagesReclaimable;
+   uint64 nPagesInflateAllowance;
+
+   /* measured throughput over the last cycle (pages per second) */
+   uint32 rateInflate;
+   uint32 rateDeflate;
+
    /* slowdown page allocations for next few cycles */
    int slowPageAllocationCycles;
 
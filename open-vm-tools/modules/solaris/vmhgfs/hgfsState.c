@@ -958,6 +958,234 @@ HgfsClearOpenFileMode(struct vnode *vp) // IN: Vnode to clear mode for
 }
 
 
+/*
+ * File data cache.
+ *
+ * Data read from the host is kept in HGFS_FILE_CACHE_BLOCKS blocks per
+ * HgfsFile, so the cache is shared by every open instance of a file.  Blocks
+ * are dropped when the file is written or its attributes are set through us,
+ * and when the host reports a size or write time other than the one last
+ * seen.  Without news from the host, a block is trusted for
+ * HGFS_FILE_CACHE_TTL_USEC.
+ */
+
+#define HGFS_FILE_CACHE_BLOCK(fp, offset)                               \
+   (&(fp)->cacheBlocks[((offset) / HGFS_IO_MAX) % HGFS_FILE_CACHE_BLOCKS])
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsFileCacheRead --
+ *
+ *    Copies data of a file to the user from the cache, if the cache has it.
+ *    The range must not cross a HGFS_IO_MAX boundary.
+ *
+ * Results:
+ *    Returns 0 if the data was copied, with the number of bytes in count (0
+ *    at the end of the file).  Returns ENOENT if the data is not cached, and
+ *    the error of uiomove(9F) if that failed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+int
+HgfsFileCacheRead(HgfsFile *fp,         // IN: File to read
+                  uint64_t offset,      // IN: Offset in the file
+                  uint32_t size,        // IN: Number of bytes wanted
+                  struct uio *uiop,     // IN/OUT: User's read request
+                  uint32_t *count)      // OUT: Number of bytes copied
+{
+   uint64_t blockOffset = offset - offset % HGFS_IO_MAX;
+   uint32_t delta = offset - blockOffset;
+   HgfsFileCacheBlock *block;
+   int ret = ENOENT;
+
+   ASSERT(fp);
+   ASSERT(uiop);
+   ASSERT(count);
+   ASSERT(delta + size <= HGFS_IO_MAX);
+
+   mutex_enter(&fp->cacheMutex);
+
+   if (!fp->cacheBlocks) {
+      goto out;
+   }
+
+   block = HGFS_FILE_CACHE_BLOCK(fp, blockOffset);
+   if (block->length == 0 || block->offset != blockOffset ||
+       ddi_get_lbolt() - block->filled >=
+          drv_usectohz(HGFS_FILE_CACHE_TTL_USEC)) {
+      goto out;
+   }
+
+   /* A block shorter than HGFS_IO_MAX ends at the end of the file. */
+   *count = delta < block->length ? MIN(size, block->length - delta) : 0;
+   ret = *count ? uiomove(block->data + delta, *count, UIO_READ, uiop) : 0;
+
+   DEBUG(VM_DEBUG_INFO, "HgfsFileCacheRead: %u bytes at %"FMT64"u of %s\n",
+         *count, offset, fp->fileName);
+
+out:
+   mutex_exit(&fp->cacheMutex);
+   return ret;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsFileCacheFill --
+ *
+ *    Puts a block of data just read from the host in the cache of the file.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The cache blocks of the file are allocated if needed.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+HgfsFileCacheFill(HgfsFile *fp,         // IN: File the data is from
+                  uint64_t offset,      // IN: Offset of the data, aligned
+                  const char *data,     // IN: The data
+                  uint32_t length)      // IN: Number of bytes of data
+{
+   HgfsFileCacheBlock *blocks = NULL;
+   HgfsFileCacheBlock *block;
+
+   ASSERT(fp);
+   ASSERT(offset % HGFS_IO_MAX == 0);
+   ASSERT(length <= HGFS_IO_MAX);
+
+   mutex_enter(&fp->cacheMutex);
+
+   /* Don't sleep in kmem_zalloc() with the mutex held. */
+   if (!fp->cacheBlocks) {
+      mutex_exit(&fp->cacheMutex);
+      blocks = kmem_zalloc(HGFS_FILE_CACHE_BLOCKS * sizeof *blocks,
+                           HGFS_ALLOC_FLAG);
+      mutex_enter(&fp->cacheMutex);
+      if (!fp->cacheBlocks) {
+         fp->cacheBlocks = blocks;
+         blocks = NULL;
+      }
+   }
+
+   block = HGFS_FILE_CACHE_BLOCK(fp, offset);
+   memcpy(block->data, data, length);
+   block->offset = offset;
+   block->length = length;
+   block->filled = ddi_get_lbolt();
+
+   mutex_exit(&fp->cacheMutex);
+
+   if (blocks) {
+      kmem_free(blocks, HGFS_FILE_CACHE_BLOCKS * sizeof *blocks);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsFileCacheInvalidate --
+ *
+ *    Drops the cached data of a file, after it was changed through us.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    The next attributes from the host are taken as the new reference.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+HgfsFileCacheInvalidate(HgfsFile *fp)   // IN: File to invalidate
+{
+   unsigned int i;
+
+   ASSERT(fp);
+
+   mutex_enter(&fp->cacheMutex);
+
+   if (fp->cacheBlocks) {
+      for (i = 0; i < HGFS_FILE_CACHE_BLOCKS; i++) {
+         fp->cacheBlocks[i].length = 0;
+      }
+   }
+   fp->cacheAttrIsSet = FALSE;
+
+   mutex_exit(&fp->cacheMutex);
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * HgfsFileCacheCheckAttr --
+ *
+ *    Checks the attributes of a file just received from the host against
+ *    the ones seen before.  If the size or write time changed, the file was
+ *    modified on the host and its cached data is dropped; otherwise the
+ *    cached data is known to be current and is trusted for another
+ *    HGFS_FILE_CACHE_TTL_USEC.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+void
+HgfsFileCacheCheckAttr(HgfsFile *fp,            // IN: File the attributes are of
+                       const HgfsAttr *attr)    // IN: Attributes from the host
+{
+   unsigned int i;
+
+   ASSERT(fp);
+   ASSERT(attr);
+
+   mutex_enter(&fp->cacheMutex);
+
+   if (fp->cacheBlocks) {
+      Bool changed = !fp->cacheAttrIsSet ||
+                     fp->cacheSize != attr->size ||
+                     fp->cacheWriteTime != attr->writeTime;
+      clock_t now = ddi_get_lbolt();
+
+      if (changed) {
+         DEBUG(VM_DEBUG_INFO, "HgfsFileCacheCheckAttr: %s changed\n",
+               fp->fileName);
+      }
+      for (i = 0; i < HGFS_FILE_CACHE_BLOCKS; i++) {
+         if (changed) {
+            fp->cacheBlocks[i].length = 0;
+         } else if (fp->cacheBlocks[i].length) {
+            fp->cacheBlocks[i].filled = now;
+         }
+      }
+   }
+
+   fp->cacheSize = attr->size;
+   fp->cacheWriteTime = attr->writeTime;
+   fp->cacheAttrIsSet = TRUE;
+
+   mutex_exit(&fp->cacheMutex);
+}
+
+
 /*
  * Internal functions
  */
@@ -1190,6 +1418,11 @@ HgfsReleaseFile(HgfsFile *fp,           // IN: File to release
       DEBUG(VM_DEBUG_ALWAYS, "HgfsReleaseFile: freeing HgfsFile for %s.\n",
             fp->fileName);
 
+      if (fp->cacheBlocks) {
+         kmem_free(fp->cacheBlocks,
+                   HGFS_FILE_CACHE_BLOCKS * sizeof *fp->cacheBlocks);
+      }
+      mutex_destroy(&fp->cacheMutex);
       rw_destroy(&fp->rwlock);
       mutex_destroy(&fp->mutex);
       kmem_free(fp, sizeof *fp);
@@ -1267,6 +1500,9 @@ HgfsInitFile(HgfsFile *fp,              // IN: File to initialize
    rw_init(&fp->rwlock, NULL, RW_DRIVER, NULL);
    mutex_init(&fp->mutex, NULL, MUTEX_DRIVER, NULL);
 
+   /* The data cache is allocated on the first read. */
+   mutex_init(&fp->cacheMutex, NULL, MUTEX_DRIVER, NULL);
+
    /* The caller is the single reference. */
    fp->refCount = 1;
 
@@ -31,6 +31,7 @@
 #include <sys/rwlock.h>         /* krwlock_t */
 #include <sys/ksynch.h>         /* kmutex_t */
 #include <sys/vnode.h>          /* struct vnode */
+#include <sys/uio.h>            /* struct uio */
 
 #include "hgfsProto.h"
 #include "dbllnklst.h"
@@ -42,6 +43,13 @@
 /* Number of buckets for the HgfsInode hash table */
 #define HGFS_HT_NR_BUCKETS             5
 
+/*
+ * Number of HGFS_IO_MAX blocks of data cached per file, and how long they are
+ * trusted without hearing from the host.
+ */
+#define HGFS_FILE_CACHE_BLOCKS         16
+#define HGFS_FILE_CACHE_TTL_USEC       1000000
+
 /* Conversion between different state structures */
 #define HGFS_VP_TO_OFP(vp)      ((HgfsOpenFile *)(vp)->v_data)
 #define HGFS_VP_TO_FP(vp)       ((HgfsFile *)(HGFS_VP_TO_OFP(vp))->hgfsFile)
@@ -84,6 +92,17 @@
 
 typedef uint32_t HgfsMode;
 
+/*
+ * A block of file data read from the host.  The blocks are aligned on
+ * HGFS_IO_MAX, so a block shorter than that ends at the end of the file.
+ */
+typedef struct HgfsFileCacheBlock {
+   uint64_t offset;                     /* Offset of the data in the file */
+   uint32_t length;                     /* Bytes of data, 0 if unused */
+   clock_t filled;                      /* When the data was read (lbolt) */
+   char data[HGFS_IO_MAX];
+} HgfsFileCacheBlock;
+
 /*
  * State kept per shared file from the host.
  *
@@ -115,6 +134,17 @@ typedef struct HgfsFile {
    /* Lock to protect the reference count of this file state. */
    kmutex_t mutex;
    uint32_t refCount;
+   /*
+    * Data read from the host, shared by all open instances of the file and
+    * protected by cacheMutex.  The blocks are allocated on the first read.
+    * The size and write time last reported by the host are kept to notice
+    * changes made behind our back.
+    */
+   kmutex_t cacheMutex;
+   HgfsFileCacheBlock *cacheBlocks;
+   Bool cacheAttrIsSet;
+   uint64_t cacheSize;
+   uint64_t cacheWriteTime;
 } HgfsFile;
 
 
@@ -186,6 +216,14 @@ int HgfsSetOpenFileMode(struct vnode *vp, HgfsMode mode);
 int HgfsGetOpenFileMode(struct vnode *vp, HgfsMode *outMode);
 int HgfsClearOpenFileMode(struct vnode *vp);
 
+/* File data cache functions */
+int HgfsFileCacheRead(HgfsFile *fp, uint64_t offset, uint32_t size,
+                      struct uio *uiop, uint32_t *count);
+void HgfsFileCacheFill(HgfsFile *fp, uint64_t offset, const char *data,
+                       uint32_t length);
+void HgfsFileCacheInvalidate(HgfsFile *fp);
+void HgfsFileCacheCheckAttr(HgfsFile *fp, const HgfsAttr *attr);
+
 /* Debugging function */
 void HgfsDebugPrintFileHashTable(HgfsFileHashTable *htp, int level);
 
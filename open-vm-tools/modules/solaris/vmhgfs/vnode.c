@@ -85,8 +85,9 @@ static int HgfsDirClose(HgfsSuperInfo *sip, struct vnode *vp);
 static int HgfsFileClose(HgfsSuperInfo *sip, struct vnode *vp);
 static int HgfsGetNextDirEntry(HgfsSuperInfo *sip, HgfsHandle handle,
                                uint32_t offset, char *nameOut, Bool *done);
-static int HgfsDoRead(HgfsSuperInfo *sip, HgfsHandle handle, uint64_t offset,
-                      uint32_t size, uio_t *uiop, uint32_t *count);
+static int HgfsDoRead(HgfsSuperInfo *sip, HgfsFile *fp, HgfsHandle handle,
+                      uint64_t offset, uint32_t size, uio_t *uiop,
+                      uint32_t *count);
 static int HgfsDoWrite(HgfsSuperInfo *sip, HgfsHandle handle, int ioflag,
                        uint64_t offset, uint32_t size, uio_t *uiop,
                        uint32_t *count);
@@ -585,7 +586,8 @@ HgfsClose(struct vnode *vp,        // IN: Vnode of file that is being closed
  *
  *    We call HgfsDoRead() to fill the user's buffer until the request is met
  *    or the file has no more data.  This is done since we can only transfer
- *    HGFS_IO_MAX bytes in any one request.
+ *    HGFS_IO_MAX bytes in any one request.  Each call stays within one
+ *    HGFS_IO_MAX aligned block, which is what the file's data cache holds.
  *
  *    "Reads the range supplied for the given vnode.  vop_read() typically
  *    maps the requested range of a file into kernel memory and then uses
@@ -654,8 +656,8 @@ HgfsRead(struct vnode *vp,              // IN: Vnode of file to read
    }
 
    /*
-    * Here we loop around HgfsDoRead with requests less than or equal to
-    * HGFS_IO_MAX until one of the following conditions is met:
+    * Here we loop around HgfsDoRead with requests that do not cross a
+    * HGFS_IO_MAX boundary until one of the following conditions is met:
     *  (1) All the requested data has been read
     *  (2) The file has no more data
     *  (3) An error occurred
@@ -674,11 +676,15 @@ HgfsRead(struct vnode *vp,              // IN: Vnode of file to read
       DEBUG(VM_DEBUG_HANDLE, "%s: ** handle=%d, file=%s\n",
             __func__, handle, HGFS_VP_TO_FILENAME(vp));
 
-      /* Request at most HGFS_IO_MAX bytes */
-      size = (uiop->uio_resid > HGFS_IO_MAX) ? HGFS_IO_MAX : uiop->uio_resid;
+      /* Request at most up to the end of the block */
+      size = HGFS_IO_MAX - offset % HGFS_IO_MAX;
+      if (uiop->uio_resid < size) {
+         size = uiop->uio_resid;
+      }
 
-      /* Send one read request. */
-      ret = HgfsDoRead(sip, handle, offset, size, uiop, &count);
+      /* Read from the cache or send one read request. */
+      ret = HgfsDoRead(sip, HGFS_VP_TO_FP(vp), handle, offset, size, uiop,
+                       &count);
       if (ret) {
          DEBUG(VM_DEBUG_FAIL, "%s: HgfsDoRead() failed.\n", __func__);
          return ret;
@@ -775,6 +781,12 @@ HgfsWrite(struct vnode *vp,             // IN: Vnode of file to write to
       return EINVAL;
    }
 
+   /*
+    * Drop the cached data of the file.  Readers hold the file's rwlock as
+    * well, so none of them can cache the old data again while we write.
+    */
+   HgfsFileCacheInvalidate(HGFS_VP_TO_FP(vp));
+
    /*
     * We loop around calls to HgfsDoWrite() until either (1) we have written all
     * of our data or (2) an error has occurred.  uiop->uio_resid is decremented
@@ -1005,6 +1017,11 @@ HgfsGetattr(struct vnode *vp,      // IN: Vnode of file to get attributes for
          /* Map the Hgfs attributes into the Solaris attributes */
          HgfsAttrToSolaris(vp, &reply->attr, vap);
 
+         /* Drop the cached data if the file changed on the host */
+         if (vp->v_type == VREG) {
+            HgfsFileCacheCheckAttr(HGFS_VP_TO_FP(vp), &reply->attr);
+         }
+
          DEBUG(VM_DEBUG_DONE, "%s: done.\n", __func__);
       }
    }
@@ -1126,6 +1143,8 @@ HgfsSetattr(struct vnode *vp,       // IN: Vnode of file to get attributes for
       DEBUG(VM_DEBUG_FAIL, "%s: failed with error %d.\n",
             __func__, ret);
    } else {
+      /* The size or times may have changed */
+      HgfsFileCacheInvalidate(HGFS_VP_TO_FP(vp));
       DEBUG(VM_DEBUG_DONE, "%s: done.\n", __func__);
    }
 
@@ -1459,6 +1478,11 @@ HgfsLookup(struct vnode *dvp,      // IN:  Directory to look in
    /* HgfsVnodeGet guarantees this. */
    ASSERT(*vpp);
 
+   /* The file may be open already; see if it changed on the host. */
+   if (reply->attr.type == HGFS_FILE_TYPE_REGULAR) {
+      HgfsFileCacheCheckAttr(HGFS_VP_TO_FP(*vpp), &reply->attr);
+   }
+
    DEBUG(VM_DEBUG_LOAD, "HgfsLookup: assigned vnode %p to %s\n", *vpp, path);
 
    ret = 0;     /* Return success */
@@ -3793,6 +3817,11 @@ HgfsFileOpen(HgfsSuperInfo *sip,        // IN: Superinfo pointer
       goto out;
    }
 
+   /* The host truncated the file, so the cached data is gone */
+   if (flag & FTRUNC) {
+      HgfsFileCacheInvalidate(HGFS_VP_TO_FP(vp));
+   }
+
    DEBUG(VM_DEBUG_DONE, "%s: done.\n", __func__);
 
 out:
@@ -4120,11 +4149,13 @@ out:
  *
  * HgfsDoRead --
  *
- *    Sends a single READ request to the Hgfs server and writes the contents
- *    into the user's buffer if successful.
+ *    Copies data of a file into the user's buffer, from the file's data
+ *    cache if it has it, or else by sending a single READ request to the
+ *    Hgfs server for the whole HGFS_IO_MAX aligned block, which is then
+ *    cached.
  *
- *    This function is called repeatedly by HgfsRead() with requests of size
- *    less than or equal to HGFS_IO_MAX.
+ *    This function is called repeatedly by HgfsRead() with requests that do
+ *    not cross a HGFS_IO_MAX boundary.
  *
  * Results:
  *   Returns 0 on success and a positive value on error.
@@ -4138,6 +4169,7 @@ out:
 
 static int
 HgfsDoRead(HgfsSuperInfo *sip,  // IN: Superinfo pointer
+           HgfsFile *fp,        // IN: File to read from
            HgfsHandle handle,   // IN: Server's handle to read from
            uint64_t offset,     // IN: File offset to read at
            uint32_t size,       // IN: Number of bytes to read
@@ -4147,15 +4179,23 @@ HgfsDoRead(HgfsSuperInfo *sip,  // IN: Superinfo pointer
    HgfsReq *req;
    HgfsRequestRead *request;
    HgfsReplyRead *reply;
+   uint64_t blockOffset = offset - offset % HGFS_IO_MAX;
+   uint32_t delta = offset - blockOffset;
    int ret;
 
    ASSERT(sip);
+   ASSERT(fp);
    ASSERT(uiop);
-   ASSERT(size <= HGFS_IO_MAX); // HgfsRead() should guarantee this
+   ASSERT(delta + size <= HGFS_IO_MAX); // HgfsRead() should guarantee this
    ASSERT(count);
 
    DEBUG(VM_DEBUG_ENTRY, "%s: entry.\n", __func__);
 
+   ret = HgfsFileCacheRead(fp, offset, size, uiop, count);
+   if (ret != ENOENT) {
+      return ret;
+   }
+
    req = HgfsGetNewReq(sip);
    if (!req) {
       return EIO;
@@ -4166,8 +4206,8 @@ HgfsDoRead(HgfsSuperInfo *sip,  // IN: Superinfo pointer
 
    /* Indicate which file, where in the file, and how much to read. */
    request->file = handle;
-   request->offset = offset;
-   request->requiredSize = size;
+   request->offset = blockOffset;
+   request->requiredSize = HGFS_IO_MAX;
 
    req->packetSize = sizeof *request;
 
@@ -4195,11 +4235,13 @@ HgfsDoRead(HgfsSuperInfo *sip,  // IN: Superinfo pointer
 
    /*
     * Now perform checks on the actualSize.  There are three cases:
-    *  o actualSize is less than or equal to size, which indicates success
+    *  o actualSize is less than or equal to the block size, which indicates
+    *    success
     *  o actualSize is zero, which indicates the end of the file (and success)
-    *  o actualSize is greater than size, which indicates a server error
+    *  o actualSize is greater than the block size, which indicates a server
+    *    error
     */
-   if (reply->actualSize > size) {
+   if (reply->actualSize > HGFS_IO_MAX) {
       /* We got too much data: server error. */
       DEBUG(VM_DEBUG_FAIL, "%s: received too much data in payload.\n",
             __func__);
@@ -4207,9 +4249,13 @@ HgfsDoRead(HgfsSuperInfo *sip,  // IN: Superinfo pointer
       goto out;
    }
 
+   HgfsFileCacheFill(fp, blockOffset, reply->payload, reply->actualSize);
+
    /* Perform the copy to the user if we have something to copy */
-   if (reply->actualSize > 0) {
-      ret = uiomove(reply->payload, reply->actualSize, UIO_READ, uiop);
+   *count = delta < reply->actualSize ?
+            MIN(size, reply->actualSize - delta) : 0;
+   if (*count > 0) {
+      ret = uiomove(reply->payload + delta, *count, UIO_READ, uiop);
       if (ret) {
          DEBUG(VM_DEBUG_FAIL, "%s: uiomove failed, rc: %d\n.",
                __func__, ret);
@@ -4217,7 +4263,6 @@ HgfsDoRead(HgfsSuperInfo *sip,  // IN: Superinfo pointer
       }
    }
 
-   *count = reply->actualSize;
    DEBUG(VM_DEBUG_DONE, "%s: successfully read %d bytes to user.\n",
          __func__, *count);
 
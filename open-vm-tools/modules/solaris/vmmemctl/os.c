@@ -218,6 +218,29 @@ OS_ReservedPageGetLimit(void)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * OS_ReservedPageGetReclaimable --
+ *
+ *      Estimate how much memory the guest can give up without swapping.
+ *
+ * Results:
+ *      The free memory pages, which include the page cache free list.
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+unsigned long
+OS_ReservedPageGetReclaimable(void)
+{
+   return freemem;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
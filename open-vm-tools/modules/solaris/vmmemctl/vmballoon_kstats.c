@@ -43,6 +43,10 @@ typedef struct {
    kstat_named_t nPages;
    kstat_named_t rateAlloc;
    kstat_named_t rateFree;
+   kstat_named_t rateInflate;
+   kstat_named_t rateDeflate;
+   kstat_named_t nPagesReclaimable;
+   kstat_named_t nPagesInflateAllowance;
    kstat_named_t timer;
    kstat_named_t start;
    kstat_named_t startFail;
@@ -96,6 +100,10 @@ BalloonKstatUpdate(kstat_t *ksp, int rw)
    /* rate info */
    bkp->rateAlloc.value.ui32 = stats->rateAlloc;
    bkp->rateFree.value.ui32 = stats->rateFree;
+   bkp->rateInflate.value.ui32 = stats->rateInflate;
+   bkp->rateDeflate.value.ui32 = stats->rateDeflate;
+   bkp->nPagesReclaimable.value.ui32 = stats->nPagesReclaimable;
+   bkp->nPagesInflateAllowance.value.ui32 = stats->nPagesInflateAllowance;
 
    /* statistics */
    bkp->timer.value.ui32 = stats->timer;
@@ -141,6 +149,12 @@ BalloonKstatCreate(void)
    kstat_named_init(&bkp->nPages, "currentPages", KSTAT_DATA_UINT32);
    kstat_named_init(&bkp->rateAlloc, "rateAlloc", KSTAT_DATA_UINT32);
    kstat_named_init(&bkp->rateFree, "rateFree", KSTAT_DATA_UINT32);
+   kstat_named_init(&bkp->rateInflate, "rateInflate", KSTAT_DATA_UINT32);
+   kstat_named_init(&bkp->rateDeflate, "rateDeflate", KSTAT_DATA_UINT32);
+   kstat_named_init(&bkp->nPagesReclaimable, "reclaimablePages",
+                    KSTAT_DATA_UINT32);
+   kstat_named_init(&bkp->nPagesInflateAllowance, "inflateAllowancePages",
+                    KSTAT_DATA_UINT32);
    kstat_named_init(&bkp->timer, "timer", KSTAT_DATA_UINT32);
    kstat_named_init(&bkp->start, "start", KSTAT_DATA_UINT32);
    kstat_named_init(&bkp->startFail, "startFail", KSTAT_DATA_UINT32);
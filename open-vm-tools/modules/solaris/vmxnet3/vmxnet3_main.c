@@ -18,7 +18,6 @@
 
 /*
  * TODO:
- *    - Tx data ring
  *    - MAC_CAPAB_POLL support
  *    - JF support
  *    - Dynamic RX pool
@@ -97,8 +96,73 @@ static ddi_dma_attr_t vmxnet3_dma_attrs_tx = {
    0                      /* dma_attr_flags */
 };
 
+/*
+ * Default Toeplitz key of RSS, the one Windows uses
+ */
+static const uint8_t vmxnet3_rss_key[UPT1_RSS_MAX_KEY_SIZE] = {
+   0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+   0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+   0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+   0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+   0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
 /* --- */
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_sum_stats --
+ *
+ *    Add up the device statistics of all the queues of a vmxnet3 device.
+ *    The statistics must have been fetched with VMXNET3_CMD_GET_STATS.
+ *
+ * Results:
+ *    The totals in txTotal and rxTotal.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_sum_stats(vmxnet3_softc_t *dp,
+                  UPT1_TxStats *txTotal,
+                  UPT1_RxStats *rxTotal)
+{
+   unsigned int i;
+
+   memset(txTotal, 0, sizeof *txTotal);
+   memset(rxTotal, 0, sizeof *rxTotal);
+
+   for (i = 0; i < dp->numQueues; i++) {
+      Vmxnet3_TxQueueDesc *tqdesc = VMXNET3_TQDESC(dp, i);
+      Vmxnet3_RxQueueDesc *rqdesc = VMXNET3_RQDESC(dp, i);
+
+      txTotal->TSOPktsTxOK += tqdesc->stats.TSOPktsTxOK;
+      txTotal->TSOBytesTxOK += tqdesc->stats.TSOBytesTxOK;
+      txTotal->ucastPktsTxOK += tqdesc->stats.ucastPktsTxOK;
+      txTotal->ucastBytesTxOK += tqdesc->stats.ucastBytesTxOK;
+      txTotal->mcastPktsTxOK += tqdesc->stats.mcastPktsTxOK;
+      txTotal->mcastBytesTxOK += tqdesc->stats.mcastBytesTxOK;
+      txTotal->bcastPktsTxOK += tqdesc->stats.bcastPktsTxOK;
+      txTotal->bcastBytesTxOK += tqdesc->stats.bcastBytesTxOK;
+      txTotal->pktsTxError += tqdesc->stats.pktsTxError;
+      txTotal->pktsTxDiscard += tqdesc->stats.pktsTxDiscard;
+
+      rxTotal->LROPktsRxOK += rqdesc->stats.LROPktsRxOK;
+      rxTotal->LROBytesRxOK += rqdesc->stats.LROBytesRxOK;
+      rxTotal->ucastPktsRxOK += rqdesc->stats.ucastPktsRxOK;
+      rxTotal->ucastBytesRxOK += rqdesc->stats.ucastBytesRxOK;
+      rxTotal->mcastPktsRxOK += rqdesc->stats.mcastPktsRxOK;
+      rxTotal->mcastBytesRxOK += rqdesc->stats.mcastBytesRxOK;
+      rxTotal->bcastPktsRxOK += rqdesc->stats.bcastPktsRxOK;
+      rxTotal->bcastBytesRxOK += rqdesc->stats.bcastBytesRxOK;
+      rxTotal->pktsRxOutOfBuf += rqdesc->stats.pktsRxOutOfBuf;
+      rxTotal->pktsRxError += rqdesc->stats.pktsRxError;
+   }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -118,8 +182,8 @@ static int
 vmxnet3_getstat(void *data, uint_t stat, uint64_t *val)
 {
    vmxnet3_softc_t *dp = data;
-   UPT1_TxStats *txStats;
-   UPT1_RxStats *rxStats;
+   UPT1_TxStats txTotal, *txStats = &txTotal;
+   UPT1_RxStats rxTotal, *rxStats = &rxTotal;
 
    VMXNET3_DEBUG(dp, 3, "getstat(%u)\n", stat);
 
@@ -127,9 +191,6 @@ vmxnet3_getstat(void *data, uint_t stat, uint64_t *val)
       return DDI_FAILURE;
    }
 
-   txStats = &VMXNET3_TQDESC(dp)->stats;
-   rxStats = &VMXNET3_RQDESC(dp)->stats;
-
    /*
     * First touch the related register
     */
@@ -147,6 +208,7 @@ vmxnet3_getstat(void *data, uint_t stat, uint64_t *val)
       case MAC_STAT_OBYTES:
       case MAC_STAT_OPACKETS:
          VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_CMD, VMXNET3_CMD_GET_STATS);
+         vmxnet3_sum_stats(dp, txStats, rxStats);
          break;
       case MAC_STAT_IFSPEED:
       case MAC_STAT_COLLISIONS:
@@ -246,6 +308,7 @@ vmxnet3_prepare_drivershared(vmxnet3_softc_t *dp)
 {
    Vmxnet3_DriverShared *ds;
    size_t allocSize = sizeof(Vmxnet3_DriverShared);
+   unsigned int i;
 
    if (vmxnet3_alloc_dma_mem_1(dp, &dp->sharedData, allocSize,
                                B_TRUE) != DDI_SUCCESS) {
@@ -254,7 +317,8 @@ vmxnet3_prepare_drivershared(vmxnet3_softc_t *dp)
    ds = VMXNET3_DS(dp);
    memset(ds, 0, allocSize);
 
-   allocSize = sizeof(Vmxnet3_TxQueueDesc) + sizeof(Vmxnet3_RxQueueDesc);
+   allocSize = dp->numQueues *
+               (sizeof(Vmxnet3_TxQueueDesc) + sizeof(Vmxnet3_RxQueueDesc));
    if (vmxnet3_alloc_dma_mem_128(dp, &dp->queueDescs, allocSize,
                                  B_TRUE) != DDI_SUCCESS) {
       vmxnet3_free_dma_mem(&dp->sharedData);
@@ -279,20 +343,63 @@ vmxnet3_prepare_drivershared(vmxnet3_softc_t *dp)
    ds->devRead.misc.driverInfo.uptVerSpt = 1;
 
    ds->devRead.misc.uptFeatures = UPT1_F_RXCSUM;
+   if (dp->lroEnabled) {
+      ds->devRead.misc.uptFeatures |= UPT1_F_LRO;
+   }
    ds->devRead.misc.mtu = dp->cur_mtu;
 
    // XXX: ds->devRead.misc.maxNumRxSG
-   ds->devRead.misc.numTxQueues = 1;
-   ds->devRead.misc.numRxQueues = 1;
+   ds->devRead.misc.numTxQueues = dp->numQueues;
+   ds->devRead.misc.numRxQueues = dp->numQueues;
    ds->devRead.misc.queueDescPA = dp->queueDescs.bufPA;
    ds->devRead.misc.queueDescLen = allocSize;
 
    /* TxQueue and RxQueue information is filled in other functions */
 
    ds->devRead.intrConf.autoMask = (dp->intrMaskMode == VMXNET3_IMM_AUTO);
-   ds->devRead.intrConf.numIntrs = 1;
+   ds->devRead.intrConf.numIntrs = dp->intrCount;
    // XXX: ds->intr.modLevels
-   ds->devRead.intrConf.eventIntrIdx = 0;
+   ds->devRead.intrConf.eventIntrIdx = dp->intrCount - 1;
+
+   for (i = 0; i < dp->numQueues; i++) {
+      uint8_t intrIdx = dp->intrCount > 1 ? i : 0;
+
+      VMXNET3_TQDESC(dp, i)->conf.intrIdx = intrIdx;
+      VMXNET3_RQDESC(dp, i)->conf.intrIdx = intrIdx;
+   }
+
+   /*
+    * Spread the flows over the rx queues with RSS
+    */
+   if (dp->numQueues > 1) {
+      UPT1_RSSConf *rssConf;
+
+      if (vmxnet3_alloc_dma_mem_1(dp, &dp->rssConf, sizeof(UPT1_RSSConf),
+                                  B_TRUE) != DDI_SUCCESS) {
+         vmxnet3_free_dma_mem(&dp->queueDescs);
+         vmxnet3_free_dma_mem(&dp->sharedData);
+         return DDI_FAILURE;
+      }
+      rssConf = (UPT1_RSSConf *) dp->rssConf.buf;
+      memset(rssConf, 0, sizeof(UPT1_RSSConf));
+
+      rssConf->hashType = UPT1_RSS_HASH_TYPE_IPV4 |
+                          UPT1_RSS_HASH_TYPE_TCP_IPV4 |
+                          UPT1_RSS_HASH_TYPE_IPV6 |
+                          UPT1_RSS_HASH_TYPE_TCP_IPV6;
+      rssConf->hashFunc = UPT1_RSS_HASH_FUNC_TOEPLITZ;
+      rssConf->hashKeySize = UPT1_RSS_MAX_KEY_SIZE;
+      memcpy(rssConf->hashKey, vmxnet3_rss_key, UPT1_RSS_MAX_KEY_SIZE);
+      rssConf->indTableSize = VMXNET3_RSS_IND_TABLE_SIZE;
+      for (i = 0; i < VMXNET3_RSS_IND_TABLE_SIZE; i++) {
+         rssConf->indTable[i] = i % dp->numQueues;
+      }
+
+      ds->devRead.misc.uptFeatures |= UPT1_F_RSS;
+      ds->devRead.rssConfDesc.confVer = 1;
+      ds->devRead.rssConfDesc.confLen = sizeof(UPT1_RSSConf);
+      ds->devRead.rssConfDesc.confPA = dp->rssConf.bufPA;
+   }
 
    VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_DSAL, VMXNET3_ADDR_LO(dp->sharedData.bufPA));
    VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_DSAH, VMXNET3_ADDR_HI(dp->sharedData.bufPA));
@@ -321,6 +428,9 @@ vmxnet3_destroy_drivershared(vmxnet3_softc_t *dp)
    VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_DSAL, 0);
    VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_DSAH, 0);
 
+   if (dp->rssConf.buf) {
+      vmxnet3_free_dma_mem(&dp->rssConf);
+   }
    vmxnet3_free_dma_mem(&dp->queueDescs);
    vmxnet3_free_dma_mem(&dp->sharedData);
 }
@@ -393,7 +503,7 @@ vmxnet3_alloc_compring(vmxnet3_softc_t *dp, vmxnet3_compring_t *compRing)
  *
  * vmxnet3_prepare_txqueue --
  *
- *    Initialize the tx queue of a vmxnet3 device.
+ *    Initialize a tx queue of a vmxnet3 device.
  *
  * Results:
  *    DDI_SUCCESS or DDI_FAILURE.
@@ -404,10 +514,9 @@ vmxnet3_alloc_compring(vmxnet3_softc_t *dp, vmxnet3_compring_t *compRing)
  *---------------------------------------------------------------------------
  */
 static int
-vmxnet3_prepare_txqueue(vmxnet3_softc_t *dp)
+vmxnet3_prepare_txqueue(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
 {
-   Vmxnet3_TxQueueDesc *tqdesc = VMXNET3_TQDESC(dp);
-   vmxnet3_txqueue_t *txq = &dp->txQueue;
+   Vmxnet3_TxQueueDesc *tqdesc = VMXNET3_TQDESC(dp, txq->qid);
 
    ASSERT(!(txq->cmdRing.size & VMXNET3_RING_SIZE_MASK));
    ASSERT(!(txq->compRing.size & VMXNET3_RING_SIZE_MASK));
@@ -418,12 +527,22 @@ vmxnet3_prepare_txqueue(vmxnet3_softc_t *dp)
    }
    tqdesc->conf.txRingBasePA = txq->cmdRing.dma.bufPA;
    tqdesc->conf.txRingSize = txq->cmdRing.size;
-   tqdesc->conf.dataRingBasePA = 0;
-   tqdesc->conf.dataRingSize = 0;
 
-   if (vmxnet3_alloc_compring(dp, &txq->compRing) != DDI_SUCCESS) {
+   /*
+    * The data ring has one pre-mapped buffer per command descriptor,
+    * for the msgs small enough to be copied
+    */
+   if (vmxnet3_alloc_dma_mem_128(dp, &txq->dataRing,
+                                 txq->cmdRing.size*sizeof(Vmxnet3_TxDataDesc),
+                                 B_TRUE) != DDI_SUCCESS) {
       goto error_cmdring;
    }
+   tqdesc->conf.dataRingBasePA = txq->dataRing.bufPA;
+   tqdesc->conf.dataRingSize = txq->cmdRing.size;
+
+   if (vmxnet3_alloc_compring(dp, &txq->compRing) != DDI_SUCCESS) {
+      goto error_dataring;
+   }
    tqdesc->conf.compRingBasePA = txq->compRing.dma.bufPA;
    tqdesc->conf.compRingSize = txq->compRing.size;
 
@@ -435,11 +554,24 @@ vmxnet3_prepare_txqueue(vmxnet3_softc_t *dp)
       goto error_mpring;
    }
 
+   /*
+    * Allocate the Tx DMA handle
+    */
+   if (ddi_dma_alloc_handle(dp->dip, &vmxnet3_dma_attrs_tx, DDI_DMA_SLEEP,
+                            NULL, &txq->dmaHandle) != DDI_SUCCESS) {
+      VMXNET3_WARN(dp, "ddi_dma_alloc_handle() failed\n");
+      goto error_txqueue;
+   }
+
    return DDI_SUCCESS;
 
+error_txqueue:
+   vmxnet3_txqueue_fini(dp, txq);
 error_mpring:
    kmem_free(txq->metaRing, txq->cmdRing.size*sizeof(vmxnet3_metatx_t));
    vmxnet3_free_dma_mem(&txq->compRing.dma);
+error_dataring:
+   vmxnet3_free_dma_mem(&txq->dataRing);
 error_cmdring:
    vmxnet3_free_dma_mem(&txq->cmdRing.dma);
 error:
@@ -451,7 +583,7 @@ error:
  *
  * vmxnet3_prepare_rxqueue --
  *
- *    Initialize the rx queue of a vmxnet3 device.
+ *    Initialize a rx queue of a vmxnet3 device.
  *
  * Results:
  *    DDI_SUCCESS or DDI_FAILURE.
@@ -462,12 +594,12 @@ error:
  *---------------------------------------------------------------------------
  */
 static int
-vmxnet3_prepare_rxqueue(vmxnet3_softc_t *dp)
+vmxnet3_prepare_rxqueue(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
 {
-   Vmxnet3_RxQueueDesc *rqdesc = VMXNET3_RQDESC(dp);
-   vmxnet3_rxqueue_t *rxq = &dp->rxQueue;
+   Vmxnet3_RxQueueDesc *rqdesc = VMXNET3_RQDESC(dp, rxq->qid);
 
    ASSERT(!(rxq->cmdRing.size & VMXNET3_RING_SIZE_MASK));
+   ASSERT(!(rxq->bodyRing.size & VMXNET3_RING_SIZE_MASK));
    ASSERT(!(rxq->compRing.size & VMXNET3_RING_SIZE_MASK));
    ASSERT(!rxq->cmdRing.dma.buf && !rxq->compRing.dma.buf);
 
@@ -479,8 +611,16 @@ vmxnet3_prepare_rxqueue(vmxnet3_softc_t *dp)
    rqdesc->conf.rxRingBasePA[1] = 0;
    rqdesc->conf.rxRingSize[1] = 0;
 
+   if (rxq->bodyRing.size) {
+      if (vmxnet3_alloc_cmdring(dp, &rxq->bodyRing) != DDI_SUCCESS) {
+         goto error_cmdring;
+      }
+      rqdesc->conf.rxRingBasePA[1] = rxq->bodyRing.dma.bufPA;
+      rqdesc->conf.rxRingSize[1] = rxq->bodyRing.size;
+   }
+
    if (vmxnet3_alloc_compring(dp, &rxq->compRing) != DDI_SUCCESS) {
-      goto error_cmdring;
+      goto error_bodyring;
    }
    rqdesc->conf.compRingBasePA = rxq->compRing.dma.bufPA;
    rqdesc->conf.compRingSize = rxq->compRing.size;
@@ -488,6 +628,11 @@ vmxnet3_prepare_rxqueue(vmxnet3_softc_t *dp)
    rxq->bufRing = kmem_zalloc(rxq->cmdRing.size*sizeof(vmxnet3_bufdesc_t),
                               KM_SLEEP);
    ASSERT(rxq->bufRing);
+   if (rxq->bodyRing.size) {
+      rxq->bodyBufRing =
+         kmem_zalloc(rxq->bodyRing.size*sizeof(vmxnet3_bufdesc_t), KM_SLEEP);
+      ASSERT(rxq->bodyBufRing);
+   }
 
    if (vmxnet3_rxqueue_init(dp, rxq) != DDI_SUCCESS) {
       goto error_bufring;
@@ -496,8 +641,16 @@ vmxnet3_prepare_rxqueue(vmxnet3_softc_t *dp)
    return DDI_SUCCESS;
 
 error_bufring:
+   if (rxq->bodyRing.size) {
+      kmem_free(rxq->bodyBufRing,
+                rxq->bodyRing.size*sizeof(vmxnet3_bufdesc_t));
+   }
    kmem_free(rxq->bufRing, rxq->cmdRing.size*sizeof(vmxnet3_bufdesc_t));
    vmxnet3_free_dma_mem(&rxq->compRing.dma);
+error_bodyring:
+   if (rxq->bodyRing.size) {
+      vmxnet3_free_dma_mem(&rxq->bodyRing.dma);
+   }
 error_cmdring:
    vmxnet3_free_dma_mem(&rxq->cmdRing.dma);
 error:
@@ -509,7 +662,7 @@ error:
  *
  * vmxnet3_destroy_txqueue --
  *
- *    Destroy the tx queue of a vmxnet3 device.
+ *    Destroy a tx queue of a vmxnet3 device.
  *
  * Results:
  *    None.
@@ -520,18 +673,19 @@ error:
  *---------------------------------------------------------------------------
  */
 static void
-vmxnet3_destroy_txqueue(vmxnet3_softc_t *dp)
+vmxnet3_destroy_txqueue(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
 {
-   vmxnet3_txqueue_t *txq = &dp->txQueue;
-
    ASSERT(txq->metaRing);
    ASSERT(txq->cmdRing.dma.buf && txq->compRing.dma.buf);
 
+   ddi_dma_free_handle(&txq->dmaHandle);
+
    vmxnet3_txqueue_fini(dp, txq);
 
    kmem_free(txq->metaRing, txq->cmdRing.size*sizeof(vmxnet3_metatx_t));
 
    vmxnet3_free_dma_mem(&txq->cmdRing.dma);
+   vmxnet3_free_dma_mem(&txq->dataRing);
    vmxnet3_free_dma_mem(&txq->compRing.dma);
 }
 
@@ -540,7 +694,7 @@ vmxnet3_destroy_txqueue(vmxnet3_softc_t *dp)
  *
  * vmxnet3_destroy_rxqueue --
  *
- *    Destroy the rx queue of a vmxnet3 device.
+ *    Destroy a rx queue of a vmxnet3 device.
  *
  * Results:
  *    None.
@@ -551,16 +705,19 @@ vmxnet3_destroy_txqueue(vmxnet3_softc_t *dp)
  *---------------------------------------------------------------------------
  */
 static void
-vmxnet3_destroy_rxqueue(vmxnet3_softc_t *dp)
+vmxnet3_destroy_rxqueue(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
 {
-   vmxnet3_rxqueue_t *rxq = &dp->rxQueue;
-
    ASSERT(rxq->bufRing);
    ASSERT(rxq->cmdRing.dma.buf && rxq->compRing.dma.buf);
 
    vmxnet3_rxqueue_fini(dp, rxq);
 
    kmem_free(rxq->bufRing, rxq->cmdRing.size*sizeof(vmxnet3_bufdesc_t));
+   if (rxq->bodyRing.size) {
+      kmem_free(rxq->bodyBufRing,
+                rxq->bodyRing.size*sizeof(vmxnet3_bufdesc_t));
+      vmxnet3_free_dma_mem(&rxq->bodyRing.dma);
+   }
 
    vmxnet3_free_dma_mem(&rxq->cmdRing.dma);
    vmxnet3_free_dma_mem(&rxq->compRing.dma);
@@ -641,13 +798,29 @@ static int
 vmxnet3_start(void *data)
 {
    vmxnet3_softc_t *dp = data;
-   Vmxnet3_TxQueueDesc *tqdesc;
-   Vmxnet3_RxQueueDesc *rqdesc;
    int txQueueSize, rxQueueSize;
+   unsigned int i, txReady = 0, rxReady = 0;
    uint32_t ret32;
 
    VMXNET3_DEBUG(dp, 1, "start()\n");
 
+   txQueueSize = vmxnet3_getprop(dp, "TxRingSize", 32, 4096,
+                                 VMXNET3_DEF_TX_RING_SIZE);
+   if (txQueueSize & VMXNET3_RING_SIZE_MASK) {
+      VMXNET3_WARN(dp, "invalid tx ring size (%d)\n", txQueueSize);
+      goto error;
+   }
+   rxQueueSize = vmxnet3_getprop(dp, "RxRingSize", 32, 4096,
+                                 VMXNET3_DEF_RX_RING_SIZE);
+   if (rxQueueSize & VMXNET3_RING_SIZE_MASK) {
+      VMXNET3_WARN(dp, "invalid rx ring size (%d)\n", rxQueueSize);
+      goto error;
+   }
+   dp->lroEnabled = vmxnet3_getprop(dp, "EnableLRO", 0, 1, 0);
+   dp->txCopyThreshold = vmxnet3_getprop(dp, "TxCopyThreshold", 0,
+                                         VMXNET3_HDR_COPY_SIZE,
+                                         VMXNET3_HDR_COPY_SIZE);
+
    /*
     * Allocate vmxnet3's shared data and advertise its PA
     */
@@ -655,52 +828,37 @@ vmxnet3_start(void *data)
       VMXNET3_WARN(dp, "vmxnet3_prepare_drivershared() failed\n");
       goto error;
    }
-   tqdesc = VMXNET3_TQDESC(dp);
-   rqdesc = VMXNET3_RQDESC(dp);
 
    /*
-    * Create and initialize the tx queue
+    * Create and initialize the tx queues
     */
-   txQueueSize = vmxnet3_getprop(dp, "TxRingSize", 32, 4096,
-                                 VMXNET3_DEF_TX_RING_SIZE);
-   if (!(txQueueSize & VMXNET3_RING_SIZE_MASK)) {
-      dp->txQueue.cmdRing.size = txQueueSize;
-      dp->txQueue.compRing.size = txQueueSize;
-      dp->txQueue.sharedCtrl = &tqdesc->ctrl;
-      if (vmxnet3_prepare_txqueue(dp) != DDI_SUCCESS) {
+   for (; txReady < dp->numQueues; txReady++) {
+      vmxnet3_txqueue_t *txq = &dp->txQueue[txReady];
+
+      txq->cmdRing.size = txQueueSize;
+      txq->compRing.size = txQueueSize;
+      txq->sharedCtrl = &VMXNET3_TQDESC(dp, txReady)->ctrl;
+      if (vmxnet3_prepare_txqueue(dp, txq) != DDI_SUCCESS) {
          VMXNET3_WARN(dp, "vmxnet3_prepare_txqueue() failed\n");
-         goto error_shared_data;
+         goto error_queues;
       }
-   } else {
-      VMXNET3_WARN(dp, "invalid tx ring size (%d)\n", txQueueSize);
-      goto error_shared_data;
    }
 
    /*
-    * Create and initialize the rx queue
+    * Create and initialize the rx queues. With LRO the packets continue
+    * in the body ring.
     */
-   rxQueueSize = vmxnet3_getprop(dp, "RxRingSize", 32, 4096,
-                                 VMXNET3_DEF_RX_RING_SIZE);
-   if (!(rxQueueSize & VMXNET3_RING_SIZE_MASK)) {
-      dp->rxQueue.cmdRing.size = rxQueueSize;
-      dp->rxQueue.compRing.size = rxQueueSize;
-      dp->rxQueue.sharedCtrl = &rqdesc->ctrl;
-      if (vmxnet3_prepare_rxqueue(dp) != DDI_SUCCESS) {
+   for (; rxReady < dp->numQueues; rxReady++) {
+      vmxnet3_rxqueue_t *rxq = &dp->rxQueue[rxReady];
+
+      rxq->cmdRing.size = rxQueueSize;
+      rxq->bodyRing.size = dp->lroEnabled ? rxQueueSize : 0;
+      rxq->compRing.size = rxq->cmdRing.size + rxq->bodyRing.size;
+      rxq->sharedCtrl = &VMXNET3_RQDESC(dp, rxReady)->ctrl;
+      if (vmxnet3_prepare_rxqueue(dp, rxq) != DDI_SUCCESS) {
          VMXNET3_WARN(dp, "vmxnet3_prepare_rxqueue() failed\n");
-         goto error_tx_queue;
+         goto error_queues;
       }
-   } else {
-      VMXNET3_WARN(dp, "invalid rx ring size (%d)\n", rxQueueSize);
-      goto error_tx_queue;
-   }
-
-   /*
-    * Allocate the Tx DMA handle
-    */
-   if (ddi_dma_alloc_handle(dp->dip, &vmxnet3_dma_attrs_tx, DDI_DMA_SLEEP,
-                            NULL, &dp->txDmaHandle) != DDI_SUCCESS) {
-      VMXNET3_WARN(dp, "ddi_dma_alloc_handle() failed\n");
-      goto error_rx_queue;
    }
 
    /*
@@ -710,11 +868,20 @@ vmxnet3_start(void *data)
    ret32 = VMXNET3_BAR1_GET32(dp, VMXNET3_REG_CMD);
    if (ret32) {
       VMXNET3_WARN(dp, "ACTIVATE_DEV failed: 0x%x\n", ret32);
-      goto error_txhandle;
+      goto error_queues;
    }
    dp->devEnabled = B_TRUE;
 
-   VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_RXPROD, dp->txQueue.cmdRing.size - 1);
+   for (i = 0; i < dp->numQueues; i++) {
+      vmxnet3_rxqueue_t *rxq = &dp->rxQueue[i];
+
+      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_RXPROD_IDX(i),
+                         rxq->cmdRing.size - 1);
+      if (rxq->bodyRing.size) {
+         VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_RXPROD2_IDX(i),
+                            rxq->bodyRing.size - 1);
+      }
+   }
 
    /*
     * Update the RX filters, must be done after ACTIVATE_DEV
@@ -729,19 +896,21 @@ vmxnet3_start(void *data)
    mac_link_update(dp->mac, dp->linkState);
 
    /*
-    * Finally, unmask the interrupt
+    * Finally, unmask the interrupts
     */
-   VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR, 0);
+   for (i = 0; i < dp->intrCount; i++) {
+      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR_IDX(i), 0);
+   }
 
    return DDI_SUCCESS;
 
-error_txhandle:
-   ddi_dma_free_handle(&dp->txDmaHandle);
-error_rx_queue:
-   vmxnet3_destroy_rxqueue(dp);
-error_tx_queue:
-   vmxnet3_destroy_txqueue(dp);
-error_shared_data:
+error_queues:
+   while (rxReady) {
+      vmxnet3_destroy_rxqueue(dp, &dp->rxQueue[--rxReady]);
+   }
+   while (txReady) {
+      vmxnet3_destroy_txqueue(dp, &dp->txQueue[--txReady]);
+   }
    vmxnet3_destroy_drivershared(dp);
 error:
    return DDI_FAILURE;
@@ -767,27 +936,40 @@ static void
 vmxnet3_stop(void *data)
 {
    vmxnet3_softc_t *dp = data;
+   unsigned int i;
 
    VMXNET3_DEBUG(dp, 1, "stop()\n");
 
    /*
-    * Take the 3 locks related to asynchronous events.
+    * Take the locks related to asynchronous events.
     * These events should always check dp->devEnabled before poking dp.
     */
    mutex_enter(&dp->intrLock);
+   for (i = 0; i < dp->numQueues; i++) {
+      mutex_enter(&dp->rxQueue[i].lock);
+   }
    mutex_enter(&dp->rxPoolLock);
-   mutex_enter(&dp->txLock);
-   VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR, 1);
+   for (i = 0; i < dp->numQueues; i++) {
+      mutex_enter(&dp->txQueue[i].lock);
+   }
+   for (i = 0; i < dp->intrCount; i++) {
+      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR_IDX(i), 1);
+   }
    dp->devEnabled = B_FALSE;
    VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_CMD, VMXNET3_CMD_QUIESCE_DEV);
-   mutex_exit(&dp->txLock);
+   for (i = dp->numQueues; i > 0; i--) {
+      mutex_exit(&dp->txQueue[i - 1].lock);
+   }
    mutex_exit(&dp->rxPoolLock);
+   for (i = dp->numQueues; i > 0; i--) {
+      mutex_exit(&dp->rxQueue[i - 1].lock);
+   }
    mutex_exit(&dp->intrLock);
 
-   ddi_dma_free_handle(&dp->txDmaHandle);
-
-   vmxnet3_destroy_rxqueue(dp);
-   vmxnet3_destroy_txqueue(dp);
+   for (i = 0; i < dp->numQueues; i++) {
+      vmxnet3_destroy_rxqueue(dp, &dp->rxQueue[i]);
+      vmxnet3_destroy_txqueue(dp, &dp->txQueue[i]);
+   }
 
    vmxnet3_destroy_drivershared(dp);
 }
@@ -1316,15 +1498,19 @@ vmxnet3_intr_events(vmxnet3_softc_t *dp)
    if (events) {
       VMXNET3_DEBUG(dp, 2, "events(0x%x)\n", events);
       if (events & (VMXNET3_ECR_RQERR | VMXNET3_ECR_TQERR)) {
-         Vmxnet3_TxQueueDesc *tqdesc = VMXNET3_TQDESC(dp);
-         Vmxnet3_RxQueueDesc *rqdesc = VMXNET3_RQDESC(dp);
+         unsigned int i;
 
          VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_CMD, VMXNET3_CMD_GET_QUEUE_STATUS);
-         if (tqdesc->status.stopped) {
-            VMXNET3_WARN(dp, "tq error 0x%x\n", tqdesc->status.error);
-         }
-         if (rqdesc->status.stopped) {
-            VMXNET3_WARN(dp, "rq error 0x%x\n", rqdesc->status.error);
+         for (i = 0; i < dp->numQueues; i++) {
+            Vmxnet3_TxQueueDesc *tqdesc = VMXNET3_TQDESC(dp, i);
+            Vmxnet3_RxQueueDesc *rqdesc = VMXNET3_RQDESC(dp, i);
+
+            if (tqdesc->status.stopped) {
+               VMXNET3_WARN(dp, "tq%u error 0x%x\n", i, tqdesc->status.error);
+            }
+            if (rqdesc->status.stopped) {
+               VMXNET3_WARN(dp, "rq%u error 0x%x\n", i, rqdesc->status.error);
+            }
          }
 
          if (ddi_taskq_dispatch(dp->resetTask, vmxnet3_reset,
@@ -1352,7 +1538,7 @@ vmxnet3_intr_events(vmxnet3_softc_t *dp)
  *
  * vmxnet3_intr --
  *
- *    Interrupt handler of a vmxnet3 device.
+ *    Interrupt handler of a vmxnet3 device using a single vector.
  *
  * Results:
  *    DDI_INTR_CLAIMED or DDI_INTR_UNCLAIMED.
@@ -1366,9 +1552,12 @@ static u_int
 vmxnet3_intr(caddr_t data1, caddr_t data2)
 {
    vmxnet3_softc_t *dp = (void *) data1;
+   vmxnet3_rxqueue_t *rxq = &dp->rxQueue[0];
 
    VMXNET3_DEBUG(dp, 3, "intr()\n");
 
+   ASSERT(dp->numQueues == 1);
+
    mutex_enter(&dp->intrLock);
 
    if (dp->devEnabled) {
@@ -1386,8 +1575,10 @@ vmxnet3_intr(caddr_t data1, caddr_t data2)
       }
 
       linkStateChanged = vmxnet3_intr_events(dp);
-      mustUpdateTx = vmxnet3_tx_complete(dp, &dp->txQueue);
-      mps = vmxnet3_rx_intr(dp, &dp->rxQueue);
+      mustUpdateTx = vmxnet3_tx_complete(dp, &dp->txQueue[0]);
+      mutex_enter(&rxq->lock);
+      mps = vmxnet3_rx_intr(dp, rxq);
+      mutex_exit(&rxq->lock);
 
       mutex_exit(&dp->intrLock);
       VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR, 0);
@@ -1410,6 +1601,636 @@ intr_unclaimed:
    return DDI_INTR_UNCLAIMED;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_intr_queue --
+ *
+ *    MSI-X handler of a pair of tx and rx queues of a vmxnet3 device,
+ *    data2 being their index.
+ *
+ * Results:
+ *    DDI_INTR_CLAIMED or DDI_INTR_UNCLAIMED.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static u_int
+vmxnet3_intr_queue(caddr_t data1, caddr_t data2)
+{
+   vmxnet3_softc_t *dp = (void *) data1;
+   unsigned int idx = (uintptr_t) data2;
+   vmxnet3_rxqueue_t *rxq = &dp->rxQueue[idx];
+   boolean_t mustUpdateTx;
+   mblk_t *mps;
+
+   VMXNET3_DEBUG(dp, 3, "intr_queue(%u)\n", idx);
+
+   mutex_enter(&rxq->lock);
+
+   if (!dp->devEnabled) {
+      mutex_exit(&rxq->lock);
+      return DDI_INTR_UNCLAIMED;
+   }
+
+   if (dp->intrMaskMode == VMXNET3_IMM_ACTIVE) {
+      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR_IDX(idx), 1);
+   }
+
+   mustUpdateTx = vmxnet3_tx_complete(dp, &dp->txQueue[idx]);
+   mps = vmxnet3_rx_intr(dp, rxq);
+
+   mutex_exit(&rxq->lock);
+   VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR_IDX(idx), 0);
+
+   if (mustUpdateTx) {
+      mac_tx_update(dp->mac);
+   }
+   if (mps) {
+      mac_rx(dp->mac, NULL, mps);
+   }
+
+   return DDI_INTR_CLAIMED;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_intr_event --
+ *
+ *    MSI-X handler of the events of a vmxnet3 device.
+ *
+ * Results:
+ *    DDI_INTR_CLAIMED or DDI_INTR_UNCLAIMED.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static u_int
+vmxnet3_intr_event(caddr_t data1, caddr_t data2)
+{
+   vmxnet3_softc_t *dp = (void *) data1;
+   unsigned int idx = dp->intrCount - 1;
+   boolean_t linkStateChanged;
+
+   VMXNET3_DEBUG(dp, 3, "intr_event()\n");
+
+   mutex_enter(&dp->intrLock);
+
+   if (!dp->devEnabled) {
+      mutex_exit(&dp->intrLock);
+      return DDI_INTR_UNCLAIMED;
+   }
+
+   if (dp->intrMaskMode == VMXNET3_IMM_ACTIVE) {
+      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR_IDX(idx), 1);
+   }
+
+   linkStateChanged = vmxnet3_intr_events(dp);
+
+   mutex_exit(&dp->intrLock);
+   VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_IMR_IDX(idx), 0);
+
+   if (linkStateChanged) {
+      mac_link_update(dp->mac, dp->linkState);
+   }
+
+   return DDI_INTR_CLAIMED;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_alloc_intrs --
+ *
+ *    Allocate the interrupts of a vmxnet3 device and decide how many
+ *    queues it uses: with MSI-X, one vector per pair of queues plus one
+ *    for the events, as many as the "NumQueues" property, the CPUs and
+ *    the vectors allow. Otherwise, one vector and one pair of queues.
+ *
+ * Results:
+ *    DDI_SUCCESS or DDI_FAILURE.
+ *
+ * Side effects:
+ *    Sets intrType, intrCount and numQueues.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+vmxnet3_alloc_intrs(vmxnet3_softc_t *dp, uint32_t confIntr)
+{
+   int maxQueues = vmxnet3_getprop(dp, "NumQueues", 1, VMXNET3_MAX_QUEUES,
+                                   MIN(ncpus, VMXNET3_MAX_QUEUES));
+   int count, err;
+
+   switch (confIntr & 0x3) {
+      case VMXNET3_IT_AUTO:
+      case VMXNET3_IT_MSIX:
+         dp->intrType = DDI_INTR_TYPE_MSIX;
+         maxQueues = MIN(maxQueues, ncpus);
+         err = ddi_intr_alloc(dp->dip, dp->intrHandles, dp->intrType, 0,
+                              maxQueues > 1 ? maxQueues + 1 : 1,
+                              &count, DDI_INTR_ALLOC_NORMAL);
+         if (err == DDI_SUCCESS) {
+            break;
+         }
+         VMXNET3_DEBUG(dp, 2, "DDI_INTR_TYPE_MSIX failed, err:%d\n", err);
+      case VMXNET3_IT_MSI:
+         dp->intrType = DDI_INTR_TYPE_MSI;
+         if (ddi_intr_alloc(dp->dip, dp->intrHandles, dp->intrType, 0, 1,
+                            &count, DDI_INTR_ALLOC_STRICT) == DDI_SUCCESS)
+            break;
+         VMXNET3_DEBUG(dp, 2, "DDI_INTR_TYPE_MSI failed\n");
+      case VMXNET3_IT_INTX:
+         dp->intrType = DDI_INTR_TYPE_FIXED;
+         if (ddi_intr_alloc(dp->dip, dp->intrHandles, dp->intrType, 0, 1,
+                            &count, DDI_INTR_ALLOC_STRICT) == DDI_SUCCESS) {
+            break;
+         }
+         VMXNET3_DEBUG(dp, 2, "DDI_INTR_TYPE_INTX failed\n");
+      default:
+         VMXNET3_WARN(dp, "ddi_intr_alloc() failed\n");
+         return DDI_FAILURE;
+   }
+
+   /*
+    * Less vectors than asked for may have been granted. Two are the
+    * minimum for separate queue and event vectors.
+    */
+   if (count > 1) {
+      dp->numQueues = count - 1;
+   } else {
+      dp->numQueues = 1;
+   }
+   dp->intrCount = count;
+
+   VMXNET3_DEBUG(dp, 2, "%d interrupt(s), %u queue(s)\n",
+                 dp->intrCount, dp->numQueues);
+
+   return DDI_SUCCESS;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_free_intrs --
+ *
+ *    Free the interrupts of a vmxnet3 device.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_free_intrs(vmxnet3_softc_t *dp)
+{
+   int i;
+
+   for (i = 0; i < dp->intrCount; i++) {
+      ddi_intr_free(dp->intrHandles[i]);
+   }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_add_intr_handlers --
+ *
+ *    Attach the handlers of the interrupts of a vmxnet3 device.
+ *
+ * Results:
+ *    DDI_SUCCESS or DDI_FAILURE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+vmxnet3_add_intr_handlers(vmxnet3_softc_t *dp)
+{
+   int i;
+
+   if (dp->intrCount == 1) {
+      return ddi_intr_add_handler(dp->intrHandles[0], vmxnet3_intr,
+                                  dp, NULL);
+   }
+
+   for (i = 0; i < dp->intrCount; i++) {
+      int ret;
+
+      if (i < dp->numQueues) {
+         ret = ddi_intr_add_handler(dp->intrHandles[i], vmxnet3_intr_queue,
+                                    dp, (void *) (uintptr_t) i);
+      } else {
+         ret = ddi_intr_add_handler(dp->intrHandles[i], vmxnet3_intr_event,
+                                    dp, NULL);
+      }
+      if (ret != DDI_SUCCESS) {
+         while (i) {
+            ddi_intr_remove_handler(dp->intrHandles[--i]);
+         }
+         return DDI_FAILURE;
+      }
+   }
+
+   return DDI_SUCCESS;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_remove_intr_handlers --
+ *
+ *    Detach the handlers of the interrupts of a vmxnet3 device.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_remove_intr_handlers(vmxnet3_softc_t *dp)
+{
+   int i;
+
+   for (i = 0; i < dp->intrCount; i++) {
+      ddi_intr_remove_handler(dp->intrHandles[i]);
+   }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_enable_intrs --
+ *
+ *    Enable (or disable) the interrupts of a vmxnet3 device.
+ *
+ * Results:
+ *    DDI_SUCCESS or DDI_FAILURE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+vmxnet3_enable_intrs(vmxnet3_softc_t *dp, boolean_t enable)
+{
+   int i, err;
+
+   if (dp->intrCap & DDI_INTR_FLAG_BLOCK) {
+      if (enable) {
+         err = ddi_intr_block_enable(dp->intrHandles, dp->intrCount);
+      } else {
+         err = ddi_intr_block_disable(dp->intrHandles, dp->intrCount);
+      }
+      if (err != DDI_SUCCESS) {
+         VMXNET3_WARN(dp, "ddi_intr_block_%sable() failed, err:%d\n",
+                      enable ? "en" : "dis", err);
+         return DDI_FAILURE;
+      }
+      return DDI_SUCCESS;
+   }
+
+   for (i = 0; i < dp->intrCount; i++) {
+      if (enable) {
+         err = ddi_intr_enable(dp->intrHandles[i]);
+      } else {
+         err = ddi_intr_disable(dp->intrHandles[i]);
+      }
+      if (err != DDI_SUCCESS) {
+         VMXNET3_WARN(dp, "ddi_intr_%sable() failed, err:%d\n",
+                      enable ? "en" : "dis", err);
+         while (enable && i) {
+            ddi_intr_disable(dp->intrHandles[--i]);
+         }
+         return DDI_FAILURE;
+      }
+   }
+
+   return DDI_SUCCESS;
+}
+
+
+/*
+ * Per-queue statistics, as kstats: "kstat -m vmxnet3s -n txq0" shows those
+ * of the first tx queue. They mix the counters of the driver with those of
+ * the device, the latter being only refreshed while the device is started.
+ */
+typedef struct vmxnet3_txq_kstats_t {
+   /* Driver */
+   kstat_named_t packets;
+   kstat_named_t bytes;
+   kstat_named_t ringFull;
+   kstat_named_t pullups;
+   kstat_named_t copied;
+   kstat_named_t drops;
+   /* Device */
+   kstat_named_t tsoPktsTxOK;
+   kstat_named_t tsoBytesTxOK;
+   kstat_named_t ucastPktsTxOK;
+   kstat_named_t mcastPktsTxOK;
+   kstat_named_t bcastPktsTxOK;
+   kstat_named_t pktsTxError;
+   kstat_named_t pktsTxDiscard;
+} vmxnet3_txq_kstats_t;
+
+typedef struct vmxnet3_rxq_kstats_t {
+   /* Driver */
+   kstat_named_t packets;
+   kstat_named_t bytes;
+   kstat_named_t noBuf;
+   kstat_named_t errors;
+   /* Device */
+   kstat_named_t lroPktsRxOK;
+   kstat_named_t lroBytesRxOK;
+   kstat_named_t ucastPktsRxOK;
+   kstat_named_t mcastPktsRxOK;
+   kstat_named_t bcastPktsRxOK;
+   kstat_named_t pktsRxOutOfBuf;
+   kstat_named_t pktsRxError;
+} vmxnet3_rxq_kstats_t;
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_txq_kstats_update --
+ *
+ *    Refresh the kstats of a tx queue.
+ *
+ * Results:
+ *    0 or EACCES.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+vmxnet3_txq_kstats_update(kstat_t *ksp, int rw)
+{
+   vmxnet3_txqueue_t *txq = ksp->ks_private;
+   vmxnet3_softc_t *dp = txq->dp;
+   vmxnet3_txq_kstats_t *ks = ksp->ks_data;
+
+   if (rw == KSTAT_WRITE) {
+      return EACCES;
+   }
+
+   /* The queue descriptors go away when the device is stopped */
+   mutex_enter(&txq->lock);
+   ks->packets.value.ui64 = txq->statPackets;
+   ks->bytes.value.ui64 = txq->statBytes;
+   ks->ringFull.value.ui64 = txq->statRingFull;
+   ks->pullups.value.ui64 = txq->statPullups;
+   ks->copied.value.ui64 = txq->statCopied;
+   ks->drops.value.ui64 = txq->statDrops;
+   if (dp->devEnabled) {
+      UPT1_TxStats *stats = &VMXNET3_TQDESC(dp, txq->qid)->stats;
+
+      VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_CMD, VMXNET3_CMD_GET_STATS);
+      ks->tsoPktsTxOK.value.ui64 = stats->TSOPktsTxOK;
+      ks->tsoBytesTxOK.value.ui64 = stats->TSOBytesTxOK;
+      ks->ucastPktsTxOK.value.ui64 = stats->ucastPktsTxOK;
+      ks->mcastPktsTxOK.value.ui64 = stats->mcastPktsTxOK;
+      ks->bcastPktsTxOK.value.ui64 = stats->bcastPktsTxOK;
+      ks->pktsTxError.value.ui64 = stats->pktsTxError;
+      ks->pktsTxDiscard.value.ui64 = stats->pktsTxDiscard;
+   }
+   mutex_exit(&txq->lock);
+
+   return 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_rxq_kstats_update --
+ *
+ *    Refresh the kstats of a rx queue.
+ *
+ * Results:
+ *    0 or EACCES.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+vmxnet3_rxq_kstats_update(kstat_t *ksp, int rw)
+{
+   vmxnet3_rxqueue_t *rxq = ksp->ks_private;
+   vmxnet3_softc_t *dp = rxq->dp;
+   vmxnet3_rxq_kstats_t *ks = ksp->ks_data;
+
+   if (rw == KSTAT_WRITE) {
+      return EACCES;
+   }
+
+   /* The queue descriptors go away when the device is stopped */
+   mutex_enter(&rxq->lock);
+   ks->packets.value.ui64 = rxq->statPackets;
+   ks->bytes.value.ui64 = rxq->statBytes;
+   ks->noBuf.value.ui64 = rxq->statNoBuf;
+   ks->errors.value.ui64 = rxq->statErrors;
+   if (dp->devEnabled) {
+      UPT1_RxStats *stats = &VMXNET3_RQDESC(dp, rxq->qid)->stats;
+
+      VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_CMD, VMXNET3_CMD_GET_STATS);
+      ks->lroPktsRxOK.value.ui64 = stats->LROPktsRxOK;
+      ks->lroBytesRxOK.value.ui64 = stats->LROBytesRxOK;
+      ks->ucastPktsRxOK.value.ui64 = stats->ucastPktsRxOK;
+      ks->mcastPktsRxOK.value.ui64 = stats->mcastPktsRxOK;
+      ks->bcastPktsRxOK.value.ui64 = stats->bcastPktsRxOK;
+      ks->pktsRxOutOfBuf.value.ui64 = stats->pktsRxOutOfBuf;
+      ks->pktsRxError.value.ui64 = stats->pktsRxError;
+   }
+   mutex_exit(&rxq->lock);
+
+   return 0;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_txq_kstats_create --
+ *
+ *    Create and install the kstats of a tx queue.
+ *
+ * Results:
+ *    The kstat or NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static kstat_t *
+vmxnet3_txq_kstats_create(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
+{
+   kstat_t *ksp;
+   vmxnet3_txq_kstats_t *ks;
+   char name[KSTAT_STRLEN];
+
+   (void) snprintf(name, sizeof name, "txq%u", txq->qid);
+   ksp = kstat_create(VMXNET3_MODNAME, dp->instance, name, "net",
+                      KSTAT_TYPE_NAMED,
+                      sizeof(vmxnet3_txq_kstats_t) / sizeof(kstat_named_t),
+                      0);
+   if (!ksp) {
+      return NULL;
+   }
+
+   ks = ksp->ks_data;
+   kstat_named_init(&ks->packets, "packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->bytes, "bytes", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->ringFull, "ring_full", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->pullups, "pullups", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->copied, "copied", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->drops, "drops", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->tsoPktsTxOK, "tso_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->tsoBytesTxOK, "tso_bytes", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->ucastPktsTxOK, "ucast_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->mcastPktsTxOK, "mcast_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->bcastPktsTxOK, "bcast_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->pktsTxError, "dev_errors", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->pktsTxDiscard, "dev_discards", KSTAT_DATA_UINT64);
+
+   ksp->ks_private = txq;
+   ksp->ks_update = vmxnet3_txq_kstats_update;
+   kstat_install(ksp);
+
+   return ksp;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_rxq_kstats_create --
+ *
+ *    Create and install the kstats of a rx queue.
+ *
+ * Results:
+ *    The kstat or NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static kstat_t *
+vmxnet3_rxq_kstats_create(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
+{
+   kstat_t *ksp;
+   vmxnet3_rxq_kstats_t *ks;
+   char name[KSTAT_STRLEN];
+
+   (void) snprintf(name, sizeof name, "rxq%u", rxq->qid);
+   ksp = kstat_create(VMXNET3_MODNAME, dp->instance, name, "net",
+                      KSTAT_TYPE_NAMED,
+                      sizeof(vmxnet3_rxq_kstats_t) / sizeof(kstat_named_t),
+                      0);
+   if (!ksp) {
+      return NULL;
+   }
+
+   ks = ksp->ks_data;
+   kstat_named_init(&ks->packets, "packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->bytes, "bytes", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->noBuf, "no_buf", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->errors, "errors", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->lroPktsRxOK, "lro_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->lroBytesRxOK, "lro_bytes", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->ucastPktsRxOK, "ucast_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->mcastPktsRxOK, "mcast_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->bcastPktsRxOK, "bcast_packets", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->pktsRxOutOfBuf, "dev_no_buf", KSTAT_DATA_UINT64);
+   kstat_named_init(&ks->pktsRxError, "dev_errors", KSTAT_DATA_UINT64);
+
+   ksp->ks_private = rxq;
+   ksp->ks_update = vmxnet3_rxq_kstats_update;
+   kstat_install(ksp);
+
+   return ksp;
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_kstats_delete --
+ *
+ *    Delete the kstats of all the queues of a vmxnet3 device.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_kstats_delete(vmxnet3_softc_t *dp)
+{
+   unsigned int i;
+
+   for (i = 0; i < dp->numQueues; i++) {
+      if (dp->txQueue[i].ksp) {
+         kstat_delete(dp->txQueue[i].ksp);
+         dp->txQueue[i].ksp = NULL;
+      }
+      if (dp->rxQueue[i].ksp) {
+         kstat_delete(dp->rxQueue[i].ksp);
+         dp->rxQueue[i].ksp = NULL;
+      }
+   }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_kstats_create --
+ *
+ *    Create the kstats of all the queues of a vmxnet3 device.
+ *
+ * Results:
+ *    DDI_SUCCESS or DDI_FAILURE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static int
+vmxnet3_kstats_create(vmxnet3_softc_t *dp)
+{
+   unsigned int i;
+
+   for (i = 0; i < dp->numQueues; i++) {
+      dp->txQueue[i].ksp = vmxnet3_txq_kstats_create(dp, &dp->txQueue[i]);
+      dp->rxQueue[i].ksp = vmxnet3_rxq_kstats_create(dp, &dp->rxQueue[i]);
+      if (!dp->txQueue[i].ksp || !dp->rxQueue[i].ksp) {
+         vmxnet3_kstats_delete(dp);
+         return DDI_FAILURE;
+      }
+   }
+
+   return DDI_SUCCESS;
+}
+
 
 /*
  *---------------------------------------------------------------------------
@@ -1435,6 +2256,7 @@ vmxnet3_attach(dev_info_t *dip, ddi_attach_cmd_t cmd)
    uint32_t ret32;
    int ret, err;
    uint_t uret;
+   unsigned int i;
 
    if (cmd != DDI_ATTACH) {
       goto error;
@@ -1559,31 +2381,8 @@ vmxnet3_attach(dev_info_t *dip, ddi_attach_cmd_t cmd)
     */
    VMXNET3_BAR1_PUT32(dp, VMXNET3_REG_CMD, VMXNET3_CMD_GET_CONF_INTR);
    ret32 = VMXNET3_BAR1_GET32(dp, VMXNET3_REG_CMD);
-   switch (ret32 & 0x3) {
-      case VMXNET3_IT_AUTO:
-      case VMXNET3_IT_MSIX:
-         dp->intrType = DDI_INTR_TYPE_MSIX;
-         err = ddi_intr_alloc(dip, &dp->intrHandle, dp->intrType, 0, 1,
-                              &ret, DDI_INTR_ALLOC_STRICT);
-         if (err == DDI_SUCCESS)
-            break;
-         VMXNET3_DEBUG(dp, 2, "DDI_INTR_TYPE_MSIX failed, err:%d\n", err);
-      case VMXNET3_IT_MSI:
-         dp->intrType = DDI_INTR_TYPE_MSI;
-         if (ddi_intr_alloc(dip, &dp->intrHandle, dp->intrType, 0, 1,
-                            &ret, DDI_INTR_ALLOC_STRICT) == DDI_SUCCESS)
-            break;
-         VMXNET3_DEBUG(dp, 2, "DDI_INTR_TYPE_MSI failed\n");
-      case VMXNET3_IT_INTX:
-         dp->intrType = DDI_INTR_TYPE_FIXED;
-         if (ddi_intr_alloc(dip, &dp->intrHandle, dp->intrType, 0, 1,
-                            &ret, DDI_INTR_ALLOC_STRICT) == DDI_SUCCESS) {
-            break;
-         }
-         VMXNET3_DEBUG(dp, 2, "DDI_INTR_TYPE_INTX failed\n");
-      default:
-         VMXNET3_WARN(dp, "ddi_intr_alloc() failed\n");
-         goto error_mac;
+   if (vmxnet3_alloc_intrs(dp, ret32) != DDI_SUCCESS) {
+      goto error_mac;
    }
    dp->intrMaskMode = (ret32 >> 2) & 0x3;
    if (dp->intrMaskMode == VMXNET3_IMM_LAZY) {
@@ -1591,7 +2390,7 @@ vmxnet3_attach(dev_info_t *dip, ddi_attach_cmd_t cmd)
       goto error_intr;
    }
 
-   if (ddi_intr_get_pri(dp->intrHandle, &uret) != DDI_SUCCESS) {
+   if (ddi_intr_get_pri(dp->intrHandles[0], &uret) != DDI_SUCCESS) {
       VMXNET3_WARN(dp, "ddi_intr_get_pri() failed\n");
       goto error_intr;
    }
@@ -1614,46 +2413,54 @@ vmxnet3_attach(dev_info_t *dip, ddi_attach_cmd_t cmd)
     * This _must_ be done before ddi_intr_enable()
     */
    mutex_init(&dp->intrLock, NULL, MUTEX_DRIVER, DDI_INTR_PRI(uret));
-   mutex_init(&dp->txLock, NULL, MUTEX_DRIVER, DDI_INTR_PRI(uret));
    mutex_init(&dp->rxPoolLock, NULL, MUTEX_DRIVER, DDI_INTR_PRI(uret));
+   for (i = 0; i < dp->numQueues; i++) {
+      dp->txQueue[i].dp = dp;
+      dp->txQueue[i].qid = i;
+      mutex_init(&dp->txQueue[i].lock, NULL, MUTEX_DRIVER,
+                 DDI_INTR_PRI(uret));
+      dp->rxQueue[i].dp = dp;
+      dp->rxQueue[i].qid = i;
+      mutex_init(&dp->rxQueue[i].lock, NULL, MUTEX_DRIVER,
+                 DDI_INTR_PRI(uret));
+   }
 
-   if (ddi_intr_add_handler(dp->intrHandle, vmxnet3_intr,
-                            dp, NULL) != DDI_SUCCESS) {
+   if (vmxnet3_add_intr_handlers(dp) != DDI_SUCCESS) {
       VMXNET3_WARN(dp, "ddi_intr_add_handler() failed\n");
       goto error_mutexes;
    }
 
-   err = ddi_intr_get_cap(dp->intrHandle, &dp->intrCap);
+   err = ddi_intr_get_cap(dp->intrHandles[0], &dp->intrCap);
    if (err != DDI_SUCCESS) {
       VMXNET3_WARN(dp, "ddi_intr_get_cap() failed %d", err);
       goto error_intr_handler;
    }
 
-   if (dp->intrCap & DDI_INTR_FLAG_BLOCK) {
-      err = ddi_intr_block_enable(&dp->intrHandle, 1);
-      if (err != DDI_SUCCESS) {
-         VMXNET3_WARN(dp, "ddi_intr_block_enable() failed, err:%d\n", err);
-         goto error_intr_handler;
-      }
-   } else {
-      err = ddi_intr_enable(dp->intrHandle);
-      if ((err != DDI_SUCCESS)) {
-         VMXNET3_WARN(dp, "ddi_intr_enable() failed, err:%d\n", err);
-         goto error_intr_handler;
-      }
+   if (vmxnet3_enable_intrs(dp, B_TRUE) != DDI_SUCCESS) {
+      goto error_intr_handler;
+   }
+
+   /*
+    * The per-queue statistics are optional
+    */
+   if (vmxnet3_kstats_create(dp) != DDI_SUCCESS) {
+      VMXNET3_WARN(dp, "vmxnet3_kstats_create() failed\n");
    }
 
    return DDI_SUCCESS;
 
 error_intr_handler:
-   ddi_intr_remove_handler(dp->intrHandle);
+   vmxnet3_remove_intr_handlers(dp);
 error_mutexes:
+   for (i = 0; i < dp->numQueues; i++) {
+      mutex_destroy(&dp->rxQueue[i].lock);
+      mutex_destroy(&dp->txQueue[i].lock);
+   }
    mutex_destroy(&dp->rxPoolLock);
-   mutex_destroy(&dp->txLock);
    mutex_destroy(&dp->intrLock);
    ddi_taskq_destroy(dp->resetTask);
 error_intr:
-   ddi_intr_free(dp->intrHandle);
+   vmxnet3_free_intrs(dp);
 error_mac:
    mac_unregister(dp->mac);
 error_regs_map_1:
@@ -1688,6 +2495,7 @@ vmxnet3_detach(dev_info_t *dip, ddi_detach_cmd_t cmd)
 {
    vmxnet3_softc_t *dp = ddi_get_driver_private(dip);
    unsigned int retries = 0;
+   unsigned int i;
 
    VMXNET3_DEBUG(dp, 1, "detach()\n");
 
@@ -1706,13 +2514,11 @@ vmxnet3_detach(dev_info_t *dip, ddi_detach_cmd_t cmd)
       }
    }
 
-   if (dp->intrCap & DDI_INTR_FLAG_BLOCK) {
-      ddi_intr_block_disable(&dp->intrHandle, 1);
-   } else {
-      ddi_intr_disable(dp->intrHandle);
-   }
-   ddi_intr_remove_handler(dp->intrHandle);
-   ddi_intr_free(dp->intrHandle);
+   vmxnet3_kstats_delete(dp);
+
+   vmxnet3_enable_intrs(dp, B_FALSE);
+   vmxnet3_remove_intr_handlers(dp);
+   vmxnet3_free_intrs(dp);
 
    mac_unregister(dp->mac);
 
@@ -1720,8 +2526,11 @@ vmxnet3_detach(dev_info_t *dip, ddi_detach_cmd_t cmd)
       vmxnet3_free_dma_mem(&dp->mfTable);
    }
 
+   for (i = 0; i < dp->numQueues; i++) {
+      mutex_destroy(&dp->rxQueue[i].lock);
+      mutex_destroy(&dp->txQueue[i].lock);
+   }
    mutex_destroy(&dp->rxPoolLock);
-   mutex_destroy(&dp->txLock);
    mutex_destroy(&dp->intrLock);
    ddi_taskq_destroy(dp->resetTask);
 
@@ -122,6 +122,7 @@ vmxnet3_put_rxbuf(vmxnet3_rxbuf_t *rxBuf)
    if (dp->devEnabled && rxPool->nBufs < rxPool->nBufsLimit) {
       rxBuf->next = rxPool->listHead;
       rxPool->listHead = rxBuf;
+      rxPool->nBufs++;
       mutex_exit(&dp->rxPoolLock);
    } else {
       mutex_exit(&dp->rxPoolLock);
@@ -155,6 +156,7 @@ vmxnet3_get_rxbuf(vmxnet3_softc_t *dp, boolean_t canSleep)
    if (rxPool->listHead) {
       rxBuf = rxPool->listHead;
       rxPool->listHead = rxBuf->next;
+      rxPool->nBufs--;
       mutex_exit(&dp->rxPoolLock);
       VMXNET3_DEBUG(dp, 5, "alloc 0x%p from pool\n", rxBuf);
    } else {
@@ -185,7 +187,7 @@ done:
  *
  * vmxnet3_rx_populate --
  *
- *    Populate a Rx descriptor with a new rxBuf.
+ *    Populate a Rx descriptor of a ring with a new rxBuf.
  *
  * Results:
  *    DDI_SUCCESS or DDI_FAILURE.
@@ -196,20 +198,20 @@ done:
  *---------------------------------------------------------------------------
  */
 static int
-vmxnet3_rx_populate(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq,
+vmxnet3_rx_populate(vmxnet3_softc_t *dp, vmxnet3_cmdring_t *cmdRing,
+                    vmxnet3_bufdesc_t *bufRing, uint8_t btype,
                     uint16_t idx, boolean_t canSleep)
 {
    int ret = DDI_SUCCESS;
    vmxnet3_rxbuf_t *rxBuf = vmxnet3_get_rxbuf(dp, canSleep);
 
    if (rxBuf) {
-      vmxnet3_cmdring_t *cmdRing = &rxq->cmdRing;
       Vmxnet3_GenericDesc *rxDesc = VMXNET3_GET_DESC(cmdRing, idx);;
 
-      rxq->bufRing[idx].rxBuf = rxBuf;
+      bufRing[idx].rxBuf = rxBuf;
       rxDesc->rxd.addr = rxBuf->dma.bufPA;
       rxDesc->rxd.len = rxBuf->dma.bufLen;
-      // rxDesc->rxd.btype = 0;
+      rxDesc->rxd.btype = btype;
       membar_producer();
       rxDesc->rxd.gen = cmdRing->gen;
    } else {
@@ -222,46 +224,161 @@ vmxnet3_rx_populate(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq,
 /*
  *---------------------------------------------------------------------------
  *
- * vmxnet3_rxqueue_init --
+ * vmxnet3_rx_fill_ring --
  *
- *    Initialize a RxQueue by populating the whole Rx ring with rxBufs.
+ *    Populate a whole Rx ring with rxBufs.
  *
  * Results:
  *    DDI_SUCCESS or DDI_FAILURE.
  *
  * Side effects:
- *    None.
+ *    On failure the rxBufs already in the ring are freed.
  *
  *---------------------------------------------------------------------------
  */
-int
-vmxnet3_rxqueue_init(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
+static int
+vmxnet3_rx_fill_ring(vmxnet3_softc_t *dp, vmxnet3_cmdring_t *cmdRing,
+                     vmxnet3_bufdesc_t *bufRing, uint8_t btype)
 {
-   vmxnet3_cmdring_t *cmdRing = &rxq->cmdRing;
-
    do {
-      if (vmxnet3_rx_populate(dp, rxq, cmdRing->next2fill,
-                              B_TRUE) != DDI_SUCCESS) {
+      if (vmxnet3_rx_populate(dp, cmdRing, bufRing, btype,
+                              cmdRing->next2fill, B_TRUE) != DDI_SUCCESS) {
          goto error;
       }
       VMXNET3_INC_RING_IDX(cmdRing, cmdRing->next2fill);
    } while (cmdRing->next2fill);
 
-   dp->rxPool.nBufsLimit = vmxnet3_getprop(dp, "RxBufPoolLimit",
-                                           0, cmdRing->size * 10,
-                                           cmdRing->size * 2);
-
    return DDI_SUCCESS;
 
 error:
    while (cmdRing->next2fill) {
       VMXNET3_DEC_RING_IDX(cmdRing, cmdRing->next2fill);
-      vmxnet3_free_rxbuf(dp, rxq->bufRing[cmdRing->next2fill].rxBuf);
+      vmxnet3_free_rxbuf(dp, bufRing[cmdRing->next2fill].rxBuf);
    }
 
    return DDI_FAILURE;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_rx_empty_ring --
+ *
+ *    Free all the rxBufs of a Rx ring.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_rx_empty_ring(vmxnet3_cmdring_t *cmdRing, vmxnet3_bufdesc_t *bufRing)
+{
+   unsigned int i;
+
+   for (i = 0; i < cmdRing->size; i++) {
+      vmxnet3_rxbuf_t *rxBuf = bufRing[i].rxBuf;
+      ASSERT(rxBuf);
+      ASSERT(rxBuf->mblk);
+      /*
+       * Here, freemsg() will trigger a call to vmxnet3_put_rxbuf() which
+       * will then call vmxnet3_free_rxbuf() because the underlying
+       * device is disabled.
+       */
+      freemsg(rxBuf->mblk);
+   }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_rx_prefill_pool --
+ *
+ *    Put up to count new rxBufs in the rxPool, within its limit, so that
+ *    the rings can be refilled from interrupt context without allocating
+ *    and binding buffers while the previous ones are loaned up the stack.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_rx_prefill_pool(vmxnet3_softc_t *dp, unsigned int count)
+{
+   vmxnet3_rxpool_t *rxPool = &dp->rxPool;
+
+   while (count--) {
+      vmxnet3_rxbuf_t *rxBuf;
+
+      mutex_enter(&dp->rxPoolLock);
+      if (rxPool->nBufs >= rxPool->nBufsLimit) {
+         mutex_exit(&dp->rxPoolLock);
+         break;
+      }
+      mutex_exit(&dp->rxPoolLock);
+
+      if (!(rxBuf = vmxnet3_alloc_rxbuf(dp, B_TRUE))) {
+         break;
+      }
+
+      mutex_enter(&dp->rxPoolLock);
+      rxBuf->next = rxPool->listHead;
+      rxPool->listHead = rxBuf;
+      rxPool->nBufs++;
+      mutex_exit(&dp->rxPoolLock);
+   }
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_rxqueue_init --
+ *
+ *    Initialize a RxQueue by populating its Rx rings with rxBufs.
+ *
+ * Results:
+ *    DDI_SUCCESS or DDI_FAILURE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+int
+vmxnet3_rxqueue_init(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
+{
+   unsigned int nBufs = rxq->cmdRing.size + rxq->bodyRing.size;
+
+   if (vmxnet3_rx_fill_ring(dp, &rxq->cmdRing, rxq->bufRing,
+                            VMXNET3_RXD_BTYPE_HEAD) != DDI_SUCCESS) {
+      return DDI_FAILURE;
+   }
+
+   if (rxq->bodyRing.size &&
+       vmxnet3_rx_fill_ring(dp, &rxq->bodyRing, rxq->bodyBufRing,
+                            VMXNET3_RXD_BTYPE_BODY) != DDI_SUCCESS) {
+      ASSERT(!dp->devEnabled);
+      vmxnet3_rx_empty_ring(&rxq->cmdRing, rxq->bufRing);
+      return DDI_FAILURE;
+   }
+
+   /* The pool is shared by the queues */
+   nBufs *= dp->numQueues;
+   dp->rxPool.nBufsLimit = vmxnet3_getprop(dp, "RxBufPoolLimit",
+                                           0, nBufs * 10, nBufs * 2);
+
+   vmxnet3_rx_prefill_pool(dp, rxq->cmdRing.size);
+
+   return DDI_SUCCESS;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -282,7 +399,6 @@ vmxnet3_rxqueue_fini(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
 {
    vmxnet3_rxpool_t *rxPool = &dp->rxPool;
    vmxnet3_rxbuf_t *rxBuf;
-   unsigned int i;
 
    ASSERT(!dp->devEnabled);
 
@@ -290,21 +406,14 @@ vmxnet3_rxqueue_fini(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
    while (rxPool->listHead) {
       rxBuf = rxPool->listHead;
       rxPool->listHead = rxBuf->next;
+      rxPool->nBufs--;
       vmxnet3_free_rxbuf(dp, rxBuf);
    }
+   ASSERT(!rxPool->nBufs);
 
-   /* Then the ring */
-   for (i = 0; i < rxq->cmdRing.size; i++) {
-      rxBuf = rxq->bufRing[i].rxBuf;
-      ASSERT(rxBuf);
-      ASSERT(rxBuf->mblk);
-      /*
-       * Here, freemsg() will trigger a call to vmxnet3_put_rxbuf() which
-       * will then call vmxnet3_free_rxbuf() because the underlying
-       * device is disabled.
-       */
-      freemsg(rxBuf->mblk);
-   }
+   /* Then the rings */
+   vmxnet3_rx_empty_ring(&rxq->cmdRing, rxq->bufRing);
+   vmxnet3_rx_empty_ring(&rxq->bodyRing, rxq->bodyBufRing);
 }
 
 /*
@@ -344,6 +453,40 @@ vmxnet3_rx_hwcksum(vmxnet3_softc_t *dp, mblk_t *mp,
    }
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_rx_update_prod --
+ *
+ *    Tell the device how far a Rx ring is filled.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_rx_update_prod(vmxnet3_softc_t *dp, vmxnet3_cmdring_t *cmdRing,
+                       uint32_t reg)
+{
+   uint32_t rxprod;
+
+   /*
+    * All buffers are actually available, but we can't tell that to
+    * the device because it may interpret that as an empty ring.
+    * So skip one buffer.
+    */
+   if (cmdRing->next2fill) {
+      rxprod = cmdRing->next2fill - 1;
+   } else {
+      rxprod = cmdRing->size - 1;
+   }
+   VMXNET3_BAR0_PUT32(dp, reg, rxprod);
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -364,26 +507,29 @@ mblk_t *
 vmxnet3_rx_intr(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
 {
    vmxnet3_compring_t *compRing = &rxq->compRing;
-   vmxnet3_cmdring_t *cmdRing = &rxq->cmdRing;
    Vmxnet3_RxQueueCtrl *rxqCtrl = rxq->sharedCtrl;
    Vmxnet3_GenericDesc *compDesc;
    mblk_t *mplist = NULL, **mplistTail = &mplist;
 
-   ASSERT(mutex_owned(&dp->intrLock));
+   ASSERT(mutex_owned(&rxq->lock));
 
    compDesc = VMXNET3_GET_DESC(compRing, compRing->next2comp);
    while (compDesc->rcd.gen == compRing->gen) {
       mblk_t *mp = NULL, **mpTail = &mp;
       boolean_t mpValid = B_TRUE;
       boolean_t eop;
+      unsigned int mpLen = 0;
 
       ASSERT(compDesc->rcd.sop);
 
       do {
-         uint16_t rxdIdx = compDesc->rcd.rxdIdx;
-         vmxnet3_rxbuf_t *rxBuf = rxq->bufRing[rxdIdx].rxBuf;
-         mblk_t *mblk = rxBuf->mblk;
+         vmxnet3_cmdring_t *cmdRing;
+         vmxnet3_bufdesc_t *bufRing;
+         vmxnet3_rxbuf_t *rxBuf;
          Vmxnet3_GenericDesc *rxDesc;
+         uint16_t rxdIdx;
+         uint8_t btype;
+         mblk_t *mblk;
 
          while (compDesc->rcd.gen != compRing->gen) {
             /*
@@ -393,7 +539,23 @@ vmxnet3_rx_intr(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
             membar_consumer();
          }
          ASSERT(compDesc->rcd.gen == compRing->gen);
+
+         /* The body ring of queue N is reported as ring numQueues + N */
+         if (compDesc->rcd.rqID < dp->numQueues) {
+            cmdRing = &rxq->cmdRing;
+            bufRing = rxq->bufRing;
+            btype = VMXNET3_RXD_BTYPE_HEAD;
+         } else {
+            ASSERT(rxq->bodyRing.size);
+            cmdRing = &rxq->bodyRing;
+            bufRing = rxq->bodyBufRing;
+            btype = VMXNET3_RXD_BTYPE_BODY;
+         }
+
+         rxdIdx = compDesc->rcd.rxdIdx;
+         rxBuf = bufRing[rxdIdx].rxBuf;
          ASSERT(rxBuf);
+         mblk = rxBuf->mblk;
          ASSERT(mblk);
 
          /* Some Rx descriptors may have been skipped */
@@ -409,20 +571,24 @@ vmxnet3_rx_intr(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
           * Now we have a piece of the packet in the rxdIdx descriptor.
           * Grab it only if we achieve to replace it with a fresh buffer.
           */
-         if (vmxnet3_rx_populate(dp, rxq, rxdIdx, B_FALSE) == DDI_SUCCESS) {
+         if (vmxnet3_rx_populate(dp, cmdRing, bufRing, btype, rxdIdx,
+                                 B_FALSE) == DDI_SUCCESS) {
             /* Success, we can chain the mblk with the mp */
             mblk->b_wptr = mblk->b_rptr + compDesc->rcd.len;
             *mpTail = mblk;
             mpTail = &mblk->b_cont;
             ASSERT(*mpTail == NULL);
+            mpLen += compDesc->rcd.len;
 
-            VMXNET3_DEBUG(dp, 3, "rx 0x%p on [%u]\n", mblk, rxdIdx);
+            VMXNET3_DEBUG(dp, 3, "rx 0x%p on [%u] of rxq%u\n", mblk, rxdIdx,
+                          rxq->qid);
 
             if (eop) {
                if (!compDesc->rcd.err) {
                   /* Tag the mp if it was checksummed by the H/W */
                   vmxnet3_rx_hwcksum(dp, mp, compDesc);
                } else {
+                  rxq->statErrors++;
                   mpValid = B_FALSE;
                }
             }
@@ -430,6 +596,9 @@ vmxnet3_rx_intr(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
             /* Keep the same buffer, we still need to flip the gen bit */
             rxDesc = VMXNET3_GET_DESC(cmdRing, rxdIdx);
             rxDesc->rxd.gen = cmdRing->gen;
+            if (mpValid) {
+               rxq->statNoBuf++;
+            }
             mpValid = B_FALSE;
          }
 
@@ -443,6 +612,8 @@ vmxnet3_rx_intr(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
             *mplistTail = mp;
             mplistTail = &mp->b_next;
             ASSERT(*mplistTail == NULL);
+            rxq->statPackets++;
+            rxq->statBytes += mpLen;
          } else {
             /* This message got holes, drop it */
             freemsg(mp);
@@ -451,19 +622,12 @@ vmxnet3_rx_intr(vmxnet3_softc_t *dp, vmxnet3_rxqueue_t *rxq)
    }
 
    if (rxqCtrl->updateRxProd) {
-      uint32_t rxprod;
-
-      /*
-       * All buffers are actually available, but we can't tell that to
-       * the device because it may interpret that as an empty ring.
-       * So skip one buffer.
-       */
-      if (cmdRing->next2fill) {
-         rxprod = cmdRing->next2fill - 1;
-      } else {
-         rxprod = cmdRing->size - 1;
+      vmxnet3_rx_update_prod(dp, &rxq->cmdRing,
+                             VMXNET3_REG_RXPROD_IDX(rxq->qid));
+      if (rxq->bodyRing.size) {
+         vmxnet3_rx_update_prod(dp, &rxq->bodyRing,
+                                VMXNET3_REG_RXPROD2_IDX(rxq->qid));
       }
-      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_RXPROD, rxprod);
    }
 
    return mplist;
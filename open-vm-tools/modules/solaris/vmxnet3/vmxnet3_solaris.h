@@ -26,6 +26,7 @@
 #include <sys/kmem.h>
 #include <sys/stat.h>
 #include <sys/kstat.h>
+#include <sys/cpuvar.h>
 #include <sys/vtrace.h>
 #include <sys/dlpi.h>
 #include <sys/strsun.h>
@@ -85,10 +86,25 @@ typedef struct vmxnet3_metatx_t {
 } vmxnet3_metatx_t;
 
 typedef struct vmxnet3_txqueue_t {
+   struct vmxnet3_softc_t *dp;
+   uint16_t             qid;
+   kmutex_t             lock;
    vmxnet3_cmdring_t    cmdRing;
    vmxnet3_compring_t   compRing;
    vmxnet3_metatx_t    *metaRing;
    Vmxnet3_TxQueueCtrl *sharedCtrl;
+   vmxnet3_dmabuf_t     dataRing;
+   ddi_dma_handle_t     dmaHandle;
+   boolean_t            mustResched;
+
+   /* Driver statistics, protected by lock */
+   kstat_t             *ksp;
+   uint64_t             statPackets;
+   uint64_t             statBytes;
+   uint64_t             statRingFull;
+   uint64_t             statPullups;
+   uint64_t             statCopied;
+   uint64_t             statDrops;
 } vmxnet3_txqueue_t;
 
 typedef struct vmxnet3_rxbuf_t {
@@ -109,13 +125,31 @@ typedef struct vmxnet3_rxpool_t {
    unsigned int         nBufsLimit;
 } vmxnet3_rxpool_t;
 
+/*
+ * The head ring (ring 1) holds the buffers packets start in. The body ring
+ * (ring 2) is only set up with LRO, for the rest of the aggregated packets.
+ */
 typedef struct vmxnet3_rxqueue_t {
+   struct vmxnet3_softc_t *dp;
+   uint16_t             qid;
+   kmutex_t             lock;
    vmxnet3_cmdring_t    cmdRing;
-   vmxnet3_compring_t   compRing;
    vmxnet3_bufdesc_t   *bufRing;
+   vmxnet3_cmdring_t    bodyRing;
+   vmxnet3_bufdesc_t   *bodyBufRing;
+   vmxnet3_compring_t   compRing;
    Vmxnet3_RxQueueCtrl *sharedCtrl;
+
+   /* Driver statistics, protected by lock */
+   kstat_t             *ksp;
+   uint64_t             statPackets;
+   uint64_t             statBytes;
+   uint64_t             statNoBuf;
+   uint64_t             statErrors;
 } vmxnet3_rxqueue_t;
 
+/* Tx and Rx queues go in pairs, so the lower Tx limit applies to both */
+#define VMXNET3_MAX_QUEUES VMXNET3_MAX_TX_QUEUES
 
 typedef struct vmxnet3_softc_t {
    dev_info_t          *dip;
@@ -135,19 +169,28 @@ typedef struct vmxnet3_softc_t {
    vmxnet3_dmabuf_t     sharedData;
    vmxnet3_dmabuf_t     queueDescs;
 
+   /*
+    * With more than one vector, vector i serves the queues i and the last
+    * one the events. With a single vector it serves everything.
+    */
    kmutex_t             intrLock;
    int                  intrType;
    int                  intrMaskMode;
    int                  intrCap;
-   ddi_intr_handle_t    intrHandle;
+   int                  intrCount;
+   ddi_intr_handle_t    intrHandles[VMXNET3_MAX_QUEUES + 1];
    ddi_taskq_t         *resetTask;
 
-   kmutex_t             txLock;
-   vmxnet3_txqueue_t    txQueue;
-   ddi_dma_handle_t     txDmaHandle;
-   boolean_t            txMustResched;
+   /*
+    * Lock order: intrLock, rxQueue[].lock, rxPoolLock, txQueue[].lock
+    */
+   unsigned int         numQueues;
+   vmxnet3_txqueue_t    txQueue[VMXNET3_MAX_QUEUES];
+   vmxnet3_rxqueue_t    rxQueue[VMXNET3_MAX_QUEUES];
+   vmxnet3_dmabuf_t     rssConf;
+   boolean_t            lroEnabled;
+   uint32_t             txCopyThreshold;
 
-   vmxnet3_rxqueue_t    rxQueue;
    kmutex_t             rxPoolLock;
    vmxnet3_rxpool_t     rxPool;
    volatile uint32_t    rxNumBufs;
@@ -208,6 +251,9 @@ extern ddi_device_acc_attr_t vmxnet3_dev_attr;
 #define VMXNET3_DEF_TX_RING_SIZE 256
 #define VMXNET3_DEF_RX_RING_SIZE 256
 
+/* Size of the RSS indirection table, 4 entries per queue at most */
+#define VMXNET3_RSS_IND_TABLE_SIZE (VMXNET3_MAX_QUEUES * 4)
+
 /* Register access helpers */
 #define VMXNET3_BAR0_GET32(Device, Reg) \
    ddi_get32((Device)->bar0Handle, (uint32_t *) ((Device)->bar0 + (Reg)))
@@ -221,10 +267,17 @@ extern ddi_device_acc_attr_t vmxnet3_dev_attr;
 /* Misc helpers */
 #define VMXNET3_DS(Device) \
    ((Vmxnet3_DriverShared *) (Device)->sharedData.buf)
-#define VMXNET3_TQDESC(Device) \
-   ((Vmxnet3_TxQueueDesc *) (Device)->queueDescs.buf)
-#define VMXNET3_RQDESC(Device) \
-   ((Vmxnet3_RxQueueDesc *) ((Device)->queueDescs.buf + sizeof(Vmxnet3_TxQueueDesc)))
+#define VMXNET3_TQDESC(Device, Idx) \
+   ((Vmxnet3_TxQueueDesc *) (Device)->queueDescs.buf + (Idx))
+#define VMXNET3_RQDESC(Device, Idx) \
+   ((Vmxnet3_RxQueueDesc *) ((Device)->queueDescs.buf + \
+                             (Device)->numQueues * sizeof(Vmxnet3_TxQueueDesc)) + (Idx))
+
+/* Per-vector and per-queue registers, 8 bytes apart */
+#define VMXNET3_REG_IMR_IDX(Idx)     (VMXNET3_REG_IMR + (Idx) * 8)
+#define VMXNET3_REG_TXPROD_IDX(Idx)  (VMXNET3_REG_TXPROD + (Idx) * 8)
+#define VMXNET3_REG_RXPROD_IDX(Idx)  (VMXNET3_REG_RXPROD + (Idx) * 8)
+#define VMXNET3_REG_RXPROD2_IDX(Idx) (VMXNET3_REG_RXPROD2 + (Idx) * 8)
 
 #define VMXNET3_ADDR_LO(addr) ((uint32_t) (addr))
 #define VMXNET3_ADDR_HI(addr) ((uint32_t) (((uint64_t) (addr)) >> 32))
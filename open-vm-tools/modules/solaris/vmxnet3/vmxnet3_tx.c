@@ -170,6 +170,86 @@ vmxnet3_tx_prepare_offload(vmxnet3_softc_t *dp,
    return ret;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_tx_copy --
+ *
+ *    Copy a small msg into the Tx data ring of a vmxnet3 device, where
+ *    each command descriptor has a pre-mapped buffer, and send it with a
+ *    single descriptor. This is cheaper than binding the mblks.
+ *
+ * Results:
+ *    VMXNET3_TX_OK if everything went well.
+ *    VMXNET3_TX_RINGFULL if the ring is nearly full.
+ *
+ * Side effects:
+ *    The msg is freed if VMXNET3_TX_OK is returned.
+ *
+ *---------------------------------------------------------------------------
+ */
+static vmxnet3_txstatus
+vmxnet3_tx_copy(vmxnet3_softc_t *dp,
+                vmxnet3_txqueue_t *txq,
+                vmxnet3_offload_t *ol,
+                mblk_t *mp)
+{
+   vmxnet3_cmdring_t *cmdRing = &txq->cmdRing;
+   Vmxnet3_GenericDesc *txDesc;
+   Vmxnet3_TxDataDesc *dataDesc;
+   uint16_t idx = cmdRing->next2fill;
+   unsigned int len = 0;
+   mblk_t *mblk;
+
+   ASSERT(mutex_owned(&txq->lock));
+   ASSERT(ol->om != VMXNET3_OM_TSO);
+
+   if (cmdRing->avail <= 1) {
+      txq->mustResched = B_TRUE;
+      txq->statRingFull++;
+      return VMXNET3_TX_RINGFULL;
+   }
+
+   dataDesc = (Vmxnet3_TxDataDesc *) txq->dataRing.buf + idx;
+   for (mblk = mp; mblk != NULL; mblk = mblk->b_cont) {
+      unsigned int mblkLen = MBLKL(mblk);
+
+      ASSERT(len + mblkLen <= sizeof(dataDesc->data));
+      bcopy(mblk->b_rptr, dataDesc->data + len, mblkLen);
+      len += mblkLen;
+   }
+
+   ASSERT(!txq->metaRing[idx].mp);
+   txDesc = VMXNET3_GET_DESC(cmdRing, idx);
+   ASSERT(txDesc->txd.gen != cmdRing->gen);
+
+   txDesc->txd.addr = txq->dataRing.bufPA + idx * sizeof(Vmxnet3_TxDataDesc);
+   txDesc->dword[2] = len | (!cmdRing->gen << VMXNET3_TXD_GEN_SHIFT);
+   txDesc->dword[3] = VMXNET3_TXD_CQ | VMXNET3_TXD_EOP;
+   txDesc->txd.om = ol->om;
+   txDesc->txd.hlen = ol->hlen;
+   txDesc->txd.msscof = ol->msscof;
+   membar_producer();
+   txDesc->txd.gen = cmdRing->gen;
+
+   /* Nothing to free on completion, the data is in the ring */
+   txq->metaRing[idx].sopIdx = idx;
+   txq->metaRing[idx].frags = 1;
+   cmdRing->avail--;
+   VMXNET3_INC_RING_IDX(cmdRing, cmdRing->next2fill);
+   txq->sharedCtrl->txNumDeferred++;
+   txq->statPackets++;
+   txq->statBytes += len;
+   txq->statCopied++;
+
+   VMXNET3_DEBUG(dp, 3, "tx 0x%p copied on [%u] of txq%u\n", mp, idx,
+                 txq->qid);
+
+   freemsg(mp);
+
+   return VMXNET3_TX_OK;
+}
+
 /*
  *---------------------------------------------------------------------------
  *
@@ -184,7 +264,8 @@ vmxnet3_tx_prepare_offload(vmxnet3_softc_t *dp,
  *    VMXNET3_TX_FAILURE if there was a DMA or offload error.
  *
  * Side effects:
- *    The ring is filled if VMXNET3_TX_OK is returned.
+ *    The ring is filled if VMXNET3_TX_OK is returned. Small msgs are
+ *    copied, and thus freed, by vmxnet3_tx_copy().
  *
  *---------------------------------------------------------------------------
  */
@@ -204,7 +285,11 @@ vmxnet3_tx_one(vmxnet3_softc_t *dp,
    uint8_t sopGen, curGen;
    mblk_t *mblk;
 
-   ASSERT(mutex_owned(&dp->txLock));
+   ASSERT(mutex_owned(&txq->lock));
+
+   if (ol->om != VMXNET3_OM_TSO && msgdsize(mp) <= dp->txCopyThreshold) {
+      return vmxnet3_tx_copy(dp, txq, ol, mp);
+   }
 
    sopIdx = eopIdx = cmdRing->next2fill;
    sopGen = cmdRing->gen;
@@ -221,7 +306,7 @@ vmxnet3_tx_one(vmxnet3_softc_t *dp,
          continue;
       }
 
-      if (ddi_dma_addr_bind_handle(dp->txDmaHandle, NULL,
+      if (ddi_dma_addr_bind_handle(txq->dmaHandle, NULL,
                                    (caddr_t) mblk->b_rptr, len,
                                    DDI_DMA_RDWR | DDI_DMA_STREAMING,
                                    DDI_DMA_DONTWAIT, NULL,
@@ -251,13 +336,14 @@ vmxnet3_tx_one(vmxnet3_softc_t *dp,
                   VMXNET3_DEBUG(dp, 2, "overfragmented, frags=%u ring=%hu om=%hu\n",
                                 frags, cmdRing->size, ol->om);
                }
-               ddi_dma_unbind_handle(dp->txDmaHandle);
+               ddi_dma_unbind_handle(txq->dmaHandle);
                ret = VMXNET3_TX_PULLUP;
                goto error;
             }
             if (cmdRing->avail - frags <= 1) {
-               dp->txMustResched = B_TRUE;
-               ddi_dma_unbind_handle(dp->txDmaHandle);
+               txq->mustResched = B_TRUE;
+               txq->statRingFull++;
+               ddi_dma_unbind_handle(txq->dmaHandle);
                ret = VMXNET3_TX_RINGFULL;
                goto error;
             }
@@ -293,11 +379,11 @@ vmxnet3_tx_one(vmxnet3_softc_t *dp,
          } while (len);
 
          if (--cookieCount) {
-            ddi_dma_nextcookie(dp->txDmaHandle, &cookie);
+            ddi_dma_nextcookie(txq->dmaHandle, &cookie);
          }
       } while (cookieCount);
 
-      ddi_dma_unbind_handle(dp->txDmaHandle);
+      ddi_dma_unbind_handle(txq->dmaHandle);
    }
 
    /* Update the EOP descriptor */
@@ -329,8 +415,11 @@ vmxnet3_tx_one(vmxnet3_softc_t *dp,
    } else {
       txqCtrl->txNumDeferred++;
    }
+   txq->statPackets++;
+   txq->statBytes += totLen;
 
-   VMXNET3_DEBUG(dp, 3, "tx 0x%p on [%u;%u]\n", mp, sopIdx, eopIdx);
+   VMXNET3_DEBUG(dp, 3, "tx 0x%p on [%u;%u] of txq%u\n", mp, sopIdx, eopIdx,
+                 txq->qid);
 
    goto done;
 
@@ -346,16 +435,121 @@ done:
    return ret;
 }
 
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_tx_select --
+ *
+ *    Pick the Tx queue of a msg. The queue is chosen after the addresses
+ *    and ports of the flow so that the packets of a flow are not
+ *    reordered. Only the first mblk is looked at, msgs whose headers are
+ *    not in it go to the first queue.
+ *
+ * Results:
+ *    The Tx queue.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static vmxnet3_txqueue_t *
+vmxnet3_tx_select(vmxnet3_softc_t *dp, mblk_t *mp)
+{
+   struct ether_vlan_header *eth = (void *) mp->b_rptr;
+   uint8_t *l3, *l4 = NULL;
+   uint16_t ethType;
+   uint32_t hash = 0;
+
+   if (dp->numQueues == 1) {
+      goto done;
+   }
+
+   if (MBLKL(mp) < sizeof(struct ether_vlan_header)) {
+      goto done;
+   }
+   if (eth->ether_tpid == htons(ETHERTYPE_VLAN)) {
+      ethType = ntohs(eth->ether_type);
+      l3 = mp->b_rptr + sizeof(struct ether_vlan_header);
+   } else {
+      ethType = ntohs(((struct ether_header *) eth)->ether_type);
+      l3 = mp->b_rptr + sizeof(struct ether_header);
+   }
+
+   if (ethType == ETHERTYPE_IP &&
+       l3 + IP_SIMPLE_HDR_LENGTH <= mp->b_wptr) {
+      ipha_t *ip = (void *) l3;
+
+      hash = ip->ipha_src ^ ip->ipha_dst;
+      if ((ip->ipha_protocol == IPPROTO_TCP ||
+           ip->ipha_protocol == IPPROTO_UDP) &&
+          !(ntohs(ip->ipha_fragment_offset_and_flags) &
+            (IPH_MF | IPH_OFFSET))) {
+         l4 = l3 + IPH_HDR_LENGTH(ip);
+      }
+   } else if (ethType == ETHERTYPE_IPV6 &&
+              l3 + IPV6_HDR_LEN <= mp->b_wptr) {
+      ip6_t *ip6 = (void *) l3;
+
+      hash = ip6->ip6_src.s6_addr32[3] ^ ip6->ip6_dst.s6_addr32[3];
+      if (ip6->ip6_nxt == IPPROTO_TCP || ip6->ip6_nxt == IPPROTO_UDP) {
+         l4 = l3 + IPV6_HDR_LEN;
+      }
+   }
+
+   if (l4 && l4 + 2 * sizeof(uint16_t) <= mp->b_wptr) {
+      uint16_t *ports = (void *) l4;
+      hash ^= ports[0] ^ ports[1];
+   }
+
+   hash ^= hash >> 16;
+   hash ^= hash >> 8;
+
+done:
+   return &dp->txQueue[hash % dp->numQueues];
+}
+
+/*
+ *---------------------------------------------------------------------------
+ *
+ * vmxnet3_tx_flush --
+ *
+ *    Notify the device of the pending Tx of a queue if enough of them
+ *    were deferred.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *---------------------------------------------------------------------------
+ */
+static void
+vmxnet3_tx_flush(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
+{
+   Vmxnet3_TxQueueCtrl *txqCtrl = txq->sharedCtrl;
+
+   ASSERT(mutex_owned(&txq->lock));
+
+   if (txqCtrl->txNumDeferred >= txqCtrl->txThreshold) {
+      txqCtrl->txNumDeferred = 0;
+      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_TXPROD_IDX(txq->qid),
+                         txq->cmdRing.next2fill);
+   }
+}
+
 /*
  *---------------------------------------------------------------------------
  *
  * vmxnet3_tx --
  *
- *    Send packets on a vmxnet3 device.
+ *    Send packets on a vmxnet3 device. Consecutive msgs of the same flow
+ *    are sent on their queue without releasing its lock.
  *
  * Results:
  *    NULL in case of success or failure.
- *    The mps to be retransmitted later if the ring is full.
+ *    The mps to be retransmitted later if a ring is full.
  *
  * Side effects:
  *    None.
@@ -366,19 +560,14 @@ mblk_t *
 vmxnet3_tx(void *data, mblk_t *mps)
 {
    vmxnet3_softc_t *dp = data;
-   vmxnet3_txqueue_t *txq = &dp->txQueue;
-   vmxnet3_cmdring_t *cmdRing = &txq->cmdRing;
-   Vmxnet3_TxQueueCtrl *txqCtrl = txq->sharedCtrl;
+   vmxnet3_txqueue_t *txq = NULL;
    vmxnet3_txstatus status = VMXNET3_TX_OK;
    mblk_t *mp;
 
    ASSERT(mps != NULL);
-   mutex_enter(&dp->txLock);
-   if (!dp->devEnabled) {
-      goto done;
-   }
 
    do {
+      vmxnet3_txqueue_t *newTxq;
       vmxnet3_offload_t ol;
       int pullup;
 
@@ -397,6 +586,21 @@ vmxnet3_tx(void *data, mblk_t *mps)
          continue;
       }
 
+      newTxq = vmxnet3_tx_select(dp, mp);
+      if (newTxq != txq) {
+         if (txq) {
+            vmxnet3_tx_flush(dp, txq);
+            mutex_exit(&txq->lock);
+         }
+         txq = newTxq;
+         mutex_enter(&txq->lock);
+      }
+      if (!dp->devEnabled) {
+         mp->b_next = mps;
+         mps = mp;
+         goto done;
+      }
+
       /*
        * Prepare the offload while we're still handling the original
        * message -- msgpullup() discards the metadata afterwards.
@@ -405,9 +609,11 @@ vmxnet3_tx(void *data, mblk_t *mps)
       if (pullup) {
          mblk_t *new_mp = msgpullup(mp, pullup);
          freemsg(mp);
+         txq->statPullups++;
          if (new_mp) {
             mp = new_mp;
          } else {
+            txq->statDrops++;
             continue;
          }
       }
@@ -425,10 +631,12 @@ vmxnet3_tx(void *data, mblk_t *mps)
          if (mp->b_cont != NULL) {
             mblk_t *new_mp = msgpullup(mp, -1);
             freemsg(mp);
+            txq->statPullups++;
             if (new_mp) {
                mp = new_mp;
                status = vmxnet3_tx_one(dp, txq, &ol, mp, B_TRUE);
             } else {
+               txq->statDrops++;
                continue;
             }
          }
@@ -436,6 +644,7 @@ vmxnet3_tx(void *data, mblk_t *mps)
       if (status != VMXNET3_TX_OK && status != VMXNET3_TX_RINGFULL) {
          /* Fatal failure, drop it */
          freemsg(mp);
+         txq->statDrops++;
       }
    } while (mps && status != VMXNET3_TX_RINGFULL);
 
@@ -447,13 +656,14 @@ vmxnet3_tx(void *data, mblk_t *mps)
    }
 
    /* Notify the device */
-   if (txqCtrl->txNumDeferred >= txqCtrl->txThreshold) {
-      txqCtrl->txNumDeferred = 0;
-      VMXNET3_BAR0_PUT32(dp, VMXNET3_REG_TXPROD, cmdRing->next2fill);
+   if (txq) {
+      vmxnet3_tx_flush(dp, txq);
    }
 
 done:
-   mutex_exit(&dp->txLock);
+   if (txq) {
+      mutex_exit(&txq->lock);
+   }
 
    return mps;
 }
@@ -482,7 +692,7 @@ vmxnet3_tx_complete(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
    boolean_t completedTx = B_FALSE;
    boolean_t ret = B_FALSE;
 
-   mutex_enter(&dp->txLock);
+   mutex_enter(&txq->lock);
 
    compDesc = VMXNET3_GET_DESC(compRing, compRing->next2comp);
    while (compDesc->tcd.gen == compRing->gen) {
@@ -498,9 +708,11 @@ vmxnet3_tx_complete(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
       ASSERT(eopMetaDesc->frags);
       cmdRing->avail += eopMetaDesc->frags;
 
-      ASSERT(sopMetaDesc->mp);
+      /* Copied msgs were freed when sent */
       mp = sopMetaDesc->mp;
-      freemsg(mp);
+      if (mp) {
+         freemsg(mp);
+      }
 
       eopMetaDesc->sopIdx = 0;
       eopMetaDesc->frags = 0;
@@ -514,12 +726,12 @@ vmxnet3_tx_complete(vmxnet3_softc_t *dp, vmxnet3_txqueue_t *txq)
       compDesc = VMXNET3_GET_DESC(compRing, compRing->next2comp);
    }
 
-   if (dp->txMustResched && completedTx) {
-      dp->txMustResched = B_FALSE;
+   if (txq->mustResched && completedTx) {
+      txq->mustResched = B_FALSE;
       ret = B_TRUE;
    }
 
-   mutex_exit(&dp->txLock);
+   mutex_exit(&txq->lock);
 
    return ret;
 }
@@ -43,9 +43,16 @@
 #define NSDB_GET_VALUE_USER_CMD  "get-value"
 #define NSDB_SET_KEY_USER_CMD    "set-key"
 #define NSDB_DEL_KEY_USER_CMD    "delete-key"
+#define NSDB_WATCH_VALUE_USER_CMD  "watch-value"
 
 #define SUPPORTED_FILE_SIZE_IN_BYTES (16 * 1024) // Refer to namespaceDb.h
 
+/*
+ * The Namespace DB cannot notify changes, watch-value reads the key again
+ * at this interval by default, in milliseconds.
+ */
+#define NSDB_WATCH_DEFAULT_INTERVAL_MS 1000
+
 /*
  * Aggregation of command options.
  */
@@ -53,10 +60,12 @@
 typedef struct NamespaceOptionsState {
    gchar *cmdName;
    gchar *nsName;
-   gchar *keyName;    //for command set-key or delete-key or get-value
-   gchar *valueToSet;
-   gchar *oldValueToSet;
+   gchar **keyNames;  //for command set-key or delete-key or get-value
+   gchar **valuesToSet;
+   gchar **oldValuesToSet;
    gchar *getValueFromFile;
+   gint watchTimeout;
+   gint watchInterval;
    gboolean verboseLogFlag;
    gboolean standardInput;
 } NamespaceOptionsState;
@@ -106,6 +115,8 @@ GetInternalNamespaceCommand(const gchar *cmd)
       return NSDB_PRIV_SET_KEYS_CMD;
    } else if (g_strcmp0(cmd, NSDB_DEL_KEY_USER_CMD) == 0) {
       return NSDB_PRIV_SET_KEYS_CMD;
+   } else if (g_strcmp0(cmd, NSDB_WATCH_VALUE_USER_CMD) == 0) {
+      return NSDB_PRIV_GET_VALUES_CMD;
    } else {
       return NULL;
    }
@@ -130,7 +141,8 @@ ValidateNSCommands(const gchar *cmdName)
 {
    if ((g_strcmp0(cmdName, NSDB_GET_VALUE_USER_CMD) == 0) ||
        (g_strcmp0(cmdName, NSDB_SET_KEY_USER_CMD) == 0) ||
-       (g_strcmp0(cmdName, NSDB_DEL_KEY_USER_CMD) == 0)) {
+       (g_strcmp0(cmdName, NSDB_DEL_KEY_USER_CMD) == 0) ||
+       (g_strcmp0(cmdName, NSDB_WATCH_VALUE_USER_CMD) == 0)) {
       return TRUE;
    } else {
       fprintf(stderr, "Invalid command \"%s\"\n", cmdName);
@@ -283,11 +295,265 @@ GetValueFromFile(const char *filePath, char **fileContents, gsize *length)
 }
 
 
+/*
+ ******************************************************************************
+ * GetOldValue --
+ *
+ * Returns the value a key must have for its update to proceed.
+ *
+ * @param[in]  nsOptions     Parsed namespace command line options.
+ * @param[in]  index         Index of the key.
+ *
+ * @return the old value, "" to update the key unconditionally.
+ *
+ ******************************************************************************
+ */
+
+static const gchar *
+GetOldValue(const NamespaceOptionsState *nsOptions, guint index)
+{
+   if (nsOptions->oldValuesToSet == NULL) {
+      return "";
+   }
+   return nsOptions->oldValuesToSet[index];
+}
+
+
+/*
+ ******************************************************************************
+ * AppendSetKeyOps --
+ *
+ * Appends the operations of command set-key or delete-key, one per key. A
+ * key with an old value is only updated if its current value matches.
+ *
+ * @param[in]  nsOptions     Parsed namespace command line options.
+ * @param[out] buf           Request buffer.
+ *
+ * @return TRUE if successful, FALSE otherwise.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+AppendSetKeyOps(NamespaceOptionsState *nsOptions, DynBuf *buf)
+{
+   Bool isSet = g_strcmp0(nsOptions->cmdName, NSDB_SET_KEY_USER_CMD) == 0;
+   guint numKeys = g_strv_length(nsOptions->keyNames);
+   gchar *numOps = g_strdup_printf("%u", numKeys);
+   gchar *keyValueData = NULL;
+   gsize keyValueLength = 0;
+   Bool retVal = FALSE;
+   guint i;
+
+   if (isSet && nsOptions->valuesToSet == NULL) {
+      if (nsOptions->getValueFromFile == NULL) {
+         if (GetValueFromStdin(&keyValueData, &keyValueLength) == FALSE) {
+            goto exit;
+         }
+      } else if (GetValueFromFile(nsOptions->getValueFromFile,
+                                  &keyValueData, &keyValueLength) == FALSE) {
+         goto exit;
+      }
+   }
+
+   if (!DynBuf_AppendString(buf, numOps)) {
+      fprintf(stderr, "Could not construct request buffer\n");
+      goto exit;
+   }
+
+   for (i = 0; i < numKeys; i++) {
+      const gchar *oldValue = GetOldValue(nsOptions, i);
+      Bool appended;
+
+      /*
+       * Op 0 sets the value always, op 1 only if the old value matches.
+       */
+      if (!DynBuf_AppendString(buf, strlen(oldValue) == 0 ? "0" : "1") ||
+          !DynBuf_AppendString(buf, nsOptions->keyNames[i])) {
+         fprintf(stderr, "Could not construct request buffer\n");
+         goto exit;
+      }
+
+      if (!isSet) {
+         appended = DynBuf_AppendString(buf, ""); // zero length to delete
+      } else if (nsOptions->valuesToSet != NULL) {
+         if (strlen(nsOptions->valuesToSet[i]) == 0) {
+            fprintf(stderr, "%s: Key value must not be empty\n", gAppName);
+            goto exit;
+         }
+         appended = DynBuf_AppendString(buf, nsOptions->valuesToSet[i]);
+      } else {
+         appended = DynBuf_Append(buf, keyValueData, keyValueLength + 1);
+      }
+
+      if (!appended || !DynBuf_AppendString(buf, oldValue)) {
+         fprintf(stderr, "Could not construct request buffer\n");
+         goto exit;
+      }
+   }
+   retVal = TRUE;
+
+exit:
+   g_free(keyValueData);
+   g_free(numOps);
+   return retVal;
+}
+
+
+/*
+ ******************************************************************************
+ * SendNamespaceRequest --
+ *
+ * Sends a request to the namespace DB.
+ *
+ * @param[in]  nsOptions     Parsed namespace command line options.
+ * @param[in]  buf           Request buffer.
+ * @param[out] result        Result of the request, freed by the caller.
+ * @param[out] resultLen     Length of the result.
+ *
+ * @return TRUE if successful, FALSE otherwise.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+SendNamespaceRequest(NamespaceOptionsState *nsOptions, DynBuf *buf,
+                     char **result, size_t *resultLen)
+{
+   Bool status;
+
+   if (nsOptions->verboseLogFlag) {
+      PrintInternalCommand(DynBuf_Get(buf), DynBuf_GetSize(buf));
+   }
+
+   status = RpcChannel_SendOneRaw(DynBuf_Get(buf), DynBuf_GetSize(buf),
+                                  result, resultLen);
+   if (!status) {
+      fprintf(stderr, "failure: %s\n",
+            *result && **result ? *result : "unknown");
+   }
+   return status;
+}
+
+
+/*
+ ******************************************************************************
+ * GetNamespaceValue --
+ *
+ * Reads the value of one key.
+ *
+ * @param[in]  nsOptions     Parsed namespace command line options.
+ * @param[in]  key           Key to read.
+ * @param[out] value         Value of the key, "" if not set. Freed by the
+ *                           caller.
+ *
+ * @return TRUE if successful, FALSE otherwise.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GetNamespaceValue(NamespaceOptionsState *nsOptions, const gchar *key,
+                  gchar **value)
+{
+   char *result = NULL;
+   size_t resultLen = 0;
+   Bool status = FALSE;
+   DynBuf buf;
+
+   DynBuf_Init(&buf);
+   if (!DynBuf_Append(&buf, NSDB_PRIV_GET_VALUES_CMD,
+                      strlen(NSDB_PRIV_GET_VALUES_CMD)) ||
+       !DynBuf_Append(&buf, " ", 1) ||
+       !DynBuf_AppendString(&buf, nsOptions->nsName) ||
+       !DynBuf_AppendString(&buf, key)) {
+      fprintf(stderr, "Could not construct request buffer\n");
+   } else if (SendNamespaceRequest(nsOptions, &buf, &result, &resultLen)) {
+      *value = g_strndup(result != NULL ? result : "", resultLen);
+      status = TRUE;
+   }
+
+   free(result);
+   DynBuf_Destroy(&buf);
+   return status;
+}
+
+
+/*
+ ******************************************************************************
+ * WatchNamespaceValue --
+ *
+ * Processes the namespace command watch-value: waits for the value of a key
+ * to differ from the old value, or from its current value if none is given,
+ * and prints the new value.
+ *
+ * @param[in]  nsOptions     Parsed namespace command line options.
+ *
+ * @return TRUE if the value changed, FALSE on error or timeout.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+WatchNamespaceValue(NamespaceOptionsState *nsOptions)
+{
+   const gchar *key = nsOptions->keyNames[0];
+   gint64 deadline = 0;
+   gchar *oldValue;
+   Bool status = FALSE;
+
+   if (nsOptions->watchTimeout > 0) {
+      deadline = g_get_monotonic_time() +
+                 (gint64) nsOptions->watchTimeout * G_USEC_PER_SEC;
+   }
+
+   if (nsOptions->oldValuesToSet != NULL) {
+      oldValue = g_strdup(nsOptions->oldValuesToSet[0]);
+   } else if (!GetNamespaceValue(nsOptions, key, &oldValue)) {
+      goto exit;
+   }
+
+   for (;;) {
+      gint64 left = G_MAXINT64;
+      gchar *value;
+
+      if (deadline != 0) {
+         left = (deadline - g_get_monotonic_time()) / 1000;
+         if (left <= 0) {
+            fprintf(stderr, "%s: Key %s did not change in %d seconds\n",
+                    gAppName, key, nsOptions->watchTimeout);
+            break;
+         }
+      }
+      g_usleep(MIN(left, nsOptions->watchInterval) * 1000);
+
+      if (!GetNamespaceValue(nsOptions, key, &value)) {
+         break;
+      }
+      if (strcmp(value, oldValue) != 0) {
+         printf("%s", value);
+         fflush(stdout);
+         g_free(value);
+         status = TRUE;
+         break;
+      }
+      g_free(value);
+   }
+
+   g_free(oldValue);
+exit:
+   fflush(stderr);
+   return status;
+}
+
+
 /*
  ******************************************************************************
  * RunNamespaceCommand --
  *
- * Processes the namespace command for get/set/delete key.
+ * Processes the namespace command for get/set/delete key. All the keys of
+ * the command are read or updated with a single request.
+ *
  * @param[in]  nsOptions     Parsed namespace command line options will
  *                           be placed in this struct.
  *
@@ -302,14 +568,18 @@ RunNamespaceCommand(NamespaceOptionsState *nsOptions)
    char *result = NULL;
    size_t resultLen = 0;
    Bool status = FALSE;
-   gchar *opCode = NULL;
-   gchar *keyValueData = NULL;
-   gsize keyValueLength = 0;
+   Bool isGet = g_strcmp0(nsOptions->cmdName, NSDB_GET_VALUE_USER_CMD) == 0;
 
    const char *nscmd = GetInternalNamespaceCommand(nsOptions->cmdName);
 
    DynBuf buf;
    ASSERT(nscmd);
+   ASSERT(nsOptions->keyNames);
+
+   if (g_strcmp0(nsOptions->cmdName, NSDB_WATCH_VALUE_USER_CMD) == 0) {
+      return WatchNamespaceValue(nsOptions);
+   }
+
    DynBuf_Init(&buf);
    if (!DynBuf_Append(&buf, nscmd, strlen(nscmd)) ||
        !DynBuf_Append(&buf, " ", 1) ||
@@ -317,90 +587,44 @@ RunNamespaceCommand(NamespaceOptionsState *nsOptions)
       fprintf(stderr, "Could not construct request buffer\n");
       goto exit;
    }
-   if (strlen(nsOptions->oldValueToSet) == 0) {
-      opCode = g_strdup("0");
-   } else {
-      opCode = g_strdup("1");
-   }
-   if (g_strcmp0(nsOptions->cmdName, NSDB_GET_VALUE_USER_CMD) == 0) {
-      ASSERT(nsOptions->keyName);
-      if (!DynBuf_AppendString(&buf, nsOptions->keyName)) {
-         fprintf(stderr, "Could not construct request buffer\n");
-         goto exit;
-      }
-   } else if (g_strcmp0(nsOptions->cmdName, NSDB_SET_KEY_USER_CMD) == 0) {
-      ASSERT(nsOptions->keyName);
-      if (!DynBuf_AppendString(&buf, "1") || // numOps
-          !DynBuf_AppendString(&buf, opCode)||
-          !DynBuf_AppendString(&buf, nsOptions->keyName)) {
-         fprintf(stderr, "Could not construct request buffer\n");
-         goto exit;
-      }
-      if (nsOptions->getValueFromFile == NULL) {
-         if (nsOptions->valueToSet != NULL) {
-            if (strlen(nsOptions->valueToSet) == 0) {
-               fprintf(stderr, "%s: Key value must not be empty\n", gAppName);
-               goto exit;
-            }
-            if (!DynBuf_AppendString(&buf, nsOptions->valueToSet) ||
-                !DynBuf_AppendString(&buf, nsOptions->oldValueToSet)) {
-               fprintf(stderr, "Could not construct request buffer\n");
-               goto exit;
-            }
-         } else {
-            if (GetValueFromStdin(&keyValueData, &keyValueLength) == FALSE) {
-               goto exit;
-            }
-            if (!DynBuf_Append(&buf, keyValueData, keyValueLength + 1) ||
-                !DynBuf_AppendString(&buf, nsOptions->oldValueToSet)) {
-               fprintf(stderr, "Could not construct request buffer\n");
-               goto exit;
-            }
-         }
-      } else {
-         if (GetValueFromFile(nsOptions->getValueFromFile,
-                              &keyValueData, &keyValueLength) == FALSE) {
-            goto exit;
-         }
-         if (!DynBuf_Append(&buf, keyValueData, keyValueLength + 1) ||
-             !DynBuf_AppendString(&buf, nsOptions->oldValueToSet)) {
+   if (isGet) {
+      guint i;
+
+      for (i = 0; nsOptions->keyNames[i] != NULL; i++) {
+         if (!DynBuf_AppendString(&buf, nsOptions->keyNames[i])) {
             fprintf(stderr, "Could not construct request buffer\n");
             goto exit;
          }
       }
-   } else if (g_strcmp0(nsOptions->cmdName, NSDB_DEL_KEY_USER_CMD) == 0) {
-      ASSERT(nsOptions->keyName);
-      if (!DynBuf_AppendString(&buf, "1") ||
-          !DynBuf_AppendString(&buf, opCode) ||
-          !DynBuf_AppendString(&buf, nsOptions->keyName) ||
-          !DynBuf_AppendString(&buf, "") || // zero length for value to delete
-          !DynBuf_AppendString(&buf, nsOptions->oldValueToSet)) {
-         fprintf(stderr, "Could not construct request buffer\n");
-         goto exit;
-      }
-   }
-
-   if (nsOptions->verboseLogFlag) {
-      PrintInternalCommand(DynBuf_Get(&buf), DynBuf_GetSize(&buf));
+   } else if (!AppendSetKeyOps(nsOptions, &buf)) {
+      goto exit;
    }
 
-   status = RpcChannel_SendOneRaw(DynBuf_Get(&buf),
-                                  DynBuf_GetSize(&buf), &result, &resultLen);
-   if (!status) {
-      fprintf(stderr, "failure: %s\n",
-            result && *result ? result : "unknown");
-   } else {
+   status = SendNamespaceRequest(nsOptions, &buf, &result, &resultLen);
+   if (status) {
       char *p = result;
       if (resultLen == 0) {
          if (nsOptions->verboseLogFlag) {
             printf("success\n");
          }
       } else {
+         guint i = 0;
+
          if (nsOptions->verboseLogFlag) {
             printf("success - result:");
          }
          while (p < result + resultLen) {
-            printf("%s", p);
+            /*
+             * The values of several keys are printed one per line, after
+             * their key.
+             */
+            if (isGet && nsOptions->keyNames[1] != NULL) {
+               if (nsOptions->keyNames[i] != NULL) {
+                  printf("%s=%s\n", nsOptions->keyNames[i++], p);
+               }
+            } else {
+               printf("%s", p);
+            }
             p += strlen(p) + 1;
          }
       }
@@ -411,8 +635,6 @@ RunNamespaceCommand(NamespaceOptionsState *nsOptions)
  exit:
    DynBuf_Destroy(&buf);
    fflush(stderr);
-   g_free(keyValueData);
-   g_free(opCode);
    return status;
 }
 
@@ -452,7 +674,7 @@ PostVerifyGetValueOptions(GOptionContext *context, GOptionGroup *group,
       return FALSE;
    }
    if (g_strcmp0(nsOptions->cmdName, NSDB_GET_VALUE_USER_CMD) == 0) {
-      if (nsOptions->keyName == NULL) {
+      if (nsOptions->keyNames == NULL) {
          g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
                       "Key name must be specified");
          return FALSE;
@@ -498,11 +720,18 @@ PostVerifyDeleteKeyOptions(GOptionContext *context, GOptionGroup *group,
       return FALSE;
    }
    if (g_strcmp0(nsOptions->cmdName, NSDB_DEL_KEY_USER_CMD) == 0) {
-      if (nsOptions->keyName == NULL) {
+      if (nsOptions->keyNames == NULL) {
          g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
                "Key name must be specified");
          return FALSE;
       }
+      if (nsOptions->oldValuesToSet != NULL &&
+          g_strv_length(nsOptions->oldValuesToSet) !=
+          g_strv_length(nsOptions->keyNames)) {
+         g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "Each key name must have an old value");
+         return FALSE;
+      }
    }
    return TRUE;
 }
@@ -547,12 +776,12 @@ PostVerifySetKeyOptions(GOptionContext *context, GOptionGroup *group,
    if (g_strcmp0(nsOptions->cmdName, NSDB_SET_KEY_USER_CMD) == 0) {
       int usedOptions = 0;
 
-      if (nsOptions->keyName == NULL) {
+      if (nsOptions->keyNames == NULL) {
          g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
                      "Key name must be specified");
          return FALSE;
       }
-      if (nsOptions->valueToSet != NULL) {
+      if (nsOptions->valuesToSet != NULL) {
          ++usedOptions;
       }
       if (nsOptions->getValueFromFile != NULL) {
@@ -566,6 +795,80 @@ PostVerifySetKeyOptions(GOptionContext *context, GOptionGroup *group,
                      "Key value must be specified with either -f or -v or -s");
          return FALSE;
       }
+      if (nsOptions->valuesToSet != NULL ?
+          g_strv_length(nsOptions->valuesToSet) !=
+          g_strv_length(nsOptions->keyNames) :
+          nsOptions->keyNames[1] != NULL) {
+         g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "Each key name must have a value, -f and -s set "
+                     "a single key");
+         return FALSE;
+      }
+      if (nsOptions->oldValuesToSet != NULL &&
+          g_strv_length(nsOptions->oldValuesToSet) !=
+          g_strv_length(nsOptions->keyNames)) {
+         g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "Each key name must have an old value");
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * PostVerifyWatchValueOptions --
+ *
+ * Post parse hook to verify namespace command watch-value
+ *
+ * @param[in]  context    Unused.
+ * @param[in]  group      Unused.
+ * @param[in]  data       Unused.
+ * @param[out] error      Setting error message to display in case of invalid
+ *                        command line options.
+ *
+ * @return TRUE if successful, FALSE if option is invalid.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+PostVerifyWatchValueOptions(GOptionContext *context, GOptionGroup *group,
+                            gpointer data, GError **error)
+{
+   NamespaceOptionsState *nsOptions;
+
+   ASSERT(data);
+   nsOptions = (NamespaceOptionsState *) data;
+
+   if (nsOptions->cmdName == NULL) {
+      g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                  "Namespace command must be specified");
+      return FALSE;
+   }
+   if (nsOptions->nsName == NULL) {
+      g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                  "Namespace name must be specified");
+      return FALSE;
+   }
+   if (g_strcmp0(nsOptions->cmdName, NSDB_WATCH_VALUE_USER_CMD) == 0) {
+      if (nsOptions->keyNames == NULL || nsOptions->keyNames[1] != NULL) {
+         g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "One key name must be specified");
+         return FALSE;
+      }
+      if (nsOptions->oldValuesToSet != NULL &&
+          nsOptions->oldValuesToSet[1] != NULL) {
+         g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "At most one old value must be specified");
+         return FALSE;
+      }
+      if (nsOptions->watchTimeout < 0 || nsOptions->watchInterval <= 0) {
+         g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                     "Timeout and interval must be positive");
+         return FALSE;
+      }
    }
    return TRUE;
 }
@@ -593,8 +896,9 @@ main(int argc, char *argv[])
    GOptionContext *optCtx;
    GOptionGroup *gr;
    gchar *summary;
-   NamespaceOptionsState nsOptions = { NULL, NULL, NULL, NULL, "",
-                                       NULL, FALSE, FALSE};
+   NamespaceOptionsState nsOptions = { NULL, NULL, NULL, NULL, NULL, NULL, 0,
+                                       NSDB_WATCH_DEFAULT_INTERVAL_MS,
+                                       FALSE, FALSE};
 
    //Options for namespacetool commands
 
@@ -604,18 +908,22 @@ main(int argc, char *argv[])
       { NULL }
    };
    GOptionEntry getValuesEntry[] = {
-      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING, &nsOptions.keyName,
-        "Key value to return", "<key-name>" },
+      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING_ARRAY,
+        &nsOptions.keyNames, "Key value to return, may be repeated",
+        "<key-name>" },
       { NULL }
    };
    GOptionEntry setKeysEntry[] = {
-      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING,
-         &nsOptions.keyName, "Key name to use",  "<key-name>" },
-      { "value", 'v', 0, G_OPTION_ARG_STRING, &nsOptions.valueToSet,
-        "Value to set", "<value>"},
-      { "oldValue", 'o', 0, G_OPTION_ARG_STRING, &nsOptions.oldValueToSet,
+      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING_ARRAY,
+         &nsOptions.keyNames, "Key name to use, may be repeated",
+         "<key-name>" },
+      { "value", 'v', 0, G_OPTION_ARG_STRING_ARRAY, &nsOptions.valuesToSet,
+        "Value to set, once per key", "<value>"},
+      { "oldValue", 'o', 0, G_OPTION_ARG_STRING_ARRAY,
+        &nsOptions.oldValuesToSet,
         "Value must match with current key value in the "
-        "namespace for update operation to proceed", "<old-value>"},
+        "namespace for update operation to proceed, once per key",
+        "<old-value>"},
       { "fromFile", 'f', 0, G_OPTION_ARG_STRING, &nsOptions.getValueFromFile,
         "Value to use from file path", "<file-path>"},
       { "stdin", 's', 0, G_OPTION_ARG_NONE, &nsOptions.standardInput,
@@ -623,12 +931,27 @@ main(int argc, char *argv[])
       { NULL }
    };
    GOptionEntry deleteKeyEntry[] = {
-      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING,
-         &nsOptions.keyName, "Key name to use", "<key-name>"},
-      { "oldValue", 'o', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING,
-         &nsOptions.oldValueToSet,
+      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING_ARRAY,
+         &nsOptions.keyNames, "Key name to use, may be repeated",
+         "<key-name>"},
+      { "oldValue", 'o', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING_ARRAY,
+         &nsOptions.oldValuesToSet,
         "Value must match with current key value in "
-        "the namespace for delete operation to proceed", "<old-value>"},
+        "the namespace for delete operation to proceed, once per key",
+        "<old-value>"},
+      { NULL }
+   };
+   GOptionEntry watchValueEntry[] = {
+      { "key", 'k', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING_ARRAY,
+         &nsOptions.keyNames, "Key name to watch", "<key-name>"},
+      { "oldValue", 'o', G_OPTION_FLAG_NOALIAS, G_OPTION_ARG_STRING_ARRAY,
+         &nsOptions.oldValuesToSet,
+        "Wait for the key value to differ from this value instead of "
+        "from its current value", "<old-value>"},
+      { "timeout", 't', 0, G_OPTION_ARG_INT, &nsOptions.watchTimeout,
+        "Give up after this many seconds, 0 to wait forever", "<seconds>"},
+      { "interval", 'i', 0, G_OPTION_ARG_INT, &nsOptions.watchInterval,
+        "Read the key value at this interval", "<milliseconds>"},
       { NULL }
    };
 
@@ -639,7 +962,8 @@ main(int argc, char *argv[])
    gAppName = g_path_get_basename(argv[0]);
    g_set_prgname(gAppName);
 
-   optCtx = g_option_context_new("[get-value | set-key | delete-key] "
+   optCtx = g_option_context_new("[get-value | set-key | delete-key | "
+                                 "watch-value] "
                                   "[<namespace-name>]");
 
    gr = g_option_group_new("namespace commands", "", "", optCtx, NULL);
@@ -653,8 +977,14 @@ main(int argc, char *argv[])
                              "<namespace-name> -k <key-name> -s\n  %s "
                              "delete-key  <namespace-name> -k <key-name>"
                              "\n  %s get-value <namespace-name> "
-                             "-k <key-name>\n", gAppName,
-                              gAppName, gAppName, gAppName, gAppName);
+                             "-k <key-name>\n  %s get-value <namespace-name> "
+                             "-k <key-name> -k <key-name>\n  %s set-key "
+                             "<namespace-name> -k <key-name> -v <value> "
+                             "-o <old-value> -k <key-name> -v <value> "
+                             "-o <old-value>\n  %s watch-value "
+                             "<namespace-name> -k <key-name> -t <seconds>\n",
+                             gAppName, gAppName, gAppName, gAppName, gAppName,
+                             gAppName, gAppName, gAppName);
    g_option_context_set_summary(optCtx, summary);
 
    if (argc > 1) {
@@ -705,6 +1035,21 @@ main(int argc, char *argv[])
    g_option_context_add_group(optCtx, gr);
    g_option_group_set_parse_hooks(gr, NULL, PostVerifyDeleteKeyOptions);
 
+   //Namespacetool command - namespace-get-values until the value changes
+   descriptionBuf = g_strdup_printf("%s command %s:- Wait for a key value "
+                                    "to change\n", gAppName,
+                                    NSDB_WATCH_VALUE_USER_CMD);
+   helpBuf = g_strdup_printf("Show help for command \"%s\"",
+                              NSDB_WATCH_VALUE_USER_CMD);
+
+   gr = g_option_group_new(NSDB_WATCH_VALUE_USER_CMD, descriptionBuf, helpBuf,
+                           &nsOptions, NULL);
+   g_free(descriptionBuf);
+   g_free(helpBuf);
+   g_option_group_add_entries(gr, watchValueEntry);
+   g_option_context_add_group(optCtx, gr);
+   g_option_group_set_parse_hooks(gr, NULL, PostVerifyWatchValueOptions);
+
    if (!g_option_context_parse(optCtx, &argc, &argv, &gErr)) {
       PrintUsage(optCtx);
       fprintf(stderr, "%s: %s\n", gAppName, (gErr != NULL ? gErr->message : ""));
@@ -728,6 +1073,9 @@ main(int argc, char *argv[])
 
  exit:
    g_option_context_free(optCtx);
+   g_strfreev(nsOptions.keyNames);
+   g_strfreev(nsOptions.valuesToSet);
+   g_strfreev(nsOptions.oldValuesToSet);
    g_free(summary);
    g_free(gAppName);
    return success;
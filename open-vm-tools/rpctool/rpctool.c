@@ -42,6 +42,7 @@
 #define NOT_VMWARE_ERROR "Failed sending message to VMware.\n"
 
 int RpcToolCommand(int argc, char *argv[]);
+int RpcToolBatch(char delim);
 
 #ifndef _WIN32
 static Bool SetSignalHandler(int sig,
@@ -55,6 +56,11 @@ PrintUsage(void)
    fprintf(stderr, "rpctool syntax:\n\n");
    fprintf(stderr, "  -h | --help\tprint usage.\n");
    fprintf(stderr, "  rpctool <text>\tsend <text> as an RPC command.\n");
+   fprintf(stderr, "  rpctool --batch [--null]\n"
+                   "\tsend each line (or NUL terminated string with --null)\n"
+                   "\tread from stdin as an RPC command over one channel.\n"
+                   "\tEach reply is printed on one line as \"<status> <reply>\",\n"
+                   "\twith status 1 on success and 0 on failure.\n");
 }
 
 
@@ -142,6 +148,8 @@ int
 main(int argc, char *argv[])
 {
    int ret = 1;
+   Bool batch = FALSE;
+   char delim = '\n';
 
 #ifdef _WIN32
    WinUtil_EnableSafePathSearching(TRUE);
@@ -158,12 +166,23 @@ main(int argc, char *argv[])
       return 0;
    }
 
+   if (strcmp(argv[1], "--batch") == 0) {
+      batch = TRUE;
+      if (argc > 2) {
+         if (argc > 3 || strcmp(argv[2], "--null") != 0) {
+            PrintUsage();
+            return 1;
+         }
+         delim = '\0';
+      }
+   }
+
    argc--;
    argv++;
 
 #ifdef _WIN32
    __try {
-      ret = RpcToolCommand(argc, argv);
+      ret = batch ? RpcToolBatch(delim) : RpcToolCommand(argc, argv);
    } __except(ExceptionIsBackdoor(GetExceptionInformation()) ?
                EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
       fprintf(stderr, NOT_VMWARE_ERROR);
@@ -176,7 +195,7 @@ main(int argc, char *argv[])
 #  define ERROR_SIGNAL SIGSEGV
 #endif
    if (SetSignalHandler(ERROR_SIGNAL, SignalHandler, FALSE)) {
-      ret = RpcToolCommand(argc, argv);
+      ret = batch ? RpcToolBatch(delim) : RpcToolCommand(argc, argv);
    }
    SetSignalHandler(ERROR_SIGNAL, NULL, TRUE);
 #endif
@@ -198,6 +217,160 @@ RpcToolCommand(int argc, char *argv[])
    return (status == TRUE ? 0 : 1);
 }
 
+
+/*
+ * Reads the next command from stdin, up to the delimiter or the end of the
+ * input. The delimiter and, for line delimited input, a trailing carriage
+ * return are stripped. Returns FALSE at the end of the input.
+ */
+
+static Bool
+ReadCommand(char delim,      // IN
+            char **buf,      // IN/OUT
+            size_t *bufSize, // IN/OUT
+            size_t *len)     // OUT
+{
+   size_t n = 0;
+   int c;
+
+   while ((c = getchar()) != EOF && c != (unsigned char)delim) {
+      if (n + 1 >= *bufSize) {
+         size_t newSize = *bufSize == 0 ? 256 : *bufSize * 2;
+         char *newBuf = realloc(*buf, newSize);
+
+         if (newBuf == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(1);
+         }
+         *buf = newBuf;
+         *bufSize = newSize;
+      }
+      (*buf)[n++] = (char)c;
+   }
+
+   if (c == EOF && n == 0) {
+      return FALSE;
+   }
+
+   if (delim == '\n' && n > 0 && (*buf)[n - 1] == '\r') {
+      n--;
+   }
+   if (*buf != NULL) {
+      (*buf)[n] = '\0';
+   }
+   *len = n;
+   return TRUE;
+}
+
+
+/*
+ * Prints a reply on a single line, escaping the line breaks and backslashes
+ * so that scripts can match replies to commands line by line.
+ */
+
+static void
+PrintReply(Bool status,        // IN
+           const char *reply,  // IN
+           size_t repLen)      // IN
+{
+   size_t i;
+
+   printf("%d ", status ? 1 : 0);
+   for (i = 0; i < repLen; i++) {
+      switch (reply[i]) {
+      case '\n':
+         fputs("\\n", stdout);
+         break;
+      case '\r':
+         fputs("\\r", stdout);
+         break;
+      case '\\':
+         fputs("\\\\", stdout);
+         break;
+      case '\0':
+         fputs("\\0", stdout);
+         break;
+      default:
+         putchar(reply[i]);
+         break;
+      }
+   }
+   putchar('\n');
+}
+
+
+/*
+ * Sends the commands read from stdin over a single RPC channel. The channel
+ * is reopened once if a send fails, e.g. after the VM was migrated. Returns
+ * 0 if all the commands succeeded, 1 otherwise.
+ *
+ * The backdoor channel is synchronous so the commands are sent one after
+ * the other; the saving comes from opening the channel only once.
+ */
+
+int
+RpcToolBatch(char delim)  // IN
+{
+   RpcOut *out = RpcOut_Construct();
+   Bool started = FALSE;
+   char *cmd = NULL;
+   size_t cmdSize = 0;
+   size_t cmdLen;
+   int ret = 0;
+
+   if (out == NULL) {
+      fprintf(stderr, "Out of memory.\n");
+      return 1;
+   }
+
+   while (ReadCommand(delim, &cmd, &cmdSize, &cmdLen)) {
+      Bool rpcStatus = FALSE;
+      char const *reply = NULL;
+      size_t repLen = 0;
+      Bool sent = FALSE;
+      int attempt;
+
+      if (cmdLen == 0) {
+         continue;
+      }
+
+      for (attempt = 0; attempt < 2 && !sent; attempt++) {
+         if (!started) {
+            started = RpcOut_start(out);
+            if (!started) {
+               continue;
+            }
+         }
+         sent = RpcOut_send(out, cmd, cmdLen, &rpcStatus, &reply, &repLen);
+         if (!sent) {
+            RpcOut_stop(out);
+            started = FALSE;
+         }
+      }
+
+      if (!sent) {
+         if (reply == NULL) {
+            reply = "Failed to open the RPC channel";
+            repLen = strlen(reply);
+         }
+         rpcStatus = FALSE;
+      }
+
+      PrintReply(rpcStatus, reply, repLen);
+      if (!rpcStatus) {
+         ret = 1;
+      }
+   }
+
+   fflush(stdout);
+   if (started) {
+      RpcOut_stop(out);
+   }
+   RpcOut_Destruct(out);
+   free(cmd);
+   return ret;
+}
+
 void
 Panic(const char *fmt, ...)
 {
@@ -33,7 +33,6 @@
 #include "vmware.h"
 #include "conf.h"
 #include "dynbuf.h"
-#include "escape.h"
 #include "str.h"
 #include "util.h"
 #include "vm_atomic.h"
@@ -82,6 +81,29 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
  */
 #define APP_INFO_CONF_USE_WMI_DEFAULT_VALUE    FALSE
 
+/**
+ * Default value for CONFNAME_APPINFO_WATCHPROCESSES setting in
+ * tools configuration file.
+ *
+ * TRUE will track the processes from the proc connector on Linux.
+ */
+#define APP_INFO_CONF_WATCH_PROCESSES_DEFAULT_VALUE TRUE
+
+/**
+ * Default value for CONFNAME_APPINFO_MAXCHUNKS setting in
+ * tools configuration file, and the largest value allowed.
+ */
+#define APP_INFO_CONF_MAX_CHUNKS_DEFAULT_VALUE 8
+#define APP_INFO_MAX_CHUNKS 64
+
+/**
+ * Default value for CONFNAME_APPINFO_GROUPDUPLICATES setting in
+ * tools configuration file.
+ *
+ * FALSE will describe each process, like the previous versions.
+ */
+#define APP_INFO_CONF_GROUP_DUPLICATES_DEFAULT_VALUE FALSE
+
 /**
  * Defines the current poll interval (in seconds).
  *
@@ -99,51 +121,56 @@ static gboolean gAppInfoEnabledInHost = TRUE;
  */
 static GSource *gAppInfoTimeoutSource = NULL;
 
+/**
+ * Number of guest variables the application information was last published
+ * into.
+ */
+static Atomic_uint32 gAppInfoChunkCount = {0};
+
+/**
+ * Location of the JSON description of an application in the buffer of all
+ * of them.
+ */
+typedef struct AppInfoJSONRange {
+   guint start;
+   guint len;
+} AppInfoJSONRange;
+
 static void TweakGatherLoop(ToolsAppCtx *ctx, gboolean force);
+static void AppInfoGatherTask(ToolsAppCtx *ctx, gpointer data);
 
 
 /*
  *****************************************************************************
- * EscapeJSONString --
- *
- * Escapes a string to be included in JSON content.
+ * AppInfoAppendJSONString --
  *
- * @param[in] str The string to be escaped.
+ * Appends a string to JSON content, escaping the '"' and '\' characters.
  *
- * @retval Pointer to a heap-allocated memory. This holds the escaped content
- *         of the string passed by the caller.
+ * @param[in,out] buf  The JSON content.
+ * @param[in]     str  The string to be escaped.
  *
  *****************************************************************************
  */
 
-static char *
-EscapeJSONString(const char *str)    // IN
+static void
+AppInfoAppendJSONString(DynBuf *buf,         // IN/OUT
+                        const char *str)     // IN
 {
-   /*
-    * Escape '"' and '\' characters in the JSON string.
-    */
-
-   static const int bytesToEscape[] = {
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,   // "
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,   // '\'
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-   };
-
-   return Escape_DoString("\\u00", bytesToEscape, str, strlen(str),
-                          NULL);
+   static const char hexDigits[] = "0123456789ABCDEF";
+   const char *unescaped = str;
+
+   for (; *str != '\0'; str++) {
+      if (*str == '"' || *str == '\\') {
+         char escSeq[] = { '\\', 'u', '0', '0',
+                           hexDigits[(unsigned char)*str >> 4],
+                           hexDigits[*str & 0xF] };
+
+         DynBuf_SafeAppend(buf, unescaped, str - unescaped);
+         DynBuf_SafeAppend(buf, escSeq, sizeof escSeq);
+         unescaped = str + 1;
+      }
+   }
+   DynBuf_SafeAppend(buf, unescaped, str - unescaped);
 }
 
 
@@ -229,7 +256,14 @@ AppInfo_GetAppList(GKeyFile *config)     // IN
    Bool useWMI;
 #endif
 
-   procList = ProcMgr_ListProcesses();
+#if defined(__linux__)
+   if (AppInfo_GetWatchedAppList(&appList)) {
+      return appList;
+   }
+#endif
+
+   /* Only the names are reported. */
+   procList = ProcMgr_ListProcessesSelect(PROCMGR_INFO_CMDNAME);
 
    if (procList == NULL) {
       g_warning("%s: Failed to get the list of processes.\n", __FUNCTION__);
@@ -265,12 +299,201 @@ AppInfo_GetAppList(GKeyFile *config)     // IN
 }
 
 
+/*
+ *****************************************************************************
+ * AppInfoChunkKey --
+ *
+ * Returns the guest variable name of a chunk of the application information.
+ *
+ * @param[in]  chunk   Index of the chunk.
+ * @param[out] key     Buffer for the name.
+ * @param[in]  keySize Size of the buffer.
+ *
+ * @retval The name.
+ *
+ *****************************************************************************
+ */
+
+static const char *
+AppInfoChunkKey(unsigned int chunk,    // IN
+                char *key,             // OUT
+                size_t keySize)        // IN
+{
+   if (chunk == 0) {
+      return APP_INFO_GUESTVAR_KEY;
+   }
+
+   Str_Sprintf(key, keySize, "%s.%u", APP_INFO_GUESTVAR_KEY, chunk);
+   return key;
+}
+
+
+/*
+ *****************************************************************************
+ * AppInfoClearChunks --
+ *
+ * Clears the chunks of a previous publication that the last one did not
+ * overwrite.
+ *
+ * @param[in]  ctx         The application context.
+ * @param[in]  chunkCount  Number of chunks in use, 0 to clear everything.
+ *
+ *****************************************************************************
+ */
+
+static void
+AppInfoClearChunks(ToolsAppCtx *ctx,         // IN
+                   unsigned int chunkCount)  // IN
+{
+   unsigned int lastCount = Atomic_ReadWrite32(&gAppInfoChunkCount,
+                                               chunkCount);
+   unsigned int i;
+
+   for (i = chunkCount; i < MAX(lastCount, 1); i++) {
+      char key[64];
+
+      SetGuestInfo(ctx, AppInfoChunkKey(i, key, sizeof key), "");
+   }
+}
+
+
+/*
+ *****************************************************************************
+ * AppInfoWriteApp --
+ *
+ * Appends the JSON description of an application.
+ *
+ * @param[in,out] apps     The descriptions.
+ * @param[in,out] ranges   Where each description is in apps.
+ * @param[in]     appInfo  The application.
+ * @param[in]     count    Number of identical applications.
+ *
+ *****************************************************************************
+ */
+
+static void
+AppInfoWriteApp(DynBuf *apps,              // IN/OUT
+                GArray *ranges,            // IN/OUT
+                const AppInfo *appInfo,    // IN
+                guint count)               // IN
+{
+   static const char nameKey[] = "{\"" APP_INFO_KEY_APP_NAME "\":\"";
+   static const char versionKey[] = "\",\"" APP_INFO_KEY_APP_VERSION "\":\"";
+   static const char end[] = "\"}";
+   AppInfoJSONRange range;
+
+   range.start = DynBuf_GetSize(apps);
+   DynBuf_SafeAppend(apps, nameKey, sizeof nameKey - 1);
+   AppInfoAppendJSONString(apps, appInfo->appName);
+   DynBuf_SafeAppend(apps, versionKey, sizeof versionKey - 1);
+   AppInfoAppendJSONString(apps, appInfo->version);
+   if (count > 1) {
+      char tmpBuf[32];
+      int len = Str_Sprintf(tmpBuf, sizeof tmpBuf,
+                            "\",\"" APP_INFO_KEY_APP_COUNT "\":\"%u", count);
+
+      DynBuf_SafeAppend(apps, tmpBuf, len);
+   }
+   DynBuf_SafeAppend(apps, end, sizeof end - 1);
+   range.len = DynBuf_GetSize(apps) - range.start;
+   g_array_append_val(ranges, range);
+}
+
+
+/*
+ *****************************************************************************
+ * AppInfoWriteApps --
+ *
+ * Writes the JSON description of each application into one buffer.
+ * Identical applications are described once with their number if so
+ * configured.
+ *
+ * @param[in]  ctx      The application context.
+ * @param[in]  appList  The applications.
+ * @param[out] apps     The descriptions, one after the other.
+ * @param[out] ranges   Where each description is in apps.
+ *
+ *****************************************************************************
+ */
+
+static void
+AppInfoWriteApps(ToolsAppCtx *ctx,      // IN
+                 GSList *appList,       // IN
+                 DynBuf *apps,          // OUT
+                 GArray *ranges)        // OUT
+{
+   GSList *appNode;
+   GHashTable *groups;
+   GArray *counts;
+   GPtrArray *unique;
+   guint i;
+
+   if (!VMTools_ConfigGetBoolean(ctx->config,
+                                 CONFGROUPNAME_APPINFO,
+                                 CONFNAME_APPINFO_GROUPDUPLICATES,
+                                 APP_INFO_CONF_GROUP_DUPLICATES_DEFAULT_VALUE)) {
+      for (appNode = appList; appNode != NULL; appNode = appNode->next) {
+         AppInfo *appInfo = (AppInfo *) appNode->data;
+
+         if (appInfo->appName != NULL && appInfo->version != NULL) {
+            AppInfoWriteApp(apps, ranges, appInfo, 1);
+         }
+      }
+      return;
+   }
+
+   /*
+    * Group in the order of the list, which is sorted by importance.
+    */
+   groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+   counts = g_array_new(FALSE, FALSE, sizeof (guint));
+   unique = g_ptr_array_new();
+
+   for (appNode = appList; appNode != NULL; appNode = appNode->next) {
+      AppInfo *appInfo = (AppInfo *) appNode->data;
+      gchar *key;
+      gpointer index;
+
+      if (appInfo->appName == NULL ||
+          appInfo->version == NULL) {
+         continue;
+      }
+
+      key = g_strconcat(appInfo->appName, "\n", appInfo->version, NULL);
+      if (g_hash_table_lookup_extended(groups, key, NULL, &index)) {
+         g_array_index(counts, guint, GPOINTER_TO_UINT(index))++;
+         g_free(key);
+      } else {
+         guint one = 1;
+
+         g_hash_table_insert(groups, key, GUINT_TO_POINTER(unique->len));
+         g_array_append_val(counts, one);
+         g_ptr_array_add(unique, appInfo);
+      }
+   }
+
+   for (i = 0; i < unique->len; i++) {
+      AppInfoWriteApp(apps, ranges, g_ptr_array_index(unique, i),
+                      g_array_index(counts, guint, i));
+   }
+
+   g_hash_table_destroy(groups);
+   g_array_free(counts, TRUE);
+   g_ptr_array_free(unique, TRUE);
+}
+
+
 /*
  *****************************************************************************
  * AppInfoGatherTask --
  *
  * Collects all the desired application related information and updates VMX.
  *
+ * The applications that do not fit in MAX_APP_INFO_SIZE continue in the
+ * chunks guestinfo.appInfo.1, guestinfo.appInfo.2, etc. Each chunk is a
+ * complete document with the same header, so the first one can still be
+ * read on its own.
+ *
  * @param[in]  ctx     The application context.
  * @param[in]  data    Unused
  *
@@ -281,14 +504,21 @@ static void
 AppInfoGatherTask(ToolsAppCtx *ctx,    // IN
                   gpointer data)       // IN
 {
-   DynBuf dynBuffer;
+   DynBuf apps;
+   DynBuf chunkBuf;
+   GArray *ranges;
+   GArray *chunkStarts;
    char tmpBuf[1024];
+   char chunkInfo[128];
    int len;
    gchar *tstamp = NULL;
-   char *escapedCmd = NULL;
-   char *escapedVersion = NULL;
    GSList *appList = NULL;
-   GSList *appNode;
+   gint maxChunks;
+   guint chunkCount;
+   guint chunk;
+   guint i;
+   size_t budget;
+   size_t used;
    static Atomic_uint64 updateCounter = {0};
    uint64 counter = (uint64) Atomic_ReadInc64(&updateCounter) + 1;
 
@@ -296,100 +526,135 @@ AppInfoGatherTask(ToolsAppCtx *ctx,    // IN
                      "\"" APP_INFO_KEY_VERSION        "\":\"%d\", \n"
                      "\"" APP_INFO_KEY_UPDATE_COUNTER "\":\"%"FMT64"d\", \n"
                      "\"" APP_INFO_KEY_PUBLISHTIME    "\":\"%s\", \n"
+                     "%s"
                      "\"" APP_INFO_KEY_APPS           "\":[";
-   static char jsonPerAppFmt[] =
-                           "%s\n" // , for all the elements after the first one
-                           "{"
-                           "\"" APP_INFO_KEY_APP_NAME    "\":\"%s\""
-                           ","
-                           "\"" APP_INFO_KEY_APP_VERSION "\":\"%s\""
-                           "}";
+   static char chunkFmt[] =
+                     "\"" APP_INFO_KEY_CHUNK          "\":\"%u\", \n"
+                     "\"" APP_INFO_KEY_CHUNK_COUNT    "\":\"%u\", \n";
    static char jsonSuffix[] = "]}";
 
-   DynBuf_Init(&dynBuffer);
+   maxChunks = VMTools_ConfigGetInteger(ctx->config,
+                                        CONFGROUPNAME_APPINFO,
+                                        CONFNAME_APPINFO_MAXCHUNKS,
+                                        APP_INFO_CONF_MAX_CHUNKS_DEFAULT_VALUE);
+   if (maxChunks < 1 || maxChunks > APP_INFO_MAX_CHUNKS) {
+      g_warning("%s: Invalid %s %d. Using default %d.\n", __FUNCTION__,
+                CONFNAME_APPINFO_MAXCHUNKS, maxChunks,
+                APP_INFO_CONF_MAX_CHUNKS_DEFAULT_VALUE);
+      maxChunks = APP_INFO_CONF_MAX_CHUNKS_DEFAULT_VALUE;
+   }
+
+   /*
+    * The descriptions of all the applications are written once into a
+    * single buffer, then copied into the chunks.
+    */
+   DynBuf_Init(&apps);
+   DynBuf_EnsureMinSize(&apps, MAX_APP_INFO_SIZE);
+   DynBuf_Init(&chunkBuf);
+   DynBuf_EnsureMinSize(&chunkBuf, MAX_APP_INFO_SIZE);
+   ranges = g_array_new(FALSE, FALSE, sizeof (AppInfoJSONRange));
+   chunkStarts = g_array_new(FALSE, FALSE, sizeof (guint));
 
    tstamp = VMTools_GetTimeAsString();
 
+   appList = AppInfo_SortAppList(AppInfo_GetAppList(ctx->config));
+   AppInfoWriteApps(ctx, appList, &apps, ranges);
+
+   /*
+    * Room left in each chunk by the largest header.
+    */
+   Str_Sprintf(chunkInfo, sizeof chunkInfo, chunkFmt, MAX_UINT32, MAX_UINT32);
    len = Str_Snprintf(tmpBuf, sizeof tmpBuf, headerFmt,
                       APP_INFO_VERSION_1,
                       counter,
-                      tstamp != NULL ? tstamp : "");
+                      tstamp != NULL ? tstamp : "",
+                      chunkInfo);
 
    if (len < 0) {
       g_warning("%s: Insufficient space for the header.\n", __FUNCTION__);
       goto abort;
    }
+   budget = MAX_APP_INFO_SIZE - len - sizeof jsonSuffix;
 
-   DynBuf_Append(&dynBuffer, tmpBuf, len);
-
-   appList = AppInfo_SortAppList(AppInfo_GetAppList(ctx->config));
-
-   for (appNode = appList; appNode != NULL; appNode = appNode->next) {
-      size_t currentBufferSize = DynBuf_GetSize(&dynBuffer);
-      AppInfo *appInfo = (AppInfo *) appNode->data;
+   /*
+    * Split the descriptions into chunks first, their number is part of
+    * each header.
+    */
+   used = budget;
+   for (i = 0; i < ranges->len; i++) {
+      AppInfoJSONRange *range = &g_array_index(ranges, AppInfoJSONRange, i);
 
-      if (appInfo->appName == NULL ||
-          appInfo->version == NULL) {
-         goto next_entry;
+      if (1 + range->len > budget) {
+         g_warning("%s: Insufficient space for the application information.\n",
+                   __FUNCTION__);
+         g_array_remove_index(ranges, i--);
+         continue;
       }
 
-      escapedCmd = EscapeJSONString(appInfo->appName);
-
-      if (NULL == escapedCmd) {
-         g_warning("%s: Failed to escape the content of cmdName.\n",
-                   __FUNCTION__);
-         goto abort;
+      /*
+       * Each description is preceded by '\n', and by ',' if not the first.
+       */
+      if (used + 2 + range->len > budget) {
+         if (chunkStarts->len == (guint) maxChunks) {
+            g_warning("%s: Exceeded the max info packet size in %u chunks."
+                      " Truncating the rest of the applications.\n",
+                      __FUNCTION__, chunkStarts->len);
+            g_array_set_size(ranges, i);
+            break;
+         }
+         g_array_append_val(chunkStarts, i);
+         used = 1 + range->len;
+      } else {
+         used += 2 + range->len;
       }
+   }
 
-      escapedVersion = EscapeJSONString(appInfo->version);
-      if (NULL == escapedVersion) {
-         g_warning("%s: Failed to escape the content of version information.\n",
-                   __FUNCTION__);
-         goto abort;
+   chunkCount = MAX(chunkStarts->len, 1);
+   for (chunk = 0; chunk < chunkCount; chunk++) {
+      char key[64];
+      guint first = chunk < chunkStarts->len ?
+                    g_array_index(chunkStarts, guint, chunk) : 0;
+      guint last = chunk + 1 < chunkStarts->len ?
+                   g_array_index(chunkStarts, guint, chunk + 1) : ranges->len;
+
+      chunkInfo[0] = '\0';
+      if (chunkCount > 1) {
+         Str_Sprintf(chunkInfo, sizeof chunkInfo, chunkFmt, chunk, chunkCount);
       }
+      len = Str_Snprintf(tmpBuf, sizeof tmpBuf, headerFmt,
+                         APP_INFO_VERSION_1,
+                         counter,
+                         tstamp != NULL ? tstamp : "",
+                         chunkInfo);
+
+      DynBuf_SetSize(&chunkBuf, 0);
+      DynBuf_Append(&chunkBuf, tmpBuf, len);
+
+      for (i = first; i < last; i++) {
+         AppInfoJSONRange *range = &g_array_index(ranges, AppInfoJSONRange, i);
 
-      if (appNode == appList) {
-         len = Str_Snprintf(tmpBuf, sizeof tmpBuf, jsonPerAppFmt,
-                            "", escapedCmd, escapedVersion);
-      } else {
          /*
           * If this is not the first element, then add ',' at the beginning.
           */
-         len = Str_Snprintf(tmpBuf, sizeof tmpBuf, jsonPerAppFmt,
-                            ",", escapedCmd, escapedVersion);
+         DynBuf_Append(&chunkBuf, i == first ? "\n" : ",\n", i == first ? 1 : 2);
+         DynBuf_Append(&chunkBuf, (char *) DynBuf_Get(&apps) + range->start,
+                       range->len);
       }
 
-      if (len < 0) {
-         g_warning("%s: Insufficient space for the application information.\n",
-                   __FUNCTION__);
-         goto next_entry;
-      }
-
-      if (currentBufferSize + len + sizeof jsonSuffix > MAX_APP_INFO_SIZE) {
-         g_warning("%s: Exceeded the max info packet size."
-                   " Truncating the rest of the applications.\n",
-                   __FUNCTION__);
-         break;
-      }
-
-      DynBuf_Append(&dynBuffer, tmpBuf, len);
-
-next_entry:
-      free(escapedCmd);
-      escapedCmd = NULL;
-      free(escapedVersion);
-      escapedVersion = NULL;
+      DynBuf_Append(&chunkBuf, jsonSuffix, sizeof jsonSuffix - 1);
+      SetGuestInfo(ctx, AppInfoChunkKey(chunk, key, sizeof key),
+                   DynBuf_GetString(&chunkBuf));
    }
 
-   DynBuf_Append(&dynBuffer, jsonSuffix, sizeof jsonSuffix - 1);
-   SetGuestInfo(ctx, APP_INFO_GUESTVAR_KEY, DynBuf_GetString(&dynBuffer));
+   AppInfoClearChunks(ctx, chunkCount);
 
 abort:
-   free(escapedCmd);
-   free(escapedVersion);
    AppInfo_DestroyAppList(appList);
    g_free(tstamp);
-   DynBuf_Destroy(&dynBuffer);
+   g_array_free(chunkStarts, TRUE);
+   g_array_free(ranges, TRUE);
+   DynBuf_Destroy(&chunkBuf);
+   DynBuf_Destroy(&apps);
 }
 
 
@@ -416,7 +681,13 @@ AppInfoGather(gpointer data)      // IN
    g_debug("%s: Submitting a task to capture application information.\n",
            __FUNCTION__);
 
-   if (!ToolsCorePool_SubmitTask(ctx, AppInfoGatherTask, NULL, NULL)) {
+#if defined(__linux__)
+   AppInfo_ProcWatchRescan();
+#endif
+
+   if (!ToolsCorePool_SubmitPluginTask(ctx, "appInfo",
+                                       TOOLS_CORE_POOL_CLASS_BACKGROUND,
+                                       AppInfoGatherTask, NULL, NULL)) {
       g_warning("%s: Failed to submit the task for capturing application "
                 "information\n", __FUNCTION__);
    }
@@ -427,6 +698,32 @@ AppInfoGather(gpointer data)      // IN
 }
 
 
+#if defined(__linux__)
+/*
+ *****************************************************************************
+ * AppInfoProcessesChanged --
+ *
+ * Publishes the application information when the set of the tracked
+ * applications changed, without waiting for the next poll.
+ *
+ * @param[in]  ctx     The application context.
+ *
+ *****************************************************************************
+ */
+
+static void
+AppInfoProcessesChanged(ToolsAppCtx *ctx)      // IN
+{
+   if (!ToolsCorePool_SubmitPluginTask(ctx, "appInfo",
+                                       TOOLS_CORE_POOL_CLASS_BACKGROUND,
+                                       AppInfoGatherTask, NULL, NULL)) {
+      g_warning("%s: Failed to submit the task for capturing application "
+                "information\n", __FUNCTION__);
+   }
+}
+#endif
+
+
 /*
  *****************************************************************************
  * TweakGatherLoopEx --
@@ -465,13 +762,15 @@ TweakGatherLoopEx(ToolsAppCtx *ctx,       // IN
       }
 
       gAppInfoTimeoutSource = g_timeout_source_new(pollInterval * 1000);
+      ToolsCorePool_SetSourceClass(gAppInfoTimeoutSource,
+                                   TOOLS_CORE_POOL_CLASS_BACKGROUND);
       VMTOOLSAPP_ATTACH_SOURCE(ctx, gAppInfoTimeoutSource,
                                AppInfoGather, ctx, NULL);
       g_source_unref(gAppInfoTimeoutSource);
    } else if (gAppInfoPollInterval > 0) {
       g_info("%s: Poll loop for %s disabled.\n",
              __FUNCTION__, CONFNAME_APPINFO_POLLINTERVAL);
-      SetGuestInfo(ctx, APP_INFO_GUESTVAR_KEY, "");
+      AppInfoClearChunks(ctx, 0);
    }
 
    gAppInfoPollInterval = pollInterval;
@@ -530,6 +829,22 @@ TweakGatherLoop(ToolsAppCtx *ctx,  // IN
        */
       TweakGatherLoopEx(ctx, (guint) pollInterval);
    }
+
+#if defined(__linux__)
+   /*
+    * Track the processes while the gather loop runs, so that the changes
+    * are published as they happen and the polls do not scan /proc twice.
+    */
+   if (pollInterval > 0 &&
+       VMTools_ConfigGetBoolean(ctx->config,
+                                CONFGROUPNAME_APPINFO,
+                                CONFNAME_APPINFO_WATCHPROCESSES,
+                                APP_INFO_CONF_WATCH_PROCESSES_DEFAULT_VALUE)) {
+      AppInfo_StartProcWatch(ctx, AppInfoProcessesChanged);
+   } else {
+      AppInfo_StopProcWatch();
+   }
+#endif
 }
 
 
@@ -580,7 +895,11 @@ AppInfoServerShutdown(gpointer src,          // IN
       gAppInfoTimeoutSource = NULL;
    }
 
-   SetGuestInfo(ctx, APP_INFO_GUESTVAR_KEY, "");
+#if defined(__linux__)
+   AppInfo_StopProcWatch();
+#endif
+
+   AppInfoClearChunks(ctx, 0);
 }
 
 
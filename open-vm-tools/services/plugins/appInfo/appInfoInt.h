@@ -69,4 +69,13 @@ AppInfo *AppInfo_GetAppInfo(ProcMgrProcInfo *procInfo, Bool useWMI);
 AppInfo *AppInfo_GetAppInfo(ProcMgrProcInfo *procInfo);
 #endif
 
+#if defined(__linux__)
+typedef void (*AppInfoChangeCb)(ToolsAppCtx *ctx);
+
+Bool AppInfo_StartProcWatch(ToolsAppCtx *ctx, AppInfoChangeCb cb);
+void AppInfo_ProcWatchRescan(void);
+Bool AppInfo_GetWatchedAppList(GSList **appList);
+void AppInfo_StopProcWatch(void);
+#endif
+
 #endif /* _APPINFOINT_H_ */
@@ -0,0 +1,727 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file appInfoProcLinux.c
+ *
+ * Tracks the running processes from the proc connector of the Linux kernel,
+ * so that the application list is known without scanning /proc.
+ *
+ * The table is seeded by a full process listing, then updated from the fork,
+ * exec and exit events. The callback is only invoked when the set of
+ * application names changes, once the events of a burst are coalesced, so
+ * that short lived processes and workers coming and going do not cause
+ * updates. The process listing is redone when the kernel drops events, and
+ * on every poll, which keeps the names of the processes that rewrite their
+ * command line.
+ *
+ * Subscribing to the proc connector needs CAP_NET_ADMIN. Without it, the
+ * plugin keeps listing the processes on each poll.
+ */
+
+#ifndef __linux__
+#   error This file should not be compiled.
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <linux/cn_proc.h>
+
+#include "appInfoInt.h"
+#include "vmware.h"
+#include "str.h"
+#include "util.h"
+#include "vmware/tools/utils.h"
+
+/**
+ * How long to coalesce the changes before reporting them, in milliseconds.
+ * This is also the shortest interval between two reports.
+ */
+#define APP_INFO_CHANGE_DELAY_MS   (30 * 1000)
+
+typedef struct AppInfoProcName {
+   guint             count;      /* Number of processes with this name. */
+   char              name[];
+} AppInfoProcName;
+
+typedef struct AppInfoProcWatch {
+   ToolsAppCtx      *ctx;
+   AppInfoChangeCb   cb;
+   GSource          *eventSource;
+   GSource          *delaySource;
+   GHashTable       *procs;      /* pid -> AppInfoProcName, owned by names. */
+   GHashTable       *names;      /* name -> AppInfoProcName. */
+   gboolean          changed;    /* Set of names changed since reported. */
+} AppInfoProcWatch;
+
+/*
+ * The watch is updated from the main loop, and the application list is read
+ * by the gather task from the thread pool.
+ */
+static GMutex gProcWatchLock;
+static AppInfoProcWatch *gProcWatch = NULL;
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcReadName --                                                */ /**
+ *
+ * Reads the command name of a process the way ProcMgr_ListProcesses()
+ * reports it: the base name of the first argument if it is an absolute
+ * path, the first argument otherwise, or the name from the status file for
+ * the processes without a command line.
+ *
+ * @param[in]  pid      The process.
+ *
+ * @return The name, to be freed by the caller, or NULL if the process is
+ *         gone.
+ *
+ ******************************************************************************
+ */
+
+static gchar *
+AppInfoProcReadName(pid_t pid)
+{
+   char path[64];
+   char buf[4096];
+   ssize_t len;
+   char *name;
+   int fd;
+
+   Str_Sprintf(path, sizeof path, "/proc/%d/cmdline", (int)pid);
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      return NULL;
+   }
+   len = read(fd, buf, sizeof buf - 1);
+   close(fd);
+   if (len < 0) {
+      return NULL;
+   }
+   buf[len] = '\0';
+
+   if (len > 0) {
+      char *slash = strrchr(buf, '/');
+
+      name = buf[0] == '/' && slash != NULL ? slash + 1 : buf;
+      return g_strdup(name);
+   }
+
+   Str_Sprintf(path, sizeof path, "/proc/%d/status", (int)pid);
+   fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      return NULL;
+   }
+   len = read(fd, buf, sizeof buf - 1);
+   close(fd);
+   if (len <= 0) {
+      return g_strdup("");
+   }
+   buf[len] = '\0';
+
+   name = buf + strcspn(buf, " \t\n");
+   name += strspn(name, " \t\n");
+   name[strcspn(name, "\n")] = '\0';
+   return g_strdup(name);
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcRemove --                                                  */ /**
+ *
+ * Removes a process from the table. The watch lock must be held.
+ *
+ * @param[in]  watch    The watch.
+ * @param[in]  pid      The process.
+ *
+ ******************************************************************************
+ */
+
+static void
+AppInfoProcRemove(AppInfoProcWatch *watch,
+                  pid_t pid)
+{
+   AppInfoProcName *entry = g_hash_table_lookup(watch->procs,
+                                                GINT_TO_POINTER(pid));
+
+   if (entry == NULL) {
+      return;
+   }
+   g_hash_table_remove(watch->procs, GINT_TO_POINTER(pid));
+
+   if (--entry->count == 0) {
+      g_hash_table_remove(watch->names, entry->name);
+      watch->changed = TRUE;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcSet --                                                     */ /**
+ *
+ * Sets the name of a process, adding it to the table if needed. The watch
+ * lock must be held.
+ *
+ * @param[in]  watch    The watch.
+ * @param[in]  pid      The process.
+ * @param[in]  name     Its name.
+ *
+ ******************************************************************************
+ */
+
+static void
+AppInfoProcSet(AppInfoProcWatch *watch,
+               pid_t pid,
+               const gchar *name)
+{
+   AppInfoProcName *entry = g_hash_table_lookup(watch->procs,
+                                                GINT_TO_POINTER(pid));
+
+   if (entry != NULL) {
+      if (strcmp(entry->name, name) == 0) {
+         return;
+      }
+      AppInfoProcRemove(watch, pid);
+   }
+
+   entry = g_hash_table_lookup(watch->names, name);
+   if (entry == NULL) {
+      size_t len = strlen(name);
+
+      entry = g_malloc(sizeof *entry + len + 1);
+      entry->count = 0;
+      memcpy(entry->name, name, len + 1);
+      g_hash_table_insert(watch->names, entry->name, entry);
+      watch->changed = TRUE;
+   }
+   entry->count++;
+   g_hash_table_insert(watch->procs, GINT_TO_POINTER(pid), entry);
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcNotify --                                                  */ /**
+ *
+ * Reports the change of the set of names, if any, once the coalescing delay
+ * expires.
+ *
+ * @param[in]  data     The watch.
+ *
+ * @return FALSE, the timer is recreated by the next change.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+AppInfoProcNotify(gpointer data)
+{
+   AppInfoProcWatch *watch = data;
+   gboolean changed;
+
+   g_source_unref(watch->delaySource);
+   watch->delaySource = NULL;
+
+   g_mutex_lock(&gProcWatchLock);
+   changed = watch->changed;
+   watch->changed = FALSE;
+   g_mutex_unlock(&gProcWatchLock);
+
+   if (changed) {
+      g_debug("%s: The set of applications changed.\n", __FUNCTION__);
+      watch->cb(watch->ctx);
+   }
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcScheduleNotify --                                          */ /**
+ *
+ * Starts the coalescing delay if the set of names changed.
+ *
+ * @param[in]  watch    The watch.
+ *
+ ******************************************************************************
+ */
+
+static void
+AppInfoProcScheduleNotify(AppInfoProcWatch *watch)
+{
+   if (watch->changed && watch->delaySource == NULL) {
+      watch->delaySource = g_timeout_source_new(APP_INFO_CHANGE_DELAY_MS);
+      VMTOOLSAPP_ATTACH_SOURCE(watch->ctx, watch->delaySource,
+                               AppInfoProcNotify, watch, NULL);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcScan --                                                    */ /**
+ *
+ * Replaces the table by a full process listing. Called from the main loop,
+ * so that no event can be applied to the table while it is rebuilt.
+ *
+ * @param[in]  watch    The watch.
+ *
+ * @return FALSE if the processes could not be listed.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+AppInfoProcScan(AppInfoProcWatch *watch)
+{
+   ProcMgrProcInfoArray *procList;
+   GHashTable *oldNames;
+   GHashTableIter iter;
+   gpointer name;
+   size_t procCount;
+   size_t i;
+
+   procList = ProcMgr_ListProcessesSelect(PROCMGR_INFO_CMDNAME);
+   if (procList == NULL) {
+      g_warning("%s: Failed to get the list of processes.\n", __FUNCTION__);
+      return FALSE;
+   }
+
+   g_mutex_lock(&gProcWatchLock);
+
+   /*
+    * Keep the old names to tell whether the set changed.
+    */
+   oldNames = watch->names;
+   watch->names = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+   g_hash_table_remove_all(watch->procs);
+
+   procCount = ProcMgrProcInfoArray_Count(procList);
+   for (i = 0; i < procCount; i++) {
+      ProcMgrProcInfo *procInfo = ProcMgrProcInfoArray_AddressOf(procList, i);
+
+      if (procInfo->procCmdName != NULL) {
+         AppInfoProcSet(watch, procInfo->procId, procInfo->procCmdName);
+      }
+   }
+
+   watch->changed = FALSE;
+   if (g_hash_table_size(oldNames) != g_hash_table_size(watch->names)) {
+      watch->changed = TRUE;
+   } else {
+      g_hash_table_iter_init(&iter, oldNames);
+      while (g_hash_table_iter_next(&iter, &name, NULL)) {
+         if (!g_hash_table_contains(watch->names, name)) {
+            watch->changed = TRUE;
+            break;
+         }
+      }
+   }
+
+   g_mutex_unlock(&gProcWatchLock);
+
+   g_hash_table_destroy(oldNames);
+   ProcMgr_FreeProcList(procList);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcEvent --                                                   */ /**
+ *
+ * Applies a proc connector event to the table. Only the processes are
+ * tracked, the threads are ignored. The watch lock must be held.
+ *
+ * @param[in]  watch    The watch.
+ * @param[in]  ev       The event.
+ *
+ ******************************************************************************
+ */
+
+static void
+AppInfoProcEvent(AppInfoProcWatch *watch,
+                 const struct proc_event *ev)
+{
+   AppInfoProcName *parent;
+   gchar *name;
+
+   switch (ev->what) {
+   case PROC_EVENT_FORK:
+      if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid) {
+         break;
+      }
+      /*
+       * The child runs the binary of its parent, until it calls exec().
+       */
+      parent = g_hash_table_lookup(watch->procs,
+                                   GINT_TO_POINTER(ev->event_data.fork.parent_tgid));
+      if (parent != NULL) {
+         AppInfoProcSet(watch, ev->event_data.fork.child_tgid, parent->name);
+      }
+      break;
+
+   case PROC_EVENT_EXEC:
+      name = AppInfoProcReadName(ev->event_data.exec.process_tgid);
+      if (name != NULL) {
+         AppInfoProcSet(watch, ev->event_data.exec.process_tgid, name);
+         g_free(name);
+      }
+      break;
+
+   case PROC_EVENT_EXIT:
+      if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid) {
+         AppInfoProcRemove(watch, ev->event_data.exit.process_tgid);
+      }
+      break;
+
+   default:
+      break;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcRead --                                                    */ /**
+ *
+ * Drains the proc connector socket.
+ *
+ * @param[in]  chan     Channel of the connector socket.
+ * @param[in]  cond     Unused.
+ * @param[in]  data     The watch.
+ *
+ * @return FALSE if the socket failed and the watch must be removed.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+AppInfoProcRead(GIOChannel *chan,
+                GIOCondition cond,
+                gpointer data)
+{
+   AppInfoProcWatch *watch = data;
+   int fd = g_io_channel_unix_get_fd(chan);
+   char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+   gboolean rescan = FALSE;
+
+   g_mutex_lock(&gProcWatchLock);
+
+   for (;;) {
+      ssize_t len = recv(fd, buf, sizeof buf, MSG_DONTWAIT);
+      struct nlmsghdr *hdr;
+      int remaining;
+
+      if (len < 0 && errno == EINTR) {
+         continue;
+      }
+      if (len < 0 && errno == ENOBUFS) {
+         /*
+          * The kernel dropped events, the table must be rebuilt.
+          */
+         rescan = TRUE;
+         continue;
+      }
+      if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         break;
+      }
+      if (len <= 0) {
+         g_mutex_unlock(&gProcWatchLock);
+         g_warning("%s: Cannot read the proc connector: %s, the processes "
+                   "will only be listed on each poll.\n", __FUNCTION__,
+                   len < 0 ? strerror(errno) : "socket closed");
+         g_source_unref(watch->eventSource);
+         watch->eventSource = NULL;
+         return FALSE;
+      }
+
+      remaining = len;
+      for (hdr = (struct nlmsghdr *)buf;
+           NLMSG_OK(hdr, remaining);
+           hdr = NLMSG_NEXT(hdr, remaining)) {
+         struct cn_msg *msg = NLMSG_DATA(hdr);
+
+         if (hdr->nlmsg_type != NLMSG_DONE ||
+             hdr->nlmsg_len < NLMSG_LENGTH(sizeof *msg) ||
+             msg->id.idx != CN_IDX_PROC || msg->id.val != CN_VAL_PROC ||
+             hdr->nlmsg_len < NLMSG_LENGTH(sizeof *msg + msg->len) ||
+             msg->len < sizeof (struct proc_event)) {
+            continue;
+         }
+         AppInfoProcEvent(watch, (const struct proc_event *)msg->data);
+      }
+   }
+
+   g_mutex_unlock(&gProcWatchLock);
+
+   if (rescan) {
+      g_debug("%s: Events were dropped, listing the processes.\n",
+              __FUNCTION__);
+      AppInfoProcScan(watch);
+   }
+
+   AppInfoProcScheduleNotify(watch);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfoProcSubscribe --                                               */ /**
+ *
+ * Opens a proc connector socket, and asks the kernel to send the process
+ * events to it.
+ *
+ * @return The socket, or -1 if the events cannot be received.
+ *
+ ******************************************************************************
+ */
+
+static int
+AppInfoProcSubscribe(void)
+{
+   struct sockaddr_nl addr;
+   struct {
+      struct nlmsghdr hdr;
+      struct cn_msg msg;
+      enum proc_cn_mcast_op op;
+   } __attribute__((packed)) req;
+   int fd;
+
+   fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+   if (fd < 0) {
+      g_info("%s: Cannot open a proc connector socket: %s\n", __FUNCTION__,
+             strerror(errno));
+      return -1;
+   }
+
+   memset(&addr, 0, sizeof addr);
+   addr.nl_family = AF_NETLINK;
+   addr.nl_groups = CN_IDX_PROC;
+   if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+      g_info("%s: Cannot bind the proc connector socket: %s\n", __FUNCTION__,
+             strerror(errno));
+      close(fd);
+      return -1;
+   }
+
+   memset(&req, 0, sizeof req);
+   req.hdr.nlmsg_len = sizeof req;
+   req.hdr.nlmsg_type = NLMSG_DONE;
+   req.hdr.nlmsg_pid = getpid();
+   req.msg.id.idx = CN_IDX_PROC;
+   req.msg.id.val = CN_VAL_PROC;
+   req.msg.len = sizeof req.op;
+   req.op = PROC_CN_MCAST_LISTEN;
+   if (send(fd, &req, sizeof req, 0) != sizeof req) {
+      g_info("%s: Cannot subscribe to the process events: %s\n", __FUNCTION__,
+             strerror(errno));
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfo_StartProcWatch --                                             */ /**
+ *
+ * Starts tracking the processes. Does nothing if already tracking them.
+ *
+ * @param[in]  ctx      The application context.
+ * @param[in]  cb       Called from the main loop when the set of applications
+ *                      changed.
+ *
+ * @return TRUE if the processes are tracked, FALSE if the caller must keep
+ *         listing them.
+ *
+ ******************************************************************************
+ */
+
+Bool
+AppInfo_StartProcWatch(ToolsAppCtx *ctx,
+                       AppInfoChangeCb cb)
+{
+   AppInfoProcWatch *watch;
+   GIOChannel *chan;
+   int fd;
+
+   if (gProcWatch != NULL) {
+      return TRUE;
+   }
+
+   fd = AppInfoProcSubscribe();
+   if (fd < 0) {
+      return FALSE;
+   }
+
+   watch = g_new0(AppInfoProcWatch, 1);
+   watch->ctx = ctx;
+   watch->cb = cb;
+   watch->procs = g_hash_table_new(NULL, NULL);
+   watch->names = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+
+   /*
+    * Subscribed first, so that the events of the processes started during
+    * the listing are not missed. The events are idempotent on the table.
+    */
+   if (!AppInfoProcScan(watch)) {
+      g_hash_table_destroy(watch->procs);
+      g_hash_table_destroy(watch->names);
+      g_free(watch);
+      close(fd);
+      return FALSE;
+   }
+   watch->changed = FALSE;
+
+   chan = g_io_channel_unix_new(fd);
+   g_io_channel_set_close_on_unref(chan, TRUE);
+   g_io_channel_set_encoding(chan, NULL, NULL);
+   g_io_channel_set_buffered(chan, FALSE);
+   watch->eventSource = g_io_create_watch(chan, G_IO_IN | G_IO_ERR);
+   g_io_channel_unref(chan);   // Ownership transferred to the source.
+   VMTOOLSAPP_ATTACH_SOURCE(ctx, watch->eventSource, AppInfoProcRead,
+                            watch, NULL);
+
+   g_mutex_lock(&gProcWatchLock);
+   gProcWatch = watch;
+   g_mutex_unlock(&gProcWatchLock);
+
+   g_info("Tracking %u processes from the proc connector.\n",
+          g_hash_table_size(watch->procs));
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfo_ProcWatchRescan --                                            */ /**
+ *
+ * Lists the processes again, to pick up the command lines rewritten since
+ * their exec. Does nothing if the processes are not tracked.
+ *
+ ******************************************************************************
+ */
+
+void
+AppInfo_ProcWatchRescan(void)
+{
+   if (gProcWatch != NULL && gProcWatch->eventSource != NULL) {
+      AppInfoProcScan(gProcWatch);
+
+      /*
+       * The caller publishes the new list.
+       */
+      gProcWatch->changed = FALSE;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfo_GetWatchedAppList --                                          */ /**
+ *
+ * Generates the application information list from the tracked processes.
+ *
+ * @param[out] appList  The list, to be freed with AppInfo_DestroyAppList().
+ *
+ * @return FALSE if the processes are not tracked, and must be listed.
+ *
+ ******************************************************************************
+ */
+
+Bool
+AppInfo_GetWatchedAppList(GSList **appList)
+{
+   GHashTableIter iter;
+   gpointer pid;
+   gpointer value;
+
+   *appList = NULL;
+
+   g_mutex_lock(&gProcWatchLock);
+
+   if (gProcWatch == NULL || gProcWatch->eventSource == NULL) {
+      g_mutex_unlock(&gProcWatchLock);
+      return FALSE;
+   }
+
+   g_hash_table_iter_init(&iter, gProcWatch->procs);
+   while (g_hash_table_iter_next(&iter, &pid, &value)) {
+      AppInfoProcName *entry = value;
+      AppInfo *appInfo = Util_SafeMalloc(sizeof *appInfo);
+
+      appInfo->procId = GPOINTER_TO_INT(pid);
+      appInfo->appName = Util_SafeStrdup(entry->name);
+      appInfo->version = Util_SafeStrdup("");
+      *appList = g_slist_prepend(*appList, appInfo);
+   }
+
+   g_mutex_unlock(&gProcWatchLock);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * AppInfo_StopProcWatch --                                              */ /**
+ *
+ * Stops tracking the processes, dropping the changes not reported yet.
+ *
+ ******************************************************************************
+ */
+
+void
+AppInfo_StopProcWatch(void)
+{
+   AppInfoProcWatch *watch;
+
+   g_mutex_lock(&gProcWatchLock);
+   watch = gProcWatch;
+   gProcWatch = NULL;
+   g_mutex_unlock(&gProcWatchLock);
+
+   if (watch == NULL) {
+      return;
+   }
+
+   if (watch->eventSource != NULL) {
+      g_source_destroy(watch->eventSource);
+      g_source_unref(watch->eventSource);
+   }
+   if (watch->delaySource != NULL) {
+      g_source_destroy(watch->delaySource);
+      g_source_unref(watch->delaySource);
+   }
+   g_hash_table_destroy(watch->procs);
+   g_hash_table_destroy(watch->names);
+   g_free(watch);
+   g_info("Stopped tracking the processes.\n");
+}
@@ -66,6 +66,9 @@
 #define G_LOG_DOMAIN "dndcp"
 
 #include <sys/time.h>
+#include <sys/poll.h>
+#include <algorithm>
+#include <limits.h>
 #include <time.h>
 #include <cxxabi.h>
 #include "copyPasteDnDWrapper.h"
@@ -97,6 +100,170 @@ extern "C" {
 GdkAtom GDK_SELECTION_CLIPBOARD;
 #endif
 
+/* Largest write of the file contents staged from the clipboard. */
+#define CP_FILE_CONTENTS_WRITE_CHUNK (1 << 20)
+
+/* Interval of the progress log of a host to guest file transfer. */
+#define CP_FILE_PROGRESS_INTERVAL 2 /* Seconds. */
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteHasTarget --
+ *
+ *    Look for a target in the list advertised by the selection owner.
+ *
+ * Results:
+ *    true if the target is advertised.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static bool
+CopyPasteHasTarget(const std::vector<Glib::ustring> &targets, // IN
+                   const char *target)                        // IN
+{
+   return std::find(targets.begin(), targets.end(), target) != targets.end();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteHasImageTarget --
+ *
+ *    Look for an image/ target in the list advertised by the selection
+ *    owner.
+ *
+ * Results:
+ *    true if an image target is advertised.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static bool
+CopyPasteHasImageTarget(const std::vector<Glib::ustring> &targets) // IN
+{
+   std::vector<Glib::ustring>::const_iterator iter;
+
+   for (iter = targets.begin(); iter != targets.end(); iter++) {
+      if (iter->compare(0, 6, "image/") == 0) {
+         return true;
+      }
+   }
+   return false;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteHashBytes --
+ *
+ *    Add bytes to a 64-bit FNV-1a hash.
+ *
+ * Results:
+ *    The new hash.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint64
+CopyPasteHashBytes(uint64 hash,      // IN
+                   const void *buf,  // IN
+                   size_t size)      // IN
+{
+   size_t i;
+
+   for (i = 0; i < size; i++) {
+      hash = (hash ^ ((const uint8 *)buf)[i]) * CONST64U(1099511628211);
+   }
+   return hash;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteHashPixbuf --
+ *
+ *    64-bit FNV-1a hash of the geometry and pixels of an image.
+ *
+ * Results:
+ *    The hash.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint64
+CopyPasteHashPixbuf(const Glib::RefPtr<Gdk::Pixbuf> &img) // IN
+{
+   uint64 hash = CONST64U(14695981039346656037);
+   int geometry[4] = { img->get_width(), img->get_height(),
+                       img->get_n_channels(), img->get_bits_per_sample() };
+   size_t rowLen = (img->get_width() * img->get_n_channels() *
+                    img->get_bits_per_sample() + 7) / 8;
+   const guint8 *pixels = img->get_pixels();
+   int y;
+
+   hash = CopyPasteHashBytes(hash, geometry, sizeof geometry);
+   /* Skip the padding at the end of the rows. */
+   for (y = 0; y < img->get_height(); y++) {
+      hash = CopyPasteHashBytes(hash, pixels + y * img->get_rowstride(),
+                                rowLen);
+   }
+   return hash;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteHashClipboard --
+ *
+ *    64-bit FNV-1a hash of the items of a clipboard.
+ *
+ * Results:
+ *    The hash.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static uint64
+CopyPasteHashClipboard(const CPClipboard *clip) // IN
+{
+   uint64 hash = CONST64U(14695981039346656037);
+   int fmt;
+
+   for (fmt = CPFORMAT_MIN; fmt < CPFORMAT_MAX; fmt++) {
+      void *buf;
+      size_t sz;
+
+      if (!CPClipboard_GetItem(clip, (DND_CPFORMAT)fmt, &buf, &sz)) {
+         continue;
+      }
+      hash = CopyPasteHashBytes(hash, &fmt, sizeof fmt);
+      hash = CopyPasteHashBytes(hash, buf, sz);
+   }
+   return hash;
+}
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -121,6 +288,8 @@ CopyPasteUIX11::CopyPasteUIX11()
    mClipTime(0),
    mPrimTime(0),
    mLastTimestamp(0),
+   mLastClipHash(0),
+   mGHImgHash(0),
    mThread(0),
    mHGGetListTime(0),
    mHGGetFileStatus(DND_FILE_TRANSFER_NOT_STARTED),
@@ -128,6 +297,8 @@ CopyPasteUIX11::CopyPasteUIX11()
    mBlockCtrl(0),
    mInited(false),
    mTotalFileSize(0),
+   mHGStartTime(0),
+   mFileBlockFd(-1),
    mGetTimestampOnly(false)
 {
    TRACE_CALL();
@@ -136,18 +307,15 @@ CopyPasteUIX11::CopyPasteUIX11()
    mCP = p->GetCopyPasteMgr();
    ASSERT(mCP);
 
+   /*
+    * The monitor thread is only started for a vmblock-fuse which cannot be
+    * polled, see WatchFileBlock.
+    */
    mThreadParams.fileBlockCondExit = false;
+   mThreadParams.fileBlockPending = false;
    pthread_mutex_init(&mThreadParams.fileBlockMutex, NULL);
    pthread_cond_init(&mThreadParams.fileBlockCond, NULL);
    mThreadParams.cp = this;
-   int ret = pthread_create(&mThread,
-                            NULL,
-                            FileBlockMonitorThread,
-                            (void *)&(this->mThreadParams));
-   if (ret != 0) {
-      Warning("%s: Create thread failed, errno:%d.\n", __FUNCTION__, ret);
-      mThread = 0;
-   }
 }
 
 
@@ -221,6 +389,7 @@ CopyPasteUIX11::Init()
 CopyPasteUIX11::~CopyPasteUIX11()
 {
    TRACE_CALL();
+   mHGProgressConn.disconnect();
    CPClipboard_Destroy(&mClipboard);
    /* Any files from last unfinished file transfer should be deleted. */
    if (DND_FILE_TRANSFER_IN_PROGRESS == mHGGetFileStatus &&
@@ -245,6 +414,7 @@ CopyPasteUIX11::~CopyPasteUIX11()
       }
    }
 
+   UnwatchFileBlock();
    TerminateThread();
    pthread_mutex_destroy(&mThreadParams.fileBlockMutex);
    pthread_cond_destroy(&mThreadParams.fileBlockCond);
@@ -416,19 +586,19 @@ CopyPasteUIX11::LocalGetFileRequestCB(Gtk::SelectionData& sd,        // IN:
          return;
       }
       mHGGetFileStatus = DND_FILE_TRANSFER_IN_PROGRESS;
+      mHGStartTime = GetCurrentTime();
+      mHGProgressConn.disconnect();
+      mHGProgressConn = Glib::signal_timeout().connect_seconds(
+         sigc::mem_fun(this, &CopyPasteUIX11::HGFileTransferProgressCB),
+         CP_FILE_PROGRESS_INTERVAL);
 
       mBlockAdded = false;
       if (DnD_BlockIsReady(mBlockCtrl) && mBlockCtrl->AddBlock(mBlockCtrl->fd, hgStagingDir.c_str())) {
          g_debug("%s: add block for %s.\n",
                __FUNCTION__, hgStagingDir.c_str());
          mBlockAdded = true;
-         pthread_mutex_lock(&mThreadParams.fileBlockMutex);
-         mThreadParams.fileBlockCondExit = false;
-         mThreadParams.fileBlockName = VMBLOCK_FUSE_NOTIFY_ROOT;
-         mThreadParams.fileBlockName += DIRSEPS;
-         mThreadParams.fileBlockName += GetLastDirName(hgStagingDir);
-         pthread_cond_signal(&mThreadParams.fileBlockCond);
-         pthread_mutex_unlock(&mThreadParams.fileBlockMutex);
+         WatchFileBlock(utf::string(VMBLOCK_FUSE_NOTIFY_ROOT) + DIRSEPS +
+                        GetLastDirName(hgStagingDir));
       } else {
          g_debug("%s: unable to add block for %s.\n",
                __FUNCTION__, hgStagingDir.c_str());
@@ -502,21 +672,16 @@ CopyPasteUIX11::LocalGetFileRequestCB(Gtk::SelectionData& sd,        // IN:
        * The reason is we are executing in the context of gtkmm callback, and
        * apparently it only has so much patience regarding how quickly we
        * return.
+       *
+       * The HGFS requests of the transfer are dispatched by the main loop,
+       * so block in it instead of spinning: each iteration waits for the
+       * next request, or the progress timer.
        */
       CopyPasteDnDWrapper *wrapper = CopyPasteDnDWrapper::GetInstance();
       ToolsAppCtx *ctx = wrapper->GetToolsAppCtx();
       while (mHGGetFileStatus == DND_FILE_TRANSFER_IN_PROGRESS) {
-         struct timeval tv;
-
-         tv.tv_sec = 0;
          g_main_context_iteration(g_main_loop_get_context(ctx->mainLoop),
-                                  FALSE);
-         if (select(0, NULL, NULL, NULL, &tv) == -1) {
-            g_debug("%s: error in select (%s).\n", __FUNCTION__,
-                  strerror(errno));
-            sd.set(sd.get_target().c_str(), "");
-            return;
-         }
+                                  TRUE);
       }
       g_debug("%s: file transfer done!\n", __FUNCTION__);
    }
@@ -590,6 +755,63 @@ CopyPasteUIX11::LocalGetTextOrRTFRequestCB(Gtk::SelectionData& sd, // IN/OUT
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPaste::LocalGetImageRequestCB --
+ *
+ *      Callback from an image paste request from another guest application.
+ *      PNG is provided as received from the host, other formats are
+ *      converted from the image decoded on the first such request.
+ *      H->G copy paste only.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CopyPasteUIX11::LocalGetImageRequestCB(Gtk::SelectionData& sd, // IN/OUT
+                                       guint info)             // Ignored
+{
+   if (!mCP->IsCopyPasteAllowed() || mHGImgData.empty()) {
+      return;
+   }
+
+   const utf::string target = sd.get_target().c_str();
+
+   g_debug("%s: Got paste request, target is %s\n",
+         __FUNCTION__, target.c_str());
+
+   if (target == TARGET_NAME_IMAGE_PNG) {
+      sd.set(target.c_str(), 8, (const guint8 *)mHGImgData.data(),
+             mHGImgData.size());
+      return;
+   }
+
+   try {
+      if (!mHGImgPixbuf) {
+         Glib::RefPtr<Gdk::PixbufLoader> loader = Gdk::PixbufLoader::create();
+         loader->write((const guint8 *)mHGImgData.data(), mHGImgData.size());
+         loader->close();
+         mHGImgPixbuf = loader->get_pixbuf();
+      }
+      sd.set_pixbuf(mHGImgPixbuf);
+   } catch (const Gdk::PixbufError& e) {
+      g_message("%s: caught Gdk::PixbufError %s\n", __FUNCTION__, e.what().c_str());
+   } catch (std::exception& e) {
+      g_message("%s: caught std::exception %s\n", __FUNCTION__, e.what());
+   } catch (...) {
+      g_message("%s: caught unknown exception (typename %s)\n", __FUNCTION__,
+                __cxxabiv1::__cxa_current_exception_type()->name());
+   }
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -729,13 +951,21 @@ again:
 
    CPClipboard_Clear(&mClipboard);
 
+   /*
+    * Get the advertised targets once, and only fetch the contents of the
+    * formats we can send.
+    */
+   std::vector<Glib::ustring> targets = refClipboard->wait_for_targets();
+
    /* First check for URIs. This must always be done first */
    bool haveURIs = false;
    std::string format;
-   if (mCP->CheckCapability(DND_CP_CAP_FILE_CP) && refClipboard->wait_is_target_available(FCP_TARGET_NAME_GNOME_COPIED_FILES)) {
+   if (mCP->CheckCapability(DND_CP_CAP_FILE_CP) &&
+       CopyPasteHasTarget(targets, FCP_TARGET_NAME_GNOME_COPIED_FILES)) {
       format = FCP_TARGET_NAME_GNOME_COPIED_FILES;
       haveURIs = true;
-   } else if (mCP->CheckCapability(DND_CP_CAP_FILE_CP) && refClipboard->wait_is_target_available(FCP_TARGET_NAME_URI_LIST)) {
+   } else if (mCP->CheckCapability(DND_CP_CAP_FILE_CP) &&
+              CopyPasteHasTarget(targets, FCP_TARGET_NAME_URI_LIST)) {
       format = FCP_TARGET_NAME_URI_LIST;
       haveURIs = true;
    }
@@ -747,38 +977,74 @@ again:
       return;
    }
 
-   /* Try to get image data from clipboard. */
-   Glib::RefPtr<Gdk::Pixbuf> img = refClipboard->wait_for_image();
+   /*
+    * Try to get image data from clipboard. PNG is sent as is, other image
+    * formats are converted; neither is fetched unless advertised.
+    */
    gsize bufSize;
-   if (mCP->CheckCapability(DND_CP_CAP_IMAGE_CP) && img) {
-      gchar *buf = NULL;
-
-      img->save_to_buffer(buf, bufSize, Glib::ustring("png"));
-      if (bufSize > 0  &&
-          bufSize <= (int)CPCLIPITEM_MAX_SIZE_V3 &&
+   if (mCP->CheckCapability(DND_CP_CAP_IMAGE_CP) &&
+       CopyPasteHasTarget(targets, TARGET_NAME_IMAGE_PNG)) {
+      Gtk::SelectionData sdata =
+         refClipboard->wait_for_contents(TARGET_NAME_IMAGE_PNG);
+      int length = sdata.get_length();
+
+      if (length > 0 &&
+          length <= (int)CPCLIPITEM_MAX_SIZE_V3 &&
           CPClipboard_SetItem(&mClipboard, CPFORMAT_IMG_PNG,
-                              buf, bufSize)) {
+                              (const void *)sdata.get_data(), length)) {
          validDataInClip = true;
-         g_debug("%s: Got PNG: %" FMTSZ "u\n", __FUNCTION__, bufSize);
+         g_debug("%s: Got PNG: %d\n", __FUNCTION__, length);
       } else {
          g_debug("%s: Failed to get PNG\n", __FUNCTION__);
       }
-      g_free(buf);
+   } else if (mCP->CheckCapability(DND_CP_CAP_IMAGE_CP) &&
+              CopyPasteHasImageTarget(targets)) {
+      Glib::RefPtr<Gdk::Pixbuf> img = refClipboard->wait_for_image();
+
+      if (img) {
+         /*
+          * Encoding is much more expensive than hashing the pixels, so keep
+          * the PNG of the last image for when the same one is copied again.
+          */
+         uint64 imgHash = CopyPasteHashPixbuf(img);
+
+         if (imgHash != mGHImgHash || mGHImgData.empty()) {
+            gchar *buf = NULL;
+
+            img->save_to_buffer(buf, bufSize, Glib::ustring("png"));
+            mGHImgData.assign(buf, bufSize);
+            mGHImgHash = imgHash;
+            g_free(buf);
+         } else {
+            g_debug("%s: reusing PNG of the last image\n", __FUNCTION__);
+         }
+
+         bufSize = mGHImgData.size();
+         if (bufSize > 0  &&
+             bufSize <= (int)CPCLIPITEM_MAX_SIZE_V3 &&
+             CPClipboard_SetItem(&mClipboard, CPFORMAT_IMG_PNG,
+                                 mGHImgData.data(), bufSize)) {
+            validDataInClip = true;
+            g_debug("%s: Got PNG: %" FMTSZ "u\n", __FUNCTION__, bufSize);
+         } else {
+            g_debug("%s: Failed to get PNG\n", __FUNCTION__);
+         }
+      }
    }
 
    /* Try to get RTF data from clipboard. */
    bool haveRTF = false;
-   if (refClipboard->wait_is_target_available(TARGET_NAME_APPLICATION_RTF)) {
+   if (CopyPasteHasTarget(targets, TARGET_NAME_APPLICATION_RTF)) {
       g_debug("%s: APP RTF is available\n", __FUNCTION__);
       format = TARGET_NAME_APPLICATION_RTF;
       haveRTF = true;
    }
-   if (refClipboard->wait_is_target_available(TARGET_NAME_TEXT_RICHTEXT)) {
+   if (CopyPasteHasTarget(targets, TARGET_NAME_TEXT_RICHTEXT)) {
       g_debug("%s: RICHTEXT is available\n", __FUNCTION__);
       format = TARGET_NAME_TEXT_RICHTEXT;
       haveRTF = true;
    }
-   if (refClipboard->wait_is_target_available(TARGET_NAME_TEXT_RTF)) {
+   if (CopyPasteHasTarget(targets, TARGET_NAME_TEXT_RTF)) {
       g_debug("%s: TEXT_RTF is available\n", __FUNCTION__);
       format = TARGET_NAME_TEXT_RTF;
       haveRTF = true;
@@ -825,8 +1091,18 @@ again:
 
    if (validDataInClip) {
       /*
-       * RTF or text data (or both) in the clipboard.
+       * RTF or text data (or both) in the clipboard. Owners which do not
+       * provide timestamps cannot be checked for changes above, so compare
+       * the contents with the last ones sent.
        */
+      uint64 hash = CopyPasteHashClipboard(&mClipboard);
+
+      if (hash == mLastClipHash) {
+         g_debug("%s: clip contents not changed\n", __FUNCTION__);
+         SendClipNotChanged();
+         return;
+      }
+      mLastClipHash = hash;
       mCP->DestUISendClip(&mClipboard);
    } else if (!flipped) {
       /*
@@ -1195,6 +1471,9 @@ CopyPasteUIX11::GetRemoteClipboardCB(const CPClipboard *clip) // IN
       }
    }
 
+   /* The next local clip must be sent even if it did not change. */
+   mLastClipHash = 0;
+
    /* Clear the clipboard contents if we are the owner. */
    if (mIsClipboardOwner) {
       refClipboard->clear();
@@ -1205,6 +1484,8 @@ CopyPasteUIX11::GetRemoteClipboardCB(const CPClipboard *clip) // IN
 
    mHGTextData.clear();
    mHGRTFData.clear();
+   mHGImgData.clear();
+   mHGImgPixbuf.reset();
    mHGFCPData.clear();
 
    if (CPClipboard_ItemExists(clip, CPFORMAT_TEXT) ||
@@ -1255,14 +1536,27 @@ CopyPasteUIX11::GetRemoteClipboardCB(const CPClipboard *clip) // IN
 
    if (CPClipboard_GetItem(clip, CPFORMAT_IMG_PNG, &buf, &sz)) {
       g_debug("%s: PNG data, size %" FMTSZ "u.\n", __FUNCTION__, sz);
-      /* Try to load buf into pixbuf, and write to local clipboard. */
+      /*
+       * Keep the PNG, which is handed out as is. It is only decoded for
+       * applications asking for another image format.
+       */
       try {
-         Glib::RefPtr<Gdk::PixbufLoader> loader = Gdk::PixbufLoader::create();
-         loader->write((const guint8 *)buf, sz);
-         loader->close();
+         std::vector<Gtk::TargetEntry> targets;
 
-         refClipboard->set_image(loader->get_pixbuf());
-         refPrimary->set_image(loader->get_pixbuf());
+         targets.push_back(Gtk::TargetEntry(TARGET_NAME_IMAGE_PNG));
+         targets.push_back(Gtk::TargetEntry("image/bmp"));
+         targets.push_back(Gtk::TargetEntry("image/jpeg"));
+         targets.push_back(Gtk::TargetEntry("image/tiff"));
+         mHGImgData.assign((const char *)buf, sz);
+         mHGImgPixbuf.reset();
+
+         refClipboard->set(targets,
+                           sigc::mem_fun(this, &CopyPasteUIX11::LocalGetImageRequestCB),
+                           sigc::mem_fun(this, &CopyPasteUIX11::LocalClearClipboardCB));
+         refPrimary->set(targets,
+                         sigc::mem_fun(this, &CopyPasteUIX11::LocalGetImageRequestCB),
+                         sigc::mem_fun(this, &CopyPasteUIX11::LocalClearClipboardCB));
+         mIsClipboardOwner = true;
 
          /*
           * Record current clipboard timestamp to prevent unexpected clipboard
@@ -1321,6 +1615,118 @@ CopyPasteUIX11::GetRemoteClipboardCB(const CPClipboard *clip) // IN
 }
 
 
+/*
+ *----------------------------------------------------------------------------
+ *
+ * CopyPasteDecodeFileItem --
+ *
+ *      Decode the next CPFileItem of a CPFileContentsList. Unlike
+ *      xdr_CPFileItem, the file contents are not copied: content_val
+ *      points into the XDR buffer, which must outlive the item.
+ *
+ * Results:
+ *      true if success, false otherwise. On success, the caller frees
+ *      item->cpName.cpName_val.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static bool
+CopyPasteDecodeFileItem(XDR *xdrs,          // IN/OUT
+                        CPFileItem *item)   // OUT
+{
+   u_int contentLen;
+
+   memset(item, 0, sizeof *item);
+   if (!xdr_uint64(xdrs, &item->validFlags) ||
+       !xdr_uint32(xdrs, &item->type) ||
+       !xdr_uint64(xdrs, &item->size) ||
+       !xdr_uint64(xdrs, &item->createTime) ||
+       !xdr_uint64(xdrs, &item->accessTime) ||
+       !xdr_uint64(xdrs, &item->writeTime) ||
+       !xdr_uint64(xdrs, &item->attrChangeTime) ||
+       !xdr_uint64(xdrs, &item->permissions) ||
+       !xdr_uint64(xdrs, &item->attributes) ||
+       !xdr_bytes(xdrs, (char **)&item->cpName.cpName_val,
+                  &item->cpName.cpName_len, ~0)) {
+      free(item->cpName.cpName_val);
+      item->cpName.cpName_val = NULL;
+      return false;
+   }
+
+   if (!xdr_u_int(xdrs, &contentLen) ||
+       contentLen > INT_MAX - BYTES_PER_XDR_UNIT) {
+      free(item->cpName.cpName_val);
+      item->cpName.cpName_val = NULL;
+      return false;
+   }
+   item->content.content_len = contentLen;
+   if (contentLen != 0) {
+      item->content.content_val =
+         (char *)xdr_inline(xdrs, RNDUP(contentLen));
+      if (item->content.content_val == NULL) {
+         free(item->cpName.cpName_val);
+         item->cpName.cpName_val = NULL;
+         return false;
+      }
+   }
+   return true;
+}
+
+
+/*
+ *----------------------------------------------------------------------------
+ *
+ * CopyPasteWriteFile --
+ *
+ *      Write the contents of a file, in chunks of at most
+ *      CP_FILE_CONTENTS_WRITE_CHUNK bytes.
+ *
+ * Results:
+ *      true if success, false otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------------
+ */
+
+static bool
+CopyPasteWriteFile(const char *path,      // IN
+                   const char *content,   // IN
+                   size_t len)            // IN
+{
+   FileIODescriptor file;
+   FileIOResult fileErr;
+   size_t done = 0;
+
+   FileIO_Invalidate(&file);
+
+   fileErr = FileIO_Open(&file, path, FILEIO_ACCESS_WRITE,
+                         FILEIO_OPEN_CREATE_EMPTY);
+   if (!FileIO_IsSuccess(fileErr)) {
+      return false;
+   }
+
+   while (done < len && FileIO_IsSuccess(fileErr)) {
+      size_t chunk = MIN(len - done, CP_FILE_CONTENTS_WRITE_CHUNK);
+
+      fileErr = FileIO_Write(&file, content + done, chunk, NULL);
+      done += chunk;
+   }
+
+   if (!FileIO_IsSuccess(FileIO_Close(&file)) ||
+       !FileIO_IsSuccess(fileErr)) {
+      g_debug("%s: writing [%s] failed.\n", __FUNCTION__, path);
+      return false;
+   }
+   return true;
+}
+
+
 /*
  *----------------------------------------------------------------------------
  *
@@ -1329,6 +1735,10 @@ CopyPasteUIX11::GetRemoteClipboardCB(const CPClipboard *clip) // IN
  *      Try to extract file contents from mClipboard. Write all files to a
  *      temporary staging directory. Construct uri list.
  *
+ *      The file items are decoded one at a time and their contents written
+ *      straight from the clipboard buffer, so that the memory used does
+ *      not grow with the total size of the files.
+ *
  * Results:
  *      true if success, false otherwise.
  *
@@ -1344,12 +1754,13 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
    void *buf = NULL;
    size_t sz = 0;
    XDR xdrs;
-   CPFileContents fileContents;
-   CPFileContentsList *contentsList = NULL;
-   size_t nFiles = 0;
-   CPFileItem *fileItem = NULL;
+   enum_t ver;
+   bool_t hasList;
+   uint64 totalFileSize;
+   u_int nFiles = 0;
+   uint64 written = 0;
    char *tempDir = NULL;
-   size_t i = 0;
+   u_int i = 0;
    bool ret = false;
 
    if (!CPClipboard_GetItem(clip, CPFORMAT_FILECONTENTS, &buf, &sz)) {
@@ -1357,35 +1768,30 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
       return false;
    }
 
-   /* Extract file contents from buf. */
+   /*
+    * Decode the CPFileContents header by hand, up to the length of the
+    * file item array.
+    */
    xdrmem_create(&xdrs, (char *)buf, sz, XDR_DECODE);
-   memset(&fileContents, 0, sizeof fileContents);
 
-   if (!xdr_CPFileContents(&xdrs, &fileContents)) {
+   if (!xdr_enum(&xdrs, &ver) || ver != CP_FILE_CONTENTS_V1 ||
+       !xdr_bool(&xdrs, &hasList)) {
       g_debug("%s: xdr_CPFileContents failed.\n", __FUNCTION__);
-      xdr_destroy(&xdrs);
-      return false;
+      goto exit;
    }
-   xdr_destroy(&xdrs);
 
-   contentsList = fileContents.CPFileContents_u.fileContentsV1;
-   if (!contentsList) {
+   if (!hasList) {
       g_debug("%s: invalid contentsList.\n", __FUNCTION__);
       goto exit;
    }
 
-   nFiles = contentsList->fileItem.fileItem_len;
-   if (0 == nFiles) {
+   if (!xdr_uint64(&xdrs, &totalFileSize) ||
+       !xdr_u_int(&xdrs, &nFiles) ||
+       0 == nFiles) {
       g_debug("%s: invalid nFiles.\n", __FUNCTION__);
       goto exit;
    }
 
-   fileItem = contentsList->fileItem.fileItem_val;
-   if (!fileItem) {
-      g_debug("%s: invalid fileItem.\n", __FUNCTION__);
-      goto exit;
-   }
-
    /*
     * Write files into a temporary staging directory. These files will be moved
     * to final destination, or deleted on next reboot.
@@ -1399,6 +1805,7 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
    mHGFileContentsList.clear();
 
    for (i = 0; i < nFiles; i++) {
+      CPFileItem fileItem;
       utf::string fileName;
       utf::string filePathName;
       VmTimeType createTime = -1;
@@ -1406,9 +1813,15 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
       VmTimeType writeTime = -1;
       VmTimeType attrChangeTime = -1;
 
-      if (!fileItem[i].cpName.cpName_val ||
-          0 == fileItem[i].cpName.cpName_len) {
-         g_debug("%s: invalid fileItem[%" FMTSZ "u].cpName.\n", __FUNCTION__, i);
+      if (!CopyPasteDecodeFileItem(&xdrs, &fileItem)) {
+         g_debug("%s: invalid fileItem[%u].\n", __FUNCTION__, i);
+         goto exit;
+      }
+
+      if (!fileItem.cpName.cpName_val ||
+          0 == fileItem.cpName.cpName_len) {
+         g_debug("%s: invalid fileItem[%u].cpName.\n", __FUNCTION__, i);
+         free(fileItem.cpName.cpName_val);
          goto exit;
       }
 
@@ -1419,43 +1832,33 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
        * Note that we don't convert the final '\0' into DIRSEPC so the string
        * is NUL terminated.
        */
-      CPNameUtil_CharReplace(fileItem[i].cpName.cpName_val,
-                             fileItem[i].cpName.cpName_len - 1,
+      CPNameUtil_CharReplace(fileItem.cpName.cpName_val,
+                             fileItem.cpName.cpName_len - 1,
                              '\0',
                              DIRSEPC);
-      fileName = fileItem[i].cpName.cpName_val;
+      fileName = fileItem.cpName.cpName_val;
+      free(fileItem.cpName.cpName_val);
       filePathName = tempDir;
       filePathName += DIRSEPS + fileName;
 
-      if (fileItem[i].validFlags & CP_FILE_VALID_TYPE &&
-          CP_FILE_TYPE_DIRECTORY == fileItem[i].type) {
+      if (fileItem.validFlags & CP_FILE_VALID_TYPE &&
+          CP_FILE_TYPE_DIRECTORY == fileItem.type) {
          if (!File_CreateDirectory(filePathName.c_str())) {
             goto exit;
          }
          g_debug("%s: created directory [%s].\n",
                    __FUNCTION__, filePathName.c_str());
-      } else if (fileItem[i].validFlags & CP_FILE_VALID_TYPE &&
-                 CP_FILE_TYPE_REGULAR == fileItem[i].type) {
-         FileIODescriptor file;
-         FileIOResult fileErr;
-
-         FileIO_Invalidate(&file);
-
-         fileErr = FileIO_Open(&file,
-                               filePathName.c_str(),
-                               FILEIO_ACCESS_WRITE,
-                               FILEIO_OPEN_CREATE_EMPTY);
-         if (!FileIO_IsSuccess(fileErr)) {
+      } else if (fileItem.validFlags & CP_FILE_VALID_TYPE &&
+                 CP_FILE_TYPE_REGULAR == fileItem.type) {
+         if (!CopyPasteWriteFile(filePathName.c_str(),
+                                 fileItem.content.content_val,
+                                 fileItem.content.content_len)) {
             goto exit;
          }
-
-         fileErr = FileIO_Write(&file,
-                                fileItem[i].content.content_val,
-                                fileItem[i].content.content_len,
-                                NULL);
-
-         FileIO_Close(&file);
-         g_debug("%s: created file [%s].\n", __FUNCTION__, filePathName.c_str());
+         written += fileItem.content.content_len;
+         g_debug("%s: created file [%s], %" FMT64 "u of %" FMT64 "u "
+                 "bytes written.\n", __FUNCTION__, filePathName.c_str(),
+                 written, totalFileSize);
       } else {
          /*
           * Right now only Windows can provide CPFORMAT_FILECONTENTS data.
@@ -1466,14 +1869,14 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
       }
 
       /* Update file time attributes. */
-      createTime = fileItem->validFlags & CP_FILE_VALID_CREATE_TIME ?
-         fileItem->createTime: -1;
-      accessTime = fileItem->validFlags & CP_FILE_VALID_ACCESS_TIME ?
-         fileItem->accessTime: -1;
-      writeTime = fileItem->validFlags & CP_FILE_VALID_WRITE_TIME ?
-         fileItem->writeTime: -1;
-      attrChangeTime = fileItem->validFlags & CP_FILE_VALID_CHANGE_TIME ?
-         fileItem->attrChangeTime: -1;
+      createTime = fileItem.validFlags & CP_FILE_VALID_CREATE_TIME ?
+         fileItem.createTime: -1;
+      accessTime = fileItem.validFlags & CP_FILE_VALID_ACCESS_TIME ?
+         fileItem.accessTime: -1;
+      writeTime = fileItem.validFlags & CP_FILE_VALID_WRITE_TIME ?
+         fileItem.writeTime: -1;
+      attrChangeTime = fileItem.validFlags & CP_FILE_VALID_CHANGE_TIME ?
+         fileItem.attrChangeTime: -1;
 
       if (!File_SetTimes(filePathName.c_str(),
                          createTime,
@@ -1486,9 +1889,9 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
       }
 
       /* Update file permission attributes. */
-      if (fileItem->validFlags & CP_FILE_VALID_PERMS) {
+      if (fileItem.validFlags & CP_FILE_VALID_PERMS) {
          if (Posix_Chmod(filePathName.c_str(),
-                         fileItem->permissions) < 0) {
+                         fileItem.permissions) < 0) {
             /* Not a critical error, only log it. */
             g_debug("%s: Posix_Chmod failed with file [%s].\n",
                   __FUNCTION__, filePathName.c_str());
@@ -1507,7 +1910,7 @@ CopyPasteUIX11::LocalPrepareFileContents(const CPClipboard *clip) // IN
    ret = true;
 
 exit:
-   xdr_free((xdrproc_t)xdr_CPFileContents, (char *)&fileContents);
+   xdr_destroy(&xdrs);
    if (tempDir && !ret) {
       DnD_DeleteStagingFiles(tempDir, FALSE);
    }
@@ -1540,6 +1943,14 @@ CopyPasteUIX11::GetLocalFilesDone(bool success)
 {
    g_debug("%s: enter success %d\n", __FUNCTION__, success);
 
+   mHGProgressConn.disconnect();
+   if (success) {
+      VmTimeType elapsed = GetCurrentTime() - mHGStartTime;
+
+      g_debug("%s: transferred %" FMT64 "u bytes in %.1fs.\n", __FUNCTION__,
+              mTotalFileSize, elapsed / 1000000.0);
+   }
+
    if (mBlockAdded) {
       g_debug("%s: removing block for %s\n", __FUNCTION__, mHGStagingDir.c_str());
       /* We need to make sure block subsystem has not been shut off. */
@@ -1564,6 +1975,47 @@ CopyPasteUIX11::GetLocalFilesDone(bool success)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteUIX11::HGFileTransferProgressCB --
+ *
+ *    Periodic callback while files are copied from host to guest. Logs how
+ *    much of the file list is in the staging directory yet, and the rate.
+ *
+ * Results:
+ *    true while the transfer is in progress.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+bool
+CopyPasteUIX11::HGFileTransferProgressCB(void)
+{
+   int64 done;
+   VmTimeType elapsed;
+
+   if (mHGGetFileStatus != DND_FILE_TRANSFER_IN_PROGRESS ||
+       mHGStagingDir.empty()) {
+      return false;
+   }
+
+   done = File_GetSizeEx(mHGStagingDir.c_str());
+   elapsed = GetCurrentTime() - mHGStartTime;
+   if (done >= 0 && elapsed > 0) {
+      g_debug("%s: %" FMT64 "d of %" FMT64 "u bytes (%u%%), %.1f MB/s\n",
+              __FUNCTION__, done, mTotalFileSize,
+              mTotalFileSize == 0 ? 0 :
+                 (unsigned int)MIN(100, done * 100 / mTotalFileSize),
+              (double)done / elapsed);
+   }
+   return true;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1616,6 +2068,146 @@ CopyPasteUIX11::Reset(void)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteUIX11::WatchFileBlock --
+ *
+ *    Watches the vmblock-fuse notification file of the staging directory
+ *    from the main loop. The file polls readable once an application
+ *    accessed the blocked files, then the file transfer is requested.
+ *
+ *    A vmblock-fuse without poll support reports the file as readable right
+ *    away, before anyone could access the just added block. The monitor
+ *    thread then blocks in read instead.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Replaces the previous watch. May start the monitor thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CopyPasteUIX11::WatchFileBlock(const utf::string &notifyName) // IN
+{
+   struct pollfd pfd;
+   int fd;
+
+   UnwatchFileBlock();
+
+   fd = open(notifyName.c_str(), O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      g_debug("%s: Failed to open %s, errno is %d\n",
+              __FUNCTION__, notifyName.c_str(), errno);
+      return;
+   }
+
+   pfd.fd = fd;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+   if (poll(&pfd, 1, 0) == 0) {
+      mFileBlockFd = fd;
+      mFileBlockConn = Glib::signal_io().connect(
+         sigc::mem_fun(this, &CopyPasteUIX11::FileBlockNotifyCB),
+         fd, Glib::IO_IN | Glib::IO_ERR | Glib::IO_HUP);
+      return;
+   }
+   close(fd);
+
+   g_debug("%s: %s cannot be polled, using monitor thread\n",
+           __FUNCTION__, notifyName.c_str());
+   if (mThread == 0) {
+      int ret = pthread_create(&mThread,
+                               NULL,
+                               FileBlockMonitorThread,
+                               (void *)&(this->mThreadParams));
+      if (ret != 0) {
+         Warning("%s: Create thread failed, errno:%d.\n", __FUNCTION__, ret);
+         mThread = 0;
+         return;
+      }
+   }
+
+   pthread_mutex_lock(&mThreadParams.fileBlockMutex);
+   mThreadParams.fileBlockCondExit = false;
+   mThreadParams.fileBlockPending = true;
+   mThreadParams.fileBlockName = notifyName;
+   pthread_cond_signal(&mThreadParams.fileBlockCond);
+   pthread_mutex_unlock(&mThreadParams.fileBlockMutex);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteUIX11::UnwatchFileBlock --
+ *
+ *    Stops watching the notification file.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+CopyPasteUIX11::UnwatchFileBlock(void)
+{
+   mFileBlockConn.disconnect();
+   if (mFileBlockFd >= 0) {
+      close(mFileBlockFd);
+      mFileBlockFd = -1;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * CopyPasteUIX11::FileBlockNotifyCB --
+ *
+ *    The blocked files were accessed, or the block was removed. Requests the
+ *    file transfer in the former case.
+ *
+ * Results:
+ *    false, the watch is done.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+bool
+CopyPasteUIX11::FileBlockNotifyCB(Glib::IOCondition cond) // IN
+{
+   char buf[sizeof(VMBLOCK_FUSE_READ_RESPONSE)];
+
+   TRACE_CALL();
+
+   /* Consume the notification, this does not block anymore. */
+   if (read(mFileBlockFd, buf, sizeof buf) < 0) {
+      g_debug("%s: read failed, errno is %d\n", __FUNCTION__, errno);
+   }
+   close(mFileBlockFd);
+   mFileBlockFd = -1;
+
+   if (IsBlockAdded()) {
+      g_debug("%s: Request files\n", __FUNCTION__);
+      RequestFiles();
+   } else {
+      g_debug("%s: Block is not added\n", __FUNCTION__);
+   }
+   return false;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -1643,13 +2235,16 @@ CopyPasteUIX11::FileBlockMonitorThread(void *arg)   // IN
    pthread_mutex_lock(&params->fileBlockMutex);
    while (true) {
       g_debug("%s: waiting signal\n", __FUNCTION__);
-      pthread_cond_wait(&params->fileBlockCond, &params->fileBlockMutex);
+      while (!params->fileBlockCondExit && !params->fileBlockPending) {
+         pthread_cond_wait(&params->fileBlockCond, &params->fileBlockMutex);
+      }
       g_debug("%s: received signal. Exit:%d\n",
               __FUNCTION__,
               params->fileBlockCondExit);
       if (params->fileBlockCondExit) {
          break;
       }
+      params->fileBlockPending = false;
       if (params->fileBlockName.bytes() == 0) {
         continue;
       }
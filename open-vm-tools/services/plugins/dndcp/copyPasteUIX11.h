@@ -71,6 +71,7 @@ struct ThreadParams
    pthread_mutex_t fileBlockMutex;
    pthread_cond_t fileBlockCond;
    bool fileBlockCondExit;
+   bool fileBlockPending;
    CopyPasteUIX11 *cp;
    utf::string fileBlockName;
 };
@@ -103,6 +104,7 @@ private:
    void LocalGetTextOrRTFRequestCB(Gtk::SelectionData& sd, guint info);
    void LocalGetSelectionFileList(const Gtk::SelectionData& sd);
    void LocalGetFileContentsRequestCB(Gtk::SelectionData& sd, guint info);
+   void LocalGetImageRequestCB(Gtk::SelectionData& sd, guint info);
    void LocalClearClipboardCB(void);
 
    /* gh */
@@ -112,6 +114,7 @@ private:
    void LocalReceivedFileListCB(const Gtk::SelectionData& selection_data);
    void GetLocalFilesDone(bool success);
    void SendClipNotChanged(void);
+   bool HGFileTransferProgressCB(void);
 
    /* Conversion methods. */
    utf::utf8string GetNextPath(utf::utf8string &str, size_t& index);
@@ -120,6 +123,9 @@ private:
 
    VmTimeType GetCurrentTime(void);
 
+   void WatchFileBlock(const utf::string &notifyName);
+   void UnwatchFileBlock(void);
+   bool FileBlockNotifyCB(Glib::IOCondition cond);
    static void* FileBlockMonitorThread(void *arg);
    void TerminateThread();
 
@@ -132,6 +138,7 @@ private:
    uint64 mClipTime;
    uint64 mPrimTime;
    uint64 mLastTimestamp;
+   uint64 mLastClipHash;
    GdkAtom mGHSelection;
    CPClipboard mClipboard;
    ThreadParams mThreadParams;
@@ -143,12 +150,20 @@ private:
    utf::utf8string mHGFCPData;
    utf::string mHGTextData;
    std::string mHGRTFData;
+   std::string mHGImgData;
+   Glib::RefPtr<Gdk::Pixbuf> mHGImgPixbuf;
+   uint64 mGHImgHash;
+   std::string mGHImgData;
    std::vector<utf::string> mHGFileContentsList;
    DND_FILE_TRANSFER_STATUS mHGGetFileStatus;
    bool mBlockAdded;
    DnDBlockControl *mBlockCtrl;
    bool mInited;
    uint64 mTotalFileSize;
+   VmTimeType mHGStartTime;
+   sigc::connection mHGProgressConn;
+   sigc::connection mFileBlockConn;
+   int mFileBlockFd;
    bool mGetTimestampOnly;
 };
 
@@ -101,6 +101,7 @@ extern "C" {
 #define TARGET_NAME_APPLICATION_RTF          "application/rtf"
 #define TARGET_NAME_TEXT_RICHTEXT            "text/richtext"
 #define TARGET_NAME_TEXT_RTF                 "text/rtf"
+#define TARGET_NAME_IMAGE_PNG                "image/png"
 
 #define DRAG_TARGET_NAME_URI_LIST  "text/uri-list"
 #define DRAG_LEAVE_TIMEOUT         500
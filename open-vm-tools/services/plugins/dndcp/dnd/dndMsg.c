@@ -304,6 +304,13 @@ DnDMsg_Serialize(DnDMsg *msg,   // IN/OUT: the message
       serializeArgsSz += sizeof(uint32) + DynBuf_GetSize(b);
    }
 
+   /* The size is known, the appends need not grow the buffer step by step. */
+   if (!DynBuf_Reserve(buf, DynBuf_GetSize(buf) + sizeof msg->ver +
+                       sizeof msg->cmd + sizeof nargs +
+                       sizeof serializeArgsSz + serializeArgsSz)) {
+      return FALSE;
+   }
+
    if (DynBuf_Append(buf, &msg->ver, sizeof msg->ver) &&
        DynBuf_Append(buf, &msg->cmd, sizeof msg->cmd) &&
        DynBuf_Append(buf, &nargs, sizeof nargs) &&
@@ -61,6 +61,7 @@ RpcV4Util::RpcV4Util(void)
 {
    DnDCPMsgV4_Init(&mBigMsgIn);
    DnDCPMsgV4_Init(&mBigMsgOut);
+   DblLnkLst_Init(&mBigMsgOutQueue);
    DblLnkLst_Init(&mRpcSentListeners);
    DblLnkLst_Init(&mRpcReceivedListeners);
 }
@@ -73,7 +74,7 @@ RpcV4Util::RpcV4Util(void)
 RpcV4Util::~RpcV4Util(void)
 {
    DnDCPMsgV4_Destroy(&mBigMsgIn);
-   DnDCPMsgV4_Destroy(&mBigMsgOut);
+   ClearBigMsgOut();
 
    while (DblLnkLst_IsLinked(&mRpcSentListeners)) {
       DnDRpcSentListenerNode *node =
@@ -176,17 +177,32 @@ RpcV4Util::SendMsg(RpcParams *params,
    bool ret = false;
    DnDCPMsgV4 *msgOut = NULL;
    DnDCPMsgV4 shortMsg;
+   DnDBigMsgOutNode *node = NULL;
 
    ASSERT(params);
 
    DnDCPMsgV4_Init(&shortMsg);
 
-   if (binarySize > mMaxTransportPacketPayloadSize) {
+   if (binarySize > mMaxTransportPacketPayloadSize &&
+       mBigMsgOut.binary != NULL &&
+       mBigMsgOut.addrId == params->addrId &&
+       mBigMsgOut.hdr.sessionId == params->sessionId) {
+      /*
+       * The peer asks for each packet of a big message, so only one can be
+       * sent at a time. Queue this one behind it, which lets the peer keep
+       * several requests in flight within the session, e.g. hgfs reads.
+       */
+      node = (DnDBigMsgOutNode *)Util_SafeMalloc(sizeof *node);
+      DblLnkLst_Init(&node->l);
+      DnDCPMsgV4_Init(&node->msg);
+      msgOut = &node->msg;
+   } else if (binarySize > mMaxTransportPacketPayloadSize) {
       /*
        * For big message, all information should be cached in mBigMsgOut
-       * because multiple packets and sends are needed.
+       * because multiple packets and sends are needed. Big messages of
+       * another session are never going to be asked for.
        */
-      DnDCPMsgV4_Destroy(&mBigMsgOut);
+      ClearBigMsgOut();
       msgOut = &mBigMsgOut;
    } else {
       /* For short message, the temporary shortMsg is enough. */
@@ -221,6 +237,14 @@ RpcV4Util::SendMsg(RpcParams *params,
     * msgOut->binary is dereferenced only if msgOut->hdr.binarySize > 0,
     * which in turn guarantees msgOut->binary will be non-NULL.
     */
+   if (node != NULL) {
+      DblLnkLst_LinkLast(&mBigMsgOutQueue, &node->l);
+      LOG(4, "%s: queued cmd %d, binary size %d.\n", __FUNCTION__,
+          params->cmd, binarySize);
+      /* coverity[leaked_storage] */
+      return true;
+   }
+
    /* coverity[var_deref_model] */
    ret = SendMsg(msgOut);
    /* The mBigMsgOut is destroyed when the message sending was failed. */
@@ -232,6 +256,53 @@ RpcV4Util::SendMsg(RpcParams *params,
 }
 
 
+/**
+ * Start sending the next queued big message, if any. Called once the
+ * previous one has been sent.
+ */
+
+void
+RpcV4Util::SendNextBigMsg(void)
+{
+   ASSERT(mBigMsgOut.binary == NULL);
+
+   while (DblLnkLst_IsLinked(&mBigMsgOutQueue)) {
+      DnDBigMsgOutNode *node =
+         DblLnkLst_Container(mBigMsgOutQueue.next, DnDBigMsgOutNode, l);
+
+      DblLnkLst_Unlink1(&node->l);
+      mBigMsgOut = node->msg;
+      free(node);
+
+      if (SendMsg(&mBigMsgOut)) {
+         return;
+      }
+      LOG(1, "%s: SendMsg failed. \n", __FUNCTION__);
+      DnDCPMsgV4_Destroy(&mBigMsgOut);
+   }
+}
+
+
+/**
+ * Drop the big message being sent and the queued ones.
+ */
+
+void
+RpcV4Util::ClearBigMsgOut(void)
+{
+   DnDCPMsgV4_Destroy(&mBigMsgOut);
+
+   while (DblLnkLst_IsLinked(&mBigMsgOutQueue)) {
+      DnDBigMsgOutNode *node =
+         DblLnkLst_Container(mBigMsgOutQueue.next, DnDBigMsgOutNode, l);
+
+      DblLnkLst_Unlink1(&node->l);
+      DnDCPMsgV4_Destroy(&node->msg);
+      free(node);
+   }
+}
+
+
 /**
  * Construct a DNDCP_CMD_PING message and send it to destId.
  *
@@ -503,10 +574,11 @@ RpcV4Util::HandleMsg(DnDCPMsgV4 *msgIn)
 
       /*
        * mBigMsgOut will be destroyed if SendMsg failed or whole message has
-       * been sent.
+       * been sent, and the next queued one started.
        */
       if (!ret || mBigMsgOut.hdr.payloadOffset == mBigMsgOut.hdr.binarySize) {
          DnDCPMsgV4_Destroy(&mBigMsgOut);
+         SendNextBigMsg();
       }
       return;
    }
@@ -53,6 +53,13 @@ typedef struct DnDRpcSentListenerNode
 } DnDRpcSentListenerNode;
 
 
+typedef struct DnDBigMsgOutNode
+{
+   DblLnkLst_Links l;
+   DnDCPMsgV4 msg;
+} DnDBigMsgOutNode;
+
+
 class LIB_EXPORT RpcV4Util
 {
 public:
@@ -91,6 +98,8 @@ private:
    void FireRpcSentCallbacks(uint32 cmd, uint32 dest, uint32 session);
    bool SendMsg(DnDCPMsgV4 *msg);
    bool RequestNextPacket(void);
+   void SendNextBigMsg(void);
+   void ClearBigMsgOut(void);
    void HandlePacket(uint32 srcId,
                      const uint8 *packet,
                      size_t packetSize);
@@ -105,6 +114,7 @@ private:
    uint32 mVersionMinor;
    DnDCPMsgV4 mBigMsgIn;
    DnDCPMsgV4 mBigMsgOut;
+   DblLnkLst_Links mBigMsgOutQueue;
    uint32 mMsgType;
    uint32 mMsgSrc;
    DblLnkLst_Links mRpcSentListeners;
@@ -82,16 +82,24 @@ VMGuestFileTransfer::OnRpcRecvHgfsPacket(uint32 sessionId,
                                          size_t packetSize)
 {
    char replyPacket[HGFS_LARGE_PACKET_MAX];
-   size_t replyPacketSize;
+   size_t replyPacketSize = sizeof replyPacket;
 
    ASSERT(packet);
    ASSERT(mRpc);
 
-   /* Call hgfs server to process the request, and send reply back to peer. */
-   HgfsServerManager_ProcessPacket(&mHgfsServerMgrData,
-                                   (const char *)packet,
-                                   packetSize,
-                                   replyPacket,
-                                   &replyPacketSize);
+   /*
+    * Call hgfs server to process the request, and send reply back to peer.
+    * Replies bigger than a transport packet are queued by the rpc layer, so
+    * the peer may send the next requests before this one is answered.
+    */
+   if (!HgfsServerManager_ProcessPacket(&mHgfsServerMgrData,
+                                        (const char *)packet,
+                                        packetSize,
+                                        replyPacket,
+                                        &replyPacketSize)) {
+      Debug("%s: failed to process hgfs packet of session %u.\n",
+            __FUNCTION__, sessionId);
+      return;
+   }
    mRpc->SendHgfsReply(sessionId, (const uint8 *)replyPacket, replyPacketSize);
 }
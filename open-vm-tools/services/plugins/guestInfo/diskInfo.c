@@ -25,6 +25,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined (__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/poll.h>
+#include <unistd.h>
+#endif
 #include "vm_assert.h"
 #include "debug.h"
 #include "guestInfoInt.h"
@@ -995,6 +1001,440 @@ GuestInfoGetDiskDevice(const char *fsName,
 }
 
 
+/*
+ ******************************************************************************
+ * GuestInfoAddPartitionEntry --                                         */ /**
+ *
+ * Append a partition to the reported disk info.
+ *
+ * @param[in/out] di          DiskInfo container.
+ * @param[in]     mountPoint  Mount point of the partition.
+ * @param[in]     fsType      File system type.
+ * @param[in]     freeBytes   Free space.
+ * @param[in]     totalBytes  Size.
+ *
+ * @return The new entry, with no disk device names.
+ *
+ ******************************************************************************
+ */
+
+static PartitionEntryInt *
+GuestInfoAddPartitionEntry(GuestDiskInfoInt *di,
+                           const char *mountPoint,
+                           const char *fsType,
+                           uint64 freeBytes,
+                           uint64 totalBytes)
+{
+   size_t partNameSize = sizeof (di->partitionList)[0].name;
+   PartitionEntryInt *partEntry;
+
+   if (strlen(mountPoint) + 1 > partNameSize) {
+      g_debug("GetDiskInfo: Partition name '%s' too large, truncating\n",
+              mountPoint);
+   }
+
+   di->partitionList = Util_SafeRealloc(di->partitionList,
+                                        (di->numEntries + 1) *
+                                        sizeof *di->partitionList);
+
+   partEntry = &di->partitionList[di->numEntries++];
+   Str_Strncpy(partEntry->name, partNameSize,
+               mountPoint, partNameSize - 1);
+   partEntry->freeBytes = freeBytes;
+   partEntry->totalBytes = totalBytes;
+   Str_Strncpy(partEntry->fsType, sizeof (di->partitionList)[0].fsType,
+               fsType, strlen(fsType));
+
+   /* Start with an empty set of disk device names. */
+   partEntry->diskDevCnt = 0;
+   partEntry->diskDevNames = NULL;
+
+   return partEntry;
+}
+
+
+#if defined (__linux__)
+
+/*
+ * On Linux, the partition table and the disk devices of the partitions are
+ * cached, and only rebuilt when the mount table changes, which is signaled
+ * by /proc/self/mountinfo polling for urgent data. The free space is
+ * queried in parallel by a pool of threads, and a partition whose statfs()
+ * does not return in time (e.g. a stale NFS or iSCSI mount) is left out of
+ * the report instead of blocking it. It is not queried again until that
+ * statfs() returns.
+ */
+
+#define GUESTINFO_DISK_STATFS_THREADS     4
+#define GUESTINFO_DISK_STATFS_TIMEOUT_MS  2000
+
+typedef struct DiskCacheEntry {
+   gint refs;              // The cache, and the statfs() in progress
+   char *mountPoint;
+   char *fsName;
+   char *fsType;
+   int type;               // WiperPartition_Type
+   Bool devicesDone;
+   int diskDevCnt;
+   DiskDevName *diskDevNames;
+
+   /* Protected by gDiskLock. */
+   Bool busy;              // A statfs() was queued and has not returned
+   Bool hung;              // It did not return in time
+   Bool done;              // It returned for the current gather
+   const char *error;
+   uint64 availBytes;
+   uint64 freeBytes;
+   uint64 totalBytes;
+} DiskCacheEntry;
+
+static GMutex gDiskLock;
+static GCond gDiskCond;
+static GThreadPool *gDiskPool = NULL;
+static GPtrArray *gDiskCache = NULL;   // DiskCacheEntry
+static int gMountInfoFd = -1;
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskCacheUnref --                                            */ /**
+ *
+ * Drop a reference to a cache entry.
+ *
+ * @param[in] data   The entry.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoDiskCacheUnref(gpointer data)
+{
+   DiskCacheEntry *entry = data;
+
+   if (g_atomic_int_dec_and_test(&entry->refs)) {
+      free(entry->mountPoint);
+      free(entry->fsName);
+      free(entry->fsType);
+      free(entry->diskDevNames);
+      free(entry);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskStatfs --                                                */ /**
+ *
+ * Thread pool worker querying the space of a partition.
+ *
+ * @param[in] data      The entry, whose reference is released.
+ * @param[in] userData  Unused.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoDiskStatfs(gpointer data,
+                    gpointer userData)
+{
+   DiskCacheEntry *entry = data;
+   WiperPartition part;
+   uint64 availBytes = 0;
+   uint64 freeBytes = 0;
+   uint64 totalBytes = 0;
+   const char *error;
+
+   memset(&part, 0, sizeof part);
+   Str_Strcpy(part.mountPoint, entry->mountPoint, sizeof part.mountPoint);
+   error = WiperSinglePartition_GetSpace(&part, &availBytes, &freeBytes,
+                                         &totalBytes);
+
+   g_mutex_lock(&gDiskLock);
+   if (entry->hung) {
+      g_message("%s: statfs() of %s returned.\n", __FUNCTION__,
+                entry->mountPoint);
+   }
+   entry->busy = FALSE;
+   entry->hung = FALSE;
+   entry->done = TRUE;
+   entry->error = error[0] != '\0' ? error : NULL;
+   entry->availBytes = availBytes;
+   entry->freeBytes = freeBytes;
+   entry->totalBytes = totalBytes;
+   g_cond_broadcast(&gDiskCond);
+   g_mutex_unlock(&gDiskLock);
+
+   GuestInfoDiskCacheUnref(entry);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskCacheChanged --                                          */ /**
+ *
+ * Check whether the mount table changed since the last call.
+ *
+ * @return TRUE if the cache must be rebuilt.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoDiskCacheChanged(void)
+{
+   struct pollfd pfd;
+
+   if (gMountInfoFd < 0) {
+      gMountInfoFd = open(LINUX_PROC_SELF_MOUNTINFO, O_RDONLY | O_CLOEXEC);
+      if (gMountInfoFd < 0) {
+         g_debug("%s: Cannot open %s: %s\n", __FUNCTION__,
+                 LINUX_PROC_SELF_MOUNTINFO, strerror(errno));
+      }
+      return TRUE;
+   }
+
+   /* Polling resets the event, nothing needs to be read. */
+   pfd.fd = gMountInfoFd;
+   pfd.events = POLLPRI;
+   pfd.revents = 0;
+   return poll(&pfd, 1, 0) != 0;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoDiskCacheRebuild --                                          */ /**
+ *
+ * Rebuild the cached partition table from the mount table. Entries of
+ * partitions still mounted are kept, with their disk devices.
+ *
+ * @return FALSE if the partition list could not be read.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoDiskCacheRebuild(void)
+{
+   WiperPartition_List pl;
+   DblLnkLst_Links *curr;
+   GPtrArray *cache;
+
+   if (!WiperPartition_Open(&pl, FALSE)) {
+      g_warning("GetDiskInfo: ERROR: could not get partition list\n");
+      return FALSE;
+   }
+
+   cache = g_ptr_array_new_with_free_func(GuestInfoDiskCacheUnref);
+
+   DblLnkLst_ForEach(curr, &pl.link) {
+      WiperPartition *part = DblLnkLst_Container(curr, WiperPartition, link);
+      DiskCacheEntry *entry = NULL;
+      guint i;
+
+      if (part->type == PARTITION_UNSUPPORTED) {
+         g_debug("%s ignoring unsupported partition %s %s\n",
+                 __FUNCTION__, part->mountPoint,
+                 part->comment ? part->comment : "");
+         continue;
+      }
+
+      for (i = 0; gDiskCache != NULL && i < gDiskCache->len; i++) {
+         DiskCacheEntry *old = g_ptr_array_index(gDiskCache, i);
+
+         if (old->type == part->type &&
+             strcmp(old->mountPoint, part->mountPoint) == 0 &&
+             strcmp(old->fsName, part->fsName) == 0 &&
+             strcmp(old->fsType, part->fsType) == 0) {
+            entry = old;
+            g_atomic_int_inc(&entry->refs);
+            break;
+         }
+      }
+
+      if (entry == NULL) {
+         entry = Util_SafeCalloc(1, sizeof *entry);
+         entry->refs = 1;
+         entry->mountPoint = Util_SafeStrdup(part->mountPoint);
+         entry->fsName = Util_SafeStrdup(part->fsName);
+         entry->fsType = Util_SafeStrdup(part->fsType);
+         entry->type = part->type;
+      }
+      g_ptr_array_add(cache, entry);
+   }
+
+   WiperPartition_Close(&pl);
+
+   if (gDiskCache != NULL) {
+      g_ptr_array_free(gDiskCache, TRUE);
+   }
+   gDiskCache = cache;
+   g_debug("%s: %u partitions.\n", __FUNCTION__, cache->len);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoGetDiskInfoWiper --                                          */ /**
+ *
+ * Report the cached partitions, with their utilization data queried in
+ * parallel.
+ *
+ * @param[in] includeReserved  Whether to count the reserved space as free.
+ * @param[in] reportDevices    Whether to report the disk devices.
+ *
+ * @return Pointer to a GuestDiskInfoInt structure on success or NULL on failure.
+ *         Caller should free returned pointer with GuestInfo_FreeDiskInfo.
+ *
+ ******************************************************************************
+ */
+
+GuestDiskInfoInt *
+GuestInfoGetDiskInfoWiper(Bool includeReserved,  // IN
+                          Bool reportDevices)    // IN
+{
+   GuestDiskInfoInt *di;
+   gint64 deadline;
+   Bool success = TRUE;
+   guint i;
+
+   if ((GuestInfoDiskCacheChanged() || gDiskCache == NULL) &&
+       !GuestInfoDiskCacheRebuild()) {
+      return NULL;
+   }
+
+   if (gDiskPool == NULL) {
+      GError *err = NULL;
+
+      gDiskPool = g_thread_pool_new(GuestInfoDiskStatfs, NULL,
+                                    GUESTINFO_DISK_STATFS_THREADS,
+                                    FALSE, &err);
+      if (gDiskPool == NULL) {
+         g_warning("%s: Unable to create the statfs threads: %s\n",
+                   __FUNCTION__, err != NULL ? err->message : "unknown");
+         g_clear_error(&err);
+         return NULL;
+      }
+   }
+
+   g_mutex_lock(&gDiskLock);
+   for (i = 0; i < gDiskCache->len; i++) {
+      DiskCacheEntry *entry = g_ptr_array_index(gDiskCache, i);
+
+      entry->done = FALSE;
+      if (entry->busy) {
+         /* Still hung since an earlier gather. */
+         continue;
+      }
+      entry->busy = TRUE;
+      g_atomic_int_inc(&entry->refs);
+      g_thread_pool_push(gDiskPool, entry, NULL);
+   }
+
+   deadline = g_get_monotonic_time() +
+              GUESTINFO_DISK_STATFS_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+   for (i = 0; i < gDiskCache->len; i++) {
+      DiskCacheEntry *entry = g_ptr_array_index(gDiskCache, i);
+
+      while (!entry->done && !entry->hung &&
+             g_cond_wait_until(&gDiskCond, &gDiskLock, deadline)) {
+      }
+      if (!entry->done && !entry->hung) {
+         g_warning("GetDiskInfo: statfs() of %s timed out, skipping it.\n",
+                   entry->mountPoint);
+         entry->hung = TRUE;
+      }
+   }
+
+   di = Util_SafeCalloc(1, sizeof *di);
+
+   for (i = 0; i < gDiskCache->len; i++) {
+      DiskCacheEntry *entry = g_ptr_array_index(gDiskCache, i);
+      PartitionEntryInt *partEntry;
+
+      if (!entry->done) {
+         continue;
+      }
+      if (entry->error != NULL) {
+         g_warning("GetDiskInfo: ERROR: could not get space info for "
+                   "partition %s: %s\n", entry->mountPoint, entry->error);
+         success = FALSE;
+         break;
+      }
+
+      partEntry = GuestInfoAddPartitionEntry(di, entry->mountPoint,
+                                             entry->fsType,
+                                             includeReserved ?
+                                                entry->freeBytes :
+                                                entry->availBytes,
+                                             entry->totalBytes);
+
+      if (reportDevices) {
+         /* Only the main thread touches the devices. */
+         if (!entry->devicesDone) {
+            PartitionEntryInt devices;
+
+            memset(&devices, 0, sizeof devices);
+            GuestInfoGetDiskDevice(entry->fsName, &devices);
+            entry->diskDevCnt = devices.diskDevCnt;
+            entry->diskDevNames = devices.diskDevNames;
+            entry->devicesDone = TRUE;
+         }
+         if (entry->diskDevCnt > 0) {
+            partEntry->diskDevCnt = entry->diskDevCnt;
+            partEntry->diskDevNames = Util_SafeMalloc(entry->diskDevCnt *
+                                                sizeof *entry->diskDevNames);
+            memcpy(partEntry->diskDevNames, entry->diskDevNames,
+                   entry->diskDevCnt * sizeof *entry->diskDevNames);
+         }
+      }
+
+      g_debug("%s added partition #%u %s type %d fstype %s (mount point %s) "
+              "free %"FMT64"u total %"FMT64"u\n",
+              __FUNCTION__, di->numEntries, partEntry->name, entry->type,
+              partEntry->fsType, entry->fsName,
+              partEntry->freeBytes, partEntry->totalBytes);
+   }
+   g_mutex_unlock(&gDiskLock);
+
+   if (!success) {
+      GuestInfo_FreeDiskInfo(di);
+      di = NULL;
+   }
+   return di;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_DiskInfoShutdown --                                         */ /**
+ *
+ * Free the partition cache. The statfs() calls still queued or hung are
+ * left to their threads, which free their entries when they return.
+ *
+ ******************************************************************************
+ */
+
+void
+GuestInfo_DiskInfoShutdown(void)
+{
+   if (gDiskPool != NULL) {
+      g_thread_pool_free(gDiskPool, FALSE, FALSE);
+      gDiskPool = NULL;
+   }
+   if (gDiskCache != NULL) {
+      g_ptr_array_free(gDiskCache, TRUE);
+      gDiskCache = NULL;
+   }
+   if (gMountInfoFd >= 0) {
+      close(gMountInfoFd);
+      gMountInfoFd = -1;
+   }
+}
+
+#else /* __linux__ */
+
 /*
  ******************************************************************************
  * GuestInfoGetDiskInfoWiper --                                          */ /**
@@ -1013,10 +1453,8 @@ GuestInfoGetDiskInfoWiper(Bool includeReserved,  // IN
 {
    WiperPartition_List pl;
    DblLnkLst_Links *curr;
-   unsigned int partCount = 0;
    uint64 freeBytes = 0;
    uint64 totalBytes = 0;
-   size_t partNameSize = 0;
    Bool success = FALSE;
    GuestDiskInfoInt *di;
 
@@ -1027,13 +1465,11 @@ GuestInfoGetDiskInfoWiper(Bool includeReserved,  // IN
    }
 
    di = Util_SafeCalloc(1, sizeof *di);
-   partNameSize = sizeof (di->partitionList)[0].name;
 
    DblLnkLst_ForEach(curr, &pl.link) {
       WiperPartition *part = DblLnkLst_Container(curr, WiperPartition, link);
 
       if (part->type != PARTITION_UNSUPPORTED) {
-         PartitionEntryInt *newPartitionList;
          PartitionEntryInt *partEntry;
          unsigned char *error;
          if (includeReserved) {
@@ -1049,35 +1485,17 @@ GuestInfoGetDiskInfoWiper(Bool includeReserved,  // IN
             goto out;
          }
 
-         if (strlen(part->mountPoint) + 1 > partNameSize) {
-            g_debug("GetDiskInfo: Partition name '%s' too large, truncating\n",
-                    part->mountPoint);
-         }
-
-         newPartitionList = Util_SafeRealloc(di->partitionList,
-                                             (partCount + 1) *
-                                             sizeof *di->partitionList);
-
-         partEntry = &newPartitionList[partCount++];
-         Str_Strncpy(partEntry->name, partNameSize,
-                     part->mountPoint, partNameSize - 1);
-         partEntry->freeBytes = freeBytes;
-         partEntry->totalBytes = totalBytes;
-         Str_Strncpy(partEntry->fsType, sizeof (di->partitionList)[0].fsType,
-                     part->fsType, strlen(part->fsType));
-
-         /* Start with an empty set of disk device names. */
-         partEntry->diskDevCnt = 0;
-         partEntry->diskDevNames = NULL;
+         partEntry = GuestInfoAddPartitionEntry(di, part->mountPoint,
+                                                part->fsType,
+                                                freeBytes, totalBytes);
 
          if (reportDevices) {
             GuestInfoGetDiskDevice(part->fsName, partEntry);
          }
 
-         di->partitionList = newPartitionList;
-         g_debug("%s added partition #%d %s type %d fstype %s (mount point %s) "
+         g_debug("%s added partition #%u %s type %d fstype %s (mount point %s) "
                  "free %"FMT64"u total %"FMT64"u\n",
-                 __FUNCTION__, partCount, partEntry->name, part->type,
+                 __FUNCTION__, di->numEntries, partEntry->name, part->type,
                  partEntry->fsType, part->fsName,
                  partEntry->freeBytes, partEntry->totalBytes);
       } else {
@@ -1087,7 +1505,6 @@ GuestInfoGetDiskInfoWiper(Bool includeReserved,  // IN
       }
    }
 
-   di->numEntries = partCount;
    success = TRUE;
 
 out:
@@ -1098,3 +1515,5 @@ out:
    WiperPartition_Close(&pl);
    return di;
 }
+
+#endif /* __linux__ */
@@ -0,0 +1,753 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file guestInfoCgroupLinux.c
+ *
+ * Collects per-cgroup resource usage from the cgroup v2 hierarchy, so that
+ * the host can attribute the guest's CPU, memory and I/O to its containers.
+ *
+ * - The hierarchy is kept as a list of nodes, parents before children, each
+ *   holding a directory fd; stat files are opened relative to it, so a scan
+ *   does no path lookups. Past GUEST_INFO_CGROUP_MAX_FDS directories, nodes
+ *   reopen their directory when visited.
+ * - Each scan visits nodes round-robin, starting where the previous one
+ *   stopped, until all were visited or the time budget is spent. A visit
+ *   lists the node's children and reads its cpu.stat, memory.stat and
+ *   io.stat.
+ * - Only leaves are ranked: cgroup v2 counters include the descendants, so
+ *   parents would always win over the containers they hold.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "guestInfoInt.h"
+#include "str.h"
+#include "util.h"
+
+#define GUEST_INFO_CGROUP_ROOT      "/sys/fs/cgroup"
+
+/**
+ * How many directory fds the tree may keep open.
+ */
+#define GUEST_INFO_CGROUP_MAX_FDS   256
+
+/**
+ * How many cgroups are tracked at most.
+ */
+#define GUEST_INFO_CGROUP_MAX_NODES 4096
+
+typedef struct GuestInfoCgroupNode {
+   struct GuestInfoCgroupNode *parent;
+   char                       *path;         // From the root, "/" for the root
+   int                         fd;           // -1 if not cached
+   uint32                      numChildren;
+   uint32                      listId;       // Id of the last children listing
+   uint32                      seenId;       // Parent's listing that saw it
+   Bool                        dead;
+   Bool                        selected;     // Among the top ones
+
+   gint64                      readTime;     // 0 if the stats were never read
+   Bool                        hasCpuUsage;
+   uint64                      cpuUsage;     // usec
+   Bool                        hasIoBytes;
+   uint64                      ioRead;       // bytes
+   uint64                      ioWrite;      // bytes
+   GuestInfoCgroupReport       report;
+} GuestInfoCgroupNode;
+
+static GPtrArray *gNodes = NULL;
+static GHashTable *gNodesByPath = NULL;
+static Bool gCgroupUnavailable = FALSE;
+static uint32 gCursor = 0;
+static uint32 gNextListId = 1;
+static uint32 gNumFds = 0;
+static Bool gSweepNeeded = FALSE;
+static const GuestInfoCgroupReport **gReports = NULL;
+static char gReadBuf[8192];
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupNewNode --                                             */ /**
+ *
+ * Adds a node for a cgroup directory.
+ *
+ * @param[in]  parent   The parent node, NULL for the root.
+ * @param[in]  path     Path of the cgroup, from the root.
+ * @param[in]  fd       Directory fd, or -1. Owned by the node.
+ *
+ * @return The node.
+ *
+ ******************************************************************************
+ */
+
+static GuestInfoCgroupNode *
+GuestInfoCgroupNewNode(GuestInfoCgroupNode *parent,
+                       char *path,
+                       int fd)
+{
+   GuestInfoCgroupNode *node = g_new0(GuestInfoCgroupNode, 1);
+
+   node->parent = parent;
+   node->path = path;
+   node->fd = fd;
+   node->report.path = path;
+   if (fd >= 0) {
+      gNumFds++;
+   }
+
+   g_ptr_array_add(gNodes, node);
+   g_hash_table_insert(gNodesByPath, node->path, node);
+   return node;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupFreeNode --                                            */ /**
+ *
+ * Closes and frees a node. It must already be out of gNodes.
+ *
+ * @param[in]  node     The node.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoCgroupFreeNode(GuestInfoCgroupNode *node)
+{
+   g_hash_table_remove(gNodesByPath, node->path);
+   if (node->fd >= 0) {
+      close(node->fd);
+      gNumFds--;
+   }
+   g_free(node->path);
+   g_free(node);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupOpenDir --                                             */ /**
+ *
+ * @param[in]  node     The node.
+ *
+ * @return The node's directory fd, to be closed with GuestInfoCgroupCloseDir,
+ *         or -1 if the cgroup is gone.
+ *
+ ******************************************************************************
+ */
+
+static int
+GuestInfoCgroupOpenDir(GuestInfoCgroupNode *node)
+{
+   GuestInfoCgroupNode *root = g_ptr_array_index(gNodes, 0);
+
+   if (node->fd >= 0) {
+      return node->fd;
+   }
+
+   return openat(root->fd, node->path + 1,
+                 O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+
+static void
+GuestInfoCgroupCloseDir(GuestInfoCgroupNode *node,
+                        int fd)
+{
+   if (fd >= 0 && fd != node->fd) {
+      close(fd);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupListChildren --                                        */ /**
+ *
+ * Adds the children of a node that are not known yet, and counts them.
+ * Children that are gone are removed by the next GuestInfoCgroupSweep.
+ *
+ * @param[in]  node     The node.
+ * @param[in]  dirFd    The node's directory fd.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoCgroupListChildren(GuestInfoCgroupNode *node,
+                            int dirFd)
+{
+   uint32 listId = gNextListId++;
+   uint32 numChildren = 0;
+   Bool isRoot = node->parent == NULL;
+   struct dirent *entry;
+   DIR *dir;
+   int fd;
+
+   /* A new open description, so that fdopendir does not take dirFd. */
+   fd = openat(dirFd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd < 0 || (dir = fdopendir(fd)) == NULL) {
+      if (fd >= 0) {
+         close(fd);
+      }
+      node->dead = node->parent != NULL;
+      gSweepNeeded = TRUE;
+      return;
+   }
+
+   node->listId = listId;
+
+   while ((entry = readdir(dir)) != NULL) {
+      GuestInfoCgroupNode *child;
+      char *path;
+
+      if (entry->d_type != DT_DIR || entry->d_name[0] == '.') {
+         continue;
+      }
+
+      path = g_strdup_printf("%s/%s", isRoot ? "" : node->path,
+                             entry->d_name);
+      child = g_hash_table_lookup(gNodesByPath, path);
+      if (child == NULL) {
+         int childFd = -1;
+
+         if (gNodes->len >= GUEST_INFO_CGROUP_MAX_NODES) {
+            g_free(path);
+            continue;
+         }
+         if (gNumFds < GUEST_INFO_CGROUP_MAX_FDS) {
+            childFd = openat(dirFd, entry->d_name,
+                             O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (childFd < 0) {
+               g_free(path);
+               continue;
+            }
+         }
+         child = GuestInfoCgroupNewNode(node, path, childFd);
+      } else {
+         g_free(path);
+      }
+
+      child->seenId = listId;
+      numChildren++;
+   }
+   closedir(dir);
+
+   if (numChildren < node->numChildren) {
+      gSweepNeeded = TRUE;
+   }
+   node->numChildren = numChildren;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupSweep --                                               */ /**
+ *
+ * Removes the nodes of the cgroups that are gone, with their descendants.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoCgroupSweep(void)
+{
+   GPtrArray *dead = g_ptr_array_new();
+   uint32 kept = 0;
+   uint32 cursor = gCursor;
+   uint32 i;
+
+   /* Parents come first, so their fate is known when children are seen. */
+   for (i = 0; i < gNodes->len; i++) {
+      GuestInfoCgroupNode *node = g_ptr_array_index(gNodes, i);
+
+      if (node->parent != NULL &&
+          (node->parent->dead ||
+           (node->parent->listId != 0 &&
+            node->seenId != node->parent->listId))) {
+         node->dead = TRUE;
+      }
+
+      if (node->dead) {
+         g_ptr_array_add(dead, node);
+         if (i < gCursor) {
+            cursor--;
+         }
+      } else {
+         g_ptr_array_index(gNodes, kept++) = node;
+      }
+   }
+   g_ptr_array_set_size(gNodes, kept);
+
+   for (i = 0; i < dead->len; i++) {
+      GuestInfoCgroupFreeNode(g_ptr_array_index(dead, i));
+   }
+   g_ptr_array_free(dead, TRUE);
+
+   gCursor = cursor;
+   gSweepNeeded = FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupReadFile --                                            */ /**
+ *
+ * Reads a stat file of a cgroup into gReadBuf.
+ *
+ * @param[in]  dirFd    The cgroup's directory fd.
+ * @param[in]  name     Name of the file.
+ *
+ * @return The NUL terminated contents, or NULL if the file cannot be read,
+ *         e.g. because its controller is not enabled for this cgroup.
+ *
+ ******************************************************************************
+ */
+
+static char *
+GuestInfoCgroupReadFile(int dirFd,
+                        const char *name)
+{
+   size_t size = 0;
+   int fd = openat(dirFd, name, O_RDONLY | O_CLOEXEC);
+
+   if (fd < 0) {
+      return NULL;
+   }
+
+   while (size < sizeof gReadBuf - 1) {
+      ssize_t len = read(fd, gReadBuf + size, sizeof gReadBuf - 1 - size);
+
+      if (len < 0 && errno == EINTR) {
+         continue;
+      }
+      if (len <= 0) {
+         if (len < 0) {
+            close(fd);
+            return NULL;
+         }
+         break;
+      }
+      size += len;
+   }
+   close(fd);
+
+   gReadBuf[size] = '\0';
+   return gReadBuf;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupFindKey --                                             */ /**
+ *
+ * Finds a "key value" line of a flat keyed cgroup file.
+ *
+ * @param[in]  data     Contents of the file.
+ * @param[in]  key      The key.
+ * @param[out] value    The value.
+ *
+ * @return TRUE if the key was found.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoCgroupFindKey(const char *data,
+                       const char *key,
+                       uint64 *value)
+{
+   size_t keyLen = strlen(key);
+   const char *line = data;
+
+   while (line != NULL && *line != '\0') {
+      if (strncmp(line, key, keyLen) == 0 && line[keyLen] == ' ') {
+         *value = strtoull(line + keyLen + 1, NULL, 10);
+         return TRUE;
+      }
+      line = strchr(line, '\n');
+      if (line != NULL) {
+         line++;
+      }
+   }
+
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupSumIo --                                               */ /**
+ *
+ * Sums the bytes read and written over all the devices of io.stat, whose
+ * lines look like "8:0 rbytes=1459200 wbytes=314773504 rios=192 ...".
+ *
+ * @param[in]  data     Contents of io.stat.
+ * @param[out] read     Bytes read.
+ * @param[out] written  Bytes written.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoCgroupSumIo(const char *data,
+                     uint64 *read,
+                     uint64 *written)
+{
+   const char *p;
+
+   *read = 0;
+   *written = 0;
+
+   for (p = data; (p = strstr(p, "bytes=")) != NULL; p += 6) {
+      uint64 value = strtoull(p + 6, NULL, 10);
+
+      if (p > data && p[-1] == 'r') {
+         *read += value;
+      } else if (p > data && p[-1] == 'w') {
+         *written += value;
+      }
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupRate --                                                */ /**
+ *
+ * @param[in]  current  Current counter value.
+ * @param[in]  previous Previous counter value.
+ * @param[in]  elapsed  Time between the two, in usec.
+ *
+ * @return The rate per second, 0 if the counter went backwards.
+ *
+ ******************************************************************************
+ */
+
+static double
+GuestInfoCgroupRate(uint64 current,
+                    uint64 previous,
+                    gint64 elapsed)
+{
+   if (current < previous || elapsed <= 0) {
+      return 0.0;
+   }
+   return (double)(current - previous) * G_USEC_PER_SEC / elapsed;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupReadStats --                                           */ /**
+ *
+ * Reads the stats of a node, and computes its rates since the last read.
+ *
+ * @param[in]  node     The node.
+ * @param[in]  dirFd    The node's directory fd.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoCgroupReadStats(GuestInfoCgroupNode *node,
+                         int dirFd)
+{
+   GuestInfoCgroupReport *report = &node->report;
+   gint64 now = g_get_monotonic_time();
+   gint64 elapsed = now - node->readTime;
+   Bool hadRead = node->readTime != 0;
+   char *data;
+   uint64 value;
+
+   data = GuestInfoCgroupReadFile(dirFd, "cpu.stat");
+   if (data != NULL && GuestInfoCgroupFindKey(data, "usage_usec", &value)) {
+      report->hasCpu = hadRead && node->hasCpuUsage;
+      if (report->hasCpu) {
+         report->cpuUsageRate = GuestInfoCgroupRate(value, node->cpuUsage,
+                                                    elapsed);
+      }
+      node->hasCpuUsage = TRUE;
+      node->cpuUsage = value;
+   } else {
+      report->hasCpu = node->hasCpuUsage = FALSE;
+   }
+
+   data = GuestInfoCgroupReadFile(dirFd, "memory.stat");
+   report->hasMem = data != NULL &&
+                    GuestInfoCgroupFindKey(data, "anon", &report->memAnon) &&
+                    GuestInfoCgroupFindKey(data, "file", &report->memFile);
+
+   data = GuestInfoCgroupReadFile(dirFd, "io.stat");
+   if (data != NULL) {
+      uint64 read;
+      uint64 written;
+
+      GuestInfoCgroupSumIo(data, &read, &written);
+      report->hasIo = hadRead && node->hasIoBytes;
+      if (report->hasIo) {
+         report->ioReadRate = GuestInfoCgroupRate(read, node->ioRead, elapsed);
+         report->ioWriteRate = GuestInfoCgroupRate(written, node->ioWrite,
+                                                   elapsed);
+      }
+      node->hasIoBytes = TRUE;
+      node->ioRead = read;
+      node->ioWrite = written;
+   } else {
+      report->hasIo = node->hasIoBytes = FALSE;
+   }
+
+   node->readTime = now;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupInit --                                                */ /**
+ *
+ * Opens the root of the cgroup v2 hierarchy.
+ *
+ * @return TRUE if the guest has one.
+ *
+ ******************************************************************************
+ */
+
+static Bool
+GuestInfoCgroupInit(void)
+{
+   int fd;
+
+   if (gNodes != NULL) {
+      return TRUE;
+   }
+   if (gCgroupUnavailable) {
+      return FALSE;
+   }
+
+   fd = open(GUEST_INFO_CGROUP_ROOT, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+   if (fd < 0 || faccessat(fd, "cgroup.controllers", F_OK, 0) != 0) {
+      g_info("%s: No cgroup v2 hierarchy at %s, not reporting cgroup "
+             "stats.\n", __FUNCTION__, GUEST_INFO_CGROUP_ROOT);
+      if (fd >= 0) {
+         close(fd);
+      }
+      gCgroupUnavailable = TRUE;
+      return FALSE;
+   }
+
+   gNodes = g_ptr_array_new();
+   gNodesByPath = g_hash_table_new(g_str_hash, g_str_equal);
+   GuestInfoCgroupNewNode(NULL, g_strdup("/"), fd);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupCompareCpu --                                          */ /**
+ *
+ * qsort comparator ordering nodes by decreasing CPU usage.
+ *
+ ******************************************************************************
+ */
+
+static int
+GuestInfoCgroupCompareCpu(const void *a,
+                          const void *b)
+{
+   const GuestInfoCgroupReport *ra =
+      &(*(GuestInfoCgroupNode * const *)a)->report;
+   const GuestInfoCgroupReport *rb =
+      &(*(GuestInfoCgroupNode * const *)b)->report;
+   double ca = ra->hasCpu ? ra->cpuUsageRate : -1.0;
+   double cb = rb->hasCpu ? rb->cpuUsageRate : -1.0;
+
+   return (ca < cb) - (ca > cb);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoCgroupCompareMem --                                          */ /**
+ *
+ * qsort comparator ordering nodes by decreasing memory usage.
+ *
+ ******************************************************************************
+ */
+
+static int
+GuestInfoCgroupCompareMem(const void *a,
+                          const void *b)
+{
+   const GuestInfoCgroupReport *ra =
+      &(*(GuestInfoCgroupNode * const *)a)->report;
+   const GuestInfoCgroupReport *rb =
+      &(*(GuestInfoCgroupNode * const *)b)->report;
+   uint64 ma = ra->hasMem ? ra->memAnon + ra->memFile : 0;
+   uint64 mb = rb->hasMem ? rb->memAnon + rb->memFile : 0;
+
+   return (ma < mb) - (ma > mb);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_CgroupScan --                                               */ /**
+ *
+ * Refreshes the cgroup stats, within a time budget, and ranks the leaf
+ * cgroups. The nodes that were not visited in time keep their previous
+ * stats, and are visited first by the next scan.
+ *
+ * @param[in]  topN     How many of the top CPU and of the top memory
+ *                      consumers to return.
+ * @param[in]  budgetMs Time budget of the scan.
+ * @param[out] reports  The consumers, valid until the next scan. A cgroup
+ *                      among the top ones for both is only returned once.
+ *
+ * @return The number of reports.
+ *
+ ******************************************************************************
+ */
+
+uint32
+GuestInfo_CgroupScan(uint32 topN,
+                     uint32 budgetMs,
+                     const GuestInfoCgroupReport ***reports)
+{
+   gint64 deadline = g_get_monotonic_time() + (gint64)budgetMs * 1000;
+   GuestInfoCgroupNode **leaves;
+   uint32 numLeaves = 0;
+   uint32 numReports = 0;
+   uint32 visited;
+   uint32 i;
+
+   *reports = NULL;
+
+   if (topN == 0 || !GuestInfoCgroupInit()) {
+      return 0;
+   }
+
+   /* Always make some progress, even if the budget is tiny. */
+   for (visited = 0;
+        visited < gNodes->len &&
+        (visited == 0 || g_get_monotonic_time() < deadline);
+        visited++) {
+      GuestInfoCgroupNode *node;
+      int fd;
+
+      if (gCursor >= gNodes->len) {
+         gCursor = 0;
+      }
+      node = g_ptr_array_index(gNodes, gCursor++);
+      if (node->dead) {
+         continue;
+      }
+
+      fd = GuestInfoCgroupOpenDir(node);
+      if (fd < 0) {
+         node->dead = TRUE;
+         gSweepNeeded = TRUE;
+         continue;
+      }
+      GuestInfoCgroupListChildren(node, fd);
+      GuestInfoCgroupReadStats(node, fd);
+      GuestInfoCgroupCloseDir(node, fd);
+   }
+
+   if (visited < gNodes->len) {
+      g_debug("%s: Visited %u of %u cgroups within %ums.\n", __FUNCTION__,
+              visited, gNodes->len, budgetMs);
+   }
+
+   if (gSweepNeeded) {
+      GuestInfoCgroupSweep();
+   }
+
+   leaves = g_new(GuestInfoCgroupNode *, gNodes->len);
+   for (i = 0; i < gNodes->len; i++) {
+      GuestInfoCgroupNode *node = g_ptr_array_index(gNodes, i);
+
+      if (node->numChildren == 0 && node->readTime != 0) {
+         node->selected = FALSE;
+         leaves[numLeaves++] = node;
+      }
+   }
+
+   g_free(gReports);
+   gReports = g_new(const GuestInfoCgroupReport *,
+                    2 * MIN(topN, numLeaves) + 1);
+
+   qsort(leaves, numLeaves, sizeof *leaves, GuestInfoCgroupCompareCpu);
+   for (i = 0; i < numLeaves && i < topN && leaves[i]->report.hasCpu; i++) {
+      leaves[i]->selected = TRUE;
+      gReports[numReports++] = &leaves[i]->report;
+   }
+
+   qsort(leaves, numLeaves, sizeof *leaves, GuestInfoCgroupCompareMem);
+   for (i = 0; i < numLeaves && i < topN && leaves[i]->report.hasMem; i++) {
+      if (!leaves[i]->selected) {
+         leaves[i]->selected = TRUE;
+         gReports[numReports++] = &leaves[i]->report;
+      }
+   }
+
+   g_free(leaves);
+
+   *reports = gReports;
+   return numReports;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_CgroupShutdown --                                           */ /**
+ *
+ * Closes the cgroup tree.
+ *
+ ******************************************************************************
+ */
+
+void
+GuestInfo_CgroupShutdown(void)
+{
+   uint32 i;
+
+   if (gNodes != NULL) {
+      for (i = 0; i < gNodes->len; i++) {
+         GuestInfoCgroupFreeNode(g_ptr_array_index(gNodes, i));
+      }
+      g_ptr_array_free(gNodes, TRUE);
+      gNodes = NULL;
+      g_hash_table_destroy(gNodesByPath);
+      gNodesByPath = NULL;
+   }
+
+   g_free(gReports);
+   gReports = NULL;
+   gCursor = 0;
+   gSweepNeeded = FALSE;
+   gCgroupUnavailable = FALSE;
+}
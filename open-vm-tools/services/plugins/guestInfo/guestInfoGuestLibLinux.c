@@ -0,0 +1,311 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file guestInfoGuestLibLinux.c
+ *
+ * Exports the guestlib statistics to libguestlib consumers.
+ *
+ * Every libguestlib consumer queries the host over the backdoor on its own,
+ * so the exits grow with the number of monitoring agents in the guest. When
+ * enabled, vmtoolsd queries the host once per interval and publishes the
+ * reply in the VMGuestLibShm segment, which libguestlib reads instead of
+ * doing its own RPC for as long as the reply is fresh.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vmware.h"
+#include "vm_basic_asm.h"
+#include "str.h"
+#include "guestInfoInt.h"
+#include "vmGuestLibShm.h"
+
+/**
+ * Protocol versions of guestlib.info.get that are exported, highest first.
+ */
+#define GUESTINFO_GUESTLIB_HIGH_VERSION   3
+#define GUESTINFO_GUESTLIB_LOW_VERSION    2
+
+typedef struct GuestInfoGuestLib {
+   ToolsAppCtx         *ctx;
+   GSource             *timeoutSource;
+   guint                interval;      /* In seconds. */
+   uint32               dataVersion;   /* Version the host answers. */
+   VMGuestLibShm       *shm;
+} GuestInfoGuestLib;
+
+static GuestInfoGuestLib *gGuestLib = NULL;
+
+
+/*
+ ******************************************************************************
+ * GuestInfoGuestLibMap --                                               */ /**
+ *
+ * Creates and maps the segment. Any previous file is replaced, so that
+ * readers which still map it see its reply go stale and remap.
+ *
+ * @return The segment, NULL on failure.
+ *
+ ******************************************************************************
+ */
+
+static VMGuestLibShm *
+GuestInfoGuestLibMap(void)
+{
+   VMGuestLibShm *shm;
+   char *dir = g_path_get_dirname(VMGUESTLIB_SHM_PATH);
+   int fd;
+
+   if (g_mkdir_with_parents(dir, 0755) != 0) {
+      g_warning("%s: cannot create %s: %s\n", __FUNCTION__, dir,
+                strerror(errno));
+      g_free(dir);
+      return NULL;
+   }
+   g_free(dir);
+
+   if (unlink(VMGUESTLIB_SHM_PATH) != 0 && errno != ENOENT) {
+      g_warning("%s: cannot remove %s: %s\n", __FUNCTION__,
+                VMGUESTLIB_SHM_PATH, strerror(errno));
+      return NULL;
+   }
+
+   fd = open(VMGUESTLIB_SHM_PATH,
+             O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+   if (fd < 0) {
+      g_warning("%s: cannot create %s: %s\n", __FUNCTION__,
+                VMGUESTLIB_SHM_PATH, strerror(errno));
+      return NULL;
+   }
+
+   /* The umask must not make it unreadable to the consumers. */
+   if (fchmod(fd, 0644) != 0 ||
+       ftruncate(fd, VMGUESTLIB_SHM_SIZE) != 0) {
+      g_warning("%s: cannot set up %s: %s\n", __FUNCTION__,
+                VMGUESTLIB_SHM_PATH, strerror(errno));
+      close(fd);
+      unlink(VMGUESTLIB_SHM_PATH);
+      return NULL;
+   }
+
+   shm = mmap(NULL, VMGUESTLIB_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+              fd, 0);
+   close(fd);
+   if (shm == MAP_FAILED) {
+      g_warning("%s: cannot map %s: %s\n", __FUNCTION__,
+                VMGUESTLIB_SHM_PATH, strerror(errno));
+      unlink(VMGUESTLIB_SHM_PATH);
+      return NULL;
+   }
+
+   /* ftruncate() zero filled it, seq is 0. */
+   shm->magic = VMGUESTLIB_SHM_MAGIC;
+   shm->version = VMGUESTLIB_SHM_VERSION;
+   return shm;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoGuestLibQuery --                                             */ /**
+ *
+ * Sends guestlib.info.get, negotiating down to the lowest exported version
+ * the first time, or if the host stops answering the negotiated one.
+ *
+ * @param[in]  guestLib    The exporter.
+ * @param[out] reply       Reply of the host, to free with vm_free().
+ * @param[out] replyLen    Length of the reply.
+ *
+ * @return TRUE if the host answered.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoGuestLibQuery(GuestInfoGuestLib *guestLib,
+                       char **reply,
+                       size_t *replyLen)
+{
+   uint32 version = guestLib->dataVersion != 0 ?
+                    guestLib->dataVersion : GUESTINFO_GUESTLIB_HIGH_VERSION;
+
+   for (; version >= GUESTINFO_GUESTLIB_LOW_VERSION; version--) {
+      char request[64];
+
+      Str_Sprintf(request, sizeof request, "guestlib.info.get %u", version);
+      *reply = NULL;
+      if (RpcChannel_Send(guestLib->ctx->rpc, request, strlen(request) + 1,
+                          reply, replyLen) &&
+          *replyLen >= sizeof (uint32) &&
+          *(uint32 *)*reply == version) {
+         guestLib->dataVersion = version;
+         return TRUE;
+      }
+      g_debug("%s: %s failed: %s\n", __FUNCTION__, request,
+              *reply != NULL ? *reply : "NULL");
+      vm_free(*reply);
+      *reply = NULL;
+   }
+
+   guestLib->dataVersion = 0;
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoGuestLibExport --                                            */ /**
+ *
+ * Queries the host and publishes the reply. A failed query publishes an
+ * empty reply, so that the consumers fall back to their own RPC.
+ *
+ * @param[in]  data     The exporter.
+ *
+ * @return TRUE to keep the timer.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoGuestLibExport(gpointer data)
+{
+   GuestInfoGuestLib *guestLib = data;
+   VMGuestLibShm *shm = guestLib->shm;
+   char *reply = NULL;
+   size_t replyLen = 0;
+
+   if (!GuestInfoGuestLibQuery(guestLib, &reply, &replyLen)) {
+      replyLen = 0;
+   } else if (replyLen > VMGUESTLIB_SHM_MAX_REPLY) {
+      g_warning("%s: reply of %"FMTSZ"u bytes too large.\n", __FUNCTION__,
+                replyLen);
+      replyLen = 0;
+   }
+
+   shm->seq++;
+   SMP_W_BARRIER_W();
+
+   shm->interval = guestLib->interval;
+   shm->updateTime = g_get_monotonic_time();
+   shm->dataVersion = guestLib->dataVersion;
+   shm->replyLen = replyLen;
+   if (replyLen != 0) {
+      memcpy(shm->reply, reply, replyLen);
+   }
+
+   SMP_W_BARRIER_W();
+   shm->seq++;
+
+   vm_free(reply);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_GuestLibExportStart --                                      */ /**
+ *
+ * Starts exporting the guestlib statistics, or changes the interval of the
+ * running export.
+ *
+ * @param[in]  ctx      The app context.
+ * @param[in]  interval Refresh interval, in seconds.
+ *
+ ******************************************************************************
+ */
+
+void
+GuestInfo_GuestLibExportStart(ToolsAppCtx *ctx,
+                              guint interval)
+{
+   GuestInfoGuestLib *guestLib = gGuestLib;
+
+   ASSERT(interval != 0);
+
+   if (guestLib != NULL && guestLib->interval == interval) {
+      return;
+   }
+
+   if (guestLib == NULL) {
+      VMGuestLibShm *shm;
+
+      /* The segment must not be writable by anyone else. */
+      if (geteuid() != 0) {
+         g_debug("%s: not running as root.\n", __FUNCTION__);
+         return;
+      }
+
+      shm = GuestInfoGuestLibMap();
+      if (shm == NULL) {
+         return;
+      }
+
+      guestLib = g_new0(GuestInfoGuestLib, 1);
+      guestLib->ctx = ctx;
+      guestLib->shm = shm;
+      gGuestLib = guestLib;
+   } else {
+      g_source_destroy(guestLib->timeoutSource);
+      g_source_unref(guestLib->timeoutSource);
+   }
+
+   g_info("Exporting guestlib statistics every %us.\n", interval);
+   guestLib->interval = interval;
+   GuestInfoGuestLibExport(guestLib);
+
+   guestLib->timeoutSource = g_timeout_source_new_seconds(interval);
+   VMTOOLSAPP_ATTACH_SOURCE(ctx, guestLib->timeoutSource,
+                            GuestInfoGuestLibExport, guestLib, NULL);
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_GuestLibExportStop --                                       */ /**
+ *
+ * Stops exporting the guestlib statistics and removes the segment. Readers
+ * which still map it see its reply go stale.
+ *
+ ******************************************************************************
+ */
+
+void
+GuestInfo_GuestLibExportStop(void)
+{
+   GuestInfoGuestLib *guestLib = gGuestLib;
+
+   if (guestLib == NULL) {
+      return;
+   }
+
+   g_source_destroy(guestLib->timeoutSource);
+   g_source_unref(guestLib->timeoutSource);
+
+   unlink(VMGUESTLIB_SHM_PATH);
+   munmap(guestLib->shm, VMGUESTLIB_SHM_SIZE);
+
+   g_free(guestLib);
+   gGuestLib = NULL;
+   g_info("Stopped exporting guestlib statistics.\n");
+}
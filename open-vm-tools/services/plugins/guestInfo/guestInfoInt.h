@@ -88,8 +88,70 @@ GuestInfo_GetDiskInfo(const ToolsAppCtx *ctx);
 void
 GuestInfo_FreeDiskInfo(GuestDiskInfoInt *di);
 
+#if defined(__linux__)
+void
+GuestInfo_DiskInfoShutdown(void);
+#endif
+
 void
 GuestInfo_StatProviderShutdown(void);
 
+void
+GuestInfo_StatProviderSetCompact(Bool enable);
+
+void
+GuestInfo_StatProviderBurst(uint32 seconds);
+
+uint32
+GuestInfo_StatProviderNextInterval(uint32 reportInterval,
+                                   uint32 maxBackoff);
+
+#if defined(__linux__)
+/* Resource usage of a cgroup, from GuestInfo_CgroupScan(). */
+typedef struct GuestInfoCgroupReport {
+   const char *path;          // From the cgroup v2 root, e.g. "/a.slice/b"
+   Bool        hasCpu;
+   double      cpuUsageRate;  // CPU usec per second
+   Bool        hasMem;
+   uint64      memAnon;       // bytes
+   uint64      memFile;       // bytes
+   Bool        hasIo;
+   double      ioReadRate;    // bytes per second
+   double      ioWriteRate;   // bytes per second
+} GuestInfoCgroupReport;
+
+uint32
+GuestInfo_CgroupScan(uint32 topN,
+                     uint32 budgetMs,
+                     const GuestInfoCgroupReport ***reports);
+
+void
+GuestInfo_CgroupShutdown(void);
+
+/* What GuestInfo_StartChangeWatch() saw change. */
+#define GUESTINFO_CHANGE_NIC    (1 << 0)
+#define GUESTINFO_CHANGE_DISK   (1 << 1)
+
+typedef void (*GuestInfoChangeCb)(ToolsAppCtx *ctx,
+                                  guint changes);
+
+Bool
+GuestInfo_StartChangeWatch(ToolsAppCtx *ctx,
+                           GuestInfoChangeCb cb);
+
+Bool
+GuestInfo_ChangeWatchActive(void);
+
+void
+GuestInfo_StopChangeWatch(void);
+
+void
+GuestInfo_GuestLibExportStart(ToolsAppCtx *ctx,
+                              guint interval);
+
+void
+GuestInfo_GuestLibExportStop(void);
+#endif
+
 #endif /* _GUESTINFOINT_H_ */
 
@@ -51,6 +51,7 @@
 #include "str.h"
 #include "strutil.h"
 #include "system.h"
+#include "toolsProbe.h"
 #include "util.h"
 #include "xdrutil.h"
 #include "vmsupport.h"
@@ -84,6 +85,17 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
  */
 #define GUESTINFO_STATS_INTERVAL 20
 
+/**
+ * Default maximum stretch of the guestStats poll interval on steady guests
+ */
+#define GUESTINFO_STATS_MAX_BACKOFF 4
+
+/**
+ * Default interval of the full guestInfo scans while changes are watched is
+ * 300s
+ */
+#define GUESTINFO_FULL_SCAN_INTERVAL 300
+
 #define GUESTINFO_DEFAULT_DELIMITER ' '
 
 /**
@@ -118,6 +130,7 @@ typedef struct _GuestInfoCache {
    char                        *value[INFO_MAX];
    HostinfoDetailedDataHeader  *detailedData;
    NicInfoV3                   *nicInfo;
+   uint64                       nicInfoHash;  // GuestInfo_Hash_NicInfoV3
    NicInfoMethod                method;
    GuestDiskInfoInt            *diskInfo;
    Bool                         diskInfoUseJson;
@@ -143,6 +156,42 @@ time_t gGuestInfoLastGatherTime = 0;
  */
 int guestInfoStatsInterval = 0;
 
+/**
+ * The interval (in milliseconds) of the stats timeout source, which differs
+ * from guestInfoStatsInterval during bursts and on steady guests, and the
+ * maximum stretch of guestInfoStatsInterval.
+ *
+ * The stretch is controlled by the guestinfo.stats-max-backoff config file
+ * option.
+ */
+static int gGuestInfoStatsSourceInterval = 0;
+static int gGuestInfoStatsMaxBackoff = GUESTINFO_STATS_MAX_BACKOFF;
+
+/**
+ * The time of the last full scan, and the interval (in seconds) between them
+ * while NIC and disk changes are watched.
+ *
+ * The interval is controlled by the guestinfo.full-scan-interval config file
+ * option.
+ */
+static time_t gGuestInfoLastFullScan = 0;
+#if defined(__linux__)
+static int gGuestInfoFullScanInterval = GUESTINFO_FULL_SCAN_INTERVAL;
+#endif
+
+/**
+ * The [guestinfo] settings used by each gather, read when the plugin loads
+ * and when the group changes instead of being looked up every time.
+ */
+typedef struct GuestInfoConfig {
+   gboolean disableDiskInfo;
+   int maxIPv4Routes;
+   int maxIPv6Routes;
+} GuestInfoConfig;
+
+static GuestInfoConfig gGuestInfoConfig;
+static guint gGuestInfoConfigWatch = 0;
+
 /*
  * Detailed guest OS data sending. Reset on channel reset.
  */
@@ -187,6 +236,7 @@ static void SendUptime(ToolsAppCtx *ctx);
 static Bool DiskInfoChanged(const GuestDiskInfoInt *diskInfo);
 static void GuestInfoClearCache(void);
 static GuestNicList *NicInfoV3ToV2(const NicInfoV3 *infoV3);
+static gboolean GuestInfoStatsGather(gpointer data);
 static void TweakGatherLoops(ToolsAppCtx *ctx,
                              gboolean enable);
 
@@ -513,6 +563,186 @@ GuestInfoFreeDetailedData(HostinfoDetailedDataHeader *info)  // IN/OUT:
 }
 
 
+#if !defined(USERWORLD)
+/*
+ ******************************************************************************
+ * GuestInfoReadConfig --                                                */ /**
+ *
+ * Reads the [guestinfo] settings used by each gather into gGuestInfoConfig.
+ *
+ * @param[in]  config   The config dictionary.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoReadConfig(GKeyFile *config)
+{
+   gGuestInfoConfig.disableDiskInfo =
+         VMTools_ConfigGetBoolean(config, CONFGROUPNAME_GUESTINFO,
+                                  CONFNAME_GUESTINFO_DISABLEQUERYDISKINFO,
+                                  FALSE);
+
+   /*
+    * Check the config registry for max IPv4/6 routes to gather
+    */
+   gGuestInfoConfig.maxIPv4Routes =
+         VMTools_ConfigGetInteger(config,
+                                  CONFGROUPNAME_GUESTINFO,
+                                  CONFNAME_GUESTINFO_MAXIPV4ROUTES,
+                                  NICINFO_MAX_ROUTES);
+   if (gGuestInfoConfig.maxIPv4Routes < 0 ||
+       gGuestInfoConfig.maxIPv4Routes > NICINFO_MAX_ROUTES) {
+      g_warning("Invalid %s.%s value: %d. Using default %u.\n",
+                CONFGROUPNAME_GUESTINFO,
+                CONFNAME_GUESTINFO_MAXIPV4ROUTES,
+                gGuestInfoConfig.maxIPv4Routes,
+                NICINFO_MAX_ROUTES);
+      gGuestInfoConfig.maxIPv4Routes = NICINFO_MAX_ROUTES;
+   }
+
+   gGuestInfoConfig.maxIPv6Routes =
+         VMTools_ConfigGetInteger(config,
+                                  CONFGROUPNAME_GUESTINFO,
+                                  CONFNAME_GUESTINFO_MAXIPV6ROUTES,
+                                  NICINFO_MAX_ROUTES);
+   if (gGuestInfoConfig.maxIPv6Routes < 0 ||
+       gGuestInfoConfig.maxIPv6Routes > NICINFO_MAX_ROUTES) {
+      g_warning("Invalid %s.%s value: %d. Using default %u.\n",
+                CONFGROUPNAME_GUESTINFO,
+                CONFNAME_GUESTINFO_MAXIPV6ROUTES,
+                gGuestInfoConfig.maxIPv6Routes,
+                NICINFO_MAX_ROUTES);
+      gGuestInfoConfig.maxIPv6Routes = NICINFO_MAX_ROUTES;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoGatherDiskInfo --                                            */ /**
+ *
+ * Collects the disk information and updates the VMX if it changed.
+ *
+ * @param[in]  ctx      The application context.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoGatherDiskInfo(ToolsAppCtx *ctx)
+{
+   GuestDiskInfoInt *diskInfo;
+
+   if (gGuestInfoConfig.disableDiskInfo) {
+      return;
+   }
+
+   if ((diskInfo = GuestInfo_GetDiskInfo(ctx)) == NULL) {
+      g_warning("Failed to get disk info.\n");
+   } else {
+      if (GuestInfoUpdateVMX(ctx, INFO_DISK_FREE_SPACE, diskInfo, 0)) {
+         GuestInfo_FreeDiskInfo(gInfoCache.diskInfo);
+         gInfoCache.diskInfo = diskInfo;
+      } else {
+         g_warning("Failed to update INFO_DISK_FREE_SPACE\n.");
+         GuestInfo_FreeDiskInfo(diskInfo);
+      }
+   }
+}
+#endif
+
+
+/*
+ ******************************************************************************
+ * GuestInfoGatherNicInfo --                                             */ /**
+ *
+ * Collects the NIC information and updates the VMX if it changed.
+ *
+ * @param[in]  ctx      The application context.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoGatherNicInfo(ToolsAppCtx *ctx)
+{
+   NicInfoV3 *nicInfo = NULL;
+   uint64 nicInfoHash;
+   Bool primaryChanged;
+   Bool lowPriorityChanged;
+
+   primaryChanged = GuestInfoResetNicPrimaryList(ctx);
+   lowPriorityChanged = GuestInfoResetNicLowPriorityList(ctx);
+   GuestInfoResetNicExcludeList(ctx);
+
+   if (!GuestInfo_GetNicInfo(gGuestInfoConfig.maxIPv4Routes,
+                             gGuestInfoConfig.maxIPv6Routes,
+                             &nicInfo)) {
+      g_warning("Failed to get NIC info.\n");
+      /*
+       * Return an empty NIC info.
+       */
+      nicInfo = Util_SafeCalloc(1, sizeof (struct NicInfoV3));
+   }
+
+   /*
+    * The hash stands in for GuestInfo_IsEqual_NicInfoV3, which is quadratic
+    * in the number of routes and addresses.  Like it, the hash does not
+    * depend on the order, so we need to check if the setting for the
+    * primary interfaces or low priority NICs have changed.
+    */
+   nicInfoHash = GuestInfo_Hash_NicInfoV3(nicInfo);
+   if (!primaryChanged && !lowPriorityChanged &&
+       gInfoCache.nicInfo != NULL && nicInfoHash == gInfoCache.nicInfoHash) {
+      g_debug("NIC info not changed.\n");
+      GuestInfo_FreeNicInfo(nicInfo);
+   } else if (GuestInfoUpdateVMX(ctx, INFO_IPADDRESS, nicInfo, 0)) {
+      /*
+       * Since the update succeeded, free the old cached object, and assign
+       * ours to the cache.
+       */
+      GuestInfo_FreeNicInfo(gInfoCache.nicInfo);
+      gInfoCache.nicInfo = nicInfo;
+      gInfoCache.nicInfoHash = nicInfoHash;
+   } else {
+      g_warning("Failed to update INFO_IPADDRESS.\n");
+      GuestInfo_FreeNicInfo(nicInfo);
+   }
+}
+
+
+#if defined(__linux__)
+/*
+ ******************************************************************************
+ * GuestInfoChanged --                                                   */ /**
+ *
+ * Gathers what GuestInfo_StartChangeWatch() reported as changed.
+ *
+ * @param[in]  ctx      The application context.
+ * @param[in]  changes  GUESTINFO_CHANGE_* flags.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoChanged(ToolsAppCtx *ctx,
+                 guint changes)
+{
+   g_debug("Guest info changed: 0x%x.\n", changes);
+
+#if !defined(USERWORLD)
+   if ((changes & GUESTINFO_CHANGE_DISK) != 0) {
+      GuestInfoGatherDiskInfo(ctx);
+   }
+#endif
+   if ((changes & GUESTINFO_CHANGE_NIC) != 0) {
+      GuestInfoGatherNicInfo(ctx);
+   }
+}
+#endif
+
+
 /*
  ******************************************************************************
  * GuestInfoGather --
@@ -531,23 +761,35 @@ GuestInfoGather(gpointer data)
 {
    char name[256];  // Size is derived from the SUS2 specification
                     // "Host names are limited to 255 bytes"
-#if !defined(USERWORLD)
-   gboolean disableQueryDiskInfo;
-   GuestDiskInfoInt *diskInfo = NULL;
-#endif
-   NicInfoV3 *nicInfo = NULL;
    ToolsAppCtx *ctx = data;
-   Bool primaryChanged;
-   Bool lowPriorityChanged;
-   int maxIPv4RoutesToGather;
-   int maxIPv6RoutesToGather;
    gchar *osNameOverride;
    gchar *osNameFullOverride;
 
+   TOOLS_PROBE0(guestinfo__gather__entry);
+
    g_debug("Entered guest info gather.\n");
 
    GuestInfoCheckIfRunningSlow(ctx);
 
+#if defined(__linux__)
+   /*
+    * NIC and mount changes are gathered as they are reported. The disk free
+    * space and the uptime have no event, so they are still sent on every
+    * gather; the full scan catches the rest, like the OS and host names.
+    */
+   if (GuestInfo_ChangeWatchActive() && gGuestInfoLastFullScan != 0 &&
+       time(NULL) - gGuestInfoLastFullScan < gGuestInfoFullScanInterval) {
+      g_debug("Changes are watched, skipping the full scan.\n");
+#if !defined(USERWORLD)
+      GuestInfoGatherDiskInfo(ctx);
+#endif
+      SendUptime(ctx);
+      TOOLS_PROBE1(guestinfo__gather__return, FALSE);
+      return TRUE;
+   }
+#endif
+   gGuestInfoLastFullScan = time(NULL);
+
    /* Send tools version. */
    if (!GuestInfoUpdateVMX(ctx, INFO_BUILD_NUMBER, BUILD_NUMBER, 0)) {
       /*
@@ -692,22 +934,7 @@ GuestInfoGather(gpointer data)
    }
 
 #if !defined(USERWORLD)
-   disableQueryDiskInfo =
-      g_key_file_get_boolean(ctx->config, CONFGROUPNAME_GUESTINFO,
-                             CONFNAME_GUESTINFO_DISABLEQUERYDISKINFO, NULL);
-   if (!disableQueryDiskInfo) {
-      if ((diskInfo = GuestInfo_GetDiskInfo(ctx)) == NULL) {
-         g_warning("Failed to get disk info.\n");
-      } else {
-         if (GuestInfoUpdateVMX(ctx, INFO_DISK_FREE_SPACE, diskInfo, 0)) {
-            GuestInfo_FreeDiskInfo(gInfoCache.diskInfo);
-            gInfoCache.diskInfo = diskInfo;
-         } else {
-            g_warning("Failed to update INFO_DISK_FREE_SPACE\n.");
-            GuestInfo_FreeDiskInfo(diskInfo);
-         }
-      }
-   }
+   GuestInfoGatherDiskInfo(ctx);
 #endif
 
    if (!System_GetNodeName(sizeof name, name)) {
@@ -716,79 +943,21 @@ GuestInfoGather(gpointer data)
       g_warning("Failed to update INFO_DNS_NAME.\n");
    }
 
-   /* Get NIC information. */
+   GuestInfoGatherNicInfo(ctx);
 
-   primaryChanged = GuestInfoResetNicPrimaryList(ctx);
-   lowPriorityChanged = GuestInfoResetNicLowPriorityList(ctx);
-   GuestInfoResetNicExcludeList(ctx);
-
-   /*
-    * Check the config registry for max IPv4/6 routes to gather
-    */
-   maxIPv4RoutesToGather =
-         VMTools_ConfigGetInteger(ctx->config,
-                                  CONFGROUPNAME_GUESTINFO,
-                                  CONFNAME_GUESTINFO_MAXIPV4ROUTES,
-                                  NICINFO_MAX_ROUTES);
-   if (maxIPv4RoutesToGather < 0 ||
-       maxIPv4RoutesToGather > NICINFO_MAX_ROUTES) {
-      g_warning("Invalid %s.%s value: %d. Using default %u.\n",
-                CONFGROUPNAME_GUESTINFO,
-                CONFNAME_GUESTINFO_MAXIPV4ROUTES,
-                maxIPv4RoutesToGather,
-                NICINFO_MAX_ROUTES);
-      maxIPv4RoutesToGather = NICINFO_MAX_ROUTES;
-   }
-
-   maxIPv6RoutesToGather =
-         VMTools_ConfigGetInteger(ctx->config,
-                                  CONFGROUPNAME_GUESTINFO,
-                                  CONFNAME_GUESTINFO_MAXIPV6ROUTES,
-                                  NICINFO_MAX_ROUTES);
-   if (maxIPv6RoutesToGather < 0 ||
-       maxIPv6RoutesToGather > NICINFO_MAX_ROUTES) {
-      g_warning("Invalid %s.%s value: %d. Using default %u.\n",
-                CONFGROUPNAME_GUESTINFO,
-                CONFNAME_GUESTINFO_MAXIPV6ROUTES,
-                maxIPv6RoutesToGather,
-                NICINFO_MAX_ROUTES);
-      maxIPv6RoutesToGather = NICINFO_MAX_ROUTES;
-   }
-
-   if (!GuestInfo_GetNicInfo(maxIPv4RoutesToGather,
-                             maxIPv6RoutesToGather,
-                             &nicInfo)) {
-      g_warning("Failed to get NIC info.\n");
-      /*
-       * Return an empty NIC info.
-       */
-      nicInfo = Util_SafeCalloc(1, sizeof (struct NicInfoV3));
-   }
+   /* Send the uptime to the VMX so that it can detect soft resets. */
+   SendUptime(ctx);
 
    /*
-    * We need to check if the setting for the primary interfaces or low
-    * priority NICs have changed, because GuestInfo_IsEqual_NicInfoV3 does not
-    * detect a change in the order.
+    * The disk and NIC gathers allocate and free a lot; in the low-memory
+    * profile, give the freed memory back instead of keeping it in the heap.
     */
-   if (!primaryChanged && !lowPriorityChanged &&
-       GuestInfo_IsEqual_NicInfoV3(nicInfo, gInfoCache.nicInfo)) {
-      g_debug("NIC info not changed.\n");
-      GuestInfo_FreeNicInfo(nicInfo);
-   } else if (GuestInfoUpdateVMX(ctx, INFO_IPADDRESS, nicInfo, 0)) {
-      /*
-       * Since the update succeeded, free the old cached object, and assign
-       * ours to the cache.
-       */
-      GuestInfo_FreeNicInfo(gInfoCache.nicInfo);
-      gInfoCache.nicInfo = nicInfo;
-   } else {
-      g_warning("Failed to update INFO_IPADDRESS.\n");
-      GuestInfo_FreeNicInfo(nicInfo);
+   if (VMTools_IsLowMemory()) {
+      VMTools_TrimMemory();
    }
 
-   /* Send the uptime to the VMX so that it can detect soft resets. */
-   SendUptime(ctx);
-
+   /* The argument tells whether the full scan was done. */
+   TOOLS_PROBE1(guestinfo__gather__return, TRUE);
    return TRUE;
 }
 
@@ -866,17 +1035,50 @@ GuestInfoConvertNicInfoToNicInfoV1(NicInfoV3 *info,
 }
 
 
+/*
+ ******************************************************************************
+ * GuestInfoSendMemoryInfoDone --                                        */ /**
+ *
+ * Logs the outcome of a GuestMemInfo update sent by GuestInfoSendMemoryInfo.
+ *
+ * @param[in] status     Whether the RPC succeeded.
+ * @param[in] result     Reply of the RPC.
+ * @param[in] resultLen  Length of the reply.
+ * @param[in] data       Unused.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoSendMemoryInfoDone(gboolean status,    // IN
+                            const char *result, // IN
+                            size_t resultLen,   // IN
+                            gpointer data)      // IN
+{
+   if (status) {
+      g_debug("GuestMemInfo sent successfully.\n");
+   } else {
+      g_warning("Error sending GuestMemInfo: %s\n",
+                result != NULL ? result : "NULL");
+   }
+}
+
+
 /*
  ******************************************************************************
  * GuestInfoSendMemoryInfo --                                            */ /**
  *
  * Push memory informations about the guest to the vmx
  *
+ * The update is sent asynchronously, as it is repeated on every stats
+ * gather and its outcome is only logged, so the main loop does not wait
+ * for the host.
+ *
  * @param[in] ctx       Application context.
  * @param[in] infoSize  Size of the struct to send
  * @param[in] info      Struct that contains memory info
  *
- * @retval TRUE  Update sent successfully.
+ * @retval TRUE  Update queued successfully.
  * @retval FALSE Had trouble with transmission.
  *
  ******************************************************************************
@@ -911,14 +1113,14 @@ GuestInfoSendMemoryInfo(ToolsAppCtx *ctx,  // IN: Application context
       memcpy(request + headerLen, info, infoSize);
 
       /* Send all the information in the message. */
-      success = RpcChannel_Send(ctx->rpc, request, requestSize, NULL, NULL);
+      success = RpcChannel_SendAsync(ctx->rpc, request, requestSize,
+                                     g_main_loop_get_context(ctx->mainLoop),
+                                     GuestInfoSendMemoryInfoDone, NULL);
 
       g_free(request);
    }
 
-   if (success) {
-      g_debug("GuestMemInfo sent successfully.\n");
-   } else {
+   if (!success) {
       g_warning("Error sending GuestMemInfo.\n");
    }
 
@@ -981,8 +1183,13 @@ GuestInfoSendNicInfoXdr(ToolsAppCtx *ctx,          // IN
       goto exit;
    }
 
-   /* Write preamble and serialized NIC info to XDR stream. */
-   if (!DynXdr_AppendRaw(&xdrs, request, strlen(request)) ||
+   /*
+    * Write preamble and serialized NIC info to XDR stream, sized up front
+    * so that the buffer is not regrown while encoding.
+    */
+   if (!DynXdr_Reserve(&xdrs, strlen(request) +
+                       DynXdr_Sizeof((xdrproc_t)xdr_GuestNicProto, message)) ||
+       !DynXdr_AppendRaw(&xdrs, request, strlen(request)) ||
        !xdr_GuestNicProto(&xdrs, message)) {
       g_warning("Error serializing NIC info v%d data.", message->ver);
    } else {
@@ -1218,6 +1425,7 @@ GuestInfoSendDiskInfoV1(ToolsAppCtx *ctx,             // IN
                         size_t infoSize)              // IN
 {
    DynBuf dynBuffer;
+   char dynBufferStorage[2048];
    char tmpBuf[1024];
    int len;
    char *infoReq;
@@ -1264,7 +1472,9 @@ GuestInfoSendDiskInfoV1(ToolsAppCtx *ctx,             // IN
    ASSERT_ON_COMPILE(sizeof tmpBuf > sizeof jsonPerDiskFmt +
                      PARTITION_NAME_SIZE * 2 + 20 + 20);
 
-   DynBuf_Init(&dynBuffer);
+   /* A few disks fit in dynBufferStorage, more go to the heap. */
+   DynBuf_InitWithBuffer(&dynBuffer, sizeof dynBufferStorage,
+                         dynBufferStorage);
 
    len = Str_Snprintf(tmpBuf, sizeof tmpBuf, headerFmt,
                       GUEST_DISK_INFO_COMMAND, DISK_INFO_VERSION_1);
@@ -2032,6 +2242,66 @@ TweakGatherLoop(ToolsAppCtx *ctx,
 }
 
 
+/*
+ ******************************************************************************
+ * GuestInfoStatsReschedule --
+ *
+ * @brief Moves the GuestStats gather loop to the interval the stat provider
+ *        asks for next.
+ *
+ * @param[in]  ctx      The app context.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoStatsReschedule(ToolsAppCtx *ctx)
+{
+   uint32 interval;
+
+   if (gatherStatsTimeoutSource == NULL) {
+      return;
+   }
+
+   interval = GuestInfo_StatProviderNextInterval(guestInfoStatsInterval,
+                                                 gGuestInfoStatsMaxBackoff);
+   if (interval == 0 || interval == gGuestInfoStatsSourceInterval) {
+      return;
+   }
+
+   g_debug("Sampling guest stats every %ums.\n", interval);
+
+   g_source_destroy(gatherStatsTimeoutSource);
+   gatherStatsTimeoutSource = g_timeout_source_new(interval);
+   VMTOOLSAPP_ATTACH_SOURCE(ctx, gatherStatsTimeoutSource,
+                            GuestInfoStatsGather, ctx, NULL);
+   g_source_unref(gatherStatsTimeoutSource);
+   gGuestInfoStatsSourceInterval = interval;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoStatsGather --
+ *
+ * @brief Periodic callback of the GuestStats gather loop.
+ *
+ * @param[in]  data     The app context.
+ *
+ * @return TRUE, the source is replaced when the interval changes.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoStatsGather(gpointer data)
+{
+   GuestInfo_StatProviderPoll(data);
+   GuestInfoStatsReschedule(data);
+   return TRUE;
+}
+
+
 /*
  ******************************************************************************
  * TweakGatherLoops --
@@ -2063,15 +2333,34 @@ TweakGatherLoops(ToolsAppCtx *ctx,
                                             NULL);
 
    if (perfmonEnabled) {
+      GSource *prevSource = gatherStatsTimeoutSource;
+
+      gGuestInfoStatsMaxBackoff =
+         VMTools_ConfigGetInteger(ctx->config,
+                                  CONFGROUPNAME_GUESTINFO,
+                                  CONFNAME_GUESTINFO_STATSMAXBACKOFF,
+                                  GUESTINFO_STATS_MAX_BACKOFF);
+      if (gGuestInfoStatsMaxBackoff < 1) {
+         g_warning("Invalid %s.%s value: %d. Using default %u.\n",
+                   CONFGROUPNAME_GUESTINFO,
+                   CONFNAME_GUESTINFO_STATSMAXBACKOFF,
+                   gGuestInfoStatsMaxBackoff,
+                   GUESTINFO_STATS_MAX_BACKOFF);
+         gGuestInfoStatsMaxBackoff = GUESTINFO_STATS_MAX_BACKOFF;
+      }
+
       /*
        * Tweak GuestStats gather loop
        */
       TweakGatherLoop(ctx, enable,
                       CONFNAME_GUESTINFO_STATSINTERVAL,
                       GUESTINFO_STATS_INTERVAL,
-                      GuestInfo_StatProviderPoll,
+                      GuestInfoStatsGather,
                       &guestInfoStatsInterval,
                       &gatherStatsTimeoutSource);
+      if (gatherStatsTimeoutSource != prevSource) {
+         gGuestInfoStatsSourceInterval = guestInfoStatsInterval;
+      }
    } else {
       /*
        * Destroy the existing timeout source, if it exists.
@@ -2094,6 +2383,58 @@ TweakGatherLoops(ToolsAppCtx *ctx,
                    GuestInfoGather,
                    &guestInfoPollInterval,
                    &gatherInfoTimeoutSource);
+
+#if defined(__linux__)
+   /*
+    * Watch NIC and disk changes while the gather loop runs. The loop keeps
+    * its interval, but only does a full scan every full-scan-interval.
+    */
+   if (guestInfoPollInterval != 0 &&
+       VMTools_ConfigGetBoolean(ctx->config, CONFGROUPNAME_GUESTINFO,
+                                CONFNAME_GUESTINFO_WATCHCHANGES, TRUE)) {
+      gGuestInfoFullScanInterval =
+         VMTools_ConfigGetInteger(ctx->config,
+                                  CONFGROUPNAME_GUESTINFO,
+                                  CONFNAME_GUESTINFO_FULLSCANINTERVAL,
+                                  GUESTINFO_FULL_SCAN_INTERVAL);
+      if (gGuestInfoFullScanInterval <= 0) {
+         g_warning("Invalid %s.%s value: %d. Using default %us.\n",
+                   CONFGROUPNAME_GUESTINFO,
+                   CONFNAME_GUESTINFO_FULLSCANINTERVAL,
+                   gGuestInfoFullScanInterval,
+                   GUESTINFO_FULL_SCAN_INTERVAL);
+         gGuestInfoFullScanInterval = GUESTINFO_FULL_SCAN_INTERVAL;
+      }
+      GuestInfo_StartChangeWatch(ctx, GuestInfoChanged);
+   } else {
+      GuestInfo_StopChangeWatch();
+   }
+
+   /*
+    * Share the guestlib statistics with the libguestlib consumers.
+    */
+   if (enable) {
+      gint interval =
+         VMTools_ConfigGetInteger(ctx->config,
+                                  CONFGROUPNAME_GUESTINFO,
+                                  CONFNAME_GUESTINFO_GUESTLIBEXPORTINTERVAL,
+                                  0);
+      if (interval < 0) {
+         g_warning("Invalid %s.%s value: %d. Disabling the export.\n",
+                   CONFGROUPNAME_GUESTINFO,
+                   CONFNAME_GUESTINFO_GUESTLIBEXPORTINTERVAL,
+                   interval);
+         interval = 0;
+      }
+      if (interval != 0) {
+         GuestInfo_GuestLibExportStart(ctx, interval);
+      } else {
+         GuestInfo_GuestLibExportStop();
+      }
+   } else {
+      GuestInfo_GuestLibExportStop();
+   }
+#endif
 }
 
 
@@ -2132,22 +2473,31 @@ GuestInfo_ServerReportStats(ToolsAppCtx *ctx,  // IN
 
 /*
  ******************************************************************************
- * GuestInfoServerConfReload --
+ * GuestInfoServerConfChanged --
  *
- * @brief Reconfigures the poll loop interval upon config file reload.
+ * @brief Rereads the settings and reconfigures the poll loop interval when
+ * the [guestinfo] group of the config file changed.
  *
- * @param[in]  src     The source object.
- * @param[in]  ctx     The application context.
- * @param[in]  data    Unused.
+ * @param[in]  config  The new config.
+ * @param[in]  group   Unused.
+ * @param[in]  key     Unused.
+ * @param[in]  data    The application context.
  *
  ******************************************************************************
  */
 
 static void
-GuestInfoServerConfReload(gpointer src,
-                          ToolsAppCtx *ctx,
-                          gpointer data)
+GuestInfoServerConfChanged(GKeyFile *config,
+                           const gchar *group,
+                           const gchar *key,
+                           gpointer data)
 {
+   ToolsAppCtx *ctx = data;
+
+   GuestInfoReadConfig(config);
+
+   /* The NIC lists may have changed, do a full scan on the next poll. */
+   gGuestInfoLastFullScan = 0;
    TweakGatherLoops(ctx, TRUE);
 }
 
@@ -2195,6 +2545,11 @@ GuestInfoServerShutdown(gpointer src,
                         ToolsAppCtx *ctx,
                         gpointer data)
 {
+   if (gGuestInfoConfigWatch != 0) {
+      VMTools_ConfigRemoveWatch(gGuestInfoConfigWatch);
+      gGuestInfoConfigWatch = 0;
+   }
+
    GuestInfoClearCache();
 
    GuestInfo_SetIfaceExcludeList(NULL);
@@ -2209,6 +2564,15 @@ GuestInfoServerShutdown(gpointer src,
       gatherStatsTimeoutSource = NULL;
    }
 
+#if defined(__linux__)
+   GuestInfo_StopChangeWatch();
+   GuestInfo_GuestLibExportStop();
+#endif
+
+#if defined(__linux__) && !defined(USERWORLD)
+   GuestInfo_DiskInfoShutdown();
+#endif
+
 #if defined(__linux__) || defined(USERWORLD) || defined(_WIN32)
    GuestInfo_StatProviderShutdown();
 #endif
@@ -2243,8 +2607,14 @@ GuestInfoServerReset(gpointer src,
    /* Reset the last gather time */
    gGuestInfoLastGatherTime = 0;
 
+   /* Resend everything on the next poll */
+   gGuestInfoLastFullScan = 0;
+
    /* Reset detailed guest OS data sending */
    gSendDetailedGosData = TRUE;
+
+   /* The new host may not understand compact stats until it says so. */
+   GuestInfo_StatProviderSetCompact(FALSE);
 }
 
 
@@ -2258,12 +2628,16 @@ GuestInfoServerReset(gpointer src,
  * vmsvc should report the guest's uptime in response to a "what're your
  * capabilities?" RPC.
  *
+ * Also advertises support for compact (GUESTMEMINFO_V6) guest stats; a host
+ * that understands them enables them with the
+ * TOOLSOPTION_ENABLE_COMPACT_GUESTSTATS option.
+ *
  * @param[in]  src      The source object.
  * @param[in]  ctx      The application context.
  * @param[in]  set      TRUE if setting capabilities, FALSE if unsetting them.
  * @param[in]  data     Client data.
  *
- * @retval NULL This function returns no capabilities.
+ * @return The guest stats capability.
  *
  ******************************************************************************
  */
@@ -2274,10 +2648,17 @@ GuestInfoServerSendCaps(gpointer src,
                         gboolean set,
                         gpointer data)
 {
+   ToolsAppCapability caps[] = {
+      { TOOLS_CAP_OLD, "guestStats_compact", 0, 1 },
+   };
+
    if (set) {
       SendUptime(ctx);
+   } else {
+      caps[0].value = 0;
+      GuestInfo_StatProviderSetCompact(FALSE);
    }
-   return NULL;
+   return VMTools_WrapArray(caps, sizeof *caps, ARRAYSIZE(caps));
 }
 
 
@@ -2286,7 +2667,9 @@ GuestInfoServerSendCaps(gpointer src,
  * GuestInfoServerSetOption --
  *
  * Responds to a "broadcastIP" Set_Option command, by sending the primary IP
- * back to the VMX.
+ * back to the VMX, to the "enableCompactGuestStats" command by switching
+ * the guest stats format, and to the "guestStatsBurst" command by sampling
+ * guest stats every second for the given number of seconds.
  *
  * @param[in]  src      The source object.
  * @param[in]  ctx      The application context.
@@ -2308,6 +2691,26 @@ GuestInfoServerSetOption(gpointer src,
    Bool ret = FALSE;
    gchar *msg;
 
+   if (strcmp(option, TOOLSOPTION_ENABLE_COMPACT_GUESTSTATS) == 0) {
+      if (strcmp(value, "0") == 0 || strcmp(value, "1") == 0) {
+         GuestInfo_StatProviderSetCompact(strcmp(value, "1") == 0);
+         ret = TRUE;
+      }
+      goto exit;
+   }
+
+   if (strcmp(option, TOOLSOPTION_GUESTSTATS_BURST) == 0) {
+      char *end;
+      unsigned long seconds = strtoul(value, &end, 10);
+
+      if (*value != '\0' && *end == '\0') {
+         GuestInfo_StatProviderBurst(MIN(seconds, MAX_UINT32));
+         GuestInfoStatsReschedule(ctx);
+         ret = TRUE;
+      }
+      goto exit;
+   }
+
    if (strcmp(option, TOOLSOPTION_BROADCASTIP) != 0) {
       goto exit;
    }
@@ -2365,7 +2768,6 @@ ToolsOnLoad(ToolsAppCtx *ctx)
       };
       ToolsPluginSignalCb sigs[] = {
          { TOOLS_CORE_SIG_CAPABILITIES, GuestInfoServerSendCaps, NULL },
-         { TOOLS_CORE_SIG_CONF_RELOAD, GuestInfoServerConfReload, NULL },
          { TOOLS_CORE_SIG_IO_FREEZE, GuestInfoServerIOFreeze, NULL },
          { TOOLS_CORE_SIG_RESET, GuestInfoServerReset, NULL },
          { TOOLS_CORE_SIG_SET_OPTION, GuestInfoServerSetOption, NULL },
@@ -2391,6 +2793,11 @@ ToolsOnLoad(ToolsAppCtx *ctx)
       gVMResumed = FALSE;
       gInfoCache.method = NIC_INFO_V3_WITH_INFO_IPADDRESS_V3;
 
+      GuestInfoReadConfig(ctx->config);
+      gGuestInfoConfigWatch =
+         VMTools_ConfigAddWatch(CONFGROUPNAME_GUESTINFO, NULL,
+                                GuestInfoServerConfChanged, ctx);
+
       /*
        * Set up the GuestInfo gather loops.
        */
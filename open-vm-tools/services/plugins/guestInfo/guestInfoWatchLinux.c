@@ -0,0 +1,353 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file guestInfoWatchLinux.c
+ *
+ * Watches the guest for changes to the information reported by guestInfo,
+ * so that the gather loop does not have to rescan everything periodically.
+ *
+ * - Link, address and route changes are read from a rtnetlink socket.
+ * - Mounts and unmounts are signaled by /proc/self/mounts, which polls as
+ *   readable for urgent data (POLLPRI) whenever the mount table changes.
+ *
+ * Events are coalesced for a short delay, so that a burst of them (e.g.
+ * a DHCP lease adding an address and several routes) costs a single scan.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+#include "vmware.h"
+#include "guestInfoInt.h"
+
+/**
+ * How long to coalesce events before reporting them, in milliseconds.
+ */
+#define GUESTINFO_CHANGE_DELAY_MS   2000
+
+#define GUESTINFO_MOUNTS_FILE       "/proc/self/mounts"
+
+typedef struct GuestInfoWatch {
+   ToolsAppCtx         *ctx;
+   GuestInfoChangeCb    cb;
+   GSource             *netlinkSource;
+   GSource             *mountSource;
+   GSource             *delaySource;
+   guint                pending;       /* GUESTINFO_CHANGE_* not reported. */
+} GuestInfoWatch;
+
+static GuestInfoWatch *gWatch = NULL;
+
+
+/*
+ ******************************************************************************
+ * GuestInfoWatchDelayed --                                              */ /**
+ *
+ * Reports the changes seen since the first one of the current burst.
+ *
+ * @param[in]  data     The watch.
+ *
+ * @return FALSE, the timer is recreated by the next event.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoWatchDelayed(gpointer data)
+{
+   GuestInfoWatch *watch = data;
+   guint changes = watch->pending;
+
+   watch->pending = 0;
+   g_source_unref(watch->delaySource);
+   watch->delaySource = NULL;
+
+   watch->cb(watch->ctx, changes);
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoWatchNotify --                                               */ /**
+ *
+ * Records a change, to be reported once the coalescing delay expires.
+ *
+ * @param[in]  watch    The watch.
+ * @param[in]  changes  GUESTINFO_CHANGE_* flags.
+ *
+ ******************************************************************************
+ */
+
+static void
+GuestInfoWatchNotify(GuestInfoWatch *watch,
+                     guint changes)
+{
+   watch->pending |= changes;
+
+   if (watch->delaySource == NULL) {
+      watch->delaySource = g_timeout_source_new(GUESTINFO_CHANGE_DELAY_MS);
+      VMTOOLSAPP_ATTACH_SOURCE(watch->ctx, watch->delaySource,
+                               GuestInfoWatchDelayed, watch, NULL);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoWatchNetlink --                                              */ /**
+ *
+ * Drains the rtnetlink socket. Only the fact that something changed
+ * matters, the NIC info is then gathered the usual way.
+ *
+ * @param[in]  chan     Channel of the netlink socket.
+ * @param[in]  cond     Unused.
+ * @param[in]  data     The watch.
+ *
+ * @return FALSE if the socket failed and the watch must be removed.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoWatchNetlink(GIOChannel *chan,
+                      GIOCondition cond,
+                      gpointer data)
+{
+   GuestInfoWatch *watch = data;
+   int fd = g_io_channel_unix_get_fd(chan);
+   char buf[8192];
+
+   for (;;) {
+      ssize_t len = recv(fd, buf, sizeof buf, MSG_DONTWAIT);
+
+      /*
+       * ENOBUFS means the kernel dropped messages because we did not read
+       * them fast enough, which only tells that more things changed.
+       */
+      if (len > 0 || (len < 0 && (errno == ENOBUFS || errno == EINTR))) {
+         continue;
+      }
+      if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         break;
+      }
+
+      g_warning("%s: Cannot read the netlink socket: %s, NIC changes will "
+                "only be seen by full scans.\n", __FUNCTION__,
+                len < 0 ? strerror(errno) : "socket closed");
+      GuestInfoWatchNotify(watch, GUESTINFO_CHANGE_NIC);
+      g_source_unref(watch->netlinkSource);
+      watch->netlinkSource = NULL;
+      return FALSE;
+   }
+
+   GuestInfoWatchNotify(watch, GUESTINFO_CHANGE_NIC);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoWatchMounts --                                               */ /**
+ *
+ * Called when the mount table changes. Polling the file resets the event,
+ * so nothing needs to be read.
+ *
+ * @param[in]  chan     Unused.
+ * @param[in]  cond     Unused.
+ * @param[in]  data     The watch.
+ *
+ * @return TRUE.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+GuestInfoWatchMounts(GIOChannel *chan,
+                     GIOCondition cond,
+                     gpointer data)
+{
+   GuestInfoWatchNotify(data, GUESTINFO_CHANGE_DISK);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfoWatchFd --                                                   */ /**
+ *
+ * Creates and attaches a source watching a file descriptor. The descriptor
+ * is closed when the source is destroyed.
+ *
+ * @param[in]  ctx      The application context.
+ * @param[in]  fd       File descriptor to watch.
+ * @param[in]  cond     Conditions to watch for.
+ * @param[in]  func     Callback.
+ * @param[in]  data     Data for the callback.
+ *
+ * @return The source, to be destroyed and unreferenced by the caller.
+ *
+ ******************************************************************************
+ */
+
+static GSource *
+GuestInfoWatchFd(ToolsAppCtx *ctx,
+                 int fd,
+                 GIOCondition cond,
+                 GIOFunc func,
+                 gpointer data)
+{
+   GIOChannel *chan = g_io_channel_unix_new(fd);
+   GSource *src;
+
+   g_io_channel_set_close_on_unref(chan, TRUE);
+   g_io_channel_set_encoding(chan, NULL, NULL);
+   g_io_channel_set_buffered(chan, FALSE);
+
+   src = g_io_create_watch(chan, cond);
+   g_io_channel_unref(chan);   // Ownership transferred to src.
+
+   VMTOOLSAPP_ATTACH_SOURCE(ctx, src, func, data, NULL);
+   return src;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_StartChangeWatch --                                         */ /**
+ *
+ * Starts watching NIC and disk changes. Does nothing if already watching.
+ *
+ * @param[in]  ctx      The application context.
+ * @param[in]  cb       Called from the main loop with the GUESTINFO_CHANGE_*
+ *                      flags of what changed.
+ *
+ * @return TRUE if changes are watched, FALSE if the guest cannot report
+ *         them and the caller must keep polling.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfo_StartChangeWatch(ToolsAppCtx *ctx,
+                           GuestInfoChangeCb cb)
+{
+   struct sockaddr_nl addr;
+   int netlinkFd;
+   int mountFd;
+
+   if (gWatch != NULL) {
+      return TRUE;
+   }
+
+   netlinkFd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+   if (netlinkFd < 0) {
+      g_info("%s: Cannot open a netlink socket: %s\n", __FUNCTION__,
+             strerror(errno));
+      return FALSE;
+   }
+
+   memset(&addr, 0, sizeof addr);
+   addr.nl_family = AF_NETLINK;
+   addr.nl_groups = RTMGRP_LINK |
+                    RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+                    RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+   if (bind(netlinkFd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+      g_info("%s: Cannot bind the netlink socket: %s\n", __FUNCTION__,
+             strerror(errno));
+      close(netlinkFd);
+      return FALSE;
+   }
+
+   mountFd = open(GUESTINFO_MOUNTS_FILE, O_RDONLY | O_CLOEXEC);
+   if (mountFd < 0) {
+      g_info("%s: Cannot open %s: %s\n", __FUNCTION__, GUESTINFO_MOUNTS_FILE,
+             strerror(errno));
+      close(netlinkFd);
+      return FALSE;
+   }
+
+   gWatch = g_new0(GuestInfoWatch, 1);
+   gWatch->ctx = ctx;
+   gWatch->cb = cb;
+   gWatch->netlinkSource = GuestInfoWatchFd(ctx, netlinkFd, G_IO_IN | G_IO_ERR,
+                                            GuestInfoWatchNetlink, gWatch);
+   gWatch->mountSource = GuestInfoWatchFd(ctx, mountFd, G_IO_PRI | G_IO_ERR,
+                                          GuestInfoWatchMounts, gWatch);
+
+   g_info("Watching NIC and disk changes.\n");
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_ChangeWatchActive --                                        */ /**
+ *
+ * @return Whether all changes are still watched.
+ *
+ ******************************************************************************
+ */
+
+Bool
+GuestInfo_ChangeWatchActive(void)
+{
+   return gWatch != NULL && gWatch->netlinkSource != NULL;
+}
+
+
+/*
+ ******************************************************************************
+ * GuestInfo_StopChangeWatch --                                          */ /**
+ *
+ * Stops watching changes, dropping the ones not reported yet.
+ *
+ ******************************************************************************
+ */
+
+void
+GuestInfo_StopChangeWatch(void)
+{
+   GSource **sources[3];
+   unsigned int i;
+
+   if (gWatch == NULL) {
+      return;
+   }
+
+   sources[0] = &gWatch->netlinkSource;
+   sources[1] = &gWatch->mountSource;
+   sources[2] = &gWatch->delaySource;
+
+   for (i = 0; i < ARRAYSIZE(sources); i++) {
+      if (*sources[i] != NULL) {
+         g_source_destroy(*sources[i]);
+         g_source_unref(*sources[i]);
+      }
+   }
+
+   g_free(gWatch);
+   gWatch = NULL;
+   g_info("Stopped watching NIC and disk changes.\n");
+}
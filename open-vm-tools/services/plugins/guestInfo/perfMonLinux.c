@@ -18,10 +18,13 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <math.h>
 
 #include "vm_basic_defs.h"
 #include "vmware.h"
@@ -31,12 +34,11 @@
 #include "guestInfoInt.h"
 #include "guestStats.h"
 #include "posix.h"
-#include "hashTable.h"
 #include "conf.h"
+#include "util.h"
 
 #define GUEST_INFO_PREALLOC_SIZE 4096
-#define INT_AS_HASHKEY(x) ((const void *)(uintptr_t)(x))
-#define KEY_FORMAT  "%s|%s"
+#define GUEST_INFO_PROC_BUF_SIZE (16 * 1024)
 
 #define STAT_FILE        "/proc/stat"
 #define VMSTAT_FILE      "/proc/vmstat"
@@ -48,6 +50,29 @@
 
 #define SYSFS_BLOCK_FOLDER  "/sys/block"
 
+/*
+ * The /proc files are opened once and reread from the start with pread on
+ * each sample, the kernel regenerates their content at offset 0.
+ */
+typedef struct {
+   const char  *pathName;
+   int          fd;
+} GuestInfoProcFile;
+
+static GuestInfoProcFile gProcFiles[] = {
+   { STAT_FILE,        -1 },
+   { VMSTAT_FILE,      -1 },
+   { UPTIME_FILE,      -1 },
+   { MEMINFO_FILE,     -1 },
+   { ZONEINFO_FILE,    -1 },
+   { SWAPPINESS_FILE,  -1 },
+   { DISKSTATS_FILE,   -1 },
+};
+
+/* Holds the content of the last file read, grows to fit the largest one. */
+static char *gProcBuf = NULL;
+static size_t gProcBufSize = 0;
+
 /*
  * For now, all data collection is of uint64 values. Rates are always returned
  * as a double, derived from the uint64 data.
@@ -146,15 +171,16 @@ typedef struct {
 } GuestInfoStat;
 
 typedef struct {
-   HashTable       *exactMatches;
+   uint32           numExactMatches;
+   GuestInfoStat  **exactMatches;     // Sorted by file, then locator
 
    uint32           numRegExps;
-   GuestInfoStat  **regExps;
+   GuestInfoStat  **regExps;          // Sorted by file
 
    uint32           numStats;
    GuestInfoStat   *stats;
 
-   HashTable       *reportMap;
+   GuestInfoStat   *reportMap[GuestStatID_Max];
 
    Bool             timeData;
    double           timeStamp;
@@ -163,12 +189,65 @@ typedef struct {
 static GuestInfoCollector *gCurrentCollector = NULL;
 static GuestInfoCollector *gPreviousCollector = NULL;
 
+/*
+ * State of the compact (GUESTMEMINFO_V6) reports: whether the host asked for
+ * them, and the last value of each stat it was sent. A full report is sent
+ * every GUEST_INFO_COMPACT_FULL_INTERVAL reports, and whenever a report may
+ * not have reached the host.
+ */
+#define GUEST_INFO_COMPACT_FULL_INTERVAL 15
+
+typedef struct {
+   Bool     hasValue;
+   uint64   bits;      // uint64 value, or the bits of a double
+} GuestInfoCompactStat;
+
+static Bool gCompactEnabled = FALSE;
+static uint32 gCompactReportsUntilFull = 0;
+static GuestInfoCompactStat gCompactLast[GuestStatID_Max];
+
+/*
+ * Adaptive sampling. While a burst requested by the host lasts, stats are
+ * sampled every GUEST_INFO_BURST_INTERVAL_MS. The samples taken between two
+ * reports are kept in a ring, and sent with the next compact report. Out of
+ * bursts, the interval doubles every GUEST_INFO_STEADY_SAMPLES samples
+ * during which no stat moved noticeably.
+ */
+#define GUEST_INFO_BURST_INTERVAL_MS     1000
+#define GUEST_INFO_BURST_MAX_SECS        3600
+#define GUEST_INFO_STEADY_SAMPLES        4
+#define GUEST_INFO_HISTORY_SLOTS         60
+
+typedef struct {
+   gint64   time;      // g_get_monotonic_time() of the sample
+   DynBuf   records;   // GUESTMEMINFO_V6 records
+} GuestInfoHistorySample;
+
+static gint64 gBurstEnd = 0;
+static gint64 gLastReportTime = 0;
+static uint32 gReportInterval = 0;   // ms, last seen by NextInterval
+static uint32 gSteadySamples = 0;
+static double gLastRates[GuestStatID_Max];
+static GuestInfoHistorySample gHistory[GUEST_INFO_HISTORY_SLOTS];
+static uint32 gHistoryFirst = 0;
+static uint32 gHistoryCount = 0;
+
+/*
+ * Per-cgroup stats: how many top consumers to report (0 disables them),
+ * and the time budget of each scan, from the config.
+ */
+#define GUEST_INFO_CGROUP_SCAN_BUDGET_MS 20
+
+static uint32 gCgroupTopN = 0;
+static uint32 gCgroupScanBudget = GUEST_INFO_CGROUP_SCAN_BUDGET_MS;
+
 static void
 GuestInfoDeriveMemNeeded(GuestInfoCollector *collector);
 
 typedef struct GuestInfoDiskStatsList {
    struct GuestInfoDiskStatsList *next;
    char                          *diskName;
+   Bool                           isBlockDevice;
    unsigned int                   weightedTime[2];  // In milliseconds
 } GuestInfoDiskStatsList;
 
@@ -236,42 +315,169 @@ GuestInfoIsBlockDevice(const char *name)  // IN:
 /*
  *----------------------------------------------------------------------
  *
- * GuestInfoGetUpTime --
+ * GuestInfoReadProcFile --
  *
- *      What time is it?
+ *      Reads a whole /proc file into gProcBuf, opening it on first use.
  *
  * Results:
- *      TRUE   Success! *now is populated
- *      FALSE  Failure! *now remains unchanged
+ *      The NUL terminated content, valid until the next call. NULL if the
+ *      file cannot be read.
  *
  * Side effects:
- *      None.
+ *      May grow gProcBuf.
  *
  *----------------------------------------------------------------------
  */
 
-static Bool
-GuestInfoGetUpTime(double *now)  // OUT:
+static char *
+GuestInfoReadProcFile(const char *pathName)  // IN:
+{
+   GuestInfoProcFile *file = NULL;
+   size_t len = 0;
+   uint32 i;
+
+   for (i = 0; i < ARRAYSIZE(gProcFiles); i++) {
+      if (strcmp(gProcFiles[i].pathName, pathName) == 0) {
+         file = &gProcFiles[i];
+         break;
+      }
+   }
+   ASSERT(file != NULL);
+
+   if (file->fd < 0) {
+      file->fd = Posix_Open(pathName, O_RDONLY | O_CLOEXEC);
+      if (file->fd < 0) {
+         return NULL;
+      }
+   }
+
+   if (gProcBuf == NULL) {
+      gProcBufSize = GUEST_INFO_PROC_BUF_SIZE;
+      gProcBuf = Util_SafeMalloc(gProcBufSize);
+   }
+
+   for (;;) {
+      ssize_t n = pread(file->fd, gProcBuf + len, gProcBufSize - len - 1, len);
+
+      if (n < 0) {
+         if (errno == EINTR) {
+            continue;
+         }
+         close(file->fd);
+         file->fd = -1;
+         return NULL;
+      }
+      if (n == 0) {
+         break;
+      }
+
+      len += n;
+      if (len == gProcBufSize - 1) {
+         gProcBufSize *= 2;
+         gProcBuf = Util_SafeRealloc(gProcBuf, gProcBufSize);
+      }
+   }
+
+   gProcBuf[len] = '\0';
+   return gProcBuf;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoNextLine --
+ *
+ *      Splits the next line off a buffer returned by
+ *      GuestInfoReadProcFile.
+ *
+ * Results:
+ *      The NUL terminated line, NULL at the end of the buffer.
+ *
+ * Side effects:
+ *      *cursor is moved to the following line.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static char *
+GuestInfoNextLine(char **cursor)  // IN/OUT:
 {
-   char line[512];
-   Bool result = FALSE;
-   FILE *fp = Posix_Fopen(UPTIME_FILE, "r");
+   char *line = *cursor;
+   char *end;
+
+   if (line == NULL || *line == '\0') {
+      return NULL;
+   }
 
-   if (fp == NULL) {
-      return result;
+   end = strchr(line, '\n');
+   if (end != NULL) {
+      *end++ = '\0';
    }
+   *cursor = end;
+
+   return line;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoCloseProcFiles --
+ *
+ *      Closes the /proc files and frees the read buffer.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
 
-   if (fgets(line, sizeof line, fp) == line) {
-      double idle;
+static void
+GuestInfoCloseProcFiles(void)
+{
+   uint32 i;
 
-      if (sscanf(line, "%lf %lf", now, &idle) == 2) {
-         result = TRUE;
+   for (i = 0; i < ARRAYSIZE(gProcFiles); i++) {
+      if (gProcFiles[i].fd >= 0) {
+         close(gProcFiles[i].fd);
+         gProcFiles[i].fd = -1;
       }
    }
 
-   fclose(fp);
+   free(gProcBuf);
+   gProcBuf = NULL;
+   gProcBufSize = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoGetUpTime --
+ *
+ *      What time is it?
+ *
+ * Results:
+ *      TRUE   Success! *now is populated
+ *      FALSE  Failure! *now remains unchanged
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+GuestInfoGetUpTime(double *now)  // OUT:
+{
+   double idle;
+   char *data = GuestInfoReadProcFile(UPTIME_FILE);
 
-   return result;
+   return data != NULL && sscanf(data, "%lf %lf", now, &idle) == 2;
 }
 
 
@@ -348,9 +554,7 @@ GuestInfoStoreStatByID(GuestStatToolsID reportID,      // IN:
 {
    GuestInfoStat *stat = NULL;
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(reportID),
-                    (void **) &stat);
+   stat = collector->reportMap[reportID];
 
    /*
     * Caller must not pass in a reportID that does not exist in the table.
@@ -362,6 +566,74 @@ GuestInfoStoreStatByID(GuestStatToolsID reportID,      // IN:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoCompareMatches --
+ *
+ *      qsort comparator ordering stats by source file, then locator.
+ *
+ * Results:
+ *      <0, 0 or >0 like strcmp.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+GuestInfoCompareMatches(const void *a,  // IN:
+                        const void *b)  // IN:
+{
+   const GuestInfoQuery *qa = (*(GuestInfoStat * const *) a)->query;
+   const GuestInfoQuery *qb = (*(GuestInfoStat * const *) b)->query;
+   int ret = strcmp(qa->sourceFile, qb->sourceFile);
+
+   return ret != 0 ? ret : strcmp(qa->locatorString, qb->locatorString);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoFindFileRange --
+ *
+ *      Finds the stats of a file in an array sorted by source file.
+ *
+ * Results:
+ *      The first stat of the file, *count is set to how many there are.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static GuestInfoStat **
+GuestInfoFindFileRange(GuestInfoStat **stats,  // IN:
+                       uint32 numStats,        // IN:
+                       const char *pathName,   // IN:
+                       uint32 *count)          // OUT:
+{
+   uint32 first = 0;
+   uint32 last;
+
+   while (first < numStats &&
+          strcmp(stats[first]->query->sourceFile, pathName) != 0) {
+      first++;
+   }
+   for (last = first;
+        last < numStats &&
+        strcmp(stats[last]->query->sourceFile, pathName) == 0;
+        last++) {
+   }
+
+   *count = last - first;
+   return stats + first;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -382,29 +654,38 @@ GuestInfoStoreStatByID(GuestStatToolsID reportID,      // IN:
  */
 
 static void
-GuestInfoCollectStat(const char *pathName,           // IN:
-                     GuestInfoCollector *collector,  // IN/OUT:
-                     const char *fieldName,          // IN:
-                     uint64 value)                   // IN:
+GuestInfoCollectStat(GuestInfoStat **exact,   // IN: file's exact matches
+                     uint32 numExact,         // IN:
+                     GuestInfoStat **regExps, // IN: file's regExps
+                     uint32 numRegExps,       // IN:
+                     const char *fieldName,   // IN:
+                     uint64 value)            // IN:
 {
    GuestInfoStat *stat = NULL;
-   char *key = Str_SafeAsprintf(NULL, KEY_FORMAT, pathName, fieldName);
-
-   if (!HashTable_Lookup(collector->exactMatches, key, (void **) &stat)) {
-      uint32 i;
+   uint32 lo = 0;
+   uint32 hi = numExact;
+   uint32 i;
 
-      for (i = 0; i < collector->numRegExps; i++) {
-         GuestInfoStat *thisOne = collector->regExps[i];
+   /* The file's exact matches are sorted by locator. */
+   while (lo < hi) {
+      uint32 mid = lo + (hi - lo) / 2;
+      int cmp = strcmp(fieldName, exact[mid]->query->locatorString);
 
-         if (strcmp(pathName, thisOne->query->sourceFile) == 0 &&
-             StrUtil_StartsWith(fieldName, thisOne->query->locatorString)) {
-            stat = thisOne;
-            break;
-         }
+      if (cmp == 0) {
+         stat = exact[mid];
+         break;
+      } else if (cmp < 0) {
+         hi = mid;
+      } else {
+         lo = mid + 1;
       }
    }
 
-   free(key);
+   for (i = 0; stat == NULL && i < numRegExps; i++) {
+      if (StrUtil_StartsWith(fieldName, regExps[i]->query->locatorString)) {
+         stat = regExps[i];
+      }
+   }
 
    if (stat != NULL) {
       GuestInfoStoreStat(stat, value);
@@ -438,21 +719,28 @@ GuestInfoProcData(const char *pathName,           // IN: path name
                   char fieldSeparator,            // IN/OPT:
                   GuestInfoCollector *collector)  // IN/OUT:
 {
-   char line[4096];  // Close to length of /proc/stat intr line
-   FILE *fp = Posix_Fopen(pathName, "r");
-
-   if (fp == NULL) {
-      g_warning("%s: Error opening %s.\n", __FUNCTION__, pathName);
+   uint32 numExact;
+   uint32 numRegExps;
+   GuestInfoStat **exact;
+   GuestInfoStat **regExps;
+   char *line;
+   char *cursor = GuestInfoReadProcFile(pathName);
+
+   if (cursor == NULL) {
+      g_warning("%s: Error reading %s.\n", __FUNCTION__, pathName);
       return FALSE;
    }
 
-   /*
-    * If a line inside the file is longer than what the buffer can hold,
-    * fgets still succeeds, the next fgets call continues at the previously
-    * stopped location in the line.
-    */
-   while (fgets(line, sizeof line, fp) == line) {
-      uint64 value = 0;
+   exact = GuestInfoFindFileRange(collector->exactMatches,
+                                  collector->numExactMatches,
+                                  pathName, &numExact);
+   regExps = GuestInfoFindFileRange(collector->regExps,
+                                    collector->numRegExps,
+                                    pathName, &numRegExps);
+
+   while ((line = GuestInfoNextLine(&cursor)) != NULL) {
+      uint64 value;
+      char *end;
       char *savedPtr = NULL;
       char *fieldName = strtok_r(line, " \t", &savedPtr);
       char *fieldData = strtok_r(NULL, " \t", &savedPtr);
@@ -474,15 +762,18 @@ GuestInfoProcData(const char *pathName,           // IN: path name
          }
       }
 
-      if ((fieldData == NULL) ||
-          (sscanf(fieldData, "%"FMT64"u", &value) != 1)) {
+      if (fieldData == NULL) {
          continue;
       }
 
-      GuestInfoCollectStat(pathName, collector, fieldName, value);
-   }
+      value = strtoull(fieldData, &end, 10);
+      if (end == fieldData) {
+         continue;
+      }
 
-   fclose(fp);
+      GuestInfoCollectStat(exact, numExact, regExps, numRegExps,
+                           fieldName, value);
+   }
 
    return TRUE;
 }
@@ -511,14 +802,12 @@ static Bool
 GuestInfoProcSimpleValue(GuestStatToolsID reportID,      // IN:
                          GuestInfoCollector *collector)  // IN/OUT:
 {
-   char line[512];
    uint64 value;
-   FILE *fp;
+   char *data;
    Bool success = FALSE;
    GuestInfoStat *stat = NULL;
 
-   HashTable_Lookup(collector->reportMap, INT_AS_HASHKEY(reportID),
-                    (void **) &stat);
+   stat = collector->reportMap[reportID];
 
    /*
     * Caller must not pass in a reportID that does not exist in the table.
@@ -528,26 +817,22 @@ GuestInfoProcSimpleValue(GuestStatToolsID reportID,      // IN:
    ASSERT(stat->query->sourceFile);
 
    /* coverity[var_deref_op] */
-   fp = Posix_Fopen(stat->query->sourceFile, "r");
-   if (fp == NULL) {
-      g_warning("%s: Error opening %s.\n",
+   data = GuestInfoReadProcFile(stat->query->sourceFile);
+   if (data == NULL) {
+      g_warning("%s: Error reading %s.\n",
                 __FUNCTION__, stat->query->sourceFile);
       return success;
    }
 
-   if (fgets(line, sizeof line, fp) == line) {
-      value = 0;
-      if (sscanf(line, "%"FMT64"u", &value) == 1) {
-         stat->err = 0;
-         stat->count = 1;
-         stat->value = value;
+   value = 0;
+   if (sscanf(data, "%"FMT64"u", &value) == 1) {
+      stat->err = 0;
+      stat->count = 1;
+      stat->value = value;
 
-         success = TRUE;
-      }
+      success = TRUE;
    }
 
-   fclose(fp);
-
    return success;
 }
 #endif
@@ -581,21 +866,13 @@ GuestInfoDeriveSwapData(GuestInfoCollector *collector)  // IN/OUT:
    GuestInfoStat *swapFilesCurrent = NULL;
    GuestInfoStat *swapFilesMax = NULL;
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapFilesMax),
-                    (void **) &swapFilesMax);
+   swapFilesMax = collector->reportMap[GuestStatID_SwapFilesMax];
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapFilesCurrent),
-                    (void **) &swapFilesCurrent);
+   swapFilesCurrent = collector->reportMap[GuestStatID_SwapFilesCurrent];
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapSpaceUsed),
-                    (void **) &swapSpaceUsed);
+   swapSpaceUsed = collector->reportMap[GuestStatID_SwapSpaceUsed];
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_SwapSpaceRemaining),
-                    (void **) &swapSpaceRemaining);
+   swapSpaceRemaining = collector->reportMap[GuestStatID_SwapSpaceRemaining];
 
    ASSERT(swapFilesMax != NULL &&
           swapFilesCurrent != NULL &&
@@ -663,9 +940,7 @@ GuestInfoDecreaseCpuRunQueueByOne(GuestInfoCollector *collector)  // IN/OUT:
 {
    GuestInfoStat *stat = NULL;
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_Linux_CpuRunQueue),
-                    (void **) &stat);
+   stat = collector->reportMap[GuestStatID_Linux_CpuRunQueue];
 
    ASSERT(stat != NULL);  // Must be in the table
    ASSERT(stat->err == 0);
@@ -705,12 +980,13 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
    GuestInfoDiskStatsList **listItem;
    uint64 inflightIOsSum;
    Bool setStats; // Only when no disk device change in between
+   Bool foundBlockDevice = FALSE;
 
-   char line[512];
-   FILE *fp = Posix_Fopen(DISKSTATS_FILE, "r");
+   char *line;
+   char *cursor = GuestInfoReadProcFile(DISKSTATS_FILE);
 
-   if (fp == NULL) {
-      g_warning("%s: Error opening " DISKSTATS_FILE ".\n", __FUNCTION__);
+   if (cursor == NULL) {
+      g_warning("%s: Error reading " DISKSTATS_FILE ".\n", __FUNCTION__);
       return FALSE;
    }
 
@@ -719,7 +995,11 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
    inflightIOsSum = 0;
    setStats = (gDiskStatsList != NULL) ? TRUE : FALSE;
 
-   while (fgets(line, sizeof line, fp) == line) {
+   /*
+    * The list holds every device with I/O, partitions included, so that
+    * whether a name is a block device is only checked when the list changes.
+    */
+   while ((line = GuestInfoNextLine(&cursor)) != NULL) {
       /*
        * Linux kernel diskstats_show format string:
        * "%4d %7d %s %lu %lu %lu %u %lu %lu %lu %u %u %u %u\n"
@@ -745,13 +1025,10 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
                              &writeIOs,
                              &inflightIOs, &weightedTime);
       if (assignedCount != 5 ||
-          (readIOs == 0 && writeIOs == 0) ||
-          !GuestInfoIsBlockDevice(diskName)) {
+          (readIOs == 0 && writeIOs == 0)) {
          continue;
       }
 
-      inflightIOsSum += inflightIOs;
-
       if (*listItem != NULL) {
          if (strcmp((*listItem)->diskName, diskName) == 0) {
             (*listItem)->weightedTime[curr] = weightedTime;
@@ -767,6 +1044,7 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
                          Util_SafeMalloc(sizeof **listItem);
          (*listItem)->next = NULL;
          (*listItem)->diskName = Util_SafeStrdup(diskName);
+         (*listItem)->isBlockDevice = GuestInfoIsBlockDevice(diskName);
          (*listItem)->weightedTime[curr] = weightedTime;
          (*listItem)->weightedTime[prev] = 0;
 
@@ -774,26 +1052,35 @@ GuestInfoProcDiskStatsData(GuestInfoCollector *collector)  // IN/OUT:
          setStats = FALSE;
       }
 
+      if ((*listItem)->isBlockDevice) {
+         inflightIOsSum += inflightIOs;
+         foundBlockDevice = TRUE;
+      }
+
       listItem = &((*listItem)->next);
    }
 
-   fclose(fp);
-
-   if (listItem == &gDiskStatsList // No qualified disk device found
-       || *listItem != NULL) {     // Disk hot unplug at the end of the list
+   if (*listItem != NULL) {  // Disk hot unplug at the end of the list
       GuestInfoDeleteDiskStatsList(*listItem);
       *listItem = NULL;
       setStats = FALSE;
    }
 
+   if (!foundBlockDevice) {  // No qualified disk device found
+      setStats = FALSE;
+   }
+
    if (setStats) {
       GuestInfoDiskStatsList *currDiskStats = gDiskStatsList;
       uint64 weightedTimeDeltaSum = 0;
 
       while (currDiskStats != NULL) {
-         unsigned int weightedTimeDelta = currDiskStats->weightedTime[curr] -
-                                          currDiskStats->weightedTime[prev];
-         weightedTimeDeltaSum += weightedTimeDelta;
+         if (currDiskStats->isBlockDevice) {
+            unsigned int weightedTimeDelta =
+               currDiskStats->weightedTime[curr] -
+               currDiskStats->weightedTime[prev];
+            weightedTimeDeltaSum += weightedTimeDelta;
+         }
          currDiskStats = currDiskStats->next;
       }
 
@@ -867,9 +1154,7 @@ GuestInfoCollect(GuestInfoCollector *collector)  // IN/OUT:
     */
 
    stat = NULL;
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_MemPhysUsable),
-                    (void **) &stat);
+   stat = collector->reportMap[GuestStatID_MemPhysUsable];
 
    ASSERT(stat != NULL);  // Must be in the table
 
@@ -879,9 +1164,7 @@ GuestInfoCollect(GuestInfoCollector *collector)  // IN/OUT:
    } else {
       GuestInfoStat *memTotal = NULL;
 
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemTotal),
-                       (void **) &memTotal);
+      memTotal = collector->reportMap[GuestStatID_Linux_MemTotal];
 
       ASSERT(memTotal != NULL);  // Must be in the table
 
@@ -927,9 +1210,7 @@ GuestInfoLegacy(GuestInfoCollector *current,  // IN: current collection
    legacy->flags   = 0;
 
    stat = NULL;
-   HashTable_Lookup(current->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_MemPhysUsable),
-                    (void **) &stat);
+   stat = current->reportMap[GuestStatID_MemPhysUsable];
 
    ASSERT(stat != NULL);  // Must be in the table
 
@@ -940,9 +1221,7 @@ GuestInfoLegacy(GuestInfoCollector *current,  // IN: current collection
    }
 
    stat = NULL;
-   HashTable_Lookup(current->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_Linux_HugePagesTotal),
-                    (void **) &stat);
+   stat = current->reportMap[GuestStatID_Linux_HugePagesTotal];
 
    ASSERT(stat != NULL);  // Must be in the table
 
@@ -1004,15 +1283,15 @@ GuestInfoBytesNeededUIntDatum(uint64 value)  // IN:
 
 static void
 GuestInfoAppendStat(int errnoValue,                // IN:
-                    Bool emitNameSpace,            // IN:
-                    GuestStatToolsID reportID,     // IN:
+                    const char *NameSpace,         // IN: NULL to keep the
+                                                   //     previous stat's
+                    uint32 reportID,               // IN:
                     GuestValueUnits units,         // IN:
                     GuestValueType valueType,      // IN:
-                    void *value,                   // IN:
+                    const void *value,             // IN:
                     size_t valueSize,              // IN:
                     DynBuf *stats)                 // IN/OUT:
 {
-   const char *NameSpace = GUEST_TOOLS_NAMESPACE;
    uint64 value64;
    GuestStatHeader header;
    GuestDatumHeader datum;
@@ -1020,7 +1299,7 @@ GuestInfoAppendStat(int errnoValue,                // IN:
    header.datumFlags = GUEST_DATUM_ID |
                        GUEST_DATUM_VALUE_TYPE_ENUM |
                        GUEST_DATUM_VALUE_UNIT_ENUM;
-   if (emitNameSpace) {
+   if (NameSpace != NULL) {
       header.datumFlags |= GUEST_DATUM_NAMESPACE;
    }
    if (errnoValue == 0) {
@@ -1067,12 +1346,12 @@ GuestInfoAppendStat(int errnoValue,                // IN:
 /*
  *----------------------------------------------------------------------
  *
- * GuestInfoAppendRate --
+ * GuestInfoComputeRate --
  *
- *      Compute a rate and then append it to the stat buffer.
+ *      Compute a rate from the current and previous collections.
  *
  * Results:
- *      None.
+ *      0 and *rate set on success, ENOENT if there is not enough data.
  *
  * Side effects:
  *      None.
@@ -1080,25 +1359,20 @@ GuestInfoAppendStat(int errnoValue,                // IN:
  *----------------------------------------------------------------------
  */
 
-static void
-GuestInfoAppendRate(Bool emitNameSpace,             // IN:
-                    GuestStatToolsID reportID,      // IN: ID of the stat
-                    GuestInfoCollector *current,    // IN: current collection
-                    GuestInfoCollector *previous,   // IN: previous collection
-                    DynBuf *statBuf)                // IN/OUT: stat data
+static int
+GuestInfoComputeRate(GuestStatToolsID reportID,      // IN: ID of the stat
+                     GuestInfoCollector *current,    // IN: current collection
+                     GuestInfoCollector *previous,   // IN: previous collection
+                     double *rate)                   // OUT:
 {
    double valueDouble = 0.0;
    int errnoValue = ENOENT;
    GuestInfoStat *currentStat = NULL;
    GuestInfoStat *previousStat = NULL;
 
-   HashTable_Lookup(current->reportMap,
-                    INT_AS_HASHKEY(reportID),
-                    (void **) &currentStat);
+   currentStat = current->reportMap[reportID];
 
-   HashTable_Lookup(previous->reportMap,
-                    INT_AS_HASHKEY(reportID),
-                    (void **) &previousStat);
+   previousStat = previous->reportMap[reportID];
 
    ASSERT(currentStat != NULL &&
           previousStat != NULL);  // Must be in the table
@@ -1145,29 +1419,91 @@ GuestInfoAppendRate(Bool emitNameSpace,             // IN:
       errnoValue = 0;
    }
 
-   {
-      float valueFloat;
-      void *valuePointer;
-      size_t valueSize;
+   *rate = valueDouble;
+   return errnoValue;
+}
+
 
-      if (valueDouble == 0) {
-         valuePointer = NULL;
-         valueSize = 0;
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoAppendDoubleStat --
+ *
+ *      Append a double stat to the stat buffer, in its smallest exact
+ *      representation.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory may be dynamically allocated (via DynBuf).
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoAppendDoubleStat(int errnoValue,          // IN:
+                          const char *NameSpace,   // IN: may be NULL
+                          uint32 reportID,         // IN:
+                          GuestValueUnits units,   // IN:
+                          double valueDouble,      // IN:
+                          DynBuf *statBuf)         // IN/OUT: stat data
+{
+   float valueFloat;
+   void *valuePointer;
+   size_t valueSize;
+
+   if (valueDouble == 0) {
+      valuePointer = NULL;
+      valueSize = 0;
+   } else {
+      valueFloat = (float)valueDouble;
+      if ((double)valueFloat == valueDouble) {
+         valuePointer = &valueFloat;
+         valueSize = sizeof valueFloat;
       } else {
-         valueFloat = (float)valueDouble;
-         if ((double)valueFloat == valueDouble) {
-            valuePointer = &valueFloat;
-            valueSize = sizeof valueFloat;
-         } else {
-            valuePointer = &valueDouble;
-            valueSize = sizeof valueDouble;
-         }
+         valuePointer = &valueDouble;
+         valueSize = sizeof valueDouble;
       }
-
-      GuestInfoAppendStat(errnoValue, emitNameSpace, reportID,
-                          currentStat->query->units, GuestTypeDouble,
-                          valuePointer, valueSize, statBuf);
    }
+
+   GuestInfoAppendStat(errnoValue, NameSpace, reportID, units,
+                       GuestTypeDouble, valuePointer, valueSize, statBuf);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoAppendRate --
+ *
+ *      Compute a rate and then append it to the stat buffer.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoAppendRate(Bool emitNameSpace,             // IN:
+                    GuestStatToolsID reportID,      // IN: ID of the stat
+                    GuestInfoCollector *current,    // IN: current collection
+                    GuestInfoCollector *previous,   // IN: previous collection
+                    DynBuf *statBuf)                // IN/OUT: stat data
+{
+   double valueDouble;
+   int errnoValue = GuestInfoComputeRate(reportID, current, previous,
+                                         &valueDouble);
+
+   GuestInfoAppendDoubleStat(errnoValue,
+                             emitNameSpace ? GUEST_TOOLS_NAMESPACE : NULL,
+                             reportID,
+                             current->reportMap[reportID]->query->units,
+                             valueDouble, statBuf);
 }
 
 
@@ -1197,9 +1533,7 @@ GuestInfoDeriveMemNeeded(GuestInfoCollector *collector)  // IN/OUT:
    GuestInfoStat *memAvail = NULL;
    GuestInfoStat *memPhysUsable = NULL;
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_Linux_MemAvailable),
-                    (void **) &memAvail);
+   memAvail = collector->reportMap[GuestStatID_Linux_MemAvailable];
 
    ASSERT(memAvail != NULL);  // Must be in the table
 
@@ -1215,27 +1549,13 @@ GuestInfoDeriveMemNeeded(GuestInfoCollector *collector)  // IN/OUT:
       GuestInfoStat *memInactiveFile = NULL;
       GuestInfoStat *memLowWaterMark = NULL;
 
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_MemFree),
-                       (void **) &memFree);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemCached),
-                       (void **) &memCache);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemBuffers),
-                       (void **) &memBuffers);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_MemActiveFileCache),
-                       (void **) &memActiveFile);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemSlabReclaim),
-                       (void **) &memSlabReclaim);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_MemInactiveFile),
-                       (void **) &memInactiveFile);
-      HashTable_Lookup(collector->reportMap,
-                       INT_AS_HASHKEY(GuestStatID_Linux_LowWaterMark),
-                       (void **) &memLowWaterMark);
+      memFree = collector->reportMap[GuestStatID_MemFree];
+      memCache = collector->reportMap[GuestStatID_Linux_MemCached];
+      memBuffers = collector->reportMap[GuestStatID_Linux_MemBuffers];
+      memActiveFile = collector->reportMap[GuestStatID_MemActiveFileCache];
+      memSlabReclaim = collector->reportMap[GuestStatID_Linux_MemSlabReclaim];
+      memInactiveFile = collector->reportMap[GuestStatID_Linux_MemInactiveFile];
+      memLowWaterMark = collector->reportMap[GuestStatID_Linux_LowWaterMark];
 
       ASSERT(memFree != NULL &&
              memCache != NULL &&
@@ -1286,9 +1606,7 @@ GuestInfoDeriveMemNeeded(GuestInfoCollector *collector)  // IN/OUT:
       }
    }
 
-   HashTable_Lookup(collector->reportMap,
-                    INT_AS_HASHKEY(GuestStatID_MemPhysUsable),
-                    (void **) &memPhysUsable);
+   memPhysUsable = collector->reportMap[GuestStatID_MemPhysUsable];
 
    ASSERT(memPhysUsable != NULL);  // Must be in the table
 
@@ -1329,32 +1647,420 @@ GuestInfoDeriveMemNeeded(GuestInfoCollector *collector)  // IN/OUT:
 /*
  *----------------------------------------------------------------------
  *
- * GuestInfoEncodeStats --
+ * GuestInfoAppendVarint --
  *
- *      Encode the guest stats.
+ *      Append an unsigned LEB128 varint to the stat buffer.
  *
  * Results:
  *      None.
  *
  * Side effects:
- *      None.
+ *      Memory may be dynamically allocated (via DynBuf).
  *
  *----------------------------------------------------------------------
  */
 
 static void
-GuestInfoEncodeStats(GuestInfoCollector *current,   // IN: current collection
-                     GuestInfoCollector *previous,  // IN: previous collection
-                     DynBuf *statBuf)               // IN/OUT: stats data
+GuestInfoAppendVarint(uint64 value,   // IN:
+                      DynBuf *stats)  // IN/OUT:
 {
-   uint32 i;
-   GuestMemInfoLegacy legacy;
-   Bool emitNameSpace = TRUE;
+   uint8 bytes[10];
+   size_t n = 0;
+
+   do {
+      bytes[n] = value & 0x7f;
+      value >>= 7;
+      if (value != 0) {
+         bytes[n] |= 0x80;
+      }
+      n++;
+   } while (value != 0);
 
-   /* Provide legacy data for backwards compatibility */
-   GuestInfoLegacy(current, &legacy);
+   DynBuf_Append(stats, bytes, n);
+}
 
-   DynBuf_Append(statBuf, &legacy, sizeof legacy);
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoAppendCompactStat --
+ *
+ *      Append a stat in the compact format, unless it did not change since
+ *      the last report and this one is a delta.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates *last if requested.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoAppendCompactStat(GuestStatToolsID reportID,    // IN:
+                           GuestValueType valueType,     // IN:
+                           Bool hasValue,                // IN:
+                           uint64 bits,                  // IN: value or double
+                           Bool full,                    // IN: full report
+                           GuestInfoCompactStat *last,   // IN/OUT: last sent
+                           Bool update,                  // IN: update *last
+                           DynBuf *stats)                // IN/OUT:
+{
+   GuestStatCompactKind kind;
+
+   if (!full && last->hasValue == hasValue &&
+       (!hasValue || last->bits == bits)) {
+      return;
+   }
+
+   if (!hasValue) {
+      kind = GuestStatCompactNone;
+   } else if (valueType == GuestTypeDouble) {
+      double valueDouble;
+      float valueFloat;
+
+      memcpy(&valueDouble, &bits, sizeof valueDouble);
+      valueFloat = (float)valueDouble;
+      kind = (double)valueFloat == valueDouble ? GuestStatCompactFloat
+                                               : GuestStatCompactDouble;
+   } else {
+      kind = full || !last->hasValue ? GuestStatCompactUint
+                                     : GuestStatCompactDelta;
+   }
+
+   GuestInfoAppendVarint(((uint64)reportID << GUEST_STAT_COMPACT_KIND_BITS) |
+                         kind, stats);
+
+   switch (kind) {
+   case GuestStatCompactUint:
+      GuestInfoAppendVarint(bits, stats);
+      break;
+
+   case GuestStatCompactDelta:
+      {
+         int64 delta = (int64)(bits - last->bits);
+
+         /* Zigzag, so that small negative deltas stay small. */
+         GuestInfoAppendVarint(((uint64)delta << 1) ^ (uint64)(delta >> 63),
+                               stats);
+      }
+      break;
+
+   case GuestStatCompactFloat:
+      {
+         double valueDouble;
+         float valueFloat;
+
+         memcpy(&valueDouble, &bits, sizeof valueDouble);
+         valueFloat = (float)valueDouble;
+         DynBuf_Append(stats, &valueFloat, sizeof valueFloat);
+      }
+      break;
+
+   case GuestStatCompactDouble:
+      DynBuf_Append(stats, &bits, sizeof bits);
+      break;
+
+   default:
+      break;
+   }
+
+   if (update) {
+      last->hasValue = hasValue;
+      last->bits = bits;
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoEncodeCompactRecords --
+ *
+ *      Encode the published stats as GUESTMEMINFO_V6 records, against the
+ *      values of the last report.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates gCompactLast if requested.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoEncodeCompactRecords(GuestInfoCollector *current,   // IN:
+                              GuestInfoCollector *previous,  // IN:
+                              Bool full,                     // IN:
+                              Bool update,                   // IN:
+                              DynBuf *statBuf)               // IN/OUT:
+{
+   uint32 i;
+
+   for (i = 0; i < current->numStats; i++) {
+      GuestInfoStat *stat = &current->stats[i];
+      Bool hasValue;
+      uint64 bits;
+
+      if (!*(stat->query->publish)) {
+         continue;
+      }
+
+      if (stat->query->dataType == GuestTypeDouble) {
+         double rate;
+
+         hasValue = GuestInfoComputeRate(stat->query->reportID, current,
+                                         previous, &rate) == 0;
+         memcpy(&bits, &rate, sizeof bits);
+      } else {
+         ASSERT(stat->query->dataType == GuestTypeUint64);
+         hasValue = stat->err == 0;
+         bits = stat->value;
+      }
+
+      GuestInfoAppendCompactStat(stat->query->reportID,
+                                 stat->query->dataType,
+                                 hasValue, hasValue ? bits : 0, full,
+                                 &gCompactLast[stat->query->reportID],
+                                 update, statBuf);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoClearHistory --
+ *
+ *      Drop the samples kept for the next report.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoClearHistory(void)
+{
+   gHistoryFirst = 0;
+   gHistoryCount = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoKeepSample --
+ *
+ *      Keep the current collection for the next report, overwriting the
+ *      oldest sample if the ring is full.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Memory may be dynamically allocated (via DynBuf).
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoKeepSample(GuestInfoCollector *current,   // IN:
+                    GuestInfoCollector *previous)  // IN:
+{
+   GuestInfoHistorySample *sample;
+
+   if (gHistoryCount == GUEST_INFO_HISTORY_SLOTS) {
+      gHistoryFirst = (gHistoryFirst + 1) % GUEST_INFO_HISTORY_SLOTS;
+      gHistoryCount--;
+   }
+
+   sample = &gHistory[(gHistoryFirst + gHistoryCount) %
+                      GUEST_INFO_HISTORY_SLOTS];
+   gHistoryCount++;
+
+   /* Slots are reused, keeping their memory. */
+   DynBuf_SetSize(&sample->records, 0);
+
+   sample->time = g_get_monotonic_time();
+   GuestInfoEncodeCompactRecords(current, previous, FALSE, FALSE,
+                                 &sample->records);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoEncodeCgroupStats --
+ *
+ *      Encode the stats of the top consuming cgroups, in the
+ *      GUEST_CGROUP_NAMESPACE.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Scans the cgroup hierarchy.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoEncodeCgroupStats(DynBuf *statBuf)  // IN/OUT:
+{
+#if defined(__linux__)
+   const GuestInfoCgroupReport **reports;
+   const char *nameSpace = GUEST_CGROUP_NAMESPACE;
+   uint32 numReports;
+   uint32 i;
+
+   numReports = GuestInfo_CgroupScan(gCgroupTopN, gCgroupScanBudget,
+                                     &reports);
+
+   for (i = 0; i < numReports; i++) {
+      const GuestInfoCgroupReport *report = reports[i];
+      int memErr = report->hasMem ? 0 : ENOENT;
+      int ioErr = report->hasIo ? 0 : ENOENT;
+
+      GuestInfoAppendStat(0, nameSpace, GuestStatCgroupID_Path,
+                          GuestUnitsNone, GuestTypeString,
+                          report->path, strlen(report->path) + 1, statBuf);
+      nameSpace = NULL;
+
+      GuestInfoAppendDoubleStat(report->hasCpu ? 0 : ENOENT, NULL,
+                                GuestStatCgroupID_CpuUsageRate,
+                                GuestUnitsMicroSeconds |
+                                   GuestUnitsModifier_Rate,
+                                report->cpuUsageRate, statBuf);
+      GuestInfoAppendStat(memErr, NULL, GuestStatCgroupID_MemAnon,
+                          GuestUnitsBytes, GuestTypeUint64, &report->memAnon,
+                          GuestInfoBytesNeededUIntDatum(report->memAnon),
+                          statBuf);
+      GuestInfoAppendStat(memErr, NULL, GuestStatCgroupID_MemFile,
+                          GuestUnitsBytes, GuestTypeUint64, &report->memFile,
+                          GuestInfoBytesNeededUIntDatum(report->memFile),
+                          statBuf);
+      GuestInfoAppendDoubleStat(ioErr, NULL, GuestStatCgroupID_IoReadRate,
+                                GuestUnitsBytesPerSecond,
+                                report->ioReadRate, statBuf);
+      GuestInfoAppendDoubleStat(ioErr, NULL, GuestStatCgroupID_IoWriteRate,
+                                GuestUnitsBytesPerSecond,
+                                report->ioWriteRate, statBuf);
+   }
+#endif
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoEncodeCompactStats --
+ *
+ *      Encode the published stats in the compact (GUESTMEMINFO_V6) format,
+ *      preceded by the samples kept since the last report.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Updates the compact report state, empties the history.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoEncodeCompactStats(GuestInfoCollector *current,   // IN:
+                            GuestInfoCollector *previous,  // IN:
+                            DynBuf *statBuf)               // IN/OUT:
+{
+   Bool full = gCompactReportsUntilFull == 0;
+   uint8 flags = full ? GUEST_STATS_COMPACT_FULL : 0;
+   DynBuf cgroups;
+
+   DynBuf_Init(&cgroups);
+   GuestInfoEncodeCgroupStats(&cgroups);
+
+   if (gHistoryCount > 0) {
+      flags |= GUEST_STATS_COMPACT_HISTORY;
+   }
+   if (DynBuf_GetSize(&cgroups) > 0) {
+      flags |= GUEST_STATS_COMPACT_CGROUPS;
+   }
+
+   DynBuf_Append(statBuf, &flags, sizeof flags);
+
+   if (gHistoryCount > 0) {
+      gint64 now = g_get_monotonic_time();
+      uint32 i;
+
+      GuestInfoAppendVarint(gHistoryCount, statBuf);
+      for (i = 0; i < gHistoryCount; i++) {
+         GuestInfoHistorySample *sample =
+            &gHistory[(gHistoryFirst + i) % GUEST_INFO_HISTORY_SLOTS];
+
+         GuestInfoAppendVarint((now - sample->time) / 1000, statBuf);
+         GuestInfoAppendVarint(DynBuf_GetSize(&sample->records), statBuf);
+         DynBuf_Append(statBuf, DynBuf_Get(&sample->records),
+                       DynBuf_GetSize(&sample->records));
+      }
+      GuestInfoClearHistory();
+   }
+
+   if (DynBuf_GetSize(&cgroups) > 0) {
+      GuestInfoAppendVarint(DynBuf_GetSize(&cgroups), statBuf);
+      DynBuf_Append(statBuf, DynBuf_Get(&cgroups), DynBuf_GetSize(&cgroups));
+   }
+   DynBuf_Destroy(&cgroups);
+
+   GuestInfoEncodeCompactRecords(current, previous, full, TRUE, statBuf);
+
+   gCompactReportsUntilFull = full ? GUEST_INFO_COMPACT_FULL_INTERVAL - 1
+                                   : gCompactReportsUntilFull - 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoEncodeStats --
+ *
+ *      Encode the guest stats.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+GuestInfoEncodeStats(GuestInfoCollector *current,   // IN: current collection
+                     GuestInfoCollector *previous,  // IN: previous collection
+                     DynBuf *statBuf)               // IN/OUT: stats data
+{
+   uint32 i;
+   GuestMemInfoLegacy legacy;
+   Bool emitNameSpace = TRUE;
+
+   /* Provide legacy data for backwards compatibility */
+   GuestInfoLegacy(current, &legacy);
+
+   if (gCompactEnabled) {
+      legacy.version = GUESTMEMINFO_V6;
+      DynBuf_Append(statBuf, &legacy, sizeof legacy);
+      GuestInfoEncodeCompactStats(current, previous, statBuf);
+      return;
+   }
+
+   DynBuf_Append(statBuf, &legacy, sizeof legacy);
 
    /* Provide data in the new, extensible format. */
    for (i = 0; i < current->numStats; i++) {
@@ -1371,7 +2077,7 @@ GuestInfoEncodeStats(GuestInfoCollector *current,   // IN: current collection
          ASSERT(stat->query->dataType == GuestTypeUint64);
          ASSERT((stat->query->units & GuestUnitsModifier_Rate) == 0);
          GuestInfoAppendStat(stat->err,
-                             emitNameSpace,
+                             emitNameSpace ? GUEST_TOOLS_NAMESPACE : NULL,
                              stat->query->reportID,
                              stat->query->units,
                              stat->query->dataType,
@@ -1382,6 +2088,8 @@ GuestInfoEncodeStats(GuestInfoCollector *current,   // IN: current collection
 
       emitNameSpace = FALSE; // use the smallest representation
    }
+
+   GuestInfoEncodeCgroupStats(statBuf);
 }
 
 
@@ -1405,8 +2113,7 @@ static void
 GuestInfoDestroyCollector(GuestInfoCollector *collector)  // IN:
 {
    if (collector != NULL) {
-      HashTable_Free(collector->exactMatches);
-      HashTable_Free(collector->reportMap);
+      free(collector->exactMatches);
       free(collector->regExps);
       free(collector->stats);
       free(collector);
@@ -1437,22 +2144,21 @@ GuestInfoConstructCollector(GuestInfoQuery *queries,  // IN:
 {
    uint32 i;
    uint32 regExp = 0;
+   uint32 exact = 0;
    GuestInfoCollector *collector = Util_SafeCalloc(1, sizeof *collector);
 
    if (collector == NULL) {
       return NULL;
    }
 
-   collector->reportMap = HashTable_Alloc(256, HASH_INT_KEY, NULL);
-
-   collector->exactMatches = HashTable_Alloc(256,
-                                           HASH_STRING_KEY | HASH_FLAG_COPYKEY,
-                                             NULL);
-
    collector->numRegExps = 0;
+   collector->numExactMatches = 0;
    for (i = 0; i < numQueries; i++) {
       if (queries[i].isRegExp) {
          collector->numRegExps++;
+      } else if (queries[i].sourceFile != NULL &&
+                 queries[i].locatorString != NULL) {
+         collector->numExactMatches++;
       }
    }
 
@@ -1460,14 +2166,8 @@ GuestInfoConstructCollector(GuestInfoQuery *queries,  // IN:
    collector->stats = Util_SafeCalloc(numQueries, sizeof *collector->stats);
    collector->regExps = Util_SafeCalloc(collector->numRegExps,
                                         sizeof(GuestInfoStat *));
-
-   if ((collector->exactMatches == NULL) ||
-       (collector->reportMap == NULL) ||
-       ((collector->numRegExps != 0) && (collector->regExps == NULL)) ||
-       ((collector->numStats != 0) && (collector->stats == NULL))) {
-      GuestInfoDestroyCollector(collector);
-      return NULL;
-   }
+   collector->exactMatches = Util_SafeCalloc(collector->numExactMatches,
+                                             sizeof(GuestInfoStat *));
 
    regExp = 0;
 
@@ -1486,41 +2186,113 @@ GuestInfoConstructCollector(GuestInfoQuery *queries,  // IN:
          collector->regExps[regExp++] = stat;
       } else {
          if (query->sourceFile != NULL && query->locatorString != NULL) {
-            char *key = Str_SafeAsprintf(NULL, KEY_FORMAT, query->sourceFile,
-                                         query->locatorString);
-            HashTable_Insert(collector->exactMatches, key, stat);
-            free(key);
+            collector->exactMatches[exact++] = stat;
          }
       }
 
       /* The report lookup */
-      HashTable_Insert(collector->reportMap, INT_AS_HASHKEY(query->reportID),
-                       stat);
+      ASSERT(query->reportID < ARRAYSIZE(collector->reportMap));
+      collector->reportMap[query->reportID] = stat;
    }
 
+   /*
+    * Sorted so that each file's stats are contiguous, and its exact matches
+    * can be binary searched.
+    */
+   qsort(collector->exactMatches, collector->numExactMatches,
+         sizeof *collector->exactMatches, GuestInfoCompareMatches);
+   qsort(collector->regExps, collector->numRegExps,
+         sizeof *collector->regExps, GuestInfoCompareMatches);
+
    return collector;
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfoIsSteady --
+ *
+ *      Check whether the published stats barely moved since the previous
+ *      collection: levels by less than 1/64 and rates by less than 1/4.
+ *
+ * Results:
+ *      TRUE if the guest looks idle or in a steady state.
+ *
+ * Side effects:
+ *      Remembers the rates for the next check.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+GuestInfoIsSteady(GuestInfoCollector *current,   // IN:
+                  GuestInfoCollector *previous)  // IN:
+{
+   Bool steady = TRUE;
+   uint32 i;
+
+   for (i = 0; i < current->numStats; i++) {
+      GuestInfoStat *stat = &current->stats[i];
+      GuestStatToolsID reportID = stat->query->reportID;
+
+      if (!*(stat->query->publish)) {
+         continue;
+      }
+
+      if (stat->query->dataType == GuestTypeDouble) {
+         double rate;
+
+         if (GuestInfoComputeRate(reportID, current, previous, &rate) != 0) {
+            steady = FALSE;
+            continue;
+         }
+         if (fabs(rate - gLastRates[reportID]) >
+             gLastRates[reportID] / 4 + 1) {
+            steady = FALSE;
+         }
+         gLastRates[reportID] = rate;
+      } else {
+         GuestInfoStat *prev = previous->reportMap[reportID];
+         uint64 delta;
+
+         if (stat->err != prev->err) {
+            steady = FALSE;
+            continue;
+         }
+         delta = stat->value > prev->value ? stat->value - prev->value
+                                           : prev->value - stat->value;
+         if (delta > prev->value / 64) {
+            steady = FALSE;
+         }
+      }
+   }
+
+   return steady;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
  * GuestInfoTakeSample --
  *
- *      Gather performance stats.
+ *      Gather performance stats. Unless a report is due, a compact sample
+ *      is kept for the next report instead of being encoded.
  *
  * Results:
- *      TRUE   Success! statBuf contains collected data
+ *      TRUE   Success! statBuf contains collected data, if a report is due
  *      FALSE  Failure! statBuf contains no collected data
  *
  * Side effects:
- *      None.
+ *      Updates the adaptive sampling state.
  *
  *----------------------------------------------------------------------
  */
 
 Bool
-GuestInfoTakeSample(DynBuf *statBuf)  // IN/OUT: inited, ready to fill
+GuestInfoTakeSample(Bool report,      // IN: a report is due
+                    DynBuf *statBuf)  // IN/OUT: inited, ready to fill
 {
    GuestInfoCollector *temp;
 
@@ -1552,8 +2324,18 @@ GuestInfoTakeSample(DynBuf *statBuf)  // IN/OUT: inited, ready to fill
    /* Collect the current data */
    GuestInfoCollect(gCurrentCollector);
 
+   if (GuestInfoIsSteady(gCurrentCollector, gPreviousCollector)) {
+      gSteadySamples++;
+   } else {
+      gSteadySamples = 0;
+   }
+
    /* Encode the captured data */
-   GuestInfoEncodeStats(gCurrentCollector, gPreviousCollector, statBuf);
+   if (report) {
+      GuestInfoEncodeStats(gCurrentCollector, gPreviousCollector, statBuf);
+   } else {
+      GuestInfoKeepSample(gCurrentCollector, gPreviousCollector);
+   }
 
    /* Switch the collections for next time. */
    temp = gCurrentCollector;
@@ -1585,6 +2367,8 @@ GuestInfo_StatProviderPoll(gpointer data)
 {
    ToolsAppCtx *ctx = data;
    DynBuf stats;
+   gint64 now = g_get_monotonic_time();
+   Bool report;
 
    g_debug("Entered guest info stats gather.\n");
 
@@ -1595,13 +2379,41 @@ GuestInfo_StatProviderPoll(gpointer data)
                                       NULL);
 #endif
 
+   gCgroupTopN =
+      MAX(0, VMTools_ConfigGetInteger(ctx->config,
+                                      CONFGROUPNAME_GUESTINFO,
+                                      CONFNAME_GUESTINFO_CGROUPSTATSTOP,
+                                      0));
+   gCgroupScanBudget =
+      MAX(1, VMTools_ConfigGetInteger(ctx->config,
+                                      CONFGROUPNAME_GUESTINFO,
+                                      CONFNAME_GUESTINFO_CGROUPSCANBUDGET,
+                                      GUEST_INFO_CGROUP_SCAN_BUDGET_MS));
+
+   /*
+    * During a burst, compact reports are only sent at the configured
+    * interval and carry the samples taken in between. V5 reports cannot,
+    * so every sample is reported.
+    */
+   report = !gCompactEnabled || now >= gBurstEnd ||
+            (now - gLastReportTime) / 1000 +
+               GUEST_INFO_BURST_INTERVAL_MS / 2 >= gReportInterval;
+
    /* Send the vmstats to the VMX. */
    DynBuf_Init(&stats);
 
-   if (!GuestInfoTakeSample(&stats)) {
+   if (!GuestInfoTakeSample(report, &stats)) {
       g_warning("Failed to get vmstats.\n");
+   } else if (!report) {
+      g_debug("Kept vmstats sample %u for the next report.\n",
+              gHistoryCount);
    } else if (!GuestInfo_ServerReportStats(ctx, &stats)) {
       g_warning("Failed to send vmstats.\n");
+      /* The host may have missed a delta, start over with a full report. */
+      gCompactReportsUntilFull = 0;
+      GuestInfoClearHistory();
+   } else {
+      gLastReportTime = now;
    }
 
    DynBuf_Destroy(&stats);
@@ -1609,6 +2421,111 @@ GuestInfo_StatProviderPoll(gpointer data)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfo_StatProviderSetCompact --
+ *
+ *      Switches between the GUESTMEMINFO_V5 and the compact
+ *      GUESTMEMINFO_V6 reports. The first compact report is a full one.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+GuestInfo_StatProviderSetCompact(Bool enable)  // IN:
+{
+   if (enable != gCompactEnabled) {
+      g_info("%s compact vmstats.\n", enable ? "Enabling" : "Disabling");
+   }
+   gCompactEnabled = enable;
+   gCompactReportsUntilFull = 0;
+   GuestInfoClearHistory();
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfo_StatProviderBurst --
+ *
+ *      Samples stats every GUEST_INFO_BURST_INTERVAL_MS for the given
+ *      time, or stops the current burst.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+GuestInfo_StatProviderBurst(uint32 seconds)  // IN: 0 to stop
+{
+   seconds = MIN(seconds, GUEST_INFO_BURST_MAX_SECS);
+
+   g_info("%s vmstats burst sampling%s.\n", seconds ? "Starting" : "Stopping",
+          seconds ? "" : " early");
+   gBurstEnd = seconds ? g_get_monotonic_time() + seconds * G_USEC_PER_SEC
+                       : 0;
+   gSteadySamples = 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GuestInfo_StatProviderNextInterval --
+ *
+ *      Compute when to sample the stats next.
+ *
+ * Results:
+ *      The sampling interval in ms: GUEST_INFO_BURST_INTERVAL_MS during a
+ *      burst, up to maxBackoff times the report interval on a steady guest,
+ *      the report interval otherwise.
+ *
+ * Side effects:
+ *      None.
+ *
+ *----------------------------------------------------------------------
+ */
+
+uint32
+GuestInfo_StatProviderNextInterval(uint32 reportInterval,  // IN: ms
+                                   uint32 maxBackoff)      // IN:
+{
+   uint32 backoff = 1;
+   uint32 steady;
+
+   gReportInterval = reportInterval;
+
+   if (reportInterval == 0) {
+      return 0;
+   }
+
+   if (g_get_monotonic_time() < gBurstEnd) {
+      return MIN(reportInterval, GUEST_INFO_BURST_INTERVAL_MS);
+   }
+
+   for (steady = gSteadySamples;
+        steady >= GUEST_INFO_STEADY_SAMPLES && backoff * 2 <= maxBackoff;
+        steady -= GUEST_INFO_STEADY_SAMPLES) {
+      backoff *= 2;
+   }
+
+   return reportInterval > MAX_UINT32 / backoff ? reportInterval
+                                                : reportInterval * backoff;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1629,6 +2546,8 @@ GuestInfo_StatProviderPoll(gpointer data)
 void
 GuestInfo_StatProviderShutdown(void)
 {
+   uint32 i;
+
    GuestInfoDeleteDiskStatsList(gDiskStatsList);
    gDiskStatsList = NULL;
 
@@ -1636,4 +2555,15 @@ GuestInfo_StatProviderShutdown(void)
    gCurrentCollector = NULL;
    GuestInfoDestroyCollector(gPreviousCollector);
    gPreviousCollector = NULL;
+
+   for (i = 0; i < ARRAYSIZE(gHistory); i++) {
+      DynBuf_Destroy(&gHistory[i].records);
+   }
+   GuestInfoClearHistory();
+
+#if defined(__linux__)
+   GuestInfo_CgroupShutdown();
+#endif
+
+   GuestInfoCloseProcFiles();
 }
@@ -31,6 +31,7 @@
 
 #define G_LOG_DOMAIN "hgfsd"
 
+#include "conf.h"
 #include "hgfs.h"
 #include "hgfsServerManager.h"
 #include "vm_basic_defs.h"
@@ -92,7 +93,66 @@ HgfsServerShutdown(gpointer src,
 
 
 /**
- * Handles hgfs requests.
+ * Applies the share scheduling settings of the config file to the server.
+ * Missing settings restore the defaults, so removing them from the config
+ * file and reloading it undoes them.
+ *
+ * @param[in]  mgrData  HGFS server manager data.
+ * @param[in]  config   The config file.
+ */
+
+static void
+HgfsServerLoadConfig(HgfsServerMgrData *mgrData,
+                     GKeyFile *config)
+{
+   gint weight;
+   gint bytesPerSec;
+
+   weight = VMTools_ConfigGetInteger(config, CONFGROUPNAME_HGFSSERVER,
+                                     CONFNAME_HGFSSERVER_SHAREWEIGHT, 1);
+   bytesPerSec = VMTools_ConfigGetInteger(config, CONFGROUPNAME_HGFSSERVER,
+                                          CONFNAME_HGFSSERVER_SHAREMAXBYTESPERSEC,
+                                          0);
+   if (weight < 1) {
+      g_warning("Invalid %s %d, using 1.\n",
+                CONFNAME_HGFSSERVER_SHAREWEIGHT, weight);
+      weight = 1;
+   }
+   if (bytesPerSec < 0) {
+      g_warning("Invalid %s %d, using 0.\n",
+                CONFNAME_HGFSSERVER_SHAREMAXBYTESPERSEC, bytesPerSec);
+      bytesPerSec = 0;
+   }
+
+   if (!HgfsServerManager_SetShareLimits(mgrData, weight, bytesPerSec) &&
+       (weight != 1 || bytesPerSec != 0)) {
+      g_info("HGFS server threadpool not in use, ignoring the share "
+             "scheduling settings.\n");
+   }
+}
+
+
+/**
+ * Reapplies the share scheduling settings after the config file changed.
+ *
+ * @param[in]  src      The source object.
+ * @param[in]  ctx      The app context.
+ * @param[in]  plugin   Plugin registration data.
+ */
+
+static void
+HgfsServerConfReload(gpointer src,
+                     ToolsAppCtx *ctx,
+                     ToolsPluginData *plugin)
+{
+   HgfsServerLoadConfig(plugin->_private, ctx->config);
+}
+
+
+/**
+ * Handles hgfs requests. Registered as a bulk RPC, so it runs on the shared
+ * thread pool; the static reply buffer is enough since a channel has at most
+ * one bulk RPC outstanding.
  *
  * @param[in]  data  RPC request data.
  *
@@ -123,6 +183,40 @@ HgfsServerRpcDispatch(RpcInData *data)
 }
 
 
+/**
+ * Reports the HGFS server request statistics, optionally turning recording
+ * on or off, resetting or logging them first.
+ *
+ * @param[in]  data  RPC request data.
+ *
+ * @return TRUE on success, FALSE on error.
+ */
+
+static gboolean
+HgfsServerStatsRpc(RpcInData *data)
+{
+   HgfsServerMgrData *mgrData;
+   gchar *command;
+   char *stats;
+
+   ASSERT(data->clientData != NULL);
+   mgrData = data->clientData;
+
+   command = g_strstrip(g_strndup(data->args, data->argsSize));
+   stats = HgfsServerManager_QueryStats(mgrData, command);
+   g_free(command);
+
+   if (stats == NULL) {
+      return RPCIN_SETRETVALS(data, "Unknown HGFS stats command", FALSE);
+   }
+
+   data->result = stats;
+   data->resultLen = strlen(stats);
+   data->freeResult = TRUE;
+   return TRUE;
+}
+
+
 /**
  * Sends the HGFS capability to the VMX.
  *
@@ -1131,12 +1225,17 @@ ToolsOnLoad(ToolsAppCtx *ctx)
       return NULL;
    }
 
+   HgfsServerLoadConfig(mgrData, ctx->config);
+
    {
       RpcChannelCallback rpcs[] = {
-         { HGFS_SYNC_REQREP_CMD, HgfsServerRpcDispatch, mgrData, NULL, NULL, 0 }
+         { HGFS_SYNC_REQREP_CMD, HgfsServerRpcDispatch, mgrData, NULL, NULL, 0,
+           RPCCHANNEL_PRIORITY_BULK },
+         { HGFS_STATS_CMD, HgfsServerStatsRpc, mgrData, NULL, NULL, 0 }
       };
       ToolsPluginSignalCb sigs[] = {
          { TOOLS_CORE_SIG_CAPABILITIES, HgfsServerCapReg, &regData },
+         { TOOLS_CORE_SIG_CONF_RELOAD, HgfsServerConfReload, &regData },
          { TOOLS_CORE_SIG_SHUTDOWN, HgfsServerShutdown, &regData }
       };
       ToolsAppReg regs[] = {
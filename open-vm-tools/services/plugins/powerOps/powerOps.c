@@ -38,6 +38,7 @@
 #  define INVALID_PID NULL
 #else
 #  define INVALID_PID (GPid) -1
+#include <signal.h>
 #include <sys/wait.h>
 #endif
 
@@ -58,6 +59,12 @@ static const char *stateChgConfNames[] = {
 };
 
 
+/*
+ * Scripts in the "<script>.d" directory with this suffix are not waited for
+ * to report the state change.
+ */
+#define POWEROPS_NOWAIT_SUFFIX ".nowait"
+
 /** Internal plugin state. */
 typedef struct PowerOpState {
    GuestOsState         stateChgInProgress;
@@ -65,13 +72,28 @@ typedef struct PowerOpState {
 #if defined(G_PLATFORM_WIN32)
    ProcMgr_AsyncProc   *pid;
 #else
-   GPid                 pid;
+   guint                pending;       // Running scripts blocking the change
+   gboolean             success;       // No blocking script failed
+   GString             *report;        // Durations of the blocking scripts
 #endif
    ToolsAppCtx         *ctx;
    gboolean             scriptEnabled[GUESTOS_STATECHANGE_LAST];
 } PowerOpState;
 
 
+#if !defined(G_PLATFORM_WIN32)
+/** A running state change script. */
+typedef struct PowerOpScript {
+   PowerOpState        *state;
+   gchar               *name;
+   GPid                 pid;
+   gboolean             blocking;
+   gint64               startTime;
+   GSource             *timeout;
+} PowerOpScript;
+#endif
+
+
 /**
  * Returns the capabilities of the power ops plugin.
  *
@@ -157,6 +179,12 @@ PowerOpsShutdown(gpointer src,
                  ToolsPluginData *plugin)
 {
    PowerOpState *state = plugin->_private;
+
+#if !defined(G_PLATFORM_WIN32)
+   if (state->report != NULL) {
+      g_string_free(state->report, TRUE);
+   }
+#endif
    g_free(state);
 }
 
@@ -308,14 +336,87 @@ PowerOpsRunScript(PowerOpState *state,
    }
 }
 
+
+/**
+ * Runs the script of a state change. Only the POSIX version supports the
+ * "<script>.d" directory and the timeout.
+ *
+ * @param[in]  state    Plugin state.
+ * @param[in]  script   Path to the script to be run.
+ *
+ * @return Whether started the process successfully.
+ */
+
+static gboolean
+PowerOpsRunScripts(PowerOpState *state,
+                   gchar *script)
+{
+   return PowerOpsRunScript(state, script);
+}
+
 #else
 
 /**
- * Callback for when the script process finishes on POSIX systems.
+ * Sends the durations of the scripts of the state change to the host, as the
+ * guestinfo.vmtools.powerops.<state change> guest variable.
+ *
+ * @param[in]  state       Plugin state.
+ */
+
+static void
+PowerOpsReportScripts(PowerOpState *state)
+{
+   size_t i;
+   gchar *msg;
+
+   for (i = 0; i < ARRAYSIZE(stateChangeCmdTable); i++) {
+      if (stateChangeCmdTable[i].id == state->stateChgInProgress) {
+         break;
+      }
+   }
+
+   if (i == ARRAYSIZE(stateChangeCmdTable) || state->report->len == 0) {
+      return;
+   }
+
+   msg = g_strdup_printf("info-set guestinfo.vmtools.powerops.%s %s",
+                         stateChangeCmdTable[i].name, state->report->str);
+   if (!RpcChannel_Send(state->ctx->rpc, msg, strlen(msg) + 1, NULL, NULL)) {
+      g_debug("Unable to report the script durations.\n");
+   }
+   g_free(msg);
+}
+
+
+/**
+ * Kills a script which ran for longer than the configured timeout.
+ *
+ * @param[in]  _script     The script.
+ *
+ * @return FALSE.
+ */
+
+static gboolean
+PowerOpsScriptTimeout(gpointer _script)
+{
+   PowerOpScript *script = _script;
+
+   g_warning("Script '%s' timed out, killing it.\n", script->name);
+   kill(script->pid, SIGKILL);
+   g_source_unref(script->timeout);
+   script->timeout = NULL;
+   return FALSE;
+}
+
+
+/**
+ * Callback for when the script process finishes on POSIX systems. Once the
+ * last blocking script of the state change is done, reports the durations
+ * and sends the state change status to the VMX.
  *
  * @param[in]  pid         Child pid.
  * @param[in]  exitStatus  Exit status of script.
- * @param[in]  _state      Plugin state.
+ * @param[in]  _script     The script.
  *
  * @return FALSE.
  */
@@ -323,28 +424,54 @@ PowerOpsRunScript(PowerOpState *state,
 static gboolean
 PowerOpsScriptCallback(GPid pid,
                        gint exitStatus,
-                       gpointer _state)
+                       gpointer _script)
 {
-   PowerOpState *state = _state;
+   PowerOpScript *script = _script;
+   PowerOpState *state = script->state;
    gboolean success = exitStatus == 0;
+   gint64 elapsedMs = (g_get_monotonic_time() - script->startTime) / 1000;
 
-   ASSERT(state->pid != INVALID_PID);
+   ASSERT(script->pid != INVALID_PID);
 
    if (WIFEXITED(exitStatus)) {
-      g_message("Script exit code: %d, success = %d\n",
-                WEXITSTATUS(exitStatus), success);
+      g_message("Script '%s' exit code: %d, success = %d, %" G_GINT64_FORMAT
+                " ms\n", script->name, WEXITSTATUS(exitStatus), success,
+                elapsedMs);
    } else if (WIFSIGNALED(exitStatus)) {
-      g_message("Script killed by signal: %d, success = %d\n",
-                WTERMSIG(exitStatus), success);
+      g_message("Script '%s' killed by signal: %d, success = %d\n",
+                script->name, WTERMSIG(exitStatus), success);
    } else if (WIFSTOPPED(exitStatus)) {
-      g_message("Script stopped by signal: %d, success = %d\n",
-                WSTOPSIG(exitStatus), success);
+      g_message("Script '%s' stopped by signal: %d, success = %d\n",
+                script->name, WSTOPSIG(exitStatus), success);
    } else {
-      g_message("Script exit status: %d, success = %d\n", exitStatus, success);
+      g_message("Script '%s' exit status: %d, success = %d\n", script->name,
+                exitStatus, success);
    }
-   PowerOpsStateChangeDone(_state, success);
-   g_spawn_close_pid(state->pid);
-   state->pid = INVALID_PID;
+
+   if (script->timeout != NULL) {
+      g_source_destroy(script->timeout);
+      g_source_unref(script->timeout);
+   }
+   g_spawn_close_pid(script->pid);
+
+   if (script->blocking) {
+      /* Exit code, or minus the signal which killed the script. */
+      gint code = WIFEXITED(exitStatus) ? WEXITSTATUS(exitStatus) :
+                  WIFSIGNALED(exitStatus) ? -WTERMSIG(exitStatus) : exitStatus;
+
+      g_string_append_printf(state->report, "%s%s=%d:%" G_GINT64_FORMAT "ms",
+                             state->report->len > 0 ? " " : "", script->name,
+                             code, elapsedMs);
+      state->success &= success;
+      ASSERT(state->pending > 0);
+      if (--state->pending == 0) {
+         PowerOpsReportScripts(state);
+         PowerOpsStateChangeDone(state, state->success);
+      }
+   }
+
+   g_free(script->name);
+   g_free(script);
    return FALSE;
 }
 
@@ -357,17 +484,22 @@ PowerOpsScriptCallback(GPid pid,
  *
  * @param[in]  state    Plugin state.
  * @param[in]  script   Path to the script to be run.
+ * @param[in]  blocking Whether the state change waits for the script.
  *
  * @return Whether started the process successfully.
  */
 
 static gboolean
 PowerOpsRunScript(PowerOpState *state,
-                  gchar *script)
+                  gchar *script,
+                  gboolean blocking)
 {
    gchar *argv[2];
    GSource *watch;
    GError *err = NULL;
+   GPid pid;
+   PowerOpScript *run;
+   gint timeout;
 
    argv[0] = g_locale_from_utf8(script, -1, NULL, NULL, &err);
    if (err != NULL) {
@@ -381,7 +513,8 @@ PowerOpsRunScript(PowerOpState *state,
    }
    argv[1] = NULL;
 
-   g_message("Executing script: '%s'\n", script);
+   g_message("Executing script: '%s'%s\n", script,
+             blocking ? "" : " (not waited for)");
    if (!g_spawn_async(NULL,
                       argv,
                       NULL,
@@ -390,7 +523,7 @@ PowerOpsRunScript(PowerOpState *state,
                       G_SPAWN_STDERR_TO_DEV_NULL,
                       NULL,
                       NULL,
-                      &state->pid,
+                      &pid,
                       &err)) {
          g_warning("Error starting script: %s\n", err->message);
          g_clear_error(&err);
@@ -398,13 +531,129 @@ PowerOpsRunScript(PowerOpState *state,
          return FALSE;
    }
 
+   run = g_malloc0(sizeof *run);
+   run->state = state;
+   run->name = g_path_get_basename(script);
+   run->pid = pid;
+   run->blocking = blocking;
+   run->startTime = g_get_monotonic_time();
+
+   if (blocking) {
+      state->pending++;
+   }
+
+   /* Kill the script if it runs for longer than the configured timeout. */
+   timeout = VMTools_ConfigGetInteger(state->ctx->config, "powerops",
+                                      CONFNAME_SCRIPTTIMEOUT, 0);
+   if (timeout > 0) {
+      run->timeout = g_timeout_source_new_seconds(timeout);
+      VMTOOLSAPP_ATTACH_SOURCE(state->ctx, run->timeout, PowerOpsScriptTimeout,
+                               run, NULL);
+   }
+
    /* Setup a watch for when the child is done. */
-   watch = g_child_watch_source_new(state->pid);
-   VMTOOLSAPP_ATTACH_SOURCE(state->ctx, watch, PowerOpsScriptCallback, state, NULL);
+   watch = g_child_watch_source_new(pid);
+   VMTOOLSAPP_ATTACH_SOURCE(state->ctx, watch, PowerOpsScriptCallback, run, NULL);
    g_source_unref(watch);
    g_free(argv[0]);
    return TRUE;
 }
+
+
+/**
+ * Compares two strings. To be used with g_ptr_array_sort.
+ *
+ * @param[in]  _str1    Pointer to string for comparison.
+ * @param[in]  _str2    Pointer to string for comparison.
+ *
+ * @return Result of strcmp.
+ */
+
+static gint
+PowerOpsStrPtrCompare(gconstpointer _str1,
+                      gconstpointer _str2)
+{
+   const gchar * const *str1 = _str1;
+   const gchar * const *str2 = _str2;
+
+   return strcmp(*str1, *str2);
+}
+
+
+/**
+ * Runs the script of a state change and, concurrently, the executables in
+ * the "<script>.d" directory, if there is one, in alphabetical order. The
+ * state change is done when all of them are done, except for the ones whose
+ * name ends in ".nowait" which just get started.
+ *
+ * @param[in]  state    Plugin state.
+ * @param[in]  script   Path to the script to be run.
+ *
+ * @return Whether the script was started.
+ */
+
+static gboolean
+PowerOpsRunScripts(PowerOpState *state,
+                   gchar *script)
+{
+   gchar *dirPath;
+   GDir *dir;
+   GPtrArray *entries;
+   const gchar *entry;
+   guint i;
+
+   if (state->report == NULL) {
+      state->report = g_string_new(NULL);
+   }
+   g_string_truncate(state->report, 0);
+   state->success = TRUE;
+
+   /*
+    * The script is counted as pending while the others are started, so that
+    * the change is not done because a script exits before the next starts.
+    */
+   state->pending = 1;
+
+   if (!PowerOpsRunScript(state, script, TRUE)) {
+      state->pending = 0;
+      return FALSE;
+   }
+
+   dirPath = g_strdup_printf("%s.d", script);
+   dir = g_dir_open(dirPath, 0, NULL);
+   if (dir != NULL) {
+      entries = g_ptr_array_new_with_free_func(g_free);
+      while ((entry = g_dir_read_name(dir)) != NULL) {
+         if (entry[0] != '.') {
+            g_ptr_array_add(entries, g_strdup(entry));
+         }
+      }
+      g_dir_close(dir);
+      g_ptr_array_sort(entries, PowerOpsStrPtrCompare);
+
+      for (i = 0; i < entries->len; i++) {
+         const gchar *name = g_ptr_array_index(entries, i);
+         gchar *path = g_build_filename(dirPath, name, NULL);
+
+         if (g_file_test(path, G_FILE_TEST_IS_REGULAR) &&
+             g_file_test(path, G_FILE_TEST_IS_EXECUTABLE) &&
+             !PowerOpsRunScript(state, path,
+                                !g_str_has_suffix(name,
+                                                  POWEROPS_NOWAIT_SUFFIX))) {
+            state->success = FALSE;
+         }
+         g_free(path);
+      }
+      g_ptr_array_free(entries, TRUE);
+   }
+   g_free(dirPath);
+
+   if (--state->pending == 0) {
+      PowerOpsReportScripts(state);
+      PowerOpsStateChangeDone(state, state->success);
+   }
+   return TRUE;
+}
 #endif
 
 
@@ -423,7 +672,11 @@ PowerOpsStateChange(RpcInData *data)
    size_t i;
    PowerOpState *state = data->clientData;
 
+#if defined(G_PLATFORM_WIN32)
    if (state->pid != INVALID_PID) {
+#else
+   if (state->pending > 0) {
+#endif
       g_debug("State change already in progress.\n");
       return RPCIN_SETRETVALS(data,  "State change already in progress", FALSE);
    }
@@ -498,7 +751,7 @@ PowerOpsStateChange(RpcInData *data)
             script = tmp;
          }
 
-         if (PowerOpsRunScript(state, script)) {
+         if (PowerOpsRunScripts(state, script)) {
             result = "";
             ret = TRUE;
          } else {
@@ -549,7 +802,9 @@ ToolsOnLoad(ToolsAppCtx *ctx)
 
    state = g_malloc0(sizeof *state);
    state->ctx = ctx;
+#if defined(G_PLATFORM_WIN32)
    state->pid = INVALID_PID;
+#endif
 
    for (i = 0; i < GUESTOS_STATECHANGE_LAST; i++) {
       state->scriptEnabled[i] = TRUE;
@@ -54,12 +54,26 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
  */
 #define RESOLUTION_SET_CAPABILITIES_MAX 5
 
+/*
+ * Every layout written to the kernel makes it send an uevent, upon which
+ * the compositor does a modeset. Resizing the console window sends a request
+ * for every intermediate size, so a layout is only written once no request
+ * came for this long, in milliseconds.
+ */
+#define RESOLUTION_KMS_DEBOUNCE_MS 100
+
 /*
  * Global information about the communication state
  */
 typedef struct {
    gboolean initialized;       // Whether the plugin is already initialized.
    int fd;                     // File descriptor to the DRM device.
+   ToolsAppCtx *ctx;           // The app context, for the debounce timer.
+   GSource *pendingTimer;      // NULL if no layout is pending.
+   struct drm_vmw_rect *pendingRects;
+   unsigned int pendingCount;
+   struct drm_vmw_rect *lastRects; // Last layout written to the kernel.
+   unsigned int lastCount;
 } KMSInfoType;
 
 /*
@@ -113,6 +127,114 @@ ResolutionWriteToKernel(const struct drm_vmw_rect *rects, // IN: Screen rects
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ResolutionWritePending --
+ *
+ *     Writes the pending layout to the drm device, unless it is the one
+ *     written last.
+ *
+ * Results:
+ *     FALSE, the timer is done.
+ *
+ * Side effects:
+ *     The pending layout becomes the last one.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+ResolutionWritePending(gpointer data) // IN: Unused.
+{
+   if (kmsInfo.pendingTimer == NULL) {
+      return FALSE;
+   }
+   g_source_unref(kmsInfo.pendingTimer);
+   kmsInfo.pendingTimer = NULL;
+
+   if (kmsInfo.lastRects != NULL &&
+       kmsInfo.lastCount == kmsInfo.pendingCount &&
+       memcmp(kmsInfo.lastRects, kmsInfo.pendingRects,
+              sizeof *kmsInfo.pendingRects * kmsInfo.pendingCount) == 0) {
+      g_debug("%s: layout unchanged, not written.\n", __FUNCTION__);
+      free(kmsInfo.pendingRects);
+   } else if (ResolutionWriteToKernel(kmsInfo.pendingRects,
+                                      kmsInfo.pendingCount)) {
+      free(kmsInfo.lastRects);
+      kmsInfo.lastRects = kmsInfo.pendingRects;
+      kmsInfo.lastCount = kmsInfo.pendingCount;
+   } else {
+      g_warning("%s: writing the layout failed.\n", __FUNCTION__);
+      free(kmsInfo.pendingRects);
+   }
+
+   kmsInfo.pendingRects = NULL;
+   kmsInfo.pendingCount = 0;
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ResolutionCancelPending --
+ *
+ *     Drops the pending layout.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+ResolutionCancelPending(void)
+{
+   if (kmsInfo.pendingTimer != NULL) {
+      g_source_destroy(kmsInfo.pendingTimer);
+      g_source_unref(kmsInfo.pendingTimer);
+      kmsInfo.pendingTimer = NULL;
+   }
+   free(kmsInfo.pendingRects);
+   kmsInfo.pendingRects = NULL;
+   kmsInfo.pendingCount = 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ResolutionSetPending --
+ *
+ *     Replaces the pending layout, and restarts the debounce timer.
+ *
+ * Results:
+ *     None.
+ *
+ * Side effects:
+ *     The pending layout owns rects.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+ResolutionSetPending(struct drm_vmw_rect *rects, // IN: Screen rects
+                     unsigned int num_rects)     // IN: Number of rects
+{
+   ResolutionCancelPending();
+
+   kmsInfo.pendingRects = rects;
+   kmsInfo.pendingCount = num_rects;
+   kmsInfo.pendingTimer = g_timeout_source_new(RESOLUTION_KMS_DEBOUNCE_MS);
+   VMTOOLSAPP_ATTACH_SOURCE(kmsInfo.ctx, kmsInfo.pendingTimer,
+                            ResolutionWritePending, NULL, NULL);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -135,6 +257,7 @@ static gboolean
 ResolutionResolutionSetCB(RpcInData *data) // IN: The RPC data
 {
    struct drm_vmw_rect rect;
+   struct drm_vmw_rect *rects;
    unsigned int index = 0;
    gboolean retval = FALSE;
 
@@ -155,7 +278,14 @@ ResolutionResolutionSetCB(RpcInData *data) // IN: The RPC data
       goto invalid_arguments;
    }
 
-   retval = ResolutionWriteToKernel(&rect, 1);
+   rects = malloc(sizeof rect);
+   if (rects == NULL) {
+      return RPCIN_SETRETVALS(data, "Failed to alloc buffer for display info",
+                              FALSE);
+   }
+   *rects = rect;
+   ResolutionSetPending(rects, 1);
+   retval = TRUE;
 
 invalid_arguments:
    return RPCIN_SETRETVALS(data, retval ? "" : "Invalid arguments", retval);
@@ -236,8 +366,11 @@ ResolutionDisplayTopologySetCB(RpcInData *data)
       }
    }
 
-   success = ResolutionWriteToKernel(rects, count);
-   RPCIN_SETRETVALS(data, success ? "" : "ResolutionSetTopology failed", success);
+   /* The pending layout owns rects now. */
+   ResolutionSetPending(rects, count);
+   rects = NULL;
+   success = TRUE;
+   RPCIN_SETRETVALS(data, "", success);
 out:
    free(rects);
    return success;
@@ -330,6 +463,11 @@ ResolutionKMSShutdown(gpointer src,     // IN: Unused.
       ResolutionKMSServerCapability(ctx->rpc, 0);
    }
 
+   ResolutionCancelPending();
+   free(kmsInfo.lastRects);
+   kmsInfo.lastRects = NULL;
+   kmsInfo.lastCount = 0;
+
    if (kmsInfo.initialized) {
       resolutionDRMClose(kmsInfo.fd);
       kmsInfo.initialized = FALSE;
@@ -470,6 +608,7 @@ ToolsOnLoad(ToolsAppCtx *ctx)
       return NULL;
    }
    kmsInfo.initialized = TRUE;
+   kmsInfo.ctx = ctx;
 
    /*
     * Save the RPC channel name from the ToolsAppCtx so that we can use it later
@@ -149,7 +149,8 @@ static FILE *_ofile;
  */
 
 static void RandR12FreeInfo(RandR12Info *info);
-static RandR12Info *RandR12GetInfo(Display *display, Window rootWin);
+static RandR12Info *RandR12GetInfo(Display *display, Window rootWin,
+                                   Bool probe);
 static Bool RandR12CrtcDisable(Display *display, unsigned int ndisplays,
                                RandR12Info *info, unsigned int width,
                                unsigned int height);
@@ -235,6 +236,8 @@ RandR12FreeInfo(RandR12Info *info)     // IN/OUT the RandR12Info context
  *      Get the current X server configuration and info about outputs and
  *      crtcs. When done with the context, it should be freed using
  *      RandR12FreeInfo.
+ *      Unless probe is set, the configuration the server already knows is
+ *      used, which saves the server probing all the outputs.
  *
  * Results:
  *      A pointer to a RandR12Info context on success. NULL on failure.
@@ -249,7 +252,8 @@ RandR12FreeInfo(RandR12Info *info)     // IN/OUT the RandR12Info context
 
 static RandR12Info *
 RandR12GetInfo(Display *display,     // IN: Pointer to our display connection
-               Window rootWin)       // IN: ID of the root window
+               Window rootWin,       // IN: ID of the root window
+               Bool probe)           // IN: Whether to probe the outputs
 {
    unsigned int i, j, num, numVMWCrtc;
    XRROutputInfo *output;
@@ -268,7 +272,9 @@ RandR12GetInfo(Display *display,     // IN: Pointer to our display connection
       goto out_err;
    }
 
-   info->xrrRes = xrrRes = XRRGetScreenResources(display, rootWin);
+   info->xrrRes = xrrRes = probe ?
+      XRRGetScreenResources(display, rootWin) :
+      XRRGetScreenResourcesCurrent(display, rootWin);
    if (!xrrRes) {
       goto out_err;
    }
@@ -932,7 +938,7 @@ RandR12Revert(Display *display,    // IN: The display connection
       }
    }
 
-   *pInfo = RandR12GetInfo(display, rootWin);
+   *pInfo = RandR12GetInfo(display, rootWin, FALSE);
    if (*pInfo) {
       RandR12FreeInfo(info);
       info = *pInfo;
@@ -982,6 +988,7 @@ RandR12_SetTopology(Display *dpy,           // IN/OUT: The display connection
    Bool retVal = FALSE;
    unsigned int i;
    static unsigned long sequence = 0;
+   static unsigned int lastNDisplays = 0;
 
    LOG_START;
 
@@ -996,7 +1003,12 @@ RandR12_SetTopology(Display *dpy,           // IN/OUT: The display connection
       return FALSE;
    }
 
-   info = RandR12GetInfo(dpy, rootWin);
+   /*
+    * The outputs only need probing when displays are added or removed, not
+    * on every resize.
+    */
+
+   info = RandR12GetInfo(dpy, rootWin, ndisplays != lastNDisplays);
    if (!info) {
       g_warning("%s: Setup info struct failed.\n", __func__);
       return FALSE;
@@ -1038,6 +1050,7 @@ RandR12_SetTopology(Display *dpy,           // IN/OUT: The display connection
    }
 
    retVal = TRUE;
+   lastNDisplays = ndisplays;
 
  out_ungrab:
 
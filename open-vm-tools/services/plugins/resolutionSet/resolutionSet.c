@@ -51,6 +51,25 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
  */
 #define RESOLUTION_SET_CAPABILITIES_MAX 5
 
+/*
+ * Resizing the console window sends a request for every intermediate size.
+ * Requests are applied once none came for this long, in milliseconds, and
+ * only the last one is.
+ */
+#define RESOLUTION_SET_DEBOUNCE_MS 100
+
+/**
+ * A request waiting for RESOLUTION_SET_DEBOUNCE_MS to pass.
+ */
+typedef struct {
+   GSource *timer;                    // NULL if no request is pending.
+   Bool isTopology;                   // DisplayTopology_Set or Resolution_Set.
+   uint32 width;
+   uint32 height;
+   unsigned int ndisplays;
+   DisplayTopologyInfo *displays;
+} ResolutionPendingType;
+
 /*
  * Internal global variables
  */
@@ -66,6 +85,13 @@ static const char *rpcChannelName = NULL;
  */
 ResolutionInfoType resolutionInfo;
 
+/**
+ * The app context, to attach the debounce timer to.
+ */
+static ToolsAppCtx *resolutionCtx = NULL;
+
+static ResolutionPendingType resolutionPending;
+
 
 /*
  * Global function definitions
@@ -116,6 +142,105 @@ ResolutionCleanup(void)
 }
 
 
+/**
+ *
+ * Applies the pending request.
+ *
+ * @param[in] data Unused.
+ * @return FALSE, the timer is done.
+ */
+
+static gboolean
+ResolutionApplyPending(gpointer data)
+{
+   ResolutionPendingType *pending = &resolutionPending;
+   Bool success;
+
+   if (pending->timer == NULL) {
+      return FALSE;
+   }
+   g_source_unref(pending->timer);
+   pending->timer = NULL;
+
+   if (pending->isTopology) {
+      success = ResolutionSetTopology(pending->ndisplays, pending->displays);
+   } else {
+      success = ResolutionSetResolution(pending->width, pending->height);
+   }
+   if (!success) {
+      g_warning("%s: setting the %s failed.\n", __FUNCTION__,
+                pending->isTopology ? "topology" : "resolution");
+   }
+
+   free(pending->displays);
+   pending->displays = NULL;
+   return FALSE;
+}
+
+
+/**
+ *
+ * Applies the pending request now, e.g. before a request which is not
+ * debounced, or drops it.
+ *
+ * @param[in] apply Whether to apply or drop the request.
+ */
+
+static void
+ResolutionFlushPending(Bool apply)
+{
+   ResolutionPendingType *pending = &resolutionPending;
+
+   if (pending->timer == NULL) {
+      return;
+   }
+   g_source_destroy(pending->timer);
+   if (apply) {
+      ResolutionApplyPending(NULL);
+   } else {
+      g_source_unref(pending->timer);
+      pending->timer = NULL;
+      free(pending->displays);
+      pending->displays = NULL;
+   }
+}
+
+
+/**
+ *
+ * Replaces the pending request, and restarts the debounce timer.
+ *
+ * @param[in] isTopology  Whether this is a topology or resolution request.
+ * @param[in] width       Width of a resolution request.
+ * @param[in] height      Height of a resolution request.
+ * @param[in] ndisplays   Number of displays of a topology request.
+ * @param[in] displays    Displays of a topology request, owned by the
+ *                        pending request.
+ */
+
+static void
+ResolutionSetPending(Bool isTopology,
+                     uint32 width,
+                     uint32 height,
+                     unsigned int ndisplays,
+                     DisplayTopologyInfo *displays)
+{
+   ResolutionPendingType *pending = &resolutionPending;
+
+   ResolutionFlushPending(FALSE);
+
+   pending->isTopology = isTopology;
+   pending->width = width;
+   pending->height = height;
+   pending->ndisplays = ndisplays;
+   pending->displays = displays;
+
+   pending->timer = g_timeout_source_new(RESOLUTION_SET_DEBOUNCE_MS);
+   VMTOOLSAPP_ATTACH_SOURCE(resolutionCtx, pending->timer,
+                            ResolutionApplyPending, NULL, NULL);
+}
+
+
 /**
  *
  * Handler for TCLO 'Resolution_Set'.
@@ -150,7 +275,8 @@ ResolutionResolutionSetCB(RpcInData *data)
       goto invalid_arguments;
    }
 
-   retval = ResolutionSetResolution(width, height);
+   ResolutionSetPending(FALSE, width, height, 0, NULL);
+   retval = TRUE;
 
 invalid_arguments:
    return RPCIN_SETRETVALS(data, retval ? "" : "Invalid arguments", retval);
@@ -223,6 +349,8 @@ ResolutionDisplayTopologyModesSetCB(RpcInData *data)
 
    g_debug("%s: enter\n", __FUNCTION__);
 
+   ResolutionFlushPending(TRUE);
+
    /*
     * The argument string will look something like:
     *   <count> <screen> <cmd> [ , <w> <h> ] * count.
@@ -347,9 +475,12 @@ ResolutionDisplayTopologySetCB(RpcInData *data)
       }
    }
 
-   success = ResolutionSetTopology(count, displays);
+   /* The pending request owns displays now. */
+   ResolutionSetPending(TRUE, 0, 0, count, displays);
+   displays = NULL;
+   success = TRUE;
 
-   RPCIN_SETRETVALS(data, success ? "" : "ResolutionSetTopology failed", success);
+   RPCIN_SETRETVALS(data, "", success);
 
 out:
    free(displays);
@@ -370,6 +501,7 @@ ResolutionSetShutdown(gpointer src,
                       ToolsAppCtx *ctx,
                       gpointer data)
 {
+   ResolutionFlushPending(FALSE);
    ResolutionCleanup();
 }
 
@@ -578,6 +710,7 @@ ToolsOnLoad(ToolsAppCtx *ctx)
    }
 
    resInfo->initialized = FALSE;
+   resolutionCtx = ctx;
 
    /*
     * XXX move to some shared lib or plugin
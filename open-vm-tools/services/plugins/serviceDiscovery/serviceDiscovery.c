@@ -30,6 +30,7 @@
 #include "conf.h"
 #include "dynbuf.h"
 #include "escape.h"
+#include "guest_msg_def.h"
 #include "str.h"
 #include "util.h"
 #include "vm_atomic.h"
@@ -88,14 +89,6 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
 
 #else
 
-/*
- * keys for types of service data collected by plugin from Linux guest
- */
-#define LIN_KEY_NAME_PROCESSES "listening-process-info"
-#define LIN_KEY_NAME_CONNECTIONS "connection-info"
-#define LIN_KEY_NAME_PERFORMANCE_METRICS "listening-process-perf-metrics"
-#define LIN_KEY_NAME_VERSIONS "versions"
-
 /*
  * scripts used by plugin to collect from Linux guest
  */
@@ -113,9 +106,22 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
 #define SERVICE_DISCOVERY_CONF_DEFAULT_DISABLED_VALUE FALSE
 
 /*
- * Polling interval of service discovery plugin in milliseconds
+ * Default value for CONFNAME_SERVICEDISCOVERY_NATIVECOLLECTORS setting in
+ * tools configuration file.
  */
-#define SERVICE_DISCOVERY_POLL_INTERVAL 300000
+#define SERVICE_DISCOVERY_CONF_DEFAULT_NATIVE_COLLECTORS_VALUE TRUE
+
+/*
+ * Default value for CONFNAME_SERVICEDISCOVERY_SCRIPTTIMEOUT setting in
+ * tools configuration file, in seconds.
+ */
+#define SERVICE_DISCOVERY_CONF_DEFAULT_SCRIPT_TIMEOUT 60
+
+/*
+ * Default value for CONFNAME_SERVICEDISCOVERY_POLLINTERVAL setting in
+ * tools configuration file, in seconds.
+ */
+#define SERVICE_DISCOVERY_POLL_INTERVAL 300
 
 /*
  * Time shift for comparision of time read from the signal and
@@ -129,9 +135,10 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
 #define SERVICE_DISCOVERY_RPC_WAIT_TIME 100
 
 /*
- * Maximum number of keys that can be deleted by one operation
+ * Size of the key updates sent to Namespace DB in one RPC, below the
+ * maximum size of a guest RPC.
  */
-#define SERVICE_DISCOVERY_DELETE_CHUNK_SIZE 25
+#define SERVICE_DISCOVERY_WRITE_BATCH_SIZE (GUESTMSG_MAX_IN_SIZE - 1024)
 
 
 typedef struct {
@@ -139,6 +146,12 @@ typedef struct {
    gchar *val;
 } KeyNameValue;
 
+typedef struct {
+   guint numChunks;           // Chunks in Namespace DB.
+   Bool hasCount;             // Whether the chunk count is in Namespace DB.
+   GPtrArray *chunkHashes;    // gchar *, checksum of each chunk.
+} PublishedKey;
+
 #if defined(_WIN32)
 static KeyNameValue gKeyScripts[] = {
    { WIN_KEY_NAME_PROCESSES, WIN_SCRIPT_NAME_PROCESSES },
@@ -159,11 +172,21 @@ static KeyNameValue gKeyScripts[] = {
 #endif
 
 static GSource *gServiceDiscoveryTimeoutSource = NULL;
+static gint gServiceDiscoveryPollInterval = 0;
 static gint64 gLastWriteTime = 0;
 
 static GArray *gFullPaths = NULL;
 static volatile Bool gTaskSubmitted = FALSE;
 
+/*
+ * Checksums of the chunks written to Namespace DB, to only write the ones
+ * that changed, and the writes queued for the current cycle.
+ */
+static GHashTable *gPublishedKeys = NULL;
+static volatile Bool gResetPublishedKeys = FALSE;
+static DynBuf gPendingOps;
+static guint gNumPendingOps = 0;
+
 
 /*
  *****************************************************************************
@@ -242,74 +265,97 @@ SendRpcMessage(ToolsAppCtx *ctx,
 
 /*
  *****************************************************************************
- * WriteData --
+ * AppendSetKeyOp --
  *
- * Sends key-value update request to the Namespace DB.
+ * Appends a namespace-priv-set-keys operation setting or deleting a key.
  *
- * @param[in] ctx       Application context.
+ * The value written is prefixed with the time of the current write cycle.
+ *
+ * @param[in/out] buf   Buffer of the operations.
  * @param[in] key       Key sent to the Namespace DB
- * @param[in] value     Service data sent to the Namespace DB
+ * @param[in] data      Service data, NULL to delete the key
  * @param[in] len       Service data len
  *
+ * @retval TRUE  The operation was appended.
+ * @retval FALSE Out of memory.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+AppendSetKeyOp(DynBuf *buf,
+               const char *key,
+               const char *data,
+               size_t len)
+{
+   /*
+    * Each operation is <op>\0<key>\0<value>\0<oldVal>\0, we always want
+    * to set the value (op 0 == setAlways), clobbering anything already
+    * there. An empty value deletes the key.
+    */
+   if (!DynBuf_AppendString(buf, "0") ||
+       !DynBuf_AppendString(buf, key)) {
+      return FALSE;
+   }
+
+   if (data != NULL) {
+      gchar *timeStamp = g_strdup_printf("%" G_GINT64_FORMAT, gLastWriteTime);
+      Bool status = DynBuf_Append(buf, timeStamp, strlen(timeStamp)) &&
+                    DynBuf_Append(buf, ",", 1) &&
+                    DynBuf_Append(buf, data, len) &&
+                    DynBuf_Append(buf, "", 1);
+
+      g_free(timeStamp);
+      if (!status) {
+         return FALSE;
+      }
+   } else if (!DynBuf_Append(buf, "", 1)) {
+      return FALSE;
+   }
+
+   return DynBuf_Append(buf, "", 1);
+}
+
+
+/*
+ *****************************************************************************
+ * SendSetKeysRequest --
+ *
+ * Sends namespace-priv-set-keys operations to the Namespace DB in one RPC.
+ *
+ * @param[in] ctx       Application context.
+ * @param[in] ops       Operations built by AppendSetKeyOp().
+ * @param[in] numOps    Number of operations.
+ *
  * @retval TRUE  Namespace DB write over RPC succeeded.
  * @retval FALSE Namespace DB write over RPC failed.
  *
  *****************************************************************************
  */
 
-Bool
-WriteData(ToolsAppCtx *ctx,
-          const char *key,
-          const char *data,
-          const size_t len)
+static Bool
+SendSetKeysRequest(ToolsAppCtx *ctx,
+                   DynBuf *ops,
+                   guint numOps)
 {
    Bool status = FALSE;
    DynBuf buf;
-   gchar *timeStamp = NULL;
-
-   if (data != NULL) {
-      timeStamp = g_strdup_printf("%" G_GINT64_FORMAT, gLastWriteTime);
-   }
+   gchar *numOpsStr = g_strdup_printf("%u", numOps);
 
    DynBuf_Init(&buf);
 
    /*
     * Format is:
     *
-    * namespace-set-keys <namespace>\0<numOps>\0<op>\0<key>\0<value>\0<oldVal>
-    *
-    * We have just a single op, and want to always set the value, clobbering
-    * anything already there.
+    * namespace-set-keys <namespace>\0<numOps>\0<op>\0<key>\0<value>\0<oldVal>...
     */
    if (!DynBuf_Append(&buf, NSDB_PRIV_SET_KEYS_CMD,
                       strlen(NSDB_PRIV_SET_KEYS_CMD)) ||
        !DynBuf_Append(&buf, " ", 1) ||
        !DynBuf_AppendString(&buf, SERVICE_DISCOVERY_NAMESPACE_DB_NAME) ||
-       !DynBuf_AppendString(&buf, "1") || // numOps
-       !DynBuf_AppendString(&buf, "0") || // op 0 == setAlways
-       !DynBuf_AppendString(&buf, key)) {
-      g_warning("%s: Could not construct buffer header\n", __FUNCTION__);
-      goto out;
-   }
-
-   if (data != NULL) {
-      if (!DynBuf_Append(&buf, timeStamp, strlen(timeStamp)) ||
-          !DynBuf_Append(&buf, ",", 1) ||
-          !DynBuf_Append(&buf, data, len) ||
-          !DynBuf_Append(&buf, "", 1)) {
-         g_warning("%s: Could not construct write buffer\n", __FUNCTION__);
-         goto out;
-      }
-   } else {
-      if (!DynBuf_Append(&buf, "", 1)) {
-         g_warning("%s: Could not construct delete buffer\n", __FUNCTION__);
-         goto out;
-      }
-   }
-
-   if (!DynBuf_Append(&buf, "", 1)) {
-      g_warning("%s: Could not construct buffer footer\n", __FUNCTION__);
-      goto out;
+       !DynBuf_AppendString(&buf, numOpsStr) ||
+       !DynBuf_Append(&buf, DynBuf_Get(ops), DynBuf_GetSize(ops))) {
+      g_warning("%s: Could not construct request buffer\n", __FUNCTION__);
    } else {
       char *result = NULL;
       size_t resultLen;
@@ -317,19 +363,53 @@ WriteData(ToolsAppCtx *ctx,
       status = SendRpcMessage(ctx, DynBuf_Get(&buf), DynBuf_GetSize(&buf),
                               &result, &resultLen);
       if (!status) {
-         g_warning("%s: Failed to update %s, result: %s resultLen: %" FMTSZ
-                   "u\n", __FUNCTION__, key, (result != NULL) ?
+         g_warning("%s: Failed to update %u keys, result: %s resultLen: %"
+                   FMTSZ "u\n", __FUNCTION__, numOps, (result != NULL) ?
                    result : "(null)", resultLen);
       }
 
-      if (result != NULL) {
-         free(result);
-      }
+      free(result);
    }
 
-out:
    DynBuf_Destroy(&buf);
-   g_free(timeStamp);
+   g_free(numOpsStr);
+   return status;
+}
+
+
+/*
+ *****************************************************************************
+ * WriteData --
+ *
+ * Sends key-value update request to the Namespace DB.
+ *
+ * @param[in] ctx       Application context.
+ * @param[in] key       Key sent to the Namespace DB
+ * @param[in] value     Service data sent to the Namespace DB
+ * @param[in] len       Service data len
+ *
+ * @retval TRUE  Namespace DB write over RPC succeeded.
+ * @retval FALSE Namespace DB write over RPC failed.
+ *
+ *****************************************************************************
+ */
+
+Bool
+WriteData(ToolsAppCtx *ctx,
+          const char *key,
+          const char *data,
+          const size_t len)
+{
+   Bool status = FALSE;
+   DynBuf op;
+
+   DynBuf_Init(&op);
+   if (!AppendSetKeyOp(&op, key, data, len)) {
+      g_warning("%s: Could not construct write buffer\n", __FUNCTION__);
+   } else {
+      status = SendSetKeysRequest(ctx, &op, 1);
+   }
+   DynBuf_Destroy(&op);
 
    return status;
 }
@@ -337,13 +417,107 @@ out:
 
 /*
  *****************************************************************************
- * ReadData --
+ * FlushPendingWrites --
  *
- * Reads value from Namespace DB by given key.
+ * Sends the queued writes to the Namespace DB.
+ *
+ * A failed write leaves the published chunks unknown, so they are all
+ * written again by the next cycle.
+ *
+ * @param[in] ctx       Application context.
+ *
+ * @retval TRUE  Namespace DB write over RPC succeeded.
+ * @retval FALSE Namespace DB write over RPC failed.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+FlushPendingWrites(ToolsAppCtx *ctx)
+{
+   Bool status = TRUE;
+
+   if (gNumPendingOps > 0) {
+      g_debug("%s: Writing %u keys, %" FMTSZ "u bytes\n", __FUNCTION__,
+              gNumPendingOps, DynBuf_GetSize(&gPendingOps));
+      status = SendSetKeysRequest(ctx, &gPendingOps, gNumPendingOps);
+      if (!status) {
+         gResetPublishedKeys = TRUE;
+      }
+      DynBuf_SetSize(&gPendingOps, 0);
+      gNumPendingOps = 0;
+   }
+
+   return status;
+}
+
+
+/*
+ *****************************************************************************
+ * QueueWrite --
+ *
+ * Queues a key update, to be sent along with the others in as few RPCs as
+ * the size of a guest RPC allows.
+ *
+ * @param[in] ctx       Application context.
+ * @param[in] key       Key sent to the Namespace DB
+ * @param[in] data      Service data, NULL to delete the key
+ * @param[in] len       Service data len
+ *
+ * @retval TRUE  The write was queued.
+ * @retval FALSE Sending the previously queued writes failed.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+QueueWrite(ToolsAppCtx *ctx,
+           const char *key,
+           const char *data,
+           size_t len)
+{
+   Bool status = TRUE;
+   size_t size = DynBuf_GetSize(&gPendingOps);
+
+   if (!AppendSetKeyOp(&gPendingOps, key, data, len)) {
+      g_warning("%s: Could not construct write buffer\n", __FUNCTION__);
+      DynBuf_SetSize(&gPendingOps, size);
+      return FALSE;
+   }
+
+   if (DynBuf_GetSize(&gPendingOps) > SERVICE_DISCOVERY_WRITE_BATCH_SIZE &&
+       gNumPendingOps > 0) {
+      DynBuf op;
+
+      /*
+       * Send what was queued before, and keep this one for the next batch.
+       */
+      DynBuf_Init(&op);
+      DynBuf_Append(&op, (char *) DynBuf_Get(&gPendingOps) + size,
+                    DynBuf_GetSize(&gPendingOps) - size);
+      DynBuf_SetSize(&gPendingOps, size);
+      status = FlushPendingWrites(ctx);
+      DynBuf_Append(&gPendingOps, DynBuf_Get(&op), DynBuf_GetSize(&op));
+      DynBuf_Destroy(&op);
+   }
+   gNumPendingOps++;
+
+   return status;
+}
+
+
+/*
+ *****************************************************************************
+ * ReadValues --
+ *
+ * Reads the values of several keys from Namespace DB with one request.
  *
  * @param[in] ctx             Application context.
- * @param[in] key             Key sent to the Namespace DB
- * @param[out] resultData     Data fetched from Namespace DB, freed by callers
+ * @param[in] keys            Keys sent to the Namespace DB
+ * @param[in] numKeys         Number of keys
+ * @param[out] resultData     Values fetched from Namespace DB, each NUL
+ *                            terminated, in the order of the keys. Freed
+ *                            by callers
  * @param[out] resultDataLen  Length of data fetched from Namespace DB
  *
  * @retval TRUE  Namespace DB read over RPC succeeded.
@@ -353,15 +527,17 @@ out:
  */
 
 static Bool
-ReadData(ToolsAppCtx *ctx,
-         const char *key,
-         char **resultData,
-         size_t *resultDataLen)
+ReadValues(ToolsAppCtx *ctx,
+           const char * const *keys,
+           guint numKeys,
+           char **resultData,
+           size_t *resultDataLen)
 {
    DynBuf buf;
    Bool status = FALSE;
+   guint i;
 
-   ASSERT(key);
+   ASSERT(keys);
 
    *resultData = NULL;
    *resultDataLen = 0;
@@ -377,11 +553,16 @@ ReadData(ToolsAppCtx *ctx,
    if (!DynBuf_Append(&buf, NSDB_PRIV_GET_VALUES_CMD,
                       strlen(NSDB_PRIV_GET_VALUES_CMD)) ||
        !DynBuf_Append(&buf, " ", 1) ||
-       !DynBuf_AppendString(&buf, SERVICE_DISCOVERY_NAMESPACE_DB_NAME) ||
-       !DynBuf_AppendString(&buf, key)) {
+       !DynBuf_AppendString(&buf, SERVICE_DISCOVERY_NAMESPACE_DB_NAME)) {
       g_warning("%s: Could not construct request buffer\n", __FUNCTION__);
       goto done;
-    }
+   }
+   for (i = 0; i < numKeys; i++) {
+      if (!DynBuf_AppendString(&buf, keys[i])) {
+         g_warning("%s: Could not construct request buffer\n", __FUNCTION__);
+         goto done;
+      }
+   }
 
    status = SendRpcMessage(ctx, DynBuf_Get(&buf), DynBuf_GetSize(&buf),
                            resultData, resultDataLen);
@@ -398,114 +579,106 @@ done:
 
 /*
  *****************************************************************************
- * DeleteData --
+ * ReadData --
  *
- * Deletes keys/values from Namespace DB.
+ * Reads value from Namespace DB by given key.
  *
- * @param[in] ctx       Application context.
- * @param[in] keys      Keys of entries to be deleted from the Namespace DB
+ * @param[in] ctx             Application context.
+ * @param[in] key             Key sent to the Namespace DB
+ * @param[out] resultData     Data fetched from Namespace DB, freed by callers
+ * @param[out] resultDataLen  Length of data fetched from Namespace DB
  *
- * @retval TRUE  Namespace DB delete over RPC succeeded.
- * @retval FALSE Namespace DB delete over RPC failed or command buffer has not
- *               been constructed correctly.
+ * @retval TRUE  Namespace DB read over RPC succeeded.
+ * @retval FALSE Namespace DB read over RPC failed.
  *
  *****************************************************************************
  */
 
 static Bool
-DeleteData(ToolsAppCtx *ctx,
-           const GPtrArray* keys)
+ReadData(ToolsAppCtx *ctx,
+         const char *key,
+         char **resultData,
+         size_t *resultDataLen)
 {
-   Bool status = FALSE;
-   DynBuf buf;
-   int i;
-   gchar *numKeys = g_strdup_printf("%d", keys->len);
+   return ReadValues(ctx, &key, 1, resultData, resultDataLen);
+}
 
-   DynBuf_Init(&buf);
 
-   /*
-    * Format is:
-    *
-    * namespace-set-keys <namespace>\0<numOps>\0<op>\0<key>\0<value>\0<oldVal>
-    *
-    */
-   if (!DynBuf_Append(&buf, NSDB_PRIV_SET_KEYS_CMD,
-                      strlen(NSDB_PRIV_SET_KEYS_CMD)) ||
-       !DynBuf_Append(&buf, " ", 1) ||
-       !DynBuf_AppendString(&buf, SERVICE_DISCOVERY_NAMESPACE_DB_NAME) ||
-       !DynBuf_AppendString(&buf, numKeys)) { // numOps
-      g_warning("%s: Could not construct buffer header\n", __FUNCTION__);
-      goto out;
-   }
-   for (i = 0; i < keys->len; ++i) {
-      const char *key = (const char *) g_ptr_array_index(keys, i);
-      g_debug("%s: Adding key %s to buffer\n", __FUNCTION__, key);
-      if (!DynBuf_AppendString(&buf, "0") ||
-          !DynBuf_AppendString(&buf, key) ||
-          !DynBuf_Append(&buf, "", 1) ||
-          !DynBuf_Append(&buf, "", 1)) {
-         g_warning("%s: Could not construct delete buffer\n", __FUNCTION__);
-         goto out;
-      }
-   }
-   if (!DynBuf_Append(&buf, "", 1)) {
-      g_warning("%s: Could not construct buffer footer\n", __FUNCTION__);
-      goto out;
-   } else {
-      char *result = NULL;
-      size_t resultLen;
-
-      status = SendRpcMessage(ctx, DynBuf_Get(&buf), DynBuf_GetSize(&buf),
-                              &result, &resultLen);
-      if (!status) {
-         g_warning("%s: Failed to delete keys, result: %s resultLen: %" FMTSZ
-                   "u\n", __FUNCTION__, (result != NULL) ? result : "(null)",
-                   resultLen);
-      }
+/*
+ *****************************************************************************
+ * FreePublishedKey --
+ *
+ * Frees what is known of the chunks of a key.
+ *
+ * @param[in] data      The PublishedKey.
+ *
+ *****************************************************************************
+ */
 
-      free(result);
-   }
+static void
+FreePublishedKey(gpointer data)
+{
+   PublishedKey *published = data;
 
-out:
-   DynBuf_Destroy(&buf);
-   g_free(numKeys);
-   return status;
+   g_ptr_array_free(published->chunkHashes, TRUE);
+   g_free(published);
 }
 
 
 /*
  *****************************************************************************
- * DeleteDataAndFree --
+ * ParseChunkCount --
+ *
+ * Parses the "<timestamp>,<count>" value of a chunk count key.
  *
- * Deletes the specified keys in Namespace DB and frees memory
- * for every key.
+ * @param[in] key       Key of the chunk count.
+ * @param[in] value     Value read from Namespace DB, modified.
+ * @param[out] count    The count of chunks.
  *
- * @param[in] ctx           Application context.
- * @param[in/out] keys      Keys to be deleted.
+ * @retval TRUE  The value is a chunk count.
+ * @retval FALSE The key was not set or has an invalid value.
  *
  *****************************************************************************
  */
 
-static void
-DeleteDataAndFree(ToolsAppCtx *ctx,
-                  GPtrArray *keys) {
-   int j;
+static Bool
+ParseChunkCount(const char *key,
+                char *value,
+                guint *count)
+{
+   char *token;
 
-   if (!DeleteData(ctx, keys)) {
-      g_warning("%s: Failed to delete data\n", __FUNCTION__);
+   if (*value == '\0') {
+      g_debug("%s: Key %s not found in Namespace DB\n", __FUNCTION__, key);
+      return FALSE;
    }
-   for (j = 0; j < keys->len; ++j) {
-      g_free((gchar *) g_ptr_array_index(keys, j));
+
+   g_debug("%s: Read %s from Namespace DB\n", __FUNCTION__, value);
+
+   /*
+    * Read count of chunks, ignore timestamp.
+    */
+   if (NULL == strtok(value, ",")) {
+      g_warning("%s: Malformed data for %s in Namespace DB",
+                __FUNCTION__, key);
+   } else if ((token = strtok(NULL, ",")) != NULL) {
+      *count = (guint) g_ascii_strtoll(token, NULL, 10);
+      return TRUE;
+   } else {
+      g_warning("%s: Chunk count has invalid value %s", __FUNCTION__,
+                value);
    }
-   g_ptr_array_set_size(keys, 0);
+   return FALSE;
 }
 
 
 /*
  *****************************************************************************
- * CleanupNamespaceDB --
+ * ReadChunkCounts --
  *
- * Deletes all the chunks written to the Namespace DB in previous cycle.
+ * Reads the counts of chunks of all the keys from Namespace DB with one
+ * request, to find the chunks left by a previous instance of the plugin.
+ * The ones it wrote beyond our count must be deleted.
  *
  * @param[in] ctx       Application context.
  *
@@ -513,69 +686,146 @@ DeleteDataAndFree(ToolsAppCtx *ctx,
  */
 
 static void
-CleanupNamespaceDB(ToolsAppCtx *ctx) {
-   int i;
-   GPtrArray *keys = g_ptr_array_new();
+ReadChunkCounts(ToolsAppCtx *ctx)
+{
+   const char **keys = g_new(const char *, gFullPaths->len);
+   char *values = NULL;
+   size_t len = 0;
+   char *p = NULL;
+   guint i;
 
-   g_debug("%s: Performing cleanup of previous data\n", __FUNCTION__);
+   for (i = 0; i < gFullPaths->len; i++) {
+      keys[i] = g_array_index(gFullPaths, KeyNameValue, i).keyName;
+   }
 
-   ASSERT(gFullPaths);
+   if (ReadValues(ctx, keys, gFullPaths->len, &values, &len)) {
+      p = values;
+   }
 
    for (i = 0; i < gFullPaths->len; i++) {
-      char *value = NULL;
-      size_t len = 0;
-      KeyNameValue tmp = g_array_index(gFullPaths, KeyNameValue, i);
-      /*
-       * Read count of chunks, ignore timestamp, iterate over chunks
-       * and remove them.
-       */
-      if (ReadData(ctx, tmp.keyName, &value, &len) && len > 1) {
-         char *token = NULL;
-         g_debug("%s: Read %s from Namespace DB\n", __FUNCTION__, value);
+      PublishedKey *published = g_new0(PublishedKey, 1);
 
-         g_ptr_array_add(keys, g_strdup(tmp.keyName));
-         if (keys->len >= SERVICE_DISCOVERY_DELETE_CHUNK_SIZE) {
-            DeleteDataAndFree(ctx, keys);
-         }
+      published->chunkHashes = g_ptr_array_new_with_free_func(g_free);
+      if (p != NULL && p < values + len) {
+         char *next = p + strlen(p) + 1;
 
-         if (NULL == strtok(value, ",")) {
-            g_warning("%s: Malformed data for %s in Namespace DB",
-                      __FUNCTION__, tmp.keyName);
-            if (value) {
-               free(value);
-               value = NULL;
-            }
+         published->hasCount = ParseChunkCount(keys[i], p,
+                                               &published->numChunks);
+         p = next;
+      }
+      g_hash_table_insert(gPublishedKeys, g_strdup(keys[i]), published);
+   }
+
+   free(values);
+   g_free(keys);
+}
+
+
+/*
+ *****************************************************************************
+ * PublishDataToNamespaceDB --
+ *
+ * Writes service data to Namespace DB in chunks.
+ *
+ * Chunk count will be written to Namespace DB using received
+ * "key" (ie. get-listening-process-info).
+ *
+ * Chunks will be written to Namespace DB with keys constructed by "key-[i]"
+ * template (ie. get-listening-process-info-1, get-listening-process-info-2)
+ *
+ * Only the chunks whose content changed since the previous cycle are
+ * written, along with the chunk count. The chunks beyond the new count are
+ * deleted. The writes are queued, and sent by FlushPendingWrites().
+ *
+ * @param[in] ctx             Application context.
+ * @param[in] key             Key used for chunk count
+ * @param[in] data            Data to be written
+ * @param[in] len             Length of the data, 0 to delete the key
+ *
+ * @retval TRUE  Namespace DB write over RPC succeeded.
+ * @retval FALSE Either the data was empty or Namespace DB write failed.
+ *
+ *****************************************************************************
+ */
+
+Bool
+PublishDataToNamespaceDB(ToolsAppCtx *ctx,
+                         const char *key,
+                         const char *data,
+                         size_t len)
+{
+   Bool status = TRUE;
+   PublishedKey *published = g_hash_table_lookup(gPublishedKeys, key);
+   guint numChunks = (len + SERVICE_DISCOVERY_VALUE_MAX_SIZE - 1) /
+                     SERVICE_DISCOVERY_VALUE_MAX_SIZE;
+   guint numWritten = 0;
+   guint i;
+
+   if (published == NULL) {
+      published = g_new0(PublishedKey, 1);
+      published->chunkHashes = g_ptr_array_new_with_free_func(g_free);
+      g_hash_table_insert(gPublishedKeys, g_strdup(key), published);
+   }
+
+   for (i = 0; i < numChunks && status; i++) {
+      size_t offset = i * SERVICE_DISCOVERY_VALUE_MAX_SIZE;
+      size_t chunkLen = MIN(len - offset, SERVICE_DISCOVERY_VALUE_MAX_SIZE);
+      gchar *hash = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                                (const guchar *) data + offset,
+                                                chunkLen);
+      gchar *msg;
+
+      if (i < published->chunkHashes->len) {
+         gchar **known = (gchar **) &g_ptr_array_index(published->chunkHashes,
+                                                       i);
+
+         if (*known != NULL && strcmp(*known, hash) == 0) {
+            g_free(hash);
             continue;
          }
-         token = strtok(NULL, ",");
-         if (token != NULL) {
-            int count = (int) g_ascii_strtoll(token, NULL, 10);
-            int j;
-
-            for (j = 0; j < count; j++) {
-               gchar *msg = g_strdup_printf("%s-%d", tmp.keyName, j + 1);
-               g_ptr_array_add(keys, msg);
-               if (keys->len >= SERVICE_DISCOVERY_DELETE_CHUNK_SIZE) {
-                  DeleteDataAndFree(ctx, keys);
-               }
-            }
-         } else {
-            g_warning("%s: Chunk count has invalid value %s", __FUNCTION__,
-                      value);
-         }
+         g_free(*known);
+         *known = hash;
       } else {
-         g_warning("%s: Key %s not found in Namespace DB\n", __FUNCTION__,
-                   tmp.keyName);
-      }
-      if (value) {
-         free(value);
-         value = NULL;
+         g_ptr_array_add(published->chunkHashes, hash);
       }
+
+      msg = g_strdup_printf("%s-%u", key, i + 1);
+      status = QueueWrite(ctx, msg, data + offset, chunkLen);
+      g_free(msg);
+      numWritten++;
+   }
+
+   if (published->chunkHashes->len > numChunks) {
+      g_ptr_array_set_size(published->chunkHashes, numChunks);
+   }
+
+   for (i = numChunks; i < published->numChunks && status; i++) {
+      gchar *msg = g_strdup_printf("%s-%u", key, i + 1);
+
+      status = QueueWrite(ctx, msg, NULL, 0);
+      g_free(msg);
    }
-   if (keys->len >= 1) {
-      DeleteDataAndFree(ctx, keys);
+
+   if (status && numChunks > 0) {
+      gchar *chunkCount = g_strdup_printf("%u", numChunks);
+
+      status = QueueWrite(ctx, key, chunkCount, strlen(chunkCount));
+      g_free(chunkCount);
+   } else if (status && published->hasCount) {
+      status = QueueWrite(ctx, key, NULL, 0);
+   }
+
+   if (status) {
+      g_debug("%s: Queued key %s with %u of %u chunks changed\n",
+              __FUNCTION__, key, numWritten, numChunks);
+   } else {
+      g_warning("%s: Was not able to store data\n", __FUNCTION__);
    }
-   g_ptr_array_free(keys, TRUE);
+
+   published->numChunks = numChunks;
+   published->hasCount = numChunks > 0;
+
+   return status && numChunks > 0;
 }
 
 
@@ -598,6 +848,12 @@ ServiceDiscoveryTask(ToolsAppCtx *ctx,
    Bool status = FALSE;
    int i;
    gint64 previousWriteTime = gLastWriteTime;
+   gint64 cycleStart = g_get_monotonic_time();
+#if !defined(_WIN32)
+   ProcSnapshot *snap = NULL;
+   GPtrArray *runs;
+   gint scriptTimeout;
+#endif
 
    gTaskSubmitted = TRUE;
 
@@ -618,10 +874,38 @@ ServiceDiscoveryTask(ToolsAppCtx *ctx,
    }
 
    /*
-    * Remove chunks written to DB in the previous iteration
+    * Write everything again if Namespace DB may have lost the chunks.
+    */
+   if (gPublishedKeys == NULL || gResetPublishedKeys) {
+      if (gPublishedKeys != NULL) {
+         g_hash_table_destroy(gPublishedKeys);
+      }
+      gPublishedKeys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                             FreePublishedKey);
+      gResetPublishedKeys = FALSE;
+      ReadChunkCounts(ctx);
+   }
+   DynBuf_Init(&gPendingOps);
+   gNumPendingOps = 0;
+
+#if !defined(_WIN32)
+   /*
+    * The native collectors share one listing of the sockets and processes
+    * instead of each script running ss, ps and friends.
     */
-   CleanupNamespaceDB(ctx);
+   if (VMTools_ConfigGetBoolean(ctx->config,
+                                CONFGROUPNAME_SERVICEDISCOVERY,
+                                CONFNAME_SERVICEDISCOVERY_NATIVECOLLECTORS,
+                                SERVICE_DISCOVERY_CONF_DEFAULT_NATIVE_COLLECTORS_VALUE)) {
+      snap = TakeProcSnapshot();
+      if (snap == NULL) {
+         g_info("%s: Native collectors unavailable, running the scripts\n",
+                __FUNCTION__);
+      }
+   }
+#endif
 
+#if defined(_WIN32)
    for (i = 0; i < gFullPaths->len; i++) {
       KeyNameValue tmp = g_array_index(gFullPaths, KeyNameValue, i);
       if (!PublishScriptOutputToNamespaceDB(ctx, tmp.keyName, tmp.val)) {
@@ -629,15 +913,78 @@ ServiceDiscoveryTask(ToolsAppCtx *ctx,
                  __FUNCTION__, tmp.val);
       }
    }
+#else
+   /*
+    * Start all the scripts, run the native collectors while they run, then
+    * read what the scripts output. Each script has its own time budget, so
+    * a slow one does not delay the others.
+    */
+   scriptTimeout =
+      VMTools_ConfigGetInteger(ctx->config,
+                               CONFGROUPNAME_SERVICEDISCOVERY,
+                               CONFNAME_SERVICEDISCOVERY_SCRIPTTIMEOUT,
+                               SERVICE_DISCOVERY_CONF_DEFAULT_SCRIPT_TIMEOUT);
+   if (scriptTimeout <= 0) {
+      scriptTimeout = SERVICE_DISCOVERY_CONF_DEFAULT_SCRIPT_TIMEOUT;
+   }
+
+   runs = g_ptr_array_new();
+   for (i = 0; i < gFullPaths->len; i++) {
+      KeyNameValue tmp = g_array_index(gFullPaths, KeyNameValue, i);
+      ScriptRun *run;
+
+      if (snap != NULL && HasNativeCollector(tmp.keyName)) {
+         continue;
+      }
+
+      run = StartScript(tmp.keyName, tmp.val, scriptTimeout);
+      if (run != NULL) {
+         g_ptr_array_add(runs, run);
+      } else {
+         /*
+          * Do not leave the data of the previous cycle.
+          */
+         PublishDataToNamespaceDB(ctx, tmp.keyName, NULL, 0);
+      }
+   }
+
+   for (i = 0; snap != NULL && i < gFullPaths->len; i++) {
+      KeyNameValue tmp = g_array_index(gFullPaths, KeyNameValue, i);
+      gint64 collectStart = g_get_monotonic_time();
+      DynBuf out;
+
+      DynBuf_Init(&out);
+      if (CollectNativeOutput(snap, tmp.keyName, &out)) {
+         g_debug("%s: Collected %s in %" G_GINT64_FORMAT " ms\n",
+                 __FUNCTION__, tmp.keyName,
+                 (g_get_monotonic_time() - collectStart) / 1000);
+         if (!PublishDataToNamespaceDB(ctx, tmp.keyName, DynBuf_Get(&out),
+                                       DynBuf_GetSize(&out))) {
+            g_debug("%s: PublishDataToNamespaceDB failed for key %s\n",
+                    __FUNCTION__, tmp.keyName);
+         }
+      }
+      DynBuf_Destroy(&out);
+   }
+   FreeProcSnapshot(snap);
+
+   WaitForScripts(ctx, runs);
+   g_ptr_array_free(runs, TRUE);
+#endif
 
    /*
-    * Update ready flag
+    * Update ready flag, along with the last chunks
     */
-   status = WriteData(ctx, SERVICE_DISCOVERY_KEY_NAME_READY, "TRUE", 4);
+   status = QueueWrite(ctx, SERVICE_DISCOVERY_KEY_NAME_READY, "TRUE", 4) &&
+            FlushPendingWrites(ctx);
    if (!status) {
       g_warning("%s: Failed to update ready flag", __FUNCTION__);
    }
 
+   g_info("%s: Service data collected in %" G_GINT64_FORMAT " ms\n",
+          __FUNCTION__, (g_get_monotonic_time() - cycleStart) / 1000);
+   DynBuf_Destroy(&gPendingOps);
+
 out:
    gTaskSubmitted = FALSE;
 }
@@ -710,6 +1057,7 @@ checkForWrite(ToolsAppCtx *ctx)
                * Signal is outdated, reset the last write time
                */
                gLastWriteTime = 0;
+               gResetPublishedKeys = TRUE;
             }
 
             g_debug("%s: result=%s client interval = %d "
@@ -763,7 +1111,9 @@ ServiceDiscoveryThread(gpointer data)
               __FUNCTION__, gTaskSubmitted ? "True" : "False");
    } else {
       g_debug("%s: Submitting task to write\n", __FUNCTION__);
-      if (!ToolsCorePool_SubmitTask(ctx, ServiceDiscoveryTask, NULL, NULL)) {
+      if (!ToolsCorePool_SubmitPluginTask(ctx, "serviceDiscovery",
+                                          TOOLS_CORE_POOL_CLASS_BACKGROUND,
+                                          ServiceDiscoveryTask, NULL, NULL)) {
          g_warning("%s: failed to start information gather thread\n",
                    __FUNCTION__);
       }
@@ -777,7 +1127,8 @@ ServiceDiscoveryThread(gpointer data)
  *****************************************************************************
  * TweakDiscoveryLoop --
  *
- * @brief Start service discovery poll loop.
+ * @brief Start service discovery poll loop, or restart it when its interval
+ * changed.
  *
  * @param[in] ctx  The app context.
  *
@@ -787,9 +1138,31 @@ ServiceDiscoveryThread(gpointer data)
 static void
 TweakDiscoveryLoop(ToolsAppCtx *ctx)
 {
+   gint pollInterval =
+      VMTools_ConfigGetInteger(ctx->config,
+                               CONFGROUPNAME_SERVICEDISCOVERY,
+                               CONFNAME_SERVICEDISCOVERY_POLLINTERVAL,
+                               SERVICE_DISCOVERY_POLL_INTERVAL);
+
+   if (pollInterval <= 0) {
+      g_warning("%s: Invalid %s, using %d s.\n", __FUNCTION__,
+                CONFNAME_SERVICEDISCOVERY_POLLINTERVAL,
+                SERVICE_DISCOVERY_POLL_INTERVAL);
+      pollInterval = SERVICE_DISCOVERY_POLL_INTERVAL;
+   }
+
+   if (gServiceDiscoveryTimeoutSource != NULL &&
+       pollInterval != gServiceDiscoveryPollInterval) {
+      g_source_destroy(gServiceDiscoveryTimeoutSource);
+      gServiceDiscoveryTimeoutSource = NULL;
+   }
+
    if (gServiceDiscoveryTimeoutSource == NULL) {
+      gServiceDiscoveryPollInterval = pollInterval;
       gServiceDiscoveryTimeoutSource =
-                      g_timeout_source_new(SERVICE_DISCOVERY_POLL_INTERVAL);
+                      g_timeout_source_new_seconds(pollInterval);
+      ToolsCorePool_SetSourceClass(gServiceDiscoveryTimeoutSource,
+                                   TOOLS_CORE_POOL_CLASS_BACKGROUND);
       VMTOOLSAPP_ATTACH_SOURCE(ctx, gServiceDiscoveryTimeoutSource,
                                ServiceDiscoveryThread, ctx, NULL);
       g_source_unref(gServiceDiscoveryTimeoutSource);
@@ -825,6 +1198,7 @@ ServiceDiscoveryServerConfReload(gpointer src,
       TweakDiscoveryLoop(ctx);
    } else if (gServiceDiscoveryTimeoutSource != NULL) {
       gLastWriteTime = 0;
+      gResetPublishedKeys = TRUE;
       g_source_destroy(gServiceDiscoveryTimeoutSource);
       gServiceDiscoveryTimeoutSource = NULL;
       g_info("%s: Service discovery loop disabled\n", __FUNCTION__);
@@ -864,6 +1238,11 @@ ServiceDiscoveryServerShutdown(gpointer src,
       }
       g_array_free(gFullPaths, TRUE);
    }
+
+   if (gPublishedKeys != NULL) {
+      g_hash_table_destroy(gPublishedKeys);
+      gPublishedKeys = NULL;
+   }
 }
 
 
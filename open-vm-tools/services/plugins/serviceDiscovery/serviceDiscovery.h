@@ -30,6 +30,7 @@
 #include <stdlib.h>
 
 #include "vm_basic_types.h"
+#include "dynbuf.h"
 #include "vmware/tools/plugin.h"
 
 /*
@@ -37,9 +38,53 @@
  */
 #define SERVICE_DISCOVERY_VALUE_MAX_SIZE (1024*15)
 
+#if !defined(_WIN32)
+
+/*
+ * keys for types of service data collected by plugin from Linux guest
+ */
+#define LIN_KEY_NAME_PROCESSES "listening-process-info"
+#define LIN_KEY_NAME_CONNECTIONS "connection-info"
+#define LIN_KEY_NAME_PERFORMANCE_METRICS "listening-process-perf-metrics"
+#define LIN_KEY_NAME_VERSIONS "versions"
+
+/*
+ * Sockets and processes of the guest, shared by the native collectors of
+ * one discovery cycle.
+ */
+typedef struct ProcSnapshot ProcSnapshot;
+
+ProcSnapshot *TakeProcSnapshot(void);
+void FreeProcSnapshot(ProcSnapshot *snap);
+Bool HasNativeCollector(const char *key);
+Bool CollectNativeOutput(const ProcSnapshot *snap,
+                         const char *key,
+                         DynBuf *out);
+
+/*
+ * A script running in the background.
+ */
+typedef struct ScriptRun ScriptRun;
+
+ScriptRun *StartScript(const char *key,
+                       const char *script,
+                       guint timeout);
+void WaitForScripts(ToolsAppCtx *ctx,
+                    GPtrArray *runs);
+
+#else
+
 Bool PublishScriptOutputToNamespaceDB(ToolsAppCtx *ctx,
                                       const char *key,
                                       const char *script);
+
+#endif
+
+Bool PublishDataToNamespaceDB(ToolsAppCtx *ctx,
+                              const char *key,
+                              const char *data,
+                              size_t len);
+
 Bool WriteData(ToolsAppCtx *ctx,
                const char *key,
                const char *data,
@@ -0,0 +1,1073 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * serviceDiscoveryLinux.c --
+ *
+ * Native collectors for the service data of a Linux guest, producing the
+ * same output as the scripts they replace:
+ *
+ *   listening-process-info          get-listening-process-info.sh
+ *   connection-info                 get-connection-info.sh
+ *   listening-process-perf-metrics  get-listening-process-perf-metrics.sh
+ *
+ * The TCP and UDP sockets are listed with sock_diag netlink, and their
+ * owners found by a single pass over /proc, which all the collectors of a
+ * cycle share. The versions are still collected by get-versions.sh, as
+ * they come from running the discovered binaries.
+ */
+
+#ifndef __linux__
+#   error This file should not be compiled.
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <linux/netlink.h>
+#include <linux/sock_diag.h>
+#include <linux/inet_diag.h>
+
+#include "serviceDiscovery.h"
+#include "vmware.h"
+#include "dynbuf.h"
+#include "str.h"
+#include "util.h"
+
+/*
+ * Interval between the two CPU and IO samples of the performance metrics,
+ * in seconds, as in get-listening-process-perf-metrics.sh.
+ */
+#define PERF_METRICS_SAMPLE_INTERVAL 1
+
+typedef struct SocketUser {
+   pid_t pid;
+   int fd;
+} SocketUser;
+
+typedef struct SocketInfo {
+   uint8 family;
+   uint8 protocol;
+   uint8 state;
+   uint32 ifIndex;
+   uint32 recvQ;
+   uint32 sendQ;
+   uint16 localPort;
+   uint16 peerPort;
+   uint8 localAddr[16];
+   uint8 peerAddr[16];
+   uint32 inode;
+   GArray *users;             // SocketUser
+} SocketInfo;
+
+typedef struct ProcInfo {
+   pid_t pid;
+   pid_t ppid;
+   char comm[32];
+} ProcInfo;
+
+struct ProcSnapshot {
+   GArray *sockets;           // SocketInfo, in the order of ss.
+   GHashTable *inodes;        // inode -> index in sockets + 1
+   GHashTable *procs;         // pid -> ProcInfo
+   GArray *listeningPids;     // pid_t, ascending
+};
+
+
+/*
+ *****************************************************************************
+ * QuerySockets --
+ *
+ * Lists the sockets of a family and protocol with sock_diag netlink.
+ *
+ * @param[in] snap          The snapshot.
+ * @param[in] family        AF_INET or AF_INET6.
+ * @param[in] protocol      IPPROTO_TCP or IPPROTO_UDP.
+ *
+ * @retval TRUE  The sockets were listed.
+ * @retval FALSE sock_diag is not available.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+QuerySockets(ProcSnapshot *snap,
+             uint8 family,
+             uint8 protocol)
+{
+   struct {
+      struct nlmsghdr hdr;
+      struct inet_diag_req_v2 req;
+   } request;
+   char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+   Bool done = FALSE;
+   Bool status = FALSE;
+   int fd;
+
+   fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+   if (fd < 0) {
+      g_debug("%s: Failed to open a sock_diag socket, errno=%d\n",
+              __FUNCTION__, errno);
+      return FALSE;
+   }
+
+   memset(&request, 0, sizeof request);
+   request.hdr.nlmsg_len = sizeof request;
+   request.hdr.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+   request.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+   request.req.sdiag_family = family;
+   request.req.sdiag_protocol = protocol;
+   request.req.idiag_states = ~0U;
+
+   if (send(fd, &request, sizeof request, 0) != sizeof request) {
+      g_debug("%s: Failed to send the sock_diag request, errno=%d\n",
+              __FUNCTION__, errno);
+      goto out;
+   }
+
+   while (!done) {
+      ssize_t len = recv(fd, buf, sizeof buf, 0);
+      struct nlmsghdr *hdr;
+      int remaining;
+
+      if (len < 0 && errno == EINTR) {
+         continue;
+      }
+      if (len <= 0) {
+         g_debug("%s: Failed to read the sock_diag reply, errno=%d\n",
+                 __FUNCTION__, errno);
+         goto out;
+      }
+
+      remaining = len;
+      for (hdr = (struct nlmsghdr *)buf;
+           NLMSG_OK(hdr, remaining);
+           hdr = NLMSG_NEXT(hdr, remaining)) {
+         struct inet_diag_msg *msg = NLMSG_DATA(hdr);
+         SocketInfo sock;
+
+         if (hdr->nlmsg_type == NLMSG_DONE) {
+            done = TRUE;
+            break;
+         }
+         if (hdr->nlmsg_type == NLMSG_ERROR) {
+            g_debug("%s: sock_diag failed for family %u protocol %u\n",
+                    __FUNCTION__, family, protocol);
+            goto out;
+         }
+         if (hdr->nlmsg_len < NLMSG_LENGTH(sizeof *msg)) {
+            continue;
+         }
+
+         memset(&sock, 0, sizeof sock);
+         sock.family = msg->idiag_family;
+         sock.protocol = protocol;
+         sock.state = msg->idiag_state;
+         sock.ifIndex = msg->id.idiag_if;
+         sock.recvQ = msg->idiag_rqueue;
+         sock.sendQ = msg->idiag_wqueue;
+         sock.localPort = ntohs(msg->id.idiag_sport);
+         sock.peerPort = ntohs(msg->id.idiag_dport);
+         memcpy(sock.localAddr, msg->id.idiag_src, sizeof sock.localAddr);
+         memcpy(sock.peerAddr, msg->id.idiag_dst, sizeof sock.peerAddr);
+         sock.inode = msg->idiag_inode;
+         g_array_append_val(snap->sockets, sock);
+      }
+   }
+   status = TRUE;
+
+out:
+   close(fd);
+   return status;
+}
+
+
+/*
+ *****************************************************************************
+ * ReadProcFile --
+ *
+ * Reads a small /proc file relative to a process directory.
+ *
+ * @param[in] pidFd         The process directory.
+ * @param[in] name          The file.
+ * @param[out] buf          Buffer for the NUL-terminated content.
+ * @param[in] size          Size of the buffer.
+ *
+ * @retval Number of bytes read, -1 on error.
+ *
+ *****************************************************************************
+ */
+
+static ssize_t
+ReadProcFile(int pidFd,
+             const char *name,
+             char *buf,
+             size_t size)
+{
+   ssize_t len;
+   int fd = openat(pidFd, name, O_RDONLY | O_CLOEXEC);
+
+   if (fd < 0) {
+      return -1;
+   }
+   len = read(fd, buf, size - 1);
+   close(fd);
+   if (len >= 0) {
+      buf[len] = '\0';
+   }
+   return len;
+}
+
+
+/*
+ *****************************************************************************
+ * ScanProcessSockets --
+ *
+ * Records a process as a user of the listed sockets it has open.
+ *
+ * @param[in] snap          The snapshot.
+ * @param[in] pidFd         The process directory.
+ * @param[in] pid           The process.
+ *
+ *****************************************************************************
+ */
+
+static void
+ScanProcessSockets(ProcSnapshot *snap,
+                   int pidFd,
+                   pid_t pid)
+{
+   struct dirent *ent;
+   DIR *dir;
+   int fdDirFd = openat(pidFd, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+   if (fdDirFd < 0) {
+      return;
+   }
+   dir = fdopendir(fdDirFd);
+   if (dir == NULL) {
+      close(fdDirFd);
+      return;
+   }
+
+   while ((ent = readdir(dir)) != NULL) {
+      char link[64];
+      ssize_t len;
+      unsigned long inode;
+      gpointer index;
+
+      if (ent->d_name[0] == '.') {
+         continue;
+      }
+      len = readlinkat(fdDirFd, ent->d_name, link, sizeof link - 1);
+      if (len <= 0) {
+         continue;
+      }
+      link[len] = '\0';
+      if (sscanf(link, "socket:[%lu]", &inode) != 1) {
+         continue;
+      }
+
+      index = g_hash_table_lookup(snap->inodes, GUINT_TO_POINTER(inode));
+      if (index != NULL) {
+         SocketInfo *sock = &g_array_index(snap->sockets, SocketInfo,
+                                           GPOINTER_TO_UINT(index) - 1);
+         SocketUser user;
+
+         user.pid = pid;
+         user.fd = atoi(ent->d_name);
+         if (sock->users == NULL) {
+            sock->users = g_array_new(FALSE, FALSE, sizeof (SocketUser));
+         }
+         g_array_append_val(sock->users, user);
+      }
+   }
+
+   closedir(dir);
+}
+
+
+/*
+ *****************************************************************************
+ * ScanProcesses --
+ *
+ * Reads the parent and the name of each process, and which of the listed
+ * sockets it has open.
+ *
+ * @param[in] snap          The snapshot.
+ *
+ * @retval TRUE  The processes were scanned.
+ * @retval FALSE /proc could not be read.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+ScanProcesses(ProcSnapshot *snap)
+{
+   struct dirent *ent;
+   DIR *dir = opendir("/proc");
+
+   if (dir == NULL) {
+      g_warning("%s: Failed to open /proc, errno=%d\n", __FUNCTION__, errno);
+      return FALSE;
+   }
+
+   while ((ent = readdir(dir)) != NULL) {
+      char stat[1024];
+      char *nameEnd;
+      ProcInfo *proc;
+      pid_t pid;
+      int pidFd;
+
+      if (ent->d_name[0] < '1' || ent->d_name[0] > '9') {
+         continue;
+      }
+      pid = atoi(ent->d_name);
+
+      pidFd = openat(dirfd(dir), ent->d_name,
+                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (pidFd < 0) {
+         continue;
+      }
+
+      /*
+       * The name may contain spaces and parentheses, it ends at the last
+       * ')' of "pid (name) state ppid ...".
+       */
+      if (ReadProcFile(pidFd, "stat", stat, sizeof stat) <= 0 ||
+          (nameEnd = strrchr(stat, ')')) == NULL ||
+          strchr(stat, '(') == NULL) {
+         close(pidFd);
+         continue;
+      }
+
+      proc = g_new0(ProcInfo, 1);
+      proc->pid = pid;
+      *nameEnd = '\0';
+      Str_Strcpy(proc->comm, strchr(stat, '(') + 1, sizeof proc->comm);
+      sscanf(nameEnd + 1, " %*c %d", &proc->ppid);
+      g_hash_table_insert(snap->procs, GINT_TO_POINTER(pid), proc);
+
+      ScanProcessSockets(snap, pidFd, pid);
+      close(pidFd);
+   }
+
+   closedir(dir);
+   return TRUE;
+}
+
+
+/*
+ *****************************************************************************
+ * ComparePids --
+ *
+ * Compare function for sorting pids in ascending order.
+ *
+ *****************************************************************************
+ */
+
+static gint
+ComparePids(gconstpointer a,
+            gconstpointer b)
+{
+   pid_t pidA = *(const pid_t *) a;
+   pid_t pidB = *(const pid_t *) b;
+
+   return pidA < pidB ? -1 : pidA > pidB;
+}
+
+
+/*
+ *****************************************************************************
+ * TakeProcSnapshot --
+ *
+ * Lists the TCP and UDP sockets with their owners, and the processes.
+ *
+ * @retval The snapshot, to be freed with FreeProcSnapshot().
+ *         NULL if the sockets or the processes cannot be listed.
+ *
+ *****************************************************************************
+ */
+
+ProcSnapshot *
+TakeProcSnapshot(void)
+{
+   static const struct {
+      uint8 protocol;
+      uint8 family;
+   } queries[] = {
+      { IPPROTO_UDP, AF_INET },
+      { IPPROTO_UDP, AF_INET6 },
+      { IPPROTO_TCP, AF_INET },
+      { IPPROTO_TCP, AF_INET6 },
+   };
+   ProcSnapshot *snap = g_new0(ProcSnapshot, 1);
+   GHashTable *listening;
+   GHashTableIter iter;
+   gpointer pid;
+   guint i;
+
+   snap->sockets = g_array_new(FALSE, FALSE, sizeof (SocketInfo));
+   snap->inodes = g_hash_table_new(NULL, NULL);
+   snap->procs = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+   snap->listeningPids = g_array_new(FALSE, FALSE, sizeof (pid_t));
+
+   for (i = 0; i < ARRAYSIZE(queries); i++) {
+      if (!QuerySockets(snap, queries[i].family, queries[i].protocol)) {
+         FreeProcSnapshot(snap);
+         return NULL;
+      }
+   }
+
+   for (i = 0; i < snap->sockets->len; i++) {
+      SocketInfo *sock = &g_array_index(snap->sockets, SocketInfo, i);
+
+      if (sock->inode != 0) {
+         g_hash_table_insert(snap->inodes, GUINT_TO_POINTER(sock->inode),
+                             GUINT_TO_POINTER(i + 1));
+      }
+   }
+
+   if (!ScanProcesses(snap)) {
+      FreeProcSnapshot(snap);
+      return NULL;
+   }
+
+   /*
+    * The listening processes are the owners of the TCP sockets in the
+    * LISTEN state and of the unconnected UDP sockets, as "ss -lntup".
+    */
+   listening = g_hash_table_new(NULL, NULL);
+   for (i = 0; i < snap->sockets->len; i++) {
+      SocketInfo *sock = &g_array_index(snap->sockets, SocketInfo, i);
+      guint j;
+
+      if (sock->users == NULL ||
+          sock->state != (sock->protocol == IPPROTO_TCP ? TCP_LISTEN
+                                                         : TCP_CLOSE)) {
+         continue;
+      }
+      for (j = 0; j < sock->users->len; j++) {
+         g_hash_table_add(listening, GINT_TO_POINTER(
+                          g_array_index(sock->users, SocketUser, j).pid));
+      }
+   }
+
+   g_hash_table_iter_init(&iter, listening);
+   while (g_hash_table_iter_next(&iter, &pid, NULL)) {
+      pid_t value = GPOINTER_TO_INT(pid);
+
+      g_array_append_val(snap->listeningPids, value);
+   }
+   g_array_sort(snap->listeningPids, ComparePids);
+   g_hash_table_destroy(listening);
+
+   g_debug("%s: %u sockets, %u processes, %u listening\n", __FUNCTION__,
+           snap->sockets->len, g_hash_table_size(snap->procs),
+           snap->listeningPids->len);
+   return snap;
+}
+
+
+/*
+ *****************************************************************************
+ * FreeProcSnapshot --
+ *
+ * Frees a snapshot.
+ *
+ * @param[in] snap          The snapshot.
+ *
+ *****************************************************************************
+ */
+
+void
+FreeProcSnapshot(ProcSnapshot *snap)
+{
+   guint i;
+
+   if (snap == NULL) {
+      return;
+   }
+
+   for (i = 0; i < snap->sockets->len; i++) {
+      SocketInfo *sock = &g_array_index(snap->sockets, SocketInfo, i);
+
+      if (sock->users != NULL) {
+         g_array_free(sock->users, TRUE);
+      }
+   }
+   g_array_free(snap->sockets, TRUE);
+   g_hash_table_destroy(snap->inodes);
+   g_hash_table_destroy(snap->procs);
+   g_array_free(snap->listeningPids, TRUE);
+   g_free(snap);
+}
+
+
+/*
+ *****************************************************************************
+ * IsListeningPid --
+ *
+ * @param[in] snap          The snapshot.
+ * @param[in] pid           The process.
+ *
+ * @retval TRUE if the process owns a listening socket.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+IsListeningPid(const ProcSnapshot *snap,
+               pid_t pid)
+{
+   return bsearch(&pid, snap->listeningPids->data, snap->listeningPids->len,
+                  sizeof (pid_t), (int (*)(const void *, const void *))
+                                  ComparePids) != NULL;
+}
+
+
+/*
+ *****************************************************************************
+ * CollectListeningProcesses --
+ *
+ * Describes the listening processes like
+ * "ps --pid <pids> -o pid=,ppid=,comm=,command=".
+ *
+ * @param[in] snap          The snapshot.
+ * @param[out] out          The output.
+ *
+ *****************************************************************************
+ */
+
+static void
+CollectListeningProcesses(const ProcSnapshot *snap,
+                          DynBuf *out)
+{
+   char pidMax[32];
+   int pidWidth = 5;
+   guint i;
+
+   /*
+    * ps aligns the pids on the number of digits of the largest one.
+    */
+   if (ReadProcFile(AT_FDCWD, "/proc/sys/kernel/pid_max", pidMax,
+                    sizeof pidMax) > 0) {
+      pidWidth = MAX(pidWidth, (int) strcspn(pidMax, "\n"));
+   }
+
+   for (i = 0; i < snap->listeningPids->len; i++) {
+      pid_t pid = g_array_index(snap->listeningPids, pid_t, i);
+      ProcInfo *proc = g_hash_table_lookup(snap->procs, GINT_TO_POINTER(pid));
+      char path[64];
+      char cmdLine[4096];
+      ssize_t len;
+      ssize_t j;
+      gchar *line;
+
+      if (proc == NULL) {
+         continue;
+      }
+
+      Str_Sprintf(path, sizeof path, "/proc/%d/cmdline", (int) pid);
+      len = ReadProcFile(AT_FDCWD, path, cmdLine, sizeof cmdLine);
+      /*
+       * Like ps, the arguments are separated by spaces and the control
+       * characters they contain are shown as spaces too.
+       */
+      for (j = 0; j < len; j++) {
+         if ((unsigned char) cmdLine[j] < 0x20 || cmdLine[j] == 0x7f) {
+            cmdLine[j] = ' ';
+         }
+      }
+      while (len > 0 && cmdLine[len - 1] == ' ') {
+         cmdLine[--len] = '\0';
+      }
+
+      if (len > 0) {
+         line = g_strdup_printf("%*d %*d %-15s %s\n", pidWidth, (int) pid,
+                                pidWidth, (int) proc->ppid, proc->comm,
+                                cmdLine);
+      } else {
+         line = g_strdup_printf("%*d %*d %-15s [%s]\n", pidWidth, (int) pid,
+                                pidWidth, (int) proc->ppid, proc->comm,
+                                proc->comm);
+      }
+      DynBuf_Append(out, line, strlen(line));
+      g_free(line);
+   }
+}
+
+
+/*
+ *****************************************************************************
+ * FormatEndpoint --
+ *
+ * Formats a socket address like ss -n.
+ *
+ * @param[in] sock          The socket.
+ * @param[in] addr          The address.
+ * @param[in] port          The port.
+ * @param[in] ifIndex       Interface the socket is bound to, 0 if none.
+ * @param[out] buf          The formatted address, with the port after ':'.
+ * @param[in] size          Size of buf.
+ *
+ *****************************************************************************
+ */
+
+static void
+FormatEndpoint(const SocketInfo *sock,
+               const uint8 *addr,
+               uint16 port,
+               uint32 ifIndex,
+               char *buf,
+               size_t size)
+{
+   char host[INET6_ADDRSTRLEN];
+   char ifName[IF_NAMESIZE + 1] = "";
+   char portStr[8] = "*";
+
+   inet_ntop(sock->family, addr, host, sizeof host);
+   if (ifIndex != 0 && if_indextoname(ifIndex, ifName + 1) != NULL) {
+      ifName[0] = '%';
+   }
+   if (port != 0) {
+      Str_Sprintf(portStr, sizeof portStr, "%u", port);
+   }
+
+   if (sock->family == AF_INET6) {
+      Str_Sprintf(buf, size, "[%s]%s:%s", host, ifName, portStr);
+   } else {
+      Str_Sprintf(buf, size, "%s%s:%s", host, ifName, portStr);
+   }
+}
+
+
+/*
+ *****************************************************************************
+ * CollectConnections --
+ *
+ * Describes the sockets of the listening processes like "ss -antup".
+ *
+ * @param[in] snap          The snapshot.
+ * @param[out] out          The output.
+ *
+ *****************************************************************************
+ */
+
+static void
+CollectConnections(const ProcSnapshot *snap,
+                   DynBuf *out)
+{
+   static const char *states[] = {
+      "UNKNOWN", "ESTAB", "SYN-SENT", "SYN-RECV", "FIN-WAIT-1", "FIN-WAIT-2",
+      "TIME-WAIT", "UNCONN", "CLOSE-WAIT", "LAST-ACK", "LISTEN", "CLOSING",
+   };
+   guint i;
+
+   for (i = 0; i < snap->sockets->len; i++) {
+      const SocketInfo *sock = &g_array_index(snap->sockets, SocketInfo, i);
+      char local[INET6_ADDRSTRLEN + IF_NAMESIZE + 16];
+      char peer[INET6_ADDRSTRLEN + IF_NAMESIZE + 16];
+      Bool listening = FALSE;
+      gchar *line;
+      guint j;
+
+      if (sock->users == NULL) {
+         continue;
+      }
+      for (j = 0; j < sock->users->len && !listening; j++) {
+         listening = IsListeningPid(snap,
+                        g_array_index(sock->users, SocketUser, j).pid);
+      }
+      if (!listening) {
+         continue;
+      }
+
+      FormatEndpoint(sock, sock->localAddr, sock->localPort, sock->ifIndex,
+                     local, sizeof local);
+      FormatEndpoint(sock, sock->peerAddr, sock->peerPort, 0,
+                     peer, sizeof peer);
+      line = g_strdup_printf("%-5s %-6s %-6u %-6u %20s %20s users:(",
+                             sock->protocol == IPPROTO_TCP ? "tcp" : "udp",
+                             sock->state < ARRAYSIZE(states) ?
+                             states[sock->state] : states[0],
+                             sock->recvQ, sock->sendQ, local, peer);
+      DynBuf_Append(out, line, strlen(line));
+      g_free(line);
+
+      for (j = 0; j < sock->users->len; j++) {
+         const SocketUser *user = &g_array_index(sock->users, SocketUser, j);
+         ProcInfo *proc = g_hash_table_lookup(snap->procs,
+                                              GINT_TO_POINTER(user->pid));
+
+         line = g_strdup_printf("%s(\"%s\",pid=%d,fd=%d)", j == 0 ? "" : ",",
+                                proc != NULL ? proc->comm : "",
+                                (int) user->pid, user->fd);
+         DynBuf_Append(out, line, strlen(line));
+         g_free(line);
+      }
+      DynBuf_Append(out, ")\n", 2);
+   }
+}
+
+
+/*
+ *****************************************************************************
+ * SumProcField --
+ *
+ * Sums a field of a /proc/<pid>/<file> over processes, like
+ * awk '/^<field>/{A+=$2} END {print A}'.
+ *
+ * @param[in] pids          The processes.
+ * @param[in] file          The file, e.g. "io".
+ * @param[in] fields        The fields, e.g. "read_bytes:".
+ * @param[in] numFields     Number of fields.
+ * @param[out] sums         The sum of each field.
+ *
+ * @retval FALSE if none of the files could be read.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+SumProcField(GArray *pids,
+             const char *file,
+             const char **fields,
+             guint numFields,
+             uint64 *sums)
+{
+   Bool found = FALSE;
+   guint i;
+   guint k;
+
+   for (k = 0; k < numFields; k++) {
+      sums[k] = 0;
+   }
+
+   for (i = 0; i < pids->len; i++) {
+      char path[64];
+      char line[256];
+      FILE *f;
+
+      Str_Sprintf(path, sizeof path, "/proc/%d/%s",
+                  (int) g_array_index(pids, pid_t, i), file);
+      f = fopen(path, "r");
+      if (f == NULL) {
+         continue;
+      }
+      found = TRUE;
+      while (fgets(line, sizeof line, f) != NULL) {
+         for (k = 0; k < numFields; k++) {
+            size_t len = strlen(fields[k]);
+
+            if (strncmp(line, fields[k], len) == 0) {
+               sums[k] += g_ascii_strtoull(line + len, NULL, 10);
+            }
+         }
+      }
+      fclose(f);
+   }
+
+   return found;
+}
+
+
+/*
+ *****************************************************************************
+ * AppendPerfSample --
+ *
+ * Appends the CPU and IO lines of each listening process group.
+ *
+ * @param[in] groups        The listening process and its children per group.
+ * @param[in] clockTicks    Clock ticks per second.
+ * @param[in] numCpus       Number of online CPUs.
+ * @param[out] out          The output.
+ *
+ *****************************************************************************
+ */
+
+static void
+AppendPerfSample(GPtrArray *groups,
+                 long clockTicks,
+                 long numCpus,
+                 DynBuf *out)
+{
+   static const char *ioFields[] = { "read_bytes:", "write_bytes:" };
+   guint i;
+
+   for (i = 0; i < groups->len; i++) {
+      GArray *pids = g_ptr_array_index(groups, i);
+      uint64 ticks = 0;
+      guint j;
+      gchar *line;
+
+      for (j = 0; j < pids->len; j++) {
+         char path[64];
+         char stat[1024];
+         unsigned long long times[4];
+         char *nameEnd;
+
+         Str_Sprintf(path, sizeof path, "/proc/%d/stat",
+                     (int) g_array_index(pids, pid_t, j));
+         if (ReadProcFile(AT_FDCWD, path, stat, sizeof stat) > 0 &&
+             (nameEnd = strrchr(stat, ')')) != NULL &&
+             sscanf(nameEnd + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u "
+                    "%*u %llu %llu %llu %llu", &times[0], &times[1],
+                    &times[2], &times[3]) == 4) {
+            ticks += times[0] + times[1] + times[2] + times[3];
+         }
+      }
+
+      /*
+       * utime + stime + cutime + cstime of the processes, as a percentage
+       * of all the CPUs over one interval.
+       */
+      line = g_strdup_printf("CPU: %d %g\n", (int) g_array_index(pids, pid_t, 0),
+                             (double) ticks /
+                             (PERF_METRICS_SAMPLE_INTERVAL * clockTicks) *
+                             100 / numCpus);
+      DynBuf_Append(out, line, strlen(line));
+      g_free(line);
+   }
+
+   for (i = 0; i < groups->len; i++) {
+      GArray *pids = g_ptr_array_index(groups, i);
+      uint64 sums[ARRAYSIZE(ioFields)];
+      gchar *line;
+
+      if (SumProcField(pids, "io", ioFields, ARRAYSIZE(ioFields), sums)) {
+         line = g_strdup_printf("IO: %d %"FMT64"u %"FMT64"u\n",
+                                (int) g_array_index(pids, pid_t, 0),
+                                sums[0], sums[1]);
+      } else {
+         line = g_strdup_printf("IO: %d\n", (int) g_array_index(pids, pid_t, 0));
+      }
+      DynBuf_Append(out, line, strlen(line));
+      g_free(line);
+   }
+}
+
+
+/*
+ *****************************************************************************
+ * ComparePidNames --
+ *
+ * Compare function for sorting pids as strings, like "sort -u".
+ *
+ *****************************************************************************
+ */
+
+static gint
+ComparePidNames(gconstpointer a,
+                gconstpointer b)
+{
+   char nameA[16];
+   char nameB[16];
+
+   Str_Sprintf(nameA, sizeof nameA, "%d", (int) *(const pid_t *) a);
+   Str_Sprintf(nameB, sizeof nameB, "%d", (int) *(const pid_t *) b);
+   return strcmp(nameA, nameB);
+}
+
+
+/*
+ *****************************************************************************
+ * CollectPerfMetrics --
+ *
+ * Samples the CPU and IO of each listening process and its children twice,
+ * then their memory, with the output of
+ * get-listening-process-perf-metrics.sh.
+ *
+ * @param[in] snap          The snapshot.
+ * @param[out] out          The output.
+ *
+ *****************************************************************************
+ */
+
+static void
+CollectPerfMetrics(const ProcSnapshot *snap,
+                   DynBuf *out)
+{
+   static const char *memFields[] = { "Pss:" };
+   long clockTicks = sysconf(_SC_CLK_TCK);
+   long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+   GArray *pids;
+   GPtrArray *groups;
+   GHashTableIter iter;
+   gpointer value;
+   guint i;
+
+   if (snap->listeningPids->len == 0) {
+      DynBuf_Append(out, "No process id has been provided.\n", 33);
+      return;
+   }
+   if (clockTicks <= 0 || numCpus <= 0) {
+      g_warning("%s: Failed to get the clock ticks or the number of CPUs\n",
+                __FUNCTION__);
+      return;
+   }
+
+   pids = g_array_sized_new(FALSE, FALSE, sizeof (pid_t),
+                            snap->listeningPids->len);
+   g_array_append_vals(pids, snap->listeningPids->data,
+                       snap->listeningPids->len);
+   g_array_sort(pids, ComparePidNames);
+
+   DynBuf_Append(out, "#PIDs: -", 8);
+
+   /*
+    * Each group is a listening process followed by its children.
+    */
+   groups = g_ptr_array_new();
+   for (i = 0; i < pids->len; i++) {
+      pid_t pid = g_array_index(pids, pid_t, i);
+      GArray *group = g_array_new(FALSE, FALSE, sizeof (pid_t));
+      char pidStr[16];
+      int len;
+
+      len = Str_Sprintf(pidStr, sizeof pidStr, " %d", (int) pid);
+      DynBuf_Append(out, pidStr, len);
+
+      g_array_append_val(group, pid);
+      g_hash_table_iter_init(&iter, snap->procs);
+      while (g_hash_table_iter_next(&iter, NULL, &value)) {
+         ProcInfo *proc = value;
+
+         if (proc->ppid == pid) {
+            g_array_append_val(group, proc->pid);
+         }
+      }
+      if (group->len > 1) {
+         g_array_sort(group, ComparePids);
+      }
+      g_ptr_array_add(groups, group);
+   }
+   DynBuf_Append(out, "\n", 1);
+
+   AppendPerfSample(groups, clockTicks, numCpus, out);
+   sleep(PERF_METRICS_SAMPLE_INTERVAL);
+   AppendPerfSample(groups, clockTicks, numCpus, out);
+
+   for (i = 0; i < groups->len; i++) {
+      GArray *group = g_ptr_array_index(groups, i);
+      uint64 pss;
+      gchar *line;
+
+      /*
+       * smaps_rollup has the sums of smaps, without a line per mapping.
+       */
+      if (SumProcField(group, "smaps_rollup", memFields, 1, &pss) ||
+          SumProcField(group, "smaps", memFields, 1, &pss)) {
+         line = g_strdup_printf("MEM: %d %"FMT64"u\n",
+                                (int) g_array_index(group, pid_t, 0), pss);
+      } else {
+         line = g_strdup_printf("MEM: %d\n",
+                                (int) g_array_index(group, pid_t, 0));
+      }
+      DynBuf_Append(out, line, strlen(line));
+      g_free(line);
+      g_array_free(group, TRUE);
+   }
+
+   g_ptr_array_free(groups, TRUE);
+   g_array_free(pids, TRUE);
+}
+
+
+typedef void (*NativeCollector)(const ProcSnapshot *snap, DynBuf *out);
+
+static const struct {
+   const char *key;
+   NativeCollector collect;
+} gNativeCollectors[] = {
+   { LIN_KEY_NAME_PROCESSES, CollectListeningProcesses },
+   { LIN_KEY_NAME_CONNECTIONS, CollectConnections },
+   { LIN_KEY_NAME_PERFORMANCE_METRICS, CollectPerfMetrics },
+};
+
+
+/*
+ *****************************************************************************
+ * HasNativeCollector --
+ *
+ * @param[in] key           Key of the data.
+ *
+ * @retval TRUE if the data of the key is collected natively.
+ *
+ *****************************************************************************
+ */
+
+Bool
+HasNativeCollector(const char *key)
+{
+   guint i;
+
+   for (i = 0; i < ARRAYSIZE(gNativeCollectors); i++) {
+      if (strcmp(key, gNativeCollectors[i].key) == 0) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+
+/*
+ *****************************************************************************
+ * CollectNativeOutput --
+ *
+ * Produces the output of the script of a key natively, if there is a
+ * native collector for it.
+ *
+ * @param[in] snap          The snapshot of the cycle.
+ * @param[in] key           Key of the data.
+ * @param[out] out          The output.
+ *
+ * @retval TRUE  The output was produced.
+ * @retval FALSE The script must be run.
+ *
+ *****************************************************************************
+ */
+
+Bool
+CollectNativeOutput(const ProcSnapshot *snap,
+                    const char *key,
+                    DynBuf *out)
+{
+   guint i;
+
+   for (i = 0; i < ARRAYSIZE(gNativeCollectors); i++) {
+      if (strcmp(key, gNativeCollectors[i].key) == 0) {
+         gNativeCollectors[i].collect(snap, out);
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
@@ -30,177 +30,369 @@
 #include "serviceDiscovery.h"
 #include "dynbuf.h"
 
-#include <stdio.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/poll.h>
+#include <sys/wait.h>
+
+/*
+ * How often to check whether a script that closed its output exited, in
+ * milliseconds.
+ */
+#define SERVICE_DISCOVERY_SCRIPT_REAP_INTERVAL 100
+
+struct ScriptRun {
+   gchar *key;
+   GPid pid;
+   int outFd;
+   int errFd;
+   DynBuf out;
+   DynBuf err;
+   gint64 startTime;          // Monotonic, in microseconds.
+   gint64 deadline;
+   gint64 endTime;
+   Bool running;
+   Bool timedOut;
+   int exitStatus;
+};
 
 
 /*
  *****************************************************************************
- * ReadFromHandle --
+ * ScriptChildSetup --
  *
- * Reads from handle and appends to provided buffer. Handle is closed inside the
- * function after read operation.
+ * Puts the script in its own process group, so that the commands it runs
+ * are killed with it when it times out.
  *
- * @param[in] h             handle.
- * @param[out] out          output buffer.
+ * @param[in] data          Unused.
  *
  *****************************************************************************
  */
 
 static void
-ReadFromHandle(gint h,
-               DynBuf* out)
+ScriptChildSetup(gpointer data)
 {
-   FILE* f = fdopen(h, "r");
-
-   if (f == NULL) {
-      g_warning("%s: Failed to create file stream, errno=%d",
-                __FUNCTION__, errno);
-      if (close(h) != 0) {
-         g_warning("%s: Failed to close file handle, errno=%d",
-                   __FUNCTION__, errno);
-      }
-   } else {
-      for (;;) {
-         size_t readBytes;
-         char buf[SERVICE_DISCOVERY_VALUE_MAX_SIZE];
-         readBytes = fread(buf, 1, sizeof(buf), f);
-         g_debug("%s: readBytes = %" G_GSSIZE_FORMAT "\n", __FUNCTION__,
-                 readBytes);
-
-         if (readBytes > 0) {
-            DynBuf_Append(out, buf, readBytes);
-         }
-
-         if (readBytes < sizeof(buf)) {
-            break;
-         }
-      }
-      if (fclose(f) != 0) {
-         g_warning("%s: Failed to close file stream, errno=%d",
-                   __FUNCTION__, errno);
-      }
-   }
+   setpgid(0, 0);
 }
 
 
 /*
  *****************************************************************************
- * PublishScriptOutputToNamespaceDB --
- *
- * Spawns child process for script, reads stdout from pipe, writes
- * generated chunks to Namespace DB.
- *
- * Chunk count will be written to Namespace DB using received
- * "key" (ie. get-listening-process-info).
+ * StartScript --
  *
- * Chunks will be written to Namespace DB with keys constructed by "key-[i]"
- * template (ie. get-listening-process-info-1, get-listening-process-info-2)
+ * Spawns child process for script, whose output is read by WaitForScripts().
  *
- * @param[in] ctx             Application context.
- * @param[in] key             Key used for chunk count
+ * @param[in] key             Key the output is written to.
  * @param[in] script          Script to be executed
+ * @param[in] timeout         Time the script may run, in seconds.
  *
- * @retval TRUE  Script execution and Namespace DB write over RPC succeeded.
- * @retval FALSE Either of script execution or Namespace DB write failed.
+ * @retval The run of the script, NULL if the script could not be spawned.
  *
  *****************************************************************************
  */
 
-Bool
-PublishScriptOutputToNamespaceDB(ToolsAppCtx *ctx,
-                                 const char *key,
-                                 const char *script)
+ScriptRun *
+StartScript(const char *key,
+            const char *script,
+            guint timeout)
 {
-   Bool status = FALSE;
-   Bool stdoutIsEmpty = TRUE;
+   ScriptRun *run;
    GPid pid;
    gchar *command = g_strdup(script);
    gchar *cmd[] = { command, NULL };
    gint child_stdout = -1;
    gint child_stderr = -1;
-   FILE* child_stdout_f;
    GError *p_error = NULL;
-   DynBuf err;
-   int i = 0;
 
-   status = g_spawn_async_with_pipes(NULL, cmd, NULL, G_SPAWN_DEFAULT, NULL,
-                                     NULL, &pid, NULL, &child_stdout, &child_stderr,
-                                     &p_error);
-   if (!status) {
+   if (!g_spawn_async_with_pipes(NULL, cmd, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                                 ScriptChildSetup, NULL, &pid, NULL,
+                                 &child_stdout, &child_stderr, &p_error)) {
       if (p_error != NULL) {
-         g_warning("%s: Error during script exec %s\n", p_error->message,
-                   __FUNCTION__);
+         g_warning("%s: Error during script exec %s\n", __FUNCTION__,
+                   p_error->message);
          g_error_free(p_error);
       } else {
          g_warning("%s: Command not run\n", __FUNCTION__);
       }
       g_free(command);
-      return status;
+      return NULL;
    }
+   g_free(command);
+
+   g_debug("%s: Child process %d spawned for %s\n", __FUNCTION__,
+           (int) pid, key);
+
+   fcntl(child_stdout, F_SETFL, fcntl(child_stdout, F_GETFL) | O_NONBLOCK);
+   fcntl(child_stderr, F_SETFL, fcntl(child_stderr, F_GETFL) | O_NONBLOCK);
+
+   run = g_new0(ScriptRun, 1);
+   run->key = g_strdup(key);
+   run->pid = pid;
+   run->outFd = child_stdout;
+   run->errFd = child_stderr;
+   DynBuf_Init(&run->out);
+   DynBuf_Init(&run->err);
+   run->startTime = g_get_monotonic_time();
+   run->deadline = run->startTime + (gint64) timeout * G_USEC_PER_SEC;
+   run->running = TRUE;
+
+   return run;
+}
+
+
+/*
+ *****************************************************************************
+ * ReadScriptPipe --
+ *
+ * Reads what is available from a pipe of a script. The pipe is closed when
+ * the script closes it.
+ *
+ * @param[in/out] fd          The pipe, -1 once closed.
+ * @param[out] buf            Buffer the data is appended to.
+ *
+ *****************************************************************************
+ */
+
+static void
+ReadScriptPipe(int *fd,
+               DynBuf *buf)
+{
+   for (;;) {
+      char data[SERVICE_DISCOVERY_VALUE_MAX_SIZE];
+      ssize_t readBytes = read(*fd, data, sizeof data);
 
-   g_debug("%s: Child process spawned for %s\n", __FUNCTION__, key);
+      if (readBytes > 0) {
+         DynBuf_Append(buf, data, readBytes);
+         continue;
+      }
+      if (readBytes < 0 && errno == EINTR) {
+         continue;
+      }
+      if (readBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+         return;
+      }
+      if (readBytes < 0) {
+         g_warning("%s: Failed to read from child, errno=%d",
+                   __FUNCTION__, errno);
+      }
+      break;
+   }
 
-   child_stdout_f = fdopen(child_stdout, "r");
-   if (child_stdout_f == NULL) {
-      g_warning("%s: Failed to create file stream for child stdout, errno=%d",
+   if (close(*fd) != 0) {
+      g_warning("%s: Failed to close child handle, errno=%d",
                 __FUNCTION__, errno);
-      goto out;
    }
+   *fd = -1;
+}
+
+
+/*
+ *****************************************************************************
+ * ReapScript --
+ *
+ * Collects the exit status of a script.
+ *
+ * @param[in] run             The run of the script.
+ * @param[in] options         Options of waitpid(), WNOHANG not to wait.
+ *
+ * @retval TRUE  The script exited.
+ * @retval FALSE The script is still running.
+ *
+ *****************************************************************************
+ */
+
+static Bool
+ReapScript(ScriptRun *run,
+           int options)
+{
+   pid_t pid;
+
+   do {
+      pid = waitpid(run->pid, &run->exitStatus, options);
+   } while (pid < 0 && errno == EINTR);
+
+   if (pid == 0) {
+      return FALSE;
+   }
+   if (pid < 0) {
+      g_warning("%s: Failed to wait for child %d, errno=%d",
+                __FUNCTION__, (int) run->pid, errno);
+      run->exitStatus = -1;
+   }
+
+   g_spawn_close_pid(run->pid);
+   run->running = FALSE;
+   run->endTime = g_get_monotonic_time();
+   return TRUE;
+}
+
+
+/*
+ *****************************************************************************
+ * KillScript --
+ *
+ * Kills a script that ran out of time, with the commands it started.
+ *
+ * @param[in] run             The run of the script.
+ *
+ *****************************************************************************
+ */
+
+static void
+KillScript(ScriptRun *run)
+{
+   if (kill(-run->pid, SIGKILL) != 0) {
+      kill(run->pid, SIGKILL);
+   }
+   if (run->outFd != -1) {
+      close(run->outFd);
+      run->outFd = -1;
+   }
+   if (run->errFd != -1) {
+      close(run->errFd);
+      run->errFd = -1;
+   }
+
+   ReapScript(run, 0);
+   run->timedOut = TRUE;
+}
+
+
+/*
+ *****************************************************************************
+ * WaitForScripts --
+ *
+ * Reads the output of the scripts as they run, then writes the output of
+ * each to Namespace DB with PublishDataToNamespaceDB().
+ *
+ * A script that runs past its timeout is killed, and its data removed from
+ * Namespace DB rather than published incomplete.
+ *
+ * @param[in] ctx             Application context.
+ * @param[in] runs            The ScriptRuns, freed.
+ *
+ *****************************************************************************
+ */
+
+void
+WaitForScripts(ToolsAppCtx *ctx,
+               GPtrArray *runs)
+{
+   struct pollfd *fds = g_new(struct pollfd, 2 * runs->len);
+   ScriptRun **fdRuns = g_new(ScriptRun *, 2 * runs->len);
+   guint i;
 
-   status = FALSE;
    for (;;) {
-      char buf[SERVICE_DISCOVERY_VALUE_MAX_SIZE];
-      size_t readBytes = fread(buf, 1, sizeof(buf), child_stdout_f);
+      gint64 now = g_get_monotonic_time();
+      int timeout = -1;
+      Bool running = FALSE;
+      nfds_t numFds = 0;
+      nfds_t j;
 
-      g_debug("%s: readBytes = %" G_GSSIZE_FORMAT "\n", __FUNCTION__, readBytes);
+      for (i = 0; i < runs->len; i++) {
+         ScriptRun *run = g_ptr_array_index(runs, i);
+         int left;
 
-      if (readBytes > 0) {
-         gchar* msg = g_strdup_printf("%s-%d", key, ++i);
-         stdoutIsEmpty = FALSE;
-         status = WriteData(ctx, msg, buf, readBytes);
-         g_free(msg);
+         if (!run->running) {
+            continue;
+         }
+         if (run->outFd == -1 && run->errFd == -1 && ReapScript(run, WNOHANG)) {
+            continue;
+         }
+         if (now >= run->deadline) {
+            KillScript(run);
+            continue;
+         }
+
+         running = TRUE;
+         left = (int) ((run->deadline - now + 999) / 1000);
+         if (run->outFd == -1 && run->errFd == -1) {
+            /*
+             * Closed its output but did not exit yet, check again soon.
+             */
+            left = MIN(left, SERVICE_DISCOVERY_SCRIPT_REAP_INTERVAL);
+         }
+         timeout = timeout < 0 ? left : MIN(timeout, left);
+         if (run->outFd != -1) {
+            fds[numFds].fd = run->outFd;
+            fds[numFds].events = POLLIN;
+            fdRuns[numFds++] = run;
+         }
+         if (run->errFd != -1) {
+            fds[numFds].fd = run->errFd;
+            fds[numFds].events = POLLIN;
+            fdRuns[numFds++] = run;
+         }
       }
 
-      if (!status || readBytes < sizeof(buf)) {
+      if (!running) {
          break;
       }
-   }
 
-   if (status) {
-      gchar *chunkCount = g_strdup_printf("%d", i);
-      status = WriteData(ctx, key, chunkCount, strlen(chunkCount));
-      if (status) {
-         g_debug("%s: Written key %s chunks %s\n", __FUNCTION__, key, chunkCount);
+      if (poll(fds, numFds, timeout) < 0) {
+         if (errno != EINTR) {
+            g_warning("%s: Failed to poll the scripts, errno=%d",
+                      __FUNCTION__, errno);
+            break;
+         }
+         continue;
       }
-      g_free(chunkCount);
-   } else if (!stdoutIsEmpty) {
-      g_warning("%s: Was not able to capture or store data\n", __FUNCTION__);
-   }
 
-   DynBuf_Init(&err);
-   ReadFromHandle(child_stderr, &err);
-   child_stderr = -1;
-   if (DynBuf_GetSize(&err) != 0) {
-      DynBuf_AppendString(&err, "");
-      g_debug("%s: stderr=%s\n", __FUNCTION__, (const char *) DynBuf_Get(&err));
-   }
-   DynBuf_Destroy(&err);
-out:
-   g_free(command);
-   if (child_stdout_f != NULL) {
-      if (fclose(child_stdout_f) != 0) {
-         g_warning("%s: Failed to close child stdout file stream, errno=%d",
-                   __FUNCTION__, errno);
+      for (j = 0; j < numFds; j++) {
+         ScriptRun *run = fdRuns[j];
+
+         if (fds[j].revents == 0) {
+            continue;
+         }
+         if (fds[j].fd == run->outFd) {
+            ReadScriptPipe(&run->outFd, &run->out);
+         } else {
+            ReadScriptPipe(&run->errFd, &run->err);
+         }
       }
-   } else if (child_stdout != -1 && close(child_stdout) != 0) {
-      g_warning("%s: Failed to close child stdout handle, errno=%d",
-                __FUNCTION__, errno);
    }
-   if (child_stderr != -1 && close(child_stderr) != 0) {
-      g_warning("%s: Failed to close child process stderr handle, errno=%d",
-                __FUNCTION__, errno);
+
+   for (i = 0; i < runs->len; i++) {
+      ScriptRun *run = g_ptr_array_index(runs, i);
+      gint64 duration;
+
+      if (run->running) {
+         KillScript(run);
+      }
+      duration = (run->endTime - run->startTime) / 1000;
+
+      if (run->timedOut) {
+         g_warning("%s: Script for %s killed after %" G_GINT64_FORMAT " ms\n",
+                   __FUNCTION__, run->key, duration);
+         PublishDataToNamespaceDB(ctx, run->key, NULL, 0);
+      } else {
+         g_debug("%s: Script for %s exited with status %d in %"
+                 G_GINT64_FORMAT " ms\n", __FUNCTION__, run->key,
+                 WIFEXITED(run->exitStatus) ? WEXITSTATUS(run->exitStatus) :
+                 -1, duration);
+         if (!PublishDataToNamespaceDB(ctx, run->key, DynBuf_Get(&run->out),
+                                       DynBuf_GetSize(&run->out))) {
+            g_debug("%s: PublishDataToNamespaceDB failed for key %s\n",
+                    __FUNCTION__, run->key);
+         }
+      }
+
+      if (DynBuf_GetSize(&run->err) != 0) {
+         DynBuf_AppendString(&run->err, "");
+         g_debug("%s: stderr=%s\n", __FUNCTION__,
+                 (const char *) DynBuf_Get(&run->err));
+      }
+
+      DynBuf_Destroy(&run->out);
+      DynBuf_Destroy(&run->err);
+      g_free(run->key);
+      g_free(run);
    }
-   return status;
+
+   g_free(fdRuns);
+   g_free(fds);
+   g_ptr_array_set_size(runs, 0);
 }
@@ -61,6 +61,25 @@ TimeSync_DisableTimeSlew(void)
 }
 
 
+/*
+ ******************************************************************************
+ * TimeSync_SlewMaxRate --                                              */ /**
+ *
+ * Report how fast TimeSync_Slew can correct the time. adjtime slews at a
+ * fixed rate, 500ppm on the BSDs and Solaris.
+ *
+ * @return The maximum slew rate, in parts per million.
+ *
+ ******************************************************************************
+ */
+
+int64
+TimeSync_SlewMaxRate(void)
+{
+   return 500;
+}
+
+
 /*
  ******************************************************************************
  * TimeSync_Slew --                                                     */ /**
@@ -80,6 +80,24 @@ TimeSync_DisableTimeSlew(void)
 }
 
 
+/*
+ ******************************************************************************
+ * TimeSync_SlewMaxRate --                                              */ /**
+ *
+ * Report how fast TimeSync_Slew can correct the time.
+ *
+ * @return The maximum slew rate, in parts per million.
+ *
+ ******************************************************************************
+ */
+
+int64
+TimeSync_SlewMaxRate(void)
+{
+   return (TICK_INCR_MAX - TICK_INCR_NOMINAL) * US_PER_SEC / TICK_INCR_NOMINAL;
+}
+
+
 /*
  ******************************************************************************
  * TimeSync_Slew --                                                     */ /**
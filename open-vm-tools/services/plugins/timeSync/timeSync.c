@@ -108,6 +108,28 @@
  *    of seconds. This additional correction mitigates potential failures
  *    in guest time sync agent.
  *
+ * Precise synchronization (tools.conf timeSync.precise):
+ *
+ * Each period takes a burst of samples and keeps the one with the lowest
+ * round trip to the host, the least disturbed by the scheduling of the
+ * vcpu.  Instead of feeding the offsets to the kernel PLL, the frequency
+ * error of the guest clock is estimated by a least squares fit over the
+ * recent bursts (net of the frequency corrections we applied), and the
+ * kernel frequency is set to cancel it and to correct the offset over a
+ * few periods.
+ *
+ * Alternatively (tools.conf timeSync.refclock-shm-unit), the samples are
+ * exported as an NTP SHM reference clock, and the periodic synchronization
+ * leaves the correction of the clock to ntpd or chronyd.
+ *
+ * Slewed resynchronization (tools.conf timeSync.resync-policy=slew):
+ *
+ * The one time synchronizations requested by the host after a resume or a
+ * vMotion measure the offset with a burst of samples and, if the platform
+ * can slew it away within resync-catchup-time, slew at the required rate
+ * instead of stepping.  The periodic loop is held off during the catch-up,
+ * whose progress is logged every TIMESYNC_CATCHUP_TRACE_PERIOD seconds.
+ *
  */
 
 #include "timeSync.h"
@@ -119,6 +141,7 @@
 #include "system.h"
 #include "vmware/guestrpc/timesync.h"
 #include "vmware/tools/plugin.h"
+#include "vmware/tools/threadPool.h"
 #include "vmware/tools/utils.h"
 
 #if !defined(__APPLE__)
@@ -150,6 +173,21 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
 /* Period during which the frequency error of guest time is measured. */
 #define TIMESYNC_CALIBRATION_DURATION (15 * 60 * US_PER_SEC) /* 15min. */
 
+/* Samples per burst of the precise synchronization, and their maximum. */
+#define TIMESYNC_BURST_SAMPLES 8
+#define TIMESYNC_MAX_BURST_SAMPLES 64
+/* Number of bursts the frequency error is estimated over. */
+#define TIMESYNC_PRECISE_HISTORY 8
+/* The offset is corrected over TIMESYNC_PRECISE_TAU periods. */
+#define TIMESYNC_PRECISE_TAU 4
+/* Largest frequency correction, as for the kernel PLL. */
+#define TIMESYNC_PRECISE_MAX_PPM 500
+
+/* Default bound of a slewed one time synchronization, in seconds. */
+#define TIMESYNC_CATCHUP_TIME 60
+/* Interval of the catch-up progress trace, in seconds. */
+#define TIMESYNC_CATCHUP_TRACE_PERIOD 5
+
 typedef enum TimeSyncState {
    TIMESYNC_INITIALIZING,
    TIMESYNC_STOPPED,
@@ -160,6 +198,7 @@ typedef enum TimeSyncSlewState {
    TimeSyncUncalibrated,
    TimeSyncCalibrating,
    TimeSyncPLL,
+   TimeSyncPrecise,
 } TimeSyncSlewState;
 
 typedef enum TimeSyncType {
@@ -180,6 +219,29 @@ typedef struct TimeSyncData {
    uint32             guestResyncTimeout;
    GSource           *guestResyncTimer;
    ToolsAppCtx       *ctx;
+
+   /* tools.conf settings. */
+   gboolean           precise;
+   uint32             burstSamples;
+   int                refclockUnit;
+
+   /*
+    * Precise synchronization state. The raw offsets are the measured ones
+    * minus what our frequency corrections made up since the first burst.
+    */
+   double             preciseFreq;            /* In ppm. */
+   double             preciseCorrection;      /* In microseconds. */
+   int64              preciseLastTime;
+   int64              preciseTime[TIMESYNC_PRECISE_HISTORY];
+   double             preciseRaw[TIMESYNC_PRECISE_HISTORY];
+   uint32             preciseCount;
+
+   /* Slewed one time synchronization. */
+   gboolean           resyncSlew;
+   uint32             catchupTime;            /* In seconds. */
+   GSource           *catchupTimer;
+   int64              catchupStart;
+   int64              catchupCorrection;
 } TimeSyncData;
 
 /*
@@ -314,6 +376,10 @@ TimeSyncReadHost(int64 *host, int64 *apparentError, Bool *apparentErrorValid,
  * @param[out]  apparentErrorValid  Did the platform inform us of apparentError.
  * @param[out]  maxTimeError        Maximum amount of error than can go.
  *                                  uncorrected.
+ * @param[in]   maxSamples          Maximum number of samples.
+ * @param[in]   goodThreshold       Stop at a sample with a round trip below
+ *                                  this, in microseconds.
+ * @param[out]  roundTrip           Round trip of the sample.
  *
  * @return TRUE on success.
  */
@@ -321,7 +387,8 @@ TimeSyncReadHost(int64 *host, int64 *apparentError, Bool *apparentErrorValid,
 static gboolean
 TimeSyncReadHostAndGuest(int64 *host, int64 *guest, 
                          int64 *apparentError, Bool *apparentErrorValid,
-                         int64 *maxTimeError)
+                         int64 *maxTimeError, int maxSamples,
+                         int64 goodThreshold, int64 *roundTrip)
 {
    int64 host1, host2, hostDiff;
    int64 tmpGuest, tmpApparentError, tmpMaxTimeError;
@@ -367,10 +434,10 @@ TimeSyncReadHostAndGuest(int64 *host, int64 *guest,
          *apparentErrorValid = tmpApparentErrorValid;
          *maxTimeError = tmpMaxTimeError;
       }
-   } while (iter < TIMESYNC_MAX_SAMPLES && 
-            bestHostDiff > TIMESYNC_GOOD_SAMPLE_THRESHOLD);
+   } while (iter < maxSamples && bestHostDiff > goodThreshold);
 
    ASSERT(*host != 0 && *guest != 0);
+   *roundTrip = bestHostDiff;
 
 #ifdef VMX86_DEBUG
    g_debug("Daemon: Guest vs host error %.6fs; guest vs apparent error %.6fs; "
@@ -527,6 +594,81 @@ TimeSyncSlewTime(TimeSyncData *data, int64 adjustment)
 }
 
 
+/**
+ * Steer the guest clock frequency from a precise sample.
+ *
+ * The frequency error of the guest clock is the slope of the raw offsets,
+ * fitted by least squares over the last TIMESYNC_PRECISE_HISTORY bursts.
+ * The frequency is set to cancel it, plus what corrects the current offset
+ * over TIMESYNC_PRECISE_TAU periods.
+ *
+ * @param[in]  data              Structure tracking time sync state.
+ * @param[in]  now               Guest time of the sample.
+ * @param[in]  offset            Guest OS error of the sample.
+ *
+ * @return TRUE on success.
+ */
+
+static gboolean
+TimeSyncPreciseSteer(TimeSyncData *data, int64 now, int64 offset)
+{
+   double tau = (double)data->timeSyncPeriod * TIMESYNC_PRECISE_TAU *
+                US_PER_SEC;
+   double slope = 0;
+   double freq;
+   uint32 n;
+
+   if (data->slewState != TimeSyncPrecise) {
+      g_debug("Starting precise synchronization.\n");
+      TimeSyncResetSlew(data);
+      data->slewState = TimeSyncPrecise;
+   } else {
+      data->preciseCorrection += data->preciseFreq *
+                                 (now - data->preciseLastTime) / US_PER_SEC;
+   }
+   data->preciseLastTime = now;
+
+   data->preciseTime[data->preciseCount % TIMESYNC_PRECISE_HISTORY] = now;
+   data->preciseRaw[data->preciseCount % TIMESYNC_PRECISE_HISTORY] =
+      offset - data->preciseCorrection;
+   data->preciseCount++;
+
+   n = MIN(data->preciseCount, TIMESYNC_PRECISE_HISTORY);
+   if (n >= 2) {
+      double sumT = 0, sumR = 0, sumTT = 0, sumTR = 0;
+      uint32 i;
+
+      /* Relative to the current time, to keep the precision. */
+      for (i = 0; i < n; i++) {
+         double t = (double)(data->preciseTime[i] - now);
+         double r = data->preciseRaw[i];
+
+         sumT += t;
+         sumR += r;
+         sumTT += t * t;
+         sumTR += t * r;
+      }
+      if (n * sumTT - sumT * sumT > 0) {
+         slope = (n * sumTR - sumT * sumR) / (n * sumTT - sumT * sumT);
+      }
+   }
+
+   freq = -(slope + offset / tau) * US_PER_SEC;
+   freq = MAX(MIN(freq, TIMESYNC_PRECISE_MAX_PPM), -TIMESYNC_PRECISE_MAX_PPM);
+
+   g_debug("Precise synchronization: offset %"FMT64"dus, frequency error "
+           "%.3fppm, correction %.3fppm\n", offset, slope * US_PER_SEC, freq);
+
+   /* The kernel frequency is in ppm shifted left by 16. */
+   if (!TimeSync_PLLSetFrequency((int64)(freq * 65536))) {
+      TimeSyncResetSlew(data);
+      return FALSE;
+   }
+   data->preciseFreq = freq;
+   return TRUE;
+}
+
+
 /**
  * Reset the slew to nominal.
  *
@@ -539,6 +681,9 @@ TimeSyncResetSlew(TimeSyncData *data)
    int64 remaining;
    int64 timeSyncPeriodUS = (int64)data->timeSyncPeriod * US_PER_SEC;
    data->slewState = TimeSyncUncalibrated;
+   data->preciseFreq = 0;
+   data->preciseCorrection = 0;
+   data->preciseCount = 0;
    TimeSync_Slew(0, timeSyncPeriodUS, &remaining);
    if (TimeSync_PLLSupported()) {
       TimeSync_PLLUpdate(0);
@@ -567,6 +712,110 @@ TimeSyncSetSlewState(TimeSyncData *data, gboolean active)
 }
 
 
+/**
+ * Stop a slewed one time synchronization, resetting the slew to nominal.
+ *
+ * @param[in]  data              Structure tracking time sync state.
+ */
+
+static void
+TimeSyncCatchUpStop(TimeSyncData *data)
+{
+   if (data->catchupTimer != NULL) {
+      g_source_destroy(data->catchupTimer);
+      g_source_unref(data->catchupTimer);
+      data->catchupTimer = NULL;
+      TimeSyncResetSlew(data);
+   }
+}
+
+
+/**
+ * Trace the progress of a slewed one time synchronization, and stop it at
+ * the end of the catch-up time.
+ *
+ * @param[in]  _data    Time sync data.
+ *
+ * @return TRUE to keep tracing.
+ */
+
+static gboolean
+TimeSyncCatchUpTrace(gpointer _data)
+{
+   TimeSyncData *data = _data;
+   int64 host, guest, apparentError, maxTimeError, roundTrip;
+   Bool apparentErrorValid;
+   int64 now;
+
+   if (!TimeSyncReadHostAndGuest(&host, &guest, &apparentError,
+                                 &apparentErrorValid, &maxTimeError,
+                                 TIMESYNC_MAX_SAMPLES,
+                                 TIMESYNC_GOOD_SAMPLE_THRESHOLD,
+                                 &roundTrip)) {
+      return TRUE;
+   }
+
+   now = guest;
+   g_info("Catch-up: %.3fs elapsed, guest OS error %.6fs, initial "
+          "correction %.6fs.\n", (now - data->catchupStart) / 1000000.0,
+          (guest - host - apparentError) / 1000000.0,
+          data->catchupCorrection / 1000000.0);
+
+   if (now - data->catchupStart >= (int64)data->catchupTime * US_PER_SEC) {
+      g_info("Catch-up done.\n");
+      /* The timer is destroyed while dispatched, glib allows it. */
+      TimeSyncCatchUpStop(data);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/**
+ * Start a slewed one time synchronization, if the correction can be slewed
+ * within the catch-up time.
+ *
+ * @param[in]  data              Structure tracking time sync state.
+ * @param[in]  now               Guest time.
+ * @param[in]  correction        Amount to correct the guest time.
+ *
+ * @return TRUE if slewing, FALSE if the time must be stepped.
+ */
+
+static gboolean
+TimeSyncCatchUpStart(TimeSyncData *data, int64 now, int64 correction)
+{
+   int64 catchupTimeUS = (int64)data->catchupTime * US_PER_SEC;
+   int64 remaining;
+
+   if (ABS(correction) > catchupTimeUS / US_PER_SEC * TimeSync_SlewMaxRate()) {
+      g_info("Correction of %.6fs too large to slew within %us, stepping.\n",
+             correction / 1000000.0, data->catchupTime);
+      return FALSE;
+   }
+
+   TimeSyncCatchUpStop(data);
+
+   /* The slew invalidates the calibration of the periodic loop. */
+   data->slewState = TimeSyncUncalibrated;
+   if (!TimeSync_Slew(correction, catchupTimeUS, &remaining)) {
+      return FALSE;
+   }
+
+   data->catchupStart = now;
+   data->catchupCorrection = correction;
+   data->catchupTimer =
+      g_timeout_source_new_seconds(MIN(data->catchupTime,
+                                       TIMESYNC_CATCHUP_TRACE_PERIOD));
+   VMTOOLSAPP_ATTACH_SOURCE(data->ctx, data->catchupTimer,
+                            TimeSyncCatchUpTrace, data, NULL);
+
+   g_info("One time synchronization: slewing %.6fs over %us.\n",
+          correction / 1000000.0, data->catchupTime);
+   return TRUE;
+}
+
+
 /**
  * Guest resync timeout handler to step correct guest time. This is a callback
  * handler that requests for step correction after a preconfigured timeout.
@@ -613,9 +862,12 @@ TimeSyncDoSync(Bool slewCorrection,
                void *_data)
 {
    int64 guest, host;
-   int64 gosError, apparentError, maxTimeError;
+   int64 gosError, apparentError, maxTimeError, roundTrip;
    Bool apparentErrorValid;
    TimeSyncData *data = _data;
+   gboolean burst = syncType == TIMESYNC_PERIODIC ?
+                    (data->precise || data->refclockUnit >= 0) :
+                    data->resyncSlew;
 
    g_debug("Synchronizing time: "
            "syncType %d, slewCorrection %d, allowBackwardSync %d "
@@ -623,8 +875,15 @@ TimeSyncDoSync(Bool slewCorrection,
            syncType, slewCorrection, allowBackwardSync,
            data->guestResync, data->guestResyncTimeout);
 
+   /*
+    * Bursts sample the host until the end, to find the lowest round trip.
+    */
    if (!TimeSyncReadHostAndGuest(&host, &guest, &apparentError, 
-                                 &apparentErrorValid, &maxTimeError)) {
+                                 &apparentErrorValid, &maxTimeError,
+                                 burst ? data->burstSamples :
+                                         TIMESYNC_MAX_SAMPLES,
+                                 burst ? 0 : TIMESYNC_GOOD_SAMPLE_THRESHOLD,
+                                 &roundTrip)) {
       return FALSE;
    }
 
@@ -671,8 +930,10 @@ TimeSyncDoSync(Bool slewCorrection,
                          "synchronization event.\n");
                return FALSE;
             }
-         } else {
+         } else if (!data->resyncSlew ||
+                    !TimeSyncCatchUpStart(data, guest, -gosError)) {
             g_debug("One time synchronization: stepping time.\n");
+            TimeSyncCatchUpStop(data);
             if (!TimeSyncStepTime(data, -gosError + -apparentError)) {
                return FALSE;
             }
@@ -691,6 +952,16 @@ TimeSyncDoSync(Bool slewCorrection,
        */
 
       ASSERT(syncType == TIMESYNC_PERIODIC);
+
+#ifndef _WIN32
+      if (data->refclockUnit >= 0) {
+         /* The NTP daemon corrects the clock from the exported samples. */
+         TimeSyncSetSlewState(data, FALSE);
+         TimeSync_RefclockUpdate(guest - gosError, guest, roundTrip / 2);
+         return TRUE;
+      }
+#endif
+
       TimeSyncSetSlewState(data, apparentErrorValid && slewCorrection);
 
       if (gosError < -maxTimeError) {
@@ -698,7 +969,18 @@ TimeSyncDoSync(Bool slewCorrection,
          if (!TimeSyncStepTime(data, -gosError + -apparentError)) {
             return FALSE;
          }
+      } else if (slewCorrection && apparentErrorValid && data->precise &&
+                 TimeSync_PLLSupported() &&
+                 ABS(gosError) < TIMESYNC_PLL_UNSYNC) {
+         if (!TimeSyncPreciseSteer(data, guest, gosError)) {
+            return FALSE;
+         }
       } else if (slewCorrection && apparentErrorValid) {
+         if (data->slewState == TimeSyncPrecise) {
+            g_debug("Adjustment too large (%"FMT64"d), stopping precise "
+                    "synchronization.\n", -gosError);
+            TimeSyncResetSlew(data);
+         }
          g_debug("Periodic synchronization: slewing time.\n");
          if (!TimeSyncSlewTime(data, -gosError)) {
             return FALSE;
@@ -725,7 +1007,10 @@ ToolsDaemonTimeSyncLoop(gpointer _data)
 
    ASSERT(data != NULL);
 
-   if (!TimeSyncDoSync(data->slewCorrection, TIMESYNC_PERIODIC, FALSE, data)) {
+   if (data->catchupTimer != NULL) {
+      g_debug("Catch-up in progress, skipping periodic synchronization.\n");
+   } else if (!TimeSyncDoSync(data->slewCorrection, TIMESYNC_PERIODIC, FALSE,
+                              data)) {
       g_warning("Unable to synchronize time.\n");
    }
 
@@ -759,11 +1044,20 @@ TimeSyncStartLoop(ToolsAppCtx *ctx,
 
    g_debug("New sync period is %d sec.\n", data->timeSyncPeriod);
 
+#ifndef _WIN32
+   if (data->refclockUnit >= 0 && !TimeSync_RefclockOpen(data->refclockUnit)) {
+      g_warning("Unable to export time samples, correcting the time.\n");
+      data->refclockUnit = -1;
+   }
+#endif
+
    if (!TimeSyncDoSync(data->slewCorrection, TIMESYNC_PERIODIC, FALSE, data)) {
       g_warning("Unable to synchronize time when starting time loop.\n");
    }
 
    data->timer = g_timeout_source_new(data->timeSyncPeriod * 1000);
+   /* Sampling the host time is sensitive to dispatch delays. */
+   ToolsCorePool_SetSourceClass(data->timer, TOOLS_CORE_POOL_CLASS_CRITICAL);
    VMTOOLSAPP_ATTACH_SOURCE(ctx, data->timer, ToolsDaemonTimeSyncLoop,
                             data, NULL);
 
@@ -789,8 +1083,12 @@ TimeSyncStopLoop(ToolsAppCtx *ctx,
 
    g_debug("Stopping time sync loop.\n");
 
+   TimeSyncCatchUpStop(data);
    TimeSyncSetSlewState(data, FALSE);
    TimeSync_DisableTimeSlew();
+#ifndef _WIN32
+   TimeSync_RefclockClose();
+#endif
 
    g_source_destroy(data->timer);
    g_source_unref(data->timer);
@@ -998,6 +1296,103 @@ TimeSyncSetOption(gpointer src,
 }
 
 
+/**
+ * Reads the timeSync settings of tools.conf.
+ *
+ * @param[in]  data     Time sync data.
+ * @param[in]  config   The config file.
+ *
+ * @return TRUE if a setting changed.
+ */
+
+static gboolean
+TimeSyncLoadConfig(TimeSyncData *data,
+                   GKeyFile *config)
+{
+   gboolean precise;
+   gint burstSamples;
+   gint refclockUnit;
+   gchar *policy;
+   gint catchupTime;
+   gboolean changed;
+
+   precise = VMTools_ConfigGetBoolean(config, CONFGROUPNAME_TIMESYNC,
+                                      CONFNAME_TIMESYNC_PRECISE, FALSE);
+   burstSamples = VMTools_ConfigGetInteger(config, CONFGROUPNAME_TIMESYNC,
+                                           CONFNAME_TIMESYNC_BURSTSAMPLES,
+                                           TIMESYNC_BURST_SAMPLES);
+   if (burstSamples < 1 || burstSamples > TIMESYNC_MAX_BURST_SAMPLES) {
+      g_warning("Invalid %s.%s value: %d. Using default %d.\n",
+                CONFGROUPNAME_TIMESYNC, CONFNAME_TIMESYNC_BURSTSAMPLES,
+                burstSamples, TIMESYNC_BURST_SAMPLES);
+      burstSamples = TIMESYNC_BURST_SAMPLES;
+   }
+   refclockUnit = VMTools_ConfigGetInteger(config, CONFGROUPNAME_TIMESYNC,
+                                           CONFNAME_TIMESYNC_REFCLOCKUNIT, -1);
+   if (refclockUnit < -1) {
+      refclockUnit = -1;
+   }
+
+   policy = VMTools_ConfigGetString(config, CONFGROUPNAME_TIMESYNC,
+                                    CONFNAME_TIMESYNC_RESYNCPOLICY, "step");
+   if (strcmp(policy, "slew") == 0) {
+      data->resyncSlew = TRUE;
+   } else {
+      if (strcmp(policy, "step") != 0) {
+         g_warning("Invalid %s.%s value: %s. Using step.\n",
+                   CONFGROUPNAME_TIMESYNC, CONFNAME_TIMESYNC_RESYNCPOLICY,
+                   policy);
+      }
+      data->resyncSlew = FALSE;
+   }
+   g_free(policy);
+
+   catchupTime = VMTools_ConfigGetInteger(config, CONFGROUPNAME_TIMESYNC,
+                                          CONFNAME_TIMESYNC_CATCHUPTIME,
+                                          TIMESYNC_CATCHUP_TIME);
+   if (catchupTime <= 0) {
+      g_warning("Invalid %s.%s value: %d. Using default %d.\n",
+                CONFGROUPNAME_TIMESYNC, CONFNAME_TIMESYNC_CATCHUPTIME,
+                catchupTime, TIMESYNC_CATCHUP_TIME);
+      catchupTime = TIMESYNC_CATCHUP_TIME;
+   }
+   data->catchupTime = catchupTime;
+
+   changed = precise != data->precise ||
+             burstSamples != data->burstSamples ||
+             refclockUnit != data->refclockUnit;
+   data->precise = precise;
+   data->burstSamples = burstSamples;
+   data->refclockUnit = refclockUnit;
+   return changed;
+}
+
+
+/**
+ * Handles a conf reload; restarts the time sync loop with the new settings.
+ *
+ * @param[in]  src      The source object.
+ * @param[in]  ctx      The app context.
+ * @param[in]  plugin   Plugin registration data.
+ */
+
+static void
+TimeSyncConfReload(gpointer src,
+                   ToolsAppCtx *ctx,
+                   ToolsPluginData *plugin)
+{
+   TimeSyncData *data = plugin->_private;
+
+   if (TimeSyncLoadConfig(data, ctx->config) &&
+       data->state == TIMESYNC_RUNNING) {
+      TimeSyncStopLoop(ctx, data);
+      if (!TimeSyncStartLoop(ctx, data)) {
+         g_warning("Unable to restart the time sync loop.\n");
+      }
+   }
+}
+
+
 /**
  * Handles a shutdown callback; cleans up internal plugin state.
  *
@@ -1016,6 +1411,7 @@ TimeSyncShutdown(gpointer src,
    if (data->state == TIMESYNC_RUNNING) {
       TimeSyncStopLoop(ctx, data);
    }
+   TimeSyncCatchUpStop(data);
 
    g_free(data);
 }
@@ -1039,12 +1435,13 @@ ToolsOnLoad(ToolsAppCtx *ctx)
       NULL
    };
 
-   TimeSyncData *data = g_malloc(sizeof (TimeSyncData));
+   TimeSyncData *data = g_malloc0(sizeof (TimeSyncData));
    RpcChannelCallback rpcs[] = {
       { TIMESYNC_SYNCHRONIZE, TimeSyncTcloHandler, data, NULL, NULL, 0 }
    };
    ToolsPluginSignalCb sigs[] = {
       { TOOLS_CORE_SIG_SET_OPTION, TimeSyncSetOption, &regData },
+      { TOOLS_CORE_SIG_CONF_RELOAD, TimeSyncConfReload, &regData },
       { TOOLS_CORE_SIG_SHUTDOWN, TimeSyncShutdown, &regData }
    };
    ToolsAppReg regs[] = {
@@ -1063,6 +1460,8 @@ ToolsOnLoad(ToolsAppCtx *ctx)
    data->guestResyncTimeout = 0;
    data->guestResyncTimer = NULL;
    data->ctx = ctx;
+   data->refclockUnit = -1;
+   TimeSyncLoadConfig(data, ctx->config);
    regData.regs = VMTools_WrapArray(regs, sizeof *regs, ARRAYSIZE(regs));
    regData._private = data;
 
@@ -44,6 +44,9 @@ TimeSync_Slew(int64 delta,
 Bool
 TimeSync_DisableTimeSlew(void);
 
+int64
+TimeSync_SlewMaxRate(void);
+
 Bool
 TimeSync_PLLUpdate(int64 offset);
 
@@ -59,5 +62,16 @@ TimeSync_IsGuestSyncServiceRunning(void);
 Bool
 TimeSync_DoGuestResync(void *_ctx);
 
+Bool
+TimeSync_RefclockOpen(int unit);
+
+void
+TimeSync_RefclockUpdate(int64 reference,
+                        int64 local,
+                        int64 error);
+
+void
+TimeSync_RefclockClose(void);
+
 #endif /* _TIMESYNC_INT_H_ */
 
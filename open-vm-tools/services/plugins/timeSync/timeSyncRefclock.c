@@ -0,0 +1,182 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file timeSyncRefclock.c
+ *
+ * Exports the host time samples as an NTP shared memory reference clock,
+ * the "SHM" refclock of ntpd and chronyd, so that the NTP daemon of the
+ * guest disciplines the clock instead of competing with timeSync.
+ */
+
+#include "timeSync.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "vm_assert.h"
+#include "vm_basic_asm.h"
+
+/* Key of the SHM segment of unit 0, "NTP0". */
+#define TIMESYNC_REFCLOCK_KEY 0x4e545030
+
+/**
+ * Layout of the segment, shared with ntpd (refclock_shm.c) and chronyd.
+ */
+typedef struct TimeSyncShmTime {
+   int            mode;    /* 1: use the sample if count did not change. */
+   volatile int   count;
+   time_t         clockTimeStampSec;
+   int            clockTimeStampUSec;
+   time_t         receiveTimeStampSec;
+   int            receiveTimeStampUSec;
+   int            leap;
+   int            precision;
+   int            nsamples;
+   volatile int   valid;
+   unsigned       clockTimeStampNSec;
+   unsigned       receiveTimeStampNSec;
+   int            dummy[8];
+} TimeSyncShmTime;
+
+static TimeSyncShmTime *gRefclock = NULL;
+
+
+/*
+ ******************************************************************************
+ * TimeSync_RefclockOpen --                                             */ /**
+ *
+ * Attaches the SHM segment of the given unit, creating it if the NTP daemon
+ * did not yet. The segment is only accessible to root, as for the units 0
+ * and 1 of ntpd.
+ *
+ * @param[in] unit   The SHM unit configured in the NTP daemon.
+ *
+ * @return TRUE on success.
+ *
+ ******************************************************************************
+ */
+
+Bool
+TimeSync_RefclockOpen(int unit)
+{
+   int id;
+   void *shm;
+
+   ASSERT(unit >= 0);
+
+   if (gRefclock != NULL) {
+      return TRUE;
+   }
+
+   id = shmget(TIMESYNC_REFCLOCK_KEY + unit, sizeof *gRefclock,
+               IPC_CREAT | 0600);
+   if (id == -1) {
+      g_warning("%s: shmget of unit %d failed: %s\n", __FUNCTION__, unit,
+                strerror(errno));
+      return FALSE;
+   }
+
+   shm = shmat(id, NULL, 0);
+   if (shm == (void *)-1) {
+      g_warning("%s: shmat of unit %d failed: %s\n", __FUNCTION__, unit,
+                strerror(errno));
+      return FALSE;
+   }
+
+   gRefclock = shm;
+   gRefclock->mode = 1;
+   gRefclock->valid = 0;
+   g_debug("Exporting time samples to SHM refclock unit %d.\n", unit);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * TimeSync_RefclockUpdate --                                           */ /**
+ *
+ * Publishes a sample.
+ *
+ * @param[in] reference  Host time of the sample, in microseconds.
+ * @param[in] local      Guest time of the sample, in microseconds.
+ * @param[in] error      Uncertainty of the sample, in microseconds.
+ *
+ ******************************************************************************
+ */
+
+void
+TimeSync_RefclockUpdate(int64 reference,
+                        int64 local,
+                        int64 error)
+{
+   TimeSyncShmTime *shm = gRefclock;
+   int64 unit = US_PER_SEC;
+   int precision = 0;
+
+   if (shm == NULL) {
+      return;
+   }
+
+   /* Precision is the log2 of the uncertainty, in seconds. */
+   while (unit > error && precision > -30) {
+      unit /= 2;
+      precision--;
+   }
+
+   shm->valid = 0;
+   shm->count++;
+   SMP_W_BARRIER_W();
+
+   shm->clockTimeStampSec = reference / US_PER_SEC;
+   shm->clockTimeStampUSec = reference % US_PER_SEC;
+   shm->clockTimeStampNSec = (reference % US_PER_SEC) * 1000;
+   shm->receiveTimeStampSec = local / US_PER_SEC;
+   shm->receiveTimeStampUSec = local % US_PER_SEC;
+   shm->receiveTimeStampNSec = (local % US_PER_SEC) * 1000;
+   shm->leap = 0;
+   shm->precision = precision;
+
+   SMP_W_BARRIER_W();
+   shm->count++;
+   shm->valid = 1;
+}
+
+
+/*
+ ******************************************************************************
+ * TimeSync_RefclockClose --                                            */ /**
+ *
+ * Detaches the SHM segment. The segment is left for the NTP daemon, which
+ * stops using the refclock once the samples stop.
+ *
+ ******************************************************************************
+ */
+
+void
+TimeSync_RefclockClose(void)
+{
+   if (gRefclock != NULL) {
+      gRefclock->valid = 0;
+      shmdt((void *)gRefclock);
+      gRefclock = NULL;
+   }
+}
@@ -64,6 +64,7 @@
 #include <Security.h>
 #else
 #include <unistd.h>
+#include <dirent.h>
 #endif
 
 #if defined(sun) || defined(__FreeBSD__) || defined(__APPLE__)
@@ -87,6 +88,7 @@
 #include <glib.h>
 
 #include "util.h"
+#include "random.h"
 #include "strutil.h"
 #include "str.h"
 #include "file.h"
@@ -219,6 +221,12 @@ static gchar *gCurrentUsername = NULL;
 
 static VGAuthUserHandle *currentUserHandle = NULL;
 
+/*
+ * TRUE if currentUserHandle belongs to the credential cache, and must not
+ * be freed when the user is logged out.
+ */
+static Bool currentUserHandleCached = FALSE;
+
 #endif
 
 /*
@@ -227,6 +235,14 @@ static VGAuthUserHandle *currentUserHandle = NULL;
  */
 char *gImpersonatedUsername = NULL;
 
+/*
+ * While a batch runs, its commands run under the impersonation made for
+ * the batch: impersonating returns gBatchUserToken, and unimpersonating
+ * and logging out do nothing.
+ */
+static Bool gInBatch = FALSE;
+static void *gBatchUserToken = NULL;
+
 
 #define SECONDS_BETWEEN_POLL_TEST_FINISHED     1
 
@@ -336,14 +352,43 @@ typedef struct VixToolsStartProgramState {
 } VixToolsStartProgramState;
 
 
+/*
+ * The monitor to call when a program started asynchronously exits.
+ */
+typedef struct VixToolsAsyncProcWatch {
+   GSourceFunc monitor;
+   void *clientData;
+} VixToolsAsyncProcWatch;
+
+
+/*
+ * The captured output of one stream of a started program. The buffer
+ * grows up to VIX_TOOLS_MAX_PROGRAM_OUTPUT, then keeps only the most
+ * recent output: the byte at offset k of the stream is data[k % size].
+ */
+typedef struct VixToolsOutputRing {
+   char *data;
+   size_t size;
+   uint64 total;           // Bytes the program wrote to the stream
+   GSource *watch;         // NULL once the stream is closed
+} VixToolsOutputRing;
+
+typedef struct VixToolsProgramOutput {
+   VixToolsOutputRing streams[2];   // Indexed by VIX_PROGRAM_OUTPUT_*
+} VixToolsProgramOutput;
+
+#define  VIX_TOOLS_MIN_PROGRAM_OUTPUT  (4 * 1024)
+#define  VIX_TOOLS_MAX_PROGRAM_OUTPUT  (256 * 1024)
+
+
 /*
  * Tracks processes started via StartProgram, so their exit information can
  * be returned with ListProcessesEx()
  *
- * We need live and dead because the exit status is fetched by from
- * a timer loop, and StartProgram of a very short lived program
+ * We need live and dead because the exit status is fetched from the
+ * main loop, and StartProgram of a very short lived program
  * followed immediately by a ListProcesses could miss the program
- * if we don't save it off for before the timer fires.
+ * if we don't save it off for before the exit is noticed.
  *
  * This data is also useful to optimize ListProcessesEx.
  *
@@ -363,15 +408,26 @@ typedef struct VixToolsStartedProgramState {
    time_t endTime;
    Bool isRunning;
    ProcMgr_AsyncProc *procState;
-   struct VixToolsStartedProgramState *next;
+   VixToolsProgramOutput *output;   // NULL unless it was captured
+   GList *link;            // In startedProcessList
+   GList *exitedLink;      // In exitedProcessList, once it exited
 } VixToolsStartedProgramState;
 
-static VixToolsStartedProgramState *startedProcessList = NULL;
+/*
+ * The programs in the order they were started, indexed by pid, and the
+ * exited ones in the order they exited so that the oldest are reaped
+ * first.
+ */
+static GQueue startedProcessList = G_QUEUE_INIT;
+static GQueue exitedProcessList = G_QUEUE_INIT;
+static GHashTable *startedProcessTable = NULL;
 
 /*
- * How long we keep the info of exited processes.
+ * How long we keep the info of exited processes, and how many of them
+ * at most.
  */
 #define  VIX_TOOLS_EXITED_PROGRAM_REAP_TIME  (5 * 60)
+#define  VIX_TOOLS_MAX_EXITED_PROGRAMS       4096
 
 /*
  * This is used to cache the results of ListProcessesEx when the reply
@@ -406,6 +462,70 @@ static uint32 listProcessesResultsKey = 1;
 
 static void VixToolsFreeCachedResult(gpointer p);
 
+/*
+ * Successful validations of credentials, so that the commands of an
+ * automation client sending the same credentials again and again do not
+ * each go through PAM or VGAuth.
+ *
+ * The entries are keyed by an HMAC of the credentials with a key made at
+ * startup, so the table holds nothing that could be used to log in. They
+ * expire after the configured number of seconds (0 disables the cache),
+ * and are all dropped when the VMX logs out of the guest, releases
+ * credentials, or when an alias is added or removed.
+ */
+#define  VIXTOOLS_CONFIG_CREDENTIAL_CACHE_TIMEOUT_NAME   "credentialCacheTimeout"
+#define  CREDENTIAL_CACHE_TIMEOUT_DEFAULT                30
+#define  MAX_CACHED_CREDENTIALS                          32
+
+typedef struct VixToolsCachedCredential {
+   char *userName;
+   gint64 expiry;                 // Monotonic time, in microseconds
+#if SUPPORT_VGAUTH
+   VGAuthUserHandle *userHandle;  // NULL for PAM validations
+#endif
+} VixToolsCachedCredential;
+
+static GHashTable *gCredentialCache = NULL;
+static uint8 gCredentialCacheKey[32];
+
+static void VixToolsFreeCachedCredential(gpointer p);
+
+/*
+ * A ListFiles or ListDirectory listing being fetched in pages. Its directory
+ * stays open between the requests, so that each page is read from where the
+ * previous one ended instead of re-reading the whole directory, and memory
+ * does not grow with the size of the directory.
+ *
+ * Entries come in the order the directory returns them. The cursors that
+ * are not used again are closed after SECONDS_UNTIL_DIR_CURSOR_CLEANUP,
+ * so that they do not keep file systems busy.
+ */
+#define  MAX_DIR_CURSORS                    4
+#define  SECONDS_UNTIL_DIR_CURSOR_CLEANUP   60
+
+typedef struct VixToolsDirCursor {
+   char *dirPathName;
+   char *pattern;          // NULL if the entries are not filtered
+   GRegex *regex;
+   Bool withDots;          // List "." and ".." first
+   int nextDot;            // Next of "." and ".." to list, 2 when done
+#ifdef _WIN32
+   WalkDirContext walk;
+   wchar_t *userName;
+#else
+   DIR *dir;
+   uid_t euid;
+#endif
+   char *pending;          // Matching entry read but not returned yet
+   int numMatches;         // Matching entries in the directory
+   int numReturned;        // Matching entries returned so far
+   GSource *timer;
+} VixToolsDirCursor;
+
+static GList *gDirCursors = NULL;
+
+static void VixToolsDirCursorFree(VixToolsDirCursor *cursor);
+
 /*
  * This structure is designed to implemente CreateTemporaryFile,
  * CreateTemporaryDirectory VI guest operations.
@@ -453,6 +573,12 @@ typedef struct VixToolsEnvironmentTableIterator {
  * Stores the environment variables to use when executing guest applications.
  */
 static HashTable *userEnvironmentTable = NULL;
+
+/*
+ * userEnvironmentTable as an envp array, built for the first program
+ * started after the table changed last.
+ */
+static char **userEnvironmentEnvp = NULL;
 #endif
 static HgfsServerMgrData gVixHgfsBkdrConn;
 
@@ -466,6 +592,10 @@ static VixError VixToolsSetFileAttributes(VixCommandRequestHeader *requestMsg);
 
 static gboolean VixToolsMonitorAsyncProc(void *clientData);
 static gboolean VixToolsMonitorStartProgram(void *clientData);
+static void VixToolsWatchAsyncProc(ProcMgr_AsyncProc *procState,
+                                   void *eventQueue,
+                                   GSourceFunc monitor,
+                                   void *clientData);
 static void VixToolsRegisterHgfsSessionInvalidator(void *clientData);
 static gboolean VixToolsInvalidateInactiveHGFSSessions(void *clientData);
 
@@ -503,6 +633,11 @@ static const char *fileInfoFormatString = "<FileInfo>"
 
 static const char *listFilesRemainingFormatString = "<rem>%d</rem>";
 
+static const char *fileInfoErrorFormatString = "<fxe>"
+                                          "<Name>%s</Name>"
+                                          "<err>%"FMT64"d</err>"
+                                          "</fxe>";
+
 #ifdef _WIN32
 static const char *fileExtendedInfoWindowsFormatString = "<fxi>"
                                           "<Name>%s</Name>"
@@ -547,8 +682,16 @@ static VixError VixToolsStartProgramImpl(const char *requestName,
                                          Bool startMinimized,
                                          void *userToken,
                                          void *eventQueue,
+                                         VixToolsProgramOutput **output,
                                          int64 *pid);
 
+#if !defined(_WIN32)
+static VixToolsProgramOutput *VixToolsWatchProgramOutput(int pipes[2][2],
+                                                         void *eventQueue);
+#endif
+
+static void VixToolsFreeProgramOutput(VixToolsProgramOutput *output);
+
 static char *VixToolsGetImpersonatedUsername(void *userToken);
 
 static const char *scriptFileBaseName = "vixScript";
@@ -596,12 +739,18 @@ static VixError VixToolsPrintProcInfoEx(DynBuf *dstBuffer,
 
 static VixError VixToolsListDirectory(VixCommandRequestHeader *requestMsg,
                                       size_t maxBufferSize,
+                                      GMainLoop *eventQueue,
                                       char **result);
 
 static VixError VixToolsListFiles(VixCommandRequestHeader *requestMsg,
                                   size_t maxBufferSize,
+                                  GMainLoop *eventQueue,
                                   char **result);
 
+static VixError VixToolsGetMultipleFileInfo(VixCommandRequestHeader *requestMsg,
+                                            size_t maxBufferSize,
+                                            char **result);
+
 static VixError VixToolsInitiateFileTransferFromGuest(VixCommandRequestHeader *requestMsg,
                                                       char **result);
 
@@ -609,6 +758,11 @@ static VixError VixToolsInitiateFileTransferToGuest(VixCommandRequestHeader *req
 
 static VixError VixToolsKillProcess(VixCommandRequestHeader *requestMsg);
 
+static VixError VixToolsReadProgramOutput(VixCommandRequestHeader *requestMsg,
+                                          size_t maxBufferSize,
+                                          char **result,
+                                          size_t *resultLength);
+
 static VixError VixToolsCreateDirectory(VixCommandRequestHeader *requestMsg);
 
 static VixError VixToolsRunScript(VixCommandRequestHeader *requestMsg,
@@ -645,6 +799,14 @@ static VixError VixToolsAcquireCredentials(VixCommandRequestHeader *requestMsg,
 
 static VixError VixToolsReleaseCredentials(VixCommandRequestHeader *requestMsg);
 
+static VixError VixToolsRunBatch(VixCommandRequestHeader *requestMsg,
+                                 char *requestName,
+                                 size_t maxBufferSize,
+                                 GKeyFile *confDictRef,
+                                 GMainLoop *eventQueue,
+                                 char **result,
+                                 size_t *resultLength);
+
 static VixError VixToolsCreateRegKey(VixCommandRequestHeader *requestMsg);
 
 static VixError VixToolsListRegKeys(VixCommandRequestHeader *requestMsg,
@@ -707,6 +869,10 @@ static int VixToolsEnvironmentTableEntryToEnvpEntry(const char *key, void *value
 
 static void VixToolsFreeEnvp(char **envp);
 
+static char **VixToolsGetUserEnvp(void);
+
+static void VixToolsInvalidateUserEnvp(void);
+
 #endif
 
 static VixError FoundryToolsDaemon_TranslateSystemErr(void);
@@ -802,6 +968,17 @@ VixTools_Initialize(Bool thisProcessRunsAsRootParam,
                                                      NULL,
                                                      VixToolsFreeCachedResult);
 
+   startedProcessTable = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+   if (Random_Crypto(sizeof gCredentialCacheKey, gCredentialCacheKey)) {
+      gCredentialCache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                               g_free,
+                                               VixToolsFreeCachedCredential);
+   } else {
+      g_warning("%s: no random key, credentials will not be cached\n",
+                __FUNCTION__);
+   }
+
 #if SUPPORT_VGAUTH
    /*
     * We don't set up the VGAuth log handler, since the default
@@ -859,6 +1036,23 @@ VixTools_Uninitialize(void) // IN
       g_debug("%s: Process Handle Invalidator detached\n", __FUNCTION__);
    }
 
+   while (NULL != gDirCursors) {
+      VixToolsDirCursor *cursor = gDirCursors->data;
+
+      gDirCursors = g_list_delete_link(gDirCursors, gDirCursors);
+      VixToolsDirCursorFree(cursor);
+   }
+
+   if (NULL != gCredentialCache) {
+      g_hash_table_destroy(gCredentialCache);
+      gCredentialCache = NULL;
+   }
+   Util_Zero(gCredentialCacheKey, sizeof gCredentialCacheKey);
+
+#ifndef _WIN32
+   VixToolsInvalidateUserEnvp();
+#endif
+
    HgfsServerManager_Unregister(&gVixHgfsBkdrConn);
 }
 
@@ -926,6 +1120,7 @@ VixToolsBuildUserEnvironmentTable(const char * const *envp)   // IN: optional
        * in case they ever do this will cover it.
        */
       HashTable_Clear(userEnvironmentTable);
+      VixToolsInvalidateUserEnvp();
    }
 
    for (; NULL != *envp; envp++) {
@@ -1065,6 +1260,62 @@ VixToolsFreeEnvp(char **envp)   // IN
       free(envp);
    }
 }
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsGetUserEnvp --
+ *
+ *      Returns the environment to run programs with, as an envp array.
+ *      It is built from userEnvironmentTable only when the table changed,
+ *      so that starting a program does not copy every variable.
+ *
+ * Results:
+ *      char ** - envp array as per environ(7), owned by this module, or
+ *      NULL to use the current environment.
+ *
+ * Side effects:
+ *      May build the cached envp.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static char **
+VixToolsGetUserEnvp(void)
+{
+   if (NULL == userEnvironmentEnvp) {
+      userEnvironmentEnvp =
+         VixToolsEnvironmentTableToEnvp(userEnvironmentTable);
+   }
+
+   return userEnvironmentEnvp;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsInvalidateUserEnvp --
+ *
+ *      Drops the envp cached by VixToolsGetUserEnvp. Called whenever
+ *      userEnvironmentTable changes.
+ *
+ * Results:
+ *      None
+ *
+ * Side effects:
+ *      None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsInvalidateUserEnvp(void)
+{
+   VixToolsFreeEnvp(userEnvironmentEnvp);
+   userEnvironmentEnvp = NULL;
+}
 #endif  // #ifndef _WIN32
 
 
@@ -1263,6 +1514,8 @@ VixTools_StartProgram(VixCommandRequestHeader *requestMsg, // IN
    void *userToken = NULL;
    static char resultBuffer[32];    // more than enough to hold a 64 bit pid
    VixToolsStartedProgramState *spState;
+   VixToolsProgramOutput *output = NULL;
+   Bool captureOutput;
    VMAutomationRequestParser parser;
 
    err = VMAutomationRequestParserInit(&parser,
@@ -1331,6 +1584,9 @@ VixTools_StartProgram(VixCommandRequestHeader *requestMsg, // IN
       }
    }
 
+   captureOutput = (requestMsg->requestFlags &
+                    VIX_REQUESTMSG_CAPTURE_PROGRAM_OUTPUT) != 0;
+
    err = VixToolsImpersonateUser(requestMsg, TRUE, &userToken);
    if (VIX_OK != err) {
       goto abort;
@@ -1351,6 +1607,7 @@ VixTools_StartProgram(VixCommandRequestHeader *requestMsg, // IN
                                   startProgramRequest->startMinimized,
                                   userToken,
                                   eventQueue,
+                                  captureOutput ? &output : NULL,
                                   &pid);
 
    if (VIX_OK == err) {
@@ -1409,8 +1666,10 @@ VixTools_StartProgram(VixCommandRequestHeader *requestMsg, // IN
       spState->exitCode = 0;
       spState->endTime = 0;
       spState->isRunning = TRUE;
-      spState->next = NULL;
       spState->procState = NULL;
+      spState->output = output;
+      spState->link = NULL;
+      spState->exitedLink = NULL;
 
       // add it to the list of started programs
       VixToolsUpdateStartedProgramList(spState);
@@ -1484,7 +1743,6 @@ VixToolsRunProgramImpl(char *requestName,      // IN
    STARTUPINFO si;
    wchar_t *envBlock = NULL;
 #endif
-   GSource *timer;
 
    if (NULL != pid) {
       *pid = (int64) -1;
@@ -1593,7 +1851,7 @@ VixToolsRunProgramImpl(char *requestName,      // IN
    si.wShowWindow = (VIX_RUNPROGRAM_ACTIVATE_WINDOW & runProgramOptions)
                      ? SW_SHOWNORMAL : SW_MINIMIZE;
 #elif !defined(__FreeBSD__)
-   procArgs.envp = VixToolsEnvironmentTableToEnvp(userEnvironmentTable);
+   procArgs.envp = VixToolsGetUserEnvp();
 #endif
 
    asyncState->procState = ProcMgr_ExecAsync(fullCommandLine, &procArgs);
@@ -1602,9 +1860,6 @@ VixToolsRunProgramImpl(char *requestName,      // IN
    if (forcedRoot) {
       Impersonate_UnforceRoot();
    }
-#else
-   VixToolsFreeEnvp(procArgs.envp);
-   DEBUG_ONLY(procArgs.envp = NULL;)
 #endif
 
    if (NULL == asyncState->procState) {
@@ -1617,13 +1872,11 @@ VixToolsRunProgramImpl(char *requestName,      // IN
    }
 
    /*
-    * Start a periodic procedure to check the app periodically
+    * Find out from the main loop when the app exits.
     */
    asyncState->eventQueue = eventQueue;
-   timer = g_timeout_source_new(SECONDS_BETWEEN_POLL_TEST_FINISHED * 1000);
-   g_source_set_callback(timer, VixToolsMonitorAsyncProc, asyncState, NULL);
-   g_source_attach(timer, g_main_loop_get_context(eventQueue));
-   g_source_unref(timer);
+   VixToolsWatchAsyncProc(asyncState->procState, eventQueue,
+                          VixToolsMonitorAsyncProc, asyncState);
 
    /*
     * VixToolsMonitorAsyncProc will clean asyncState up when the program finishes.
@@ -1653,7 +1906,8 @@ abort:
  *
  * VixToolsStartProgramImpl --
  *
- *    Start a named program on the guest.
+ *    Start a named program on the guest. If output is not NULL, its
+ *    stdout and stderr are captured into ring buffers returned there.
  *
  * Return value:
  *    VixError
@@ -1674,6 +1928,7 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
                          Bool startMinimized,                // IN
                          void *userToken,                    // IN
                          void *eventQueue,                   // IN
+                         VixToolsProgramOutput **output,     // OUT: optional
                          int64 *pid)                         // OUT
 {
    VixError err = VIX_OK;
@@ -1692,12 +1947,15 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
    wchar_t *envBlock = NULL;
    Bool envBlockFromMalloc = TRUE;
 #endif
-   GSource *timer;
 #if defined(_WIN32) && SUPPORT_VGAUTH
    VGAuthError vgErr;
    VGAuthContext *ctx;
    Bool holdVGAuthUserProfile;
 #endif
+#if !defined(_WIN32)
+   int outputPipes[2][2] = { { -1, -1 }, { -1, -1 } };
+   int i;
+#endif
 
    /*
     * Initialize this here so we can call free on its member variables in abort
@@ -1708,6 +1966,14 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
       *pid = (int64) -1;
    }
 
+   if (NULL != output) {
+      *output = NULL;
+#if defined(_WIN32)
+      err = VIX_E_NOT_SUPPORTED;
+      goto abort;
+#endif
+   }
+
    tempCommandLine = Util_SafeStrdup(programPath);
    startProgramFileName = tempCommandLine;
 
@@ -1859,6 +2125,26 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
 #else
    procArgs.workingDirectory = workingDirectory;
    procArgs.envp = (char **)envVars;
+
+   /*
+    * Only the program gets the write ends of the pipes; ProcMgr_ExecAsync
+    * makes them its stdout and stderr.
+    */
+   if (NULL != output) {
+      for (i = 0; i < ARRAYSIZE(outputPipes); i++) {
+         if (pipe(outputPipes[i]) < 0) {
+            err = FoundryToolsDaemon_TranslateSystemErr();
+            g_warning("%s: Unable to create an output pipe, errno %d\n",
+                      __FUNCTION__, errno);
+            goto abort;
+         }
+         fcntl(outputPipes[i][0], F_SETFL, O_NONBLOCK);
+         fcntl(outputPipes[i][0], F_SETFD, FD_CLOEXEC);
+         fcntl(outputPipes[i][1], F_SETFD, FD_CLOEXEC);
+      }
+      procArgs.stdoutFd = outputPipes[VIX_PROGRAM_OUTPUT_STDOUT][1];
+      procArgs.stderrFd = outputPipes[VIX_PROGRAM_OUTPUT_STDERR][1];
+   }
 #endif
 
 #if defined(_WIN32) && SUPPORT_VGAUTH
@@ -1915,6 +2201,13 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
    if (forcedRoot) {
       Impersonate_UnforceRoot();
    }
+#else
+   for (i = 0; i < ARRAYSIZE(outputPipes); i++) {
+      if (outputPipes[i][1] >= 0) {
+         close(outputPipes[i][1]);
+         outputPipes[i][1] = -1;
+      }
+   }
 #endif
 
    if (NULL == asyncState->procState) {
@@ -1950,13 +2243,11 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
 #endif
 
    /*
-    * Start a periodic procedure to check the app periodically
+    * Find out from the main loop when the app exits.
     */
    asyncState->eventQueue = eventQueue;
-   timer = g_timeout_source_new(SECONDS_BETWEEN_POLL_TEST_FINISHED * 1000);
-   g_source_set_callback(timer, VixToolsMonitorStartProgram, asyncState, NULL);
-   g_source_attach(timer, g_main_loop_get_context(eventQueue));
-   g_source_unref(timer);
+   VixToolsWatchAsyncProc(asyncState->procState, eventQueue,
+                          VixToolsMonitorStartProgram, asyncState);
 
    /*
     * VixToolsMonitorStartProgram will clean asyncState up when the program
@@ -1964,6 +2255,12 @@ VixToolsStartProgramImpl(const char *requestName,            // IN
     */
    asyncState = NULL;
 
+#if !defined(_WIN32)
+   if (NULL != output) {
+      *output = VixToolsWatchProgramOutput(outputPipes, eventQueue);
+   }
+#endif
+
 
 abort:
    free(tempCommandLine);
@@ -1976,6 +2273,15 @@ abort:
       VixToolsDestroyEnvironmentBlock(envBlock);
    }
    UNICODE_RELEASE_UTF16(procArgs.lpCurrentDirectory);
+#else
+   for (i = 0; i < ARRAYSIZE(outputPipes); i++) {
+      if (outputPipes[i][0] >= 0) {
+         close(outputPipes[i][0]);
+      }
+      if (outputPipes[i][1] >= 0) {
+         close(outputPipes[i][1]);
+      }
+   }
 #endif
 
    if (VIX_FAILED(err)) {
@@ -1986,12 +2292,99 @@ abort:
 } // VixToolsStartProgramImpl
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsAsyncProcExited --
+ *
+ *    Watch callback calling the monitor of a program when it exits.
+ *
+ * Return value:
+ *    FALSE, the monitor watches the program again if needed.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#ifdef _WIN32
+static gboolean
+VixToolsAsyncProcExited(gpointer clientData)  // IN
+#else
+static gboolean
+VixToolsAsyncProcExited(GIOChannel *chan,     // IN
+                        GIOCondition cond,    // IN
+                        gpointer clientData)  // IN
+#endif
+{
+   VixToolsAsyncProcWatch *watch = clientData;
+
+   (void) watch->monitor(watch->clientData);
+
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsWatchAsyncProc --
+ *
+ *    Has the main loop call the monitor of a program when the program
+ *    exits, instead of polling it. The monitor is called with clientData,
+ *    and must watch the program again if it is still running.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsWatchAsyncProc(ProcMgr_AsyncProc *procState,   // IN
+                       void *eventQueue,               // IN
+                       GSourceFunc monitor,            // IN
+                       void *clientData)               // IN
+{
+   VixToolsAsyncProcWatch *watch = g_new(VixToolsAsyncProcWatch, 1);
+   GSource *source;
+#ifndef _WIN32
+   GIOChannel *chan;
+#endif
+
+   watch->monitor = monitor;
+   watch->clientData = clientData;
+
+#ifdef _WIN32
+   source = VMTools_NewHandleSource(ProcMgr_GetAsyncProcSelectable(procState));
+#else
+   /*
+    * The fd of the process waiter becomes readable when the program
+    * exits. It stays owned by procState.
+    */
+   chan = g_io_channel_unix_new(ProcMgr_GetAsyncProcSelectable(procState));
+   source = g_io_create_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR);
+   g_io_channel_unref(chan);   // Ownership transferred to source.
+#endif
+
+   g_source_set_callback(source, (GSourceFunc) VixToolsAsyncProcExited,
+                         watch, g_free);
+   g_source_attach(source,
+                   g_main_loop_get_context((GMainLoop *) eventQueue));
+   g_source_unref(source);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * VixToolsMonitorAsyncProc --
  *
- *    This polls a program running in the guest to see if it has completed.
+ *    Called when a program running in the guest may have completed.
  *    It is used by the test/dev code to detect when a test application
  *    completes.
  *
@@ -2028,15 +2421,21 @@ VixToolsMonitorAsyncProc(void *clientData) // IN
     * that freeze the filesystem.
     */
    procIsRunning = ProcMgr_IsAsyncProcRunning(asyncState->procState);
-   if (!procIsRunning) {
-      if (gRestrictCommands) {
-         g_debug("%s: Deferring RunScript cleanup due to IO freeze\n",
-                 __FUNCTION__);
-      } else {
-         goto cleanup;
-      }
+   if (procIsRunning) {
+      VixToolsWatchAsyncProc(asyncState->procState, asyncState->eventQueue,
+                             VixToolsMonitorAsyncProc, asyncState);
+      return FALSE;
+   }
+
+   if (!gRestrictCommands) {
+      goto cleanup;
    }
 
+   /*
+    * The program has exited, so poll until the freeze is over.
+    */
+   g_debug("%s: Deferring RunScript cleanup due to IO freeze\n",
+           __FUNCTION__);
    timer = g_timeout_source_new(SECONDS_BETWEEN_POLL_TEST_FINISHED * 1000);
    g_source_set_callback(timer, VixToolsMonitorAsyncProc, asyncState, NULL);
    g_source_attach(timer, g_main_loop_get_context(asyncState->eventQueue));
@@ -2101,7 +2500,7 @@ VixToolsInvalidateStaleProcHandles(void *clientData)   // IN:
 {
    VixToolsUpdateStartedProgramList(NULL);
 
-   if (startedProcessList != NULL) {
+   if (!g_queue_is_empty(&startedProcessList)) {
       /*
        * There are still proc handles on the list, so keep the periodic timer
        * registered.
@@ -2254,7 +2653,7 @@ VixToolsRegisterHgfsSessionInvalidator(void *clientData)    // IN:
  *
  * VixToolsMonitorStartProgram --
  *
- *    This polls a program started by StartProgram to see if it has completed.
+ *    Called when a program started by StartProgram may have completed.
  *    If it has, saves off its exitCode and endTime so they can be queried
  *    via ListProcessesEx.
  *
@@ -2277,7 +2676,6 @@ VixToolsMonitorStartProgram(void *clientData) // IN
    ProcMgr_Pid pid = -1;
    int result = -1;
    VixToolsStartedProgramState *spState;
-   GSource *timer;
 
    asyncState = (VixToolsStartProgramState *) clientData;
    ASSERT(asyncState);
@@ -2290,10 +2688,8 @@ VixToolsMonitorStartProgram(void *clientData) // IN
       goto done;
    }
 
-   timer = g_timeout_source_new(SECONDS_BETWEEN_POLL_TEST_FINISHED * 1000);
-   g_source_set_callback(timer, VixToolsMonitorStartProgram, asyncState, NULL);
-   g_source_attach(timer, g_main_loop_get_context(asyncState->eventQueue));
-   g_source_unref(timer);
+   VixToolsWatchAsyncProc(asyncState->procState, asyncState->eventQueue,
+                          VixToolsMonitorStartProgram, asyncState);
    return FALSE;
 
 done:
@@ -2321,8 +2717,9 @@ done:
    spState->exitCode = exitCode;
    spState->endTime = time(NULL);
    spState->isRunning = FALSE;
-   spState->next = NULL;
    spState->procState = asyncState->procState;
+   spState->link = NULL;
+   spState->exitedLink = NULL;
 
    // add it to the list of exited programs
    VixToolsUpdateStartedProgramList(spState);
@@ -2333,6 +2730,36 @@ done:
 } // VixToolsMonitorStartProgram
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsRemoveStartedProgramState --
+ *
+ *    Removes a program's state from the saved list and frees it.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsRemoveStartedProgramState(VixToolsStartedProgramState *state) // IN
+{
+   if (g_hash_table_lookup(startedProcessTable, &state->pid) == state) {
+      g_hash_table_remove(startedProcessTable, &state->pid);
+   }
+   g_queue_delete_link(&startedProcessList, state->link);
+   if (NULL != state->exitedLink) {
+      g_queue_delete_link(&exitedProcessList, state->exitedLink);
+   }
+   VixToolsFreeStartedProgramState(state);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -2345,7 +2772,8 @@ done:
  *    None
  *
  * Side effects:
- *    Apps that have been saved past their expiration date are dropped.
+ *    Apps that have been saved past their expiration date are dropped,
+ *    and the oldest exited ones if there are too many.
  *
  *-----------------------------------------------------------------------------
  */
@@ -2353,9 +2781,7 @@ done:
 static void
 VixToolsUpdateStartedProgramList(VixToolsStartedProgramState *state)        // IN
 {
-   VixToolsStartedProgramState *spList = NULL;
-   VixToolsStartedProgramState *last = NULL;
-   VixToolsStartedProgramState *old = NULL;
+   VixToolsStartedProgramState *old;
    time_t now;
 
    now = time(NULL);
@@ -2364,90 +2790,84 @@ VixToolsUpdateStartedProgramList(VixToolsStartedProgramState *state)        // I
     * Update the 'running' record if the process has completed.
     */
    if (state && (state->isRunning == FALSE)) {
-      spList = startedProcessList;
-      while (spList) {
-         if (spList->pid == state->pid) {
-            /*
-             * Update the two exit fields now that we have them
-             */
-            spList->exitCode = state->exitCode;
-            spList->endTime = state->endTime;
-            spList->isRunning = FALSE;
+      old = g_hash_table_lookup(startedProcessTable, &state->pid);
+      if (NULL != old) {
+         /*
+          * Update the two exit fields now that we have them
+          */
+         old->exitCode = state->exitCode;
+         old->endTime = state->endTime;
+         old->isRunning = FALSE;
 
-            guest_debug("%s: started program '%s' has completed, "
-                        "exitCode %d\n", __FUNCTION__,
-                        spList->fullCommandLine, spList->exitCode);
+         guest_debug("%s: started program '%s' has completed, "
+                     "exitCode %d\n", __FUNCTION__,
+                     old->fullCommandLine, old->exitCode);
 
-            /*
-             * Don't let the procState be free'd on Windows to
-             * keep OS from reusing the pid. We need to free
-             * procState in case of Posix to avoid unnecessary
-             * caching of FDs, which might make the service run
-             * out of FDs as FDs are limited (usually 1024 by
-             * default) for a process.
-             */
+         /*
+          * Don't let the procState be free'd on Windows to
+          * keep OS from reusing the pid. We need to free
+          * procState in case of Posix to avoid unnecessary
+          * caching of FDs, which might make the service run
+          * out of FDs as FDs are limited (usually 1024 by
+          * default) for a process.
+          */
 #ifdef WIN32
-            spList->procState = state->procState;
-            state->procState = NULL;
+         old->procState = state->procState;
+         state->procState = NULL;
 #else
-            spList->procState = NULL;
+         old->procState = NULL;
 #endif
 
-            VixToolsFreeStartedProgramState(state);
-            // NULL it out so we don't try to add it later in this function
-            state  = NULL;
-            break;
-         } else {
-            spList = spList->next;
+         if (NULL == old->exitedLink) {
+            g_queue_push_tail(&exitedProcessList, old);
+            old->exitedLink = g_queue_peek_tail_link(&exitedProcessList);
          }
+
+         VixToolsFreeStartedProgramState(state);
+         // NULL it out so we don't try to add it later in this function
+         state  = NULL;
+      }
+   }
+
+
+   /*
+    * Find and toss any old records. They are sorted by exit time.
+    */
+   while (!g_queue_is_empty(&exitedProcessList)) {
+      old = g_queue_peek_head(&exitedProcessList);
+      if (old->endTime >= (now - VIX_TOOLS_EXITED_PROGRAM_REAP_TIME) &&
+          g_queue_get_length(&exitedProcessList) <=
+             VIX_TOOLS_MAX_EXITED_PROGRAMS) {
+         break;
       }
+      VixToolsRemoveStartedProgramState(old);
    }
 
 
    /*
-    * Find and toss any old records.
+    * Add any new record to the list
     */
-   spList = startedProcessList;
-   while (spList) {
+   if (state) {
       /*
        * Sanity check we don't have a duplicate entry -- this should
        * only happen when the OS re-uses the PID before we reap the record
-       * of its exit status.
+       * of its exit status. The new program replaces the old record.
        */
-      if (state) {
-         if (state->pid == spList->pid) {
-            // XXX just whine for M/N, needs better fix in *main
-            g_warning("%s: found duplicate entry in startedProcessList\n",
-                      __FUNCTION__);
-         }
+      old = g_hash_table_lookup(startedProcessTable, &state->pid);
+      if (NULL != old) {
+         // XXX just whine for M/N, needs better fix in *main
+         g_warning("%s: found duplicate entry in startedProcessList\n",
+                   __FUNCTION__);
+         VixToolsRemoveStartedProgramState(old);
       }
 
-      if (!spList->isRunning &&
-          (spList->endTime < (now - VIX_TOOLS_EXITED_PROGRAM_REAP_TIME))) {
-         if (last) {
-            last->next = spList->next;
-         } else {
-            startedProcessList = spList->next;
-         }
-         old = spList;
-         spList = spList->next;
-         VixToolsFreeStartedProgramState(old);
-      } else {
-         last = spList;
-         spList = spList->next;
-      }
-   }
-
-
-   /*
-    * Add any new record to the list
-    */
-   if (state) {
-      if (last) {
-         last->next = state;
-      } else {
-         startedProcessList = state;
+      g_queue_push_tail(&startedProcessList, state);
+      state->link = g_queue_peek_tail_link(&startedProcessList);
+      if (!state->isRunning) {
+         g_queue_push_tail(&exitedProcessList, state);
+         state->exitedLink = g_queue_peek_tail_link(&exitedProcessList);
       }
+      g_hash_table_insert(startedProcessTable, &state->pid, state);
    }
 
 } // VixToolsUpdateStartedProgramList
@@ -2483,6 +2903,8 @@ VixToolsFreeStartedProgramState(VixToolsStartedProgramState *spState) // IN
       ProcMgr_Free(spState->procState);
    }
 
+   VixToolsFreeProgramOutput(spState->output);
+
    free(spState);
 } // VixToolsFreeStartedProgramState
 
@@ -2507,17 +2929,192 @@ VixToolsFreeStartedProgramState(VixToolsStartedProgramState *spState) // IN
 VixToolsStartedProgramState *
 VixToolsFindStartedProgramState(uint64 pid)
 {
-   VixToolsStartedProgramState *spList;
+   return g_hash_table_lookup(startedProcessTable, &pid);
+}
+
+
+#if !defined(_WIN32)
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsOutputRingAppend --
+ *
+ *    Appends output of a program to its ring buffer. The buffer grows up
+ *    to VIX_TOOLS_MAX_PROGRAM_OUTPUT, then the oldest output is
+ *    overwritten.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsOutputRingAppend(VixToolsOutputRing *ring,   // IN/OUT
+                         const char *data,           // IN
+                         size_t length)              // IN
+{
+   size_t pos;
+   size_t chunk;
+
+   if (ring->total + length > ring->size &&
+       ring->size < VIX_TOOLS_MAX_PROGRAM_OUTPUT) {
+      size_t newSize = MAX(ring->size, VIX_TOOLS_MIN_PROGRAM_OUTPUT);
+
+      /*
+       * It did not wrap yet, so the output stays in place.
+       */
+      while (newSize < ring->total + length &&
+             newSize < VIX_TOOLS_MAX_PROGRAM_OUTPUT) {
+         newSize *= 2;
+      }
+      ring->data = Util_SafeRealloc(ring->data, newSize);
+      ring->size = newSize;
+   }
+
+   if (length > ring->size) {
+      data += length - ring->size;
+      ring->total += length - ring->size;
+      length = ring->size;
+   }
+
+   while (length > 0) {
+      pos = ring->total % ring->size;
+      chunk = MIN(length, ring->size - pos);
+      memcpy(ring->data + pos, data, chunk);
+      data += chunk;
+      length -= chunk;
+      ring->total += chunk;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsProgramOutputReadable --
+ *
+ *    Reads the output a program wrote to one of its streams.
+ *
+ * Results:
+ *    FALSE once the stream is closed, TRUE otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+VixToolsProgramOutputReadable(GIOChannel *chan,       // IN
+                              GIOCondition cond,      // IN
+                              gpointer clientData)    // IN
+{
+   VixToolsOutputRing *ring = clientData;
+   char buf[4096];
+   ssize_t n;
+
+   n = read(g_io_channel_unix_get_fd(chan), buf, sizeof buf);
+   if (n > 0) {
+      VixToolsOutputRingAppend(ring, buf, n);
+      return TRUE;
+   }
+   if (n < 0 && (EINTR == errno || EAGAIN == errno)) {
+      return TRUE;
+   }
+
+   /*
+    * The program, and anything it started, closed the stream.
+    */
+   g_source_unref(ring->watch);
+   ring->watch = NULL;
+
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsWatchProgramOutput --
+ *
+ *    Starts reading the output of a program from the read ends of its
+ *    stdout and stderr pipes, which the result takes over.
+ *
+ * Results:
+ *    The captured output.
+ *
+ * Side effects:
+ *    The descriptors are set to -1.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VixToolsProgramOutput *
+VixToolsWatchProgramOutput(int pipes[2][2],     // IN/OUT
+                           void *eventQueue)    // IN
+{
+   VixToolsProgramOutput *output = Util_SafeCalloc(1, sizeof *output);
+   int i;
+
+   for (i = 0; i < ARRAYSIZE(output->streams); i++) {
+      VixToolsOutputRing *ring = &output->streams[i];
+      GIOChannel *chan = g_io_channel_unix_new(pipes[i][0]);
+
+      g_io_channel_set_close_on_unref(chan, TRUE);
+      ring->watch = g_io_create_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR);
+      g_io_channel_unref(chan);   // Ownership transferred to the watch.
+      pipes[i][0] = -1;
+
+      g_source_set_callback(ring->watch,
+                            (GSourceFunc) VixToolsProgramOutputReadable,
+                            ring, NULL);
+      g_source_attach(ring->watch,
+                      g_main_loop_get_context((GMainLoop *) eventQueue));
+   }
+
+   return output;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsFreeProgramOutput --
+ *
+ *    Stops capturing the output of a program and frees it.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Closes the streams that are still open.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsFreeProgramOutput(VixToolsProgramOutput *output)  // IN
+{
+   int i;
 
-   spList = startedProcessList;
-   while (spList) {
-      if (spList->pid == pid) {
-         return spList;
+   if (NULL == output) {
+      return;
+   }
+
+   for (i = 0; i < ARRAYSIZE(output->streams); i++) {
+      if (NULL != output->streams[i].watch) {
+         g_source_destroy(output->streams[i].watch);
+         g_source_unref(output->streams[i].watch);
       }
-      spList = spList->next;
+      free(output->streams[i].data);
    }
 
-   return NULL;
+   free(output);
 }
 
 
@@ -4487,7 +5084,7 @@ VixToolsGetAllEnvVarsForUser(void *userToken,     // IN
       err = VIX_E_FAIL;
       return err;
    }
-   envp = VixToolsEnvironmentTableToEnvp(userEnvironmentTable);
+   envp = VixToolsGetUserEnvp();
 #endif
 
    if (NULL == result) {
@@ -4565,9 +5162,6 @@ VixToolsGetAllEnvVarsForUser(void *userToken,     // IN
 
 abort:
    VixToolsDestroyEnvIterator(itr);
-#ifdef __FreeBSD__
-   VixToolsFreeEnvp(envp);
-#endif
    *result = resultLocal;
 
    return err;
@@ -4656,6 +5250,7 @@ VixToolsWriteVariable(VixCommandRequestHeader *requestMsg)   // IN
           */
          HashTable_ReplaceOrInsert(userEnvironmentTable, valueName,
                                    Util_SafeStrdup(value));
+         VixToolsInvalidateUserEnvp();
       }
 #endif
       break;
@@ -5522,6 +6117,7 @@ VixToolsListProcessesExGenerateData(uint32 numPids,          // IN
    ProcMgrProcInfo *procInfo;
    DynBuf dynBuffer;
    VixToolsStartedProgramState *spList;
+   GList *link;
    int numReported = 0;
    int i;
    int j;
@@ -5542,29 +6138,25 @@ VixToolsListProcessesExGenerateData(uint32 numPids,          // IN
    VixToolsUpdateStartedProgramList(NULL);
    if (numPids > 0) {
       for (i = 0; i < numPids; i++) {
-         spList = startedProcessList;
-         while (spList) {
-            if (pids[i] == spList->pid) {
-               err = VixToolsPrintProcInfoEx(&dynBuffer,
-                                             spList->cmdName,
-                                             spList->fullCommandLine,
-                                             spList->pid,
-                                             spList->user,
-                                             (int) spList->startTime,
-                                             spList->exitCode,
-                                             (int) spList->endTime);
-               if (VIX_OK != err) {
-                  goto abort;
-               }
-               numReported++;
-               break;
+         spList = VixToolsFindStartedProgramState(pids[i]);
+         if (NULL != spList) {
+            err = VixToolsPrintProcInfoEx(&dynBuffer,
+                                          spList->cmdName,
+                                          spList->fullCommandLine,
+                                          spList->pid,
+                                          spList->user,
+                                          (int) spList->startTime,
+                                          spList->exitCode,
+                                          (int) spList->endTime);
+            if (VIX_OK != err) {
+               goto abort;
             }
-            spList = spList->next;
+            numReported++;
          }
       }
    } else {
-      spList = startedProcessList;
-      while (spList) {
+      for (link = startedProcessList.head; NULL != link; link = link->next) {
+         spList = link->data;
          err = VixToolsPrintProcInfoEx(&dynBuffer,
                                        spList->cmdName,
                                        spList->fullCommandLine,
@@ -5576,7 +6168,6 @@ VixToolsListProcessesExGenerateData(uint32 numPids,          // IN
          if (VIX_OK != err) {
             goto abort;
          }
-         spList = spList->next;
       }
    }
 
@@ -6222,6 +6813,133 @@ abort:
 } // VixToolsKillProcess
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsReadProgramOutput --
+ *
+ *    Returns the output a program started with
+ *    VIX_REQUESTMSG_CAPTURE_PROGRAM_OUTPUT wrote to one of its streams,
+ *    from the requested offset on, or from the oldest output still kept.
+ *
+ * Return value:
+ *    VixError
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VixError
+VixToolsReadProgramOutput(VixCommandRequestHeader *requestMsg,  // IN
+                          size_t maxBufferSize,                 // IN
+                          char **result,                        // OUT
+                          size_t *resultLength)                 // OUT
+{
+   VixError err = VIX_OK;
+   VixMsgReadProgramOutputRequest *outputRequest;
+   VixMsgReadProgramOutputResponse *response;
+   VixToolsStartedProgramState *spState;
+   VixToolsOutputRing *ring;
+   Bool impersonatingVMWareUser = FALSE;
+   void *userToken = NULL;
+   char *userName = NULL;
+   uint64 offset;
+   uint64 oldest;
+   size_t length;
+   size_t pos;
+   size_t chunk;
+   char *data;
+   VMAutomationRequestParser parser;
+
+   *result = NULL;
+   *resultLength = 0;
+
+   err = VMAutomationRequestParserInit(&parser,
+                                       requestMsg, sizeof *outputRequest);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+
+   outputRequest = (VixMsgReadProgramOutputRequest *) requestMsg;
+
+   /*
+    * The output may be binary.
+    */
+   if (!(requestMsg->commonHeader.commonFlags &
+         VIX_COMMAND_GUEST_RETURNS_BINARY) ||
+       outputRequest->stream > VIX_PROGRAM_OUTPUT_STDERR ||
+       maxBufferSize <= sizeof *response) {
+      err = VIX_E_INVALID_ARG;
+      goto abort;
+   }
+
+   err = VixToolsImpersonateUser(requestMsg, TRUE, &userToken);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+   impersonatingVMWareUser = TRUE;
+
+   g_debug("%s: User: %s pid %"FMT64"d stream %u offset %"FMT64"u\n",
+           __FUNCTION__, IMPERSONATED_USERNAME, outputRequest->pid,
+           outputRequest->stream, outputRequest->offset);
+
+   spState = VixToolsFindStartedProgramState(outputRequest->pid);
+   if (NULL == spState || NULL == spState->output) {
+      err = VIX_E_NO_SUCH_PROCESS;
+      goto abort;
+   }
+
+   /*
+    * The output is only for the user who started the program.
+    */
+   userName = VixToolsGetImpersonatedUsername(&userToken);
+   if (NULL == userName || NULL == spState->user ||
+       0 != strcmp(userName, spState->user)) {
+      err = VIX_E_GUEST_USER_PERMISSIONS;
+      goto abort;
+   }
+
+   ring = &spState->output->streams[outputRequest->stream];
+   oldest = (ring->total > ring->size) ? ring->total - ring->size : 0;
+   offset = MIN(MAX(outputRequest->offset, oldest), ring->total);
+   length = (size_t) MIN(ring->total - offset,
+                         MIN(outputRequest->maxLength,
+                             maxBufferSize - sizeof *response));
+
+   *result = Util_SafeMalloc(sizeof *response + length);
+   response = (VixMsgReadProgramOutputResponse *) *result;
+   response->dataOffset = offset;
+   response->totalLength = ring->total;
+   response->eof = (NULL == ring->watch);
+   response->dataLength = (uint32) length;
+   *resultLength = sizeof *response + length;
+
+   data = *result + sizeof *response;
+   while (length > 0) {
+      pos = offset % ring->size;
+      chunk = MIN(length, ring->size - pos);
+      memcpy(data, ring->data + pos, chunk);
+      data += chunk;
+      offset += chunk;
+      length -= chunk;
+   }
+
+abort:
+   if (impersonatingVMWareUser) {
+      VixToolsUnimpersonateUser(userToken);
+   }
+   VixToolsLogoutUser(userToken);
+   free(userName);
+
+   g_message("%s: opcode %d returning %"FMT64"d\n", __FUNCTION__,
+             requestMsg->opCode, err);
+
+   return err;
+} // VixToolsReadProgramOutput
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -6333,12 +7051,12 @@ abort:
 /*
  *-----------------------------------------------------------------------------
  *
- * VixToolsListDirectory --
+ * VixToolsDirCursorFree --
  *
+ *    Closes the directory of a cursor and frees it.
  *
  * Return value:
- *    TRUE on success
- *    FALSE on failure
+ *    None
  *
  * Side effects:
  *    None
@@ -6346,52 +7064,459 @@ abort:
  *-----------------------------------------------------------------------------
  */
 
-VixError
-VixToolsListDirectory(VixCommandRequestHeader *requestMsg,    // IN
-                      size_t maxBufferSize,                   // IN
-                      char **result)                          // OUT
+static void
+VixToolsDirCursorFree(VixToolsDirCursor *cursor)  // IN
 {
-   VixError err = VIX_OK;
-   const char *dirPathName = NULL;
-   char *fileList = NULL;
-   char **fileNameList = NULL;
-   size_t resultBufferSize = 0;
-   size_t lastGoodResultBufferSize = 0;
-   int numFiles = 0;
-   int lastGoodNumFiles = 0;
-   int fileNum;
-   char *currentFileName;
-   char *destPtr;
-   char *endDestPtr;
-   Bool impersonatingVMWareUser = FALSE;
-   size_t formatStringLength;
-   void *userToken = NULL;
-   VixMsgListDirectoryRequest *listRequest = NULL;
-   VixMsgSimpleFileRequest *legacyListRequest = NULL;
-   Bool truncated = FALSE;
-   int64 offset = 0;
-   Bool isLegacyFormat;
-   VMAutomationRequestParser parser;
-   int dirPathLen;
-   Bool escapeStrs;
+   if (NULL != cursor->timer) {
+      g_source_destroy(cursor->timer);
+      g_source_unref(cursor->timer);
+   }
+#ifdef _WIN32
+   File_WalkDirectoryEnd(cursor->walk);
+   free(cursor->userName);
+#else
+   if (NULL != cursor->dir) {
+      closedir(cursor->dir);
+   }
+#endif
+   if (NULL != cursor->regex) {
+      g_regex_unref(cursor->regex);
+   }
+   free(cursor->pending);
+   free(cursor->pattern);
+   free(cursor->dirPathName);
+   free(cursor);
+}
 
-   legacyListRequest = (VixMsgSimpleFileRequest *) requestMsg;
-   if (legacyListRequest->fileOptions & VIX_LIST_DIRECTORY_USE_OFFSET) {
-      /*
-       * Support updated ListDirectory format.
-       */
-      err = VMAutomationRequestParserInit(&parser,
-                                          requestMsg, sizeof *listRequest);
-      if (VIX_OK != err) {
-         goto abort;
-      }
 
-      listRequest = (VixMsgListDirectoryRequest *) requestMsg;
-      offset = listRequest->offset;
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorCleanup --
+ *
+ *    Timer callback closing a cursor that was not used again.
+ *
+ * Return value:
+ *    FALSE -- tells glib not to clean up
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
 
-      dirPathLen = listRequest->guestPathNameLength;
-      isLegacyFormat = FALSE;
-   } else {
+static gboolean
+VixToolsDirCursorCleanup(void *clientData) // IN
+{
+   VixToolsDirCursor *cursor = clientData;
+
+   g_debug("%s: closing listing of '%s' after %d entries\n",
+           __FUNCTION__, cursor->dirPathName, cursor->numReturned);
+
+   gDirCursors = g_list_remove(gDirCursors, cursor);
+   VixToolsDirCursorFree(cursor);
+
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorRewind --
+ *
+ *    Opens the directory of a cursor, or goes back to its first entry.
+ *
+ * Return value:
+ *    TRUE on success, FALSE with errno set otherwise.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsDirCursorRewind(VixToolsDirCursor *cursor)  // IN
+{
+   cursor->nextDot = cursor->withDots ? 0 : 2;
+   free(cursor->pending);
+   cursor->pending = NULL;
+
+#ifdef _WIN32
+   /*
+    * File_WalkDirectory keeps the names it returned, to skip the ones a
+    * concurrent change would return twice.
+    */
+   File_WalkDirectoryEnd(cursor->walk);
+   cursor->walk = File_WalkDirectoryStart(cursor->dirPathName);
+   return NULL != cursor->walk;
+#else
+   if (NULL == cursor->dir) {
+      cursor->dir = Posix_OpenDir(cursor->dirPathName);
+      return NULL != cursor->dir;
+   }
+   rewinddir(cursor->dir);
+   return TRUE;
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorRead --
+ *
+ *    Reads the next entry of a cursor matching its pattern, "." and ".."
+ *    coming first if requested.
+ *
+ * Return value:
+ *    TRUE and the name of the entry, to be freed by the caller, or FALSE
+ *    at the end of the directory or on error.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsDirCursorRead(VixToolsDirCursor *cursor,  // IN
+                      char **fileName)            // OUT
+{
+   if (NULL != cursor->pending) {
+      *fileName = cursor->pending;
+      cursor->pending = NULL;
+      return TRUE;
+   }
+
+   while (TRUE) {
+      char *name;
+
+      if (cursor->nextDot < 2) {
+         name = Unicode_Alloc(0 == cursor->nextDot++ ? "." : "..",
+                              STRING_ENCODING_UTF8);
+      } else {
+#ifdef _WIN32
+         if (!File_WalkDirectoryNext(cursor->walk, &name)) {
+            return FALSE;
+         }
+#else
+         struct dirent *entry;
+
+         errno = 0;
+         entry = readdir(cursor->dir);
+         if (NULL == entry) {
+            return FALSE;
+         }
+         if ((strcmp(entry->d_name, ".") == 0) ||
+             (strcmp(entry->d_name, "..") == 0)) {
+            continue;
+         }
+         if (Unicode_IsBufferValid(entry->d_name, -1,
+                                   STRING_ENCODING_DEFAULT)) {
+            name = Unicode_Alloc(entry->d_name, STRING_ENCODING_DEFAULT);
+         } else {
+            name = Unicode_Duplicate(UNICODE_SUBSTITUTION_CHAR
+                                     UNICODE_SUBSTITUTION_CHAR
+                                     UNICODE_SUBSTITUTION_CHAR);
+         }
+#endif
+      }
+
+      if (NULL == cursor->regex ||
+          g_regex_match(cursor->regex, name, 0, NULL)) {
+         *fileName = name;
+         return TRUE;
+      }
+      free(name);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorIsOwned --
+ *
+ *    Checks that a cursor was opened by the impersonated user.
+ *
+ * Return value:
+ *    TRUE if it was.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsDirCursorIsOwned(const VixToolsDirCursor *cursor)  // IN
+{
+#ifdef _WIN32
+   wchar_t *userName = NULL;
+   Bool owned = VixToolsGetUserName(&userName) &&
+                0 == wcscmp(userName, cursor->userName);
+
+   free(userName);
+   return owned;
+#else
+   return cursor->euid == Id_GetEUid();
+#endif
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorGet --
+ *
+ *    Finds the cursor of the listing of a directory that returned exactly
+ *    'start' entries, or opens a new one positioned there. A new cursor
+ *    reads the directory once to count the matching entries.
+ *
+ * Return value:
+ *    VixError
+ *
+ * Side effects:
+ *    The cursor is owned by the caller until VixToolsDirCursorRelease.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VixError
+VixToolsDirCursorGet(const char *dirPathName,       // IN
+                     const char *pattern,           // IN: may be NULL
+                     Bool withDots,                 // IN
+                     int start,                     // IN
+                     VixToolsDirCursor **cursorOut) // OUT
+{
+   VixToolsDirCursor *cursor;
+   GList *link;
+   char *name;
+
+   for (link = gDirCursors; NULL != link; link = link->next) {
+      cursor = link->data;
+      if (cursor->numReturned == start &&
+          cursor->withDots == withDots &&
+          0 == strcmp(cursor->dirPathName, dirPathName) &&
+          0 == g_strcmp0(cursor->pattern, pattern) &&
+          VixToolsDirCursorIsOwned(cursor)) {
+         gDirCursors = g_list_delete_link(gDirCursors, link);
+         g_source_destroy(cursor->timer);
+         g_source_unref(cursor->timer);
+         cursor->timer = NULL;
+         *cursorOut = cursor;
+         return VIX_OK;
+      }
+   }
+
+   cursor = Util_SafeCalloc(1, sizeof *cursor);
+   cursor->dirPathName = Util_SafeStrdup(dirPathName);
+   cursor->withDots = withDots;
+   if (NULL != pattern) {
+      cursor->pattern = Util_SafeStrdup(pattern);
+      cursor->regex = g_regex_new(pattern, 0, 0, NULL);
+   }
+#ifdef _WIN32
+   if (!VixToolsGetUserName(&cursor->userName)) {
+      g_warning("%s: failed to get current userName\n", __FUNCTION__);
+      VixToolsDirCursorFree(cursor);
+      return VIX_E_FAIL;
+   }
+#else
+   cursor->euid = Id_GetEUid();
+#endif
+
+   if (!VixToolsDirCursorRewind(cursor)) {
+      VixError err = FoundryToolsDaemon_TranslateSystemErr();
+
+      VixToolsDirCursorFree(cursor);
+      return err;
+   }
+
+   /*
+    * Count what the whole listing returns, then skip what the previous
+    * pages returned.
+    */
+   while (VixToolsDirCursorRead(cursor, &name)) {
+      cursor->numMatches++;
+      free(name);
+   }
+   if (!VixToolsDirCursorRewind(cursor)) {
+      VixError err = FoundryToolsDaemon_TranslateSystemErr();
+
+      VixToolsDirCursorFree(cursor);
+      return err;
+   }
+   while (cursor->numReturned < start &&
+          VixToolsDirCursorRead(cursor, &name)) {
+      cursor->numReturned++;
+      free(name);
+   }
+
+   *cursorOut = cursor;
+   return VIX_OK;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorNext --
+ *
+ *    Returns the next entry of a listing.
+ *
+ * Return value:
+ *    TRUE and the name of the entry, to be freed by the caller, or FALSE
+ *    at the end of the listing.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VixToolsDirCursorNext(VixToolsDirCursor *cursor,  // IN
+                      char **fileName)            // OUT
+{
+   if (!VixToolsDirCursorRead(cursor, fileName)) {
+      return FALSE;
+   }
+   cursor->numReturned++;
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorUnread --
+ *
+ *    Gives back the last entry returned by VixToolsDirCursorNext, because
+ *    it did not fit in the page. It comes first in the next page.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    The cursor takes ownership of fileName.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsDirCursorUnread(VixToolsDirCursor *cursor,  // IN
+                        char *fileName)             // IN
+{
+   ASSERT(NULL == cursor->pending);
+
+   cursor->pending = fileName;
+   cursor->numReturned--;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsDirCursorRelease --
+ *
+ *    Keeps a cursor for the request fetching the next page of the listing,
+ *    or frees it if the listing is complete.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    The least recently used cursor may be closed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsDirCursorRelease(VixToolsDirCursor *cursor,  // IN
+                         Bool complete,              // IN
+                         GMainLoop *eventQueue)      // IN
+{
+   if (complete || NULL == eventQueue) {
+      VixToolsDirCursorFree(cursor);
+      return;
+   }
+
+   gDirCursors = g_list_prepend(gDirCursors, cursor);
+   if (g_list_length(gDirCursors) > MAX_DIR_CURSORS) {
+      GList *last = g_list_last(gDirCursors);
+
+      VixToolsDirCursorFree(last->data);
+      gDirCursors = g_list_delete_link(gDirCursors, last);
+   }
+
+   cursor->timer = g_timeout_source_new(SECONDS_UNTIL_DIR_CURSOR_CLEANUP * 1000);
+   g_source_set_callback(cursor->timer, VixToolsDirCursorCleanup, cursor, NULL);
+   g_source_attach(cursor->timer, g_main_loop_get_context(eventQueue));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsListDirectory --
+ *
+ *
+ * Return value:
+ *    TRUE on success
+ *    FALSE on failure
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+VixError
+VixToolsListDirectory(VixCommandRequestHeader *requestMsg,    // IN
+                      size_t maxBufferSize,                   // IN
+                      GMainLoop *eventQueue,                  // IN
+                      char **result)                          // OUT
+{
+   VixError err = VIX_OK;
+   const char *dirPathName = NULL;
+   char *fileList = NULL;
+   size_t resultBufferSize = 0;
+   char *currentFileName;
+   char *destPtr;
+   char *endDestPtr;
+   Bool impersonatingVMWareUser = FALSE;
+   size_t formatStringLength;
+   void *userToken = NULL;
+   VixMsgListDirectoryRequest *listRequest = NULL;
+   VixMsgSimpleFileRequest *legacyListRequest = NULL;
+   VixToolsDirCursor *cursor = NULL;
+   Bool truncated = FALSE;
+   int64 offset = 0;
+   Bool isLegacyFormat;
+   VMAutomationRequestParser parser;
+   int dirPathLen;
+   Bool escapeStrs;
+
+   legacyListRequest = (VixMsgSimpleFileRequest *) requestMsg;
+   if (legacyListRequest->fileOptions & VIX_LIST_DIRECTORY_USE_OFFSET) {
+      /*
+       * Support updated ListDirectory format.
+       */
+      err = VMAutomationRequestParserInit(&parser,
+                                          requestMsg, sizeof *listRequest);
+      if (VIX_OK != err) {
+         goto abort;
+      }
+
+      listRequest = (VixMsgListDirectoryRequest *) requestMsg;
+      offset = listRequest->offset;
+
+      dirPathLen = listRequest->guestPathNameLength;
+      isLegacyFormat = FALSE;
+   } else {
       /*
        * Support legacy ListDirectory format.
        */
@@ -6411,7 +7536,7 @@ VixToolsListDirectory(VixCommandRequestHeader *requestMsg,    // IN
       goto abort;
    }
 
-   if (0 == *dirPathName) {
+   if (0 == *dirPathName || offset < 0 || offset > MAX_INT32) {
       err = VIX_E_INVALID_ARG;
       goto abort;
    }
@@ -6433,68 +7558,35 @@ VixToolsListDirectory(VixCommandRequestHeader *requestMsg,    // IN
       goto abort;
    }
 
-   numFiles = File_ListDirectory(dirPathName, &fileNameList);
-   if (numFiles < 0) {
-      err = FoundryToolsDaemon_TranslateSystemErr();
+   err = VixToolsDirCursorGet(dirPathName, NULL, FALSE, (int) offset,
+                              &cursor);
+   if (VIX_OK != err) {
       goto abort;
    }
 
    /*
-    * Calculate the size of the result buffer and keep track of the
-    * max number of entries we can store.
+    * The page is printed straight into the result buffer, keeping room
+    * for the largest entry.
     */
    resultBufferSize = 3; // truncation bool + space + '\0'
    if (escapeStrs) {
       resultBufferSize += strlen(VIX_XML_ESCAPED_TAG);
    }
-   lastGoodResultBufferSize = resultBufferSize;
-   ASSERT_NOT_IMPLEMENTED(lastGoodResultBufferSize < maxBufferSize);
+   ASSERT_NOT_IMPLEMENTED(resultBufferSize < maxBufferSize);
    formatStringLength = strlen(fileInfoFormatString);
 
-   for (fileNum = offset; fileNum < numFiles; fileNum++) {
-      currentFileName = fileNameList[fileNum];
-
-      resultBufferSize += formatStringLength;
-      resultBufferSize += VixToolsXMLStringEscapedLen(currentFileName,
-                                                      escapeStrs);
-      resultBufferSize += 2; // DIRSEPC chars
-      resultBufferSize += 10 + 20 + 20; // properties + size + modTime
-
-      if (resultBufferSize < maxBufferSize) {
-         /*
-          * lastGoodNumFiles is a count (1 based), while fileNum is
-          * an array index (zero based).  So lastGoodNumFiles is
-          * fileNum + 1.
-          */
-         lastGoodNumFiles = fileNum + 1;
-         lastGoodResultBufferSize = resultBufferSize;
-      } else {
-         truncated = TRUE;
-         break;
-      }
-   }
-   resultBufferSize = lastGoodResultBufferSize;
-
-   /*
-    * Print the result buffer.
-    */
-   fileList = Util_SafeMalloc(resultBufferSize);
+   fileList = Util_SafeMalloc(maxBufferSize);
    destPtr = fileList;
-   endDestPtr = fileList + resultBufferSize;
+   endDestPtr = fileList + maxBufferSize;
 
    /*
     * Indicate if we have a truncated buffer with "1 ", otherwise "0 ".
-    * This should only happen for non-legacy requests.
+    * This should only happen for non-legacy requests. The flag is set
+    * once the page is complete.
     */
    if (!isLegacyFormat) {
-      if ((destPtr + 2) < endDestPtr) {
-         *destPtr++ = truncated ? '1' : '0';
-         *destPtr++ = ' ';
-      } else {
-         ASSERT(0);
-         err = VIX_E_OUT_OF_MEMORY;
-         goto abort;
-      }
+      *destPtr++ = '0';
+      *destPtr++ = ' ';
    }
 
    if (escapeStrs) {
@@ -6502,11 +7594,21 @@ VixToolsListDirectory(VixCommandRequestHeader *requestMsg,    // IN
                              VIX_XML_ESCAPED_TAG);
    }
 
-   for (fileNum = offset; fileNum < lastGoodNumFiles; fileNum++) {
-      /* File_ListDirectory never returns "." or ".." */
+   while (VixToolsDirCursorNext(cursor, &currentFileName)) {
+      /* The cursor never returns "." or ".." here */
       char *pathName;
 
-      currentFileName = fileNameList[fileNum];
+      resultBufferSize += formatStringLength;
+      resultBufferSize += VixToolsXMLStringEscapedLen(currentFileName,
+                                                      escapeStrs);
+      resultBufferSize += 2; // DIRSEPC chars
+      resultBufferSize += 10 + 20 + 20; // properties + size + modTime
+
+      if (resultBufferSize >= maxBufferSize) {
+         truncated = TRUE;
+         VixToolsDirCursorUnread(cursor, currentFileName);
+         break;
+      }
 
       pathName = Str_SafeAsprintf(NULL, "%s%s%s", dirPathName, DIRSEPS,
                                   currentFileName);
@@ -6515,10 +7617,23 @@ VixToolsListDirectory(VixCommandRequestHeader *requestMsg,    // IN
                             endDestPtr);
 
       free(pathName);
-   } // for (fileNum = 0; fileNum < lastGoodNumFiles; fileNum++)
+      free(currentFileName);
+   }
    *destPtr = '\0';
 
+   if (!isLegacyFormat && truncated) {
+      fileList[0] = '1';
+   }
+
 abort:
+   if (NULL != cursor) {
+      /*
+       * Legacy requests have no offset to fetch the rest of the listing.
+       */
+      VixToolsDirCursorRelease(cursor, !truncated || isLegacyFormat,
+                               eventQueue);
+   }
+
    if (impersonatingVMWareUser) {
       VixToolsUnimpersonateUser(userToken);
    }
@@ -6529,13 +7644,6 @@ abort:
    }
    *result = fileList;
 
-   if (NULL != fileNameList) {
-      for (fileNum = 0; fileNum < numFiles; fileNum++) {
-         free(fileNameList[fileNum]);
-      }
-      free(fileNameList);
-   }
-
    // XXX result too large for g_debug()
 
    g_message("%s: opcode %d returning %"FMT64"d\n", __FUNCTION__,
@@ -6564,22 +7672,21 @@ abort:
 VixError
 VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
                   size_t maxBufferSize,                   // IN
+                  GMainLoop *eventQueue,                  // IN
                   char **result)                          // OUT
 {
    VixError err = VIX_OK;
    const char *dirPathName = NULL;
    char *fileList = NULL;
-   char **fileNameList = NULL;
+   DynBuf entries;
    size_t resultBufferSize = 0;
-   size_t lastGoodResultBufferSize = 0;
-   int numFiles = 0;
-   int fileNum;
-   char *currentFileName;
-   char *destPtr;
-   char *endDestPtr;
+   char *currentFileName = NULL;
+   char *entry;
+   char *remainingTag;
    Bool impersonatingVMWareUser = FALSE;
    void *userToken = NULL;
    VixMsgListFilesRequest *listRequest = NULL;
+   VixToolsDirCursor *cursor = NULL;
    Bool truncated = FALSE;
    uint64 offset = 0;
    Bool listingSingleFile = FALSE;
@@ -6588,7 +7695,7 @@ VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
    int maxResults = 0;
    int count = 0;
    int remaining = 0;
-   int numResults;
+   uint64 start;
    GRegex *regex = NULL;
    GError *gErr = NULL;
    char *pathName;
@@ -6596,38 +7703,264 @@ VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
 
    ASSERT(NULL != requestMsg);
 
+   DynBuf_Init(&entries);
+
+   err = VMAutomationRequestParserInit(&parser,
+                                       requestMsg, sizeof *listRequest);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+
+   listRequest = (VixMsgListFilesRequest *) requestMsg;
+   offset = listRequest->offset;
+   index = listRequest->index;
+   maxResults = listRequest->maxResults;
+
+   err = VMAutomationRequestParserGetString(&parser,
+                                            listRequest->guestPathNameLength,
+                                            &dirPathName);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+
+   if (listRequest->patternLength > 0) {
+      err = VMAutomationRequestParserGetString(&parser,
+                                               listRequest->patternLength,
+                                               &pattern);
+      if (VIX_OK != err) {
+         goto abort;
+      }
+
+      g_debug("%s: pattern length is %d, value is '%s'\n",
+              __FUNCTION__, listRequest->patternLength, pattern);
+   }
+
+   /*
+    * Entries are skipped by their position in the (filtered) listing.
+    */
+   start = offset + index;
+   if (0 == *dirPathName || index < 0 || start > MAX_INT32) {
+      err = VIX_E_INVALID_ARG;
+      goto abort;
+   }
+
+   err = VixToolsImpersonateUser(requestMsg, TRUE, &userToken);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+   impersonatingVMWareUser = TRUE;
+
+   g_debug("%s: User: %s listing files in '%s' with pattern '%s' "
+           "index %d, maxResults %d (offset %d)\n",
+           __FUNCTION__, IMPERSONATED_USERNAME, dirPathName,
+           (NULL != pattern) ? pattern : "",
+           index, maxResults, (int) offset);
+
+   if (pattern) {
+      regex = g_regex_new(pattern, 0, 0, &gErr);
+      if (!regex) {
+         g_warning("%s: bad regex pattern '%s' (%s);"
+                   "failing with INVALID_ARG\n",
+                   __FUNCTION__, pattern, gErr ? gErr->message : "");
+         err = VIX_E_INVALID_ARG;
+         goto abort;
+      }
+   }
+
+   /*
+    * First check for symlink -- File_IsDirectory() will lie
+    * if its a symlink to a directory.
+    */
+   if (!File_IsSymLink(dirPathName) && File_IsDirectory(dirPathName)) {
+      /*
+       * The cursor lists '.' and '..' too, in front since that's a more
+       * normal location.
+       */
+      err = VixToolsDirCursorGet(dirPathName, pattern, TRUE, (int) start,
+                                 &cursor);
+      if (VIX_OK != err) {
+         goto abort;
+      }
+   } else {
+      if (File_Exists(dirPathName)) {
+         listingSingleFile = TRUE;
+      } else {
+         /*
+          * We don't know what they intended to list, but we'll
+          * assume file since that gives a fairly sane error.
+          */
+         err = FoundryToolsDaemon_TranslateSystemErr();
+         goto abort;
+      }
+   }
+
+   /*
+    * Keep track of the max number of entries we can store. Also
+    * compute the number we won't be returning (anything > maxResults).
+    */
+   resultBufferSize = 3; // truncation bool + space + '\0'
+   // space for the 'remaining' tag up front
+   resultBufferSize += strlen(listFilesRemainingFormatString) + 10;
+   ASSERT_NOT_IMPLEMENTED(resultBufferSize < maxBufferSize);
+
+   while (TRUE) {
+      if (listingSingleFile) {
+         if (0 != start || NULL != currentFileName ||
+             (regex && !g_regex_match(regex, dirPathName, 0, NULL))) {
+            break;
+         }
+         currentFileName = Util_SafeStrdup(dirPathName);
+         if (count >= maxResults) {
+            remaining = 1;
+            break;
+         }
+         pathName = Util_SafeStrdup(currentFileName);
+      } else {
+         if (count >= maxResults ||
+             !VixToolsDirCursorNext(cursor, &currentFileName)) {
+            break;
+         }
+         pathName = Str_SafeAsprintf(NULL, "%s%s%s", dirPathName, DIRSEPS,
+                                     currentFileName);
+      }
+
+      entry = VixToolsPrintFileExtendedInfoEx(pathName, currentFileName);
+      free(pathName);
+
+      resultBufferSize += strlen(entry);
+      if (resultBufferSize >= maxBufferSize) {
+         truncated = TRUE;
+         free(entry);
+         if (NULL != cursor) {
+            VixToolsDirCursorUnread(cursor, currentFileName);
+            currentFileName = NULL;
+         }
+         break;
+      }
+
+      DynBuf_Append(&entries, entry, strlen(entry));
+      free(entry);
+      if (NULL != cursor) {
+         free(currentFileName);
+         currentFileName = NULL;
+      }
+      count++;
+   }
+
+   if (NULL != cursor && !truncated) {
+      remaining = MAX(cursor->numMatches - cursor->numReturned, 0);
+   }
+   DynBuf_AppendString(&entries, "");
+
+   /*
+    * Indicate if we have a truncated buffer with "1 ", otherwise "0 ".
+    */
+   remainingTag = Str_SafeAsprintf(NULL, listFilesRemainingFormatString,
+                                   remaining);
+   fileList = Str_SafeAsprintf(NULL, "%c %s%s", truncated ? '1' : '0',
+                               remainingTag, (char *) DynBuf_Get(&entries));
+   free(remainingTag);
+
+abort:
+   if (NULL != cursor) {
+      VixToolsDirCursorRelease(cursor, !truncated && 0 == remaining,
+                               eventQueue);
+   }
+
+   if (impersonatingVMWareUser) {
+      VixToolsUnimpersonateUser(userToken);
+   }
+   VixToolsLogoutUser(userToken);
+
+   if (NULL != regex) {
+      g_regex_unref(regex);
+   }
+   if (NULL != gErr) {
+      g_error_free(gErr);
+   }
+
+   if (listingSingleFile) {
+      free(currentFileName);
+   }
+   DynBuf_Destroy(&entries);
+
+   if (NULL == fileList) {
+      fileList = Util_SafeStrdup("");
+   }
+   *result = fileList;
+
+   // XXX result too large for g_debug()
+
+   g_message("%s: opcode %d returning %"FMT64"d\n", __FUNCTION__,
+             requestMsg->opCode, err);
+
+   return err;
+} // VixToolsListFiles
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsGetMultipleFileInfo --
+ *
+ *    Get the extended info of each path in the request, under a single
+ *    impersonation, into one reply formatted like the ListFiles one.
+ *    A path that can't be found gets an <fxe> element with its error
+ *    instead of failing the command. If the reply is full, the remaining
+ *    paths are left out and counted in the <rem> tag, so that the client
+ *    can ask for them again.
+ *
+ * Return value:
+ *    VixError
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+VixError
+VixToolsGetMultipleFileInfo(VixCommandRequestHeader *requestMsg,  // IN
+                            size_t maxBufferSize,                 // IN
+                            char **result)                        // OUT
+{
+   VixError err = VIX_OK;
+   Bool impersonatingVMWareUser = FALSE;
+   void *userToken = NULL;
+   VixMsgGetMultipleFileInfoRequest *infoRequest;
+   VMAutomationRequestParser parser;
+   const char *paths = NULL;
+   const char *filePathName;
+   DynBuf entries;
+   size_t resultBufferSize = 0;
+   char *remainingTag;
+   char *fileList = NULL;
+   Bool truncated = FALSE;
+   uint32 count = 0;
+
+   ASSERT(NULL != requestMsg);
+   ASSERT(NULL != result);
+
+   DynBuf_Init(&entries);
+
    err = VMAutomationRequestParserInit(&parser,
-                                       requestMsg, sizeof *listRequest);
+                                       requestMsg, sizeof *infoRequest);
    if (VIX_OK != err) {
       goto abort;
    }
 
-   listRequest = (VixMsgListFilesRequest *) requestMsg;
-   offset = listRequest->offset;
-   index = listRequest->index;
-   maxResults = listRequest->maxResults;
+   infoRequest = (VixMsgGetMultipleFileInfoRequest *) requestMsg;
 
-   err = VMAutomationRequestParserGetString(&parser,
-                                            listRequest->guestPathNameLength,
-                                            &dirPathName);
-   if (VIX_OK != err) {
+   if (0 == infoRequest->numPaths) {
+      err = VIX_E_INVALID_ARG;
       goto abort;
    }
 
-   if (listRequest->patternLength > 0) {
-      err = VMAutomationRequestParserGetString(&parser,
-                                               listRequest->patternLength,
-                                               &pattern);
-      if (VIX_OK != err) {
-         goto abort;
-      }
-
-      g_debug("%s: pattern length is %d, value is '%s'\n",
-              __FUNCTION__, listRequest->patternLength, pattern);
-   }
-
-   if (0 == *dirPathName) {
-      err = VIX_E_INVALID_ARG;
+   err = VMAutomationRequestParserGetOptionalStrings(&parser,
+                                                     infoRequest->numPaths,
+                                                     infoRequest->pathsLength,
+                                                     &paths);
+   if (VIX_OK != err) {
       goto abort;
    }
 
@@ -6637,166 +7970,55 @@ VixToolsListFiles(VixCommandRequestHeader *requestMsg,    // IN
    }
    impersonatingVMWareUser = TRUE;
 
-   g_debug("%s: User: %s listing files in '%s' with pattern '%s' "
-           "index %d, maxResults %d (offset %d)\n",
-           __FUNCTION__, IMPERSONATED_USERNAME, dirPathName,
-           (NULL != pattern) ? pattern : "",
-           index, maxResults, (int) offset);
-
-   if (pattern) {
-      regex = g_regex_new(pattern, 0, 0, &gErr);
-      if (!regex) {
-         g_warning("%s: bad regex pattern '%s' (%s);"
-                   "failing with INVALID_ARG\n",
-                   __FUNCTION__, pattern, gErr ? gErr->message : "");
-         err = VIX_E_INVALID_ARG;
-         goto abort;
-      }
-   }
-
-   /*
-    * First check for symlink -- File_IsDirectory() will lie
-    * if its a symlink to a directory.
-    */
-   if (!File_IsSymLink(dirPathName) && File_IsDirectory(dirPathName)) {
-      numFiles = File_ListDirectory(dirPathName, &fileNameList);
-      if (numFiles < 0) {
-         err = FoundryToolsDaemon_TranslateSystemErr();
-         goto abort;
-      }
-      /*
-       * File_ListDirectory() doesn't return '.' and '..', but we want them,
-       * so add '.' and '..' to the list.  Place them in front since that's
-       * a more normal location.
-       */
-      numFiles += 2;
-      {
-         char **newFileNameList = NULL;
-
-         newFileNameList = Util_SafeMalloc(numFiles * sizeof(char *));
-         newFileNameList[0] = Unicode_Alloc(".", STRING_ENCODING_UTF8);
-         newFileNameList[1] = Unicode_Alloc("..", STRING_ENCODING_UTF8);
-         memcpy(newFileNameList + 2, fileNameList, (numFiles - 2) * sizeof(char *));
-         free(fileNameList);
-         fileNameList = newFileNameList;
-      }
-   } else {
-      if (File_Exists(dirPathName)) {
-         listingSingleFile = TRUE;
-         numFiles = 1;
-         fileNameList = Util_SafeMalloc(sizeof(char *));
-         fileNameList[0] = Util_SafeStrdup(dirPathName);
-      } else {
-         /*
-          * We don't know what they intended to list, but we'll
-          * assume file since that gives a fairly sane error.
-          */
-         err = FoundryToolsDaemon_TranslateSystemErr();
-         goto abort;
-      }
-   }
+   g_debug("%s: User: %s paths: %u\n",
+           __FUNCTION__, IMPERSONATED_USERNAME, infoRequest->numPaths);
 
-   /*
-    * Calculate the size of the result buffer and keep track of the
-    * max number of entries we can store.  Also compute the number
-    * we won't be returning (anything > maxResults).
-    */
    resultBufferSize = 3; // truncation bool + space + '\0'
    // space for the 'remaining' tag up front
    resultBufferSize += strlen(listFilesRemainingFormatString) + 10;
-   lastGoodResultBufferSize = resultBufferSize;
-   ASSERT_NOT_IMPLEMENTED(lastGoodResultBufferSize < maxBufferSize);
-
-   for (fileNum = offset + index;
-        fileNum < numFiles;
-        fileNum++) {
-
-      currentFileName = fileNameList[fileNum];
-
-      if (regex) {
-         if (!g_regex_match(regex, currentFileName, 0, NULL)) {
-            continue;
-         }
-      }
-
-      if (count < maxResults) {
-         count++;
+   ASSERT_NOT_IMPLEMENTED(resultBufferSize < maxBufferSize);
+
+   for (filePathName = paths;
+        count < infoRequest->numPaths;
+        filePathName += strlen(filePathName) + 1) {
+      char *entry;
+
+      if (0 == *filePathName) {
+         entry = Str_SafeAsprintf(NULL, fileInfoErrorFormatString, "",
+                                  (int64) VIX_E_INVALID_ARG);
+      } else if (File_Exists(filePathName)) {
+         entry = VixToolsPrintFileExtendedInfoEx(filePathName, filePathName);
       } else {
-         remaining++;
-         continue;   // stop computing buffersize
-      }
+         VixError fileErr = FoundryToolsDaemon_TranslateSystemErr();
+         char *escapedFileName = VixToolsEscapeXMLString(filePathName);
 
-      if (listingSingleFile) {
-         resultBufferSize += VixToolsGetFileExtendedInfoLength(currentFileName,
-                                                               currentFileName);
-      } else {
-         pathName = Str_SafeAsprintf(NULL, "%s%s%s", dirPathName, DIRSEPS,
-                                     currentFileName);
-         resultBufferSize += VixToolsGetFileExtendedInfoLength(pathName,
-                                                               currentFileName);
-         free(pathName);
+         ASSERT_MEM_ALLOC(NULL != escapedFileName);
+         entry = Str_SafeAsprintf(NULL, fileInfoErrorFormatString,
+                                  escapedFileName, fileErr);
+         free(escapedFileName);
       }
 
-      if (resultBufferSize < maxBufferSize) {
-         lastGoodResultBufferSize = resultBufferSize;
-      } else {
+      resultBufferSize += strlen(entry);
+      if (resultBufferSize >= maxBufferSize) {
          truncated = TRUE;
+         free(entry);
          break;
       }
-   }
-   resultBufferSize = lastGoodResultBufferSize;
-   numResults = count;
 
-   /*
-    * Print the result buffer.
-    */
-   fileList = Util_SafeMalloc(resultBufferSize);
-   destPtr = fileList;
-   endDestPtr = fileList + resultBufferSize;
+      DynBuf_Append(&entries, entry, strlen(entry));
+      free(entry);
+      count++;
+   }
+   DynBuf_AppendString(&entries, "");
 
    /*
     * Indicate if we have a truncated buffer with "1 ", otherwise "0 ".
-    * This should only happen for non-legacy requests.
     */
-   if ((destPtr + 2) < endDestPtr) {
-      *destPtr++ = truncated ? '1' : '0';
-      *destPtr++ = ' ';
-   } else {
-      ASSERT(0);
-      err = VIX_E_OUT_OF_MEMORY;
-      goto abort;
-   }
-
-   destPtr += Str_Sprintf(destPtr, endDestPtr - destPtr,
-                          listFilesRemainingFormatString, remaining);
-
-
-   for (fileNum = offset + index, count = 0;
-        count < numResults;
-        fileNum++) {
-
-      currentFileName = fileNameList[fileNum];
-
-      if (regex) {
-         if (!g_regex_match(regex, currentFileName, 0, NULL)) {
-            continue;
-         }
-      }
-
-      if (listingSingleFile) {
-         pathName = Util_SafeStrdup(currentFileName);
-      } else {
-         pathName = Str_SafeAsprintf(NULL, "%s%s%s", dirPathName, DIRSEPS,
-                                     currentFileName);
-      }
-
-      VixToolsPrintFileExtendedInfo(pathName, currentFileName,
-                                    &destPtr, endDestPtr);
-
-      free(pathName);
-      count++;
-   } // for (fileNum = 0; fileNum < lastGoodNumFiles; fileNum++)
-   *destPtr = '\0';
+   remainingTag = Str_SafeAsprintf(NULL, listFilesRemainingFormatString,
+                                   (int) (infoRequest->numPaths - count));
+   fileList = Str_SafeAsprintf(NULL, "%c %s%s", truncated ? '1' : '0',
+                               remainingTag, (char *) DynBuf_Get(&entries));
+   free(remainingTag);
 
 abort:
    if (impersonatingVMWareUser) {
@@ -6804,29 +8026,20 @@ abort:
    }
    VixToolsLogoutUser(userToken);
 
-   if (NULL != regex) {
-      g_regex_unref(regex);
-   }
+   DynBuf_Destroy(&entries);
 
    if (NULL == fileList) {
       fileList = Util_SafeStrdup("");
    }
    *result = fileList;
 
-   if (NULL != fileNameList) {
-      for (fileNum = 0; fileNum < numFiles; fileNum++) {
-         free(fileNameList[fileNum]);
-      }
-      free(fileNameList);
-   }
-
    // XXX result too large for g_debug()
 
    g_message("%s: opcode %d returning %"FMT64"d\n", __FUNCTION__,
              requestMsg->opCode, err);
 
    return err;
-} // VixToolsListFiles
+} // VixToolsGetMultipleFileInfo
 
 
 /*
@@ -7555,7 +8768,6 @@ VixToolsRunScript(VixCommandRequestHeader *requestMsg,  // IN
    Bool forcedRoot = FALSE;
    wchar_t *envBlock = NULL;
 #endif
-   GSource *timer;
    VMAutomationRequestParser parser;
 
    err = VMAutomationRequestParserInit(&parser,
@@ -7797,7 +9009,7 @@ VixToolsRunScript(VixCommandRequestHeader *requestMsg,  // IN
    procArgs.dwCreationFlags = CREATE_UNICODE_ENVIRONMENT;
    procArgs.lpEnvironment = envBlock;
 #else
-   procArgs.envp = VixToolsEnvironmentTableToEnvp(userEnvironmentTable);
+   procArgs.envp = VixToolsGetUserEnvp();
 #endif
 
    asyncState->procState = ProcMgr_ExecAsync(fullCommandLine, &procArgs);
@@ -7806,9 +9018,6 @@ VixToolsRunScript(VixCommandRequestHeader *requestMsg,  // IN
    if (forcedRoot) {
       Impersonate_UnforceRoot();
    }
-#else
-   VixToolsFreeEnvp(procArgs.envp);
-   DEBUG_ONLY(procArgs.envp = NULL;)
 #endif
 
    if (NULL == asyncState->procState) {
@@ -7819,10 +9028,8 @@ VixToolsRunScript(VixCommandRequestHeader *requestMsg,  // IN
    pid = (int64) ProcMgr_GetPid(asyncState->procState);
 
    asyncState->eventQueue = eventQueue;
-   timer = g_timeout_source_new(SECONDS_BETWEEN_POLL_TEST_FINISHED * 1000);
-   g_source_set_callback(timer, VixToolsMonitorAsyncProc, asyncState, NULL);
-   g_source_attach(timer, g_main_loop_get_context(eventQueue));
-   g_source_unref(timer);
+   VixToolsWatchAsyncProc(asyncState->procState, eventQueue,
+                          VixToolsMonitorAsyncProc, asyncState);
 
    /*
     * VixToolsMonitorAsyncProc will clean asyncState up when the program finishes.
@@ -7884,6 +9091,11 @@ VixToolsImpersonateUser(VixCommandRequestHeader *requestMsg,   // IN
    char *credentialField;
    int credentialType;
 
+   if (gInBatch) {
+      *userToken = gBatchUserToken;
+      return VIX_OK;
+   }
+
    credentialField = ((char *) requestMsg)
                            + requestMsg->commonHeader.headerLength
                            + requestMsg->commonHeader.bodyLength;
@@ -7967,54 +9179,260 @@ VixToolsImpersonateUser(VixCommandRequestHeader *requestMsg,   // IN
       }
       break;
    }
-#if SUPPORT_VGAUTH
-   case VIX_USER_CREDENTIAL_SAML_BEARER_TOKEN:
-   {
-      VixCommandSAMLToken *samlStruct =
-         (VixCommandSAMLToken *) credentialField;
-      credentialField += sizeof(*samlStruct);
+#if SUPPORT_VGAUTH
+   case VIX_USER_CREDENTIAL_SAML_BEARER_TOKEN:
+   {
+      VixCommandSAMLToken *samlStruct =
+         (VixCommandSAMLToken *) credentialField;
+      credentialField += sizeof(*samlStruct);
+
+      err = VixToolsImpersonateUserImplEx(NULL,
+                                          credentialType,
+                                          credentialField,
+                                          loadUserProfile,
+                                          userToken);
+      break;
+   }
+#endif
+   case VIX_USER_CREDENTIAL_SSPI:
+      /*
+       * SSPI currently only supported in ticketed sessions
+       */
+   default:
+      g_warning("%s: Unsupported credentialType = %d\n",
+                __FUNCTION__, credentialType);
+      err = VIX_E_NOT_SUPPORTED;
+   }
+
+done:
+   if (err != VIX_OK) {
+      g_warning("%s: impersonation failed (%"FMT64"d)\n",
+                  __FUNCTION__, err);
+   } else {
+      g_debug("%s: successfully impersonated user %s\n", __FUNCTION__,
+              IMPERSONATED_USERNAME);
+   }
+
+   return(err);
+} // VixToolsImpersonateUser
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsImpersonateUserImpl --
+ *
+ *    Little compatability wrapper for legacy Foundry Tools implementations.
+ *
+ * Return value:
+ *    TRUE on success
+ *    FALSE on failure
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+Bool
+VixToolsImpersonateUserImpl(char const *credentialTypeStr,         // IN
+                            int credentialType,                    // IN
+                            char const *obfuscatedNamePassword,    // IN
+                            void **userToken)                      // OUT
+{
+   return(VIX_OK == VixToolsImpersonateUserImplEx(credentialTypeStr,
+                                                  credentialType,
+                                                  obfuscatedNamePassword,
+                                                  TRUE,
+                                                  userToken));
+} // VixToolsImpersonateUserImpl
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsFreeCachedCredential --
+ *
+ *    Frees a credential cache entry. A VGAuth handle still used by the
+ *    current impersonation is left for VixToolsLogoutUser to free.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsFreeCachedCredential(gpointer p)  // IN
+{
+   VixToolsCachedCredential *entry = p;
+
+#if SUPPORT_VGAUTH
+   if (NULL != entry->userHandle) {
+      if (currentUserHandleCached && entry->userHandle == currentUserHandle) {
+         currentUserHandleCached = FALSE;
+      } else {
+         VGAuth_UserHandleFree(entry->userHandle);
+      }
+   }
+#endif
+   free(entry->userName);
+   free(entry);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsCredentialCacheKey --
+ *
+ *    Computes the key of credentials checked by a validation method.
+ *
+ * Return value:
+ *    The key, to be freed with g_free, or NULL if credentials are not
+ *    cached.
+ *
+ * Side effects:
+ *    None
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gchar *
+VixToolsCredentialCacheKey(const char *method,        // IN
+                           const char *credentials)   // IN
+{
+   char *data;
+   gchar *key;
+
+   if (NULL == gCredentialCache || NULL == gConfDictRef ||
+       VMTools_ConfigGetInteger(gConfDictRef,
+                                VIX_TOOLS_CONFIG_API_GROUPNAME,
+                                VIXTOOLS_CONFIG_CREDENTIAL_CACHE_TIMEOUT_NAME,
+                                CREDENTIAL_CACHE_TIMEOUT_DEFAULT) <= 0) {
+      return NULL;
+   }
+
+   data = Str_SafeAsprintf(NULL, "%s:%s", method, credentials);
+   key = g_compute_hmac_for_data(G_CHECKSUM_SHA256,
+                                 gCredentialCacheKey,
+                                 sizeof gCredentialCacheKey,
+                                 (const guchar *) data, strlen(data));
+   Util_ZeroFreeString(data);
+
+   return key;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsCredentialCacheLookup --
+ *
+ *    Finds a validation of credentials that has not expired.
+ *
+ * Return value:
+ *    The entry, owned by the cache, or NULL.
+ *
+ * Side effects:
+ *    An expired entry is removed.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VixToolsCachedCredential *
+VixToolsCredentialCacheLookup(const gchar *key)   // IN: may be NULL
+{
+   VixToolsCachedCredential *entry;
+
+   if (NULL == key) {
+      return NULL;
+   }
 
-      err = VixToolsImpersonateUserImplEx(NULL,
-                                          credentialType,
-                                          credentialField,
-                                          loadUserProfile,
-                                          userToken);
-      break;
+   entry = g_hash_table_lookup(gCredentialCache, key);
+   if (NULL != entry && entry->expiry <= g_get_monotonic_time()) {
+      g_hash_table_remove(gCredentialCache, key);
+      entry = NULL;
    }
-#endif
-   case VIX_USER_CREDENTIAL_SSPI:
-      /*
-       * SSPI currently only supported in ticketed sessions
-       */
-   default:
-      g_warning("%s: Unsupported credentialType = %d\n",
-                __FUNCTION__, credentialType);
-      err = VIX_E_NOT_SUPPORTED;
+
+   return entry;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsCredentialCacheAdd --
+ *
+ *    Remembers a successful validation of credentials.
+ *
+ * Return value:
+ *    None
+ *
+ * Side effects:
+ *    The cache owns userHandle, if given. Expired entries are removed
+ *    when the cache is full.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VixToolsCredentialCacheAdd(const gchar *key,              // IN: may be NULL
+                           const char *userName,          // IN
+                           void *userHandle)              // IN: may be NULL
+{
+   VixToolsCachedCredential *entry;
+   gint64 now = g_get_monotonic_time();
+
+   if (NULL == key) {
+      return;
    }
 
-done:
-   if (err != VIX_OK) {
-      g_warning("%s: impersonation failed (%"FMT64"d)\n",
-                  __FUNCTION__, err);
-   } else {
-      g_debug("%s: successfully impersonated user %s\n", __FUNCTION__,
-              IMPERSONATED_USERNAME);
+   if (g_hash_table_size(gCredentialCache) >= MAX_CACHED_CREDENTIALS) {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init(&iter, gCredentialCache);
+      while (g_hash_table_iter_next(&iter, NULL, &value)) {
+         if (((VixToolsCachedCredential *) value)->expiry <= now) {
+            g_hash_table_iter_remove(&iter);
+         }
+      }
+      if (g_hash_table_size(gCredentialCache) >= MAX_CACHED_CREDENTIALS) {
+         g_hash_table_remove_all(gCredentialCache);
+      }
    }
 
-   return(err);
-} // VixToolsImpersonateUser
+   entry = Util_SafeCalloc(1, sizeof *entry);
+   entry->userName = Util_SafeStrdup(userName);
+   entry->expiry = now +
+      (gint64) VMTools_ConfigGetInteger(gConfDictRef,
+                                VIX_TOOLS_CONFIG_API_GROUPNAME,
+                                VIXTOOLS_CONFIG_CREDENTIAL_CACHE_TIMEOUT_NAME,
+                                CREDENTIAL_CACHE_TIMEOUT_DEFAULT) *
+      G_USEC_PER_SEC;
+#if SUPPORT_VGAUTH
+   entry->userHandle = userHandle;
+#else
+   ASSERT(NULL == userHandle);
+#endif
+
+   g_hash_table_replace(gCredentialCache, g_strdup(key), entry);
+}
 
 
 /*
  *-----------------------------------------------------------------------------
  *
- * VixToolsImpersonateUserImpl --
+ * VixToolsCredentialCacheFlush --
  *
- *    Little compatability wrapper for legacy Foundry Tools implementations.
+ *    Forgets all the validated credentials.
  *
  * Return value:
- *    TRUE on success
- *    FALSE on failure
+ *    None
  *
  * Side effects:
  *    None
@@ -8022,18 +9440,16 @@ done:
  *-----------------------------------------------------------------------------
  */
 
-Bool
-VixToolsImpersonateUserImpl(char const *credentialTypeStr,         // IN
-                            int credentialType,                    // IN
-                            char const *obfuscatedNamePassword,    // IN
-                            void **userToken)                      // OUT
+static void
+VixToolsCredentialCacheFlush(void)
 {
-   return(VIX_OK == VixToolsImpersonateUserImplEx(credentialTypeStr,
-                                                  credentialType,
-                                                  obfuscatedNamePassword,
-                                                  TRUE,
-                                                  userToken));
-} // VixToolsImpersonateUserImpl
+   if (NULL != gCredentialCache &&
+       g_hash_table_size(gCredentialCache) > 0) {
+      g_debug("%s: dropping %u cached credentials\n", __FUNCTION__,
+              g_hash_table_size(gCredentialCache));
+      g_hash_table_remove_all(gCredentialCache);
+   }
+}
 
 
 /*
@@ -8091,6 +9507,10 @@ VixToolsImpersonateUserImplEx(char const *credentialTypeStr,         // IN
       char *unobfuscatedUserName = NULL;
       char *unobfuscatedPassword = NULL;
       Bool success = FALSE;
+#ifndef _WIN32
+      gchar *cacheKey = NULL;
+      VixToolsCachedCredential *cached;
+#endif
 
       if (NULL != credentialTypeStr) {
          if (!StrUtil_StrToInt(&credentialType, credentialTypeStr)) {
@@ -8245,8 +9665,26 @@ VixToolsImpersonateUserImplEx(char const *credentialTypeStr,         // IN
             goto abort;
          }
 
+#ifdef _WIN32
          authToken = Auth_AuthenticateUser(unobfuscatedUserName,
                                            unobfuscatedPassword);
+#else
+         /*
+          * Credentials validated recently only need the user's entry.
+          */
+         cacheKey = VixToolsCredentialCacheKey("pam", obfuscatedNamePassword);
+         cached = VixToolsCredentialCacheLookup(cacheKey);
+         if (NULL != cached) {
+            authToken = Auth_GetPwnam(cached->userName);
+         } else {
+            authToken = Auth_AuthenticateUser(unobfuscatedUserName,
+                                              unobfuscatedPassword);
+            if (NULL != authToken) {
+               VixToolsCredentialCacheAdd(cacheKey, unobfuscatedUserName,
+                                          NULL);
+            }
+         }
+#endif
          if (NULL == authToken) {
             err = VIX_E_INVALID_LOGIN_CREDENTIALS;
             goto abort;
@@ -8281,6 +9719,9 @@ VixToolsImpersonateUserImplEx(char const *credentialTypeStr,         // IN
 abort:
       free(unobfuscatedUserName);
       Util_ZeroFreeString(unobfuscatedPassword);
+#ifndef _WIN32
+      g_free(cacheKey);
+#endif
    }
 
    return err;
@@ -8304,6 +9745,10 @@ abort:
 void
 VixToolsUnimpersonateUser(void *userToken)
 {
+   if (gInBatch) {
+      return;
+   }
+
    free(gImpersonatedUsername);
    gImpersonatedUsername = NULL;
 
@@ -8345,7 +9790,7 @@ VixToolsUnimpersonateUser(void *userToken)
 void
 VixToolsLogoutUser(void *userToken)    // IN
 {
-   if (PROCESS_CREATOR_USER_TOKEN == userToken) {
+   if (gInBatch || PROCESS_CREATOR_USER_TOKEN == userToken) {
       return;
    }
 
@@ -8355,8 +9800,11 @@ VixToolsLogoutUser(void *userToken)    // IN
       // close the handle we copied out
       CloseHandle((HANDLE) userToken);
 #endif
-      VGAuth_UserHandleFree(currentUserHandle);
+      if (!currentUserHandleCached) {
+         VGAuth_UserHandleFree(currentUserHandle);
+      }
       currentUserHandle = NULL;
+      currentUserHandleCached = FALSE;
       return;
    }
 #endif
@@ -9622,6 +11070,11 @@ VixToolsAddAuthAlias(VixCommandRequestHeader *requestMsg)    // IN
       err = VixToolsTranslateVGAuthError(vgErr);
    }
 
+   /*
+    * Cached SAML validations were made against the old aliases.
+    */
+   VixToolsCredentialCacheFlush();
+
 abort:
    if (ctx) {
       vgErr = VGAuth_Shutdown(ctx);
@@ -9762,6 +11215,11 @@ VixToolsRemoveAuthAlias(VixCommandRequestHeader *requestMsg)    // IN
       err = VixToolsTranslateVGAuthError(vgErr);
    }
 
+   /*
+    * Cached SAML validations may rely on the removed alias.
+    */
+   VixToolsCredentialCacheFlush();
+
 abort:
    if (ctx) {
       vgErr = VGAuth_Shutdown(ctx);
@@ -10640,6 +12098,7 @@ VixToolsCheckIfVixCommandEnabled(int opcode,                          // IN
          break;
 
       case VIX_COMMAND_LIST_FILES:
+      case VIX_COMMAND_GET_MULTIPLE_FILE_INFO:
          enabled = !VixToolsGetAPIDisabledFromConf(confDictRef,
                                    VIX_TOOLS_CONFIG_API_LIST_FILES_NAME);
          break;
@@ -10674,6 +12133,7 @@ VixToolsCheckIfVixCommandEnabled(int opcode,                          // IN
                                    VIX_TOOLS_CONFIG_API_MOVE_DIRECTORY_NAME);
          break;
       case VIX_COMMAND_START_PROGRAM:
+      case VIX_COMMAND_READ_PROGRAM_OUTPUT:
          enabled = !VixToolsGetAPIDisabledFromConf(confDictRef,
                                    VIX_TOOLS_CONFIG_API_START_PROGRAM_NAME);
          break;
@@ -10856,6 +12316,170 @@ VixToolsCheckIfAuthenticationTypeEnabled(GKeyFile *confDictRef,     // IN
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VixToolsRunBatch --
+ *
+ *    Runs the commands of a batch in order, impersonating the user once
+ *    for all of them, and returns all their results.
+ *
+ *    The batch stops at the first command that fails if the request asks
+ *    for it, or when the result of a command does not fit in the reply.
+ *    That command's result is then dropped and VIX_E_BUFFER_TOOSMALL
+ *    reported for it, although it did run.
+ *
+ * Return value:
+ *    VixError for the batch itself. The commands' errors are in the
+ *    result.
+ *
+ * Side effects:
+ *    Those of the commands.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VixError
+VixToolsRunBatch(VixCommandRequestHeader *requestMsg,   // IN
+                 char *requestName,                     // IN
+                 size_t maxBufferSize,                  // IN
+                 GKeyFile *confDictRef,                 // IN
+                 GMainLoop *eventQueue,                 // IN
+                 char **result,                         // OUT
+                 size_t *resultLength)                  // OUT
+{
+   VixError err = VIX_OK;
+   VixMsgBatchRequest *batchRequest;
+   VMAutomationRequestParser parser;
+   const char *commands;
+   size_t commandsLength;
+   DynBuf reply;
+   Bool impersonatingVMWareUser = FALSE;
+   void *userToken = NULL;
+   uint32 i;
+
+   DynBuf_Init(&reply);
+
+   err = VMAutomationRequestParserInit(&parser,
+                                       requestMsg, sizeof *batchRequest);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+   batchRequest = (VixMsgBatchRequest *) requestMsg;
+
+   /*
+    * The results may be binary.
+    */
+   if (!(requestMsg->commonHeader.commonFlags &
+         VIX_COMMAND_GUEST_RETURNS_BINARY) || gInBatch) {
+      err = VIX_E_INVALID_ARG;
+      goto abort;
+   }
+
+   commands = VMAutomationRequestParserGetRemainingData(&parser,
+                                                        &commandsLength);
+
+   err = VixToolsImpersonateUser(requestMsg, TRUE, &userToken);
+   if (VIX_OK != err) {
+      goto abort;
+   }
+   impersonatingVMWareUser = TRUE;
+
+   g_debug("%s: User: %s running %u commands\n",
+           __FUNCTION__, IMPERSONATED_USERNAME, batchRequest->numCommands);
+
+   gBatchUserToken = userToken;
+   gInBatch = TRUE;
+
+   for (i = 0; i < batchRequest->numCommands; i++) {
+      VixCommandRequestHeader *command = (VixCommandRequestHeader *) commands;
+      VixMsgBatchResult batchResult;
+      char *commandResult = NULL;
+      size_t commandResultLength = 0;
+      Bool deleteCommandResult = FALSE;
+      size_t room;
+
+      err = VixMsg_ValidateRequestMsg(command, commandsLength);
+      if (VIX_OK != err) {
+         break;
+      }
+      commands += command->commonHeader.totalMessageLength;
+      commandsLength -= command->commonHeader.totalMessageLength;
+
+      room = maxBufferSize - DynBuf_GetSize(&reply);
+      if (room <= sizeof batchResult) {
+         break;
+      }
+      room -= sizeof batchResult;
+
+      batchResult.opCode = command->opCode;
+      switch (command->opCode) {
+      /*
+       * These report their completion after the batch replied, or
+       * change the credentials the batch runs with.
+       */
+      case VIX_COMMAND_BATCH:
+      case VIX_COMMAND_RUN_PROGRAM:
+      case VIX_COMMAND_RUN_SCRIPT_IN_GUEST:
+      case VIX_COMMAND_LOGOUT_IN_GUEST:
+      case VIX_COMMAND_ACQUIRE_CREDENTIALS:
+      case VIX_COMMAND_RELEASE_CREDENTIALS:
+         batchResult.error = VIX_E_NOT_SUPPORTED;
+         break;
+      default:
+         batchResult.error = VixTools_ProcessVixCommand(command,
+                                                        requestName,
+                                                        room,
+                                                        confDictRef,
+                                                        eventQueue,
+                                                        &commandResult,
+                                                        &commandResultLength,
+                                                        &deleteCommandResult);
+         break;
+      }
+      gConfDictRef = confDictRef;
+
+      if (commandResultLength > room) {
+         batchResult.error = VIX_E_BUFFER_TOOSMALL;
+         commandResultLength = 0;
+      }
+      batchResult.additionalError =
+         VixTools_GetAdditionalError(command->opCode, batchResult.error);
+      batchResult.resultLength = (uint32) commandResultLength;
+
+      DynBuf_Append(&reply, &batchResult, sizeof batchResult);
+      DynBuf_Append(&reply, commandResult, commandResultLength);
+      if (deleteCommandResult) {
+         free(commandResult);
+      }
+
+      if (VIX_E_BUFFER_TOOSMALL == batchResult.error ||
+          (VIX_FAILED(batchResult.error) &&
+           (batchRequest->options & VIX_BATCH_STOP_ON_ERROR))) {
+         break;
+      }
+   }
+
+   gInBatch = FALSE;
+   gBatchUserToken = NULL;
+
+abort:
+   if (impersonatingVMWareUser) {
+      VixToolsUnimpersonateUser(userToken);
+   }
+   VixToolsLogoutUser(userToken);
+
+   *resultLength = DynBuf_GetSize(&reply);
+   *result = DynBuf_Detach(&reply);
+   DynBuf_Destroy(&reply);
+
+   g_message("%s: opcode %d returning %"FMT64"d\n", __FUNCTION__,
+             requestMsg->opCode, err);
+
+   return err;
+} // VixToolsRunBatch
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -10950,8 +12574,13 @@ VixTools_ProcessVixCommand(VixCommandRequestHeader *requestMsg,   // IN
    switch (requestMsg->opCode) {
       ////////////////////////////////////
       case VIX_COMMAND_CHECK_USER_ACCOUNT:
+         err = VixToolsCheckUserAccount(requestMsg);
+         break;
+
+      ////////////////////////////////////
       case VIX_COMMAND_LOGOUT_IN_GUEST:
          err = VixToolsCheckUserAccount(requestMsg);
+         VixToolsCredentialCacheFlush();
          break;
 
       ////////////////////////////////////
@@ -10999,6 +12628,7 @@ VixTools_ProcessVixCommand(VixCommandRequestHeader *requestMsg,   // IN
       case VIX_COMMAND_LIST_DIRECTORY:
          err = VixToolsListDirectory(requestMsg,
                                      maxResultBufferSize,
+                                     eventQueue,
                                      &resultValue);
          deleteResultValue = TRUE;
          break;
@@ -11007,10 +12637,18 @@ VixTools_ProcessVixCommand(VixCommandRequestHeader *requestMsg,   // IN
       case VIX_COMMAND_LIST_FILES:
          err = VixToolsListFiles(requestMsg,
                                  maxResultBufferSize,
+                                 eventQueue,
                                  &resultValue);
          deleteResultValue = TRUE;
          break;
       ////////////////////////////////////
+      case VIX_COMMAND_GET_MULTIPLE_FILE_INFO:
+         err = VixToolsGetMultipleFileInfo(requestMsg,
+                                           maxResultBufferSize,
+                                           &resultValue);
+         deleteResultValue = TRUE;
+         break;
+      ////////////////////////////////////
       case VIX_COMMAND_DELETE_GUEST_FILE:
       case VIX_COMMAND_DELETE_GUEST_FILE_EX:
       case VIX_COMMAND_DELETE_GUEST_REGISTRY_KEY:
@@ -11080,6 +12718,16 @@ VixTools_ProcessVixCommand(VixCommandRequestHeader *requestMsg,   // IN
          // resultValue is static. Do not free it.
          break;
 
+      ////////////////////////////////////
+      case VIX_COMMAND_READ_PROGRAM_OUTPUT:
+         err = VixToolsReadProgramOutput(requestMsg,
+                                         maxResultBufferSize,
+                                         &resultValue,
+                                         &resultValueLength);
+         deleteResultValue = TRUE;
+         mustSetResultValueLength = FALSE;
+         break;
+
       ////////////////////////////////////
       case VIX_COMMAND_CREATE_TEMPORARY_FILE:
       case VIX_COMMAND_CREATE_TEMPORARY_FILE_EX:
@@ -11187,6 +12835,7 @@ VixTools_ProcessVixCommand(VixCommandRequestHeader *requestMsg,   // IN
       ////////////////////////////////////
       case VIX_COMMAND_RELEASE_CREDENTIALS:
          err = VixToolsReleaseCredentials(requestMsg);
+         VixToolsCredentialCacheFlush();
          break;
 
       ////////////////////////////////////
@@ -11213,6 +12862,19 @@ VixTools_ProcessVixCommand(VixCommandRequestHeader *requestMsg,   // IN
       case VIX_COMMAND_REMOVE_AUTH_ALIAS_BY_CERT:
          err = VixToolsRemoveAuthAlias(requestMsg);
          break;
+
+      ////////////////////////////////////
+      case VIX_COMMAND_BATCH:
+         err = VixToolsRunBatch(requestMsg,
+                                requestName,
+                                maxResultBufferSize,
+                                confDictRef,
+                                eventQueue,
+                                &resultValue,
+                                &resultValueLength);
+         deleteResultValue = TRUE;
+         mustSetResultValueLength = FALSE;
+         break;
       case VIX_COMMAND_LIST_AUTH_PROVIDER_ALIASES:
           err = VixToolsListAuthAliases(requestMsg, maxResultBufferSize,
                                         &resultValue);
@@ -11755,39 +13417,51 @@ GuestAuthPasswordAuthenticateImpersonate(
 {
 #if SUPPORT_VGAUTH
    VixError err;
-   char *username = NULL;
-   char *password = NULL;
+   char *packed = NULL;
+   size_t packedLength = 0;
+   const char *username = NULL;
+   const char *password = NULL;
    VGAuthContext *ctx = NULL;
    VGAuthError vgErr;
    VGAuthUserHandle *newHandle = NULL;
    VGAuthExtraParams extraParams[1];
    Bool impersonated = FALSE;
+   gchar *cacheKey = NULL;
+   VixToolsCachedCredential *cached = NULL;
 
    extraParams[0].name = VGAUTH_PARAM_LOAD_USER_PROFILE;
    extraParams[0].value = loadUserProfile ? VGAUTH_PARAM_VALUE_TRUE :
                                             VGAUTH_PARAM_VALUE_FALSE;
 
-   err = VixMsg_DeObfuscateNamePassword(obfuscatedNamePassword,
-                                        &username,
-                                        &password);
-   if (err != VIX_OK) {
-      goto done;
-   }
-
-   err = VIX_E_INVALID_LOGIN_CREDENTIALS;
-
    vgErr = TheVGAuthContext(&ctx);
    if (VGAUTH_FAILED(vgErr)) {
       err = VixToolsTranslateVGAuthError(vgErr);
       goto done;
    }
 
-   vgErr = VGAuth_ValidateUsernamePassword(ctx, username, password,
-                                           0, NULL,
-                                           &newHandle);
-   if (VGAUTH_FAILED(vgErr)) {
-      err = VixToolsTranslateVGAuthError(vgErr);
-      goto done;
+   /*
+    * The credentials are only decoded when they have to be validated.
+    */
+   cacheKey = VixToolsCredentialCacheKey("password", obfuscatedNamePassword);
+   cached = VixToolsCredentialCacheLookup(cacheKey);
+   if (NULL != cached) {
+      newHandle = cached->userHandle;
+      username = cached->userName;
+   } else {
+      err = VixMsg_DeObfuscateNamePasswordInBuffer(obfuscatedNamePassword,
+                                                   &packed, &packedLength,
+                                                   &username, &password);
+      if (err != VIX_OK) {
+         goto done;
+      }
+
+      vgErr = VGAuth_ValidateUsernamePassword(ctx, username, password,
+                                              0, NULL,
+                                              &newHandle);
+      if (VGAUTH_FAILED(vgErr)) {
+         err = VixToolsTranslateVGAuthError(vgErr);
+         goto done;
+      }
    }
 
    vgErr = VGAuth_Impersonate(ctx, newHandle,
@@ -11809,14 +13483,18 @@ GuestAuthPasswordAuthenticateImpersonate(
    }
 #endif
 
+   if (NULL == cached && NULL != cacheKey) {
+      VixToolsCredentialCacheAdd(cacheKey, username, newHandle);
+      cached = VixToolsCredentialCacheLookup(cacheKey);
+   }
    currentUserHandle = newHandle;
+   currentUserHandleCached = NULL != cached;
    gImpersonatedUsername = Util_SafeStrdup(username);
 
    err = VIX_OK;
 
 done:
-   free(username);
-   Util_ZeroFreeString(password);
+   Util_ZeroFree(packed, packedLength);
 
    if (VIX_OK != err) {
       if (impersonated) {
@@ -11829,9 +13507,15 @@ done:
          vgErr = VGAuth_EndImpersonation(ctx);
          ASSERT(vgErr == VGAUTH_E_OK);
       }
-      VGAuth_UserHandleFree(newHandle);
+      if (NULL != cached) {
+         /* Don't trust a handle that failed to impersonate again. */
+         g_hash_table_remove(gCredentialCache, cacheKey);
+      } else {
+         VGAuth_UserHandleFree(newHandle);
+      }
       newHandle = NULL;
    }
+   g_free(cacheKey);
    return err;
 #else
    return VIX_E_NOT_SUPPORTED;
@@ -11864,33 +13548,47 @@ GuestAuthSAMLAuthenticateAndImpersonate(
 {
 #if SUPPORT_VGAUTH
    VixError err;
-   char *token = NULL;
-   char *username = NULL;
+   char *packed = NULL;
+   size_t packedLength = 0;
+   const char *token = NULL;
+   const char *username = NULL;
    VGAuthContext *ctx = NULL;
    VGAuthError vgErr;
    VGAuthUserHandle *newHandle = NULL;
    VGAuthExtraParams extraParams[1];
    Bool impersonated = FALSE;
+   gchar *cacheKey = NULL;
+   VixToolsCachedCredential *cached = NULL;
 
    extraParams[0].name = VGAUTH_PARAM_LOAD_USER_PROFILE;
    extraParams[0].value = loadUserProfile ? VGAUTH_PARAM_VALUE_TRUE :
                                             VGAUTH_PARAM_VALUE_FALSE;
 
-   err = VixMsg_DeObfuscateNamePassword(obfuscatedNamePassword,
-                                        &token,
-                                        &username);
-   if (err != VIX_OK) {
+   vgErr = TheVGAuthContext(&ctx);
+   if (VGAUTH_FAILED(vgErr)) {
+      err = VixToolsTranslateVGAuthError(vgErr);
       goto done;
    }
 
-   err = VIX_E_INVALID_LOGIN_CREDENTIALS;
+   /*
+    * The token is only decoded when it has to be validated.
+    */
+   cacheKey = VixToolsCredentialCacheKey("saml", obfuscatedNamePassword);
+   cached = VixToolsCredentialCacheLookup(cacheKey);
+   if (NULL != cached) {
+      newHandle = cached->userHandle;
+      goto impersonate;
+   }
 
-   vgErr = TheVGAuthContext(&ctx);
-   if (VGAUTH_FAILED(vgErr)) {
-      err = VixToolsTranslateVGAuthError(vgErr);
+   err = VixMsg_DeObfuscateNamePasswordInBuffer(obfuscatedNamePassword,
+                                                &packed, &packedLength,
+                                                &token, &username);
+   if (err != VIX_OK) {
       goto done;
    }
 
+   err = VIX_E_INVALID_LOGIN_CREDENTIALS;
+
    vgErr = VGAuth_ValidateSamlBearerToken(ctx,
                                           token,
                                           username,
@@ -11952,9 +13650,7 @@ GuestAuthSAMLAuthenticateAndImpersonate(
    }
 #endif
 
-#if ALLOW_LOCAL_SYSTEM_IMPERSONATION_BYPASS
 impersonate:
-#endif
    vgErr = VGAuth_Impersonate(ctx, newHandle,
                               (int)ARRAYSIZE(extraParams),
                               extraParams);
@@ -11975,13 +13671,23 @@ impersonate:
 #endif
 
    currentUserHandle = newHandle;
+   currentUserHandleCached = NULL != cached;
    gImpersonatedUsername = VixToolsGetImpersonatedUsername(NULL);
 
+   /*
+    * The bearer token is only cached once it let us impersonate; the
+    * local SYSTEM fallback above returns before reaching here.
+    */
+   if (NULL == cached && NULL != cacheKey) {
+      VixToolsCredentialCacheAdd(cacheKey, gImpersonatedUsername, newHandle);
+      currentUserHandleCached =
+         NULL != VixToolsCredentialCacheLookup(cacheKey);
+   }
+
    err = VIX_OK;
 
 done:
-   Util_ZeroFreeString(token);
-   Util_ZeroFreeString(username);
+   Util_ZeroFree(packed, packedLength);
 
    if (VIX_OK != err) {
       if (impersonated) {
@@ -11994,9 +13700,15 @@ done:
          vgErr = VGAuth_EndImpersonation(ctx);
          ASSERT(vgErr == VGAUTH_E_OK);
       }
-      VGAuth_UserHandleFree(newHandle);
+      if (NULL != cached) {
+         /* Don't trust a handle that failed to impersonate again. */
+         g_hash_table_remove(gCredentialCache, cacheKey);
+      } else {
+         VGAuth_UserHandleFree(newHandle);
+      }
       newHandle = NULL;
    }
+   g_free(cacheKey);
 
    return err;
 #else
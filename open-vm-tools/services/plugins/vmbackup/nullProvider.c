@@ -208,6 +208,7 @@ VmBackupNullStart(ToolsAppCtx *ctx,
                          op,
                          VmBackupNullReadyForSnapshot,
                          __FUNCTION__);
+   VmBackup_Notify(state);
 }
 
 
@@ -24,6 +24,8 @@
 
 #include "vmBackupInt.h"
 
+#include <ctype.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -58,6 +60,10 @@
 typedef struct VmBackupScript {
    char *path;
    ProcMgr_AsyncProc *proc;
+   int stage;
+   Bool skipFail;
+   gint64 startTime;
+   GSource *exitWatch;
 } VmBackupScript;
 
 
@@ -67,6 +73,9 @@ typedef struct VmBackupScriptOp {
    Bool thawFailed;
    VmBackupScriptType type;
    VmBackupState *state;
+   ssize_t stageFirst;
+   ssize_t stageLast;
+   gint64 stageStart;
 } VmBackupScriptOp;
 
 
@@ -103,24 +112,267 @@ VmBackupGetScriptPath(void)
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ *  VmBackupGetScriptStage --
+ *
+ *    Returns the stage a script belongs to, given its file name. Scripts whose
+ *    names start with the same number followed by a dash (e.g. "20-mysql" and
+ *    "20-postgres") are in the same stage and are run concurrently.
+ *
+ * Result
+ *    The stage number, or -1 if the name has no stage prefix.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+VmBackupGetScriptStage(const char *name)  // IN
+{
+   int stage = 0;
+   const char *p;
+
+   for (p = name; isdigit((unsigned char) *p); p++) {
+      if (stage > (INT_MAX - 9) / 10) {
+         return -1;
+      }
+      stage = stage * 10 + (*p - '0');
+   }
+
+   return (p != name && *p == '-') ? stage : -1;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ *  VmBackupSameStage --
+ *
+ *    Checks whether two scripts belong to the same stage.
+ *
+ * Result
+ *    TRUE if both scripts should run concurrently.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VmBackupSameStage(const VmBackupScript *a,   // IN
+                  const VmBackupScript *b)   // IN
+{
+   return a->stage >= 0 && a->stage == b->stage;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ *  VmBackupScriptExited --
+ *
+ *    Called from the main loop when the selectable of a running script
+ *    becomes readable, i.e. when the script has exited. Wakes up the state
+ *    machine so that it picks up the result right away.
+ *
+ * Result
+ *    FALSE (the watch is one-shot).
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#if !defined(_WIN32)
+static gboolean
+VmBackupScriptExited(GIOChannel *chan,    // IN
+                     GIOCondition cond,   // IN
+                     gpointer data)       // IN
+{
+   VmBackupScriptOp *op = data;
+
+   VmBackup_Notify(op->state);
+   return FALSE;
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ *  VmBackupScriptClearWatch --
+ *
+ *    Removes the exit watch of a script, if any.
+ *
+ * Result
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+VmBackupScriptClearWatch(VmBackupScript *script)  // IN/OUT
+{
+   if (script->exitWatch != NULL) {
+      g_source_destroy(script->exitWatch);
+      g_source_unref(script->exitWatch);
+      script->exitWatch = NULL;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ *  VmBackupStartScript --
+ *
+ *    Starts a script, and watches its selectable so the state machine is
+ *    notified as soon as it exits instead of having to poll for it. On
+ *    Windows the selectable is a handle, so the state machine keeps polling.
+ *
+ * Result
+ *    TRUE if the script was started.
+ *
+ * Side effects:
+ *    Attaches a source to the main loop.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VmBackupStartScript(VmBackupScriptOp *op,       // IN
+                    VmBackupScript *script,     // IN/OUT
+                    const char *scriptOp)       // IN
+{
+   char *cmd;
+
+   if (op->state->scriptArg != NULL) {
+      cmd = Str_Asprintf(NULL, "\"%s\" %s \"%s\"", script->path,
+                         scriptOp, op->state->scriptArg);
+   } else {
+      cmd = Str_Asprintf(NULL, "\"%s\" %s", script->path, scriptOp);
+   }
+   if (cmd != NULL) {
+      host_debug("Running script: %s\n", script->path);
+      guest_debug("Running script: %s\n", cmd);
+      script->proc = ProcMgr_ExecAsync(cmd, NULL);
+   } else {
+      g_debug("Failed to allocate memory to run script: %s\n", script->path);
+      script->proc = NULL;
+   }
+   vm_free(cmd);
+
+   if (script->proc == NULL) {
+      return FALSE;
+   }
+
+   script->startTime = g_get_monotonic_time();
+
+#if !defined(_WIN32)
+   {
+      GIOChannel *chan;
+
+      VmBackupScriptClearWatch(script);
+
+      chan = g_io_channel_unix_new(ProcMgr_GetAsyncProcSelectable(script->proc));
+      script->exitWatch = g_io_create_watch(chan, G_IO_IN | G_IO_HUP | G_IO_ERR);
+      g_io_channel_unref(chan);
+
+      VMTOOLSAPP_ATTACH_SOURCE(op->state->ctx,
+                               script->exitWatch,
+                               VmBackupScriptExited,
+                               op,
+                               NULL);
+   }
+#endif
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ *  VmBackupReapScript --
+ *
+ *    Collects the exit code of a script that has finished (or, if "kill" is
+ *    set, kills it first), logs how long it ran and releases its process.
+ *
+ * Result
+ *    TRUE if the script ran to completion and exited with status 0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+VmBackupReapScript(VmBackupScript *script,   // IN/OUT
+                   Bool kill)                // IN
+{
+   int exitCode = -1;
+   Bool succeeded;
+   gint64 elapsed = (g_get_monotonic_time() - script->startTime) / 1000;
+
+   ASSERT(script->proc != NULL);
+
+   VmBackupScriptClearWatch(script);
+
+   if (kill) {
+      ProcMgr_Pid pid = ProcMgr_GetPid(script->proc);
+      if (!ProcMgr_KillByPid(pid)) {
+         // XXX: what to do in this situation? other than log and cry?
+      } else {
+         ProcMgr_GetExitCode(script->proc, &exitCode);
+      }
+      succeeded = FALSE;
+      g_info("Script %s killed after %"G_GINT64_FORMAT" ms.\n",
+             script->path, elapsed);
+   } else {
+      succeeded = (ProcMgr_GetExitCode(script->proc, &exitCode) == 0 &&
+                   exitCode == 0);
+      g_info("Script %s exited with status %d after %"G_GINT64_FORMAT" ms.\n",
+             script->path, exitCode, elapsed);
+   }
+
+   ProcMgr_Free(script->proc);
+   script->proc = NULL;
+
+   return succeeded;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
  * VmBackupRunNextScript --
  *
- *    Runs the next script for the given operation. If thawing (or running
+ *    Runs the next stage of scripts for the given operation. A stage is
+ *    usually a single script; scripts sharing a stage prefix are started
+ *    together when "enableScriptStages" is set. If thawing (or running
  *    scripts after a failure), this function will try as much as possible
- *    to start a script, meaning that if it fails to start a script it will
- *    try to start the preceding one until one script is run, or it runs out
- *    of scripts to try.
+ *    to start a script, meaning that if it fails to start a stage it will
+ *    try to start the preceding one until some script is run, or it runs
+ *    out of scripts to try.
  *
  * Results:
  *    -1: an error occurred.
  *    0: no more scripts to run.
- *    1: script was started.
+ *    1: at least one script was started.
  *
  * Side effects:
- *    Increments (or decrements) the "current script" index in the backup state.
+ *    Moves the "current script" index in the backup state to the last
+ *    script of the started stage, in execution order.
  *
  *-----------------------------------------------------------------------------
  */
@@ -130,22 +382,23 @@ VmBackupRunNextScript(VmBackupScriptOp *op)  // IN/OUT
 {
    const char *scriptOp;
    int ret = 0;
+   int step;
    ssize_t index;
    VmBackupScript *scripts = op->state->scripts;
 
    switch (op->type) {
    case VMBACKUP_SCRIPT_FREEZE:
-      index = ++op->state->currentScript;
+      step = 1;
       scriptOp = "freeze";
       break;
 
    case VMBACKUP_SCRIPT_FREEZE_FAIL:
-      index = --op->state->currentScript;
+      step = -1;
       scriptOp = "freezeFail";
       break;
 
    case VMBACKUP_SCRIPT_THAW:
-      index = --op->state->currentScript;
+      step = -1;
       scriptOp = "thaw";
       break;
 
@@ -153,47 +406,68 @@ VmBackupRunNextScript(VmBackupScriptOp *op)  // IN/OUT
       NOT_REACHED();
    }
 
-   while (index >= 0 && scripts[index].path != NULL) {
-      if (File_IsFile(scripts[index].path)) {
-         char *cmd;
+   op->stageFirst = -1;
+   op->stageLast = -1;
+   index = op->state->currentScript += step;
 
-         if (op->state->scriptArg != NULL) {
-            cmd = Str_Asprintf(NULL, "\"%s\" %s \"%s\"", scripts[index].path,
-                               scriptOp, op->state->scriptArg);
-         } else {
-            cmd = Str_Asprintf(NULL, "\"%s\" %s", scripts[index].path,
-                               scriptOp);
-         }
-         if (cmd != NULL) {
-            host_debug("Running script: %s\n", scripts[index].path);
-            guest_debug("Running script: %s\n", cmd);
-            scripts[index].proc = ProcMgr_ExecAsync(cmd, NULL);
-         } else {
-            g_debug("Failed to allocate memory to run script: %s\n",
-                    scripts[index].path);
-            scripts[index].proc = NULL;
-         }
-         vm_free(cmd);
+   while (index >= 0 && scripts[index].path != NULL) {
+      ssize_t last = index;
+      ssize_t i;
+      Bool started = FALSE;
+
+      /* Scripts in a stage are adjacent in the (sorted) script list. */
+      while (last + step >= 0 && scripts[last + step].path != NULL &&
+             VmBackupSameStage(&scripts[index], &scripts[last + step])) {
+         last += step;
+      }
 
-         if (scripts[index].proc == NULL) {
-            if (op->type == VMBACKUP_SCRIPT_FREEZE) {
+      for (i = index; ret == 0; i += step) {
+         VmBackupScript *script = &scripts[i];
+
+         if (op->type == VMBACKUP_SCRIPT_FREEZE_FAIL && script->skipFail) {
+            /* The freeze script didn't run successfully, nothing to undo. */
+         } else if (File_IsFile(script->path)) {
+            if (VmBackupStartScript(op, script, scriptOp)) {
+               started = TRUE;
+            } else if (op->type == VMBACKUP_SCRIPT_FREEZE) {
+               ssize_t j;
+
+               /*
+                * Neither this script nor the rest of the stage was started;
+                * the ones started before it will get "freezeFail".
+                */
+               for (j = i; j <= last; j++) {
+                  scripts[j].skipFail = TRUE;
+               }
                ret = -1;
-               break;
             } else {
                op->thawFailed = TRUE;
             }
-         } else {
-            ret = 1;
+         }
+         if (i == last) {
             break;
          }
       }
 
-      if (op->type == VMBACKUP_SCRIPT_FREEZE) {
-         index = ++op->state->currentScript;
-      } else {
-         index = --op->state->currentScript;
+      if (started || ret != 0) {
+         op->state->currentScript = last;
+         op->stageFirst = MIN(index, last);
+         op->stageLast = MAX(index, last);
+         if (ret == 0) {
+            op->stageStart = g_get_monotonic_time();
+            ret = 1;
+         } else {
+            for (i = op->stageFirst; i <= op->stageLast; i++) {
+               if (scripts[i].proc != NULL) {
+                  VmBackupReapScript(&scripts[i], TRUE);
+               }
+            }
+         }
+         break;
       }
 
+      index = op->state->currentScript = last + step;
+
       /*
        * This happens if all thaw/fail scripts failed to start. Since the first
        * entry may be a legacy script (which may not exist), need to check
@@ -205,7 +479,8 @@ VmBackupRunNextScript(VmBackupScriptOp *op)  // IN/OUT
          if (!File_IsFile(scripts[0].path)) {
             failIdx = 1;
          }
-         if (scripts[failIdx].proc == NULL && scripts[failIdx].path != NULL) {
+         if (scripts[failIdx].proc == NULL && scripts[failIdx].path != NULL &&
+             !scripts[failIdx].skipFail) {
             ret = -1;
          }
       }
@@ -244,15 +519,16 @@ VmBackupStringCompare(const void *str1,   // IN
  *
  *  VmBackupScriptOpQuery --
  *
- *    Checks the status of the current running script. If the script is
- *    finished, run the next script in the queue or, if no scripts are left,
- *    return a "finished" status.
+ *    Checks the status of the currently running stage of scripts. If all of
+ *    them are finished, run the next stage in the queue or, if no scripts are
+ *    left, return a "finished" status. Scripts still running when the stage
+ *    timeout expires are killed and considered failed.
  *
  * Result
  *    The status of the operation.
  *
  * Side effects:
- *    Might start a new process.
+ *    Might start new processes.
  *
  *-----------------------------------------------------------------------------
  */
@@ -263,54 +539,81 @@ VmBackupScriptOpQuery(VmBackupOp *_op) // IN
    VmBackupOpStatus ret = VMBACKUP_STATUS_PENDING;
    VmBackupScriptOp *op = (VmBackupScriptOp *) _op;
    VmBackupScript *scripts = op->state->scripts;
-   VmBackupScript *currScript = NULL;
-
-   if (scripts != NULL && op->state->currentScript >= 0) {
-      currScript = &scripts[op->state->currentScript];
-   }
+   guint timeout = op->state->scriptStageTimeout;
+   Bool running = FALSE;
+   Bool failed = FALSE;
+   ssize_t i;
 
    if (op->canceled) {
       ret = VMBACKUP_STATUS_CANCELED;
       goto exit;
-   } else if (scripts == NULL || currScript == NULL || currScript->proc == NULL) {
+   } else if (scripts == NULL || op->stageFirst < 0) {
       ret = VMBACKUP_STATUS_FINISHED;
       goto exit;
    }
 
-   if (!ProcMgr_IsAsyncProcRunning(currScript->proc)) {
-      int exitCode;
-      Bool succeeded;
+   for (i = op->stageFirst; i <= op->stageLast; i++) {
+      VmBackupScript *script = &scripts[i];
 
-      succeeded = (ProcMgr_GetExitCode(currScript->proc, &exitCode) == 0 &&
-                   exitCode == 0);
-      ProcMgr_Free(currScript->proc);
-      currScript->proc = NULL;
+      if (script->proc == NULL) {
+         continue;
+      } else if (ProcMgr_IsAsyncProcRunning(script->proc)) {
+         running = TRUE;
+      } else if (!VmBackupReapScript(script, FALSE)) {
+         script->skipFail = TRUE;
+         failed = TRUE;
+      }
+   }
 
-      /*
-       * If thaw scripts fail, keep running and only notify the failure after
-       * all others have run.
-       */
-      if (!succeeded) {
-          if (op->type == VMBACKUP_SCRIPT_FREEZE) {
-             ret = VMBACKUP_STATUS_ERROR;
-             goto exit;
-          } else if (op->type == VMBACKUP_SCRIPT_THAW) {
-             op->thawFailed = TRUE;
-          }
+   if (running && timeout > 0 &&
+       g_get_monotonic_time() - op->stageStart >=
+          (gint64) timeout * G_USEC_PER_SEC) {
+      g_warning("Quiesce scripts did not finish within %u seconds.\n", timeout);
+      for (i = op->stageFirst; i <= op->stageLast; i++) {
+         if (scripts[i].proc != NULL) {
+            VmBackupReapScript(&scripts[i], TRUE);
+            scripts[i].skipFail = TRUE;
+         }
       }
+      running = FALSE;
+      failed = TRUE;
+   }
 
-      switch (VmBackupRunNextScript(op)) {
-      case -1:
+   /*
+    * If thaw scripts fail, keep running and only notify the failure after
+    * all others have run. A failed freeze stops the rest of the stage; the
+    * scripts that were killed get "freezeFail" along with the earlier ones.
+    */
+   if (failed) {
+      if (op->type == VMBACKUP_SCRIPT_FREEZE) {
+         for (i = op->stageFirst; i <= op->stageLast; i++) {
+            if (scripts[i].proc != NULL) {
+               VmBackupReapScript(&scripts[i], TRUE);
+            }
+         }
+         op->state->currentScript = op->stageLast + 1;
          ret = VMBACKUP_STATUS_ERROR;
-         break;
+         goto exit;
+      } else if (op->type == VMBACKUP_SCRIPT_THAW) {
+         op->thawFailed = TRUE;
+      }
+   }
 
-      case 0:
-         ret = op->thawFailed ? VMBACKUP_STATUS_ERROR : VMBACKUP_STATUS_FINISHED;
-         break;
+   if (running) {
+      goto exit;
+   }
 
-      default:
-         break;
-      }
+   switch (VmBackupRunNextScript(op)) {
+   case -1:
+      ret = VMBACKUP_STATUS_ERROR;
+      break;
+
+   case 0:
+      ret = op->thawFailed ? VMBACKUP_STATUS_ERROR : VMBACKUP_STATUS_FINISHED;
+      break;
+
+   default:
+      break;
    }
 
 exit:
@@ -346,11 +649,15 @@ static void
 VmBackupScriptOpRelease(VmBackupOp *_op)  // IN
 {
    VmBackupScriptOp *op = (VmBackupScriptOp *) _op;
+   VmBackupScript *scripts = op->state->scripts;
+   size_t i;
 
-   if (op->type != VMBACKUP_SCRIPT_FREEZE && op->state->scripts != NULL) {
-      size_t i;
-      VmBackupScript *scripts = op->state->scripts;
+   /* The exit watches refer to this op. */
+   for (i = 0; scripts != NULL && scripts[i].path != NULL; i++) {
+      VmBackupScriptClearWatch(&scripts[i]);
+   }
 
+   if (op->type != VMBACKUP_SCRIPT_FREEZE && scripts != NULL) {
       for (i = 0; scripts[i].path != NULL; i++) {
          free(scripts[i].path);
          if (scripts[i].proc != NULL) {
@@ -371,7 +678,7 @@ VmBackupScriptOpRelease(VmBackupOp *_op)  // IN
  *
  *  VmBackupScriptOpCancel --
  *
- *    Cancels the current operation. Kills any currently running script and
+ *    Cancels the current operation. Kills any currently running scripts and
  *    flags the operation as canceled.
  *
  * Result
@@ -388,19 +695,13 @@ VmBackupScriptOpCancel(VmBackupOp *_op)   // IN
 {
    VmBackupScriptOp *op = (VmBackupScriptOp *) _op;
    VmBackupScript *scripts = op->state->scripts;
-   VmBackupScript *currScript = NULL;
-   ProcMgr_Pid pid;
-
-   if (scripts != NULL) {
-      currScript = &scripts[op->state->currentScript];
-      ASSERT(currScript->proc != NULL);
+   ssize_t i;
 
-      pid = ProcMgr_GetPid(currScript->proc);
-      if (!ProcMgr_KillByPid(pid)) {
-         // XXX: what to do in this situation? other than log and cry?
-      } else {
-         int exitCode;
-         ProcMgr_GetExitCode(currScript->proc, &exitCode);
+   if (scripts != NULL && op->stageFirst >= 0) {
+      for (i = op->stageFirst; i <= op->stageLast; i++) {
+         if (scripts[i].proc != NULL) {
+            VmBackupReapScript(&scripts[i], TRUE);
+         }
       }
    }
 
@@ -454,6 +755,8 @@ VmBackup_NewScriptOp(VmBackupScriptType type, // IN
 
    op->state = state;
    op->type = type;
+   op->stageFirst = -1;
+   op->stageLast = -1;
    op->callbacks.queryFn = VmBackupScriptOpQuery;
    op->callbacks.cancelFn = VmBackupScriptOpCancel;
    op->callbacks.releaseFn = VmBackupScriptOpRelease;
@@ -506,6 +809,7 @@ VmBackup_NewScriptOp(VmBackupScriptType type, // IN
       }
 
       if (legacy > 0) {
+         scripts[idx].stage = -1;
          scripts[idx++].path = Util_SafeStrdup(LEGACY_FREEZE_SCRIPT);
       }
 
@@ -524,6 +828,8 @@ VmBackup_NewScriptOp(VmBackupScriptType type, // IN
                fail = TRUE;
                goto exit;
             } else if (File_IsFile(script)) {
+               scripts[idx].stage = state->scriptStages ?
+                                    VmBackupGetScriptStage(fileList[i]) : -1;
                scripts[idx++].path = script;
             } else {
                free(script);
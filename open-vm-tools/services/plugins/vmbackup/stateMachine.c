@@ -37,9 +37,11 @@
 
 #include <glib-object.h>
 #include <gmodule.h>
+#include <string.h>
 #include "guestApp.h"
 #include "str.h"
 #include "strutil.h"
+#include "toolsProbe.h"
 #include "util.h"
 #include "vmBackupSignals.h"
 #include "guestQuiesce.h"
@@ -68,15 +70,6 @@ VM_EMBED_VERSION(VMTOOLSD_VERSION_STRING);
 #endif
 #endif
 
-#define VMBACKUP_ENQUEUE_EVENT() do {                                         \
-   gBackupState->timerEvent = g_timeout_source_new(gBackupState->pollPeriod); \
-   VMTOOLSAPP_ATTACH_SOURCE(gBackupState->ctx,                                \
-                            gBackupState->timerEvent,                         \
-                            VmBackupAsyncCallback,                            \
-                            NULL,                                             \
-                            NULL);                                            \
-} while (0)
-
 /*
  * Macros to read values from config file.
  */
@@ -102,6 +95,9 @@ VmBackupEnableSyncWait(void);
 static Bool
 VmBackupEnableCompleteWait(void);
 
+static gboolean
+VmBackupAsyncCallback(void *clientData);
+
 
 /**
  * Returns a string representation of the given state machine state.
@@ -148,6 +144,21 @@ VmBackupGetStateName(VmBackupMState state)
 }
 
 
+/**
+ * Moves the state machine to the given state. The transition fires the
+ * vmtools:vmbackup__state probe with the old and new states.
+ *
+ * @param[in]  next     The new state.
+ */
+
+static void
+VmBackupSetMachineState(VmBackupMState next)
+{
+   TOOLS_PROBE2(vmbackup__state, gBackupState->machineState, next);
+   gBackupState->machineState = next;
+}
+
+
 /**
  * Sends a keep alive backup event to the VMX.
  *
@@ -275,6 +286,9 @@ VmBackup_SendEventNoAbort(const char *event,
 #endif
 
    if (success) {
+      if (strcmp(event, VMBACKUP_EVENT_SNAPSHOT_COMMIT) == 0) {
+         VmBackup_RecordPhase(gBackupState, "snapshotCommit");
+      }
       ASSERT(gBackupState->keepAlive == NULL);
       gBackupState->keepAlive =
          g_timeout_source_new(VMBACKUP_KEEP_ALIVE_PERIOD / 2);
@@ -324,6 +338,52 @@ VmBackup_SendEvent(const char *event,
 }
 
 
+/**
+ * Records the start of a phase of the backup operation in its timeline.
+ * Must be called from the main loop thread.
+ *
+ * @param[in]  state    The backup state.
+ * @param[in]  phase    Name of the phase; must be a static string.
+ */
+
+void
+VmBackup_RecordPhase(VmBackupState *state,
+                     const char *phase)
+{
+   VmBackupPhase entry;
+
+   entry.name = phase;
+   entry.usecs = g_get_monotonic_time() - state->startTime;
+   g_array_append_val(state->timeline, entry);
+   TOOLS_PROBE1(vmbackup__phase, phase);
+   g_debug("Quiesce phase '%s' started at %"G_GINT64_FORMAT" us.\n",
+           entry.name, entry.usecs);
+}
+
+
+/**
+ * Logs the timeline of the backup operation, so the time spent quiesced can
+ * be split between guest work (scripts, freeze, thaw) and host work (the
+ * time between "snapshotCommit" and "snapshotDone").
+ */
+
+static void
+VmBackupLogTimeline(void)
+{
+   GString *str = g_string_new(NULL);
+   guint i;
+
+   for (i = 0; i < gBackupState->timeline->len; i++) {
+      VmBackupPhase *entry = &g_array_index(gBackupState->timeline,
+                                            VmBackupPhase, i);
+      g_string_append_printf(str, " %s=%"G_GINT64_FORMAT,
+                             entry->name, entry->usecs);
+   }
+   g_message("Quiesce timeline (us):%s\n", str->str);
+   g_string_free(str, TRUE);
+}
+
+
 /**
  * Cleans up the backup state object and sends a "done" event to the VMX.
  */
@@ -348,6 +408,9 @@ VmBackupFinalize(void)
 
    VmBackup_SendEvent(VMBACKUP_EVENT_REQUESTOR_DONE, VMBACKUP_SUCCESS, "");
 
+   VmBackup_RecordPhase(gBackupState, "done");
+   VmBackupLogTimeline();
+
    if (gBackupState->timerEvent != NULL) {
       g_source_destroy(gBackupState->timerEvent);
       g_source_unref(gBackupState->timerEvent);
@@ -363,6 +426,7 @@ VmBackupFinalize(void)
       gBackupState->completer->release(gBackupState->completer);
    }
    g_mutex_clear(&gBackupState->opLock);
+   g_array_free(gBackupState->timeline, TRUE);
    vm_free(gBackupState->configDir);
    g_free(gBackupState->scriptArg);
    g_free(gBackupState->volumes);
@@ -386,22 +450,26 @@ static Bool
 VmBackupStartScripts(VmBackupScriptType type)
 {
    const char *opName;
+   const char *phase;
    VmBackupMState nextState;
    g_debug("*** %s\n", __FUNCTION__);
 
    switch (type) {
       case VMBACKUP_SCRIPT_FREEZE:
          opName = "VmBackupOnFreeze";
+         phase = "scriptFreeze";
          nextState = VMBACKUP_MSTATE_SCRIPT_FREEZE;
          break;
 
       case VMBACKUP_SCRIPT_FREEZE_FAIL:
          opName = "VmBackupOnFreezeFail";
+         phase = "scriptFreezeFail";
          nextState = VMBACKUP_MSTATE_SCRIPT_ERROR;
          break;
 
       case VMBACKUP_SCRIPT_THAW:
          opName = "VmBackupOnThaw";
+         phase = "scriptThaw";
          nextState = VMBACKUP_MSTATE_SCRIPT_THAW;
          break;
 
@@ -409,6 +477,7 @@ VmBackupStartScripts(VmBackupScriptType type)
          NOT_REACHED();
    }
 
+   VmBackup_RecordPhase(gBackupState, phase);
    if (gBackupState->execScripts &&
        !VmBackup_SetCurrentOp(gBackupState,
                               VmBackup_NewScriptOp(type, gBackupState),
@@ -420,7 +489,7 @@ VmBackupStartScripts(VmBackupScriptType type)
       return FALSE;
    }
 
-   gBackupState->machineState = nextState;
+   VmBackupSetMachineState(nextState);
    return TRUE;
 }
 
@@ -436,12 +505,13 @@ VmBackupStartScripts(VmBackupScriptType type)
 static gboolean
 VmBackupOnError(void)
 {
+   VmBackup_RecordPhase(gBackupState, "error");
    switch (gBackupState->machineState) {
    case VMBACKUP_MSTATE_SCRIPT_FREEZE:
    case VMBACKUP_MSTATE_SYNC_ERROR:
       /* Next state is "script error". */
       if (!VmBackupStartScripts(VMBACKUP_SCRIPT_FREEZE_FAIL)) {
-         gBackupState->machineState = VMBACKUP_MSTATE_IDLE;
+         VmBackupSetMachineState(VMBACKUP_MSTATE_IDLE);
       }
       break;
 
@@ -450,7 +520,7 @@ VmBackupOnError(void)
    case VMBACKUP_MSTATE_SYNC_THAW:
       /* Next state is "sync error". */
       gBackupState->pollPeriod = 1000;
-      gBackupState->machineState = VMBACKUP_MSTATE_SYNC_ERROR;
+      VmBackupSetMachineState(VMBACKUP_MSTATE_SYNC_ERROR);
       g_signal_emit_by_name(gBackupState->ctx->serviceObj,
                             TOOLS_CORE_SIG_IO_FREEZE,
                             gBackupState->ctx,
@@ -460,7 +530,7 @@ VmBackupOnError(void)
    case VMBACKUP_MSTATE_SCRIPT_THAW:
    case VMBACKUP_MSTATE_COMPLETE_WAIT:
       /* Next state is "idle". */
-      gBackupState->machineState = VMBACKUP_MSTATE_IDLE;
+      VmBackupSetMachineState(VMBACKUP_MSTATE_IDLE);
       break;
 
    default:
@@ -519,6 +589,8 @@ VmBackupDoAbort(void)
       /* Transition to the error state. */
       if (VmBackupOnError()) {
          VmBackupFinalize();
+      } else {
+         VmBackup_Notify(gBackupState);
       }
    }
 }
@@ -636,6 +708,97 @@ exit:
 }
 
 
+/**
+ * Schedules the next run of the state machine.
+ *
+ * Nothing is polled unless there is no other way to find out about progress:
+ *
+ * - if the current operation is still running, the state machine waits for
+ *   it to call VmBackup_Notify() (e.g. when a script exits); a poll timer
+ *   is kept only as a fallback for operations that can't signal completion.
+ * - if the state machine is waiting for the freeze task or for the host's
+ *   "snapshot done" message, nothing is scheduled; those paths notify the
+ *   state machine when they're done.
+ * - otherwise the state machine can make progress right away, so it's run
+ *   again as soon as the main loop is idle.
+ *
+ * @param[in]  opPending   Whether the current op was found to be pending.
+ */
+
+static void
+VmBackupEnqueueEvent(gboolean opPending)
+{
+   GSource *src = NULL;
+
+   ASSERT(gBackupState->timerEvent == NULL);
+
+   g_mutex_lock(&gBackupState->opLock);
+   if (opPending) {
+      src = g_timeout_source_new(gBackupState->pollPeriod);
+   } else if (gBackupState->currentOp == NULL &&
+              gBackupState->callback == NULL &&
+              (gBackupState->machineState == VMBACKUP_MSTATE_SYNC_FREEZE ||
+               (gBackupState->machineState == VMBACKUP_MSTATE_SYNC_FREEZE_WAIT &&
+                gBackupState->freezeStatus == VMBACKUP_FREEZE_PENDING))) {
+      g_debug("%s: waiting for notification in state %s.\n", __FUNCTION__,
+              VmBackupGetStateName(gBackupState->machineState));
+   } else {
+      src = g_idle_source_new();
+   }
+   g_mutex_unlock(&gBackupState->opLock);
+
+   if (src != NULL) {
+      gBackupState->timerEvent = src;
+      VMTOOLSAPP_ATTACH_SOURCE(gBackupState->ctx,
+                               gBackupState->timerEvent,
+                               VmBackupAsyncCallback,
+                               NULL,
+                               NULL);
+   }
+}
+
+
+/**
+ * Main loop callback for VmBackup_Notify(). Cancels whatever the state
+ * machine was waiting on and runs it right away.
+ *
+ * @param[in]  clientData     Unused.
+ *
+ * @return FALSE
+ */
+
+static gboolean
+VmBackupNotifyCallback(void *clientData)
+{
+   if (gBackupState != NULL &&
+       gBackupState->machineState != VMBACKUP_MSTATE_IDLE) {
+      if (gBackupState->timerEvent != NULL) {
+         g_source_destroy(gBackupState->timerEvent);
+      }
+      VmBackupAsyncCallback(NULL);
+   }
+   return FALSE;
+}
+
+
+/**
+ * Tells the state machine that the current operation (or the state it's
+ * waiting on) may have changed, so that it runs without waiting for the
+ * poll timer. May be called from any thread.
+ *
+ * @param[in]  state    The backup state.
+ */
+
+void
+VmBackup_Notify(VmBackupState *state)
+{
+   GSource *src = g_idle_source_new();
+
+   VMTOOLSAPP_ATTACH_SOURCE(state->ctx, src, VmBackupNotifyCallback, NULL, NULL);
+   g_source_unref(src);
+}
+
+
 /**
  * Callback to advance the state machine to next state once
  * current operation finishes.
@@ -652,8 +815,10 @@ VmBackupAsyncCallback(void *clientData)
    g_debug("*** %s\n", __FUNCTION__);
    ASSERT(gBackupState != NULL);
 
-   g_source_unref(gBackupState->timerEvent);
-   gBackupState->timerEvent = NULL;
+   if (gBackupState->timerEvent != NULL) {
+      g_source_unref(gBackupState->timerEvent);
+      gBackupState->timerEvent = NULL;
+   }
 
    /*
     * Move the state machine to the next state, if the
@@ -735,7 +900,7 @@ VmBackupAsyncCallback(void *clientData)
    case VMBACKUP_MSTATE_SCRIPT_ERROR:
    case VMBACKUP_MSTATE_COMPLETE_WAIT:
       /* Next state is "idle". */
-      gBackupState->machineState = VMBACKUP_MSTATE_IDLE;
+      VmBackupSetMachineState(VMBACKUP_MSTATE_IDLE);
       break;
 
    case VMBACKUP_MSTATE_SYNC_ERROR:
@@ -756,7 +921,7 @@ exit:
       VmBackupFinalize();
    } else {
       gBackupState->forceRequeue = FALSE;
-      VMBACKUP_ENQUEUE_EVENT();
+      VmBackupEnqueueEvent(opPending);
    }
    return FALSE;
 }
@@ -777,6 +942,7 @@ static Bool
 VmBackupEnableSyncWait(void)
 {
    g_debug("*** %s\n", __FUNCTION__);
+   VmBackup_RecordPhase(gBackupState, "syncFreeze");
    g_signal_emit_by_name(gBackupState->ctx->serviceObj,
                          TOOLS_CORE_SIG_IO_FREEZE,
                          gBackupState->ctx,
@@ -795,10 +961,11 @@ VmBackupEnableSyncWait(void)
     * and track it with an extra state in the state machine.
     */
    gBackupState->freezeStatus = VMBACKUP_FREEZE_PENDING;
-   if (!ToolsCorePool_SubmitTask(gBackupState->ctx,
-                                 gBackupState->provider->start,
-                                 gBackupState,
-                                 NULL)) {
+   if (!ToolsCorePool_SubmitClassTask(gBackupState->ctx,
+                                      TOOLS_CORE_POOL_CLASS_CRITICAL,
+                                      gBackupState->provider->start,
+                                      gBackupState,
+                                      NULL)) {
       g_warning("Failed to submit backup start task.");
 #endif
       g_signal_emit_by_name(gBackupState->ctx->serviceObj,
@@ -813,11 +980,11 @@ VmBackupEnableSyncWait(void)
 
 #if defined(_WIN32)
    /* Move to next state */
-   gBackupState->machineState = VMBACKUP_MSTATE_SYNC_FREEZE;
+   VmBackupSetMachineState(VMBACKUP_MSTATE_SYNC_FREEZE);
 #else
    g_debug("Submitted backup start task.");
    /* Move to next state */
-   gBackupState->machineState = VMBACKUP_MSTATE_SYNC_FREEZE_WAIT;
+   VmBackupSetMachineState(VMBACKUP_MSTATE_SYNC_FREEZE_WAIT);
 #endif
 
    return TRUE;
@@ -839,10 +1006,12 @@ VmBackupEnableCompleteWait(void)
    g_debug("*** %s\n", __FUNCTION__);
 
    if (gBackupState->completer == NULL) {
-      gBackupState->machineState = VMBACKUP_MSTATE_IDLE;
+      VmBackupSetMachineState(VMBACKUP_MSTATE_IDLE);
       goto exit;
    }
 
+   VmBackup_RecordPhase(gBackupState, "completeWait");
+
    if (gBackupState->abortTimer != NULL) {
       g_source_destroy(gBackupState->abortTimer);
       g_source_unref(gBackupState->abortTimer);
@@ -867,7 +1036,7 @@ VmBackupEnableCompleteWait(void)
    if (gBackupState->completer->start(gBackupState,
                                       gBackupState->completer->clientData)) {
       /* Move to next state */
-      gBackupState->machineState = VMBACKUP_MSTATE_COMPLETE_WAIT;
+      VmBackupSetMachineState(VMBACKUP_MSTATE_COMPLETE_WAIT);
    } else {
       VmBackup_SendEvent(VMBACKUP_EVENT_REQUESTOR_ERROR,
                          VMBACKUP_SYNC_ERROR,
@@ -904,7 +1073,7 @@ VmBackupEnableSync(void)
    } else if (gBackupState->freezeStatus == VMBACKUP_FREEZE_CANCELED ||
               gBackupState->freezeStatus == VMBACKUP_FREEZE_FINISHED) {
       /* Move to next state */
-      gBackupState->machineState = VMBACKUP_MSTATE_SYNC_FREEZE;
+      VmBackupSetMachineState(VMBACKUP_MSTATE_SYNC_FREEZE);
    } else {
       ASSERT(gBackupState->freezeStatus == VMBACKUP_FREEZE_PENDING);
    }
@@ -1016,7 +1185,7 @@ VmBackupStartCommon(RpcInData *data,
    /* Instantiate the backup state and start the operation. */
    gBackupState->ctx = data->appCtx;
    gBackupState->pollPeriod = 1000;
-   gBackupState->machineState = VMBACKUP_MSTATE_IDLE;
+   VmBackupSetMachineState(VMBACKUP_MSTATE_IDLE);
    gBackupState->freezeStatus = VMBACKUP_FREEZE_FINISHED;
    gBackupState->provider = provider;
    gBackupState->completer = completer;
@@ -1026,20 +1195,33 @@ VmBackupStartCommon(RpcInData *data,
                                                              "enableNullDriver",
                                                              TRUE);
    gBackupState->rpcState = VMBACKUP_RPC_STATE_NORMAL;
+   gBackupState->startTime = g_get_monotonic_time();
+   gBackupState->timeline = g_array_new(FALSE, FALSE, sizeof (VmBackupPhase));
+   VmBackup_RecordPhase(gBackupState, "start");
+   gBackupState->scriptStages = VMBACKUP_CONFIG_GET_BOOL(ctx->config,
+                                                         "enableScriptStages",
+                                                         FALSE);
+   gBackupState->scriptStageTimeout =
+         MAX(0, VMBACKUP_CONFIG_GET_INT(ctx->config, "scriptStageTimeout", 0));
 
    g_debug("Using quiesceApps = %d, quiesceFS = %d, allowHWProvider = %d,"
            " execScripts = %d, scriptArg = %s, timeout = %u,"
-           " enableNullDriver = %d, forceQuiesce = %d\n",
+           " enableNullDriver = %d, forceQuiesce = %d,"
+           " enableScriptStages = %d, scriptStageTimeout = %u\n",
            gBackupState->quiesceApps, gBackupState->quiesceFS,
            gBackupState->allowHWProvider, gBackupState->execScripts,
            (gBackupState->scriptArg != NULL) ? gBackupState->scriptArg : "",
-           gBackupState->timeout, gBackupState->enableNullDriver, forceQuiesce);
+           gBackupState->timeout, gBackupState->enableNullDriver, forceQuiesce,
+           gBackupState->scriptStages, gBackupState->scriptStageTimeout);
 #if defined(__linux__)
    gBackupState->excludedFileSystems =
          VMBACKUP_CONFIG_GET_STR(ctx->config, "excludedFileSystems", NULL);
    g_debug("Using excludedFileSystems = \"%s\"\n",
            (gBackupState->excludedFileSystems != NULL) ?
             gBackupState->excludedFileSystems : "(null)");
+   gBackupState->parallelFreeze =
+         VMBACKUP_CONFIG_GET_BOOL(ctx->config, "enableParallelFreeze", FALSE);
+   g_debug("Using enableParallelFreeze = %d\n", gBackupState->parallelFreeze);
 #endif
    g_debug("Quiescing volumes: %s",
            (gBackupState->volumes) ? gBackupState->volumes : "(null)");
@@ -1085,7 +1267,7 @@ VmBackupStartCommon(RpcInData *data,
                                NULL);
    }
 
-   VMBACKUP_ENQUEUE_EVENT();
+   VmBackupEnqueueEvent(FALSE);
    return RPCIN_SETRETVALS(data, "", TRUE);
 
 error:
@@ -1100,6 +1282,9 @@ error:
    if (gBackupState->completer) {
       gBackupState->completer->release(gBackupState->completer);
    }
+   if (gBackupState->timeline != NULL) {
+      g_array_free(gBackupState->timeline, TRUE);
+   }
    vm_free(gBackupState->configDir);
    g_free(gBackupState->scriptArg);
    g_free(gBackupState->volumes);
@@ -1321,6 +1506,7 @@ VmBackupSnapshotDone(RpcInData *data)
                               "Error: unexpected state for quiesce done message.",
                               FALSE);
    } else {
+      VmBackup_RecordPhase(gBackupState, "snapshotDone");
       if (data->argsSize > 1) {
          gBackupState->snapshots = g_strndup(data->args + 1, data->argsSize - 1);
       }
@@ -1331,10 +1517,12 @@ VmBackupSnapshotDone(RpcInData *data)
                             "Error when notifying the sync provider.");
          if (VmBackupOnError()) {
             VmBackupFinalize();
+            return RPCIN_SETRETVALS(data, "", TRUE);
          }
       } else {
-         gBackupState->machineState = VMBACKUP_MSTATE_SYNC_THAW;
+         VmBackupSetMachineState(VMBACKUP_MSTATE_SYNC_THAW);
       }
+      VmBackup_Notify(gBackupState);
       return RPCIN_SETRETVALS(data, "", TRUE);
    }
 }
@@ -1372,6 +1560,8 @@ VmBackupSnapshotCompleted(RpcInData *data)
                             "Error when notifying the sync completer.");
          if (VmBackupOnError()) {
             VmBackupFinalize();
+         } else {
+            VmBackup_Notify(gBackupState);
          }
       }
       return RPCIN_SETRETVALS(data, "", TRUE);
@@ -272,6 +272,9 @@ VmBackupNewDriverOp(VmBackupState *state,       // IN
 
    switch (opType) {
       case OP_FREEZE:
+#if defined(__linux__)
+         SyncDriver_SetParallelFreeze(state->parallelFreeze);
+#endif
          success = SyncDriver_Freeze(op->volumes,
                                      useNullDriverPrefs ?
                                         state->enableNullDriver : FALSE,
@@ -281,6 +284,7 @@ VmBackupNewDriverOp(VmBackupState *state,       // IN
       case OP_THAW:
          op->manifest = SyncNewManifest(state, *op->syncHandle);
          success = VmBackupDriverThaw(op->syncHandle);
+         VmBackup_RecordPhase(state, "thawed");
          break;
       default:
          ASSERT(opType == OP_UNDO);
@@ -460,6 +464,7 @@ VmBackupSyncDriverStart(ToolsAppCtx *ctx,
                          (VmBackupOp *) op,
                          VmBackupSyncDriverReadyForSnapshot,
                          __FUNCTION__);
+   VmBackup_Notify(state);
 }
 
 
@@ -498,6 +503,7 @@ VmBackupSyncDriverOnlyStart(ToolsAppCtx *ctx,
                          (VmBackupOp *) op,
                          VmBackupSyncDriverReadyForSnapshot,
                          __FUNCTION__);
+   VmBackup_Notify(state);
 }
 #endif
 
@@ -42,8 +42,25 @@ static const char syncManifestFmt[] = {
    "<quiesceManifest>\n"
    "   <productVersion>%d</productVersion>\n"  /* version of tools */
    "   <providerName>%s</providerName>\n"      /* name of backend provider */
+   "%s"                                        /* frozen file systems */
+   "   <timeline>\n"
+   "%s"                                        /* phases, see below */
+   "   </timeline>\n"
    "</quiesceManifest>\n"
 };
+static const char syncManifestFsFmt[] = {
+   "   <fileSystem>\n"
+   "      <mountPoint>%s</mountPoint>\n"
+   "      <flushMicroseconds>%"FMT64"u</flushMicroseconds>\n"
+   "      <freezeMicroseconds>%"FMT64"u</freezeMicroseconds>\n"
+   "   </fileSystem>\n"
+};
+static const char syncManifestPhaseFmt[] = {
+   "      <phase>\n"
+   "         <name>%s</name>\n"
+   "         <microseconds>%"FMT64"d</microseconds>\n"
+   "      </phase>\n"
+};
 
 /*
  * tools.conf switch to enable manifest generation
@@ -70,6 +87,10 @@ SyncNewManifest(VmBackupState *state,          // IN
 {
    Bool providerQuiesces;
    const char *providerName;
+   const SyncDriverFsTime *times;
+   size_t numTimes;
+   size_t i;
+   GString *fileSystems;
    SyncManifest *manifest;
 
    if (!VMTools_ConfigGetBoolean(state->ctx->config, "vmbackup",
@@ -94,6 +115,22 @@ SyncNewManifest(VmBackupState *state,          // IN
    manifest->path = g_strdup_printf("%s/%s", state->configDir,
                                     syncManifestName);
    manifest->providerName = g_strdup(providerName);
+   manifest->state = state;
+
+   /*
+    * The handle is thawed and closed before the manifest is sent, so
+    * record how long each file system took to freeze now.
+    */
+   fileSystems = g_string_new(NULL);
+   numTimes = SyncDriver_GetFreezeTimes(handle, &times);
+   for (i = 0; i < numTimes; i++) {
+      gchar *mountPoint = g_markup_escape_text(times[i].path, -1);
+
+      g_string_append_printf(fileSystems, syncManifestFsFmt, mountPoint,
+                             times[i].flushUsecs, times[i].freezeUsecs);
+      g_free(mountPoint);
+   }
+   manifest->fileSystems = g_string_free(fileSystems, FALSE);
    return manifest;
 }
 
@@ -117,6 +154,7 @@ SyncManifestRelease(SyncManifest *manifest)    // IN
    if (manifest != NULL) {
       g_free(manifest->path);
       g_free(manifest->providerName);
+      g_free(manifest->fileSystems);
       g_free(manifest);
    }
 }
@@ -144,18 +182,34 @@ SyncManifestSend(SyncManifest *manifest)       // IN
 {
    FILE *f;
    int ret;
+   guint i;
+   GString *timeline = g_string_new(NULL);
+
+   /*
+    * The timeline is rendered now rather than when the manifest is created,
+    * so that it covers the thaw.
+    */
+   for (i = 0; i < manifest->state->timeline->len; i++) {
+      const VmBackupPhase *entry = &g_array_index(manifest->state->timeline,
+                                                  VmBackupPhase, i);
+      g_string_append_printf(timeline, syncManifestPhaseFmt,
+                             entry->name, entry->usecs);
+   }
 
    unlink(manifest->path);
    f = fopen(manifest->path, "w");
    if (f == NULL) {
       g_warning("Error opening backup manifest file %s\n",
                 manifest->path);
+      g_string_free(timeline, TRUE);
       return FALSE;
    }
 
    ret = fprintf(f, syncManifestFmt, TOOLS_VERSION_CURRENT,
-                 manifest->providerName);
+                 manifest->providerName, manifest->fileSystems,
+                 timeline->str);
    fclose(f);
+   g_string_free(timeline, TRUE);
    if (ret < 0) {
       g_warning("Error writing backup manifest file %s: %d %s\n",
                 manifest->path, errno, strerror(errno));
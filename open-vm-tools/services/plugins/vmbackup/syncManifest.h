@@ -34,6 +34,8 @@
 typedef struct {
    char *path;
    char *providerName;
+   char *fileSystems;      /* <fileSystem> entries with freeze timings */
+   VmBackupState *state;   /* for the phase timeline, when sending */
 } SyncManifest;
 
 SyncManifest *
@@ -95,6 +95,17 @@ typedef struct VmBackupOp {
 struct VmBackupSyncProvider;
 struct VmBackupSyncCompleter;
 
+/**
+ * An entry in the timeline of a backup operation: the time at which a
+ * phase (scripts, freeze, snapshot commit, thaw...) started, relative to
+ * the start of the operation.
+ */
+
+typedef struct VmBackupPhase {
+   const char *name;
+   gint64      usecs;
+} VmBackupPhase;
+
 /**
  * Holds information about the current state of the backup operation.
  * Don't modify the fields directly - rather, use VmBackup_SetCurrentOp,
@@ -124,8 +135,11 @@ typedef struct VmBackupState {
    Bool           quiesceApps;
    Bool           quiesceFS;
    char          *excludedFileSystems;
+   Bool           parallelFreeze;
    Bool           allowHWProvider;
    Bool           execScripts;
+   Bool           scriptStages;
+   guint          scriptStageTimeout;
    Bool           enableNullDriver;
    Bool           needsPriv;
    gchar         *scriptArg;
@@ -145,6 +159,8 @@ typedef struct VmBackupState {
    Bool           vssPartialFileSupport;
    Bool           vssUseDefault;
    VmBackupRpcState rpcState;
+   gint64         startTime;       // Monotonic, in microseconds
+   GArray        *timeline;        // VmBackupPhase entries
 } VmBackupState;
 
 typedef Bool (*VmBackupCallback)(VmBackupState *);
@@ -187,7 +203,7 @@ typedef struct VmBackupSyncCompleter {
 /**
  * Sets the current asynchronous operation being monitored, and an
  * optional callback for after it's done executing. If the operation
- * is NULL, the callback is set to execute later (currently, later = 200ms).
+ * is NULL, the callback is set to execute as soon as the main loop is idle.
  *
  * @param[in]  state          The backup state.
  * @param[in]  op             The current op to set.
@@ -304,6 +320,13 @@ VmBackup_SendEvent(const char *event,
                    const char *desc);
 
 
+void
+VmBackup_Notify(VmBackupState *state);
+
+void
+VmBackup_RecordPhase(VmBackupState *state,
+                     const char *phase);
+
 Bool
 VmBackup_SendEventNoAbort(const char *event,
                           const uint32 code,
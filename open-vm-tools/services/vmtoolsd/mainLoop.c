@@ -47,8 +47,32 @@
 #if defined(_WIN32)
 #  include "windowsu.h"
 #else
+#  include <errno.h>
+#  include <unistd.h>
 #  include "posix.h"
 #endif
+#if defined(__linux__)
+#  include <sys/inotify.h>
+#endif
+
+/*
+ * Delay between a change in the config directory and the reload, so that
+ * editors writing the file in several steps cause a single reload.
+ */
+#define CONF_WATCH_DELAY_MS   200
+
+/** Pending delayed reload, see ToolsCoreScheduleConfReload(). */
+static guint gConfReloadTimer = 0;
+
+/*
+ * Low-memory profile, see VMTools_SetLowMemory(): the config key, and how
+ * often unused memory is released.
+ */
+#define CONFNAME_LOW_MEMORY   "lowMemory"
+#define TRIM_INTERVAL_SEC     60
+
+/** Periodic release of unused memory in the low-memory profile. */
+static guint gTrimTimer = 0;
 
 /*
  * Establish the default and maximum vmusr RPC channel error limits
@@ -92,8 +116,25 @@
 static void
 ToolsCoreCleanup(ToolsServiceState *state)
 {
+   if (gTrimTimer != 0) {
+      g_source_remove(gTrimTimer);
+      gTrimTimer = 0;
+   }
+#if !defined(_WIN32)
+   ToolsCoreMetrics_Stop();
+#endif
    ToolsCorePool_Shutdown(&state->ctx);
    ToolsCore_UnloadPlugins(state);
+
+   if (state->startup != NULL) {
+      guint i;
+
+      for (i = 0; i < state->startup->len; i++) {
+         g_free(g_array_index(state->startup, ToolsStartupStep, i).name);
+      }
+      g_array_free(state->startup, TRUE);
+      state->startup = NULL;
+   }
 #if defined(__linux__)
    if (state->mainService) {
       ToolsCore_ReleaseVsockFamily(state);
@@ -180,6 +221,193 @@ ToolsCoreConfFileCb(gpointer clientData)
 }
 
 
+/**
+ * Timer callback of ToolsCoreScheduleConfReload(). The modification time
+ * of the file only has a one second granularity, so the reload is forced;
+ * ToolsCore_ReloadConfig() still only notifies plugins of actual changes.
+ *
+ * @param[in]  clientData  Service state.
+ *
+ * @return FALSE.
+ */
+
+static gboolean
+ToolsCoreConfReloadTimerCb(gpointer clientData)
+{
+   ToolsServiceState *state = clientData;
+
+   gConfReloadTimer = 0;
+   state->configMtime = 0;
+   ToolsCore_ReloadConfig(state, FALSE);
+   return FALSE;
+}
+
+
+/**
+ * Schedules a reload of the config file after CONF_WATCH_DELAY_MS, unless
+ * one is pending already.
+ *
+ * @param[in]  state    Service state.
+ */
+
+static void
+ToolsCoreScheduleConfReload(ToolsServiceState *state)
+{
+   if (gConfReloadTimer == 0) {
+      gConfReloadTimer = g_timeout_add(CONF_WATCH_DELAY_MS,
+                                       ToolsCoreConfReloadTimerCb,
+                                       state);
+   }
+}
+
+
+#if defined(__linux__)
+/** Name of the config file in the watched directory. */
+static gchar *gConfWatchName = NULL;
+
+
+/**
+ * Reads the inotify events of the config directory, and schedules a reload
+ * when the config file was written, replaced or removed. Falls back to
+ * polling if the inotify descriptor fails.
+ *
+ * @param[in]  chan        The inotify channel.
+ * @param[in]  cond        Unused.
+ * @param[in]  clientData  Service state.
+ *
+ * @return Whether to keep watching.
+ */
+
+static gboolean
+ToolsCoreConfWatchCb(GIOChannel *chan,
+                     GIOCondition cond,
+                     gpointer clientData)
+{
+   ToolsServiceState *state = clientData;
+   int fd = g_io_channel_unix_get_fd(chan);
+   char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+   gboolean changed = FALSE;
+   ssize_t len;
+
+   while ((len = read(fd, buf, sizeof buf)) > 0) {
+      char *p = buf;
+
+      while (p < buf + len) {
+         struct inotify_event *ev = (struct inotify_event *)p;
+
+         if ((ev->mask & IN_Q_OVERFLOW) != 0 ||
+             (ev->len > 0 && strcmp(ev->name, gConfWatchName) == 0)) {
+            changed = TRUE;
+         }
+         p += sizeof *ev + ev->len;
+      }
+   }
+
+   if (changed) {
+      ToolsCoreScheduleConfReload(state);
+   }
+
+   if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+      g_warning("%s: config watch failed, polling instead: %s\n",
+                __FUNCTION__, len == 0 ? "eof" : g_strerror(errno));
+      state->configCheckTask = g_timeout_add(CONF_POLL_TIME * 1000,
+                                             ToolsCoreConfFileCb,
+                                             state);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Watches the directory of the config file with inotify, so that changes
+ * are picked up right away without polling the file.
+ *
+ * @param[in]  state    Service state.
+ *
+ * @return Id of the watch source, 0 on failure.
+ */
+
+static guint
+ToolsCoreWatchConfFile(ToolsServiceState *state)
+{
+   gchar *path;
+   gchar *dir;
+   GIOChannel *chan;
+   guint id = 0;
+   int fd;
+
+   if (state->configFile != NULL) {
+      path = g_strdup(state->configFile);
+   } else {
+      char *confPath = GuestApp_GetConfPath();
+
+      if (confPath == NULL) {
+         return 0;
+      }
+      path = g_build_filename(confPath, CONF_FILE, NULL);
+      free(confPath);
+   }
+
+   fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if (fd == -1) {
+      g_debug("%s: inotify_init1 failed: %s\n", __FUNCTION__,
+              g_strerror(errno));
+      g_free(path);
+      return 0;
+   }
+
+   dir = g_path_get_dirname(path);
+   if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                         IN_MOVED_FROM | IN_CREATE | IN_DELETE |
+                         IN_ATTRIB) == -1) {
+      g_debug("%s: cannot watch %s: %s\n", __FUNCTION__, dir,
+              g_strerror(errno));
+      close(fd);
+   } else {
+      g_free(gConfWatchName);
+      gConfWatchName = g_path_get_basename(path);
+
+      chan = g_io_channel_unix_new(fd);
+      g_io_channel_set_close_on_unref(chan, TRUE);
+      id = g_io_add_watch(chan, G_IO_IN | G_IO_ERR | G_IO_HUP,
+                          ToolsCoreConfWatchCb, state);
+      g_io_channel_unref(chan);
+      g_debug("Watching %s for config changes.\n", dir);
+   }
+
+   g_free(dir);
+   g_free(path);
+   return id;
+}
+#endif
+
+
+/**
+ * Starts checking the config file for changes: with inotify where
+ * available, by polling every CONF_POLL_TIME seconds otherwise.
+ *
+ * @param[in]  state    Service state.
+ *
+ * @return Id of the source checking for changes.
+ */
+
+static guint
+ToolsCoreStartConfCheck(ToolsServiceState *state)
+{
+#if defined(__linux__)
+   guint id = ToolsCoreWatchConfFile(state);
+
+   if (id != 0) {
+      return id;
+   }
+#endif
+
+   return g_timeout_add(CONF_POLL_TIME * 1000, ToolsCoreConfFileCb, state);
+}
+
+
 /**
  * IO freeze signal handler. Disables the conf file check task if I/O is
  * frozen, re-enable it otherwise. See bug 529653.
@@ -199,12 +427,17 @@ ToolsCoreIOFreezeCb(gpointer src,
    if (state->configCheckTask > 0 && freeze) {
       g_source_remove(state->configCheckTask);
       state->configCheckTask = 0;
+      if (gConfReloadTimer != 0) {
+         g_source_remove(gConfReloadTimer);
+         gConfReloadTimer = 0;
+      }
       VMTools_SuspendLogIO();
    } else if (state->configCheckTask == 0 && !freeze) {
       VMTools_ResumeLogIO();
-      state->configCheckTask = g_timeout_add(CONF_POLL_TIME * 1000,
-                                             ToolsCoreConfFileCb,
-                                             state);
+      state->configCheckTask = ToolsCoreStartConfCheck(state);
+
+      /* Changes made while frozen were not seen by the watch. */
+      ToolsCoreScheduleConfReload(state);
    }
 }
 
@@ -364,6 +597,93 @@ ToolsCoreResetSignalCb(gpointer src,          // IN
 }
 
 
+/**
+ * Records a step of the service startup, for the startup timeline logged
+ * once the service is ready and in the state dump.
+ *
+ * @param[in]  state    Service state.
+ * @param[in]  name     Name of the step.
+ * @param[in]  start    Monotonic time the step started, in microseconds.
+ * @param[in]  end      Monotonic time the step ended, in microseconds.
+ */
+
+void
+ToolsCore_StartupStep(ToolsServiceState *state,
+                      const gchar *name,
+                      gint64 start,
+                      gint64 end)
+{
+   ToolsStartupStep step;
+
+   if (state->startup == NULL) {
+      return;
+   }
+
+   step.name = g_strdup(name);
+   step.startUs = start - state->startupUs;
+   step.durationUs = end - start;
+   g_array_append_val(state->startup, step);
+}
+
+
+/**
+ * Logs the startup timeline.
+ *
+ * @param[in]  state    Service state.
+ * @param[in]  dump     Whether to log as part of the state dump.
+ */
+
+static void
+ToolsCoreLogStartup(ToolsServiceState *state,
+                    gboolean dump)
+{
+   guint i;
+
+   for (i = 0; state->startup != NULL && i < state->startup->len; i++) {
+      ToolsStartupStep *step = &g_array_index(state->startup,
+                                              ToolsStartupStep, i);
+
+      if (dump) {
+         ToolsCore_LogState(TOOLS_STATE_LOG_CONTAINER,
+                            "Startup: %s at %.1f ms took %.1f ms\n",
+                            step->name, step->startUs / 1000.0,
+                            step->durationUs / 1000.0);
+      } else {
+         g_debug("Startup: %s at %.1f ms took %.1f ms\n",
+                 step->name, step->startUs / 1000.0,
+                 step->durationUs / 1000.0);
+      }
+   }
+}
+
+
+/**
+ * Releases the memory the service no longer uses, in the low-memory
+ * profile: the idle threads of the thread pools and the free memory kept
+ * by the heap. Runs at low priority, so only when the service is idle.
+ *
+ * @param[in]  data     Unused.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+ToolsCoreTrimMemoryCb(gpointer data)
+{
+   guint64 rss;
+   guint64 peakRss;
+
+   g_thread_pool_stop_unused_threads();
+   VMTools_TrimMemory();
+
+   if (VMTools_GetMemoryUsage(&rss, &peakRss)) {
+      g_debug("Memory trimmed, RSS %"G_GUINT64_FORMAT" KB, peak "
+              "%"G_GUINT64_FORMAT" KB.\n", rss / 1024, peakRss / 1024);
+   }
+   return TRUE;
+}
+
+
 /*
  ******************************************************************************
  * ToolsCoreRunLoop --                                                  */ /**
@@ -380,6 +700,11 @@ ToolsCoreResetSignalCb(gpointer src,          // IN
 static int
 ToolsCoreRunLoop(ToolsServiceState *state)
 {
+   gint64 start;
+
+   state->startupUs = g_get_monotonic_time();
+   state->startup = g_array_new(FALSE, FALSE, sizeof (ToolsStartupStep));
+
    if (!ToolsCore_InitRpc(state)) {
       return 1;
    }
@@ -396,10 +721,22 @@ ToolsCoreRunLoop(ToolsServiceState *state)
    if (state->ctx.rpc) {
       ToolsCoreReportVersionData(state);
    }
+   ToolsCore_StartupStep(state, "rpc channel", state->startupUs,
+                         g_get_monotonic_time());
 
+   /* Serve guest customization before loading the other plugins. */
+   if (state->mainService) {
+      start = g_get_monotonic_time();
+      ToolsCore_EarlyStart(state);
+      ToolsCore_StartupStep(state, "early start", start,
+                            g_get_monotonic_time());
+   }
+
+   start = g_get_monotonic_time();
    if (!ToolsCore_LoadPlugins(state)) {
       return 1;
    }
+   ToolsCore_StartupStep(state, "load plugins", start, g_get_monotonic_time());
 
 #if defined(__linux__)
    /*
@@ -424,7 +761,10 @@ ToolsCoreRunLoop(ToolsServiceState *state)
        (state->ctx.isVMware ||
         ToolsCore_GetTcloName(state) == NULL ||
         state->debugPlugin != NULL)) {
+      start = g_get_monotonic_time();
       ToolsCore_RegisterPlugins(state);
+      ToolsCore_StartupStep(state, "register plugins", start,
+                            g_get_monotonic_time());
 
       /*
        * Listen for the I/O freeze signal. We have to disable the config file
@@ -455,9 +795,21 @@ ToolsCoreRunLoop(ToolsServiceState *state)
                           NULL);
       }
 
-      state->configCheckTask = g_timeout_add(CONF_POLL_TIME * 1000,
-                                             ToolsCoreConfFileCb,
-                                             state);
+      state->configCheckTask = ToolsCoreStartConfCheck(state);
+#if !defined(_WIN32)
+      ToolsCoreMetrics_Start(state);
+#endif
+      if (VMTools_IsLowMemory()) {
+         gTrimTimer = g_timeout_add_seconds_full(G_PRIORITY_LOW,
+                                                 TRIM_INTERVAL_SEC,
+                                                 ToolsCoreTrimMemoryCb,
+                                                 NULL, NULL);
+      }
+
+      g_message("Service '%s' ready %.1f ms after startup began.\n",
+                state->name,
+                (g_get_monotonic_time() - state->startupUs) / 1000.0);
+      ToolsCoreLogStartup(state, FALSE);
 
 #if defined(__APPLE__)
       ToolsCore_CFRunLoop(state);
@@ -524,7 +876,36 @@ ToolsCore_DumpState(ToolsServiceState *state)
       }
    }
 
+   {
+      guint64 rss;
+      guint64 peakRss;
+
+      if (VMTools_GetMemoryUsage(&rss, &peakRss)) {
+         ToolsCore_LogState(TOOLS_STATE_LOG_CONTAINER,
+                            "Memory: RSS %"G_GUINT64_FORMAT" KB, peak "
+                            "%"G_GUINT64_FORMAT" KB%s\n",
+                            rss / 1024, peakRss / 1024,
+                            VMTools_IsLowMemory() ? " (low-memory profile)" :
+                                                    "");
+      }
+   }
+
+   if (state->ctx.rpc != NULL) {
+      RpcChannelStats stats;
+
+      RpcChannel_GetStats(state->ctx.rpc, &stats);
+      if (stats.fallbacks > 0) {
+         ToolsCore_LogState(TOOLS_STATE_LOG_CONTAINER,
+                            "RPC channel: %u backdoor fallback(s), %"
+                            G_GUINT64_FORMAT" s degraded%s\n",
+                            stats.fallbacks, stats.degradedSecs,
+                            stats.degraded ? " (on backdoor now)" : "");
+      }
+   }
+
    ToolsCore_DumpPluginInfo(state);
+   ToolsCoreLogStartup(state, TRUE);
+   ToolsCoreHangDetector_DumpProfile();
 
    g_signal_emit_by_name(state->ctx.serviceObj,
                          TOOLS_CORE_SIG_DUMP_STATE,
@@ -607,23 +988,35 @@ ToolsCore_ReloadConfig(ToolsServiceState *state,
                        gboolean reset)
 {
    gboolean first = state->ctx.config == NULL;
-   gboolean loaded;
-
-   loaded = VMTools_LoadConfig(state->configFile,
-                               G_KEY_FILE_NONE,
-                               &state->ctx.config,
-                               &state->configMtime);
-
-   if (!first && loaded) {
-      g_debug("Config file reloaded.\n");
-
-      /*
-       * Inform plugins of config file update.
-       */
-      ASSERT(state->ctx.serviceObj != NULL);
-      g_signal_emit_by_name(state->ctx.serviceObj,
-                            TOOLS_CORE_SIG_CONF_RELOAD,
-                            &state->ctx);
+   GKeyFile *oldConfig = state->ctx.config;
+   GKeyFile *newConfig = NULL;
+   gboolean changed = FALSE;
+
+   if (VMTools_LoadConfig(state->configFile,
+                          G_KEY_FILE_NONE,
+                          &newConfig,
+                          &state->configMtime)) {
+      state->ctx.config = newConfig;
+      changed = TRUE;
+
+      if (!first) {
+         /*
+          * Run the subscriptions of the keys which changed, and inform
+          * plugins of the config file update unless nothing changed.
+          */
+         changed = VMTools_ConfigNotifyChanges(oldConfig, newConfig);
+         if (changed) {
+            g_debug("Config file reloaded.\n");
+
+            ASSERT(state->ctx.serviceObj != NULL);
+            g_signal_emit_by_name(state->ctx.serviceObj,
+                                  TOOLS_CORE_SIG_CONF_RELOAD,
+                                  &state->ctx);
+         } else {
+            g_debug("Config file reloaded, no changes.\n");
+         }
+         g_key_file_free(oldConfig);
+      }
    }
 
    if (state->ctx.config == NULL) {
@@ -631,7 +1024,18 @@ ToolsCore_ReloadConfig(ToolsServiceState *state,
       state->ctx.config = g_key_file_new();
    }
 
-   if (reset || loaded) {
+   /*
+    * The low-memory profile is chosen once, before the first threads are
+    * created, since it changes their defaults.
+    */
+   if (first) {
+      VMTools_SetLowMemory(g_key_file_get_boolean(state->ctx.config,
+                                                  state->name,
+                                                  CONFNAME_LOW_MEMORY,
+                                                  NULL));
+   }
+
+   if (reset || changed) {
       VMTools_ConfigLogging(state->name,
                             state->ctx.config,
                             TRUE,
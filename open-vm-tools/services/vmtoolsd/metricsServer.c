@@ -0,0 +1,456 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file metricsServer.c
+ *
+ *    Exports the metrics registry on a local UNIX socket. Each client that
+ *    connects is sent one snapshot, in the Prometheus text format, and the
+ *    connection is then closed; e.g. a cron job can feed the node exporter's
+ *    textfile collector with:
+ *
+ *    socat -u UNIX-CONNECT:/run/vmtoolsd.metrics - > vmtoolsd.prom.tmp
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "vm_assert.h"
+#include "asyncsocket.h"
+#include "fileIO.h"
+#include "fileLock.h"
+#include "toolsCoreInt.h"
+#include "vmware/tools/metrics.h"
+#include "vmware/tools/utils.h"
+
+#define CONFNAME_METRICS_SOCKET "metrics.socket"
+
+#define METRICS_RSS_NAME "vmtools_resident_memory_bytes"
+#define METRICS_RPC_RECEIVED_NAME "vmtools_rpc_received"
+#define METRICS_RPC_IDLE_NAME "vmtools_rpc_idle_wakeups"
+#define METRICS_POOL_HITS_NAME "vmtools_fileio_aligned_pool{result=\"hit\"}"
+#define METRICS_POOL_MISSES_NAME "vmtools_fileio_aligned_pool{result=\"miss\"}"
+#define METRICS_POOL_HELP \
+   "Aligned FileIO buffers reused from the pool, and allocated on a miss."
+
+/* Counters of AsyncSocket_GetGlobalStats exported as metrics. */
+static const struct {
+   const gchar *name;
+   const gchar *help;
+   gsize offset;
+} gMetricsAsyncSocket[] = {
+   { "vmtools_asyncsocket_bytes{dir=\"sent\"}",
+     "Bytes sent and received on asyncsockets.",
+     offsetof(AsyncSocketStats, bytesSent) },
+   { "vmtools_asyncsocket_bytes{dir=\"received\"}",
+     "Bytes sent and received on asyncsockets.",
+     offsetof(AsyncSocketStats, bytesRecvd) },
+   { "vmtools_asyncsocket_empty_wakeups",
+     "Asyncsocket receive callbacks that found no data.",
+     offsetof(AsyncSocketStats, emptyWakeups) },
+   { "vmtools_asyncsocket_blocked_us{op=\"send\"}",
+     "Microseconds spent in blocking asyncsocket sends and receives.",
+     offsetof(AsyncSocketStats, blockedSendUs) },
+   { "vmtools_asyncsocket_blocked_us{op=\"recv\"}",
+     "Microseconds spent in blocking asyncsocket sends and receives.",
+     offsetof(AsyncSocketStats, blockedRecvUs) },
+   { "vmtools_asyncsocket_handshakes",
+     "SSL handshakes completed on asyncsockets.",
+     offsetof(AsyncSocketStats, handshakes) },
+   { "vmtools_asyncsocket_handshake_us",
+     "Microseconds spent in asyncsocket SSL handshakes.",
+     offsetof(AsyncSocketStats, handshakeUs) },
+   { "vmtools_asyncsocket_send_queue_high_water_bytes",
+     "Most bytes ever queued for sending on an asyncsocket.",
+     offsetof(AsyncSocketStats, sendQueueHighWater) },
+};
+
+/* Counters of FileLock_GetStats exported as metrics. */
+static const struct {
+   const gchar *name;
+   const gchar *help;
+   gsize offset;
+} gMetricsFileLock[] = {
+   { "vmtools_filelock_acquired{kind=\"any\"}",
+     "File locks acquired, and of those the OFD locks.",
+     offsetof(FileLockStats, acquired) },
+   { "vmtools_filelock_acquired{kind=\"ofd\"}",
+     "File locks acquired, and of those the OFD locks.",
+     offsetof(FileLockStats, acquiredOFD) },
+   { "vmtools_filelock_timed_out",
+     "File locks not acquired within their wait time.",
+     offsetof(FileLockStats, timedOut) },
+   { "vmtools_filelock_wait_us",
+     "Microseconds spent acquiring file locks.",
+     offsetof(FileLockStats, waitTimeUsec) },
+   { "vmtools_filelock_max_wait_us",
+     "Longest time spent acquiring a file lock, in microseconds.",
+     offsetof(FileLockStats, maxWaitTimeUsec) },
+};
+
+static guint gMetricsWatch = 0;
+static gchar *gMetricsPath = NULL;
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsRss --                                               */ /**
+ *
+ * Gauge callback returning the resident set size of the process.
+ *
+ * @param[in]  data     Unused.
+ *
+ * @return RSS in bytes, 0 if unknown.
+ *
+ ******************************************************************************
+ */
+
+static gint64
+ToolsCoreMetricsRss(gpointer data)
+{
+   guint64 rss;
+   guint64 peakRss;
+
+   return VMTools_GetMemoryUsage(&rss, &peakRss) ? (gint64) rss : 0;
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsRpcReceived --                                       */ /**
+ *
+ * Gauge callback returning the RPCs received from the host on the service's
+ * RPC channel.
+ *
+ * @param[in]  data     Service state.
+ *
+ * @return The count, 0 without a channel.
+ *
+ ******************************************************************************
+ */
+
+static gint64
+ToolsCoreMetricsRpcReceived(gpointer data)
+{
+   ToolsServiceState *state = data;
+   RpcChannelStats stats;
+
+   if (state->ctx.rpc == NULL) {
+      return 0;
+   }
+   RpcChannel_GetStats(state->ctx.rpc, &stats);
+   return (gint64) stats.rpcs;
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsRpcIdle --                                           */ /**
+ *
+ * Gauge callback returning the receive wakeups of the service's RPC channel
+ * that had no RPC to dispatch: empty Backdoor polls and vsocket heartbeats.
+ *
+ * @param[in]  data     Service state.
+ *
+ * @return The count, 0 without a channel.
+ *
+ ******************************************************************************
+ */
+
+static gint64
+ToolsCoreMetricsRpcIdle(gpointer data)
+{
+   ToolsServiceState *state = data;
+   RpcChannelStats stats;
+
+   if (state->ctx.rpc == NULL) {
+      return 0;
+   }
+   RpcChannel_GetStats(state->ctx.rpc, &stats);
+   return (gint64) stats.idleWakeups;
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsAsyncSocket --                                       */ /**
+ *
+ * Gauge callback returning one of the counters summed over the asyncsockets
+ * of the process.
+ *
+ * @param[in]  data     Entry of gMetricsAsyncSocket.
+ *
+ * @return The counter.
+ *
+ ******************************************************************************
+ */
+
+static gint64
+ToolsCoreMetricsAsyncSocket(gpointer data)
+{
+   gsize offset = gMetricsAsyncSocket[GPOINTER_TO_UINT(data)].offset;
+   AsyncSocketStats stats;
+
+   AsyncSocket_GetGlobalStats(&stats);
+   return (gint64) *(const uint64 *) ((const char *) &stats + offset);
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsFileLock --                                          */ /**
+ *
+ * Gauge callback returning one of the file lock counters of the process.
+ *
+ * @param[in]  data     Entry of gMetricsFileLock.
+ *
+ * @return The counter.
+ *
+ ******************************************************************************
+ */
+
+static gint64
+ToolsCoreMetricsFileLock(gpointer data)
+{
+   gsize offset = gMetricsFileLock[GPOINTER_TO_UINT(data)].offset;
+   FileLockStats stats;
+
+   FileLock_GetStats(&stats);
+   return (gint64) *(const uint64 *) ((const char *) &stats + offset);
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsAlignedPool --                                       */ /**
+ *
+ * Gauge callback returning the hits or the misses of the aligned buffer pool
+ * of FileIO, summed over its size classes.
+ *
+ * @param[in]  data     TRUE for the misses, FALSE for the hits.
+ *
+ * @return The counter.
+ *
+ ******************************************************************************
+ */
+
+static gint64
+ToolsCoreMetricsAlignedPool(gpointer data)
+{
+   uint64 hits;
+   uint64 misses;
+
+   FileIOAligned_PoolGetStats(&hits, &misses);
+   return (gint64) (GPOINTER_TO_INT(data) ? misses : hits);
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetricsAcceptCb --                                          */ /**
+ *
+ * Accepts a client of the metrics socket, writes a snapshot to it and
+ * closes it. The write does not block: a snapshot is a few KB, which fits
+ * in the socket buffer, and a client that doesn't read just gets less.
+ *
+ * @param[in]  chan        The listening socket.
+ * @param[in]  cond        Unused.
+ * @param[in]  clientData  Unused.
+ *
+ * @return TRUE.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+ToolsCoreMetricsAcceptCb(GIOChannel *chan,
+                         GIOCondition cond,
+                         gpointer clientData)
+{
+   int fd = accept(g_io_channel_unix_get_fd(chan), NULL, NULL);
+   gchar *snapshot;
+   gsize len;
+   gsize off = 0;
+
+   if (fd == -1) {
+      if (errno != EAGAIN && errno != EINTR) {
+         g_debug("%s: accept failed: %s\n", __FUNCTION__, g_strerror(errno));
+      }
+      return TRUE;
+   }
+
+   snapshot = VMTools_MetricsSnapshot();
+   len = strlen(snapshot);
+   while (off < len) {
+      ssize_t n = send(fd, snapshot + off, len - off,
+                       MSG_DONTWAIT | MSG_NOSIGNAL);
+
+      if (n == -1 && errno == EINTR) {
+         continue;
+      }
+      if (n <= 0) {
+         g_debug("%s: snapshot truncated at %"G_GSIZE_FORMAT" of "
+                 "%"G_GSIZE_FORMAT" bytes.\n", __FUNCTION__, off, len);
+         break;
+      }
+      off += n;
+   }
+
+   g_free(snapshot);
+   close(fd);
+   return TRUE;
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetrics_Start --                                            */ /**
+ *
+ * Registers the service's process, RPC channel, asyncsocket, file lock and
+ * aligned buffer pool metrics, and starts listening on the metrics socket if one is configured
+ * with "metrics.socket" in the service's config group. The socket is only
+ * accessible to its owner.
+ *
+ * @param[in]  state    Service state.
+ *
+ ******************************************************************************
+ */
+
+void
+ToolsCoreMetrics_Start(ToolsServiceState *state)
+{
+   struct sockaddr_un addr;
+   GIOChannel *chan;
+   mode_t mask;
+   guint i;
+   int fd;
+
+   VMTools_MetricGaugeFunc(METRICS_RSS_NAME,
+                           "Resident set size of the process.",
+                           ToolsCoreMetricsRss, NULL);
+   VMTools_MetricGaugeFunc(METRICS_RPC_RECEIVED_NAME,
+                           "RPCs received from the host.",
+                           ToolsCoreMetricsRpcReceived, state);
+   VMTools_MetricGaugeFunc(METRICS_RPC_IDLE_NAME,
+                           "RPC channel wakeups with no RPC to dispatch.",
+                           ToolsCoreMetricsRpcIdle, state);
+   for (i = 0; i < ARRAYSIZE(gMetricsAsyncSocket); i++) {
+      VMTools_MetricGaugeFunc(gMetricsAsyncSocket[i].name,
+                              gMetricsAsyncSocket[i].help,
+                              ToolsCoreMetricsAsyncSocket,
+                              GUINT_TO_POINTER(i));
+   }
+   for (i = 0; i < ARRAYSIZE(gMetricsFileLock); i++) {
+      VMTools_MetricGaugeFunc(gMetricsFileLock[i].name,
+                              gMetricsFileLock[i].help,
+                              ToolsCoreMetricsFileLock,
+                              GUINT_TO_POINTER(i));
+   }
+   VMTools_MetricGaugeFunc(METRICS_POOL_HITS_NAME, METRICS_POOL_HELP,
+                           ToolsCoreMetricsAlignedPool,
+                           GINT_TO_POINTER(FALSE));
+   VMTools_MetricGaugeFunc(METRICS_POOL_MISSES_NAME, METRICS_POOL_HELP,
+                           ToolsCoreMetricsAlignedPool,
+                           GINT_TO_POINTER(TRUE));
+
+   ASSERT(gMetricsWatch == 0);
+   gMetricsPath = VMTools_ConfigGetString(state->ctx.config, state->name,
+                                          CONFNAME_METRICS_SOCKET, NULL);
+   if (gMetricsPath == NULL || *gMetricsPath == '\0') {
+      goto skip;
+   }
+
+   memset(&addr, 0, sizeof addr);
+   addr.sun_family = AF_UNIX;
+   if (strlen(gMetricsPath) >= sizeof addr.sun_path) {
+      g_warning("Metrics socket path '%s' is too long.\n", gMetricsPath);
+      goto skip;
+   }
+   g_strlcpy(addr.sun_path, gMetricsPath, sizeof addr.sun_path);
+
+   fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (fd == -1) {
+      g_warning("Cannot create metrics socket: %s\n", g_strerror(errno));
+      goto skip;
+   }
+
+   unlink(gMetricsPath);
+   mask = umask(0077);
+   if (bind(fd, (struct sockaddr *) &addr, sizeof addr) == -1 ||
+       listen(fd, 8) == -1) {
+      umask(mask);
+      g_warning("Cannot listen on metrics socket '%s': %s\n", gMetricsPath,
+                g_strerror(errno));
+      close(fd);
+      goto skip;
+   }
+   umask(mask);
+
+   chan = g_io_channel_unix_new(fd);
+   g_io_channel_set_close_on_unref(chan, TRUE);
+   gMetricsWatch = g_io_add_watch(chan, G_IO_IN, ToolsCoreMetricsAcceptCb,
+                                  NULL);
+   g_io_channel_unref(chan);
+   g_info("Exporting metrics on '%s'.\n", gMetricsPath);
+   return;
+
+skip:
+   g_free(gMetricsPath);
+   gMetricsPath = NULL;
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreMetrics_Stop --                                             */ /**
+ *
+ * Stops listening on the metrics socket, removes it, and unregisters the
+ * process metrics.
+ *
+ ******************************************************************************
+ */
+
+void
+ToolsCoreMetrics_Stop(void)
+{
+   guint i;
+
+   if (gMetricsWatch != 0) {
+      g_source_remove(gMetricsWatch);
+      gMetricsWatch = 0;
+      unlink(gMetricsPath);
+   }
+   g_free(gMetricsPath);
+   gMetricsPath = NULL;
+   VMTools_MetricRemove(METRICS_RSS_NAME);
+   VMTools_MetricRemove(METRICS_RPC_RECEIVED_NAME);
+   VMTools_MetricRemove(METRICS_RPC_IDLE_NAME);
+   for (i = 0; i < ARRAYSIZE(gMetricsAsyncSocket); i++) {
+      VMTools_MetricRemove(gMetricsAsyncSocket[i].name);
+   }
+   for (i = 0; i < ARRAYSIZE(gMetricsFileLock); i++) {
+      VMTools_MetricRemove(gMetricsFileLock[i].name);
+   }
+   VMTools_MetricRemove(METRICS_POOL_HITS_NAME);
+   VMTools_MetricRemove(METRICS_POOL_MISSES_NAME);
+}
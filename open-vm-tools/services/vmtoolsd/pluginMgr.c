@@ -20,6 +20,20 @@
  * @file pluginMgr.c
  *
  *    Provides functions for loading and manipulating Tools plugins.
+ *
+ *    A plugin installed with a manifest ("<plugin>.manifest" next to the
+ *    shared object) is loaded on demand instead of at startup:
+ *
+ *    @code
+ *    [lazy]
+ *    rpcs=deployPkg.begin;deployPkg.deploy
+ *    capabilities=...
+ *    @endcode
+ *
+ *    The service registers the listed RPCs and advertises the listed
+ *    old-style capabilities on behalf of the plugin, and only loads the
+ *    shared object when the first of those RPCs arrives. The plugin must
+ *    not depend on signals emitted before that.
  */
 
 #include <string.h>
@@ -40,9 +54,41 @@ typedef struct ToolsPlugin {
    GModule             *module;
    ToolsPluginOnLoad    onload;
    ToolsPluginData     *data;
+   gboolean             parallel;    /* May initialize in its own thread. */
+   GThread             *initThread;
+   ToolsAppCtx         *ctx;         /* For the entry point. */
+   gint64               initStart;
+   gint64               initEnd;
 } ToolsPlugin;
 
 
+/** Defines a plugin waiting to be loaded on demand. */
+typedef struct ToolsLazyPlugin {
+   ToolsServiceState   *state;
+   gchar               *fileName;
+   gchar               *path;
+   gchar              **rpcs;
+   gchar              **caps;
+   gchar               *early;
+   RpcChannelCallback  *stubs;
+} ToolsLazyPlugin;
+
+
+/** Defines the RPC that ends the early start window for a plugin. */
+typedef struct ToolsEarlyRpc {
+   RpcChannelCallback   stub;
+   RpcChannelCallback  *rpc;
+   guint               *pending;
+   gboolean             done;
+} ToolsEarlyRpc;
+
+#define LAZY_MANIFEST_SUFFIX  ".manifest"
+#define LAZY_MANIFEST_GROUP   "lazy"
+#define INIT_MANIFEST_GROUP   "init"
+#define CONFNAME_DISABLE_LAZY "disableLazyPlugins"
+#define CONFNAME_EARLY_START  "earlyStartTimeout"
+
+
 #ifdef USE_APPLOADER
 static Bool (*LoadDependencies)(char *libName, Bool useShipped);
 #endif
@@ -109,6 +155,7 @@ ToolsCoreDumpPluginInfo(ToolsServiceState *state,
    if (plugin->regs == NULL) {
       ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN, "No registrations.\n");
    }
+   ToolsCorePool_LogBudget(plugin->name);
 }
 
 
@@ -304,82 +351,106 @@ ToolsCoreRegisterProvider(ToolsServiceState *state,
 
 
 /**
- * Iterates through the list of plugins, and through each plugin's app
- * registration data, calling the appropriate callback for each piece
- * of data.
+ * Iterates through a plugin's app registration data, calling the appropriate
+ * callback for each piece of data.
  *
  * One of the two callback arguments must be provided.
  *
  * @param[in]  state       Service state.
- * @param[in]  pluginCb    Callback called for each plugin data instance.
+ * @param[in]  plugin      The plugin.
+ * @param[in]  pluginCb    Callback called for the plugin data instance.
  * @param[in]  appRegCb    Callback called for each application registration.
  */
 
 static void
-ToolsCoreForEachPlugin(ToolsServiceState *state,
-                       PluginDataCallback pluginCb,
-                       PluginAppRegCallback appRegCb)
+ToolsCoreForEachApp(ToolsServiceState *state,
+                    ToolsPlugin *plugin,
+                    PluginDataCallback pluginCb,
+                    PluginAppRegCallback appRegCb)
 {
-   guint i;
+   GArray *regs = (plugin->data != NULL) ? plugin->data->regs : NULL;
+   guint j;
 
    ASSERT(pluginCb != NULL || appRegCb != NULL);
 
-   for (i = 0; i < state->plugins->len; i++) {
-      ToolsPlugin *plugin = g_ptr_array_index(state->plugins, i);
-      GArray *regs = (plugin->data != NULL) ? plugin->data->regs : NULL;
-      guint j;
+   if (pluginCb != NULL) {
+      pluginCb(state, plugin->data);
+   }
+
+   if (regs == NULL || appRegCb == NULL) {
+      return;
+   }
+
+   for (j = 0; j < regs->len; j++) {
+      guint k;
+      guint pregIdx;
+      ToolsAppReg *reg = &g_array_index(regs, ToolsAppReg, j);
+      ToolsAppProviderReg *preg = NULL;
 
-      if (pluginCb != NULL) {
-         pluginCb(state, plugin->data);
+      /* Find the provider for the desired reg type. */
+      for (k = 0; k < state->providers->len; k++) {
+         ToolsAppProviderReg *tmp = &g_array_index(state->providers,
+                                                   ToolsAppProviderReg,
+                                                   k);
+         if (tmp->prov->regType == reg->type) {
+            preg = tmp;
+            pregIdx = k;
+            break;
+         }
       }
 
-      if (regs == NULL || appRegCb == NULL) {
+      if (preg == NULL) {
+         g_message("Cannot find provider for app type %d, plugin %s may not work.\n",
+                   reg->type, plugin->data->name);
+         if (plugin->data->errorCb != NULL &&
+             !plugin->data->errorCb(&state->ctx, reg->type, NULL, plugin->data)) {
+            break;
+         }
          continue;
       }
 
-      for (j = 0; j < regs->len; j++) {
-         guint k;
-         guint pregIdx;
-         ToolsAppReg *reg = &g_array_index(regs, ToolsAppReg, j);
-         ToolsAppProviderReg *preg = NULL;
-
-         /* Find the provider for the desired reg type. */
-         for (k = 0; k < state->providers->len; k++) {
-            ToolsAppProviderReg *tmp = &g_array_index(state->providers,
-                                                      ToolsAppProviderReg,
-                                                      k);
-            if (tmp->prov->regType == reg->type) {
-               preg = tmp;
-               pregIdx = k;
-               break;
-            }
+      for (k = 0; k < reg->data->len; k++) {
+         gpointer appdata = &reg->data->data[preg->prov->regSize * k];
+         if (!appRegCb(state, plugin->data, reg->type, preg, appdata)) {
+            /* Break out of the outer loop. */
+            j = regs->len;
+            break;
          }
 
-         if (preg == NULL) {
-            g_message("Cannot find provider for app type %d, plugin %s may not work.\n",
-                      reg->type, plugin->data->name);
-            if (plugin->data->errorCb != NULL &&
-                !plugin->data->errorCb(&state->ctx, reg->type, NULL, plugin->data)) {
-               break;
-            }
-            continue;
-         }
+         /*
+          * The registration callback may have modified the provider array,
+          * so we need to re-read the provider pointer.
+          */
+         preg = &g_array_index(state->providers, ToolsAppProviderReg, pregIdx);
+      }
+   }
+}
 
-         for (k = 0; k < reg->data->len; k++) {
-            gpointer appdata = &reg->data->data[preg->prov->regSize * k];
-            if (!appRegCb(state, plugin->data, reg->type, preg, appdata)) {
-               /* Break out of the outer loop. */
-               j = regs->len;
-               break;
-            }
 
-            /*
-             * The registration callback may have modified the provider array,
-             * so we need to re-read the provider pointer.
-             */
-            preg = &g_array_index(state->providers, ToolsAppProviderReg, pregIdx);
-         }
-      }
+/**
+ * Iterates through the list of plugins, and through each plugin's app
+ * registration data, calling the appropriate callback for each piece
+ * of data.
+ *
+ * One of the two callback arguments must be provided.
+ *
+ * @param[in]  state       Service state.
+ * @param[in]  pluginCb    Callback called for each plugin data instance.
+ * @param[in]  appRegCb    Callback called for each application registration.
+ */
+
+static void
+ToolsCoreForEachPlugin(ToolsServiceState *state,
+                       PluginDataCallback pluginCb,
+                       PluginAppRegCallback appRegCb)
+{
+   guint i;
+
+   ASSERT(pluginCb != NULL || appRegCb != NULL);
+
+   for (i = 0; i < state->plugins->len; i++) {
+      ToolsCoreForEachApp(state, g_ptr_array_index(state->plugins, i),
+                          pluginCb, appRegCb);
    }
 }
 
@@ -488,19 +559,223 @@ ToolsCoreStrPtrCompare(gconstpointer _str1,
 }
 
 
+/**
+ * Tells whether the manifest of a plugin allows calling its entry point in
+ * a thread of its own, concurrently with the other plugins: "parallel=true"
+ * in the "init" group. Such plugins must not depend on other plugins being
+ * initialized, nor use the RPC channel from their entry point.
+ *
+ * @param[in]  path     Path of the shared object.
+ *
+ * @return Whether the plugin may initialize in parallel.
+ */
+
+static gboolean
+ToolsCoreCanInitInParallel(const gchar *path)
+{
+#if defined(_WIN32)
+   /* Plugins initialize COM for the thread calling their entry point. */
+   return FALSE;
+#else
+   gboolean ret = FALSE;
+   gchar *manifest;
+   GKeyFile *keyFile;
+
+   if (!g_str_has_suffix(path, "." G_MODULE_SUFFIX)) {
+      return FALSE;
+   }
+
+   manifest = g_strdup_printf("%.*s" LAZY_MANIFEST_SUFFIX,
+                              (int) (strlen(path) -
+                                     strlen("." G_MODULE_SUFFIX)),
+                              path);
+   keyFile = g_key_file_new();
+   if (g_key_file_load_from_file(keyFile, manifest, G_KEY_FILE_NONE, NULL)) {
+      ret = g_key_file_get_boolean(keyFile, INIT_MANIFEST_GROUP, "parallel",
+                                   NULL);
+   }
+   g_key_file_free(keyFile);
+   g_free(manifest);
+   return ret;
+#endif
+}
+
+
+/**
+ * Opens a plugin's shared object and looks up its entry point.
+ *
+ * @param[in]  path     Path of the shared object.
+ * @param[in]  entry    File name of the plugin, owned by the new instance on
+ *                      success.
+ *
+ * @return A new ToolsPlugin instance, or NULL on error.
+ */
+
+static ToolsPlugin *
+ToolsCoreOpenPlugin(const gchar *path,
+                    gchar *entry)
+{
+   GModule *module = NULL;
+   ToolsPlugin *plugin = NULL;
+   ToolsPluginOnLoad onload;
+
+#ifdef USE_APPLOADER
+   /* Trying loading the plugins with system libraries */
+   if (!LoadDependencies((char *) path, FALSE)) {
+      g_warning("Loading of library dependencies for %s failed.\n", entry);
+      goto exit;
+   }
+#endif
+
+   module = g_module_open(path, G_MODULE_BIND_LOCAL);
+#ifdef USE_APPLOADER
+   if (module == NULL) {
+      g_info("Opening plugin '%s' with system libraries failed: %s\n",
+                entry, g_module_error());
+      /* Falling back to the shipped libraries */
+      if (!LoadDependencies((char *) path, TRUE)) {
+         g_warning("Loading of shipped library dependencies for %s failed.\n",
+                  entry);
+         goto exit;
+      }
+      module = g_module_open(path, G_MODULE_BIND_LOCAL);
+   }
+#endif
+   if (module == NULL) {
+      g_warning("Opening plugin '%s' failed: %s.\n", entry, g_module_error());
+      goto exit;
+   }
+
+   if (!g_module_symbol(module, "ToolsOnLoad", (gpointer *) &onload)) {
+      g_warning("Lookup of plugin entry point for '%s' failed.\n", entry);
+      goto exit;
+   }
+
+   plugin = g_malloc0(sizeof *plugin);
+   plugin->fileName = entry;
+   plugin->data = NULL;
+   plugin->module = module;
+   plugin->onload = onload;
+   plugin->parallel = ToolsCoreCanInitInParallel(path);
+
+exit:
+   if (plugin == NULL && module != NULL) {
+      if (!g_module_close(module)) {
+         g_warning("Error unloading plugin '%s': %s\n", entry, g_module_error());
+      }
+   }
+   return plugin;
+}
+
+
+/**
+ * Reads the manifest of a plugin, if it has one. Plugins with a valid
+ * manifest are added to the list of plugins to load on demand.
+ *
+ * @param[in]  pluginPath  Directory of the plugin.
+ * @param[in]  entry       File name of the plugin, owned by the on-demand
+ *                         entry on success.
+ * @param[in]  path        Path of the shared object.
+ * @param[out] lazy        Array where to store the on-demand plugin.
+ *
+ * @return Whether the plugin will be loaded on demand.
+ */
+
+static gboolean
+ToolsCoreReadManifest(const gchar *pluginPath,
+                      gchar *entry,
+                      const gchar *path,
+                      GPtrArray *lazy)
+{
+   gboolean ret = FALSE;
+   gchar *base;
+   gchar *manifest;
+   gchar **rpcs;
+   gsize numRpcs = 0;
+   GKeyFile *keyFile = g_key_file_new();
+   ToolsLazyPlugin *lp;
+
+   base = g_strndup(entry, strlen(entry) - strlen("." G_MODULE_SUFFIX));
+   manifest = g_strdup_printf("%s%c%s" LAZY_MANIFEST_SUFFIX,
+                              pluginPath, DIRSEPC, base);
+
+   if (!g_key_file_load_from_file(keyFile, manifest, G_KEY_FILE_NONE, NULL) ||
+       !g_key_file_has_group(keyFile, LAZY_MANIFEST_GROUP)) {
+      goto exit;
+   }
+
+   rpcs = g_key_file_get_string_list(keyFile, LAZY_MANIFEST_GROUP, "rpcs",
+                                     &numRpcs, NULL);
+   if (rpcs == NULL || numRpcs == 0) {
+      g_warning("Manifest '%s' lists no RPCs, loading the plugin now.\n",
+                manifest);
+      g_strfreev(rpcs);
+      goto exit;
+   }
+
+   lp = g_malloc0(sizeof *lp);
+   lp->fileName = entry;
+   lp->path = g_strdup(path);
+   lp->rpcs = rpcs;
+   lp->caps = g_key_file_get_string_list(keyFile, LAZY_MANIFEST_GROUP,
+                                         "capabilities", NULL, NULL);
+   lp->early = g_key_file_get_string(keyFile, LAZY_MANIFEST_GROUP, "early",
+                                     NULL);
+   g_ptr_array_add(lazy, lp);
+   g_debug("Plugin '%s' will be loaded on demand.\n", entry);
+   ret = TRUE;
+
+exit:
+   g_key_file_free(keyFile);
+   g_free(manifest);
+   g_free(base);
+   return ret;
+}
+
+
+/**
+ * Tells whether a plugin was loaded already, by the early start.
+ *
+ * @param[in]  state    The service state.
+ * @param[in]  entry    File name of the plugin.
+ *
+ * @return Whether the plugin is in the list of loaded plugins.
+ */
+
+static gboolean
+ToolsCoreIsPluginLoaded(ToolsServiceState *state,
+                        const gchar *entry)
+{
+   guint i;
+
+   for (i = 0; state->plugins != NULL && i < state->plugins->len; i++) {
+      ToolsPlugin *plugin = g_ptr_array_index(state->plugins, i);
+
+      if (plugin->fileName != NULL && strcmp(plugin->fileName, entry) == 0) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+
 /**
  * Loads all the plugins found in the given directory, adding the registration
- * data to the given array.
+ * data to the given array. Plugins already loaded are skipped.
  *
- * @param[in]  ctx         Application context.
+ * @param[in]  state       The service state.
  * @param[in]  pluginPath  Path where to look for plugins.
- * @param[out] regs        Array where to store plugin registration info.
+ * @param[out] regs        Array where to store plugin registration info,
+ *                         NULL to only read the manifests.
+ * @param[out] lazy        Array where to store plugins to load on demand,
+ *                         NULL to load all plugins now.
  */
 
 static gboolean
-ToolsCoreLoadDirectory(ToolsAppCtx *ctx,
+ToolsCoreLoadDirectory(ToolsServiceState *state,
                        const gchar *pluginPath,
-                       GPtrArray *regs)
+                       GPtrArray *regs,
+                       GPtrArray *lazy)
 {
    gboolean ret = FALSE;
    const gchar *staticEntry;
@@ -534,64 +809,37 @@ ToolsCoreLoadDirectory(ToolsAppCtx *ctx,
    for (i = 0; i < plugins->len; i++) {
       gchar *entry;
       gchar *path;
-      GModule *module = NULL;
-      ToolsPlugin *plugin = NULL;
-      ToolsPluginOnLoad onload;
+      ToolsPlugin *plugin;
 
       entry = g_ptr_array_index(plugins, i);
       path = g_strdup_printf("%s%c%s", pluginPath, DIRSEPC, entry);
 
-      if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
-         g_warning("File '%s' is not a regular file, skipping.\n", entry);
+      if (ToolsCoreIsPluginLoaded(state, entry)) {
+         g_free(entry);
          goto next;
       }
 
-#ifdef USE_APPLOADER
-      /* Trying loading the plugins with system libraries */
-      if (!LoadDependencies(path, FALSE)) {
-         g_warning("Loading of library dependencies for %s failed.\n", entry);
+      if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+         g_warning("File '%s' is not a regular file, skipping.\n", entry);
          goto next;
       }
-#endif
 
-      module = g_module_open(path, G_MODULE_BIND_LOCAL);
-#ifdef USE_APPLOADER
-      if (module == NULL) {
-         g_info("Opening plugin '%s' with system libraries failed: %s\n",
-                   entry, g_module_error());
-         /* Falling back to the shipped libraries */
-         if (!LoadDependencies(path, TRUE)) {
-            g_warning("Loading of shipped library dependencies for %s failed.\n",
-                     entry);
-            goto next;
-         }
-         module = g_module_open(path, G_MODULE_BIND_LOCAL);
-      }
-#endif
-      if (module == NULL) {
-         g_warning("Opening plugin '%s' failed: %s.\n", entry, g_module_error());
+      if (lazy != NULL && ToolsCoreReadManifest(pluginPath, entry, path, lazy)) {
          goto next;
       }
 
-      if (!g_module_symbol(module, "ToolsOnLoad", (gpointer *) &onload)) {
-         g_warning("Lookup of plugin entry point for '%s' failed.\n", entry);
+      if (regs == NULL) {
+         g_free(entry);
          goto next;
       }
 
-      plugin = g_malloc(sizeof *plugin);
-      plugin->fileName = entry;
-      plugin->data = NULL;
-      plugin->module = module;
-      plugin->onload = onload;
-      g_ptr_array_add(regs, plugin);
+      plugin = ToolsCoreOpenPlugin(path, entry);
+      if (plugin != NULL) {
+         g_ptr_array_add(regs, plugin);
+      }
 
    next:
       g_free(path);
-      if (plugin == NULL && module != NULL) {
-         if (!g_module_close(module)) {
-            g_warning("Error unloading plugin '%s': %s\n", entry, g_module_error());
-         }
-      }
    }
 
    g_ptr_array_free(plugins, TRUE);
@@ -602,6 +850,241 @@ exit:
 }
 
 
+/**
+ * Calls the entry point of a plugin, timing it. Also the function of the
+ * threads of the plugins initialized in parallel.
+ *
+ * @param[in]  data     The plugin.
+ *
+ * @return NULL.
+ */
+
+static gpointer
+ToolsCoreCallOnLoad(gpointer data)
+{
+   ToolsPlugin *plugin = data;
+
+   plugin->initStart = g_get_monotonic_time();
+   plugin->data = plugin->onload(plugin->ctx);
+   plugin->initEnd = g_get_monotonic_time();
+   return NULL;
+}
+
+
+/**
+ * Initializes a plugin by calling its entry point, or waiting for it if it
+ * was started in parallel, and adds it to the list of loaded plugins.
+ * Unloads the plugin if it doesn't want to run.
+ *
+ * @param[in]  state    The service state.
+ * @param[in]  plugin   The plugin.
+ *
+ * @return Whether the plugin was initialized.
+ */
+
+static gboolean
+ToolsCoreInitPlugin(ToolsServiceState *state,
+                    ToolsPlugin *plugin)
+{
+   gboolean parallel = plugin->initThread != NULL;
+   gchar *step;
+
+   if (parallel) {
+      g_thread_join(plugin->initThread);
+      plugin->initThread = NULL;
+   } else {
+      plugin->ctx = &state->ctx;
+      ToolsCoreCallOnLoad(plugin);
+   }
+
+   step = g_strdup_printf("init %s%s", plugin->fileName,
+                          parallel ? " (parallel)" : "");
+   ToolsCore_StartupStep(state, step, plugin->initStart, plugin->initEnd);
+   g_free(step);
+
+   if (plugin->data == NULL) {
+      g_info("Plugin '%s' didn't provide deployment data, unloading.\n",
+             plugin->fileName);
+      ToolsCoreFreePlugin(plugin);
+      return FALSE;
+   } else if (state->ctx.errorCode != 0 && !parallel) {
+      /*
+       * The plugin has requested the container to quit. A plugin which ran
+       * in parallel may have set up sources already, keep it until the
+       * plugins are unloaded.
+       */
+      ToolsCoreFreePlugin(plugin);
+      return FALSE;
+   }
+
+   ASSERT(plugin->data->name != NULL);
+   g_module_make_resident(plugin->module);
+   g_ptr_array_add(state->plugins, plugin);
+   VMTools_BindTextDomain(plugin->data->name, NULL, NULL);
+   g_message("Plugin '%s' initialized.\n", plugin->data->name);
+   return TRUE;
+}
+
+
+/**
+ * Unregisters the RPC stubs of an on-demand plugin, if registered.
+ *
+ * @param[in]  lp    The on-demand plugin.
+ */
+
+static void
+ToolsCoreUnregisterLazyStubs(ToolsLazyPlugin *lp)
+{
+   if (lp->stubs != NULL) {
+      guint i;
+
+      for (i = 0; lp->rpcs[i] != NULL; i++) {
+         RpcChannel_UnregisterCallback(lp->state->ctx.rpc, &lp->stubs[i]);
+      }
+      g_free(lp->stubs);
+      lp->stubs = NULL;
+   }
+}
+
+
+/**
+ * Frees an on-demand plugin entry, unregistering its RPC stubs.
+ *
+ * @param[in]  lp    The on-demand plugin.
+ */
+
+static void
+ToolsCoreFreeLazyPlugin(ToolsLazyPlugin *lp)
+{
+   ToolsCoreUnregisterLazyStubs(lp);
+   g_strfreev(lp->rpcs);
+   g_strfreev(lp->caps);
+   g_free(lp->early);
+   g_free(lp->path);
+   g_free(lp->fileName);
+   g_free(lp);
+}
+
+
+/**
+ * Loads an on-demand plugin and registers its applications. The on-demand
+ * entry is freed.
+ *
+ * @param[in]  lp    The on-demand plugin.
+ *
+ * @return Whether the plugin was loaded.
+ */
+
+static gboolean
+ToolsCoreLoadLazyPlugin(ToolsLazyPlugin *lp)
+{
+   ToolsServiceState *state = lp->state;
+   ToolsPlugin *plugin;
+   gboolean ret = FALSE;
+
+   /* The plugin registers the same RPCs. */
+   ToolsCoreUnregisterLazyStubs(lp);
+   g_ptr_array_remove(state->lazyPlugins, lp);
+
+   plugin = ToolsCoreOpenPlugin(lp->path, g_strdup(lp->fileName));
+   if (plugin != NULL && ToolsCoreInitPlugin(state, plugin)) {
+      ToolsCoreForEachApp(state, plugin, NULL, ToolsCoreRegisterProvider);
+      ToolsCoreForEachApp(state, plugin, NULL, ToolsCoreRegisterApp);
+      ret = TRUE;
+   } else if (state->ctx.errorCode != 0) {
+      g_main_loop_quit(state->ctx.mainLoop);
+   }
+
+   ToolsCoreFreeLazyPlugin(lp);
+   return ret;
+}
+
+
+/**
+ * RPC stub of an on-demand plugin. Loads the plugin, and dispatches the RPC
+ * again so that it reaches the handler the plugin just registered.
+ *
+ * @param[in]  data     RPC data.
+ *
+ * @return Result of the plugin's handler.
+ */
+
+static gboolean
+ToolsCoreLazyRpc(RpcInData *data)
+{
+   ToolsLazyPlugin *lp = data->clientData;
+   ToolsServiceState *state = lp->state;
+   size_t nameLen = strlen(data->name);
+   RpcInData copy;
+   gchar *cmd;
+   gboolean status;
+
+   g_message("Loading plugin '%s' for RPC '%s'.\n", lp->fileName, data->name);
+
+   if (!ToolsCoreLoadLazyPlugin(lp)) {
+      return RPCIN_SETRETVALS(data, "Unknown Command", FALSE);
+   }
+
+   cmd = g_malloc(nameLen + data->argsSize + 1);
+   memcpy(cmd, data->name, nameLen);
+   memcpy(cmd + nameLen, data->args, data->argsSize);
+   cmd[nameLen + data->argsSize] = '\0';
+
+   memset(&copy, 0, sizeof copy);
+   copy.args = cmd;
+   copy.argsSize = nameLen + data->argsSize;
+   copy.clientData = state->ctx.rpc;
+
+   status = RpcChannel_Dispatch(&copy);
+
+   data->result = copy.result;
+   data->resultLen = copy.resultLen;
+   data->freeResult = copy.freeResult;
+   g_free(cmd);
+   return status;
+}
+
+
+/**
+ * Capabilities signal handler advertising the capabilities listed in the
+ * manifests of plugins that are not loaded yet.
+ *
+ * @param[in]  src      Unused.
+ * @param[in]  ctx      Unused.
+ * @param[in]  set      Whether capabilities are being set or unset.
+ * @param[in]  data     The service state.
+ *
+ * @return The capabilities, or NULL.
+ */
+
+static GArray *
+ToolsCoreLazyCapabilities(gpointer src,
+                          ToolsAppCtx *ctx,
+                          gboolean set,
+                          gpointer data)
+{
+   ToolsServiceState *state = data;
+   GArray *caps = NULL;
+   guint i;
+
+   for (i = 0; state->lazyPlugins != NULL && i < state->lazyPlugins->len; i++) {
+      ToolsLazyPlugin *lp = g_ptr_array_index(state->lazyPlugins, i);
+      guint k;
+
+      for (k = 0; lp->caps != NULL && lp->caps[k] != NULL; k++) {
+         ToolsAppCapability cap = { TOOLS_CAP_OLD, lp->caps[k], 0, 1 };
+
+         if (caps == NULL) {
+            caps = g_array_new(FALSE, TRUE, sizeof (ToolsAppCapability));
+         }
+         g_array_append_val(caps, cap);
+      }
+   }
+
+   return caps;
+}
+
+
 /**
  * State dump callback for logging information about loaded plugins.
  *
@@ -611,32 +1094,35 @@ exit:
 void
 ToolsCore_DumpPluginInfo(ToolsServiceState *state)
 {
+   guint i;
+
    if (state->plugins == NULL) {
       g_message("   No plugins loaded.");
    } else {
       ToolsCoreForEachPlugin(state, ToolsCoreDumpPluginInfo, ToolsCoreDumpAppInfo);
    }
+
+   for (i = 0; state->lazyPlugins != NULL && i < state->lazyPlugins->len; i++) {
+      ToolsLazyPlugin *lp = g_ptr_array_index(state->lazyPlugins, i);
+      ToolsCore_LogState(TOOLS_STATE_LOG_CONTAINER,
+                         "Plugin: %s (not loaded yet)\n", lp->fileName);
+   }
 }
 
 
 /**
- * Loads all plugins present in the plugin directory. If the plugin path
- * is NULL, then default directories are used in case the service is either
- * the main tools service of the user daemon, otherwise failure is returned.
+ * Returns the default directory of the plugins of a container.
  *
- * @param[in]  state    The service state.
+ * @param[in]  name     The container name, or TOOLSCORE_COMMON.
  *
- * @return Whether loading the plugins was successful.
+ * @return The path, to free with g_free.
  */
 
-gboolean
-ToolsCore_LoadPlugins(ToolsServiceState *state)
+static gchar *
+ToolsCoreDefaultPluginPath(const gchar *name)
 {
-   gboolean pluginDirExists;
-   gboolean ret = FALSE;
    gchar *pluginRoot;
-   guint i;
-   GPtrArray *plugins = NULL;
+   gchar *path;
 
 #if defined(sun) && defined(__x86_64__)
    const char *subdir = "/amd64";
@@ -652,6 +1138,206 @@ ToolsCore_LoadPlugins(ToolsServiceState *state)
    vm_free(instPath);
 #endif
 
+   path = g_strdup_printf("%s%s%c%s", pluginRoot, subdir, DIRSEPC, name);
+   g_free(pluginRoot);
+   return path;
+}
+
+
+/**
+ * RPC wrapper of the RPC ending the early start window of a plugin: calls
+ * the plugin's handler and counts the window as done for that plugin.
+ *
+ * @param[in]  data     RPC data.
+ *
+ * @return Result of the plugin's handler.
+ */
+
+static gboolean
+ToolsCoreEarlyRpc(RpcInData *data)
+{
+   ToolsEarlyRpc *er = data->clientData;
+   gboolean ret;
+
+   data->clientData = er->rpc->clientData;
+   ret = er->rpc->callback(data);
+
+   if (!er->done) {
+      er->done = TRUE;
+      (*er->pending)--;
+   }
+   return ret;
+}
+
+
+/**
+ * Timer callback closing the early start window.
+ *
+ * @param[in]  data     Flag to set.
+ *
+ * @return FALSE.
+ */
+
+static gboolean
+ToolsCoreEarlyTimeout(gpointer data)
+{
+   gboolean *timedOut = data;
+
+   *timedOut = TRUE;
+   return FALSE;
+}
+
+
+/**
+ * Early start of the service. With the RPC channel up, but before other
+ * plugins are loaded, loads the plugins whose manifest names an "early" RPC
+ * and serves their RPCs, until each has received its early RPC or the
+ * earlyStartTimeout (in seconds) expires. This lets guest customization,
+ * on the critical path of clone provisioning, run without waiting for the
+ * initialization of all the other plugins.
+ *
+ * Other RPCs are not known during the window. The early plugins stay
+ * loaded, and their applications are registered with the others by
+ * ToolsCore_RegisterPlugins.
+ *
+ * @param[in]  state    The service state.
+ */
+
+void
+ToolsCore_EarlyStart(ToolsServiceState *state)
+{
+   gint timeout;
+   guint i;
+   guint pending = 0;
+   gboolean timedOut = FALSE;
+   GPtrArray *lazy;
+   GPtrArray *registered;
+   GPtrArray *earlyRpcs;
+   GMainContext *mainCtx;
+   GSource *timer;
+
+   timeout = g_key_file_get_integer(state->ctx.config, state->name,
+                                    CONFNAME_EARLY_START, NULL);
+   if (timeout <= 0 || state->ctx.rpc == NULL) {
+      return;
+   }
+
+   if (state->pluginPath == NULL) {
+      state->pluginPath = ToolsCoreDefaultPluginPath(state->name);
+   }
+   if (!g_file_test(state->pluginPath, G_FILE_TEST_IS_DIR)) {
+      return;
+   }
+
+   lazy = g_ptr_array_new();
+   registered = g_ptr_array_new();
+   earlyRpcs = g_ptr_array_new_with_free_func(g_free);
+   if (state->plugins == NULL) {
+      state->plugins = g_ptr_array_new();
+   }
+
+   ToolsCoreLoadDirectory(state, state->pluginPath, NULL, lazy);
+
+   for (i = 0; i < lazy->len; i++) {
+      ToolsLazyPlugin *lp = g_ptr_array_index(lazy, i);
+      ToolsPlugin *plugin;
+      guint j;
+
+      if (lp->early == NULL) {
+         continue;
+      }
+
+      plugin = ToolsCoreOpenPlugin(lp->path, g_strdup(lp->fileName));
+      if (plugin == NULL || !ToolsCoreInitPlugin(state, plugin)) {
+         continue;
+      }
+
+      g_message("Plugin '%s' started early, until RPC '%s'.\n",
+                plugin->data->name, lp->early);
+
+      /* Only the GuestRPC applications are registered now. */
+      for (j = 0; plugin->data->regs != NULL && j < plugin->data->regs->len;
+           j++) {
+         ToolsAppReg *reg = &g_array_index(plugin->data->regs, ToolsAppReg, j);
+         guint k;
+
+         if (reg->type != TOOLS_APP_GUESTRPC || reg->data == NULL) {
+            continue;
+         }
+
+         for (k = 0; k < reg->data->len; k++) {
+            RpcChannelCallback *rpc = &g_array_index(reg->data,
+                                                     RpcChannelCallback, k);
+
+            if (strcmp(rpc->name, lp->early) == 0) {
+               ToolsEarlyRpc *er = g_malloc0(sizeof *er);
+
+               er->stub = *rpc;
+               er->stub.callback = ToolsCoreEarlyRpc;
+               er->stub.clientData = er;
+               er->rpc = rpc;
+               er->pending = &pending;
+               g_ptr_array_add(earlyRpcs, er);
+               RpcChannel_RegisterCallback(state->ctx.rpc, &er->stub);
+               g_ptr_array_add(registered, &er->stub);
+               pending++;
+            } else {
+               RpcChannel_RegisterCallback(state->ctx.rpc, rpc);
+               g_ptr_array_add(registered, rpc);
+            }
+         }
+      }
+   }
+
+   for (i = 0; i < lazy->len; i++) {
+      ToolsCoreFreeLazyPlugin(g_ptr_array_index(lazy, i));
+   }
+   g_ptr_array_free(lazy, TRUE);
+
+   if (pending > 0) {
+      mainCtx = g_main_loop_get_context(state->ctx.mainLoop);
+      timer = g_timeout_source_new_seconds(timeout);
+      g_source_set_callback(timer, ToolsCoreEarlyTimeout, &timedOut, NULL);
+      g_source_attach(timer, mainCtx);
+
+      while (pending > 0 && !timedOut && state->ctx.errorCode == 0) {
+         g_main_context_iteration(mainCtx, TRUE);
+      }
+
+      g_source_destroy(timer);
+      g_source_unref(timer);
+      g_message("Early start done%s.\n", timedOut ? " (timed out)" : "");
+   }
+
+   /* The RPCs are registered again with the other applications. */
+   for (i = 0; i < registered->len; i++) {
+      RpcChannel_UnregisterCallback(state->ctx.rpc,
+                                    g_ptr_array_index(registered, i));
+   }
+   g_ptr_array_free(registered, TRUE);
+   g_ptr_array_free(earlyRpcs, TRUE);
+}
+
+
+/**
+ * Loads all plugins present in the plugin directory. If the plugin path
+ * is NULL, then default directories are used in case the service is either
+ * the main tools service of the user daemon, otherwise failure is returned.
+ *
+ * @param[in]  state    The service state.
+ *
+ * @return Whether loading the plugins was successful.
+ */
+
+gboolean
+ToolsCore_LoadPlugins(ToolsServiceState *state)
+{
+   gboolean pluginDirExists;
+   gboolean ret = FALSE;
+   guint i;
+   GPtrArray *plugins = NULL;
+   GPtrArray *lazy = NULL;
+
    ASSERT(g_module_supported());
 
 #ifdef USE_APPLOADER
@@ -673,23 +1359,26 @@ ToolsCore_LoadPlugins(ToolsServiceState *state)
 
    plugins = g_ptr_array_new();
 
+   /* Plugins with a manifest are loaded on demand, unless disabled. */
+   if (!g_key_file_get_boolean(state->ctx.config, state->name,
+                               CONFNAME_DISABLE_LAZY, NULL)) {
+      lazy = g_ptr_array_new();
+   }
+
    /*
     * First, load plugins from the common directory. The common directory
     * is not required to exist unless provided on the command line.
     */
    if (state->commonPath == NULL) {
-      state->commonPath = g_strdup_printf("%s%s%c%s",
-                                          pluginRoot,
-                                          subdir,
-                                          DIRSEPC,
-                                          TOOLSCORE_COMMON);
+      state->commonPath = ToolsCoreDefaultPluginPath(TOOLSCORE_COMMON);
    } else if (!g_file_test(state->commonPath, G_FILE_TEST_IS_DIR)) {
       g_warning("Common plugin path is not a directory: %s\n", state->commonPath);
       goto exit;
    }
 
    if (g_file_test(state->commonPath, G_FILE_TEST_IS_DIR) &&
-       !ToolsCoreLoadDirectory(&state->ctx, state->commonPath, plugins)) {
+       !ToolsCoreLoadDirectory(state, state->commonPath, plugins,
+                               lazy)) {
       goto exit;
    }
 
@@ -699,11 +1388,7 @@ ToolsCore_LoadPlugins(ToolsServiceState *state)
     */
 
    if (state->pluginPath == NULL) {
-      state->pluginPath = g_strdup_printf("%s%s%c%s",
-                                          pluginRoot,
-                                          subdir,
-                                          DIRSEPC,
-                                          state->name);
+      state->pluginPath = ToolsCoreDefaultPluginPath(state->name);
    }
 
    pluginDirExists = g_file_test(state->pluginPath, G_FILE_TEST_IS_DIR);
@@ -713,7 +1398,8 @@ ToolsCore_LoadPlugins(ToolsServiceState *state)
    }
 
    if (pluginDirExists &&
-       !ToolsCoreLoadDirectory(&state->ctx, state->pluginPath, plugins)) {
+       !ToolsCoreLoadDirectory(state, state->pluginPath, plugins,
+                               lazy)) {
       goto exit;
    }
 
@@ -722,28 +1408,40 @@ ToolsCore_LoadPlugins(ToolsServiceState *state)
     * All plugins are loaded, now initialize them.
     */
 
-   state->plugins = g_ptr_array_new();
+   if (state->plugins == NULL) {
+      state->plugins = g_ptr_array_new();
+   }
+   state->lazyPlugins = lazy;
+   lazy = NULL;
 
+   /*
+    * Plugins whose manifest allows it call their entry point in a thread of
+    * their own, so that their blocking work overlaps with the others. They
+    * are still added to the list of plugins in the usual order.
+    */
    for (i = 0; i < plugins->len; i++) {
       ToolsPlugin *plugin = g_ptr_array_index(plugins, i);
 
-      plugin->data = plugin->onload(&state->ctx);
+      if (plugin->parallel) {
+         plugin->ctx = &state->ctx;
+         plugin->initThread = g_thread_try_new(plugin->fileName,
+                                               ToolsCoreCallOnLoad,
+                                               plugin, NULL);
+      }
+   }
 
-      if (plugin->data == NULL) {
-         g_info("Plugin '%s' didn't provide deployment data, unloading.\n",
-                plugin->fileName);
-         ToolsCoreFreePlugin(plugin);
-      } else if (state->ctx.errorCode != 0) {
-         /* Break early if a plugin has requested the container to quit. */
+   for (i = 0; i < plugins->len; i++) {
+      ToolsPlugin *plugin = g_ptr_array_index(plugins, i);
+
+      /*
+       * Skip the remaining plugins if a plugin has requested the container
+       * to quit, except those already running in parallel.
+       */
+      if (state->ctx.errorCode != 0 && plugin->initThread == NULL) {
          ToolsCoreFreePlugin(plugin);
-         break;
-      } else {
-         ASSERT(plugin->data->name != NULL);
-         g_module_make_resident(plugin->module);
-         g_ptr_array_add(state->plugins, plugin);
-         VMTools_BindTextDomain(plugin->data->name, NULL, NULL);
-         g_message("Plugin '%s' initialized.\n", plugin->data->name);
+         continue;
       }
+      ToolsCoreInitPlugin(state, plugin);
    }
 
 
@@ -753,7 +1451,7 @@ ToolsCore_LoadPlugins(ToolsServiceState *state)
     */
    if (state->debugData != NULL && state->debugData->debugPlugin->plugin != NULL) {
       ToolsPluginData *data = state->debugData->debugPlugin->plugin;
-      ToolsPlugin *plugin = g_malloc(sizeof *plugin);
+      ToolsPlugin *plugin = g_malloc0(sizeof *plugin);
       plugin->fileName = NULL;
       plugin->module = NULL;
       plugin->data = data;
@@ -767,7 +1465,12 @@ exit:
    if (plugins != NULL) {
       g_ptr_array_free(plugins, TRUE);
    }
-   g_free(pluginRoot);
+   if (lazy != NULL) {
+      for (i = 0; i < lazy->len; i++) {
+         ToolsCoreFreeLazyPlugin(g_ptr_array_index(lazy, i));
+      }
+      g_ptr_array_free(lazy, TRUE);
+   }
    return ret;
 }
 
@@ -783,6 +1486,7 @@ ToolsCore_RegisterPlugins(ToolsServiceState *state)
 {
    ToolsAppProvider *fakeProv;
    ToolsAppProviderReg fakeReg;
+   guint i;
 
    if (state->plugins == NULL) {
       return;
@@ -852,6 +1556,42 @@ ToolsCore_RegisterPlugins(ToolsServiceState *state)
     * individual app providers as necessary.
     */
    ToolsCoreForEachPlugin(state, NULL, ToolsCoreRegisterApp);
+
+   if (state->lazyPlugins == NULL || state->lazyPlugins->len == 0) {
+      return;
+   }
+
+   /*
+    * Register the RPCs of the plugins loaded on demand. Without a channel
+    * nothing would ever load them, so load them now.
+    */
+   if (state->ctx.rpc == NULL) {
+      while (state->lazyPlugins->len > 0) {
+         ToolsLazyPlugin *lp = g_ptr_array_index(state->lazyPlugins, 0);
+         lp->state = state;
+         ToolsCoreLoadLazyPlugin(lp);
+      }
+      return;
+   }
+
+   for (i = 0; i < state->lazyPlugins->len; i++) {
+      ToolsLazyPlugin *lp = g_ptr_array_index(state->lazyPlugins, i);
+      guint k;
+
+      lp->state = state;
+      lp->stubs = g_new0(RpcChannelCallback, g_strv_length(lp->rpcs));
+      for (k = 0; lp->rpcs[k] != NULL; k++) {
+         lp->stubs[k].name = lp->rpcs[k];
+         lp->stubs[k].callback = ToolsCoreLazyRpc;
+         lp->stubs[k].clientData = lp;
+         RpcChannel_RegisterCallback(state->ctx.rpc, &lp->stubs[k]);
+      }
+   }
+
+   g_signal_connect(state->ctx.serviceObj,
+                    TOOLS_CORE_SIG_CAPABILITIES,
+                    G_CALLBACK(ToolsCoreLazyCapabilities),
+                    state);
 }
 
 
@@ -895,6 +1635,15 @@ ToolsCore_UnloadPlugins(ToolsServiceState *state)
       }
    }
 
+   /* Drop the plugins that were never needed. */
+   if (state->lazyPlugins != NULL) {
+      for (i = 0; i < state->lazyPlugins->len; i++) {
+         ToolsCoreFreeLazyPlugin(g_ptr_array_index(state->lazyPlugins, i));
+      }
+      g_ptr_array_free(state->lazyPlugins, TRUE);
+      state->lazyPlugins = NULL;
+   }
+
    /*
     * Stop all app providers, and free the memory we allocated for the
     * internal app providers.
@@ -24,24 +24,131 @@
 
 #include <limits.h>
 #include <string.h>
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <errno.h>
+#  include <time.h>
+#  include <sys/resource.h>
+#endif
+#if defined(__linux__)
+#  include <sched.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#endif
 #include "vmware.h"
 #include "toolsCoreInt.h"
 #include "serviceObj.h"
+#include "vmware/tools/metrics.h"
 #include "vmware/tools/threadPool.h"
 
 #define DEFAULT_MAX_IDLE_TIME       5000
 #define DEFAULT_MAX_THREADS         5
 #define DEFAULT_MAX_UNUSED_THREADS  0
+#define DEFAULT_CRITICAL_THREADS    2
+#define DEFAULT_BACKGROUND_THREADS  1
 
-typedef struct ThreadPoolState {
-   ToolsCorePool  funcs;
-   gboolean       active;
-   ToolsAppCtx   *ctx;
+/*
+ * In the low-memory profile, at most this many threads per class by default,
+ * and idle threads exit sooner.
+ */
+#define LOW_MEMORY_MAX_THREADS      2
+#define LOW_MEMORY_MAX_IDLE_TIME    1000
+
+/* Tasks that waited longer than this in their queue are logged. */
+#define SLOW_WAIT_US                (G_USEC_PER_SEC)
+
+/* Nice values of the "high" and "idle" scheduling policies. */
+#define SCHED_HIGH_NICE             (-5)
+#define SCHED_IDLE_NICE             19
+
+/* Length of a plugin budget interval, and the most intervals skipped. */
+#define DEFAULT_BUDGET_INTERVAL     60
+#define MAX_BUDGET_BACKOFF          16
+
+/* IOPRIO_WHO_PROCESS and IOPRIO_CLASS_IDLE, for the calling thread. */
+#define IOPRIO_WHO_THREAD           1
+#define IOPRIO_IDLE                 (3 << 13)
+
+/* Buckets of the queue wait histograms, in microseconds. */
+static const guint64 gWaitBuckets[] = {
+   100, 1000, 10000, 100000, 1000000, 10000000,
+};
+
+/*
+ * CPU scheduling policies of the worker threads of a class. Threads of the
+ * main service loop always keep the default policy.
+ */
+typedef enum ThreadPoolSched {
+   POOL_SCHED_REALTIME,    /* SCHED_FIFO, with "high" as a fallback. */
+   POOL_SCHED_HIGH,        /* Raised nice value. */
+   POOL_SCHED_NORMAL,      /* Whatever the service runs with. */
+   POOL_SCHED_IDLE,        /* SCHED_IDLE and idle I/O priority. */
+} ThreadPoolSched;
+
+/*
+ * A work class: its own queue and worker threads, so that classes never
+ * wait on each other, and the queue metrics.
+ */
+typedef struct ThreadPoolClass {
+   const gchar   *name;
+   gint           idlePriority;
+   ThreadPoolSched sched;
+#if defined(__linux__)
+   gboolean       hasAffinity;
+   cpu_set_t      cpus;
+#endif
    GThreadPool   *pool;
    GQueue        *workQueue;
-   GPtrArray     *threads;
-   GMutex         lock;
-   guint          nextWorkId;
+   guint          maxDepth;
+   guint64        completed;
+   guint64        totalWaitUs;
+   guint64        maxWaitUs;
+   VMToolsMetric *tasksMetric;
+   VMToolsMetric *waitMetric;
+   VMToolsMetric *queuedMetric;
+} ThreadPoolClass;
+
+
+/*
+ * CPU time and I/O accounting of a plugin's tasks. The usage of the current
+ * interval is checked against the budget after each task; on an overrun, the
+ * plugin's tasks are skipped for "backoff" intervals, which doubles with each
+ * overrun and halves with each interval within budget.
+ */
+typedef struct ThreadPoolBudget {
+   gchar         *owner;
+   guint64        cpuBudgetUs;      /* Per interval; 0 is unlimited. */
+   guint64        ioBudgetKB;       /* Per interval; 0 is unlimited. */
+   gint64         windowStart;
+   guint64        cpuUs;
+   guint64        ioKB;
+   guint          backoff;
+   gint64         skipUntil;
+   guint64        totalCpuUs;
+   guint64        totalIoKB;
+   guint          overruns;
+   guint          skipped;
+} ThreadPoolBudget;
+
+
+/* Resource usage of the current thread, including reaped children. */
+typedef struct ThreadPoolUsage {
+   guint64        cpuUs;
+   guint64        ioKB;
+} ThreadPoolUsage;
+
+
+typedef struct ThreadPoolState {
+   ToolsCorePool     funcs;
+   gboolean          active;
+   ToolsAppCtx      *ctx;
+   ThreadPoolClass   classes[TOOLS_CORE_POOL_CLASS_MAX];
+   GPtrArray        *threads;
+   GMutex            lock;
+   guint             nextWorkId;
+   GHashTable       *budgets;
+   gint64            budgetIntervalUs;
 } ThreadPoolState;
 
 
@@ -51,11 +158,15 @@ typedef struct WorkerTask {
    ToolsCorePoolCb   cb;
    gpointer          data;
    GDestroyNotify    dtor;
+   ThreadPoolClass  *cls;
+   ThreadPoolBudget *budget;
+   gint64            queued;
 } WorkerTask;
 
 
 typedef struct StandaloneTask {
    gboolean          active;
+   ThreadPoolClass  *cls;
    ToolsCorePoolCb   cb;
    ToolsCorePoolCb   interrupt;
    gpointer          data;
@@ -66,6 +177,224 @@ typedef struct StandaloneTask {
 
 static ThreadPoolState gState;
 
+/* The class whose scheduling policy the current thread is running with. */
+static GPrivate gThreadClass = G_PRIVATE_INIT(NULL);
+
+/*
+ * Class configuration. The bulk class keeps the historical "pool.maxThreads"
+ * key, and setting it to zero still disables threading for all classes. In
+ * single threaded mode, critical tasks run ahead of other idle sources in
+ * the main loop.
+ */
+static const struct {
+   const gchar     *name;
+   const gchar     *configKey;
+   gint             defaultThreads;
+   gint             idlePriority;
+   const gchar     *schedKey;
+   ThreadPoolSched  defaultSched;
+   const gchar     *affinityKey;
+} gClassConfig[TOOLS_CORE_POOL_CLASS_MAX] = {
+   { "critical",   "pool.criticalThreads",   DEFAULT_CRITICAL_THREADS,
+     G_PRIORITY_HIGH_IDLE, "pool.criticalPolicy", POOL_SCHED_HIGH,
+     "pool.criticalAffinity" },
+   { "bulk",       "pool.maxThreads",        DEFAULT_MAX_THREADS,
+     G_PRIORITY_DEFAULT_IDLE, "pool.bulkPolicy", POOL_SCHED_NORMAL,
+     "pool.bulkAffinity" },
+   { "background", "pool.backgroundThreads", DEFAULT_BACKGROUND_THREADS,
+     G_PRIORITY_LOW, "pool.backgroundPolicy", POOL_SCHED_IDLE,
+     "pool.backgroundAffinity" },
+};
+
+/* Names of the scheduling policies in the config file. */
+static const gchar *gSchedNames[] = {
+   [POOL_SCHED_REALTIME] = "realtime",
+   [POOL_SCHED_HIGH]     = "high",
+   [POOL_SCHED_NORMAL]   = "normal",
+   [POOL_SCHED_IDLE]     = "idle",
+};
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolReadSched --                                              */ /**
+ *
+ * Reads the CPU scheduling policy and affinity of a class from the config
+ * file. Affinity is a list of CPUs and CPU ranges, e.g. "0,2-3"; when not
+ * set, the class runs on all the CPUs the service may use.
+ *
+ * @param[in] ctx    Application context.
+ * @param[in] idx    Index of the class.
+ * @param[in] cls    The class.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolReadSched(ToolsAppCtx *ctx,
+                       guint idx,
+                       ThreadPoolClass *cls)
+{
+   gchar *value;
+   guint i;
+
+   cls->sched = gClassConfig[idx].defaultSched;
+   value = g_key_file_get_string(ctx->config, ctx->name,
+                                 gClassConfig[idx].schedKey, NULL);
+   if (value != NULL) {
+      g_strstrip(value);
+      for (i = 0; i < ARRAYSIZE(gSchedNames); i++) {
+         if (g_ascii_strcasecmp(value, gSchedNames[i]) == 0) {
+            cls->sched = i;
+            break;
+         }
+      }
+      if (i == ARRAYSIZE(gSchedNames)) {
+         g_warning("Unknown %s '%s', using '%s'.\n", gClassConfig[idx].schedKey,
+                   value, gSchedNames[cls->sched]);
+      }
+      g_free(value);
+   }
+
+#if defined(__linux__)
+   if (sched_getaffinity(0, sizeof cls->cpus, &cls->cpus) != 0) {
+      CPU_ZERO(&cls->cpus);
+   }
+
+   value = g_key_file_get_string(ctx->config, ctx->name,
+                                 gClassConfig[idx].affinityKey, NULL);
+   if (value != NULL) {
+      gchar **ranges = g_strsplit(value, ",", 0);
+      cpu_set_t cpus;
+      gboolean ok = TRUE;
+
+      CPU_ZERO(&cpus);
+      for (i = 0; ranges[i] != NULL && ok; i++) {
+         gchar *end;
+         guint64 first;
+         guint64 last;
+         guint64 cpu;
+
+         g_strstrip(ranges[i]);
+         first = g_ascii_strtoull(ranges[i], &end, 10);
+         last = first;
+         ok = end != ranges[i];
+         if (ok && *end == '-') {
+            const gchar *start = end + 1;
+
+            last = g_ascii_strtoull(start, &end, 10);
+            ok = end != start;
+         }
+         ok = ok && *end == '\0' && first <= last && last < CPU_SETSIZE;
+         for (cpu = first; ok && cpu <= last; cpu++) {
+            CPU_SET((int) cpu, &cpus);
+         }
+      }
+
+      if (ok && CPU_COUNT(&cpus) > 0) {
+         cls->hasAffinity = TRUE;
+         cls->cpus = cpus;
+      } else {
+         g_warning("Invalid %s '%s', ignoring.\n",
+                   gClassConfig[idx].affinityKey, value);
+      }
+      g_strfreev(ranges);
+      g_free(value);
+   }
+#else
+   if (cls->sched != POOL_SCHED_NORMAL) {
+      g_debug("Scheduling policy '%s' of %s threads not supported here.\n",
+              gSchedNames[cls->sched], cls->name);
+   }
+#endif
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolSetThreadClass --                                         */ /**
+ *
+ * Makes the current thread run with the CPU scheduling policy and affinity
+ * of a class. Thread pool threads may be reused across classes, so this is
+ * done whenever the class of the thread changes. Failures, e.g. due to lack
+ * of privilege, are logged and otherwise ignored.
+ *
+ * @param[in] cls    The class.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolSetThreadClass(ThreadPoolClass *cls)
+{
+   ThreadPoolClass *prev = g_private_get(&gThreadClass);
+
+   if (prev == cls) {
+      return;
+   }
+   g_private_set(&gThreadClass, cls);
+
+#if defined(__linux__)
+   {
+      struct sched_param param = { 0 };
+      int policy = SCHED_OTHER;
+      int nice = 0;
+      int ioprio = 0;
+      pid_t tid = (pid_t) syscall(SYS_gettid);
+
+      /* A new thread already has the defaults. */
+      if (prev == NULL && cls->sched == POOL_SCHED_NORMAL &&
+          !cls->hasAffinity) {
+         return;
+      }
+
+      switch (cls->sched) {
+      case POOL_SCHED_REALTIME:
+         policy = SCHED_FIFO;
+         param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+         break;
+      case POOL_SCHED_HIGH:
+         nice = SCHED_HIGH_NICE;
+         break;
+      case POOL_SCHED_IDLE:
+#if defined(SCHED_IDLE)
+         policy = SCHED_IDLE;
+#endif
+         nice = SCHED_IDLE_NICE;
+         ioprio = IOPRIO_IDLE;
+         break;
+      default:
+         break;
+      }
+
+      /* sched_setscheduler() on Linux applies to the calling thread only. */
+      if (sched_setscheduler(0, policy, &param) != 0) {
+         g_debug("Unable to set %s thread policy %d (%d).\n",
+                 cls->name, policy, errno);
+         if (policy == SCHED_FIFO) {
+            param.sched_priority = 0;
+            (void) sched_setscheduler(0, SCHED_OTHER, &param);
+            nice = SCHED_HIGH_NICE;
+         }
+      }
+      if (setpriority(PRIO_PROCESS, tid, nice) != 0) {
+         g_debug("Unable to set %s thread nice value %d (%d).\n",
+                 cls->name, nice, errno);
+      }
+#if defined(SYS_ioprio_set)
+      if (syscall(SYS_ioprio_set, IOPRIO_WHO_THREAD, 0, ioprio) != 0) {
+         g_debug("Unable to set %s thread I/O priority (%d).\n",
+                 cls->name, errno);
+      }
+#endif
+      if (CPU_COUNT(&cls->cpus) > 0 &&
+          sched_setaffinity(0, sizeof cls->cpus, &cls->cpus) != 0) {
+         g_debug("Unable to set %s thread affinity (%d).\n", cls->name, errno);
+      }
+   }
+#endif
+}
+
 
 /*
  *******************************************************************************
@@ -100,6 +429,252 @@ ToolsCorePoolCompareTask(gconstpointer p1,
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePoolDequeued --                                               */ /**
+ *
+ * Updates the metrics of a task's class when the task leaves the queue to be
+ * executed. Must be called with the pool lock held.
+ *
+ * @param[in] work   The WorkerTask about to run.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolDequeued(WorkerTask *work)
+{
+   ThreadPoolClass *cls = work->cls;
+   guint64 waitUs = MAX(g_get_monotonic_time() - work->queued, 0);
+
+   cls->completed++;
+   cls->totalWaitUs += waitUs;
+   cls->maxWaitUs = MAX(cls->maxWaitUs, waitUs);
+   VMTools_MetricAdd(cls->tasksMetric, 1);
+   VMTools_MetricObserve(cls->waitMetric, waitUs);
+   VMTools_MetricSet(cls->queuedMetric, g_queue_get_length(cls->workQueue));
+
+   if (waitUs >= SLOW_WAIT_US) {
+      g_debug("%s task %u waited %"G_GUINT64_FORMAT" us, %u queued behind.\n",
+              cls->name, work->id, waitUs, g_queue_get_length(cls->workQueue));
+   }
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolGetUsage --                                               */ /**
+ *
+ * Samples the CPU time and I/O of the current thread. On POSIX systems, the
+ * usage of children reaped by the process, such as the scripts run by
+ * plugins, is included; that part is only approximate when several tasks
+ * reap children at the same time. I/O is only known on Linux.
+ *
+ * @param[out] usage  The usage so far.
+ *
+ * @return TRUE iff the usage could be sampled.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+ToolsCorePoolGetUsage(ThreadPoolUsage *usage)
+{
+#if defined(_WIN32)
+   FILETIME created;
+   FILETIME exited;
+   FILETIME kernel;
+   FILETIME user;
+
+   if (!GetThreadTimes(GetCurrentThread(), &created, &exited, &kernel, &user)) {
+      return FALSE;
+   }
+
+   /* FILETIMEs are in 100ns units. */
+   usage->cpuUs = ((((guint64) kernel.dwHighDateTime << 32) |
+                    kernel.dwLowDateTime) +
+                   (((guint64) user.dwHighDateTime << 32) |
+                    user.dwLowDateTime)) / 10;
+   usage->ioKB = 0;
+   return TRUE;
+#else
+   struct timespec ts;
+   struct rusage ru;
+
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) {
+      return FALSE;
+   }
+   usage->cpuUs = (guint64) ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+   usage->ioKB = 0;
+
+#if defined(RUSAGE_THREAD)
+   /* Block counts are in 512 byte units. */
+   if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+      usage->ioKB += (ru.ru_inblock + ru.ru_oublock) / 2;
+   }
+#endif
+
+   if (getrusage(RUSAGE_CHILDREN, &ru) == 0) {
+      usage->cpuUs += (guint64) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) *
+                      G_USEC_PER_SEC + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#if defined(__linux__)
+      usage->ioKB += (ru.ru_inblock + ru.ru_oublock) / 2;
+#endif
+   }
+   return TRUE;
+#endif
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolGetBudget --                                              */ /**
+ *
+ * Returns the budget of a plugin, creating it from the config file the first
+ * time. Must be called with the pool lock held.
+ *
+ * @param[in] owner  Name of the plugin.
+ *
+ * @return The budget.
+ *
+ *******************************************************************************
+ */
+
+static ThreadPoolBudget *
+ToolsCorePoolGetBudget(const gchar *owner)
+{
+   ThreadPoolBudget *budget = g_hash_table_lookup(gState.budgets, owner);
+
+   if (budget == NULL) {
+      ToolsAppCtx *ctx = gState.ctx;
+      gchar *key;
+      gint value;
+
+      budget = g_malloc0(sizeof *budget);
+      budget->owner = g_strdup(owner);
+      budget->windowStart = g_get_monotonic_time();
+
+      key = g_strdup_printf("pool.budget.%s.cpu", owner);
+      value = g_key_file_get_integer(ctx->config, ctx->name, key, NULL);
+      budget->cpuBudgetUs = (guint64) MAX(value, 0) * 1000;
+      g_free(key);
+
+      key = g_strdup_printf("pool.budget.%s.io", owner);
+      value = g_key_file_get_integer(ctx->config, ctx->name, key, NULL);
+      budget->ioBudgetKB = (guint64) MAX(value, 0);
+      g_free(key);
+
+      g_hash_table_insert(gState.budgets, budget->owner, budget);
+   }
+
+   return budget;
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolFreeBudget --                                             */ /**
+ *
+ * Frees a ThreadPoolBudget.
+ *
+ * @param[in] data   A ThreadPoolBudget.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolFreeBudget(gpointer data)
+{
+   ThreadPoolBudget *budget = data;
+
+   g_free(budget->owner);
+   g_free(budget);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolCharge --                                                 */ /**
+ *
+ * Charges the usage of a task to its plugin's budget, and starts backing off
+ * the plugin if it went over budget in the current interval.
+ *
+ * @param[in] budget    The plugin's budget.
+ * @param[in] before    Usage of the thread before the task.
+ * @param[in] after     Usage of the thread after the task.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolCharge(ThreadPoolBudget *budget,
+                    const ThreadPoolUsage *before,
+                    const ThreadPoolUsage *after)
+{
+   guint64 cpuUs = after->cpuUs > before->cpuUs ? after->cpuUs - before->cpuUs : 0;
+   guint64 ioKB = after->ioKB > before->ioKB ? after->ioKB - before->ioKB : 0;
+   gint64 now = g_get_monotonic_time();
+
+   g_mutex_lock(&gState.lock);
+
+   budget->cpuUs += cpuUs;
+   budget->ioKB += ioKB;
+   budget->totalCpuUs += cpuUs;
+   budget->totalIoKB += ioKB;
+
+   if ((budget->cpuBudgetUs > 0 && budget->cpuUs > budget->cpuBudgetUs) ||
+       (budget->ioBudgetKB > 0 && budget->ioKB > budget->ioBudgetKB)) {
+      budget->overruns++;
+      budget->backoff = MIN(MAX(budget->backoff * 2, 1), MAX_BUDGET_BACKOFF);
+      budget->skipUntil = now + budget->backoff * gState.budgetIntervalUs;
+      g_message("%s used %"G_GUINT64_FORMAT" ms of CPU and %"G_GUINT64_FORMAT
+                " KB of I/O in %"G_GINT64_FORMAT" s, over its budget; skipping "
+                "its tasks for %"G_GINT64_FORMAT" s.\n", budget->owner,
+                budget->cpuUs / 1000, budget->ioKB,
+                (now - budget->windowStart) / G_USEC_PER_SEC,
+                (budget->skipUntil - now) / G_USEC_PER_SEC);
+   } else if (now - budget->windowStart < gState.budgetIntervalUs) {
+      goto exit;
+   } else {
+      budget->backoff /= 2;
+   }
+
+   budget->windowStart = now;
+   budget->cpuUs = 0;
+   budget->ioKB = 0;
+
+exit:
+   g_mutex_unlock(&gState.lock);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolRunTask --                                                */ /**
+ *
+ * Runs a task on the current thread, charging its usage to its plugin's
+ * budget, if any.
+ *
+ * @param[in] work   The WorkerTask.
+ *
+ *******************************************************************************
+ */
+
+static void
+ToolsCorePoolRunTask(WorkerTask *work)
+{
+   ThreadPoolUsage before;
+   ThreadPoolUsage after;
+   gboolean measured = work->budget != NULL && ToolsCorePoolGetUsage(&before);
+
+   work->cb(gState.ctx, work->data);
+
+   if (measured && ToolsCorePoolGetUsage(&after)) {
+      ToolsCorePoolCharge(work->budget, &before, &after);
+   }
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePoolDestroyThread --                                          */ /**
@@ -151,7 +726,7 @@ ToolsCorePoolDestroyTask(gpointer data)
  *******************************************************************************
  * ToolsCorePoolDoWork --                                                 */ /**
  *
- * Execute a work item.
+ * Execute a work item from the main loop.
  *
  * @param[in] data   A WorkerTask.
  *
@@ -166,16 +741,15 @@ ToolsCorePoolDoWork(gpointer data)
    WorkerTask *work = data;
 
    /*
-    * In single threaded mode, remove the task being executed from the queue.
-    * In multi-threaded mode, the thread pool callback already did this.
+    * Remove the task being executed from the queue. Tasks run by the worker
+    * threads are dequeued by the thread pool callback instead.
     */
-   if (gState.pool == NULL) {
-      g_mutex_lock(&gState.lock);
-      g_queue_remove(gState.workQueue, work);
-      g_mutex_unlock(&gState.lock);
-   }
+   g_mutex_lock(&gState.lock);
+   g_queue_remove(work->cls->workQueue, work);
+   ToolsCorePoolDequeued(work);
+   g_mutex_unlock(&gState.lock);
 
-   work->cb(gState.ctx, work->data);
+   ToolsCorePoolRunTask(work);
    return FALSE;
 }
 
@@ -220,6 +794,9 @@ ToolsCorePoolRunThread(gpointer data)
 {
    StandaloneTask *task = data;
 
+   if (task->cls != NULL) {
+      ToolsCorePoolSetThreadClass(task->cls);
+   }
    task->cb(gState.ctx, task->data);
    task->active = FALSE;
 
@@ -243,10 +820,10 @@ ToolsCorePoolRunThread(gpointer data)
  * ToolsCorePoolRunWorker --                                              */ /**
  *
  * Thread pool callback function. Dequeues the next work item from the work
- * queue and execute it.
+ * queue of the class and execute it.
  *
- * @param[in] state        Description of state.
- * @param[in] clientData   Description of clientData.
+ * @param[in] state        The ThreadPoolClass.
+ * @param[in] clientData   Unused.
  *
  *******************************************************************************
  */
@@ -255,28 +832,39 @@ static void
 ToolsCorePoolRunWorker(gpointer state,
                        gpointer clientData)
 {
+   ThreadPoolClass *cls = state;
    WorkerTask *work;
 
    g_mutex_lock(&gState.lock);
-   work = g_queue_pop_tail(gState.workQueue);
+   work = g_queue_pop_tail(cls->workQueue);
+   if (work != NULL) {
+      ToolsCorePoolDequeued(work);
+   }
    g_mutex_unlock(&gState.lock);
 
-   ASSERT(work != NULL);
+   /* The task may have been canceled since it was pushed. */
+   if (work == NULL) {
+      return;
+   }
 
-   ToolsCorePoolDoWork(work);
+   ToolsCorePoolSetThreadClass(cls);
+   ToolsCorePoolRunTask(work);
    ToolsCorePoolDestroyTask(work);
 }
 
 
 /*
  *******************************************************************************
- * ToolsCorePoolSubmit --                                                 */ /**
+ * ToolsCorePoolSubmitOwned --                                            */ /**
  *
- * Submits a new task for execution in one of the shared worker threads.
+ * Submits a new task for execution in one of the worker threads of its class,
+ * accounting it to a plugin. The task is skipped if the plugin is backing off.
  *
- * @see ToolsCorePool_SubmitTask()
+ * @see ToolsCorePool_SubmitPluginTask()
  *
  * @param[in] ctx    Application context.
+ * @param[in] owner  Name of the plugin, NULL if none.
+ * @param[in] cls    Work class of the task.
  * @param[in] cb     Function to execute the task.
  * @param[in] data   Opaque data for the task.
  * @param[in] dtor   Destructor for the task data.
@@ -287,18 +875,26 @@ ToolsCorePoolRunWorker(gpointer state,
  */
 
 static guint
-ToolsCorePoolSubmit(ToolsAppCtx *ctx,
-                    ToolsCorePoolCb cb,
-                    gpointer data,
-                    GDestroyNotify dtor)
+ToolsCorePoolSubmitOwned(ToolsAppCtx *ctx,
+                         const gchar *owner,
+                         ToolsCorePoolClass cls,
+                         ToolsCorePoolCb cb,
+                         gpointer data,
+                         GDestroyNotify dtor)
 {
    guint id = 0;
-   WorkerTask *task = g_malloc0(sizeof *task);
+   WorkerTask *task;
+   gboolean skip = FALSE;
 
+   g_return_val_if_fail((guint)cls < TOOLS_CORE_POOL_CLASS_MAX, 0);
+
+   task = g_malloc0(sizeof *task);
    task->srcId = 0;
    task->cb = cb;
    task->data = data;
    task->dtor = dtor;
+   task->cls = &gState.classes[cls];
+   task->queued = g_get_monotonic_time();
 
    g_mutex_lock(&gState.lock);
 
@@ -323,18 +919,31 @@ ToolsCorePoolSubmit(ToolsAppCtx *ctx,
 
    id = task->id;
 
+   if (owner != NULL) {
+      task->budget = ToolsCorePoolGetBudget(owner);
+      if (task->budget->skipUntil > task->queued) {
+         task->budget->skipped++;
+         skip = TRUE;
+         goto exit;
+      }
+   }
+
    /*
     * We always add the task to the queue, even in single threaded mode, so
     * that it can be canceled. In single threaded mode, it's unlikely someone
     * will be able to cancel it before it runs, but they can try.
     */
-   g_queue_push_head(gState.workQueue, task);
+   g_queue_push_head(task->cls->workQueue, task);
+   task->cls->maxDepth = MAX(task->cls->maxDepth,
+                             g_queue_get_length(task->cls->workQueue));
+   VMTools_MetricSet(task->cls->queuedMetric,
+                     g_queue_get_length(task->cls->workQueue));
 
-   if (gState.pool != NULL) {
+   if (task->cls->pool != NULL) {
       GError *err = NULL;
 
-      /* The client data pointer is bogus, just to avoid passing NULL. */
-      g_thread_pool_push(gState.pool, &gState, &err);
+      /* The worker pops the oldest task of the class, not this one. */
+      g_thread_pool_push(task->cls->pool, task->cls, &err);
       if (err == NULL) {
          goto exit;
       } else {
@@ -345,17 +954,81 @@ ToolsCorePoolSubmit(ToolsAppCtx *ctx,
    }
 
    /* Run the task in the service's thread. */
-   task->srcId = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE,
+   task->srcId = g_idle_add_full(task->cls->idlePriority,
                                  ToolsCorePoolDoWork,
                                  task,
                                  ToolsCorePoolDestroyTask);
 
 exit:
    g_mutex_unlock(&gState.lock);
+
+   if (skip) {
+      g_debug("%s is over budget, skipping task %u.\n", owner, id);
+      ToolsCorePoolDestroyTask(task);
+   }
    return id;
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePoolSubmitClass --                                            */ /**
+ *
+ * Submits a new task for execution in one of the worker threads of its class.
+ *
+ * @see ToolsCorePool_SubmitClassTask()
+ *
+ * @param[in] ctx    Application context.
+ * @param[in] cls    Work class of the task.
+ * @param[in] cb     Function to execute the task.
+ * @param[in] data   Opaque data for the task.
+ * @param[in] dtor   Destructor for the task data.
+ *
+ * @return New task's ID, or 0 on error.
+ *
+ *******************************************************************************
+ */
+
+static guint
+ToolsCorePoolSubmitClass(ToolsAppCtx *ctx,
+                         ToolsCorePoolClass cls,
+                         ToolsCorePoolCb cb,
+                         gpointer data,
+                         GDestroyNotify dtor)
+{
+   return ToolsCorePoolSubmitOwned(ctx, NULL, cls, cb, data, dtor);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolSubmit --                                                 */ /**
+ *
+ * Submits a new bulk task for execution in one of the shared worker threads.
+ *
+ * @see ToolsCorePool_SubmitTask()
+ *
+ * @param[in] ctx    Application context.
+ * @param[in] cb     Function to execute the task.
+ * @param[in] data   Opaque data for the task.
+ * @param[in] dtor   Destructor for the task data.
+ *
+ * @return New task's ID, or 0 on error.
+ *
+ *******************************************************************************
+ */
+
+static guint
+ToolsCorePoolSubmit(ToolsAppCtx *ctx,
+                    ToolsCorePoolCb cb,
+                    gpointer data,
+                    GDestroyNotify dtor)
+{
+   return ToolsCorePoolSubmitClass(ctx, TOOLS_CORE_POOL_CLASS_BULK,
+                                   cb, data, dtor);
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePoolCancel --                                                 */ /**
@@ -372,9 +1045,10 @@ exit:
 static void
 ToolsCorePoolCancel(guint id)
 {
-   GList *taskLnk;
+   GList *taskLnk = NULL;
    WorkerTask *task = NULL;
    WorkerTask search = { id, };
+   guint i;
 
    g_return_if_fail(id != 0);
 
@@ -383,10 +1057,16 @@ ToolsCorePoolCancel(guint id)
       goto exit;
    }
 
-   taskLnk = g_queue_find_custom(gState.workQueue, &search, ToolsCorePoolCompareTask);
-   if (taskLnk != NULL) {
-      task = taskLnk->data;
-      g_queue_delete_link(gState.workQueue, taskLnk);
+   for (i = 0; i < ARRAYSIZE(gState.classes) && taskLnk == NULL; i++) {
+      GQueue *workQueue = gState.classes[i].workQueue;
+
+      taskLnk = g_queue_find_custom(workQueue, &search, ToolsCorePoolCompareTask);
+      if (taskLnk != NULL) {
+         task = taskLnk->data;
+         g_queue_delete_link(workQueue, taskLnk);
+         VMTools_MetricSet(gState.classes[i].queuedMetric,
+                           g_queue_get_length(workQueue));
+      }
    }
 
 exit:
@@ -404,13 +1084,15 @@ exit:
 
 /*
  *******************************************************************************
- * ToolsCorePoolStart --                                                  */ /**
+ * ToolsCorePoolStartClass --                                             */ /**
  *
- * Start a new task in a dedicated thread.
+ * Start a new task in a dedicated thread, running with the scheduling policy
+ * of the given class.
  *
- * @see ToolsCorePool_StartThread()
+ * @see ToolsCorePool_StartClassThread()
  *
  * @param[in] ctx        Application context.
+ * @param[in] cls        Work class of the task.
  * @param[in] threadName Name for the new thread.
  * @param[in] cb         Callback that executes the task.
  * @param[in] interrupt  Callback that interrupts the task.
@@ -423,16 +1105,19 @@ exit:
  */
 
 static gboolean
-ToolsCorePoolStart(ToolsAppCtx *ctx,
-                   const gchar *threadName,
-                   ToolsCorePoolCb cb,
-                   ToolsCorePoolCb interrupt,
-                   gpointer data,
-                   GDestroyNotify dtor)
+ToolsCorePoolStartClass(ToolsAppCtx *ctx,
+                        ToolsCorePoolClass cls,
+                        const gchar *threadName,
+                        ToolsCorePoolCb cb,
+                        ToolsCorePoolCb interrupt,
+                        gpointer data,
+                        GDestroyNotify dtor)
 {
    GError *err = NULL;
    StandaloneTask *task = NULL;
 
+   g_return_val_if_fail((guint)cls < TOOLS_CORE_POOL_CLASS_MAX, FALSE);
+
    g_mutex_lock(&gState.lock);
    if (!gState.active) {
       goto exit;
@@ -440,6 +1125,7 @@ ToolsCorePoolStart(ToolsAppCtx *ctx,
 
    task = g_malloc0(sizeof *task);
    task->active = TRUE;
+   task->cls = &gState.classes[cls];
    task->cb = cb;
    task->interrupt = interrupt;
    task->data = data;
@@ -461,6 +1147,140 @@ exit:
 }
 
 
+/*
+ *******************************************************************************
+ * ToolsCorePoolStart --                                                  */ /**
+ *
+ * Start a new bulk task in a dedicated thread.
+ *
+ * @see ToolsCorePool_StartThread()
+ *
+ * @param[in] ctx        Application context.
+ * @param[in] threadName Name for the new thread.
+ * @param[in] cb         Callback that executes the task.
+ * @param[in] interrupt  Callback that interrupts the task.
+ * @param[in] data       Opaque data.
+ * @param[in] dtor       Destructor for the task data.
+ *
+ * @return TRUE iff thread was successfully started.
+ *
+ *******************************************************************************
+ */
+
+static gboolean
+ToolsCorePoolStart(ToolsAppCtx *ctx,
+                   const gchar *threadName,
+                   ToolsCorePoolCb cb,
+                   ToolsCorePoolCb interrupt,
+                   gpointer data,
+                   GDestroyNotify dtor)
+{
+   return ToolsCorePoolStartClass(ctx, TOOLS_CORE_POOL_CLASS_BULK, threadName,
+                                  cb, interrupt, data, dtor);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePoolFormatBudget --                                           */ /**
+ *
+ * Formats the usage of a plugin's tasks. Must be called with the pool lock
+ * held.
+ *
+ * @param[in] budget    The plugin's budget.
+ *
+ * @return The line, to free with g_free.
+ *
+ *******************************************************************************
+ */
+
+static gchar *
+ToolsCorePoolFormatBudget(const ThreadPoolBudget *budget)
+{
+   return g_strdup_printf("%s cpu=%"G_GUINT64_FORMAT" io=%"G_GUINT64_FORMAT
+                          " cpuBudget=%"G_GUINT64_FORMAT
+                          " ioBudget=%"G_GUINT64_FORMAT
+                          " overruns=%u skipped=%u backoff=%u",
+                          budget->owner, budget->totalCpuUs / 1000,
+                          budget->totalIoKB, budget->cpuBudgetUs / 1000,
+                          budget->ioBudgetKB, budget->overruns,
+                          budget->skipped, budget->backoff);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePool_GetBudgetStats --                                        */ /**
+ *
+ * Returns the usage of the tasks of each plugin that submitted any, one
+ * plugin per line: total CPU time in ms and I/O in KB, the budgets per
+ * interval (0 if unlimited), the number of overruns and skipped tasks, and
+ * the current back-off in intervals.
+ *
+ * @return The stats, to free with g_free.
+ *
+ *******************************************************************************
+ */
+
+gchar *
+ToolsCorePool_GetBudgetStats(void)
+{
+   GString *str = g_string_new(NULL);
+
+   if (gState.budgets != NULL) {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_mutex_lock(&gState.lock);
+      g_hash_table_iter_init(&iter, gState.budgets);
+      while (g_hash_table_iter_next(&iter, NULL, &value)) {
+         gchar *line = ToolsCorePoolFormatBudget(value);
+
+         g_string_append_printf(str, "%s\n", line);
+         g_free(line);
+      }
+      g_mutex_unlock(&gState.lock);
+   }
+
+   return g_string_free(str, FALSE);
+}
+
+
+/*
+ *******************************************************************************
+ * ToolsCorePool_LogBudget --                                             */ /**
+ *
+ * Logs the usage of a plugin's tasks in the state dump, if it submitted any.
+ *
+ * @param[in] owner  Name of the plugin.
+ *
+ *******************************************************************************
+ */
+
+void
+ToolsCorePool_LogBudget(const gchar *owner)
+{
+   ThreadPoolBudget *budget;
+   gchar *line = NULL;
+
+   if (gState.budgets == NULL) {
+      return;
+   }
+
+   g_mutex_lock(&gState.lock);
+   budget = g_hash_table_lookup(gState.budgets, owner);
+   if (budget != NULL) {
+      line = ToolsCorePoolFormatBudget(budget);
+   }
+   g_mutex_unlock(&gState.lock);
+
+   if (line != NULL) {
+      ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN, "Tasks: %s\n", line);
+      g_free(line);
+   }
+}
+
+
 /*
  *******************************************************************************
  * ToolsCorePool_Init --                                                  */ /**
@@ -470,6 +1290,11 @@ exit:
  * can have different configuration. Exports the thread pool functions through
  * the service's object.
  *
+ * Each work class gets its own set of worker threads, sized by the class's
+ * config key; a class configured with no threads runs its tasks on the main
+ * service thread. The threads of a class run with the class's configured CPU
+ * scheduling policy and affinity.
+ *
  * @param[in] ctx Application context.
  *
  *******************************************************************************
@@ -478,7 +1303,11 @@ exit:
 void
 ToolsCorePool_Init(ToolsAppCtx *ctx)
 {
-   gint maxThreads;
+   gint maxIdleTime;
+   gint maxUnused;
+   gboolean threaded = FALSE;
+   gboolean disabled;
+   guint i;
    GError *err = NULL;
 
    ToolsServiceProperty prop = { TOOLS_CORE_PROP_TPOOL };
@@ -486,49 +1315,105 @@ ToolsCorePool_Init(ToolsAppCtx *ctx)
    gState.funcs.submit = ToolsCorePoolSubmit;
    gState.funcs.cancel = ToolsCorePoolCancel;
    gState.funcs.start = ToolsCorePoolStart;
+   gState.funcs.submitClass = ToolsCorePoolSubmitClass;
+   gState.funcs.startClass = ToolsCorePoolStartClass;
+   gState.funcs.submitOwned = ToolsCorePoolSubmitOwned;
    gState.ctx = ctx;
 
-   maxThreads = g_key_file_get_integer(ctx->config, ctx->name,
-                                       "pool.maxThreads", &err);
-   if (err != NULL) {
-      maxThreads = DEFAULT_MAX_THREADS;
-      g_clear_error(&err);
-   }
-
-   if (maxThreads > 0) {
-      gState.pool = g_thread_pool_new(ToolsCorePoolRunWorker,
-                                      NULL, maxThreads, FALSE, &err);
-      if (err == NULL) {
-         gint maxIdleTime;
-         gint maxUnused;
-
-         maxIdleTime = g_key_file_get_integer(ctx->config, ctx->name,
-                                              "pool.maxIdleTime", &err);
-         if (err != NULL || maxIdleTime <= 0) {
-            maxIdleTime = DEFAULT_MAX_IDLE_TIME;
-            g_clear_error(&err);
+   /* An explicit "pool.maxThreads=0" means no worker threads of any class. */
+   disabled = g_key_file_get_integer(ctx->config, ctx->name,
+                                     "pool.maxThreads", &err) <= 0 &&
+              err == NULL;
+   g_clear_error(&err);
+
+   for (i = 0; i < ARRAYSIZE(gState.classes); i++) {
+      ThreadPoolClass *cls = &gState.classes[i];
+      gint maxThreads;
+      gchar *metric;
+
+      cls->name = gClassConfig[i].name;
+      cls->idlePriority = gClassConfig[i].idlePriority;
+      cls->workQueue = g_queue_new();
+      ToolsCorePoolReadSched(ctx, i, cls);
+
+      metric = g_strdup_printf("vmtools_pool_tasks_total{class=\"%s\"}",
+                               cls->name);
+      cls->tasksMetric = VMTools_MetricCounter(metric,
+                                               "Thread pool tasks run.");
+      g_free(metric);
+      metric = g_strdup_printf("vmtools_pool_wait_us{class=\"%s\"}",
+                               cls->name);
+      cls->waitMetric = VMTools_MetricHistogram(metric,
+                                                "Time thread pool tasks "
+                                                "waited in their queue, in "
+                                                "microseconds.",
+                                                gWaitBuckets,
+                                                ARRAYSIZE(gWaitBuckets));
+      g_free(metric);
+      metric = g_strdup_printf("vmtools_pool_queued{class=\"%s\"}",
+                               cls->name);
+      cls->queuedMetric = VMTools_MetricGauge(metric,
+                                              "Thread pool tasks waiting in "
+                                              "their queue.");
+      g_free(metric);
+
+      maxThreads = g_key_file_get_integer(ctx->config, ctx->name,
+                                          gClassConfig[i].configKey, &err);
+      if (err != NULL) {
+         maxThreads = gClassConfig[i].defaultThreads;
+         if (VMTools_IsLowMemory()) {
+            maxThreads = MIN(maxThreads, LOW_MEMORY_MAX_THREADS);
          }
+         g_clear_error(&err);
+      }
 
-         maxUnused = g_key_file_get_integer(ctx->config, ctx->name,
-                                            "pool.maxUnusedThreads", &err);
-         if (err != NULL || maxUnused < 0) {
-            maxUnused = DEFAULT_MAX_UNUSED_THREADS;
+      if (maxThreads > 0 && !disabled) {
+         cls->pool = g_thread_pool_new(ToolsCorePoolRunWorker,
+                                       NULL, maxThreads, FALSE, &err);
+         if (err == NULL) {
+            threaded = TRUE;
+         } else {
+            g_warning("error initializing %s thread pool, running single "
+                      "threaded: %s", cls->name, err->message);
             g_clear_error(&err);
          }
+      }
+   }
 
-         g_thread_pool_set_max_idle_time(maxIdleTime);
-         g_thread_pool_set_max_unused_threads(maxUnused);
-      } else {
-         g_warning("error initializing thread pool, running single threaded: %s",
-                   err->message);
+   if (threaded) {
+      maxIdleTime = g_key_file_get_integer(ctx->config, ctx->name,
+                                           "pool.maxIdleTime", &err);
+      if (err != NULL || maxIdleTime <= 0) {
+         maxIdleTime = VMTools_IsLowMemory() ? LOW_MEMORY_MAX_IDLE_TIME :
+                                               DEFAULT_MAX_IDLE_TIME;
+         g_clear_error(&err);
+      }
+
+      maxUnused = g_key_file_get_integer(ctx->config, ctx->name,
+                                         "pool.maxUnusedThreads", &err);
+      if (err != NULL || maxUnused < 0) {
+         maxUnused = DEFAULT_MAX_UNUSED_THREADS;
          g_clear_error(&err);
       }
+
+      g_thread_pool_set_max_idle_time(maxIdleTime);
+      g_thread_pool_set_max_unused_threads(maxUnused);
+   }
+
+   gState.budgetIntervalUs = g_key_file_get_integer(ctx->config, ctx->name,
+                                                    "pool.budgetInterval",
+                                                    &err);
+   if (err != NULL || gState.budgetIntervalUs <= 0) {
+      gState.budgetIntervalUs = DEFAULT_BUDGET_INTERVAL;
+      g_clear_error(&err);
    }
+   gState.budgetIntervalUs *= G_USEC_PER_SEC;
+   gState.budgets = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                          ToolsCorePoolFreeBudget);
 
    gState.active = TRUE;
    g_mutex_init(&gState.lock);
    gState.threads = g_ptr_array_new();
-   gState.workQueue = g_queue_new();
 
    ToolsCoreService_RegisterProperty(ctx->serviceObj, &prop);
    g_object_set(ctx->serviceObj, TOOLS_CORE_PROP_TPOOL, &gState.funcs, NULL);
@@ -542,6 +1427,7 @@ ToolsCorePool_Init(ToolsAppCtx *ctx)
  * Shuts down the shared thread pool. This function will interrupt any running
  * threads (by calling their registered interrupt function), and wait for all
  * running tasks to finish before cleaning the remaining tasks and shared state.
+ * The queue metrics of each work class are logged.
  *
  * @param[in] ctx Application context.
  *
@@ -565,9 +1451,11 @@ ToolsCorePool_Shutdown(ToolsAppCtx *ctx)
       }
    }
 
-   /* Stop the thread pool. */
-   if (gState.pool != NULL) {
-      g_thread_pool_free(gState.pool, TRUE, TRUE);
+   /* Stop the thread pools. */
+   for (i = 0; i < ARRAYSIZE(gState.classes); i++) {
+      if (gState.classes[i].pool != NULL) {
+         g_thread_pool_free(gState.classes[i].pool, TRUE, TRUE);
+      }
    }
 
    /* Join all spawned threads. */
@@ -576,21 +1464,32 @@ ToolsCorePool_Shutdown(ToolsAppCtx *ctx)
       ToolsCorePoolDestroyThread(task);
    }
 
-   /* Destroy all pending tasks. */
-   while (1) {
-      WorkerTask *task = g_queue_pop_tail(gState.workQueue);
-      if (task != NULL) {
-         ToolsCorePoolDestroyTask(task);
-      } else {
-         break;
+   for (i = 0; i < ARRAYSIZE(gState.classes); i++) {
+      ThreadPoolClass *cls = &gState.classes[i];
+
+      g_debug("%s tasks: %"G_GUINT64_FORMAT" run, max queue depth %u, "
+              "avg wait %"G_GUINT64_FORMAT" us, max wait %"G_GUINT64_FORMAT
+              " us.\n", cls->name, cls->completed, cls->maxDepth,
+              cls->completed > 0 ? cls->totalWaitUs / cls->completed : 0,
+              cls->maxWaitUs);
+
+      /* Destroy all pending tasks. */
+      while (1) {
+         WorkerTask *task = g_queue_pop_tail(cls->workQueue);
+         if (task != NULL) {
+            ToolsCorePoolDestroyTask(task);
+         } else {
+            break;
+         }
       }
+      g_queue_free(cls->workQueue);
+      VMTools_MetricSet(cls->queuedMetric, 0);
    }
 
    /* Cleanup. */
+   g_hash_table_destroy(gState.budgets);
    g_ptr_array_free(gState.threads, TRUE);
-   g_queue_free(gState.workQueue);
    g_mutex_clear(&gState.lock);
    memset(&gState, 0, sizeof gState);
    g_object_set(ctx->serviceObj, TOOLS_CORE_PROP_TPOOL, NULL, NULL);
 }
-
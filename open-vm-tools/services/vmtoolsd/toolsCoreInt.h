@@ -67,6 +67,13 @@ typedef struct ToolsAppProviderReg {
    ToolsAppProviderState   state;
 } ToolsAppProviderReg;
 
+/** A step of the service startup, see ToolsCore_StartupStep(). */
+typedef struct ToolsStartupStep {
+   gchar         *name;
+   gint64         startUs;       /* Since the startup began. */
+   gint64         durationUs;
+} ToolsStartupStep;
+
 /** Defines internal service state. */
 typedef struct ToolsServiceState {
    gchar         *name;
@@ -78,6 +85,7 @@ typedef struct ToolsServiceState {
    gchar         *commonPath;
    gchar         *pluginPath;
    GPtrArray     *plugins;
+   GPtrArray     *lazyPlugins;
 #if defined(_WIN32)
    gchar         *displayName;
 #else
@@ -88,6 +96,8 @@ typedef struct ToolsServiceState {
    RpcDebugLibData  *debugData;
    ToolsAppCtx    ctx;
    GArray        *providers;
+   gint64         startupUs;     /* Monotonic time the startup began. */
+   GArray        *startup;       /* ToolsStartupStep of the startup. */
 #if defined(__linux__)
    /*
     * We hold a reference to vSocket device to avoid
@@ -113,6 +123,12 @@ ToolsCore_DumpPluginInfo(ToolsServiceState *state);
 void
 ToolsCore_DumpState(ToolsServiceState *state);
 
+void
+ToolsCore_StartupStep(ToolsServiceState *state,
+                      const gchar *name,
+                      gint64 start,
+                      gint64 end);
+
 guint
 ToolsCore_GetVmusrLimit(ToolsServiceState *state);
 
@@ -136,6 +152,9 @@ void
 ToolsCore_ReleaseVsockFamily(ToolsServiceState *state);
 #endif
 
+void
+ToolsCore_EarlyStart(ToolsServiceState *state);
+
 gboolean
 ToolsCore_LoadPlugins(ToolsServiceState *state);
 
@@ -165,5 +184,19 @@ ToolsCorePool_Init(ToolsAppCtx *ctx);
 void
 ToolsCorePool_Shutdown(ToolsAppCtx *ctx);
 
+gchar *
+ToolsCorePool_GetBudgetStats(void);
+
+void
+ToolsCorePool_LogBudget(const gchar *owner);
+
+#if !defined(_WIN32)
+void
+ToolsCoreMetrics_Start(ToolsServiceState *state);
+
+void
+ToolsCoreMetrics_Stop(void);
+#endif
+
 #endif /* _TOOLSCOREINT_H_ */
 
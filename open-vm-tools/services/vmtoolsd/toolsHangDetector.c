@@ -20,14 +20,26 @@
  * @file toolsHangDetector.c
  *
  *    Implementation of the tools hang detection and reporting
+ *
+ *    The detector also profiles the main loop: the time spent dispatching
+ *    each main loop iteration is measured by wrapping the context's poll
+ *    function, and GuestRPC handlers are timed through the channel's
+ *    dispatch observer. The profile keeps a histogram of the iteration
+ *    times and a table of the slowest callbacks, and is logged when a hang
+ *    is detected and with the service state dump, along with the most
+ *    contended MXUser locks, as sampled by lib/lock.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <glib.h>
 
 #include "vmware.h"
+#include "userlock.h"
 #include "vmware/tools/log.h"
+#include "vmware/tools/metrics.h"
 #include "vmware/tools/threadPool.h"
+#include "vmware/tools/utils.h"
 #include "toolsHangDetector.h"
 #include "vmware/guestrpc/tclodefs.h"
 #include "vmware/tools/guestrpc.h"
@@ -37,11 +49,33 @@
 #define COUNTER_RESET_VALUE 5    /* approximately 5 seconds */
 #define STARVE_THRESHOLD 1.5
 
+#define PROFILE_NUM_BUCKETS 16   /* bucket i counts iterations under 2^i ms */
+#define PROFILE_TOP_N 16         /* slow callbacks remembered */
+#define PROFILE_LABEL_LEN 64
+#define PROFILE_SLOW_US (100 * G_TIME_SPAN_MILLISECOND)
+#define PROFILE_UNATTRIBUTED "main loop (unattributed)"
+#define PROFILE_TOP_LOCKS 8      /* contended locks logged */
+
+/* Buckets of the main loop iteration histogram, in microseconds. */
+static const guint64 gIterBuckets[] = {
+   1000, 10000, 100000, 1000000, 5000000,
+};
+
+/* 1 in this many lock acquisitions of each thread is timed. */
+#define LOCK_SAMPLE_PERIOD_DEFAULT 1024
+
 typedef enum {
    NORMAL,
    HUNG
 } DetectedMode;
 
+typedef struct ProfileEntry {
+   gchar *name;
+   guint64 count;
+   gint64 totalUs;
+   gint64 maxUs;
+} ProfileEntry;
+
 typedef struct HangDetectorState {
    /* 'mutex' and 'cond' protect concurrent accesses to 'terminate' flag */
    GMutex mutex;
@@ -58,6 +92,23 @@ typedef struct HangDetectorState {
     */
    gint64 timeSeq[COUNTER_RESET_VALUE+1];
    gboolean vmxRejectedHealthUpdate;
+
+   /* Main loop profiler. Only the main thread touches these. */
+   GMainContext *mainCtx;
+   RpcChannel *rpc;
+   GPollFunc origPoll;
+   gint64 wakeTime;
+   gboolean iterAttributed;
+   VMToolsMetric *iterMetric;
+   VMToolsMetric *hangMetric;
+
+   /* 'profileLock' protects the profiler data read by the detector thread. */
+   GMutex profileLock;
+   gchar current[PROFILE_LABEL_LEN];
+   gint64 currentStart;
+   guint64 iterations;
+   guint64 hist[PROFILE_NUM_BUCKETS];
+   ProfileEntry top[PROFILE_TOP_N];
 } HangDetectorState;
 
 static HangDetectorState gDetectorState;
@@ -88,6 +139,324 @@ DetectorInit(void)
 }
 
 
+/*
+ ******************************************************************************
+ * ProfilerRecord --                                                     */ /**
+ *
+ * Accounts a callback run in the slow callback table. If the table is full,
+ * the entry with the smallest maximum is replaced when this run is slower.
+ * Must be called with the profile lock held.
+ *
+ * @param[in] name       Label of the callback.
+ * @param[in] elapsed    Run time in microseconds.
+ *
+ ******************************************************************************
+ */
+
+static void
+ProfilerRecord(const gchar *name,
+               gint64 elapsed)
+{
+   HangDetectorState *state = &gDetectorState;
+   ProfileEntry *entry = NULL;
+   gint i;
+
+   for (i = 0; i < PROFILE_TOP_N; i++) {
+      ProfileEntry *cur = &state->top[i];
+
+      if (cur->name == NULL || strcmp(cur->name, name) == 0) {
+         entry = cur;
+         break;
+      }
+      if (entry == NULL || cur->maxUs < entry->maxUs) {
+         entry = cur;
+      }
+   }
+
+   if (entry->name == NULL || strcmp(entry->name, name) != 0) {
+      if (entry->name != NULL && entry->maxUs >= elapsed) {
+         return;
+      }
+      g_free(entry->name);
+      entry->name = g_strdup(name);
+      entry->count = 0;
+      entry->totalUs = 0;
+      entry->maxUs = 0;
+   }
+
+   entry->count++;
+   entry->totalUs += elapsed;
+   entry->maxUs = MAX(entry->maxUs, elapsed);
+}
+
+
+/*
+ ******************************************************************************
+ * ProfilerPoll --                                                       */ /**
+ *
+ * Poll function of the main context. The time since the previous poll
+ * returned is the time the main loop spent dispatching that iteration; it
+ * goes into the histogram, and into the slow callback table when no
+ * attributed callback accounted for it.
+ *
+ * @param[in] fds       Descriptors to poll.
+ * @param[in] nfds      Number of descriptors.
+ * @param[in] timeout   Poll timeout in milliseconds.
+ *
+ * @return The result of the original poll function.
+ *
+ ******************************************************************************
+ */
+
+static gint
+ProfilerPoll(GPollFD *fds,
+             guint nfds,
+             gint timeout)
+{
+   HangDetectorState *state = &gDetectorState;
+   gint ret;
+
+   if (state->wakeTime != 0) {
+      gint64 busy = g_get_monotonic_time() - state->wakeTime;
+      gint64 ms = busy / G_TIME_SPAN_MILLISECOND;
+      guint bucket = 0;
+
+      while (bucket < PROFILE_NUM_BUCKETS - 1 && ms >= (G_GINT64_CONSTANT(1) << bucket)) {
+         bucket++;
+      }
+
+      VMTools_MetricObserve(state->iterMetric, busy);
+
+      g_mutex_lock(&state->profileLock);
+      state->iterations++;
+      state->hist[bucket]++;
+      if (!state->iterAttributed && busy >= PROFILE_SLOW_US) {
+         ProfilerRecord(PROFILE_UNATTRIBUTED, busy);
+      }
+      g_mutex_unlock(&state->profileLock);
+   }
+
+   ret = state->origPoll(fds, nfds, timeout);
+
+   state->wakeTime = g_get_monotonic_time();
+   state->iterAttributed = FALSE;
+
+   return ret;
+}
+
+
+/*
+ ******************************************************************************
+ * ProfilerRpcDispatch --                                                */ /**
+ *
+ * Dispatch observer of the RPC channel. Publishes the RPC being handled, so
+ * the detector thread can name it if the loop hangs, and accounts its run
+ * time.
+ *
+ * @param[in] name   Name of the RPC.
+ * @param[in] done   FALSE before the handler runs, TRUE after.
+ * @param[in] data   Unused.
+ *
+ ******************************************************************************
+ */
+
+static void
+ProfilerRpcDispatch(const char *name,
+                    gboolean done,
+                    UNUSED_PARAM(gpointer data))
+{
+   HangDetectorState *state = &gDetectorState;
+   gint64 now = g_get_monotonic_time();
+
+   g_mutex_lock(&state->profileLock);
+   if (!done) {
+      g_snprintf(state->current, sizeof state->current, "rpc %s", name);
+      state->currentStart = now;
+   } else if (state->current[0] != '\0') {
+      ProfilerRecord(state->current, now - state->currentStart);
+      state->current[0] = '\0';
+      state->iterAttributed = TRUE;
+   }
+   g_mutex_unlock(&state->profileLock);
+}
+
+
+/*
+ ******************************************************************************
+ * ProfilerStart --                                                      */ /**
+ *
+ * Hooks the profiler into the main context and the RPC channel.
+ *
+ * @param[in] ctx    Application context
+ *
+ ******************************************************************************
+ */
+
+static void
+ProfilerStart(ToolsAppCtx *ctx)
+{
+   HangDetectorState *state = &gDetectorState;
+
+   state->mainCtx = g_main_loop_get_context(ctx->mainLoop);
+   state->origPoll = g_main_context_get_poll_func(state->mainCtx);
+   state->wakeTime = 0;
+   state->iterMetric = VMTools_MetricHistogram("vmtools_main_loop_iteration_us",
+                                               "Time the main loop spent "
+                                               "dispatching an iteration, in "
+                                               "microseconds.",
+                                               gIterBuckets,
+                                               ARRAYSIZE(gIterBuckets));
+   state->hangMetric = VMTools_MetricCounter("vmtools_hangs_total",
+                                             "Times the main loop was "
+                                             "detected hung or slow.");
+   g_main_context_set_poll_func(state->mainCtx, ProfilerPoll);
+
+   state->rpc = ctx->rpc;
+   if (state->rpc != NULL) {
+      RpcChannel_SetDispatchCb(state->rpc, ProfilerRpcDispatch, NULL);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * ProfilerStop --                                                       */ /**
+ *
+ * Unhooks the profiler and frees the slow callback table.
+ *
+ ******************************************************************************
+ */
+
+static void
+ProfilerStop(void)
+{
+   HangDetectorState *state = &gDetectorState;
+   gint i;
+
+   if (state->mainCtx == NULL) {
+      return;
+   }
+
+   g_main_context_set_poll_func(state->mainCtx, state->origPoll);
+   if (state->rpc != NULL) {
+      RpcChannel_SetDispatchCb(state->rpc, NULL, NULL);
+      state->rpc = NULL;
+   }
+   state->mainCtx = NULL;
+
+   g_mutex_lock(&state->profileLock);
+   for (i = 0; i < PROFILE_TOP_N; i++) {
+      g_free(state->top[i].name);
+   }
+   memset(state->top, 0, sizeof state->top);
+   g_mutex_unlock(&state->profileLock);
+}
+
+
+/*
+ ******************************************************************************
+ * ProfilerDumpLocks --                                                  */ /**
+ *
+ * Logs the MXUser locks with the most sampled contention.
+ *
+ ******************************************************************************
+ */
+
+static void
+ProfilerDumpLocks(void)
+{
+   gchar *report = MXUser_TopContendedLocks(PROFILE_TOP_LOCKS);
+   gchar **lines = g_strsplit(report, "\n", -1);
+   gint i;
+
+   for (i = 0; lines[i] != NULL; i++) {
+      if (lines[i][0] != '\0') {
+         ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN, "Contended lock: %s\n",
+                            lines[i]);
+      }
+   }
+
+   g_strfreev(lines);
+   free(report);
+}
+
+
+/*
+ ******************************************************************************
+ * ToolsCoreHangDetector_DumpProfile --                                  */ /**
+ *
+ * Logs the main loop profile: the callback running now, if any, the
+ * histogram of iteration times, and the slow callback table.
+ *
+ * Safe to call from any thread.
+ *
+ ******************************************************************************
+ */
+
+void
+ToolsCoreHangDetector_DumpProfile(void)
+{
+   HangDetectorState *state = &gDetectorState;
+   gchar hist[PROFILE_NUM_BUCKETS * 12 + 1];
+   gulong used = 0;
+   gint last = 0;
+   gint i;
+
+   g_mutex_lock(&state->profileLock);
+
+   if (state->iterations == 0) {
+      goto exit;
+   }
+
+   ToolsCore_LogState(TOOLS_STATE_LOG_CONTAINER,
+                      "Main loop profile: %"G_GUINT64_FORMAT" iterations.\n",
+                      state->iterations);
+
+   if (state->current[0] != '\0') {
+      ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                         "Running: %s for %"G_GINT64_FORMAT" ms.\n",
+                         state->current,
+                         (g_get_monotonic_time() - state->currentStart) /
+                         G_TIME_SPAN_MILLISECOND);
+   }
+
+   for (i = 0; i < PROFILE_NUM_BUCKETS; i++) {
+      if (state->hist[i] != 0) {
+         last = i;
+      }
+   }
+   hist[0] = '\0';
+   for (i = 0; i <= last; i++) {
+      gint ret = g_snprintf(hist + used, sizeof hist - used,
+                            " %"G_GUINT64_FORMAT, state->hist[i]);
+      if (ret < 0 || ret >= sizeof hist - used) {
+         break;
+      }
+      used += ret;
+   }
+   ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                      "Iteration ms histogram (<1, <2, <4, ...):%s\n", hist);
+
+   for (i = 0; i < PROFILE_TOP_N; i++) {
+      ProfileEntry *entry = &state->top[i];
+
+      if (entry->name == NULL) {
+         continue;
+      }
+      ToolsCore_LogState(TOOLS_STATE_LOG_PLUGIN,
+                         "Slow callback: %s count %"G_GUINT64_FORMAT
+                         " avg %"G_GINT64_FORMAT" us max %"G_GINT64_FORMAT
+                         " us.\n", entry->name, entry->count,
+                         entry->totalUs / (gint64)entry->count, entry->maxUs);
+   }
+
+exit:
+   g_mutex_unlock(&state->profileLock);
+
+   ProfilerDumpLocks();
+}
+
+
 /*
  ******************************************************************************
  * DetectorFree --                                                       */ /**
@@ -104,6 +473,8 @@ DetectorFree(UNUSED_PARAM(gpointer args))
 {
    HangDetectorState *state = &gDetectorState;
 
+   ProfilerStop();
+
    if (state->checkinTimer) {
       g_source_destroy(state->checkinTimer);
       g_source_unref(state->checkinTimer);
@@ -248,11 +619,13 @@ UpdateStateToHung(void)
    double elapsed;
 
    state->mode = HUNG;
+   VMTools_MetricAdd(state->hangMetric, 1);
 
    elapsed = (state->timeSeq[0] - state->timeSeq[COUNTER_RESET_VALUE]) /
       (double)G_TIME_SPAN_SECOND;
 
    g_info("tools hang detector time sequence %s.", GetTimeSeqString());
+   ToolsCoreHangDetector_DumpProfile();
 
    if (elapsed > SLEEP_INTERVAL * COUNTER_RESET_VALUE * STARVE_THRESHOLD) {
       g_info("tools service was slow for the last %.2f seconds.", elapsed);
@@ -477,6 +850,7 @@ ToolsCoreHangDetector_Start(ToolsAppCtx *ctx)
    gboolean ret;
    GKeyFile *cfg = ctx->config;
    gboolean disabled;
+   gint period;
 
    ASSERT(NULL != cfg);
    disabled = g_key_file_get_boolean(cfg, VMTOOLS_GUEST_SERVICE,
@@ -490,12 +864,19 @@ ToolsCoreHangDetector_Start(ToolsAppCtx *ctx)
 
    DetectorInit();
 
+   period = VMTools_ConfigGetInteger(cfg, VMTOOLS_GUEST_SERVICE,
+                                     "lockContentionSamplePeriod",
+                                     LOCK_SAMPLE_PERIOD_DEFAULT);
+   MXUser_SetContentionSampling(MAX(period, 0));
+
    ret = ScheduleCheckinTimer(ctx);
    if (!ret) {
       g_info("Unable to schedule hang detector checkin timer on the main loop");
       goto exit;
    }
 
+   ProfilerStart(ctx);
+
    ret = ToolsCorePool_StartThread(ctx,
                                    "HangDetector",
                                    DetectorThread,
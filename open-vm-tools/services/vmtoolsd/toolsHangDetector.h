@@ -27,5 +27,6 @@
 
 gboolean ToolsCoreHangDetector_Start(ToolsAppCtx *ctx);
 void ToolsCoreHangDetector_RpcReset(void);
+void ToolsCoreHangDetector_DumpProfile(void);
 
 #endif /* _TOOLS_HANG_DETECTOR_H_ */
@@ -34,11 +34,13 @@
 #include "vm_assert.h"
 #include "conf.h"
 #include "str.h"
-#include "strutil.h"
 #include "toolsCoreInt.h"
+#include "userlock.h"
 #include "vmtoolsd_version.h"
 #include "vmware/tools/utils.h"
 #include "vmware/tools/log.h"
+#include "vmware/tools/metrics.h"
+#include "vmware/tools/threadPool.h"
 #include "vm_version.h"
 #if defined(__linux__)
 #include "vmci_sockets.h"
@@ -307,17 +309,19 @@ ToolsCoreRpcSetOption(RpcInData *data)
 
    gboolean retVal = FALSE;
    char *option;
-   char *value;
-   unsigned int index = 0;
+   char *value = NULL;
+   size_t index = 0;
    ToolsServiceState *state = data->clientData;
 
    /* Parse the option & value string. */
-   option = StrUtil_GetNextToken(&index, data->args, " ");
+   option = RpcChannel_NextArgDup(data, &index, " ");
    /* Ignore leading space before value. */
-   index++;
-   value = StrUtil_GetNextToken(&index, data->args, "");
+   if (index < data->argsSize) {
+      index++;
+      value = RpcChannel_NextArgDup(data, &index, "");
+   }
 
-   if (option != NULL && value != NULL && strlen(value) != 0) {
+   if (option != NULL && value != NULL) {
 
       g_debug("Setting option '%s' to '%s'.\n", option, value);
       g_signal_emit_by_name(state->ctx.serviceObj,
@@ -328,15 +332,145 @@ ToolsCoreRpcSetOption(RpcInData *data)
                             &retVal);
    }
 
-   vm_free(option);
-   vm_free(value);
-
    RPCIN_SETRETVALS(data, retVal ? "" : "Unknown or invalid option", retVal);
 
    return retVal;
 }
 
 
+/**
+ * Replies with the MXUser locks of the service with the most sampled
+ * contention, one per line. The optional argument is the number of locks.
+ *
+ * @param[in]  data     The RPC data.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+ToolsCoreRpcLockStats(RpcInData *data)
+{
+   guint32 maxLocks = 16;
+   size_t index = 0;
+
+   RpcChannel_NextArgUint(data, &index, " ", &maxLocks);
+
+   data->result = MXUser_TopContendedLocks(MIN(maxLocks, 1024));
+   data->resultLen = strlen(data->result);
+   data->freeResult = TRUE;
+   return TRUE;
+}
+
+
+/**
+ * Replies with the resident memory of the service in KB, current and peak,
+ * as "rss=<n> peak=<n>", and whether the low-memory profile is enabled.
+ *
+ * @param[in]  data     The RPC data.
+ *
+ * @return TRUE on success.
+ */
+
+static gboolean
+ToolsCoreRpcMemStats(RpcInData *data)
+{
+   guint64 rss;
+   guint64 peakRss;
+
+   if (!VMTools_GetMemoryUsage(&rss, &peakRss)) {
+      return RPCIN_SETRETVALS(data, "Memory usage not available", FALSE);
+   }
+
+   return RPCIN_SETRETVALS(data,
+                           RpcChannel_Printf(data,
+                                             "rss=%"G_GUINT64_FORMAT" "
+                                             "peak=%"G_GUINT64_FORMAT" "
+                                             "lowMemory=%d",
+                                             rss / 1024, peakRss / 1024,
+                                             VMTools_IsLowMemory()),
+                           TRUE);
+}
+
+
+/**
+ * Replies with the CPU time and I/O used by the thread pool tasks of each
+ * plugin, and how each plugin is doing against its budget, one plugin per
+ * line.
+ *
+ * @param[in]  data     The RPC data.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+ToolsCoreRpcBudgetStats(RpcInData *data)
+{
+   data->result = ToolsCorePool_GetBudgetStats();
+   data->resultLen = strlen(data->result);
+   data->freeResult = TRUE;
+   return TRUE;
+}
+
+
+/**
+ * Replies with a snapshot of the process' metrics registry, in the
+ * Prometheus text exposition format.
+ *
+ * @param[in]  data     The RPC data.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+ToolsCoreRpcMetrics(RpcInData *data)
+{
+   data->result = VMTools_MetricsSnapshot();
+   data->resultLen = strlen(data->result);
+   data->freeResult = TRUE;
+   return TRUE;
+}
+
+
+/**
+ * Thread pool task running a bulk RPC.
+ *
+ * @param[in]  ctx      Unused.
+ * @param[in]  job      The bulk RPC.
+ */
+
+static void
+ToolsCoreRpcBulkTask(ToolsAppCtx *ctx,
+                     gpointer job)
+{
+   RpcChannel_RunBulk(job);
+}
+
+
+/**
+ * Bulk runner of the RPC channel: runs the handlers marked
+ * RPCCHANNEL_PRIORITY_BULK as bulk tasks of the shared thread pool, so that
+ * the main loop keeps serving timers and signals while they run.
+ *
+ * @param[in]  job      The bulk RPC.
+ * @param[in]  _state   The service state.
+ *
+ * @return Whether the task was submitted.
+ */
+
+static gboolean
+ToolsCoreRpcRunBulk(RpcChannelBulkJob *job,
+                    gpointer _state)
+{
+   ToolsServiceState *state = _state;
+
+   return ToolsCorePool_SubmitClassTask(&state->ctx,
+                                        TOOLS_CORE_POOL_CLASS_BULK,
+                                        ToolsCoreRpcBulkTask,
+                                        job,
+                                        NULL) != 0;
+}
+
+
 /**
  * Initializes the RPC channel. Currently this instantiates an RpcIn loop.
  * This function should only be called once.
@@ -352,6 +486,10 @@ ToolsCore_InitRpc(ToolsServiceState *state)
    static RpcChannelCallback rpcs[] = {
       { "Capabilities_Register", ToolsCoreRpcCapReg, NULL, NULL, NULL, 0 },
       { "Set_Option", ToolsCoreRpcSetOption, NULL, NULL, NULL, 0 },
+      { "vmtools.lockStats", ToolsCoreRpcLockStats, NULL, NULL, NULL, 0 },
+      { "vmtools.memStats", ToolsCoreRpcMemStats, NULL, NULL, NULL, 0 },
+      { "vmtools.budgetStats", ToolsCoreRpcBudgetStats, NULL, NULL, NULL, 0 },
+      { "vmtools.metrics", ToolsCoreRpcMetrics, NULL, NULL, NULL, 0 },
    };
 
    const gchar *app;
@@ -415,6 +553,8 @@ ToolsCore_InitRpc(ToolsServiceState *state)
                        failureCb,
                        errorLimit);
 
+      RpcChannel_SetBulkRunner(state->ctx.rpc, ToolsCoreRpcRunBulk, state);
+
       /* Register the "built in" RPCs. */
       for (i = 0; i < ARRAYSIZE(rpcs); i++) {
          RpcChannelCallback *rpc = &rpcs[i];
@@ -0,0 +1,311 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * backdoorBench.c --
+ *
+ *   Benchmark for the guest backdoor on the current CPU and hypervisor.
+ *   Each test runs once over the legacy I/O port interface and once over
+ *   the interface the library picks (vmcall or vmmcall when the hypervisor
+ *   offers them):
+ *
+ *   - lb: BDOOR_CMD_GETVERSION in a loop, one exit per call.
+ *   - batch: the same command through Backdoor_Batch.
+ *   - rpc<N>: GuestRPCs of N bytes, which use high-bandwidth exits for the
+ *     message body when the host supports them.
+ *
+ *   Results are exits per second and, for the RPC tests, bytes per exit,
+ *   from the Backdoor_GetStats counters. Must be run inside a VM.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "backdoor.h"
+#include "backdoor_def.h"
+#include "hostinfo.h"
+#include "rpcout.h"
+#include "str.h"
+#include "util.h"
+#include "vmcheck.h"
+
+#define BACKDOOR_BENCH_DEFAULT_ITERATIONS  100000
+#define BACKDOOR_BENCH_BATCH               16
+#define BACKDOOR_BENCH_RPC_KEY             "info-set guestinfo.vmware.bench "
+
+typedef Bool (*BackdoorBenchTest)(unsigned int iterations,
+                                  size_t arg,
+                                  uint64 *bytes);
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BackdoorBenchLb --
+ *
+ *    Issue low-bandwidth GETVERSION commands one at a time.
+ *
+ * Results:
+ *    TRUE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BackdoorBenchLb(unsigned int iterations,   // IN
+                size_t arg,                // IN: unused
+                uint64 *bytes)             // OUT: unused
+{
+   unsigned int i;
+
+   for (i = 0; i < iterations; i++) {
+      Backdoor_proto bp;
+
+      memset(&bp, 0, sizeof bp);
+      bp.in.cx.halfs.low = BDOOR_CMD_GETVERSION;
+      Backdoor(&bp);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BackdoorBenchBatch --
+ *
+ *    Issue low-bandwidth GETVERSION commands through Backdoor_Batch.
+ *
+ * Results:
+ *    TRUE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BackdoorBenchBatch(unsigned int iterations,   // IN
+                   size_t arg,                // IN: unused
+                   uint64 *bytes)             // OUT: unused
+{
+   Backdoor_proto bps[BACKDOOR_BENCH_BATCH];
+   unsigned int i;
+
+   for (i = 0; i < iterations; i += BACKDOOR_BENCH_BATCH) {
+      size_t count = MIN(BACKDOOR_BENCH_BATCH, iterations - i);
+      size_t j;
+
+      memset(bps, 0, sizeof bps);
+      for (j = 0; j < count; j++) {
+         bps[j].in.cx.halfs.low = BDOOR_CMD_GETVERSION;
+      }
+      Backdoor_Batch(bps, count);
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BackdoorBenchRpc --
+ *
+ *    Send GuestRPCs of the given size on one RPCI channel. The request
+ *    sets a guestinfo key, the host reply is not checked.
+ *
+ * Results:
+ *    TRUE on success, FALSE if the channel could not be used.
+ *
+ * Side effects:
+ *    Sets guestinfo.vmware.bench.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+BackdoorBenchRpc(unsigned int iterations,   // IN
+                 size_t size,               // IN: request size
+                 uint64 *bytes)             // OUT: bytes sent and received
+{
+   size_t keyLen = strlen(BACKDOOR_BENCH_RPC_KEY);
+   RpcOut *out;
+   char *request;
+   Bool ok = TRUE;
+   unsigned int i;
+
+   size = MAX(size, keyLen + 1);
+   request = Util_SafeMalloc(size);
+   memcpy(request, BACKDOOR_BENCH_RPC_KEY, keyLen);
+   memset(request + keyLen, 'x', size - keyLen);
+
+   out = RpcOut_Construct();
+   if (out == NULL || !RpcOut_start(out)) {
+      fprintf(stderr, "Cannot open the RPCI channel\n");
+      if (out != NULL) {
+         RpcOut_Destruct(out);
+      }
+      free(request);
+      return FALSE;
+   }
+
+   for (i = 0; i < iterations && ok; i++) {
+      Bool status;
+      char const *reply;
+      size_t replyLen;
+
+      ok = RpcOut_send(out, request, size, &status, &reply, &replyLen);
+      *bytes += size + replyLen;
+   }
+
+   RpcOut_stop(out);
+   RpcOut_Destruct(out);
+   free(request);
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * BackdoorBenchUsage --
+ *
+ *    Print the usage message.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+BackdoorBenchUsage(const char *prog)   // IN: program name
+{
+   fprintf(stderr,
+           "Usage: %s [-n iterations]\n"
+           "  -n iterations  calls per low-bandwidth test (%u), RPC tests\n"
+           "                 use a hundredth of it\n",
+           prog, BACKDOOR_BENCH_DEFAULT_ITERATIONS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Run every test over each backdoor interface.
+ *
+ * Results:
+ *    0 if all tests succeeded, 1 otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,       // IN
+     char *argv[])   // IN
+{
+   static const struct {
+      const char *name;
+      BackdoorBenchTest run;
+      size_t arg;
+      Bool rpc;
+   } tests[] = {
+      { "lb",       BackdoorBenchLb,    0,         FALSE },
+      { "batch",    BackdoorBenchBatch, 0,         FALSE },
+      { "rpc64",    BackdoorBenchRpc,   64,        TRUE },
+      { "rpc4k",    BackdoorBenchRpc,   4096,      TRUE },
+      { "rpc60k",   BackdoorBenchRpc,   60 * 1024, TRUE },
+   };
+   unsigned int iterations = BACKDOOR_BENCH_DEFAULT_ITERATIONS;
+   int result = 0;
+   unsigned int mode;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:h")) != -1) {
+      switch (opt) {
+      case 'n':
+         iterations = strtoul(optarg, NULL, 0);
+         break;
+      default:
+         BackdoorBenchUsage(argv[0]);
+         return 1;
+      }
+   }
+
+   if (!VmCheck_IsVirtualWorld()) {
+      fprintf(stderr, "Not running in a VMware VM\n");
+      return 1;
+   }
+
+   printf("%-10s %-8s %12s %12s %12s\n",
+          "interface", "test", "exits", "exits/s", "bytes/exit");
+
+   for (mode = 0; mode < 2; mode++) {
+      const char *ifName = mode == 0 ? "io" : "auto";
+      unsigned int i;
+
+      Backdoor_ForceLegacy(mode == 0);
+
+      for (i = 0; i < ARRAYSIZE(tests); i++) {
+         unsigned int n = tests[i].rpc ? MAX(iterations / 100, 1) : iterations;
+         BackdoorStats before;
+         BackdoorStats after;
+         uint64 bytes = 0;
+         uint64 exits;
+         VmTimeType start;
+         VmTimeType elapsed;
+
+         Backdoor_GetStats(&before);
+         start = Hostinfo_SystemTimerUS();
+         if (!tests[i].run(n, tests[i].arg, &bytes)) {
+            fprintf(stderr, "%s/%s: failed\n", ifName, tests[i].name);
+            result = 1;
+            continue;
+         }
+         elapsed = MAX(Hostinfo_SystemTimerUS() - start, 1);
+         Backdoor_GetStats(&after);
+
+         exits = after.exits - before.exits;
+         printf("%-10s %-8s %12"FMT64"u %12.0f ", ifName, tests[i].name,
+                exits, (double)exits * 1000000 / elapsed);
+         if (tests[i].rpc && exits > 0) {
+            printf("%12.1f\n", (double)bytes / exits);
+         } else {
+            printf("%12s\n", "-");
+         }
+      }
+   }
+
+   Backdoor_ForceLegacy(FALSE);
+   return result;
+}
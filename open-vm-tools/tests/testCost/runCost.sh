@@ -0,0 +1,276 @@
+#!/bin/bash
+##########################################################
+# Copyright (C) 2020 VMware, Inc. All rights reserved.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU Lesser General Public License as published
+# by the Free Software Foundation version 2.1 and no later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+# or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+# License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public License
+# along with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+#
+##########################################################
+
+# Plugin CPU-cost regression suite. Each plugin is loaded alone in vmtoolsd,
+# with the testCost debug plugin as the RPC channel, and its per-cycle cost
+# is compared with the baseline; see testCost.c for what is measured.
+#
+# The service runs in new user, mount and PID namespaces, so that it sees:
+#	- synthetic /proc/{meminfo,stat,vmstat,zoneinfo,diskstats,uptime} and
+#	  /sys/block, the same on every machine;
+#	- a /proc with only a fixed set of synthetic processes, for appInfo
+#	  and serviceDiscovery.
+# appInfo and serviceDiscovery only run inside a VM, so the suite should be
+# run in one; timeSync can't set the clock in the namespace, so its numbers
+# are for the sampling and the failed adjustment.
+
+DEFAULT_PLUGINS="guestInfo appInfo serviceDiscovery timeSync vmbackup"
+DEFAULT_PLUGIN_DIR=/usr/lib/open-vm-tools/plugins/vmsvc
+
+# usage(): prints how to use this script
+usage()
+{
+	echo ""
+	echo "Usage: $0 [-h] [-u] [-n cycles] [-t threshold] [-p procs]"
+	echo "	[-b baseline-dir] [-o results-dir] [plugin ...]"
+	echo "	-h prints this usage statement"
+	echo "	-u updates the baseline with the results instead of comparing"
+	echo "	-n number of measured cycles, 20 by default"
+	echo "	-t allowed regression in percent, 20 by default"
+	echo "	-p number of synthetic processes, 200 by default"
+	echo "	-b directory of the <plugin>.baseline files, this script's by default"
+	echo "	-o directory for the <plugin>.results files, a temporary one by default"
+	echo "	plugins default to: $DEFAULT_PLUGINS"
+	echo ""
+	echo "Environment: VMTOOLSD (the service binary), PLUGIN_DIR (the vmsvc"
+	echo "plugins, $DEFAULT_PLUGIN_DIR by default), TESTCOST_LIB"
+	echo "(libtestCost.so, next to this script by default)."
+}
+
+# make_fixtures(): writes the synthetic /proc and /sys files to $1
+make_fixtures()
+{
+	mkdir -p "$1/proc"
+
+	cat > "$1/proc/meminfo" <<-EOF
+	MemTotal:        8167848 kB
+	MemFree:         2917196 kB
+	MemAvailable:    6072256 kB
+	Buffers:          211680 kB
+	Cached:          3093348 kB
+	SwapCached:            0 kB
+	Active:          2940148 kB
+	Inactive:        1835080 kB
+	SwapTotal:       2097148 kB
+	SwapFree:        2097148 kB
+	Dirty:               148 kB
+	Shmem:             18432 kB
+	Slab:             310532 kB
+	HugePages_Total:       0
+	Hugepagesize:       2048 kB
+	EOF
+
+	cat > "$1/proc/stat" <<-EOF
+	cpu  104716 1801 36236 8384037 2587 0 1110 0 0 0
+	cpu0 26049 448 9132 2096199 642 0 501 0 0 0
+	cpu1 26397 466 8955 2095982 660 0 259 0 0 0
+	cpu2 26005 437 9124 2096153 633 0 185 0 0 0
+	cpu3 26265 450 9025 2095703 652 0 165 0 0 0
+	intr 11524612 0 9 0 0 0 0 0 0 0
+	ctxt 22269968
+	btime 1600000000
+	processes 37437
+	procs_running 1
+	procs_blocked 0
+	EOF
+
+	cat > "$1/proc/vmstat" <<-EOF
+	nr_free_pages 729299
+	nr_inactive_anon 4608
+	nr_active_anon 380548
+	nr_inactive_file 454162
+	nr_active_file 354489
+	nr_dirty 37
+	pgpgin 2339104
+	pgpgout 4476712
+	pswpin 0
+	pswpout 0
+	pgfault 41654365
+	pgmajfault 7116
+	pgsteal_kswapd 0
+	pgscan_kswapd 0
+	EOF
+
+	cat > "$1/proc/zoneinfo" <<-EOF
+	Node 0, zone   Normal
+	  pages free     700000
+	        min      11275
+	        low      14093
+	        high     16911
+	        spanned  1835008
+	        present  1835008
+	        managed  1795924
+	EOF
+
+	cat > "$1/proc/diskstats" <<-EOF
+	   8       0 sda 73118 21069 4526887 37170 140215 104906 8543696 171631 0 141660 208802
+	   8       1 sda1 72951 21069 4520423 37101 136129 104906 8543696 169307 0 140204 206409
+	   8      16 sdb 1031 0 41594 402 18 0 96 12 0 232 414
+	EOF
+
+	echo "3600.00 14000.00" > "$1/proc/uptime"
+
+	mkdir -p "$1/sys/block/sda" "$1/sys/block/sdb"
+	echo "73118 21069 4526887 37170 140215 104906 8543696 171631 0 141660 208802" \
+		> "$1/sys/block/sda/stat"
+	echo "1031 0 41594 402 18 0 96 12 0 232 414" > "$1/sys/block/sdb/stat"
+	echo 8:0 > "$1/sys/block/sda/dev"
+	echo 8:16 > "$1/sys/block/sdb/dev"
+	echo 16777216 > "$1/sys/block/sda/size"
+	echo 16777216 > "$1/sys/block/sdb/size"
+}
+
+# make_config(): writes the service config for one plugin run to $1
+make_config()
+{
+	cat > "$1" <<-EOF
+	[logging]
+	log = false
+
+	[guestinfo]
+	poll-interval = 1
+	stats-interval = 1
+
+	[appinfo]
+	poll-interval = 1
+
+	[servicediscovery]
+	poll-interval = 1
+
+	[vmbackup]
+	enableSyncDriver = false
+	execScripts = false
+
+	[testCost]
+	cycles = $CYCLES
+	threshold = $THRESHOLD
+	results = $2
+	EOF
+	if [ -n "$3" ]; then
+		echo "baseline = $3" >> "$1"
+	fi
+}
+
+# inner(): runs in the namespaces; mounts the fixtures, starts the
+# synthetic processes and runs the service
+inner()
+{
+	local fixtures=$1 procs=$2 work=$3
+	local names="java httpd postgres mysqld nginx sshd redis-server node"
+	local i=0 f
+
+	for f in "$fixtures"/proc/*; do
+		mount --bind "$f" "/proc/${f##*/}" ||
+			echo "warning: /proc/${f##*/} is not synthetic" >&2
+	done
+	mount --bind "$fixtures/sys/block" /sys/block ||
+		echo "warning: /sys/block is not synthetic" >&2
+
+	set -- $names
+	while [ $i -lt "$procs" ]; do
+		shift
+		[ $# -eq 0 ] && set -- $names
+		(exec -a "$1 --instance=$i" sleep 100000) &
+		i=$((i + 1))
+	done
+
+	LD_PRELOAD="$TESTCOST_LIB" "$VMTOOLSD" -n vmsvc -c "$work/tools.conf" \
+		-p "$work/plugins" -g "$TESTCOST_LIB"
+}
+
+if [ "$1" = "--inner" ]; then
+	shift
+	inner "$@"
+	exit $?
+fi
+
+CYCLES=20
+THRESHOLD=20
+PROCS=200
+UPDATE=
+BASELINE_DIR=$(cd "$(dirname "$0")" && pwd)
+RESULTS_DIR=
+
+while getopts "hun:t:p:b:o:" opt; do
+	case $opt in
+	u) UPDATE=1 ;;
+	n) CYCLES=$OPTARG ;;
+	t) THRESHOLD=$OPTARG ;;
+	p) PROCS=$OPTARG ;;
+	b) BASELINE_DIR=$OPTARG ;;
+	o) RESULTS_DIR=$OPTARG ;;
+	h) usage; exit 0 ;;
+	*) usage; exit 1 ;;
+	esac
+done
+shift $((OPTIND - 1))
+
+PLUGINS=${*:-$DEFAULT_PLUGINS}
+VMTOOLSD=${VMTOOLSD:-$(command -v vmtoolsd)}
+PLUGIN_DIR=${PLUGIN_DIR:-$DEFAULT_PLUGIN_DIR}
+TESTCOST_LIB=${TESTCOST_LIB:-$(dirname "$0")/libtestCost.so}
+TESTCOST_LIB=$(cd "$(dirname "$TESTCOST_LIB")" && pwd)/${TESTCOST_LIB##*/}
+export VMTOOLSD TESTCOST_LIB
+
+if [ ! -x "$VMTOOLSD" ] || [ ! -f "$TESTCOST_LIB" ]; then
+	echo "Cannot find vmtoolsd or libtestCost.so." >&2
+	usage
+	exit 1
+fi
+
+WORK=$(mktemp -d) || exit 1
+trap 'rm -rf "$WORK"' EXIT
+RESULTS_DIR=${RESULTS_DIR:-$WORK}
+make_fixtures "$WORK/fixtures"
+
+failed=
+for plugin in $PLUGINS; do
+	lib="$PLUGIN_DIR/lib$plugin.so"
+	results="$RESULTS_DIR/$plugin.results"
+	baseline="$BASELINE_DIR/$plugin.baseline"
+
+	if [ ! -f "$lib" ]; then
+		echo "$plugin: $lib not found, skipped."
+		continue
+	fi
+
+	rm -rf "$WORK/run"
+	mkdir -p "$WORK/run/plugins"
+	ln -s "$lib" "$WORK/run/plugins/"
+	if [ -n "$UPDATE" ] || [ ! -f "$baseline" ]; then
+		make_config "$WORK/run/tools.conf" "$results"
+	else
+		make_config "$WORK/run/tools.conf" "$results" "$baseline"
+	fi
+
+	unshare --user --map-root-user --mount --pid --fork --mount-proc \
+		"$BASH" "$0" --inner "$WORK/fixtures" "$PROCS" "$WORK/run"
+	ret=$?
+
+	echo "$plugin:"
+	[ -f "$results" ] && sed 's/^/	/' "$results"
+	if [ $ret -ne 0 ]; then
+		echo "$plugin: FAILED"
+		failed=1
+	elif [ -n "$UPDATE" ]; then
+		cp "$results" "$baseline" && echo "$plugin: baseline updated"
+	fi
+done
+
+[ -z "$failed" ]
@@ -0,0 +1,751 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file testCost.c
+ *
+ * A debug plugin that measures what the plugins loaded next to it cost per
+ * cycle of their periodic work, and fails when the cost regressed from a
+ * baseline. It is meant to be run by runCost.sh, which sets up the fixtures
+ * and loads one plugin at a time, so that each gets its own numbers.
+ *
+ * The plugin plays the host: it enables time sync, answers the Namespace DB
+ * reads of service discovery with a fresh signal, and drives a vmbackup
+ * cycle (with the null provider) each cycle. The periodic tasks of the other
+ * plugins run on their own timers, which the fixture config shortens to one
+ * cycle.
+ *
+ * Each cycle is "cycle-ms" milliseconds of the service's life; after
+ * "warmup" cycles, "cycles" cycles are measured. The per-cycle results are:
+ *
+ *   - cpu-us: user and system time of the service and of its children.
+ *   - allocs: calls to malloc, calloc and realloc. Only counted when the
+ *     plugin is also in LD_PRELOAD, so that its definitions are used by the
+ *     whole process.
+ *   - syscalls: system calls of the service's threads, from perf
+ *     tracepoint counters, when perf_event_paranoid allows them. Children
+ *     are not counted.
+ *   - rpc-bytes: bytes sent by the service over the RPC channel.
+ *
+ * The results are logged and written to "results" as "name value" lines.
+ * If "baseline" names a file in the same format, a result above its
+ * baseline by more than "threshold" percent, and by more than the noise
+ * floor of the counter, fails the run; to update the baseline, copy the
+ * results over it. All the settings are in the [testCost] config group.
+ */
+
+#define G_LOG_DOMAIN "testCost"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if defined(__linux__)
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#endif
+
+#include "vmware.h"
+#include "strutil.h"
+#include "util.h"
+#include "vm_atomic.h"
+#include "vmware/guestrpc/timesync.h"
+#include "vmware/guestrpc/vmbackup.h"
+#include "vmware/tools/rpcdebug.h"
+#include "vmware/tools/utils.h"
+
+#define TESTCOST_CONF_GROUP        "testCost"
+#define TESTCOST_DEFAULT_CYCLES    20
+#define TESTCOST_DEFAULT_CYCLE_MS  1000
+#define TESTCOST_DEFAULT_WARMUP    3
+#define TESTCOST_DEFAULT_THRESHOLD 20
+
+#define TESTCOST_NSDB_GET          "namespace-priv-get-values"
+#define TESTCOST_SET_OPTION        "Set_Option "
+
+typedef enum TestCostCounter {
+   COST_CPU_US,
+   COST_ALLOCS,
+   COST_SYSCALLS,
+   COST_RPC_BYTES,
+   COST_MAX
+} TestCostCounter;
+
+/*
+ * Names of the counters, and the per-cycle difference from the baseline
+ * that is always accepted as noise.
+ */
+static const struct {
+   const gchar *name;
+   guint64 noise;
+} gCounters[COST_MAX] = {
+   { "cpu-us",    500 },
+   { "allocs",    50 },
+   { "syscalls",  50 },
+   { "rpc-bytes", 256 },
+};
+
+typedef enum TestCostBackup {
+   BACKUP_IDLE,
+   BACKUP_RUNNING,
+   BACKUP_SNAPSHOT,
+   BACKUP_DISABLED,
+} TestCostBackup;
+
+typedef struct TestCostState {
+   ToolsAppCtx      *ctx;
+   guint             cycles;
+   guint             cycleMs;
+   guint             warmup;
+   guint             threshold;
+   gchar            *results;
+   gchar            *baseline;
+
+   guint             cycle;
+   gint64            cycleStart;
+   guint64           start[COST_MAX];
+   gboolean          syscallsKnown;
+
+   GHashTable       *threadCounters;
+   gint              syscallEvent;
+
+   TestCostBackup    backup;
+   guint             backups;
+   gchar            *message;
+} TestCostState;
+
+static TestCostState gState;
+
+static Atomic_uint64 gAllocs;
+static Atomic_uint64 gRpcBytes;
+
+
+#if defined(__GLIBC__)
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+
+/**
+ * Counts the allocations of the whole process, when this library is in
+ * LD_PRELOAD, and hands them to glibc.
+ *
+ * @param[in]  size     Size of the allocation.
+ *
+ * @return As malloc.
+ */
+
+void *
+malloc(size_t size)
+{
+   Atomic_Inc64(&gAllocs);
+   return __libc_malloc(size);
+}
+
+
+/**
+ * See malloc.
+ *
+ * @param[in]  nmemb    Number of elements.
+ * @param[in]  size     Size of an element.
+ *
+ * @return As calloc.
+ */
+
+void *
+calloc(size_t nmemb,
+       size_t size)
+{
+   Atomic_Inc64(&gAllocs);
+   return __libc_calloc(nmemb, size);
+}
+
+
+/**
+ * See malloc.
+ *
+ * @param[in]  ptr      The allocation to resize.
+ * @param[in]  size     New size.
+ *
+ * @return As realloc.
+ */
+
+void *
+realloc(void *ptr,
+        size_t size)
+{
+   Atomic_Inc64(&gAllocs);
+   return __libc_realloc(ptr, size);
+}
+#endif
+
+
+/**
+ * Reads the id of the raw_syscalls:sys_enter tracepoint.
+ *
+ * @return The id, -1 if tracing is not available.
+ */
+
+static gint
+TestCostSyscallEvent(void)
+{
+   static const gchar *paths[] = {
+      "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+      "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+   };
+   guint i;
+
+   for (i = 0; i < ARRAYSIZE(paths); i++) {
+      gchar *contents;
+
+      if (g_file_get_contents(paths[i], &contents, NULL, NULL)) {
+         gint id = atoi(contents);
+
+         g_free(contents);
+         return id;
+      }
+   }
+   return -1;
+}
+
+
+/**
+ * Opens a system call counter for each thread of the service that doesn't
+ * have one yet, and sums all the counters. The counters of threads which
+ * exited keep their final count.
+ *
+ * @param[out] count    Number of system calls so far.
+ *
+ * @return Whether system calls can be counted.
+ */
+
+static gboolean
+TestCostSyscalls(guint64 *count)
+{
+#if defined(__linux__)
+   GHashTableIter iter;
+   gpointer value;
+   GDir *dir;
+   const gchar *entry;
+
+   if (gState.syscallEvent < 0) {
+      return FALSE;
+   }
+
+   dir = g_dir_open("/proc/self/task", 0, NULL);
+   if (dir == NULL) {
+      return FALSE;
+   }
+
+   while ((entry = g_dir_read_name(dir)) != NULL) {
+      gint tid = atoi(entry);
+      struct perf_event_attr attr;
+      int fd;
+
+      if (g_hash_table_contains(gState.threadCounters,
+                                GINT_TO_POINTER(tid))) {
+         continue;
+      }
+
+      memset(&attr, 0, sizeof attr);
+      attr.type = PERF_TYPE_TRACEPOINT;
+      attr.size = sizeof attr;
+      attr.config = gState.syscallEvent;
+      fd = syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+      if (fd == -1) {
+         g_message("Cannot count system calls: %s\n", g_strerror(errno));
+         gState.syscallEvent = -1;
+         g_dir_close(dir);
+         return FALSE;
+      }
+      g_hash_table_insert(gState.threadCounters, GINT_TO_POINTER(tid),
+                          GINT_TO_POINTER(fd));
+   }
+   g_dir_close(dir);
+
+   *count = 0;
+   g_hash_table_iter_init(&iter, gState.threadCounters);
+   while (g_hash_table_iter_next(&iter, NULL, &value)) {
+      guint64 threadCount;
+
+      if (read(GPOINTER_TO_INT(value), &threadCount,
+               sizeof threadCount) == sizeof threadCount) {
+         *count += threadCount;
+      }
+   }
+   return TRUE;
+#else
+   return FALSE;
+#endif
+}
+
+
+/**
+ * Samples all the counters.
+ *
+ * @param[out] counters    The current values.
+ */
+
+static void
+TestCostSample(guint64 *counters)
+{
+   struct rusage self;
+   struct rusage children;
+
+   getrusage(RUSAGE_SELF, &self);
+   getrusage(RUSAGE_CHILDREN, &children);
+   counters[COST_CPU_US] =
+      (self.ru_utime.tv_sec + self.ru_stime.tv_sec +
+       children.ru_utime.tv_sec + children.ru_stime.tv_sec) *
+         (guint64) G_USEC_PER_SEC +
+      self.ru_utime.tv_usec + self.ru_stime.tv_usec +
+      children.ru_utime.tv_usec + children.ru_stime.tv_usec;
+   counters[COST_ALLOCS] = Atomic_Read64(&gAllocs);
+   gState.syscallsKnown = TestCostSyscalls(&counters[COST_SYSCALLS]);
+   counters[COST_RPC_BYTES] = Atomic_Read64(&gRpcBytes);
+}
+
+
+/**
+ * Reads the baseline, and compares the results with it.
+ *
+ * @param[in]  results     Per-cycle results.
+ *
+ * @return Whether all the results are within the threshold.
+ */
+
+static gboolean
+TestCostCompare(const guint64 *results)
+{
+   gchar *contents;
+   gchar **lines;
+   gboolean ok = TRUE;
+   GError *err = NULL;
+   guint i;
+
+   if (!g_file_get_contents(gState.baseline, &contents, NULL, &err)) {
+      g_warning("Cannot read baseline: %s\n", err->message);
+      g_clear_error(&err);
+      return FALSE;
+   }
+
+   lines = g_strsplit(contents, "\n", 0);
+   for (i = 0; lines[i] != NULL; i++) {
+      gchar **fields = g_strsplit(g_strstrip(lines[i]), " ", 2);
+      guint j;
+
+      if (fields[0] == NULL || fields[1] == NULL) {
+         g_strfreev(fields);
+         continue;
+      }
+
+      for (j = 0; j < COST_MAX; j++) {
+         guint64 base;
+         guint64 limit;
+
+         if (strcmp(fields[0], gCounters[j].name) != 0 ||
+             (j == COST_SYSCALLS && !gState.syscallsKnown) ||
+             (j == COST_ALLOCS && results[j] == 0)) {
+            continue;
+         }
+
+         base = g_ascii_strtoull(fields[1], NULL, 10);
+         limit = MAX(base + base * gState.threshold / 100,
+                     base + gCounters[j].noise);
+         if (results[j] > limit) {
+            g_warning("%s regressed: %"G_GUINT64_FORMAT" per cycle, baseline "
+                      "%"G_GUINT64_FORMAT", limit %"G_GUINT64_FORMAT".\n",
+                      gCounters[j].name, results[j], base, limit);
+            ok = FALSE;
+         }
+      }
+      g_strfreev(fields);
+   }
+
+   g_strfreev(lines);
+   g_free(contents);
+   return ok;
+}
+
+
+/**
+ * Computes and reports the per-cycle results, and checks them against the
+ * baseline.
+ *
+ * @return Whether the run passed.
+ */
+
+static gboolean
+TestCostReport(void)
+{
+   guint64 now[COST_MAX];
+   guint64 results[COST_MAX];
+   GString *str = g_string_new(NULL);
+   gboolean ok = TRUE;
+   guint i;
+
+   TestCostSample(now);
+   for (i = 0; i < COST_MAX; i++) {
+      if (i == COST_SYSCALLS && !gState.syscallsKnown) {
+         continue;
+      }
+      results[i] = (now[i] - gState.start[i]) / gState.cycles;
+      g_string_append_printf(str, "%s %"G_GUINT64_FORMAT"\n",
+                             gCounters[i].name, results[i]);
+   }
+   if (gState.backup != BACKUP_DISABLED) {
+      g_string_append_printf(str, "backups %u\n", gState.backups);
+   }
+
+   g_message("Per-cycle cost over %u cycles of %u ms:\n%s", gState.cycles,
+             gState.cycleMs, str->str);
+
+   if (gState.results != NULL &&
+       !g_file_set_contents(gState.results, str->str, str->len, NULL)) {
+      g_warning("Cannot write results to %s.\n", gState.results);
+      ok = FALSE;
+   }
+   if (gState.baseline != NULL && !TestCostCompare(results)) {
+      ok = FALSE;
+   }
+
+   g_string_free(str, TRUE);
+   return ok;
+}
+
+
+/**
+ * Accounts the bytes of any message the service sends, and replies with an
+ * empty result.
+ *
+ * @param[in]  data        Incoming data.
+ * @param[in]  dataLen     Size of incoming data.
+ * @param[out] result      Result sent back to the application.
+ * @param[out] resultLen   Length of result.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+TestCostReceive(char *data,
+                size_t dataLen,
+                char **result,
+                size_t *resultLen)
+{
+   Atomic_Add64(&gRpcBytes, dataLen);
+   RpcDebug_SetResult("", result, resultLen);
+   return TRUE;
+}
+
+
+/**
+ * Answers the Namespace DB reads of service discovery: the signal is a
+ * request to publish every second, sent just now.
+ *
+ * @param[in]  data        Incoming data.
+ * @param[in]  dataLen     Size of incoming data.
+ * @param[out] result      Result sent back to the application.
+ * @param[out] resultLen   Length of result.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+TestCostReceiveNsdbGet(char *data,
+                       size_t dataLen,
+                       char **result,
+                       size_t *resultLen)
+{
+   gchar *signal = g_strdup_printf("1000,%"G_GINT64_FORMAT,
+                                   g_get_real_time() / 1000);
+
+   Atomic_Add64(&gRpcBytes, dataLen);
+   RpcDebug_SetResult(signal, result, resultLen);
+   g_free(signal);
+   return TRUE;
+}
+
+
+/**
+ * Follows the progress of the vmbackup operation.
+ *
+ * @param[in]  data        Incoming data.
+ * @param[in]  dataLen     Size of incoming data.
+ * @param[out] result      Result sent back to the application.
+ * @param[out] resultLen   Length of result.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+TestCostReceiveBackupEvent(char *data,
+                           size_t dataLen,
+                           char **result,
+                           size_t *resultLen)
+{
+   unsigned int idx = 0;
+   char *cmd = StrUtil_GetNextToken(&idx, data, " ");
+   char *event = StrUtil_GetNextToken(&idx, data, " ");
+
+   Atomic_Add64(&gRpcBytes, dataLen);
+   if (event == NULL) {
+      /* Nothing to follow. */
+   } else if (strcmp(event, VMBACKUP_EVENT_SNAPSHOT_COMMIT) == 0) {
+      gState.backup = BACKUP_SNAPSHOT;
+   } else if (strcmp(event, VMBACKUP_EVENT_REQUESTOR_DONE) == 0 ||
+              strcmp(event, VMBACKUP_EVENT_REQUESTOR_ERROR) == 0 ||
+              strcmp(event, VMBACKUP_EVENT_REQUESTOR_ABORT) == 0) {
+      if (strcmp(event, VMBACKUP_EVENT_REQUESTOR_DONE) == 0) {
+         gState.backups++;
+      } else {
+         g_warning("Backup ended with %s.\n", event);
+      }
+      gState.backup = BACKUP_IDLE;
+   }
+
+   vm_free(cmd);
+   vm_free(event);
+   RpcDebug_SetResult("", result, resultLen);
+   return TRUE;
+}
+
+
+/**
+ * Turns off the vmbackup cycles when the plugin is not loaded.
+ *
+ * @param[in]  data     RPC request data.
+ * @param[in]  ret      Return value from RPC handler.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+TestCostValidateBackupStart(RpcInData *data,
+                            gboolean ret)
+{
+   if (!ret) {
+      g_debug("vmbackup is not active: %s\n",
+              data->result != NULL ? data->result : "");
+      gState.backup = BACKUP_DISABLED;
+   }
+   return TRUE;
+}
+
+
+/**
+ * Accepts any result, so that the RPCs of plugins which are not loaded
+ * don't fail the run.
+ *
+ * @param[in]  data     Unused.
+ * @param[in]  ret      Unused.
+ *
+ * @return TRUE.
+ */
+
+static gboolean
+TestCostValidateAny(RpcInData *data,
+                    gboolean ret)
+{
+   return TRUE;
+}
+
+
+/**
+ * Sets up the next RPC to inject.
+ *
+ * @param[out] rpcdata     RPC to inject.
+ * @param[in]  message     The message.
+ * @param[in]  validateFn  The validation function.
+ */
+
+static void
+TestCostSetMessage(RpcDebugMsgMapping *rpcdata,
+                   const gchar *message,
+                   RpcDebugValidateFn validateFn)
+{
+   g_free(gState.message);
+   gState.message = g_strdup(message);
+   rpcdata->message = gState.message;
+   rpcdata->messageLen = strlen(message) + 1;
+   rpcdata->validateFn = validateFn;
+   rpcdata->freeMsg = FALSE;
+}
+
+
+/**
+ * Called every 100 ms by the debug channel. Runs the startup RPCs, starts
+ * the measurement after the warm-up, drives vmbackup, and ends the run.
+ *
+ * @param[out] rpcdata     RPC to inject, if any.
+ *
+ * @return FALSE to end the run.
+ */
+
+static gboolean
+TestCostSendNext(RpcDebugMsgMapping *rpcdata)
+{
+   static RpcDebugMsgMapping startup[] = {
+      { "reset", sizeof "reset", TestCostValidateAny, FALSE },
+      { "Capabilities_Register", sizeof "Capabilities_Register",
+        TestCostValidateAny, FALSE },
+      { TESTCOST_SET_OPTION TOOLSOPTION_SYNCTIME_PERIOD " 1",
+        sizeof TESTCOST_SET_OPTION TOOLSOPTION_SYNCTIME_PERIOD " 1",
+        TestCostValidateAny, FALSE },
+      { TESTCOST_SET_OPTION TOOLSOPTION_SYNCTIME " 1",
+        sizeof TESTCOST_SET_OPTION TOOLSOPTION_SYNCTIME " 1",
+        TestCostValidateAny, FALSE },
+      { NULL, 0, NULL, FALSE }
+   };
+   static RpcDebugMsgList startupList = { startup, 0 };
+   gint64 now = g_get_monotonic_time();
+
+   if (RpcDebug_SendNext(rpcdata, &startupList)) {
+      gState.cycleStart = now;
+      return TRUE;
+   }
+
+   if (gState.backup == BACKUP_SNAPSHOT) {
+      gState.backup = BACKUP_RUNNING;
+      TestCostSetMessage(rpcdata, VMBACKUP_PROTOCOL_SNAPSHOT_DONE,
+                         TestCostValidateAny);
+      return TRUE;
+   }
+
+   if (now - gState.cycleStart < gState.cycleMs * (gint64) 1000) {
+      return TRUE;
+   }
+   gState.cycleStart = now;
+   gState.cycle++;
+
+   if (gState.cycle == gState.warmup) {
+      TestCostSample(gState.start);
+      gState.backups = 0;
+   } else if (gState.cycle == gState.warmup + gState.cycles) {
+      if (!TestCostReport()) {
+         VMTOOLSAPP_ERROR(gState.ctx, 1);
+      }
+      return FALSE;
+   }
+
+   if (gState.backup == BACKUP_IDLE) {
+      gState.backup = BACKUP_RUNNING;
+      TestCostSetMessage(rpcdata, VMBACKUP_PROTOCOL_START " 0",
+                         TestCostValidateBackupStart);
+   }
+   return TRUE;
+}
+
+
+/**
+ * Releases the plugin's state.
+ *
+ * @param[in]  ctx      Unused.
+ * @param[in]  plugin   Unused.
+ */
+
+static void
+TestCostShutdown(ToolsAppCtx *ctx,
+                 RpcDebugPlugin *plugin)
+{
+   if (gState.threadCounters != NULL) {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init(&iter, gState.threadCounters);
+      while (g_hash_table_iter_next(&iter, NULL, &value)) {
+         close(GPOINTER_TO_INT(value));
+      }
+      g_hash_table_destroy(gState.threadCounters);
+      gState.threadCounters = NULL;
+   }
+   g_free(gState.message);
+   g_free(gState.results);
+   g_free(gState.baseline);
+}
+
+
+/**
+ * Reads a positive integer from the plugin's config group.
+ *
+ * @param[in]  ctx      The application context.
+ * @param[in]  key      Config key.
+ * @param[in]  dflt     Default value.
+ *
+ * @return The value.
+ */
+
+static guint
+TestCostConfigUint(ToolsAppCtx *ctx,
+                   const gchar *key,
+                   guint dflt)
+{
+   gint value = VMTools_ConfigGetInteger(ctx->config, TESTCOST_CONF_GROUP,
+                                         key, dflt);
+   return value > 0 ? value : dflt;
+}
+
+
+/**
+ * Returns the debug plugin's registration data.
+ *
+ * @param[in]  ctx      The application context.
+ *
+ * @return The application data.
+ */
+
+TOOLS_MODULE_EXPORT RpcDebugPlugin *
+RpcDebugOnLoad(ToolsAppCtx *ctx)
+{
+   static RpcDebugRecvMapping recvFns[] = {
+      { TESTCOST_NSDB_GET, TestCostReceiveNsdbGet, NULL, 0 },
+      { VMBACKUP_PROTOCOL_EVENT_SET, TestCostReceiveBackupEvent, NULL, 0 },
+      { NULL, NULL }
+   };
+   static ToolsPluginData pluginData = {
+      "testCost",
+      NULL,
+      NULL,
+      NULL,
+   };
+   static RpcDebugPlugin regData = {
+      recvFns,
+      TestCostReceive,
+      TestCostSendNext,
+      TestCostShutdown,
+      &pluginData,
+   };
+
+   gState.ctx = ctx;
+   gState.cycles = TestCostConfigUint(ctx, "cycles", TESTCOST_DEFAULT_CYCLES);
+   gState.cycleMs = TestCostConfigUint(ctx, "cycle-ms",
+                                       TESTCOST_DEFAULT_CYCLE_MS);
+   gState.warmup = TestCostConfigUint(ctx, "warmup", TESTCOST_DEFAULT_WARMUP);
+   gState.threshold = TestCostConfigUint(ctx, "threshold",
+                                         TESTCOST_DEFAULT_THRESHOLD);
+   gState.results = VMTools_ConfigGetString(ctx->config, TESTCOST_CONF_GROUP,
+                                            "results", NULL);
+   gState.baseline = VMTools_ConfigGetString(ctx->config, TESTCOST_CONF_GROUP,
+                                             "baseline", NULL);
+   gState.threadCounters = g_hash_table_new(NULL, NULL);
+   gState.syscallEvent = TestCostSyscallEvent();
+   gState.backup = BACKUP_IDLE;
+
+   return &regData;
+}
@@ -0,0 +1,1247 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsServerBench.c --
+ *
+ *   Benchmark for the HGFS server without a hypervisor. The server is
+ *   driven through a loopback channel which hands request packets straight
+ *   to the session receive callback and collects the reply in the send
+ *   callback, the same way the guest backdoor channel does, and replays
+ *   synthetic workloads against a temporary directory.
+ *
+ *   Every request is timed and each workload reports requests per second
+ *   and latency percentiles.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "vmware.h"
+#include "hostinfo.h"
+#include "str.h"
+#include "util.h"
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerPolicy.h"
+
+#define HGFS_BENCH_REQ_PAYLOAD(bench) ((bench)->request + sizeof (HgfsHeader))
+
+#define HGFS_BENCH_DEFAULT_FILES     1000
+#define HGFS_BENCH_DEFAULT_SIZE_MB   256
+#define HGFS_BENCH_SMALL_FILE_SIZE   1024
+#define HGFS_BENCH_ENUM_DEPTH        4
+#define HGFS_BENCH_ENUM_FANOUT       4
+#define HGFS_BENCH_ENUM_FILES        32
+
+typedef struct HgfsBench {
+   const HgfsServerCallbacks *serverCb;
+   HgfsServerChannelCallbacks channelCb;
+   void *transportSession;
+   uint64 sessionId;
+   uint32 requestId;
+   size_t replySize;                       /* Set by the send callback. */
+
+   char root[PATH_MAX];                    /* Local temp directory. */
+   VmTimeType start;                       /* Start of the measurement. */
+   unsigned int numFiles;
+   unsigned int sizeMB;
+
+   /* Request latencies of the running workload, in microseconds. */
+   VmTimeType *samples;
+   size_t numSamples;
+   size_t maxSamples;
+
+   char request[HGFS_LARGE_PACKET_MAX];
+   char reply[HGFS_LARGE_PACKET_MAX];
+} HgfsBench;
+
+typedef Bool (*HgfsBenchWorkload)(HgfsBench *bench,
+                                  uint64 *bytes);
+
+static HgfsBench gBench;
+
+static void HgfsBenchExit(HgfsBench *bench);
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchSend --
+ *
+ *    Channel send callback, called by the server with the reply to the
+ *    request being dispatched.
+ *
+ * Results:
+ *    Always TRUE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchSend(void *transportData,   // IN: our bench state
+              HgfsPacket *packet,    // IN/OUT: packet with the reply
+              HgfsSendFlags flags)   // IN: send flags
+{
+   HgfsBench *bench = transportData;
+
+   bench->replySize = packet->replyPacketDataSize;
+   if (!(flags & HGFS_SEND_NO_COMPLETE)) {
+      bench->serverCb->session.sendComplete(packet, bench->transportSession);
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRecord --
+ *
+ *    Add one latency sample to the running workload.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    May grow the sample array.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchRecord(HgfsBench *bench,      // IN/OUT: bench state
+                VmTimeType elapsed)    // IN: request latency (us)
+{
+   if (bench->numSamples == bench->maxSamples) {
+      bench->maxSamples = MAX(bench->maxSamples * 2, 1024);
+      bench->samples = Util_SafeRealloc(bench->samples,
+                                        bench->maxSamples * sizeof *bench->samples);
+   }
+   bench->samples[bench->numSamples++] = elapsed;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchDispatch --
+ *
+ *    Fill in the header of the request built in bench->request and run it
+ *    through the server synchronously.
+ *
+ * Results:
+ *    The status of the reply and a pointer to the reply payload.
+ *
+ * Side effects:
+ *    Records the latency of the request.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchDispatch(HgfsBench *bench,      // IN/OUT: bench state
+                  HgfsOp op,             // IN: request opcode
+                  size_t payloadSize,    // IN: size of the request payload
+                  void **replyPayload)   // OUT/OPT: reply payload
+{
+   HgfsHeader *header = (HgfsHeader *)bench->request;
+   const HgfsHeader *replyHeader = (const HgfsHeader *)bench->reply;
+   HgfsPacket packet;
+   VmTimeType start;
+
+   ASSERT(sizeof *header + payloadSize <= sizeof bench->request);
+
+   header->version = HGFS_HEADER_VERSION;
+   memset(header->reserved1, 0, sizeof header->reserved1);
+   header->dummy = HGFS_OP_NEW_HEADER;
+   header->packetSize = sizeof *header + payloadSize;
+   header->headerSize = sizeof *header;
+   header->requestId = bench->requestId++;
+   header->op = op;
+   header->status = 0;
+   header->flags = HGFS_PACKET_FLAG_REQUEST;
+   header->information = 0;
+   header->sessionId = bench->sessionId;
+   header->reserved = 0;
+
+   memset(&packet, 0, sizeof packet);
+   packet.iov[0].va = bench->request;
+   packet.iov[0].len = header->packetSize;
+   packet.iovCount = 1;
+   packet.metaPacket = bench->request;
+   packet.metaPacketDataSize = header->packetSize;
+   packet.metaPacketSize = header->packetSize;
+   packet.replyPacket = bench->reply;
+   packet.replyPacketSize = sizeof bench->reply;
+   packet.state |= HGFS_STATE_CLIENT_REQUEST;
+
+   bench->replySize = 0;
+   start = Hostinfo_SystemTimerUS();
+   bench->serverCb->session.receive(&packet, bench->transportSession);
+   HgfsBenchRecord(bench, Hostinfo_SystemTimerUS() - start);
+
+   if (bench->replySize < sizeof *replyHeader ||
+       replyHeader->headerSize > bench->replySize) {
+      return HGFS_STATUS_PROTOCOL_ERROR;
+   }
+   if (replyPayload != NULL) {
+      *replyPayload = bench->reply + replyHeader->headerSize;
+   }
+
+   return replyHeader->status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchPackName --
+ *
+ *    Fill in a file name for a path relative to the temp directory. The
+ *    guest policy exports the whole file system as the "root" share, so the
+ *    name is the share name followed by the local path in CPName form.
+ *
+ * Results:
+ *    The size of the name, not counting the terminating NUL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static size_t
+HgfsBenchPackName(HgfsBench *bench,         // IN: bench state
+                  const char *relPath,      // IN: path relative to root
+                  HgfsCaseType caseType,    // IN: lookup case type
+                  HgfsFileNameV3 *name)     // OUT: file name
+{
+   int len;
+   int i;
+
+   len = Str_Snprintf(name->name, PATH_MAX, "%s%s%s%s",
+                      HGFS_SERVER_POLICY_ROOT_SHARE_NAME, bench->root,
+                      *relPath != '\0' ? "/" : "", relPath);
+   VERIFY(len > 0);
+
+   for (i = 0; i < len; i++) {
+      if (name->name[i] == '/') {
+         name->name[i] = '\0';
+      }
+   }
+
+   name->length = len;
+   name->flags = 0;
+   name->caseType = caseType;
+   name->fid = HGFS_INVALID_HANDLE;
+
+   return len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCreateSession --
+ * HgfsBenchDestroySession --
+ *
+ *    Create and destroy the session all workloads run in.
+ *
+ * Results:
+ *    HGFS status of the reply.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchCreateSession(HgfsBench *bench)   // IN/OUT: bench state
+{
+   HgfsRequestCreateSessionV4 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsReplyCreateSessionV4 *reply;
+   HgfsStatus status;
+
+   memset(request, 0, sizeof *request);
+   request->numCapabilities = 0;
+   request->maxPacketSize = HGFS_LARGE_PACKET_MAX;
+
+   bench->sessionId = HGFS_INVALID_SESSION_ID;
+   status = HgfsBenchDispatch(bench, HGFS_OP_CREATE_SESSION_V4,
+                              sizeof *request, (void **)&reply);
+   if (status == HGFS_STATUS_SUCCESS) {
+      bench->sessionId = reply->sessionId;
+   }
+
+   return status;
+}
+
+
+static HgfsStatus
+HgfsBenchDestroySession(HgfsBench *bench)   // IN/OUT: bench state
+{
+   HgfsRequestDestroySessionV4 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+
+   request->reserved = 0;
+
+   return HgfsBenchDispatch(bench, HGFS_OP_DESTROY_SESSION_V4,
+                            sizeof *request, NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchOpen --
+ *
+ *    Open or create a file.
+ *
+ * Results:
+ *    HGFS status of the reply and the handle on success.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchOpen(HgfsBench *bench,       // IN/OUT: bench state
+              const char *relPath,    // IN: file to open
+              HgfsOpenMode mode,      // IN: access mode
+              HgfsOpenFlags flags,    // IN: open flags
+              HgfsHandle *file)       // OUT: file handle
+{
+   HgfsRequestOpenV3 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsReplyOpenV3 *reply;
+   HgfsStatus status;
+   size_t nameLen;
+
+   memset(request, 0, sizeof *request);
+   request->mask = HGFS_OPEN_VALID_MODE | HGFS_OPEN_VALID_FLAGS |
+                   HGFS_OPEN_VALID_OWNER_PERMS | HGFS_OPEN_VALID_FILE_NAME;
+   request->mode = mode;
+   request->flags = flags;
+   request->ownerPerms = HGFS_PERM_READ | HGFS_PERM_WRITE;
+   nameLen = HgfsBenchPackName(bench, relPath, HGFS_FILE_NAME_CASE_SENSITIVE,
+                               &request->fileName);
+
+   status = HgfsBenchDispatch(bench, HGFS_OP_OPEN_V3,
+                              sizeof *request + nameLen, (void **)&reply);
+   if (status == HGFS_STATUS_SUCCESS) {
+      *file = reply->file;
+   }
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchClose --
+ *
+ *    Close a file.
+ *
+ * Results:
+ *    HGFS status of the reply.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchClose(HgfsBench *bench,   // IN/OUT: bench state
+               HgfsHandle file)    // IN: file handle
+{
+   HgfsRequestCloseV3 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+
+   request->file = file;
+   request->reserved = 0;
+
+   return HgfsBenchDispatch(bench, HGFS_OP_CLOSE_V3, sizeof *request, NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchWrite --
+ *
+ *    Write size bytes at offset. The data is whatever is in the request
+ *    buffer, the benchmark does not care about file contents.
+ *
+ * Results:
+ *    HGFS status of the reply and the number of bytes written.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchWrite(HgfsBench *bench,     // IN/OUT: bench state
+               HgfsHandle file,      // IN: file handle
+               uint64 offset,        // IN: file offset
+               uint32 size,          // IN: bytes to write
+               uint32 *written)      // OUT: bytes written
+{
+   HgfsRequestWriteV3 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsReplyWriteV3 *reply;
+   HgfsStatus status;
+
+   request->file = file;
+   request->flags = 0;
+   request->offset = offset;
+   request->requiredSize = size;
+   request->reserved = 0;
+
+   status = HgfsBenchDispatch(bench, HGFS_OP_WRITE_V3,
+                              offsetof(HgfsRequestWriteV3, payload) + size,
+                              (void **)&reply);
+   *written = status == HGFS_STATUS_SUCCESS ? reply->actualSize : 0;
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRead --
+ *
+ *    Read up to size bytes at offset.
+ *
+ * Results:
+ *    HGFS status of the reply and the number of bytes read.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchRead(HgfsBench *bench,     // IN/OUT: bench state
+              HgfsHandle file,      // IN: file handle
+              uint64 offset,        // IN: file offset
+              uint32 size,          // IN: bytes to read
+              uint32 *bytesRead)    // OUT: bytes read
+{
+   HgfsRequestReadV3 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsReplyReadV3 *reply;
+   HgfsStatus status;
+
+   request->file = file;
+   request->offset = offset;
+   request->requiredSize = size;
+   request->reserved = 0;
+
+   status = HgfsBenchDispatch(bench, HGFS_OP_READ_V3, sizeof *request,
+                              (void **)&reply);
+   *bytesRead = status == HGFS_STATUS_SUCCESS ? reply->actualSize : 0;
+
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchGetattr --
+ *
+ *    Look up the attributes of a file by name.
+ *
+ * Results:
+ *    HGFS status of the reply.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsBenchGetattr(HgfsBench *bench,         // IN/OUT: bench state
+                 const char *relPath,      // IN: file to look up
+                 HgfsCaseType caseType)    // IN: lookup case type
+{
+   HgfsRequestGetattrV3 *request = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   size_t nameLen;
+
+   request->hints = 0;
+   request->reserved = 0;
+   nameLen = HgfsBenchPackName(bench, relPath, caseType, &request->fileName);
+
+   return HgfsBenchDispatch(bench, HGFS_OP_GETATTR_V3,
+                            sizeof *request + nameLen, NULL);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchEnumDir --
+ *
+ *    Enumerate a directory entry by entry and recurse into the directories
+ *    found.
+ *
+ * Results:
+ *    TRUE on success, FALSE if any request failed.
+ *
+ * Side effects:
+ *    Adds the number of entries seen to numEntries.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchEnumDir(HgfsBench *bench,          // IN/OUT: bench state
+                 const char *relPath,       // IN: directory to enumerate
+                 uint64 *numEntries)        // IN/OUT: entries seen
+{
+   HgfsRequestSearchOpenV3 *openRequest = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsRequestSearchReadV3 *readRequest = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsRequestSearchCloseV3 *closeRequest = (void *)HGFS_BENCH_REQ_PAYLOAD(bench);
+   HgfsReplySearchOpenV3 *openReply;
+   HgfsReplySearchReadV3 *readReply;
+   char **subDirs = NULL;
+   size_t numSubDirs = 0;
+   HgfsHandle search;
+   uint32 offset;
+   Bool success = TRUE;
+   size_t nameLen;
+   size_t i;
+
+   openRequest->reserved = 0;
+   nameLen = HgfsBenchPackName(bench, relPath, HGFS_FILE_NAME_CASE_SENSITIVE,
+                               &openRequest->dirName);
+   if (HgfsBenchDispatch(bench, HGFS_OP_SEARCH_OPEN_V3,
+                         sizeof *openRequest + nameLen,
+                         (void **)&openReply) != HGFS_STATUS_SUCCESS) {
+      return FALSE;
+   }
+   search = openReply->search;
+
+   for (offset = 0; ; offset++) {
+      const HgfsDirEntry *entry;
+      char name[PATH_MAX];
+
+      readRequest->search = search;
+      readRequest->offset = offset;
+      readRequest->flags = 0;
+      readRequest->reserved = 0;
+      if (HgfsBenchDispatch(bench, HGFS_OP_SEARCH_READ_V3, sizeof *readRequest,
+                            (void **)&readReply) != HGFS_STATUS_SUCCESS) {
+         success = FALSE;
+         break;
+      }
+
+      entry = (const HgfsDirEntry *)readReply->payload;
+      if (readReply->count == 0 || entry->fileName.length == 0) {
+         break;
+      }
+
+      (*numEntries)++;
+      if (entry->attr.type != HGFS_FILE_TYPE_DIRECTORY ||
+          entry->fileName.length >= sizeof name) {
+         continue;
+      }
+      memcpy(name, entry->fileName.name, entry->fileName.length);
+      name[entry->fileName.length] = '\0';
+      if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+         continue;
+      }
+
+      subDirs = Util_SafeRealloc(subDirs, (numSubDirs + 1) * sizeof *subDirs);
+      subDirs[numSubDirs++] = Str_SafeAsprintf(NULL, "%s%s%s", relPath,
+                                               *relPath != '\0' ? "/" : "",
+                                               name);
+   }
+
+   closeRequest->search = search;
+   closeRequest->reserved = 0;
+   if (HgfsBenchDispatch(bench, HGFS_OP_SEARCH_CLOSE_V3, sizeof *closeRequest,
+                         NULL) != HGFS_STATUS_SUCCESS) {
+      success = FALSE;
+   }
+
+   for (i = 0; i < numSubDirs; i++) {
+      if (success) {
+         success = HgfsBenchEnumDir(bench, subDirs[i], numEntries);
+      }
+      free(subDirs[i]);
+   }
+   free(subDirs);
+
+   return success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchMakeFile --
+ *
+ *    Create an empty file directly, used to set up the workloads.
+ *
+ * Results:
+ *    TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchMakeFile(const char *path)   // IN: file to create
+{
+   int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+
+   if (fd < 0) {
+      fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+      return FALSE;
+   }
+   close(fd);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchMakeTree --
+ *
+ *    Create a directory tree of the given depth, each directory holding
+ *    HGFS_BENCH_ENUM_FANOUT directories and HGFS_BENCH_ENUM_FILES files.
+ *
+ * Results:
+ *    TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchMakeTree(const char *path,     // IN: directory to create
+                  unsigned int depth)   // IN: levels below it
+{
+   char child[PATH_MAX];
+   unsigned int i;
+
+   if (mkdir(path, 0755) != 0) {
+      fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+      return FALSE;
+   }
+
+   for (i = 0; i < HGFS_BENCH_ENUM_FILES; i++) {
+      Str_Snprintf(child, sizeof child, "%s/file%02u", path, i);
+      if (!HgfsBenchMakeFile(child)) {
+         return FALSE;
+      }
+   }
+
+   if (depth > 0) {
+      for (i = 0; i < HGFS_BENCH_ENUM_FANOUT; i++) {
+         Str_Snprintf(child, sizeof child, "%s/dir%02u", path, i);
+         if (!HgfsBenchMakeTree(child, depth - 1)) {
+            return FALSE;
+         }
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCreateStorm --
+ *
+ *    Create, write and close many small files in one directory.
+ *
+ * Results:
+ *    TRUE on success, FALSE if any request failed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchCreateStorm(HgfsBench *bench,   // IN/OUT: bench state
+                     uint64 *bytes)      // OUT: bytes transferred
+{
+   char path[PATH_MAX];
+   unsigned int i;
+
+   Str_Snprintf(path, sizeof path, "%s/create", bench->root);
+   if (mkdir(path, 0755) != 0) {
+      fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+      return FALSE;
+   }
+
+   for (i = 0; i < bench->numFiles; i++) {
+      HgfsHandle file;
+      uint32 written;
+
+      Str_Snprintf(path, sizeof path, "create/f%06u", i);
+      if (HgfsBenchOpen(bench, path, HGFS_OPEN_MODE_WRITE_ONLY,
+                        HGFS_OPEN_CREATE_EMPTY, &file) != HGFS_STATUS_SUCCESS) {
+         return FALSE;
+      }
+      if (HgfsBenchWrite(bench, file, 0, HGFS_BENCH_SMALL_FILE_SIZE,
+                         &written) != HGFS_STATUS_SUCCESS) {
+         HgfsBenchClose(bench, file);
+         return FALSE;
+      }
+      *bytes += written;
+      if (HgfsBenchClose(bench, file) != HGFS_STATUS_SUCCESS) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchSeqWrite --
+ * HgfsBenchSeqRead --
+ *
+ *    Write a large file sequentially with the largest I/O size, then read
+ *    it back the same way.
+ *
+ * Results:
+ *    TRUE on success, FALSE if any request failed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchSeqWrite(HgfsBench *bench,   // IN/OUT: bench state
+                  uint64 *bytes)      // OUT: bytes transferred
+{
+   uint64 total = (uint64)bench->sizeMB * 1024 * 1024;
+   HgfsHandle file;
+   Bool success = TRUE;
+
+   if (HgfsBenchOpen(bench, "seqio", HGFS_OPEN_MODE_WRITE_ONLY,
+                     HGFS_OPEN_CREATE_EMPTY, &file) != HGFS_STATUS_SUCCESS) {
+      return FALSE;
+   }
+
+   while (*bytes < total) {
+      uint32 size = (uint32)MIN(total - *bytes, HGFS_LARGE_IO_MAX);
+      uint32 written;
+
+      if (HgfsBenchWrite(bench, file, *bytes, size,
+                         &written) != HGFS_STATUS_SUCCESS || written == 0) {
+         success = FALSE;
+         break;
+      }
+      *bytes += written;
+   }
+
+   return HgfsBenchClose(bench, file) == HGFS_STATUS_SUCCESS && success;
+}
+
+
+static Bool
+HgfsBenchSeqRead(HgfsBench *bench,   // IN/OUT: bench state
+                 uint64 *bytes)      // OUT: bytes transferred
+{
+   HgfsHandle file;
+   Bool success = TRUE;
+
+   if (HgfsBenchOpen(bench, "seqio", HGFS_OPEN_MODE_READ_ONLY,
+                     HGFS_OPEN, &file) != HGFS_STATUS_SUCCESS) {
+      return FALSE;
+   }
+
+   for (;;) {
+      uint32 bytesRead;
+
+      if (HgfsBenchRead(bench, file, *bytes, HGFS_LARGE_IO_MAX,
+                        &bytesRead) != HGFS_STATUS_SUCCESS) {
+         success = FALSE;
+         break;
+      }
+      if (bytesRead == 0) {
+         break;
+      }
+      *bytes += bytesRead;
+   }
+
+   return HgfsBenchClose(bench, file) == HGFS_STATUS_SUCCESS && success;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchEnumerate --
+ *
+ *    Enumerate a deep directory tree.
+ *
+ * Results:
+ *    TRUE on success, FALSE if any request failed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchEnumerate(HgfsBench *bench,   // IN/OUT: bench state
+                   uint64 *bytes)      // OUT: bytes transferred
+{
+   char path[PATH_MAX];
+   uint64 numEntries = 0;
+
+   Str_Snprintf(path, sizeof path, "%s/enum", bench->root);
+   if (!HgfsBenchMakeTree(path, HGFS_BENCH_ENUM_DEPTH)) {
+      return FALSE;
+   }
+
+   /* Setup is not part of the measurement. */
+   bench->numSamples = 0;
+   bench->start = Hostinfo_SystemTimerUS();
+
+   if (!HgfsBenchEnumDir(bench, "enum", &numEntries)) {
+      return FALSE;
+   }
+   printf("  %"FMT64"u directory entries\n", numEntries);
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchLookup --
+ *
+ *    Look up files by name with a different case than they were created
+ *    with, so that every lookup goes through the case-insensitive search
+ *    of the directory.
+ *
+ * Results:
+ *    TRUE on success, FALSE if any request failed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchLookup(HgfsBench *bench,   // IN/OUT: bench state
+                uint64 *bytes)      // OUT: bytes transferred
+{
+   char path[PATH_MAX];
+   unsigned int i;
+
+   Str_Snprintf(path, sizeof path, "%s/lookup", bench->root);
+   if (mkdir(path, 0755) != 0) {
+      fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+      return FALSE;
+   }
+   for (i = 0; i < bench->numFiles; i++) {
+      Str_Snprintf(path, sizeof path, "%s/lookup/File%06u", bench->root, i);
+      if (!HgfsBenchMakeFile(path)) {
+         return FALSE;
+      }
+   }
+
+   /* Setup is not part of the measurement. */
+   bench->numSamples = 0;
+   bench->start = Hostinfo_SystemTimerUS();
+
+   for (i = 0; i < bench->numFiles; i++) {
+      Str_Snprintf(path, sizeof path, "lookup/FILE%06u", i);
+      if (HgfsBenchGetattr(bench, path,
+                           HGFS_FILE_NAME_CASE_INSENSITIVE) != HGFS_STATUS_SUCCESS) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchCompareSamples --
+ *
+ *    qsort comparison for latency samples.
+ *
+ * Results:
+ *    <0, 0 or >0 as for qsort.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsBenchCompareSamples(const void *a,   // IN
+                        const void *b)   // IN
+{
+   VmTimeType x = *(const VmTimeType *)a;
+   VmTimeType y = *(const VmTimeType *)b;
+
+   return x < y ? -1 : x > y;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchReport --
+ *
+ *    Print rates and latency percentiles for a finished workload.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Sorts the samples.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchReport(HgfsBench *bench,      // IN/OUT: bench state
+                const char *name,      // IN: workload name
+                VmTimeType elapsed,    // IN: wall time of the workload (us)
+                uint64 bytes)          // IN: bytes transferred
+{
+   size_t n = bench->numSamples;
+   double seconds = MAX(elapsed, 1) / 1000000.0;
+
+   if (n == 0) {
+      printf("%-10s no requests\n", name);
+      return;
+   }
+
+   qsort(bench->samples, n, sizeof *bench->samples, HgfsBenchCompareSamples);
+
+   printf("%-10s %8"FMTSZ"u reqs %10.0f reqs/s", name, n, n / seconds);
+   if (bytes != 0) {
+      printf(" %8.1f MB/s", bytes / seconds / (1024 * 1024));
+   }
+   printf("  p50 %"FMT64"u p90 %"FMT64"u p99 %"FMT64"u max %"FMT64"u us\n",
+          bench->samples[n / 2], bench->samples[n * 90 / 100],
+          bench->samples[n * 99 / 100], bench->samples[n - 1]);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchRemove --
+ *
+ *    nftw callback removing the temp directory.
+ *
+ * Results:
+ *    Always 0 so that the walk continues.
+ *
+ * Side effects:
+ *    Removes path.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+HgfsBenchRemove(const char *path,          // IN
+                const struct stat *sb,     // IN: unused
+                int typeflag,              // IN: unused
+                struct FTW *ftwbuf)        // IN: unused
+{
+   if (remove(path) != 0) {
+      fprintf(stderr, "Cannot remove %s: %s\n", path, strerror(errno));
+   }
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchInit --
+ * HgfsBenchExit --
+ *
+ *    Bring up the server and connect the loopback channel, and tear them
+ *    down again.
+ *
+ * Results:
+ *    HgfsBenchInit returns TRUE on success, FALSE otherwise, in which case
+ *    nothing is left to tear down.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsBenchInit(HgfsBench *bench)   // IN/OUT: bench state
+{
+   static HgfsServerMgrCallbacks mgrCb;
+   /* The guest policy only exports the root share. */
+   static HgfsServerConfig config = {
+      HGFS_CONFIG_SHARE_ALL_HOST_DRIVES_ENABLED,
+      HGFS_MAX_CACHED_FILENODES
+   };
+   static HgfsServerChannelData capData = {
+      0,
+      HGFS_LARGE_PACKET_MAX
+   };
+
+   if (!HgfsServerPolicy_Init(NULL, &mgrCb.enumResources)) {
+      fprintf(stderr, "Cannot initialize the server policy\n");
+      return FALSE;
+   }
+
+   if (!HgfsServer_InitState(&bench->serverCb, &config, &mgrCb)) {
+      fprintf(stderr, "Cannot initialize the server\n");
+      HgfsServerPolicy_Cleanup();
+      return FALSE;
+   }
+
+   bench->channelCb.getReadVa = NULL;
+   bench->channelCb.getWriteVa = NULL;
+   bench->channelCb.putVa = NULL;
+   bench->channelCb.send = HgfsBenchSend;
+   if (!bench->serverCb->session.connect(bench, &bench->channelCb, &capData,
+                                         &bench->transportSession)) {
+      fprintf(stderr, "Cannot connect to the server\n");
+      HgfsServer_ExitState();
+      HgfsServerPolicy_Cleanup();
+      return FALSE;
+   }
+
+   if (HgfsBenchCreateSession(bench) != HGFS_STATUS_SUCCESS) {
+      fprintf(stderr, "Cannot create a session\n");
+      HgfsBenchExit(bench);
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+static void
+HgfsBenchExit(HgfsBench *bench)   // IN/OUT: bench state
+{
+   if (bench->sessionId != HGFS_INVALID_SESSION_ID) {
+      HgfsBenchDestroySession(bench);
+   }
+   if (bench->transportSession != NULL) {
+      bench->serverCb->session.disconnect(bench->transportSession);
+      bench->serverCb->session.close(bench->transportSession);
+      bench->transportSession = NULL;
+   }
+   HgfsServer_ExitState();
+   HgfsServerPolicy_Cleanup();
+   free(bench->samples);
+   bench->samples = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsBenchUsage --
+ *
+ *    Print the usage message.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsBenchUsage(const char *prog)   // IN: program name
+{
+   fprintf(stderr,
+           "Usage: %s [-d dir] [-n files] [-s MB] [workload ...]\n"
+           "  -d dir    directory to create the temp directory in (/tmp)\n"
+           "  -n files  files for the create and lookup workloads (%u)\n"
+           "  -s MB     file size for the sequential workloads (%u)\n"
+           "Workloads: create seqwrite seqread enum lookup (default all)\n",
+           prog, HGFS_BENCH_DEFAULT_FILES, HGFS_BENCH_DEFAULT_SIZE_MB);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Run the selected workloads in a fresh temp directory which is removed
+ *    afterwards.
+ *
+ * Results:
+ *    0 if all workloads succeeded, 1 otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,       // IN
+     char *argv[])   // IN
+{
+   static const struct {
+      const char *name;
+      HgfsBenchWorkload run;
+   } workloads[] = {
+      { "create",   HgfsBenchCreateStorm },
+      { "seqwrite", HgfsBenchSeqWrite },
+      { "seqread",  HgfsBenchSeqRead },
+      { "enum",     HgfsBenchEnumerate },
+      { "lookup",   HgfsBenchLookup },
+   };
+   HgfsBench *bench = &gBench;
+   const char *dir = "/tmp";
+   Bool ran[ARRAYSIZE(workloads)] = { FALSE };
+   Bool wanted[ARRAYSIZE(workloads)] = { FALSE };
+   Bool any = FALSE;
+   int result = 0;
+   unsigned int i;
+   int opt;
+
+   bench->numFiles = HGFS_BENCH_DEFAULT_FILES;
+   bench->sizeMB = HGFS_BENCH_DEFAULT_SIZE_MB;
+
+   while ((opt = getopt(argc, argv, "d:n:s:h")) != -1) {
+      switch (opt) {
+      case 'd':
+         dir = optarg;
+         break;
+      case 'n':
+         bench->numFiles = strtoul(optarg, NULL, 0);
+         break;
+      case 's':
+         bench->sizeMB = strtoul(optarg, NULL, 0);
+         break;
+      default:
+         HgfsBenchUsage(argv[0]);
+         return 1;
+      }
+   }
+
+   for (; optind < argc; optind++) {
+      for (i = 0; i < ARRAYSIZE(workloads); i++) {
+         if (strcmp(argv[optind], workloads[i].name) == 0) {
+            wanted[i] = any = TRUE;
+            break;
+         }
+      }
+      if (i == ARRAYSIZE(workloads)) {
+         HgfsBenchUsage(argv[0]);
+         return 1;
+      }
+   }
+   if (!any) {
+      for (i = 0; i < ARRAYSIZE(workloads); i++) {
+         wanted[i] = TRUE;
+      }
+   }
+
+   Str_Snprintf(bench->root, sizeof bench->root, "%s/hgfsbench.XXXXXX", dir);
+   if (mkdtemp(bench->root) == NULL) {
+      fprintf(stderr, "Cannot create a directory in %s: %s\n", dir,
+              strerror(errno));
+      return 1;
+   }
+
+   if (!HgfsBenchInit(bench)) {
+      nftw(bench->root, HgfsBenchRemove, 16, FTW_DEPTH | FTW_PHYS);
+      return 1;
+   }
+
+   for (i = 0; i < ARRAYSIZE(workloads); i++) {
+      uint64 bytes = 0;
+
+      if (!wanted[i]) {
+         continue;
+      }
+      /* Reading needs the file written by the write workload. */
+      if (workloads[i].run == HgfsBenchSeqRead && !ran[i - 1]) {
+         fprintf(stderr, "seqread needs seqwrite\n");
+         result = 1;
+         continue;
+      }
+
+      bench->numSamples = 0;
+      bench->start = Hostinfo_SystemTimerUS();
+      if (!workloads[i].run(bench, &bytes)) {
+         fprintf(stderr, "%s: request failed\n", workloads[i].name);
+         result = 1;
+         continue;
+      }
+      HgfsBenchReport(bench, workloads[i].name,
+                      Hostinfo_SystemTimerUS() - bench->start, bytes);
+      ran[i] = TRUE;
+   }
+
+   HgfsBenchExit(bench);
+   nftw(bench->root, HgfsBenchRemove, 16, FTW_DEPTH | FTW_PHYS);
+
+   return result;
+}
@@ -0,0 +1,1040 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * hgfsServerTest.c --
+ *
+ *   Tests of the HGFS server without a hypervisor:
+ *
+ *   - share-cap: a share capped with HgfsServer_SetShareLimits. Items
+ *     queued on its flow must be spread over the time its budget allows,
+ *     while the items of an uncapped share queued with them run at once.
+ *     Once the cap is lifted, its items run at once too.
+ *
+ *   - compound: open + getattr + read + close of a file in a temp directory
+ *     sent as one compound request through a loopback channel, the members
+ *     after the open using its handle. A compound whose open fails
+ *     must stop there when asked to stop on errors.
+ *
+ *   - async: getattrs on the loopback channel, which is asynchronous like
+ *     the guest backdoor channel, must run in the threadpool and have their
+ *     reply by the time the dispatch returns.
+ *
+ *   The program prints one line per test and exits with 1 if any failed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "vmware.h"
+#include "hostinfo.h"
+#include "str.h"
+#include "hgfsProto.h"
+#include "hgfsServer.h"
+#include "hgfsServerPolicy.h"
+#include "hgfsThreadpool.h"
+
+#define HGFS_TEST_CAP_SHARE     "capped"
+#define HGFS_TEST_FREE_SHARE    "free"
+#define HGFS_TEST_CAP_BYTES     (1024 * 1024)   /* Per second */
+#define HGFS_TEST_ITEM_BYTES    (128 * 1024)
+#define HGFS_TEST_CAP_ITEMS     8
+#define HGFS_TEST_FREE_ITEMS    16
+
+/* Scheduling noise allowed on top of the time the cap imposes. */
+#define HGFS_TEST_TOLERANCE_US  (100 * 1000)
+
+/* How long to wait for queued items before giving up. */
+#define HGFS_TEST_TIMEOUT_S     10
+
+#define HGFS_TEST_FILE          "data"
+#define HGFS_TEST_FILE_SIZE     100
+
+typedef struct HgfsTestItem {
+   VmTimeType doneAt;    /* Microseconds since the items were queued. */
+} HgfsTestItem;
+
+/* Loopback channel, see HgfsTestDispatch. */
+typedef struct HgfsTestChannel {
+   HgfsServerChannelCallbacks channelCb;
+   void *transportSession;
+   uint64 sessionId;
+   uint32 requestId;
+   size_t replySize;                       /* Set by the send callback. */
+   Bool replyPending;                      /* Cleared by the send callback. */
+   Bool replyAsync;                        /* Last request ran in the pool. */
+   char root[PATH_MAX];                    /* Temp directory of the files. */
+   char request[HGFS_LARGE_PACKET_MAX];
+   char reply[HGFS_LARGE_PACKET_MAX];
+} HgfsTestChannel;
+
+static const HgfsServerCallbacks *gServerCb;
+static HgfsTestChannel gChannel;
+
+static pthread_mutex_t gMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gCond = PTHREAD_COND_INITIALIZER;
+static unsigned int gDone;
+static VmTimeType gStart;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestWorkItem --
+ *
+ *    Threadpool work item, records when it ran.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Wakes up HgfsTestWait.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+HgfsTestWorkItem(void *data)   // IN: HgfsTestItem
+{
+   HgfsTestItem *item = data;
+
+   pthread_mutex_lock(&gMutex);
+   item->doneAt = Hostinfo_SystemTimerUS() - gStart;
+   gDone++;
+   pthread_cond_signal(&gCond);
+   pthread_mutex_unlock(&gMutex);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestQueue --
+ *
+ *    Queue items of HGFS_TEST_ITEM_BYTES each on the flow of a session and
+ *    a share.
+ *
+ * Results:
+ *    TRUE if all were queued.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestQueue(HgfsTestItem *items,       // IN: items to queue
+              unsigned int numItems,     // IN
+              uint64 sessionId,          // IN
+              const char *shareName)     // IN
+{
+   HgfsThreadpoolSchedInfo sched = { 0 };
+   unsigned int i;
+
+   sched.sessionId = sessionId;
+   sched.shareId = HgfsThreadpool_ShareId(shareName, strlen(shareName));
+   sched.cost = HGFS_TEST_ITEM_BYTES;
+
+   for (i = 0; i < numItems; i++) {
+      if (!HgfsThreadpool_QueueScheduledWorkItem(HgfsTestWorkItem, &items[i],
+                                                 &sched)) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestWait --
+ *
+ *    Wait for a number of items to have run.
+ *
+ * Results:
+ *    TRUE if they did before HGFS_TEST_TIMEOUT_S.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestWait(unsigned int numItems)   // IN
+{
+   struct timespec deadline;
+   Bool done;
+
+   clock_gettime(CLOCK_REALTIME, &deadline);
+   deadline.tv_sec += HGFS_TEST_TIMEOUT_S;
+
+   pthread_mutex_lock(&gMutex);
+   while (gDone < numItems &&
+          pthread_cond_timedwait(&gCond, &gMutex, &deadline) == 0) {
+   }
+   done = gDone >= numItems;
+   pthread_mutex_unlock(&gMutex);
+
+   return done;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestLast --
+ *
+ *    Find when the last of a set of items ran.
+ *
+ * Results:
+ *    The latest doneAt.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static VmTimeType
+HgfsTestLast(const HgfsTestItem *items,   // IN
+             unsigned int numItems)       // IN
+{
+   VmTimeType last = 0;
+   unsigned int i;
+
+   for (i = 0; i < numItems; i++) {
+      last = MAX(last, items[i].doneAt);
+   }
+
+   return last;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestShareCap --
+ *
+ *    The share-cap test. The capped share starts with an empty budget, so
+ *    its first item runs at once and each of the others waits for the
+ *    budget of one item to refill.
+ *
+ * Results:
+ *    TRUE if passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestShareCap(void)
+{
+   const VmTimeType itemUs =
+      (VmTimeType)HGFS_TEST_ITEM_BYTES * 1000000 / HGFS_TEST_CAP_BYTES;
+   const VmTimeType minCapped = (HGFS_TEST_CAP_ITEMS - 1) * itemUs;
+   HgfsTestItem capped[HGFS_TEST_CAP_ITEMS];
+   HgfsTestItem uncapped[HGFS_TEST_FREE_ITEMS];
+   VmTimeType cappedLast;
+   VmTimeType freeLast;
+   Bool ok = TRUE;
+
+   if (!HgfsServer_SetShareLimits(HGFS_TEST_CAP_SHARE, 1,
+                                  HGFS_TEST_CAP_BYTES)) {
+      fprintf(stderr, "share-cap: cannot set the share limits\n");
+      return FALSE;
+   }
+   if (!HgfsThreadpool_Activate()) {
+      fprintf(stderr, "share-cap: cannot start the threadpool\n");
+      return FALSE;
+   }
+
+   gDone = 0;
+   gStart = Hostinfo_SystemTimerUS();
+   if (!HgfsTestQueue(capped, ARRAYSIZE(capped), 1, HGFS_TEST_CAP_SHARE) ||
+       !HgfsTestQueue(uncapped, ARRAYSIZE(uncapped), 2,
+                      HGFS_TEST_FREE_SHARE)) {
+      fprintf(stderr, "share-cap: cannot queue the items\n");
+      ok = FALSE;
+   } else if (!HgfsTestWait(ARRAYSIZE(capped) + ARRAYSIZE(uncapped))) {
+      fprintf(stderr, "share-cap: items did not run\n");
+      ok = FALSE;
+   }
+
+   if (ok) {
+      cappedLast = HgfsTestLast(capped, ARRAYSIZE(capped));
+      freeLast = HgfsTestLast(uncapped, ARRAYSIZE(uncapped));
+
+      if (cappedLast < minCapped - HGFS_TEST_TOLERANCE_US ||
+          cappedLast > minCapped + HGFS_TEST_TOLERANCE_US) {
+         fprintf(stderr, "share-cap: capped items took %"FMT64"d us, "
+                 "expected %"FMT64"d us\n", cappedLast, minCapped);
+         ok = FALSE;
+      }
+      if (freeLast > HGFS_TEST_TOLERANCE_US) {
+         fprintf(stderr, "share-cap: uncapped items took %"FMT64"d us\n",
+                 freeLast);
+         ok = FALSE;
+      }
+   }
+
+   /* Lifting the cap lets the share run its items at once. */
+   if (ok) {
+      HgfsServer_SetShareLimits(HGFS_TEST_CAP_SHARE, 1, 0);
+
+      gDone = 0;
+      gStart = Hostinfo_SystemTimerUS();
+      if (!HgfsTestQueue(capped, ARRAYSIZE(capped), 1, HGFS_TEST_CAP_SHARE) ||
+          !HgfsTestWait(ARRAYSIZE(capped))) {
+         fprintf(stderr, "share-cap: items did not run once uncapped\n");
+         ok = FALSE;
+      } else {
+         cappedLast = HgfsTestLast(capped, ARRAYSIZE(capped));
+         if (cappedLast > HGFS_TEST_TOLERANCE_US) {
+            fprintf(stderr, "share-cap: uncapped share took %"FMT64"d us\n",
+                    cappedLast);
+            ok = FALSE;
+         }
+      }
+   }
+
+   /* Completes whatever is still queued. */
+   HgfsThreadpool_Deactivate();
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestSend --
+ *
+ *    Channel send callback, called by the server with the reply to the
+ *    request being dispatched, from a threadpool worker if the request is
+ *    asynchronous.
+ *
+ * Results:
+ *    Always TRUE.
+ *
+ * Side effects:
+ *    Wakes up HgfsTestDispatch.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestSend(void *transportData,   // IN: HgfsTestChannel
+             HgfsPacket *packet,    // IN/OUT: packet with the reply
+             HgfsSendFlags flags)   // IN: send flags
+{
+   HgfsTestChannel *channel = transportData;
+
+   channel->replySize = packet->replyPacketDataSize;
+   if (!(flags & HGFS_SEND_NO_COMPLETE)) {
+      gServerCb->session.sendComplete(packet, channel->transportSession);
+   }
+
+   pthread_mutex_lock(&gMutex);
+   channel->replyPending = FALSE;
+   pthread_cond_broadcast(&gCond);
+   pthread_mutex_unlock(&gMutex);
+
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestPackHeader --
+ *
+ *    Fill in the header of a request of the session.
+ *
+ * Results:
+ *    The size of the request.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static size_t
+HgfsTestPackHeader(HgfsTestChannel *channel,   // IN/OUT
+                   HgfsHeader *header,         // OUT
+                   HgfsOp op,                  // IN
+                   size_t payloadSize)         // IN
+{
+   memset(header, 0, sizeof *header);
+   header->version = HGFS_HEADER_VERSION;
+   header->dummy = HGFS_OP_NEW_HEADER;
+   header->packetSize = sizeof *header + payloadSize;
+   header->headerSize = sizeof *header;
+   header->requestId = channel->requestId++;
+   header->op = op;
+   header->flags = HGFS_PACKET_FLAG_REQUEST;
+   header->sessionId = channel->sessionId;
+
+   return header->packetSize;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestDispatch --
+ *
+ *    Run the request whose payload was built after the header in
+ *    channel->request through the server, the way the guest backdoor
+ *    channel does: asynchronous requests go to the threadpool, and the
+ *    dispatch waits for their reply.
+ *
+ * Results:
+ *    The status of the reply and a pointer to the reply payload.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsTestDispatch(HgfsTestChannel *channel,   // IN/OUT
+                 HgfsOp op,                  // IN: request opcode
+                 size_t payloadSize,         // IN: size of the request payload
+                 void **replyPayload)        // OUT/OPT: reply payload
+{
+   const HgfsHeader *replyHeader = (const HgfsHeader *)channel->reply;
+   HgfsPacket packet;
+   size_t size;
+
+   size = HgfsTestPackHeader(channel, (HgfsHeader *)channel->request, op,
+                             payloadSize);
+   ASSERT(size <= sizeof channel->request);
+
+   memset(&packet, 0, sizeof packet);
+   packet.iov[0].va = channel->request;
+   packet.iov[0].len = size;
+   packet.iovCount = 1;
+   packet.metaPacket = channel->request;
+   packet.metaPacketDataSize = size;
+   packet.metaPacketSize = size;
+   packet.replyPacket = channel->reply;
+   packet.replyPacketSize = sizeof channel->reply;
+   packet.state |= HGFS_STATE_CLIENT_REQUEST;
+
+   channel->replySize = 0;
+   channel->replyPending = TRUE;
+   gServerCb->session.receive(&packet, channel->transportSession);
+
+   pthread_mutex_lock(&gMutex);
+   channel->replyAsync = 0 != (packet.state & HGFS_STATE_ASYNC_REQUEST);
+   if (channel->replyAsync) {
+      while (channel->replyPending) {
+         pthread_cond_wait(&gCond, &gMutex);
+      }
+   }
+   channel->replyPending = FALSE;
+   pthread_mutex_unlock(&gMutex);
+
+   if (channel->replySize < sizeof *replyHeader ||
+       replyHeader->headerSize > channel->replySize) {
+      return HGFS_STATUS_PROTOCOL_ERROR;
+   }
+   if (replyPayload != NULL) {
+      *replyPayload = channel->reply + replyHeader->headerSize;
+   }
+
+   return replyHeader->status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestPackName --
+ *
+ *    Fill in the name of a file in the temp directory. The guest policy
+ *    exports the whole file system as the "root" share.
+ *
+ * Results:
+ *    The size of the name, not counting the terminating NUL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static size_t
+HgfsTestPackName(const HgfsTestChannel *channel,   // IN
+                 const char *fileName,             // IN: file in root
+                 HgfsFileNameV3 *name)             // OUT
+{
+   int len;
+   int i;
+
+   len = Str_Snprintf(name->name, PATH_MAX, "%s%s/%s",
+                      HGFS_SERVER_POLICY_ROOT_SHARE_NAME, channel->root,
+                      fileName);
+   VERIFY(len > 0);
+
+   for (i = 0; i < len; i++) {
+      if (name->name[i] == '/') {
+         name->name[i] = '\0';
+      }
+   }
+
+   name->length = len;
+   name->flags = 0;
+   name->caseType = HGFS_FILE_NAME_CASE_SENSITIVE;
+   name->fid = HGFS_INVALID_HANDLE;
+
+   return len;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestConnect --
+ * HgfsTestDisconnect --
+ *
+ *    Connect the loopback channel and create a session on it, and tear
+ *    them down again.
+ *
+ * Results:
+ *    HgfsTestConnect returns TRUE on success, FALSE otherwise, in which
+ *    case nothing is left to tear down.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestConnect(HgfsTestChannel *channel)   // OUT
+{
+   static HgfsServerChannelData capData = {
+      HGFS_CHANNEL_ASYNC,
+      HGFS_LARGE_PACKET_MAX
+   };
+   HgfsRequestCreateSessionV4 *request =
+      (void *)(channel->request + sizeof (HgfsHeader));
+   HgfsReplyCreateSessionV4 *reply;
+
+   channel->channelCb.getReadVa = NULL;
+   channel->channelCb.getWriteVa = NULL;
+   channel->channelCb.putVa = NULL;
+   channel->channelCb.send = HgfsTestSend;
+   if (!gServerCb->session.connect(channel, &channel->channelCb, &capData,
+                                   &channel->transportSession)) {
+      return FALSE;
+   }
+
+   memset(request, 0, sizeof *request);
+   request->maxPacketSize = HGFS_LARGE_PACKET_MAX;
+   channel->sessionId = HGFS_INVALID_SESSION_ID;
+   if (HgfsTestDispatch(channel, HGFS_OP_CREATE_SESSION_V4, sizeof *request,
+                        (void **)&reply) != HGFS_STATUS_SUCCESS) {
+      gServerCb->session.disconnect(channel->transportSession);
+      gServerCb->session.close(channel->transportSession);
+      return FALSE;
+   }
+   channel->sessionId = reply->sessionId;
+
+   return TRUE;
+}
+
+
+static void
+HgfsTestDisconnect(HgfsTestChannel *channel)   // IN/OUT
+{
+   HgfsRequestDestroySessionV4 *request =
+      (void *)(channel->request + sizeof (HgfsHeader));
+
+   request->reserved = 0;
+   HgfsTestDispatch(channel, HGFS_OP_DESTROY_SESSION_V4, sizeof *request,
+                    NULL);
+   gServerCb->session.disconnect(channel->transportSession);
+   gServerCb->session.close(channel->transportSession);
+   channel->transportSession = NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestSetUp --
+ * HgfsTestTearDown --
+ *
+ *    Create a temp directory with a test file of HGFS_TEST_FILE_SIZE bytes,
+ *    returned in data, and connect the loopback channel; and undo it.
+ *
+ * Results:
+ *    HgfsTestSetUp returns TRUE on success, FALSE otherwise, in which case
+ *    nothing is left to tear down.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestSetUp(const char *test,            // IN: name for the messages
+              HgfsTestChannel *channel,    // OUT
+              char *data)                  // OUT: HGFS_TEST_FILE_SIZE bytes
+{
+   char path[PATH_MAX];
+   FILE *file;
+   uint32 i;
+
+   Str_Snprintf(channel->root, sizeof channel->root, "/tmp/hgfstest.XXXXXX");
+   if (mkdtemp(channel->root) == NULL) {
+      fprintf(stderr, "%s: cannot create a directory: %s\n", test,
+              strerror(errno));
+      return FALSE;
+   }
+
+   for (i = 0; i < HGFS_TEST_FILE_SIZE; i++) {
+      data[i] = 'a' + i % 26;
+   }
+   Str_Snprintf(path, sizeof path, "%s/%s", channel->root, HGFS_TEST_FILE);
+   file = fopen(path, "w");
+   if (file == NULL || fwrite(data, HGFS_TEST_FILE_SIZE, 1, file) != 1) {
+      fprintf(stderr, "%s: cannot write %s\n", test, path);
+      if (file != NULL) {
+         fclose(file);
+      }
+      goto removeFile;
+   }
+   fclose(file);
+
+   if (!HgfsTestConnect(channel)) {
+      fprintf(stderr, "%s: cannot connect to the server\n", test);
+      goto removeFile;
+   }
+
+   return TRUE;
+
+removeFile:
+   unlink(path);
+   rmdir(channel->root);
+
+   return FALSE;
+}
+
+
+static void
+HgfsTestTearDown(HgfsTestChannel *channel)   // IN/OUT
+{
+   char path[PATH_MAX];
+
+   HgfsTestDisconnect(channel);
+   Str_Snprintf(path, sizeof path, "%s/%s", channel->root, HGFS_TEST_FILE);
+   unlink(path);
+   rmdir(channel->root);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestMember --
+ *
+ *    Add a member, whose payload was built at HGFS_TEST_MEMBER_PAYLOAD, to
+ *    the compound request being built in channel->request.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Advances offset past the member.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+#define HGFS_TEST_COMPOUND_START \
+   (sizeof (HgfsHeader) + sizeof (HgfsRequestCompoundV4))
+
+#define HGFS_TEST_MEMBER_PAYLOAD(channel, offset) \
+   ((void *)((channel)->request + (offset) + \
+             sizeof (HgfsCompoundEntryV4) + sizeof (HgfsHeader)))
+
+static void
+HgfsTestMember(HgfsTestChannel *channel,   // IN/OUT
+               size_t *offset,             // IN/OUT: end of the members
+               HgfsOp op,                  // IN
+               uint32 flags,               // IN: entry flags
+               size_t payloadSize)         // IN
+{
+   HgfsCompoundEntryV4 *entry = (void *)(channel->request + *offset);
+
+   entry->flags = flags;
+   entry->size = HgfsTestPackHeader(channel, (HgfsHeader *)(entry + 1), op,
+                                    payloadSize);
+   *offset += sizeof *entry + entry->size;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestCompoundReply --
+ *
+ *    Find a member reply in the reply to a compound request.
+ *
+ * Results:
+ *    The header of the member reply, NULL if the reply has no such member.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static const HgfsHeader *
+HgfsTestCompoundReply(const HgfsTestChannel *channel,   // IN
+                      const HgfsReplyCompoundV4 *reply, // IN
+                      uint32 index)                     // IN: member
+{
+   const char *end = channel->reply + channel->replySize;
+   const char *cur = (const char *)(reply + 1);
+   uint32 i;
+
+   if (index >= reply->numReplies) {
+      return NULL;
+   }
+
+   for (i = 0; ; i++) {
+      const HgfsCompoundEntryV4 *entry = (const HgfsCompoundEntryV4 *)cur;
+
+      if (end - cur < sizeof *entry ||
+          end - cur - sizeof *entry < entry->size ||
+          entry->size < sizeof (HgfsHeader)) {
+         return NULL;
+      }
+      if (i == index) {
+         return (const HgfsHeader *)(entry + 1);
+      }
+      cur += sizeof *entry + entry->size;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestCompoundOpen --
+ *
+ *    Build a compound request which opens a file in the temp directory and
+ *    then gets its attributes, reads it and closes it through the handle
+ *    of the open, and send it.
+ *
+ * Results:
+ *    The status of the compound reply and the reply payload.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static HgfsStatus
+HgfsTestCompoundOpen(HgfsTestChannel *channel,      // IN/OUT
+                     const char *fileName,          // IN: file in root
+                     HgfsReplyCompoundV4 **reply)   // OUT
+{
+   HgfsRequestCompoundV4 *compound =
+      (void *)(channel->request + sizeof (HgfsHeader));
+   size_t offset = HGFS_TEST_COMPOUND_START;
+   HgfsRequestOpenV3 *open;
+   HgfsRequestGetattrV3 *getattr;
+   HgfsRequestReadV3 *read;
+   HgfsRequestCloseV3 *close;
+   size_t nameLen;
+
+   compound->flags = HGFS_COMPOUND_FLAG_STOP_ON_ERROR;
+   compound->numRequests = 4;
+   compound->reserved = 0;
+
+   open = HGFS_TEST_MEMBER_PAYLOAD(channel, offset);
+   memset(open, 0, sizeof *open);
+   open->mask = HGFS_OPEN_VALID_MODE | HGFS_OPEN_VALID_FLAGS |
+                HGFS_OPEN_VALID_FILE_NAME;
+   open->mode = HGFS_OPEN_MODE_READ_ONLY;
+   open->flags = HGFS_OPEN;
+   nameLen = HgfsTestPackName(channel, fileName, &open->fileName);
+   HgfsTestMember(channel, &offset, HGFS_OP_OPEN_V3, 0,
+                  sizeof *open + nameLen);
+
+   getattr = HGFS_TEST_MEMBER_PAYLOAD(channel, offset);
+   memset(getattr, 0, sizeof *getattr);
+   HgfsTestMember(channel, &offset, HGFS_OP_GETATTR_V3,
+                  HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE, sizeof *getattr);
+
+   read = HGFS_TEST_MEMBER_PAYLOAD(channel, offset);
+   memset(read, 0, sizeof *read);
+   read->requiredSize = HGFS_TEST_FILE_SIZE;
+   HgfsTestMember(channel, &offset, HGFS_OP_READ_V3,
+                  HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE, sizeof *read);
+
+   close = HGFS_TEST_MEMBER_PAYLOAD(channel, offset);
+   memset(close, 0, sizeof *close);
+   HgfsTestMember(channel, &offset, HGFS_OP_CLOSE_V3,
+                  HGFS_COMPOUND_ENTRY_USE_LAST_HANDLE, sizeof *close);
+
+   return HgfsTestDispatch(channel, HGFS_OP_COMPOUND_V4,
+                           offset - sizeof (HgfsHeader), (void **)reply);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestCompound --
+ *
+ *    The compound test.
+ *
+ * Results:
+ *    TRUE if passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestCompound(void)
+{
+   static const HgfsOp ops[] = {
+      HGFS_OP_OPEN_V3, HGFS_OP_GETATTR_V3, HGFS_OP_READ_V3, HGFS_OP_CLOSE_V3
+   };
+   HgfsTestChannel *channel = &gChannel;
+   char data[HGFS_TEST_FILE_SIZE];
+   HgfsReplyCompoundV4 *reply;
+   const HgfsHeader *member;
+   const HgfsReplyGetattrV3 *attr;
+   const HgfsReplyReadV3 *read;
+   Bool ok = FALSE;
+   uint32 i;
+
+   if (!HgfsTestSetUp("compound", channel, data)) {
+      return FALSE;
+   }
+
+   if (HgfsTestCompoundOpen(channel, HGFS_TEST_FILE, &reply) !=
+          HGFS_STATUS_SUCCESS ||
+       reply->numReplies != ARRAYSIZE(ops)) {
+      fprintf(stderr, "compound: the compound did not run all members\n");
+      goto disconnect;
+   }
+   for (i = 0; i < ARRAYSIZE(ops); i++) {
+      member = HgfsTestCompoundReply(channel, reply, i);
+      if (member == NULL || member->op != ops[i] ||
+          member->status != HGFS_STATUS_SUCCESS) {
+         fprintf(stderr, "compound: member %u failed\n", i);
+         goto disconnect;
+      }
+   }
+
+   member = HgfsTestCompoundReply(channel, reply, 1);
+   attr = (const void *)((const char *)member + member->headerSize);
+   if (attr->attr.size != HGFS_TEST_FILE_SIZE) {
+      fprintf(stderr, "compound: getattr returned size %"FMT64"u\n",
+              attr->attr.size);
+      goto disconnect;
+   }
+
+   member = HgfsTestCompoundReply(channel, reply, 2);
+   read = (const void *)((const char *)member + member->headerSize);
+   if (read->actualSize != sizeof data ||
+       memcmp(read->payload, data, sizeof data) != 0) {
+      fprintf(stderr, "compound: read returned the wrong data\n");
+      goto disconnect;
+   }
+
+   /* The members after a failed open must not run. */
+   if (HgfsTestCompoundOpen(channel, "missing", &reply) !=
+          HGFS_STATUS_SUCCESS ||
+       reply->numReplies != 1 ||
+       (member = HgfsTestCompoundReply(channel, reply, 0)) == NULL ||
+       member->status == HGFS_STATUS_SUCCESS) {
+      fprintf(stderr, "compound: did not stop after the failed open\n");
+      goto disconnect;
+   }
+
+   ok = TRUE;
+
+disconnect:
+   HgfsTestTearDown(channel);
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * HgfsTestAsync --
+ *
+ *    The async test: a getattr on the asynchronous channel runs in the
+ *    threadpool, and its reply is there when the dispatch returns.
+ *
+ * Results:
+ *    TRUE if passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+HgfsTestAsync(void)
+{
+   HgfsTestChannel *channel = &gChannel;
+   char data[HGFS_TEST_FILE_SIZE];
+   HgfsRequestGetattrV3 *request =
+      (void *)(channel->request + sizeof (HgfsHeader));
+   HgfsReplyGetattrV3 *reply;
+   size_t nameLen;
+   Bool ok = FALSE;
+   unsigned int i;
+
+   if (!HgfsTestSetUp("async", channel, data)) {
+      return FALSE;
+   }
+
+   for (i = 0; i < HGFS_TEST_FREE_ITEMS; i++) {
+      memset(request, 0, sizeof *request);
+      nameLen = HgfsTestPackName(channel, HGFS_TEST_FILE, &request->fileName);
+      if (HgfsTestDispatch(channel, HGFS_OP_GETATTR_V3,
+                           sizeof *request + nameLen, (void **)&reply) !=
+          HGFS_STATUS_SUCCESS) {
+         fprintf(stderr, "async: getattr failed\n");
+         goto disconnect;
+      }
+      if (!channel->replyAsync) {
+         fprintf(stderr, "async: getattr did not go to the threadpool\n");
+         goto disconnect;
+      }
+      if (reply->attr.size != HGFS_TEST_FILE_SIZE) {
+         fprintf(stderr, "async: getattr returned size %"FMT64"u\n",
+                 reply->attr.size);
+         goto disconnect;
+      }
+   }
+
+   ok = TRUE;
+
+disconnect:
+   HgfsTestTearDown(channel);
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Run the tests named on the command line, all of them by default.
+ *
+ * Results:
+ *    0 if all tests passed, 1 otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,       // IN
+     char *argv[])   // IN
+{
+   static const struct {
+      const char *name;
+      Bool (*run)(void);
+   } tests[] = {
+      { "share-cap",   HgfsTestShareCap },
+      { "compound",    HgfsTestCompound },
+      { "async",       HgfsTestAsync },
+   };
+   static HgfsServerMgrCallbacks mgrCb;
+   /* The guest policy only exports the root share. */
+   static HgfsServerConfig config = {
+      HGFS_CONFIG_THREADPOOL_ENABLED | HGFS_CONFIG_SHARE_ALL_HOST_DRIVES_ENABLED,
+      HGFS_MAX_CACHED_FILENODES
+   };
+   Bool ok = TRUE;
+   unsigned int i;
+
+   if (!HgfsServerPolicy_Init(NULL, &mgrCb.enumResources)) {
+      fprintf(stderr, "Cannot initialize the server policy\n");
+      return 1;
+   }
+   if (!HgfsServer_InitState(&gServerCb, &config, &mgrCb)) {
+      fprintf(stderr, "Cannot initialize the server\n");
+      HgfsServerPolicy_Cleanup();
+      return 1;
+   }
+
+   for (i = 0; i < ARRAYSIZE(tests); i++) {
+      Bool passed;
+
+      if (argc > 1) {
+         int j;
+
+         for (j = 1; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) {
+               break;
+            }
+         }
+         if (j == argc) {
+            continue;
+         }
+      }
+
+      passed = tests[i].run();
+      printf("%-12s %s\n", tests[i].name, passed ? "PASS" : "FAIL");
+      ok = ok && passed;
+   }
+
+   HgfsServer_ExitState();
+   HgfsServerPolicy_Cleanup();
+   return ok ? 0 : 1;
+}
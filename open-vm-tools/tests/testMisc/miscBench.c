@@ -0,0 +1,1353 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * miscBench.c --
+ *
+ *   Microbenchmarks for the containers and string primitives of lib/misc,
+ *   lib/hashMap, lib/dataMap and lib/string, with inputs shaped like the
+ *   ones the tools see:
+ *
+ *   - ht-*: HashTable with HGFS-like paths, case sensitive and not, and
+ *     int keys.
+ *   - hm-*: HashMap with 32-bit handles, as the HGFS handle maps use;
+ *     hm-churn opens and closes handles in a sliding window.
+ *   - dm-*: DataMap encoding and decoding of a vsock GuestRPC packet with a
+ *     4KB payload, dm-encode-to into a buffer sized by the caller and
+ *     dm-view without copying the packet.
+ *   - dynbuf-rpc: a 4KB RPC message built from small appends.
+ *   - dynarray-grow: an array grown one element at a time.
+ *   - iov-*: gather and scatter of 16 4KB entries.
+ *   - str-*, strutil-token: formatting and parsing of RPC messages.
+ *   - b64-*: encoding and decoding of 1KB and 64KB guestinfo payloads.
+ *   - sha*: hashing of the 64KB payload, and of 8 8KB slices of it at once
+ *     with SHA1MultiBuffer.
+ *   - rand-16, rand-32, rand-4k: Random_Crypto with session id, key and
+ *     bulk sized requests.
+ *   - rand-quick, rand-fast: the non-cryptographic generators, for
+ *     comparison.
+ *
+ *   Results are nanoseconds and heap allocations per operation, and MB/s
+ *   for the tests which move bytes. Allocations are only counted with
+ *   glibc, whose malloc can be interposed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "base64.h"
+#include "dataMap.h"
+#include "dynarray.h"
+#include "dynbuf.h"
+#include "hashMap.h"
+#include "hashTable.h"
+#include "hostinfo.h"
+#include "iovector.h"
+#include "random.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "str.h"
+#include "strutil.h"
+#include "util.h"
+
+#define MISC_BENCH_DEFAULT_ITERATIONS  100000
+#define MISC_BENCH_DEFAULT_KEYS        10000
+#define MISC_BENCH_TABLE_SIZE          256
+#define MISC_BENCH_RPC_SIZE            4096
+#define MISC_BENCH_RPC_CHUNK           64
+#define MISC_BENCH_ARRAY_SIZE          1024
+#define MISC_BENCH_IOV_ENTRIES         16
+#define MISC_BENCH_IOV_SIZE            4096
+#define MISC_BENCH_TOPOLOGY            "2 , 0 0 1920 1080 , 1920 0 1280 1024"
+
+typedef struct MiscBench {
+   unsigned int numKeys;
+   char **keys;           /* HGFS-like paths. */
+   char **upperKeys;      /* The same paths, upper case. */
+   char **missKeys;       /* Paths which are not in the tables. */
+   uint8 *payload;        /* Guestinfo-like bytes, 64KB. */
+   char *encoded;         /* payload in base64. */
+   uint8 *decoded;
+   struct iovec iov[MISC_BENCH_IOV_ENTRIES];
+   uint8 *iovBuf;
+} MiscBench;
+
+/*
+ * Runs 'iterations' operations, or a bit more if the test works in rounds.
+ * Returns the operation count, and adds the bytes moved to *bytes.
+ */
+
+typedef unsigned int (*MiscBenchTest)(MiscBench *bench,
+                                      unsigned int iterations,
+                                      size_t arg,
+                                      uint64 *bytes);
+
+static uint64 gAllocs;
+
+/* The measurement, see MiscBenchStart and MiscBenchStop. */
+static VmTimeType gStart;
+static VmTimeType gElapsed;
+static uint64 gMeasuredAllocs;
+static Bool gStopped;
+
+#if defined(__GLIBC__)
+#define MISC_BENCH_COUNT_ALLOCS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * malloc, calloc, realloc --
+ *
+ *    Count the allocations of the whole process, the benchmark and the
+ *    libraries alike, and hand them to glibc.
+ *
+ * Results:
+ *    As the glibc functions.
+ *
+ * Side effects:
+ *    Increments gAllocs.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void *
+malloc(size_t size)   // IN
+{
+   gAllocs++;
+   return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb,  // IN
+       size_t size)   // IN
+{
+   gAllocs++;
+   return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr,    // IN
+        size_t size)  // IN
+{
+   gAllocs++;
+   return __libc_realloc(ptr, size);
+}
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchInit --
+ *
+ *    Generate the inputs: paths of varying depth and length under a few
+ *    share names, and pseudo-random payload bytes.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Allocates the inputs.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+MiscBenchInit(MiscBench *bench,        // OUT
+              unsigned int numKeys)    // IN
+{
+   static const char *shares[] = { "src", "Documents", "build-output", "vm" };
+   static const char *exts[] = { "c", "h", "txt", "o", "docx", "vmdk" };
+   uint32 seed = 0x12345678;
+   size_t encodedSize;
+   size_t len;
+   unsigned int i;
+
+   memset(bench, 0, sizeof *bench);
+   bench->numKeys = numKeys;
+   bench->keys = Util_SafeCalloc(numKeys, sizeof *bench->keys);
+   bench->upperKeys = Util_SafeCalloc(numKeys, sizeof *bench->upperKeys);
+   bench->missKeys = Util_SafeCalloc(numKeys, sizeof *bench->missKeys);
+
+   for (i = 0; i < numKeys; i++) {
+      char *p;
+
+      bench->keys[i] = Str_SafeAsprintf(NULL, "/%s/project%u/%s/file%05u.%s",
+                                        shares[i % ARRAYSIZE(shares)],
+                                        i / 500,
+                                        i % 3 == 0 ? "lib" : "lib/include",
+                                        i, exts[i % ARRAYSIZE(exts)]);
+      bench->upperKeys[i] = Util_SafeStrdup(bench->keys[i]);
+      for (p = bench->upperKeys[i]; *p != '\0'; p++) {
+         if (*p >= 'a' && *p <= 'z') {
+            *p -= 'a' - 'A';
+         }
+      }
+      bench->missKeys[i] = Str_SafeAsprintf(NULL, "%s.orig", bench->keys[i]);
+   }
+
+   bench->payload = Util_SafeMalloc(64 * 1024);
+   for (i = 0; i < 64 * 1024; i++) {
+      seed = seed * 1103515245 + 12345;
+      bench->payload[i] = seed >> 16;
+   }
+   encodedSize = Base64_EncodedLength(bench->payload, 64 * 1024) + 1;
+   bench->encoded = Util_SafeMalloc(encodedSize);
+   bench->decoded = Util_SafeMalloc(64 * 1024);
+   VERIFY(Base64_Encode(bench->payload, 64 * 1024, bench->encoded,
+                        encodedSize, &len));
+
+   bench->iovBuf = Util_SafeMalloc(MISC_BENCH_IOV_ENTRIES * MISC_BENCH_IOV_SIZE);
+   for (i = 0; i < MISC_BENCH_IOV_ENTRIES; i++) {
+      bench->iov[i].iov_base = Util_SafeMalloc(MISC_BENCH_IOV_SIZE);
+      bench->iov[i].iov_len = MISC_BENCH_IOV_SIZE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchStart --
+ *
+ *    Start measuring, after the setup of a test.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+MiscBenchStart(void)
+{
+   gStopped = FALSE;
+   gAllocs = 0;
+   gStart = Hostinfo_SystemTimerNS();
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchStop --
+ *
+ *    Stop measuring, before the teardown of a test. Only the first call
+ *    after MiscBenchStart counts.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+MiscBenchStop(void)
+{
+   if (!gStopped) {
+      gElapsed = MAX(Hostinfo_SystemTimerNS() - gStart, 1);
+      gMeasuredAllocs = gAllocs;
+      gStopped = TRUE;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchHtInsert --
+ *
+ *    Fill a HashTable with all the keys, and free it, in rounds. arg is
+ *    the key type.
+ *
+ * Results:
+ *    The number of inserts.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchHtInsert(MiscBench *bench,          // IN
+                  unsigned int iterations,   // IN
+                  size_t arg,                // IN: key type
+                  uint64 *bytes)             // OUT: unused
+{
+   unsigned int ops = 0;
+
+   while (ops < iterations) {
+      HashTable *ht = HashTable_Alloc(MISC_BENCH_TABLE_SIZE, arg, NULL);
+      unsigned int i;
+
+      for (i = 0; i < bench->numKeys; i++) {
+         const void *key = arg == HASH_INT_KEY ? (void *)(uintptr_t)(i + 1)
+                                               : bench->keys[i];
+
+         HashTable_Insert(ht, key, bench->keys[i]);
+      }
+      HashTable_Free(ht);
+      ops += bench->numKeys;
+   }
+   return ops;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchHtLookup --
+ *
+ *    Look up keys in a HashTable holding all the keys. arg is the key type,
+ *    HASH_ISTRING_KEY tables are looked up with the upper case keys.
+ *
+ * Results:
+ *    The number of lookups.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchHtLookup(MiscBench *bench,          // IN
+                  unsigned int iterations,   // IN
+                  size_t arg,                // IN: key type
+                  uint64 *bytes)             // OUT: unused
+{
+   HashTable *ht = HashTable_Alloc(MISC_BENCH_TABLE_SIZE, arg, NULL);
+   unsigned int i;
+
+   for (i = 0; i < bench->numKeys; i++) {
+      const void *key = arg == HASH_INT_KEY ? (void *)(uintptr_t)(i + 1)
+                                            : bench->keys[i];
+
+      HashTable_Insert(ht, key, bench->keys[i]);
+   }
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      unsigned int k = i % bench->numKeys;
+      const void *key;
+
+      switch (arg) {
+      case HASH_INT_KEY:
+         key = (void *)(uintptr_t)(k + 1);
+         break;
+      case HASH_ISTRING_KEY:
+         key = bench->upperKeys[k];
+         break;
+      default:
+         key = bench->keys[k];
+      }
+      VERIFY(HashTable_Lookup(ht, key, NULL));
+   }
+
+   MiscBenchStop();
+   HashTable_Free(ht);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchHtMiss --
+ *
+ *    Look up absent keys in a HashTable holding all the keys.
+ *
+ * Results:
+ *    The number of lookups.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchHtMiss(MiscBench *bench,          // IN
+                unsigned int iterations,   // IN
+                size_t arg,                // IN: unused
+                uint64 *bytes)             // OUT: unused
+{
+   HashTable *ht = HashTable_Alloc(MISC_BENCH_TABLE_SIZE, HASH_STRING_KEY,
+                                   NULL);
+   unsigned int i;
+
+   for (i = 0; i < bench->numKeys; i++) {
+      HashTable_Insert(ht, bench->keys[i], NULL);
+   }
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      VERIFY(!HashTable_Lookup(ht, bench->missKeys[i % bench->numKeys], NULL));
+   }
+
+   MiscBenchStop();
+   HashTable_Free(ht);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchHmPut --
+ *
+ *    Fill a HashMap with handles, and destroy it, in rounds.
+ *
+ * Results:
+ *    The number of puts.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchHmPut(MiscBench *bench,          // IN
+               unsigned int iterations,   // IN
+               size_t arg,                // IN: unused
+               uint64 *bytes)             // OUT: unused
+{
+   unsigned int ops = 0;
+
+   while (ops < iterations) {
+      HashMap *map = HashMap_AllocMap(MISC_BENCH_TABLE_SIZE, sizeof (uint32),
+                                      sizeof (char *));
+      uint32 handle;
+
+      for (handle = 0; handle < bench->numKeys; handle++) {
+         HashMap_Put(map, &handle, &bench->keys[handle]);
+      }
+      HashMap_DestroyMap(map);
+      ops += bench->numKeys;
+   }
+   return ops;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchHmGet --
+ *
+ *    Look up handles in a HashMap holding all of them.
+ *
+ * Results:
+ *    The number of lookups.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchHmGet(MiscBench *bench,          // IN
+               unsigned int iterations,   // IN
+               size_t arg,                // IN: unused
+               uint64 *bytes)             // OUT: unused
+{
+   HashMap *map = HashMap_AllocMap(MISC_BENCH_TABLE_SIZE, sizeof (uint32),
+                                   sizeof (char *));
+   uint32 handle;
+   unsigned int i;
+
+   for (handle = 0; handle < bench->numKeys; handle++) {
+      HashMap_Put(map, &handle, &bench->keys[handle]);
+   }
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      handle = i % bench->numKeys;
+      VERIFY(HashMap_Get(map, &handle) != NULL);
+   }
+
+   MiscBenchStop();
+   HashMap_DestroyMap(map);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchHmChurn --
+ *
+ *    Put new handles in a HashMap and remove the oldest ones, keeping as
+ *    many open as there are keys, like a busy HGFS share.
+ *
+ * Results:
+ *    The number of puts and removes.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchHmChurn(MiscBench *bench,          // IN
+                 unsigned int iterations,   // IN
+                 size_t arg,                // IN: unused
+                 uint64 *bytes)             // OUT: unused
+{
+   HashMap *map = HashMap_AllocMap(MISC_BENCH_TABLE_SIZE, sizeof (uint32),
+                                   sizeof (char *));
+   uint32 handle;
+   unsigned int i;
+
+   for (handle = 0; handle < bench->numKeys; handle++) {
+      HashMap_Put(map, &handle, &bench->keys[handle]);
+   }
+
+   MiscBenchStart();
+   for (i = 0; i < iterations / 2; i++, handle++) {
+      uint32 oldest = handle - bench->numKeys;
+
+      HashMap_Put(map, &handle, &bench->keys[handle % bench->numKeys]);
+      VERIFY(HashMap_Remove(map, &oldest));
+   }
+
+   MiscBenchStop();
+   VERIFY(HashMap_Count(map) == bench->numKeys);
+   HashMap_DestroyMap(map);
+   return iterations / 2 * 2;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchDmPacket --
+ *
+ *    Build a DataMap like a vsock GuestRPC packet: a type, a payload of
+ *    MISC_BENCH_RPC_SIZE bytes and the fast close flag.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+MiscBenchDmPacket(MiscBench *bench,   // IN
+                  DataMap *map)       // OUT
+{
+   char *payload = Util_SafeMalloc(MISC_BENCH_RPC_SIZE);
+
+   memcpy(payload, bench->payload, MISC_BENCH_RPC_SIZE);
+   VERIFY(DataMap_Create(map) == DMERR_SUCCESS);
+   VERIFY(DataMap_SetInt64(map, 1, 1, TRUE) == DMERR_SUCCESS);
+   VERIFY(DataMap_SetString(map, 2, payload, MISC_BENCH_RPC_SIZE,
+                            TRUE) == DMERR_SUCCESS);
+   VERIFY(DataMap_SetInt64(map, 3, TRUE, TRUE) == DMERR_SUCCESS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchDmEncode --
+ *
+ *    Serialize a GuestRPC packet, into a buffer allocated by DataMap
+ *    (arg FALSE), or into one sized by the caller (arg TRUE).
+ *
+ * Results:
+ *    The number of packets.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchDmEncode(MiscBench *bench,          // IN
+                  unsigned int iterations,   // IN
+                  size_t arg,                // IN: to a caller's buffer
+                  uint64 *bytes)             // OUT: bytes encoded
+{
+   DataMap map;
+   char *buf;
+   uint32 len;
+   unsigned int i;
+
+   MiscBenchDmPacket(bench, &map);
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      if (arg) {
+         buf = Util_SafeMalloc(MISC_BENCH_RPC_SIZE + 64);
+         VERIFY(DataMap_SerializeTo(&map, buf, MISC_BENCH_RPC_SIZE + 64,
+                                    &len) == DMERR_SUCCESS);
+      } else {
+         VERIFY(DataMap_Serialize(&map, &buf, &len) == DMERR_SUCCESS);
+      }
+      free(buf);
+      *bytes += len;
+   }
+
+   MiscBenchStop();
+   DataMap_Destroy(&map);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchDmDecode --
+ *
+ *    Deserialize a GuestRPC packet and get its payload, copying the
+ *    fields (arg FALSE) or as a view of the packet (arg TRUE).
+ *
+ * Results:
+ *    The number of packets.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchDmDecode(MiscBench *bench,          // IN
+                  unsigned int iterations,   // IN
+                  size_t arg,                // IN: as a view
+                  uint64 *bytes)             // OUT: bytes decoded
+{
+   DataMap map;
+   char *buf;
+   uint32 len;
+   unsigned int i;
+
+   MiscBenchDmPacket(bench, &map);
+   VERIFY(DataMap_Serialize(&map, &buf, &len) == DMERR_SUCCESS);
+   DataMap_Destroy(&map);
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      char *payload;
+      int32 payloadLen;
+
+      VERIFY((arg ? DataMap_DeserializeView(buf, len, &map)
+                  : DataMap_Deserialize(buf, len, &map)) == DMERR_SUCCESS);
+      VERIFY(DataMap_GetString(&map, 2, &payload, &payloadLen) ==
+             DMERR_SUCCESS);
+      DataMap_Destroy(&map);
+      *bytes += len;
+   }
+
+   MiscBenchStop();
+   free(buf);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchDynBufRpc --
+ *
+ *    Build RPC messages of MISC_BENCH_RPC_SIZE bytes from a command and
+ *    small appends, as the guestinfo and RPC layers do.
+ *
+ * Results:
+ *    The number of messages.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchDynBufRpc(MiscBench *bench,          // IN
+                   unsigned int iterations,   // IN
+                   size_t arg,                // IN: unused
+                   uint64 *bytes)             // OUT: bytes appended
+{
+   unsigned int i;
+
+   for (i = 0; i < iterations; i++) {
+      DynBuf buf;
+      size_t off;
+
+      DynBuf_Init(&buf);
+      DynBuf_Append(&buf, "info-set guestinfo.bench ", 25);
+      for (off = 0; off < MISC_BENCH_RPC_SIZE; off += MISC_BENCH_RPC_CHUNK) {
+         DynBuf_Append(&buf, bench->encoded + off, MISC_BENCH_RPC_CHUNK);
+      }
+      DynBuf_Append(&buf, "", 1);
+      *bytes += DynBuf_GetSize(&buf);
+      DynBuf_Destroy(&buf);
+   }
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchDynArrayGrow --
+ *
+ *    Grow DynArrays of uint64 one element at a time, in rounds.
+ *
+ * Results:
+ *    The number of elements added.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchDynArrayGrow(MiscBench *bench,          // IN
+                      unsigned int iterations,   // IN
+                      size_t arg,                // IN: unused
+                      uint64 *bytes)             // OUT: unused
+{
+   unsigned int ops = 0;
+
+   while (ops < iterations) {
+      DynArray a;
+      unsigned int i;
+
+      DynArray_Init(&a, 0, sizeof (uint64));
+      for (i = 0; i < MISC_BENCH_ARRAY_SIZE; i++) {
+         VERIFY(DynArray_SetCount(&a, i + 1));
+         *(uint64 *)DynArray_AddressOf(&a, i) = i;
+      }
+      DynArray_Destroy(&a);
+      ops += MISC_BENCH_ARRAY_SIZE;
+   }
+   return ops;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchIov --
+ *
+ *    Gather the iovec into a flat buffer (arg FALSE), or scatter the flat
+ *    buffer into the iovec (arg TRUE).
+ *
+ * Results:
+ *    The number of copies.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchIov(MiscBench *bench,          // IN
+             unsigned int iterations,   // IN
+             size_t arg,                // IN: scatter
+             uint64 *bytes)             // OUT: bytes copied
+{
+   size_t size = MISC_BENCH_IOV_ENTRIES * MISC_BENCH_IOV_SIZE;
+   unsigned int i;
+
+   for (i = 0; i < iterations; i++) {
+      if (arg) {
+         IOV_WriteBufToIov(bench->iovBuf, size, bench->iov,
+                           MISC_BENCH_IOV_ENTRIES);
+      } else {
+         IOV_WriteIovToBuf(bench->iov, MISC_BENCH_IOV_ENTRIES, bench->iovBuf,
+                           size);
+      }
+      *bytes += size;
+   }
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchStrSprintf --
+ *
+ *    Format guestinfo RPCs into a stack buffer.
+ *
+ * Results:
+ *    The number of messages.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchStrSprintf(MiscBench *bench,          // IN
+                    unsigned int iterations,   // IN
+                    size_t arg,                // IN: unused
+                    uint64 *bytes)             // OUT: bytes formatted
+{
+   unsigned int i;
+
+   for (i = 0; i < iterations; i++) {
+      char msg[1024];
+
+      *bytes += Str_Sprintf(msg, sizeof msg, "info-set guestinfo.%s %u %s",
+                            "ip", i, bench->keys[i % bench->numKeys]);
+   }
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchStrAsprintf --
+ *
+ *    Format guestinfo RPCs into allocated strings.
+ *
+ * Results:
+ *    The number of messages.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchStrAsprintf(MiscBench *bench,          // IN
+                     unsigned int iterations,   // IN
+                     size_t arg,                // IN: unused
+                     uint64 *bytes)             // OUT: bytes formatted
+{
+   unsigned int i;
+
+   for (i = 0; i < iterations; i++) {
+      size_t len;
+      char *msg = Str_SafeAsprintf(&len, "info-set guestinfo.%s %u %s",
+                                   "ip", i, bench->keys[i % bench->numKeys]);
+
+      *bytes += len;
+      free(msg);
+   }
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchStrUtilToken --
+ *
+ *    Split DisplayTopology_Set arguments into tokens and parse the numbers,
+ *    as the resolution plugins do.
+ *
+ * Results:
+ *    The number of messages.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchStrUtilToken(MiscBench *bench,          // IN
+                      unsigned int iterations,   // IN
+                      size_t arg,                // IN: unused
+                      uint64 *bytes)             // OUT: bytes parsed
+{
+   unsigned int i;
+
+   for (i = 0; i < iterations; i++) {
+      unsigned int index = 0;
+      char *token;
+
+      while ((token = StrUtil_GetNextToken(&index, MISC_BENCH_TOPOLOGY,
+                                           " ,")) != NULL) {
+         int32 value;
+
+         StrUtil_StrToInt(&value, token);
+         free(token);
+      }
+      *bytes += sizeof MISC_BENCH_TOPOLOGY - 1;
+   }
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchB64Encode --
+ *
+ *    Encode the first arg bytes of the payload.
+ *
+ * Results:
+ *    The number of encodings.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchB64Encode(MiscBench *bench,          // IN
+                   unsigned int iterations,   // IN
+                   size_t arg,                // IN: payload size
+                   uint64 *bytes)             // OUT: bytes encoded
+{
+   size_t targSize = Base64_EncodedLength(bench->payload, arg) + 1;
+   char *target = Util_SafeMalloc(targSize);
+   unsigned int i;
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      size_t len;
+
+      VERIFY(Base64_Encode(bench->payload, arg, target, targSize, &len));
+      *bytes += arg;
+   }
+
+   MiscBenchStop();
+   free(target);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchB64Decode --
+ *
+ *    Decode the encoding of the first arg bytes of the payload.
+ *
+ * Results:
+ *    The number of decodings.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchB64Decode(MiscBench *bench,          // IN
+                   unsigned int iterations,   // IN
+                   size_t arg,                // IN: payload size
+                   uint64 *bytes)             // OUT: bytes decoded
+{
+   size_t srcSize = Base64_EncodedLength(bench->payload, arg) + 1;
+   char *src = Util_SafeMalloc(srcSize);
+   unsigned int i;
+   size_t len;
+
+   VERIFY(Base64_Encode(bench->payload, arg, src, srcSize, &len));
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      VERIFY(Base64_Decode(src, bench->decoded, 64 * 1024, &len));
+      *bytes += len;
+   }
+
+   MiscBenchStop();
+   free(src);
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchSha1 --
+ * MiscBenchSha256 --
+ *
+ *    Hash the first arg bytes of the payload.
+ *
+ * Results:
+ *    The number of hashes.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchSha1(MiscBench *bench,          // IN
+              unsigned int iterations,   // IN
+              size_t arg,                // IN: payload size
+              uint64 *bytes)             // OUT: bytes hashed
+{
+   unsigned char digest[SHA1_HASH_LEN];
+   unsigned int i;
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      SHA1_CTX ctx;
+
+      SHA1Init(&ctx);
+      SHA1Update(&ctx, bench->payload, arg);
+      SHA1Final(digest, &ctx);
+      *bytes += arg;
+   }
+
+   MiscBenchStop();
+   return iterations;
+}
+
+
+static unsigned int
+MiscBenchSha256(MiscBench *bench,          // IN
+                unsigned int iterations,   // IN
+                size_t arg,                // IN: payload size
+                uint64 *bytes)             // OUT: bytes hashed
+{
+   unsigned char digest[SHA256_HASH_LEN];
+   unsigned int i;
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      SHA256Context ctx;
+
+      SHA256Init(&ctx);
+      SHA256Update(&ctx, bench->payload, arg);
+      SHA256Final(digest, &ctx);
+      *bytes += arg;
+   }
+
+   MiscBenchStop();
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchSha1Multi --
+ *
+ *    Hash the arg slices of 64KB / arg bytes of the payload at once.
+ *
+ * Results:
+ *    The number of SHA1MultiBuffer calls.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchSha1Multi(MiscBench *bench,          // IN
+                   unsigned int iterations,   // IN
+                   size_t arg,                // IN: number of slices
+                   uint64 *bytes)             // OUT: bytes hashed
+{
+   unsigned char digests[SHA1_MULTI_MAX_BUFFERS][SHA1_HASH_LEN];
+   unsigned char *digestPtrs[SHA1_MULTI_MAX_BUFFERS];
+   const void *data[SHA1_MULTI_MAX_BUFFERS];
+   uint32 len = 64 * 1024 / arg;
+   unsigned int i;
+
+   VERIFY(arg <= SHA1_MULTI_MAX_BUFFERS);
+   for (i = 0; i < arg; i++) {
+      data[i] = bench->payload + i * len;
+      digestPtrs[i] = digests[i];
+   }
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      SHA1MultiBuffer(arg, len, NULL, 0, data, digestPtrs);
+      *bytes += 64 * 1024;
+   }
+
+   MiscBenchStop();
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchRandCrypto --
+ *
+ *    Get arg bytes from Random_Crypto.
+ *
+ * Results:
+ *    The number of requests.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchRandCrypto(MiscBench *bench,          // IN
+                    unsigned int iterations,   // IN
+                    size_t arg,                // IN: request size
+                    uint64 *bytes)             // OUT: bytes generated
+{
+   unsigned int i;
+
+   VERIFY(arg <= 64 * 1024);
+   for (i = 0; i < iterations; i++) {
+      VERIFY(Random_Crypto(arg, bench->decoded));
+      *bytes += arg;
+   }
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchRandQuick --
+ * MiscBenchRandFast --
+ *
+ *    Get 32-bit numbers from Random_Quick and Random_Fast.
+ *
+ * Results:
+ *    The number of numbers.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+MiscBenchRandQuick(MiscBench *bench,          // IN
+                   unsigned int iterations,   // IN
+                   size_t arg,                // IN: unused
+                   uint64 *bytes)             // OUT: bytes generated
+{
+   rqContext *rq = Random_QuickSeed(getpid());
+   volatile uint32 value;
+   unsigned int i;
+
+   MiscBenchStart();
+   for (i = 0; i < iterations; i++) {
+      value = Random_Quick(rq);
+   }
+
+   MiscBenchStop();
+   free(rq);
+   *bytes += (uint64)iterations * sizeof value;
+   return iterations;
+}
+
+
+static unsigned int
+MiscBenchRandFast(MiscBench *bench,          // IN
+                  unsigned int iterations,   // IN
+                  size_t arg,                // IN: unused
+                  uint64 *bytes)             // OUT: bytes generated
+{
+   volatile uint32 value;
+   uint64 state;
+   unsigned int i;
+
+   Random_FastSeed(&state, getpid());
+   for (i = 0; i < iterations; i++) {
+      value = Random_Fast(&state);
+   }
+   *bytes += (uint64)iterations * sizeof value;
+   return iterations;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * MiscBenchUsage --
+ *
+ *    Print the usage message.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+MiscBenchUsage(const char *prog)   // IN: program name
+{
+   fprintf(stderr,
+           "Usage: %s [-n iterations] [-k keys] [test...]\n"
+           "  -n iterations  operations per test (%u), the byte moving\n"
+           "                 tests use a hundredth of it\n"
+           "  -k keys        keys in the hash tables (%u)\n",
+           prog, MISC_BENCH_DEFAULT_ITERATIONS, MISC_BENCH_DEFAULT_KEYS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Run the tests named on the command line, or all of them.
+ *
+ * Results:
+ *    0.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,       // IN
+     char *argv[])   // IN
+{
+   static const struct {
+      const char *name;
+      MiscBenchTest run;
+      size_t arg;
+      Bool bulk;
+   } tests[] = {
+      { "ht-insert",     MiscBenchHtInsert,     HASH_STRING_KEY,  FALSE },
+      { "ht-lookup",     MiscBenchHtLookup,     HASH_STRING_KEY,  FALSE },
+      { "ht-ilookup",    MiscBenchHtLookup,     HASH_ISTRING_KEY, FALSE },
+      { "ht-intlookup",  MiscBenchHtLookup,     HASH_INT_KEY,     FALSE },
+      { "ht-miss",       MiscBenchHtMiss,       0,                FALSE },
+      { "hm-put",        MiscBenchHmPut,        0,                FALSE },
+      { "hm-get",        MiscBenchHmGet,        0,                FALSE },
+      { "hm-churn",      MiscBenchHmChurn,      0,                FALSE },
+      { "dm-encode",     MiscBenchDmEncode,     FALSE,            FALSE },
+      { "dm-encode-to",  MiscBenchDmEncode,     TRUE,             FALSE },
+      { "dm-decode",     MiscBenchDmDecode,     FALSE,            FALSE },
+      { "dm-view",       MiscBenchDmDecode,     TRUE,             FALSE },
+      { "dynbuf-rpc",    MiscBenchDynBufRpc,    0,                FALSE },
+      { "dynarray-grow", MiscBenchDynArrayGrow, 0,                FALSE },
+      { "iov-gather",    MiscBenchIov,          FALSE,            TRUE },
+      { "iov-scatter",   MiscBenchIov,          TRUE,             TRUE },
+      { "str-sprintf",   MiscBenchStrSprintf,   0,                FALSE },
+      { "str-asprintf",  MiscBenchStrAsprintf,  0,                FALSE },
+      { "strutil-token", MiscBenchStrUtilToken, 0,                FALSE },
+      { "b64-enc-1k",    MiscBenchB64Encode,    1024,             FALSE },
+      { "b64-dec-1k",    MiscBenchB64Decode,    1024,             FALSE },
+      { "b64-enc-64k",   MiscBenchB64Encode,    64 * 1024,        TRUE },
+      { "b64-dec-64k",   MiscBenchB64Decode,    64 * 1024,        TRUE },
+      { "sha1-64k",      MiscBenchSha1,         64 * 1024,        TRUE },
+      { "sha1-multi8",   MiscBenchSha1Multi,    8,                TRUE },
+      { "sha256-64k",    MiscBenchSha256,       64 * 1024,        TRUE },
+      { "rand-16",       MiscBenchRandCrypto,   16,               FALSE },
+      { "rand-32",       MiscBenchRandCrypto,   32,               FALSE },
+      { "rand-4k",       MiscBenchRandCrypto,   4096,             TRUE },
+      { "rand-quick",    MiscBenchRandQuick,    0,                FALSE },
+      { "rand-fast",     MiscBenchRandFast,     0,                FALSE },
+   };
+   unsigned int iterations = MISC_BENCH_DEFAULT_ITERATIONS;
+   unsigned int numKeys = MISC_BENCH_DEFAULT_KEYS;
+   MiscBench bench;
+   unsigned int i;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:k:h")) != -1) {
+      switch (opt) {
+      case 'n':
+         iterations = strtoul(optarg, NULL, 0);
+         break;
+      case 'k':
+         numKeys = strtoul(optarg, NULL, 0);
+         break;
+      default:
+         MiscBenchUsage(argv[0]);
+         return 1;
+      }
+   }
+   if (iterations == 0 || numKeys == 0) {
+      MiscBenchUsage(argv[0]);
+      return 1;
+   }
+
+   MiscBenchInit(&bench, numKeys);
+
+   printf("%-14s %10s %10s %10s %10s\n",
+          "test", "ops", "ns/op", "allocs/op", "MB/s");
+
+   for (i = 0; i < ARRAYSIZE(tests); i++) {
+      unsigned int n = tests[i].bulk ? MAX(iterations / 100, 1) : iterations;
+      unsigned int ops;
+      uint64 bytes = 0;
+
+      if (optind < argc) {
+         int j;
+
+         for (j = optind; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) {
+               break;
+            }
+         }
+         if (j == argc) {
+            continue;
+         }
+      }
+
+      /* Tests with a setup or teardown measure only their loop. */
+      MiscBenchStart();
+      ops = tests[i].run(&bench, n, tests[i].arg, &bytes);
+      MiscBenchStop();
+
+      printf("%-14s %10u %10.1f ", tests[i].name, ops, (double)gElapsed / ops);
+#if defined(MISC_BENCH_COUNT_ALLOCS)
+      printf("%10.2f ", (double)gMeasuredAllocs / ops);
+#else
+      printf("%10s ", "-");
+#endif
+      if (bytes != 0) {
+         printf("%10.1f\n", (double)bytes * 1000 / gElapsed);
+      } else {
+         printf("%10s\n", "-");
+      }
+   }
+
+   return 0;
+}
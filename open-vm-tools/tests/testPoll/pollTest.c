@@ -0,0 +1,467 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA.
+ *
+ *********************************************************/
+
+/*
+ * pollTest.c --
+ *
+ *   Tests of the timer wheel and callback locking of the epoll/kqueue Poll
+ *   implementation, driven through Poll_LoopTimeout:
+ *
+ *   - timers: one-shot timers whose delays end on every level of the
+ *     wheel and across level boundaries, some removed before they are
+ *     due. Each must fire once, not early, and no later than the
+ *     coalescing slack allows.
+ *   - periodic: a periodic timer fires at its period.
+ *   - busy-timer, busy-device: a timer and a ready fd whose callback lock
+ *     another thread holds. They must fire once the lock is dropped,
+ *     without the loop spinning while it is held.
+ *
+ *   The program prints one line per test and exits with 1 if any failed.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "vmware.h"
+#include "poll.h"
+#include "userlock.h"
+
+/* Scheduling noise allowed on top of the lateness the wheel may add. */
+#define POLL_TEST_TOLERANCE_US  (25 * 1000)
+
+/* How long the busy tests keep the callback lock. */
+#define POLL_TEST_BUSY_US       (100 * 1000)
+
+/*
+ * Passes of the loop allowed while the lock is held: a retry per
+ * millisecond, and as much again for wakeups.
+ */
+#define POLL_TEST_BUSY_PASSES   (2 * POLL_TEST_BUSY_US / 1000)
+
+typedef struct PollTestTimer {
+   int64 delay;        /* Microseconds */
+   Bool removed;       /* Removed before it is due */
+   unsigned int fired;
+   int64 firedAt;
+} PollTestTimer;
+
+typedef struct PollTestBusy {
+   MXUserRecLock *lock;
+   GMutex mutex;
+   GCond cond;
+   Bool locked;
+   Bool release;
+} PollTestBusy;
+
+static int64 gStart;
+static unsigned int gFired;
+static int gPipe[2];
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestTimerFire --
+ * PollTestCount --
+ * PollTestRead --
+ *
+ *    Callbacks of the tests, recording that they fired.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+PollTestTimerFire(void *clientData)   // IN: PollTestTimer
+{
+   PollTestTimer *timer = clientData;
+
+   timer->fired++;
+   timer->firedAt = g_get_monotonic_time();
+}
+
+
+static void
+PollTestCount(void *clientData)   // IN: unused
+{
+   gFired++;
+}
+
+
+static void
+PollTestRead(void *clientData)   // IN: unused
+{
+   char c;
+
+   if (read(gPipe[0], &c, 1) == 1) {
+      gFired++;
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestRun --
+ *
+ *    Run the loop for a while.
+ *
+ * Results:
+ *    The number of passes of the loop.
+ *
+ * Side effects:
+ *    Callbacks fire.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static unsigned int
+PollTestRun(int64 duration)   // IN: microseconds
+{
+   int64 end = g_get_monotonic_time() + duration;
+   unsigned int passes = 0;
+   int64 now;
+
+   while ((now = g_get_monotonic_time()) < end) {
+      Poll_LoopTimeout(FALSE, NULL, POLL_CLASS_MAIN, end - now);
+      passes++;
+   }
+   return passes;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestTimers --
+ *
+ *    One-shot timers ending on every level of the wheel.
+ *
+ * Results:
+ *    TRUE if the test passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+PollTestTimers(void)
+{
+   static const int64 delaysMs[] = {
+      1, 2, 5, 10, 63, 64, 65, 100, 127, 128, 500, 1000, 4095, 4096, 4100,
+      5000,
+   };
+   PollTestTimer timers[2 * ARRAYSIZE(delaysMs)];
+   Bool ok = TRUE;
+   unsigned int i;
+
+   memset(timers, 0, sizeof timers);
+   gStart = g_get_monotonic_time();
+   for (i = 0; i < ARRAYSIZE(timers); i++) {
+      timers[i].delay = delaysMs[i / 2] * 1000 + (i % 2) * 500;
+      timers[i].removed = i % 4 == 3;
+      Poll_CB_RTime(PollTestTimerFire, &timers[i], timers[i].delay, FALSE,
+                    NULL);
+   }
+   for (i = 0; i < ARRAYSIZE(timers); i++) {
+      if (timers[i].removed &&
+          !Poll_CB_RTimeRemove(PollTestTimerFire, &timers[i], FALSE)) {
+         printf("   timer %"FMT64"dus cannot be removed\n", timers[i].delay);
+         ok = FALSE;
+      }
+   }
+
+   PollTestRun(delaysMs[ARRAYSIZE(delaysMs) - 1] * 1000 * 17 / 16 +
+               POLL_TEST_TOLERANCE_US);
+
+   for (i = 0; i < ARRAYSIZE(timers); i++) {
+      PollTestTimer *timer = &timers[i];
+      int64 late = timer->firedAt - gStart - timer->delay;
+
+      if (timer->removed) {
+         if (timer->fired != 0) {
+            printf("   removed timer %"FMT64"dus fired\n", timer->delay);
+            ok = FALSE;
+         }
+      } else if (timer->fired != 1) {
+         printf("   timer %"FMT64"dus fired %u times\n", timer->delay,
+                timer->fired);
+         ok = FALSE;
+      } else if (late < 0 ||
+                 late > timer->delay / 16 + 1000 + POLL_TEST_TOLERANCE_US) {
+         printf("   timer %"FMT64"dus fired %"FMT64"dus late\n",
+                timer->delay, late);
+         ok = FALSE;
+      }
+   }
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestPeriodic --
+ *
+ *    A periodic timer.
+ *
+ * Results:
+ *    TRUE if the test passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+PollTestPeriodic(void)
+{
+   gFired = 0;
+   Poll_CB_RTime(PollTestCount, NULL, 10 * 1000, TRUE, NULL);
+   PollTestRun(205 * 1000);
+   Poll_CB_RTimeRemove(PollTestCount, NULL, TRUE);
+
+   if (gFired < 15 || gFired > 20) {
+      printf("   10ms periodic timer fired %u times in 205ms\n", gFired);
+      return FALSE;
+   }
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestBusyThread --
+ *
+ *    Hold the callback lock until told to drop it.
+ *
+ * Results:
+ *    NULL.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+PollTestBusyThread(gpointer data)   // IN: PollTestBusy
+{
+   PollTestBusy *busy = data;
+
+   MXUser_AcquireRecLock(busy->lock);
+   g_mutex_lock(&busy->mutex);
+   busy->locked = TRUE;
+   g_cond_broadcast(&busy->cond);
+   while (!busy->release) {
+      g_cond_wait(&busy->cond, &busy->mutex);
+   }
+   g_mutex_unlock(&busy->mutex);
+   MXUser_ReleaseRecLock(busy->lock);
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestBusyRun --
+ *
+ *    A callback whose lock another thread holds: a timer, or a read
+ *    callback on a ready pipe.
+ *
+ * Results:
+ *    TRUE if the test passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+PollTestBusyRun(Bool device)   // IN: test a device, else a timer
+{
+   PollTestBusy busy;
+   GThread *thread;
+   unsigned int passes;
+   Bool ok = TRUE;
+
+   memset(&busy, 0, sizeof busy);
+   busy.lock = MXUser_CreateRecLock("pollTestLock", RANK_UNRANKED);
+   g_mutex_init(&busy.mutex);
+   g_cond_init(&busy.cond);
+
+   thread = g_thread_new("pollTestBusy", PollTestBusyThread, &busy);
+   g_mutex_lock(&busy.mutex);
+   while (!busy.locked) {
+      g_cond_wait(&busy.cond, &busy.mutex);
+   }
+   g_mutex_unlock(&busy.mutex);
+
+   gFired = 0;
+   if (device) {
+      if (pipe(gPipe) < 0 || write(gPipe[1], "x", 1) != 1) {
+         printf("   cannot set up the pipe\n");
+         return FALSE;
+      }
+      Poll_Callback(POLL_CS_MAIN, POLL_FLAG_READ | POLL_FLAG_PERIODIC,
+                    PollTestRead, NULL, POLL_DEVICE, gPipe[0], busy.lock);
+   } else {
+      Poll_CB_RTime(PollTestCount, NULL, 0, FALSE, busy.lock);
+   }
+
+   passes = PollTestRun(POLL_TEST_BUSY_US);
+   if (gFired != 0) {
+      printf("   callback fired with its lock held\n");
+      ok = FALSE;
+   }
+   if (passes > POLL_TEST_BUSY_PASSES) {
+      printf("   loop ran %u passes in %ums with the lock held\n", passes,
+             POLL_TEST_BUSY_US / 1000);
+      ok = FALSE;
+   }
+
+   g_mutex_lock(&busy.mutex);
+   busy.release = TRUE;
+   g_cond_broadcast(&busy.cond);
+   g_mutex_unlock(&busy.mutex);
+   g_thread_join(thread);
+
+   PollTestRun(20 * 1000);
+   if (gFired != 1) {
+      printf("   callback fired %u times after its lock was dropped\n",
+             gFired);
+      ok = FALSE;
+   }
+
+   if (device) {
+      Poll_CallbackRemove(POLL_CS_MAIN, POLL_FLAG_READ | POLL_FLAG_PERIODIC,
+                          PollTestRead, NULL, POLL_DEVICE);
+      close(gPipe[0]);
+      close(gPipe[1]);
+   }
+   g_cond_clear(&busy.cond);
+   g_mutex_clear(&busy.mutex);
+   MXUser_DestroyRecLock(busy.lock);
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * PollTestBusyTimer --
+ * PollTestBusyDevice --
+ *
+ *    The busy tests, see PollTestBusyRun.
+ *
+ * Results:
+ *    TRUE if the test passed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+PollTestBusyTimer(void)
+{
+   return PollTestBusyRun(FALSE);
+}
+
+
+static Bool
+PollTestBusyDevice(void)
+{
+   return PollTestBusyRun(TRUE);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Run the tests named on the command line, or all of them.
+ *
+ * Results:
+ *    0 if all tests passed, 1 otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,       // IN
+     char *argv[])   // IN
+{
+   static const struct {
+      const char *name;
+      Bool (*run)(void);
+   } tests[] = {
+      { "timers",      PollTestTimers },
+      { "periodic",    PollTestPeriodic },
+      { "busy-timer",  PollTestBusyTimer },
+      { "busy-device", PollTestBusyDevice },
+   };
+   Bool ok = TRUE;
+   unsigned int i;
+
+   Poll_InitEpoll();
+
+   for (i = 0; i < ARRAYSIZE(tests); i++) {
+      Bool passed;
+
+      if (argc > 1) {
+         int j;
+
+         for (j = 1; j < argc; j++) {
+            if (strcmp(argv[j], tests[i].name) == 0) {
+               break;
+            }
+         }
+         if (j == argc) {
+            continue;
+         }
+      }
+
+      passed = tests[i].run();
+      printf("%-12s %s\n", tests[i].name, passed ? "PASS" : "FAIL");
+      ok = ok && passed;
+   }
+
+   Poll_Exit();
+   return ok ? 0 : 1;
+}
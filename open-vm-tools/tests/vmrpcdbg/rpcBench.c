@@ -0,0 +1,933 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * rpcBench.c --
+ *
+ *   Benchmark and fuzz-load tool for the guest side of GuestRPC. Messages
+ *   are handed straight to RpcChannel_Dispatch, the way the TCLO loop does
+ *   it, without a host or a VM:
+ *
+ *   - dispatch: cost of one dispatch with 1 to 4096 registered callbacks.
+ *   - xdr: encoding with RpcChannel_BuildXdrCommand and decoding through
+ *     the xdrIn path of the dispatcher, using NIC info messages.
+ *   - fuzz: mutated and random messages, including random XDR payloads.
+ *     Meant to be run under valgrind or a sanitizer build.
+ *   - replay: a trace of TCLO commands, one per line, as sent by the host.
+ *     Every distinct command name gets a callback that replies OK.
+ *   - reply: a callback that parses two arguments and formats its reply,
+ *     with malloc'ed copies and with the per-RPC arena.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "vmware.h"
+#include "vmware/tools/guestrpc.h"
+#include "hostinfo.h"
+#include "nicInfo.h"
+#include "str.h"
+#include "strutil.h"
+#include "util.h"
+
+#define RPC_BENCH_DEFAULT_ITERATIONS  1000000
+#define RPC_BENCH_CMD_FMT             "bench.cmd.%u"
+#define RPC_BENCH_XDR_CMD             "bench.xdr"
+#define RPC_BENCH_REPLY_MSG           "bench.reply option.name 42"
+#define RPC_BENCH_FUZZ_MAX_LEN        512
+#define RPC_BENCH_MAX_LINE            4096
+
+typedef struct RpcBenchCallbacks {
+   RpcChannel *chan;
+   RpcChannelCallback *rpcs;
+   unsigned int count;
+} RpcBenchCallbacks;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchOk --
+ *
+ *    RPC callback that replies OK with an empty result.
+ *
+ * Results:
+ *    TRUE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+RpcBenchOk(RpcInData *data)   // IN/OUT
+{
+   return RPCIN_SETRETVALS(data, "", TRUE);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchRegister --
+ *
+ *    Create a channel and register callbacks under the given names. The
+ *    channel is never started, only the dispatcher is used.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    Takes ownership of the names.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcBenchRegister(RpcBenchCallbacks *cbs,   // OUT
+                 char **names,             // IN: g_malloc'ed names
+                 unsigned int count,       // IN
+                 gpointer xdrIn,           // IN: XDR function or NULL
+                 size_t xdrInSize)         // IN
+{
+   unsigned int i;
+
+   cbs->chan = RpcChannel_Create();
+   cbs->rpcs = g_new0(RpcChannelCallback, count);
+   cbs->count = count;
+
+   for (i = 0; i < count; i++) {
+      cbs->rpcs[i].name = names[i];
+      cbs->rpcs[i].callback = RpcBenchOk;
+      cbs->rpcs[i].xdrIn = xdrIn;
+      cbs->rpcs[i].xdrInSize = xdrInSize;
+      RpcChannel_RegisterCallback(cbs->chan, &cbs->rpcs[i]);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchUnregister --
+ *
+ *    Undo RpcBenchRegister.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcBenchUnregister(RpcBenchCallbacks *cbs)   // IN
+{
+   unsigned int i;
+
+   for (i = 0; i < cbs->count; i++) {
+      RpcChannel_UnregisterCallback(cbs->chan, &cbs->rpcs[i]);
+      g_free((char *)cbs->rpcs[i].name);
+   }
+   RpcChannel_Destroy(cbs->chan);
+   g_free(cbs->rpcs);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchDispatch --
+ *
+ *    Dispatch one message as RpcIn would. The message must be
+ *    NUL-terminated, len does not include the terminator.
+ *
+ * Results:
+ *    Status of the RPC.
+ *
+ * Side effects:
+ *    Runs the callback.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchDispatch(RpcChannel *chan,   // IN
+                 const char *msg,    // IN
+                 size_t len)         // IN
+{
+   RpcInData data;
+   Bool status;
+
+   memset(&data, 0, sizeof data);
+   data.clientData = chan;
+   data.args = msg;
+   data.argsSize = len;
+
+   status = RpcChannel_Dispatch(&data);
+   if (data.freeResult) {
+      vm_free(data.result);
+   }
+   return status;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchReport --
+ *
+ *    Print one result line.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcBenchReport(const char *test,      // IN
+               const char *param,     // IN
+               uint64 count,          // IN: messages
+               uint64 bytes,          // IN: message bytes
+               VmTimeType elapsed)    // IN: microseconds
+{
+   elapsed = MAX(elapsed, 1);
+   printf("%-10s %-14s %10"FMT64"u %12.0f %10.1f %10.1f\n", test, param,
+          count, (double)count * 1000000 / elapsed,
+          (double)elapsed * 1000 / MAX(count, 1),
+          (double)bytes / MAX(count, 1));
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchDispatchTest --
+ *
+ *    Dispatch messages spread over N registered callbacks, for growing N.
+ *
+ * Results:
+ *    TRUE if every RPC succeeded.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchDispatchTest(unsigned int iterations)   // IN
+{
+   static const unsigned int counts[] = { 1, 16, 256, 4096 };
+   Bool ok = TRUE;
+   unsigned int c;
+
+   for (c = 0; c < ARRAYSIZE(counts); c++) {
+      unsigned int count = counts[c];
+      RpcBenchCallbacks cbs;
+      char **names = g_new(char *, count);
+      char **msgs = g_new(char *, count);
+      size_t *lens = g_new(size_t, count);
+      char param[32];
+      uint64 bytes = 0;
+      VmTimeType start;
+      unsigned int i;
+
+      for (i = 0; i < count; i++) {
+         names[i] = g_strdup_printf(RPC_BENCH_CMD_FMT, i);
+         msgs[i] = g_strdup_printf("%s arg", names[i]);
+         lens[i] = strlen(msgs[i]);
+      }
+      RpcBenchRegister(&cbs, names, count, NULL, 0);
+
+      start = Hostinfo_SystemTimerUS();
+      for (i = 0; i < iterations; i++) {
+         unsigned int n = (i * 2654435761U) % count;
+
+         ok &= RpcBenchDispatch(cbs.chan, msgs[n], lens[n]);
+         bytes += lens[n];
+      }
+      Str_Sprintf(param, sizeof param, "%u callbacks", count);
+      RpcBenchReport("dispatch", param, iterations, bytes,
+                     Hostinfo_SystemTimerUS() - start);
+
+      RpcBenchUnregister(&cbs);
+      for (i = 0; i < count; i++) {
+         g_free(msgs[i]);
+      }
+      g_free(msgs);
+      g_free(lens);
+      g_free(names);
+   }
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchNicInfoNew --
+ *
+ *    Build a V3 NIC info message with the given number of NICs, each with
+ *    two IPv4 addresses.
+ *
+ * Results:
+ *    The message, free with RpcBenchNicInfoFree.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static GuestNicProto *
+RpcBenchNicInfoNew(unsigned int nics)   // IN
+{
+   GuestNicProto *msg = g_new0(GuestNicProto, 1);
+   NicInfoV3 *info = g_new0(NicInfoV3, 1);
+   unsigned int i;
+
+   msg->ver = NIC_INFO_V3;
+   msg->GuestNicProto_u.nicInfoV3 = info;
+
+   info->nics.nics_len = nics;
+   info->nics.nics_val = g_new0(GuestNicV3, nics);
+   for (i = 0; i < nics; i++) {
+      GuestNicV3 *nic = &info->nics.nics_val[i];
+      unsigned int j;
+
+      nic->macAddress = g_strdup_printf("00:50:56:00:%02x:%02x",
+                                        (i >> 8) & 0xff, i & 0xff);
+      nic->ips.ips_len = 2;
+      nic->ips.ips_val = g_new0(IpAddressEntry, 2);
+      for (j = 0; j < 2; j++) {
+         IpAddressEntry *ip = &nic->ips.ips_val[j];
+         char *addr = g_malloc(4);
+
+         addr[0] = 10;
+         addr[1] = j;
+         addr[2] = (i >> 8) & 0xff;
+         addr[3] = i & 0xff;
+         ip->ipAddressAddr.ipAddressAddrType = IAT_IPV4;
+         ip->ipAddressAddr.ipAddressAddr.InetAddress_len = 4;
+         ip->ipAddressAddr.ipAddressAddr.InetAddress_val = addr;
+         ip->ipAddressPrefixLength = 16;
+      }
+   }
+
+   return msg;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchNicInfoFree --
+ *
+ *    Free a message from RpcBenchNicInfoNew.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcBenchNicInfoFree(GuestNicProto *msg)   // IN
+{
+   NicInfoV3 *info = msg->GuestNicProto_u.nicInfoV3;
+   unsigned int i;
+
+   for (i = 0; i < info->nics.nics_len; i++) {
+      GuestNicV3 *nic = &info->nics.nics_val[i];
+      unsigned int j;
+
+      for (j = 0; j < nic->ips.ips_len; j++) {
+         g_free(nic->ips.ips_val[j].ipAddressAddr.ipAddressAddr.InetAddress_val);
+      }
+      g_free(nic->ips.ips_val);
+      g_free(nic->macAddress);
+   }
+   g_free(info->nics.nics_val);
+   g_free(info);
+   g_free(msg);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchXdrTest --
+ *
+ *    Encode NIC info messages of a few sizes, then dispatch them to a
+ *    callback which has the dispatcher decode them.
+ *
+ * Results:
+ *    TRUE if every message was encoded and decoded.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchXdrTest(unsigned int iterations)   // IN
+{
+   static const unsigned int nics[] = { 1, 8, 64 };
+   unsigned int n = MAX(iterations / 100, 1);
+   Bool ok = TRUE;
+   unsigned int c;
+
+   for (c = 0; c < ARRAYSIZE(nics); c++) {
+      GuestNicProto *msg = RpcBenchNicInfoNew(nics[c]);
+      RpcBenchCallbacks cbs;
+      char *name = g_strdup(RPC_BENCH_XDR_CMD);
+      char param[32];
+      char *data = NULL;
+      size_t dataLen = 0;
+      VmTimeType start;
+      unsigned int i;
+
+      Str_Sprintf(param, sizeof param, "%u nics", nics[c]);
+
+      start = Hostinfo_SystemTimerUS();
+      for (i = 0; i < n && ok; i++) {
+         free(data);
+         ok = RpcChannel_BuildXdrCommand(RPC_BENCH_XDR_CMD, xdr_GuestNicProto,
+                                         msg, &data, &dataLen);
+      }
+      if (!ok) {
+         fprintf(stderr, "xdr: cannot encode %s\n", param);
+         g_free(name);
+         RpcBenchNicInfoFree(msg);
+         return FALSE;
+      }
+      RpcBenchReport("xdr-enc", param, n, (uint64)n * dataLen,
+                     Hostinfo_SystemTimerUS() - start);
+
+      /*
+       * The dispatcher wants a NUL-terminated message, which
+       * RpcChannel_BuildXdrCommand does not guarantee.
+       */
+      data = Util_SafeRealloc(data, dataLen + 1);
+      data[dataLen] = '\0';
+
+      RpcBenchRegister(&cbs, &name, 1, xdr_GuestNicProto,
+                       sizeof(GuestNicProto));
+      start = Hostinfo_SystemTimerUS();
+      for (i = 0; i < n && ok; i++) {
+         ok = RpcBenchDispatch(cbs.chan, data, dataLen);
+      }
+      if (!ok) {
+         fprintf(stderr, "xdr: cannot decode %s\n", param);
+      } else {
+         RpcBenchReport("xdr-dec", param, n, (uint64)n * dataLen,
+                        Hostinfo_SystemTimerUS() - start);
+      }
+
+      RpcBenchUnregister(&cbs);
+      free(data);
+      RpcBenchNicInfoFree(msg);
+   }
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchFuzzTest --
+ *
+ *    Dispatch messages made of a registered command name followed by
+ *    random bytes, mutated copies of valid XDR messages and fully random
+ *    data. The results are not checked, the dispatcher only has to
+ *    survive.
+ *
+ * Results:
+ *    TRUE.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchFuzzTest(unsigned int iterations,   // IN
+                 unsigned int seed)         // IN
+{
+   GRand *rand = g_rand_new_with_seed(seed);
+   GuestNicProto *nicMsg = RpcBenchNicInfoNew(4);
+   RpcBenchCallbacks cbs;
+   RpcBenchCallbacks xdrCbs;
+   char **names = g_new(char *, 16);
+   char *xdrName = g_strdup(RPC_BENCH_XDR_CMD);
+   char *xdrData;
+   size_t xdrLen;
+   char *buf = g_malloc(RPC_BENCH_FUZZ_MAX_LEN + 1);
+   uint64 bytes = 0;
+   uint64 failed = 0;
+   VmTimeType start;
+   unsigned int i;
+
+   for (i = 0; i < 16; i++) {
+      names[i] = g_strdup_printf(RPC_BENCH_CMD_FMT, i);
+   }
+   RpcBenchRegister(&cbs, names, 16, NULL, 0);
+   RpcBenchRegister(&xdrCbs, &xdrName, 1, xdr_GuestNicProto,
+                    sizeof(GuestNicProto));
+
+   if (!RpcChannel_BuildXdrCommand(RPC_BENCH_XDR_CMD, xdr_GuestNicProto,
+                                   nicMsg, &xdrData, &xdrLen)) {
+      fprintf(stderr, "fuzz: cannot encode the seed message\n");
+      xdrData = NULL;
+      xdrLen = 0;
+   }
+   xdrLen = MIN(xdrLen, RPC_BENCH_FUZZ_MAX_LEN);
+
+   start = Hostinfo_SystemTimerUS();
+   for (i = 0; i < iterations; i++) {
+      RpcChannel *chan = cbs.chan;
+      size_t len = g_rand_int_range(rand, 0, RPC_BENCH_FUZZ_MAX_LEN + 1);
+      size_t pos = 0;
+      size_t j;
+
+      switch (i % 3) {
+      case 0:
+         pos = Str_Sprintf(buf, RPC_BENCH_FUZZ_MAX_LEN + 1, RPC_BENCH_CMD_FMT,
+                           g_rand_int_range(rand, 0, 17));
+         len = MAX(len, pos);
+         break;
+      case 1:
+         if (xdrData != NULL) {
+            chan = xdrCbs.chan;
+            memcpy(buf, xdrData, xdrLen);
+            len = g_rand_int_range(rand, 0, xdrLen + 1);
+            for (j = 0; j < 4; j++) {
+               buf[g_rand_int_range(rand, 0, xdrLen)] = g_rand_int(rand);
+            }
+            pos = len;
+         }
+         break;
+      default:
+         break;
+      }
+
+      for (j = pos; j < len; j++) {
+         buf[j] = g_rand_int(rand);
+      }
+      buf[len] = '\0';
+
+      if (!RpcBenchDispatch(chan, buf, len)) {
+         failed++;
+      }
+      bytes += len;
+   }
+   RpcBenchReport("fuzz", "mixed", iterations, bytes,
+                  Hostinfo_SystemTimerUS() - start);
+   printf("fuzz: seed %u, %"FMT64"u of %u messages rejected\n",
+          seed, failed, iterations);
+
+   RpcBenchUnregister(&xdrCbs);
+   RpcBenchUnregister(&cbs);
+   g_free(names);
+   free(xdrData);
+   g_free(buf);
+   RpcBenchNicInfoFree(nicMsg);
+   g_rand_free(rand);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchReplayTest --
+ *
+ *    Replay a TCLO trace, one command per line as the host sends it.
+ *    Empty lines and lines starting with '#' are skipped. The trace is
+ *    replayed until at least the given number of messages was dispatched.
+ *
+ * Results:
+ *    TRUE if the trace could be read and every RPC succeeded.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchReplayTest(const char *path,          // IN
+                   unsigned int iterations)   // IN
+{
+   GPtrArray *msgs = g_ptr_array_new_with_free_func(g_free);
+   GHashTable *seen = g_hash_table_new(g_str_hash, g_str_equal);
+   GPtrArray *names = g_ptr_array_new();
+   RpcBenchCallbacks cbs;
+   char line[RPC_BENCH_MAX_LINE];
+   uint64 count = 0;
+   uint64 bytes = 0;
+   Bool ok = TRUE;
+   VmTimeType start;
+   FILE *f;
+
+   f = fopen(path, "r");
+   if (f == NULL) {
+      fprintf(stderr, "replay: cannot open %s\n", path);
+      return FALSE;
+   }
+
+   while (fgets(line, sizeof line, f) != NULL) {
+      size_t len = strcspn(line, "\r\n");
+      char *name;
+
+      line[len] = '\0';
+      if (len == 0 || line[0] == '#') {
+         continue;
+      }
+
+      name = g_strndup(line, strcspn(line, " "));
+      if (*name == '\0' || g_hash_table_lookup(seen, name) != NULL) {
+         g_free(name);
+      } else {
+         g_hash_table_insert(seen, name, name);
+         g_ptr_array_add(names, name);
+      }
+      g_ptr_array_add(msgs, g_strdup(line));
+   }
+   fclose(f);
+   g_hash_table_destroy(seen);
+
+   if (msgs->len == 0) {
+      fprintf(stderr, "replay: no commands in %s\n", path);
+      g_ptr_array_free(names, TRUE);
+      g_ptr_array_free(msgs, TRUE);
+      return FALSE;
+   }
+
+   RpcBenchRegister(&cbs, (char **)names->pdata, names->len, NULL, 0);
+
+   start = Hostinfo_SystemTimerUS();
+   while (count < iterations) {
+      unsigned int i;
+
+      for (i = 0; i < msgs->len; i++) {
+         const char *msg = g_ptr_array_index(msgs, i);
+         size_t len = strlen(msg);
+
+         ok &= RpcBenchDispatch(cbs.chan, msg, len);
+         bytes += len;
+      }
+      count += msgs->len;
+   }
+   RpcBenchReport("replay", "trace", count, bytes,
+                  Hostinfo_SystemTimerUS() - start);
+   printf("replay: %u messages, %u commands\n", msgs->len, names->len);
+
+   RpcBenchUnregister(&cbs);
+   g_ptr_array_free(names, TRUE);
+   g_ptr_array_free(msgs, TRUE);
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchReplyMalloc --
+ *
+ *    RPC callback that parses "<name> <number>" and echoes both back, with
+ *    StrUtil_GetNextToken and g_strdup_printf as most handlers do.
+ *
+ * Results:
+ *    TRUE if the arguments parsed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+RpcBenchReplyMalloc(RpcInData *data)   // IN/OUT
+{
+   unsigned int index = 0;
+   char *name = StrUtil_GetNextToken(&index, data->args, " ");
+   uint32 value;
+   gboolean ok = name != NULL &&
+                 StrUtil_GetNextUintToken(&value, &index, data->args, " ");
+
+   if (!ok) {
+      free(name);
+      return RPCIN_SETRETVALS(data, "Bad arguments", FALSE);
+   }
+
+   RPCIN_SETRETVALSF(data, g_strdup_printf("%s=%u", name, value), TRUE);
+   free(name);
+   return TRUE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchReplyArena --
+ *
+ *    Same as RpcBenchReplyMalloc, using the arena of the RPC.
+ *
+ * Results:
+ *    TRUE if the arguments parsed.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gboolean
+RpcBenchReplyArena(RpcInData *data)   // IN/OUT
+{
+   size_t index = 0;
+   size_t len;
+   const char *name = RpcChannel_NextArg(data, &index, " ", &len);
+   guint32 value;
+
+   if (name == NULL || !RpcChannel_NextArgUint(data, &index, " ", &value)) {
+      return RPCIN_SETRETVALS(data, "Bad arguments", FALSE);
+   }
+
+   return RPCIN_SETRETVALS(data,
+                           RpcChannel_Printf(data, "%.*s=%u", (int)len, name,
+                                             value),
+                           TRUE);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchReplyTest --
+ *
+ *    Dispatch one message to a callback that parses its arguments and
+ *    formats its reply, once allocating with malloc and once in the arena.
+ *
+ * Results:
+ *    TRUE if every RPC succeeded.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchReplyTest(unsigned int iterations)   // IN
+{
+   static const struct {
+      const char *param;
+      RpcIn_Callback callback;
+   } tests[] = {
+      { "malloc", RpcBenchReplyMalloc },
+      { "arena",  RpcBenchReplyArena  },
+   };
+   size_t len = strlen(RPC_BENCH_REPLY_MSG);
+   Bool ok = TRUE;
+   unsigned int t;
+
+   for (t = 0; t < ARRAYSIZE(tests); t++) {
+      RpcChannel *chan = RpcChannel_Create();
+      RpcChannelCallback rpc = { "bench.reply", tests[t].callback };
+      VmTimeType start;
+      unsigned int i;
+
+      RpcChannel_RegisterCallback(chan, &rpc);
+
+      start = Hostinfo_SystemTimerUS();
+      for (i = 0; i < iterations; i++) {
+         ok &= RpcBenchDispatch(chan, RPC_BENCH_REPLY_MSG, len);
+      }
+      RpcBenchReport("reply", tests[t].param, iterations,
+                     (uint64)iterations * len,
+                     Hostinfo_SystemTimerUS() - start);
+
+      RpcChannel_UnregisterCallback(chan, &rpc);
+      RpcChannel_Destroy(chan);
+   }
+
+   return ok;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchUsage --
+ *
+ *    Print the usage message.
+ *
+ * Results:
+ *    None.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+RpcBenchUsage(const char *prog)   // IN: program name
+{
+   fprintf(stderr,
+           "Usage: %s [-n iterations] [-s seed] [-r trace] [test...]\n"
+           "  -n iterations  messages per test (%u), XDR tests use a\n"
+           "                 hundredth of it\n"
+           "  -s seed        seed for the fuzz test\n"
+           "  -r trace       TCLO trace to replay, one command per line\n"
+           "  test           dispatch, xdr, fuzz, replay or reply, default\n"
+           "                 all\n",
+           prog, RPC_BENCH_DEFAULT_ITERATIONS);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RpcBenchSelected --
+ *
+ *    Check whether a test was named on the command line.
+ *
+ * Results:
+ *    TRUE if it was.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Bool
+RpcBenchSelected(int argc,            // IN
+                 char *argv[],        // IN
+                 const char *test)    // IN
+{
+   int i;
+
+   for (i = 0; i < argc; i++) {
+      if (strcmp(argv[i], test) == 0) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * main --
+ *
+ *    Run the selected tests.
+ *
+ * Results:
+ *    0 if all tests succeeded, 1 otherwise.
+ *
+ * Side effects:
+ *    None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+main(int argc,       // IN
+     char *argv[])   // IN
+{
+   unsigned int iterations = RPC_BENCH_DEFAULT_ITERATIONS;
+   unsigned int seed = (unsigned int)Hostinfo_SystemTimerUS();
+   const char *trace = NULL;
+   Bool all;
+   int result = 0;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "n:s:r:h")) != -1) {
+      switch (opt) {
+      case 'n':
+         iterations = strtoul(optarg, NULL, 0);
+         break;
+      case 's':
+         seed = strtoul(optarg, NULL, 0);
+         break;
+      case 'r':
+         trace = optarg;
+         break;
+      default:
+         RpcBenchUsage(argv[0]);
+         return 1;
+      }
+   }
+   all = optind == argc;
+
+#define RPC_BENCH_SELECTED(test)                                        \
+   (all || RpcBenchSelected(argc - optind, argv + optind, test))
+
+   printf("%-10s %-14s %10s %12s %10s %10s\n",
+          "test", "param", "msgs", "msgs/s", "ns/msg", "bytes/msg");
+
+   if (RPC_BENCH_SELECTED("dispatch") && !RpcBenchDispatchTest(iterations)) {
+      result = 1;
+   }
+   if (RPC_BENCH_SELECTED("xdr") && !RpcBenchXdrTest(iterations)) {
+      result = 1;
+   }
+   if (RPC_BENCH_SELECTED("fuzz") && !RpcBenchFuzzTest(iterations, seed)) {
+      result = 1;
+   }
+   if (RPC_BENCH_SELECTED("replay")) {
+      if (trace == NULL) {
+         if (!all) {
+            fprintf(stderr, "replay: no trace given, use -r\n");
+            result = 1;
+         }
+      } else if (!RpcBenchReplayTest(trace, iterations)) {
+         result = 1;
+      }
+   }
+
+   if (RPC_BENCH_SELECTED("reply") && !RpcBenchReplyTest(iterations)) {
+      result = 1;
+   }
+
+#undef RPC_BENCH_SELECTED
+
+   return result;
+}
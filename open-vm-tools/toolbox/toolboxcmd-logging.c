@@ -243,6 +243,16 @@ Logging_Command(char **argv,      // IN: Command line arguments
                                      argv[optind + 1]);
          return EX_USAGE;
       }
+   } else if (toolbox_strcmp(subcommand, "binlog") == 0) {
+      if (toolbox_strcmp(op, "decode") == 0) {
+         return VMTools_DecodeBinaryLog(argv[optind + 2], stdout) ? EXIT_SUCCESS
+                                                                  : EX_DATAERR;
+      } else {
+         ToolsCmd_UnknownEntityError(argv[0],
+                                     SU_(arg.subcommand, "subcommand"),
+                                     argv[optind + 1]);
+         return EX_USAGE;
+      }
    } else {
       ToolsCmd_UnknownEntityError(argv[0],
                                   SU_(arg.subcommand, "subcommand"),
@@ -273,14 +283,16 @@ Logging_Help(const char *progName, // IN: The name of the program obtained from
              const char *cmd)      // IN
 {
    g_print(SU_(help.logging,
-               "%s: modify tools logging\n"
-               "Usage: %s %s level <subcommand> <servicename> <level>\n\n"
+               "%1$s: modify tools logging\n"
+               "Usage: %2$s %3$s level <subcommand> <servicename> <level>\n"
+               "       %2$s %3$s binlog decode <file>\n\n"
                "Subcommands:\n"
                "   get <servicename>: display current level\n"
-               "   set <servicename> <level>: set current level\n\n"
+               "   set <servicename> <level>: set current level\n"
+               "   decode <file>: print the messages in a binary log file\n\n"
                "<servicename> can be any supported service, such as vmsvc or vmusr\n"
                "<level> can be one of error, critical, warning, info, message, debug\n"
-               "   default is %s\n"),
+               "   default is %4$s\n"),
            cmd, progName, cmd, VMTOOLS_LOGGING_LEVEL_DEFAULT);
 }
 
@@ -36,6 +36,7 @@
 #include "wiper.h"
 #include "vmware/guestrpc/tclodefs.h"
 #include "vmware/tools/i18n.h"
+#include "vmware/tools/utils.h"
 
 #ifndef _WIN32
 static void ShrinkWiperDestroy(int signal);
@@ -67,6 +68,26 @@ static Wiper_State *wiper = NULL;
 
 #define WIPER_STATE_CMD "disk.wiper.enable"
 
+/*
+ * tools.conf settings of background wipes, which leave room and I/O
+ * bandwidth to the workloads running in the guest.
+ */
+#define CONFGROUPNAME_DISKWIPER "diskwiper"
+#define CONFNAME_DISKWIPER_BACKGROUND "background"
+#define CONFNAME_DISKWIPER_FREESPACEFLOOR "freeSpaceFloorMB"
+#define CONFNAME_DISKWIPER_MAXREADLATENCY "maxReadLatency"
+
+#define SHRINK_DEFAULT_FREESPACEFLOOR_MB 1024
+#define SHRINK_DEFAULT_MAXREADLATENCY_MS 20
+
+#ifndef _WIN32
+static struct {
+   gboolean enabled;
+   uint64 freeFloor;          // bytes
+   unsigned int maxLatency;   // ms
+} shrinkBackground;
+#endif
+
 typedef enum {
    WIPER_UNAVAILABLE,
    WIPER_DISABLED,
@@ -317,59 +338,129 @@ ShrinkDoAllDiskShrinkOnly(void)
 }
 
 
+#ifndef _WIN32
 /*
  *-----------------------------------------------------------------------------
  *
- * ShrinkDoWipeAndShrink  --
+ * ShrinkLoadBackgroundConfig  --
  *
- *      Wipe a single partition, returning only when the wiper
- *      operation is done or canceled.
- *      Caller can optionally indicate whether a disk shrink operation is required
- *      to be performed after the wipe operation or not.
+ *      Reads the background wipe settings from tools.conf.
  *
  * Results:
- *      EXIT_SUCCESS on success.
+ *      None.
+ *
+ * Side effects:
+ *      Sets shrinkBackground.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+ShrinkLoadBackgroundConfig(void)
+{
+   GKeyFile *conf = NULL;
+   gint floorMB;
+
+   VMTools_LoadConfig(NULL, G_KEY_FILE_NONE, &conf, NULL);
+
+   shrinkBackground.enabled =
+      VMTools_ConfigGetBoolean(conf, CONFGROUPNAME_DISKWIPER,
+                               CONFNAME_DISKWIPER_BACKGROUND, FALSE);
+   floorMB = VMTools_ConfigGetInteger(conf, CONFGROUPNAME_DISKWIPER,
+                                      CONFNAME_DISKWIPER_FREESPACEFLOOR,
+                                      SHRINK_DEFAULT_FREESPACEFLOOR_MB);
+   shrinkBackground.freeFloor = (uint64)MAX(0, floorMB) << 20;
+   shrinkBackground.maxLatency =
+      MAX(0, VMTools_ConfigGetInteger(conf, CONFGROUPNAME_DISKWIPER,
+                                      CONFNAME_DISKWIPER_MAXREADLATENCY,
+                                      SHRINK_DEFAULT_MAXREADLATENCY_MS));
+
+   if (shrinkBackground.enabled) {
+      g_debug("Background wipe: free space floor %"FMT64"u bytes, "
+              "read latency target %u ms\n",
+              shrinkBackground.freeFloor, shrinkBackground.maxLatency);
+   }
+
+   if (conf != NULL) {
+      g_key_file_free(conf);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkWiperStart  --
+ *
+ *      Starts wiping a partition, in background mode if so configured.
+ *
+ * Results:
+ *      The wiper state, NULL on failure.
+ *
+ * Side effects:
+ *      In background mode, lowers the I/O priority of the calling thread.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static Wiper_State *
+ShrinkWiperStart(const WiperPartition *part)   // IN
+{
+   Wiper_State *state = Wiper_Start(part, MAX_WIPER_FILE_SIZE);
+
+   if (state != NULL && shrinkBackground.enabled) {
+      Wiper_SetBackground(state, shrinkBackground.freeFloor,
+                          shrinkBackground.maxLatency);
+   }
+   return state;
+}
+#else
+#define ShrinkWiperStart(part) Wiper_Start((part), MAX_WIPER_FILE_SIZE)
+#endif
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkFindPartition  --
+ *
+ *      Looks up the wiper partition mounted at the given location and verifies
+ *      that it can be wiped / shrunk.
+ *
+ * Results:
+ *      EXIT_SUCCESS on success, with the detached partition in *part.
  *      EX_OSFILE if partition is not found.
- *      EX_TEMPFAIL on failure.
+ *      EX_UNAVAILABLE if the partition is not shrinkable.
+ *      EX_TEMPFAIL if wiping / shrinking is not permitted.
  *
  * Side effects:
- *      The wipe operation will fill the partition with dummy files.
  *      Prints to stderr on errors.
  *
  *-----------------------------------------------------------------------------
  */
 
 static int
-ShrinkDoWipeAndShrink(char *mountPoint,         // IN: mount point
-                      gboolean quiet,           // IN: verbosity flag
-                      gboolean performShrink)   // IN: perform a shrink operation
+ShrinkFindPartition(const char *mountPoint,   // IN: mount point
+                    WiperPartition **part)    // OUT: partition
 {
-   int i;
-   int progress = 0;
-   unsigned char *err;
-   WiperPartition *part = NULL;
    WiperPartition_List plist;
-   int rc;
+   WiperPartition *found = NULL;
 
-#if defined(_WIN32)
-   DWORD currPriority = GetPriorityClass(GetCurrentProcess());
-#else
-   signal(SIGINT, ShrinkWiperDestroy);
-#endif
+   *part = NULL;
 
    if (ShrinkGetMountPoints(&plist)) {
       DblLnkLst_Links *curr, *nextElem;
       DblLnkLst_ForEachSafe(curr, nextElem, &plist.link) {
          WiperPartition *p = DblLnkLst_Container(curr, WiperPartition, link);
          if (toolbox_strcmp(p->mountPoint, mountPoint) == 0) {
-            WiperSinglePartition_Close(part);
-            part = p;
+            WiperSinglePartition_Close(found);
+            found = p;
             /*
              * Detach the element we are interested in so it is not
              * destroyed when we call WiperPartition_Close.
              */
-            DblLnkLst_Unlink1(&part->link);
-            if (part->type != PARTITION_UNSUPPORTED) {
+            DblLnkLst_Unlink1(&found->link);
+            if (found->type != PARTITION_UNSUPPORTED) {
                break;
             }
          }
@@ -377,40 +468,61 @@ ShrinkDoWipeAndShrink(char *mountPoint,         // IN: mount point
       WiperPartition_Close(&plist);
    }
 
-   if (part == NULL) {
+   if (found == NULL) {
       ToolsCmd_PrintErr(SU_(disk.shrink.partition.notfound,
                             "Unable to find partition %s\n"),
                         mountPoint);
       return EX_OSFILE;
    }
 
-   if (part->type == PARTITION_UNSUPPORTED) {
+   if (found->type == PARTITION_UNSUPPORTED) {
       ToolsCmd_PrintErr(SU_(disk.shrink.partition.unsupported,
                             "Partition %s is not shrinkable\n"),
-                        part->mountPoint);
-      rc = EX_UNAVAILABLE;
-      goto out;
+                        found->mountPoint);
+      WiperSinglePartition_Close(found);
+      return EX_UNAVAILABLE;
    }
 
    /*
     * Verify that wiping/shrinking are permitted before going through with the
     * wiping operation.
     */
-   if (ShrinkGetWiperState() != WIPER_ENABLED && !Wiper_IsWipeSupported(part)) {
+   if (ShrinkGetWiperState() != WIPER_ENABLED && !Wiper_IsWipeSupported(found)) {
       g_debug("%s cannot be wiped / shrunk\n", mountPoint);
       ToolsCmd_PrintErr("%s",
                         SU_(disk.shrink.disabled, SHRINK_DISABLED_ERR));
-      rc = EX_TEMPFAIL;
-      goto out;
+      WiperSinglePartition_Close(found);
+      return EX_TEMPFAIL;
    }
 
-   /*
-    * During the initial 'wipe' process, the Toolbox CLI first fills the
-    * entire guest's disk space with files filled with zeroes. During this step,
-    * user may notice few warning messages related to 'low disk space' in the
-    * guest operating system. We need to print a warning message to disregard
-    * such warnings in the guest operating system.
-    */
+   *part = found;
+   return EXIT_SUCCESS;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkPrintFreeSpaceWarning  --
+ *
+ *      During the initial 'wipe' process, the Toolbox CLI first fills the
+ *      entire guest's disk space with files filled with zeroes. During this
+ *      step, user may notice few warning messages related to 'low disk space'
+ *      in the guest operating system. Print a warning message to disregard
+ *      such warnings.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+ShrinkPrintFreeSpaceWarning(gboolean performShrink)   // IN: shrink follows
+{
    if (performShrink) {
       ToolsCmd_Print("%s", SU_(disk.shrink.ignoreFreeSpaceWarnings,
                                "Please disregard any warnings about disk space "
@@ -420,8 +532,177 @@ ShrinkDoWipeAndShrink(char *mountPoint,         // IN: mount point
                                "Please disregard any warnings about disk space "
                                "for the duration of wipe process.\n"));
    }
+}
 
-   wiper = Wiper_Start(part, MAX_WIPER_FILE_SIZE);
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkPrintWiperError  --
+ *
+ *      Prints an error returned by Wiper_Next.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints to stderr.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+ShrinkPrintWiperError(const char *mountPoint,   // IN/OPT: partition
+                      const unsigned char *err) // IN: wiper error
+{
+   if (mountPoint != NULL) {
+      ToolsCmd_PrintErr("%s: ", mountPoint);
+   }
+   if (strcmp(err, "error.create") == 0) {
+      ToolsCmd_PrintErr("%s",
+                        SU_(disk.wiper.file.error,
+                            "Error, Unable to create wiper file.\n"));
+   } else {
+      ToolsCmd_PrintErr(SU_(error.message, "Error: %s\n"), err);
+   }
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkPrintProgress  --
+ *
+ *      Prints the wipe progress bar, followed by the zero-fill throughput
+ *      when it is known.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Prints to stdout.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static void
+ShrinkPrintProgress(int progress,        // IN: percent done
+                    uint64 bytesDone,    // IN: bytes written so far
+                    gint64 startTime)    // IN: monotonic start time (us)
+{
+   int i;
+   gint64 elapsed = g_get_monotonic_time() - startTime;
+
+   g_print(SU_(disk.wiper.progress, "\rProgress: %d"), progress);
+   g_print(" [");
+   for (i = 0; i <= progress / 10; i++) {
+      putchar('=');
+   }
+   g_print(">%*c", 10 - i + 1, ']');
+#ifndef _WIN32
+   if (shrinkBackground.enabled) {
+      g_print("%s", SU_(disk.wiper.background, " (background)"));
+   }
+#endif
+   if (bytesDone > 0 && elapsed > 0) {
+      g_print(SU_(disk.wiper.throughput, " %.1f MB/s  "),
+              (double)bytesDone / elapsed);
+   }
+   fflush(stdout);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkFinish  --
+ *
+ *      Completes a wipe: sends the shrink RPC if one was requested and the
+ *      wipe finished.
+ *
+ * Results:
+ *      EXIT_SUCCESS on success.
+ *      EX_TEMPFAIL on failure.
+ *
+ * Side effects:
+ *      Prints to stderr on errors.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+ShrinkFinish(gboolean wiped,          // IN: wipe completed
+             gboolean performShrink)  // IN: perform a shrink operation
+{
+   int rc;
+
+   g_print("\n");
+   if (!wiped) {
+      rc = EX_TEMPFAIL;
+   } else if (performShrink) {
+      rc = ShrinkDiskSendRPC();
+   } else {
+      rc = EXIT_SUCCESS;
+      g_debug("Shrink skipped.\n");
+   }
+
+   if (rc != EXIT_SUCCESS) {
+      ToolsCmd_PrintErr("%s",
+                        SU_(disk.shrink.incomplete, "Shrinking not completed.\n"));
+   }
+   return rc;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkDoWipeAndShrink  --
+ *
+ *      Wipe a single partition, returning only when the wiper
+ *      operation is done or canceled.
+ *      Caller can optionally indicate whether a disk shrink operation is required
+ *      to be performed after the wipe operation or not.
+ *
+ * Results:
+ *      EXIT_SUCCESS on success.
+ *      EX_OSFILE if partition is not found.
+ *      EX_TEMPFAIL on failure.
+ *
+ * Side effects:
+ *      The wipe operation will fill the partition with dummy files.
+ *      Prints to stderr on errors.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+ShrinkDoWipeAndShrink(char *mountPoint,         // IN: mount point
+                      gboolean quiet,           // IN: verbosity flag
+                      gboolean performShrink)   // IN: perform a shrink operation
+{
+   int progress = 0;
+   unsigned char *err;
+   WiperPartition *part;
+   uint64 bytesDone = 0;
+   gint64 startTime;
+   int rc;
+
+#if defined(_WIN32)
+   DWORD currPriority = GetPriorityClass(GetCurrentProcess());
+#else
+   signal(SIGINT, ShrinkWiperDestroy);
+#endif
+
+   rc = ShrinkFindPartition(mountPoint, &part);
+   if (rc != EXIT_SUCCESS) {
+      return rc;
+   }
+
+   ShrinkPrintFreeSpaceWarning(performShrink);
+
+   startTime = g_get_monotonic_time();
+   wiper = ShrinkWiperStart(part);
 
 #if defined(_WIN32)
    /*
@@ -436,25 +717,22 @@ ShrinkDoWipeAndShrink(char *mountPoint,         // IN: mount point
    while (progress < 100 && wiper != NULL) {
       err = Wiper_Next(&wiper, &progress);
       if (strlen(err) > 0) {
-         if (strcmp(err, "error.create") == 0) {
-            ToolsCmd_PrintErr("%s",
-                              SU_(disk.wiper.file.error,
-                                  "Error, Unable to create wiper file.\n"));
-         } else {
-            ToolsCmd_PrintErr(SU_(error.message, "Error: %s\n"), err);
-         }
+         ShrinkPrintWiperError(NULL, err);
          /* progress < 100 will result in "rc" of EX_TEMPFAIL */
          break;
       }
 
-      if (!quiet) {
-         g_print(SU_(disk.wiper.progress, "\rProgress: %d"), progress);
-         g_print(" [");
-         for (i = 0; i <= progress / 10; i++) {
-            putchar('=');
+#if !defined(_WIN32)
+      if (wiper != NULL) {
+         bytesDone = Wiper_GetBytesDone(wiper);
+         if (Wiper_GetDutyCycle(wiper) == 0) {
+            g_debug("Wipe of %s paused by guest I/O load\n", mountPoint);
          }
-         g_print(">%*c", 10 - i + 1, ']');
-         fflush(stdout);
+      }
+#endif
+
+      if (!quiet) {
+         ShrinkPrintProgress(progress, bytesDone, startTime);
       }
    }
 
@@ -465,27 +743,231 @@ ShrinkDoWipeAndShrink(char *mountPoint,         // IN: mount point
    }
 #endif
 
-   g_print("\n");
-   if (progress < 100) {
-      rc = EX_TEMPFAIL;
-   } else if (performShrink) {
-      rc = ShrinkDiskSendRPC();
-   } else {
-      rc = EXIT_SUCCESS;
-      g_debug("Shrink skipped.\n");
+   rc = ShrinkFinish(progress >= 100, performShrink);
+
+   WiperSinglePartition_Close(part);
+   free(wiper);
+   wiper = NULL;
+   return rc;
+}
+
+
+#ifndef _WIN32
+/*
+ * A partition being wiped by ShrinkDoWipeAndShrinkMulti. The progress fields
+ * are written by the disk's worker thread and read by the main thread, both
+ * under shrinkJobLock.
+ */
+
+typedef struct ShrinkWipeJob {
+   WiperPartition *part;
+   unsigned int progress;
+   uint64 bytesDone;
+   unsigned char *err;
+   gboolean finished;
+} ShrinkWipeJob;
+
+static GMutex shrinkJobLock;
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkWipeDiskThread  --
+ *
+ *      Worker thread wiping, one after the other, the partitions that live on
+ *      the same disk. Partitions sharing a spindle are not wiped concurrently
+ *      since that would only turn sequential writes into seeks.
+ *
+ * Results:
+ *      NULL.
+ *
+ * Side effects:
+ *      Fills the partitions with dummy files, updates the jobs' progress.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static gpointer
+ShrinkWipeDiskThread(gpointer data)   // IN: GPtrArray of ShrinkWipeJob
+{
+   GPtrArray *jobs = data;
+   guint i;
+
+   for (i = 0; i < jobs->len; i++) {
+      ShrinkWipeJob *job = g_ptr_array_index(jobs, i);
+      Wiper_State *state = ShrinkWiperStart(job->part);
+      unsigned int progress = 0;
+      unsigned char *err = NULL;
+      uint64 bytesDone = 0;
+
+      while (progress < 100 && state != NULL) {
+         err = Wiper_Next(&state, &progress);
+         if (state != NULL) {
+            bytesDone = Wiper_GetBytesDone(state);
+         }
+
+         g_mutex_lock(&shrinkJobLock);
+         job->progress = progress;
+         job->bytesDone = bytesDone;
+         if (strlen(err) > 0) {
+            job->err = err;
+         }
+         g_mutex_unlock(&shrinkJobLock);
+
+         if (strlen(err) > 0) {
+            break;
+         }
+      }
+
+      if (state != NULL) {
+         Wiper_Cancel(&state);
+      }
+
+      g_mutex_lock(&shrinkJobLock);
+      job->finished = TRUE;
+      g_mutex_unlock(&shrinkJobLock);
    }
 
+   return NULL;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkDoWipeAndShrinkMulti  --
+ *
+ *      Wipe several partitions, returning only when all wiper operations are
+ *      done. Partitions are grouped by the disk backing them; the groups are
+ *      wiped in parallel, one thread per disk.
+ *      Caller can optionally indicate whether a disk shrink operation is required
+ *      to be performed after the wipe operations or not.
+ *
+ * Results:
+ *      EXIT_SUCCESS on success.
+ *      EX_OSFILE if a partition is not found.
+ *      EX_TEMPFAIL on failure.
+ *
+ * Side effects:
+ *      The wipe operation will fill the partitions with dummy files.
+ *      Prints to stderr on errors.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+ShrinkDoWipeAndShrinkMulti(char **mountPoints,     // IN: mount points
+                           int count,              // IN: number of mount points
+                           gboolean quiet,         // IN: verbosity flag
+                           gboolean performShrink) // IN: perform a shrink operation
+{
+   ShrinkWipeJob *jobs = g_new0(ShrinkWipeJob, count);
+   GPtrArray *disks = g_ptr_array_new();     // GPtrArray of ShrinkWipeJob
+   GPtrArray *diskNames = g_ptr_array_new_with_free_func(g_free);
+   GThread **threads;
+   gboolean wiped = TRUE;
+   gboolean done = FALSE;
+   gint64 startTime;
+   int rc = EXIT_SUCCESS;
+   int i;
+   guint d;
+
+   signal(SIGINT, ShrinkWiperDestroy);
+
+   for (i = 0; i < count && rc == EXIT_SUCCESS; i++) {
+      rc = ShrinkFindPartition(mountPoints[i], &jobs[i].part);
+   }
    if (rc != EXIT_SUCCESS) {
-      ToolsCmd_PrintErr("%s",
-                        SU_(disk.shrink.incomplete, "Shrinking not completed.\n"));
+      goto out;
+   }
+
+   /*
+    * Group the partitions by backing disk. Partitions whose disk cannot be
+    * determined get a group of their own.
+    */
+   for (i = 0; i < count; i++) {
+      char *disk = WiperSinglePartition_GetDisk(jobs[i].part);
+      GPtrArray *group = NULL;
+
+      for (d = 0; disk != NULL && d < diskNames->len; d++) {
+         const char *name = g_ptr_array_index(diskNames, d);
+         if (name != NULL && strcmp(name, disk) == 0) {
+            group = g_ptr_array_index(disks, d);
+            break;
+         }
+      }
+
+      g_debug("%s is on disk %s\n", jobs[i].part->mountPoint,
+              disk != NULL ? disk : "(unknown)");
+
+      if (group == NULL) {
+         group = g_ptr_array_new();
+         g_ptr_array_add(disks, group);
+         g_ptr_array_add(diskNames, disk);
+      } else {
+         g_free(disk);
+      }
+      g_ptr_array_add(group, &jobs[i]);
    }
 
+   ShrinkPrintFreeSpaceWarning(performShrink);
+
+   startTime = g_get_monotonic_time();
+   threads = g_new0(GThread *, disks->len);
+   for (d = 0; d < disks->len; d++) {
+      threads[d] = g_thread_new("wiper", ShrinkWipeDiskThread,
+                                g_ptr_array_index(disks, d));
+   }
+
+   while (!done) {
+      uint64 progress = 0;
+      uint64 bytesDone = 0;
+
+      g_usleep(200 * 1000);
+
+      done = TRUE;
+      g_mutex_lock(&shrinkJobLock);
+      for (i = 0; i < count; i++) {
+         progress += jobs[i].progress;
+         bytesDone += jobs[i].bytesDone;
+         done = done && jobs[i].finished;
+      }
+      g_mutex_unlock(&shrinkJobLock);
+
+      if (!quiet) {
+         ShrinkPrintProgress(progress / count, bytesDone, startTime);
+      }
+   }
+
+   for (d = 0; d < disks->len; d++) {
+      g_thread_join(threads[d]);
+   }
+   g_free(threads);
+
+   for (i = 0; i < count; i++) {
+      if (jobs[i].err != NULL) {
+         if (!quiet) {
+            g_print("\n");
+         }
+         ShrinkPrintWiperError(jobs[i].part->mountPoint, jobs[i].err);
+      }
+      wiped = wiped && jobs[i].progress >= 100;
+   }
+
+   rc = ShrinkFinish(wiped, performShrink);
+
 out:
-   WiperSinglePartition_Close(part);
-   free(wiper);
-   wiper = NULL;
+   for (i = 0; i < count; i++) {
+      WiperSinglePartition_Close(jobs[i].part);
+   }
+   g_ptr_array_foreach(disks, (GFunc)g_ptr_array_unref, NULL);
+   g_ptr_array_free(disks, TRUE);
+   g_ptr_array_free(diskNames, TRUE);
+   g_free(jobs);
    return rc;
 }
+#endif
 
 
 #ifndef _WIN32
@@ -519,6 +1001,52 @@ ShrinkWiperDestroy(int signal)	// IN: Signal caught
 #endif
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * ShrinkDoWipe --
+ *
+ *      Wipes the file systems at the given locations, optionally shrinking the
+ *      disks afterwards. Several locations are wiped in parallel where the
+ *      platform supports it, and one after another otherwise.
+ *
+ * Results:
+ *      EXIT_SUCCESS on success.
+ *      The appropriate exit code on errors.
+ *
+ * Side effects:
+ *      See ShrinkDoWipeAndShrink.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+static int
+ShrinkDoWipe(char **mountPoints,      // IN: mount points
+             int count,               // IN: number of mount points
+             gboolean quiet,          // IN: verbosity flag
+             gboolean performShrink)  // IN: perform a shrink operation
+{
+#if defined(_WIN32)
+   int i;
+   int rc = EXIT_SUCCESS;
+
+   /* Shrink once, after the last partition has been wiped. */
+   for (i = 0; i < count && rc == EXIT_SUCCESS; i++) {
+      rc = ShrinkDoWipeAndShrink(mountPoints[i], quiet,
+                                 performShrink && i == count - 1);
+   }
+   return rc;
+#else
+   ShrinkLoadBackgroundConfig();
+
+   if (count == 1) {
+      return ShrinkDoWipeAndShrink(mountPoints[0], quiet, performShrink);
+   }
+   return ShrinkDoWipeAndShrinkMulti(mountPoints, count, quiet, performShrink);
+#endif
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -547,15 +1075,15 @@ Disk_Command(char **argv,      // IN: command line arguments
       if (++optind >= argc) {
          ToolsCmd_MissingEntityError(argv[0], SU_(arg.mountpoint, "mount point"));
       } else {
-         return ShrinkDoWipeAndShrink(argv[optind], quiet,
-                                      TRUE /* perform shrink */);
+         return ShrinkDoWipe(argv + optind, argc - optind, quiet,
+                             TRUE /* perform shrink */);
       }
    } else if (toolbox_strcmp(argv[optind], "wipe") == 0) {
       if (++optind >= argc) {
          ToolsCmd_MissingEntityError(argv[0], SU_(arg.mountpoint, "mount point"));
       } else {
-         return ShrinkDoWipeAndShrink(argv[optind], quiet,
-                                      FALSE /* do not perform shrink */);
+         return ShrinkDoWipe(argv + optind, argc - optind, quiet,
+                             FALSE /* do not perform shrink */);
       }
    } else if (toolbox_strcmp(argv[optind], "shrinkonly") == 0) {
       return ShrinkDoAllDiskShrinkOnly();
@@ -592,9 +1120,10 @@ Disk_Help(const char *progName, // IN: The name of the program obtained from arg
                           "Usage: %s %s <subcommand> [args]\n\n"
                           "Subcommands:\n"
                           "   list: list available locations\n"
-                          "   shrink <location>: wipes and shrinks a file system at the given location\n"
+                          "   shrink <location> [<location> ...]: wipes and shrinks the file systems at the given locations\n"
                           "   shrinkonly: shrinks all disks\n"
-                          "   wipe <location>: wipes a file system at the given location\n"),
+                          "   wipe <location> [<location> ...]: wipes the file systems at the given locations\n"
+                          "\nFile systems on different disks are wiped in parallel.\n"),
            cmd, progName, cmd);
 }
 
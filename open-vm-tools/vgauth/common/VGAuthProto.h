@@ -637,4 +637,61 @@
    VGAUTH_USERHANDLESAMLINFO_FORMAT_END \
    VGAUTH_REPLY_FORMAT_END
 
+
+/*
+ * BinaryWireFormat
+ *
+ * Switches a private connection to the binary wire format.  Sent right
+ * after Connect.  A service that does not know the request fails it and
+ * closes the connection, and the client reconnects using XML only.
+ *
+ * Permissions: any
+ *
+ * Request:
+ *   (empty)
+ * =>
+ *   (empty)
+ *
+ * Once the reply is read, ValidateSamlBToken requests and their replies
+ * are sent as binary frames, which saves escaping and parsing the SAML
+ * token, itself XML, on both sides.  All other messages stay XML, and the
+ * service may still reply to a binary request with an XML error.
+ *
+ * A frame is:
+ *   VGAUTH_BINARY_MAGIC   4 bytes, can't be the start of an XML message
+ *   payload length        uint32, network byte order
+ *   payload               the fields, each a uint32 length in network
+ *                         byte order followed by that many bytes.  Fields
+ *                         are strings, not escaped nor NUL terminated, and
+ *                         must not contain a NUL.
+ *
+ * ValidateSamlBToken request fields:
+ *   requestName, sequenceNumber, samlToken, userName, validateOnly
+ * Reply fields:
+ *   sequenceNumber, errorCode, then
+ *   errorMsg                                      if errorCode is not 0,
+ *   userName, token, samlSubject, subjectType,
+ *   subject, comment                              otherwise.
+ * subjectType is VGAUTH_BINARY_SUBJECT_NAMED or VGAUTH_BINARY_SUBJECT_ANY;
+ * subject is empty for the latter.
+ */
+#define VGAUTH_REQUESTBINARYWIREFORMAT_ELEMENT_NAME "BinaryWireFormat"
+
+#define VGAUTH_BINARYWIREFORMAT_REQUEST_FORMAT \
+   VGAUTH_REQUEST_FORMAT_START \
+      "<"VGAUTH_REQUESTNAME_ELEMENT_NAME">"VGAUTH_REQUESTBINARYWIREFORMAT_ELEMENT_NAME"</"VGAUTH_REQUESTNAME_ELEMENT_NAME">" \
+   VGAUTH_REQUEST_FORMAT_END
+
+#define VGAUTH_BINARYWIREFORMAT_REPLY_FORMAT \
+   VGAUTH_REPLY_FORMAT_START \
+   VGAUTH_REPLY_FORMAT_END
+
+#define VGAUTH_BINARY_MAGIC "VGB1"
+#define VGAUTH_BINARY_MAGIC_LEN 4
+#define VGAUTH_BINARY_HEADER_LEN (VGAUTH_BINARY_MAGIC_LEN + 4)
+#define VGAUTH_BINARY_MAX_PAYLOAD (16 * 1024 * 1024)
+
+#define VGAUTH_BINARY_SUBJECT_NAMED "named"
+#define VGAUTH_BINARY_SUBJECT_ANY "any"
+
 #endif   // _VGAUTHPROTO_H_
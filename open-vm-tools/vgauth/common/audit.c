@@ -44,6 +44,24 @@ static gboolean auditInited = FALSE;
 static HANDLE hAuditSource = INVALID_HANDLE_VALUE;
 #endif
 
+/*
+ * Optional background writer.  When running, events are queued to it
+ * rather than written by the caller, except for failure events when
+ * those must persist, and when the queue is full.
+ */
+typedef struct AuditQueuedEvent {
+   gboolean isSuccess;
+   gchar *msg;                // NULL tells the writer to exit
+} AuditQueuedEvent;
+
+static GAsyncQueue *auditQueue = NULL;
+static GThread *auditWriter = NULL;
+static gint auditQueued = 0;
+static guint auditMaxQueued = 0;
+static gboolean auditSyncFailures = TRUE;
+
+static void AuditWrite(gboolean isSuccess, const gchar *buf);
+
 /*
  ******************************************************************************
  * Audit_Init --                                                         */ /**
@@ -104,6 +122,8 @@ Audit_Init(const char *appName,
 void
 Audit_Shutdown(void)
 {
+   Audit_StopWriter();
+
 #ifdef _WIN32
    DeregisterEventSource(hAuditSource);
    hAuditSource = INVALID_HANDLE_VALUE;
@@ -162,6 +182,7 @@ Audit_EventV(gboolean isSuccess,
              va_list args)
 {
    gchar *buf;
+   GAsyncQueue *queue = auditQueue;
 
    if (isSuccess && !doLogSuccess) {
       return;
@@ -171,10 +192,48 @@ Audit_EventV(gboolean isSuccess,
 #ifdef VMX86_DEBUG
    if (!auditInited) {
       fprintf(stderr, "Audit Event being dropped!: %s\n", buf);
-      goto done;
+      g_free(buf);
+      return;
    }
 #endif
 
+   /*
+    * Hand the event to the writer unless it must be on record before we
+    * return.  If the queue is full, write it here rather than drop it.
+    */
+   if (NULL != queue && (isSuccess || !auditSyncFailures)) {
+      if ((guint) g_atomic_int_add(&auditQueued, 1) < auditMaxQueued) {
+         AuditQueuedEvent *ev = g_malloc(sizeof *ev);
+
+         ev->isSuccess = isSuccess;
+         ev->msg = buf;
+         g_async_queue_push(queue, ev);
+         return;
+      }
+      g_atomic_int_add(&auditQueued, -1);
+   }
+
+   AuditWrite(isSuccess, buf);
+   g_free(buf);
+}
+
+
+/*
+ ******************************************************************************
+ * AuditWrite --                                                         */ /**
+ *
+ * Writes an auditing event to the system log.
+ *
+ * @param[in] isSuccess   If true, the message is a successful event.
+ * @param[in] buf         The event message.
+ *
+ ******************************************************************************
+ */
+
+static void
+AuditWrite(gboolean isSuccess,
+           const gchar *buf)
+{
 #ifdef _WIN32
    {
       wchar_t *buf16 = (wchar_t *) g_utf8_to_utf16(buf, -1, NULL, NULL, NULL);
@@ -204,10 +263,123 @@ Audit_EventV(gboolean isSuccess,
     */
    syslog(isSuccess ? LOG_INFO : LOG_WARNING, "%s.", buf);
 #endif
+}
 
-#ifdef VMX86_DEBUG
-done:
-#endif
-   g_free(buf);
+
+/*
+ ******************************************************************************
+ * AuditWriterThread --                                                  */ /**
+ *
+ * Body of the background writer.  Waits for events and writes whatever
+ * has queued up in one go, until told to exit.
+ *
+ * @param[in] data        The event queue.
+ *
+ * @return NULL
+ *
+ ******************************************************************************
+ */
+
+static gpointer
+AuditWriterThread(gpointer data)
+{
+   GAsyncQueue *queue = data;
+   gboolean done = FALSE;
+
+   while (!done) {
+      AuditQueuedEvent *ev = g_async_queue_pop(queue);
+
+      do {
+         if (NULL == ev->msg) {
+            done = TRUE;
+         } else {
+            AuditWrite(ev->isSuccess, ev->msg);
+            g_free(ev->msg);
+            g_atomic_int_add(&auditQueued, -1);
+         }
+         g_free(ev);
+      } while (!done && (ev = g_async_queue_try_pop(queue)) != NULL);
+   }
+
+   return NULL;
+}
+
+
+/*
+ ******************************************************************************
+ * Audit_StartWriter --                                                  */ /**
+ *
+ * Starts writing audit events from a background thread, so callers don't
+ * wait on the system log.  Only meant for long-running processes like
+ * the service; the library writes synchronously.
+ *
+ * @param[in] maxQueued     The most events allowed to wait for the writer.
+ *                          Further events are written by the caller.
+ * @param[in] syncFailures  If set, failure events are always written
+ *                          before Audit_Event() returns.
+ *
+ ******************************************************************************
+ */
+
+void
+Audit_StartWriter(guint maxQueued,
+                  gboolean syncFailures)
+{
+   GError *gErr = NULL;
+
+   auditSyncFailures = syncFailures;
+   if (NULL != auditQueue || 0 == maxQueued) {
+      return;
+   }
+
+   auditMaxQueued = maxQueued;
+   auditQueue = g_async_queue_new();
+   auditWriter = g_thread_try_new("audit", AuditWriterThread, auditQueue,
+                                 &gErr);
+   if (NULL == auditWriter) {
+      VGAUTH_LOG_WARNING("failed to start audit writer: %s", gErr->message);
+      g_error_free(gErr);
+      g_async_queue_unref(auditQueue);
+      auditQueue = NULL;
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * Audit_StopWriter --                                                   */ /**
+ *
+ * Writes any queued audit events and stops the background writer.
+ * Later events are written synchronously.
+ *
+ ******************************************************************************
+ */
+
+void
+Audit_StopWriter(void)
+{
+   AuditQueuedEvent *ev;
+   GAsyncQueue *queue = auditQueue;
+
+   if (NULL == queue) {
+      return;
+   }
+
+   ev = g_malloc0(sizeof *ev);
+   g_async_queue_push(queue, ev);
+   g_thread_join(auditWriter);
+   auditWriter = NULL;
+   auditQueue = NULL;
+
+   /*
+    * Anything pushed while the writer was exiting.  The queue itself is
+    * left alone, since a racing Audit_EventV() may still push to it.
+    */
+   while ((ev = g_async_queue_try_pop(queue)) != NULL) {
+      AuditWrite(ev->isSuccess, ev->msg);
+      g_free(ev->msg);
+      g_free(ev);
+   }
+   g_atomic_int_set(&auditQueued, 0);
 }
 
@@ -32,6 +32,10 @@ void Audit_Init(const char *appName, gboolean logSuccess);
 
 void Audit_Shutdown(void);
 
+void Audit_StartWriter(guint maxQueued, gboolean syncFailures);
+
+void Audit_StopWriter(void);
+
 void Audit_Event(gboolean isSuccess, const char *fmt, ...) PRINTF_DECL(2, 3);
 
 void Audit_EventV(gboolean isSuccess, const char *fmt, va_list args);
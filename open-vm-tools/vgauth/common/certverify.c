@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include <openssl/ssl.h>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
@@ -587,6 +588,52 @@ done:
 }
 
 
+/*
+ ******************************************************************************
+ * CertVerifyChainNotAfter --                                            */ /**
+ *
+ * Finds when the first cert of a verified chain expires.
+ *
+ * @param[in]  verifyCtx     The x509 store context that verified the chain.
+ *
+ * @return The earliest notAfter of the chain.
+ *
+ ******************************************************************************
+ */
+
+static time_t
+CertVerifyChainNotAfter(X509_STORE_CTX *verifyCtx)
+{
+   STACK_OF(X509) *chain = X509_STORE_CTX_get1_chain(verifyCtx);
+   time_t now = time(NULL);
+   time_t earliest = now;
+   int days;
+   int secs;
+   int i;
+
+   if (NULL == chain) {
+      return now;
+   }
+
+   for (i = 0; i < sk_X509_num(chain); i++) {
+      time_t notAfter;
+
+      if (!ASN1_TIME_diff(&days, &secs, NULL,
+                          X509_get_notAfter(sk_X509_value(chain, i)))) {
+         earliest = now;
+         break;
+      }
+      notAfter = now + (time_t) days * 24 * 60 * 60 + secs;
+      if (0 == i || notAfter < earliest) {
+         earliest = notAfter;
+      }
+   }
+   sk_X509_pop_free(chain, X509_free);
+
+   return earliest;
+}
+
+
 /*
  ******************************************************************************
  * CertVerify_CertChain --                                               */ /**
@@ -604,6 +651,8 @@ done:
  * @param[in]  pemUntrustedCertChain    The chain of untrusted certificates.
  * @param[in]  numTrustedCerts          The size of the trusted chain.
  * @param[in]  pemTrustedCertChain      The chain of trusted certificates.
+ * @param[out] notAfter                 If not NULL, set to when the first
+ *                                      cert of the verified chain expires.
  *
  * @return VGAUTH_E_OK on success, VGAuthError on failure
  *
@@ -615,7 +664,8 @@ CertVerify_CertChain(const char *pemLeafCert,
                      int numUntrustedCerts,
                      const char **pemUntrustedCertChain,
                      int numTrustedCerts,
-                     const char **pemTrustedCertChain)
+                     const char **pemTrustedCertChain,
+                     time_t *notAfter)
 {
    VGAuthError err = VGAUTH_E_OK;
    int ret;
@@ -718,6 +768,10 @@ CertVerify_CertChain(const char *pemLeafCert,
       goto done;
    }
 
+   if (NULL != notAfter) {
+      *notAfter = CertVerifyChainNotAfter(verifyCtx);
+   }
+
 done:
    sk_X509_pop_free(trustedChain, X509_free);
    sk_X509_pop_free(untrustedChain, X509_free);
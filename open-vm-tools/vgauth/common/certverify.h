@@ -26,6 +26,7 @@
  */
 
 #include <glib.h>
+#include <time.h>
 #include "VGAuthAuthentication.h"
 
 /* new API from OpenSSL 1.1.0
@@ -57,7 +58,8 @@ VGAuthError CertVerify_CertChain(const char *pemLeafCert,
                                   int numUntrustedCerts,
                                   const char **pemUntrustedCertChain,
                                   int numTrustedCerts,
-                                  const char **pemTrustedCertChain);
+                                  const char **pemTrustedCertChain,
+                                  time_t *notAfter);
 
 VGAuthError CertVerify_CheckSignatureUsingCert(VGAuthHashAlg hash,
                                                const char *pemCert,
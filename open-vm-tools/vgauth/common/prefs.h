@@ -93,12 +93,16 @@ loglevel=normal
 enableLogging=true
 enableCoreDumps=true
 clockSkewAdjustment = 300
+maxWorkerThreads = 4
+logFlushInterval = 1
 
 [ticket]
 ticketTTL=3600
 
 [auditing]
 auditSuccessEvents=true
+maxQueuedEvents=1024
+syncFailureEvents=true
 
 [localization]
 msgCatalog = /etc/vmware-tools/vgauth/messages
@@ -125,6 +129,8 @@ msgCatalog = /etc/vmware-tools/vgauth/messages
 #define VGAUTH_PREF_NAME_MAX_OLD_LOGFILES  "maxOldLogFiles"
 /** Maxiumum size in MB of each log file. */
 #define VGAUTH_PREF_NAME_MAX_LOGSIZE       "maxLogSize"
+/** Seconds informational log messages may stay buffered; 0 flushes each one. */
+#define VGAUTH_PREF_NAME_LOG_FLUSH_INTERVAL "logFlushInterval"
 /** Number of seconds a specific user's listen connection will go unreferenced until it is discarded. */
 #define VGAUTH_PREF_NAME_LISTEN_TTL        "listenTTL"
 /** Maximum number of data connections allowed for a non privileged user */
@@ -136,6 +142,8 @@ msgCatalog = /etc/vmware-tools/vgauth/messages
 #define VGAUTH_PREF_ALIASSTORE_DIR         "aliasStoreDir"
 /** The number of seconds slack allowed in either direction in SAML token date checks. */
 #define VGAUTH_PREF_CLOCK_SKEW_SECS        "clockSkewAdjustment"
+/** Number of threads verifying SAML tokens off the main loop; 0 verifies them on the main loop. */
+#define VGAUTH_PREF_NAME_MAX_WORKER_THREADS "maxWorkerThreads"
 
 /** Ticket group name. */
 #define VGAUTH_PREF_GROUP_NAME_TICKET      "ticket"
@@ -149,6 +157,12 @@ msgCatalog = /etc/vmware-tools/vgauth/messages
 /** Whether to generate audit events for successful operations. */
 #define VGAUTH_PREF_AUDIT_SUCCESS          "auditSuccessEvents"
 
+/** Audit events that may wait for the background writer; 0 writes them all synchronously. */
+#define VGAUTH_PREF_AUDIT_MAX_QUEUED       "maxQueuedEvents"
+
+/** Whether failure audit events are written before the request continues. */
+#define VGAUTH_PREF_AUDIT_SYNC_FAILURE     "syncFailureEvents"
+
 /** SSPI group name. */
 #define VGAUTH_PREF_GROUP_NAME_SSPI        "sspi"
 
@@ -185,6 +199,9 @@ msgCatalog = /etc/vmware-tools/vgauth/messages
 
 #define VGAUTH_PREF_DEFAULT_SSPI_HANDSHAKE_TTL (10 * 60)
 
+#define VGAUTH_PREF_DEFAULT_LOG_FLUSH_INTERVAL 1
+#define VGAUTH_PREF_DEFAULT_AUDIT_MAX_QUEUED 1024
+
 /*
  * Parent directory of 'messages', which has <lang>/<app>.vmsg
  * below that.
@@ -199,5 +216,7 @@ msgCatalog = /etc/vmware-tools/vgauth/messages
 
 #define VGAUTH_PREF_DEFAULT_CLOCK_SKEW_SECS (300)
 
+#define VGAUTH_PREF_DEFAULT_MAX_WORKER_THREADS 4
+
 #endif // _PREFS_H_
 
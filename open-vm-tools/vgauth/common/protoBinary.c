@@ -0,0 +1,309 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/**
+ * @file protoBinary.c --
+ *
+ *    Building and parsing of binary wire format frames, shared by the
+ *    client library and the service.
+ */
+
+#include <string.h>
+
+#include "protoBinary.h"
+#include "VGAuthProto.h"
+#include "VGAuthBasicDefs.h"
+
+
+/*
+ ******************************************************************************
+ * ProtoBinaryPutUint32 --                                               */ /**
+ *
+ * Stores a 32 bit value in network byte order.
+ *
+ * @param[out] buf        Where to store the value, 4 bytes.
+ * @param[in]  val        The value.
+ *
+ ******************************************************************************
+ */
+
+static void
+ProtoBinaryPutUint32(guint8 *buf,
+                     guint32 val)
+{
+   buf[0] = (val >> 24) & 0xff;
+   buf[1] = (val >> 16) & 0xff;
+   buf[2] = (val >> 8) & 0xff;
+   buf[3] = val & 0xff;
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinaryGetUint32 --                                               */ /**
+ *
+ * Loads a 32 bit value stored in network byte order.
+ *
+ * @param[in]  buf        The stored value, 4 bytes.
+ *
+ * @return The value.
+ *
+ ******************************************************************************
+ */
+
+static guint32
+ProtoBinaryGetUint32(const guint8 *buf)
+{
+   return ((guint32) buf[0] << 24) | ((guint32) buf[1] << 16) |
+          ((guint32) buf[2] << 8) | (guint32) buf[3];
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_NewFrame --                                               */ /**
+ *
+ * Starts a new frame, with room for its header.
+ *
+ * @return The frame.  Free with g_byte_array_free().
+ *
+ ******************************************************************************
+ */
+
+GByteArray *
+ProtoBinary_NewFrame(void)
+{
+   GByteArray *frame = g_byte_array_new();
+   guint8 header[VGAUTH_BINARY_HEADER_LEN] = { 0 };
+
+   memcpy(header, VGAUTH_BINARY_MAGIC, VGAUTH_BINARY_MAGIC_LEN);
+   g_byte_array_append(frame, header, sizeof header);
+
+   return frame;
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_AppendField --                                            */ /**
+ *
+ * Appends a string field to a frame.  The string is sent as is, without
+ * any escaping.
+ *
+ * @param[in]  frame      The frame.
+ * @param[in]  field      The field.  NULL is sent as an empty field.
+ *
+ ******************************************************************************
+ */
+
+void
+ProtoBinary_AppendField(GByteArray *frame,
+                        const gchar *field)
+{
+   gsize len = (NULL != field) ? strlen(field) : 0;
+   guint8 fieldLen[4];
+
+   ProtoBinaryPutUint32(fieldLen, (guint32) len);
+   g_byte_array_append(frame, fieldLen, sizeof fieldLen);
+   if (len > 0) {
+      g_byte_array_append(frame, (const guint8 *) field, (guint) len);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_AppendUint64Field --                                      */ /**
+ *
+ * Appends a number to a frame, as a decimal string field.
+ *
+ * @param[in]  frame      The frame.
+ * @param[in]  val        The number.
+ *
+ ******************************************************************************
+ */
+
+void
+ProtoBinary_AppendUint64Field(GByteArray *frame,
+                              guint64 val)
+{
+   gchar buf[32];
+
+   g_snprintf(buf, sizeof buf, "%" G_GUINT64_FORMAT, val);
+   ProtoBinary_AppendField(frame, buf);
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_FinishFrame --                                            */ /**
+ *
+ * Fills in the payload length of a frame once all its fields are added.
+ *
+ * @param[in]  frame      The frame.
+ *
+ ******************************************************************************
+ */
+
+void
+ProtoBinary_FinishFrame(GByteArray *frame)
+{
+   ASSERT(frame->len >= VGAUTH_BINARY_HEADER_LEN);
+
+   ProtoBinaryPutUint32(frame->data + VGAUTH_BINARY_MAGIC_LEN,
+                        frame->len - VGAUTH_BINARY_HEADER_LEN);
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_IsFrameStart --                                           */ /**
+ *
+ * Checks whether the first bytes of a message are the start of a binary
+ * frame rather than XML.  Works with less data than the magic.
+ *
+ * @param[in]  data       The first bytes of the message.
+ * @param[in]  len        The number of bytes.
+ *
+ * @return TRUE if the message is a binary frame.
+ *
+ ******************************************************************************
+ */
+
+gboolean
+ProtoBinary_IsFrameStart(const gchar *data,
+                         gsize len)
+{
+   return len > 0 &&
+          memcmp(data, VGAUTH_BINARY_MAGIC,
+                 MIN(len, VGAUTH_BINARY_MAGIC_LEN)) == 0;
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_GetFrameLength --                                         */ /**
+ *
+ * Returns the length of the frame at the start of some data, if the data
+ * holds the whole frame.
+ *
+ * @param[in]  data       The data received so far.
+ * @param[in]  len        The length of the data.
+ * @param[out] frameLen   The length of the frame, header included, or 0 if
+ *                        more data is needed.
+ *
+ * @return VGAUTH_E_OK on success, VGAUTH_E_COMM if the data is not a
+ *         valid frame.
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+ProtoBinary_GetFrameLength(const guint8 *data,
+                           gsize len,
+                           gsize *frameLen)
+{
+   guint32 payloadLen;
+
+   *frameLen = 0;
+
+   if (len < VGAUTH_BINARY_HEADER_LEN) {
+      return ProtoBinary_IsFrameStart((const gchar *) data, len) ?
+         VGAUTH_E_OK : VGAUTH_E_COMM;
+   }
+
+   if (memcmp(data, VGAUTH_BINARY_MAGIC, VGAUTH_BINARY_MAGIC_LEN) != 0) {
+      g_warning("%s: bad frame magic\n", __FUNCTION__);
+      return VGAUTH_E_COMM;
+   }
+
+   payloadLen = ProtoBinaryGetUint32(data + VGAUTH_BINARY_MAGIC_LEN);
+   if (payloadLen > VGAUTH_BINARY_MAX_PAYLOAD) {
+      g_warning("%s: frame too large (%u bytes)\n", __FUNCTION__, payloadLen);
+      return VGAUTH_E_COMM;
+   }
+
+   if (len >= VGAUTH_BINARY_HEADER_LEN + (gsize) payloadLen) {
+      *frameLen = VGAUTH_BINARY_HEADER_LEN + payloadLen;
+   }
+
+   return VGAUTH_E_OK;
+}
+
+
+/*
+ ******************************************************************************
+ * ProtoBinary_ParseFields --                                            */ /**
+ *
+ * Splits a complete frame into its fields.
+ *
+ * Fields are strings, so an embedded NUL is rejected rather than silently
+ * truncating the field.
+ *
+ * @param[in]  frame      The frame, as sized by ProtoBinary_GetFrameLength().
+ * @param[in]  frameLen   The length of the frame.
+ * @param[out] fields     The NULL terminated fields.  Free with g_strfreev().
+ * @param[out] numFields  The number of fields.
+ *
+ * @return VGAUTH_E_OK on success, VGAUTH_E_COMM if the frame is malformed.
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+ProtoBinary_ParseFields(const guint8 *frame,
+                        gsize frameLen,
+                        gchar ***fields,
+                        guint *numFields)
+{
+   GPtrArray *arr = g_ptr_array_new();
+   gsize pos = VGAUTH_BINARY_HEADER_LEN;
+
+   ASSERT(frameLen >= VGAUTH_BINARY_HEADER_LEN);
+
+   while (pos < frameLen) {
+      guint32 fieldLen;
+
+      if (frameLen - pos < 4) {
+         goto bad;
+      }
+      fieldLen = ProtoBinaryGetUint32(frame + pos);
+      pos += 4;
+      if (fieldLen > frameLen - pos ||
+          memchr(frame + pos, '\0', fieldLen) != NULL) {
+         goto bad;
+      }
+      g_ptr_array_add(arr, g_strndup((const gchar *) frame + pos, fieldLen));
+      pos += fieldLen;
+   }
+
+   *numFields = arr->len;
+   g_ptr_array_add(arr, NULL);
+   *fields = (gchar **) g_ptr_array_free(arr, FALSE);
+
+   return VGAUTH_E_OK;
+
+bad:
+   g_warning("%s: malformed frame\n", __FUNCTION__);
+   g_ptr_array_add(arr, NULL);
+   g_strfreev((gchar **) g_ptr_array_free(arr, FALSE));
+   *fields = NULL;
+   *numFields = 0;
+
+   return VGAUTH_E_COMM;
+}
@@ -0,0 +1,53 @@
+/*********************************************************
+ * Copyright (C) 2026 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+#ifndef _PROTOBINARY_H_
+#define _PROTOBINARY_H_
+
+/*
+ * @file protoBinary.h
+ *
+ * Framing of the binary wire format, see VGAuthProto.h.
+ */
+
+#include <glib.h>
+#include "VGAuthError.h"
+
+GByteArray *ProtoBinary_NewFrame(void);
+
+void ProtoBinary_AppendField(GByteArray *frame,
+                             const gchar *field);
+
+void ProtoBinary_AppendUint64Field(GByteArray *frame,
+                                   guint64 val);
+
+void ProtoBinary_FinishFrame(GByteArray *frame);
+
+gboolean ProtoBinary_IsFrameStart(const gchar *data,
+                                  gsize len);
+
+VGAuthError ProtoBinary_GetFrameLength(const guint8 *data,
+                                       gsize len,
+                                       gsize *frameLen);
+
+VGAuthError ProtoBinary_ParseFields(const guint8 *frame,
+                                    gsize frameLen,
+                                    gchar ***fields,
+                                    guint *numFields);
+
+#endif // _PROTOBINARY_H_
@@ -75,6 +75,9 @@
  */
 typedef struct VCAGComm {
    gboolean connected;
+   gboolean commError;        // the stream may be out of sync, so the
+                              // connection must not be reused
+   gboolean binaryWire;       // the binary wire format was negotiated
    unsigned int sequenceNumber;
    gchar *userName;           // the user we're runing as, used for
                               // setting up the comm pipe permissions
@@ -132,14 +135,6 @@ struct VGAuthContext {
     */
    VGAuthUserHandle *impersonatedUser;
 
-   /*
-    * XXX optimization -- keep a comm channel alive for superuser?
-    *
-    * An app that just does validation would probably just be connected
-    * as root all the time anyways.  But it could be useful for something
-    * that did both certstore work and validation.
-    */
-
 };
 
 
@@ -200,7 +195,11 @@ gboolean VGAuth_IsConnectedToServiceAsAnyUser(VGAuthContext *ctx);
 
 VGAuthError VGAuth_InitConnection(VGAuthContext *ctx);
 VGAuthError VGAuth_CloseConnection(VGAuthContext *ctx);
+VGAuthError VGAuth_ReleaseConnection(VGAuthContext *ctx);
 
+VGAuthError VGAuth_CommSendBytes(VGAuthContext *ctx,
+                                 gsize len,
+                                 gchar *data);
 VGAuthError VGAuth_CommSendData(VGAuthContext *ctx,
                                 gchar *request);
 
@@ -209,6 +208,7 @@ VGAuthError VGAuth_CommReadData(VGAuthContext *ctx,
                                 gchar **response);
 
 VGAuthError VGAuth_SendConnectRequest(VGAuthContext *ctx);
+VGAuthError VGAuth_SendBinaryWireFormatRequest(VGAuthContext *ctx);
 
 VGAuthError VGAuth_SendSessionRequest(VGAuthContext *ctx,
                                       const char *userName,
@@ -270,6 +270,8 @@ VGAuthError VGAuth_NetworkConnect(VGAuthContext *ctx);
 
 gboolean VGAuth_NetworkValidatePublicPipeOwner(VGAuthContext *ctx);
 
+gboolean VGAuth_NetworkIsAlive(VGAuthContext *ctx);
+
 VGAuthError VGAuth_NetworkWriteBytes(VGAuthContext *ctx,
                                      gsize len,
                                      gchar *buffer);
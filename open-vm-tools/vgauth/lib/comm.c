@@ -24,11 +24,107 @@
 
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "VGAuthInt.h"
 #include "VGAuthProto.h"
 #include "usercheck.h"
 
+/*
+ * Connections of contexts that are shut down, or switched to another
+ * user, are kept in a process-wide pool and handed to the next context
+ * connecting as the same user.  This saves the public pipe session request,
+ * the private pipe connect and the handshake for apps like vix that create
+ * a context per guest operation.
+ */
+#if !defined(_WIN32) && !defined(UNITTEST)
+#define VGAUTH_CONN_POOL 1
+#endif
+
+#ifdef VGAUTH_CONN_POOL
+
+/*
+ * Upper bound on pooled connections, each holds a private pipe open in
+ * the service.
+ */
+#define VGAUTH_CONN_POOL_MAX        4
+
+/*
+ * Pooled connections idle for longer than this are closed instead of being
+ * reused.
+ */
+#define VGAUTH_CONN_POOL_IDLE_USEC  (60 * G_USEC_PER_SEC)
+
+typedef struct VGAuthPooledConn {
+   VGAuthComm comm;
+   gint64 releaseTime;
+   pid_t pid;                 // a forked child must not share the socket
+} VGAuthPooledConn;
+
+G_LOCK_DEFINE_STATIC(connPool);
+static GSList *connPool = NULL;    // most recently released first
+
+#endif
+
+/*
+ * The binary wire format is asked for on each new private connection,
+ * until a service turns it down.  Not for UNITTEST builds, whose canned
+ * replies are XML.
+ */
+#ifndef UNITTEST
+#define VGAUTH_BINARY_WIRE 1
+
+static gint binaryWireUnsupported = 0;
+#endif
+
+
+/*
+ ******************************************************************************
+ * VGAuthCommClose --                                                    */ /**
+ *
+ * Closes the channel of a VGAuthComm and frees its data.
+ *
+ * @param[in]  comm       The VGAuthComm.
+ *
+ ******************************************************************************
+ */
+
+static void
+VGAuthCommClose(VGAuthComm *comm)
+{
+   comm->sequenceNumber = 0;
+
+   g_free(comm->userName);
+   comm->userName = NULL;
+
+#ifdef _WIN32
+   if (comm->hPipe != INVALID_HANDLE_VALUE) {
+      CloseHandle(comm->hPipe);
+      comm->hPipe = INVALID_HANDLE_VALUE;
+   }
+#else
+   if (comm->sock >= 0) {
+      close(comm->sock);
+      comm->sock = -1;
+   }
+#endif
+
+   g_free(comm->pipeName);
+   comm->pipeName = NULL;
+
+#ifdef UNITTEST
+   if (comm->fileTest) {
+      fclose(comm->testFp);
+   }
+#endif
+
+   comm->connected = FALSE;
+   comm->commError = FALSE;
+   comm->binaryWire = FALSE;
+}
+
 
 /*
  ******************************************************************************
@@ -103,6 +199,8 @@ VGAuth_InitConnection(VGAuthContext *ctx)
 #endif
 
    ctx->comm.connected = FALSE;
+   ctx->comm.commError = FALSE;
+   ctx->comm.binaryWire = FALSE;
    ctx->comm.sequenceNumber = 0;
 
    return VGAUTH_E_OK;
@@ -131,36 +229,153 @@ VGAuth_CloseConnection(VGAuthContext *ctx)
       return err;
    }
 
+   VGAuthCommClose(&ctx->comm);
 
-   ctx->comm.sequenceNumber = 0;
+   return err;
+}
 
-   g_free(ctx->comm.userName);
-   ctx->comm.userName = NULL;
 
-#ifdef _WIN32
-   if (ctx->comm.hPipe != INVALID_HANDLE_VALUE) {
-      CloseHandle(ctx->comm.hPipe);
-      ctx->comm.hPipe = INVALID_HANDLE_VALUE;
+/*
+ ******************************************************************************
+ * VGAuth_ReleaseConnection --                                           */ /**
+ *
+ * Releases the connection of a context that no longer needs it.  A healthy
+ * connection is put in the connection pool for reuse by another context
+ * of this process, otherwise it is closed.
+ *
+ * @param[in]  ctx        The VGAuthContext.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+VGAuth_ReleaseConnection(VGAuthContext *ctx)
+{
+#ifdef VGAUTH_CONN_POOL
+   VGAuthPooledConn *entry;
+   VGAuthPooledConn *evicted = NULL;
+
+   if (NULL == ctx) {
+      return VGAUTH_E_OK;
    }
-#else
-   if (ctx->comm.sock >= 0) {
-      close(ctx->comm.sock);
+
+   if (!ctx->comm.connected || ctx->comm.commError ||
+       NULL == ctx->comm.userName) {
+      return VGAuth_CloseConnection(ctx);
    }
-#endif
 
-   g_free(ctx->comm.pipeName);
+   entry = g_malloc0(sizeof *entry);
+   entry->comm = ctx->comm;
+   entry->releaseTime = g_get_monotonic_time();
+   entry->pid = getpid();
+
+   /*
+    * The connection now belongs to the pool.
+    */
+   ctx->comm.userName = NULL;
    ctx->comm.pipeName = NULL;
+   VGAuth_InitConnection(ctx);
 
-#ifdef UNITTEST
-   if (ctx->comm.fileTest) {
-      fclose(ctx->comm.testFp);
+   G_LOCK(connPool);
+   connPool = g_slist_prepend(connPool, entry);
+   if (g_slist_length(connPool) > VGAUTH_CONN_POOL_MAX) {
+      GSList *last = g_slist_last(connPool);
+
+      evicted = last->data;
+      connPool = g_slist_delete_link(connPool, last);
    }
+   G_UNLOCK(connPool);
+
+   if (NULL != evicted) {
+      VGAuthCommClose(&evicted->comm);
+      g_free(evicted);
+   }
+
+   return VGAUTH_E_OK;
+#else
+   return VGAuth_CloseConnection(ctx);
 #endif
+}
 
-   ctx->comm.connected = FALSE;
 
-   return err;
+#ifdef VGAUTH_CONN_POOL
+/*
+ ******************************************************************************
+ * VGAuthConnPoolTake --                                                 */ /**
+ *
+ * Looks for a usable pooled connection to the service as the given user
+ * and moves it to the context.  Expired connections, and the ones found
+ * dead, are closed on the way.
+ *
+ * @param[in]  ctx        The VGAuthContext, which must not be connected.
+ * @param[in]  userName   The user.
+ *
+ * @return TRUE if the context got a connection, FALSE otherwise.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+VGAuthConnPoolTake(VGAuthContext *ctx,
+                   const char *userName)
+{
+   gint64 now = g_get_monotonic_time();
+   pid_t pid = getpid();
+   GSList *stale = NULL;
+   GSList *l;
+   GSList *next;
+   VGAuthPooledConn *found = NULL;
+
+   ASSERT(!ctx->comm.connected);
+
+   G_LOCK(connPool);
+   for (l = connPool; l != NULL; l = next) {
+      VGAuthPooledConn *entry = l->data;
+
+      next = l->next;
+      /*
+       * An entry inherited across fork() belongs to the parent's stream;
+       * closing our copy of the descriptor does not affect the parent.
+       */
+      if (entry->pid != pid ||
+          now - entry->releaseTime > VGAUTH_CONN_POOL_IDLE_USEC) {
+         connPool = g_slist_delete_link(connPool, l);
+         stale = g_slist_prepend(stale, entry);
+      } else if (NULL == found &&
+                 Usercheck_CompareByName(userName, entry->comm.userName)) {
+         connPool = g_slist_delete_link(connPool, l);
+         found = entry;
+      }
+   }
+   G_UNLOCK(connPool);
+
+   for (l = stale; l != NULL; l = l->next) {
+      VGAuthPooledConn *entry = l->data;
+
+      VGAuthCommClose(&entry->comm);
+      g_free(entry);
+   }
+   g_slist_free(stale);
+
+   if (NULL == found) {
+      return FALSE;
+   }
+
+   ctx->comm = found->comm;
+   g_free(found);
+
+   if (!VGAuth_NetworkIsAlive(ctx)) {
+      Debug("%s: dropping dead pooled connection for '%s'\n",
+            __FUNCTION__, userName);
+      VGAuth_CloseConnection(ctx);
+      return FALSE;
+   }
+
+   return TRUE;
 }
+#endif
 
 
 /*
@@ -193,11 +408,19 @@ VGAuth_ConnectToServiceAsUser(VGAuthContext *ctx,
    }
 
    /*
-    * If currently connected (presumably as another user), close down
-    * and re-open.
+    * If currently connected (presumably as another user), release the
+    * connection and re-open.
     */
 
-   VGAuth_CloseConnection(ctx);
+   VGAuth_ReleaseConnection(ctx);
+
+#ifdef VGAUTH_CONN_POOL
+   if (VGAuthConnPoolTake(ctx, userName)) {
+      Debug("%s: reusing pooled connection as '%s'\n",
+            __FUNCTION__, userName);
+      goto done;
+   }
+#endif
 
    /*
     * Make a temp context to connect to the public pipe.
@@ -268,6 +491,29 @@ VGAuth_ConnectToServiceAsUser(VGAuthContext *ctx,
       goto done;
    }
 
+#ifdef VGAUTH_BINARY_WIRE
+   /*
+    * Switch to the binary wire format if the service knows it.  An older
+    * service drops the connection on the unknown request, so reconnect
+    * and don't ask again.
+    */
+   if (!g_atomic_int_get(&binaryWireUnsupported)) {
+      err = VGAuth_SendBinaryWireFormatRequest(ctx);
+      if (err != VGAUTH_E_OK) {
+         Log("%s: service doesn't support the binary wire format "
+             "("VGAUTHERR_FMT64X"), using XML\n", __FUNCTION__, err);
+         g_atomic_int_set(&binaryWireUnsupported, 1);
+
+         VGAuth_CloseConnection(ctx);
+         VGAuth_CloseConnection(pubCtx);
+         g_free(pubCtx);
+         g_free(pipeName);
+
+         return VGAuth_ConnectToServiceAsUser(ctx, userName);
+      }
+   }
+#endif
+
    /*
     * The user-private connection is good to go.
     */
@@ -337,7 +583,36 @@ VGAuthError
 VGAuth_CommSendData(VGAuthContext *ctx,
                     gchar *packet)
 {
-   return VGAuth_NetworkWriteBytes(ctx, strlen(packet), packet);
+   return VGAuth_CommSendBytes(ctx, strlen(packet), packet);
+}
+
+
+/*
+ ******************************************************************************
+ * VGAuth_CommSendBytes --                                               */ /**
+ *
+ * Sends some bytes, such as a binary frame, to the service.
+ *
+ * @param[in]  ctx        The VGAuthContext.
+ * @param[in]  len        The number of bytes.
+ * @param[in]  data       The data to be sent.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+VGAuth_CommSendBytes(VGAuthContext *ctx,
+                     gsize len,
+                     gchar *data)
+{
+   VGAuthError err = VGAuth_NetworkWriteBytes(ctx, len, data);
+
+   if (VGAUTH_E_OK != err) {
+      ctx->comm.commError = TRUE;
+   }
+   return err;
 }
 
 
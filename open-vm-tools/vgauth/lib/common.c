@@ -310,7 +310,7 @@ VGAuth_Shutdown(VGAuthContext *ctx)
 
    VGAuthShutdownAuthentication(ctx);
 
-   VGAuth_CloseConnection(ctx);
+   VGAuth_ReleaseConnection(ctx);
 
    for (i = 0; i < ctx->numExtraParams; i++) {
       g_free(ctx->extraParams[i].name);
@@ -25,6 +25,7 @@
 #define _GNU_SOURCE
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/poll.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <sys/unistd.h>
@@ -34,6 +35,7 @@
 #include <netdb.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 #include <signal.h>
 #include "VGAuthInt.h"
 #include "VGAuthLog.h"
@@ -181,6 +183,47 @@ done:
 }
 
 
+/*
+ ******************************************************************************
+ * VGAuth_NetworkIsAlive --                                              */ /**
+ *
+ * Checks that an idle connection can still be used: the service has not
+ * closed it and there is no unread data on it.  This is a local check
+ * that costs a single poll() instead of a request to the service.
+ *
+ * @param[in]  ctx        The VGAuthContext.
+ *
+ * @return TRUE if the connection looks usable, FALSE otherwise.
+ *
+ ******************************************************************************
+ */
+
+gboolean
+VGAuth_NetworkIsAlive(VGAuthContext *ctx)
+{
+   struct pollfd pfd;
+   int ret;
+
+   if (ctx->comm.sock < 0) {
+      return FALSE;
+   }
+
+   pfd.fd = ctx->comm.sock;
+   pfd.events = POLLIN;
+   pfd.revents = 0;
+
+   do {
+      ret = poll(&pfd, 1, 0);
+   } while (ret == -1 && errno == EINTR);
+
+   /*
+    * Readable means either EOF or a stray reply, neither of which is
+    * expected on an idle connection.
+    */
+   return ret == 0;
+}
+
+
 /*
  ******************************************************************************
  * VGAuth_NetworkReadBytes --                                            */ /**
@@ -226,7 +269,13 @@ VGAuth_NetworkReadBytes(VGAuthContext *ctx,
       return VGAUTH_E_COMM;
    }
 
-   *buffer = g_strndup(buf, ret);
+   /*
+    * Copy the bytes as is, the binary wire format may contain NULs, but
+    * keep the data NUL terminated for the XML parser users.
+    */
+   *buffer = g_malloc(ret + 1);
+   memcpy(*buffer, buf, ret);
+   (*buffer)[ret] = '\0';
    *len = ret;
 
    return err;
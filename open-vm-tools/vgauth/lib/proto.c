@@ -35,6 +35,7 @@
 #include "VGAuthLog.h"
 #include "VGAuthUtil.h"
 #include "usercheck.h"
+#include "protoBinary.h"
 
 /* cranks up parser debugging */
 #define VGAUTH_PROTO_TRACE 0
@@ -55,6 +56,7 @@ typedef enum {
    PROTO_REPLY_VALIDATETICKET,
    PROTO_REPLY_REVOKETICKET,
    PROTO_REPLY_VALIDATE_SAML_BEARER_TOKEN,
+   PROTO_REPLY_BINARYWIREFORMAT,
 } ProtoReplyType;
 
 /*
@@ -1095,6 +1097,7 @@ Proto_FreeReply(ProtoReply *reply)
    case PROTO_REPLY_ADDALIAS:
    case PROTO_REPLY_REMOVEALIAS:
    case PROTO_REPLY_REVOKETICKET:
+   case PROTO_REPLY_BINARYWIREFORMAT:
       break;
    case PROTO_REPLY_QUERYMAPPEDALIASES:
       VGAuth_FreeMappedAliasList(reply->replyData.queryMappedAliases.num,
@@ -1175,6 +1178,133 @@ Proto_SanityCheckReply(ProtoReply *reply,
 }
 
 
+/*
+ ******************************************************************************
+ * ProtoReadBinaryReply --                                               */ /**
+ *
+ * Reads the rest of a binary frame reply and fills in the reply.  Only a
+ * ValidateSamlBToken reply, or an error, comes as a binary frame.
+ *
+ * @param[in]  ctx                       The VGAuthContext.
+ * @param[in]  reply                     The reply to fill in.
+ * @param[in]  data                      The start of the frame.
+ * @param[in]  len                       The length of the data.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+ProtoReadBinaryReply(VGAuthContext *ctx,
+                     ProtoReply *reply,
+                     const gchar *data,
+                     gsize len)
+{
+   VGAuthError err;
+   GByteArray *buf = g_byte_array_new();
+   gsize frameLen;
+   gchar **fields = NULL;
+   guint numFields = 0;
+   guint i;
+
+   g_byte_array_append(buf, (const guint8 *) data, (guint) len);
+
+   for (;;) {
+      gchar *more = NULL;
+
+      err = ProtoBinary_GetFrameLength(buf->data, buf->len, &frameLen);
+      if (VGAUTH_E_OK != err || 0 != frameLen) {
+         break;
+      }
+      err = VGAuth_CommReadData(ctx, &len, &more);
+      if (0 == len) {      // EOF -- not expected
+         Warning("%s: EOF on datastream when trying to read frame\n",
+                 __FUNCTION__);
+         err = VGAUTH_E_COMM;
+      }
+      if (VGAUTH_E_OK != err) {
+         g_free(more);
+         goto done;
+      }
+      g_byte_array_append(buf, (const guint8 *) more, (guint) len);
+      g_free(more);
+   }
+   if (VGAUTH_E_OK != err) {
+      goto done;
+   }
+
+   err = VGAUTH_E_COMM;
+   if (frameLen != buf->len) {
+      Warning("%s: unexpected data after the reply frame\n", __FUNCTION__);
+      goto done;
+   }
+
+   err = ProtoBinary_ParseFields(buf->data, frameLen, &fields, &numFields);
+   if (VGAUTH_E_OK != err) {
+      goto done;
+   }
+
+   err = VGAUTH_E_COMM;
+   if (numFields < 2) {
+      goto bad;
+   }
+   reply->sequenceNumber = atoi(fields[0]);
+   reply->errorCode = g_ascii_strtoull(fields[1], NULL, 10);
+
+   if (VGAUTH_E_OK != reply->errorCode) {
+      if (numFields != 3) {
+         goto bad;
+      }
+      reply->actualReplyType = PROTO_REPLY_ERROR;
+      reply->replyData.error.errorMsg = fields[2];
+      fields[2] = NULL;
+   } else {
+      VGAuthAliasInfo *ai = &reply->replyData.validateSamlBToken.aliasInfo;
+
+      if (numFields != 8 ||
+          PROTO_REPLY_VALIDATE_SAML_BEARER_TOKEN != reply->expectedReplyType) {
+         goto bad;
+      }
+      reply->replyData.validateSamlBToken.userName = fields[2];
+      reply->replyData.validateSamlBToken.token = fields[3];
+      reply->replyData.validateSamlBToken.samlSubject = fields[4];
+      fields[2] = fields[3] = fields[4] = NULL;
+
+      if (g_strcmp0(fields[5], VGAUTH_BINARY_SUBJECT_NAMED) == 0) {
+         ai->subject.type = VGAUTH_SUBJECT_NAMED;
+         ai->subject.val.name = fields[6];
+         fields[6] = NULL;
+      } else if (g_strcmp0(fields[5], VGAUTH_BINARY_SUBJECT_ANY) == 0) {
+         ai->subject.type = VGAUTH_SUBJECT_ANY;
+      } else {
+         goto bad;
+      }
+      ai->comment = fields[7];
+      fields[7] = NULL;
+   }
+
+   reply->complete = TRUE;
+   err = VGAUTH_E_OK;
+   goto done;
+
+bad:
+   Warning("%s: unexpected reply frame with %u fields\n", __FUNCTION__,
+           numFields);
+done:
+   /*
+    * Some fields were moved to the reply, so g_strfreev() won't do.
+    */
+   for (i = 0; i < numFields; i++) {
+      g_free(fields[i]);
+   }
+   g_free(fields);
+   g_byte_array_free(buf, TRUE);
+
+   return err;
+}
+
+
 /*
  ******************************************************************************
  * VGAuth_ReadAndParseResponse --                                        */ /**
@@ -1204,6 +1334,7 @@ VGAuth_ReadAndParseResponse(VGAuthContext *ctx,
    ProtoReply *reply;
    gboolean bRet;
    GError *gErr = NULL;
+   gboolean xmlStarted = FALSE;
 
    reply = Proto_NewReply(expectedReplyType);
 
@@ -1226,6 +1357,16 @@ VGAuth_ReadAndParseResponse(VGAuthContext *ctx,
       if (VGAUTH_E_OK != err) {
          goto abort;
       }
+      if (ctx->comm.binaryWire && !xmlStarted &&
+          ProtoBinary_IsFrameStart(rawReply, len)) {
+         err = ProtoReadBinaryReply(ctx, reply, rawReply, len);
+         g_free(rawReply);
+         if (VGAUTH_E_OK != err) {
+            goto abort;
+         }
+         break;
+      }
+      xmlStarted = TRUE;
 #if VGAUTH_PROTO_TRACE
       if (reply->rawData) {
          reply->rawData = g_strdup_printf("%s%s", reply->rawData, rawReply);
@@ -1275,6 +1416,7 @@ VGAuth_ReadAndParseResponse(VGAuthContext *ctx,
    goto done;
 
 abort:
+   ctx->comm.commError = TRUE;
    Proto_FreeReply(reply);
    reply = NULL;
 done:
@@ -2030,6 +2172,51 @@ done:
 }
 
 
+/*
+ ******************************************************************************
+ * VGAuth_SendBinaryWireFormatRequest --                                 */ /**
+ *
+ * Asks the service to accept the binary wire format on this connection.
+ *
+ * @param[in]  ctx                       The VGAuthContext.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure, such as an
+ *         older service that doesn't know the request.
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+VGAuth_SendBinaryWireFormatRequest(VGAuthContext *ctx)
+{
+   VGAuthError err;
+   gchar *packet;
+   ProtoReply *reply = NULL;
+
+   packet = g_markup_printf_escaped(VGAUTH_BINARYWIREFORMAT_REQUEST_FORMAT,
+                                    ctx->comm.sequenceNumber);
+
+   err = VGAuth_CommSendData(ctx, packet);
+   if (VGAUTH_E_OK != err) {
+      goto abort;
+   }
+
+   err = VGAuth_ReadAndParseResponse(ctx, PROTO_REPLY_BINARYWIREFORMAT,
+                                     &reply);
+   if (VGAUTH_E_OK != err) {
+      goto abort;
+   }
+
+   ctx->comm.binaryWire = TRUE;
+   ctx->comm.sequenceNumber++;
+
+abort:
+   Proto_FreeReply(reply);
+   g_free(packet);
+   return err;
+}
+
+
 /*
  ******************************************************************************
  * VGAuth_SendValidateSamlBearerTokenRequest --                          */ /**
@@ -2078,13 +2265,31 @@ VGAuth_SendValidateSamlBearerTokenRequest(VGAuthContext *ctx,
       }
    }
 
-   packet = g_markup_printf_escaped(VGAUTH_VALIDATESAMLBEARERTOKEN_REQUEST_FORMAT,
-                                    ctx->comm.sequenceNumber,
-                                    samlToken,
-                                    userName ? userName : "",
-                                    validateOnly ? "1" : "0");
+   if (ctx->comm.binaryWire) {
+      /*
+       * Saves escaping the token, and the service parsing it twice.
+       */
+      GByteArray *frame = ProtoBinary_NewFrame();
+
+      ProtoBinary_AppendField(frame,
+                              VGAUTH_REQUESTVALIDATESAMLBEARERTOKEN_ELEMENT_NAME);
+      ProtoBinary_AppendUint64Field(frame, ctx->comm.sequenceNumber);
+      ProtoBinary_AppendField(frame, samlToken);
+      ProtoBinary_AppendField(frame, userName);
+      ProtoBinary_AppendField(frame, validateOnly ? "1" : "0");
+      ProtoBinary_FinishFrame(frame);
+
+      err = VGAuth_CommSendBytes(ctx, frame->len, (gchar *) frame->data);
+      g_byte_array_free(frame, TRUE);
+   } else {
+      packet = g_markup_printf_escaped(VGAUTH_VALIDATESAMLBEARERTOKEN_REQUEST_FORMAT,
+                                       ctx->comm.sequenceNumber,
+                                       samlToken,
+                                       userName ? userName : "",
+                                       validateOnly ? "1" : "0");
 
-   err = VGAuth_CommSendData(ctx, packet);
+      err = VGAuth_CommSendData(ctx, packet);
+   }
    if (VGAUTH_E_OK != err) {
       Warning("%s: failed to send packet\n", __FUNCTION__);
       goto abort;
@@ -43,9 +43,72 @@ typedef struct FileLoggerData {
    guint             maxFiles;
    gboolean          append;
    gboolean          error;
+   gint              flushInterval;    // seconds
+   gint              lastFlush;        // seconds, monotonic
+   gint              unflushed;
    GRWLock           lock;
 } FileLoggerData;
 
+/*
+ * Log levels that are always flushed right away.
+ */
+#define FILE_LOGGER_FLUSH_LEVELS (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | \
+                                  G_LOG_LEVEL_WARNING)
+
+static guint flushTimerId = 0;
+
+
+/*
+ ******************************************************************************
+ * ServiceFileLoggerFlush --                                             */ /**
+ *
+ * Flushes the log file.
+ *
+ * @note Make sure this function is called with a lock held.
+ *
+ * @param[in] data   Log handler data.
+ *
+ ******************************************************************************
+ */
+
+static void
+ServiceFileLoggerFlush(FileLoggerData *data)
+{
+   g_atomic_int_set(&data->unflushed, 0);
+   g_atomic_int_set(&data->lastFlush,
+                    (gint) (g_get_monotonic_time() / G_USEC_PER_SEC));
+   fflush(data->file);
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceFileLoggerFlushTimer --                                        */ /**
+ *
+ * Timer callback that flushes anything written since the last flush, so
+ * buffered messages don't wait indefinitely for the next one.
+ *
+ * @param[in] _data  FileLoggerData pointer.
+ *
+ * @return TRUE to keep the timer.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+ServiceFileLoggerFlushTimer(gpointer _data)
+{
+   FileLoggerData *data = (FileLoggerData *) _data;
+
+   g_rw_lock_reader_lock(&data->lock);
+   if (data->file != NULL && g_atomic_int_get(&data->unflushed)) {
+      ServiceFileLoggerFlush(data);
+   }
+   g_rw_lock_reader_unlock(&data->lock);
+
+   return TRUE;
+}
+
 
 /*
  ******************************************************************************
@@ -265,11 +328,22 @@ ServiceFileLogger_Log(const gchar *domain,
             }
             g_rw_lock_writer_unlock(&data->lock);
             g_rw_lock_reader_lock(&data->lock);
-         } else {
-            fflush(data->file);
+            ret = TRUE;
+            goto exit;
          }
+      }
+
+      /*
+       * Informational messages can sit in the stdio buffer for up to
+       * flushInterval seconds, so a busy service doesn't flush for
+       * every line; the timer picks up the tail.
+       */
+      if (data->flushInterval == 0 || (level & FILE_LOGGER_FLUSH_LEVELS) ||
+          (gint) (g_get_monotonic_time() / G_USEC_PER_SEC) -
+             g_atomic_int_get(&data->lastFlush) >= data->flushInterval) {
+         ServiceFileLoggerFlush(data);
       } else {
-         fflush(data->file);
+         g_atomic_int_set(&data->unflushed, 1);
       }
       ret = TRUE;
    }
@@ -364,6 +438,27 @@ ServiceFileLogger_Init(void)
                                   VGAUTH_PREF_NAME_MAX_LOGSIZE,
                                   VGAUTH_PREF_GROUP_NAME_SERVICE, 10);
       data->maxSize = data->maxSize * 1024 * 1024;
+
+      data->flushInterval = Pref_GetInt(gPrefs,
+                                        VGAUTH_PREF_NAME_LOG_FLUSH_INTERVAL,
+                                        VGAUTH_PREF_GROUP_NAME_SERVICE,
+                                        VGAUTH_PREF_DEFAULT_LOG_FLUSH_INTERVAL);
+      if (data->flushInterval < 0) {
+         data->flushInterval = 0;
+      }
+   }
+
+   /*
+    * Re-initialized on a pref reload; only the newest logger is flushed.
+    */
+   if (flushTimerId != 0) {
+      g_source_remove(flushTimerId);
+      flushTimerId = 0;
+   }
+   if (data->flushInterval > 0) {
+      flushTimerId = g_timeout_add_seconds(data->flushInterval,
+                                           ServiceFileLoggerFlushTimer,
+                                           data);
    }
 
    return data;
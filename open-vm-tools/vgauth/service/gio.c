@@ -202,6 +202,7 @@ ServiceSigtermHandler(gpointer data)
    Pref_Shutdown(gPrefs);
    (void) ServiceEndMainLoop(NULL);
    Service_Shutdown();
+   Audit_Shutdown();
    Log("END SERVICE");
    VMXLog_Log(VMXLOG_LEVEL_INFO, "%s END SERVICE",
               VGAUTH_SERVICE_NAME);
@@ -348,26 +349,9 @@ ServiceIOAcceptGSource(gpointer userData)
 
    err = ServiceAcceptConnection(lConn, newConn);
    if (VGAUTH_E_OK == err) {
-#ifdef _WIN32
-      GSource *gSourceData;
-#else
-      GIOChannel *echan;
-#endif
-
       VGAUTH_LOG_DEBUG("Established a new pipe connection %d on %s", newConn->connId,
                        newConn->pipeName);
-#ifdef _WIN32
-      gSourceData = ServiceIONewHandleGSource(newConn->ol.hEvent,
-                                              ServiceIOHandleIOGSource,
-                                              (gpointer) newConn);
-      newConn->gioId = g_source_attach(gSourceData, NULL);
-      g_source_unref(gSourceData);
-#else
-      echan = g_io_channel_unix_new(newConn->sock);
-      newConn->gioId = g_io_add_watch(echan, G_IO_IN, ServiceIOHandleIO,
-                            (gpointer) newConn);
-      g_io_channel_unref(echan);
-#endif
+      (void) ServiceIOStartRead(newConn);
    } else if (VGAUTH_E_TOO_MANY_CONNECTIONS == err) {
       ServiceConnectionShutdown(newConn);
    } else {
@@ -391,6 +375,49 @@ ServiceIOAccept(GIOChannel *chan,
 
 }
 
+/*
+ ******************************************************************************
+ * ServiceIOStartRead --                                              */ /**
+ *
+ * Starts watching for requests on an accepted ServiceConnection.
+ * Also used to resume reading after a request handled off the main
+ * loop has been answered.
+ *
+ * @param[in]   conn              The ServiceConnection to read from.
+ *
+ * @return VGAuthError
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+ServiceIOStartRead(ServiceConnection *conn)
+{
+#ifdef _WIN32
+   GSource *gSourceData;
+#else
+   GIOChannel *echan;
+#endif
+
+   ASSERT(conn->gioId == 0);
+
+#ifdef _WIN32
+   gSourceData = ServiceIONewHandleGSource(conn->ol.hEvent,
+                                           ServiceIOHandleIOGSource,
+                                           (gpointer) conn);
+   conn->gioId = g_source_attach(gSourceData, NULL);
+   g_source_unref(gSourceData);
+#else
+   echan = g_io_channel_unix_new(conn->sock);
+   conn->gioId = g_io_add_watch(echan, G_IO_IN, ServiceIOHandleIO,
+                                (gpointer) conn);
+   g_io_channel_unref(echan);
+#endif
+
+   return VGAUTH_E_OK;
+}
+
+
 /*
  ******************************************************************************
  * ServiceIOStartListen --                                            */ /**
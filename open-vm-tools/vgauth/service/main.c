@@ -132,6 +132,14 @@ ServiceStartAndRun(void)
                                         VGAUTH_PREF_AUDIT_SUCCESS,
                                         VGAUTH_PREF_GROUP_NAME_AUDIT,
                                         TRUE);
+   int auditMaxQueued = Pref_GetInt(gPrefs,
+                                    VGAUTH_PREF_AUDIT_MAX_QUEUED,
+                                    VGAUTH_PREF_GROUP_NAME_AUDIT,
+                                    VGAUTH_PREF_DEFAULT_AUDIT_MAX_QUEUED);
+   gboolean auditSyncFailures = Pref_GetBool(gPrefs,
+                                             VGAUTH_PREF_AUDIT_SYNC_FAILURE,
+                                             VGAUTH_PREF_GROUP_NAME_AUDIT,
+                                             TRUE);
    gchar *msgCatalog = Pref_GetString(gPrefs,
                                       VGAUTH_PREF_LOCALIZATION_DIR,
                                       VGAUTH_PREF_GROUP_NAME_LOCALIZATION,
@@ -142,6 +150,9 @@ ServiceStartAndRun(void)
    g_free(msgCatalog);
 
    Audit_Init(VGAUTH_SERVICE_NAME, auditSuccess);
+   if (auditMaxQueued > 0) {
+      Audit_StartWriter((guint) auditMaxQueued, auditSyncFailures);
+   }
 
    Log("INIT SERVICE\n");
 
@@ -174,7 +185,14 @@ ServiceStartAndRun(void)
       exit(-1);
    }
 
-   err = ServiceRegisterIOFunctions(ServiceIOStartListen, ServiceStopIO);
+   err = ServiceProtoInitWorkers();
+   if (VGAUTH_E_OK != err) {
+      Warning("%s: failed to init request workers; exiting\n", __FUNCTION__);
+      exit(-1);
+   }
+
+   err = ServiceRegisterIOFunctions(ServiceIOStartListen, ServiceStopIO,
+                                    ServiceIOStartRead);
    if (VGAUTH_E_OK != err) {
       Warning("%s: failed to register IO functions; exiting\n", __FUNCTION__);
       exit(-1);
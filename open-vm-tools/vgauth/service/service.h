@@ -48,6 +48,8 @@
 
 VGAuthError ServiceIOStartListen(ServiceConnection *conn);
 
+VGAuthError ServiceIOStartRead(ServiceConnection *conn);
+
 VGAuthError ServiceIOPrepareMainLoop(void);
 
 VGAuthError ServiceIOMainLoop(void);
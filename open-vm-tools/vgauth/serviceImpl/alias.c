@@ -236,6 +236,51 @@ typedef struct _MappedAliasParseList {
    ServiceMappedAlias *maList;
 } MappedAliasParseList;
 
+/*
+ * Identifies a version of a store file.  Saving a file renames a new one
+ * over it, and a chmod() or chown() changes its change time, so while
+ * these stay the same the file and its security checks do not need to be
+ * done again.
+ */
+typedef struct _AliasFileId {
+   gboolean exists;
+   guint64 size;
+   guint64 ino;
+   gint64 mtime;
+   gint64 ctime;
+} AliasFileId;
+
+/*
+ * The parsed contents of an alias file.
+ */
+typedef struct _AliasCacheEntry {
+   AliasFileId id;
+   int num;
+   ServiceAlias *aList;
+} AliasCacheEntry;
+
+/*
+ * The parsed alias files, keyed by file name, and the parsed mapping
+ * file, so queries only parse the files that changed since.
+ *
+ * On Windows the security checks look at the ACLs, which can change
+ * without changing the file times, so the files are always parsed.
+ */
+#ifdef _WIN32
+#define ALIAS_CACHE_PARSED_FILES FALSE
+#else
+#define ALIAS_CACHE_PARSED_FILES TRUE
+#endif
+
+static GHashTable *aliasCache = NULL;
+
+static struct {
+   gboolean valid;
+   AliasFileId id;
+   int num;
+   ServiceMappedAlias *maList;
+} mappedCache;
+
 /*
 mapping file layout:
 
@@ -1409,12 +1454,247 @@ AliasCheckMapFilePerms(const gchar *fileName)
    return err;
 }
 
+/*
+ ******************************************************************************
+ * AliasGetFileId --                                                     */ /**
+ *
+ * Gets the identity of the current version of a store file.
+ *
+ * @param[in]   fileName        The file.
+ * @param[out]  id              Its identity.  Only 'exists' is set if the
+ *                              file can't be found.
+ *
+ ******************************************************************************
+ */
+
+static void
+AliasGetFileId(const gchar *fileName,
+               AliasFileId *id)
+{
+#ifdef _WIN32
+   GStatBuf st;
+#else
+   struct stat st;
+#endif
+   int ret;
+
+   memset(id, 0, sizeof *id);
+
+#ifdef _WIN32
+   ret = g_stat(fileName, &st);
+#else
+   ret = g_lstat(fileName, &st);
+#endif
+   if (ret != 0) {
+      return;
+   }
+
+   id->exists = TRUE;
+   id->size = st.st_size;
+   id->ino = st.st_ino;
+   id->mtime = st.st_mtime;
+   id->ctime = st.st_ctime;
+}
+
+
+/*
+ ******************************************************************************
+ * AliasFileUnchanged --                                                 */ /**
+ *
+ * Checks whether a store file is still the version that was parsed, and
+ * still passes the owner check.  The owner check looks the user up again,
+ * in case it was deleted and recreated with a different uid.
+ *
+ * @param[in]   fileName        The file.
+ * @param[in]   userName        The owner of an alias file, or NULL for the
+ *                              mapping file.
+ * @param[in]   parsedId        The identity of the parsed version.
+ * @param[in]   id              The identity of the current version.
+ *
+ * @return TRUE if the parsed version can be used.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+AliasFileUnchanged(const gchar *fileName,
+                   const gchar *userName,
+                   const AliasFileId *parsedId,
+                   const AliasFileId *id)
+{
+#ifdef _WIN32
+   return FALSE;
+#else
+   uid_t uid;
+   gid_t gid;
+
+   if (parsedId->exists != id->exists ||
+       parsedId->size != id->size ||
+       parsedId->ino != id->ino ||
+       parsedId->mtime != id->mtime ||
+       parsedId->ctime != id->ctime) {
+      return FALSE;
+   }
+
+   if (!id->exists) {
+      return TRUE;
+   }
+
+   return ServiceFileVerifyFileOwnerAndPerms(fileName,
+                                             (userName != NULL) ?
+                                                userName : SUPERUSER_NAME,
+                                             (userName != NULL) ?
+                                                ALIASSTORE_FILE_PERMS :
+                                                ALIASSTORE_MAPFILE_PERMS,
+                                             &uid, &gid) == VGAUTH_E_OK;
+#endif
+}
+
+
+/*
+ ******************************************************************************
+ * AliasCopyAliasList --                                                 */ /**
+ *
+ * Copies an array of ServiceAlias.
+ *
+ * @param[in]   num             The size of the array.
+ * @param[in]   aList           The list of ServiceAlias.
+ *
+ * @return The copy.  The caller should call ServiceAliasFreeAliasList()
+ *         when done.
+ *
+ ******************************************************************************
+ */
+
+static ServiceAlias *
+AliasCopyAliasList(int num,
+                   const ServiceAlias *aList)
+{
+   ServiceAlias *copy;
+   int i;
+   int j;
+
+   if (num == 0) {
+      return NULL;
+   }
+
+   copy = g_new0(ServiceAlias, num);
+   for (i = 0; i < num; i++) {
+      copy[i].pemCert = g_strdup(aList[i].pemCert);
+      copy[i].num = aList[i].num;
+      copy[i].infos = g_new0(ServiceAliasInfo, aList[i].num);
+      for (j = 0; j < aList[i].num; j++) {
+         ServiceAliasCopyAliasInfoContents(&(aList[i].infos[j]),
+                                           &(copy[i].infos[j]));
+      }
+   }
+
+   return copy;
+}
+
+
+/*
+ ******************************************************************************
+ * AliasCopyMappedAliasList --                                           */ /**
+ *
+ * Copies an array of ServiceMappedAlias.
+ *
+ * @param[in]   num             The size of the array.
+ * @param[in]   maList          The list of ServiceMappedAlias.
+ *
+ * @return The copy.  The caller should call
+ *         ServiceAliasFreeMappedAliasList() when done.
+ *
+ ******************************************************************************
+ */
+
+static ServiceMappedAlias *
+AliasCopyMappedAliasList(int num,
+                         const ServiceMappedAlias *maList)
+{
+   ServiceMappedAlias *copy;
+   int i;
+   int j;
+
+   if (num == 0) {
+      return NULL;
+   }
+
+   copy = g_new0(ServiceMappedAlias, num);
+   for (i = 0; i < num; i++) {
+      copy[i].pemCert = g_strdup(maList[i].pemCert);
+      copy[i].userName = g_strdup(maList[i].userName);
+      copy[i].num = maList[i].num;
+      copy[i].subjects = g_new0(ServiceSubject, maList[i].num);
+      for (j = 0; j < maList[i].num; j++) {
+         copy[i].subjects[j].type = maList[i].subjects[j].type;
+         if (SUBJECT_TYPE_NAMED == maList[i].subjects[j].type) {
+            copy[i].subjects[j].name = g_strdup(maList[i].subjects[j].name);
+         }
+      }
+   }
+
+   return copy;
+}
+
+
+/*
+ ******************************************************************************
+ * AliasCacheEntryFree --                                                */ /**
+ *
+ * Frees a parsed alias file.
+ *
+ * @param[in]   data            The AliasCacheEntry.
+ *
+ ******************************************************************************
+ */
+
+static void
+AliasCacheEntryFree(gpointer data)
+{
+   AliasCacheEntry *entry = data;
+
+   ServiceAliasFreeAliasList(entry->num, entry->aList);
+   g_free(entry);
+}
+
+
+/*
+ ******************************************************************************
+ * AliasCacheInvalidate --                                               */ /**
+ *
+ * Forgets the parsed alias file of a user and the parsed mapping file.
+ * Used when they are saved, in case they change within the resolution of
+ * the file times.
+ *
+ * @param[in]   userName        The user whose alias file changed.
+ *
+ ******************************************************************************
+ */
+
+static void
+AliasCacheInvalidate(const gchar *userName)
+{
+   if (aliasCache != NULL) {
+      gchar *aliasFilename = ServiceUserNameToAliasStoreFileName(userName);
+
+      g_hash_table_remove(aliasCache, aliasFilename);
+      g_free(aliasFilename);
+   }
+
+   if (mappedCache.valid) {
+      ServiceAliasFreeMappedAliasList(mappedCache.num, mappedCache.maList);
+      memset(&mappedCache, 0, sizeof mappedCache);
+   }
+}
+
 
 /*
  ******************************************************************************
  * AliasLoadAliases --                                                   */ /**
  *
- * Reads and parses the Alias file for userName.
+ * Reads and parses the Alias file for userName.  The parsed file is kept
+ * and returned again until the file changes.
  *
  * @param[in]   userName        The user whose store is to be loaded.
  * @param[out]  num             The number of certs read.
@@ -1446,6 +1726,9 @@ AliasLoadAliases(const gchar *userName,
    AliasParseList list;
    VGAuthError err;
    GError *gErr = NULL;
+   AliasFileId fileId;
+   AliasCacheEntry *entry;
+   gboolean cacheIt = FALSE;
 
    ASSERT(num);
    ASSERT(aList);
@@ -1461,10 +1744,22 @@ AliasLoadAliases(const gchar *userName,
 
    aliasFilename = ServiceUserNameToAliasStoreFileName(userName);
 
+   AliasGetFileId(aliasFilename, &fileId);
+   entry = (aliasCache != NULL) ?
+      g_hash_table_lookup(aliasCache, aliasFilename) : NULL;
+   if (entry != NULL &&
+       AliasFileUnchanged(aliasFilename, userName, &entry->id, &fileId)) {
+      *num = entry->num;
+      *aList = AliasCopyAliasList(entry->num, entry->aList);
+      err = VGAUTH_E_OK;
+      goto cleanup;
+   }
+
    /*
     * If it's not there, then we have nothing to read.
     */
    if (!g_file_test(aliasFilename, G_FILE_TEST_EXISTS)) {
+      cacheIt = ALIAS_CACHE_PARSED_FILES;
       goto done;
    }
 
@@ -1486,8 +1781,25 @@ AliasLoadAliases(const gchar *userName,
       err = VGAUTH_E_FAIL;
       goto cleanup;
    }
+   cacheIt = ALIAS_CACHE_PARSED_FILES;
 
 done:
+   /*
+    * Only keep what was read from a file that passed the security checks,
+    * or from no file at all.
+    */
+   if (cacheIt) {
+      if (aliasCache == NULL) {
+         aliasCache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            g_free, AliasCacheEntryFree);
+      }
+      entry = g_new0(AliasCacheEntry, 1);
+      entry->id = fileId;
+      entry->num = list.num;
+      entry->aList = AliasCopyAliasList(list.num, list.aList);
+      g_hash_table_replace(aliasCache, g_strdup(aliasFilename), entry);
+   }
+
    /*
     * We're just transferring the data to the caller to free.
     */
@@ -1751,7 +2063,8 @@ MappedEndElement(GMarkupParseContext *parseContext,
  ******************************************************************************
  * AliasLoadMapped --                                                    */ /**
  *
- * Reads and parses the mapping file.
+ * Reads and parses the mapping file.  The parsed file is kept and
+ * returned again until the file changes.
  *
  * @param[out]  num             The number of entries read.
  * @param[out]  maList          The ServiceMappedAliases read.  The caller
@@ -1782,6 +2095,8 @@ AliasLoadMapped(int *num,
    MappedAliasParseList list;
    VGAuthError err;
    GError *gErr = NULL;
+   AliasFileId fileId;
+   gboolean cacheIt = FALSE;
 
    ASSERT(num);
    ASSERT(maList);
@@ -1799,10 +2114,20 @@ AliasLoadMapped(int *num,
                                  aliasStoreRootDir,
                                  ALIASSTORE_MAPFILE_NAME);
 
+   AliasGetFileId(mapFilename, &fileId);
+   if (mappedCache.valid &&
+       AliasFileUnchanged(mapFilename, NULL, &mappedCache.id, &fileId)) {
+      *num = mappedCache.num;
+      *maList = AliasCopyMappedAliasList(mappedCache.num, mappedCache.maList);
+      err = VGAUTH_E_OK;
+      goto cleanup;
+   }
+
    /*
     * If its not there, then we have nothing to read.
     */
    if (!g_file_test(mapFilename, G_FILE_TEST_EXISTS)) {
+      cacheIt = ALIAS_CACHE_PARSED_FILES;
       goto done;
    }
 
@@ -1824,8 +2149,17 @@ AliasLoadMapped(int *num,
       err = VGAUTH_E_FAIL;
       goto cleanup;
    }
+   cacheIt = ALIAS_CACHE_PARSED_FILES;
 
 done:
+   if (cacheIt) {
+      ServiceAliasFreeMappedAliasList(mappedCache.num, mappedCache.maList);
+      mappedCache.valid = TRUE;
+      mappedCache.id = fileId;
+      mappedCache.num = list.num;
+      mappedCache.maList = AliasCopyMappedAliasList(list.num, list.maList);
+   }
+
    /*
     * We're just transferring the certs to the caller to free.
     */
@@ -2360,6 +2694,7 @@ cleanup:
    }
 
 done:
+   AliasCacheInvalidate(userName);
    g_free(tmpAliasFilename);
    g_free(tmpMapFilename);
    return err;
@@ -33,6 +33,7 @@
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <string.h>
 #include "serviceInt.h"
 #include "VGAuthProto.h"
 
@@ -354,7 +355,13 @@ ServiceNetworkReadData(ServiceConnection *conn,
       return VGAUTH_E_COMM;
    }
 
-   *data = g_strndup(buf, ret);
+   /*
+    * Copy the bytes as is, the binary wire format may contain NULs, but
+    * keep the data NUL terminated for the XML parser users.
+    */
+   *data = g_malloc(ret + 1);
+   memcpy(*data, buf, ret);
+   (*data)[ret] = '\0';
    *len = ret;
 
    return err;
@@ -30,6 +30,7 @@
 #include "VGAuthLog.h"
 #include "serviceInt.h"
 #include "VGAuthProto.h"
+#include "protoBinary.h"
 #ifdef _WIN32
 #include "winToken.h"
 #include "winDupHandle.h"
@@ -53,8 +54,11 @@ typedef enum {
    PROTO_REQUEST_VALIDATETICKET,
    PROTO_REQUEST_REVOKETICKET,
    PROTO_REQUEST_VALIDATE_SAML_BEARER_TOKEN,
+   PROTO_REQUEST_BINARYWIREFORMAT,
 } ProtoRequestType;
 
+#define PROTO_REQUEST_NUM_TYPES  (PROTO_REQUEST_BINARYWIREFORMAT + 1)
+
 /*
  * Possible parse states for requests.
  */
@@ -90,6 +94,13 @@ struct ProtoRequest {
    gboolean complete;
    int sequenceNumber;
 
+   /*
+    * xmlStarted is set once data was fed to the XML parser; binary is set
+    * if the request came as a binary frame, and must be answered with one.
+    */
+   gboolean xmlStarted;
+   gboolean binary;
+
    ProtoRequestType reqType;
 
    ProtoParseState parseState;
@@ -156,8 +167,61 @@ struct ProtoRequest {
 };
 
 
+/*
+ * Timing of the requests handled, by request type, so the worker pool
+ * can be sized.  Only touched from the main loop.
+ */
+typedef struct ProtoRequestStats {
+   guint64 count;
+   gint64 totalUsecs;
+   gint64 maxUsecs;
+   gint64 totalWaitUsecs;     // time spent queued for a worker
+   gint64 maxWaitUsecs;
+} ProtoRequestStats;
+
+static ProtoRequestStats protoRequestStats[PROTO_REQUEST_NUM_TYPES];
+static guint protoMaxQueued = 0;
+
+/*
+ * SAML token verification is the one expensive request, so it runs on a
+ * pool of worker threads to keep the main loop answering other clients.
+ * Only the token verification itself runs on a worker; the alias store
+ * check and the reply are done back on the main loop, while reading
+ * from the connection is suspended.
+ */
+typedef struct ProtoWork {
+   ServiceConnection *conn;
+   ProtoRequest *req;
+   gint64 queued;             // monotonic time the request was queued
+   gint64 started;            // monotonic time a worker picked it up
+   VGAuthError err;
+   gchar *subjectName;
+   int numCerts;
+   gchar **certChain;
+} ProtoWork;
+
+static GThreadPool *protoWorkerPool = NULL;
+
+
 static VGAuthError ServiceProtoValidateSamlBearerToken(ServiceConnection *conn,
                                                        ProtoRequest *req);
+static VGAuthError ServiceProtoQueueValidateSamlBearerToken(ServiceConnection *conn,
+                                                            ProtoRequest *req,
+                                                            gint64 start);
+static VGAuthError ServiceProtoFinishValidateSamlBearerToken(ServiceConnection *conn,
+                                                             ProtoRequest *req,
+                                                             VGAuthError err,
+                                                             char *subjectName,
+                                                             int numCerts,
+                                                             char **certChain);
+static gboolean ServiceProtoWorkDone(gpointer data);
+static VGAuthError ServiceProtoHandleBinaryWireFormat(ServiceConnection *conn,
+                                                      ProtoRequest *req);
+static void ServiceProtoRecordRequest(ServiceConnection *conn,
+                                      ProtoRequest *req,
+                                      VGAuthError err,
+                                      gint64 waitUsecs,
+                                      gint64 totalUsecs);
 
 
 /*
@@ -197,6 +261,8 @@ ProtoRequestTypeText(ProtoRequestType t)
       return "REVOKETICKET";
    case PROTO_REQUEST_VALIDATE_SAML_BEARER_TOKEN:
       return "VALIDATE_SAML_BEARER_TOKEN";
+   case PROTO_REQUEST_BINARYWIREFORMAT:
+      return "BINARYWIREFORMAT";
    default:
       return "INVALID";
    }
@@ -348,6 +414,8 @@ static const ReqName reqNameList[] = {
    { PROTO_REQUEST_REVOKETICKET, VGAUTH_REQUESTREVOKETICKET_ELEMENT_NAME },
    { PROTO_REQUEST_VALIDATE_SAML_BEARER_TOKEN,
      VGAUTH_REQUESTVALIDATESAMLBEARERTOKEN_ELEMENT_NAME },
+   { PROTO_REQUEST_BINARYWIREFORMAT,
+     VGAUTH_REQUESTBINARYWIREFORMAT_ELEMENT_NAME },
 };
 
 static ProtoRequestType
@@ -1015,6 +1083,7 @@ Proto_FreeRequest(ProtoRequest *req)
       g_free(req->reqData.queryAliases.userName);
       break;
    case PROTO_REQUEST_QUERYMAPPEDALIASES:
+   case PROTO_REQUEST_BINARYWIREFORMAT:
       //empty
       break;
    case PROTO_REQUEST_CREATETICKET:
@@ -1064,13 +1133,108 @@ Proto_SanityCheckRequest(ProtoRequest *request)
     * care about sequence numbers, or matching a request to a reply.
     */
 #if VGAUTH_PROTO_TRACE
-   ASSERT(strncmp(request->rawData, VGAUTH_XML_PREAMBLE,
+   ASSERT(request->binary ||
+          strncmp(request->rawData, VGAUTH_XML_PREAMBLE,
                   strlen(VGAUTH_XML_PREAMBLE)) == 0);
 #endif
    return VGAUTH_E_OK;
 }
 
 
+/*
+ ******************************************************************************
+ * ServiceProtoParseBinaryRequest --                                     */ /**
+ *
+ * Adds data read from a client using the binary wire format to the frame
+ * being received, and fills in the request once the frame is complete.
+ * Only ValidateSamlBToken is sent as a binary frame.
+ *
+ * @param[in]  conn                 The ServiceConnection.
+ * @param[in]  req                  The request being received.
+ * @param[in]  data                 The data read.
+ * @param[in]  len                  The length of the data.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+ServiceProtoParseBinaryRequest(ServiceConnection *conn,
+                               ProtoRequest *req,
+                               const gchar *data,
+                               gsize len)
+{
+   VGAuthError err;
+   gsize frameLen;
+   gchar **fields = NULL;
+   guint numFields;
+
+   if (NULL == conn->binaryBuf) {
+      conn->binaryBuf = g_byte_array_new();
+   }
+   g_byte_array_append(conn->binaryBuf, (const guint8 *) data, (guint) len);
+
+   err = ProtoBinary_GetFrameLength(conn->binaryBuf->data,
+                                    conn->binaryBuf->len, &frameLen);
+   if (err != VGAUTH_E_OK || 0 == frameLen) {
+      return err;
+   }
+
+   /*
+    * The client waits for the reply before sending anything else.
+    */
+   if (frameLen != conn->binaryBuf->len) {
+      Warning("%s: unexpected data after binary request on connection %d\n",
+              __FUNCTION__, conn->connId);
+      return VGAUTH_E_COMM;
+   }
+
+   err = ProtoBinary_ParseFields(conn->binaryBuf->data, frameLen,
+                                 &fields, &numFields);
+   g_byte_array_free(conn->binaryBuf, TRUE);
+   conn->binaryBuf = NULL;
+   if (err != VGAUTH_E_OK) {
+      return err;
+   }
+
+   if (numFields != 5 ||
+       Proto_RequestNameToType(fields[0]) !=
+          PROTO_REQUEST_VALIDATE_SAML_BEARER_TOKEN) {
+      Warning("%s: unsupported binary request '%s' with %u fields\n",
+              __FUNCTION__, numFields > 0 ? fields[0] : "", numFields);
+      g_strfreev(fields);
+      return VGAUTH_E_COMM;
+   }
+
+   req->reqType = PROTO_REQUEST_VALIDATE_SAML_BEARER_TOKEN;
+   req->sequenceNumber = atoi(fields[1]);
+   req->reqData.validateSamlBToken.samlToken = fields[2];
+   fields[2] = NULL;
+   /*
+    * An empty userName element leaves the XML request with NULL.
+    */
+   if (*fields[3] != '\0') {
+      req->reqData.validateSamlBToken.userName = fields[3];
+      fields[3] = NULL;
+   }
+   req->reqData.validateSamlBToken.validateOnly = atoi(fields[4]) != 0;
+   req->binary = TRUE;
+   req->complete = TRUE;
+
+   /*
+    * g_strfreev() stops at the first NULL, so free what is left by hand.
+    */
+   g_free(fields[0]);
+   g_free(fields[1]);
+   g_free(fields[3]);
+   g_free(fields[4]);
+   g_free(fields);
+
+   return VGAUTH_E_OK;
+}
+
+
 /*
  ******************************************************************************
  * ServiceProtoReadAndProcessRequest --                                  */ /**
@@ -1123,24 +1287,35 @@ ServiceProtoReadAndProcessRequest(ServiceConnection *conn)
       if (err != VGAUTH_E_OK) {
          goto abort;
       }
-#if VGAUTH_PROTO_TRACE
-      if (req->rawData) {
-         req->rawData = g_strdup_printf("%s%s", req->rawData, data);
+
+      if (conn->binaryWire && !req->xmlStarted &&
+          (NULL != conn->binaryBuf || ProtoBinary_IsFrameStart(data, len))) {
+         err = ServiceProtoParseBinaryRequest(conn, req, data, len);
+         g_free(data);
+         if (err != VGAUTH_E_OK) {
+            goto abort;
+         }
       } else {
-         req->rawData = g_strdup(data);
-      }
+         req->xmlStarted = TRUE;
+#if VGAUTH_PROTO_TRACE
+         if (req->rawData) {
+            req->rawData = g_strdup_printf("%s%s", req->rawData, data);
+         } else {
+            req->rawData = g_strdup(data);
+         }
 #endif
-      bRet = g_markup_parse_context_parse(conn->parseContext,
-                                          data,
-                                          len,
-                                          &gErr);
-      g_free(data);
-      if (!bRet) {
-         err = VGAUTH_E_COMM;
-         Warning("%s: g_markup_parse_context_parse() failed: %s\n",
-                 __FUNCTION__, gErr->message);
-         g_error_free(gErr);
-         goto abort;
+         bRet = g_markup_parse_context_parse(conn->parseContext,
+                                             data,
+                                             len,
+                                             &gErr);
+         g_free(data);
+         if (!bRet) {
+            err = VGAUTH_E_COMM;
+            Warning("%s: g_markup_parse_context_parse() failed: %s\n",
+                    __FUNCTION__, gErr->message);
+            g_error_free(gErr);
+            goto abort;
+         }
       }
    }
 
@@ -1215,6 +1390,12 @@ Proto_SecurityCheckRequest(ServiceConnection *conn,
    case PROTO_REQUEST_QUERYMAPPEDALIASES:
       err = VGAUTH_E_OK;
       break;
+      /*
+       * The wire format of the public pipe stays XML.
+       */
+   case PROTO_REQUEST_BINARYWIREFORMAT:
+      err = conn->isPublic ? VGAUTH_E_PERMISSION_DENIED : VGAUTH_E_OK;
+      break;
       /*
        * These request can come over any user connection; always let
        * them through if they are coming from root or the owner of
@@ -1364,6 +1545,7 @@ ServiceProtoDispatchRequest(ServiceConnection *conn,
 {
    VGAuthError err;
    gchar *packet;
+   gint64 start = g_get_monotonic_time();
 
 
    /*
@@ -1450,7 +1632,13 @@ ServiceProtoDispatchRequest(ServiceConnection *conn,
    case PROTO_REQUEST_REVOKETICKET:
       err = ServiceProtoRevokeTicket(conn, req);
       break;
+   case PROTO_REQUEST_BINARYWIREFORMAT:
+      err = ServiceProtoHandleBinaryWireFormat(conn, req);
+      break;
    case PROTO_REQUEST_VALIDATE_SAML_BEARER_TOKEN:
+      if (NULL != protoWorkerPool) {
+         return ServiceProtoQueueValidateSamlBearerToken(conn, req, start);
+      }
       err = ServiceProtoValidateSamlBearerToken(conn, req);
       break;
    default:
@@ -1472,12 +1660,251 @@ sendError:
       break;
    }
 
+   ServiceProtoRecordRequest(conn, req, err, 0,
+                             g_get_monotonic_time() - start);
+
+   return err;
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoRecordRequest --                                          */ /**
+ *
+ * Logs a processed request and adds its timing to the request stats.
+ *
+ * @param[in]   conn          The ServiceConnection.
+ * @param[in]   req           The processed request.
+ * @param[in]   err           The result of sending the reply.
+ * @param[in]   waitUsecs     How long the request waited for a worker.
+ * @param[in]   totalUsecs    How long the request took, waiting included.
+ *
+ ******************************************************************************
+ */
+
+static void
+ServiceProtoRecordRequest(ServiceConnection *conn,
+                          ProtoRequest *req,
+                          VGAuthError err,
+                          gint64 waitUsecs,
+                          gint64 totalUsecs)
+{
+   ProtoRequestStats *stats;
+
    // 'err' is from ServiceNetworkWriteData(), not from the operation
    Log("%s: processed reqType %d(%s REQ), returning "
-       VGAUTHERR_FMT64" on connection %d\n", __FUNCTION__,
-       req->reqType, ProtoRequestTypeText(req->reqType), err, conn->connId);
+       VGAUTHERR_FMT64" on connection %d in %"G_GINT64_FORMAT" usecs\n",
+       __FUNCTION__, req->reqType, ProtoRequestTypeText(req->reqType), err,
+       conn->connId, totalUsecs);
 
-   return err;
+   if (req->reqType < 0 || req->reqType >= PROTO_REQUEST_NUM_TYPES) {
+      return;
+   }
+
+   stats = &protoRequestStats[req->reqType];
+   stats->count++;
+   stats->totalUsecs += totalUsecs;
+   stats->maxUsecs = MAX(stats->maxUsecs, totalUsecs);
+   stats->totalWaitUsecs += waitUsecs;
+   stats->maxWaitUsecs = MAX(stats->maxWaitUsecs, waitUsecs);
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoLogStats --                                               */ /**
+ *
+ * Logs the request timing collected since the service started.
+ *
+ ******************************************************************************
+ */
+
+static void
+ServiceProtoLogStats(void)
+{
+   int i;
+
+   for (i = 0; i < PROTO_REQUEST_NUM_TYPES; i++) {
+      ProtoRequestStats *stats = &protoRequestStats[i];
+
+      if (0 == stats->count) {
+         continue;
+      }
+      Log("%s: %s REQ: %"G_GUINT64_FORMAT" requests, "
+          "avg %"G_GINT64_FORMAT" usecs, max %"G_GINT64_FORMAT" usecs, "
+          "avg wait %"G_GINT64_FORMAT" usecs, max wait %"G_GINT64_FORMAT
+          " usecs\n", __FUNCTION__, ProtoRequestTypeText(i), stats->count,
+          stats->totalUsecs / (gint64) stats->count, stats->maxUsecs,
+          stats->totalWaitUsecs / (gint64) stats->count, stats->maxWaitUsecs);
+   }
+   if (NULL != protoWorkerPool) {
+      Log("%s: %d worker threads, at most %u requests queued\n",
+          __FUNCTION__, g_thread_pool_get_max_threads(protoWorkerPool),
+          protoMaxQueued);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoWorker --                                                 */ /**
+ *
+ * Worker thread function: verifies the SAML token of a queued request,
+ * then hands the request back to the main loop.
+ *
+ * @param[in]   data          The ProtoWork.
+ * @param[in]   userData      Unused.
+ *
+ ******************************************************************************
+ */
+
+static void
+ServiceProtoWorker(gpointer data,
+                   gpointer userData)
+{
+   ProtoWork *work = data;
+
+   work->started = g_get_monotonic_time();
+   work->err = SAML_VerifyBearerTokenCerts(work->req->reqData.validateSamlBToken.samlToken,
+                                           &work->subjectName,
+                                           &work->numCerts,
+                                           &work->certChain);
+
+   (void) g_idle_add(ServiceProtoWorkDone, work);
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoSetWorkerThreads --                                       */ /**
+ *
+ * Sizes the worker pool, creating or freeing it as needed.
+ *
+ * @param[in]   numThreads    The number of worker threads.  0 handles all
+ *                            requests on the main loop.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+ServiceProtoSetWorkerThreads(int numThreads)
+{
+   GError *gErr = NULL;
+
+   if (numThreads <= 0) {
+      if (NULL != protoWorkerPool) {
+         // any queued requests are still processed
+         g_thread_pool_free(protoWorkerPool, FALSE, FALSE);
+         protoWorkerPool = NULL;
+      }
+      return VGAUTH_E_OK;
+   }
+
+   if (NULL == protoWorkerPool) {
+      protoWorkerPool = g_thread_pool_new(ServiceProtoWorker, NULL,
+                                          numThreads, FALSE, &gErr);
+   } else {
+      (void) g_thread_pool_set_max_threads(protoWorkerPool, numThreads,
+                                           &gErr);
+   }
+   if (NULL != gErr) {
+      Warning("%s: failed to start %d worker threads: %s\n",
+              __FUNCTION__, numThreads, gErr->message);
+      g_error_free(gErr);
+      return VGAUTH_E_FAIL;
+   }
+
+   return VGAUTH_E_OK;
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoGetWorkerThreadsPref --                                   */ /**
+ *
+ * Reads the number of worker threads from the preferences.
+ *
+ * @return The number of worker threads.
+ *
+ ******************************************************************************
+ */
+
+static int
+ServiceProtoGetWorkerThreadsPref(void)
+{
+   int numThreads;
+
+   numThreads = Pref_GetInt(gPrefs,
+                            VGAUTH_PREF_NAME_MAX_WORKER_THREADS,
+                            VGAUTH_PREF_GROUP_NAME_SERVICE,
+                            VGAUTH_PREF_DEFAULT_MAX_WORKER_THREADS);
+   if (numThreads < 0) {
+      Warning(VGAUTH_PREF_NAME_MAX_WORKER_THREADS
+              " set to invalid value of %d, using default of %d instead\n",
+              numThreads, VGAUTH_PREF_DEFAULT_MAX_WORKER_THREADS);
+      numThreads = VGAUTH_PREF_DEFAULT_MAX_WORKER_THREADS;
+   }
+   Debug("%s: using %d worker threads\n", __FUNCTION__, numThreads);
+
+   return numThreads;
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoInitWorkers --                                            */ /**
+ *
+ * Starts the worker pool used for SAML token verification.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+ServiceProtoInitWorkers(void)
+{
+   return ServiceProtoSetWorkerThreads(ServiceProtoGetWorkerThreadsPref());
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoReloadPrefs --                                            */ /**
+ *
+ * Logs the request stats so far, and resizes the worker pool.
+ *
+ ******************************************************************************
+ */
+
+void
+ServiceProtoReloadPrefs(void)
+{
+   ServiceProtoLogStats();
+   (void) ServiceProtoSetWorkerThreads(ServiceProtoGetWorkerThreadsPref());
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoShutdown --                                               */ /**
+ *
+ * Logs the request stats, and waits for any running workers.
+ * Requests still queued are dropped, since the service is exiting.
+ *
+ ******************************************************************************
+ */
+
+void
+ServiceProtoShutdown(void)
+{
+   ServiceProtoLogStats();
+   if (NULL != protoWorkerPool) {
+      g_thread_pool_free(protoWorkerPool, TRUE, TRUE);
+      protoWorkerPool = NULL;
+   }
 }
 
 
@@ -1596,6 +2023,43 @@ ServiceProtoHandleConnection(ServiceConnection *conn,
 }
 
 
+/*
+ ******************************************************************************
+ * ServiceProtoHandleBinaryWireFormat --                                 */ /**
+ *
+ * Handles a BinaryWireFormat request: replies, then accepts binary frames
+ * on the connection.
+ *
+ * @param[in]   conn          The ServiceConnection.
+ * @param[in]   req           The BinaryWireFormat request to process.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+ServiceProtoHandleBinaryWireFormat(ServiceConnection *conn,
+                                   ProtoRequest *req)
+{
+   VGAuthError err;
+   gchar *packet;
+
+   packet = g_markup_printf_escaped(VGAUTH_BINARYWIREFORMAT_REPLY_FORMAT,
+                                    req->sequenceNumber);
+
+   err = ServiceNetworkWriteData(conn, strlen(packet), packet);
+   if (err != VGAUTH_E_OK) {
+      Warning("%s: failed to send BinaryWireFormat reply\n", __FUNCTION__);
+   } else {
+      conn->binaryWire = TRUE;
+   }
+   g_free(packet);
+
+   return err;
+}
+
+
 /*
  ******************************************************************************
  * ServiceProtoAddAlias --                                               */ /**
@@ -2105,22 +2569,169 @@ ServiceProtoValidateSamlBearerToken(ServiceConnection *conn,
                                     ProtoRequest *req)
 {
    VGAuthError err;
+   char *subjectName;
+   int numCerts;
+   char **certChain;
+
+   /*
+    * The validate code will do argument validation.
+    */
+   err = SAML_VerifyBearerTokenCerts(req->reqData.validateSamlBToken.samlToken,
+                                     &subjectName,
+                                     &numCerts,
+                                     &certChain);
+
+   return ServiceProtoFinishValidateSamlBearerToken(conn, req, err,
+                                                    subjectName, numCerts,
+                                                    certChain);
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoQueueValidateSamlBearerToken --                           */ /**
+ *
+ * Hands a ValidateSamlBearerToken request to the worker pool.  The
+ * request is taken from the connection, and reading from the connection
+ * is suspended until the reply is sent.
+ *
+ * @param[in]   conn          The ServiceConnection.
+ * @param[in]   req           The ValidateSamlToken request to process.
+ * @param[in]   start         When the request started being processed.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+ServiceProtoQueueValidateSamlBearerToken(ServiceConnection *conn,
+                                         ProtoRequest *req,
+                                         gint64 start)
+{
+   ProtoWork *work;
+   GError *gErr = NULL;
+
+   ASSERT(conn->curRequest == req);
+
+   work = g_malloc0(sizeof *work);
+   work->conn = conn;
+   work->req = req;
+   work->queued = start;
+
+   if (!g_thread_pool_push(protoWorkerPool, work, &gErr)) {
+      Warning("%s: failed to queue request: %s\n", __FUNCTION__,
+              gErr->message);
+      g_error_free(gErr);
+      g_free(work);
+      return ServiceProtoValidateSamlBearerToken(conn, req);
+   }
+
+   conn->curRequest = NULL;
+   ServiceConnectionSuspendIO(conn);
+
+   protoMaxQueued = MAX(protoMaxQueued,
+                        g_thread_pool_unprocessed(protoWorkerPool));
+   Debug("%s: queued reqType %d(%s REQ) on connection %d\n", __FUNCTION__,
+         req->reqType, ProtoRequestTypeText(req->reqType), conn->connId);
+
+   return VGAUTH_E_OK;
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoWorkDone --                                               */ /**
+ *
+ * Main loop callback for a request whose token a worker has verified.
+ * Finishes the request, then resumes reading from the connection.
+ *
+ * @param[in]   data          The ProtoWork.
+ *
+ * @return FALSE, to run only once.
+ *
+ ******************************************************************************
+ */
+
+static gboolean
+ServiceProtoWorkDone(gpointer data)
+{
+   ProtoWork *work = data;
+   ServiceConnection *conn = work->conn;
+   VGAuthError err;
+
+   err = ServiceProtoFinishValidateSamlBearerToken(conn, work->req, work->err,
+                                                   work->subjectName,
+                                                   work->numCerts,
+                                                   work->certChain);
+   ServiceProtoRecordRequest(conn, work->req, err,
+                             work->started - work->queued,
+                             g_get_monotonic_time() - work->queued);
+
+   Proto_FreeRequest(work->req);
+   g_free(work);
+
+   if (err == VGAUTH_E_OK) {
+      err = ServiceConnectionResumeIO(conn);
+   }
+   if (err != VGAUTH_E_OK) {
+      ServiceConnectionShutdown(conn);
+   }
+
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceProtoFinishValidateSamlBearerToken --                          */ /**
+ *
+ * Finishes a ValidateSamlBearerToken request once its token has been
+ * verified: checks the cert chain against the alias store and sends
+ * the reply.
+ *
+ * @param[in]   conn          The ServiceConnection.
+ * @param[in]   req           The ValidateSamlToken request to process.
+ * @param[in]   err           The result of verifying the token.
+ * @param[in]   subjectName   The subject of the token.  Freed here.
+ * @param[in]   numCerts      The number of certs that signed the token.
+ * @param[in]   certChain     The certs that signed the token.  Freed here.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+ServiceProtoFinishValidateSamlBearerToken(ServiceConnection *conn,
+                                          ProtoRequest *req,
+                                          VGAuthError err,
+                                          char *subjectName,
+                                          int numCerts,
+                                          char **certChain)
+{
    gchar *packet;
+   gsize packetLen;
    gchar *sPacket;
    char *userName = NULL;
-   char *subjectName = NULL;
    char *comment = NULL;
    char *tokenStr = NULL;
    ServiceAliasInfo *ai = NULL;
-
-   /*
-    * The validate code will do argument validation.
-    */
-   err = SAML_VerifyBearerTokenAndChain(req->reqData.validateSamlBToken.samlToken,
-                                        req->reqData.validateSamlBToken.userName,
-                                        &userName,
-                                        &subjectName,
-                                        &ai);
+   ServiceSubject subj;
+
+   if (err == VGAUTH_E_OK) {
+      subj.type = SUBJECT_TYPE_NAMED;
+      subj.name = subjectName;
+      err = ServiceVerifyAndCheckTrustCertChainForSubject(numCerts,
+                                                          (const char **) certChain,
+                                                          req->reqData.validateSamlBToken.userName,
+                                                          &subj,
+                                                          &userName,
+                                                          &ai);
+      Debug("%s: ServiceVerifyAndCheckTrustCertChainForSubject() "
+            "returned "VGAUTHERR_FMT64"\n", __FUNCTION__, err);
+   }
+   SAML_FreeCertChain(numCerts, certChain);
 #ifdef _WIN32
    /*
     * Only create a token in the non-info-only mode
@@ -2164,8 +2775,43 @@ ServiceProtoValidateSamlBearerToken(ServiceConnection *conn,
       if (err ==  VGAUTH_E_INVALID_CERTIFICATE) {
          err = VGAUTH_E_AUTHENTICATION_DENIED;
       }
-      packet = Proto_MakeErrorReply(conn, req, err,
-                                    "validateSamlToken failed");
+      if (req->binary) {
+         GByteArray *frame = ProtoBinary_NewFrame();
+
+         ProtoBinary_AppendUint64Field(frame, req->sequenceNumber);
+         ProtoBinary_AppendUint64Field(frame, err);
+         ProtoBinary_AppendField(frame, "validateSamlToken failed");
+         ProtoBinary_FinishFrame(frame);
+         packetLen = frame->len;
+         packet = (gchar *) g_byte_array_free(frame, FALSE);
+      } else {
+         packet = Proto_MakeErrorReply(conn, req, err,
+                                       "validateSamlToken failed");
+         packetLen = strlen(packet);
+      }
+   } else if (req->binary) {
+      GByteArray *frame = ProtoBinary_NewFrame();
+
+      Audit_Event(FALSE,
+                  SU_(validate.samlBearer.success,
+                      "Validated SAML bearer token for user '%s'"),
+                  userName);
+      ProtoBinary_AppendUint64Field(frame, req->sequenceNumber);
+      ProtoBinary_AppendUint64Field(frame, VGAUTH_E_OK);
+      ProtoBinary_AppendField(frame, userName);
+      ProtoBinary_AppendField(frame, tokenStr);
+      ProtoBinary_AppendField(frame, subjectName);
+      if (SUBJECT_TYPE_NAMED == ai->type) {
+         ProtoBinary_AppendField(frame, VGAUTH_BINARY_SUBJECT_NAMED);
+         ProtoBinary_AppendField(frame, ai->name);
+      } else {
+         ProtoBinary_AppendField(frame, VGAUTH_BINARY_SUBJECT_ANY);
+         ProtoBinary_AppendField(frame, NULL);
+      }
+      ProtoBinary_AppendField(frame, ai->comment);
+      ProtoBinary_FinishFrame(frame);
+      packetLen = frame->len;
+      packet = (gchar *) g_byte_array_free(frame, FALSE);
    } else {
       Audit_Event(FALSE,
                   SU_(validate.samlBearer.success,
@@ -2190,9 +2836,10 @@ ServiceProtoValidateSamlBearerToken(ServiceConnection *conn,
       packet = Proto_ConcatXMLStrings(packet, sPacket);
       packet = Proto_ConcatXMLStrings(packet,
                                       g_strdup(VGAUTH_VALIDATESAMLBEARERTOKEN_REPLY_FORMAT_END));
+      packetLen = strlen(packet);
    }
 
-   err = ServiceNetworkWriteData(conn, strlen(packet), packet);
+   err = ServiceNetworkWriteData(conn, packetLen, packet);
    if (err != VGAUTH_E_OK) {
       VGAUTH_LOG_WARNING("ServiceNetWorkWriteData() failed, pipe = %s", conn->pipeName);
       goto done;
@@ -2224,6 +2871,11 @@ done:
 void
 ServiceProtoCleanupParseState(ServiceConnection *conn)
 {
+   if (NULL != conn->binaryBuf) {
+      g_byte_array_free(conn->binaryBuf, TRUE);
+      conn->binaryBuf = NULL;
+   }
+
    // g_markup_parse_context_free() whines if passed a NULL
    if (NULL != conn->parseContext) {
       g_markup_parse_context_free(conn->parseContext);
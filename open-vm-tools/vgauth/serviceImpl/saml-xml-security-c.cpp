@@ -189,6 +189,19 @@ static const char *schemas[] = {
  */
 static XMLGrammarPool *pool = NULL;
 
+/*
+ * Tokens may be verified off the main loop, by the service's worker
+ * threads.  Verification shares the grammar pool, which SAML_Reload()
+ * replaces, so it is serialized.
+ */
+static GMutex samlLock;
+
+class SAMLLockGuard {
+public:
+   SAMLLockGuard() { g_mutex_lock(&samlLock); }
+   ~SAMLLockGuard() { g_mutex_unlock(&samlLock); }
+};
+
 static int clockSkewAdjustment = VGAUTH_PREF_DEFAULT_CLOCK_SKEW_SECS;
 
 static bool SAMLLoadSchema(XercesDOMParser &parser,
@@ -379,6 +392,8 @@ SAML_Reload()
       return;
    }
 
+   SAMLLockGuard lock;
+
    delete pool;
    pool = myPool.release();
 }
@@ -459,6 +474,7 @@ SAML_VerifyBearerToken(const char *xmlText,
                        ServiceAliasInfo **verifyAi)
 {
    try {
+      SAMLLockGuard lock;
       vector<string> certs;
       VGAuthError err;
       SAMLTokenData token;
@@ -490,20 +506,18 @@ SAML_VerifyBearerToken(const char *xmlText,
 
 /*
  ******************************************************************************
- * SAML_VerifyBearerTokenAndChain --                                     */ /**
+ * SAML_VerifyBearerTokenCerts --                                        */ /**
  *
- * Determines whether the SAML bearer token can be used to authenticate.
- * A token consists of a single SAML assertion.
- * The token must first be verified, then the certificate chain used
- * verify it must be checked against the appropriate certificate store.
+ * Verifies a SAML bearer token and returns the cert chain that signed it,
+ * without checking the chain against any alias store.  This is the
+ * expensive part of SAML_VerifyBearerTokenAndChain(), and it is safe to
+ * call from any thread.
  *
  * @param[in]  xmlText     The text of the SAML assertion.
- * @param[in]  userName    Optional username to authenticate as.
- * @param[out] userNameOut The user that the token has authenticated as.
- * @param[out] subjNameOut The subject in the token.
- * @param[out] verifySi    The subjectInfo associated with the entry
- *                         in the ID provider store used to verify the
- *                         SAML cert.
+ * @param[out] subjNameOut The subject in the token.  Caller must g_free().
+ * @param[out] numCerts    The number of certs in the chain.
+ * @param[out] certChain   The certs in the chain.  Caller must free with
+ *                         SAML_FreeCertChain().
  *
  * @return VGAUTH_E_OK on success, VGAuthError on failure
  *
@@ -511,22 +525,21 @@ SAML_VerifyBearerToken(const char *xmlText,
  */
 
 VGAuthError
-SAML_VerifyBearerTokenAndChain(const char *xmlText,
-                               const char *userName,
-                               char **userNameOut,
-                               char **subjNameOut,
-                               ServiceAliasInfo **verifyAi)
+SAML_VerifyBearerTokenCerts(const char *xmlText,
+                            char **subjNameOut,
+                            int *numCerts,
+                            char ***certChain)
 {
-   *userNameOut = NULL;
    *subjNameOut = NULL;
-   *verifyAi = NULL;
+   *numCerts = 0;
+   *certChain = NULL;
 
    try {
+      SAMLLockGuard lock;
       vector<string> certs;
       VGAuthError err;
       SAMLTokenData token;
       char **pemCerts;
-      ServiceSubject subj;
       int i;
 
       err = SAMLVerifyAssertion(xmlText, token, certs);
@@ -538,24 +551,9 @@ SAML_VerifyBearerTokenAndChain(const char *xmlText,
       for (i = 0; i < (int) certs.size(); i++) {
          pemCerts[i] = g_strdup(certs[i].c_str());
       }
-      subj.type = SUBJECT_TYPE_NAMED;
-      if (subjNameOut) {
-         *subjNameOut = g_strdup(token.subjectName.c_str());
-      }
-      subj.name = g_strdup(token.subjectName.c_str());
-      err = ServiceVerifyAndCheckTrustCertChainForSubject((int) certs.size(),
-                                                          (const char **) pemCerts,
-                                                          userName,
-                                                          &subj,
-                                                          userNameOut,
-                                                          verifyAi);
-      Debug("%s: ServiceVerifyAndCheckTrustCertChainForSubject() returned " VGAUTHERR_FMT64 "\n", __FUNCTION__, err);
-
-      for (i = 0; i < (int) certs.size(); i++) {
-         g_free(pemCerts[i]);
-      }
-      g_free(pemCerts);
-      g_free(subj.name);
+      *subjNameOut = g_strdup(token.subjectName.c_str());
+      *numCerts = (int) certs.size();
+      *certChain = pemCerts;
       return err;
    } catch (XSECException &e) {
       SAMLStringWrapper msg(e.getMsg());
@@ -576,6 +574,91 @@ SAML_VerifyBearerTokenAndChain(const char *xmlText,
 }
 
 
+/*
+ ******************************************************************************
+ * SAML_FreeCertChain --                                                 */ /**
+ *
+ * Frees a cert chain returned by SAML_VerifyBearerTokenCerts().
+ *
+ * @param[in]  numCerts    The number of certs in the chain.
+ * @param[in]  certChain   The certs in the chain.
+ *
+ ******************************************************************************
+ */
+
+void
+SAML_FreeCertChain(int numCerts,
+                   char **certChain)
+{
+   int i;
+
+   for (i = 0; i < numCerts; i++) {
+      g_free(certChain[i]);
+   }
+   g_free(certChain);
+}
+
+
+/*
+ ******************************************************************************
+ * SAML_VerifyBearerTokenAndChain --                                     */ /**
+ *
+ * Determines whether the SAML bearer token can be used to authenticate.
+ * A token consists of a single SAML assertion.
+ * The token must first be verified, then the certificate chain used
+ * verify it must be checked against the appropriate certificate store.
+ *
+ * @param[in]  xmlText     The text of the SAML assertion.
+ * @param[in]  userName    Optional username to authenticate as.
+ * @param[out] userNameOut The user that the token has authenticated as.
+ * @param[out] subjNameOut The subject in the token.
+ * @param[out] verifySi    The subjectInfo associated with the entry
+ *                         in the ID provider store used to verify the
+ *                         SAML cert.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+SAML_VerifyBearerTokenAndChain(const char *xmlText,
+                               const char *userName,
+                               char **userNameOut,
+                               char **subjNameOut,
+                               ServiceAliasInfo **verifyAi)
+{
+   VGAuthError err;
+   int num;
+   char **pemCerts;
+   char *subjName;
+   ServiceSubject subj;
+
+   *userNameOut = NULL;
+   *subjNameOut = NULL;
+   *verifyAi = NULL;
+
+   err = SAML_VerifyBearerTokenCerts(xmlText, &subjName, &num, &pemCerts);
+   if (VGAUTH_E_OK != err) {
+      return err;
+   }
+
+   subj.type = SUBJECT_TYPE_NAMED;
+   subj.name = subjName;
+   err = ServiceVerifyAndCheckTrustCertChainForSubject(num,
+                                                       (const char **) pemCerts,
+                                                       userName,
+                                                       &subj,
+                                                       userNameOut,
+                                                       verifyAi);
+   Debug("%s: ServiceVerifyAndCheckTrustCertChainForSubject() returned " VGAUTHERR_FMT64 "\n", __FUNCTION__, err);
+
+   SAML_FreeCertChain(num, pemCerts);
+   *subjNameOut = subjName;
+   return err;
+}
+
+
 /*
  ******************************************************************************
  * SAMLVerifyAssertion --                                                */ /**
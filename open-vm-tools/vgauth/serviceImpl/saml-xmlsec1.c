@@ -53,6 +53,36 @@ static xmlSchemaValidCtxtPtr gSchemaValidateCtx = NULL;
 #define CATALOG_FILENAME            "catalog.xml"
 #define SAML_SCHEMA_FILENAME        "saml-schema-assertion-2.0.xsd"
 
+/*
+ * Tokens that verified successfully, keyed by the SHA-256 of their text,
+ * so that presenting the same token again skips parsing, schema
+ * validation and signature verification.  The cert chain of the token
+ * is still checked against the alias store every time.
+ *
+ * An entry is used until the earliest NotOnOrAfter of the token, with
+ * the clock skew allowed by CheckTimeAttr(), and for
+ * SAML_TOKEN_CACHE_MAX_AGE seconds at most.
+ */
+#define SAML_TOKEN_CACHE_MAX_AGE       (5 * 60)
+#define SAML_TOKEN_CACHE_MAX_ENTRIES   64
+
+typedef struct _VerifiedToken {
+   gchar *subject;
+   int numCerts;
+   gchar **certChain;
+   glong notOnOrAfter;     // wall clock, in seconds
+   gint64 expiry;          // monotonic time, in microseconds
+} VerifiedToken;
+
+static GHashTable *gVerifiedTokens = NULL;
+
+/*
+ * Tokens may be verified off the main loop, by the service's worker
+ * threads.  This protects the schemas, which libxml2 can't share among
+ * threads, the clock skew and the token cache.
+ */
+static GMutex gSamlLock;
+
 /*
  * Hack to test expired tokens and by-pass the time checks.
  *
@@ -448,7 +478,13 @@ SAML_Init(void)
 void
 SAML_Shutdown()
 {
+   g_mutex_lock(&gSamlLock);
+   if (NULL != gVerifiedTokens) {
+      g_hash_table_destroy(gVerifiedTokens);
+      gVerifiedTokens = NULL;
+   }
    FreeSchemas();
+   g_mutex_unlock(&gSamlLock);
    xmlSecCryptoShutdown();
    xmlSecCryptoAppShutdown();
    xmlSecShutdown();
@@ -477,9 +513,17 @@ SAML_Shutdown()
 void
 SAML_Reload()
 {
+   g_mutex_lock(&gSamlLock);
+   /*
+    * The clock skew may change.
+    */
+   if (NULL != gVerifiedTokens) {
+      g_hash_table_remove_all(gVerifiedTokens);
+   }
    FreeSchemas();
    LoadPrefs();
    LoadCatalogAndSchema();
+   g_mutex_unlock(&gSamlLock);
 }
 
 
@@ -707,7 +751,9 @@ ValidateDoc(xmlDocPtr doc)
 {
    int ret;
 
+   g_mutex_lock(&gSamlLock);
    ret = xmlSchemaValidateDoc(gSchemaValidateCtx, doc);
+   g_mutex_unlock(&gSamlLock);
    if (ret < 0) {
       g_warning("Failed to validate doc against schema\n");
    }
@@ -1323,12 +1369,147 @@ done:
 }
 
 
+/*
+ ******************************************************************************
+ * FindNotOnOrAfter --                                                   */ /**
+ *
+ * Lowers *earliest to the NotOnOrAfter attribute of a node, if it has one.
+ *
+ * @param[in]     node      The node.
+ * @param[in/out] earliest  The earliest time found so far, in seconds.
+ *
+ ******************************************************************************
+ */
+
+static void
+FindNotOnOrAfter(const xmlNodePtr node,
+                 glong *earliest)
+{
+   xmlChar *timeAttr;
+   GTimeVal attrTime;
+
+   timeAttr = FindAttrValue(node, "NotOnOrAfter");
+   if ((NULL != timeAttr) && (0 != *timeAttr) &&
+       g_time_val_from_iso8601(timeAttr, &attrTime) &&
+       attrTime.tv_sec + gClockSkewAdjustment < *earliest) {
+      *earliest = attrTime.tv_sec + gClockSkewAdjustment;
+   }
+   if (timeAttr) {
+      xmlFree(timeAttr);
+   }
+}
+
+
+/*
+ ******************************************************************************
+ * TokenNotOnOrAfter --                                                  */ /**
+ *
+ * Finds until when a verified token passes its time checks: the earliest
+ * NotOnOrAfter of its Conditions and SubjectConfirmationData, or
+ * SAML_TOKEN_CACHE_MAX_AGE from now if that is sooner.
+ *
+ * @param[in]  doc  The parsed SAML token.
+ *
+ * @return The time in seconds.
+ *
+ ******************************************************************************
+ */
+
+static glong
+TokenNotOnOrAfter(xmlDocPtr doc)
+{
+   xmlNodePtr root = xmlDocGetRootElement(doc);
+   xmlNodePtr node;
+   xmlNodePtr child;
+   GTimeVal now;
+   glong earliest;
+
+   g_get_current_time(&now);
+   earliest = now.tv_sec + SAML_TOKEN_CACHE_MAX_AGE;
+
+   node = FindNodeByName(root, "Conditions");
+   if (NULL != node) {
+      FindNotOnOrAfter(node, &earliest);
+   }
+
+   node = FindNodeByName(root, "Subject");
+   if (NULL != node) {
+      for (child = node->children; child != NULL; child = child->next) {
+         xmlNodePtr subjConfirmData;
+
+         if (child->type != XML_ELEMENT_NODE ||
+             !xmlStrEqual(child->name, "SubjectConfirmation")) {
+            continue;
+         }
+         subjConfirmData = FindNodeByName(child, "SubjectConfirmationData");
+         if (NULL != subjConfirmData) {
+            FindNotOnOrAfter(subjConfirmData, &earliest);
+         }
+      }
+   }
+
+   return earliest;
+}
+
+
+/*
+ ******************************************************************************
+ * FreeVerifiedToken --                                                  */ /**
+ *
+ * Frees a cached verified token.
+ *
+ * @param[in]  data     The VerifiedToken.
+ *
+ ******************************************************************************
+ */
+
+static void
+FreeVerifiedToken(gpointer data)
+{
+   VerifiedToken *vt = data;
+
+   g_free(vt->subject);
+   FreeCertArray(vt->numCerts, vt->certChain);
+   g_free(vt);
+}
+
+
+/*
+ ******************************************************************************
+ * CopyCertArray --                                                      */ /**
+ *
+ * Copies a simple array of pemCert.
+ *
+ * @param[in]  num      Number of certs in array.
+ * @param[in]  certs    Array of certs to copy.
+ *
+ * @return The copy.  Free with FreeCertArray().
+ *
+ ******************************************************************************
+ */
+
+static gchar **
+CopyCertArray(int num,
+              gchar **certs)
+{
+   gchar **copy = g_new0(gchar *, num + 1);
+   int i;
+
+   for (i = 0; i < num; i++) {
+      copy[i] = g_strdup(certs[i]);
+   }
+
+   return copy;
+}
+
+
 /*
  ******************************************************************************
  * VerifySAMLToken --                                                    */ /**
  *
  * Verifies a XML text as a SAML token.
  * Parses the XML, then verifies Subject, Conditions and Signature.
+ * Tokens that verified recently are not verified again.
  *
  * @param[in]  token     Text of SAML token.
  * @param[out] subject   Subject of SAML token,  Caller must g_free().
@@ -1350,12 +1531,43 @@ VerifySAMLToken(const gchar *token,
    xmlDocPtr doc = NULL;
    int retCode = FALSE;
    gboolean bRet;
+   gchar *digest;
+   VerifiedToken *vt;
+   GTimeVal now;
    /*
     * If we want to set extra options, use this path.
     */
 #if PARSE_WITH_OPTIONS
    xmlParserCtxtPtr parseCtx = NULL;
+#endif
 
+   digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, token, -1);
+
+   g_mutex_lock(&gSamlLock);
+   if (NULL == gVerifiedTokens) {
+      gVerifiedTokens = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              g_free, FreeVerifiedToken);
+   }
+   vt = g_hash_table_lookup(gVerifiedTokens, digest);
+   if (NULL != vt) {
+      g_get_current_time(&now);
+      if (g_get_monotonic_time() < vt->expiry &&
+          now.tv_sec < vt->notOnOrAfter) {
+         g_debug("%s: token verified recently\n", __FUNCTION__);
+         if (NULL != subject) {
+            *subject = g_strdup(vt->subject);
+         }
+         *numCerts = vt->numCerts;
+         *certChain = CopyCertArray(vt->numCerts, vt->certChain);
+         g_mutex_unlock(&gSamlLock);
+         g_free(digest);
+         return TRUE;
+      }
+      g_hash_table_remove(gVerifiedTokens, digest);
+   }
+   g_mutex_unlock(&gSamlLock);
+
+#if PARSE_WITH_OPTIONS
    parseCtx = xmlCreateDocParserCtxt(token);
 
    /*
@@ -1407,6 +1619,27 @@ VerifySAMLToken(const gchar *token,
    }
 
    retCode = TRUE;
+
+#ifndef TEST_VERIFY_SIGN_ONLY
+   if (NULL != subject) {
+      vt = g_new0(VerifiedToken, 1);
+      vt->subject = g_strdup(*subject);
+      vt->numCerts = *numCerts;
+      vt->certChain = CopyCertArray(*numCerts, *certChain);
+      vt->expiry = g_get_monotonic_time() +
+                   (gint64) SAML_TOKEN_CACHE_MAX_AGE * G_USEC_PER_SEC;
+
+      g_mutex_lock(&gSamlLock);
+      vt->notOnOrAfter = TokenNotOnOrAfter(doc);
+      if (g_hash_table_size(gVerifiedTokens) >= SAML_TOKEN_CACHE_MAX_ENTRIES) {
+         g_hash_table_remove_all(gVerifiedTokens);
+      }
+      g_hash_table_insert(gVerifiedTokens, digest, vt);
+      g_mutex_unlock(&gSamlLock);
+      digest = NULL;
+   }
+#endif
+
 done:
 #if PARSE_WITH_OPTIONS
    if (NULL != parseCtx) {
@@ -1420,6 +1653,7 @@ done:
    if (doc) {
       xmlFreeDoc(doc);
    }
+   g_free(digest);
 
    return retCode;
 }
@@ -1470,6 +1704,67 @@ SAML_VerifyBearerToken(const char *xmlText,
 }
 
 
+/*
+ ******************************************************************************
+ * SAML_VerifyBearerTokenCerts --                                        */ /**
+ *
+ * Verifies a SAML bearer token and returns the cert chain that signed it,
+ * without checking the chain against any alias store.  This is the
+ * expensive part of SAML_VerifyBearerTokenAndChain(), and it is safe to
+ * call from any thread.
+ *
+ * @param[in]  xmlText     The text of the SAML assertion.
+ * @param[out] subjNameOut The subject in the token.  Caller must g_free().
+ * @param[out] numCerts    The number of certs in the chain.
+ * @param[out] certChain   The certs in the chain.  Caller must free with
+ *                         SAML_FreeCertChain().
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+SAML_VerifyBearerTokenCerts(const char *xmlText,
+                            char **subjNameOut,
+                            int *numCerts,
+                            char ***certChain)
+{
+   gboolean bRet;
+
+   *subjNameOut = NULL;
+   *numCerts = 0;
+   *certChain = NULL;
+
+   bRet = VerifySAMLToken(xmlText,
+                          subjNameOut,
+                          numCerts,
+                          certChain);
+
+   return (bRet == TRUE) ? VGAUTH_E_OK : VGAUTH_E_AUTHENTICATION_DENIED;
+}
+
+
+/*
+ ******************************************************************************
+ * SAML_FreeCertChain --                                                 */ /**
+ *
+ * Frees a cert chain returned by SAML_VerifyBearerTokenCerts().
+ *
+ * @param[in]  numCerts    The number of certs in the chain.
+ * @param[in]  certChain   The certs in the chain.
+ *
+ ******************************************************************************
+ */
+
+void
+SAML_FreeCertChain(int numCerts,
+                   char **certChain)
+{
+   FreeCertArray(numCerts, certChain);
+}
+
+
 /*
  ******************************************************************************
  * SAML_VerifyBearerTokenAndChain --                                     */ /**
@@ -1500,22 +1795,16 @@ SAML_VerifyBearerTokenAndChain(const char *xmlText,
                                ServiceAliasInfo **verifyAi)
 {
    VGAuthError err;
-   gboolean bRet;
    int num;
    gchar **certChain = NULL;
    ServiceSubject subj;
 
    *userNameOut = NULL;
-   *subjNameOut = NULL;
    *verifyAi = NULL;
 
-   bRet = VerifySAMLToken(xmlText,
-                          subjNameOut,
-                          &num,
-                          &certChain);
-
-   if (FALSE == bRet) {
-      return VGAUTH_E_AUTHENTICATION_DENIED;
+   err = SAML_VerifyBearerTokenCerts(xmlText, subjNameOut, &num, &certChain);
+   if (VGAUTH_E_OK != err) {
+      return err;
    }
 
    subj.type = SUBJECT_TYPE_NAMED;
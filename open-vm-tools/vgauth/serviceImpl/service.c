@@ -32,6 +32,7 @@
 
 static ServiceStartListeningForIOFunc startListeningIOFunc = NULL;
 static ServiceStopListeningForIOFunc stopListeningIOFunc = NULL;
+static ServiceStartReadingIOFunc startReadingIOFunc = NULL;
 
 static GHashTable *listenConnectionMap = NULL;
 
@@ -112,6 +113,8 @@ ServiceConnectionGetNextConnectionId(void)
  *                              listening for IO on a connection.
  * @param[in]   stopFunc        The function called when we no longer
  *                              care about IO on a connection.
+ * @param[in]   readFunc        The function called when we want to read
+ *                              requests from an accepted connection again.
  *
  * @return VGAUTH_E_OK on success, VGAuthError on failure
  *
@@ -120,15 +123,61 @@ ServiceConnectionGetNextConnectionId(void)
 
 VGAuthError
 ServiceRegisterIOFunctions(ServiceStartListeningForIOFunc startFunc,
-                           ServiceStopListeningForIOFunc stopFunc)
+                           ServiceStopListeningForIOFunc stopFunc,
+                           ServiceStartReadingIOFunc readFunc)
 {
    startListeningIOFunc = startFunc;
    stopListeningIOFunc = stopFunc;
+   startReadingIOFunc = readFunc;
 
    return VGAUTH_E_OK;
 }
 
 
+/*
+ ******************************************************************************
+ * ServiceConnectionSuspendIO --                                         */ /**
+ *
+ * Stops reading requests from a connection while one of its requests is
+ * being handled off the main loop.
+ *
+ * @param[in]   conn            The connection.
+ *
+ ******************************************************************************
+ */
+
+void
+ServiceConnectionSuspendIO(ServiceConnection *conn)
+{
+   ASSERT(stopListeningIOFunc);
+
+   (* stopListeningIOFunc) (conn);
+}
+
+
+/*
+ ******************************************************************************
+ * ServiceConnectionResumeIO --                                          */ /**
+ *
+ * Starts reading requests from a connection suspended with
+ * ServiceConnectionSuspendIO() again.
+ *
+ * @param[in]   conn            The connection.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+VGAuthError
+ServiceConnectionResumeIO(ServiceConnection *conn)
+{
+   ASSERT(startReadingIOFunc);
+
+   return (* startReadingIOFunc) (conn);
+}
+
+
 /*
  ******************************************************************************
  * ServiceCreatePublicConnection --                                     */ /**
@@ -773,6 +822,7 @@ Service_ReloadPrefs(void)
 {
    ServiceInitTicketPrefs();
    ServiceInitListenConnectionPrefs();
+   ServiceProtoReloadPrefs();
    SAML_Reload();
 }
 
@@ -789,6 +839,7 @@ Service_ReloadPrefs(void)
 void
 Service_Shutdown(void)
 {
+   ServiceProtoShutdown();
    SAML_Shutdown();
 }
 
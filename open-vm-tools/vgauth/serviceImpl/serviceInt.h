@@ -112,6 +112,13 @@ typedef struct _ServiceConnection {
    ProtoRequest *curRequest;
    GMarkupParseContext *parseContext;
 
+   /*
+    * Set once the client switched to the binary wire format; binaryBuf
+    * holds a partially read binary frame.
+    */
+   gboolean binaryWire;
+   GByteArray *binaryBuf;
+
 #ifdef SUPPORT_TCP
    int port;
 #endif
@@ -260,9 +267,14 @@ gboolean ServiceNetworkIsConnectionPrivateSuperUser(ServiceConnection *conn);
  */
 typedef VGAuthError (* ServiceStartListeningForIOFunc)(ServiceConnection *conn);
 typedef VGAuthError (* ServiceStopListeningForIOFunc)(ServiceConnection *conn);
+typedef VGAuthError (* ServiceStartReadingIOFunc)(ServiceConnection *conn);
 
 VGAuthError ServiceRegisterIOFunctions(ServiceStartListeningForIOFunc startFunc,
-                                       ServiceStopListeningForIOFunc stopFunc);
+                                       ServiceStopListeningForIOFunc stopFunc,
+                                       ServiceStartReadingIOFunc readFunc);
+
+void ServiceConnectionSuspendIO(ServiceConnection *conn);
+VGAuthError ServiceConnectionResumeIO(ServiceConnection *conn);
 
 
 /*
@@ -397,6 +409,10 @@ VGAuthError ServiceProtoValidateTicket(ServiceConnection *conn,
 VGAuthError ServiceProtoRevokeTicket(ServiceConnection *conn,
                                      ProtoRequest *req);
 
+VGAuthError ServiceProtoInitWorkers(void);
+void ServiceProtoReloadPrefs(void);
+void ServiceProtoShutdown(void);
+
 /*
  * File wrapper functions.
  */
@@ -489,6 +505,11 @@ VGAuthError SAML_VerifyBearerTokenAndChain(const char *xmlText,
                                            char **userNameOut,
                                            char **subjectNameOut,
                                            ServiceAliasInfo **verifyAi);
+VGAuthError SAML_VerifyBearerTokenCerts(const char *xmlText,
+                                        char **subjectNameOut,
+                                        int *numCerts,
+                                        char ***certChain);
+void SAML_FreeCertChain(int numCerts, char **certChain);
 void SAML_Shutdown(void);
 void SAML_Reload(void);
 
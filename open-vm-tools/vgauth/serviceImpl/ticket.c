@@ -71,6 +71,7 @@
 #define  TICKET_EXPIRE_TIME_IN_SECONDS_DEFAULT (24 * 60 * 60)
 
 static void ServiceReapOldTickets(void);
+static void TicketScheduleReap(void);
 
 typedef struct {
    gchar *ticket;
@@ -93,12 +94,21 @@ typedef struct {
    // XXX I wanted to use GDateTime, but its in glib 2.26, and we're at 2.24.
    // Its probably a good idea to upgrade asap.
    GTimeVal lastUse;
+
+   GList *useLink;            // this ticket's link in ticketUseOrder
 } TicketInfo;
 
 static GHashTable *ticketTable = NULL;
 static int ticketExpireTime = TICKET_EXPIRE_TIME_IN_SECONDS_DEFAULT;
-static int reapCheckTime;
-static gboolean reapTimerRunning = FALSE;
+
+/*
+ * All tickets, least recently used first.  Since every ticket has the
+ * same TTL, this is also the order they expire in, so reaping only
+ * looks at the head, and the reap timer is set for when the head
+ * expires.
+ */
+static GQueue ticketUseOrder = G_QUEUE_INIT;
+static guint reapTimerId = 0;
 
 
 /*
@@ -136,6 +146,7 @@ TicketFreeTicketInfo(gpointer i)
 {
    TicketInfo *info = (TicketInfo *) i;
 
+   g_queue_delete_link(&ticketUseOrder, info->useLink);
    g_free(info->ticket);
    g_free(info->userName);
    ServiceFreeValidationResultsData(info->svData);
@@ -150,11 +161,12 @@ TicketFreeTicketInfo(gpointer i)
  ******************************************************************************
  * TicketReapTimerCallback --                                            */ /**
  *
- * Callback for a timer which looks for old tickets to reap.
+ * Callback for a timer set for when the least recently used ticket
+ * expires.  Reaps it, and sets the timer for the next one.
  *
  * @param[in] userData   Any user data (unused).
  *
- * @return TRUE if the timer is to be kept, FALSE if not.
+ * @return FALSE, the timer is set again by TicketScheduleReap().
  *
  ******************************************************************************
  */
@@ -162,17 +174,77 @@ TicketFreeTicketInfo(gpointer i)
 static gboolean
 TicketReapTimerCallback(gpointer userData)
 {
+   reapTimerId = 0;
    ServiceReapOldTickets();
+   TicketScheduleReap();
+
+   return FALSE;
+}
+
+
+/*
+ ******************************************************************************
+ * TicketScheduleReap --                                                 */ /**
+ *
+ * (Re)sets the reap timer for when the least recently used ticket expires,
+ * or stops it if there are no tickets.
+ *
+ ******************************************************************************
+ */
+
+static void
+TicketScheduleReap(void)
+{
+   TicketInfo *oldest;
+   GTimeVal now;
+   glong delay;
+
+   if (reapTimerId > 0) {
+      g_source_remove(reapTimerId);
+      reapTimerId = 0;
+   }
+
+   oldest = g_queue_peek_head(&ticketUseOrder);
+   if (NULL == oldest) {
+      return;
+   }
+
    /*
-    * Keep the timer running if we still have entries in the hashtable.
+    * Util_CheckExpiration() is true once we're past the expiration second.
     */
-   reapTimerRunning = (g_hash_table_size(ticketTable) > 0);
+   g_get_current_time(&now);
+   delay = oldest->lastUse.tv_sec + ticketExpireTime + 1 - now.tv_sec;
+   if (delay <= 0) {
+      delay = 1;
+   }
 
 #if TICKET_TABLE_DEBUG
-   Debug("%s: reapTimerRunning? %d\n", __FUNCTION__, reapTimerRunning);
+   Debug("%s: next reap in %ld seconds\n", __FUNCTION__, delay);
 #endif
 
-   return reapTimerRunning;
+   reapTimerId = g_timeout_add_seconds((guint) delay,
+                                       TicketReapTimerCallback,
+                                       NULL);
+}
+
+
+/*
+ ******************************************************************************
+ * TicketTouch --                                                        */ /**
+ *
+ * Marks a ticket as just used, moving it to the end of the expiry order.
+ *
+ * @param[in] info   The ticket.
+ *
+ ******************************************************************************
+ */
+
+static void
+TicketTouch(TicketInfo *info)
+{
+   g_get_current_time(&info->lastUse);
+   g_queue_unlink(&ticketUseOrder, info->useLink);
+   g_queue_push_tail_link(&ticketUseOrder, info->useLink);
 }
 
 
@@ -201,15 +273,11 @@ ServiceInitTicketPrefs(void)
    Debug("%s: ticket TTL set to %d seconds\n", __FUNCTION__, ticketExpireTime);
 
    /*
-    * Compute the reapCheckTime based on the TTL.
+    * The TTL may have changed, so may the time the oldest ticket expires.
     */
-   reapCheckTime = ticketExpireTime / 10;
-   if (reapCheckTime <= 0) {
-      reapCheckTime = 1;
+   if (NULL != ticketTable) {
+      TicketScheduleReap();
    }
-   Debug("%s: computed reapCheckTime as %d seconds\n",
-         __FUNCTION__, reapCheckTime);
-
 }
 
 
@@ -366,6 +434,9 @@ ServiceCreateTicketInfo(const char *userName,
 
    newInfo->userName = g_strdup(userName);
    g_get_current_time(&newInfo->lastUse);
+   newInfo->useLink = g_list_alloc();
+   newInfo->useLink->data = newInfo;
+   g_queue_push_tail_link(&ticketUseOrder, newInfo->useLink);
 
    newInfo->type = type;
    if (VALIDATION_RESULTS_TYPE_SAML == type) {
@@ -386,11 +457,8 @@ ServiceCreateTicketInfo(const char *userName,
    /*
     * Set up a reap timer if it's not already running.
     */
-   if (!reapTimerRunning) {
-      (void) g_timeout_add_seconds(reapCheckTime,
-                                   TicketReapTimerCallback,
-                                   NULL);
-      reapTimerRunning = TRUE;
+   if (0 == reapTimerId) {
+      TicketScheduleReap();
    }
 
    *info = newInfo;
@@ -508,44 +576,12 @@ done:
 #endif
 
 
-/*
- ******************************************************************************
- * TicketHashRemoveCheck --                                             */ /**
- *
- * Hash table remove check function.
- *
- * @param[in]  key       Hash table key.
- * @param[in]  value     Hash table value.
- * @param[in]  userData  Any user data (unused)
- *
- * @returns TRUE if the entry is to be removed from the table.
- *
- ******************************************************************************
- */
-
-static gboolean
-TicketHashRemoveCheck(gpointer key,
-                      gpointer value,
-                      gpointer userData)
-{
-   TicketInfo *info = (TicketInfo *) value;
-
-   if (Util_CheckExpiration(&(info->lastUse), ticketExpireTime)) {
-#if TICKET_TABLE_DEBUG
-      Debug("%s: removing old ticket %s\n", __FUNCTION__, info->ticket);
-#endif
-      return TRUE;
-   }
-
-   return FALSE;
-}
-
-
 /*
  ******************************************************************************
  * ServiceReapOldTickets --                                              */ /**
  *
- * Looks for any expired tickets and removes them.
+ * Looks for any expired tickets and removes them.  Only the expired
+ * tickets at the head of the expiry order are looked at.
  *
  ******************************************************************************
  */
@@ -553,15 +589,30 @@ TicketHashRemoveCheck(gpointer key,
 static void
 ServiceReapOldTickets(void)
 {
-   int numRemoved;
+   TicketInfo *info;
+   int numRemoved = 0;
 
 #if TICKET_TABLE_DEBUG
    Debug("%s: dumping ticket table before reap\n", __FUNCTION__);
    DumpTicketTable();
 #endif
 
-   numRemoved = g_hash_table_foreach_remove(ticketTable,
-                                            TicketHashRemoveCheck, NULL);
+   while ((info = g_queue_peek_head(&ticketUseOrder)) != NULL &&
+          Util_CheckExpiration(&(info->lastUse), ticketExpireTime)) {
+#if TICKET_TABLE_DEBUG
+      Debug("%s: removing old ticket %s\n", __FUNCTION__, info->ticket);
+#endif
+      // frees info, and its link in ticketUseOrder
+      g_hash_table_remove(ticketTable, info->ticket);
+      numRemoved++;
+   }
+
+   /*
+    * The oldest ticket changed, so the timer is for the wrong time.
+    */
+   if (numRemoved > 0) {
+      TicketScheduleReap();
+   }
 
 #if TICKET_TABLE_DEBUG
    Debug("%s: reaped %d tickets\n", __FUNCTION__, numRemoved);
@@ -629,7 +680,7 @@ ServiceValidateTicketWin(const char *ticket,
 
    /* all OK */
 
-   g_get_current_time(&info->lastUse);
+   TicketTouch(info);
 
    *userName = g_strdup(info->userName);
    *token = dupTokenInText;
@@ -683,7 +734,7 @@ ServiceValidateTicketPosix(const char *ticket,
 
    if (NULL != info) {
       // update the last access time
-      g_get_current_time(&info->lastUse);
+      TicketTouch(info);
 
       *userName = g_strdup(info->userName);
       *type = info->type;
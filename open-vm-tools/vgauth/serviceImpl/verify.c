@@ -29,6 +29,28 @@
 #include "certverify.h"
 #include "vmxlog.h"
 
+/*
+ * Chains that verified successfully, keyed by a hash of the leaf,
+ * untrusted and trusted certs passed to CertVerify_CertChain(), so that
+ * the tokens of an issuer don't verify the same chain again and again.
+ * The trusted certs come from the alias store, so changing the aliases
+ * of a chain changes its key.
+ *
+ * An entry is used until the first cert of the chain expires, and for
+ * VERIFY_CHAIN_CACHE_MAX_AGE seconds at most, since revocation lists are
+ * not checked yet and nothing would tell us about them.
+ */
+#define VERIFY_CHAIN_CACHE_MAX_AGE        (5 * 60)
+#define VERIFY_CHAIN_CACHE_MAX_ENTRIES    64
+
+typedef struct _VerifiedChain {
+   time_t notAfter;
+   gint64 expiry;          // monotonic time, in microseconds
+} VerifiedChain;
+
+static GHashTable *verifiedChains = NULL;
+
+
 /*
  ******************************************************************************
  * ServiceInitVerify --                                                 */ /**
@@ -49,6 +71,124 @@ ServiceInitVerify(void)
 }
 
 
+/*
+ ******************************************************************************
+ * VerifyChainCacheKey --                                                */ /**
+ *
+ * Hashes the certs of a chain verification.
+ *
+ * @param[in]  leafCert      The leaf cert.
+ * @param[in]  numUntrusted  The number of untrusted certs.
+ * @param[in]  untrusted     The untrusted certs.
+ * @param[in]  numTrusted    The number of trusted certs.
+ * @param[in]  trusted       The trusted certs.
+ *
+ * @return The key, to be g_free()d.
+ *
+ ******************************************************************************
+ */
+
+static gchar *
+VerifyChainCacheKey(const char *leafCert,
+                    int numUntrusted,
+                    const char **untrusted,
+                    int numTrusted,
+                    const char **trusted)
+{
+   GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA256);
+   gchar counts[32];
+   gchar *key;
+   int i;
+
+   /*
+    * Include the terminating NULs and the counts, so that certs can't
+    * move between the lists or run into each other.
+    */
+   g_snprintf(counts, sizeof counts, "%d:%d", numUntrusted, numTrusted);
+   g_checksum_update(sum, (const guchar *) counts, strlen(counts) + 1);
+   g_checksum_update(sum, (const guchar *) leafCert, strlen(leafCert) + 1);
+   for (i = 0; i < numUntrusted; i++) {
+      g_checksum_update(sum, (const guchar *) untrusted[i],
+                        strlen(untrusted[i]) + 1);
+   }
+   for (i = 0; i < numTrusted; i++) {
+      g_checksum_update(sum, (const guchar *) trusted[i],
+                        strlen(trusted[i]) + 1);
+   }
+
+   key = g_strdup(g_checksum_get_string(sum));
+   g_checksum_free(sum);
+
+   return key;
+}
+
+
+/*
+ ******************************************************************************
+ * VerifyCertChain --                                                    */ /**
+ *
+ * Verifies a chain with CertVerify_CertChain(), unless the same chain
+ * verified successfully recently and none of its certs expired since.
+ *
+ * @param[in]  leafCert      The leaf cert.
+ * @param[in]  numUntrusted  The number of untrusted certs.
+ * @param[in]  untrusted     The untrusted certs.
+ * @param[in]  numTrusted    The number of trusted certs.
+ * @param[in]  trusted       The trusted certs.
+ *
+ * @return VGAUTH_E_OK on success, VGAuthError on failure
+ *
+ ******************************************************************************
+ */
+
+static VGAuthError
+VerifyCertChain(const char *leafCert,
+                int numUntrusted,
+                const char **untrusted,
+                int numTrusted,
+                const char **trusted)
+{
+   VGAuthError err;
+   gchar *key;
+   VerifiedChain *vc;
+   time_t notAfter;
+
+   if (NULL == verifiedChains) {
+      verifiedChains = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             g_free, g_free);
+   }
+
+   key = VerifyChainCacheKey(leafCert, numUntrusted, untrusted,
+                             numTrusted, trusted);
+   vc = g_hash_table_lookup(verifiedChains, key);
+   if (NULL != vc) {
+      if (g_get_monotonic_time() < vc->expiry && time(NULL) < vc->notAfter) {
+         Debug("%s: cert chain verified recently\n", __FUNCTION__);
+         g_free(key);
+         return VGAUTH_E_OK;
+      }
+      g_hash_table_remove(verifiedChains, key);
+   }
+
+   err = CertVerify_CertChain(leafCert, numUntrusted, untrusted,
+                              numTrusted, trusted, &notAfter);
+   if (VGAUTH_E_OK == err) {
+      if (g_hash_table_size(verifiedChains) >= VERIFY_CHAIN_CACHE_MAX_ENTRIES) {
+         g_hash_table_remove_all(verifiedChains);
+      }
+      vc = g_new0(VerifiedChain, 1);
+      vc->notAfter = notAfter;
+      vc->expiry = g_get_monotonic_time() +
+                   (gint64) VERIFY_CHAIN_CACHE_MAX_AGE * G_USEC_PER_SEC;
+      g_hash_table_insert(verifiedChains, key, vc);
+      key = NULL;
+   }
+   g_free(key);
+
+   return err;
+}
+
+
 /*
  ******************************************************************************
  * ServiceVerifyAndCheckTrustCertChainForSubject --                      */ /**
@@ -314,11 +454,11 @@ ServiceVerifyAndCheckTrustCertChainForSubject(int numCerts,
       ASSERT(0);
    }
 
-   err = CertVerify_CertChain(leafCert,
-                              numUntrusted,
-                              (const char **) untrustedCerts,
-                              numTrusted,
-                              (const char **) trustedCerts);
+   err = VerifyCertChain(leafCert,
+                         numUntrusted,
+                         (const char **) untrustedCerts,
+                         numTrusted,
+                         (const char **) trustedCerts);
    if (VGAUTH_E_OK != err) {
       VMXLog_Log(VMXLOG_LEVEL_WARNING,
                  "%s: cert chain validation failed\n", __FUNCTION__);
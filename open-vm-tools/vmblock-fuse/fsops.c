@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <limits.h>
 #include <fcntl.h>
+#include <sys/poll.h>
 #include <sys/time.h>
 #include <time.h>
 #include <stdint.h>
@@ -65,6 +66,67 @@ static vmblockSpecialDirEntry symlinkDirEntry =
 static vmblockSpecialDirEntry notifyDirEntry =
    { NOTIFY_DIR "/*",   S_IFREG | 0444, 1, 0 };
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * RedirectTarget --
+ *
+ *      Gets the target of a symlink, without checking that it exists.
+ *
+ *      Fills buf with a null terminated string. If target doesn't fit in buf,
+ *      it is truncated.
+ *
+ * Results:
+ *      0 on success. Possible errors (as negative values):
+ *      -EINVAL       bufSize is not positive.
+ *      -ENAMETOOLONG path was too long.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+RedirectTarget(const char *path,   // IN: Path within vmblock filesystem. Must
+                                   //     be within the redirect directory.
+               char *buf,          // OUT: Target of link (or part of it).
+               size_t bufSize)     // IN: Size of buf.
+{
+   const char redirectPrefix[] = REDIRECT_DIR "/";
+   const int redirectPrefixLength = sizeof redirectPrefix - 1;
+   const char targetPrefix[] = TARGET_DIR "/";
+   const int targetPrefixLength = sizeof targetPrefix - 1;
+   const char *relativeTarget = path + redirectPrefixLength;
+   const size_t spaceForRelativeTarget = PATH_MAX + 1 - targetPrefixLength;
+
+   /* TARGET_DIR + '/' needs to leave room for relative target. */
+   ASSERT_ON_COMPILE(sizeof TARGET_DIR + 1 < PATH_MAX);
+
+   ASSERT(strncmp(path, redirectPrefix, redirectPrefixLength) == 0 &&
+          strlen(path) > redirectPrefixLength);
+   if (bufSize < 1) {
+      return -EINVAL;
+   }
+
+   /*
+    * spaceForRelativeTarget must be greater than strlen(relativeTarget) to
+    * leave room for the nul terminator.
+    */
+
+   if (spaceForRelativeTarget <= strlen(relativeTarget)) {
+      return -ENAMETOOLONG;
+   }
+
+   strlcpy(buf, targetPrefix, bufSize);
+   if (bufSize > targetPrefixLength) {
+      strlcpy(buf + targetPrefixLength, relativeTarget,
+              bufSize - targetPrefixLength);
+   }
+   return 0;
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -96,20 +158,9 @@ RealReadLink(const char *path,   // IN: Path within vmblock filesystem. Must be
              size_t bufSize)     // IN: Size of buf.
 {
    int status;
-   const char redirectPrefix[] = REDIRECT_DIR "/";
-   const int redirectPrefixLength = sizeof redirectPrefix - 1;
-   const char targetPrefix[] = TARGET_DIR "/";
-   const int targetPrefixLength = sizeof targetPrefix - 1;
-   const char *relativeTarget = path + redirectPrefixLength;
    char target[PATH_MAX + 1];
-   const size_t spaceForRelativeTarget = sizeof target - targetPrefixLength;
    struct stat dummyStatBuf; // Don't care what goes here.
 
-   /* TARGET_DIR + '/' needs to leave room for relative target. */
-   ASSERT_ON_COMPILE(sizeof TARGET_DIR + 1 < PATH_MAX);
-
-   ASSERT(strncmp(path, redirectPrefix, redirectPrefixLength) == 0 &&
-          strlen(path) > redirectPrefixLength);
    if (bufSize < 1) {
       return -EINVAL;
    }
@@ -121,17 +172,10 @@ RealReadLink(const char *path,   // IN: Path within vmblock filesystem. Must be
     * exists which means it must lstat the full target path.
     */
 
-   strlcpy(target, targetPrefix, sizeof target);
-
-   /*
-    * spaceForRelativeTarget must be greater than strlen(relativeTarget) to
-    * leave room for the nul terminator.
-    */
-
-   if (spaceForRelativeTarget <= strlen(relativeTarget)) {
-      return -ENAMETOOLONG;
+   status = RedirectTarget(path, target, sizeof target);
+   if (status != 0) {
+      return status;
    }
-   strlcpy(target + targetPrefixLength, relativeTarget, spaceForRelativeTarget);
 
    /* Verify that target exists. */
 
@@ -180,7 +224,12 @@ VMBlockReadLink(const char *path,   // IN: Path within vmblock (top level) mount
    if (strncmp(path, REDIRECT_DIR, strlen(REDIRECT_DIR)) != 0) {
       return -ENOENT;
    }
-   status = RealReadLink(path, target, sizeof target);
+
+   /*
+    * The lookup of path already checked that the target exists, and a link
+    * whose target just went away is as good as ENOENT, so save the lstat.
+    */
+   status = RedirectTarget(path, target, sizeof target);
    if (status < 0) {
       return status;
    }
@@ -646,6 +695,44 @@ VMBlockWrite(const char *path,                 // IN: Must be control file.
 }
 
 
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * NotifyTargetLink --
+ *
+ *      Gets the blocked file of a notification file, which has the name of
+ *      its link in the redirect directory.
+ *
+ * Results:
+ *      0 on success.
+ *      Possible error (as negative value):
+ *      See RedirectTarget.
+ *
+ * Side effects:
+ *      None.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+NotifyTargetLink(const char *path,   // IN: Notification file.
+                 char *targetLink,   // OUT: Blocked file.
+                 size_t size)        // IN: Size of targetLink.
+{
+   const char redirectPrefix[] = REDIRECT_DIR "/";
+   const char redirectPrefixLength = sizeof redirectPrefix - 1;
+   const char notifyPrefix[] = NOTIFY_DIR "/";
+   const char notifyPrefixLength = sizeof notifyPrefix - 1;
+   char target[PATH_MAX+1];
+
+   strlcpy(target, redirectPrefix, sizeof target);
+   strlcpy(target + redirectPrefixLength,
+           path + notifyPrefixLength,
+           sizeof target - redirectPrefixLength);
+   return RedirectTarget(target, targetLink, size);
+}
+
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -675,12 +762,6 @@ VMBlockRead(const char *path,                 // IN: Must be control file.
             off_t offset,                     // IN: Ignored.
             struct fuse_file_info *fileInfo)  // IN: Ignored.
 {
-   const char redirectPrefix[] = REDIRECT_DIR "/";
-   const char redirectPrefixLength = sizeof redirectPrefix - 1;
-   const char notifyPrefix[] = NOTIFY_DIR "/";
-   const char notifyPrefixLength = sizeof notifyPrefix - 1;
-   const char *relativePath = path + notifyPrefixLength;
-
    LOG(4, "%s: path: %s, size: %"FMTSZ"u\n", __func__, path, size);
    LOG(4, "%s: fileInfo->fh: %p\n", __func__,
        FuseFileHandleToCharPointer(fileInfo->fh));
@@ -694,14 +775,9 @@ VMBlockRead(const char *path,                 // IN: Must be control file.
    }
 
    if (strncmp(path, NOTIFY_DIR, strlen(NOTIFY_DIR)) == 0) {
-      char target[PATH_MAX+1];
       char targetLink[PATH_MAX+1];
 
-      strlcpy(target, redirectPrefix, sizeof target);
-      strlcpy(target + redirectPrefixLength,
-              relativePath,
-              sizeof target - redirectPrefixLength);
-      if (RealReadLink(target, targetLink, sizeof targetLink) < 0) {
+      if (NotifyTargetLink(path, targetLink, sizeof targetLink) < 0) {
          return -EINVAL;
       }
       return BlockWaitFileBlock(targetLink, OS_UNKNOWN_BLOCKER);
@@ -710,6 +786,110 @@ VMBlockRead(const char *path,                 // IN: Must be control file.
    return -EINVAL;
 }
 
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * VMBlockPoll --
+ *
+ *      Polls a notification file. It becomes readable, i.e. reads do not
+ *      block anymore, once the blocked file was accessed or its block was
+ *      removed. This lets the blocker wait for it in its main loop rather
+ *      than in a thread blocked in read.
+ *
+ * Results:
+ *      Returns 0 and sets *reventsp on success.
+ *      Possible error (as negative value):
+ *      -EINVAL if the notification file does not name a blocked file.
+ *
+ * Side effects:
+ *      The poll handle, if any, is notified once the file becomes readable.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+int
+VMBlockPoll(const char *path,                 // IN
+            struct fuse_file_info *fileInfo,  // IN: Ignored.
+            struct fuse_pollhandle *ph,       // IN: Handle to notify, or NULL.
+            unsigned *reventsp)               // OUT: Ready events.
+{
+   char targetLink[PATH_MAX+1];
+   int ret;
+
+   LOG(4, "%s: path: %s\n", __func__, path);
+
+   if (strncmp(path, NOTIFY_DIR, strlen(NOTIFY_DIR)) != 0) {
+      if (ph != NULL) {
+         fuse_pollhandle_destroy(ph);
+      }
+      *reventsp = POLLIN | POLLOUT;
+      return 0;
+   }
+
+   if (NotifyTargetLink(path, targetLink, sizeof targetLink) < 0) {
+      if (ph != NULL) {
+         fuse_pollhandle_destroy(ph);
+      }
+      return -EINVAL;
+   }
+
+   ret = BlockPollFileBlock(targetLink, OS_UNKNOWN_BLOCKER, ph);
+   if (ret < 0 && ph != NULL) {
+      fuse_pollhandle_destroy(ph);
+   }
+   /* Reads do not block if the file is not blocked anymore either. */
+   *reventsp = ret != 0 ? POLLIN : 0;
+   return 0;
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * OsPollHandleNotify --
+ *
+ *      Notifies a poller kept by a completion, see os_complete_all.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Destroys the poll handle.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+OsPollHandleNotify(void *pollHandle)   // IN
+{
+   fuse_notify_poll(pollHandle);
+   fuse_pollhandle_destroy(pollHandle);
+}
+
+
+/*
+ *-----------------------------------------------------------------------------
+ *
+ * OsPollHandleDestroy --
+ *
+ *      Drops a poller kept by a completion.
+ *
+ * Results:
+ *      None.
+ *
+ * Side effects:
+ *      Destroys the poll handle.
+ *
+ *-----------------------------------------------------------------------------
+ */
+
+void
+OsPollHandleDestroy(void *pollHandle)  // IN
+{
+   fuse_pollhandle_destroy(pollHandle);
+}
+
 /*
  *-----------------------------------------------------------------------------
  *
@@ -765,7 +945,7 @@ VMBlockRelease(const char *path,                   // IN: Must be control file.
  */
 
 void *
-VMBlockInit(void)
+VMBlockInit(struct fuse_conn_info *conn)  // IN: Not used.
 {
    BlockInit();
    return NULL;
@@ -803,6 +983,7 @@ struct fuse_operations vmblockOperations = {
    .write    = VMBlockWrite,
    .read     = VMBlockRead,
    .release  = VMBlockRelease,
+   .poll     = VMBlockPoll,
    .init     = VMBlockInit,
    .destroy  = VMBlockDestroy
 };
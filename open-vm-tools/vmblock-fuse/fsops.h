@@ -32,11 +32,11 @@
 
 /*
  * FUSE_USE_VERSION sets the version of the FUSE API that will be exported.
- * Version 25 is the newest version supported by the libfuse in our toolchain
- * as of 2008-07.
+ * Version 28 is the first one supporting poll, which lets the blocker wait
+ * for notifications in its main loop. vmhgfs-fuse needs 29 already.
  */
 
-#define FUSE_USE_VERSION 25
+#define FUSE_USE_VERSION 29
 #include <fuse.h>
 
 #include "vmblock.h"
@@ -62,6 +62,8 @@ int VMBlockOpen(const char *path, struct fuse_file_info *fileInfo);
 int VMBlockWrite(const char *path, const char *buf, size_t size, off_t offset,
                  struct fuse_file_info *fileInfo);
 int VMBlockRelease(const char *path, struct fuse_file_info *fileInfo);
+int VMBlockPoll(const char *path, struct fuse_file_info *fileInfo,
+                struct fuse_pollhandle *ph, unsigned *reventsp);
 
 extern struct fuse_operations vmblockOperations;
 
@@ -69,7 +71,9 @@ extern struct fuse_operations vmblockOperations;
  * Internal functions
  */
 
+int RedirectTarget(const char *path, char *buf, size_t bufSize);
 int RealReadLink(const char *path, char *buf, size_t bufSize);
+int NotifyTargetLink(const char *path, char *targetLink, size_t size);
 void SetTimesToNow(struct stat *statBuf);
 int ExternalReadDir(const char *blockPath, const char *realPath,
                     void *buf, fuse_fill_dir_t filler,
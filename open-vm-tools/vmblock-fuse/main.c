@@ -29,6 +29,9 @@
 
 int LOGLEVEL_THRESHOLD = 0;
 
+/* Seconds the kernel caches lookups and attributes for, see main(). */
+#define VMBLOCK_FUSE_CACHE_TIMEOUT "60"
+
 
 /*
  *-----------------------------------------------------------------------------
@@ -47,6 +50,11 @@ int LOGLEVEL_THRESHOLD = 0;
  *      If the -d option is specified, enables our logging in addition to
  *      what fuse does.
  *
+ *      The kernel caches lookups and attributes for VMBLOCK_FUSE_CACHE_TIMEOUT
+ *      unless overridden on the command line. This does not defeat blocking,
+ *      which happens in readlink, which fuse always passes through. New
+ *      entries are seen right away as failed lookups are not cached.
+ *
  * Results:
  *      Returns 0 on success and nonzero on failure.
  *
@@ -60,11 +68,23 @@ int
 main(int argc,           // IN
      char *argv[])       // IN
 {
+   struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
    int i;
+   int ret;
+
    for (i = 1; i < argc && strcmp(argv[i], "--") != 0; ++i) {
       if (strcmp(argv[i], "-d") == 0) {
          LOGLEVEL_THRESHOLD = 4;
       }
    }
-   return fuse_main(argc, argv, &vmblockOperations);
+
+   /* Later options win, so insert the defaults first. */
+   if (fuse_opt_insert_arg(&args, 1,
+                           "-oentry_timeout=" VMBLOCK_FUSE_CACHE_TIMEOUT
+                           ",attr_timeout=" VMBLOCK_FUSE_CACHE_TIMEOUT) != 0) {
+      return 1;
+   }
+   ret = fuse_main(args.argc, args.argv, &vmblockOperations, NULL);
+   fuse_opt_free_args(&args);
+   return ret;
 }
@@ -44,6 +44,7 @@ typedef struct os_completion_t {
 	pthread_cond_t cv;
 	pthread_mutex_t mutex;
 	int completed;
+	void *pollHandle;       /* Poller to notify on completion. */
 }                                       os_completion_t;
 typedef gint                            os_atomic_t;
 typedef char *                          os_blocker_id_t;
@@ -95,9 +96,13 @@ typedef char *                          os_blocker_id_t;
    pthread_cond_init(&(comp)->cv, NULL);                \
    pthread_mutex_init(&(comp)->mutex, NULL);            \
    (comp)->completed = 0;                               \
+   (comp)->pollHandle = NULL;                           \
 })
 #define os_completion_destroy(comp)                     \
 ({                                                      \
+   if ((comp)->pollHandle != NULL) {                    \
+      OsPollHandleDestroy((comp)->pollHandle);          \
+   }                                                    \
    pthread_cond_destroy(&(comp)->cv);                   \
    pthread_mutex_destroy(&(comp)->mutex);               \
 })
@@ -115,10 +120,36 @@ typedef char *                          os_blocker_id_t;
     pthread_mutex_lock(&(comp)->mutex);                 \
     (comp)->completed = 1;                              \
     pthread_cond_broadcast(&(comp)->cv);                \
+    if ((comp)->pollHandle != NULL) {                   \
+       OsPollHandleNotify((comp)->pollHandle);          \
+       (comp)->pollHandle = NULL;                       \
+    }                                                   \
     pthread_mutex_unlock(&(comp)->mutex);               \
     0;                                                  \
 })
 
+/*
+ * Returns whether the completion happened. If not, the poll handle is kept
+ * and notified when it does, replacing one kept from an earlier poll.
+ */
+
+#define os_completion_poll(comp, handle)                \
+({                                                      \
+    int completed;                                      \
+    pthread_mutex_lock(&(comp)->mutex);                 \
+    completed = (comp)->completed;                      \
+    if (completed && (handle) != NULL) {                \
+       OsPollHandleDestroy(handle);                     \
+    } else if (!completed && (handle) != NULL) {        \
+       if ((comp)->pollHandle != NULL) {                \
+          OsPollHandleDestroy((comp)->pollHandle);      \
+       }                                                \
+       (comp)->pollHandle = (handle);                   \
+    }                                                   \
+    pthread_mutex_unlock(&(comp)->mutex);               \
+    completed;                                          \
+})
+
 /*
  * Atomic Value Functions
  *
@@ -156,4 +187,11 @@ extern int LOGLEVEL_THRESHOLD;
 
 size_t strlcpy(char *dest, const char *src, size_t count);
 
+/*
+ * Poll handles of the completions are fuse_pollhandles, see fsops.c.
+ */
+
+void OsPollHandleNotify(void *pollHandle);
+void OsPollHandleDestroy(void *pollHandle);
+
 #endif /* __OS_H__ */
@@ -34,7 +34,28 @@
 #include "transport.h"
 #include "vm_assert.h"
 
-static HgfsTransportChannel bdChannel;
+/*
+ * A backdoor RPC channel carries one request at a time, so the channel keeps
+ * a small pool of them. Each sender takes an idle connection for the length
+ * of its request, which lets requests from several FUSE threads be on the
+ * wire at once, even on a mount with a single transport channel. The host
+ * limits the RPC channels of a guest: the pool stops growing at the first
+ * one it refuses and works with those it got.
+ */
+#define HGFS_BD_MAX_CONNECTIONS 4
+
+typedef struct HgfsBdConnections {
+   RpcOut *idle[HGFS_BD_MAX_CONNECTIONS];   /* Connections not in use. */
+   uint32 numIdle;                          /* Entries in idle. */
+   uint32 numOpen;                          /* Connections opened. */
+   pthread_cond_t idleCond;                 /* Signalled when one is released. */
+} HgfsBdConnections;
+
+/* A backdoor channel, the transport may have several of them open. */
+typedef struct HgfsBdChannel {
+   HgfsTransportChannel channel;
+   HgfsBdConnections conns;
+} HgfsBdChannel;
 
 
 /*
@@ -64,15 +85,30 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
    case HGFS_CHANNEL_CONNECTED:
       LOG(8, ("Backdoor already connected.\n"));
       break;
-   case HGFS_CHANNEL_NOTCONNECTED:
-      if (HgfsBd_OpenBackdoor((RpcOut **)&channel->priv)) {
-         LOG(8, ("Backdoor opened and connected.\n"));
+   case HGFS_CHANNEL_NOTCONNECTED: {
+      HgfsBdConnections *conns = channel->priv;
+
+      ASSERT(conns->numOpen == 0);
+      while (conns->numOpen < ARRAYSIZE(conns->idle)) {
+         RpcOut *out = NULL;
+
+         if (!HgfsBd_OpenBackdoor(&out)) {
+            break;
+         }
+         conns->idle[conns->numIdle++] = out;
+         conns->numOpen++;
+      }
+
+      /* A single connection works, just without concurrency. */
+      if (conns->numOpen > 0) {
+         LOG(8, ("Backdoor opened and connected with %u channels.\n",
+                 conns->numOpen));
          channel->status = HGFS_CHANNEL_CONNECTED;
-         ASSERT(channel->priv != NULL);
       } else {
          LOG(8, ("ERROR: Backdoor cannot connect.\n"));
       }
       break;
+   }
    default:
       ASSERT(0); /* Not reached. */
       LOG(2, ("ERROR: Backdoor status %d is unknown resetting.\n",
@@ -90,7 +126,8 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
  *
  * HgfsBdChannelCloseInt --
  *
- *      Close the backdoor in an idempotent way.
+ *      Close the backdoor in an idempotent way. The caller holds the
+ *      connection lock, which is dropped while requests in flight finish.
  *
  * Results:
  *      None
@@ -104,11 +141,22 @@ HgfsBdChannelOpen(HgfsTransportChannel *channel) // IN: Channel
 static void
 HgfsBdChannelCloseInt(HgfsTransportChannel *channel) // IN: Channel
 {
+   HgfsBdConnections *conns = channel->priv;
+
    if (channel->status == HGFS_CHANNEL_CONNECTED) {
-      ASSERT(channel->priv != NULL);
-      HgfsBd_CloseBackdoor((RpcOut **)&channel->priv);
-      ASSERT(channel->priv == NULL);
+      /* New senders see the status change, wait for the current ones. */
       channel->status = HGFS_CHANNEL_NOTCONNECTED;
+      while (conns->numIdle < conns->numOpen) {
+         pthread_cond_wait(&conns->idleCond, &channel->connLock);
+      }
+
+      while (conns->numIdle > 0) {
+         RpcOut *out = conns->idle[--conns->numIdle];
+
+         HgfsBd_CloseBackdoor(&out);
+         ASSERT(out == NULL);
+      }
+      conns->numOpen = 0;
    }
    LOG(8, ("Backdoor closed.\n"));
 }
@@ -145,7 +193,8 @@ HgfsBdChannelClose(HgfsTransportChannel *channel) // IN: Channel
  *
  * HgfsBdChannelSend --
  *
- *     Send a request via backdoor.
+ *     Send a request via backdoor on an idle connection, waiting for
+ *     one to be released if all of them are busy.
  *
  * Results:
  *     0 on success, negative error on failure.
@@ -160,8 +209,10 @@ static int
 HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
                   HgfsReq *req)                  // IN: request to send
 {
+   HgfsBdConnections *conns = channel->priv;
    char const *replyPacket = NULL;
    size_t payloadSize;
+   RpcOut *out;
    int ret;
 
    ASSERT(req);
@@ -169,6 +220,9 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
    ASSERT(req->payloadSize <= HgfsLargePacketMax(FALSE));
 
    pthread_mutex_lock(&channel->connLock);
+   while (channel->status == HGFS_CHANNEL_CONNECTED && conns->numIdle == 0) {
+      pthread_cond_wait(&conns->idleCond, &channel->connLock);
+   }
 
    if (channel->status != HGFS_CHANNEL_CONNECTED) {
       LOG(6, ("Backdoor not opened.\n"));
@@ -176,20 +230,56 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
       return -ENOTCONN;
    }
 
+   out = conns->idle[--conns->numIdle];
+   pthread_mutex_unlock(&channel->connLock);
+
    payloadSize = req->payloadSize;
    LOG(8, ("Backdoor sending.\n"));
-   ret = HgfsBd_Dispatch(channel->priv, HGFS_REQ_PAYLOAD(req), &payloadSize,
-                         &replyPacket);
-   if (ret == 0) {
-      LOG(8, ("Backdoor reply received.\n"));
-      /* Request sent successfully. Copy the reply and wake the client. */
-      ASSERT(replyPacket);
-      HgfsCompleteReq(req, replyPacket, payloadSize);
+   if (req->replyData != NULL) {
+      /*
+       * Scatter the reply: the header lands in the request packet, the
+       * data goes straight to the caller's buffer.
+       */
+      HgfsBdIov reqIov;
+      HgfsBdIov replyIov[2];
+      size_t replySize;
+
+      ASSERT(req->replyDataOffset <= HgfsLargePacketMax(FALSE));
+
+      reqIov.va = HGFS_REQ_PAYLOAD(req);
+      reqIov.len = req->payloadSize;
+      replyIov[0].va = HGFS_REQ_PAYLOAD(req);
+      replyIov[0].len = req->replyDataOffset;
+      replyIov[1].va = req->replyData;
+      replyIov[1].len = req->replyDataSize;
+
+      ret = HgfsBd_DispatchV(out, HGFS_REQ_PAYLOAD(req),
+                             HgfsLargePacketMax(FALSE), &reqIov, 1,
+                             replyIov, ARRAYSIZE(replyIov), &replySize);
+      if (ret == 0) {
+         LOG(8, ("Backdoor reply received.\n"));
+         req->replyDataDone = TRUE;
+         HgfsCompleteReqInPlace(req, MIN(replySize, req->replyDataOffset));
+      } else {
+         ret = -EIO;
+      }
    } else {
-      /* Map rpc failure to EIO. */
-      ret = -EIO;
+      ret = HgfsBd_Dispatch(out, HGFS_REQ_PAYLOAD(req), &payloadSize,
+                            &replyPacket);
+      if (ret == 0) {
+         LOG(8, ("Backdoor reply received.\n"));
+         /* Request sent successfully. Copy the reply and wake the client. */
+         ASSERT(replyPacket);
+         HgfsCompleteReq(req, replyPacket, payloadSize);
+      } else {
+         /* Map rpc failure to EIO. */
+         ret = -EIO;
+      }
    }
 
+   pthread_mutex_lock(&channel->connLock);
+   conns->idle[conns->numIdle++] = out;
+   pthread_cond_broadcast(&conns->idleCond);
    pthread_mutex_unlock(&channel->connLock);
 
    return ret;
@@ -207,7 +297,7 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
  *     None
  *
  * Side effects:
- *     None
+ *     The channel is freed.
  *
  *----------------------------------------------------------------------
  */
@@ -215,10 +305,16 @@ HgfsBdChannelSend(HgfsTransportChannel *channel, // IN: Channel
 static void
 HgfsBdChannelExit(HgfsTransportChannel *channel)  // IN
 {
+   HgfsBdChannel *bdChannel = (HgfsBdChannel *)channel;
+
    pthread_mutex_lock(&channel->connLock);
    HgfsBdChannelCloseInt(channel);
    channel->status = HGFS_CHANNEL_UNINITIALIZED;
    pthread_mutex_unlock(&channel->connLock);
+
+   pthread_cond_destroy(&bdChannel->conns.idleCond);
+   pthread_mutex_destroy(&channel->connLock);
+   free(bdChannel);
 }
 
 
@@ -227,10 +323,11 @@ HgfsBdChannelExit(HgfsTransportChannel *channel)  // IN
  *
  * HgfsBdChannelInit --
  *
- *     Initialize backdoor channel.
+ *     Initialize a new backdoor channel.
  *
  * Results:
- *     Always return pointer to back door channel.
+ *     Pointer to the back door channel, NULL if out of memory. It is
+ *     freed by its exit op.
  *
  * Side effects:
  *     None
@@ -241,14 +338,25 @@ HgfsBdChannelExit(HgfsTransportChannel *channel)  // IN
 HgfsTransportChannel*
 HgfsBdChannelInit(void)
 {
-   bdChannel.name = "backdoor";
-   bdChannel.ops.open = HgfsBdChannelOpen;
-   bdChannel.ops.close = HgfsBdChannelClose;
-   bdChannel.ops.send = HgfsBdChannelSend;
-   bdChannel.ops.recv = NULL;
-   bdChannel.ops.exit = HgfsBdChannelExit;
-   bdChannel.priv = NULL;
-   pthread_mutex_init(&bdChannel.connLock, NULL);
-   bdChannel.status = HGFS_CHANNEL_NOTCONNECTED;
-   return &bdChannel;
+   HgfsBdChannel *bdChannel = calloc(1, sizeof *bdChannel);
+   HgfsTransportChannel *channel;
+
+   if (bdChannel == NULL) {
+      LOG(4, ("Can't allocate memory.\n"));
+      return NULL;
+   }
+
+   channel = &bdChannel->channel;
+   channel->name = "backdoor";
+   channel->ops.open = HgfsBdChannelOpen;
+   channel->ops.close = HgfsBdChannelClose;
+   channel->ops.send = HgfsBdChannelSend;
+   channel->ops.exit = HgfsBdChannelExit;
+   channel->priv = &bdChannel->conns;
+   bdChannel->conns.numIdle = 0;
+   bdChannel->conns.numOpen = 0;
+   pthread_mutex_init(&channel->connLock, NULL);
+   pthread_cond_init(&bdChannel->conns.idleCond, NULL);
+   channel->status = HGFS_CHANNEL_NOTCONNECTED;
+   return channel;
 }
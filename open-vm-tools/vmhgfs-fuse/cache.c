@@ -34,9 +34,9 @@
 #define CACHE_TIMEOUT HGFS_DEFAULT_TTL
 #define CACHE_PURGE_TIME 10
 #define CACHE_PURGE_SLEEP_TIME 30
-#define HASH_THRESHOLD_SIZE (2046 * 4)
-#define HASH_PURGE_SIZE (HASH_THRESHOLD_SIZE / 2)
+#define HGFS_ATTR_CACHE_DEFAULT_SIZE (2046 * 4)
 #include "cache.h"
+#include "stats.h"
 
 /*
  * HgfsAttrCache, holds an entry for each path
@@ -46,6 +46,11 @@ typedef struct HgfsAttrCache {
    HgfsAttrInfo attr; /* Attribute of a file or directory */
    uint64 changeTime; /* time the attribute was last updated */
    struct list_head list; /* used in linked list implementation */
+#if !defined(__FreeBSD__) && !defined(__SOLARIS__)
+   struct HgfsAttrCache *parent; /* cached parent directory or NULL */
+   struct list_head children;    /* cached entries of this directory */
+   struct list_head sibling;     /* in the children of parent or the orphans */
+#endif
    char path[0];      /* path of the file corresponding the the attr */
 } HgfsAttrCache;
 
@@ -53,9 +58,6 @@ typedef struct HgfsAttrCache {
 /* Head of the list */
 struct HgfsAttrCache attrList;
 
-/*Lock for accessing the attribute cache*/
-static pthread_mutex_t HgfsAttrCacheLock = PTHREAD_MUTEX_INITIALIZER;
-
 #if !defined(__FreeBSD__) && !defined(__SOLARIS__)
 static void HgfsInvalidateParentsChildren(const char* parent);
 #endif
@@ -69,6 +71,9 @@ static void HgfsInvalidateParentsChildren(const char* parent);
 
 #if defined(__FreeBSD__) || defined(__SOLARIS__)
 
+/*Lock for accessing the attribute cache*/
+static pthread_mutex_t HgfsAttrCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  *----------------------------------------------------------------------
  *
@@ -137,6 +142,7 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
    }
 
    pthread_mutex_unlock(&HgfsAttrCacheLock);
+   HgfsStatsInc(res == 0 ? HGFS_STAT_ATTR_CACHE_HIT : HGFS_STAT_ATTR_CACHE_MISS);
    return res;
 }
 
@@ -256,6 +262,7 @@ HgfsPurgeCache(void* unused) //IN: Thread argument
    while (1)
    {
       sleep(CACHE_PURGE_SLEEP_TIME);
+      HgfsStatsDumpIfRequested();
 
       pthread_mutex_lock(&HgfsAttrCacheLock);
 
@@ -274,15 +281,256 @@ HgfsPurgeCache(void* unused) //IN: Thread argument
 
 #else
 
+/*
+ * The attribute cache is split in shards by the hash of the path, each with
+ * its own lock, hash table and LRU list, so that lookups from different
+ * FUSE threads rarely contend. Every shard holds at most its part of the
+ * configured number of entries and evicts the least recently used one when
+ * full.
+ *
+ * Cached directories link their cached children so that invalidating a
+ * directory only visits its subtree. Entries whose parent is not cached
+ * are kept on a short orphan list and adopted when the parent is cached.
+ * The links are protected by gAttrCacheTreeLock, which is always taken
+ * before a shard lock and never while holding one. Lookups take only the
+ * shard lock.
+ */
+
+#define HGFS_ATTR_CACHE_SHARDS 16
+#define HGFS_ATTR_CACHE_MAX_ORPHANS 256
+#define HGFS_ATTR_CACHE_PURGE_BATCH 64
+
+typedef struct HgfsAttrCacheShard {
+   pthread_mutex_t lock;
+   GHashTable *table;         /* Entries by path. */
+   struct list_head lru;      /* Entries, most recently used first. */
+   uint32 count;              /* Entries in the shard. */
+} HgfsAttrCacheShard;
+
+static HgfsAttrCacheShard gAttrCacheShards[HGFS_ATTR_CACHE_SHARDS];
+static uint32 gAttrCacheShardMax;
+
+static pthread_mutex_t gAttrCacheTreeLock = PTHREAD_MUTEX_INITIALIZER;
+static struct list_head gAttrCacheOrphans;
+static uint32 gAttrCacheNumOrphans;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheShardOf
+ *
+ *    Find the shard holding a path.
+ *
+ * Results:
+ *    The shard.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsAttrCacheShard *
+HgfsAttrCacheShardOf(const char *path)   //IN: Path of file or directory
+{
+   return &gAttrCacheShards[g_str_hash(path) % HGFS_ATTR_CACHE_SHARDS];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheIsChild
+ *
+ *    Check whether a path lies below a directory.
+ *
+ * Results:
+ *    TRUE if child is a descendant of parent.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static Bool
+HgfsAttrCacheIsChild(const char *parent,   //IN: Directory path
+                     size_t parentLen,     //IN: Length of parent
+                     const char *child)    //IN: Path to check
+{
+   if (strncmp(parent, child, parentLen) != 0) {
+      return FALSE;
+   }
+   if (parentLen > 0 && parent[parentLen - 1] == '/') {
+      return child[parentLen] != '\0';
+   }
+   return child[parentLen] == '/';
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheLookupParent
+ *
+ *    Find the cached entry of the directory holding a path. The tree lock
+ *    must be held and keeps the result alive.
+ *
+ * Results:
+ *    The parent entry or NULL if it is not cached.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsAttrCache *
+HgfsAttrCacheLookupParent(const char *path)   //IN: Path of file or directory
+{
+   const char *sep = strrchr(path, '/');
+   HgfsAttrCacheShard *shard;
+   HgfsAttrCache *parent;
+   char *parentPath;
+
+   if (sep == NULL || sep[1] == '\0') {
+      return NULL;
+   }
+
+   /* The parent of "/a" is "/". */
+   parentPath = g_strndup(path, sep == path ? 1 : sep - path);
+   shard = HgfsAttrCacheShardOf(parentPath);
+
+   pthread_mutex_lock(&shard->lock);
+   parent = g_hash_table_lookup(shard->table, parentPath);
+   pthread_mutex_unlock(&shard->lock);
+
+   g_free(parentPath);
+   return parent;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheAdoptOrphans
+ *
+ *    Link the orphans whose parent is the given directory to it. The tree
+ *    lock must be held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsAttrCacheAdoptOrphans(HgfsAttrCache *dir)   //IN: Newly cached entry
+{
+   HgfsAttrCache *tmp;
+   HgfsAttrCache *next;
+   size_t dirLen = strlen(dir->path);
+
+   list_for_each_entry_safe(tmp, next, &gAttrCacheOrphans, sibling) {
+      if (HgfsAttrCacheIsChild(dir->path, dirLen, tmp->path) &&
+          strchr(tmp->path + dirLen + 1, '/') == NULL) {
+         tmp->parent = dir;
+         list_move(&tmp->sibling, &dir->children);
+         gAttrCacheNumOrphans--;
+      }
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheFree
+ *
+ *    Free an entry which was already removed from its shard, together with
+ *    its cached subtree. The tree lock must be held, no shard lock.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsAttrCacheFree(HgfsAttrCache *entry)   //IN: Entry to free
+{
+   HgfsAttrCache *child;
+   HgfsAttrCache *next;
+
+   list_for_each_entry_safe(child, next, &entry->children, sibling) {
+      HgfsAttrCacheShard *shard = HgfsAttrCacheShardOf(child->path);
+
+      pthread_mutex_lock(&shard->lock);
+      g_hash_table_remove(shard->table, child->path);
+      list_del(&child->list);
+      shard->count--;
+      pthread_mutex_unlock(&shard->lock);
+
+      HgfsAttrCacheFree(child);
+   }
+
+   if (entry->parent == NULL) {
+      gAttrCacheNumOrphans--;
+   }
+   list_del(&entry->sibling);
+   free(entry);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsAttrCacheInvalidateTree
+ *
+ *    Mark an entry and its cached subtree as out of date. The tree lock
+ *    must be held, no shard lock.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsAttrCacheInvalidateTree(HgfsAttrCache *entry)   //IN: Entry to invalidate
+{
+   HgfsAttrCacheShard *shard = HgfsAttrCacheShardOf(entry->path);
+   HgfsAttrCache *child;
+
+   LOG(10, ("Invalidating cache entry = %s\n", entry->path));
+
+   pthread_mutex_lock(&shard->lock);
+   entry->changeTime = 0;
+   pthread_mutex_unlock(&shard->lock);
+
+   list_for_each_entry(child, &entry->children, sibling) {
+      HgfsAttrCacheInvalidateTree(child);
+   }
+}
 
-GHashTable *g_hash_table;
 
 /*
  *----------------------------------------------------------------------
  *
  * HgfsInitCache
  *
- *    Creates a hash table with string as a key.
+ *    Creates the shards of the cache, sized after the max_cached_attrs
+ *    mount option.
  *
  * Results:
  *    None
@@ -296,7 +544,25 @@ GHashTable *g_hash_table;
 void
 HgfsInitCache()
 {
-   g_hash_table = g_hash_table_new(g_str_hash, g_str_equal);
+   uint32 maxEntries = gState->maxCachedAttrs;
+   unsigned int i;
+
+   if (maxEntries == 0) {
+      maxEntries = HGFS_ATTR_CACHE_DEFAULT_SIZE;
+   }
+   gAttrCacheShardMax = MAX(1, maxEntries / HGFS_ATTR_CACHE_SHARDS);
+
+   for (i = 0; i < ARRAYSIZE(gAttrCacheShards); i++) {
+      HgfsAttrCacheShard *shard = &gAttrCacheShards[i];
+
+      pthread_mutex_init(&shard->lock, NULL);
+      shard->table = g_hash_table_new(g_str_hash, g_str_equal);
+      INIT_LIST_HEAD(&shard->lru);
+      shard->count = 0;
+   }
+
+   INIT_LIST_HEAD(&gAttrCacheOrphans);
+   gAttrCacheNumOrphans = 0;
 }
 
 
@@ -305,13 +571,13 @@ HgfsInitCache()
  *
  * HgfsGetAttrCache
  *
- *    Retrieves the attr from the HashTable for a given path.
+ *    Retrieves the attr from the cache for a given path.
  *
  * Results:
  *    0 on success else -1 on error
  *
  * Side effects:
- *    None
+ *    The entry becomes the most recently used of its shard.
  *
  *----------------------------------------------------------------------
  */
@@ -320,12 +586,13 @@ int
 HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
                  HgfsAttrInfo *attr) //IN: Attribute for a given path
 {
+   HgfsAttrCacheShard *shard = HgfsAttrCacheShardOf(path);
    HgfsAttrCache *tmp;
    int res = -1;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
+   pthread_mutex_lock(&shard->lock);
 
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   tmp = (HgfsAttrCache *)g_hash_table_lookup(shard->table, path);
    if (tmp != NULL) {
       int diff;
 
@@ -335,11 +602,13 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
       LOG(4, ("time since last updated is %d seconds\n", diff));
       if ( diff <= CACHE_TIMEOUT ) {
          *attr = tmp->attr;
+         list_move(&tmp->list, &shard->lru);
          res = 0;
       }
    }
 
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   pthread_mutex_unlock(&shard->lock);
+   HgfsStatsInc(res == 0 ? HGFS_STAT_ATTR_CACHE_HIT : HGFS_STAT_ATTR_CACHE_MISS);
    return res;
 }
 
@@ -349,7 +618,9 @@ HgfsGetAttrCache(const char* path,   //IN: Path of file or directory
  *
  * HgfsSetAttrCache
  *
- *    Updates the HashTable with the given (key, attr) pair.
+ *    Updates the cache with the given (key, attr) pair. A new entry may
+ *    evict the least recently used one of its shard, and is not cached if
+ *    neither its parent is cached nor there is room for another orphan.
  *
  * Results:
  *    0 on success else negative value on error
@@ -364,15 +635,30 @@ int
 HgfsSetAttrCache(const char* path,         //IN: Path of file or directory
                  HgfsAttrInfo *attr)       //IN: Attribute for a given path
 {
+   HgfsAttrCacheShard *shard = HgfsAttrCacheShardOf(path);
+   HgfsAttrCache *victim = NULL;
+   HgfsAttrCache *parent;
    HgfsAttrCache *tmp;
    int res = 0;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   /* Updating an entry does not change the tree. */
+   pthread_mutex_lock(&shard->lock);
+   tmp = (HgfsAttrCache *)g_hash_table_lookup(shard->table, path);
    if (tmp != NULL) {
       tmp->attr = *attr;
       tmp->changeTime = HGFS_GET_TIME(time(NULL));
+      list_move(&tmp->list, &shard->lru);
+   }
+   pthread_mutex_unlock(&shard->lock);
+   if (tmp != NULL) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&gAttrCacheTreeLock);
+
+   parent = HgfsAttrCacheLookupParent(path);
+   if (parent == NULL && gAttrCacheNumOrphans >= HGFS_ATTR_CACHE_MAX_ORPHANS) {
+      LOG(4, ("too many orphans, not caching path = %s\n", path));
       goto out;
    }
 
@@ -385,11 +671,44 @@ HgfsSetAttrCache(const char* path,         //IN: Path of file or directory
    Str_Strcpy(tmp->path, path, strlen(path) + 1);
    tmp->attr = *attr;
    tmp->changeTime = HGFS_GET_TIME(time(NULL));
+   INIT_LIST_HEAD(&tmp->children);
+
+   pthread_mutex_lock(&shard->lock);
+   if (g_hash_table_lookup(shard->table, path) != NULL) {
+      /* Lost a race with an update through the fast path. */
+      pthread_mutex_unlock(&shard->lock);
+      free(tmp);
+      goto out;
+   }
+   g_hash_table_insert(shard->table, (gpointer)tmp->path, (gpointer)tmp);
+   list_add(&tmp->list, &shard->lru);
+   if (++shard->count > gAttrCacheShardMax) {
+      victim = list_entry(shard->lru.prev, HgfsAttrCache, list);
+      g_hash_table_remove(shard->table, victim->path);
+      list_del(&victim->list);
+      shard->count--;
+   }
+   pthread_mutex_unlock(&shard->lock);
+
+   tmp->parent = parent;
+   if (parent != NULL) {
+      list_add(&tmp->sibling, &parent->children);
+   } else {
+      list_add(&tmp->sibling, &gAttrCacheOrphans);
+      gAttrCacheNumOrphans++;
+   }
+   if (tmp->attr.type == HGFS_FILE_TYPE_DIRECTORY) {
+      HgfsAttrCacheAdoptOrphans(tmp);
+   }
 
-   g_hash_table_insert(g_hash_table, (gpointer)tmp->path, (gpointer)tmp);
+   if (victim != NULL) {
+      LOG(4, ("cache entry evicted. path = %s\n", victim->path));
+      HgfsStatsInc(HGFS_STAT_ATTR_CACHE_EVICT);
+      HgfsAttrCacheFree(victim);
+   }
 
 out:
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   pthread_mutex_unlock(&gAttrCacheTreeLock);
    return res;
 }
 
@@ -399,7 +718,8 @@ out:
  *
  * HgfsInvalidateAttrCache
  *
- *    Invalidate the HashTable entry for a path.
+ *    Invalidate the cache entry for a path and, for a directory, the
+ *    cached entries below it.
  *
  * Results:
  *    None
@@ -413,17 +733,23 @@ out:
 void
 HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
 {
+   HgfsAttrCacheShard *shard = HgfsAttrCacheShardOf(path);
    HgfsAttrCache *tmp;
 
-   pthread_mutex_lock(&HgfsAttrCacheLock);
-   tmp = (HgfsAttrCache *)g_hash_table_lookup(g_hash_table, path);
+   pthread_mutex_lock(&gAttrCacheTreeLock);
+
+   pthread_mutex_lock(&shard->lock);
+   tmp = (HgfsAttrCache *)g_hash_table_lookup(shard->table, path);
+   pthread_mutex_unlock(&shard->lock);
+
    if (tmp != NULL) {
-      tmp->changeTime = 0;
-      if (tmp->attr.type == HGFS_FILE_TYPE_DIRECTORY) {
-         HgfsInvalidateParentsChildren(tmp->path);
-      }
+      HgfsAttrCacheInvalidateTree(tmp);
    }
-   pthread_mutex_unlock(&HgfsAttrCacheLock);
+   if (tmp == NULL || tmp->attr.type == HGFS_FILE_TYPE_DIRECTORY) {
+      HgfsInvalidateParentsChildren(path);
+   }
+
+   pthread_mutex_unlock(&gAttrCacheTreeLock);
 }
 
 
@@ -433,8 +759,10 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
  * HgfsInvalidateParentsChildren
  *
  *    This routine is called by the general function to invalidate a cache
- *    entry. If the entry is a directory this function is called to invalidate
- *    any cached children.
+ *    entry. If the entry is a directory this function is called to
+ *    invalidate any cached descendants which are not linked to it, the
+ *    linked ones are reached through the children lists. The tree lock
+ *    must be held.
  *
  * Results:
  *    None
@@ -448,21 +776,15 @@ HgfsInvalidateAttrCache(const char* path)      //IN: Path to file
 static void
 HgfsInvalidateParentsChildren(const char* parent)      //IN: parent
 {
-   gpointer key, value;
-   GHashTableIter iter;
+   HgfsAttrCache *child;
    size_t parentLen = Str_Strlen(parent, PATH_MAX);
 
    LOG(4, ("Invalidating cache children for parent = %s\n",
            parent));
 
-   g_hash_table_iter_init(&iter, g_hash_table);
-
-   while (g_hash_table_iter_next(&iter, &key, &value)) {
-      HgfsAttrCache *child = (HgfsAttrCache *)value;
-
-      if (Str_Strncasecmp(parent, child->path, parentLen) == 0) {
-         LOG(10, ("Invalidating cache child = %s\n", child->path));
-         child->changeTime = 0;
+   list_for_each_entry(child, &gAttrCacheOrphans, sibling) {
+      if (HgfsAttrCacheIsChild(parent, parentLen, child->path)) {
+         HgfsAttrCacheInvalidateTree(child);
       }
    }
 }
@@ -473,9 +795,10 @@ HgfsInvalidateParentsChildren(const char* parent)      //IN: parent
  *
  * HgfsPurgeCache
  *
- *    This routine is called by an independent thread to purge the cache,
- *    for performance reasons, the deletion is done in random based
- *    on the order of iteration.
+ *    This routine is called by an independent thread to purge the cache.
+ *    It visits one shard at a time and drops up to a batch of expired
+ *    entries from the cold end of its LRU list, so lookups on the other
+ *    shards are never held up.
  *
  * Results:
  *    None
@@ -489,25 +812,875 @@ HgfsInvalidateParentsChildren(const char* parent)      //IN: parent
 void*
 HgfsPurgeCache(void* unused)      //IN: Thread argument
 {
-   gpointer key, value;
-   GHashTableIter iter;
+   unsigned int next = 0;
 
    while (1) {
-      sleep(CACHE_PURGE_SLEEP_TIME);
-
-      pthread_mutex_lock(&HgfsAttrCacheLock);
+      HgfsAttrCacheShard *shard = &gAttrCacheShards[next];
+      unsigned int i;
+
+      sleep(MAX(1, CACHE_PURGE_SLEEP_TIME / HGFS_ATTR_CACHE_SHARDS));
+      HgfsStatsDumpIfRequested();
+      next = (next + 1) % HGFS_ATTR_CACHE_SHARDS;
+
+      pthread_mutex_lock(&gAttrCacheTreeLock);
+
+      for (i = 0; i < HGFS_ATTR_CACHE_PURGE_BATCH; i++) {
+         HgfsAttrCache *tmp = NULL;
+
+         pthread_mutex_lock(&shard->lock);
+         if (!list_empty(&shard->lru)) {
+            tmp = list_entry(shard->lru.prev, HgfsAttrCache, list);
+            if ((HGFS_GET_TIME(time(NULL)) - tmp->changeTime) / 10000000 >
+                CACHE_PURGE_TIME) {
+               g_hash_table_remove(shard->table, tmp->path);
+               list_del(&tmp->list);
+               shard->count--;
+            } else {
+               tmp = NULL;
+            }
+         }
+         pthread_mutex_unlock(&shard->lock);
 
-      if (g_hash_table_size(g_hash_table) >= HASH_THRESHOLD_SIZE) {
-         g_hash_table_iter_init(&iter, g_hash_table);
-         while (g_hash_table_iter_next(&iter, &key, &value) &&
-               (g_hash_table_size(g_hash_table) >= HASH_PURGE_SIZE)) {
-            g_hash_table_iter_remove(&iter);
-            free(value);
+         if (tmp == NULL) {
+            break;
          }
+         HgfsAttrCacheFree(tmp);
       }
 
-      pthread_mutex_unlock(&HgfsAttrCacheLock);
+      pthread_mutex_unlock(&gAttrCacheTreeLock);
    }
    return 0;
 }
 #endif
+
+
+/*
+ * Directory listings are cached for the same time as attributes, keyed by
+ * the path of the directory. A listing holds the names and the stat data
+ * passed to the FUSE filler. Only a few directories are kept, the least
+ * recently read one is dropped first. Local changes to a directory drop
+ * its listing, changes made on the host show up once the listing expires.
+ */
+
+#define HGFS_DIR_CACHE_MAX_DIRS 64
+#define HGFS_DIR_CACHE_MAX_ENTRIES 4096
+
+typedef struct HgfsDirListingEntry {
+   struct stat st;    /* Stat data passed to the filler */
+   char *name;        /* Entry name */
+} HgfsDirListingEntry;
+
+struct HgfsDirListing {
+   struct list_head list;          /* In gDirCacheList, most recent first */
+   time_t fetchTime;               /* Time the listing was read */
+   uint32 count;                   /* Entries in use */
+   uint32 size;                    /* Entries allocated */
+   HgfsDirListingEntry *entries;
+   char *path;                     /* Directory path */
+};
+
+static struct list_head gDirCacheList = LIST_HEAD_INIT(gDirCacheList);
+static uint32 gDirCacheCount;
+static pthread_mutex_t gDirCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsDirListingNew
+ *
+ *    Allocate an empty listing for a directory.
+ *
+ * Results:
+ *    The listing or NULL if out of memory.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+HgfsDirListing *
+HgfsDirListingNew(const char *path)   //IN: Path of the directory
+{
+   HgfsDirListing *listing = calloc(1, sizeof *listing);
+
+   if (listing == NULL) {
+      return NULL;
+   }
+   listing->path = strdup(path);
+   if (listing->path == NULL) {
+      free(listing);
+      return NULL;
+   }
+   INIT_LIST_HEAD(&listing->list);
+   listing->fetchTime = time(NULL);
+   return listing;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsDirListingAdd
+ *
+ *    Append an entry to a listing which is being filled.
+ *
+ * Results:
+ *    0 on success, -ENOMEM if out of memory and -E2BIG if the directory
+ *    is too large to be cached.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsDirListingAdd(HgfsDirListing *listing,   //IN/OUT: Listing to fill
+                  const char *name,          //IN: Entry name
+                  const struct stat *st)     //IN: Stat data of the entry
+{
+   HgfsDirListingEntry *entry;
+
+   if (listing->count == listing->size) {
+      uint32 newSize = MAX(16, listing->size * 2);
+      HgfsDirListingEntry *newEntries;
+
+      if (listing->size >= HGFS_DIR_CACHE_MAX_ENTRIES) {
+         return -E2BIG;
+      }
+      newEntries = realloc(listing->entries, newSize * sizeof *newEntries);
+      if (newEntries == NULL) {
+         return -ENOMEM;
+      }
+      listing->entries = newEntries;
+      listing->size = newSize;
+   }
+
+   entry = &listing->entries[listing->count];
+   entry->name = strdup(name);
+   if (entry->name == NULL) {
+      return -ENOMEM;
+   }
+   entry->st = *st;
+   listing->count++;
+   return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsDirListingFree
+ *
+ *    Free a listing which is not in the cache.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsDirListingFree(HgfsDirListing *listing)   //IN: Listing to free
+{
+   uint32 i;
+
+   if (listing == NULL) {
+      return;
+   }
+   for (i = 0; i < listing->count; i++) {
+      free(listing->entries[i].name);
+   }
+   free(listing->entries);
+   free(listing->path);
+   free(listing);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetDirCache
+ *
+ *    Fill a readdir buffer from the cached listing of a directory.
+ *
+ * Results:
+ *    0 if the listing was cached and fresh, else -1.
+ *
+ * Side effects:
+ *    The listing becomes the most recently used one.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsGetDirCache(const char *path,          //IN: Path of the directory
+                void *buf,                 //OUT: Buffer to fill
+                fuse_fill_dir_t filler)    //IN: Filler function
+{
+   HgfsDirListing *listing;
+   int res = -1;
+
+   pthread_mutex_lock(&gDirCacheLock);
+
+   list_for_each_entry(listing, &gDirCacheList, list) {
+      if (strcmp(path, listing->path) == 0) {
+         if (time(NULL) - listing->fetchTime <= CACHE_TIMEOUT) {
+            uint32 i;
+
+            LOG(4, ("dir cache hit. path = %s\n", path));
+            for (i = 0; i < listing->count; i++) {
+               if (filler(buf, listing->entries[i].name,
+                          &listing->entries[i].st, 0)) {
+                  break;
+               }
+            }
+            list_move(&listing->list, &gDirCacheList);
+            res = 0;
+         }
+         break;
+      }
+   }
+
+   pthread_mutex_unlock(&gDirCacheLock);
+   HgfsStatsInc(res == 0 ? HGFS_STAT_DIR_CACHE_HIT : HGFS_STAT_DIR_CACHE_MISS);
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetDirCache
+ *
+ *    Cache a complete listing, replacing an older one of the directory.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    The cache owns the listing. May drop the least recently used one.
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsSetDirCache(HgfsDirListing *listing)   //IN: Listing to cache
+{
+   HgfsDirListing *tmp;
+   HgfsDirListing *next;
+   HgfsDirListing *victim = NULL;
+
+   pthread_mutex_lock(&gDirCacheLock);
+
+   list_for_each_entry_safe(tmp, next, &gDirCacheList, list) {
+      if (strcmp(listing->path, tmp->path) == 0) {
+         list_del(&tmp->list);
+         gDirCacheCount--;
+         victim = tmp;
+         break;
+      }
+   }
+
+   if (victim == NULL && gDirCacheCount >= HGFS_DIR_CACHE_MAX_DIRS) {
+      victim = list_entry(gDirCacheList.prev, HgfsDirListing, list);
+      list_del(&victim->list);
+      gDirCacheCount--;
+   }
+
+   list_add(&listing->list, &gDirCacheList);
+   gDirCacheCount++;
+
+   pthread_mutex_unlock(&gDirCacheLock);
+
+   HgfsDirListingFree(victim);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsInvalidateDirCache
+ *
+ *    Drop the cached listings a change to path affects: the one of the
+ *    directory holding it and, for a directory, its own and those below.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsInvalidateDirCache(const char *path)   //IN: Path which changed
+{
+   const char *sep = strrchr(path, '/');
+   size_t parentLen = sep == NULL ? 0 : MAX(1, sep - path);
+   size_t pathLen = strlen(path);
+   HgfsDirListing *tmp;
+   HgfsDirListing *next;
+   struct list_head dropped;
+
+   INIT_LIST_HEAD(&dropped);
+
+   pthread_mutex_lock(&gDirCacheLock);
+
+   list_for_each_entry_safe(tmp, next, &gDirCacheList, list) {
+      Bool isParent = sep != NULL && strlen(tmp->path) == parentLen &&
+                      strncmp(tmp->path, path, parentLen) == 0;
+      Bool isBelow = strncmp(tmp->path, path, pathLen) == 0 &&
+                     (tmp->path[pathLen] == '\0' || tmp->path[pathLen] == '/');
+
+      if (isParent || isBelow) {
+         LOG(4, ("dir cache entry dropped. path = %s\n", tmp->path));
+         list_move(&tmp->list, &dropped);
+         gDirCacheCount--;
+      }
+   }
+
+   pthread_mutex_unlock(&gDirCacheLock);
+
+   list_for_each_entry_safe(tmp, next, &dropped, list) {
+      HgfsDirListingFree(tmp);
+   }
+}
+
+
+/*
+ * Paths found not to exist and symlink targets are cached for the same
+ * time as attributes, in small tables indexed by the hash of the path. A
+ * new entry replaces the one in its slot. Local changes that can create a
+ * path or change a link drop the entries of the path and those below it,
+ * changes made on the host show up once the entries expire.
+ */
+
+#define HGFS_NEGATIVE_CACHE_SLOTS 1024
+#define HGFS_LINK_CACHE_SLOTS 256
+
+typedef struct HgfsPathCacheEntry {
+   char *path;                     /* Path, NULL if the slot is free */
+   char *target;                   /* Link target, unused for negative ones */
+   time_t fetchTime;               /* Time the entry was added */
+} HgfsPathCacheEntry;
+
+typedef struct HgfsPathCache {
+   pthread_mutex_t lock;
+   uint32 numSlots;
+   HgfsPathCacheEntry *slots;
+} HgfsPathCache;
+
+static HgfsPathCacheEntry gNegativeCacheSlots[HGFS_NEGATIVE_CACHE_SLOTS];
+static HgfsPathCache gNegativeCache = {
+   PTHREAD_MUTEX_INITIALIZER, HGFS_NEGATIVE_CACHE_SLOTS, gNegativeCacheSlots
+};
+static HgfsPathCacheEntry gLinkCacheSlots[HGFS_LINK_CACHE_SLOTS];
+static HgfsPathCache gLinkCache = {
+   PTHREAD_MUTEX_INITIALIZER, HGFS_LINK_CACHE_SLOTS, gLinkCacheSlots
+};
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPathHash
+ *
+ *    Hash a path (FNV-1a) to pick its slot in a path table.
+ *
+ * Results:
+ *    The hash.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint32
+HgfsPathHash(const char *path)   //IN: Path of file or directory
+{
+   uint32 hash = 2166136261u;
+
+   while (*path != '\0') {
+      hash = (hash ^ (uint8)*path++) * 16777619u;
+   }
+   return hash;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPathCacheSlot
+ *
+ *    Find the slot of a path in a path cache. The lock must be held.
+ *
+ * Results:
+ *    The slot, which may be free or hold another path.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsPathCacheEntry *
+HgfsPathCacheSlot(HgfsPathCache *cache,   //IN: Cache to look in
+                  const char *path)       //IN: Path of file or directory
+{
+   return &cache->slots[HgfsPathHash(path) % cache->numSlots];
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPathCacheClear
+ *
+ *    Free the entry in a slot. The lock must be held.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsPathCacheClear(HgfsPathCacheEntry *entry)   //IN/OUT: Slot to free
+{
+   free(entry->path);
+   free(entry->target);
+   entry->path = NULL;
+   entry->target = NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPathCacheLookup
+ *
+ *    Find the fresh entry of a path. The lock must be held.
+ *
+ * Results:
+ *    The entry or NULL if the path is not cached or expired.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsPathCacheEntry *
+HgfsPathCacheLookup(HgfsPathCache *cache,   //IN: Cache to look in
+                    const char *path)       //IN: Path of file or directory
+{
+   HgfsPathCacheEntry *entry = HgfsPathCacheSlot(cache, path);
+
+   if (entry->path == NULL || strcmp(path, entry->path) != 0) {
+      return NULL;
+   }
+   if (time(NULL) - entry->fetchTime > CACHE_TIMEOUT) {
+      HgfsPathCacheClear(entry);
+      return NULL;
+   }
+   return entry;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPathCacheAdd
+ *
+ *    Cache a path, replacing the entry in its slot.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    Nothing is cached if out of memory.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsPathCacheAdd(HgfsPathCache *cache,   //IN: Cache to add to
+                 const char *path,       //IN: Path of file or directory
+                 const char *target)     //IN: Link target or NULL
+{
+   HgfsPathCacheEntry *entry;
+   char *newPath = strdup(path);
+   char *newTarget = target != NULL ? strdup(target) : NULL;
+
+   if (newPath == NULL || (target != NULL && newTarget == NULL)) {
+      free(newPath);
+      free(newTarget);
+      return;
+   }
+
+   pthread_mutex_lock(&cache->lock);
+
+   entry = HgfsPathCacheSlot(cache, path);
+   HgfsPathCacheClear(entry);
+   entry->path = newPath;
+   entry->target = newTarget;
+   entry->fetchTime = time(NULL);
+
+   pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsPathCacheInvalidate
+ *
+ *    Drop the entries of a path and of the paths below it.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsPathCacheInvalidate(HgfsPathCache *cache,   //IN: Cache to invalidate
+                        const char *path)       //IN: Path which changed
+{
+   size_t pathLen = strlen(path);
+   uint32 i;
+
+   pthread_mutex_lock(&cache->lock);
+
+   for (i = 0; i < cache->numSlots; i++) {
+      HgfsPathCacheEntry *entry = &cache->slots[i];
+
+      if (entry->path != NULL &&
+          strncmp(entry->path, path, pathLen) == 0 &&
+          (entry->path[pathLen] == '\0' || entry->path[pathLen] == '/')) {
+         LOG(4, ("path cache entry dropped. path = %s\n", entry->path));
+         HgfsPathCacheClear(entry);
+      }
+   }
+
+   pthread_mutex_unlock(&cache->lock);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetNegativeCache
+ *
+ *    Check whether a path was recently found not to exist.
+ *
+ * Results:
+ *    TRUE if so, the caller can fail with ENOENT.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+HgfsGetNegativeCache(const char *path)   //IN: Path of file or directory
+{
+   Bool res;
+
+   pthread_mutex_lock(&gNegativeCache.lock);
+   res = HgfsPathCacheLookup(&gNegativeCache, path) != NULL;
+   pthread_mutex_unlock(&gNegativeCache.lock);
+
+   if (res) {
+      LOG(4, ("negative cache hit. path = %s\n", path));
+      HgfsStatsInc(HGFS_STAT_NEGATIVE_CACHE_HIT);
+   }
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetNegativeCache
+ *
+ *    Remember that the host reported a path does not exist.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsSetNegativeCache(const char *path)   //IN: Path of file or directory
+{
+   HgfsPathCacheAdd(&gNegativeCache, path, NULL);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsInvalidateNegativeCache
+ *
+ *    Forget that a path and those below it do not exist, after a local
+ *    change which may have created them.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsInvalidateNegativeCache(const char *path)   //IN: Path which changed
+{
+   HgfsPathCacheInvalidate(&gNegativeCache, path);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsGetLinkCache
+ *
+ *    Copy the cached target of a symlink.
+ *
+ * Results:
+ *    0 if the target was cached and fresh, -ENOBUFS if it does not fit in
+ *    buf, else -1.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsGetLinkCache(const char *path,   //IN: Path of the symlink
+                 char *buf,          //OUT: Target of the link
+                 size_t size)        //IN: Size of buf
+{
+   HgfsPathCacheEntry *entry;
+   int res = -1;
+
+   pthread_mutex_lock(&gLinkCache.lock);
+
+   entry = HgfsPathCacheLookup(&gLinkCache, path);
+   if (entry != NULL) {
+      size_t len = strlen(entry->target);
+
+      if (size > len) {
+         memcpy(buf, entry->target, len + 1);
+         res = 0;
+      } else {
+         res = -ENOBUFS;
+      }
+   }
+
+   pthread_mutex_unlock(&gLinkCache.lock);
+   HgfsStatsInc(res == -1 ? HGFS_STAT_LINK_CACHE_MISS :
+                            HGFS_STAT_LINK_CACHE_HIT);
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsSetLinkCache
+ *
+ *    Cache the target of a symlink.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsSetLinkCache(const char *path,     //IN: Path of the symlink
+                 const char *target)   //IN: Target of the link
+{
+   HgfsPathCacheAdd(&gLinkCache, path, target);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsInvalidateLinkCache
+ *
+ *    Drop the cached targets of a path and of the paths below it.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsInvalidateLinkCache(const char *path)   //IN: Path which changed
+{
+   HgfsPathCacheInvalidate(&gLinkCache, path);
+}
+
+
+/*
+ * The kernel drops the page cache of a file on every open unless told to
+ * keep it. To keep it safely, we remember the attributes the host reported
+ * at the last open of each file and keep the pages only if the host still
+ * reports the same file, size and times: anything written since, here or
+ * on the host, changes the write time. Entries do not expire, a new open
+ * refreshes them and a new entry replaces the one in its slot.
+ */
+
+#define HGFS_PAGE_CACHE_SLOTS 1024
+#define HGFS_PAGE_CACHE_ATTRS (HGFS_ATTR_VALID_SIZE | HGFS_ATTR_VALID_WRITE_TIME)
+
+typedef struct HgfsPageCacheEntry {
+   char *path;                     /* Path, NULL if the slot is free */
+   HgfsAttrValid mask;             /* Which of the fields below are valid */
+   uint64 size;                    /* File size at the last open */
+   uint64 writeTime;               /* Time of last write at the last open */
+   uint64 attrChangeTime;          /* Attribute change time at the last open */
+   uint64 hostFileId;              /* Host file id at the last open */
+} HgfsPageCacheEntry;
+
+static pthread_mutex_t gPageCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static HgfsPageCacheEntry gPageCache[HGFS_PAGE_CACHE_SLOTS];
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsKeepPageCache
+ *
+ *    Check whether the file at a path is unchanged since it was last
+ *    opened, according to attributes fetched from the host on open, and
+ *    remember these attributes for the next open.
+ *
+ * Results:
+ *    TRUE if the kernel can keep the cached pages of the file.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+Bool
+HgfsKeepPageCache(const char *path,          //IN: Path of the file
+                  const HgfsAttrInfo *attr)  //IN: Attributes from the host
+{
+   HgfsPageCacheEntry *entry;
+   HgfsAttrValid mask = attr->mask & (HGFS_PAGE_CACHE_ATTRS |
+                                      HGFS_ATTR_VALID_CHANGE_TIME |
+                                      HGFS_ATTR_VALID_FILEID);
+   Bool keep = FALSE;
+   char *newPath = NULL;
+
+   if ((mask & HGFS_PAGE_CACHE_ATTRS) != HGFS_PAGE_CACHE_ATTRS) {
+      return FALSE;
+   }
+
+   pthread_mutex_lock(&gPageCacheLock);
+
+   entry = &gPageCache[HgfsPathHash(path) % HGFS_PAGE_CACHE_SLOTS];
+   if (entry->path != NULL && strcmp(entry->path, path) == 0) {
+      keep = entry->mask == mask &&
+             entry->size == attr->size &&
+             entry->writeTime == attr->writeTime &&
+             ((mask & HGFS_ATTR_VALID_CHANGE_TIME) == 0 ||
+              entry->attrChangeTime == attr->attrChangeTime) &&
+             ((mask & HGFS_ATTR_VALID_FILEID) == 0 ||
+              entry->hostFileId == attr->hostFileId);
+   } else {
+      newPath = strdup(path);
+      if (newPath == NULL) {
+         goto exit;
+      }
+      free(entry->path);
+      entry->path = newPath;
+   }
+
+   entry->mask = mask;
+   entry->size = attr->size;
+   entry->writeTime = attr->writeTime;
+   entry->attrChangeTime = attr->attrChangeTime;
+   entry->hostFileId = attr->hostFileId;
+
+exit:
+   pthread_mutex_unlock(&gPageCacheLock);
+   HgfsStatsInc(keep ? HGFS_STAT_PAGE_CACHE_KEEP : HGFS_STAT_PAGE_CACHE_DROP);
+   LOG(4, ("%s page cache. path = %s\n", keep ? "keep" : "drop", path));
+   return keep;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsInvalidatePageCache
+ *
+ *    Forget the attributes of a path and of the paths below it, so that
+ *    the next open of the file drops its cached pages.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsInvalidatePageCache(const char *path)   //IN: Path which changed
+{
+   size_t pathLen = strlen(path);
+   uint32 i;
+
+   pthread_mutex_lock(&gPageCacheLock);
+
+   for (i = 0; i < HGFS_PAGE_CACHE_SLOTS; i++) {
+      HgfsPageCacheEntry *entry = &gPageCache[i];
+
+      if (entry->path != NULL &&
+          strncmp(entry->path, path, pathLen) == 0 &&
+          (entry->path[pathLen] == '\0' || entry->path[pathLen] == '/')) {
+         free(entry->path);
+         entry->path = NULL;
+      }
+   }
+
+   pthread_mutex_unlock(&gPageCacheLock);
+}
@@ -31,4 +31,24 @@ void HgfsInitCache();
 void* HgfsPurgeCache(void*);
 void HgfsInvalidateAttrCache(const char* path);
 
+typedef struct HgfsDirListing HgfsDirListing;
+
+HgfsDirListing *HgfsDirListingNew(const char *path);
+int HgfsDirListingAdd(HgfsDirListing *listing, const char *name,
+                      const struct stat *st);
+void HgfsDirListingFree(HgfsDirListing *listing);
+int HgfsGetDirCache(const char *path, void *buf, fuse_fill_dir_t filler);
+void HgfsSetDirCache(HgfsDirListing *listing);
+void HgfsInvalidateDirCache(const char *path);
+
+Bool HgfsGetNegativeCache(const char *path);
+void HgfsSetNegativeCache(const char *path);
+void HgfsInvalidateNegativeCache(const char *path);
+int HgfsGetLinkCache(const char *path, char *buf, size_t size);
+void HgfsSetLinkCache(const char *path, const char *target);
+void HgfsInvalidateLinkCache(const char *path);
+
+Bool HgfsKeepPageCache(const char *path, const HgfsAttrInfo *attr);
+void HgfsInvalidatePageCache(const char *path);
+
 #endif
@@ -75,6 +75,9 @@ const struct fuse_opt vmhgfsOpts[] = {
      VMHGFS_OPT("--loglevel %i",    logLevel, 4),
      VMHGFS_OPT("-l %i",            logLevel, 4),
 #endif
+     VMHGFS_OPT("max_cached_attrs=%u", maxCachedAttrs, 0),
+     VMHGFS_OPT("writeback_cache",  writebackCache, 1),
+     VMHGFS_OPT("channels=%u",      numChannels, 0),
      /* We will change the default value, unless it is specified explicitly. */
      FUSE_OPT_KEY("big_writes",     KEY_BIG_WRITES),
      FUSE_OPT_KEY("nobig_writes",   KEY_NO_BIG_WRITES),
@@ -121,12 +124,19 @@ Usage(char *prog_name)  // IN
            "                           1 - system OS version is not supported for HGFS FUSE\n"
            "                           2 - system needs FUSE packages for HGFS FUSE\n"
            "\n"
+           "vmhgfs mount options:\n"
+           "    -o max_cached_attrs=N  cache the attributes of up to N files\n"
+           "    -o writeback_cache     gather small writes, they reach the host\n"
+           "                           on close, fsync or when a packet is full\n"
+           "    -o channels=N          spread requests over N host channels\n"
+           "                           (1 to %u, default 1)\n"
+           "\n"
 #ifdef VMX86_DEVEL
            "vmhgfs options:\n"
            "    -l   --loglevel NUM    set loglevel=NUM only available in debug build.\n"
            "\n"
 #endif
-           , prog_name, prog_name, prog_name);
+           , prog_name, prog_name, prog_name, HGFS_TRANSPORT_MAX_CHANNELS);
 }
 
 #define LIB_MODULEPATH         "/lib/modules"
@@ -502,6 +512,9 @@ vmhgfsPreprocessArgs(struct fuse_args *outargs)    // IN/OUT
 #else
    config.addBigWrites = TRUE;
 #endif
+   config.maxCachedAttrs = 0;
+   config.writebackCache = FALSE;
+   config.numChannels = 1;
 
    res = fuse_opt_parse(outargs, &config, vmhgfsOpts, vmhgfsOptProc);
    if (res != 0) {
@@ -511,7 +524,26 @@ vmhgfsPreprocessArgs(struct fuse_args *outargs)    // IN/OUT
 #ifdef VMX86_DEVEL
    LOGLEVEL_THRESHOLD = config.logLevel;
 #endif
+   gState->maxCachedAttrs = config.maxCachedAttrs;
+   gState->writebackCache = config.writebackCache;
+   if (config.numChannels < 1 ||
+       config.numChannels > HGFS_TRANSPORT_MAX_CHANNELS) {
+      fprintf(stderr, "channels must be between 1 and %u\n",
+              HGFS_TRANSPORT_MAX_CHANNELS);
+      res = -1;
+      goto exit;
+   }
+   gState->numChannels = config.numChannels;
    /* Default option changes for vmhgfs fuse client. */
+   /*
+    * Let the kernel cache lookups of missing paths as long as we do, unless
+    * the user asks otherwise: options given later on override this one.
+    */
+   res = fuse_opt_insert_arg(outargs, 1,
+                             "-onegative_timeout=" XSTR(HGFS_DEFAULT_TTL));
+   if (res != 0) {
+      goto exit;
+   }
    if (config.addBigWrites) {
       res = fuse_opt_add_arg(outargs, "-obig_writes");
       if (res != 0) {
@@ -32,6 +32,9 @@ struct vmhgfsConfig {
 #endif
    int addBigWrites;
    int addAllowOther;
+   unsigned int maxCachedAttrs;
+   int writebackCache;
+   unsigned int numChannels;
 };
 
 int vmhgfsOptProc(void *data, const char *arg,
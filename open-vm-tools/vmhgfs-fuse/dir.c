@@ -22,6 +22,7 @@
  * File operations for the hgfs driver.
  */
 #include "module.h"
+#include "cache.h"
 
 
 #define HGFS_CREATE_DIR_MASK (HGFS_CREATE_DIR_VALID_FILE_NAME | \
@@ -213,6 +214,54 @@ out:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadDirCacheEntry --
+ *
+ *    Remember a directory entry read from the server: its attributes go
+ *    to the attribute cache and the entry to the listing being filled.
+ *    Symlinks are not cached as their attributes need the target name,
+ *    which a search reply does not carry.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    The listing is freed and set to NULL if it cannot be completed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsReadDirCacheEntry(const char *path,          // IN: Path of the directory
+                      const char *name,          // IN: Escaped entry name
+                      HgfsAttrInfo *attr,        // IN: Entry attributes
+                      const struct stat *st,     // IN: Stat data given to filler
+                      HgfsDirListing **listing)  // IN/OUT: Listing to fill
+{
+   if (*listing != NULL && HgfsDirListingAdd(*listing, name, st) != 0) {
+      HgfsDirListingFree(*listing);
+      *listing = NULL;
+   }
+
+   if (attr->type != HGFS_FILE_TYPE_SYMLINK &&
+       strcmp(name, ".") != 0 && strcmp(name, "..") != 0) {
+      size_t pathLen = strlen(path);
+      char *childPath;
+
+      childPath = Str_Asprintf(NULL, "%s%s%s", path,
+                               pathLen > 0 && path[pathLen - 1] == '/' ?
+                               "" : "/", name);
+      if (childPath != NULL) {
+         attr->fileName = NULL;
+         HgfsSetAttrCache(childPath, attr);
+         free(childPath);
+      }
+   }
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -226,6 +275,10 @@ out:
  *    server, while for V3 we may have multiple directory entries. The
  *    number of entries can be read from the reply packet.
  *
+ *    The attributes in the reply are added to the attribute cache, so
+ *    the stat which usually follows each entry needs no request, and the
+ *    entries are added to the listing if one is being filled.
+ *
  * Results:
  *    0 on success, anything else on failure.
  *
@@ -237,8 +290,10 @@ out:
 
 static int
 HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
+                     const char *path,  // IN:  Path of the directory
                      void *vfsDirent,   // OUT: Buffer to copy dentries into
                      fuse_fill_dir_t filldir, // IN:  Filler function
+                     HgfsDirListing **listing, // IN/OUT: Listing to fill
                      HgfsReq *req,      // IN:  The request containing reply
                      HgfsOp opUsed,     // IN:  request type
                      Bool *done)        // OUT: Set true when there are no
@@ -398,6 +453,10 @@ HgfsReadDirFromReply(uint32 *f_pos,     // IN/OUT: Offset
       st.st_mode = d_type << 12;
       result = filldir(vfsDirent, escName, &st, 0);
 
+      if (result == 0) {
+         HgfsReadDirCacheEntry(path, escName, &attr, &st, listing);
+      }
+
       if (result) {
          /*
           * This means that filldir ran out of room in the user buffer
@@ -550,21 +609,26 @@ HgfsRequestDirEntries(HgfsHandle searchHandle, // IN: Handle to dir
 
 int
 HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
+            const char *path,         // IN:  Path of the directory
             void *dirent,             // OUT: Buffer to copy dentries into
             fuse_fill_dir_t filldir)  // IN:  Filler function
 {
    Bool done = FALSE;
    HgfsReq *request;
+   HgfsDirListing *listing;
    int result = 0;
    uint32 f_pos = 0;
 
    ASSERT(dirent);
+   ASSERT(path);
 
    request = HgfsGetNewRequest();
    if (!request) {
       LOG(4, ("Out of memory while getting new request\n"));
       return -ENOMEM;
    }
+   request->channelKey = handle;
+   listing = HgfsDirListingNew(path);
    while (!done) {
       HgfsOp opUsed;
       /* Nonzero result = we failed to get valid reply from server. */
@@ -577,13 +641,16 @@ HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
          break;
       }
 
-      result = HgfsReadDirFromReply(&f_pos, dirent, filldir, request, opUsed,
-                                    &done);
+      result = HgfsReadDirFromReply(&f_pos, path, dirent, filldir, &listing,
+                                    request, opUsed, &done);
 
       LOG(4, ("f_pos = %d\n", f_pos));
       if (result == -ENAMETOOLONG) {
          continue;
       } else if (result == -ENOSPC) {
+         /* The listing misses the entries the buffer had no room for. */
+         HgfsDirListingFree(listing);
+         listing = NULL;
          result = 0;
          break;
       } else if (result < 0) {
@@ -594,7 +661,12 @@ HgfsReaddir(HgfsHandle handle,        // IN:  Directory handle to read from
 
    if (done == TRUE) {
       LOG(6, ("End of dir reached.\n"));
+      if (listing != NULL && result == 0) {
+         HgfsSetDirCache(listing);
+         listing = NULL;
+      }
    }
+   HgfsDirListingFree(listing);
    HgfsFreeRequest(request);
    return result;
 }
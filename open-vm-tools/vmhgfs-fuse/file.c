@@ -29,9 +29,71 @@
 #include "hgfsUtil.h"
 #include "fsutil.h"
 #include "file.h"
+#include "stats.h"
 #include "vm_assert.h"
 #include "vm_basic_types.h"
 
+#include <pthread.h>
+
+
+/* Most chunks of one read that are sent to the server at the same time. */
+#define HGFS_READ_MAX_PARALLEL 4
+
+/*
+ * One chunk of a read split by HgfsRead. All but the first chunk are
+ * queued for the read workers; a chunk still queued when the reader gets
+ * to it is taken back and read by the reader itself.
+ */
+typedef struct HgfsReadChunk {
+   struct list_head list;
+   HgfsHandle handle;
+   char *buf;
+   size_t count;
+   loff_t offset;
+   int result;
+   Bool queued;       /* On gHgfsReadQueue, under gHgfsReadLock */
+   Bool done;         /* Result is set, under gHgfsReadLock */
+} HgfsReadChunk;
+
+/*
+ * The read workers are started on first use and live as long as the
+ * process, so a read does not pay for thread creation.
+ */
+static LIST_HEAD(gHgfsReadQueue);
+static pthread_mutex_t gHgfsReadLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gHgfsReadQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t gHgfsReadDone = PTHREAD_COND_INITIALIZER;
+static pthread_once_t gHgfsReadWorkersOnce = PTHREAD_ONCE_INIT;
+static unsigned int gHgfsReadNumWorkers;
+
+/*
+ * Write-behind buffer of an open handle, used with the writeback_cache
+ * mount option. Sequential writes are gathered until there is a packet
+ * worth of data and sent when the buffer fills, on flush, fsync and
+ * release, or before an operation on the same path that needs to see
+ * the data. An error hit while sending is kept and reported by the next
+ * write, flush or fsync of the handle.
+ *
+ * Buffers are only removed by the release of their handle, so a buffer
+ * found under gHgfsWriteCacheLock stays valid for the handle's user.
+ * Anyone else takes a reference under gHgfsWriteCacheLock. Data is never
+ * sent with gHgfsWriteCacheLock held, only with the lock of the buffer.
+ */
+typedef struct HgfsWriteCache {
+   struct list_head list;
+   HgfsHandle handle;
+   char *path;
+   pthread_mutex_t lock;
+   unsigned int refCount;  /* The list and flushers, under gHgfsWriteCacheLock */
+   loff_t offset;     /* File offset of data[0] */
+   size_t len;        /* Bytes buffered */
+   size_t size;       /* Capacity of data */
+   int error;         /* Pending error, zero if none */
+   char *data;
+} HgfsWriteCache;
+
+static LIST_HEAD(gHgfsWriteCaches);
+static pthread_mutex_t gHgfsWriteCacheLock = PTHREAD_MUTEX_INITIALIZER;
 
 
 static int
@@ -566,6 +628,7 @@ HgfsDoRead(HgfsHandle handle,  // IN:  Handle for this file
       result = -ENOMEM;
       goto out;
    }
+   req->channelKey = handle;
 
  retry:
    opUsed = hgfsVersionRead;
@@ -592,6 +655,17 @@ HgfsDoRead(HgfsHandle handle,  // IN:  Handle for this file
    /* Fill in header here as payloadSize needs to be there. */
    HgfsPackHeader(req, opUsed);
 
+   /* Let the channel place the data in buf directly if it can. */
+   req->replyData = buf;
+   req->replyDataSize = count;
+   req->replyDataDone = FALSE;
+   if (opUsed == HGFS_OP_READ_V3) {
+      req->replyDataOffset = HgfsGetReplyHeaderSize() +
+                             offsetof(HgfsReplyReadV3, payload);
+   } else {
+      req->replyDataOffset = offsetof(HgfsReplyRead, payload);
+   }
+
    /* Send the request and process the reply. */
    result = HgfsSendRequest(req);
    if (result == 0) {
@@ -627,7 +701,9 @@ HgfsDoRead(HgfsHandle handle,  // IN:  Handle for this file
          }
 
          /* Return result. */
-         memcpy(buf, payload, actualSize);
+         if (!req->replyDataDone) {
+            memcpy(buf, payload, actualSize);
+         }
          LOG(8, ("Copied %u\n", actualSize));
          result = actualSize;
          break;
@@ -675,7 +751,7 @@ out:
  *----------------------------------------------------------------------
  */
 
-static uint32
+uint32
 HgfsMaxIOSize(void)
 {
    uint32 maxIOSize = gState->maxPacketSize - HGFS_HEADER_SIZE_MAX;
@@ -687,6 +763,129 @@ HgfsMaxIOSize(void)
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadWorker --
+ *
+ *    Thread body of a read worker, issuing queued chunks of reads split
+ *    by HgfsRead.
+ *
+ * Results:
+ *    Never returns.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void *
+HgfsReadWorker(void *data)   // IN: Unused
+{
+   pthread_mutex_lock(&gHgfsReadLock);
+   for (;;) {
+      HgfsReadChunk *chunk;
+      int result;
+
+      while (list_empty(&gHgfsReadQueue)) {
+         pthread_cond_wait(&gHgfsReadQueued, &gHgfsReadLock);
+      }
+      chunk = list_entry(gHgfsReadQueue.next, HgfsReadChunk, list);
+      list_del(&chunk->list);
+      chunk->queued = FALSE;
+      pthread_mutex_unlock(&gHgfsReadLock);
+
+      result = HgfsDoRead(chunk->handle, chunk->buf,
+                          chunk->count, chunk->offset);
+
+      pthread_mutex_lock(&gHgfsReadLock);
+      chunk->result = result;
+      chunk->done = TRUE;
+      pthread_cond_broadcast(&gHgfsReadDone);
+   }
+   return NULL;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadStartWorkers --
+ *
+ *    Start the read workers, once.
+ *
+ * Results:
+ *    None. Without workers reads are issued one chunk at a time.
+ *
+ * Side effects:
+ *    Starts up to HGFS_READ_MAX_PARALLEL - 1 detached threads.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsReadStartWorkers(void)
+{
+   pthread_attr_t attr;
+   unsigned int i;
+
+   if (pthread_attr_init(&attr) != 0) {
+      return;
+   }
+   pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+   for (i = 0; i < HGFS_READ_MAX_PARALLEL - 1; i++) {
+      pthread_t thread;
+
+      if (pthread_create(&thread, &attr, HgfsReadWorker, NULL) != 0) {
+         break;
+      }
+   }
+   pthread_attr_destroy(&attr);
+
+   pthread_mutex_lock(&gHgfsReadLock);
+   gHgfsReadNumWorkers = i;
+   pthread_mutex_unlock(&gHgfsReadLock);
+   LOG(4, ("Started %u read workers\n", i));
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReadChunkWait --
+ *
+ *    Get the result of a chunk given to the read workers. A chunk that
+ *    no worker has picked up yet is read by the caller.
+ *
+ * Results:
+ *    None, the outcome is left in the chunk.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsReadChunkWait(HgfsReadChunk *chunk)   // IN/OUT: chunk to read
+{
+   pthread_mutex_lock(&gHgfsReadLock);
+   if (chunk->queued) {
+      list_del(&chunk->list);
+      chunk->queued = FALSE;
+      pthread_mutex_unlock(&gHgfsReadLock);
+      chunk->result = HgfsDoRead(chunk->handle, chunk->buf,
+                                 chunk->count, chunk->offset);
+      return;
+   }
+   while (!chunk->done) {
+      pthread_cond_wait(&gHgfsReadDone, &gHgfsReadLock);
+   }
+   pthread_mutex_unlock(&gHgfsReadLock);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -694,6 +893,12 @@ HgfsMaxIOSize(void)
  *
  *    Called whenever a process reads from a file in our filesystem.
  *
+ *    Reads larger than one packet are split into chunks of the maximum
+ *    IO size and up to HGFS_READ_MAX_PARALLEL of them are sent at once,
+ *    the transport lets several requests be outstanding together. The
+ *    caller reads the first chunk and the read workers the others. The
+ *    chunks are then consumed in order and a short chunk ends the read.
+ *
  * Results:
  *    Returns the number of bytes read on success, or an error on
  *    failure.
@@ -710,11 +915,13 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
          size_t count,               // IN:  Number of bytes to read
          loff_t offset)              // IN:  Offset at which to read
 {
+   HgfsReadChunk chunks[HGFS_READ_MAX_PARALLEL];
    int result = 0;
    char *buffer = buf;
    loff_t curOffset = offset;
-   size_t nextCount, remainingCount = count;
+   size_t remainingCount = count;
    uint32 maxIOSize = HgfsMaxIOSize();
+   Bool done = FALSE;
 
    ASSERT(NULL != fi);
    ASSERT(NULL != buf);
@@ -722,24 +929,69 @@ HgfsRead(struct fuse_file_info *fi,  // IN:  File info struct
    LOG(4, ("Entry(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
            fi->fh, count, offset));
 
-    do {
-      nextCount = (remainingCount > maxIOSize) ? maxIOSize : remainingCount;
+   if (count > maxIOSize) {
+      pthread_once(&gHgfsReadWorkersOnce, HgfsReadStartWorkers);
+   }
+
+   do {
+      size_t issued = 0;
+      unsigned int numChunks = 0;
+      unsigned int i;
+
+      while (numChunks < ARRAYSIZE(chunks) && issued < remainingCount) {
+         HgfsReadChunk *chunk = &chunks[numChunks];
+
+         chunk->handle = fi->fh;
+         chunk->buf = buffer + issued;
+         chunk->count = MIN(remainingCount - issued, maxIOSize);
+         chunk->offset = curOffset + issued;
+         chunk->result = 0;
+         chunk->queued = FALSE;
+         chunk->done = FALSE;
+         issued += chunk->count;
+         numChunks++;
+      }
+
+      if (numChunks > 1) {
+         pthread_mutex_lock(&gHgfsReadLock);
+         if (gHgfsReadNumWorkers > 0) {
+            for (i = 1; i < numChunks; i++) {
+               LOG(4, ("Queue DoRead(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
+                       fi->fh, chunks[i].count, chunks[i].offset));
+               list_add_tail(&chunks[i].list, &gHgfsReadQueue);
+               chunks[i].queued = TRUE;
+            }
+            pthread_cond_broadcast(&gHgfsReadQueued);
+         }
+         pthread_mutex_unlock(&gHgfsReadLock);
+      }
+
       LOG(4, ("Issue DoRead(0x%"FMT64"x 0x%"FMTSZ"x bytes @ 0x%"FMT64"x)\n",
-              fi->fh, nextCount, curOffset));
-      result = HgfsDoRead(fi->fh, buffer, nextCount, curOffset);
-      if (result < 0) {
-         LOG(8, ("Error: DoRead: -> %d\n", result));
-         goto out;
+              fi->fh, chunks[0].count, chunks[0].offset));
+      chunks[0].result = HgfsDoRead(chunks[0].handle, chunks[0].buf,
+                                    chunks[0].count, chunks[0].offset);
+
+      for (i = 1; i < numChunks; i++) {
+         HgfsReadChunkWait(&chunks[i]);
       }
-      remainingCount -= result;
-      curOffset += result;
-      buffer += result;
 
-   } while ((result > 0) && (remainingCount > 0));
+      for (i = 0; i < numChunks && !done; i++) {
+         result = chunks[i].result;
+         if (result < 0) {
+            LOG(8, ("Error: DoRead: -> %d\n", result));
+            goto out;
+         }
+         remainingCount -= result;
+         curOffset += result;
+         buffer += result;
+         done = result < chunks[i].count;
+      }
+   } while (!done && remainingCount > 0);
 
   memset(buffer, 0, remainingCount);
 
   out:
+   HgfsStatsAdd(HGFS_STAT_BYTES_READ, count - remainingCount);
    LOG(4, ("Exit(%"FMTSZ"d)\n", count - remainingCount));
    return (count - remainingCount);
 }
@@ -788,6 +1040,7 @@ HgfsDoWrite(HgfsHandle handle,       // IN: Handle for the file
       result = -ENOMEM;
       goto out;
    }
+   req->channelKey = handle;
    LOG( 4,("handle = %u \n", handle));
  retry:
    opUsed = hgfsVersionWrite;
@@ -927,6 +1180,7 @@ HgfsWrite(struct fuse_file_info *fi,  // IN: File info structure
    } while ((result > 0) && (remainingCount > 0));
 
    bytesWritten = count - remainingCount;
+   HgfsStatsAdd(HGFS_STAT_BYTES_WRITTEN, bytesWritten);
 
 out:
    LOG(6, ("Exit(0x%"FMTSZ"x)\n", bytesWritten));
@@ -934,6 +1188,381 @@ out:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWriteCacheGet --
+ *
+ *    Find the write-behind buffer of a handle, creating an empty one when
+ *    there is none yet.
+ *
+ * Results:
+ *    The buffer, or NULL if it could not be allocated.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static HgfsWriteCache *
+HgfsWriteCacheGet(HgfsHandle handle,  // IN: Handle of the file
+                  const char *path)   // IN: Path of the file
+{
+   HgfsWriteCache *wc;
+
+   pthread_mutex_lock(&gHgfsWriteCacheLock);
+   list_for_each_entry(wc, &gHgfsWriteCaches, list) {
+      if (wc->handle == handle) {
+         goto exit;
+      }
+   }
+
+   wc = calloc(1, sizeof *wc);
+   if (wc == NULL) {
+      goto exit;
+   }
+   wc->size = HgfsMaxIOSize();
+   wc->data = malloc(wc->size);
+   wc->path = strdup(path);
+   if (wc->data == NULL || wc->path == NULL) {
+      free(wc->data);
+      free(wc->path);
+      free(wc);
+      wc = NULL;
+      goto exit;
+   }
+   wc->handle = handle;
+   wc->refCount = 1;
+   pthread_mutex_init(&wc->lock, NULL);
+   list_add(&wc->list, &gHgfsWriteCaches);
+
+exit:
+   pthread_mutex_unlock(&gHgfsWriteCacheLock);
+   return wc;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWriteCachePut --
+ *
+ *    Drop a reference to a write-behind buffer, freeing it with the last.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsWriteCachePut(HgfsWriteCache *wc)  // IN: buffer
+{
+   Bool last;
+
+   pthread_mutex_lock(&gHgfsWriteCacheLock);
+   ASSERT(wc->refCount > 0);
+   last = --wc->refCount == 0;
+   pthread_mutex_unlock(&gHgfsWriteCacheLock);
+
+   if (last) {
+      pthread_mutex_destroy(&wc->lock);
+      free(wc->data);
+      free(wc->path);
+      free(wc);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWriteCacheFlushLocked --
+ *
+ *    Send the data buffered for a handle to the server. Called with the
+ *    buffer lock held.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure, which is
+ *    also kept as the pending error of the buffer.
+ *
+ * Side effects:
+ *    The buffer is empty afterwards, even if sending failed.
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+HgfsWriteCacheFlushLocked(HgfsWriteCache *wc)  // IN/OUT: buffer to flush
+{
+   struct fuse_file_info fi = { 0 };
+   ssize_t res;
+
+   if (wc->len == 0) {
+      return 0;
+   }
+
+   fi.fh = wc->handle;
+   res = HgfsWrite(&fi, wc->data, wc->len, wc->offset);
+   if (res >= 0 && res < wc->len) {
+      LOG(4, ("Short write 0x%"FMTSZ"x of 0x%"FMTSZ"x bytes\n", res, wc->len));
+      res = -EIO;
+   }
+   wc->len = 0;
+
+   if (res < 0) {
+      if (wc->error == 0) {
+         wc->error = res;
+      }
+      return res;
+   }
+   return 0;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsWriteCached --
+ *
+ *    Write through the write-behind buffer of the handle. A write that
+ *    continues the buffered data is only copied, anything else flushes
+ *    the buffer first. Writes of at least a packet are sent directly.
+ *
+ * Results:
+ *    Returns the number of bytes written on success, or an error on
+ *    failure. The error may come from data written earlier.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+ssize_t
+HgfsWriteCached(const char *path,           // IN: Path of the file
+                struct fuse_file_info *fi,  // IN: File info structure
+                const char *buf,            // IN: Data to write
+                size_t count,               // IN: Number of bytes to write
+                loff_t offset)              // IN: Offset to write at
+{
+   HgfsWriteCache *wc;
+   ssize_t res;
+
+   wc = HgfsWriteCacheGet(fi->fh, path);
+   if (wc == NULL) {
+      return HgfsWrite(fi, buf, count, offset);
+   }
+
+   pthread_mutex_lock(&wc->lock);
+   if (wc->error != 0) {
+      res = wc->error;
+      wc->error = 0;
+      goto exit;
+   }
+
+   /* The file may have been renamed since the buffer was created. */
+   if (strcmp(wc->path, path) != 0) {
+      char *newPath = strdup(path);
+
+      if (newPath != NULL) {
+         free(wc->path);
+         wc->path = newPath;
+      }
+   }
+
+   if (wc->len > 0 && offset == wc->offset + wc->len &&
+       count <= wc->size - wc->len) {
+      memcpy(wc->data + wc->len, buf, count);
+      wc->len += count;
+      res = count;
+      goto exit;
+   }
+
+   res = HgfsWriteCacheFlushLocked(wc);
+   if (res < 0) {
+      wc->error = 0;
+      goto exit;
+   }
+
+   if (count < wc->size) {
+      memcpy(wc->data, buf, count);
+      wc->offset = offset;
+      wc->len = count;
+      res = count;
+   } else {
+      res = HgfsWrite(fi, buf, count, offset);
+   }
+
+exit:
+   pthread_mutex_unlock(&wc->lock);
+   LOG(6, ("Exit(0x%"FMTSZ"x)\n", res));
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFlushWriteCache --
+ *
+ *    Send the data buffered for a handle, for flush and fsync.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error if this or an earlier
+ *    write-behind of the handle failed.
+ *
+ * Side effects:
+ *    The pending error is cleared.
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsFlushWriteCache(HgfsHandle handle)  // IN: Handle of the file
+{
+   HgfsWriteCache *wc;
+   HgfsWriteCache *found = NULL;
+   int res = 0;
+
+   pthread_mutex_lock(&gHgfsWriteCacheLock);
+   list_for_each_entry(wc, &gHgfsWriteCaches, list) {
+      if (wc->handle == handle) {
+         found = wc;
+         break;
+      }
+   }
+   pthread_mutex_unlock(&gHgfsWriteCacheLock);
+
+   /* Called by the handle's user, so the buffer cannot be released. */
+   if (found != NULL) {
+      pthread_mutex_lock(&found->lock);
+      HgfsWriteCacheFlushLocked(found);
+      res = found->error;
+      found->error = 0;
+      pthread_mutex_unlock(&found->lock);
+   }
+
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFlushWriteCacheByPath --
+ *
+ *    Send the data buffered for every handle open on a path, before an
+ *    operation that must see it, e.g. getattr, read or setting the times.
+ *
+ * Results:
+ *    None. Errors are left pending on the handles.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsFlushWriteCacheByPath(const char *path)  // IN: Path of the file
+{
+   HgfsWriteCache *wc;
+   HgfsWriteCache **found = NULL;
+   size_t numFound = 0;
+   size_t i;
+
+   if (!gState->writebackCache) {
+      return;
+   }
+
+   /*
+    * Take a reference to every buffer, then send those of the path
+    * without gHgfsWriteCacheLock so other handles are not held up. The
+    * path of a buffer is only changed under its own lock, which may be
+    * held across a send, so it is compared once gHgfsWriteCacheLock is
+    * dropped.
+    */
+   pthread_mutex_lock(&gHgfsWriteCacheLock);
+   list_for_each_entry(wc, &gHgfsWriteCaches, list) {
+      numFound++;
+   }
+   if (numFound > 0) {
+      found = malloc(numFound * sizeof *found);
+   }
+   numFound = 0;
+   if (found != NULL) {
+      list_for_each_entry(wc, &gHgfsWriteCaches, list) {
+         wc->refCount++;
+         found[numFound++] = wc;
+      }
+   }
+   pthread_mutex_unlock(&gHgfsWriteCacheLock);
+
+   for (i = 0; i < numFound; i++) {
+      pthread_mutex_lock(&found[i]->lock);
+      if (strcmp(found[i]->path, path) == 0) {
+         HgfsWriteCacheFlushLocked(found[i]);
+      }
+      pthread_mutex_unlock(&found[i]->lock);
+      HgfsWriteCachePut(found[i]);
+   }
+   free(found);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsReleaseWriteCache --
+ *
+ *    Flush and free the write-behind buffer of a handle being released.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error if a write-behind of
+ *    the handle failed.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+HgfsReleaseWriteCache(HgfsHandle handle)  // IN: Handle of the file
+{
+   HgfsWriteCache *wc;
+   HgfsWriteCache *found = NULL;
+   int res;
+
+   pthread_mutex_lock(&gHgfsWriteCacheLock);
+   list_for_each_entry(wc, &gHgfsWriteCaches, list) {
+      if (wc->handle == handle) {
+         list_del(&wc->list);
+         found = wc;
+         break;
+      }
+   }
+   pthread_mutex_unlock(&gHgfsWriteCacheLock);
+
+   if (found == NULL) {
+      return 0;
+   }
+
+   pthread_mutex_lock(&found->lock);
+   HgfsWriteCacheFlushLocked(found);
+   res = found->error;
+   pthread_mutex_unlock(&found->lock);
+
+   HgfsWriteCachePut(found);
+   return res;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1476,6 +2105,7 @@ HgfsRelease(HgfsHandle handle)  //IN:File handle to close
       result = -ENOMEM;
       goto out;
    }
+   req->channelKey = handle;
 
 retry:
    opUsed = hgfsVersionClose;
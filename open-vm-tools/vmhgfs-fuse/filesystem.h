@@ -48,6 +48,15 @@ typedef struct HgfsFuseState {
 
    GKeyFile *conf;
 
+   /* Attribute cache entries, zero for the default. */
+   uint32 maxCachedAttrs;
+
+   /* Gather small sequential writes before sending them to the host. */
+   Bool writebackCache;
+
+   /* Transport channels to spread the requests over. */
+   uint32 numChannels;
+
 } HgfsFuseState;
 
 /* Public functions (with respect to the entire module). */
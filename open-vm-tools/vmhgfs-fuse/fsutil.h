@@ -75,6 +75,25 @@ HgfsWrite(struct fuse_file_info *fi,
           size_t count,
           loff_t offset);
 
+ssize_t
+HgfsWriteCached(const char *path,
+                struct fuse_file_info *fi,
+                const char *buf,
+                size_t count,
+                loff_t offset);
+
+int
+HgfsFlushWriteCache(HgfsHandle handle);
+
+void
+HgfsFlushWriteCacheByPath(const char *path);
+
+int
+HgfsReleaseWriteCache(HgfsHandle handle);
+
+uint32
+HgfsMaxIOSize(void);
+
 int
 HgfsRename(const char* from, const char* to);
 
@@ -121,6 +140,7 @@ HgfsDirOpen(const char* path, HgfsHandle* handle);
 
 int
 HgfsReaddir(HgfsHandle handle,
+            const char *path,
             void *dirent,
             fuse_fill_dir_t filldir);
 
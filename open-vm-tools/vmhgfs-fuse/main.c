@@ -30,6 +30,10 @@
 #include "cache.h"
 #include "filesystem.h"
 #include "file.h"
+#include "stats.h"
+
+/* Largest write most kernels send to a FUSE file system, 32 pages. */
+#define HGFS_FUSE_MAX_WRITE (32 * 4096)
 
 /*
  *----------------------------------------------------------------------
@@ -136,14 +140,21 @@ hgfs_getattr(const char *path,    //IN: path of a file/directory
       goto exit;
    }
 
+   /* Buffered writes must reach the host first. */
+   HgfsFlushWriteCacheByPath(abspath);
+
    res = HgfsGetAttrCache(abspath, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
-   if (res != 0) {
+   if (res != 0 && HgfsGetNegativeCache(abspath)) {
+      res = -ENOENT;
+   } else if (res != 0) {
       /* Retrieve new complete attribute settings and update the cache. */
       res = HgfsPrivateGetattr(fileHandle, abspath, attr);
       LOG(4, ("Retrieve attr from server. result = %d \n", res));
       if (res == 0 ) {
          HgfsSetAttrCache(abspath, attr);
+      } else if (res == -ENOENT) {
+         HgfsSetNegativeCache(abspath);
       }
    }
 
@@ -249,12 +260,16 @@ hgfs_access(const char *path,  //IN: Path to a file.
 
    res = HgfsGetAttrCache(path, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
-   if (res != 0) {
+   if (res != 0 && HgfsGetNegativeCache(abspath)) {
+      res = -ENOENT;
+   } else if (res != 0) {
       /* Retrieve new complete attribute settings and update the cache. */
       res = HgfsPrivateGetattr(fileHandle, abspath, attr);
       LOG(4, ("Retrieve attr from server. result = %d \n", res));
       if (res == 0 ) {
          HgfsSetAttrCache(abspath, attr);
+      } else if (res == -ENOENT) {
+         HgfsSetNegativeCache(abspath);
       }
    }
 
@@ -326,6 +341,13 @@ hgfs_readlink(const char *path, //IN: path to a file
       goto exit;
    }
 
+   res = HgfsGetLinkCache(abspath, buf, size);
+   if (res != -1) {
+      LOG(4, ("ReadLink: cached link target name = %s\n",
+              res == 0 ? buf : ""));
+      goto exit;
+   }
+
    /* The attributes fileName field will hold the symlink target name. */
    res = HgfsPrivateGetattr(fileHandle, abspath, attr);
    LOG(4, ("ReadLink: Path = %s, attr->fileName = %s \n", abspath, attr->fileName));
@@ -333,6 +355,9 @@ hgfs_readlink(const char *path, //IN: path to a file
       goto exit;
    }
 
+   if (attr->fileName != NULL) {
+      HgfsSetLinkCache(abspath, attr->fileName);
+   }
    if (size > strlen(attr->fileName)) {
       Str_Strcpy(buf, attr->fileName,
                  strlen(attr->fileName) + 1);
@@ -354,7 +379,8 @@ exit:
  *
  * hgfs_readdir
  *
- *    Read the directoy file.
+ *    Read the directoy file. A listing read within the attribute
+ *    timeout is served from the cache.
  *
  * Results:
  *    Returns zero on success, or a negative error on failure.
@@ -382,13 +408,18 @@ hgfs_readdir(const char *path,          //IN: path to a directory
       goto exit;
    }
 
+   if (HgfsGetDirCache(abspath, buf, filler) == 0) {
+      res = 0;
+      goto exit;
+   }
+
    res = HgfsDirOpen(abspath, &fileHandle);
    if (res < 0) {
       goto exit;
    }
 
    fi->fh = fileHandle;
-   res = HgfsReaddir(fileHandle, buf, filler);
+   res = HgfsReaddir(fileHandle, abspath, buf, filler);
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -459,6 +490,10 @@ hgfs_mkdir(const char *path,  //IN: path to a new dir
    }
 
    res = HgfsMkdir(abspath, mode);
+   if (res == 0) {
+      HgfsInvalidateNegativeCache(abspath);
+      HgfsInvalidateDirCache(abspath);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -498,6 +533,9 @@ hgfs_unlink(const char *path) //IN: path to a file
    res = HgfsDelete(abspath, HGFS_OP_DELETE_FILE);
    if (res == 0) {
       HgfsInvalidateAttrCache(abspath);
+      HgfsInvalidateLinkCache(abspath);
+      HgfsInvalidatePageCache(abspath);
+      HgfsInvalidateDirCache(abspath);
    }
 
 exit:
@@ -538,6 +576,7 @@ hgfs_rmdir(const char *path) //IN: path to a dir
    res = HgfsDelete(abspath, HGFS_OP_DELETE_DIR);
    if (res == 0) {
       HgfsInvalidateAttrCache(abspath);
+      HgfsInvalidateDirCache(abspath);
    }
 
 exit:
@@ -578,6 +617,11 @@ hgfs_symlink(const char *symname,   //IN: symname target
 
    LOG(4, ("symname = %s, abs source = %s)\n", symname, absSource));
    res = HgfsSymlink(absSource, symname);
+   if (res == 0) {
+      HgfsInvalidateNegativeCache(absSource);
+      HgfsInvalidateLinkCache(absSource);
+      HgfsInvalidateDirCache(absSource);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -620,10 +664,18 @@ hgfs_rename(const char *from,  //IN: from path name
       goto exit;
    }
 
+   HgfsFlushWriteCacheByPath(absfrom);
    res = HgfsRename(absfrom, absto);
    if (res == 0) {
       HgfsInvalidateAttrCache(absfrom);
       HgfsInvalidateAttrCache(absto);
+      HgfsInvalidateNegativeCache(absto);
+      HgfsInvalidateLinkCache(absfrom);
+      HgfsInvalidateLinkCache(absto);
+      HgfsInvalidatePageCache(absfrom);
+      HgfsInvalidatePageCache(absto);
+      HgfsInvalidateDirCache(absfrom);
+      HgfsInvalidateDirCache(absto);
    }
 
 exit:
@@ -839,6 +891,9 @@ hgfs_truncate(const char *path,  //IN: path to a file
       goto exit;
    }
 
+   /* Buffered writes must reach the host first. */
+   HgfsFlushWriteCacheByPath(abspath);
+
    attr->mask = HGFS_ATTR_VALID_SIZE;
    attr->size = size;
 
@@ -907,6 +962,9 @@ hgfs_utime(const char *path,        //IN: path to a file
       goto exit;
    }
 
+   /* Buffered writes must reach the host first. */
+   HgfsFlushWriteCacheByPath(abspath);
+
    res = HgfsGetAttrCache(abspath, attr);
    LOG(4, ("Retrieve attr from cache. result = %d \n", res));
    if (res != 0) {
@@ -991,6 +1049,8 @@ static int
 hgfs_open(const char *path,          //IN: path to a file
           struct fuse_file_info *fi) //IN: file info structure
 {
+   HgfsAttrInfo newAttr = {0};
+   HgfsAttrInfo *attr = &newAttr;
    char *abspath = NULL;
    int res;
 
@@ -1001,6 +1061,20 @@ hgfs_open(const char *path,          //IN: path to a file
    }
 
    res = HgfsOpen(abspath, fi);
+   if (res < 0) {
+      goto exit;
+   }
+
+   /*
+    * Keep the pages the kernel cached at previous opens if the host still
+    * reports the same file. The attributes must come from the host, the
+    * cached ones may be older than a change made there.
+    */
+   if (HgfsPrivateGetattr(fi->fh, abspath, attr) == 0) {
+      HgfsSetAttrCache(abspath, attr);
+      fi->keep_cache = HgfsKeepPageCache(abspath, attr);
+      free(attr->fileName);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1040,6 +1114,11 @@ hgfs_create(const char *path,          //IN: path to a file
    }
 
    res = HgfsCreate(abspath, mode, fi);
+   if (res == 0) {
+      HgfsInvalidateNegativeCache(abspath);
+      HgfsInvalidateLinkCache(abspath);
+      HgfsInvalidateDirCache(abspath);
+   }
 
 exit:
    LOG(4, ("Exit(%d)\n", res));
@@ -1082,6 +1161,9 @@ hgfs_read(const char *path,          //IN: path to a file
       goto exit;
    }
 
+   /* Buffered writes must reach the host first. */
+   HgfsFlushWriteCacheByPath(abspath);
+
    if (fi->fh == HGFS_INVALID_HANDLE) {
       res = HgfsOpen(abspath, fi);
       if (res) {
@@ -1138,7 +1220,11 @@ hgfs_write(const char *path,          //IN: path to a file
       }
    }
 
-   res = HgfsWrite(fi, buf, size, offset);
+   if (gState->writebackCache) {
+      res = HgfsWriteCached(abspath, fi, buf, size, offset);
+   } else {
+      res = HgfsWrite(fi, buf, size, offset);
+   }
    if (res >= 0) {
       /*
        * Positive result indicates the number of bytes written.
@@ -1154,6 +1240,7 @@ exit:
    return res;
 }
 
+
 /*
  *----------------------------------------------------------------------
  *
@@ -1221,6 +1308,12 @@ hgfs_release(const char *path,                //IN: path to a file
       goto exit;
    }
 
+   res = HgfsReleaseWriteCache(fi->fh);
+   if (res < 0) {
+      LOG(4, ("Lost buffered writes. error = %d\n", res));
+      HgfsInvalidateAttrCache(abspath);
+   }
+
    res = HgfsRelease(fi->fh);
    if (0 == res) {
       fi->fh = HGFS_INVALID_HANDLE;
@@ -1233,12 +1326,92 @@ exit:
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_flush
+ *
+ *    Called on each close of a file. Sends the writes buffered for the
+ *    handle so that close reports their errors.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure. Without
+ *    the writeback_cache option returns -ENOSYS so that the kernel stops
+ *    calling it.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_flush(const char *path,                //IN: path to a file
+           struct fuse_file_info *fi)       //IN: file info structure
+{
+   int res;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x)\n", path, fi->fh));
+   if (!gState->writebackCache) {
+      res = -ENOSYS;
+      goto exit;
+   }
+
+   res = HgfsFlushWriteCache(fi->fh);
+
+exit:
+   LOG(4, ("Exit(%d)\n", res));
+   return res;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * hgfs_fsync
+ *
+ *    Sends the writes buffered for the handle. The host file system
+ *    decides when the data is on disk.
+ *
+ * Results:
+ *    Returns zero on success, or a negative error on failure. Without
+ *    the writeback_cache option returns -ENOSYS so that the kernel stops
+ *    calling it.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static int
+hgfs_fsync(const char *path,                //IN: path to a file
+           int datasync,                    //IN: unused
+           struct fuse_file_info *fi)       //IN: file info structure
+{
+   int res;
+
+   LOG(4, ("Entry(path = %s, fi->fh = %#"FMT64"x)\n", path, fi->fh));
+   if (!gState->writebackCache) {
+      res = -ENOSYS;
+      goto exit;
+   }
+
+   res = HgfsFlushWriteCache(fi->fh);
+
+exit:
+   LOG(4, ("Exit(%d)\n", res));
+   return res;
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
  * hgfs_init
  *
- *    Initialization routine. We spawn the cache purge thread here.
+ *    Initialization routine. We spawn the cache purge thread here and
+ *    size the kernel writes once the session has set the packet size.
  *
  * Results:
  *    Returns NULL.
@@ -1250,9 +1423,10 @@ exit:
  */
 
 static void*
-hgfs_init(struct fuse_conn_info *conn) // IN: unused
+hgfs_init(struct fuse_conn_info *conn) // IN/OUT: connection parameters
 {
    pthread_t purgeCacheThread;
+   uint32 ioSize;
    int dummy;
    int res;
 
@@ -1273,6 +1447,15 @@ hgfs_init(struct fuse_conn_info *conn) // IN: unused
       LOG(4, ("Create session failed. error = %d\n", res));
    }
 
+   /*
+    * Size the kernel writes to a whole number of packets so that a big
+    * write does not end with a runt request.
+    */
+   ioSize = HgfsMaxIOSize();
+   conn->max_write = ioSize < HGFS_FUSE_MAX_WRITE ?
+                     HGFS_FUSE_MAX_WRITE / ioSize * ioSize : ioSize;
+   LOG(4, ("max_write = %#x\n", conn->max_write));
+
    LOG(4, ("Exit(NULL)\n"));
    return NULL;
 }
@@ -1307,6 +1490,7 @@ hgfs_destroy(void *data) // IN: unused
    }
 
    HgfsTransportExit();
+   HgfsFreeRequestPool();
 
    free(gState->basePath);
 
@@ -1344,6 +1528,8 @@ static struct fuse_operations vmhgfs_operations = {
    .read        = hgfs_read,
    .write       = hgfs_write,
    .statfs      = hgfs_statfs,
+   .flush       = hgfs_flush,
+   .fsync       = hgfs_fsync,
    .release     = hgfs_release,
    .create      = hgfs_create,
    .init        = hgfs_init,
@@ -1383,12 +1569,13 @@ main(int argc,       //IN: Argument count
    /* Initialization */
    umask(0);
    HgfsResetOps();
-   res = HgfsTransportInit();
+   res = HgfsTransportInit(gState->numChannels);
    if (res != 0) {
       fprintf(stderr, "Error %d cannot open connection!\n", res);
       return res;
    }
    HgfsInitCache();
+   HgfsStatsInit();
 
    return fuse_main(args.argc, args.argv, &vmhgfs_operations, NULL);
 }
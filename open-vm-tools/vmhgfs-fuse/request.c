@@ -33,13 +33,26 @@
 static HgfsHandle hgfsIdCounter;
 pthread_mutex_t hgfsIdLock = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Freed requests are kept for reuse. A request holds a large packet, so
+ * malloc hands it out with mmap and every operation would otherwise pay
+ * for mapping, faulting in and unmapping the buffer. The pool is bounded
+ * to keep the memory held by an idle client small.
+ */
+#define HGFS_REQ_POOL_MAX 16
+
+static struct list_head hgfsReqPool = LIST_HEAD_INIT(hgfsReqPool);
+static unsigned int hgfsReqPoolCount;
+static pthread_mutex_t hgfsReqPoolLock = PTHREAD_MUTEX_INITIALIZER;
+
 
 /*
  *----------------------------------------------------------------------
  *
  * HgfsGetNewRequest --
  *
- *    Get a new request structure off the free list and initialize it.
+ *    Get a new request structure off the free list and initialize it,
+ *    allocating one when the list is empty.
  *
  * Results:
  *    On success the new struct is returned with all fields
@@ -54,13 +67,29 @@ pthread_mutex_t hgfsIdLock = PTHREAD_MUTEX_INITIALIZER;
 HgfsReq *
 HgfsGetNewRequest(void)
 {
-   HgfsReq *req = (HgfsReq*) malloc(sizeof(HgfsReq));
+   HgfsReq *req = NULL;
+
+   pthread_mutex_lock(&hgfsReqPoolLock);
+   if (!list_empty(&hgfsReqPool)) {
+      req = list_entry(hgfsReqPool.next, HgfsReq, list);
+      list_del(&req->list);
+      hgfsReqPoolCount--;
+   }
+   pthread_mutex_unlock(&hgfsReqPoolLock);
+
    if (req == NULL) {
-      LOG(4, ("Can't allocate memory.\n"));
-      return NULL;
+      req = (HgfsReq*) malloc(sizeof(HgfsReq));
+      if (req == NULL) {
+         LOG(4, ("Can't allocate memory.\n"));
+         return NULL;
+      }
    }
    INIT_LIST_HEAD(&req->list);
    req->payloadSize = 0;
+   req->replyData = NULL;
+   req->replyDataOffset = 0;
+   req->replyDataSize = 0;
+   req->replyDataDone = FALSE;
    req->state = HGFS_REQ_STATE_ALLOCATED;
    /* Setup the packet prefix. */
    memcpy(req->packet, HGFS_SYNC_REQREP_CLIENT_CMD,
@@ -69,6 +98,8 @@ HgfsGetNewRequest(void)
    req->id = hgfsIdCounter;
    hgfsIdCounter++;
    pthread_mutex_unlock(&hgfsIdLock);
+   req->channelKey = req->id;
+   req->op = HGFS_OP_MAX;
 
    return req;
 }
@@ -96,6 +127,8 @@ HgfsStatus
 HgfsPackHeader(HgfsReq *req,  // IN/OUT:
                HgfsOp opUsed) // IN
 {
+   req->op = opUsed;
+
    if (gState->sessionEnabled) { /* use new header */
       HgfsHeader *header = (HgfsHeader*)HGFS_REQ_PAYLOAD(req);
 
@@ -329,7 +362,8 @@ HgfsSendRequest(HgfsReq *req)       // IN/OUT: Outgoing request
  *
  * HgfsFreeRequest --
  *
- *    Free an HGFS request.
+ *    Free an HGFS request, putting it back on the free list if there
+ *    is room.
  *
  * Results:
  *    None
@@ -343,10 +377,53 @@ HgfsSendRequest(HgfsReq *req)       // IN/OUT: Outgoing request
 void
 HgfsFreeRequest(HgfsReq *req) // IN: Request to free
 {
+   if (req == NULL) {
+      return;
+   }
+
+   pthread_mutex_lock(&hgfsReqPoolLock);
+   if (hgfsReqPoolCount < HGFS_REQ_POOL_MAX) {
+      list_add(&req->list, &hgfsReqPool);
+      hgfsReqPoolCount++;
+      req = NULL;
+   }
+   pthread_mutex_unlock(&hgfsReqPoolLock);
+
    free(req);
 }
 
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsFreeRequestPool --
+ *
+ *    Release the requests kept on the free list.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsFreeRequestPool(void)
+{
+   pthread_mutex_lock(&hgfsReqPoolLock);
+   while (!list_empty(&hgfsReqPool)) {
+      HgfsReq *req = list_entry(hgfsReqPool.next, HgfsReq, list);
+
+      list_del(&req->list);
+      free(req);
+   }
+   hgfsReqPoolCount = 0;
+   pthread_mutex_unlock(&hgfsReqPoolLock);
+}
+
+
 /*
  *----------------------------------------------------------------------
  *
@@ -438,6 +515,34 @@ HgfsCompleteReq(HgfsReq *req,       // IN: Request
    ASSERT(replySize <= HgfsLargePacketMax(FALSE));
 
    memcpy(HGFS_REQ_PAYLOAD(req), reply, replySize);
+   HgfsCompleteReqInPlace(req, replySize);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsCompleteReqInPlace --
+ *
+ *    Marks the request completed for a channel which already placed the
+ *    reply in the request packet, and wakes up the associated client.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsCompleteReqInPlace(HgfsReq *req,       // IN: Request
+                       size_t replySize)   // IN: Size of reply packet
+{
+   ASSERT(req);
+   ASSERT(replySize <= HgfsLargePacketMax(FALSE));
+
    req->payloadSize = replySize;
    req->state = HGFS_REQ_STATE_COMPLETED;
    if (!list_empty(&req->list)) {
@@ -100,9 +100,30 @@ typedef struct HgfsReq {
    /* ID of this request */
    HgfsHandle id;
 
+   /*
+    * Requests with the same key are sent on the same transport channel,
+    * which keeps the operations on one open file in order. Defaults to
+    * the request ID, callers working on a handle set the handle.
+    */
+   uint32 channelKey;
+
+   /* Operation packed into the header, for statistics. */
+   HgfsOp op;
+
    /* Total size of the payload.*/
    size_t payloadSize;
 
+   /*
+    * Optional destination for the data part of the reply. Channels which
+    * can scatter a reply place the bytes past replyDataOffset straight
+    * into replyData and set replyDataDone, saving the caller a copy out
+    * of the packet.
+    */
+   char *replyData;
+   size_t replyDataOffset;
+   size_t replyDataSize;
+   Bool replyDataDone;
+
    /*
     * Packet of data, for both incoming and outgoing messages.
     * Include room for the command.
@@ -124,12 +145,14 @@ HgfsStatus HgfsUnpackHeader(void *serverReply,
 			    HgfsStatus *replyStatus,
 			    void **payload,
 			    size_t *payloadSize);
+void HgfsCompleteReqInPlace(HgfsReq *req, size_t replySize);
 void* HgfsGetRequestPayload(HgfsReq *req);
 void* HgfsGetReplyPayload(HgfsReq *req);
 size_t HgfsGetReplyHeaderSize(void);
 size_t HgfsGetRequestHeaderSize(void);
 int HgfsSendRequest(HgfsReq *req);
 void HgfsFreeRequest(HgfsReq *req);
+void HgfsFreeRequestPool(void);
 HgfsStatus HgfsGetReplyStatus(HgfsReq *req);
 void HgfsCompleteReq(HgfsReq *req,
                      char const *reply,
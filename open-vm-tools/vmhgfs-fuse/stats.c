@@ -0,0 +1,334 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * stats.c --
+ *
+ * Runtime statistics of the HGFS FUSE client: cache hits and misses,
+ * bytes moved, channel resets, requests in flight and a latency
+ * histogram per HGFS opcode.
+ *
+ * Counters are updated with atomics from any thread. Sending SIGUSR1 to
+ * the client asks for a dump to the tools log, which the cache purge
+ * thread writes within a few seconds since a signal handler cannot log.
+ */
+
+#include <signal.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "module.h"
+#include "stats.h"
+#include "vm_atomic.h"
+
+/* Latency buckets, bucket i counts requests under 2^i microseconds. */
+#define HGFS_STATS_NUM_BUCKETS 24
+
+typedef struct HgfsStatsOp {
+   Atomic_uint64 requests;
+   Atomic_uint64 errors;
+   Atomic_uint64 totalUs;
+   Atomic_uint32 buckets[HGFS_STATS_NUM_BUCKETS];
+} HgfsStatsOp;
+
+static const char *const gHgfsStatNames[HGFS_STAT_MAX] = {
+   "attr_cache_hit",
+   "attr_cache_miss",
+   "attr_cache_evict",
+   "dir_cache_hit",
+   "dir_cache_miss",
+   "negative_cache_hit",
+   "link_cache_hit",
+   "link_cache_miss",
+   "page_cache_keep",
+   "page_cache_drop",
+   "bytes_read",
+   "bytes_written",
+   "channel_resets",
+};
+
+static Atomic_uint64 gHgfsStats[HGFS_STAT_MAX];
+static Atomic_uint32 gHgfsStatsOutstanding;
+static HgfsStatsOp gHgfsStatsOps[HGFS_OP_MAX];
+static volatile sig_atomic_t gHgfsStatsDumpRequested;
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsSignalHandler --
+ *
+ *    SIGUSR1 handler, flags the dump for the purge thread.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static void
+HgfsStatsSignalHandler(int sig)   // IN: unused
+{
+   gHgfsStatsDumpRequested = 1;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsInit --
+ *
+ *    Install the SIGUSR1 handler requesting a dump.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsStatsInit(void)
+{
+   struct sigaction sa;
+
+   memset(&sa, 0, sizeof sa);
+   sa.sa_handler = HgfsStatsSignalHandler;
+   sigemptyset(&sa.sa_mask);
+   sa.sa_flags = SA_RESTART;
+   if (sigaction(SIGUSR1, &sa, NULL) != 0) {
+      LOG(4, ("Cannot install SIGUSR1 handler. error = %d\n", errno));
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsAdd --
+ *
+ *    Add to a counter.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsStatsAdd(HgfsStatCounter counter,   // IN: counter to update
+             uint64 value)              // IN: amount to add
+{
+   ASSERT(counter < HGFS_STAT_MAX);
+   Atomic_Add64(&gHgfsStats[counter], value);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsNowUs --
+ *
+ *    Monotonic time in microseconds.
+ *
+ * Results:
+ *    The time.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+static uint64
+HgfsStatsNowUs(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsRequestStart --
+ *
+ *    Count a request going out.
+ *
+ * Results:
+ *    The start time to pass to HgfsStatsRequestDone.
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+uint64
+HgfsStatsRequestStart(void)
+{
+   Atomic_Inc32(&gHgfsStatsOutstanding);
+   return HgfsStatsNowUs();
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsRequestDone --
+ *
+ *    Record the latency and outcome of a request.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsStatsRequestDone(HgfsOp op,       // IN: request opcode
+                     uint64 start,    // IN: from HgfsStatsRequestStart
+                     int result)      // IN: transport result
+{
+   uint64 elapsed = HgfsStatsNowUs() - start;
+   unsigned int bucket = 0;
+   HgfsStatsOp *opStats;
+
+   Atomic_Dec32(&gHgfsStatsOutstanding);
+
+   if ((unsigned int)op >= ARRAYSIZE(gHgfsStatsOps)) {
+      return;
+   }
+
+   while (bucket < HGFS_STATS_NUM_BUCKETS - 1 &&
+          elapsed >= (CONST64U(1) << bucket)) {
+      bucket++;
+   }
+
+   opStats = &gHgfsStatsOps[op];
+   Atomic_Inc64(&opStats->requests);
+   if (result != 0) {
+      Atomic_Inc64(&opStats->errors);
+   }
+   Atomic_Add64(&opStats->totalUs, elapsed);
+   Atomic_Inc32(&opStats->buckets[bucket]);
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsDump --
+ *
+ *    Write the statistics to the log, one line per counter and one per
+ *    opcode that saw traffic:
+ *
+ *      op 42 requests 100 errors 0 avg_us 120 hist 0 0 0 3 ...
+ *
+ *    The histogram lists buckets up to the last non-empty one.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsStatsDump(void)
+{
+   unsigned int i;
+
+   g_message("vmhgfs-fuse statistics\n");
+   for (i = 0; i < HGFS_STAT_MAX; i++) {
+      g_message("%s %"FMT64"u\n", gHgfsStatNames[i],
+                Atomic_Read64(&gHgfsStats[i]));
+   }
+   g_message("outstanding_requests %u\n",
+             Atomic_Read32(&gHgfsStatsOutstanding));
+
+   for (i = 0; i < ARRAYSIZE(gHgfsStatsOps); i++) {
+      HgfsStatsOp *opStats = &gHgfsStatsOps[i];
+      uint64 requests = Atomic_Read64(&opStats->requests);
+      char hist[HGFS_STATS_NUM_BUCKETS * 11 + 1];
+      size_t len = 0;
+      unsigned int last = 0;
+      unsigned int b;
+
+      if (requests == 0) {
+         continue;
+      }
+
+      for (b = 0; b < HGFS_STATS_NUM_BUCKETS; b++) {
+         if (Atomic_Read32(&opStats->buckets[b]) != 0) {
+            last = b;
+         }
+      }
+      hist[0] = '\0';
+      for (b = 0; b <= last; b++) {
+         len += snprintf(hist + len, sizeof hist - len, " %u",
+                         Atomic_Read32(&opStats->buckets[b]));
+      }
+
+      g_message("op %u requests %"FMT64"u errors %"FMT64"u "
+                "avg_us %"FMT64"u hist%s\n", i, requests,
+                Atomic_Read64(&opStats->errors),
+                Atomic_Read64(&opStats->totalUs) / requests, hist);
+   }
+}
+
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * HgfsStatsDumpIfRequested --
+ *
+ *    Dump the statistics if SIGUSR1 arrived since the last call.
+ *
+ * Results:
+ *    None
+ *
+ * Side effects:
+ *    None
+ *
+ *----------------------------------------------------------------------
+ */
+
+void
+HgfsStatsDumpIfRequested(void)
+{
+   if (gHgfsStatsDumpRequested) {
+      gHgfsStatsDumpRequested = 0;
+      HgfsStatsDump();
+   }
+}
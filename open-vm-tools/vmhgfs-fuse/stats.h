@@ -0,0 +1,57 @@
+/*********************************************************
+ * Copyright (C) 2020 VMware, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published
+ * by the Free Software Foundation version 2.1 and no later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the Lesser GNU General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA.
+ *
+ *********************************************************/
+
+/*
+ * stats.h --
+ *
+ * Runtime statistics of the HGFS FUSE client.
+ */
+
+#ifndef _HGFS_DRIVER_STATS_H_
+#define _HGFS_DRIVER_STATS_H_
+
+#include "hgfsProto.h"
+#include "vm_basic_types.h"
+
+typedef enum {
+   HGFS_STAT_ATTR_CACHE_HIT,
+   HGFS_STAT_ATTR_CACHE_MISS,
+   HGFS_STAT_ATTR_CACHE_EVICT,
+   HGFS_STAT_DIR_CACHE_HIT,
+   HGFS_STAT_DIR_CACHE_MISS,
+   HGFS_STAT_NEGATIVE_CACHE_HIT,
+   HGFS_STAT_LINK_CACHE_HIT,
+   HGFS_STAT_LINK_CACHE_MISS,
+   HGFS_STAT_PAGE_CACHE_KEEP,
+   HGFS_STAT_PAGE_CACHE_DROP,
+   HGFS_STAT_BYTES_READ,
+   HGFS_STAT_BYTES_WRITTEN,
+   HGFS_STAT_CHANNEL_RESETS,
+   HGFS_STAT_MAX
+} HgfsStatCounter;
+
+void HgfsStatsInit(void);
+void HgfsStatsAdd(HgfsStatCounter counter, uint64 value);
+uint64 HgfsStatsRequestStart(void);
+void HgfsStatsRequestDone(HgfsOp op, uint64 start, int result);
+void HgfsStatsDumpIfRequested(void);
+void HgfsStatsDump(void);
+
+#define HgfsStatsInc(counter) HgfsStatsAdd(counter, 1)
+
+#endif // _HGFS_DRIVER_STATS_H_
@@ -23,10 +23,15 @@
  * This acts as a glue between the HGFS filesystem driver and the
  * actual transport channels (backdoor, tcp, vsock, ...).
  *
- * The sends happen in the process context, where as a thread
- * handles the asynchronous replies. A queue of pending replies is
- * maintained and is protected by a lock. The channel opens and close
- * is protected by a mutex.
+ * The sends happen in the process context. The backdoor returns the
+ * reply within the send, so no request outlives it.
+ *
+ * Several channels may be open at once, each in its own slot. A request
+ * goes to the slot picked by its channel key, so the requests for one
+ * open file always use the same channel. Senders share the channel of a
+ * slot under a read lock and the channel orders their requests; opening,
+ * resetting and closing the channel of a slot take the lock of that slot
+ * for writing and leave the others alone.
  */
 
 
@@ -35,21 +40,21 @@
 #include "hgfsProto.h"
 #include "module.h"
 #include "request.h"
+#include "stats.h"
 #include "transport.h"
 #include "vm_assert.h"
 
-static HgfsTransportChannel *gHgfsActiveChannel;     /* Current active channel. */
-static pthread_mutex_t gHgfsActiveChannelLock;       /* Current active channel lock. */
-static Bool gHgfsActiveChannelLockInited;
+typedef struct HgfsTransportSlot {
+   HgfsTransportChannel *channel;     /* Current channel of the slot. */
+   pthread_rwlock_t lock;             /* Protects channel. */
+   Bool lockInited;
+} HgfsTransportSlot;
 
-static struct list_head gHgfsPendingRequests;        /* Pending requests queue. */
-static pthread_mutex_t gHgfsPendingRequestsLock;     /* Pending requests queue lock. */
-static Bool gHgfsPendingRequestsLockInited;
+static HgfsTransportSlot gHgfsChannelSlots[HGFS_TRANSPORT_MAX_CHANNELS];
+static uint32 gHgfsNumChannelSlots;
 
 
-#define HgfsRequestId(req) ((HgfsRequest *)req)->id
-
-static void HgfsTransportChannelClose(HgfsTransportChannel **channel);
+static void HgfsTransportChannelClose(HgfsTransportSlot *slot);
 
 /*
  * Private function implementations.
@@ -60,10 +65,11 @@ static void HgfsTransportChannelClose(HgfsTransportChannel **channel);
  *
  * HgfsTransportChannelOpen --
  *
- *     Open a new workable channel.
+ *     Open a new workable channel in the slot. Called with the slot lock
+ *     held for writing.
  *
  * Results:
- *     0 on success and the new channel, otherwise -ENOTCONN and NULL.
+ *     0 on success, otherwise a negative error and no channel.
  *
  * Side effects:
  *     None
@@ -72,17 +78,20 @@ static void HgfsTransportChannelClose(HgfsTransportChannel **channel);
  */
 
 static int
-HgfsTransportChannelOpen(HgfsTransportChannel **channel) // IN: active channel
+HgfsTransportChannelOpen(HgfsTransportSlot *slot)  // IN/OUT: slot to fill
 {
-   int result = 0;
-
-   *channel = HgfsBdChannelInit();
-   if (NULL != *channel) {
-      HgfsChannelStatus status = (*channel)->ops.open(*channel);
-      if (status != HGFS_CHANNEL_CONNECTED) {
-         HgfsTransportChannelClose(channel);
-         result = -ENOTCONN;
-         *channel = NULL;
+   HgfsTransportChannel *channel;
+   int result = -ENOTCONN;
+
+   ASSERT(slot->channel == NULL);
+
+   channel = HgfsBdChannelInit();
+   if (NULL != channel) {
+      slot->channel = channel;
+      if (channel->ops.open(channel) != HGFS_CHANNEL_CONNECTED) {
+         HgfsTransportChannelClose(slot);
+      } else {
+         result = 0;
       }
    }
 
@@ -95,7 +104,7 @@ HgfsTransportChannelOpen(HgfsTransportChannel **channel) // IN: active channel
  *
  * HgfsTransportChannelClose --
  *
- *     Teardown current channel and stop current receive thread.
+ *     Teardown the channel of a slot.
  *
  * Results:
  *     None
@@ -107,14 +116,14 @@ HgfsTransportChannelOpen(HgfsTransportChannel **channel) // IN: active channel
  */
 
 static void
-HgfsTransportChannelClose(HgfsTransportChannel **channel) // active channel
+HgfsTransportChannelClose(HgfsTransportSlot *slot)  // IN/OUT: slot to empty
 {
-   if (NULL != *channel) {
-      HgfsTransportChannel *closeChannel = *channel;
+   if (NULL != slot->channel) {
+      HgfsTransportChannel *closeChannel = slot->channel;
 
       closeChannel->ops.close(closeChannel);
       closeChannel->ops.exit(closeChannel);
-      *channel = NULL;
+      slot->channel = NULL;
    }
 }
 
@@ -124,27 +133,26 @@ HgfsTransportChannelClose(HgfsTransportChannel **channel) // active channel
  *
  * HgfsTransportChannelReset --
  *
- *     Called when current channel doesn't work. Find a new channel
- *     for transport.
+ *     Called when the channel of a slot doesn't work. Find a new channel
+ *     for it.
  *
  * Results:
  *     TRUE on success, otherwise FALSE;
  *
  * Side effects:
- *     Teardown current opened channel and the receive thread, set up
- *     new channel and new receive thread.
+ *     Teardown current opened channel, set up new channel.
  *
  *----------------------------------------------------------------------
  */
 
 static Bool
-HgfsTransportChannelReset(HgfsTransportChannel **channel) // IN: active channel
+HgfsTransportChannelReset(HgfsTransportSlot *slot)  // IN/OUT: slot to reset
 {
    Bool ret = FALSE;
    int openResult;
 
-   HgfsTransportChannelClose(channel);
-   openResult = HgfsTransportChannelOpen(channel);
+   HgfsTransportChannelClose(slot);
+   openResult = HgfsTransportChannelOpen(slot);
    if (openResult == 0) {
       ret = TRUE;
    }
@@ -156,10 +164,12 @@ HgfsTransportChannelReset(HgfsTransportChannel **channel) // IN: active channel
 /*
  *----------------------------------------------------------------------
  *
- * HgfsTransportEnqueueRequest --
+ * HgfsTransportSlotForRequest --
  *
- *     Add the request to the gHgfsPendingRequests queue.
+ *     Pick the slot of the channel carrying a request.
  *
+ * Results:
+ *     The slot.
  *
  * Side effects:
  *     None
@@ -167,26 +177,25 @@ HgfsTransportChannelReset(HgfsTransportChannel **channel) // IN: active channel
  *----------------------------------------------------------------------
  */
 
-static void
-HgfsTransportEnqueueRequest(HgfsReq *req)   // IN: Request to add
+static HgfsTransportSlot *
+HgfsTransportSlotForRequest(const HgfsReq *req)   // IN: Request to send
 {
-   ASSERT(req);
+   ASSERT(gHgfsNumChannelSlots > 0);
 
-   pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   list_add_tail(&req->list, &gHgfsPendingRequests);
-   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+   return &gHgfsChannelSlots[req->channelKey % gHgfsNumChannelSlots];
 }
 
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsTransportDequeueRequest --
+ * HgfsTransportChannelSend --
  *
- *     Removes the request from the gHgfsPendingRequests queue.
+ *     Send the request on the channel of a slot.
  *
  * Results:
- *     None
+ *     Zero on success, negative error on failure and the channel used,
+ *     NULL if there was none.
  *
  * Side effects:
  *     None
@@ -194,33 +203,38 @@ HgfsTransportEnqueueRequest(HgfsReq *req)   // IN: Request to add
  *----------------------------------------------------------------------
  */
 
-static void
-HgfsTransportDequeueRequest(HgfsReq *req)   // IN: Request to dequeue
+static int
+HgfsTransportChannelSend(HgfsTransportSlot *slot,          // IN: Slot to use
+                         HgfsReq *req,                     // IN: Request to send
+                         HgfsTransportChannel **channel)   // OUT: Channel used
 {
-   ASSERT(req);
+   int ret = -ENOTCONN;
 
-   pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   if (!list_empty(&req->list)) {
-      list_del_init(&req->list);
+   pthread_rwlock_rdlock(&slot->lock);
+
+   *channel = slot->channel;
+   if (NULL != *channel) {
+      ASSERT((*channel)->ops.send);
+      ret = (*channel)->ops.send(*channel, req);
    }
-   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
-}
 
+   pthread_rwlock_unlock(&slot->lock);
+
+   return ret;
+}
 
-/*
- * Public function implementations.
- */
 
 /*
  *----------------------------------------------------------------------
  *
- * HgfsTransportProcessPacket --
+ * HgfsTransportChannelRecover --
  *
- *     Helper function to process received packets, called by the channel
- *     handler thread.
+ *     Called when a send on the channel of a slot failed. Reset the
+ *     channel unless another sender did so already, or open one if there
+ *     was none. Other slots keep working meanwhile.
  *
  * Results:
- *     None
+ *     TRUE if there is a channel to retry on, otherwise FALSE.
  *
  * Side effects:
  *     None
@@ -228,86 +242,41 @@ HgfsTransportDequeueRequest(HgfsReq *req)   // IN: Request to dequeue
  *----------------------------------------------------------------------
  */
 
-void
-HgfsTransportProcessPacket(char *receivedPacket,    //IN: received packet
-                           size_t receivedSize)     //IN: packet size
+static Bool
+HgfsTransportChannelRecover(HgfsTransportSlot *slot,        // IN: Slot used
+                            HgfsTransportChannel *failed)   // IN: Channel used
 {
-   struct list_head *cur, *next;
-   HgfsHandle id;
-   Bool found = FALSE;
+   Bool ret;
 
-   /* Got the reply. */
+   pthread_rwlock_wrlock(&slot->lock);
 
-   ASSERT(receivedPacket != NULL && receivedSize > 0);
-   id = HgfsRequestId(receivedPacket);
-   LOG(8, ("Entered.\n"));
-   LOG(6, ("Req id: %d\n", id));
-   /*
-    * Search through gHgfsPendingRequests queue for the matching id and wake up
-    * the associated waiting process. Delete the req from the queue.
-    */
-   pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   list_for_each_safe(cur, next, &gHgfsPendingRequests) {
-      HgfsReq *req;
-      req = list_entry(cur, HgfsReq, list);
-      if (req->id == id) {
-         ASSERT(req->state == HGFS_REQ_STATE_SUBMITTED);
-         HgfsCompleteReq(req, receivedPacket, receivedSize);
-         found = TRUE;
-         break;
+   if (slot->channel == failed) {
+      if (NULL == failed) {
+         HgfsTransportChannelOpen(slot);
+      } else {
+         HgfsStatsInc(HGFS_STAT_CHANNEL_RESETS);
+         HgfsTransportChannelReset(slot);
       }
    }
-   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
+   ret = slot->channel != NULL;
 
-   if (!found) {
-      LOG(4, ("No matching id, dropping reply.\n"));
-   }
-   LOG(8, ("Exited.\n"));
+   pthread_rwlock_unlock(&slot->lock);
+
+   return ret;
 }
 
 
 /*
- *----------------------------------------------------------------------
- *
- * HgfsTransportBeforeExitingRecvThread --
- *
- *     The cleanup work to do before the recv thread exits, including
- *     completing pending requests with error.
- *
- * Results:
- *     None
- *
- * Side effects:
- *     None
- *
- *----------------------------------------------------------------------
+ * Public function implementations.
  */
 
-void
-HgfsTransportBeforeExitingRecvThread(void)
-{
-   struct list_head *cur, *next;
-
-   /* Walk through gHgfsPendingRequests queue and reply them with error. */
-   pthread_mutex_lock(&gHgfsPendingRequestsLock);
-   list_for_each_safe(cur, next, &gHgfsPendingRequests) {
-      HgfsReq *req;
-      HgfsReply reply;
-
-      req = list_entry(cur, HgfsReq, list);
-      LOG(6, ("Injecting error reply to req id: %d\n", req->id));
-      HgfsCompleteReq(req, (char *)&reply, sizeof reply);
-   }
-   pthread_mutex_unlock(&gHgfsPendingRequestsLock);
-}
-
-
 /*
  *----------------------------------------------------------------------
  *
  * HgfsTransportSendRequest --
  *
- *     Sends the request via channel communication.
+ *     Sends the request via channel communication and waits for the
+ *     reply. Safe to call from any number of threads at once.
  *
  * Results:
  *     Zero on success, non-zero error on failure.
@@ -321,44 +290,31 @@ HgfsTransportBeforeExitingRecvThread(void)
 int
 HgfsTransportSendRequest(HgfsReq *req)   // IN: Request to send
 {
+   HgfsTransportSlot *slot;
+   HgfsTransportChannel *channel;
+   uint64 start;
    int ret;
+
    ASSERT(req);
    ASSERT(req->state == HGFS_REQ_STATE_UNSENT);
    ASSERT(req->payloadSize <= HgfsLargePacketMax(FALSE));
 
-   pthread_mutex_lock(&gHgfsActiveChannelLock);
-
-   /* Try opening the channel. */
-   if (NULL == gHgfsActiveChannel) {
-      ret = HgfsTransportChannelOpen(&gHgfsActiveChannel);
-      if (ret != 0) {
-         goto exit;
-      }
-   }
-
-   ASSERT(gHgfsActiveChannel->ops.send);
-
-   HgfsTransportEnqueueRequest(req);
-
-   ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+   start = HgfsStatsRequestStart();
+   slot = HgfsTransportSlotForRequest(req);
+   ret = HgfsTransportChannelSend(slot, req, &channel);
    if (ret < 0) {
       LOG(4, ("Send failed, status = %d. Try reopening the channel ...\n",
               ret));
-      if (HgfsTransportChannelReset(&gHgfsActiveChannel)) {
-         ret = gHgfsActiveChannel->ops.send(gHgfsActiveChannel, req);
+      if (HgfsTransportChannelRecover(slot, channel)) {
+         ret = HgfsTransportChannelSend(slot, req, &channel);
       }
    }
 
-exit:
    ASSERT(req->state == HGFS_REQ_STATE_COMPLETED ||
           req->state == HGFS_REQ_STATE_SUBMITTED ||
           req->state == HGFS_REQ_STATE_UNSENT);
 
-   pthread_mutex_unlock(&gHgfsActiveChannelLock);
-
-   if (ret < 0) {
-      HgfsTransportDequeueRequest(req);
-   }
+   HgfsStatsRequestDone(req->op, start, ret);
 
    return ret;
 }
@@ -369,10 +325,8 @@ exit:
  *
  * HgfsTransportInit --
  *
- *     Initialize the transport.
- *
- *     Starts the reply thread, for handling incoming packets on the
- *     connected socket.
+ *     Initialize the transport, opening up to numChannels channels. It
+ *     succeeds if at least the first channel opened.
  *
  * Results:
  *     Zero on success and negative error on failure.
@@ -384,30 +338,51 @@ exit:
  */
 
 int
-HgfsTransportInit(void)
+HgfsTransportInit(uint32 numChannels)   // IN: Channels to open
 {
+   unsigned int i;
    int res;
 
-   gHgfsActiveChannel = NULL;
-   gHgfsPendingRequestsLockInited = FALSE;
-   gHgfsActiveChannelLockInited = FALSE;
-   INIT_LIST_HEAD(&gHgfsPendingRequests);
+   ASSERT(numChannels > 0 && numChannels <= HGFS_TRANSPORT_MAX_CHANNELS);
 
-   res = pthread_mutex_init(&gHgfsPendingRequestsLock, NULL);
-   if (res != 0) {
-      res = -res;
-      goto exit;
-   }
-   gHgfsPendingRequestsLockInited = TRUE;
+   gHgfsNumChannelSlots = 0;
 
-   res = pthread_mutex_init(&gHgfsActiveChannelLock, NULL);
-   if (res != 0) {
-      res = -res;
-      goto exit;
+   for (i = 0; i < numChannels; i++) {
+      HgfsTransportSlot *slot = &gHgfsChannelSlots[i];
+      int openResult;
+
+      slot->channel = NULL;
+      res = pthread_rwlock_init(&slot->lock, NULL);
+      if (res != 0) {
+         res = -res;
+         goto exit;
+      }
+      slot->lockInited = TRUE;
+      gHgfsNumChannelSlots++;
+
+      pthread_rwlock_wrlock(&slot->lock);
+      openResult = HgfsTransportChannelOpen(slot);
+      pthread_rwlock_unlock(&slot->lock);
+
+      if (openResult != 0) {
+         LOG(4, ("Channel %u did not open: %d\n", i, openResult));
+         res = openResult;
+         break;
+      }
    }
-   gHgfsActiveChannelLockInited = TRUE;
 
-   res = HgfsTransportChannelOpen(&gHgfsActiveChannel);
+   /*
+    * The host limits the backdoor connections of a guest, so make do with
+    * the channels that opened rather than route requests to a dead slot.
+    */
+   if (gHgfsNumChannelSlots > 1 && res != 0) {
+      HgfsTransportSlot *slot = &gHgfsChannelSlots[--gHgfsNumChannelSlots];
+
+      pthread_rwlock_destroy(&slot->lock);
+      slot->lockInited = FALSE;
+      LOG(4, ("Using %u of %u channels\n", gHgfsNumChannelSlots, numChannels));
+      res = 0;
+   }
 
 exit:
    if (res != 0) {
@@ -436,22 +411,22 @@ exit:
 void
 HgfsTransportExit(void)
 {
+   unsigned int i;
+
    LOG(8, ("Entered.\n"));
 
-   if (gHgfsActiveChannelLockInited) {
-      pthread_mutex_lock(&gHgfsActiveChannelLock);
-      HgfsTransportChannelClose(&gHgfsActiveChannel);
-      pthread_mutex_unlock(&gHgfsActiveChannelLock);
+   for (i = 0; i < gHgfsNumChannelSlots; i++) {
+      HgfsTransportSlot *slot = &gHgfsChannelSlots[i];
 
-      pthread_mutex_destroy(&gHgfsActiveChannelLock);
-      gHgfsActiveChannelLockInited = FALSE;
-   }
+      if (slot->lockInited) {
+         pthread_rwlock_wrlock(&slot->lock);
+         HgfsTransportChannelClose(slot);
+         pthread_rwlock_unlock(&slot->lock);
 
-   ASSERT(list_empty(&gHgfsPendingRequests));
-
-   if (gHgfsPendingRequestsLockInited) {
-      pthread_mutex_destroy(&gHgfsPendingRequestsLock);
-      gHgfsPendingRequestsLockInited = FALSE;
+         pthread_rwlock_destroy(&slot->lock);
+         slot->lockInited = FALSE;
+      }
    }
+   gHgfsNumChannelSlots = 0;
    LOG(8, ("Exited.\n"));
 }
@@ -40,7 +40,6 @@ typedef struct HgfsTransportChannelOps {
    HgfsChannelStatus (*open)(struct HgfsTransportChannel *);
    void (*close)(struct HgfsTransportChannel *);
    int (*send)(struct HgfsTransportChannel *, HgfsReq *);
-   int (*recv)(struct HgfsTransportChannel *, char **, size_t *);
    void (*exit)(struct HgfsTransportChannel *);
 } HgfsTransportChannelOps;
 
@@ -52,12 +51,12 @@ typedef struct HgfsTransportChannel {
    pthread_mutex_t connLock;       /* Protect _this_ struct. */
 } HgfsTransportChannel;
 
+/* Most channels the transport spreads requests over. */
+#define HGFS_TRANSPORT_MAX_CHANNELS 8
+
 /* Public functions (with respect to the entire module). */
-int HgfsTransportInit(void);
+int HgfsTransportInit(uint32 numChannels);
 void HgfsTransportExit(void);
 int HgfsTransportSendRequest(HgfsReq *req);
-void HgfsTransportProcessPacket(char *receivedPacket,
-                                size_t receivedSize);
-void HgfsTransportBeforeExitingRecvThread(void);
 
 #endif // _HGFS_DRIVER_TRANSPORT_H_
@@ -35,6 +35,10 @@
  *      Aug 24 18:48:10: vcpu-0| Guest: >Mi4K
  *      Aug 24 18:48:10: vcpu-0| Guest: >Logfile Ends
  *
+ *      A transfer resumed from a byte offset has that offset in its start
+ *      mark, e.g. ">Logfile Begins : /root/install.log: ver - 1 offset - 4104",
+ *      and is appended by the decoder to the output of the interrupted one.
+ *
  */
 
 #include <stdio.h>
@@ -71,10 +75,12 @@ VM_EMBED_VERSION(XFERLOGS_VERSION_STRING);
  */
 
 #define BUF_BASE64_SIZE        57
+#define BUF_READ_SIZE          (BUF_BASE64_SIZE * 1024)
 #define BUF_OUT_SIZE           256
 #define LOG_GUEST_MARK         "Guest: >"
 #define LOG_START_MARK         ">Logfile Begins "
 #define LOG_END_MARK           ">Logfile Ends "
+#define LOG_OFFSET_MARK        " offset - "
 
 typedef enum {
    NOT_IN_GUEST_LOGGING,
@@ -84,30 +90,125 @@ typedef enum {
 #define LOG_VERSION            1
 
 
+/*
+ *--------------------------------------------------------------------------
+ *
+ * xmitLog --
+ *
+ *       Sends a log RPC over the given channel, opening it if needed. The
+ *       channel is reopened once if the send fails.
+ *
+ * Results:
+ *       TRUE if the VMX logged the message, FALSE otherwise.
+ *
+ * Side effects:
+ *       Output is added to the vmx log file.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static Bool
+xmitLog(RpcOut *out,       //IN: channel to the VMX
+        Bool *started,     //IN/OUT: whether the channel is open
+        const char *fmt,   //IN: format of the message
+        ...)
+{
+   char msg[BUF_OUT_SIZE];
+   va_list args;
+   int msgLen;
+   int payloadLen;
+   int attempt;
+
+   msgLen = Str_Sprintf(msg, sizeof msg, "log ");
+
+   va_start(args, fmt);
+   payloadLen = Str_Vsnprintf(msg + msgLen, sizeof msg - msgLen, fmt, args);
+   va_end(args);
+
+   /* Send the truncated message on overflow, like RpcVMX_Log. */
+   msgLen = payloadLen < 0 ? sizeof msg - 1 : msgLen + payloadLen;
+
+   for (attempt = 0; attempt < 2; attempt++) {
+      Bool rpcStatus;
+      char const *reply;
+      size_t repLen;
+
+      if (!*started && !(*started = RpcOut_start(out))) {
+         continue;
+      }
+      if (RpcOut_send(out, msg, msgLen, &rpcStatus, &reply, &repLen)) {
+         return rpcStatus;
+      }
+      RpcOut_stop(out);
+      *started = FALSE;
+   }
+   return FALSE;
+}
+
+
+/*
+ *--------------------------------------------------------------------------
+ *
+ * xferSeek --
+ *
+ *       Positions the file at the given offset, which may be larger than
+ *       what a long can represent.
+ *
+ * Results:
+ *       TRUE on success, FALSE otherwise.
+ *
+ * Side effects:
+ *       None.
+ *
+ *--------------------------------------------------------------------------
+ */
+
+static Bool
+xferSeek(FILE *fp,       //IN: file to position
+         uint64 offset)  //IN: offset from the beginning
+{
+#ifdef _WIN32
+   return _fseeki64(fp, (__int64)offset, SEEK_SET) == 0;
+#else
+   return fseeko(fp, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+
 /*
  *--------------------------------------------------------------------------
  *
  * xmitFile --
  *
  *       This function transfers a file using the rpc channel in base64
- *       encoding to the vmx logs.
+ *       encoding to the vmx logs, starting at the given offset.
+ *
+ *       The file is read in large chunks and sent over a single channel,
+ *       one encoded line per log RPC since the decoders read the log line
+ *       by line.
  *
  * Results:
  *       None.
  *
  * Side effects:
- *       The program would exit if an error occurs in Base64_Encode.
+ *       The program would exit if an error occurs in Base64_Encode or if
+ *       the VMX stops accepting the log RPCs, after reporting the offset
+ *       to resume the transfer from.
  *       Output is added to the vmx log file.
  *
  *--------------------------------------------------------------------------
  */
 
 static void
-xmitFile(char *filename) //IN : file to be transmitted.
+xmitFile(char *filename, //IN : file to be transmitted.
+         uint64 offset)  //IN : offset to start the transfer at.
 {
    FILE *fp;
+   RpcOut *out;
    size_t readLen;
-   char buf[BUF_BASE64_SIZE];
+   uint8 *buf;
+   Bool started = FALSE;
+   Bool success = TRUE;
 
    /*
     * We have a unique identifier saying that this is guest dumping the
@@ -121,19 +222,63 @@ xmitFile(char *filename) //IN : file to be transmitted.
       exit(-1);
    }
 
+   if (offset > 0 && !xferSeek(fp, offset)) {
+      Warning("Unable to seek file %s to offset %"FMT64"u with errno %d\n",
+              filename, offset, errno);
+      exit(-1);
+   }
+
+   out = RpcOut_Construct();
+   buf = malloc(BUF_READ_SIZE);
+   if (out == NULL || buf == NULL) {
+      Warning("Out of memory\n");
+      exit(-1);
+   }
+
    //XXX the format below is hardcoded and used by extractFile
-   RpcVMX_Log("%s: %s: ver - %d", LOG_START_MARK, filename, LOG_VERSION);
-   while ((readLen = fread(buf, 1, sizeof buf, fp)) > 0 ) {
-      if (Base64_Encode(buf, readLen, base64Buf, sizeof base64B - 1, NULL)) {
-         RpcVMX_Log("%s", base64B);
-      } else {
-         Warning("Error in Base64_Encode\n");
-         goto exit;
+   if (offset > 0) {
+      success = xmitLog(out, &started,
+                        "%s: %s: ver - %d"LOG_OFFSET_MARK"%"FMT64"u",
+                        LOG_START_MARK, filename, LOG_VERSION, offset);
+   } else {
+      success = xmitLog(out, &started, "%s: %s: ver - %d", LOG_START_MARK,
+                        filename, LOG_VERSION);
+   }
+
+   while (success && (readLen = fread(buf, 1, BUF_READ_SIZE, fp)) > 0) {
+      size_t pos;
+
+      for (pos = 0; pos < readLen; pos += BUF_BASE64_SIZE) {
+         size_t len = MIN(BUF_BASE64_SIZE, readLen - pos);
+
+         if (!Base64_Encode(buf + pos, len, base64Buf, sizeof base64B - 1,
+                            NULL)) {
+            Warning("Error in Base64_Encode\n");
+            goto exit;
+         }
+         if (!xmitLog(out, &started, "%s", base64B)) {
+            success = FALSE;
+            break;
+         }
+         offset += len;
       }
    }
+
 exit:
-   RpcVMX_Log(LOG_END_MARK);
+   if (success) {
+      xmitLog(out, &started, LOG_END_MARK);
+   }
+   RpcOut_stop(out);
+   RpcOut_Destruct(out);
+   free(buf);
    fclose(fp);
+
+   if (!success) {
+      Warning("Transfer of %s interrupted at offset %"FMT64"u, run "
+              "\"xferlogs enc %s %"FMT64"u\" to resume it.\n",
+              filename, offset, filename, offset);
+      exit(-1);
+   }
 }
 
 
@@ -144,7 +289,8 @@ exit:
  *
  *       This function iterates through the vmx log file and for every
  *       line which has a "Guest: >" writes the unencoded base64 output to
- *       a file, depending on the state machine.
+ *       a file, depending on the state machine. A transfer resumed at the
+ *       size of the previous output of the same file is appended to it.
  *
  * Results:
  *       None
@@ -164,6 +310,9 @@ extractFile(char *filename) //IN: vmx log filename e.g. vmware.log
    uint8 base64Out[BUF_OUT_SIZE];
    size_t lenOut;
    char fname[256];
+   char lastFname[256] = "";
+   char lastInpFilename[BUF_OUT_SIZE] = "";
+   uint64 outSize = 0; // bytes in lastFname
    char *ptrStr, *logInpFilename, *ver;
    int version;
    int filenu = 0; // output file enumerator
@@ -251,9 +400,40 @@ extractFile(char *filename) //IN: vmx log filename e.g. vmware.log
                   Warning("Input version %d doesn't match the\
                           version of this binary %d", version, LOG_VERSION);
                } else {
-                  printf("Reading file %s to %s \n", logInpFilename, fname);
-                  if (!(outfp = fopen(fname, "wb"))) {
+                  uint64 offset = 0;
+
+                  ptrStr = strstr(ver, LOG_OFFSET_MARK);
+                  if (ptrStr != NULL) {
+                     offset = strtoull(ptrStr + sizeof LOG_OFFSET_MARK - 1,
+                                       NULL, 10);
+                  }
+
+                  if (offset > 0 && offset == outSize &&
+                      strcmp(logInpFilename, lastInpFilename) == 0) {
+                     printf("Resuming file %s at offset %"FMT64"u to %s \n",
+                            logInpFilename, offset, lastFname);
+                     Str_Strcpy(fname, lastFname, sizeof fname);
+                     outfp = fopen(fname, "ab");
+                  } else {
+                     if (offset > 0) {
+                        Warning("No interrupted transfer of %s ending at "
+                                "offset %"FMT64"u, its data is written "
+                                "without the beginning\n", logInpFilename,
+                                offset);
+                     }
+                     printf("Reading file %s to %s \n", logInpFilename, fname);
+                     outfp = fopen(fname, "wb");
+                     offset = 0;
+                  }
+
+                  if (outfp == NULL) {
                      Warning("Error opening file %s\n", fname);
+                     lastInpFilename[0] = '\0';
+                  } else {
+                     Str_Strcpy(lastFname, fname, sizeof lastFname);
+                     Str_Strcpy(lastInpFilename, logInpFilename,
+                                sizeof lastInpFilename);
+                     outSize = offset;
                   }
                }
             }
@@ -280,6 +460,7 @@ extractFile(char *filename) //IN: vmx log filename e.g. vmware.log
                   if (fwrite(base64Out, 1, lenOut, outfp) != lenOut) {
                      Warning("Error writing output\n");
                   }
+                  outSize += lenOut;
                } else {
                   Warning("Error decoding output %s\n", ptrStr);
                }
@@ -305,10 +486,11 @@ extractFile(char *filename) //IN: vmx log filename e.g. vmware.log
 static void
 usage(void)
 {
-   Warning("xferlogs <options> <filename>\n");
+   Warning("xferlogs <options> <filename> [<offset>]\n");
    Warning("options:\n");
    Warning("\t-h | --help - prints this usage.\n");
-   Warning("\tenc - encodes and transfers <filename> to the VMX log.\n");
+   Warning("\tenc - encodes and transfers <filename> to the VMX log,\n"
+           "\t      from byte <offset> to resume an interrupted transfer.\n");
    Warning("\tdec - extracts encoded data to <filename> from the VMX log.\n");
 }
 
@@ -330,13 +512,19 @@ main(int argc,
       return 0;
    }
 
-   if (argc != 3) {
+   if (argc != 3 && !(argc == 4 && !strncmp(argv[1], "enc", 3))) {
       usage();
       return -1;
    }
 
    if (!strncmp(argv[1], "enc", 3)) {
-      xmitFile(argv[2]);
+      uint64 offset = 0;
+
+      if (argc == 4 && !StrUtil_StrToUint64(&offset, argv[3])) {
+         usage();
+         return -1;
+      }
+      xmitFile(argv[2], offset);
    } else if (!strncmp(argv[1], "dec", 3)) {
       extractFile(argv[2]);
    } else if (!strncmp(argv[1], "upd", 3)) {